@@ -0,0 +1,381 @@
+/*******************************************************************************
+ *
+ * bench_catalog - latency benchmark of hot pg_backup_ctl++ catalog operations
+ *
+ * Creates a scratch catalog database from the catalog schema and runs
+ * the catalog operations workers and streamers issue over and over again,
+ * once with the prepared statement cache of BackupCatalog and once with
+ * the cache dropped before every call, which is what every call cost
+ * before statements were cached. Every run is reported as a JSON object
+ * on a single line (or a CSV row with --format=csv).
+ *
+ * Operations:
+ *
+ * update_stream   - update the XLOG position of a stream (walstreamer)
+ * get_proc        - look up the launcher process (every worker)
+ * register_backup - insert a basebackup with a tablespace and
+ *                   finalize it (basebackup workers)
+ * list_backups    - fetch a basebackup from a BaseBackupCursor, the
+ *                   archive holds --backups basebackups (LIST BASEBACKUPS,
+ *                   retention, restore planning)
+ *
+ ******************************************************************************/
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <popt.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <common.hxx>
+#include <BackupCatalog.hxx>
+#include <fs-archive.hxx>
+
+using namespace pgbckctl;
+
+/*
+ * Parameters and results of a single run.
+ */
+typedef struct bench_result {
+
+  std::string operation;
+  bool cached = true;
+  bool autocommit = false;
+  unsigned int run = 0;
+
+  unsigned long calls = 0;
+  double seconds = 0.0;
+
+  unsigned long long cache_hits = 0;
+  unsigned long long cache_misses = 0;
+
+} BenchResult;
+
+/*
+ * Creates a new catalog database from the specified schema file.
+ */
+static void make_catalog(path catalog, path schema) {
+
+  std::ifstream in(schema.string());
+  std::stringstream sql;
+  sqlite3 *db = NULL;
+  char *errmsg = NULL;
+
+  if (!in.is_open())
+    throw CPGBackupCtlFailure("cannot read catalog schema \"" + schema.string() + "\"");
+
+  sql << in.rdbuf();
+
+  boost::filesystem::remove(catalog);
+
+  if (sqlite3_open(catalog.string().c_str(), &db) != SQLITE_OK) {
+    std::string err = sqlite3_errmsg(db);
+    sqlite3_close(db);
+    throw CPGBackupCtlFailure("cannot create catalog \"" + catalog.string() + "\": " + err);
+  }
+
+  if (sqlite3_exec(db, sql.str().c_str(), NULL, NULL, &errmsg) != SQLITE_OK) {
+    std::string err = (errmsg != NULL) ? errmsg : "unknown error";
+    sqlite3_free(errmsg);
+    sqlite3_close(db);
+    throw CPGBackupCtlFailure("cannot create catalog schema: " + err);
+  }
+
+  sqlite3_close(db);
+
+}
+
+/*
+ * Registers a finalized basebackup with a single tablespace.
+ */
+static void register_backup(std::shared_ptr<BackupCatalog> catalog,
+                            int archive_id,
+                            int profile_id) {
+
+  /* basebackups registered so far, makes fsentry unique */
+  static unsigned long i = 0;
+
+  std::shared_ptr<BaseBackupDescr> backup = std::make_shared<BaseBackupDescr>();
+  std::shared_ptr<BackupTablespaceDescr> tblspc = std::make_shared<BackupTablespaceDescr>();
+
+  backup->archive_id = archive_id;
+  backup->xlogpos = "0/" + CPGBackupCtlBase::intToStr(i) + "000000";
+  backup->timeline = 1;
+  backup->label = "bench";
+  backup->fsentry = "/tmp/bench/backup" + CPGBackupCtlBase::intToStr(i);
+  backup->started = "2024-01-01 10:00:00";
+  backup->systemid = "6000000000000000001";
+  backup->wal_segment_size = 16777216;
+  backup->used_profile = profile_id;
+  backup->pg_version_num = 160000;
+
+  catalog->registerBasebackup(archive_id, backup);
+
+  tblspc->backup_id = backup->id;
+  tblspc->spcoid = 0;
+  tblspc->spclocation = "";
+  tblspc->spcsize = 1024;
+
+  catalog->registerTablespaceForBackup(tblspc);
+
+  backup->xlogposend = "0/" + CPGBackupCtlBase::intToStr(i) + "800000";
+  catalog->finalizeBasebackup(backup);
+
+  i++;
+
+}
+
+static BenchResult run_operation(std::shared_ptr<BackupCatalog> catalog,
+                                 BenchResult params,
+                                 int archive_id,
+                                 int profile_id,
+                                 StreamIdentification &ident) {
+
+  std::vector<int> statusCols = { SQL_STREAM_XLOGPOS_ATTNO, SQL_STREAM_STATUS_ATTNO };
+  unsigned long long hits = catalog->statementCacheHits();
+  unsigned long long misses = catalog->statementCacheMisses();
+  std::shared_ptr<BaseBackupCursor> cursor = nullptr;
+  std::shared_ptr<BaseBackupDescr> bbdescr = nullptr;
+  BaseBackupListFilter filter;
+
+  filter.archive_id = archive_id;
+
+  catalog->clearStatementCache();
+
+  if (!params.autocommit)
+    catalog->startTransaction();
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (unsigned long i = 0; i < params.calls; i++) {
+
+    if (!params.cached)
+      catalog->clearStatementCache();
+
+    if (params.operation == "update_stream") {
+
+      ident.xlogpos = "0/" + CPGBackupCtlBase::intToStr(i);
+      ident.status = StreamIdentification::STREAM_PROGRESS_STREAMING;
+      catalog->updateStream(ident.id, statusCols, ident);
+
+    } else if (params.operation == "register_backup") {
+
+      register_backup(catalog, archive_id, profile_id);
+
+    } else if (params.operation == "list_backups") {
+
+      /* Start over if all basebackups were listed */
+      if (cursor == nullptr || !cursor->next(bbdescr)) {
+        cursor = catalog->openBackupCursor(filter);
+        cursor->next(bbdescr);
+      }
+
+    } else {
+
+      catalog->getProc(archive_id, "launcher");
+
+    }
+
+  }
+
+  params.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if (cursor != nullptr)
+    cursor->close();
+
+  if (!params.autocommit)
+    catalog->commitTransaction();
+
+  params.cache_hits = catalog->statementCacheHits() - hits;
+  params.cache_misses = catalog->statementCacheMisses() - misses;
+
+  return params;
+
+}
+
+static void print_result(BenchResult const &r, bool csv) {
+
+  double us_per_call = (r.calls > 0) ? r.seconds * 1e6 / r.calls : 0.0;
+  double calls_per_sec = (r.seconds > 0) ? r.calls / r.seconds : 0.0;
+
+  if (csv) {
+
+    std::cout << r.operation << "," << (r.cached ? 1 : 0) << ","
+              << (r.autocommit ? 1 : 0) << "," << r.run << ","
+              << r.calls << "," << r.seconds << ","
+              << us_per_call << "," << calls_per_sec << ","
+              << r.cache_hits << "," << r.cache_misses << std::endl;
+
+  } else {
+
+    std::cout << "{\"operation\":\"" << r.operation << "\""
+              << ",\"cached\":" << (r.cached ? "true" : "false")
+              << ",\"autocommit\":" << (r.autocommit ? "true" : "false")
+              << ",\"run\":" << r.run
+              << ",\"calls\":" << r.calls
+              << ",\"seconds\":" << r.seconds
+              << ",\"us_per_call\":" << us_per_call
+              << ",\"calls_per_sec\":" << calls_per_sec
+              << ",\"cache_hits\":" << r.cache_hits
+              << ",\"cache_misses\":" << r.cache_misses
+              << "}" << std::endl;
+
+  }
+
+}
+
+int main(int argc, const char **argv) {
+
+  char *directory = NULL;
+  char *schema = (char *) "src/sql/catalog.sql";
+  char *operations = (char *) "update_stream,get_proc,register_backup,list_backups";
+  char *format = (char *) "json";
+  int calls = 100000;
+  int backups = 1000;
+  int repeat = 1;
+  int autocommit = 0;
+  int rc;
+
+  poptOption options[] = {
+
+    { "directory", 'D', POPT_ARG_STRING,
+      &directory, 0, "directory for the scratch catalog (default: temp directory)" },
+    { "schema", 'S', POPT_ARG_STRING,
+      &schema, 0, "catalog schema file (default: src/sql/catalog.sql)" },
+    { "operations", 'o', POPT_ARG_STRING,
+      &operations, 0, "catalog operations to run: update_stream, get_proc, register_backup, list_backups" },
+    { "backups", 'b', POPT_ARG_INT,
+      &backups, 0, "number of basebackups in the archive listed by list_backups" },
+    { "calls", 'n', POPT_ARG_INT,
+      &calls, 0, "number of calls per run" },
+    { "autocommit", 0, POPT_ARG_NONE,
+      &autocommit, 0, "commit every call, instead of running all calls in one transaction" },
+    { "repeat", 'r', POPT_ARG_INT,
+      &repeat, 0, "number of runs per operation" },
+    { "format", 'f', POPT_ARG_STRING,
+      &format, 0, "output format: json (one object per line) or csv" },
+
+    POPT_AUTOHELP { NULL, 0, 0, NULL, 0 }
+  };
+
+  poptContext context = poptGetContext(argv[0], argc, argv, options, 0);
+
+  rc = poptGetNextOpt(context);
+
+  if (rc < -1) {
+    std::cerr << poptBadOption(context, POPT_BADOPTION_NOALIAS)
+              << ": " << poptStrerror(rc) << std::endl;
+    poptFreeContext(context);
+    return 1;
+  }
+
+  boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+
+  try {
+
+    path basedir = (directory != NULL) ? path(directory) : BackupDirectory::system_temp_directory();
+    path catalogfile = basedir / "_bench_catalog.sqlite";
+    std::shared_ptr<BackupCatalog> catalog = nullptr;
+    std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+    std::vector<std::string> operation_list;
+    std::istringstream iss(operations);
+    std::string name;
+    std::shared_ptr<BackupProfileDescr> profile = nullptr;
+    StreamIdentification ident;
+    bool csv = (std::string(format) == "csv");
+
+    if (!csv && std::string(format) != "json")
+      throw CPGBackupCtlFailure("invalid output format \"" + std::string(format) + "\"");
+
+    if (calls <= 0)
+      throw CPGBackupCtlFailure("number of calls must be greater than 0");
+
+    if (backups <= 0)
+      throw CPGBackupCtlFailure("number of basebackups must be greater than 0");
+
+    while (std::getline(iss, name, ',')) {
+
+      if (name != "update_stream" && name != "get_proc"
+          && name != "register_backup" && name != "list_backups")
+        throw CPGBackupCtlFailure("invalid operation \"" + name + "\"");
+
+      operation_list.push_back(name);
+
+    }
+
+    make_catalog(catalogfile, path(schema));
+    catalog = std::make_shared<BackupCatalog>(catalogfile.string());
+
+    /* An archive with a registered stream to work on */
+    desc->archive_name = "bench";
+    desc->directory = basedir.string();
+    desc->compression = false;
+    desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+    catalog->startTransaction();
+    catalog->createArchive(desc);
+    desc = catalog->existsByName("bench");
+
+    ident.systemid = "6000000000000000001";
+    ident.timeline = 1;
+    ident.xlogpos  = "0/0";
+    ident.dbname   = "";
+    catalog->registerStream(desc->id, "walstreamer", ident);
+
+    /* Basebackups to list, register_backup adds more */
+    profile = catalog->getBackupProfile("default");
+
+    for (int i = 0; i < backups; i++)
+      register_backup(catalog, desc->id, profile->profile_id);
+
+    catalog->commitTransaction();
+
+    if (csv) {
+      std::cout << "operation,cached,autocommit,run,calls,seconds,us_per_call,"
+                << "calls_per_sec,cache_hits,cache_misses" << std::endl;
+    }
+
+    for (auto &operation : operation_list) {
+      for (int cached = 0; cached <= 1; cached++) {
+        for (int run = 1; run <= repeat; run++) {
+
+          BenchResult params;
+
+          params.operation = operation;
+          params.cached = (cached == 1);
+          params.autocommit = (autocommit != 0);
+          params.run = run;
+          params.calls = calls;
+
+          print_result(run_operation(catalog, params, desc->id,
+                                     profile->profile_id, ident), csv);
+
+        }
+      }
+    }
+
+    catalog->close();
+    boost::filesystem::remove(catalogfile);
+    boost::filesystem::remove(path(catalogfile.string() + "-wal"));
+    boost::filesystem::remove(path(catalogfile.string() + "-shm"));
+
+  } catch (std::exception &e) {
+
+    std::cerr << "error: " << e.what() << std::endl;
+    poptFreeContext(context);
+    return 1;
+
+  }
+
+  poptFreeContext(context);
+  return 0;
+
+}
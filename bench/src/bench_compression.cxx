@@ -0,0 +1,353 @@
+/*******************************************************************************
+ *
+ * bench_compression - benchmark of the compressed archive files of
+ *                     pg_backup_ctl++
+ *
+ * Writes a WAL segment sized file per compression method through the
+ * BackupFile returned by BackupDirectory::walfile(), the same handles
+ * the WAL streamer and restore-wal use, and reads it back. Reports
+ * write and read throughput and the achieved compression ratio.
+ *
+ * The data written is either WAL-like and compressible (pattern) or
+ * random and incompressible (random).
+ *
+ * Every run is reported as a JSON object on a single line (or a CSV
+ * row with --format=csv).
+ *
+ ******************************************************************************/
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <popt.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <common.hxx>
+#include <fs-archive.hxx>
+
+using namespace pgbckctl;
+
+/*
+ * Parameters and results of a single run.
+ */
+typedef struct bench_result {
+
+  std::string compression = "none";
+  std::string data = "pattern";
+  int level = 0;
+  size_t file_size = 0;
+  size_t block_size = 0;
+  unsigned int run = 0;
+
+  unsigned long long compressed_size = 0;
+  double write_seconds = 0.0;
+  double read_seconds = 0.0;
+
+} BenchResult;
+
+/*
+ * Fills the buffer with the data to compress.
+ */
+static void make_data(std::vector<char> &buffer, std::string data) {
+
+  if (data == "random") {
+
+    std::mt19937 generator(42);
+
+    for (size_t i = 0; i < buffer.size(); i++)
+      buffer[i] = (char) (generator() & 0xff);
+
+  } else {
+
+    /* record-like patterns with a counter in between, like bench_wal */
+    for (size_t i = 0; i < buffer.size(); i++)
+      buffer[i] = (char) ((i % 64 < 8) ? (i / 64) : (i % 251));
+
+  }
+
+}
+
+static BenchResult run_compression(std::shared_ptr<BackupDirectory> archiveDir,
+                                   std::vector<char> const &data,
+                                   BenchResult params) {
+
+  std::shared_ptr<BackupFile> file
+    = archiveDir->walfile("000000010000000000000001",
+                          BackupProfileDescr::compressionType(params.compression),
+                          params.level);
+  std::vector<char> buffer(params.block_size);
+  size_t pos = 0;
+  size_t bytes_read = 0;
+
+  file->setOpenMode("wb");
+
+  auto start = std::chrono::steady_clock::now();
+
+  file->open();
+
+  while (pos < params.file_size) {
+
+    size_t len = std::min(params.block_size, params.file_size - pos);
+
+    file->write(data.data() + (pos % data.size()), len);
+    pos += len;
+
+  }
+
+  file->fsync();
+  file->close();
+
+  params.write_seconds
+    = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  params.compressed_size = boost::filesystem::file_size(file->getFilePath());
+
+  file->setOpenMode("rb");
+
+  start = std::chrono::steady_clock::now();
+
+  file->open();
+
+  /*
+   * ArchiveFile::read() returns the number of blocks read rather
+   * than bytes, so read exactly what was written and check the
+   * file position afterwards.
+   */
+  while (bytes_read < params.file_size) {
+
+    size_t len = std::min(params.block_size, params.file_size - bytes_read);
+
+    if (file->read(buffer.data(), len) == 0)
+      break;
+
+    bytes_read += len;
+
+  }
+
+  bytes_read = file->current_position();
+  file->close();
+
+  params.read_seconds
+    = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if (bytes_read != params.file_size)
+    throw CArchiveIssue("read " + std::to_string(bytes_read) + " bytes from "
+                        + file->getFilePath() + ", expected "
+                        + std::to_string(params.file_size));
+
+  boost::filesystem::remove(file->getFilePath());
+
+  return params;
+
+}
+
+/*
+ * Compression methods compiled in, used when --compression
+ * isn't specified.
+ */
+static std::string default_compression() {
+
+  std::string result = "none";
+
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+  result += ",gzip";
+#endif
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+  result += ",zstd";
+#endif
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+  result += ",lz4";
+#endif
+#ifdef PG_BACKUP_CTL_HAS_LIBLZMA
+  result += ",xz";
+#endif
+
+  return result;
+
+}
+
+static void print_result(BenchResult const &r, bool csv) {
+
+  double mb = r.file_size / (1024.0 * 1024.0);
+  double write_mb_per_sec = (r.write_seconds > 0) ? mb / r.write_seconds : 0.0;
+  double read_mb_per_sec = (r.read_seconds > 0) ? mb / r.read_seconds : 0.0;
+  double ratio = (r.compressed_size > 0) ? (double) r.file_size / r.compressed_size : 0.0;
+
+  if (csv) {
+
+    std::cout << r.compression << "," << r.level << "," << r.data << ","
+              << r.file_size << "," << r.block_size << "," << r.run << ","
+              << r.compressed_size << "," << ratio << ","
+              << r.write_seconds << "," << write_mb_per_sec << ","
+              << r.read_seconds << "," << read_mb_per_sec << std::endl;
+
+  } else {
+
+    std::cout << "{\"benchmark\":\"compression\""
+              << ",\"compression\":\"" << r.compression << "\""
+              << ",\"level\":" << r.level
+              << ",\"data\":\"" << r.data << "\""
+              << ",\"file_size\":" << r.file_size
+              << ",\"block_size\":" << r.block_size
+              << ",\"run\":" << r.run
+              << ",\"compressed_size\":" << r.compressed_size
+              << ",\"ratio\":" << ratio
+              << ",\"write_seconds\":" << r.write_seconds
+              << ",\"write_mb_per_sec\":" << write_mb_per_sec
+              << ",\"read_seconds\":" << r.read_seconds
+              << ",\"read_mb_per_sec\":" << read_mb_per_sec
+              << "}" << std::endl;
+
+  }
+
+}
+
+int main(int argc, const char **argv) {
+
+  char *directory = NULL;
+  char *compression = NULL;
+  char *data = (char *) "pattern,random";
+  char *format = (char *) "json";
+  int file_size_mb = 16;
+  int block_size = 8192;
+  int level = 0;
+  int repeat = 1;
+  int rc;
+
+  poptOption options[] = {
+
+    { "directory", 'D', POPT_ARG_STRING,
+      &directory, 0, "directory for the scratch archive (default: temp directory)" },
+    { "compression", 'c', POPT_ARG_STRING,
+      &compression, 0, "compression methods to benchmark (default: all compiled in)" },
+    { "level", 'l', POPT_ARG_INT,
+      &level, 0, "compression level, 0 uses the default of each method" },
+    { "data", 'd', POPT_ARG_STRING,
+      &data, 0, "data to compress: pattern and/or random" },
+    { "file-size", 's', POPT_ARG_INT,
+      &file_size_mb, 0, "size of the file written in MB" },
+    { "block-size", 'b', POPT_ARG_INT,
+      &block_size, 0, "size of the blocks written and read" },
+    { "repeat", 'r', POPT_ARG_INT,
+      &repeat, 0, "number of runs per compression method" },
+    { "format", 'f', POPT_ARG_STRING,
+      &format, 0, "output format: json (one object per line) or csv" },
+
+    POPT_AUTOHELP { NULL, 0, 0, NULL, 0 }
+  };
+
+  poptContext context = poptGetContext(argv[0], argc, argv, options, 0);
+
+  rc = poptGetNextOpt(context);
+
+  if (rc < -1) {
+    std::cerr << poptBadOption(context, POPT_BADOPTION_NOALIAS)
+              << ": " << poptStrerror(rc) << std::endl;
+    poptFreeContext(context);
+    return 1;
+  }
+
+  boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+
+  try {
+
+    path basedir = (directory != NULL) ? path(directory) : BackupDirectory::system_temp_directory();
+    path archivePath = basedir / "_bench_compression_archive";
+    std::shared_ptr<BackupDirectory> archiveDir = nullptr;
+    std::vector<std::string> compression_list;
+    std::vector<std::string> data_list;
+    std::string name;
+    bool csv = (std::string(format) == "csv");
+
+    if (!csv && std::string(format) != "json")
+      throw CPGBackupCtlFailure("invalid output format \"" + std::string(format) + "\"");
+
+    if (file_size_mb <= 0 || block_size <= 0 || repeat <= 0 || level < 0)
+      throw CPGBackupCtlFailure("file size, block size and repeat must be greater than 0");
+
+    {
+      std::istringstream iss((compression != NULL) ? std::string(compression)
+                             : default_compression());
+
+      while (std::getline(iss, name, ',')) {
+
+        /* throws on unknown methods */
+        BackupProfileDescr::compressionType(name);
+        compression_list.push_back(name);
+
+      }
+    }
+
+    {
+      std::istringstream iss(data);
+
+      while (std::getline(iss, name, ',')) {
+
+        if (name != "pattern" && name != "random")
+          throw CPGBackupCtlFailure("invalid data \"" + name + "\"");
+
+        data_list.push_back(name);
+
+      }
+    }
+
+    if (boost::filesystem::exists(archivePath))
+      boost::filesystem::remove_all(archivePath);
+
+    boost::filesystem::create_directories(archivePath);
+    archiveDir = std::make_shared<BackupDirectory>(archivePath);
+    archiveDir->create();
+
+    if (csv) {
+      std::cout << "compression,level,data,file_size,block_size,run,"
+                << "compressed_size,ratio,write_seconds,write_mb_per_sec,"
+                << "read_seconds,read_mb_per_sec" << std::endl;
+    }
+
+    for (auto &kind : data_list) {
+
+      /* 1MB of source data, written over and over */
+      std::vector<char> buffer(1024 * 1024);
+
+      make_data(buffer, kind);
+
+      for (auto &method : compression_list) {
+        for (int run = 1; run <= repeat; run++) {
+
+          BenchResult params;
+
+          params.compression = method;
+          params.level = level;
+          params.data = kind;
+          params.file_size = (size_t) file_size_mb * 1024 * 1024;
+          params.block_size = block_size;
+          params.run = run;
+
+          print_result(run_compression(archiveDir, buffer, params), csv);
+
+        }
+      }
+
+    }
+
+    boost::filesystem::remove_all(archivePath);
+
+  } catch (std::exception &e) {
+
+    std::cerr << "error: " << e.what() << std::endl;
+    poptFreeContext(context);
+    return 1;
+
+  }
+
+  poptFreeContext(context);
+  return 0;
+
+}
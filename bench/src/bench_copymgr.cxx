@@ -0,0 +1,514 @@
+/*******************************************************************************
+ *
+ * bench_copymgr - throughput benchmark of the pg_backup_ctl++ copy engines
+ *
+ * Creates synthetic source trees resembling PostgreSQL data directories
+ * and copies them with the copy manager of this build, sweeping the number
+ * of copy instances, chunk size, request size and io_uring queue depth.
+ * Every run is reported as a JSON object on a single line (or a CSV
+ * row with --format=csv), so results can be consumed by scripts to pick
+ * settings per storage class and to compare releases.
+ *
+ ******************************************************************************/
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <popt.h>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+}
+
+#include <boost/filesystem.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <common.hxx>
+#include <fs-copy.hxx>
+
+using namespace pgbckctl;
+
+/*
+ * A synthetic source tree.
+ */
+typedef struct bench_profile {
+
+  std::string name;
+
+  /* small files, spread over subdirectories like base/<oid>/ */
+  unsigned int small_files = 0;
+  size_t small_size = 0;
+
+  /* large files like 1GB relation segments */
+  unsigned int large_files = 0;
+  size_t large_size = 0;
+
+} BenchProfile;
+
+/*
+ * Parameters and results of a single copy run.
+ */
+typedef struct bench_result {
+
+  std::string profile;
+  std::string engine;
+  std::string strategy;
+
+  unsigned int instances = 0;
+  size_t chunk_size = 0;
+  size_t io_size = 0;
+  unsigned int queue_depth = 0;
+  bool direct_io = false;
+  unsigned int run = 0;
+
+  unsigned long files = 0;
+  size_t bytes = 0;
+  double seconds = 0.0;
+  double cpu_seconds = 0.0;
+
+  /*
+   * Read and write requests issued by the engine, derived
+   * from the request size, since the kernel might split or
+   * merge them.
+   */
+  unsigned long requests = 0;
+  unsigned long stolen_chunks = 0;
+
+} BenchResult;
+
+/*
+ * Parses a size with an optional K, M or G suffix.
+ */
+static size_t parse_size(std::string value) {
+
+  size_t multiplier = 1;
+  char suffix;
+
+  if (value.empty())
+    throw CPGBackupCtlFailure("empty size value");
+
+  suffix = toupper(value.back());
+
+  switch (suffix) {
+  case 'K':
+    multiplier = 1024;
+    break;
+  case 'M':
+    multiplier = 1024 * 1024;
+    break;
+  case 'G':
+    multiplier = 1024 * 1024 * 1024;
+    break;
+  default:
+    break;
+  }
+
+  if (multiplier > 1)
+    value.pop_back();
+
+  try {
+    return std::stoull(value) * multiplier;
+  } catch (std::exception &e) {
+    throw CPGBackupCtlFailure("invalid size value \"" + value + "\"");
+  }
+
+}
+
+/*
+ * Parses a comma separated list of sizes.
+ */
+static std::vector<size_t> parse_list(const char *value) {
+
+  std::vector<size_t> result;
+  std::istringstream iss(value);
+  std::string item;
+
+  while (std::getline(iss, item, ','))
+    result.push_back(parse_size(item));
+
+  if (result.empty())
+    throw CPGBackupCtlFailure("empty list value");
+
+  return result;
+
+}
+
+static CopyStrategy parse_strategy(std::string value) {
+
+  if (value == "auto")
+    return COPY_STRATEGY_AUTO;
+  if (value == "reflink")
+    return COPY_STRATEGY_REFLINK;
+  if (value == "copy_range")
+    return COPY_STRATEGY_COPY_RANGE;
+  if (value == "stream")
+    return COPY_STRATEGY_STREAM;
+
+  throw CPGBackupCtlFailure("invalid copy strategy \"" + value + "\"");
+
+}
+
+static double cpu_time() {
+
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+    + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+}
+
+/*
+ * Writes a file of the specified size with non-repeating contents,
+ * so filesystems can't compress or deduplicate it.
+ */
+static void make_file(path file, size_t size, std::vector<char> &pattern) {
+
+  std::shared_ptr<ArchiveFile> fh = std::make_shared<ArchiveFile>(file);
+  size_t written = 0;
+  unsigned int round = 0;
+
+  fh->setOpenMode("wb");
+  fh->open();
+
+  while (written < size) {
+
+    size_t len = std::min(size - written, pattern.size());
+
+    pattern[0] = (char) round++;
+    fh->write(pattern.data(), len);
+    written += len;
+
+  }
+
+  fh->fsync();
+  fh->close();
+
+}
+
+static void make_tree(path source, BenchProfile const &profile) {
+
+  std::vector<char> pattern(1024 * 1024);
+  unsigned int seed = 42;
+
+  for (auto &c : pattern) {
+    seed = seed * 1103515245 + 12345;
+    c = (char) (seed >> 16);
+  }
+
+  boost::filesystem::remove_all(source);
+  boost::filesystem::create_directories(source);
+
+  /* 1000 files per directory, like a database with many relations */
+  for (unsigned int i = 0; i < profile.small_files; i++) {
+
+    path dir = source / "base" / std::to_string(16384 + i / 1000);
+
+    if (i % 1000 == 0)
+      boost::filesystem::create_directories(dir);
+
+    make_file(dir / std::to_string(i), profile.small_size, pattern);
+
+  }
+
+  if (profile.large_files > 0)
+    boost::filesystem::create_directories(source / "base" / "1");
+
+  for (unsigned int i = 0; i < profile.large_files; i++) {
+    make_file(source / "base" / "1" / ("16400." + std::to_string(i)),
+              profile.large_size, pattern);
+  }
+
+}
+
+/*
+ * Evicts the source tree from the page cache, so runs
+ * read from storage.
+ */
+static void evict_tree(path source) {
+
+  boost::filesystem::recursive_directory_iterator it(source), end;
+
+  for (; it != end; it++) {
+
+    if (!boost::filesystem::is_regular_file(it->path()))
+      continue;
+
+    int fd = ::open(it->path().string().c_str(), O_RDONLY);
+
+    if (fd < 0)
+      continue;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+
+  }
+
+}
+
+static BenchResult run_copy(path source, path target,
+                            BenchProfile const &profile,
+                            BenchResult params,
+                            CopyStrategy strategy,
+                            bool evict) {
+
+  std::shared_ptr<BackupCopyManager> copyMgr = nullptr;
+  size_t io_size;
+
+  boost::filesystem::remove_all(target);
+  boost::filesystem::create_directories(target);
+
+  if (evict)
+    evict_tree(source);
+
+  copyMgr = std::make_shared<BackupCopyManager>(std::make_shared<BackupDirectory>(source),
+                                                std::make_shared<TargetDirectory>(target));
+
+  copyMgr->setNumberOfCopyInstances(params.instances);
+  copyMgr->setChunkSize(params.chunk_size);
+  copyMgr->setIOParameters(params.io_size, params.queue_depth);
+  copyMgr->setCopyStrategy(strategy);
+  copyMgr->setDirectIO(params.direct_io);
+
+  params.engine = copyMgr->getEngineName();
+
+  double cpu_start = cpu_time();
+  auto start = std::chrono::steady_clock::now();
+
+  copyMgr->start();
+  copyMgr->wait();
+
+  params.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  params.cpu_seconds = cpu_time() - cpu_start;
+  params.stolen_chunks = copyMgr->getStolenChunks();
+
+  params.files = profile.small_files + profile.large_files;
+  params.bytes = profile.small_files * profile.small_size
+    + profile.large_files * profile.large_size;
+
+  /* a read and a write per request, at least one of each per file */
+  io_size = (params.io_size > 0) ? params.io_size : 256 * 1024;
+  params.requests = 2 * (profile.small_files * std::max<size_t>(1, (profile.small_size + io_size - 1) / io_size)
+                         + profile.large_files * std::max<size_t>(1, (profile.large_size + io_size - 1) / io_size));
+
+  return params;
+
+}
+
+static void print_result(BenchResult const &r, bool csv) {
+
+  double gbps = (r.seconds > 0) ? r.bytes / r.seconds / 1e9 : 0.0;
+  double iops = (r.seconds > 0) ? r.requests / r.seconds : 0.0;
+  double cpu_ns_per_byte = (r.bytes > 0) ? r.cpu_seconds * 1e9 / r.bytes : 0.0;
+
+  if (csv) {
+
+    std::cout << r.profile << "," << r.engine << "," << r.strategy << ","
+              << r.instances << "," << r.chunk_size << "," << r.io_size << ","
+              << r.queue_depth << "," << (r.direct_io ? 1 : 0) << "," << r.run << ","
+              << r.files << "," << r.bytes << "," << r.seconds << ","
+              << gbps << "," << iops << "," << cpu_ns_per_byte << ","
+              << r.stolen_chunks << std::endl;
+
+  } else {
+
+    std::cout << "{\"profile\":\"" << r.profile << "\""
+              << ",\"engine\":\"" << r.engine << "\""
+              << ",\"strategy\":\"" << r.strategy << "\""
+              << ",\"instances\":" << r.instances
+              << ",\"chunk_size\":" << r.chunk_size
+              << ",\"io_size\":" << r.io_size
+              << ",\"queue_depth\":" << r.queue_depth
+              << ",\"direct_io\":" << (r.direct_io ? "true" : "false")
+              << ",\"run\":" << r.run
+              << ",\"files\":" << r.files
+              << ",\"bytes\":" << r.bytes
+              << ",\"seconds\":" << r.seconds
+              << ",\"gb_per_sec\":" << gbps
+              << ",\"iops\":" << iops
+              << ",\"cpu_ns_per_byte\":" << cpu_ns_per_byte
+              << ",\"stolen_chunks\":" << r.stolen_chunks
+              << "}" << std::endl;
+
+  }
+
+}
+
+int main(int argc, const char **argv) {
+
+  char *directory = NULL;
+  char *profiles = (char *) "small,large";
+  char *instances = (char *) "1,4";
+  char *chunk_sizes = (char *) "64M";
+  char *io_sizes = (char *) "0";
+  char *queue_depths = (char *) "0";
+  char *strategy = (char *) "stream";
+  char *format = (char *) "json";
+  char *small_size = (char *) "8K";
+  char *large_size = (char *) "1G";
+  int small_files = 10000;
+  int large_files = 4;
+  int repeat = 1;
+  int direct_io = 0;
+  int cached = 0;
+  int keep = 0;
+  int rc;
+
+  poptOption options[] = {
+
+    { "directory", 'D', POPT_ARG_STRING,
+      &directory, 0, "directory for the source and target trees (default: temp directory)" },
+    { "profiles", 'p', POPT_ARG_STRING,
+      &profiles, 0, "source trees to copy: small, large and/or mixed" },
+    { "small-files", 0, POPT_ARG_INT,
+      &small_files, 0, "number of files of the small and mixed profiles" },
+    { "small-size", 0, POPT_ARG_STRING,
+      &small_size, 0, "size of small files" },
+    { "large-files", 0, POPT_ARG_INT,
+      &large_files, 0, "number of files of the large and mixed profiles" },
+    { "large-size", 0, POPT_ARG_STRING,
+      &large_size, 0, "size of large files" },
+    { "instances", 'i', POPT_ARG_STRING,
+      &instances, 0, "list of copy instances to sweep" },
+    { "chunk-sizes", 'c', POPT_ARG_STRING,
+      &chunk_sizes, 0, "list of chunk sizes to sweep" },
+    { "io-sizes", 'b', POPT_ARG_STRING,
+      &io_sizes, 0, "list of request sizes to sweep, 0 is the engine default" },
+    { "queue-depths", 'q', POPT_ARG_STRING,
+      &queue_depths, 0, "list of io_uring queue depths to sweep, 0 is the engine default" },
+    { "strategy", 's', POPT_ARG_STRING,
+      &strategy, 0, "copy strategy: auto, reflink, copy_range or stream" },
+    { "direct", 0, POPT_ARG_NONE,
+      &direct_io, 0, "copy with O_DIRECT" },
+    { "cached", 0, POPT_ARG_NONE,
+      &cached, 0, "don't evict the source tree from the page cache before each run" },
+    { "repeat", 'r', POPT_ARG_INT,
+      &repeat, 0, "number of runs per parameter set" },
+    { "format", 'f', POPT_ARG_STRING,
+      &format, 0, "output format: json (one object per line) or csv" },
+    { "keep", 0, POPT_ARG_NONE,
+      &keep, 0, "keep the source trees" },
+
+    POPT_AUTOHELP { NULL, 0, 0, NULL, 0 }
+  };
+
+  poptContext context = poptGetContext(argv[0], argc, argv, options, 0);
+
+  rc = poptGetNextOpt(context);
+
+  if (rc < -1) {
+    std::cerr << poptBadOption(context, POPT_BADOPTION_NOALIAS)
+              << ": " << poptStrerror(rc) << std::endl;
+    poptFreeContext(context);
+    return 1;
+  }
+
+  /* Only warnings and errors, the copy manager logs every file at debug level */
+  boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+
+  try {
+
+    path basedir = (directory != NULL) ? path(directory) : BackupDirectory::system_temp_directory();
+    std::vector<BenchProfile> bench_profiles;
+    std::istringstream iss(profiles);
+    std::string name;
+    bool csv = (std::string(format) == "csv");
+    CopyStrategy copy_strategy = parse_strategy(strategy);
+
+    std::vector<size_t> instance_list = parse_list(instances);
+    std::vector<size_t> chunk_list = parse_list(chunk_sizes);
+    std::vector<size_t> io_list = parse_list(io_sizes);
+    std::vector<size_t> depth_list = parse_list(queue_depths);
+
+    if (!csv && std::string(format) != "json")
+      throw CPGBackupCtlFailure("invalid output format \"" + std::string(format) + "\"");
+
+    while (std::getline(iss, name, ',')) {
+
+      BenchProfile profile;
+
+      profile.name = name;
+
+      if (name == "small" || name == "mixed") {
+        profile.small_files = small_files;
+        profile.small_size = parse_size(small_size);
+      }
+
+      if (name == "large" || name == "mixed") {
+        profile.large_files = large_files;
+        profile.large_size = parse_size(large_size);
+      }
+
+      if (name != "small" && name != "large" && name != "mixed")
+        throw CPGBackupCtlFailure("invalid profile \"" + name + "\"");
+
+      bench_profiles.push_back(profile);
+
+    }
+
+    if (csv) {
+      std::cout << "profile,engine,strategy,instances,chunk_size,io_size,queue_depth,"
+                << "direct_io,run,files,bytes,seconds,gb_per_sec,iops,cpu_ns_per_byte,"
+                << "stolen_chunks" << std::endl;
+    }
+
+    for (auto &profile : bench_profiles) {
+
+      path source = basedir / ("_bench_copymgr_" + profile.name);
+      path target = basedir / ("_bench_copymgr_" + profile.name + "_target");
+
+      make_tree(source, profile);
+
+      for (size_t inst : instance_list) {
+        for (size_t chunk : chunk_list) {
+          for (size_t io : io_list) {
+            for (size_t depth : depth_list) {
+              for (int run = 1; run <= repeat; run++) {
+
+                BenchResult params;
+
+                params.profile = profile.name;
+                params.strategy = strategy;
+                params.instances = inst;
+                params.chunk_size = chunk;
+                params.io_size = io;
+                params.queue_depth = depth;
+                params.direct_io = (direct_io != 0);
+                params.run = run;
+
+                print_result(run_copy(source, target, profile, params,
+                                      copy_strategy, (cached == 0)), csv);
+
+              }
+            }
+          }
+        }
+      }
+
+      boost::filesystem::remove_all(target);
+
+      if (!keep)
+        boost::filesystem::remove_all(source);
+
+    }
+
+  } catch (std::exception &e) {
+
+    std::cerr << "error: " << e.what() << std::endl;
+    poptFreeContext(context);
+    return 1;
+
+  }
+
+  poptFreeContext(context);
+  return 0;
+
+}
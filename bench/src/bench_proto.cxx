@@ -0,0 +1,286 @@
+/*******************************************************************************
+ *
+ * bench_proto - benchmark of the protocol message encoding of
+ *               pg_backup_ctl++
+ *
+ * Three benchmarks:
+ *
+ * buffer - Encodes DataRow messages field by field into a ProtocolBuffer
+ *          with write_byte(), write_int(), write_short() and
+ *          write_buffer().
+ *
+ * data   - Encodes a PGProtoResultSet with PGProtoResultSet::data(),
+ *          one DataRow message per call, as the replication protocol
+ *          commands do.
+ *
+ * chunk  - Encodes the same PGProtoResultSet with
+ *          PGProtoResultSet::dataChunk(), many DataRow messages per
+ *          call, as streaming commands do.
+ *
+ * Every run is reported as a JSON object on a single line (or a CSV
+ * row with --format=csv).
+ *
+ ******************************************************************************/
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <popt.h>
+
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <common.hxx>
+#include <proto-buffer.hxx>
+#include <pgsql-proto.hxx>
+
+using namespace pgbckctl;
+using namespace pgbckctl::pgprotocol;
+
+/* OID of the text datatype */
+#define BENCH_TEXTOID 25
+
+/*
+ * Parameters and results of a single run.
+ */
+typedef struct bench_result {
+
+  std::string benchmark;
+  unsigned int columns = 0;
+  unsigned int width = 0;
+  unsigned int run = 0;
+
+  unsigned long long rows = 0;
+  unsigned long long messages = 0;
+  unsigned long long bytes = 0;
+  double seconds = 0.0;
+
+} BenchResult;
+
+static BenchResult run_buffer(BenchResult params) {
+
+  std::string value(params.width, 'x');
+  int message_size = sizeof(int) + sizeof(short)
+    + params.columns * (sizeof(int) + params.width);
+  ProtocolBuffer buffer;
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (unsigned long long i = 0; i < params.rows; i++) {
+
+    buffer.allocate(message_size + 1);
+
+    buffer.write_byte('D');
+    buffer.write_int(message_size);
+    buffer.write_short(params.columns);
+
+    for (unsigned int col = 0; col < params.columns; col++) {
+
+      buffer.write_int(params.width);
+      buffer.write_buffer(value.data(), value.length());
+
+    }
+
+    params.bytes += buffer.getSize();
+    params.messages++;
+
+  }
+
+  params.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  return params;
+
+}
+
+static BenchResult run_resultset(BenchResult params) {
+
+  PGProtoResultSet set;
+  ProtocolBuffer buffer;
+  int rc;
+
+  for (unsigned int col = 0; col < params.columns; col++)
+    set.addColumn("col" + std::to_string(col), 0, col + 1, BENCH_TEXTOID, -1, -1);
+
+  for (unsigned long long i = 0; i < params.rows; i++) {
+
+    std::vector<PGProtoColumnDataDescr> row;
+
+    for (unsigned int col = 0; col < params.columns; col++) {
+
+      PGProtoColumnDataDescr value;
+
+      value.data = std::to_string(i) + std::string(params.width, 'x');
+      value.data.resize(params.width);
+      value.length = value.data.length();
+
+      row.push_back(value);
+
+    }
+
+    set.addRow(row);
+
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  /* positions the result set on the first row */
+  params.bytes += set.descriptor(buffer);
+
+  if (params.benchmark == "data") {
+
+    while ((rc = set.data(buffer)) > 0) {
+      params.bytes += rc;
+      params.messages++;
+    }
+
+  } else {
+
+    while ((rc = set.dataChunk(buffer, PGProtoResultSet::DATA_CHUNK_SIZE)) > 0) {
+      params.bytes += rc;
+      params.messages++;
+    }
+
+  }
+
+  params.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  return params;
+
+}
+
+static void print_result(BenchResult const &r, bool csv) {
+
+  double rows_per_sec = (r.seconds > 0) ? r.rows / r.seconds : 0.0;
+  double mb_per_sec = (r.seconds > 0) ? r.bytes / r.seconds / (1024.0 * 1024.0) : 0.0;
+
+  if (csv) {
+
+    std::cout << r.benchmark << "," << r.columns << "," << r.width << ","
+              << r.run << "," << r.rows << "," << r.messages << ","
+              << r.bytes << "," << r.seconds << ","
+              << rows_per_sec << "," << mb_per_sec << std::endl;
+
+  } else {
+
+    std::cout << "{\"benchmark\":\"" << r.benchmark << "\""
+              << ",\"columns\":" << r.columns
+              << ",\"width\":" << r.width
+              << ",\"run\":" << r.run
+              << ",\"rows\":" << r.rows
+              << ",\"messages\":" << r.messages
+              << ",\"bytes\":" << r.bytes
+              << ",\"seconds\":" << r.seconds
+              << ",\"rows_per_sec\":" << rows_per_sec
+              << ",\"mb_per_sec\":" << mb_per_sec
+              << "}" << std::endl;
+
+  }
+
+}
+
+int main(int argc, const char **argv) {
+
+  char *benchmarks = (char *) "buffer,data,chunk";
+  char *format = (char *) "json";
+  int rows = 100000;
+  int columns = 8;
+  int width = 16;
+  int repeat = 1;
+  int rc;
+
+  poptOption options[] = {
+
+    { "benchmarks", 'B', POPT_ARG_STRING,
+      &benchmarks, 0, "benchmarks to run: buffer, data and/or chunk" },
+    { "rows", 'n', POPT_ARG_INT,
+      &rows, 0, "number of rows encoded per run" },
+    { "columns", 'c', POPT_ARG_INT,
+      &columns, 0, "number of columns per row" },
+    { "width", 'w', POPT_ARG_INT,
+      &width, 0, "size of each column value in bytes" },
+    { "repeat", 'r', POPT_ARG_INT,
+      &repeat, 0, "number of runs per benchmark" },
+    { "format", 'f', POPT_ARG_STRING,
+      &format, 0, "output format: json (one object per line) or csv" },
+
+    POPT_AUTOHELP { NULL, 0, 0, NULL, 0 }
+  };
+
+  poptContext context = poptGetContext(argv[0], argc, argv, options, 0);
+
+  rc = poptGetNextOpt(context);
+
+  if (rc < -1) {
+    std::cerr << poptBadOption(context, POPT_BADOPTION_NOALIAS)
+              << ": " << poptStrerror(rc) << std::endl;
+    poptFreeContext(context);
+    return 1;
+  }
+
+  boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+
+  try {
+
+    std::vector<std::string> benchmark_list;
+    std::string name;
+    bool csv = (std::string(format) == "csv");
+
+    if (!csv && std::string(format) != "json")
+      throw CPGBackupCtlFailure("invalid output format \"" + std::string(format) + "\"");
+
+    if (rows <= 0 || columns <= 0 || width <= 0 || repeat <= 0)
+      throw CPGBackupCtlFailure("rows, columns, width and repeat must be greater than 0");
+
+    {
+      std::istringstream iss(benchmarks);
+
+      while (std::getline(iss, name, ',')) {
+
+        if (name != "buffer" && name != "data" && name != "chunk")
+          throw CPGBackupCtlFailure("invalid benchmark \"" + name + "\"");
+
+        benchmark_list.push_back(name);
+
+      }
+    }
+
+    if (csv) {
+      std::cout << "benchmark,columns,width,run,rows,messages,bytes,seconds,"
+                << "rows_per_sec,mb_per_sec" << std::endl;
+    }
+
+    for (auto &benchmark : benchmark_list) {
+      for (int run = 1; run <= repeat; run++) {
+
+        BenchResult params;
+
+        params.benchmark = benchmark;
+        params.columns = columns;
+        params.width = width;
+        params.rows = rows;
+        params.run = run;
+
+        if (benchmark == "buffer")
+          print_result(run_buffer(params), csv);
+        else
+          print_result(run_resultset(params), csv);
+
+      }
+    }
+
+  } catch (std::exception &e) {
+
+    std::cerr << "error: " << e.what() << std::endl;
+    poptFreeContext(context);
+    return 1;
+
+  }
+
+  poptFreeContext(context);
+  return 0;
+
+}
@@ -0,0 +1,463 @@
+/*******************************************************************************
+ *
+ * bench_wal - benchmark of the WAL archiving hot paths of pg_backup_ctl++
+ *
+ * Two benchmarks, both working on a scratch archive:
+ *
+ * write          - Feeds a synthetic XLOG stream in blocks through
+ *                  TransactionLogBackup::write(), like the WAL streamer
+ *                  does, across a number of segment boundaries. Reported
+ *                  per compression method, including the latency of the
+ *                  write() calls switching to a new segment.
+ *
+ * start_position - Calls ArchiveLogDirectory::getXlogStartPosition() on
+ *                  a log directory with many (by default 10^5) segments,
+ *                  which is what every WAL streamer start does. Measured
+ *                  with a rebuilt segment index (scan), a loaded
+ *                  index (load) and an index already in memory (cached).
+ *
+ * Every run is reported as a JSON object on a single line (or a CSV
+ * row with --format=csv).
+ *
+ ******************************************************************************/
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <popt.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <common.hxx>
+#include <backup.hxx>
+#include <fs-archive.hxx>
+#include <walindex.hxx>
+#include <xlogdefs.hxx>
+
+using namespace pgbckctl;
+
+/*
+ * Parameters and results of a single run.
+ */
+typedef struct bench_result {
+
+  std::string benchmark;
+
+  /* write */
+  std::string compression = "none";
+  size_t block_size = 0;
+  size_t segment_size = 0;
+  unsigned int run = 0;
+
+  unsigned long long calls = 0;
+  unsigned long long bytes = 0;
+  double seconds = 0.0;
+
+  /* write: segment switches and their latency */
+  unsigned long long switches = 0;
+  double switch_seconds = 0.0;
+  double max_switch_seconds = 0.0;
+
+  /* start_position */
+  std::string mode = "";
+  unsigned long long segments = 0;
+
+} BenchResult;
+
+/*
+ * Creates an empty scratch archive below the specified directory.
+ */
+static std::shared_ptr<BackupDirectory> make_archive(path basedir) {
+
+  path archivePath = basedir / "_bench_wal_archive";
+
+  if (boost::filesystem::exists(archivePath))
+    boost::filesystem::remove_all(archivePath);
+
+  boost::filesystem::create_directories(archivePath);
+
+  std::shared_ptr<BackupDirectory> archiveDir
+    = std::make_shared<BackupDirectory>(archivePath);
+  archiveDir->create();
+
+  return archiveDir;
+
+}
+
+static BenchResult run_write(path basedir,
+                             BenchResult params,
+                             unsigned int segments) {
+
+  std::shared_ptr<BackupDirectory> archiveDir = make_archive(basedir);
+  std::shared_ptr<CatalogDescr> descr = std::make_shared<CatalogDescr>();
+  std::vector<char> block(params.block_size);
+  XLogRecPtr pos = 0;
+  XLogRecPtr end = (XLogRecPtr) params.segment_size * segments;
+
+  /*
+   * Somewhat compressible, like real WAL: repeating
+   * record-like patterns with a counter in between.
+   */
+  for (size_t i = 0; i < block.size(); i++)
+    block[i] = (char) ((i % 64 < 8) ? (i / 64) : (i % 251));
+
+  descr->directory = archiveDir->getArchiveDir().string();
+
+  {
+    std::shared_ptr<TransactionLogBackup> backup
+      = std::make_shared<TransactionLogBackup>(descr);
+
+    backup->setWalSegmentSize(params.segment_size);
+    backup->setCompression(BackupProfileDescr::compressionType(params.compression));
+    backup->initialize();
+
+    auto start = std::chrono::steady_clock::now();
+
+    while (pos < end) {
+
+      XLogRecPtr flush_position = InvalidXLogRecPtr;
+      size_t len = std::min((XLogRecPtr) block.size(), end - pos);
+
+      auto call_start = std::chrono::steady_clock::now();
+
+      if (backup->write(pos, block.data(), len, flush_position, 1) == InvalidXLogRecPtr)
+        throw CArchiveIssue("write of XLOG block failed");
+
+      /* write() reports a flush position when it switched segments */
+      if (flush_position != InvalidXLogRecPtr) {
+
+        double latency
+          = std::chrono::duration<double>(std::chrono::steady_clock::now() - call_start).count();
+
+        params.switches++;
+        params.switch_seconds += latency;
+        params.max_switch_seconds = std::max(params.max_switch_seconds, latency);
+
+      }
+
+      pos += len;
+      params.calls++;
+
+    }
+
+    params.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    params.bytes = pos;
+
+    backup->finalize();
+  }
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+  return params;
+
+}
+
+/*
+ * Creates the specified number of completed segments in the log
+ * directory. The files are sparse, so this is cheap even for
+ * 10^5 16MB segments.
+ */
+static void make_segments(std::shared_ptr<ArchiveLogDirectory> logDir,
+                          unsigned long long segments,
+                          size_t segment_size) {
+
+  for (unsigned long long segno = 1; segno <= segments; segno++) {
+
+    path file = logDir->getPath()
+      / ArchiveLogDirectory::XLogFileByRecPtr((XLogRecPtr) segno * segment_size,
+                                              1, segment_size);
+
+    {
+      std::ofstream out(file.string());
+    }
+
+    boost::filesystem::resize_file(file, segment_size);
+
+  }
+
+}
+
+static BenchResult run_start_position(std::shared_ptr<BackupDirectory> archiveDir,
+                                      BenchResult params) {
+
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  unsigned int timeline = 0;
+  unsigned int segno = 0;
+  std::string position;
+
+  /* Load the index into memory once before measuring cached calls */
+  if (params.mode == "cached")
+    logDir->getXlogStartPosition(timeline, segno, params.segment_size);
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (unsigned long long i = 0; i < params.calls; i++) {
+
+    if (params.mode == "scan") {
+
+      /* a stale index forces a directory scan */
+      logDir = archiveDir->logdirectory();
+      logDir->segmentIndex(params.segment_size)->invalidate();
+
+    } else if (params.mode == "load") {
+
+      /* a new handle reads the index file, like a new process */
+      logDir = archiveDir->logdirectory();
+
+    }
+
+    position = logDir->getXlogStartPosition(timeline, segno, params.segment_size);
+
+  }
+
+  params.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if (segno != params.segments)
+    throw CArchiveIssue("unexpected start position " + position);
+
+  return params;
+
+}
+
+/*
+ * Compression methods compiled in, used when --compression
+ * isn't specified.
+ */
+static std::string default_compression() {
+
+  std::string result = "none";
+
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+  result += ",gzip";
+#endif
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+  result += ",zstd";
+#endif
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+  result += ",lz4";
+#endif
+
+  return result;
+
+}
+
+static void print_result(BenchResult const &r, bool csv) {
+
+  double us_per_call = (r.calls > 0) ? r.seconds * 1e6 / r.calls : 0.0;
+  double mb_per_sec = (r.seconds > 0) ? r.bytes / r.seconds / (1024.0 * 1024.0) : 0.0;
+  double avg_switch_us = (r.switches > 0) ? r.switch_seconds * 1e6 / r.switches : 0.0;
+
+  if (csv) {
+
+    std::cout << r.benchmark << "," << r.compression << "," << r.mode << ","
+              << r.block_size << "," << r.segment_size << "," << r.segments << ","
+              << r.run << "," << r.calls << "," << r.bytes << ","
+              << r.seconds << "," << us_per_call << "," << mb_per_sec << ","
+              << r.switches << "," << avg_switch_us << ","
+              << (r.max_switch_seconds * 1e6) << std::endl;
+
+  } else if (r.benchmark == "write") {
+
+    std::cout << "{\"benchmark\":\"" << r.benchmark << "\""
+              << ",\"compression\":\"" << r.compression << "\""
+              << ",\"block_size\":" << r.block_size
+              << ",\"segment_size\":" << r.segment_size
+              << ",\"run\":" << r.run
+              << ",\"calls\":" << r.calls
+              << ",\"bytes\":" << r.bytes
+              << ",\"seconds\":" << r.seconds
+              << ",\"us_per_call\":" << us_per_call
+              << ",\"mb_per_sec\":" << mb_per_sec
+              << ",\"switches\":" << r.switches
+              << ",\"avg_switch_us\":" << avg_switch_us
+              << ",\"max_switch_us\":" << (r.max_switch_seconds * 1e6)
+              << "}" << std::endl;
+
+  } else {
+
+    std::cout << "{\"benchmark\":\"" << r.benchmark << "\""
+              << ",\"mode\":\"" << r.mode << "\""
+              << ",\"segments\":" << r.segments
+              << ",\"segment_size\":" << r.segment_size
+              << ",\"run\":" << r.run
+              << ",\"calls\":" << r.calls
+              << ",\"seconds\":" << r.seconds
+              << ",\"us_per_call\":" << us_per_call
+              << "}" << std::endl;
+
+  }
+
+}
+
+int main(int argc, const char **argv) {
+
+  char *directory = NULL;
+  char *benchmarks = (char *) "write,start_position";
+  char *compression = NULL;
+  char *format = (char *) "json";
+  int segment_size_mb = 16;
+  int block_size = 8192;
+  int write_segments = 16;
+  int segments = 100000;
+  int calls = 100;
+  int repeat = 1;
+  int rc;
+
+  poptOption options[] = {
+
+    { "directory", 'D', POPT_ARG_STRING,
+      &directory, 0, "directory for the scratch archive (default: temp directory)" },
+    { "benchmarks", 'B', POPT_ARG_STRING,
+      &benchmarks, 0, "benchmarks to run: write and/or start_position" },
+    { "compression", 'c', POPT_ARG_STRING,
+      &compression, 0, "compression methods for write (default: all compiled in)" },
+    { "segment-size", 's', POPT_ARG_INT,
+      &segment_size_mb, 0, "WAL segment size in MB" },
+    { "block-size", 'b', POPT_ARG_INT,
+      &block_size, 0, "size of the XLOG blocks written by write" },
+    { "write-segments", 'w', POPT_ARG_INT,
+      &write_segments, 0, "number of segments written per write run" },
+    { "segments", 'S', POPT_ARG_INT,
+      &segments, 0, "number of segments in the log directory for start_position" },
+    { "calls", 'n', POPT_ARG_INT,
+      &calls, 0, "number of start_position calls per run" },
+    { "repeat", 'r', POPT_ARG_INT,
+      &repeat, 0, "number of runs per benchmark" },
+    { "format", 'f', POPT_ARG_STRING,
+      &format, 0, "output format: json (one object per line) or csv" },
+
+    POPT_AUTOHELP { NULL, 0, 0, NULL, 0 }
+  };
+
+  poptContext context = poptGetContext(argv[0], argc, argv, options, 0);
+
+  rc = poptGetNextOpt(context);
+
+  if (rc < -1) {
+    std::cerr << poptBadOption(context, POPT_BADOPTION_NOALIAS)
+              << ": " << poptStrerror(rc) << std::endl;
+    poptFreeContext(context);
+    return 1;
+  }
+
+  boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+
+  try {
+
+    path basedir = (directory != NULL) ? path(directory) : BackupDirectory::system_temp_directory();
+    size_t segment_size = (size_t) segment_size_mb * 1024 * 1024;
+    std::vector<std::string> benchmark_list;
+    std::vector<std::string> compression_list;
+    std::string name;
+    bool csv = (std::string(format) == "csv");
+
+    if (!csv && std::string(format) != "json")
+      throw CPGBackupCtlFailure("invalid output format \"" + std::string(format) + "\"");
+
+    if (block_size <= 0 || write_segments <= 0 || segments <= 0 || calls <= 0 || repeat <= 0)
+      throw CPGBackupCtlFailure("block size, segments, calls and repeat must be greater than 0");
+
+    if (segment_size_mb <= 0 || (segment_size_mb & (segment_size_mb - 1)) != 0
+        || segment_size_mb > 1024)
+      throw CPGBackupCtlFailure("invalid WAL segment size " + std::to_string(segment_size_mb) + "MB");
+
+    {
+      std::istringstream iss(benchmarks);
+
+      while (std::getline(iss, name, ',')) {
+
+        if (name != "write" && name != "start_position")
+          throw CPGBackupCtlFailure("invalid benchmark \"" + name + "\"");
+
+        benchmark_list.push_back(name);
+
+      }
+    }
+
+    {
+      std::istringstream iss((compression != NULL) ? std::string(compression)
+                             : default_compression());
+
+      while (std::getline(iss, name, ',')) {
+
+        /* throws on unknown methods */
+        BackupProfileDescr::compressionType(name);
+        compression_list.push_back(name);
+
+      }
+    }
+
+    if (csv) {
+      std::cout << "benchmark,compression,mode,block_size,segment_size,segments,"
+                << "run,calls,bytes,seconds,us_per_call,mb_per_sec,"
+                << "switches,avg_switch_us,max_switch_us" << std::endl;
+    }
+
+    for (auto &benchmark : benchmark_list) {
+
+      if (benchmark == "write") {
+
+        for (auto &method : compression_list) {
+          for (int run = 1; run <= repeat; run++) {
+
+            BenchResult params;
+
+            params.benchmark = benchmark;
+            params.compression = method;
+            params.block_size = block_size;
+            params.segment_size = segment_size;
+            params.run = run;
+
+            print_result(run_write(basedir, params, write_segments), csv);
+
+          }
+        }
+
+      } else {
+
+        std::shared_ptr<BackupDirectory> archiveDir = make_archive(basedir);
+
+        make_segments(archiveDir->logdirectory(), segments, segment_size);
+
+        for (std::string mode : { "scan", "load", "cached" }) {
+          for (int run = 1; run <= repeat; run++) {
+
+            BenchResult params;
+
+            params.benchmark = benchmark;
+            params.mode = mode;
+            params.segments = segments;
+            params.segment_size = segment_size;
+            params.run = run;
+            params.calls = (mode == "cached") ? calls * 1000 : calls;
+
+            print_result(run_start_position(archiveDir, params), csv);
+
+          }
+        }
+
+        boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+      }
+
+    }
+
+  } catch (std::exception &e) {
+
+    std::cerr << "error: " << e.what() << std::endl;
+    poptFreeContext(context);
+    return 1;
+
+  }
+
+  poptFreeContext(context);
+  return 0;
+
+}
@@ -0,0 +1,33 @@
+#
+# Submodule for CMake to find liblz4
+#
+# Sets the following variables:
+# - lz4_FOUND: liblz4 was found
+# - lz4_INCLUDE_DIRS: Include directories for liblz4
+# - lz4_LIBRARIES: Library directories for liblz4
+#
+
+find_path(lz4_INCLUDE_DIR
+  NAMES "lz4frame.h"
+  DOC "lz4 include header files")
+mark_as_advanced(lz4_INCLUDE_DIR)
+
+# find libraries
+find_library(lz4_LIBRARY "lz4"
+  DOC "lz4 compression library")
+mark_as_advanced(lz4_LIBRARY)
+
+include(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(lz4
+  FOUND_VAR lz4_FOUND
+  REQUIRED_VARS lz4_INCLUDE_DIR
+  FAIL_MESSAGE "Failed to get lz4 library")
+
+if(lz4_FOUND)
+  set(lz4_INCLUDE_DIRS "${lz4_INCLUDE_DIR}")
+  if (lz4_LIBRARY)
+    set(lz4_LIBRARIES "${lz4_LIBRARY}")
+  else()
+    unset(lz4_LIBRARIES)
+  endif()
+endif()
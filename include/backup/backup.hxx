@@ -1,6 +1,12 @@
 #ifndef __BACKUP_HXX__
 #define __BACKUP_HXX__
 
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
 #include <descr.hxx>
 #include <BackupCatalog.hxx>
 #include <fs-archive.hxx>
@@ -9,8 +15,11 @@
 namespace pgbckctl {
 
   class BackupFile;
+  class ArchiveWriterPool;
+  class ArchiveRateLimiter;
   class BackupDirectory;
   class ArchiveLogDirectory;
+  class DedupChunkStore;
 
   /*
    * Generic base class to implement backup
@@ -52,6 +61,179 @@ namespace pgbckctl {
     virtual std::string backupDirectoryString() = 0;
   };
 
+  /*
+   * Method used to sync streamed WAL data within
+   * a WAL segment file. See WALSyncPolicy for details.
+   */
+  typedef enum {
+
+                WAL_SYNC_METHOD_FSYNC,
+                WAL_SYNC_METHOD_FDATASYNC,
+                WAL_SYNC_METHOD_SYNC_FILE_RANGE
+
+  } WALSyncMethod;
+
+  /*
+   * Durability policy for streamed WAL.
+   *
+   * A WAL segment file is always synced and renamed into its final
+   * name when the segment is completed. Additionally, data within the
+   * current segment is synced as soon as sync_interval_ms milliseconds
+   * passed since the last sync or sync_threshold_bytes were written
+   * unsynced. A value of 0 disables the according trigger, so with
+   * both set to 0 WAL is synced on segment boundaries only (or, if the
+   * stream is idle, see TransactionLogBackup::sync()).
+   *
+   * WAL_SYNC_METHOD_SYNC_FILE_RANGE starts writeback of every write
+   * into the current segment file right away via sync_file_range(),
+   * so the fdatasync() done when a sync is due has little left to do.
+   * sync_file_range() alone doesn't make anything durable, the flush
+   * position is advanced by the fdatasync() only.
+   */
+  class WALSyncPolicy {
+  public:
+    unsigned int sync_interval_ms = 0;
+    size_t sync_threshold_bytes = 0;
+    WALSyncMethod method = WAL_SYNC_METHOD_FSYNC;
+
+    /**
+     * Maps the string representation (fsync, fdatasync, sync_file_range)
+     * to a WALSyncMethod. Throws a CArchiveIssue on unknown values.
+     */
+    static WALSyncMethod methodFromString(std::string method);
+  };
+
+  /**
+   * Write statistics of a TransactionLogBackup instance,
+   * see TransactionLogBackup::writeStatistics().
+   */
+  typedef struct {
+
+    uint64_t bytes_written = 0;
+    uint64_t segments_synced = 0;
+    uint64_t syncs = 0;
+    uint64_t sync_time_us = 0;
+    uint64_t sync_latency[WAL_SYNC_LATENCY_BUCKETS] = {};
+
+  } WALWriteStatistics;
+
+  /**
+   * An XLOG segment completed by a TransactionLogBackup, see
+   * TransactionLogBackup::setSegmentCallback(). size is the physical
+   * size of the segment file, start and end the XLOG range it covers.
+   */
+  typedef struct CompletedWALSegment {
+
+    std::string filename = "";
+    std::string path = "";
+    unsigned int timeline = 0;
+    XLogRecPtr start = InvalidXLogRecPtr;
+    XLogRecPtr end = InvalidXLogRecPtr;
+    unsigned long long size = 0;
+
+  } CompletedWALSegment;
+
+  /*
+   * Validation of streamed WAL, see WALPageValidator.
+   */
+  typedef enum {
+
+                WAL_VALIDATE_OFF,
+                WAL_VALIDATE_HEADERS,
+                WAL_VALIDATE_CHECKSUMS
+
+  } WALValidationMode;
+
+  /*
+   * Validates streamed XLOG data before it's written into
+   * the archive.
+   *
+   * The XLOG page header at every XLOG_BLCKSZ boundary is checked
+   * for a consistent magic number, the page address matching its
+   * position in the stream, and a timeline not beyond the streamed one
+   * and not going backwards. The long header at the start of a segment
+   * must carry the WAL segment and block size. Page headers split over
+   * several data blocks are collected first, everything in between is
+   * skipped, so the costs don't depend on the amount of WAL.
+   *
+   * With WAL_VALIDATE_CHECKSUMS, a CRC-32C over each segment is
+   * computed, too. CRC32C::update() uses the SSE 4.2 or ARMv8 CRC
+   * instructions if available.
+   *
+   * Validation failures throw a CArchiveIssue.
+   */
+  class WALPageValidator {
+  private:
+
+    WALValidationMode mode = WAL_VALIDATE_OFF;
+    uint64_t wal_segment_size = 0;
+
+    /* XLOG position of the next byte expected */
+    XLogRecPtr next_pos = InvalidXLogRecPtr;
+
+    /* Header of the current page, collected from the stream */
+    char header[SizeOfXLogLongPHD];
+
+    /* XLOG page magic of the stream, 0 if not seen yet */
+    uint16_t magic = 0;
+
+    /* Timeline of the last page header */
+    TimeLineID last_tli = 0;
+
+    /* CRC of the current segment, not finalized */
+    uint32_t crc = 0xFFFFFFFF;
+
+    uint64_t pages_validated = 0;
+
+    /**
+     * Checks the page header collected in header for the
+     * page starting at pageaddr.
+     */
+    virtual void checkPageHeader(XLogRecPtr pageaddr,
+                                 unsigned int timeline);
+
+  public:
+
+    WALPageValidator(WALValidationMode mode,
+                     uint64_t wal_segment_size);
+    virtual ~WALPageValidator();
+
+    /**
+     * Starts a new segment at the specified segment
+     * start position.
+     */
+    virtual void startSegment(XLogRecPtr segment_start);
+
+    /**
+     * Validates the specified XLOG data block, which must continue
+     * the current segment. The block must not cross a segment boundary.
+     */
+    virtual void validate(XLogRecPtr startpos,
+                          const char *buf,
+                          size_t len,
+                          unsigned int timeline);
+
+    /**
+     * Returns the finalized CRC-32C of the data validated since
+     * the last call to startSegment().
+     */
+    virtual uint32_t segmentChecksum();
+
+    virtual WALValidationMode getMode();
+
+    /**
+     * Number of page headers validated so far.
+     */
+    virtual uint64_t countPages();
+
+    /**
+     * Maps the string representation (off, headers, checksums)
+     * to a WALValidationMode. Throws a CArchiveIssue on unknown values.
+     */
+    static WALValidationMode modeFromString(std::string mode);
+
+  };
+
   /*
    * Represents a list entry of pending
    * transaction log segments in TransactionLogBackup.
@@ -100,7 +282,148 @@ namespace pgbckctl {
      * of WAL files synced into the transaction log archive during
      * the lifetime of a TransactionLogBackup instance.
      */
-    uint64_t wal_synced = 0;
+    std::atomic<uint64_t> wal_synced{0};
+
+    /*
+     * Write statistics. These are atomic, since they are read
+     * by the WAL receiver while a WALWriterPipeline thread writes.
+     */
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<uint64_t> syncs{0};
+    std::atomic<uint64_t> sync_time_us{0};
+    std::atomic<uint64_t> sync_latency[WAL_SYNC_LATENCY_BUCKETS];
+
+    /**
+     * Preallocate uncompressed WAL segment files to
+     * their full segment size before writing into them.
+     */
+    bool preallocate = false;
+
+    /**
+     * Number of spare, already preallocated WAL segment files kept
+     * in the log directory. A new segment is created by renaming a
+     * spare file into its final .partial name instead of allocating
+     * it from scratch during the segment switch.
+     */
+    unsigned int prealloc_segments = 0;
+
+    /**
+     * Write uncompressed WAL segment files without stdio
+     * buffering, see setDirectWrite().
+     */
+    bool direct_write = false;
+
+    /**
+     * Spare preallocated segment files currently available.
+     */
+    std::vector<boost::filesystem::path> spareSegments;
+
+    /**
+     * Compression level for WAL segment files.
+     */
+    int compression_level = 0;
+
+    /**
+     * Size of independently decodable frames of compressed WAL
+     * segment files in XLOG blocks, see setCompressionFrameBlocks().
+     */
+    unsigned int compression_frame_blocks = 0;
+
+    /**
+     * WAL durability policy.
+     */
+    WALSyncPolicy syncPolicy;
+
+    /**
+     * Number of bytes written into the current segment file
+     * since the last sync.
+     */
+    size_t unsynced_bytes = 0;
+
+    /**
+     * Offset in the current segment file up to which data
+     * was synced.
+     */
+    off_t synced_offset = 0;
+
+    /**
+     * Offset in the current segment file up to which writeback
+     * was started, see WAL_SYNC_METHOD_SYNC_FILE_RANGE.
+     */
+    off_t writeback_offset = 0;
+
+    /**
+     * XLOG position written into the archive so far.
+     */
+    XLogRecPtr written_position = InvalidXLogRecPtr;
+
+    /**
+     * Time of the last sync.
+     */
+    std::chrono::high_resolution_clock::time_point last_sync;
+
+    /**
+     * Validation of streamed WAL, see setValidation().
+     */
+    WALValidationMode validation = WAL_VALIDATE_OFF;
+    std::shared_ptr<WALPageValidator> validator = nullptr;
+
+    /**
+     * Set if the log directory needs a sync, e.g. because
+     * a segment file was created or renamed.
+     */
+    bool dir_sync_pending = false;
+
+    /**
+     * Returns true if the sync policy requires a sync of
+     * the current segment file.
+     */
+    virtual bool syncDue();
+
+    /**
+     * Syncs the data of the current segment file according
+     * to the configured WAL sync method.
+     */
+    virtual void syncCurrentWALFile();
+
+    /**
+     * Starts writeback of the data written into the current
+     * segment file since the last call, without making it durable.
+     */
+    virtual void startWriteback();
+
+    /**
+     * Syncs the log directory and the directories of all
+     * stacked segment files.
+     */
+    virtual void syncLogDirectory();
+
+    /**
+     * Records a new (oldname is empty) or renamed segment file
+     * in the segment index of the log directory. The index is just
+     * an optimization, so errors don't interrupt streaming: the
+     * index is invalidated instead and rebuilt on its next use.
+     */
+    virtual void updateSegmentIndex(const std::string &oldname,
+                                    const std::string &newname,
+                                    unsigned long long size);
+
+    /**
+     * Accounts a sync which started at the specified time
+     * in the write statistics.
+     */
+    virtual void countSync(std::chrono::high_resolution_clock::time_point start);
+
+    /**
+     * Called for every completed segment, see setSegmentCallback().
+     */
+    std::function<void(const CompletedWALSegment &)> segment_cb = nullptr;
+
+    /**
+     * Passes the specified, just completed segment file
+     * to the segment callback.
+     */
+    virtual void segmentCompleted(const boost::filesystem::path &segment);
 
   public:
     TransactionLogBackup(const std::shared_ptr<CatalogDescr> & descr);
@@ -162,11 +485,24 @@ namespace pgbckctl {
      * argument flush_position. If no switch has occured, flush_position
      * is set to InvalidXLogRecPtr. This can be used to check whether
      * a new segment was created during write().
+     *
+     * flush_position is also set if the WAL sync policy forced
+     * a sync of the current segment file, see WALSyncPolicy.
      */
     virtual XLogRecPtr write(XLOGDataStreamMessage *message,
                              XLogRecPtr &flush_position,
                              unsigned int timeline);
 
+    /**
+     * Same as above, but writes a raw XLOG data block starting
+     * at XLOG position startpos.
+     */
+    virtual XLogRecPtr write(XLogRecPtr startpos,
+                             const char *buf,
+                             size_t len,
+                             XLogRecPtr &flush_position,
+                             unsigned int timeline);
+
     virtual void sync_pending();
     virtual void flush_pending();
 
@@ -215,6 +551,254 @@ namespace pgbckctl {
      * instance.
      */
     virtual uint64_t countSynced();
+
+    /**
+     * Returns a snapshot of the write statistics of this
+     * instance. Safe to call while another thread writes.
+     */
+    virtual WALWriteStatistics writeStatistics();
+
+    /**
+     * Enable or disable preallocation of WAL segment files. Preallocation
+     * is only done for uncompressed WAL segments, compressed segment files
+     * don't have a known size in advance.
+     */
+    virtual void setPreallocate(bool preallocate);
+
+    /**
+     * Sets the number of spare preallocated segment files to maintain
+     * (0 disables spare segments). Only effective when preallocation
+     * is enabled, see setPreallocate().
+     */
+    virtual void setPreallocSegments(unsigned int prealloc_segments);
+
+    /**
+     * Fills up the list of spare preallocated segment files
+     * until prealloc_segments files are available. This allocates and
+     * syncs files, so call it while the stream is idle rather than
+     * on the write path. write() only consumes spare files.
+     */
+    virtual void preallocateSpareSegments();
+
+    /**
+     * Sets the compression method for WAL segment files. Only
+     * none, gzip, zstd and lz4 are supported.
+     */
+    virtual void setCompression(BackupProfileCompressType compression);
+
+    /**
+     * Compression level for WAL segment files, 0 uses the default
+     * level of the configured compression method.
+     */
+    virtual void setCompressionLevel(int level);
+
+    /**
+     * Write compressed WAL segment files as a sequence of independently
+     * decodable frames of the specified number of XLOG blocks each,
+     * followed by a frame table (see FramedArchiveFile). This allows
+     * readers to start decoding at any LSN within the segment. 0 writes
+     * a single compressed stream without a frame table.
+     */
+    virtual void setCompressionFrameBlocks(unsigned int blocks);
+
+    /**
+     * Sets the WAL durability policy.
+     */
+    virtual void setSyncPolicy(WALSyncPolicy policy);
+
+    /**
+     * Write uncompressed WAL segment files unbuffered, so XLOG data
+     * is passed from the receive buffer to the kernel without copying it
+     * into a stdio buffer first.
+     */
+    virtual void setDirectWrite(bool direct_write);
+
+    /**
+     * Validate XLOG page headers of streamed WAL before writing it,
+     * and with WAL_VALIDATE_CHECKSUMS record a CRC-32C per completed
+     * segment in the segment index. See WALPageValidator. Must be set
+     * before initialize().
+     */
+    virtual void setValidation(WALValidationMode mode);
+
+    /**
+     * Installs a callback called for every completed XLOG segment
+     * after it was renamed into its final name, e.g. to maintain archive
+     * statistics. The callback runs in the thread writing the WAL, which
+     * is the writer thread if a WALWriterPipeline is used. Exceptions
+     * thrown by the callback are logged and otherwise ignored.
+     */
+    virtual void setSegmentCallback(std::function<void(const CompletedWALSegment &)> cb);
+
+    /**
+     * Syncs pending data in the current WAL segment file, if the
+     * sync policy says so or force is set to true. Returns the XLOG
+     * position known to be durable, or InvalidXLogRecPtr in case
+     * nothing was synced.
+     */
+    virtual XLogRecPtr sync(bool force);
+  };
+
+  /*
+   * Sync requests passed to a WALWriterPipeline writer thread.
+   */
+  typedef enum {
+    WAL_WRITER_SYNC_NONE = 0,
+    WAL_WRITER_SYNC_POLICY,
+    WAL_WRITER_SYNC_FORCE
+  } WALWriterSyncRequest;
+
+  /*
+   * A single XLOG data block queued in a WALWriterPipeline.
+   * Slots are allocated once and their buffers reused, so
+   * enqueuing a block doesn't allocate memory once a slot has
+   * seen a block of the same size.
+   */
+  struct WALWriterSlot {
+
+    XLogRecPtr startpos = InvalidXLogRecPtr;
+    unsigned int timeline = 0;
+    size_t len = 0;
+    std::vector<char> data;
+
+  };
+
+  /*
+   * WALWriterPipeline decouples receiving XLOG data from the
+   * network from writing it into the archive. The receiver enqueues
+   * XLOG data blocks into a bounded ring buffer, a dedicated writer thread
+   * dequeues them and writes them via TransactionLogBackup::write().
+   *
+   * The ring is a single-producer single-consumer queue, slot indexes
+   * are published via atomics. The mutex and condition variable are
+   * only used to park the receiver when the ring is full or the writer
+   * when it's empty.
+   *
+   * The writer publishes the XLOG positions it has written and
+   * synced, so the receiver is able to report the true write and flush
+   * positions upstream. Sync requests are executed by the writer thread, too,
+   * since the TransactionLogBackup handle must not be accessed by the
+   * receiver as long as the pipeline is running.
+   *
+   * An error in the writer stops the writer thread. The error is
+   * rethrown as a CArchiveIssue into the receiver on its next call
+   * to push(), requestSync(), drain() or stop().
+   */
+  class WALWriterPipeline {
+  private:
+
+    std::shared_ptr<TransactionLogBackup> backup = nullptr;
+
+    /* Preallocated ring slots */
+    std::vector<WALWriterSlot> ring;
+
+    /* Next slot to fill, modified by the receiver only */
+    std::atomic<uint64_t> head;
+
+    /* Next slot to write, modified by the writer only */
+    std::atomic<uint64_t> tail;
+
+    /* Positions published by the writer */
+    std::atomic<XLogRecPtr> written_position;
+    std::atomic<XLogRecPtr> flushed_position;
+
+    /*
+     * Pending sync request, see requestSync(). WAL_WRITER_SYNC_NONE
+     * means there is nothing to do.
+     */
+    std::atomic<int> sync_request;
+
+    std::atomic<bool> running;
+    std::atomic<bool> failed;
+
+    /* Error message of a failed writer, protected by wait_mutex */
+    std::string error_message = "";
+
+    std::mutex wait_mutex;
+    std::condition_variable wait_cond;
+
+    std::shared_ptr<std::thread> writer = nullptr;
+
+    /*
+     * Writer thread main loop.
+     */
+    virtual void work();
+
+    /*
+     * Executes a pending sync request, called by the writer.
+     */
+    virtual void handleSyncRequest();
+
+    /*
+     * Throws a CArchiveIssue in case the writer failed.
+     */
+    virtual void checkFailed();
+
+    /*
+     * Wakes up a parked receiver or writer.
+     */
+    virtual void wakeup();
+
+  public:
+
+    WALWriterPipeline(std::shared_ptr<TransactionLogBackup> backup,
+                      unsigned int slots);
+    virtual ~WALWriterPipeline();
+
+    /**
+     * Starts the writer thread.
+     */
+    virtual void start();
+
+    /**
+     * Enqueues a XLOG data block. The data is copied into the next
+     * free ring slot, blocks as long as the ring is full.
+     */
+    virtual void push(XLogRecPtr startpos,
+                      unsigned int timeline,
+                      const char *buf,
+                      size_t len);
+
+    /**
+     * Asks the writer to sync the current WAL segment file, either
+     * forced or according to the sync policy of the backup handle.
+     * Doesn't wait for the sync to happen.
+     */
+    virtual void requestSync(bool force);
+
+    /**
+     * Waits until the writer has written all queued XLOG data blocks.
+     */
+    virtual void drain();
+
+    /**
+     * Drains the ring and stops the writer thread. Afterwards, the
+     * backup handle can be used by the caller again.
+     */
+    virtual void stop();
+
+    /**
+     * Returns true if the writer thread is running.
+     */
+    virtual bool isRunning();
+
+    /**
+     * Position up to which the writer has written XLOG data,
+     * InvalidXLogRecPtr if nothing was written so far.
+     */
+    virtual XLogRecPtr writtenPosition();
+
+    /**
+     * Position up to which written XLOG data is known to be
+     * durable, InvalidXLogRecPtr if nothing was synced so far.
+     */
+    virtual XLogRecPtr flushedPosition();
+
+    /**
+     * Number of XLOG data blocks queued but not yet written.
+     */
+    virtual size_t queued();
+
   };
 
   typedef enum {
@@ -250,6 +834,39 @@ namespace pgbckctl {
     /* Read or write operation mode */
     StreamDirectoryOperationMode mode = SB_NOT_SET;
 
+    /*
+     * Compression level and number of compression worker
+     * threads for stacked files, 0 uses the defaults.
+     */
+    int compression_level = 0;
+    int compression_workers = 0;
+
+    /*
+     * Writer pool for stacked files, nullptr if files
+     * are written by the caller directly.
+     */
+    unsigned int parallel_writers = 0;
+    std::shared_ptr<ArchiveWriterPool> writerPool = nullptr;
+
+    /*
+     * Rate limiter shared by all stacked files, nullptr
+     * if writes aren't throttled.
+     */
+    std::shared_ptr<ArchiveRateLimiter> rateLimiter = nullptr;
+
+    /*
+     * Write a member index next to each tablespace archive,
+     * see setArchiveIndex().
+     */
+    bool archiveIndex = true;
+
+    /*
+     * Store tablespace archives deduplicated in the chunk store
+     * of the archive, see setDeduplicate().
+     */
+    bool deduplicate = false;
+    std::shared_ptr<DedupChunkStore> chunkStore = nullptr;
+
     /*
      * Stack of internal allocated file handles
      * representing this instance of StreamBaseBackup.
@@ -291,6 +908,51 @@ namespace pgbckctl {
     virtual void finalize();
     virtual void setCompression(BackupProfileCompressType compression);
     virtual BackupProfileCompressType getCompression();
+
+    /**
+     * Compression level used for files stacked afterwards,
+     * 0 uses the default level of the compression method.
+     */
+    virtual void setCompressionLevel(int level);
+
+    /**
+     * Number of worker threads used to compress files stacked afterwards.
+     * 0 compresses within the streaming thread. Not all compression
+     * methods support this, see StreamingBaseBackupDirectory::basebackup().
+     */
+    virtual void setCompressionWorkers(int workers);
+
+    /**
+     * Number of writer threads stacked files are written by,
+     * must be called before initialize(). 0 makes the caller of
+     * write() on the stacked files write them directly. Stacked
+     * files are assigned to the writers round robin.
+     */
+    virtual void setParallelWriters(unsigned int writers);
+
+    /**
+     * Throttles writes into files stacked afterwards by the specified
+     * rate limiter. All stacked files share the limiter, so it limits
+     * the overall throughput of the basebackup. nullptr disables
+     * throttling.
+     */
+    virtual void setRateLimiter(std::shared_ptr<ArchiveRateLimiter> limiter);
+
+    /**
+     * Enables or disables the member index written next to each
+     * tablespace archive (see IndexedArchiveFile). The default is to
+     * write one, but it requires the stream to be an uncompressed tar
+     * stream, which isn't the case with server-side compression.
+     */
+    virtual void setArchiveIndex(bool enabled);
+
+    /**
+     * Stores tablespace archives stacked afterwards as
+     * DedupArchiveFile, their chunks compressed with the compression
+     * set by setCompression(). Deduplicated archives don't get a
+     * member index.
+     */
+    virtual void setDeduplicate(bool enabled);
     virtual void create();
     virtual std::string backupDirectoryString();
     virtual void setMode(StreamDirectoryOperationMode mode);
@@ -75,6 +75,15 @@ namespace pgbckctl {
 
     WALCleanupMode mode = NO_WAL_TO_DELETE;
 
+    /*
+     * Basebackups and WAL to move to the cold tier of the
+     * archive instead of deleting them, set by a TieringRetention
+     * rule. Its basebackups are the ones to move, its offsets
+     * select the WAL segments to move just like the offsets of
+     * this descriptor select the ones to delete.
+     */
+    std::shared_ptr<BackupCleanupDescr> migrateDescr = nullptr;
+
   };
 }
 
@@ -2,7 +2,11 @@
 #define __BACKUP_PROCESSES__
 
 /* STL headers */
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <queue>
+#include <thread>
 
 /* pg_backup_ctl++ headers */
 #include <BackupCatalog.hxx>
@@ -24,7 +28,9 @@ namespace pgbckctl {
   class StreamBaseBackup;
   class BackupFile;
   class TransactionLogBackup;
+  class WALWriterPipeline;
   class BackupCatalog;
+  class ArchiveRateLimiter;
 
   /**
    * @ref BaseBackupState State of base backup stream.
@@ -182,6 +188,36 @@ namespace pgbckctl {
      */
     std::shared_ptr<TransactionLogBackup> backupHandler = nullptr;
 
+    /**
+     * Writer pipeline, only allocated during receive() if
+     * pipeline_slots is greater than 0. See setPipelineSlots().
+     */
+    std::shared_ptr<WALWriterPipeline> pipeline = nullptr;
+
+    /**
+     * Number of ring slots for the writer pipeline, 0 writes
+     * XLOG data synchronously from the receive loop.
+     */
+    unsigned int pipeline_slots = 0;
+
+    /**
+     * Worker shared memory handle and slot to publish stream
+     * statistics into, see setStatisticsSlot().
+     */
+    std::shared_ptr<WorkerSHM> stats_shm = nullptr;
+    int stats_slot = -1;
+
+    /**
+     * Statistics not maintained by the backup handler and
+     * the archive identity published along with them.
+     */
+    shm_stream_stats stats;
+
+    /**
+     * Last time statistics were published.
+     */
+    std::chrono::high_resolution_clock::time_point last_stats_update;
+
     /**
      * Timeout for polling on WAL stream.
      *
@@ -206,9 +242,17 @@ namespace pgbckctl {
     std::chrono::high_resolution_clock::time_point last_status_update;
 
     /**
-     * Receive buffer
+     * Last time XLOG data was received by receiveAvailable(). Used
+     * to detect idle streams, see idle().
+     */
+    std::chrono::high_resolution_clock::time_point last_data_received;
+
+    /**
+     * Message objects, reused for every XLOG data and
+     * primary keepalive message received. Allocated on first use.
      */
-    MemoryBuffer receiveBuffer;
+    std::shared_ptr<XLOGDataStreamMessage> dataMessage = nullptr;
+    std::shared_ptr<PrimaryFeedbackMessage> feedbackMessage = nullptr;
 
     /**
      * Send buffer.
@@ -229,6 +273,14 @@ namespace pgbckctl {
      */
     virtual ArchiverState handleReceive(char **buffer, int *bufferlen);
 
+    /**
+     * Interprets a buffer returned by handleReceive() into one of
+     * the reused message objects. XLOG data isn't copied, the returned message
+     * references buffer directly, so it must not be used after the buffer
+     * was freed. Returns a nullptr for an empty buffer.
+     */
+    virtual XLOGStreamMessage *messageFromBuffer(const char *buffer, int bufferlen);
+
     /**
      * Internal helper method to read a timeline switch
      * message after indicated a end-of-stream condition
@@ -252,6 +304,41 @@ namespace pgbckctl {
      */
     void timeoutSelectValue(timeval *timeoutptr);
 
+    /**
+     * Syncs pending WAL data of the backup handler, if any. If force is
+     * false, data is synced only if the WAL sync policy of the
+     * handler says so. Updates the flush positions reported to
+     * upstream accordingly.
+     */
+    virtual void syncBackupHandler(bool force);
+
+    /**
+     * Updates the write and flush positions reported to upstream
+     * from the positions published by the writer pipeline.
+     */
+    virtual void updatePipelinePositions();
+
+    /**
+     * Refills the spare segment files of the backup handler while
+     * the stream is idle. With a writer pipeline, the writer thread
+     * does this itself whenever its ring is empty.
+     */
+    virtual void refillSpareSegments();
+
+    /**
+     * Sends a receiver status update to upstream, if the receiver
+     * status timeout has expired. Also publishes stream
+     * statistics, see publishStatistics().
+     */
+    virtual void statusUpdateIfDue();
+
+    /**
+     * Publishes the stream statistics into the worker shared memory
+     * slot, if assigned. Unless forced, this is done once per second at
+     * most.
+     */
+    virtual void publishStatistics(bool force);
+
   public:
 
     WALStreamerProcess(PGconn *prepared_connection,
@@ -304,6 +391,68 @@ namespace pgbckctl {
      */
     virtual bool receive();
 
+    /**
+     * The following methods split receive() into its single steps, so
+     * that callers can drive many WAL streams from a single event loop (see
+     * WALStreamMultiplexer). A caller calls beginReceive() after start(),
+     * then receiveAvailable() whenever socket() is readable and idle()
+     * periodically. As soon as one of them returns a state for which
+     * stateEndsReceive() is true, endReceive() must be called, which
+     * returns the same as receive() would have done.
+     */
+
+    /**
+     * Prepares the WAL streamer for receiving. Throws a StreamingFailure
+     * if the stream wasn't started.
+     */
+    virtual void beginReceive();
+
+    /**
+     * Handles all XLOG messages currently available on the stream
+     * without blocking, but at most max_messages (0 means no limit).
+     *
+     * Returns ARCHIVER_STREAMING_NO_DATA if all input was consumed,
+     * ARCHIVER_STREAMING if max_messages was hit and there might be
+     * more input buffered already, otherwise the state which ended
+     * receiving.
+     */
+    virtual ArchiverState receiveAvailable(unsigned int max_messages);
+
+    /**
+     * Periodic housekeeping for a stream without input: sends
+     * overdue status updates and syncs pending WAL data if the stream was idle
+     * for longer than the poll timeout. Returns the current state.
+     */
+    virtual ArchiverState idle();
+
+    /**
+     * Finishes receiving. Handles timeline switches and
+     * shutdown of the stream, see receive() for the return value.
+     */
+    virtual bool endReceive();
+
+    /**
+     * Marks the stream to be shut down. The next call to
+     * receiveAvailable() or idle() will return ARCHIVER_SHUTDOWN.
+     */
+    virtual void requestShutdown();
+
+    /**
+     * Returns the socket of the streaming connection.
+     */
+    virtual int socket();
+
+    /**
+     * Returns true if the specified state ends receiving.
+     */
+    static bool stateEndsReceive(ArchiverState state);
+
+    /**
+     * Drains and stops the writer pipeline, if running. Afterwards
+     * the backup handler is owned by the WAL streamer again.
+     */
+    virtual void stopPipeline();
+
     /**
      * Returns an identifier indicating the
      * current status of the XLOG stream.
@@ -323,6 +472,28 @@ namespace pgbckctl {
      */
     virtual void setBackupHandler(std::shared_ptr<TransactionLogBackup> backupHandler);
 
+    /**
+     * Enables writing XLOG data from a dedicated writer thread, so
+     * receiving from the network doesn't stall on disk writes and syncs.
+     * slots is the number of XLOG data messages which can be queued
+     * before the receiver blocks, 0 disables the writer thread.
+     *
+     * Only effective with a backup handler assigned, takes effect
+     * on the next call to receive().
+     */
+    virtual void setPipelineSlots(unsigned int slots);
+
+    /**
+     * Assigns the worker shared memory slot to publish
+     * live statistics of this stream into, see SHOW STREAM STATISTICS.
+     * archive_name and archive_id identify the stream there, so readers
+     * don't need to consult the catalog.
+     */
+    virtual void setStatisticsSlot(std::shared_ptr<WorkerSHM> shm,
+                                   int slot,
+                                   std::string archive_name,
+                                   int archive_id);
+
     /**
      * Returns the current encoded XLOG position, if active.
      */
@@ -365,6 +536,131 @@ namespace pgbckctl {
 
   };
 
+  /**
+   * A WAL stream driven by a WALStreamMultiplexer. Implementations
+   * own the streaming connection and the WALStreamerProcess instance and
+   * take care of everything required to (re)start the stream.
+   */
+  class MultiplexedWALStream {
+  public:
+
+    virtual ~MultiplexedWALStream() {};
+
+    /**
+     * Name of the stream, used for log messages.
+     */
+    virtual std::string streamName() = 0;
+
+    /**
+     * The WAL streamer instance of this stream.
+     */
+    virtual std::shared_ptr<WALStreamerProcess> walStreamer() = 0;
+
+    /**
+     * Starts streaming. Called by the multiplexer before it
+     * begins receiving, and again after a timeline switch.
+     */
+    virtual void startStream() = 0;
+
+    /**
+     * Called after receiving from the stream ended, can_continue
+     * is what WALStreamerProcess::endReceive() returned. Returns true if
+     * the stream should be restarted via startStream().
+     */
+    virtual bool streamEnded(bool can_continue) = 0;
+
+    /**
+     * Returns true if just this stream should be stopped.
+     */
+    virtual bool stopRequested() = 0;
+
+    /**
+     * Called if the stream failed and was removed from the
+     * multiplexer. Other streams are not affected.
+     */
+    virtual void streamFailed(std::string errmsg) = 0;
+
+  };
+
+  /**
+   * WALStreamMultiplexer drives many WAL streams from a single
+   * thread via epoll(7), instead of running a blocking receive loop
+   * per stream.
+   *
+   * Streams are served round robin with a limited number of messages
+   * per stream and round, so a busy stream can't starve the others. A stream
+   * failing doesn't affect the other streams. run() returns after all streams
+   * have ended.
+   */
+  class WALStreamMultiplexer {
+  private:
+
+    typedef struct {
+
+      std::shared_ptr<MultiplexedWALStream> stream = nullptr;
+      bool active = false;
+
+      /*
+       * Set if another receiveAvailable() call is needed, either
+       * because epoll reported input or because libpq might have
+       * buffered input left.
+       */
+      bool ready = false;
+
+    } multiplexed_stream_entry;
+
+    std::vector<multiplexed_stream_entry> entries;
+
+    int epoll_fd = -1;
+
+    unsigned int active_streams = 0;
+
+    /* Max messages handled per stream and round */
+    unsigned int max_messages = 64;
+
+    /* Max time to wait for input in milliseconds */
+    int wakeup_interval = 1000;
+
+    virtual void startEntry(unsigned int index);
+    virtual void finishEntry(unsigned int index);
+    virtual void failEntry(unsigned int index, std::string errmsg);
+    virtual void unwatch(unsigned int index);
+
+  public:
+
+    WALStreamMultiplexer();
+    virtual ~WALStreamMultiplexer();
+
+    /**
+     * Adds a stream. Not allowed while run() is active.
+     */
+    virtual void addStream(std::shared_ptr<MultiplexedWALStream> stream);
+
+    /**
+     * Max number of messages handled per stream before
+     * serving the next one, 0 means no limit.
+     */
+    virtual void setMaxMessagesPerRound(unsigned int max_messages);
+
+    /**
+     * Max time in milliseconds to wait for input before doing
+     * housekeeping on idle streams.
+     */
+    virtual void setWakeupInterval(int wakeup_interval);
+
+    /**
+     * Number of streams currently served.
+     */
+    virtual unsigned int activeStreams();
+
+    /**
+     * Starts all streams and serves them until every stream
+     * has ended or failed.
+     */
+    virtual void run();
+
+  };
+
   /**
    * @ref TablespaceQueue
    * Class TablespaceQueue holds a queue of tablespace descriptors initialized
@@ -383,6 +679,13 @@ namespace pgbckctl {
      */
     std::queue<std::shared_ptr<BackupTablespaceDescr>> tablespaces;
 
+    /**
+     * Number of tablespaces and their estimated size in bytes,
+     * as reported by the server.
+     */
+    unsigned int num_tablespaces = 0;
+    uint64_t estimated_size = 0;
+
     /**
      * Reads tablespace information from basebackup stream
      * @param current state of basebackup stream
@@ -395,6 +698,18 @@ namespace pgbckctl {
     explicit TablespaceQueue(PGconn *conn);
     ~TablespaceQueue() = default;
 
+    /**
+     * Number of tablespaces of the basebackup, valid
+     * after getTablespaceInfo().
+     */
+    virtual unsigned int getNumTablespaces();
+
+    /**
+     * Size of the basebackup in bytes estimated by the server,
+     * valid after getTablespaceInfo().
+     */
+    virtual uint64_t getEstimatedSize();
+
   };
 
   /**
@@ -405,8 +720,11 @@ namespace pgbckctl {
   class TablespaceIterator {
   private:
 
-    /** Byte counter of bytes streamed */
-    size_t _consumed = 0;
+    /**
+     * Byte counter of bytes streamed. Atomic, since a
+     * BaseBackupProgressPublisher reads it concurrently.
+     */
+    std::atomic<size_t> _consumed { 0 };
 
   protected:
 
@@ -422,7 +740,8 @@ namespace pgbckctl {
     virtual bool next(std::shared_ptr<BackupElemDescr> &next) = 0;
 
     /**
-     * Set consumed bytes
+     * Set consumed bytes. The server reports the number of bytes
+     * done for the whole basebackup so far.
      */
     virtual void setConsumed(size_t bytes_consumed);
 
@@ -616,6 +935,20 @@ namespace pgbckctl {
     virtual BaseBackupState getTablespaceInfo(BaseBackupState &state) = 0;
     virtual std::shared_ptr<BackupElemDescr> handleMessage(BaseBackupState &current_state) = 0;
 
+    /**
+     * Number of tablespaces and estimated size in bytes of the
+     * basebackup, valid after getTablespaceInfo().
+     */
+    virtual unsigned int numTablespaces() = 0;
+    virtual uint64_t estimatedSize() = 0;
+
+    /**
+     * Number of bytes the server reported as done, 0 if the
+     * protocol doesn't report progress. Can be called from other
+     * threads while the stream is running.
+     */
+    virtual uint64_t reportedProgress() { return 0; }
+
     /**
      *
      * @param prepared_conn Prepared PostgreSQL database connection.
@@ -630,6 +963,21 @@ namespace pgbckctl {
                              PGconn *prepared_conn,
                              BaseBackupQueryType type) = 0;
 
+    /**
+     * Assigns the backup manifest of the parent basebackup, requesting
+     * an incremental basebackup. Incremental basebackups are supported
+     * with PostgreSQL 17 and above only, so the default implementation
+     * throws a StreamingFailure.
+     */
+    virtual void setParentManifest(std::string const& manifest);
+
+    /**
+     * Uploads the parent backup manifest to the server. Must be
+     * called before the BASE_BACKUP command is sent, a no-op for full
+     * basebackups.
+     */
+    virtual void uploadManifest();
+
   };
 
   /**
@@ -647,6 +995,9 @@ namespace pgbckctl {
     BaseBackupState getTablespaceInfo(BaseBackupState &state) override;
     std::shared_ptr<BackupElemDescr> handleMessage(BaseBackupState &current_state) override;
 
+    unsigned int numTablespaces() override;
+    uint64_t estimatedSize() override;
+
     std::string query(std::shared_ptr<BackupProfileDescr> profile,
                       PGconn *prepared_conn,
                       BaseBackupQueryType type) override;
@@ -669,6 +1020,9 @@ namespace pgbckctl {
     BaseBackupState getTablespaceInfo(BaseBackupState &state) override;
     std::shared_ptr<BackupElemDescr> handleMessage(BaseBackupState &current_state) override;
 
+    unsigned int numTablespaces() override;
+    uint64_t estimatedSize() override;
+
     std::string query(std::shared_ptr<BackupProfileDescr> profile,
                       PGconn *prepared_conn,
                       BaseBackupQueryType type) override;
@@ -691,12 +1045,185 @@ namespace pgbckctl {
     BaseBackupState getTablespaceInfo(BaseBackupState &state) override;
     std::shared_ptr<BackupElemDescr> handleMessage(BaseBackupState &current_state) override;
 
+    unsigned int numTablespaces() override;
+    uint64_t estimatedSize() override;
+    uint64_t reportedProgress() override;
+
+    std::string query(std::shared_ptr<BackupProfileDescr> profile,
+                      PGconn *prepared_conn,
+                      BaseBackupQueryType type) override;
+
+  };
+
+  /**
+   * Protocol implementation for BASE_BACKUP command, suitable for
+   * PostgreSQL versions 17 and above.
+   *
+   * The stream protocol is the same as with PostgreSQL 15, but
+   * basebackups can be taken incrementally: if a parent manifest was
+   * assigned via setParentManifest(), uploadManifest() sends it to the server
+   * via UPLOAD_MANIFEST and query() adds the INCREMENTAL option to the
+   * BASE_BACKUP command. The server then only sends blocks changed since
+   * the parent basebackup was taken.
+   */
+  class BaseBackupStream17 : public BaseBackupStream15 {
+  private:
+
+    /**
+     * Path to the manifest of the parent basebackup, empty
+     * for full basebackups.
+     */
+    std::string parent_manifest = "";
+
+  public:
+
+    explicit BaseBackupStream17(PGconn *prepared_conn,
+                                std::shared_ptr<StreamBaseBackup> backupHandle,
+                                std::shared_ptr<BackupProfileDescr> profileDescr);
+    ~BaseBackupStream17() override;
+
+    void setParentManifest(std::string const& manifest) override;
+    void uploadManifest() override;
+
     std::string query(std::shared_ptr<BackupProfileDescr> profile,
                       PGconn *prepared_conn,
                       BaseBackupQueryType type) override;
 
   };
 
+  /*
+   * Adapts the rate of an ArchiveRateLimiter throttling a basebackup
+   * to the lag of the WAL streamers running on the same archive host.
+   *
+   * While running, a monitor thread samples the WAL stream statistics
+   * published in the worker shared memory once a second. If any WAL stream
+   * lags behind its upstream by more than the configured threshold, the
+   * rate is halved, down to the configured minimum rate. Once all streams
+   * caught up again, the rate is raised step by step until it reaches its
+   * ceiling again. A ceiling of 0 means unlimited, in this case backing off
+   * starts from the throughput measured before.
+   *
+   * Without access to the worker shared memory (launcher not
+   * running), the limiter keeps the ceiling rate.
+   */
+  class BaseBackupRateControl {
+  private:
+
+    std::shared_ptr<ArchiveRateLimiter> limiter = nullptr;
+    std::shared_ptr<WorkerSHM> shm = nullptr;
+
+    uint64_t ceiling = 0;
+    uint64_t min_rate = 0;
+    uint64_t lag_threshold = 0;
+
+    /* true while the rate is reduced because of WAL lag */
+    bool backing_off = false;
+
+    /* effective ceiling while backing off */
+    uint64_t recover_rate = 0;
+
+    std::thread monitor;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool shutdown = false;
+
+    /*
+     * Returns the highest lag in bytes of all WAL
+     * streams publishing statistics.
+     */
+    virtual uint64_t maxWalLag();
+
+    /*
+     * Recomputes the rate of the limiter, called by the
+     * monitor thread once a second.
+     */
+    virtual void adjust(uint64_t throughput);
+
+    /* Monitor thread main loop */
+    virtual void run();
+
+  public:
+
+    /*
+     * ceiling and min_rate are specified in bytes per
+     * second, lag_threshold in bytes. A lag_threshold of 0 disables
+     * backing off.
+     */
+    BaseBackupRateControl(std::shared_ptr<ArchiveRateLimiter> limiter,
+                          std::shared_ptr<WorkerSHM> shm,
+                          uint64_t ceiling,
+                          uint64_t min_rate,
+                          uint64_t lag_threshold);
+    virtual ~BaseBackupRateControl();
+
+    /*
+     * Starts and stops the monitor thread.
+     */
+    virtual void start();
+    virtual void stop();
+
+  };
+
+  /*
+   * Publishes the progress of a running basebackup into the worker
+   * shared memory slot of its worker once a second, from a thread of
+   * its own. Used by the metrics endpoint of the launcher, see
+   * MetricsServer.
+   *
+   * Written bytes are counted by the limiter, which is attached to
+   * the backup handle. A limiter with a rate of 0 doesn't throttle.
+   */
+  class BaseBackupProgressPublisher {
+  private:
+
+    std::shared_ptr<WorkerSHM> shm = nullptr;
+    unsigned int slot = 0;
+
+    std::shared_ptr<ArchiveRateLimiter> limiter = nullptr;
+    std::shared_ptr<BaseBackupStream> stream = nullptr;
+
+    shm_basebackup_progress progress;
+    std::atomic<unsigned int> tablespaces_streamed { 0 };
+
+    std::thread monitor;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool shutdown = false;
+
+    /* Writes the current progress into the slot */
+    virtual void publish();
+
+    /* Monitor thread main loop */
+    virtual void run();
+
+  public:
+
+    BaseBackupProgressPublisher(std::shared_ptr<WorkerSHM> shm,
+                                unsigned int slot,
+                                std::shared_ptr<ArchiveRateLimiter> limiter,
+                                std::string archive_name,
+                                int archive_id);
+    virtual ~BaseBackupProgressPublisher();
+
+    /*
+     * Catalog id of the basebackup, once registered.
+     */
+    virtual void setBackupID(int backup_id);
+
+    /*
+     * Counts a tablespace streamed completely.
+     */
+    virtual void tablespaceStreamed();
+
+    /*
+     * Starts publishing the progress of the specified stream
+     * and stops it, publishing the final state.
+     */
+    virtual void start(std::shared_ptr<BaseBackupStream> stream);
+    virtual void stop();
+
+  };
+
   /*
    * Implements the base backup streaming
    * infrastructure.
@@ -721,6 +1248,23 @@ namespace pgbckctl {
     std::string systemid;
     unsigned long long wal_segment_size = 0;
 
+    /*
+     * Manifest of the parent basebackup, if an incremental
+     * basebackup should be streamed.
+     */
+    std::string parent_manifest = "";
+
+    /*
+     * Adapts the throughput of the stream while running, if
+     * assigned.
+     */
+    std::shared_ptr<BaseBackupRateControl> rateControl = nullptr;
+
+    /*
+     * Publishes the progress of the stream, if assigned.
+     */
+    std::shared_ptr<BaseBackupProgressPublisher> progressPublisher = nullptr;
+
   public:
 
     BaseBackupProcess(PGconn *prepared_connection,
@@ -781,6 +1325,25 @@ namespace pgbckctl {
      */
     virtual void prepareStream(std::shared_ptr<StreamBaseBackup> &backupHandle);
 
+    /**
+     * Requests an incremental basebackup relative to the basebackup
+     * the specified manifest belongs to. Must be called before
+     * prepareStream().
+     */
+    virtual void setParentManifest(std::string const& manifest);
+
+    /**
+     * Assigns a rate control, which is running while
+     * stream() receives the tablespace archives.
+     */
+    virtual void setRateControl(std::shared_ptr<BaseBackupRateControl> control);
+
+    /**
+     * Assigns a progress publisher, which is running while
+     * stream() receives the tablespace archives.
+     */
+    virtual void setProgressPublisher(std::shared_ptr<BaseBackupProgressPublisher> publisher);
+
     /**
      * Step through the interal tablespace meta info
      * (initialized by calling readTablespaceInfo()), and
@@ -0,0 +1,204 @@
+#ifndef __HAVE_VERIFYBACKUP_HXX__
+#define __HAVE_VERIFYBACKUP_HXX__
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+#include <descr.hxx>
+#include <fs-archive.hxx>
+#include <checksum.hxx>
+#include <xlogdefs.hxx>
+
+namespace pgbckctl {
+
+  /*
+   * Default minimum size of the tar stream covered by a single
+   * task of a split archive, so that we don't start decompressing
+   * at every sync point.
+   */
+#define VERIFY_TASK_MIN_SIZE (16 * 1024 * 1024)
+
+  /**
+   * A file recorded in a PostgreSQL backup manifest.
+   */
+  typedef struct backup_manifest_file {
+
+    /* path relative to the data directory */
+    std::string path;
+
+    size_t size = 0;
+
+    /* manifest checksum algorithm and hex encoded checksum */
+    std::string algorithm = "NONE";
+    std::string checksum  = "";
+
+    /* set when the file was found in one of the tar archives */
+    bool seen = false;
+
+  } BackupManifestFile;
+
+  /**
+   * A WAL range recorded in a PostgreSQL backup manifest.
+   */
+  typedef struct backup_manifest_wal_range {
+
+    unsigned int timeline = 0;
+    XLogRecPtr start = InvalidXLogRecPtr;
+    XLogRecPtr end   = InvalidXLogRecPtr;
+
+  } BackupManifestWALRange;
+
+  /**
+   * Part of a tar archive read by a single verification
+   * worker.
+   */
+  typedef struct basebackup_verify_task {
+
+    path archive;
+
+    /* prefix of member names, e.g. pg_tblspc/16384/ */
+    std::string prefix = "";
+
+    /*
+     * Sync point the worker starts decompressing at, 0 if
+     * reading starts at the beginning of the archive.
+     */
+    off_t sync_offset = 0;
+
+    /* first and end tar stream position of this task, -1 is EOF */
+    off_t start = 0;
+    off_t end   = -1;
+
+  } BaseBackupVerifyTask;
+
+  /**
+   * Verifies the tar archives of a streamed basebackup against
+   * its backup manifest, without extracting them.
+   *
+   * Every file in the archives is checksummed with the algorithm
+   * recorded in the manifest and compared with its manifest entry,
+   * files missing from either side are reported. Additionally,
+   * the WAL required to restore the basebackup must be present
+   * in the log directory of the archive or in the basebackup
+   * itself.
+   *
+   * Archives are read by a pool of worker threads. An archive which
+   * has a member index with sync points (see IndexedArchiveFile)
+   * is split into several tasks, so even a basebackup consisting of
+   * a single large archive is verified in parallel.
+   */
+  class BaseBackupVerifier {
+  private:
+
+    std::shared_ptr<BaseBackupDescr> bbdescr = nullptr;
+
+    /* log directory of the archive the basebackup belongs to */
+    path logdir;
+
+    /* number of worker threads, 0 means one per CPU */
+    unsigned int workers = 0;
+
+    /* minimum tar stream size of a task */
+    size_t task_size = VERIFY_TASK_MIN_SIZE;
+
+    /* files and WAL ranges recorded in the manifest */
+    std::unordered_map<std::string, BackupManifestFile> manifest_files;
+    std::vector<BackupManifestWALRange> manifest_wal_ranges;
+
+    /* WAL segment files found in pg_wal/ of the archives */
+    std::set<std::string> archived_wal;
+
+    /* manifest checksum algorithms we already warned about */
+    std::set<std::string> unsupported_algorithms;
+
+    std::vector<BaseBackupVerifyTask> tasks;
+    std::atomic<size_t> next_task;
+
+    /* protects result and all of the above during verification */
+    std::mutex result_mtx;
+
+    std::shared_ptr<BaseBackupVerificationResult> result = nullptr;
+
+    /**
+     * Reads and checks the backup manifest of the basebackup,
+     * if there is one.
+     */
+    virtual void loadManifest();
+
+    /**
+     * Creates the tasks for all tar archives of the basebackup.
+     */
+    virtual void planTasks();
+
+    /**
+     * Worker thread main loop, processes tasks
+     * until there are none left.
+     */
+    virtual void worker();
+
+    /**
+     * Reads the members of the archive covered by the
+     * specified task.
+     */
+    virtual void verifyTask(BaseBackupVerifyTask const& task);
+
+    /**
+     * Checks a member of an archive against the manifest.
+     */
+    virtual void verifyMember(std::string const& name,
+                              size_t size,
+                              std::shared_ptr<FileChecksum> checksum);
+
+    /**
+     * Checks that all WAL segments in the specified
+     * range are available.
+     */
+    virtual void verifyWALRange(BackupManifestWALRange const& range);
+
+    virtual void error(std::string const& file, std::string const& message);
+    virtual void warning(std::string const& file, std::string const& message);
+
+  public:
+
+    BaseBackupVerifier(std::shared_ptr<BaseBackupDescr> bbdescr,
+                       path logdir);
+    virtual ~BaseBackupVerifier();
+
+    /**
+     * Sets the number of worker threads, 0 starts
+     * one worker per CPU.
+     */
+    virtual void setWorkers(unsigned int workers);
+
+    /**
+     * Sets the minimum part of the tar stream read by a single
+     * task when splitting archives at their sync points.
+     */
+    virtual void setTaskSize(size_t task_size);
+
+    /**
+     * Verifies the basebackup. Problems found are reported
+     * in the returned result, exceptions are only thrown if
+     * the basebackup can't be read at all.
+     */
+    virtual std::shared_ptr<BaseBackupVerificationResult> verify();
+
+    /**
+     * Returns true if the specified file of a data
+     * directory isn't expected in a backup manifest.
+     */
+    static bool ignoredFile(std::string const& name);
+
+    /**
+     * Returns a BackupFile to read the specified tar archive,
+     * according to its compression suffix.
+     */
+    static std::shared_ptr<BackupFile> archiveFile(path archive);
+
+  };
+
+}
+
+#endif
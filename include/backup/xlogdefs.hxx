@@ -38,6 +38,265 @@ namespace pgbckctl {
     XLOGMessageFailure(std::string errstr) throw() : CPGBackupCtlFailure(errstr) {};
   };
 
+  /**
+   * XLOG position and WAL segment filename arithmetic.
+   *
+   * Everything here works on fixed size buffers without any
+   * heap allocation, since it's called per segment and per status
+   * update, and in loops over whole archive log directories. The
+   * arithmetic is constexpr, WALSegment<> bakes in a WAL segment size
+   * known at compile time.
+   *
+   * WAL segment sizes are always powers of two.
+   */
+  namespace xlog {
+
+    /**
+     * Length of a WAL segment filename, e.g. 000000010000000A000000FE.
+     */
+    constexpr size_t WAL_FILENAME_LEN = 24;
+
+    /**
+     * Buffer size required by encodeXLogPos(), "XXXXXXXX/XXXXXXXX"
+     * plus the terminating NUL.
+     */
+    constexpr size_t XLOGPOS_BUFSIZE = 18;
+
+    constexpr uint64_t segmentsPerXLogId(uint64_t wal_segment_size) {
+      return UINT64CONST(0x100000000) / wal_segment_size;
+    }
+
+    constexpr uint64_t segmentOffset(XLogRecPtr pos, uint64_t wal_segment_size) {
+      return pos & (wal_segment_size - 1);
+    }
+
+    /**
+     * Number of the segment the specified position belongs to.
+     */
+    constexpr XLogSegNo segmentNumber(XLogRecPtr pos, uint64_t wal_segment_size) {
+      return pos / wal_segment_size;
+    }
+
+    /**
+     * Number of the segment the byte before the specified position
+     * belongs to, so a position at a segment boundary belongs to the
+     * segment it ends.
+     */
+    constexpr XLogSegNo prevSegmentNumber(XLogRecPtr pos, uint64_t wal_segment_size) {
+      return (pos - 1) / wal_segment_size;
+    }
+
+    constexpr XLogRecPtr segmentStart(XLogSegNo segno, uint64_t wal_segment_size) {
+      return segno * wal_segment_size;
+    }
+
+    /**
+     * Start of the segment the specified position belongs to.
+     */
+    constexpr XLogRecPtr segmentStartPosition(XLogRecPtr pos, uint64_t wal_segment_size) {
+      return pos - segmentOffset(pos, wal_segment_size);
+    }
+
+    /**
+     * Start of the segment before the one the specified
+     * position belongs to.
+     */
+    constexpr XLogRecPtr prevSegmentStartPosition(XLogRecPtr pos, uint64_t wal_segment_size) {
+      return segmentStartPosition(segmentStartPosition(pos, wal_segment_size) - 1,
+                                  wal_segment_size);
+    }
+
+    /**
+     * Value of a hex digit, -1 if c isn't one.
+     */
+    constexpr int hexDigitValue(char c) {
+      return (c >= '0' && c <= '9') ? c - '0'
+        : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+        : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+        : -1;
+    }
+
+    /**
+     * Writes value as hex digits to buf. With width 0 only the
+     * significant digits are written, otherwise exactly width digits.
+     * Returns the number of digits written, buf isn't terminated.
+     */
+    inline size_t encodeHex32(char *buf, uint32_t value,
+                              unsigned int width, bool upper) {
+
+      const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+      size_t len = width;
+
+      if (len == 0) {
+        len = 1;
+        while (len < 8 && (value >> (len * 4)) != 0)
+          len++;
+      }
+
+      for (size_t i = len; i > 0; i--) {
+        buf[i - 1] = digits[value & 0xF];
+        value >>= 4;
+      }
+
+      return len;
+
+    }
+
+    /**
+     * Reads up to maxdigits hex digits from str. Returns the number
+     * of digits consumed, 0 if str doesn't start with a hex digit.
+     */
+    inline size_t decodeHex32(const char *str, size_t len,
+                              size_t maxdigits, uint32_t &value) {
+
+      size_t i = 0;
+
+      value = 0;
+
+      while (i < len && i < maxdigits && hexDigitValue(str[i]) >= 0) {
+        value = (value << 4) | (uint32_t) hexDigitValue(str[i]);
+        i++;
+      }
+
+      return i;
+
+    }
+
+    /**
+     * Formats pos as XLOG position string, e.g. 0/3000060, into buf,
+     * which must hold XLOGPOS_BUFSIZE bytes. Returns the length of
+     * the string.
+     */
+    inline size_t encodeXLogPos(char *buf, XLogRecPtr pos) {
+
+      size_t len = encodeHex32(buf, (uint32_t) (pos >> 32), 0, false);
+
+      buf[len++] = '/';
+      len += encodeHex32(buf + len, (uint32_t) pos, 0, false);
+      buf[len] = '\0';
+
+      return len;
+
+    }
+
+    /**
+     * Parses a XLOG position string. Returns false if str
+     * isn't a valid XLOG position.
+     */
+    inline bool decodeXLogPos(const char *str, size_t len, XLogRecPtr &pos) {
+
+      uint32_t hi, lo;
+      size_t hilen, lolen;
+
+      hilen = decodeHex32(str, len, 8, hi);
+
+      if (hilen == 0 || hilen >= len || str[hilen] != '/')
+        return false;
+
+      lolen = decodeHex32(str + hilen + 1, len - hilen - 1, 8, lo);
+
+      if (lolen == 0 || hilen + 1 + lolen != len)
+        return false;
+
+      pos = ((uint64_t) hi << 32) | lo;
+      return true;
+
+    }
+
+    /**
+     * Formats the WAL segment filename of segment segno on the
+     * specified timeline into buf, which must hold WAL_FILENAME_LEN + 1
+     * bytes.
+     */
+    inline void walFileName(char *buf, TimeLineID timeline,
+                            XLogSegNo segno, uint64_t wal_segment_size) {
+
+      encodeHex32(buf, timeline, 8, true);
+      encodeHex32(buf + 8,
+                  (uint32_t) (segno / segmentsPerXLogId(wal_segment_size)),
+                  8, true);
+      encodeHex32(buf + 16,
+                  (uint32_t) (segno % segmentsPerXLogId(wal_segment_size)),
+                  8, true);
+      buf[WAL_FILENAME_LEN] = '\0';
+
+    }
+
+    /**
+     * Extracts timeline and segment number from the first
+     * WAL_FILENAME_LEN characters of a WAL segment filename, so suffixes
+     * like .partial are ignored. Returns false if name doesn't
+     * start with a WAL segment filename.
+     */
+    inline bool parseWalFileName(const char *name, size_t len,
+                                 TimeLineID &timeline, XLogSegNo &segno,
+                                 uint64_t wal_segment_size) {
+
+      uint32_t tli, log, seg;
+
+      if (len < WAL_FILENAME_LEN)
+        return false;
+
+      if (decodeHex32(name, 8, 8, tli) != 8
+          || decodeHex32(name + 8, 8, 8, log) != 8
+          || decodeHex32(name + 16, 8, 8, seg) != 8)
+        return false;
+
+      timeline = tli;
+      segno = (uint64_t) log * segmentsPerXLogId(wal_segment_size) + seg;
+
+      return true;
+
+    }
+
+    /**
+     * Segment arithmetic for a WAL segment size known at compile time.
+     */
+    template<uint64_t wal_segment_size>
+    class WALSegment {
+    public:
+
+      static_assert(wal_segment_size > 0
+                    && (wal_segment_size & (wal_segment_size - 1)) == 0,
+                    "WAL segment size must be a power of two");
+
+      static constexpr uint64_t size() {
+        return wal_segment_size;
+      }
+
+      static constexpr uint64_t offset(XLogRecPtr pos) {
+        return segmentOffset(pos, wal_segment_size);
+      }
+
+      static constexpr XLogSegNo number(XLogRecPtr pos) {
+        return segmentNumber(pos, wal_segment_size);
+      }
+
+      static constexpr XLogSegNo prevNumber(XLogRecPtr pos) {
+        return prevSegmentNumber(pos, wal_segment_size);
+      }
+
+      static constexpr XLogRecPtr startPosition(XLogRecPtr pos) {
+        return segmentStartPosition(pos, wal_segment_size);
+      }
+
+      static constexpr XLogRecPtr prevStartPosition(XLogRecPtr pos) {
+        return prevSegmentStartPosition(pos, wal_segment_size);
+      }
+
+      static void filename(char *buf, TimeLineID timeline, XLogSegNo segno) {
+        walFileName(buf, timeline, segno, wal_segment_size);
+      }
+
+      static bool parse(const char *name, size_t len,
+                        TimeLineID &timeline, XLogSegNo &segno) {
+        return parseWalFileName(name, len, timeline, segno, wal_segment_size);
+      }
+
+    };
+
+  }
+
   /*
    * Message handles for XLOG streaming.
    */
@@ -69,6 +328,11 @@ namespace pgbckctl {
      * Performs basic checks on the assigned byte buffer.
      */
     void basicCheckMemoryBuffer(MemoryBuffer &mybuffer);
+
+    /**
+     * Same as basicCheckMemoryBuffer(), but for a raw message buffer.
+     */
+    void basicCheckBuffer(const char *buf, size_t len);
   public:
     XLOGStreamMessage(PGconn *prepared_connection);
     XLOGStreamMessage(PGconn *prepared_connection,
@@ -77,6 +341,15 @@ namespace pgbckctl {
 
     virtual void assign(MemoryBuffer &mybuffer) {};
 
+    /**
+     * Interprets a raw message buffer, e.g. directly returned by
+     * PQgetCopyData(). Message objects can be reused for any number
+     * of messages by calling assignBuffer() again.
+     */
+    virtual void assignBuffer(const char *buf, size_t len) {
+      throw XLOGMessageFailure("raw buffer assignment not implemented");
+    }
+
     /**
      * Toggle request for server/client feedback message. Calling this before
      * send() requests the streaming endpoint to respond to this
@@ -132,6 +405,14 @@ namespace pgbckctl {
     XLogRecPtr xlogserverpos = 0;
     long long xlogstreamtime = 0;
     MemoryBuffer xlogdata;
+
+    /*
+     * XLOG data block of the current message. Either points
+     * into xlogdata or into the buffer passed to assignBuffer().
+     */
+    const char *xlogdataptr = nullptr;
+    size_t xlogdatalen = 0;
+
   public:
     XLOGDataStreamMessage(PGconn *prepared_connection);
     XLOGDataStreamMessage(PGconn *prepared_connection,
@@ -147,6 +428,13 @@ namespace pgbckctl {
      */
     virtual void assign(MemoryBuffer &mybuffer);
 
+    /**
+     * Interprets a raw XLogData message buffer without copying
+     * the XLOG data block. buffer() points into buf afterwards, so the
+     * caller must keep buf alive as long as the XLOG data is accessed.
+     */
+    virtual void assignBuffer(const char *buf, size_t len);
+
     /**
      * Overloaded operator to assign a memory buffer.
      */
@@ -170,9 +458,12 @@ namespace pgbckctl {
      * pointer carefully, since we *DO NOT* copy the
      * message bytes over into a new one. Thus, the lifetime
      * of the returned pointer is bound to the object lifetime
-     * of a XLOGDataStreamMessage instance.
+     * of a XLOGDataStreamMessage instance, or to the lifetime of the
+     * buffer passed to assignBuffer().
+     *
+     * Returns a nullptr if the message doesn't carry any XLOG data.
      */
-    virtual char *buffer();
+    virtual const char *buffer();
 
     /**
      * Returns the size of the data block of
@@ -216,6 +507,11 @@ namespace pgbckctl {
      */
     virtual void assign(MemoryBuffer &mybuffer);
 
+    /**
+     * Same as assign(), but reads a raw message buffer.
+     */
+    virtual void assignBuffer(const char *buf, size_t len);
+
     /**
      * Overloaded operator to assign a memory buffer.
      */
@@ -2,7 +2,10 @@
 #define __BACKUP_CATALOG__
 
 #include <sqlite3.h>
+#include <functional>
 #include <list>
+#include <map>
+#include <set>
 
 #include <common.hxx>
 #include <catalog.hxx>
@@ -20,6 +23,96 @@ namespace pgbckctl {
     CCatalogIssue(std::string errstr) throw() : CPGBackupCtlFailure(errstr) {};
   };
 
+  class BackupCatalog;
+
+  /**
+   * Ordering of basebackups returned by a BaseBackupCursor.
+   */
+  typedef enum {
+
+    BASEBACKUP_LIST_STARTED_DESC,
+    BASEBACKUP_LIST_STARTED_ASC,
+    BASEBACKUP_LIST_STOPPED_DESC,
+    BASEBACKUP_LIST_STOPPED_ASC
+
+  } BaseBackupListOrder;
+
+  /**
+   * Selects the basebackups a BaseBackupCursor returns. The archive
+   * is identified either by archive_id or, if that is negative, by
+   * archive_name. Everything else is optional.
+   */
+  typedef struct BaseBackupListFilter {
+
+    int archive_id = -1;
+    std::string archive_name = "";
+
+    /* Restrict to a single basebackup by its ID or fsentry */
+    int basebackup_id = -1;
+    std::string fsentry = "";
+
+    /* Only basebackups in state "ready" */
+    bool valid_only = false;
+
+    BaseBackupListOrder order = BASEBACKUP_LIST_STARTED_DESC;
+
+    /* Max number of basebackups to return, 0 means all */
+    unsigned int limit = 0;
+
+    /* Number of basebackups to skip */
+    unsigned int offset = 0;
+
+  } BaseBackupListFilter;
+
+  /**
+   * Iterates over the basebackups of an archive, including
+   * their tablespaces.
+   *
+   * The cursor runs a single query joining basebackups with their
+   * tablespaces and assembles one BaseBackupDescr at a time from
+   * the joined rows, so callers processing basebackups one after
+   * another never hold the whole list. Ordering, filtering and LIMIT
+   * are evaluated by SQLite.
+   *
+   * A cursor is created by BackupCatalog::openBackupCursor() and
+   * must not outlive the catalog connection it was created from.
+   * The underlying statement is finalized by close(), which is also
+   * called when the cursor is exhausted or destroyed.
+   */
+  class BaseBackupCursor {
+  private:
+
+    BackupCatalog *catalog = nullptr;
+    sqlite3 *db_handle = nullptr;
+    sqlite3_stmt *stmt = nullptr;
+
+    std::vector<int> backupAttrs;
+    std::vector<int> tblspcAttrs;
+
+    /* Result of the last sqlite3_step() */
+    int rc = SQLITE_DONE;
+
+  public:
+
+    BaseBackupCursor(BackupCatalog *catalog,
+                     sqlite3 *db_handle,
+                     BaseBackupListFilter filter);
+    virtual ~BaseBackupCursor();
+
+    /**
+     * Fetches the next basebackup into descr. Returns false if
+     * there are no more basebackups, descr is left untouched then.
+     */
+    virtual bool next(std::shared_ptr<BaseBackupDescr> &descr);
+
+    /**
+     * Finalizes the underlying statement. Any later call
+     * to next() returns false.
+     */
+    virtual void close();
+
+  };
+
   class BackupCatalog : protected CPGBackupCtlBase {
   private:
     sqlite3 *db_handle;
@@ -63,6 +156,75 @@ namespace pgbckctl {
      */
     virtual void setPragma();
 
+    /*
+     * Cache of prepared statements of this connection. Statements are
+     * identified by the name of the catalog operation and the list of
+     * attributes it was generated for, since dynamically generated SQL
+     * only depends on those.
+     */
+    typedef std::pair<std::string, std::vector<int>> CatalogStatementKey;
+
+    std::map<CatalogStatementKey, sqlite3_stmt *> stmt_cache;
+    unsigned long long stmt_cache_hits = 0;
+    unsigned long long stmt_cache_misses = 0;
+
+    /**
+     * Returns the cached prepared statement for the specified catalog
+     * operation and attribute list. On a cache miss, sql() is called
+     * to generate the SQL text, which is prepared and cached afterwards.
+     *
+     * The returned statement is reset and has no bound values. Callers
+     * must pass it to releaseStatement() when done, instead of
+     * finalizing it, even in case of errors.
+     */
+    virtual sqlite3_stmt *cachedStatement(std::string operation,
+                                          const std::vector<int> &attrs,
+                                          std::function<std::string()> sql);
+
+    /**
+     * Resets a statement returned by cachedStatement() and
+     * clears its bound values, so it can be reused. This also
+     * ends the implicit read transaction of a SELECT.
+     */
+    virtual void releaseStatement(sqlite3_stmt *stmt);
+
+    /**
+     * Makes sure the specified archive has got a row in
+     * archive_stats, which is zeroed if created.
+     */
+    virtual void initArchiveStats(int archive_id);
+
+    /*
+     * Lock wait settings and statistics, see busyHandler().
+     */
+    unsigned int busy_timeout = CATALOG_BUSY_TIMEOUT_MS;
+    unsigned int busy_waited_ms = 0;
+    unsigned long long busy_retries = 0;
+
+    /* PRAGMA synchronous level, see setSynchronous() */
+    std::string synchronous = "NORMAL";
+
+    /*
+     * Number of transactions started and not yet committed or
+     * rolled back, nested ones run as savepoints.
+     */
+    unsigned int tx_depth = 0;
+
+    /* Set by setKeepOpen() */
+    bool keep_open = false;
+
+    /**
+     * SQLite busy handler, called if another connection holds
+     * a conflicting lock. Waits with exponential backoff until the
+     * busy timeout of the connection is exhausted.
+     */
+    static int busyHandler(void *arg, int count);
+
+    /**
+     * Sets PRAGMA synchronous of the opened database.
+     */
+    virtual void applySynchronous();
+
   protected:
     std::string sqliteDB;
     std::string archiveDir;
@@ -215,7 +377,8 @@ namespace pgbckctl {
                                           Range range);
 
     /**
-     * Rollback an existing catalog transaction.
+     * Rollback an existing catalog transaction. Within a nested
+     * transaction, just its changes are rolled back.
      */
     virtual void rollbackTransaction();
 
@@ -242,15 +405,24 @@ namespace pgbckctl {
     virtual std::shared_ptr<CatalogDescr> existsById(int archive_id);
 
     /*
-     * Commits the current catalog transaction.
+     * Commits the current catalog transaction. Committing a nested
+     * transaction releases its savepoint, its changes are committed
+     * along with the outer transaction.
      */
     virtual void commitTransaction();
 
     /*
-     * Starts a transaction in the catalog database.
+     * Starts a transaction in the catalog database. If a transaction
+     * is in progress already, e.g. a command file executed within a
+     * single transaction, a savepoint is set instead.
      */
     virtual void startTransaction();
 
+    /**
+     * Returns true if a transaction is in progress.
+     */
+    virtual bool inTransaction();
+
     /*
      * Set sqlite database filename.
      */
@@ -402,10 +574,61 @@ namespace pgbckctl {
     virtual bool opened();
 
     /*
-     * Close the sqlite catalog database.
+     * Close the sqlite catalog database. Does nothing while the
+     * catalog is kept open, see setKeepOpen().
      */
     virtual void close();
 
+    /**
+     * Keeps the catalog open until called with false again, so
+     * several commands can be executed on one connection, possibly
+     * within one transaction. Commands closing the catalog when
+     * they're done don't close it then. The destructor always
+     * closes the catalog.
+     */
+    virtual void setKeepOpen(bool keep_open);
+
+    /**
+     * Finalizes all cached prepared statements. Called when the
+     * database is closed and after the catalog schema was checked or
+     * changed, since cached statements might refer to tables or
+     * columns which don't exist anymore.
+     */
+    virtual void clearStatementCache();
+
+    /**
+     * Statistics of the prepared statement cache: number of cached
+     * statements, and how often a cached statement could be reused
+     * or had to be prepared.
+     */
+    virtual size_t statementCacheSize();
+    virtual unsigned long long statementCacheHits();
+    virtual unsigned long long statementCacheMisses();
+
+    /**
+     * Maximum time to wait for a lock held by another connection
+     * before an operation fails with SQLITE_BUSY, in milliseconds.
+     * Defaults to CATALOG_BUSY_TIMEOUT_MS.
+     */
+    virtual void setBusyTimeout(unsigned int timeout_ms);
+    virtual unsigned int getBusyTimeout();
+
+    /**
+     * Number of lock wait retries of this connection so far.
+     */
+    virtual unsigned long long busyRetries();
+
+    /**
+     * Sets the SQLite synchronous level of the catalog database,
+     * one of OFF, NORMAL, FULL or EXTRA. The default is NORMAL, which
+     * doesn't sync the write-ahead log on every commit, but only
+     * during checkpoints. The catalog stays consistent after a crash,
+     * but might lose the most recent transactions after a power
+     * failure. Use FULL to sync every commit.
+     */
+    virtual void setSynchronous(std::string level);
+    virtual std::string getSynchronous();
+
     /**
      * Register the specified process handle in the catalog database.
      */
@@ -600,6 +823,12 @@ namespace pgbckctl {
      */
     virtual void deleteBaseBackup(int basebackupId);
 
+    /**
+     * Returns the IDs of all basebackups taken incrementally
+     * against the specified basebackup, regardless of their state.
+     */
+    virtual std::vector<int> getDependentBasebackups(int basebackupId);
+
     /*
      * Abort a registered basebackup. Marks the specified basebackup as failed.
      */
@@ -642,6 +871,13 @@ namespace pgbckctl {
     virtual std::vector<std::shared_ptr<BaseBackupDescr>>
     getBackupList(std::string archive_name);
 
+    /**
+     * Returns a cursor over the basebackups selected by
+     * filter, see BaseBackupCursor. Throws a CCatalogIssue if the
+     * catalog isn't opened or the query fails to prepare.
+     */
+    virtual std::shared_ptr<BaseBackupCursor> openBackupCursor(BaseBackupListFilter filter);
+
     /**
      * Returns a list of all basebackups.
      *
@@ -668,6 +904,15 @@ namespace pgbckctl {
                                                            int archive_id,
                                                            bool valid_only);
 
+    /**
+     * Evaluates the given retention interval relative to the
+     * current local time and returns the resulting timestamp, formatted
+     * like the started and stopped timestamps of basebackups. Comparing
+     * a stopped timestamp against it gives the same result as
+     * exceedsRetention(), without a query per basebackup.
+     */
+    virtual std::string retentionDateTimeThreshold(RetentionIntervalDescr interval);
+
     /**
      * Checks whether the given retention interval would be
      * exceeded for the specified basebackup. The specified
@@ -692,6 +937,18 @@ namespace pgbckctl {
     virtual std::shared_ptr<BaseBackupDescr> getBaseBackup(int basebackupId,
                                                            int archive_Id);
 
+    /**
+     * Returns the chain of basebackups required to restore the
+     * specified basebackup, starting with the full basebackup and
+     * ending with the specified one. For full basebackups, the chain
+     * consists of the basebackup itself.
+     *
+     * Throws a CCatalogIssue if any basebackup of the chain is
+     * missing or not in state "ready".
+     */
+    virtual std::vector<std::shared_ptr<BaseBackupDescr>> getBaseBackupChain(int basebackupId,
+                                                                         int archive_id);
+
     /**
      * Returns a basebackup descriptor, describing the
      * specified basebackup referenced within the given archive_id
@@ -709,6 +966,210 @@ namespace pgbckctl {
      */
     virtual std::shared_ptr<StatCatalogArchive> statCatalog(std::string archive_name);
 
+    /**
+     * Appends the backup counts and materialised statistics of all
+     * archives to list, ordered by archive name. Other than statCatalog(),
+     * this reads a single aggregate query and doesn't estimate sizes
+     * or durations, so it stays cheap with many archives.
+     */
+    virtual void statCatalogArchives(std::vector<std::shared_ptr<StatCatalogArchive>> &list);
+
+    /**
+     * Returns the materialised statistics of the specified archive.
+     * If none were recorded yet, the returned descriptor has its
+     * archive_id set to -1.
+     */
+    virtual std::shared_ptr<ArchiveStatsDescr> getArchiveStats(int archive_id);
+
+    /**
+     * Replaces the WAL statistics of an archive, e.g. after they were
+     * recomputed from the WAL segment index. backup_bytes is
+     * maintained by registerBackupStats() and deleteBaseBackup() and
+     * left untouched.
+     */
+    virtual void setArchiveWALStats(std::shared_ptr<ArchiveStatsDescr> stats);
+
+    /**
+     * Adds the specified number of bytes and segments to the WAL
+     * statistics of an archive, called by WAL streamers for every
+     * completed segment. The oldest XLOG position is only recorded
+     * if none is known yet, the newest one unless empty.
+     */
+    virtual void updateArchiveWALStats(int archive_id,
+                                       unsigned long long bytes,
+                                       unsigned long long segments,
+                                       std::string oldest_xlogpos,
+                                       std::string newest_xlogpos);
+
+    /**
+     * Records the size of a finalized basebackup and accounts
+     * it in the statistics of its archive.
+     */
+    virtual void registerBackupStats(std::shared_ptr<BaseBackupDescr> bbdescr,
+                                     unsigned long long size);
+
+    /**
+     * Returns the recorded size of the specified basebackup,
+     * 0 if none was recorded.
+     */
+    virtual unsigned long long getBackupSize(int basebackup_id);
+
+    /**
+     * Reads a schedule from the current row of stmt, which
+     * must select the columns in the order of getSchedules().
+     */
+    std::shared_ptr<ScheduleDescr> fetchSchedule(sqlite3_stmt *stmt);
+
+    /**
+     * Creates the specified schedule. Throws if the archive
+     * has a schedule of the same job type already. Sets the id
+     * and the creation timestamp of the descriptor.
+     */
+    virtual void createSchedule(std::shared_ptr<ScheduleDescr> schedule);
+
+    /**
+     * Drops the schedule of the specified job type from
+     * an archive. A no-op if there's none.
+     */
+    virtual void dropSchedule(int archive_id, ScheduleJobType type);
+
+    /**
+     * Returns the schedule of the specified job type of an
+     * archive. If there's none, the returned descriptor has its
+     * id set to -1.
+     */
+    virtual std::shared_ptr<ScheduleDescr> getSchedule(int archive_id, ScheduleJobType type);
+
+    /**
+     * Appends all schedules of the catalog to list, ordered
+     * by archive name and job type.
+     */
+    virtual void getSchedules(std::vector<std::shared_ptr<ScheduleDescr>> &list);
+
+    /**
+     * Records the next run of a schedule. If last_run is
+     * not empty, it's recorded as the time of the last run, too.
+     */
+    virtual void updateScheduleRun(int schedule_id,
+                                   std::string next_run,
+                                   std::string last_run);
+
+    /**
+     * Reads the object storage of an archive from the current row
+     * of stmt, see getArchiveStorage().
+     */
+    std::shared_ptr<ArchiveStorageDescr> fetchArchiveStorage(sqlite3_stmt *stmt);
+
+    /**
+     * Creates the object storage of an archive. Throws if
+     * the archive has one already. Sets the creation timestamp of
+     * the descriptor.
+     */
+    virtual void createArchiveStorage(std::shared_ptr<ArchiveStorageDescr> storage);
+
+    /**
+     * Drops the object storage of an archive together with all
+     * its queued uploads. A no-op if there's none.
+     */
+    virtual void dropArchiveStorage(int archive_id);
+
+    /**
+     * Returns the object storage of an archive. If there's none,
+     * the returned descriptor has its archive_id set to -1.
+     */
+    virtual std::shared_ptr<ArchiveStorageDescr> getArchiveStorage(int archive_id);
+
+    /**
+     * Appends the object storage of all archives with pending
+     * uploads which were tried less than max_attempts times to list.
+     */
+    virtual void getArchiveStoragesWithPendingUploads(std::vector<std::shared_ptr<ArchiveStorageDescr>> &list,
+                                                      unsigned int max_attempts);
+
+    /**
+     * Reads a queued upload from the current row of stmt, which
+     * must select the columns in the order of getUploads().
+     */
+    std::shared_ptr<UploadDescr> fetchUpload(sqlite3_stmt *stmt);
+
+    /**
+     * Queues a file for upload. A file already queued for
+     * the archive is left alone. Sets the id of the descriptor, -1 if
+     * the file was queued before.
+     */
+    virtual void queueUpload(std::shared_ptr<UploadDescr> upload);
+
+    /**
+     * Appends the queued uploads of an archive to list, ordered
+     * by their id. With archive_id set to -1, the uploads of all
+     * archives are returned. With pending_only set, uploads which
+     * are done are skipped. limit restricts the number of uploads
+     * returned, 0 means no limit.
+     */
+    virtual void getUploads(int archive_id,
+                            std::vector<std::shared_ptr<UploadDescr>> &list,
+                            bool pending_only = false,
+                            unsigned int limit = 0);
+
+    /**
+     * Records the status, multipart upload ID, number of attempts,
+     * last error and size of an upload.
+     */
+    virtual void updateUploadStatus(std::shared_ptr<UploadDescr> upload);
+
+    /**
+     * Removes an upload from the queue.
+     */
+    virtual void deleteUpload(int upload_id);
+
+    /**
+     * Returns the cold tier directory of an archive, an
+     * empty string if it has none.
+     */
+    virtual std::string getArchiveColdDirectory(int archive_id);
+
+    /**
+     * Sets the cold tier directory of an archive, replacing
+     * the one set before.
+     */
+    virtual void setArchiveColdDirectory(int archive_id, std::string directory);
+
+    /**
+     * Records the new location of a basebackup which was
+     * moved to another directory, see RetentionPlanner::migrate().
+     */
+    virtual void updateBaseBackupFsentry(int basebackupId, std::string fsentry);
+
+    /**
+     * Increments the reference counts of the specified chunks
+     * of the chunk store of an archive, adding chunks not known
+     * yet. See DedupChunkStore.
+     */
+    virtual void referenceChunks(int archive_id, std::set<std::string> const& ids);
+
+    /**
+     * Decrements the reference counts of the specified chunks.
+     */
+    virtual void releaseChunks(int archive_id, std::set<std::string> const& ids);
+
+    /**
+     * Returns true if the specified chunk is referenced by
+     * a basebackup of the archive.
+     */
+    virtual bool chunkReferenced(int archive_id, std::string const& id);
+
+    /**
+     * Forgets all chunks of an archive which aren't
+     * referenced anymore.
+     */
+    virtual void deleteUnreferencedChunks(int archive_id);
+
+    /**
+     * Returns true if a basebackup of the specified
+     * archive is in progress.
+     */
+    virtual bool hasBasebackupsInProgress(int archive_id);
+
     /**
      * Returns the compiled in catalog magic number. Should
      * match at least the version returned from the catalog database
@@ -1,7 +1,14 @@
 #ifndef __CATALOG__
 #define __CATALOG__
 
-#define CATALOG_MAGIC 108
+#define CATALOG_MAGIC 118
+
+/*
+ * Default time to wait for a catalog lock held by another process,
+ * and the upper limit of a single backoff delay while waiting.
+ */
+#define CATALOG_BUSY_TIMEOUT_MS 60000
+#define CATALOG_BUSY_MAX_DELAY_MS 100
 
 /*
  * Archive catalog entity
@@ -56,6 +63,8 @@
 #define SQL_BACKUP_WAL_SEGMENT_SIZE_ATTNO 12
 #define SQL_BACKUP_USED_PROFILE_ATTNO 13
 #define SQL_BACKUP_PG_VERSION_NUM_ATTNO 14
+#define SQL_BACKUP_PARENT_ID_ATTNO 15
+#define SQL_BACKUP_COMPRESS_TYPE_ATTNO 16
 
 /*
  * Computed columns with no corresponding
@@ -64,13 +73,13 @@
  * a BaseBackupDescr. They must not be counted
  * below in SQL_BACKUP_NCOLS!
  */
-#define SQL_BACKUP_COMPUTED_DURATION 15
-#define SQL_BACKUP_COMPUTED_RETENTION_DATETIME 16
+#define SQL_BACKUP_COMPUTED_DURATION 17
+#define SQL_BACKUP_COMPUTED_RETENTION_DATETIME 18
 
 /*
  * Keep that in sync with above number of cols
  */
-#define SQL_BACKUP_NCOLS 15
+#define SQL_BACKUP_NCOLS 17
 
 /*
  * Attributes belong to stream tablex
@@ -109,11 +118,18 @@
 #define SQL_BCK_PROF_NOVERIFY_CHECKSUMS_ATTNO 8
 #define SQL_BCK_PROF_MANIFEST_ATTNO 9
 #define SQL_BCK_PROF_MANIFEST_CHECKSUMS_ATTNO 10
+#define SQL_BCK_PROF_COMPRESS_LEVEL_ATTNO 11
+#define SQL_BCK_PROF_COMPRESS_WORKERS_ATTNO 12
+#define SQL_BCK_PROF_PARALLEL_WRITERS_ATTNO 13
+#define SQL_BCK_PROF_INCREMENTAL_ATTNO 14
+#define SQL_BCK_PROF_SERVER_COMPRESSION_ATTNO 15
+#define SQL_BCK_PROF_ADAPTIVE_RATE_ATTNO 16
+#define SQL_BCK_PROF_DEDUPLICATE_ATTNO 17
 
 /*
  * Keep number of columns in sync with above definitions
  */
-#define SQL_BACKUP_PROFILES_NCOLS 11
+#define SQL_BACKUP_PROFILES_NCOLS 17
 
 /*
  * Attributes belonging to backup_tablespaces catalog table.
@@ -25,6 +25,21 @@ namespace pgbckctl {
   class RetentionDescr;
   class RetentionRuleDescr;
   class RestoreDescr;
+  class ScheduleDescr;
+  class ArchiveStorageDescr;
+
+  /**
+   * Recovery target of a RESTORE ... RECOVERY TARGET command,
+   * see RestorePlanner.
+   */
+  typedef enum {
+
+    RESTORE_TARGET_NONE,   /* basebackup specified explicitly */
+    RESTORE_TARGET_TIME,   /* recover up to a timestamp */
+    RESTORE_TARGET_LSN,    /* recover up to an XLOG position */
+    RESTORE_TARGET_LATEST  /* recover all WAL available */
+
+  } RestoreTargetType;
 
   /*
    * Defines flags to characterize the
@@ -72,7 +87,18 @@ namespace pgbckctl {
     RESET_VARIABLE,
     DROP_BASEBACKUP,
     RESTORE_BACKUP,
-    STAT_ARCHIVE_BASEBACKUP
+    STAT_ARCHIVE_BASEBACKUP,
+    SHOW_STREAM_STATISTICS,
+    VERIFY_BASEBACKUP,
+    ALTER_ARCHIVE_LOG_LAYOUT,
+    CREATE_SCHEDULE,
+    DROP_SCHEDULE,
+    LIST_SCHEDULES,
+    CREATE_ARCHIVE_STORAGE,
+    DROP_ARCHIVE_STORAGE,
+    LIST_UPLOADS,
+    UPLOAD_ARCHIVE,
+    ALTER_ARCHIVE_COLD_TIER
   } CatalogTag;
 
   /**
@@ -89,6 +115,12 @@ namespace pgbckctl {
 
   } BackupProfileCompressType;
 
+  /*
+   * Upper limit of parallel archive writers of a backup profile,
+   * keep in sync with the CHECK constraint of backup_profiles.
+   */
+#define BACKUP_PROFILE_MAX_PARALLEL_WRITERS 64
+
   /**
    * Replication slot states.
    */
@@ -105,7 +137,8 @@ namespace pgbckctl {
    */
   typedef enum {
                 OUTPUT_CONSOLE,
-                OUTPUT_JSON
+                OUTPUT_JSON,
+                OUTPUT_JSON_LINES
   } OutputFormatType;
 
   /**
@@ -128,7 +161,8 @@ namespace pgbckctl {
 
     RETENTION_NO_ACTION,
     RETENTION_ACTION_DROP,
-    RETENTION_ACTION_KEEP
+    RETENTION_ACTION_KEEP,
+    RETENTION_ACTION_MOVE
 
   } RetentionParsedAction;
 
@@ -183,7 +217,10 @@ namespace pgbckctl {
     RETENTION_PIN = 500,
     RETENTION_UNPIN = 600,
 
-    RETENTION_CLEANUP = 700
+    RETENTION_CLEANUP = 700,
+
+    /* moves basebackups and WAL to the cold tier of an archive */
+    RETENTION_MOVE_OLDER_BY_DATETIME = 800
 
   } RetentionRuleId;
 
@@ -525,6 +562,41 @@ namespace pgbckctl {
 
   } VerifyOption;
 
+  /**
+   * Jobs the launcher can schedule for an archive, see
+   * ScheduleDescr.
+   */
+  typedef enum {
+
+    SCHEDULE_BASEBACKUP,
+    SCHEDULE_VERIFY
+
+  } ScheduleJobType;
+
+  /**
+   * Kind of a file queued for upload to the object
+   * storage of an archive, see UploadDescr.
+   */
+  typedef enum {
+
+    UPLOAD_WAL,
+    UPLOAD_BASEBACKUP
+
+  } UploadKind;
+
+  /**
+   * State of a queued upload. Anything but UPLOAD_DONE
+   * counts as pending.
+   */
+  typedef enum {
+
+    UPLOAD_PENDING,
+    UPLOAD_RUNNING,
+    UPLOAD_DONE,
+    UPLOAD_FAILED
+
+  } UploadStatus;
+
   /**
    * Type of ConfigVariable.
    */
@@ -585,6 +657,18 @@ namespace pgbckctl {
      */
     std::shared_ptr<RestoreDescr> restoreDescr = nullptr;
 
+    /**
+     * A pointer to a ScheduleDescr instantiated during
+     * parsing a CREATE or DROP SCHEDULE command.
+     */
+    std::shared_ptr<ScheduleDescr> schedule = nullptr;
+
+    /**
+     * A pointer to an ArchiveStorageDescr instantiated during
+     * parsing a CREATE STORAGE command.
+     */
+    std::shared_ptr<ArchiveStorageDescr> storage = nullptr;
+
   public:
     CatalogDescr() { tag = EMPTY_DESCR; };
     virtual ~CatalogDescr();
@@ -650,10 +734,36 @@ namespace pgbckctl {
      */
     bool forceXLOGPosRestart = false;
 
+    /**
+     * Additional archives to stream from, if more than one
+     * archive was specified by START STREAMING FOR ARCHIVE. The first
+     * archive is always stored in archive_name.
+     */
+    std::vector<std::string> stream_archive_names;
+
     /*
      * VERIFY command options.
      */
     bool check_connection = false;
+    int verify_workers = 0;
+
+    /*
+     * ALTER ARCHIVE ... SET LOG LAYOUT option, true
+     * for SHARDED, false for FLAT.
+     */
+    bool log_layout_sharded = false;
+
+    /*
+     * ALTER ARCHIVE ... SET COLD DIRECTORY option, the
+     * directory of the cold tier of the archive.
+     */
+    std::string cold_directory = "";
+
+    /*
+     * APPLY RETENTION POLICY ... PREVIEW option, only
+     * prints the retention plan without executing it.
+     */
+    bool retention_preview = false;
 
     /**
      * Used for executing shell commands.
@@ -681,6 +791,88 @@ namespace pgbckctl {
      */
     void setBasebackupID(std::string const& bbid);
 
+    /**
+     * Set the number of threads used by VERIFY ... BASEBACKUP
+     * during parse analysis.
+     */
+    void setVerifyWorkers(std::string const& workers);
+
+    /**
+     * Set the requested log directory layout of
+     * ALTER ARCHIVE ... SET LOG LAYOUT during parse analysis.
+     */
+    void setLogLayoutSharded(bool const& sharded);
+
+    /**
+     * Set the cold tier directory of ALTER ARCHIVE ... SET
+     * COLD DIRECTORY during parse analysis.
+     */
+    void setColdDirectory(std::string const& directory);
+
+    /**
+     * Set the PREVIEW option of APPLY RETENTION POLICY
+     * during parse analysis.
+     */
+    void setRetentionPreview(bool const& preview);
+
+    /**
+     * Creates the internal schedule descriptor for the
+     * specified job type during parsing CREATE or DROP SCHEDULE.
+     * If one already exists, only its job type is changed.
+     */
+    void makeScheduleDescr(ScheduleJobType const& type);
+
+    /**
+     * Returns the internal schedule descriptor, a nullptr
+     * if makeScheduleDescr() wasn't called before.
+     */
+    std::shared_ptr<ScheduleDescr> getScheduleDescr();
+
+    /**
+     * Set the EVERY <n> and JITTER <n> values of
+     * CREATE SCHEDULE. They count in units of seconds until
+     * setScheduleIntervalUnit() or setScheduleJitterUnit() are
+     * called with the number of seconds of the parsed unit.
+     *
+     * Throw if no schedule descriptor was created before.
+     */
+    void setScheduleInterval(std::string const& value);
+    void setScheduleIntervalUnit(unsigned int const& seconds);
+    void setScheduleJitter(std::string const& value);
+    void setScheduleJitterUnit(unsigned int const& seconds);
+
+    /**
+     * Set the PRIORITY of CREATE SCHEDULE.
+     */
+    void setSchedulePriority(std::string const& value);
+
+    /**
+     * Creates the internal object storage descriptor during
+     * parsing CREATE STORAGE, if not already done.
+     */
+    void makeArchiveStorageDescr();
+
+    /**
+     * Returns the internal object storage descriptor, a nullptr
+     * if makeArchiveStorageDescr() wasn't called before.
+     */
+    std::shared_ptr<ArchiveStorageDescr> getArchiveStorageDescr();
+
+    /**
+     * Set the options of CREATE STORAGE. PART_SIZE is in
+     * megabytes, MAX_RATE in kilobytes per second like the MAX_RATE
+     * of backup profiles.
+     *
+     * Throw if no storage descriptor was created before.
+     */
+    void setStorageEndpoint(std::string const& endpoint);
+    void setStorageBucket(std::string const& bucket);
+    void setStoragePrefix(std::string const& prefix);
+    void setStorageRegion(std::string const& region);
+    void setStorageParallel(std::string const& parallel);
+    void setStoragePartSize(std::string const& megabytes);
+    void setStorageMaxRate(std::string const& max_rate);
+
     /**
      * Set the FORCE_SYSTEMID_OPTION option.
      */
@@ -798,6 +990,32 @@ namespace pgbckctl {
      */
     void restoreTablespaceAllFromParserState(std::string const& location);
 
+    /**
+     * Sets the target directory of a formerly created restore
+     * descriptor. Throws if no restore descriptor is attached.
+     */
+    void restoreTargetDirectoryFromParserState(std::string const& directory);
+
+    /**
+     * Assign a new internal restore descriptor for the specified
+     * recovery target. The basebackup is chosen later by a
+     * RestorePlanner. target is ignored for RESTORE_TARGET_LATEST.
+     */
+    void createRestoreDescrByTarget(RestoreTargetType const& type,
+                                    std::string const& target);
+
+    /**
+     * Sets the timeline to recover of a formerly created
+     * restore descriptor.
+     */
+    void restoreTargetTimelineFromParserState(std::string const& timeline);
+
+    /**
+     * Sets the PREVIEW flag of a formerly created restore
+     * descriptor.
+     */
+    void setRestorePreview(bool const& preview);
+
     /**
      * addRecoveryStreamAddress() stores the specified
      * hostname or ip in the recovery descriptor currently
@@ -937,6 +1155,20 @@ namespace pgbckctl {
 
     void setProfileMaxRate(std::string const& max_rate);
 
+    void setProfileCompressLevel(std::string const& level);
+
+    void setProfileCompressWorkers(std::string const& workers);
+
+    void setProfileParallelWriters(std::string const& writers);
+
+    void setProfileIncremental(bool const& incremental);
+
+    void setProfileServerCompression(bool const& server_compression);
+
+    void setProfileAdaptiveRate(bool const& adaptive_rate);
+
+    void setProfileDeduplicate(bool const& deduplicate);
+
     std::shared_ptr<BackupProfileDescr> getBackupProfileDescr();
 
     void setProfileBackupLabel(std::string const& label);
@@ -959,6 +1191,8 @@ namespace pgbckctl {
 
     void setStreamingForceXLOGPositionRestart( bool const& restart );
 
+    void pushStreamArchiveName( std::string const& archive_name );
+
     OutputFormatType getOutputFormat();
 
     CatalogDescr& operator=(CatalogDescr& source);
@@ -984,9 +1218,53 @@ namespace pgbckctl {
     bool manifest           = false;
     std::string manifest_checksums = "CRC32C";
 
+    /*
+     * Compression level and number of compression worker
+     * threads, 0 uses the defaults of the compression method.
+     */
+    int compress_level   = 0;
+    int compress_workers = 0;
+
+    /*
+     * Number of threads writing tablespace archives of
+     * streamed basebackups, 0 writes them from the receiving
+     * process directly.
+     */
+    int parallel_writers = 0;
+
+    /*
+     * Request incremental basebackups relative to the newest
+     * basebackup in the archive (PostgreSQL 17 and above).
+     */
+    bool incremental = false;
+
+    /*
+     * Let the server compress the tablespace archives
+     * (PostgreSQL 15 and above), the archive stores them as received.
+     */
+    bool server_compression = false;
+
+    /*
+     * Enforce max_rate ourselves and throttle the basebackup
+     * further while WAL streams of the archive host lag behind.
+     */
+    bool adaptive_rate = false;
+
+    /*
+     * Store tablespace archives deduplicated in the chunk
+     * store of the archive, see DedupArchiveFile.
+     */
+    bool deduplicate = false;
+
     static BackupProfileCompressType compressionType(std::string type) noexcept(false);
     static std::string compressionType(BackupProfileCompressType type) noexcept(false);
 
+    /*
+     * Returns the highest compression level supported by
+     * the specified compression type, 0 if it doesn't support levels.
+     */
+    static int maxCompressionLevel(BackupProfileCompressType type);
+
   };
 
   /**
@@ -1079,6 +1357,19 @@ namespace pgbckctl {
     int used_profile = -1;
     int pg_version_num;
 
+    /*
+     * ID of the basebackup an incremental basebackup was
+     * taken against, -1 for full basebackups.
+     */
+    int parent_id = -1;
+
+    /*
+     * Compression of the tablespace archives stored for this
+     * basebackup, regardless whether they were compressed by
+     * the server or by ourselves.
+     */
+    BackupProfileCompressType compress_type = BACKUP_COMPRESS_TYPE_NONE;
+
     /**
      * Static const specifiers for status flags.
      */
@@ -1127,6 +1418,193 @@ namespace pgbckctl {
 
     std::string latest_finished = "";
 
+    /* Materialised statistics, see ArchiveStatsDescr */
+    unsigned long long wal_bytes = 0;
+    unsigned long long wal_segments = 0;
+    std::string oldest_xlogpos = "";
+    std::string newest_xlogpos = "";
+    unsigned long long backup_bytes = 0;
+
+  };
+
+  /*
+   * Materialised statistics of an archive, stored in the
+   * archive_stats catalog table. WAL statistics are maintained by the
+   * WAL streamer for every completed segment and by retention, the
+   * size of the basebackups whenever a basebackup is finalized or deleted.
+   *
+   * Sizes are physical sizes on disk, so compressed WAL segments
+   * and basebackups count with their compressed size. The XLOG positions
+   * are the start of the oldest and the end of the newest segment in
+   * the archive.
+   */
+  class ArchiveStatsDescr {
+  public:
+    int archive_id = -1;
+
+    unsigned long long wal_bytes = 0;
+    unsigned long long wal_segments = 0;
+    std::string oldest_xlogpos = "";
+    std::string newest_xlogpos = "";
+    unsigned long long backup_bytes = 0;
+
+    std::string updated = "";
+
+  };
+
+  /*
+   * A job the launcher starts periodically for an archive, stored
+   * in the schedule catalog table. There's at most one schedule
+   * per archive and job type.
+   *
+   * interval and jitter are in seconds. The next run is scheduled
+   * interval seconds after the previous one, delayed by a random
+   * amount of up to jitter seconds. Among jobs which are due, the one
+   * with the highest priority is started first. next_run and
+   * last_run are empty as long as the schedule wasn't picked up
+   * by a launcher, or didn't run yet.
+   */
+  class ScheduleDescr {
+  public:
+    int id = -1;
+    int archive_id = -1;
+
+    /* Only set by BackupCatalog::getSchedules() */
+    std::string archive_name = "";
+
+    ScheduleJobType type = SCHEDULE_BASEBACKUP;
+
+    /* Backup profile for basebackups, empty for the default profile */
+    std::string profile_name = "";
+
+    unsigned int interval = 0;
+    unsigned int jitter = 0;
+    int priority = 0;
+
+    std::string next_run = "";
+    std::string last_run = "";
+    std::string created = "";
+
+    /**
+     * Catalog representation of a job type.
+     */
+    static std::string typeName(ScheduleJobType type);
+
+    /**
+     * Job type of its catalog representation, throws
+     * if unknown.
+     */
+    static ScheduleJobType typeFromName(std::string name);
+
+  };
+
+  /*
+   * S3-compatible object storage an archive is uploaded to, stored
+   * in the archive_storage catalog table. There's at most one per archive.
+   *
+   * endpoint is the URL of the storage service, e.g.
+   * https://s3.eu-central-1.amazonaws.com. Objects are addressed path-style
+   * below it as <bucket>/<prefix><path relative to the archive directory>.
+   * A file:// endpoint names a local directory the bucket is created in,
+   * e.g. a mounted network filesystem. Credentials aren't stored in the
+   * catalog, see S3StorageClient.
+   *
+   * Files are uploaded by parallel workers in parts of part_size bytes,
+   * limited to max_rate kilobytes per second in total, 0 means unlimited.
+   */
+  class ArchiveStorageDescr {
+  public:
+    int archive_id = -1;
+
+    /* Only set by BackupCatalog::getArchiveStorage() */
+    std::string archive_name = "";
+
+    std::string endpoint = "";
+    std::string bucket = "";
+    std::string prefix = "";
+    std::string region = "us-east-1";
+
+    unsigned int parallel = 4;
+    unsigned long long part_size = 16ULL * 1024 * 1024;
+    unsigned int max_rate = 0;
+
+    std::string created = "";
+
+  };
+
+  /*
+   * A finished WAL segment or basebackup file queued for upload to
+   * the object storage of its archive, stored in the upload catalog
+   * table. path is the local path of the file, object_key its key
+   * within the bucket. basebackup_id is -1 for WAL segments.
+   *
+   * upload_id is the ID of the multipart upload in progress, if any,
+   * attempts the number of times the upload was started.
+   */
+  class UploadDescr {
+  public:
+    int id = -1;
+    int archive_id = -1;
+
+    /* Only set by BackupCatalog::getUploads() */
+    std::string archive_name = "";
+
+    UploadKind kind = UPLOAD_WAL;
+    int basebackup_id = -1;
+    std::string path = "";
+    std::string object_key = "";
+    unsigned long long size = 0;
+
+    UploadStatus status = UPLOAD_PENDING;
+    std::string upload_id = "";
+    unsigned int attempts = 0;
+    std::string last_error = "";
+
+    std::string queued = "";
+    std::string updated = "";
+
+    /**
+     * Catalog representations of upload kinds and states,
+     * the *FromName() variants throw if unknown.
+     */
+    static std::string kindName(UploadKind kind);
+    static UploadKind kindFromName(std::string name);
+    static std::string statusName(UploadStatus status);
+    static UploadStatus statusFromName(std::string name);
+
+  };
+
+  /*
+   * Result of verifying the contents of a basebackup
+   * against its backup manifest.
+   */
+  class BaseBackupVerificationResult {
+  public:
+    int basebackup_id = -1;
+    std::string archive_name = "";
+
+    /* number of threads used to read the archives */
+    unsigned int workers = 0;
+
+    /* true if CRC32C checksums were calculated by CPU instructions */
+    bool crc32c_hardware = false;
+
+    /* false if the basebackup doesn't have a manifest */
+    bool manifest_found = false;
+
+    unsigned long long files_checked = 0;
+    unsigned long long bytes_checked = 0;
+    unsigned long long wal_segments_checked = 0;
+
+    /*
+     * Problems found, each one is a pair of the affected
+     * file or WAL segment and a message.
+     */
+    std::vector<std::pair<std::string, std::string>> errors;
+    std::vector<std::pair<std::string, std::string>> warnings;
+
+    bool ok() { return this->errors.empty(); }
+
   };
 
   /**
@@ -1198,6 +1676,7 @@ namespace pgbckctl {
 
     RESTORE_BASEBACKUP_BY_ID,    /* restore a basebackup identified by its ID */
     RESTORE_BASEBACKUP_BY_NAME,  /* restore a basebackup identified by its name */
+    RESTORE_BASEBACKUP_BY_TARGET, /* basebackup chosen for a recovery target */
     RESTORE_BASEBACKUP_BY_UNDEF  /* descriptor not defined yet */
 
   } RestoreDescrIdentificationType;
@@ -1230,6 +1709,8 @@ namespace pgbckctl {
 
     RestoreDescrIdentificationType type = RESTORE_BASEBACKUP_BY_UNDEF;
 
+    ~RestoreDescrID();
+
     void getId(int &id);
     void getId(std::string &name);
 
@@ -1280,6 +1761,7 @@ namespace pgbckctl {
     RestoreDescr();
     RestoreDescr(std::string bbname);
     RestoreDescr(int id);
+    RestoreDescr(RestoreTargetType target_type, std::string target);
     virtual ~RestoreDescr();
 
     /* Descriptor basebackup identification */
@@ -1288,6 +1770,28 @@ namespace pgbckctl {
     std::shared_ptr<BaseBackupDescr> basebackup = nullptr;
     std::shared_ptr<BackupProfileDescr> profile = nullptr;
 
+    /**
+     * Directory the data directory of the basebackup
+     * is restored to (TO DIRECTORY).
+     */
+    std::string target_directory = "";
+
+    /**
+     * Recovery target the basebackup is chosen for, if
+     * id.type is RESTORE_BASEBACKUP_BY_TARGET. target holds the
+     * timestamp or the XLOG position, target_timeline is the
+     * timeline to recover, 0 selects the newest one.
+     */
+    RestoreTargetType target_type = RESTORE_TARGET_NONE;
+    std::string target = "";
+    unsigned int target_timeline = 0;
+
+    /**
+     * Set by RESTORE ... PREVIEW, just print the restore
+     * plan and don't restore anything.
+     */
+    bool preview = false;
+
     /**
      * Tablespace Mapping Mode.
      *
@@ -25,6 +25,18 @@ namespace pgbckctl {
 
   };
 
+  /**
+   * Listings an OutputFormatter can print incrementally,
+   * see OutputFormatter::beginList().
+   */
+  typedef enum {
+
+    OUTPUT_LIST_BASEBACKUPS,
+    OUTPUT_LIST_WORKERS,
+    OUTPUT_LIST_STREAMS
+
+  } OutputListType;
+
   /**
    * This is an abstract base class for output formatting
    *
@@ -62,6 +74,10 @@ namespace pgbckctl {
     /* Internal reference to output format options */
     std::shared_ptr<OutputFormatConfiguration> config = nullptr;
 
+    /* Listing currently printed and number of rows printed so far */
+    OutputListType list_type = OUTPUT_LIST_BASEBACKUPS;
+    unsigned long long list_rows = 0;
+
   public:
 
     OutputFormatter(std::shared_ptr<OutputFormatConfiguration> config) {};
@@ -80,6 +96,8 @@ namespace pgbckctl {
                         std::ostringstream &output) = 0;
     virtual void nodeAs(std::vector<shm_worker_area> &slots,
                         std::ostringstream &output) = 0;
+    virtual void nodeAs(std::vector<shm_stream_stats> &streams,
+                        std::ostringstream &output) = 0;
     virtual void nodeAs(std::vector<std::shared_ptr<ConnectionDescr>> connections,
                         std::ostringstream &output) = 0;
     virtual void nodeAs(std::vector<std::shared_ptr<RetentionDescr>> &retentionList,
@@ -98,12 +116,42 @@ namespace pgbckctl {
                         std::ostringstream &output) = 0;
     virtual void nodeAs(std::shared_ptr<StatCatalogArchive> stat,
                         std::ostringstream &output) = 0;
+    virtual void nodeAs(std::shared_ptr<BaseBackupVerificationResult> result,
+                        std::ostringstream &output) = 0;
     virtual void nodeAs(std::shared_ptr<std::list<directory_entry>> fileList,
                         std::ostringstream &output) = 0;
+    virtual void nodeAs(std::vector<std::shared_ptr<ScheduleDescr>> &schedules,
+                        std::ostringstream &output) = 0;
+    virtual void nodeAs(std::vector<std::shared_ptr<UploadDescr>> &uploads,
+                        std::ostringstream &output) = 0;
     static void nodeAs(std::exception &e,
                        std::ostringstream &output,
                        std::string output_type);
 
+    /*
+     * Incremental output of listings.
+     *
+     * A listing is started by beginList(), followed by a row() call
+     * for each item and finished by endList(). Every row is written to
+     * the output stream as soon as it is passed in, so listings are
+     * printed with constant memory, no matter how many items they
+     * have, e.g. basebackups read from a BaseBackupCursor. The
+     * nodeAs() methods for vectors of these items are implemented
+     * on top of this.
+     */
+    virtual void beginList(OutputListType type, std::ostream &output) = 0;
+    virtual void row(std::shared_ptr<BaseBackupDescr> basebackup,
+                     std::ostream &output) = 0;
+    virtual void row(shm_worker_area &worker, std::ostream &output) = 0;
+    virtual void row(shm_stream_stats &stats, std::ostream &output) = 0;
+    virtual void endList(std::ostream &output) = 0;
+
+    /**
+     * Prints all basebackups returned by the specified cursor.
+     */
+    virtual void streamAs(std::shared_ptr<BaseBackupCursor> cursor,
+                          std::ostream &output);
+
     /**
      * Static factory method, returns an instance of
      * OutputFormatter for the specified output format.
@@ -122,17 +170,20 @@ namespace pgbckctl {
   class ConsoleOutputFormatter : public OutputFormatter {
   private:
 
+    /* Basebackup listing requested with VERBOSE */
+    bool verbose = false;
+
     /**
-     * Internal method to list backups non-verbose
+     * Internal method to print a basebackup non-verbose
      */
-    void listBackups(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
-                     std::ostringstream &output);
+    void backupRow(std::shared_ptr<BaseBackupDescr> basebackup,
+                   std::ostream &output);
 
     /**
-     * Internal method to list backups verbose
+     * Internal method to print a basebackup verbose
      */
-    void listBackupsVerbose(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
-                            std::ostringstream &output);
+    void backupRowVerbose(std::shared_ptr<BaseBackupDescr> basebackup,
+                          std::ostream &output);
 
     /**
      * Output archive information in full or filtered mode.
@@ -153,12 +204,21 @@ namespace pgbckctl {
                            std::shared_ptr<CatalogDescr> catalog_descr);
     virtual ~ConsoleOutputFormatter();
 
+    virtual void beginList(OutputListType type, std::ostream &output);
+    virtual void row(std::shared_ptr<BaseBackupDescr> basebackup,
+                     std::ostream &output);
+    virtual void row(shm_worker_area &worker, std::ostream &output);
+    virtual void row(shm_stream_stats &stats, std::ostream &output);
+    virtual void endList(std::ostream &output);
+
     virtual void nodeAs(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
                         std::ostringstream &output);
     virtual void nodeAs(std::shared_ptr<RetentionDescr> retentionDescr,
                         std::ostringstream &output);
     virtual void nodeAs(std::vector<shm_worker_area> &slots,
                         std::ostringstream &output);
+    virtual void nodeAs(std::vector<shm_stream_stats> &streams,
+                        std::ostringstream &output);
     virtual void nodeAs(std::vector<std::shared_ptr<ConnectionDescr>> connections,
                         std::ostringstream &output);
     virtual void nodeAs(std::vector<std::shared_ptr<RetentionDescr>> &retentionList,
@@ -177,13 +237,25 @@ namespace pgbckctl {
                         std::ostringstream &output);
     virtual void nodeAs(std::shared_ptr<StatCatalogArchive> stat,
                         std::ostringstream &output);
+    virtual void nodeAs(std::shared_ptr<BaseBackupVerificationResult> result,
+                        std::ostringstream &output);
     virtual void nodeAs(std::shared_ptr<std::list<directory_entry>> fileList,
                         std::ostringstream &output);
+    virtual void nodeAs(std::vector<std::shared_ptr<ScheduleDescr>> &schedules,
+                        std::ostringstream &output);
+    virtual void nodeAs(std::vector<std::shared_ptr<UploadDescr>> &uploads,
+                        std::ostringstream &output);
 
   };
 
   class JsonOutputFormatter : public OutputFormatter {
-  private:
+  protected:
+
+    /* Write JSON indented over several lines */
+    bool pretty = true;
+
+    /* Basebackup listing requested with VERBOSE */
+    bool verbose = false;
 
     /**
      * Internal method to convert a RetentionDescr instance
@@ -192,16 +264,24 @@ namespace pgbckctl {
     boost::property_tree::ptree toPtree(std::shared_ptr<RetentionDescr> retentionDescr);
 
     /**
-     * Internal method to list backups verbose
+     * Internal methods to convert listing items
+     * to their json ptree representation.
      */
-    void listBackupsVerbose(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
-                            std::ostringstream &output);
+    boost::property_tree::ptree toPtree(std::shared_ptr<BaseBackupDescr> basebackup);
+    boost::property_tree::ptree toPtree(shm_worker_area &worker);
+    boost::property_tree::ptree toPtree(shm_stream_stats &stats);
+
+    /**
+     * Resets the listing state for a new listing of the specified
+     * type. Throws a CCatalogIssue if the listing can't be printed.
+     */
+    void prepareList(OutputListType type);
 
     /**
-     * Internal method to list backups non-verbose
+     * Writes a listing item, separated from the previous one.
      */
-    void listBackups(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
-                     std::ostringstream &output);
+    virtual void writeRow(boost::property_tree::ptree &node,
+                          std::ostream &output);
 
     /**
      * Output archive information in full or filtered mode.
@@ -228,12 +308,21 @@ namespace pgbckctl {
                         std::shared_ptr<CatalogDescr> catalog_descr);
     virtual ~JsonOutputFormatter();
 
+    virtual void beginList(OutputListType type, std::ostream &output);
+    virtual void row(std::shared_ptr<BaseBackupDescr> basebackup,
+                     std::ostream &output);
+    virtual void row(shm_worker_area &worker, std::ostream &output);
+    virtual void row(shm_stream_stats &stats, std::ostream &output);
+    virtual void endList(std::ostream &output);
+
     virtual void nodeAs(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
                         std::ostringstream &output);
     virtual void nodeAs(std::shared_ptr<RetentionDescr> retentionDescr,
                         std::ostringstream &output);
     virtual void nodeAs(std::vector<shm_worker_area> &slots,
                             std::ostringstream &output);
+    virtual void nodeAs(std::vector<shm_stream_stats> &streams,
+                        std::ostringstream &output);
     virtual void nodeAs(std::vector<std::shared_ptr<ConnectionDescr>> connections,
                         std::ostringstream &output);
     virtual void nodeAs(std::vector<std::shared_ptr<RetentionDescr>> &retentionList,
@@ -252,9 +341,41 @@ namespace pgbckctl {
                         std::ostringstream &output);
     virtual void nodeAs(std::shared_ptr<StatCatalogArchive> stat,
                         std::ostringstream &output);
+    virtual void nodeAs(std::shared_ptr<BaseBackupVerificationResult> result,
+                        std::ostringstream &output);
     virtual void nodeAs(std::shared_ptr<std::list<directory_entry>> fileList,
                         std::ostringstream &output);
+    virtual void nodeAs(std::vector<std::shared_ptr<ScheduleDescr>> &schedules,
+                        std::ostringstream &output);
+    virtual void nodeAs(std::vector<std::shared_ptr<UploadDescr>> &uploads,
+                        std::ostringstream &output);
+
+
+  };
+
+  /**
+   * Newline delimited JSON (output.format=ndjson).
+   *
+   * Listings are printed as one JSON object per item and line, without
+   * an enclosing document, so they can be consumed item by item while
+   * they're printed. Everything else is printed as a single line JSON
+   * document.
+   */
+  class JsonLinesOutputFormatter : public JsonOutputFormatter {
+  protected:
+
+    virtual void writeRow(boost::property_tree::ptree &node,
+                          std::ostream &output);
+
+  public:
+
+    JsonLinesOutputFormatter(std::shared_ptr<OutputFormatConfiguration> config,
+                             std::shared_ptr<BackupCatalog> catalog,
+                             std::shared_ptr<CatalogDescr> catalog_descr);
+    virtual ~JsonLinesOutputFormatter();
 
+    virtual void beginList(OutputListType type, std::ostream &output);
+    virtual void endList(std::ostream &output);
 
   };
 
@@ -61,7 +61,7 @@ namespace pgbckctl {
      * unchanged!
      */
     virtual void move(std::vector<std::shared_ptr<BaseBackupDescr>> &target,
-                      std::vector<std::shared_ptr<BaseBackupDescr>> source,
+                      const std::vector<std::shared_ptr<BaseBackupDescr>> &source,
                       std::shared_ptr<BaseBackupDescr> bbdescr,
                       unsigned int index);
 
@@ -128,6 +128,16 @@ namespace pgbckctl {
                                       unsigned int timeline,
                                       unsigned int wal_segment_size);
 
+    /*
+     * Removes all basebackups from the deletion list of the given
+     * cleanup descriptor, which are the parent of an incremental basebackup
+     * not being deleted as well. The remaining list is ordered by
+     * descending basebackup ID, so incremental basebackups are deleted before
+     * their parents. Returns the number of basebackups kept.
+     */
+    static unsigned int keepIncrementalParents(shared_ptr<BackupCleanupDescr> cleanupDescr,
+                                               shared_ptr<BackupCatalog> catalog);
+
     /**
      * Factory method, returns a Retention object instances identified
      * by retention_name from the catalog, implementing
@@ -152,7 +162,16 @@ namespace pgbckctl {
      * basebackups. Returns the number of basebackups
      * which got the retention policy applied.
      */
-    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> list) = 0;
+    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> &list) = 0;
+
+    /**
+     * Returns a string identifying the outcome of this rule on
+     * the given list of basebackups without applying it. RetentionPlanner
+     * uses it to tell whether a cached retention plan is still valid.
+     * The default is the rule itself, which is sufficient for rules
+     * depending on nothing but the list of basebackups.
+     */
+    virtual std::string planStamp(std::vector<std::shared_ptr<BaseBackupDescr>> &list);
 
     /**
      * Returns the string representation of a retention rule. Must be implemented
@@ -242,7 +261,7 @@ namespace pgbckctl {
      * basebackups. Returns the number of basebackups
      * which got the retention policy applied.
      */
-    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> list);
+    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> &list);
 
     /**
      * Set regular expression to evaluate by a LabelRetention instance.
@@ -277,6 +296,14 @@ namespace pgbckctl {
     /* Set interval expression */
     void setIntervalExpr(std::string value);
 
+    /*
+     * Returns true if the stopped timestamp of the specified
+     * basebackup exceeds the threshold computed from the retention
+     * interval, see BackupCatalog::retentionDateTimeThreshold().
+     */
+    bool exceeds(std::shared_ptr<BaseBackupDescr> bbdescr,
+                 const std::string &threshold);
+
   public:
 
     DateTimeRetention();
@@ -304,7 +331,14 @@ namespace pgbckctl {
      * basebackups. Returns the number of basebackups
      * which got the retention policy applied.
      */
-    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> list);
+    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> &list);
+
+    /**
+     * The outcome of a datetime rule changes as time goes by, so
+     * the stamp also carries the number of basebackups currently
+     * exceeding the retention interval.
+     */
+    virtual std::string planStamp(std::vector<std::shared_ptr<BaseBackupDescr>> &list);
 
     /**
      * asString() returns the Retention Rule string representation.
@@ -388,7 +422,7 @@ namespace pgbckctl {
      * basebackups. Returns the number of basebackups
      * which got the retention policy applied.
      */
-    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> list);
+    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> &list);
 
     /**
      * Returns the string representation of a CountRetention policy value.
@@ -449,7 +483,7 @@ namespace pgbckctl {
      * basebackups. Returns the number of basebackups
      * which got the retention policy applied.
      */
-    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> list);
+    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> &list);
 
     /**
      * Returns the string representation of this rule.
@@ -468,6 +502,76 @@ namespace pgbckctl {
     virtual void init();
   };
 
+  /**
+   * TieringRetention policy class.
+   *
+   * Implements MOVE OLDER THAN <interval>: ready basebackups
+   * stopped before the interval are elected to be moved to the cold
+   * tier of the archive, see RetentionPlanner::migrate(). Nothing is
+   * deleted. The newest ready basebackup always stays in the archive
+   * directory, as do basebackups in progress or in use by a worker.
+   *
+   * The WAL cleanup offsets of the migrate descriptor are those of
+   * the basebackups staying in the archive directory, so WAL is moved
+   * only if no basebackup left there needs it.
+   */
+  class TieringRetention : public Retention {
+  private:
+
+    /* Assigned retention interval expression */
+    RetentionIntervalDescr interval;
+
+    /*
+     * Returns true if the basebackup lives outside of the
+     * archive directory, so it was moved already.
+     */
+    bool migrated(std::shared_ptr<BaseBackupDescr> bbdescr);
+
+  public:
+
+    TieringRetention();
+    TieringRetention(std::string datetime_expr,
+                     std::shared_ptr<CatalogDescr> archiveDescr,
+                     std::shared_ptr<BackupCatalog> catalog);
+    TieringRetention(std::shared_ptr<RetentionRuleDescr> rule);
+
+    virtual ~TieringRetention();
+
+    /**
+     * Initialize a TieringRetention instance with a given
+     * cleanup descriptor.
+     */
+    virtual void init(std::shared_ptr<BackupCleanupDescr> prevCleanupDescr);
+
+    /**
+     * Initialize internal state of a TieringRetention policy.
+     */
+    virtual void init();
+
+    /**
+     * Elects basebackups for migration into the migrate
+     * descriptor of the cleanup descriptor. Returns their number.
+     */
+    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> &list);
+
+    /**
+     * Like a datetime rule, the stamp also carries the
+     * number of basebackups exceeding the interval.
+     */
+    virtual std::string planStamp(std::vector<std::shared_ptr<BaseBackupDescr>> &list);
+
+    /**
+     * Returns the string representation of this rule.
+     */
+    virtual std::string asString();
+
+    /**
+     * Set the retention rule type. Only RETENTION_MOVE_OLDER_BY_DATETIME
+     * is accepted.
+     */
+    virtual void setRetentionRuleType(const RetentionRuleId ruleType);
+  };
+
   /**
    * A PinRetention is to some degree a special
    * kind of retention. Instead of deleting and cleaning
@@ -624,7 +728,7 @@ namespace pgbckctl {
      * is returned. Can throw if catalog database access violations
      * or errors occur (mainly CArchiveIssue exceptions).
      */
-    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> list);
+    virtual unsigned int apply(std::vector<std::shared_ptr<BaseBackupDescr>> &list);
 
     /*
      * After having called apply(), returns the number of
@@ -0,0 +1,235 @@
+#ifndef __HAVE_RETENTIONPLAN__
+#define __HAVE_RETENTIONPLAN__
+
+#include <retention.hxx>
+#include <fs-archive.hxx>
+#include <fs-copy.hxx>
+
+namespace pgbckctl {
+
+  /**
+   * A RetentionPlan describes what applying a retention policy
+   * to an archive would do, without doing it: the basebackups to
+   * drop, the WAL cleanup offsets per timeline and the WAL files
+   * this removes. Plans are created by RetentionPlanner::plan() and
+   * can be printed (APPLY RETENTION POLICY ... PREVIEW) or passed
+   * to RetentionPlanner::execute().
+   */
+  class RetentionPlan {
+  public:
+
+    /* Retention policy and archive this plan was made for */
+    std::string policy = "";
+    int archive_id = -1;
+
+    /*
+     * Fingerprint of the basebackups and rule outcomes the
+     * plan was computed from, see RetentionPlanner::plan().
+     */
+    std::string fingerprint = "";
+
+    /*
+     * Final cleanup descriptor, with the basebackups to drop
+     * in deletion order and the WAL cleanup offsets. The
+     * basebackupMode is NO_BASEBACKUPS if there's nothing to do.
+     */
+    std::shared_ptr<BackupCleanupDescr> cleanupDescr = nullptr;
+
+    /* Number of basebackups kept for incremental basebackups */
+    unsigned int kept_parents = 0;
+
+    /* Number of basebackups kept since they're not uploaded yet */
+    unsigned int kept_uploads = 0;
+
+    /* WAL segment size used for WAL cleanup */
+    unsigned long long wal_segment_size = 0;
+
+    /* WAL files which would be removed, as of planning time */
+    XLogRemovalResult wal;
+
+    /*
+     * Cold tier directory of the archive, only set if a rule
+     * elected something to move there.
+     */
+    std::string cold_directory = "";
+
+    /*
+     * Estimated size of the basebackups to move and the
+     * WAL files which would be moved, as of planning time.
+     */
+    unsigned long long migrate_bytes = 0;
+    XLogRemovalResult wal_moved;
+
+    /*
+     * Estimated size of the basebackups to drop, summed
+     * up from the tablespace sizes recorded in the catalog.
+     */
+    unsigned long long basebackup_bytes = 0;
+
+    /* True if this plan was returned from the plan cache */
+    bool cached = false;
+
+    /**
+     * Returns true if the plan doesn't drop anything.
+     */
+    virtual bool empty();
+
+    /**
+     * Returns true if the plan moves basebackups or WAL
+     * to the cold tier.
+     */
+    virtual bool migrates();
+
+    /**
+     * Estimated number of bytes freed by this plan.
+     */
+    virtual unsigned long long bytesFreed();
+
+  };
+
+  /**
+   * A RetentionPlanner evaluates all rules of a retention policy
+   * against the basebackups of an archive in a single planning pass.
+   *
+   * The basebackup list is fetched once and every rule is applied
+   * to it in turn, each one continuing with the cleanup descriptor of
+   * the rule before. Dependencies of incremental basebackups are
+   * resolved once for the final list and the WAL to remove is
+   * determined by a single dry run over the log directory.
+   *
+   * Plans are cached within the process per catalog, archive and
+   * policy. Before a cached plan is reused, its fingerprint is compared
+   * against the current state of the archive: the ID, status, pin
+   * state, lock state, timestamps and XLOG positions of all basebackups
+   * together with the outcome of every rule (see Retention::planStamp())
+   * and the pending uploads of the archive. Only if something changed,
+   * the rules are evaluated again.
+   *
+   * Files queued for upload to the object storage of the archive and
+   * not uploaded yet are never removed: their basebackups are kept and
+   * the WAL cleanup offsets are lowered to keep their WAL segments.
+   * Basebackups with pending uploads aren't moved to the cold tier
+   * either, the upload refers to their current location.
+   *
+   * The caller is responsible for transaction handling, a plan
+   * should be executed within the transaction it was made in.
+   */
+  class RetentionPlanner : public BackupLockInfoAggregator {
+  private:
+
+    std::shared_ptr<BackupCatalog> catalog = nullptr;
+    std::shared_ptr<CatalogDescr> archiveDescr = nullptr;
+    std::string policy = "";
+
+    /* Uploads of the archive not done yet, read by plan() */
+    std::vector<std::shared_ptr<UploadDescr>> pending_uploads;
+
+    /**
+     * Key of plans for this archive and policy within the plan cache.
+     */
+    virtual std::string cacheKey();
+
+    /**
+     * Computes the fingerprint of the specified basebackup
+     * list and rule set.
+     */
+    virtual std::string fingerprint(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
+                                    std::vector<std::shared_ptr<Retention>> &rules);
+
+    /**
+     * Evaluates the rules and fills in the specified plan.
+     */
+    virtual void evaluate(std::shared_ptr<RetentionPlan> plan,
+                          std::vector<std::shared_ptr<BaseBackupDescr>> &list,
+                          std::vector<std::shared_ptr<Retention>> &rules);
+
+    /**
+     * Removes basebackups with pending uploads from the
+     * deletion list of the cleanup descriptor. Returns their number.
+     */
+    virtual unsigned int keepUploadingBasebackups(std::shared_ptr<BackupCleanupDescr> cleanupDescr);
+
+    /**
+     * Lowers the WAL cleanup offsets of the cleanup descriptor, so
+     * WAL segments with pending uploads are kept.
+     */
+    virtual void keepUploadingWAL(std::shared_ptr<BackupCleanupDescr> cleanupDescr,
+                                  unsigned long long wal_segment_size);
+
+    /**
+     * Completes the migrate descriptor of the plan's cleanup
+     * descriptor, if a rule elected anything to move: looks up the
+     * cold tier and determines what would be moved.
+     */
+    virtual void evaluateMigration(std::shared_ptr<RetentionPlan> plan);
+
+    /**
+     * Moves a basebackup to the cold tier, see migrate(). Returns
+     * false if it got locked in the meantime and was left alone.
+     */
+    virtual bool migrateBasebackup(std::shared_ptr<BaseBackupDescr> bbdescr,
+                                   path cold_base);
+
+    /**
+     * Accounts the WAL removed by an executed plan in
+     * the archive statistics.
+     */
+    virtual void updateArchiveStats(std::shared_ptr<RetentionPlan> plan,
+                                    std::shared_ptr<ArchiveLogDirectory> archiveLogDir);
+
+  public:
+
+    RetentionPlanner(std::shared_ptr<BackupCatalog> catalog,
+                     std::shared_ptr<CatalogDescr> archiveDescr,
+                     std::string policy);
+    virtual ~RetentionPlanner();
+
+    /**
+     * Returns the plan for applying the retention policy to the
+     * archive, either computed from scratch or from the plan cache.
+     * Throws a CArchiveIssue if the policy doesn't contain a rule.
+     */
+    virtual std::shared_ptr<RetentionPlan> plan();
+
+    /**
+     * Executes the specified plan: drops its basebackups from the
+     * catalog and the archive directory, then removes the WAL
+     * not needed anymore in one go. Updates plan->wal with what was
+     * actually removed.
+     *
+     * If a basebackup of the plan got locked in the meantime, e.g. by
+     * a worker streaming from it, the archive is planned again and the
+     * new plan is executed instead.
+     */
+    virtual void execute(std::shared_ptr<RetentionPlan> plan);
+
+    /**
+     * Moves the basebackups and WAL of the plan to the cold tier
+     * of the archive. Must be called outside of a catalog transaction,
+     * since copying takes long: every basebackup is copied with a
+     * BackupCopyManager and synced, then its location is updated
+     * in a transaction of its own before the original is removed.
+     * WAL segments are moved by ArchiveLogDirectory::moveXLogs().
+     *
+     * Restores and retention find a moved basebackup through its
+     * catalog entry and moved WAL through its symlink, so the archive
+     * stays a single logical archive. Returns the number of basebackups
+     * moved, plan->wal_moved is updated with the WAL actually moved.
+     */
+    virtual unsigned int migrate(std::shared_ptr<RetentionPlan> plan);
+
+    /**
+     * Drops the cached plan for this archive and policy.
+     */
+    virtual void invalidate();
+
+    /**
+     * Drops all cached plans of this process.
+     */
+    static void clearCache();
+
+  };
+
+}
+
+#endif
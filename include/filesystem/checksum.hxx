@@ -0,0 +1,141 @@
+#ifndef __HAVE_CHECKSUM_HXX__
+#define __HAVE_CHECKSUM_HXX__
+
+/* here for pg_backup_ctl.hxx */
+#include <common.hxx>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#ifdef PG_BACKUP_CTL_HAS_OPENSSL
+#include <openssl/evp.h>
+#endif
+
+namespace pgbckctl {
+
+  /**
+   * CRC-32C (Castagnoli), the CRC variant PostgreSQL uses for
+   * WAL records and backup manifests.
+   *
+   * Uses the SSE 4.2 CRC32 instruction if the CPU supports it, or
+   * the ARMv8 CRC extension if we're compiled for it. Otherwise
+   * a slicing-by-8 table implementation is used.
+   */
+  class CRC32C {
+  public:
+
+    /**
+     * Returns true if update() uses CPU instructions.
+     */
+    static bool hardwareAccelerated();
+
+    /**
+     * Continues the CRC over the specified data. Like with
+     * INIT_CRC32C() and FIN_CRC32C() in PostgreSQL, the caller
+     * initializes crc with 0xFFFFFFFF and finalizes it by XOR'ing
+     * 0xFFFFFFFF.
+     */
+    static uint32_t update(uint32_t crc, const void *data, size_t len);
+
+    /**
+     * Returns the finalized CRC-32C of the specified data.
+     */
+    static uint32_t compute(const void *data, size_t len);
+
+  };
+
+  /**
+   * Base class of file checksums as recorded in a
+   * PostgreSQL backup manifest.
+   */
+  class FileChecksum {
+  public:
+
+    virtual ~FileChecksum();
+
+    /**
+     * Adds the specified data to the checksum.
+     */
+    virtual void update(const char *buf, size_t len) = 0;
+
+    /**
+     * Returns the checksum as a hex string, formatted the
+     * same way PostgreSQL writes it into a backup manifest. The
+     * instance can't be updated afterwards.
+     */
+    virtual std::string final() = 0;
+
+    /**
+     * Returns the manifest name of the checksum
+     * algorithm, e.g. CRC32C.
+     */
+    virtual std::string algorithm() = 0;
+
+    /**
+     * Returns true if the specified manifest checksum
+     * algorithm is supported.
+     */
+    static bool supported(std::string algorithm);
+
+    /**
+     * Returns a new checksum instance for the specified manifest
+     * checksum algorithm. Throws a CArchiveIssue if the
+     * algorithm isn't supported.
+     */
+    static std::shared_ptr<FileChecksum> create(std::string algorithm);
+
+    /**
+     * Hex encodes the specified bytes.
+     */
+    static std::string toHex(const unsigned char *data, size_t len);
+
+  };
+
+  /**
+   * CRC32C file checksum.
+   */
+  class CRC32CChecksum : public FileChecksum {
+  private:
+
+    uint32_t crc = 0xFFFFFFFF;
+
+  public:
+
+    CRC32CChecksum();
+    virtual ~CRC32CChecksum();
+
+    virtual void update(const char *buf, size_t len);
+    virtual std::string final();
+    virtual std::string algorithm();
+
+  };
+
+#ifdef PG_BACKUP_CTL_HAS_OPENSSL
+
+  /**
+   * SHA-2 file checksums (SHA224, SHA256, SHA384 and SHA512)
+   * via OpenSSL.
+   */
+  class SHAChecksum : public FileChecksum {
+  private:
+
+    EVP_MD_CTX *ctx = NULL;
+    std::string name;
+
+  public:
+
+    SHAChecksum(std::string algorithm);
+    virtual ~SHAChecksum();
+
+    virtual void update(const char *buf, size_t len);
+    virtual std::string final();
+    virtual std::string algorithm();
+
+  };
+
+#endif
+
+}
+
+#endif
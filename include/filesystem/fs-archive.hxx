@@ -3,8 +3,17 @@
 #include <boost/filesystem.hpp>
 #include <boost/iostreams/device/file_descriptor.hpp>
 #include <boost/regex.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <common.hxx>
 #include <daemon.hxx>
@@ -20,6 +29,18 @@
 #include <zlib.h>
 #endif
 
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+#include <zstd.h>
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+#include <lz4frame.h>
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZMA
+#include <lzma.h>
+#endif
+
 using namespace pgbckctl;
 using namespace std;
 using namespace boost::filesystem;
@@ -29,7 +50,10 @@ using namespace boost::iostreams;
 namespace pgbckctl {
 
   /* Forwarded class definitions */
+  class BackupCatalog;
   class ArchiveLogDirectory;
+  class WALSegmentIndex;
+  struct WALSegmentIndexEntry;
 
   /**
    * Encodes XLOG LSN information
@@ -51,13 +75,47 @@ namespace pgbckctl {
     WAL_SEGMENT_COMPLETE = 1,
     WAL_SEGMENT_PARTIAL,
     WAL_SEGMENT_COMPLETE_COMPRESSED,
-    WAL_SEGMENT_PARTIAL_COMPRESSED, /* NOTE: XLOG segments are gzipped only! */
+    WAL_SEGMENT_PARTIAL_COMPRESSED, /* gzip, zstd or lz4 */
     WAL_SEGMENT_TLI_HISTORY_FILE,
     WAL_SEGMENT_TLI_HISTORY_FILE_COMPRESSED,
     WAL_SEGMENT_INVALID_FILENAME,
     WAL_SEGMENT_UNKNOWN
   } WALSegmentFileStatus;
 
+  /**
+   * Layout of an archive log/ directory.
+   *
+   * WAL_LOG_LAYOUT_FLAT stores all files directly within log/.
+   *
+   * WAL_LOG_LAYOUT_SHARDED stores XLOG segment files within
+   * log/<timeline>/<high 8 hex digits of the segment>/ instead, both
+   * components taken from the segment filename. TLI history files
+   * stay within log/ in both layouts.
+   */
+  typedef enum {
+    WAL_LOG_LAYOUT_FLAT,
+    WAL_LOG_LAYOUT_SHARDED
+  } WALLogLayout;
+
+  /**
+   * Result of ArchiveLogDirectory::removeXLogs() and
+   * ArchiveLogDirectory::moveXLogs().
+   *
+   * bytes is the sum of the file sizes (st_size) of the removed
+   * files, so compressed segments count with their compressed size.
+   * The space freed on disk can differ, e.g. for sparse or
+   * preallocated files. In dry-run mode nothing is removed, but files
+   * and bytes report what would have been removed.
+   */
+  typedef struct XLogRemovalResult {
+
+    bool dry_run = false;
+    unsigned long long files = 0;
+    unsigned long long bytes = 0;
+    std::vector<std::string> filenames;
+
+  } XLogRemovalResult;
+
   /**
    * Verification codes returned by
    * StreamingBaseBackupDirectory::verify().
@@ -86,198 +144,1530 @@ namespace pgbckctl {
   };
 
   /**
-   * Base class for archive files
+   * Base class for archive files
+   */
+  class BackupFile {
+
+  protected:
+
+    bool compressed = false;
+    bool available = false;
+    bool temporary = false;
+
+    /** boost::filesystem handle */
+    path   handle;
+
+    /**
+     * Current internal position in file.
+     * initialized by read(), lseek() and write().
+     */
+    off_t currpos = 0;
+
+  public:
+
+    BackupFile(path handle);
+    virtual ~BackupFile();
+
+    virtual void setAvailable(bool avail);
+    virtual void setCompressed(bool compressed);
+
+    virtual bool isCompressed() { return this->compressed; };
+    virtual bool isAvailable() { return this->available; };
+
+    virtual void open() = 0;
+    virtual void close() = 0;
+    virtual void fsync() = 0;
+    virtual bool isOpen() = 0;
+    virtual bool exists();
+    virtual void rename(path& newname) = 0;
+    virtual void setOpenMode(std::string mode) = 0;
+    virtual std::string getOpenMode() = 0;
+    virtual size_t write(const char *buf, size_t len) = 0;
+    virtual size_t read(char *buf, size_t len) = 0;
+    virtual void remove() = 0;
+    virtual size_t size();
+    virtual off_t lseek(off_t offset, int whence) = 0;
+    virtual off_t current_position();
+    virtual void setTemporary();
+    virtual bool isTemporary();
+
+    /**
+     * Finishes the current compressed block of a file opened for
+     * writing, so that decompression can start at the returned
+     * physical file offset later on, see seekSyncPoint().
+     * Returns -1 if the file doesn't support this, which
+     * is the default.
+     */
+    virtual off_t syncPoint();
+
+    /**
+     * Positions a file opened for reading at a physical offset
+     * formerly returned by syncPoint(). Reading continues with the
+     * data written after the sync point. The default throws a
+     * CArchiveIssue.
+     */
+    virtual void seekSyncPoint(off_t offset);
+
+    /**
+     * Returns the filename as a string.
+     */
+    virtual std::string getFileName();
+
+    /**
+     * Returns the full qualified path of the
+     * allocated file.
+     */
+    virtual std::string getFilePath();
+
+  };
+
+  /**
+   * Derived from BackupFile, this implements a basic file
+   * in the backup archive.
+   */
+  class ArchiveFile : public BackupFile {
+  private:
+    FILE  *fp = NULL;
+
+    /*
+     * Sets the mode the file is opened. The default
+     * is binary read only.
+     */
+    std::string mode = "rb";
+
+    bool opened = false;
+
+    /*
+     * If false, the file stream is opened unbuffered. See
+     * setBuffered().
+     */
+    bool buffered = true;
+
+    /*
+     * If true, the file descriptor is switched to O_DIRECT
+     * after opening. See setDirectIO().
+     */
+    bool direct_io = false;
+
+  protected:
+
+    /*
+     * Reserves len bytes via posix_fallocate(), returns its
+     * result. See allocate().
+     */
+    virtual int fallocate(size_t len);
+
+  public:
+
+    /*
+     * Alignment of buffers, file offsets and lengths
+     * required for I/O on files opened with O_DIRECT.
+     */
+    const static size_t DIRECT_IO_ALIGNMENT = 4096;
+
+    ArchiveFile(path pathHandle);
+    virtual ~ArchiveFile();
+
+    virtual bool isCompressed();
+    virtual void setCompressed(bool compressed);
+    virtual bool isOpen();
+
+    /*
+     * Opens the file.
+     */
+    virtual void open();
+
+    virtual size_t write(const char *buf, size_t len);
+    virtual size_t read(char *buf, size_t len);
+    virtual void rename(path& newname);
+    virtual void fsync();
+    virtual void close();
+
+    virtual void remove();
+
+    /*
+     * Set open mode for this file. The default is "rb".
+     */
+    virtual void setOpenMode(std::string mode);
+
+    /**
+     * Returns the mode an ArchiveFile instance was opened with.
+     */
+    virtual std::string getOpenMode();
+
+    /*
+     * Disables stdio buffering if set to false, so write() passes
+     * the caller's buffer straight to the kernel without copying it into
+     * the stream buffer first. Must be called before open().
+     */
+    virtual void setBuffered(bool buffered);
+
+    /*
+     * Requests I/O bypassing the page cache with O_DIRECT, must be
+     * called before open(). Reads and writes through the file descriptor
+     * must then be aligned to DIRECT_IO_ALIGNMENT, stdio read() and write()
+     * must not be used. If the filesystem doesn't support O_DIRECT, open()
+     * falls back to cached I/O, see isDirectIO().
+     */
+    virtual void setDirectIO(bool direct_io);
+
+    /*
+     * Returns true if the opened file uses O_DIRECT.
+     */
+    virtual bool isDirectIO();
+
+    /*
+     * Returns the internal file stream pointer.
+     */
+    virtual FILE* getFileHandle();
+
+    /*
+     * Returns the internal filedescriptor referenced by
+     * this object.
+     */
+    virtual int getFileno();
+
+    /*
+     * Seek into the file.
+     */
+    virtual off_t lseek(off_t offset, int whence);
+
+    /*
+     * Reserves len bytes of disk space for the opened file,
+     * starting at offset 0. Uses posix_fallocate() if the
+     * underlying filesystem supports it, otherwise the file
+     * is padded with zeroes. The file position is reset to
+     * the start of the file afterwards.
+     */
+    virtual void allocate(size_t len);
+
+    /*
+     * Flushes file data to disk via fdatasync(), skipping
+     * metadata not required to retrieve the data.
+     */
+    virtual void datasync();
+
+    /*
+     * Starts writeback of the specified file range via
+     * sync_file_range() without waiting for it. This neither flushes
+     * volatile disk caches nor commits metadata, so nothing is durable
+     * before a later datasync() or fsync(). A no-op on platforms
+     * without sync_file_range().
+     */
+    virtual void startWriteback(off_t offset, off_t nbytes);
+
+    /*
+     * Every offset of an uncompressed file is a sync point,
+     * so this just returns the current physical position.
+     */
+    virtual off_t syncPoint();
+    virtual void seekSyncPoint(off_t offset);
+
+  };
+
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+
+  /**
+   * A compressed archive file, using gzip
+   */
+  class CompressedArchiveFile : public BackupFile {
+  private:
+    gzFile zh = NULL;
+    FILE  *fp = NULL;
+
+    /*
+     * Sets the mode the file is opened. The default
+     * is binary read only.
+     */
+    std::string mode = "rb";
+
+    /*
+     * Gzip compression level, 0 uses the zlib default.
+     */
+    int compressionLevel = 0;
+    bool opened = false;
+  public:
+
+    CompressedArchiveFile(path pathHandle);
+    virtual ~CompressedArchiveFile();
+
+    virtual bool isCompressed();
+    virtual void setCompressed(bool compressed);
+    virtual bool isOpen();
+
+    /**
+     * Opens a compressed gzip handle.
+     */
+    virtual void open();
+    virtual void close();
+    virtual size_t write(const char *buf, size_t len);
+    virtual size_t read(char *buf, size_t len);
+    virtual void fsync();
+    virtual void rename(path& newname);
+    virtual off_t lseek(off_t offset, int whence);
+    virtual void remove();
+
+    /**
+     * Set open mode for this file. The default is "rb"
+     */
+    virtual void setOpenMode(std::string mode);
+
+    /**
+     * Returns the mode this file instance was opened with.
+     */
+    virtual std::string getOpenMode();
+
+    /*
+     * Returns the internal file stream pointer.
+     */
+    virtual FILE* getFileHandle();
+
+    virtual gzFile getGZHandle();
+
+    /*
+     * Extended methods.
+     */
+    virtual void setCompressionLevel(int level);
+
+    /*
+     * Finishes the current gzip member. Writing continues with
+     * a new member, which gzread() reads as part of the same stream.
+     */
+    virtual off_t syncPoint();
+    virtual void seekSyncPoint(off_t offset);
+  };
+
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+
+  /**
+   * A compressed archive file, using libzstd streaming
+   * compression in-process.
+   *
+   * ZstdArchiveFile is either opened for writing ("w" or "a" open
+   * modes) or reading, but not both. Seeking isn't supported, except
+   * rewinding a freshly opened file.
+   */
+  class ZstdArchiveFile : public BackupFile {
+  private:
+    FILE *fp = NULL;
+    ZSTD_CCtx *cctx = NULL;
+    ZSTD_DCtx *dctx = NULL;
+
+    /*
+     * Compressed data buffer, used for both
+     * reading and writing.
+     */
+    std::vector<char> buffer;
+
+    /*
+     * Read position into buffer when decompressing.
+     */
+    ZSTD_inBuffer input = { NULL, 0, 0 };
+
+    std::string mode = "rb";
+
+    /*
+     * Compression level, 0 uses the libzstd default.
+     */
+    int compressionLevel = 0;
+
+    /*
+     * Number of libzstd compression worker threads,
+     * 0 compresses within the calling thread.
+     */
+    int compressionWorkers = 0;
+
+    bool opened = false;
+    bool writing = false;
+
+    /*
+     * Pushes all data pending in the compression stream
+     * to the file. If end is true, the current frame is finished.
+     */
+    virtual void flushStream(bool end);
+
+  public:
+
+    ZstdArchiveFile(path pathHandle);
+    virtual ~ZstdArchiveFile();
+
+    virtual bool isCompressed();
+    virtual void setCompressed(bool compressed);
+    virtual bool isOpen();
+
+    virtual void open();
+    virtual void close();
+    virtual size_t write(const char *buf, size_t len);
+    virtual size_t read(char *buf, size_t len);
+
+    /**
+     * Flushes the compression stream and fsyncs
+     * the file.
+     */
+    virtual void fsync();
+
+    /**
+     * Finishes and closes an opened file before renaming it. The file
+     * handle stays closed afterwards.
+     */
+    virtual void rename(path& newname);
+    virtual off_t lseek(off_t offset, int whence);
+    virtual void remove();
+
+    virtual void setOpenMode(std::string mode);
+    virtual std::string getOpenMode();
+
+    /**
+     * Sets the compression level, must be called before open().
+     */
+    virtual void setCompressionLevel(int level);
+
+    /**
+     * Sets the number of worker threads libzstd uses
+     * to compress the stream, must be called before open().
+     * 0 compresses within the calling thread. Throws
+     * if libzstd was built without multithreading support.
+     */
+    virtual void setCompressionWorkers(int workers);
+
+    /*
+     * Finishes the current zstd frame. Writing continues with
+     * a new frame, which is decompressed independently.
+     */
+    virtual off_t syncPoint();
+    virtual void seekSyncPoint(off_t offset);
+  };
+
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+
+  /**
+   * A compressed archive file, using the liblz4 frame API
+   * in-process.
+   *
+   * Same restrictions as ZstdArchiveFile apply.
+   */
+  class LZ4ArchiveFile : public BackupFile {
+  private:
+    FILE *fp = NULL;
+    LZ4F_cctx *cctx = NULL;
+    LZ4F_dctx *dctx = NULL;
+
+    /*
+     * Compressed data buffer, used for both
+     * reading and writing.
+     */
+    std::vector<char> buffer;
+
+    /*
+     * Read offsets into buffer when decompressing.
+     */
+    size_t input_pos = 0;
+    size_t input_size = 0;
+
+    std::string mode = "rb";
+
+    /*
+     * Compression level, 0 uses the fast default.
+     */
+    int compressionLevel = 0;
+
+    bool opened = false;
+    bool writing = false;
+
+    /*
+     * Writes len bytes of compressed data from
+     * our internal buffer to the file.
+     */
+    virtual void writeBuffer(size_t len);
+
+  public:
+
+    LZ4ArchiveFile(path pathHandle);
+    virtual ~LZ4ArchiveFile();
+
+    virtual bool isCompressed();
+    virtual void setCompressed(bool compressed);
+    virtual bool isOpen();
+
+    virtual void open();
+    virtual void close();
+    virtual size_t write(const char *buf, size_t len);
+    virtual size_t read(char *buf, size_t len);
+
+    /**
+     * Flushes the compression stream and fsyncs
+     * the file.
+     */
+    virtual void fsync();
+
+    /**
+     * Finishes and closes an opened file before renaming it. The file
+     * handle stays closed afterwards.
+     */
+    virtual void rename(path& newname);
+    virtual off_t lseek(off_t offset, int whence);
+    virtual void remove();
+
+    virtual void setOpenMode(std::string mode);
+    virtual std::string getOpenMode();
+
+    /**
+     * Sets the compression level, must be called before open().
+     */
+    virtual void setCompressionLevel(int level);
+
+    /*
+     * Finishes the current lz4 frame and starts a new
+     * one, which is decompressed independently.
+     */
+    virtual off_t syncPoint();
+    virtual void seekSyncPoint(off_t offset);
+  };
+
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZMA
+
+  /**
+   * A compressed archive file, using liblzma to write
+   * xz streams in-process.
+   *
+   * With more than one worker, the multithreaded liblzma
+   * encoder is used, which splits the input into independent
+   * blocks compressed in parallel.
+   *
+   * Same restrictions as ZstdArchiveFile apply.
+   */
+  class XZArchiveFile : public BackupFile {
+  private:
+    FILE *fp = NULL;
+    lzma_stream strm = LZMA_STREAM_INIT;
+
+    /*
+     * Compressed data buffer, used for both
+     * reading and writing.
+     */
+    std::vector<char> buffer;
+
+    std::string mode = "rb";
+
+    /*
+     * Compression preset, 0-9.
+     */
+    int compressionLevel = 0;
+
+    /*
+     * Number of encoder threads, 0 or 1 use the
+     * single threaded encoder.
+     */
+    int compressionWorkers = 0;
+
+    bool opened = false;
+    bool writing = false;
+
+    /*
+     * Set when reading hit the end of the compressed stream.
+     */
+    bool stream_end = false;
+
+    /*
+     * Runs the encoder with the specified action until
+     * all pending input is consumed, writing compressed
+     * output to the file.
+     */
+    virtual void code(lzma_action action);
+
+    /*
+     * Returns a readable description of a liblzma error code.
+     */
+    static std::string errorMessage(lzma_ret rc);
+
+  public:
+
+    XZArchiveFile(path pathHandle);
+    virtual ~XZArchiveFile();
+
+    virtual bool isCompressed();
+    virtual void setCompressed(bool compressed);
+    virtual bool isOpen();
+
+    virtual void open();
+    virtual void close();
+    virtual size_t write(const char *buf, size_t len);
+    virtual size_t read(char *buf, size_t len);
+
+    /**
+     * Flushes the compression stream and fsyncs
+     * the file.
+     */
+    virtual void fsync();
+
+    /**
+     * Finishes and closes an opened file before renaming it. The file
+     * handle stays closed afterwards.
+     */
+    virtual void rename(path& newname);
+    virtual off_t lseek(off_t offset, int whence);
+    virtual void remove();
+
+    virtual void setOpenMode(std::string mode);
+    virtual std::string getOpenMode();
+
+    /**
+     * Sets the compression preset (0-9), must be called before open().
+     */
+    virtual void setCompressionLevel(int level);
+
+    /**
+     * Sets the number of encoder threads, must be called before open().
+     */
+    virtual void setCompressionWorkers(int workers);
+  };
+
+#endif
+
+  /*
+   * Operations queued for an ArchiveWriterPool writer thread.
+   */
+  typedef enum {
+    ARCHIVE_WRITE_DATA,
+    ARCHIVE_WRITE_FSYNC,
+    ARCHIVE_WRITE_CLOSE
+  } ArchiveWriteOp;
+
+  /*
+   * A single request queued for a writer of an ArchiveWriterPool.
+   */
+  struct ArchiveWriteRequest {
+
+    ArchiveWriteOp op = ARCHIVE_WRITE_DATA;
+    std::shared_ptr<BackupFile> file = nullptr;
+    std::vector<char> data;
+
+  };
+
+  /*
+   * Number of bytes a single ArchiveWriterPool writer might have
+   * queued before the receiver is parked.
+   */
+#define ARCHIVE_WRITER_MAX_QUEUED (64 * 1024 * 1024)
+
+  /*
+   * ArchiveWriterPool runs a fixed number of writer threads, each
+   * with its own request queue. Every archive file of a streamed
+   * basebackup is bound to a single writer, so the requests for one
+   * file are executed in order, while different tablespace archives
+   * are written and compressed concurrently.
+   *
+   * Since the BASE_BACKUP protocol delivers all tablespaces one after
+   * another over a single connection, this decouples the receiver from
+   * compression and disk I/O: a writer still finishes a tablespace archive
+   * while the receiver already streams the next one into another writer.
+   *
+   * The queue of a writer is bounded by ARCHIVE_WRITER_MAX_QUEUED
+   * bytes. An error in any writer stops the pool, it is rethrown as a
+   * CArchiveIssue into the receiver on its next call to push(),
+   * drain() or stop().
+   */
+  class ArchiveWriterPool {
+  private:
+
+    /*
+     * Per writer state, protected by the pool mutex.
+     */
+    struct ArchiveWriter {
+
+      std::deque<ArchiveWriteRequest> queue;
+      size_t queued_bytes = 0;
+      bool busy = false;
+      std::shared_ptr<std::thread> thread = nullptr;
+
+    };
+
+    std::vector<ArchiveWriter> writers;
+
+    bool running = false;
+    bool failed = false;
+
+    /* Error message of a failed writer */
+    std::string error_message = "";
+
+    std::mutex pool_mutex;
+    std::condition_variable writer_cond;
+    std::condition_variable receiver_cond;
+
+    /*
+     * Writer thread main loop.
+     */
+    virtual void work(unsigned int writer_id);
+
+    /*
+     * Throws a CArchiveIssue in case a writer failed, caller
+     * must hold the pool mutex.
+     */
+    virtual void checkFailed();
+
+  public:
+
+    ArchiveWriterPool(unsigned int num_writers);
+    virtual ~ArchiveWriterPool();
+
+    /**
+     * Starts the writer threads.
+     */
+    virtual void start();
+
+    /**
+     * Number of writer threads.
+     */
+    virtual unsigned int size();
+
+    /**
+     * Enqueues a request for the specified writer. Data requests
+     * block as long as the writer has ARCHIVE_WRITER_MAX_QUEUED bytes
+     * queued.
+     */
+    virtual void push(unsigned int writer_id,
+                      ArchiveWriteRequest &request);
+
+    /**
+     * Waits until all writers have executed their queued requests.
+     */
+    virtual void drain();
+
+    /**
+     * Drains all queues and stops the writer threads.
+     */
+    virtual void stop();
+
+  };
+
+  /*
+   * A BackupFile, whose writes are executed asynchronously
+   * by a writer of an ArchiveWriterPool.
+   *
+   * write() copies the data into the queue of the writer, fsync()
+   * and close() are queued as well and don't wait for the writer. This
+   * way, finalizing a tablespace archive doesn't stall the receiver.
+   * Everything else waits for the pool to drain before it's forwarded
+   * to the wrapped file.
+   */
+  class PipelinedArchiveFile : public BackupFile {
+  private:
+
+    std::shared_ptr<BackupFile> file = nullptr;
+    std::shared_ptr<ArchiveWriterPool> pool = nullptr;
+    unsigned int writer_id = 0;
+
+    bool opened = false;
+
+  public:
+
+    PipelinedArchiveFile(std::shared_ptr<BackupFile> file,
+                         std::shared_ptr<ArchiveWriterPool> pool,
+                         unsigned int writer_id);
+    virtual ~PipelinedArchiveFile();
+
+    virtual bool isCompressed();
+    virtual bool isOpen();
+
+    virtual void open();
+    virtual void close();
+    virtual void fsync();
+    virtual size_t write(const char *buf, size_t len);
+    virtual size_t read(char *buf, size_t len);
+    virtual void rename(path& newname);
+    virtual off_t lseek(off_t offset, int whence);
+    virtual void remove();
+    virtual size_t size();
+
+    virtual void setOpenMode(std::string mode);
+    virtual std::string getOpenMode();
+  };
+
+  /*
+   * Token bucket limiting the throughput of archive writes.
+   *
+   * consume() takes the specified number of bytes from the bucket and
+   * sleeps as long as the bucket is in debt, so callers never get
+   * ahead of the configured rate by more than the burst size. A rate
+   * of 0 doesn't limit anything but still counts the consumed bytes,
+   * so callers can measure the throughput achieved. The rate can be
+   * changed at any time, also from other threads.
+   */
+  class ArchiveRateLimiter {
+  private:
+
+    std::mutex mtx;
+
+    /* bytes per second, 0 means unlimited */
+    uint64_t rate = 0;
+
+    /* available bytes, negative if in debt */
+    double tokens = 0;
+
+    std::chrono::steady_clock::time_point last_refill;
+
+    /* total number of bytes passed through consume() */
+    std::atomic<uint64_t> consumed_bytes { 0 };
+
+    /* Max number of bytes the bucket can hold */
+    double burst();
+
+  public:
+
+    ArchiveRateLimiter(uint64_t bytes_per_second = 0);
+    virtual ~ArchiveRateLimiter();
+
+    /**
+     * Sets the rate in bytes per second, 0 disables the limit.
+     */
+    virtual void setRate(uint64_t bytes_per_second);
+
+    /**
+     * Returns the current rate in bytes per second.
+     */
+    virtual uint64_t getRate();
+
+    /**
+     * Takes len bytes from the bucket, blocks until they
+     * are covered by the configured rate.
+     */
+    virtual void consume(size_t len);
+
+    /**
+     * Total number of bytes consumed so far.
+     */
+    virtual uint64_t consumed();
+
+  };
+
+  /*
+   * A BackupFile whose writes are throttled by an ArchiveRateLimiter
+   * before they are forwarded to the wrapped file. Several files can
+   * share one limiter, limiting their aggregated throughput.
+   */
+  class ThrottledArchiveFile : public BackupFile {
+  private:
+
+    std::shared_ptr<BackupFile> file = nullptr;
+    std::shared_ptr<ArchiveRateLimiter> limiter = nullptr;
+
+  public:
+
+    ThrottledArchiveFile(std::shared_ptr<BackupFile> file,
+                         std::shared_ptr<ArchiveRateLimiter> limiter);
+    virtual ~ThrottledArchiveFile();
+
+    virtual bool isCompressed();
+    virtual bool isOpen();
+
+    virtual void open();
+    virtual void close();
+    virtual void fsync();
+    virtual size_t write(const char *buf, size_t len);
+    virtual size_t read(char *buf, size_t len);
+    virtual void rename(path& newname);
+    virtual off_t lseek(off_t offset, int whence);
+    virtual void remove();
+    virtual size_t size();
+
+    virtual void setOpenMode(std::string mode);
+    virtual std::string getOpenMode();
+  };
+
+  /**
+   * A member of a tar archive, recorded by an ArchiveMemberIndex.
+   */
+  typedef struct archive_member_index_entry {
+
+    /* member name, including the ustar prefix */
+    std::string name;
+
+    /* tar typeflag of the member */
+    char type = '0';
+
+    /* offset of the member header within the tar stream */
+    off_t offset = 0;
+
+    /* size of the member contents */
+    size_t size = 0;
+
+    /*
+     * Physical file offset of the last sync point before
+     * the member header and its offset within the tar stream. Both
+     * are 0 if the archive must be read from its beginning.
+     */
+    off_t sync_offset = 0;
+    off_t sync_pos    = 0;
+
+  } ArchiveMemberIndexEntry;
+
+  /**
+   * Index of the members of a tar archive, stored in a sidecar
+   * file next to the archive. The index allows to extract single
+   * members without reading the whole archive before.
+   *
+   * The sidecar is a text file, one line per member:
+   *
+   * <type> <offset> <size> <sync offset> <sync pos> <name>
+   */
+  class ArchiveMemberIndex {
+  private:
+
+    std::vector<ArchiveMemberIndexEntry> entries;
+
+    /* member name -> position in entries */
+    std::unordered_map<std::string, size_t> names;
+
+  public:
+
+    ArchiveMemberIndex();
+    virtual ~ArchiveMemberIndex();
+
+    /**
+     * Returns the path of the index file for
+     * the specified archive file.
+     */
+    static path indexPath(path archive);
+
+    /**
+     * Decodes a numeric tar header field, either octal or
+     * in the base-256 encoding used for large values.
+     */
+    static size_t tarNumber(const char *field, size_t len);
+
+    /**
+     * Parses the specified 512 byte tar header into entry. Only name,
+     * type and size are set. Returns false if the header is a zero
+     * block marking the end of the archive, throws a CArchiveIssue if
+     * the header checksum is invalid.
+     */
+    static bool parseTarHeader(const char *header, ArchiveMemberIndexEntry &entry);
+
+    virtual void add(ArchiveMemberIndexEntry const& entry);
+    virtual size_t count();
+    virtual std::vector<ArchiveMemberIndexEntry> getEntries();
+
+    /**
+     * Looks up the specified member name. Returns false if
+     * the archive doesn't contain this member.
+     */
+    virtual bool lookup(std::string name, ArchiveMemberIndexEntry &entry);
+
+    /**
+     * Writes the index into the specified file and fsyncs it.
+     */
+    virtual void write(path indexfile);
+
+    /**
+     * Reads the entries from the specified index file, throws
+     * a CArchiveIssue if the file can't be read or is malformed.
+     */
+    virtual void read(path indexfile);
+
+    /**
+     * Copies the contents of the specified member from archive into
+     * target. archive must be opened for reading, target must be
+     * opened for writing. Returns the number of bytes copied.
+     */
+    virtual size_t extract(std::shared_ptr<BackupFile> archive,
+                           ArchiveMemberIndexEntry const& entry,
+                           std::shared_ptr<BackupFile> target);
+
+  };
+
+  /**
+   * A BackupFile receiving an uncompressed tar stream. Tar headers
+   * are parsed while writing the stream into the wrapped file, which
+   * might compress it, and each member is recorded in an
+   * ArchiveMemberIndex written when the file is closed.
+   *
+   * Every syncInterval bytes of the tar stream, the wrapped file is
+   * asked for a sync point before the next member header, so a member
+   * can be extracted by decompressing at most syncInterval bytes
+   * besides its contents.
+   */
+  class IndexedArchiveFile : public BackupFile {
+  private:
+
+    std::shared_ptr<BackupFile> file = nullptr;
+    ArchiveMemberIndex index;
+
+    /* collects the current tar header */
+    char header[512];
+    size_t header_fill = 0;
+
+    /* member contents and padding left before the next header */
+    size_t remaining = 0;
+
+    /* current offset in the tar stream */
+    off_t stream_pos = 0;
+
+    /* last sync point */
+    off_t sync_offset = 0;
+    off_t sync_pos    = 0;
+    bool can_sync = true;
+
+    /* end of archive seen */
+    bool eof = false;
+
+    bool opened = false;
+
+    size_t syncInterval = 4 * 1024 * 1024;
+
+    /* false if the stream doesn't look like a tar archive */
+    bool valid = true;
+
+    /*
+     * Records the member described by the
+     * completed header.
+     */
+    virtual void member();
+
+  public:
+
+    IndexedArchiveFile(std::shared_ptr<BackupFile> file);
+    virtual ~IndexedArchiveFile();
+
+    /**
+     * Number of tar stream bytes between sync points,
+     * 0 never requests one.
+     */
+    virtual void setSyncInterval(size_t interval);
+
+    virtual ArchiveMemberIndex getIndex();
+
+    virtual bool isCompressed();
+    virtual bool isOpen();
+
+    virtual void open();
+
+    /**
+     * Closes the wrapped file and writes the index next to it.
+     */
+    virtual void close();
+    virtual void fsync();
+    virtual size_t write(const char *buf, size_t len);
+    virtual size_t read(char *buf, size_t len);
+    virtual void rename(path& newname);
+    virtual off_t lseek(off_t offset, int whence);
+    virtual void remove();
+    virtual size_t size();
+
+    virtual void setOpenMode(std::string mode);
+    virtual std::string getOpenMode();
+  };
+
+  /**
+   * An independently decodable frame of a FramedArchiveFile. Decompression
+   * can start at compressed_offset, yielding the data starting at
+   * uncompressed_offset.
+   */
+  typedef struct compressed_frame {
+
+    uint64_t uncompressed_offset = 0;
+    uint64_t compressed_offset = 0;
+
+  } CompressedFrame;
+
+  /**
+   * A BackupFile wrapping a compressed file, which can be positioned
+   * at any uncompressed offset without decompressing everything before.
+   *
+   * When writing, the wrapped file is asked for a sync point every
+   * frameSize bytes of uncompressed data, so the file consists of
+   * independently decodable gzip members, zstd or lz4 frames. When the file
+   * is closed, a frame table recording the start of every frame is
+   * appended. The table is wrapped into something decompressors skip:
+   * a skippable frame for zstd and lz4, an empty gzip member carrying
+   * the table in its extra field for gzip. Such files are still
+   * decompressed by gzip, zstd and lz4 command line tools as before.
+   *
+   * When reading, lseek() looks up the frame containing the requested
+   * offset, positions the wrapped file at the frame start and decompresses
+   * at most one frame to get to the offset. This is what's needed to
+   * start streaming or restoring from an LSN within a compressed
+   * WAL segment. Files without a frame table, e.g. partial segments
+   * still being written or segments written by an older release, are
+   * positioned by decompressing from the start instead.
+   *
+   * gzip extra fields are limited to 64KB, which is enough for 4094 frames.
+   * If a gzip file has more frames, no frame table is written.
+   */
+  class FramedArchiveFile : public BackupFile {
+  private:
+
+    typedef enum {
+      FRAME_ENVELOPE_NONE,
+      FRAME_ENVELOPE_GZIP,
+      FRAME_ENVELOPE_SKIPPABLE
+    } FrameEnvelope;
+
+    std::shared_ptr<BackupFile> file = nullptr;
+
+    FrameEnvelope envelope = FRAME_ENVELOPE_NONE;
+
+    /* frame table, ordered by offsets */
+    std::vector<CompressedFrame> frames;
+
+    /* uncompressed size recorded in the frame table */
+    uint64_t total_size = 0;
+    bool has_table = false;
+
+    /* uncompressed bytes per frame when writing, 0 disables frames */
+    size_t frameSize = 0;
+
+    /* uncompressed offset of the current frame when writing */
+    off_t frame_start = 0;
+
+    bool opened = false;
+    bool writing = false;
+
+    /*
+     * Finishes the current frame of the wrapped file and
+     * records the next one.
+     */
+    virtual void finishFrame();
+
+    /*
+     * Appends the frame table to the closed wrapped file.
+     */
+    virtual void writeFrameTable();
+
+    /*
+     * Decompresses and discards len bytes.
+     */
+    virtual void skip(off_t len);
+
+    static FrameEnvelope envelopeFor(std::shared_ptr<BackupFile> file);
+    static FrameEnvelope envelopeFor(path file);
+
+    static bool readFrameTable(path file, FrameEnvelope envelope,
+                               std::vector<CompressedFrame> &frames,
+                               uint64_t &total_size);
+
+  public:
+
+    /**
+     * Magic number of the skippable frame holding the frame table,
+     * valid for both zstd and lz4.
+     */
+    const static uint32_t SKIPPABLE_FRAME_MAGIC = 0x184D2A5B;
+
+    /**
+     * Wraps file. frameSize is the number of uncompressed bytes
+     * per frame when writing, 0 just records a frame table for sync
+     * points explicitly requested with syncPoint().
+     */
+    FramedArchiveFile(std::shared_ptr<BackupFile> file, size_t frameSize = 0);
+    virtual ~FramedArchiveFile();
+
+    /**
+     * Returns a FramedArchiveFile for reading the specified file,
+     * the wrapped file is chosen by the extension of the filename.
+     */
+    static std::shared_ptr<FramedArchiveFile> forReading(path file);
+
+    /**
+     * Reads the frame table of a compressed file without opening it. Returns
+     * false if the file doesn't have one. total_size is set to the uncompressed
+     * size of the file.
+     */
+    static bool readFrameTable(path file,
+                               std::vector<CompressedFrame> &frames,
+                               uint64_t &total_size);
+
+    /**
+     * Returns the frame table, read by open() when reading or
+     * recorded so far when writing.
+     */
+    virtual std::vector<CompressedFrame> getFrames();
+
+    /**
+     * True if a file opened for reading has a frame table.
+     */
+    virtual bool hasFrameTable();
+
+    /**
+     * Positions a file opened for reading at the specified LSN,
+     * which must belong to the WAL segment stored in this file.
+     */
+    virtual off_t seekLSN(XLogRecPtr lsn, unsigned long long wal_segment_size);
+
+    virtual bool isCompressed();
+    virtual bool isOpen();
+
+    virtual void open();
+
+    /**
+     * Closes the wrapped file and appends the frame table.
+     */
+    virtual void close();
+    virtual void fsync();
+    virtual size_t write(const char *buf, size_t len);
+    virtual size_t read(char *buf, size_t len);
+
+    /**
+     * Closes an opened file, including writing its
+     * frame table, before renaming it.
+     */
+    virtual void rename(path& newname);
+
+    /**
+     * Positions a file opened for reading, SEEK_SET and SEEK_CUR
+     * are supported, SEEK_END only with a frame table. Uncompressed files
+     * are positioned directly.
+     */
+    virtual off_t lseek(off_t offset, int whence);
+    virtual void remove();
+    virtual size_t size();
+
+    /**
+     * Finishes the current frame, regardless of the frame size.
+     */
+    virtual off_t syncPoint();
+    virtual void seekSyncPoint(off_t offset);
+
+    virtual void setOpenMode(std::string mode);
+    virtual std::string getOpenMode();
+  };
+
+  /**
+   * Content addressed store for the chunks of deduplicated
+   * tablespace archives, see DedupArchiveFile.
+   *
+   * Each chunk is a file named by the SHA-256 of its uncompressed
+   * contents, followed by the suffix of the compression it is stored
+   * with, e.g. chunks/3f/3fa4...e1.zst. This name is the chunk ID. A
+   * chunk is written once and shared by every basebackup of the archive
+   * containing the same data.
+   *
+   * How many basebackups reference a chunk is recorded in the
+   * catalog, see BackupCatalog::referenceChunks(). Chunks are removed
+   * by sweep() only. Writers hold a shared flock() on the store
+   * directory, sweep() an exclusive one, see lock().
    */
-  class BackupFile {
+  class DedupChunkStore {
+  private:
 
-  protected:
+    path directory;
 
-    bool compressed = false;
-    bool available = false;
-    bool temporary = false;
+    /* makes the names of temporary chunk files unique */
+    static std::atomic<unsigned long long> temp_seq;
 
-    /** boost::filesystem handle */
-    path   handle;
+    static std::shared_ptr<BackupFile> chunkFile(path file,
+                                                 BackupProfileCompressType compression,
+                                                 int compression_level = 0);
+
+    /* sweep() with the exclusive lock held */
+    virtual unsigned long long sweepLocked(std::shared_ptr<BackupCatalog> catalog,
+                                           int archive_id);
+
+  public:
+
+    DedupChunkStore(path directory);
+    virtual ~DedupChunkStore();
 
     /**
-     * Current internal position in file.
-     * initialized by read(), lseek() and write().
+     * Returns the chunk store directory of the
+     * specified archive directory.
      */
-    off_t currpos = 0;
+    static path forArchive(path archiveDir);
 
-  public:
+    /**
+     * Returns true if chunks can be stored with the specified
+     * compression. Deduplication requires OpenSSL for hashing and
+     * in-process compression.
+     */
+    static bool supported(BackupProfileCompressType compression);
 
-    BackupFile(path handle);
-    virtual ~BackupFile();
+    /**
+     * Filename suffix of chunks stored with the
+     * specified compression.
+     */
+    static std::string suffix(BackupProfileCompressType compression);
 
-    virtual void setAvailable(bool avail);
-    virtual void setCompressed(bool compressed);
+    /**
+     * Compression of a chunk, derived from the suffix of its ID.
+     */
+    static BackupProfileCompressType compressionOf(std::string const& id);
 
-    virtual bool isCompressed() { return this->compressed; };
-    virtual bool isAvailable() { return this->available; };
+    /**
+     * Collects the IDs of the chunks referenced by the deduplicated
+     * tablespace archives in the specified basebackup directory.
+     */
+    static std::set<std::string> referencedChunks(path basebackup_dir);
 
-    virtual void open() = 0;
-    virtual void close() = 0;
-    virtual void fsync() = 0;
-    virtual bool isOpen() = 0;
-    virtual bool exists();
-    virtual void rename(path& newname) = 0;
-    virtual void setOpenMode(std::string mode) = 0;
-    virtual std::string getOpenMode() = 0;
-    virtual size_t write(const char *buf, size_t len) = 0;
-    virtual size_t read(char *buf, size_t len) = 0;
-    virtual void remove() = 0;
-    virtual size_t size();
-    virtual off_t lseek(off_t offset, int whence) = 0;
-    virtual off_t current_position();
-    virtual void setTemporary();
-    virtual bool isTemporary();
+    /**
+     * Releases the chunks referenced by a basebackup about to be
+     * deleted from the catalog, before its files are removed. Only
+     * ready basebackups hold references. If the archives of the
+     * basebackup can't be read, its chunks stay referenced.
+     */
+    static void release(std::shared_ptr<BackupCatalog> catalog,
+                        int archive_id,
+                        std::shared_ptr<BaseBackupDescr> basebackup);
+
+    virtual path getPath();
+    virtual path chunkPath(std::string const& id);
+    virtual bool exists(std::string const& id);
 
     /**
-     * Returns the filename as a string.
+     * Returns true if the store holds no chunks, neither committed
+     * ones nor ones of basebackups in progress.
      */
-    virtual std::string getFileName();
+    virtual bool empty();
 
     /**
-     * Returns the full qualified path of the
-     * allocated file.
+     * Takes a flock() on the store directory, operation is LOCK_SH or
+     * LOCK_EX, optionally with LOCK_NB. Returns the descriptor holding
+     * the lock, to be released by unlock(), or -1 if LOCK_NB was
+     * specified and the lock is held by someone else.
      */
-    virtual std::string getFilePath();
+    virtual int lock(int operation);
+    static void unlock(int fd);
+
+    /**
+     * Writes a chunk into a temporary file next to its final
+     * location and returns the path of the temporary file. The chunk
+     * doesn't exist before it is committed by commit().
+     */
+    virtual path write(std::string const& id,
+                       const char *buf,
+                       size_t len,
+                       int compression_level);
+
+    /**
+     * Syncs the specified temporary chunk files and renames them
+     * to their chunk IDs, then syncs their directories. A chunk
+     * committed by another basebackup in the meantime is replaced
+     * by the same contents.
+     */
+    virtual void commit(std::vector<std::pair<path, std::string>> const& pending);
+
+    /**
+     * Reads and decompresses the specified chunk into buf and checks
+     * its contents against the hash in its ID. Throws a CArchiveIssue
+     * if the chunk is missing or corrupted.
+     */
+    virtual void read(std::string const& id, std::vector<char> &buf);
+
+    /**
+     * Removes every chunk of the archive which isn't referenced by
+     * a basebackup in the catalog anymore, together with temporary
+     * files left over by aborted basebackups. Nothing is removed while
+     * a basebackup of the archive is in progress or a deduplicated
+     * archive is written into the store, since they might reuse chunks
+     * not referenced yet. The exclusive lock on the store is held
+     * until the sweep is done, so no writer starts meanwhile. Must be
+     * called within a catalog transaction. Returns the number of
+     * chunks removed.
+     */
+    virtual unsigned long long sweep(std::shared_ptr<BackupCatalog> catalog,
+                                     int archive_id);
 
   };
 
   /**
-   * Derived from BackupFile, this implements a basic file
-   * in the backup archive.
+   * A tablespace archive stored deduplicated in a DedupChunkStore.
+   *
+   * When writing, the tar stream is parsed like IndexedArchiveFile does.
+   * The contents of members of at least MIN_CHUNK_SIZE bytes are cut into
+   * chunks of CHUNK_SIZE bytes, counted from the start of the member. Relation
+   * segments are thus chunked along their block boundaries and an unchanged
+   * range of a relation results in the same chunk in every basebackup. Chunks
+   * not in the store yet are compressed and written there. Everything else,
+   * the tar headers, padding and small files, goes into the file itself,
+   * which is a recipe to rebuild the tar stream:
+   *
+   * "PGBCKDEDUP 1\n", the length of the chunk store directory and the
+   * directory, followed by records of a type byte and a 32 bit length. All
+   * numbers are big endian. 'L' records contain the next <length> bytes of
+   * the stream, 'C' records reference a chunk of <length> bytes by its ID,
+   * stored as a length byte and the ID. An 'E' record of 8 bytes, the
+   * 64 bit size of the whole stream, ends the recipe.
+   *
+   * When reading, the tar stream is rebuilt from the recipe and the
+   * chunks, every chunk checked against its hash. Readers thus see an
+   * uncompressed tar archive, though isCompressed() is true since the
+   * file itself can't be read as such.
    */
-  class ArchiveFile : public BackupFile {
+  class DedupArchiveFile : public BackupFile {
   private:
-    FILE  *fp = NULL;
 
-    /*
-     * Sets the mode the file is opened. The default
-     * is binary read only.
-     */
-    std::string mode = "rb";
+    /* the recipe */
+    std::shared_ptr<ArchiveFile> file = nullptr;
+    std::shared_ptr<DedupChunkStore> store = nullptr;
+
+    BackupProfileCompressType compression = BACKUP_COMPRESS_TYPE_NONE;
+    int compression_level = 0;
 
+    std::string mode = "rb";
     bool opened = false;
-  public:
+    bool writing = false;
 
-    ArchiveFile(path pathHandle);
-    virtual ~ArchiveFile();
+    /* shared lock on the chunk store while writing */
+    int store_lock = -1;
 
-    virtual bool isCompressed();
-    virtual void setCompressed(bool compressed);
-    virtual bool isOpen();
+    /* collects the current tar header */
+    char header[512];
+    size_t header_fill = 0;
 
-    /*
-     * Opens the file.
-     */
-    virtual void open();
+    /* contents and padding left of the current member */
+    size_t remaining = 0;
+    size_t padding = 0;
 
-    virtual size_t write(const char *buf, size_t len);
-    virtual size_t read(char *buf, size_t len);
-    virtual void rename(path& newname);
-    virtual void fsync();
-    virtual void close();
+    /* contents of the current member are chunked */
+    bool chunking = false;
 
-    virtual void remove();
+    /* end of archive seen or stream not understood, store the rest as is */
+    bool eof = false;
+
+    /* stream data not written into the recipe yet */
+    std::vector<char> literal;
+    std::vector<char> chunk;
+
+    /* written chunks not committed yet, see DedupChunkStore::commit() */
+    std::vector<std::pair<path, std::string>> pending;
+    std::unordered_set<std::string> pending_ids;
+
+    /* size of the whole stream */
+    uint64_t stream_size = 0;
+
+    /* chunk data written into the store and found there already */
+    uint64_t bytes_stored = 0;
+    uint64_t bytes_reused = 0;
+
+    /* current record when reading */
+    std::vector<char> data;
+    size_t data_pos = 0;
+    bool end = false;
 
     /*
-     * Set open mode for this file. The default is "rb".
+     * Looks at the completed tar header and decides
+     * how to store the member contents.
      */
-    virtual void setOpenMode(std::string mode);
+    virtual void member();
 
-    /**
-     * Returns the mode an ArchiveFile instance was opened with.
-     */
-    virtual std::string getOpenMode();
+    virtual void writeRecord(char type, uint32_t len, const char *buf, size_t buflen);
+    virtual void writeLiteral();
+    virtual void writeChunk();
+    virtual void commitChunks();
 
     /*
-     * Returns the internal file stream pointer.
+     * Reads the recipe header, returns the chunk store
+     * directory.
      */
-    virtual FILE* getFileHandle();
+    static path readHeader(std::shared_ptr<ArchiveFile> recipe);
 
     /*
-     * Returns the internal filedescriptor referenced by
-     * this object.
+     * Reads the next record of the recipe, the contents of 'L' and
+     * 'E' records into literal if set. len is the size of the stream
+     * data of the record. Returns false if the end record was read.
      */
-    virtual int getFileno();
+    static bool readRecord(std::shared_ptr<ArchiveFile> recipe,
+                           char &type, uint64_t &len, std::string &id,
+                           std::vector<char> *literal);
 
     /*
-     * Seek into the file.
+     * Makes the next record the current one when reading, returns
+     * false at the end of the stream.
      */
-    virtual off_t lseek(off_t offset, int whence);
+    virtual bool nextRecord();
 
-  };
+  public:
 
-#ifdef PG_BACKUP_CTL_HAS_ZLIB
+    /**
+     * Number of bytes per chunk, a multiple of the PostgreSQL block
+     * size. Much smaller chunks would deduplicate better, but
+     * store a file per chunk.
+     */
+    const static size_t CHUNK_SIZE = 1024 * 1024;
 
-  /**
-   * A compressed archive file, using gzip
-   */
-  class CompressedArchiveFile : public BackupFile {
-  private:
-    gzFile zh = NULL;
-    FILE  *fp = NULL;
+    /**
+     * Members smaller than this are stored within the recipe.
+     */
+    const static size_t MIN_CHUNK_SIZE = 8192;
 
-    /*
-     * Sets the mode the file is opened. The default
-     * is binary read only.
+    /**
+     * Number of written chunks synced and renamed at once.
      */
-    std::string mode = "rb";
+    const static size_t COMMIT_BATCH = 64;
 
-    /*
-     * Gzip compression level, default 9
+    /**
+     * Filename suffix of deduplicated archives.
      */
-    //    int compressionLevel = 9;
-    bool opened = false;
-  public:
+    static constexpr const char *SUFFIX = ".dedup";
 
-    CompressedArchiveFile(path pathHandle);
-    virtual ~CompressedArchiveFile();
+    /**
+     * Opens an existing deduplicated archive for reading.
+     */
+    DedupArchiveFile(path file);
+
+    /**
+     * Writes a new deduplicated archive, chunks are stored with the
+     * specified compression into store. The store is locked against
+     * DedupChunkStore::sweep() from open() until close().
+     */
+    DedupArchiveFile(path file,
+                     std::shared_ptr<DedupChunkStore> store,
+                     BackupProfileCompressType compression,
+                     int compression_level);
+    virtual ~DedupArchiveFile();
+
+    /**
+     * Adds the IDs of the chunks referenced by the specified
+     * deduplicated archive to ids.
+     */
+    static void chunks(path file, std::set<std::string> &ids);
+
+    /**
+     * Bytes of chunk data written into the store and bytes of chunk
+     * data found in the store already, when writing.
+     */
+    virtual uint64_t bytesStored();
+    virtual uint64_t bytesReused();
 
     virtual bool isCompressed();
-    virtual void setCompressed(bool compressed);
     virtual bool isOpen();
 
+    virtual void open();
+
     /**
-     * Opens a compressed gzip handle.
+     * Finishes the recipe and commits the chunks
+     * written, when writing.
      */
-    virtual void open();
     virtual void close();
+
+    /**
+     * Commits the chunks written so far and syncs the recipe.
+     */
+    virtual void fsync();
     virtual size_t write(const char *buf, size_t len);
     virtual size_t read(char *buf, size_t len);
-    virtual void fsync();
     virtual void rename(path& newname);
-    virtual off_t lseek(off_t offset, int whence);
-    virtual void remove();
 
     /**
-     * Set open mode for this file. The default is "rb"
+     * Positions a file opened for reading. Seeking backwards starts
+     * over from the beginning, SEEK_END isn't supported.
      */
-    virtual void setOpenMode(std::string mode);
+    virtual off_t lseek(off_t offset, int whence);
 
     /**
-     * Returns the mode this file instance was opened with.
-     */
-    virtual std::string getOpenMode();
-
-    /*
-     * Returns the internal file stream pointer.
+     * Removes the recipe, the chunks are left to
+     * DedupChunkStore::sweep().
      */
-    virtual FILE* getFileHandle();
-
-    virtual gzFile getGZHandle();
+    virtual void remove();
 
-    /*
-     * Extended methods.
-     */
-    virtual void setCompressionLevel(int level);
+    virtual void setOpenMode(std::string mode);
+    virtual std::string getOpenMode();
   };
 
-#endif
-
   /**
    * Directory tree walker instance
    */
@@ -366,7 +1756,9 @@ namespace pgbckctl {
       *
       * This might be an expensive operation, if the
       * the directory was just created and contains many
-      * new or large files.
+      * new or large files. Uses RecursiveSync with its default
+      * settings and ignores errors, see fs-sync.hxx for
+      * more control.
       */
      static void fsync_recursive(path handle);
 
@@ -530,6 +1922,14 @@ namespace pgbckctl {
     virtual std::shared_ptr<BackupFile> walfile(std::string name,
                                                 BackupProfileCompressType compression);
 
+    /**
+     * Same as above, but with a specific compression level. A
+     * level of 0 uses the default level of the compression method.
+     */
+    virtual std::shared_ptr<BackupFile> walfile(std::string name,
+                                                BackupProfileCompressType compression,
+                                                int compression_level);
+
     /**
      * Factory method returns a new basebackup file handle.
      *
@@ -547,6 +1947,17 @@ namespace pgbckctl {
      */
     virtual std::shared_ptr<BackupFile> basebackup(std::string name,
                                                    BackupProfileCompressType compression);
+
+    /**
+     * Same as above, but with a specific compression level and
+     * number of compression worker threads. A level of 0 uses the
+     * default level of the compression method, 0 workers compress
+     * within the calling thread.
+     */
+    virtual std::shared_ptr<BackupFile> basebackup(std::string name,
+                                                   BackupProfileCompressType compression,
+                                                   int compression_level,
+                                                   int compression_workers);
   };
 
   /**
@@ -557,6 +1968,13 @@ namespace pgbckctl {
    */
   class ArchiveLogDirectory : public BackupDirectory {
   protected:
+
+    /**
+     * Segment index of this log directory, allocated
+     * on first use by segmentIndex().
+     */
+    std::shared_ptr<WALSegmentIndex> segindex = nullptr;
+
   public:
     ArchiveLogDirectory(std::shared_ptr<BackupDirectory> parent);
     ArchiveLogDirectory(path parent);
@@ -586,6 +2004,10 @@ namespace pgbckctl {
      * The returned XLOG start position starts either by the *end*
      * of the last completed XLOG segment found or at the beginning
      * of the last partial segment.
+     *
+     * The last segment is looked up in the segment index of the
+     * log directory, so this doesn't need to scan the directory
+     * unless the index needs to be rebuilt.
      */
     virtual std::string getXlogStartPosition(unsigned int &timelineID,
                                              unsigned int &segmentNumber,
@@ -610,6 +2032,101 @@ namespace pgbckctl {
      */
     virtual WALSegmentFileStatus determineXlogSegmentStatus(path segmentFile);
 
+    /**
+     * Same as determineXlogSegmentStatus(), but doesn't look at
+     * the file itself, just at the specified filename. Never returns
+     * WAL_SEGMENT_UNKNOWN.
+     */
+    static WALSegmentFileStatus xlogSegmentStatusByName(const std::string &xlogfilename);
+
+    /**
+     * Name of the file within log/ recording the log directory
+     * layout. If it doesn't exist, the layout is WAL_LOG_LAYOUT_FLAT.
+     */
+    static const char *LAYOUT_FILENAME;
+
+    /**
+     * Returns true if the specified directory name looks like a
+     * timeline or segment high digits directory of the sharded layout,
+     * which are both 8 uppercase hex digits.
+     */
+    static bool isShardDirectoryName(const std::string &name);
+
+    /**
+     * Reads the layout of the specified log directory.
+     */
+    static WALLogLayout readLogLayout(path logdir);
+
+    /**
+     * Returns the directory an XLOG segment or TLI history file with
+     * the specified filename belongs to in the specified layout.
+     */
+    static path xlogFileDirectory(path logdir,
+                                  WALLogLayout layout,
+                                  const std::string &filename);
+
+    /**
+     * Returns the path of an existing file with the specified filename
+     * within the log directory. The location according to the specified
+     * layout is tried first, then the location of the other layout, since
+     * the file might not have been moved by a layout migration yet.
+     *
+     * If the file doesn't exist at all, the path according to the
+     * specified layout is returned.
+     */
+    static path locateXLogFile(path logdir,
+                               WALLogLayout layout,
+                               const std::string &filename);
+
+    /**
+     * Returns the current layout of this log directory. The layout is
+     * read each time, since it might be migrated while we're running.
+     */
+    virtual WALLogLayout getLogLayout();
+
+    /**
+     * Returns the path of the specified XLOG segment or TLI history
+     * file according to the current layout, see xlogFileDirectory().
+     */
+    virtual path xlogFilePath(const std::string &filename);
+
+    /**
+     * Same as the static version, according to the current layout.
+     */
+    virtual path locateXLogFile(const std::string &filename);
+
+    /**
+     * Removes a file with the specified filename from the location
+     * of the layout *not* in use. Returns true if a file was removed.
+     */
+    virtual bool removeAlternateXLogFile(const std::string &filename);
+
+    /**
+     * Migrates this log directory into the specified layout. The new
+     * layout is recorded first, so files written from now on already
+     * use it, then existing files are moved. Returns the number of
+     * files moved.
+     *
+     * This works online, while a stream is writing into the log
+     * directory. Partial segment files are left where they are, since
+     * a streamer might be writing them. They are finalized in place,
+     * and a restarted stream rewrites them in the new location. Calling
+     * this again for the same layout moves files left behind.
+     *
+     * The segment index is invalidated afterwards and rebuilt on
+     * its next use.
+     */
+    virtual unsigned long long migrateLogLayout(WALLogLayout layout);
+
+    /**
+     * Returns the segment index of this log directory for the
+     * specified WAL segment size. The index is allocated once and
+     * reused by subsequent calls with the same WAL segment size, it
+     * loads (or rebuilds) itself on first use. See walindex.hxx
+     * for details.
+     */
+    virtual std::shared_ptr<WALSegmentIndex> segmentIndex(unsigned long long wal_segment_size);
+
     /**
      * Gets the previous XLOG segment file for the given
      * XLogRecPtr.
@@ -636,14 +2153,58 @@ namespace pgbckctl {
                                                   WALSegmentFileStatus status);
 
     /**
-     * Scans through the current contents of the log directory
-     * and deletes all files older that the XLogRecPtr offset
+     * Returns the compression type of a compressed XLOG segment or
+     * TLI history file, derived from its filename suffix (.gz, .zst
+     * or .lz4). BACKUP_COMPRESS_TYPE_NONE is returned for anything else.
+     */
+    static BackupProfileCompressType xlogCompressionType(path segmentFile);
+
+    /**
+     * Collects all files from the segment index older than the
+     * XLogRecPtr offset specified in the BackupCleanupDescr structure.
+     * The result is ordered by timeline and segment number.
+     */
+    virtual void selectXLogsToRemove(std::shared_ptr<BackupCleanupDescr> cleanupDescr,
+                                     unsigned long long wal_segment_size,
+                                     std::vector<WALSegmentIndexEntry> &victims);
+
+    /**
+     * Deletes all files older that the XLogRecPtr offset
      * specified in the BackupCleanDescr structure. The caller should have
      * called identifyDeletionPoints() before doing the phyiscal stuff
      * here to be safe.
+     *
+     * The files to delete are selected by selectXLogsToRemove() first
+     * and then unlinked in batches by a few worker threads, relative to
+     * an open handle of the log directory. The log directory is synced
+     * once at the end and the segment index is updated accordingly.
+     *
+     * With dry_run set, nothing is removed. The returned result
+     * reports what would have been removed in this case.
+     */
+    virtual XLogRemovalResult removeXLogs(std::shared_ptr<BackupCleanupDescr> cleanupDescr,
+                                          unsigned long long wal_segment_size,
+                                          bool dry_run = false);
+
+    /**
+     * Moves the completed XLOG segment files selected by the
+     * offsets of the cleanup descriptor (see selectXLogsToRemove())
+     * into target_dir, the log directory of the cold tier.
+     *
+     * Each file is copied and synced first, then replaced by a
+     * symlink to its copy with a single rename(), so readers always
+     * find the segment under its name. Files which are symlinks
+     * already are skipped, as are TLI history files and partial
+     * segments. removeXLogs() removes the copy together with its
+     * symlink.
+     *
+     * With dry_run set, nothing is moved. The returned result
+     * reports what would have been moved in this case.
      */
-    void removeXLogs(std::shared_ptr<BackupCleanupDescr> cleanupDescr,
-                     unsigned long long wal_segment_size);
+    virtual XLogRemovalResult moveXLogs(std::shared_ptr<BackupCleanupDescr> cleanupDescr,
+                                        unsigned long long wal_segment_size,
+                                        path target_dir,
+                                        bool dry_run = false);
 
     /**
      * Check specified cleanup descriptor being suitable to perform a
@@ -731,6 +2292,17 @@ namespace pgbckctl {
     virtual std::shared_ptr<BackupFile> basebackup(std::string name,
                                                    BackupProfileCompressType compression);
 
+    /*
+     * Same as above, with a specific compression level and number
+     * of compression worker threads. gzip, zstd, xz and lz4 are
+     * compressed in-process if the libraries are available, otherwise
+     * we fall back to pipe the stream through the compression binary.
+     */
+    virtual std::shared_ptr<BackupFile> basebackup(std::string name,
+                                                   BackupProfileCompressType compression,
+                                                   int compression_level,
+                                                   int compression_workers);
+
     /**
      * Instantiate the directory.
      *
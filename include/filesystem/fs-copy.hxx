@@ -10,7 +10,9 @@
 #warning using experimental io_uring library support
 #endif
 
+#include <atomic>
 #include <stack>
+#include <vector>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
@@ -24,6 +26,25 @@ namespace pgbckctl {
   /* Forwarded declarations */
   class BackupCopyManager;
 
+  /**
+   * How a copy manager copies the contents of a file.
+   */
+  typedef enum {
+
+    /* Try a reflink, then copy_file_range(), then copy through buffers */
+    COPY_STRATEGY_AUTO,
+
+    /* Clone the file with FICLONE, copy through buffers if that fails */
+    COPY_STRATEGY_REFLINK,
+
+    /* Copy in the kernel with copy_file_range(), copy through buffers if that fails */
+    COPY_STRATEGY_COPY_RANGE,
+
+    /* Always copy through buffers with the copy engine of the copy manager */
+    COPY_STRATEGY_STREAM
+
+  } CopyStrategy;
+
   class TargetDirectory : public RootDirectory {
   private:
 
@@ -43,12 +64,90 @@ namespace pgbckctl {
      */
     unsigned short max_copy_instances = 1;
 
+    /**
+     * Copy strategy passed to copy items.
+     */
+    CopyStrategy copy_strategy = COPY_STRATEGY_AUTO;
+
+    /**
+     * Copy files with O_DIRECT, see setDirectIO().
+     */
+    bool direct_io = false;
+
+    /**
+     * Size of a single read or write request and queue depth of the
+     * copy engines, 0 selects the engine's default. See setIOParameters().
+     */
+    size_t io_size = 0;
+    unsigned int io_queue_depth = 0;
+
+    /**
+     * A regular file to copy, see BaseCopyManager::start().
+     *
+     * Files are split into chunks of _copyOperations::chunk_size
+     * bytes. The copy item which starts a file claims its chunks one
+     * after another, but once all files are started, idle copy items
+     * steal the remaining chunks of the files still in progress.
+     */
+    class _copyTask {
+    public:
+
+      path source;
+      path target;
+
+      /** File size as seen when walking the source directory */
+      size_t size = 0;
+
+      /** Offset of the first chunk not claimed by a copy item yet */
+      std::atomic<size_t> next;
+
+      /** Bytes of all finished chunks */
+      std::atomic<size_t> copied;
+
+      /**
+       * Set by the copy item starting the file as soon as the target
+       * file exists and wasn't cloned, so chunks can be stolen.
+       */
+      std::atomic<bool> stealable;
+
+      /** Set once copy_file_range() failed for a chunk of this file */
+      std::atomic<bool> range_failed;
+
+      _copyTask(path source, path target, size_t size);
+
+      /**
+       * Claims the next chunk of the file, returns false
+       * if there is none left.
+       */
+      virtual bool claim(size_t chunk_size, off_t &offset, size_t &len);
+
+      /** Bytes not claimed by any copy item yet */
+      virtual size_t unclaimed();
+
+    };
+
     class _copyItem {
     private:
 
       /** Exit forced */
       bool exit_forced = false;
 
+      /**
+       * Creates the target file of a task and clones it if
+       * the copy strategy allows it. Returns true if there are
+       * chunks left to copy.
+       */
+      virtual bool startTask(std::shared_ptr<_copyTask> task);
+
+      /**
+       * Copies a chunk of the specified task, if it's the last
+       * one of the file, the target file is synced.
+       */
+      virtual void copyChunk(BaseCopyManager::_copyOperations &ops_handler,
+                             std::shared_ptr<_copyTask> task,
+                             off_t offset,
+                             size_t len);
+
     protected:
 
       /** I/O thread */
@@ -57,10 +156,40 @@ namespace pgbckctl {
       /** internal slot reference for copy operations list */
       int slot = -1;
 
-      /** I/O Thread legwork method */
-      virtual void work(BaseCopyManager::_copyOperations &ops_handler,
-                        path inputFileName,
-                        path outFileName) const = 0;
+      /** How to copy the file, see BaseCopyManager::setCopyStrategy() */
+      CopyStrategy strategy = COPY_STRATEGY_AUTO;
+
+      /** Open files with O_DIRECT, see BaseCopyManager::setDirectIO() */
+      bool direct_io = false;
+
+      /** See BaseCopyManager::setIOParameters() */
+      size_t io_size = 0;
+      unsigned int io_queue_depth = 0;
+
+      /**
+       * I/O Thread legwork method, claims chunks
+       * until there is nothing left to copy.
+       */
+      virtual void work(BaseCopyManager::_copyOperations &ops_handler);
+
+      /**
+       * Initializes resources of the copy engine kept
+       * for the whole lifetime of the I/O thread.
+       */
+      virtual void setup();
+
+      /** Releases the resources allocated by setup() */
+      virtual void teardown();
+
+      /**
+       * Copies len bytes at offset from in to the same offset of out
+       * through the copy engine. Returns the number of bytes copied.
+       */
+      virtual size_t copyRange(BaseCopyManager::_copyOperations &ops_handler,
+                               std::shared_ptr<ArchiveFile> in,
+                               std::shared_ptr<ArchiveFile> out,
+                               off_t offset,
+                               size_t len) = 0;
 
     public:
 
@@ -71,7 +200,7 @@ namespace pgbckctl {
        */
       explicit _copyItem(int slot);
 
-      /** Destructor, stops copy operation and frees all resources */
+      /** Destructor, waits for the I/O thread to finish */
       virtual ~_copyItem();
 
       /**
@@ -80,11 +209,31 @@ namespace pgbckctl {
       virtual void exitForced();
 
       /**
-       * Does the legwork of copying the queued file
+       * Sets the copy strategy, must be called before go().
+       */
+      virtual void setCopyStrategy(CopyStrategy strategy);
+
+      /**
+       * Enables O_DIRECT, must be called before go().
+       */
+      virtual void setDirectIO(bool direct_io);
+
+      /**
+       * Sets request size and queue depth of the copy
+       * engine, must be called before go().
+       */
+      virtual void setIOParameters(size_t io_size, unsigned int queue_depth);
+
+      /**
+       * Starts the I/O thread working on the tasks
+       * of the operations handler.
+       */
+      virtual void go(BaseCopyManager::_copyOperations &ops_handler);
+
+      /**
+       * Waits for the I/O thread to finish.
        */
-      virtual void go(BaseCopyManager::_copyOperations &ops_handler,
-                      path inputFileName,
-                      path outputFileName) = 0;
+      virtual void join();
 
     };
 
@@ -100,12 +249,27 @@ namespace pgbckctl {
       /**
        * Stack of available ops slots.
        *
-       * The stack is only once filled in by operations itself, when having entered
-       * the processing loop (see @link IOUringCopyManager::start()) we just atomically check
-       * which slots are available, protected by the active_ops_mutex.
+       * Filled by BaseCopyManager::start() and taken by starting copy items,
+       * each copy item puts its slot back when its I/O thread is done,
+       * protected by the active_ops_mutex.
        */
       std::stack<unsigned int> ops_free;
 
+      /**
+       * Files to copy, ordered by size, largest first. Not modified
+       * anymore once copy items are started.
+       */
+      std::vector<std::shared_ptr<_copyTask>> tasks;
+
+      /** Index of the next task no copy item started yet */
+      std::atomic<size_t> next_task;
+
+      /** Size of the chunks copy items claim */
+      size_t chunk_size = 0;
+
+      /** Number of chunks copied by another copy item than the one starting the file */
+      std::atomic<unsigned long> stolen_chunks;
+
       /**
        * The condition_variable notify_cv is responsible to notify operations
        * that something is to do and otherwise having to wait.
@@ -117,16 +281,20 @@ namespace pgbckctl {
       std::mutex active_ops_mutex;
 
       /*
-       * Flag set if no more files left to process. We set this to true as soon as there
-       * are no files left to process. This allows the BackupCopyManager to call wait()
+       * Flag set if no more files left to process. We set this to true as soon as all
+       * copy items are started. This allows the BackupCopyManager to call wait()
        * to finalize any remaining copy operations safely, since no concurrent creation of new
-       * copy items happen anymore. See the start() implementations of the various copy
-       * managers.
+       * copy items happen anymore. See BaseCopyManager::start().
        */
       bool finalize = false;
 
       /** Abort operations requested */
       bool exit = false;
+
+      /** First error a copy item failed with, protected by active_ops_mutex */
+      std::string error = "";
+
+      _copyOperations();
     };
 
     _copyOperations ops;
@@ -140,26 +308,51 @@ namespace pgbckctl {
     /** A SIGINT signal handler */
     JobSignalHandler *intHandler  = nullptr;
 
+    /**
+     * Creates the target of the specified directory entry if it's
+     * a directory, or adds a task to copy it if it's a regular file.
+     */
+    virtual void planCopyItem(const directory_entry &de);
+
+    /**
+     * Creates a new _copyItem of the copy engine with the specified slot
+     * ID within the operations manager.
+     */
+    virtual std::shared_ptr<_copyItem> makeCopyItem(const unsigned int slot) = 0;
+
   public:
 
+    /**
+     * Default size of the chunks files are split into, so
+     * that copy items can share the work on large files.
+     */
+    const static size_t DEFAULT_COPY_CHUNK_SIZE = 64 * 1024 * 1024;
+
     BaseCopyManager(std::shared_ptr<BackupDirectory> in,
                     std::shared_ptr<TargetDirectory> out);
     virtual ~BaseCopyManager();
 
     /**
-     * Abstract start() method to start a copy operation.
+     * Starts a copy operation.
+     *
+     * Walks the whole source directory first, creating all target
+     * directories and collecting the files to copy. The files are then
+     * copied largest first by a fixed number of copy items, see
+     * setNumberOfCopyInstances(), so a large file found last doesn't
+     * keep a single copy item busy while all others are idle.
      */
-    virtual void start() = 0;
+    virtual void start();
 
     /**
-     * Abstract stop() method to stop a copy operation.
+     * Stops a copy operation.
      */
-    virtual void stop() = 0;
+    virtual void stop();
 
     /**
-     * Waits for copy operation to finish.
+     * Waits for copy operation to finish. Throws if a
+     * copy item failed.
      */
-    virtual void wait() = 0;
+    virtual void wait();
 
     /**
      * Assign source directory.
@@ -191,53 +384,135 @@ namespace pgbckctl {
       /** Sets the number of parallel workers */
       virtual void setNumberOfCopyInstances(unsigned short instances);
 
-  };
+      /**
+       * Sets how files are copied. By default, the copy manager tries
+       * to clone a file first, which only works if source and target
+       * are on the same filesystem supporting reflinks (e.g. XFS or
+       * btrfs). Then copy_file_range() is tried, which copies in the
+       * kernel and might clone, too. If both fail, the file is
+       * copied through buffers by the copy engine.
+       */
+      virtual void setCopyStrategy(CopyStrategy strategy);
 
-#ifdef PG_BACKUP_CTL_HAS_LIBURING
+      /** Returns the configured copy strategy */
+      virtual CopyStrategy getCopyStrategy();
+
+      /**
+       * Copies files with O_DIRECT, bypassing the page cache, so that
+       * copying a basebackup doesn't evict the pages of WAL other processes
+       * on the host depend on. Copy engines use page aligned buffers
+       * allocated once per copy thread, the unaligned tail of a file is
+       * written padded and the file truncated afterwards. Files on
+       * filesystems without O_DIRECT support are copied through the page
+       * cache. copy_file_range() is skipped unless requested explicitly
+       * by COPY_STRATEGY_COPY_RANGE, since it might go through the
+       * page cache, too. Chunk size must be a multiple of
+       * ArchiveFile::DIRECT_IO_ALIGNMENT.
+       */
+      virtual void setDirectIO(bool direct_io);
+
+      /** Returns true if files are copied with O_DIRECT */
+      virtual bool getDirectIO();
+
+      /**
+       * Tunes the copy engine for the storage copied from and to. io_size is
+       * the size of a single read or write request, the buffer size of the
+       * legacy engine or the chunk size of an io_uring copy pipeline.
+       * queue_depth is the io_uring queue depth of every copy thread, it's
+       * ignored by the legacy engine. 0 selects the engine's default for
+       * both. Must be called before start().
+       */
+      virtual void setIOParameters(size_t io_size, unsigned int queue_depth);
+
+      /** Returns the configured request size, 0 means engine default */
+      virtual size_t getIOSize();
+
+      /** Returns the configured queue depth, 0 means engine default */
+      virtual unsigned int getIOQueueDepth();
+
+      /**
+       * Returns the name of the copy engine, for reports.
+       */
+      virtual std::string getEngineName() = 0;
+
+      /**
+       * Sets the size of the chunks files are split into, must
+       * be called before start().
+       */
+      virtual void setChunkSize(size_t chunk_size);
+
+      /** Returns the configured chunk size */
+      virtual size_t getChunkSize();
+
+      /**
+       * Returns the number of chunks copied by idle copy items
+       * on behalf of others during the last copy operation.
+       */
+      virtual unsigned long getStolenChunks();
+
+      /**
+       * Copies the contents of in into out without passing them
+       * through user space buffers, see setCopyStrategy(). Both files must
+       * be opened, out must be empty. Returns the strategy used
+       * or COPY_STRATEGY_STREAM if the caller has to copy the file
+       * itself.
+       */
+      static CopyStrategy fastCopy(std::shared_ptr<ArchiveFile> in,
+                                   std::shared_ptr<ArchiveFile> out,
+                                   CopyStrategy strategy);
+
+      /**
+       * Copies len bytes at offset of in to the same offset of
+       * out with copy_file_range(). Returns false if the kernel
+       * couldn't copy the whole range.
+       */
+      static bool copyFileRange(std::shared_ptr<ArchiveFile> in,
+                                std::shared_ptr<ArchiveFile> out,
+                                off_t offset,
+                                size_t len);
 
-  class IOUringCopyManager : public BaseCopyManager {
   private:
 
-    /**
-     * Creates a new _copyItem for the specified directory entry.
-     * slot is the slot ID within the operations manager.
-     *
-     * @param dentry: directory entry to work on (regular file)
-     * @param slot: the ID of the slot within the operations manager.
-     *
-     * NOTE: it is dangerous to call this method outside a critical section. The
-     *       caller has to make sure a critical section was established before entering.
-     */
-    virtual void makeCopyItem(const directory_entry &dentry,
-                              const unsigned int slot);
+    size_t chunk_size = DEFAULT_COPY_CHUNK_SIZE;
+
+  };
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
 
+  class IOUringCopyManager : public BaseCopyManager {
   protected:
 
     /**
      * io_uring specific implementation of internal copy management
+     *
+     * Every copy item keeps a single ring for the lifetime
+     * of its I/O thread, which copies all chunks it claims.
      */
     class _iouring_copyItem final : public BaseCopyManager::_copyItem {
+    private:
+
+      IOUringCopyPipeline ring;
+
     protected:
 
-      /** I/O Thread legwork method */
-      virtual void work(BaseCopyManager::_copyOperations &ops_handler,
-                        path inputFileName,
-                        path outFileName) const;
+      virtual void setup();
+      virtual void teardown();
+
+      virtual size_t copyRange(BaseCopyManager::_copyOperations &ops_handler,
+                               std::shared_ptr<ArchiveFile> in,
+                               std::shared_ptr<ArchiveFile> out,
+                               off_t offset,
+                               size_t len);
 
     public:
 
       _iouring_copyItem(unsigned int slot) noexcept;
       ~_iouring_copyItem() final;
 
-      /**
-       * Does the legwork of copying the queued file
-       */
-      virtual void go(BaseCopyManager::_copyOperations &ops_handler,
-                      path inputFileName,
-                      path outputFileName);
-
     };
 
+    virtual std::shared_ptr<_copyItem> makeCopyItem(const unsigned int slot);
+
   public:
 
     IOUringCopyManager(std::shared_ptr<BackupDirectory> in,
@@ -249,9 +524,7 @@ namespace pgbckctl {
 
     virtual ~IOUringCopyManager() {}
 
-    virtual void start();
-    virtual void stop();
-    virtual void wait();
+    virtual std::string getEngineName();
 
   };
 
@@ -266,51 +539,42 @@ namespace pgbckctl {
 #else
 
   class LegacyCopyManager : public BaseCopyManager {
-  private:
-
-    /**
-     * Creates a new _copyItem for the specified directory entry.
-     * slot is the slot ID within the operations manager.
-     *
-     * @param dentry: directory entry to work on (regular file)
-     * @param slot: the ID of the slot within the operations manager.
-     *
-     * NOTE: it is dangerous to call this method outside a critical section. The
-     *       caller has to make sure a critical section was established before entering.
-     */
-    virtual void makeCopyItem(const directory_entry &de,
-                              const unsigned int slot);
-
   protected:
 
     class _legacy_copyItem final : public BaseCopyManager::_copyItem {
+    private:
+
+      /** Copy buffer, allocated by setup() */
+      std::shared_ptr<MemoryBuffer> buf = nullptr;
+
     protected:
 
-      /** I/O Thread legwork method */
-      virtual void work(BaseCopyManager::_copyOperations &ops_handler,
-                        path inputFileName,
-                        path outFileName) const;
+      virtual void setup();
+      virtual void teardown();
+
+      virtual size_t copyRange(BaseCopyManager::_copyOperations &ops_handler,
+                               std::shared_ptr<ArchiveFile> in,
+                               std::shared_ptr<ArchiveFile> out,
+                               off_t offset,
+                               size_t len);
 
     public:
 
+      /** Size of the copy buffer */
+      const static size_t COPY_BUFFER_SIZE = 256 * 1024;
+
       _legacy_copyItem(unsigned int slot) noexcept;
       ~_legacy_copyItem();
 
-      /**
-       * Does the legwork of copying the queued file
-       */
-      virtual void go(BaseCopyManager::_copyOperations &ops_handler,
-                      path inputFileName,
-                      path outputFileName);
-
     };
 
+    virtual std::shared_ptr<_copyItem> makeCopyItem(const unsigned int slot);
+
   public:
     LegacyCopyManager(std::shared_ptr<BackupDirectory> in,
                       std::shared_ptr<TargetDirectory> out);
-    virtual void start();
-    virtual void stop();
-    virtual void wait();
+
+    virtual std::string getEngineName();
   };
 
   class CopyManager : public LegacyCopyManager {
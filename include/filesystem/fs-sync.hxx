@@ -0,0 +1,216 @@
+#ifndef __HAVE_FS_SYNC_HXX__
+#define __HAVE_FS_SYNC_HXX__
+
+#include <sys/types.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fs-archive.hxx>
+
+namespace pgbckctl {
+
+  /**
+   * How RecursiveSync makes a directory tree durable.
+   */
+  typedef enum {
+
+    /*
+     * syncfs() if the directory is the root of a dedicated
+     * filesystem, otherwise io_uring if available, otherwise
+     * fsync() from a pool of threads.
+     */
+    RECURSIVE_SYNC_AUTO,
+
+    /* fsync() every file and directory from a pool of threads */
+    RECURSIVE_SYNC_FSYNC,
+
+    /* fsync() every file and directory through io_uring */
+    RECURSIVE_SYNC_IO_URING,
+
+    /* syncfs() every filesystem the directory tree spans */
+    RECURSIVE_SYNC_SYNCFS
+
+  } RecursiveSyncMethod;
+
+  /**
+   * Progress and result of a RecursiveSync operation.
+   */
+  typedef struct RecursiveSyncProgress {
+
+    /* Method actually used, never RECURSIVE_SYNC_AUTO */
+    RecursiveSyncMethod method = RECURSIVE_SYNC_FSYNC;
+
+    /* Files and directories found below the root, including the root */
+    unsigned long long total = 0;
+
+    /* Files and directories synced so far */
+    unsigned long long synced = 0;
+
+    /* Number of files and directories which couldn't be synced */
+    unsigned long long errors = 0;
+
+    /* Time spent so far */
+    std::chrono::milliseconds elapsed = std::chrono::milliseconds(0);
+
+  } RecursiveSyncProgress;
+
+  /**
+   * Makes a whole directory tree durable.
+   *
+   * RootDirectory::fsync_recursive() used to open and fsync() every file
+   * and directory one after another, which takes very long for a
+   * cluster with hundreds of thousands of relation files, even if
+   * most of them don't have any dirty pages. RecursiveSync walks the
+   * tree once to collect all entries and then keeps many fsync requests
+   * in flight, either through io_uring or from a pool of threads. If the
+   * tree lives on its own filesystem, a single syncfs() per filesystem is
+   * sufficient and by far the cheapest way.
+   *
+   * Symlinked directories are followed, as done for tablespaces
+   * within a PostgreSQL data directory.
+   *
+   * sync() throws a CArchiveIssue if any entry couldn't be synced,
+   * unless errors are ignored with setIgnoreErrors(). Entries
+   * vanishing while the tree is synced are not an error.
+   */
+  class RecursiveSync {
+  private:
+
+    path root;
+
+    RecursiveSyncMethod method = RECURSIVE_SYNC_AUTO;
+
+    /* Method used by the current sync() operation */
+    RecursiveSyncMethod active = RECURSIVE_SYNC_FSYNC;
+
+    /* Number of fsync requests in flight, see setParallelism() */
+    unsigned int parallelism = DEFAULT_PARALLELISM;
+
+    bool ignore_errors = false;
+
+    /* Progress callback and its interval, see setProgressCallback() */
+    std::function<void(const RecursiveSyncProgress &)> progress_cb = nullptr;
+    std::chrono::milliseconds progress_interval = std::chrono::milliseconds(1000);
+
+    /*
+     * State of the current sync() operation. Counters are
+     * updated by worker threads, the first error seen is kept
+     * in error, protected by mtx.
+     */
+    std::vector<path> files;
+    std::vector<path> directories;
+    std::vector<dev_t> devices;
+    std::atomic<unsigned long long> synced;
+    std::atomic<unsigned long long> errors;
+    std::string error = "";
+    std::mutex mtx;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last_report;
+
+    /**
+     * Walks the tree below root and collects all files, directories
+     * and filesystems to sync.
+     */
+    virtual void collect(const path &dir, dev_t dev);
+
+    /**
+     * Opens and fsyncs a single file or directory. Returns false
+     * and records the error if that failed.
+     */
+    virtual bool syncEntry(const path &entry, bool directory);
+
+    /**
+     * Records an error for the specified entry.
+     */
+    virtual void recordError(const path &entry, const std::string &what, int err);
+
+    /**
+     * The different sync strategies.
+     */
+    virtual void syncThreaded();
+    virtual void syncIOUring();
+    virtual void syncFilesystems();
+
+    /**
+     * Calls the progress callback if the progress interval
+     * elapsed or force is set. Called by the thread calling sync() only.
+     */
+    virtual void report(bool force);
+
+    /**
+     * Builds the current progress.
+     */
+    virtual RecursiveSyncProgress progress();
+
+  public:
+
+    /**
+     * Default number of fsync requests in flight.
+     */
+    const static unsigned int DEFAULT_PARALLELISM = 32;
+
+    /**
+     * Upper limit for setParallelism().
+     */
+    const static unsigned int MAX_PARALLELISM = 1024;
+
+    RecursiveSync(path root);
+    virtual ~RecursiveSync();
+
+    /**
+     * Selects the sync method, RECURSIVE_SYNC_AUTO by default. If
+     * RECURSIVE_SYNC_IO_URING is requested, but io_uring isn't
+     * available, files are synced from a pool of threads instead.
+     */
+    virtual void setMethod(RecursiveSyncMethod method);
+    virtual RecursiveSyncMethod getMethod();
+
+    /**
+     * Sets the number of fsync requests in flight, which is the
+     * queue depth with io_uring or the number of threads otherwise.
+     * 0 selects DEFAULT_PARALLELISM.
+     */
+    virtual void setParallelism(unsigned int parallelism);
+
+    /**
+     * If set, errors are only logged and counted in the
+     * result of sync(), but sync() doesn't throw.
+     */
+    virtual void setIgnoreErrors(bool ignore);
+
+    /**
+     * Installs a callback called with the current progress
+     * every interval while sync() is running, and once with the
+     * final result.
+     */
+    virtual void setProgressCallback(std::function<void(const RecursiveSyncProgress &)> cb,
+                                     std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+
+    /**
+     * Syncs the whole directory tree. root can also be a
+     * regular file, which is just synced then.
+     */
+    virtual RecursiveSyncProgress sync();
+
+    /**
+     * Returns true if path is the root of a filesystem, e.g. the
+     * mount point of a filesystem dedicated to a restored cluster.
+     */
+    static bool isMountPoint(const path &p);
+
+    /**
+     * Conversion of sync methods from and to their names auto,
+     * fsync, io_uring and syncfs, as used for runtime variables.
+     */
+    static RecursiveSyncMethod methodFromString(std::string method);
+    static std::string methodToString(RecursiveSyncMethod method);
+
+  };
+
+}
+
+#endif
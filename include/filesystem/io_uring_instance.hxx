@@ -9,6 +9,9 @@
 #include <memorybuffer.hxx>
 
 
+#include <mutex>
+#include <vector>
+
 #include <liburing.h>
 extern "C" {
 #include <sys/uio.h>
@@ -82,7 +85,13 @@ namespace pgbckctl {
   public:
     std::vector<std::shared_ptr<MemoryBuffer>> buffers;
 
-    explicit vectored_buffer(size_t total_size, unsigned int bufsize);
+    /**
+     * Allocates total_size bytes in buffers of bufsize bytes. If alignment
+     * is set, all buffers start at an address aligned to it, as required
+     * for files opened with O_DIRECT.
+     */
+    explicit vectored_buffer(size_t total_size, unsigned int bufsize,
+                             size_t alignment = 0);
     virtual ~vectored_buffer();
 
     /**
@@ -187,6 +196,73 @@ namespace pgbckctl {
 
   };
 
+  /**
+   * A pool of page aligned vectored buffers.
+   *
+   * Allocating the buffers for every file copied is expensive
+   * and, with O_DIRECT, requires aligned allocations every time.
+   * Buffers returned by release() are handed out again by get()
+   * for a request of the same size, so they are allocated only once
+   * per copy operation. The pool can be shared between the
+   * IOUringInstances of several threads.
+   */
+  class vectored_buffer_pool {
+  private:
+
+    unsigned int block_size;
+    size_t alignment;
+
+    /* maximum number of idle buffers kept */
+    unsigned int max_idle;
+
+    std::mutex pool_mtx;
+    std::vector<std::shared_ptr<vectored_buffer>> idle;
+
+    /* number of buffers allocated by the pool */
+    unsigned long allocated = 0;
+
+  public:
+
+    /**
+     * Default number of idle buffers kept by a pool.
+     */
+    const static unsigned int DEFAULT_MAX_IDLE = 64;
+
+    vectored_buffer_pool(unsigned int block_size,
+                         size_t alignment = ArchiveFile::DIRECT_IO_ALIGNMENT,
+                         unsigned int max_idle = DEFAULT_MAX_IDLE);
+    virtual ~vectored_buffer_pool();
+
+    /**
+     * Returns a buffer of the specified total size, either
+     * an idle one or a newly allocated one. Its effective size is
+     * reset to the total size.
+     */
+    virtual std::shared_ptr<vectored_buffer> get(size_t total_size);
+
+    /**
+     * Gives back a buffer retrieved with get().
+     */
+    virtual void release(std::shared_ptr<vectored_buffer> buf);
+
+    /**
+     * Returns the block size of the buffers in the pool.
+     */
+    virtual unsigned int getBlockSize();
+
+    /**
+     * Returns the number of buffers allocated by the
+     * pool so far.
+     */
+    virtual unsigned long getAllocated();
+
+    /**
+     * Returns the number of idle buffers.
+     */
+    virtual size_t getIdle();
+
+  };
+
   /**
    * A handler class for I/O uring.
    */
@@ -212,6 +288,19 @@ namespace pgbckctl {
      */
     size_t block_size = DEFAULT_BLOCK_SIZE;
 
+    /**
+     * Pool alloc_buffer() takes buffers from, see
+     * setBufferPool().
+     */
+    std::shared_ptr<vectored_buffer_pool> pool = nullptr;
+
+    /**
+     * Checks the alignment of a request on a file opened with O_DIRECT and
+     * pads the last I/O vector to the alignment, see read() and write().
+     */
+    virtual void prepare_direct_io(std::shared_ptr<vectored_buffer> buf,
+                                   off_t pos);
+
   protected:
 
     struct io_uring ring;
@@ -266,10 +355,23 @@ namespace pgbckctl {
 
     /**
      * Returns an allocated, aligned vectorized_buffer suitable
-     * for use for an io_uring instance.
+     * for use for an io_uring instance. If a buffer pool is assigned,
+     * the buffer is taken from the pool.
      */
     virtual void alloc_buffer(std::shared_ptr<vectored_buffer> &vbuf, size_t size);
 
+    /**
+     * Gives back a buffer retrieved by alloc_buffer() to the buffer
+     * pool, if any, and resets vbuf.
+     */
+    virtual void release_buffer(std::shared_ptr<vectored_buffer> &vbuf);
+
+    /**
+     * Assigns a buffer pool for alloc_buffer(). Its block size must
+     * match the block size of this instance.
+     */
+    virtual void setBufferPool(std::shared_ptr<vectored_buffer_pool> pool);
+
     /**
      * Returns true if the ring is available. This is
      * usually set if the caller used setup() before. exit()
@@ -289,6 +391,11 @@ namespace pgbckctl {
      * Emplaces the specified vector into the ring. The vector size
      * must be smaller or equal to queue depth and buffer size must match
      * block size.
+     *
+     * If the file is opened with O_DIRECT, pos and the buffers must be
+     * aligned to ArchiveFile::DIRECT_IO_ALIGNMENT. An unaligned tail of the
+     * buffer is read with the length padded to the alignment, reading a
+     * file's tail just returns less bytes.
      */
     virtual void read(std::shared_ptr<ArchiveFile> file,
                       std::shared_ptr<vectored_buffer> buf,
@@ -306,11 +413,32 @@ namespace pgbckctl {
      * Emplaces the specified vector into the ring. The vector size
      * must be smaller or equal to queue depth and buffer size must match
      * block size.
+     *
+     * With O_DIRECT, the same alignment rules as for read() apply. An
+     * unaligned tail is written padded to the alignment, so the caller
+     * has to truncate the file to its real size afterwards.
      */
     virtual void write(std::shared_ptr<ArchiveFile> file,
                        std::shared_ptr<vectored_buffer> buf,
                        off_t pos);
 
+    /**
+     * Prepares a fsync request for the specified file descriptor.
+     *
+     * The request is tagged with user_data, which is returned in the
+     * user_data field of its completion queue entry. Unlike read() and
+     * write(), the request isn't submitted immediately, so callers
+     * can queue up to queue depth requests and submit them with
+     * a single call to submit().
+     */
+    virtual void prepare_fsync(int fd, unsigned long long user_data);
+
+    /**
+     * Submits all prepared requests, returns the number
+     * of requests submitted.
+     */
+    virtual int submit();
+
     /**
      * Wait for consumer completion
      */
@@ -336,6 +464,153 @@ namespace pgbckctl {
 
   };
 
+  /**
+   * Copies a file through an io_uring instance, keeping
+   * many reads and writes in flight.
+   *
+   * The file is divided into chunks, each one assigned to a slot
+   * with its own buffer. For every slot, a read of the chunk and a
+   * write of the same buffer are submitted as linked SQEs, so the
+   * kernel starts the write as soon as the read completed, without
+   * a roundtrip through userspace. With queue depth / 2 slots, reads
+   * of the following chunks are in flight while a chunk is
+   * written.
+   *
+   * The slot buffers are registered with the ring and the input and
+   * output files are registered as fixed files, which saves the
+   * kernel mapping the buffers and looking up the file descriptors
+   * for every request. If registration fails, e.g. because
+   * RLIMIT_MEMLOCK is too low, plain requests are used instead.
+   *
+   * Slot buffers are page aligned, so files opened with O_DIRECT
+   * can be copied, too. The chunk size must be a multiple of
+   * ArchiveFile::DIRECT_IO_ALIGNMENT then. The unaligned tail of such
+   * a file is read and written padded to the alignment, and the
+   * output file is truncated to the input size afterwards.
+   */
+  class IOUringCopyPipeline : public IOUringInstance {
+  private:
+
+    typedef struct _copy_slot {
+
+      std::shared_ptr<MemoryBuffer> buffer = nullptr;
+
+      /* file offset and length of the chunk */
+      off_t  offset = 0;
+      size_t len = 0;
+
+      /* bytes of the chunk read and written so far */
+      size_t done_read = 0;
+      size_t done_write = 0;
+
+      /* number of requests in flight */
+      unsigned int inflight = 0;
+
+      bool busy = false;
+
+    } copy_slot;
+
+    std::vector<copy_slot> slots;
+
+    /* size of a chunk, see setChunkSize() */
+    size_t chunk_size = DEFAULT_CHUNK_SIZE;
+
+    /* file descriptors of the current copy operation */
+    int fd_in  = -1;
+    int fd_out = -1;
+
+    bool fixed_buffers = false;
+    bool fixed_files = false;
+
+    /* set if input or output of the current copy uses O_DIRECT */
+    bool direct_io = false;
+
+    /* number of requests in flight over all slots */
+    unsigned int inflight = 0;
+
+    /* first error seen during a copy operation */
+    std::string error = "";
+
+    /**
+     * Prepares a read or write request for the specified part
+     * of a slot's chunk. With link set, the next request
+     * prepared is started after this one completed.
+     */
+    virtual void prepare(unsigned int slot, bool write,
+                         size_t start, size_t len,
+                         bool link);
+
+    /**
+     * Submits the requests for the remaining part of a slot's
+     * chunk after a short read or write.
+     */
+    virtual void resume(unsigned int slot);
+
+    /**
+     * Processes a completion queue entry, returns
+     * the number of bytes of completed chunks.
+     */
+    virtual size_t complete(struct io_uring_cqe *cqe);
+
+  public:
+
+    /**
+     * Default chunk size read and written by a single request.
+     */
+    const static size_t DEFAULT_CHUNK_SIZE = 256 * 1024;
+
+    /**
+     * Default queue depth, gives 16 chunks in flight.
+     */
+    const static unsigned int DEFAULT_COPY_QUEUE_DEPTH = 32;
+
+    IOUringCopyPipeline();
+    IOUringCopyPipeline(unsigned int queue_depth, size_t chunk_size);
+    virtual ~IOUringCopyPipeline();
+
+    /**
+     * Sets the chunk size. Must be called before setup().
+     */
+    virtual void setChunkSize(size_t chunk_size);
+
+    /**
+     * Sets up the ring and allocates and registers the
+     * slot buffers.
+     */
+    virtual void setup();
+
+    /**
+     * Copies the contents of in into out, both must be opened. Stops
+     * submitting new requests once abort is set, but always waits
+     * for all requests in flight. Returns the number of bytes
+     * copied, throws a CIOUringIssue on I/O errors.
+     */
+    virtual size_t copy(std::shared_ptr<ArchiveFile> in,
+                        std::shared_ptr<ArchiveFile> out,
+                        const bool &abort);
+
+    /**
+     * Like copy(), but copies only len bytes starting at
+     * offset, which are written to the same offset of out.
+     */
+    virtual size_t copy(std::shared_ptr<ArchiveFile> in,
+                        std::shared_ptr<ArchiveFile> out,
+                        off_t offset,
+                        size_t len,
+                        const bool &abort);
+
+    /**
+     * Returns true if the slot buffers are registered with the ring.
+     */
+    virtual bool usesFixedBuffers();
+
+    /**
+     * Unregisters the slot buffers and tears down the ring.
+     */
+    virtual void exit();
+
+  };
+
 }
 
 #endif
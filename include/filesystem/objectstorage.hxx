@@ -0,0 +1,297 @@
+#ifndef __HAVE_OBJECTSTORAGE_HXX__
+#define __HAVE_OBJECTSTORAGE_HXX__
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fs-archive.hxx>
+
+namespace pgbckctl {
+
+  /**
+   * Access to the bucket of an object storage, see ArchiveStorageDescr.
+   *
+   * Files are uploaded either with a single putObject() or as a
+   * multipart upload: createMultipartUpload() returns the ID of the upload,
+   * its parts are uploaded with uploadPart() in any order and from any
+   * number of threads, then completeMultipartUpload() assembles the object
+   * from the ETags of all parts in the order of their part numbers. Part
+   * numbers start at 1.
+   *
+   * All methods throw a CArchiveIssue on errors. Implementations
+   * must be safe to be called from several threads at once.
+   */
+  class ObjectStorageClient {
+  protected:
+
+    std::shared_ptr<ArchiveStorageDescr> storage = nullptr;
+
+  public:
+
+    ObjectStorageClient(std::shared_ptr<ArchiveStorageDescr> storage);
+    virtual ~ObjectStorageClient();
+
+    virtual void putObject(const std::string &key,
+                           const char *data,
+                           size_t len) = 0;
+
+    virtual std::string createMultipartUpload(const std::string &key) = 0;
+
+    /**
+     * Uploads a part, returns its ETag.
+     */
+    virtual std::string uploadPart(const std::string &key,
+                                   const std::string &upload_id,
+                                   unsigned int part_number,
+                                   const char *data,
+                                   size_t len) = 0;
+
+    virtual void completeMultipartUpload(const std::string &key,
+                                         const std::string &upload_id,
+                                         const std::vector<std::string> &etags) = 0;
+
+    virtual void abortMultipartUpload(const std::string &key,
+                                      const std::string &upload_id) = 0;
+
+    /**
+     * Returns a client for the endpoint of the specified storage: a
+     * DirectoryStorageClient for file:// endpoints, an S3StorageClient
+     * otherwise. Throws if S3 support isn't compiled in.
+     */
+    static std::shared_ptr<ObjectStorageClient> create(std::shared_ptr<ArchiveStorageDescr> storage);
+
+    /**
+     * Returns true if S3 endpoints are supported.
+     */
+    static bool s3Supported();
+
+  };
+
+  /**
+   * A bucket in a local directory, the directory of a file://
+   * endpoint. Objects are stored as files below <directory>/<bucket>,
+   * the key used as their relative path. Parts of multipart uploads are
+   * kept in a directory of their own below <bucket>/.uploads until the
+   * upload is completed. An object shows up under its key only once it's
+   * complete.
+   *
+   * Meant for mounted network filesystems and for testing.
+   */
+  class DirectoryStorageClient : public ObjectStorageClient {
+  private:
+
+    boost::filesystem::path root;
+
+    std::atomic<unsigned long long> upload_seq { 0 };
+
+    virtual boost::filesystem::path objectPath(const std::string &key);
+    virtual boost::filesystem::path uploadPath(const std::string &upload_id);
+
+    /*
+     * Writes data into path under a temporary name and
+     * renames it afterwards.
+     */
+    virtual void writeFile(const boost::filesystem::path &path,
+                           const char *data,
+                           size_t len);
+
+  public:
+
+    DirectoryStorageClient(std::shared_ptr<ArchiveStorageDescr> storage);
+    virtual ~DirectoryStorageClient();
+
+    virtual void putObject(const std::string &key,
+                           const char *data,
+                           size_t len);
+    virtual std::string createMultipartUpload(const std::string &key);
+    virtual std::string uploadPart(const std::string &key,
+                                   const std::string &upload_id,
+                                   unsigned int part_number,
+                                   const char *data,
+                                   size_t len);
+    virtual void completeMultipartUpload(const std::string &key,
+                                         const std::string &upload_id,
+                                         const std::vector<std::string> &etags);
+    virtual void abortMultipartUpload(const std::string &key,
+                                      const std::string &upload_id);
+
+  };
+
+#if defined(PG_BACKUP_CTL_HAS_LIBCURL) && defined(PG_BACKUP_CTL_HAS_OPENSSL)
+
+  /**
+   * S3 API client using libcurl. Requests are signed with AWS
+   * signature version 4, objects are addressed path-style as
+   * <endpoint>/<bucket>/<key>, which S3-compatible services like MinIO
+   * or Ceph support as well.
+   *
+   * Credentials are never stored in the catalog. They're read from
+   * the environment of the process like the AWS command line tools
+   * do: AWS_ACCESS_KEY_ID, AWS_SECRET_ACCESS_KEY and optionally
+   * AWS_SESSION_TOKEN. Payloads are sent as UNSIGNED-PAYLOAD, so use
+   * an https:// endpoint to protect them in transit.
+   */
+  class S3StorageClient : public ObjectStorageClient {
+  private:
+
+    std::string access_key = "";
+    std::string secret_key = "";
+    std::string session_token = "";
+
+    /* endpoint without a trailing slash and its host[:port] */
+    std::string base_url = "";
+    std::string host = "";
+
+    /*
+     * Performs a signed request on the object key, query must
+     * be canonical already (sorted, URI encoded). Returns the HTTP
+     * status, the response body and the ETag response header, if any.
+     */
+    virtual long request(const std::string &method,
+                         const std::string &key,
+                         const std::string &query,
+                         const char *data,
+                         size_t len,
+                         std::string &response,
+                         std::string &etag);
+
+    /*
+     * Returns the Authorization header of a request.
+     */
+    virtual std::string authorization(const std::string &method,
+                                      const std::string &uri,
+                                      const std::string &query,
+                                      const std::string &amz_date);
+
+    /*
+     * Throws a CArchiveIssue describing a failed request.
+     */
+    virtual void failed(const std::string &what,
+                        long status,
+                        const std::string &response);
+
+  public:
+
+    S3StorageClient(std::shared_ptr<ArchiveStorageDescr> storage);
+    virtual ~S3StorageClient();
+
+    virtual void putObject(const std::string &key,
+                           const char *data,
+                           size_t len);
+    virtual std::string createMultipartUpload(const std::string &key);
+    virtual std::string uploadPart(const std::string &key,
+                                   const std::string &upload_id,
+                                   unsigned int part_number,
+                                   const char *data,
+                                   size_t len);
+    virtual void completeMultipartUpload(const std::string &key,
+                                         const std::string &upload_id,
+                                         const std::vector<std::string> &etags);
+    virtual void abortMultipartUpload(const std::string &key,
+                                      const std::string &upload_id);
+
+    /**
+     * URI encodes a string as required by signature version 4,
+     * with slashes kept if encode_slash is false.
+     */
+    static std::string uriEncode(const std::string &in, bool encode_slash = true);
+
+  };
+
+#endif
+
+  /**
+   * Uploads queued files (see UploadDescr) to the object storage
+   * of an archive.
+   *
+   * Files up to the part size of the storage are uploaded with a single
+   * request. Larger files are uploaded in parts by up to storage->parallel
+   * threads, each reading the next part not taken yet into a buffer of its
+   * own. All threads share a rate limiter, so the storage's max_rate is
+   * a limit for the whole upload. A failed part is retried PART_ATTEMPTS
+   * times before the upload is aborted.
+   *
+   * The local file is never touched, it stays in the archive until
+   * retention removes it.
+   */
+  class ObjectUploader {
+  private:
+
+    std::shared_ptr<ArchiveStorageDescr> storage = nullptr;
+    std::shared_ptr<ObjectStorageClient> client = nullptr;
+    ArchiveRateLimiter limiter;
+
+    std::atomic<bool> cancelled { false };
+
+    /*
+     * Uploads part number part_number, retrying it on errors.
+     */
+    virtual std::string uploadPart(const std::string &key,
+                                   const std::string &upload_id,
+                                   unsigned int part_number,
+                                   const char *data,
+                                   size_t len);
+
+  public:
+
+    /**
+     * Number of times a single part is tried.
+     */
+    const static unsigned int PART_ATTEMPTS = 3;
+
+    /**
+     * Number of times a queued file is tried before it's
+     * left alone as failed.
+     */
+    const static unsigned int MAX_ATTEMPTS = 5;
+
+    /**
+     * Number of seconds between two checks of the launcher
+     * for pending uploads.
+     */
+    const static unsigned int REFRESH_INTERVAL = 60;
+
+    /**
+     * With client set to a nullptr, the client is created
+     * from the endpoint of the storage.
+     */
+    ObjectUploader(std::shared_ptr<ArchiveStorageDescr> storage,
+                   std::shared_ptr<ObjectStorageClient> client = nullptr);
+    virtual ~ObjectUploader();
+
+    /**
+     * Returns the object key of a file at the specified path
+     * relative to the archive directory.
+     */
+    static std::string objectKey(std::shared_ptr<ArchiveStorageDescr> storage,
+                                 const std::string &relative_path);
+
+    /**
+     * Uploads the file of the queued upload to its object key. A
+     * multipart upload left over by a former attempt is aborted
+     * first. started is called with the upload ID set once a multipart
+     * upload was created, so the caller can record it. Throws a
+     * CArchiveIssue if the upload failed.
+     */
+    virtual void upload(std::shared_ptr<UploadDescr> upload,
+                        std::function<void(std::shared_ptr<UploadDescr>)> started = nullptr);
+
+    /**
+     * Lets a running upload() fail as soon as possible. Safe
+     * to call from another thread.
+     */
+    virtual void cancel();
+
+    /**
+     * Number of bytes uploaded so far.
+     */
+    virtual uint64_t bytesUploaded();
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef __HAVE_WALCACHE_HXX__
+#define __HAVE_WALCACHE_HXX__
+
+#include <sys/types.h>
+#include <cstdint>
+
+#include <fs-archive.hxx>
+
+namespace pgbckctl {
+
+  /**
+   * Statistics of a WALSegmentCache, see WALSegmentCache::stats().
+   */
+  typedef struct wal_segment_cache_stats {
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+
+  } wal_segment_cache_stats;
+
+  /**
+   * Cache of decompressed pages of compressed XLOG segments, shared
+   * by all connections of a recovery stream.
+   *
+   * Serving the same segments to several standbys, or to a fleet of
+   * clones restoring the same WAL, would otherwise decompress them once
+   * per reader. Uncompressed segments are sent with sendfile() and are
+   * shared by the page cache of the kernel already, so they don't need
+   * this.
+   *
+   * The cache lives in an anonymous shared mapping created by the
+   * streaming server before it starts serving connections, so sessions
+   * served by threads and by forked processes see the same cache. Pages
+   * are PAGE_SIZE bytes and keyed by archive, timeline, segment number
+   * and page within the segment. The cache is WAYS-way set associative:
+   * a page can only be stored within the set selected by the hash of its
+   * key and evicts the least recently used page of that set, so a lookup
+   * never looks at more than WAYS slots.
+   *
+   * The slots are protected by a process shared mutex within the
+   * mapping, which is held while copying a page in or out, but never
+   * while decompressing. Concurrent readers missing the same page both
+   * decompress it, the second insert just refreshes the slot.
+   *
+   * Throws a CArchiveIssue if the mapping can't be created.
+   */
+  class WALSegmentCache {
+  private:
+
+    /* The shared mapping and its size */
+    void *mapping = nullptr;
+    size_t mapping_size = 0;
+
+    /* Number of sets, each with WAYS slots */
+    unsigned long long nsets = 0;
+
+    /**
+     * Returns the set the specified page belongs to.
+     */
+    unsigned long long findSet(int archive_id,
+                               unsigned int timeline,
+                               unsigned long long segno,
+                               unsigned long long pageno);
+
+  public:
+
+    /**
+     * Size of a cached page.
+     */
+    static const size_t PAGE_SIZE = 128 * 1024;
+
+    /**
+     * Number of slots of each set.
+     */
+    static const unsigned int WAYS = 8;
+
+    /**
+     * Creates a cache of size bytes, rounded down to a multiple
+     * of PAGE_SIZE * WAYS. A size smaller than that is an error.
+     */
+    WALSegmentCache(size_t size);
+    virtual ~WALSegmentCache();
+
+    /**
+     * Copies the specified page into buf, which must have room
+     * for PAGE_SIZE bytes. Returns false if the page isn't cached.
+     */
+    virtual bool read(int archive_id,
+                      unsigned int timeline,
+                      unsigned long long segno,
+                      unsigned long long pageno,
+                      char *buf);
+
+    /**
+     * Stores PAGE_SIZE bytes of buf as the specified page.
+     */
+    virtual void insert(int archive_id,
+                        unsigned int timeline,
+                        unsigned long long segno,
+                        unsigned long long pageno,
+                        const char *buf);
+
+    /**
+     * Number of pages the cache can hold.
+     */
+    virtual unsigned long long getPages();
+
+    /**
+     * Returns the hit, miss and eviction counters
+     * of all users of the cache.
+     */
+    virtual wal_segment_cache_stats stats();
+
+  };
+
+}
+
+#endif
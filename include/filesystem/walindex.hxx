@@ -0,0 +1,287 @@
+#ifndef __HAVE_WALINDEX_HXX__
+#define __HAVE_WALINDEX_HXX__
+
+#include <sys/types.h>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fs-archive.hxx>
+
+namespace pgbckctl {
+
+  /**
+   * A single file tracked by a WALSegmentIndex.
+   *
+   * segno is the XLOG segment number derived from the filename
+   * and the WAL segment size of the index. TLI history files are
+   * tracked with segno 0.
+   *
+   * size is the uncompressed size of the file, if known. Partial
+   * segment files are still being written, so they are recorded
+   * with a size of 0.
+   *
+   * crc32c is the finalized CRC-32C over the uncompressed contents of
+   * a completed segment, only valid if has_checksum is set. Checksums
+   * are recorded while streaming with walstreamer.validate = checksums.
+   */
+  typedef struct WALSegmentIndexEntry {
+
+    unsigned int timeline = 0;
+    unsigned long long segno = 0;
+    WALSegmentFileStatus status = WAL_SEGMENT_UNKNOWN;
+    unsigned long long size = 0;
+    std::string filename = "";
+    bool has_checksum = false;
+    uint32_t crc32c = 0;
+
+    /**
+     * True if this entry is a completed or partial XLOG
+     * segment, false for TLI history files.
+     */
+    bool isSegment() const;
+
+  } WALSegmentIndexEntry;
+
+  /**
+   * Persistent index of the XLOG segment and TLI history files
+   * within an archive log/ directory.
+   *
+   * Determining the streaming start position or the files to remove
+   * during retention requires looking at every file within the log
+   * directory, which takes minutes with hundreds of thousands of
+   * segments, especially when compressed segments need to be opened.
+   * The index is maintained incrementally by TransactionLogBackup
+   * while streaming instead and answers those questions from
+   * an in-memory ordered map.
+   *
+   * On disk, the index is a sidecar file within the log directory
+   * (see INDEX_FILENAME). It consists of a fixed size header followed
+   * by fixed size records, each one either adding or removing a
+   * file. New records are appended, removals compact the file into
+   * add records only. The format uses host byte order, since the
+   * index is never shipped anywhere and can always be rebuilt.
+   *
+   * The header carries a stamp of the log directory after the last
+   * change recorded in the index: its modification time, or a hash
+   * over the modification times of all shard directories for a sharded
+   * log directory. If the directory was changed behind our back (files
+   * copied or removed manually, an older release streaming into the
+   * archive), the recorded stamp doesn't match anymore and the index
+   * is rebuilt from a full directory scan. The same happens if the index is missing, was
+   * written with a different WAL segment size or is truncated. Segment checksums can't
+   * be recovered from a directory scan, so a rebuild keeps the checksums of
+   * all files it already knew.
+   *
+   * Every operation takes an exclusive flock() on the index file,
+   * so a streamer and a retention run in another process don't
+   * overwrite each other's changes. Changes made by other
+   * processes are picked up before the in-memory state is used.
+   *
+   * All methods throw a CArchiveIssue in case of errors.
+   */
+  class WALSegmentIndex {
+  private:
+
+    /**
+     * Ordering of the in-memory index: segment number first,
+     * then timeline, so the last entry is what receivewal.c
+     * would pick as the streaming start point.
+     */
+    typedef struct WALSegmentIndexKey {
+
+      unsigned long long segno;
+      unsigned int timeline;
+      std::string filename;
+
+      bool operator<(const WALSegmentIndexKey &other) const;
+
+    } WALSegmentIndexKey;
+
+    /* Path of the log directory */
+    path logdir;
+
+    /* Path of the sidecar index file */
+    path indexfile;
+
+    /* WAL segment size used to derive segment numbers */
+    unsigned long long wal_segment_size = 0;
+
+    /* Open index file while an operation holds its lock */
+    int fd = -1;
+
+    /*
+     * Size, inode and generation of the index file we've replayed
+     * so far. The generation is bumped whenever the file is rewritten.
+     */
+    off_t loaded_size = 0;
+    ino_t loaded_ino = 0;
+    uint64_t loaded_generation = 0;
+
+    /* The in-memory index */
+    std::map<WALSegmentIndexKey, WALSegmentIndexEntry> entries;
+
+    /* Serializes threads sharing this instance */
+    std::recursive_mutex mtx;
+
+    /**
+     * Builds an index entry from the specified filename. Returns
+     * false if this isn't a XLOG segment or TLI history filename.
+     */
+    virtual bool makeEntry(const std::string &filename,
+                           unsigned long long size,
+                           WALSegmentIndexEntry &entry);
+
+    /**
+     * Opens the index file and locks it. If the index file is
+     * new, empty or damaged, the index is rebuilt by scanning
+     * the log directory. Otherwise, records appended by others are
+     * replayed into the in-memory index.
+     *
+     * If check_stamp is true, the index is also rebuilt if the log
+     * directory was modified after the last recorded change. Callers
+     * which just changed the directory themselves pass false. With
+     * force_scan set, the index is rebuilt unconditionally.
+     */
+    virtual void lock(bool check_stamp, bool force_scan = false);
+
+    /**
+     * Releases the lock and closes the index file.
+     */
+    virtual void unlock();
+
+    /**
+     * Reads the index file into memory. Returns false if the
+     * index file needs to be rebuilt.
+     */
+    virtual bool readIndex(bool check_stamp);
+
+    /**
+     * Scans the log directory and rewrites the index file
+     * from the result.
+     */
+    virtual void scan();
+
+    /**
+     * Rewrites the index file from the in-memory index.
+     */
+    virtual void rewrite();
+
+    /**
+     * Appends add or remove records for the specified entries.
+     */
+    virtual void append(const std::vector<WALSegmentIndexEntry> &add,
+                        const std::vector<WALSegmentIndexEntry> &del);
+
+    /**
+     * Writes the header, stamped with the current modification
+     * time of the log directory.
+     */
+    virtual void writeHeader(bool valid);
+
+    /**
+     * Helper functions to modify the in-memory index.
+     */
+    virtual void insertEntry(const WALSegmentIndexEntry &entry);
+    virtual void eraseEntry(const WALSegmentIndexEntry &entry);
+
+  public:
+
+    /**
+     * Name of the sidecar index file within the log directory.
+     */
+    static const char *INDEX_FILENAME;
+
+    WALSegmentIndex(path logdir, unsigned long long wal_segment_size);
+    virtual ~WALSegmentIndex();
+
+    /**
+     * Loads the index, rebuilding it from a directory scan
+     * if required.
+     */
+    virtual void load();
+
+    /**
+     * Unconditionally rebuilds the index from a directory scan.
+     */
+    virtual void rebuild();
+
+    /**
+     * Removes the index file, forcing the next operation
+     * to rebuild it. Used after errors, when the index can't
+     * be trusted anymore.
+     */
+    virtual void invalidate();
+
+    /**
+     * Records a new file in the log directory. The file
+     * is expected to exist already.
+     */
+    virtual void add(const std::string &filename,
+                     unsigned long long size);
+
+    /**
+     * Records a file renamed within the log directory, e.g.
+     * a partial segment being finalized.
+     */
+    virtual void rename(const std::string &oldname,
+                        const std::string &newname,
+                        unsigned long long size);
+
+    /**
+     * Same as above, but records the CRC-32C of the
+     * completed segment, too.
+     */
+    virtual void rename(const std::string &oldname,
+                        const std::string &newname,
+                        unsigned long long size,
+                        uint32_t crc32c);
+
+    /**
+     * Records files removed from the log directory.
+     */
+    virtual void remove(const std::vector<std::string> &filenames);
+
+    /**
+     * Retrieves the XLOG segment with the highest segment number
+     * and timeline. Returns false if there's no segment in the index.
+     */
+    virtual bool last(WALSegmentIndexEntry &entry);
+
+    /**
+     * Returns all XLOG segments of the specified timeline with
+     * segment numbers between startSegno and endSegno (both inclusive),
+     * ordered by segment number.
+     */
+    virtual std::vector<WALSegmentIndexEntry> range(unsigned int timeline,
+                                                    unsigned long long startSegno,
+                                                    unsigned long long endSegno);
+
+    /**
+     * Returns a copy of all entries of the index, ordered
+     * by segment number and timeline.
+     */
+    virtual std::vector<WALSegmentIndexEntry> getEntries();
+
+    /**
+     * Number of entries in the index.
+     */
+    virtual size_t size();
+
+    /**
+     * Path of the index file.
+     */
+    virtual path getIndexPath();
+
+    /**
+     * WAL segment size this index was created with.
+     */
+    virtual unsigned long long getWalSegmentSize();
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef __HAVE_CATALOGQUEUE_HXX__
+#define __HAVE_CATALOGQUEUE_HXX__
+
+#include <boost/interprocess/ipc/message_queue.hpp>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace pgbckctl {
+
+  class BackupCatalog;
+  class StreamIdentification;
+
+  /**
+   * Max length of XLOG positions and stream states carried
+   * by a catalog status message, including the terminating NUL byte.
+   */
+#define CATALOG_STATUS_MSG_FIELD_LEN 32
+
+  /**
+   * A stream status update, as transferred through
+   * a CatalogStatusQueue.
+   */
+  typedef struct {
+
+    int stream_id = -1;
+    unsigned int timeline = 0;
+    char xlogpos[CATALOG_STATUS_MSG_FIELD_LEN] = "";
+    char status[CATALOG_STATUS_MSG_FIELD_LEN] = "";
+
+  } catalog_stream_status_msg;
+
+  /**
+   * Routes stream status updates of background workers through
+   * the launcher of their catalog.
+   *
+   * Every WAL streamer used to update its stream status in the catalog
+   * by itself. With many streams per catalog, all of them compete for
+   * the single SQLite write lock, and each update is a transaction
+   * of its own. Instead, workers put their status updates into a
+   * message queue owned by the launcher. The launcher collects them,
+   * keeps only the latest update per stream and writes all of them
+   * within a single transaction, either every flush interval or as
+   * soon as enough updates are pending.
+   *
+   * The launcher calls create() once and receive()/flush() from
+   * its processing loop. Workers call attach(), which fails if no
+   * launcher is running for the catalog, and send(). If an update
+   * can't be queued, workers are expected to write it into the
+   * catalog directly.
+   */
+  class CatalogStatusQueue {
+  private:
+
+    /* Name of the message queue, derived from the catalog name */
+    std::string name;
+
+    boost::interprocess::message_queue *queue = nullptr;
+
+    /* Latest pending update per stream id, collected by receive() */
+    std::map<int, catalog_stream_status_msg> pending;
+
+    std::chrono::steady_clock::time_point last_flush;
+
+    /* milliseconds between flushes */
+    unsigned int flush_interval = DEFAULT_FLUSH_INTERVAL;
+
+  public:
+
+    /**
+     * Number of messages the queue can hold.
+     */
+    const static unsigned int QUEUE_SIZE = 1024;
+
+    /**
+     * Default flush interval in milliseconds.
+     */
+    const static unsigned int DEFAULT_FLUSH_INTERVAL = 100;
+
+    /**
+     * Number of pending updates which triggers a flush
+     * regardless of the flush interval.
+     */
+    const static unsigned int FLUSH_THRESHOLD = 256;
+
+    CatalogStatusQueue(std::string catalog_name);
+    virtual ~CatalogStatusQueue();
+
+    /**
+     * Creates the message queue or opens an existing one. Used
+     * by the launcher.
+     */
+    virtual void create();
+
+    /**
+     * Opens the message queue of a running launcher. Returns false
+     * if there is none.
+     */
+    virtual bool attach();
+
+    /**
+     * Returns true if the message queue was created or attached.
+     */
+    virtual bool isAvailable();
+
+    /**
+     * Queues a status update of the specified stream. Waits up to
+     * timeout_ms milliseconds if the queue is full. Returns false if the
+     * update couldn't be queued.
+     */
+    virtual bool send(StreamIdentification &ident,
+                      unsigned int timeout_ms = 1000);
+
+    /**
+     * Receives all queued updates without waiting. Returns the
+     * number of received messages.
+     */
+    virtual size_t receive();
+
+    /**
+     * True if pending updates should be written now, because the
+     * flush interval passed or FLUSH_THRESHOLD updates are pending.
+     */
+    virtual bool flushDue();
+
+    /**
+     * Milliseconds until the pending updates are due to be written,
+     * 0 if a flush is due already. If nothing is pending, this is
+     * the flush interval. Used by the launcher to bound the time it
+     * blocks on its command queue.
+     */
+    virtual unsigned int msUntilFlush();
+
+    /**
+     * Writes all pending updates into the catalog within a
+     * single transaction. Returns the number of updated streams. If the
+     * transaction fails, updates are kept and retried by the next
+     * flush(), and the error is rethrown.
+     */
+    virtual size_t flush(std::shared_ptr<BackupCatalog> catalog);
+
+    /**
+     * Number of streams with pending updates.
+     */
+    virtual size_t pendingUpdates();
+
+    /**
+     * Sets the flush interval in milliseconds.
+     */
+    virtual void setFlushInterval(unsigned int interval_ms);
+
+    /**
+     * Returns the message queue name used for the specified catalog.
+     */
+    static std::string queueName(std::string catalog_name);
+
+    /**
+     * Removes the message queue of the specified catalog.
+     */
+    static void remove(std::string catalog_name);
+
+  };
+
+}
+
+#endif
@@ -12,12 +12,24 @@
 #define DAEMON_STATUS_UPDATE 3
 #define DAEMON_FAILURE 4
 
+/*
+ * Max number of milliseconds an idle launcher blocks on its
+ * command queue. This bounds the delay of reaping dead workers
+ * and reacting on shutdown requests, since signals don't interrupt
+ * waiting on an interprocess message queue.
+ */
+#define LAUNCHER_IDLE_TIMEOUT_MS 1000
+
 namespace pgbckctl {
 
   /* Forwarded declarations */
   class BackgroundWorker;
   class BaseCatalogCommand;
   class BackupCatalog;
+  class CatalogStatusQueue;
+  class WorkerPool;
+  class JobScheduler;
+  class MetricsServer;
 
   /*
    * Launcher errors are mapped to
@@ -104,6 +116,43 @@ namespace pgbckctl {
      */
     std::shared_ptr<BackupCatalog> catalog = nullptr;
 
+    /*
+     * Stream status updates sent by background workers, written
+     * into the catalog by the launcher. Only set in the launcher,
+     * see establish_status_queue().
+     */
+    std::shared_ptr<CatalogStatusQueue> status_queue = nullptr;
+
+    /*
+     * Current command queue timeout of an idle launcher,
+     * see next_wakeup().
+     */
+    unsigned int idle_wait = 0;
+
+    /*
+     * Pre-forked workers executing commands of this launcher,
+     * see establish_worker_pool(). Only set in the launcher.
+     */
+    std::shared_ptr<WorkerPool> worker_pool = nullptr;
+
+    /*
+     * Starts the jobs of the schedule catalog table, see
+     * establish_scheduler(). Only set in the launcher.
+     */
+    std::shared_ptr<JobScheduler> scheduler = nullptr;
+
+    /*
+     * Exports the state of the workers, see
+     * establish_metrics_server(). Only set in the launcher.
+     */
+    std::shared_ptr<MetricsServer> metrics_server = nullptr;
+
+    /* Last time the archive statistics were read, see refresh_metrics() */
+    std::time_t metrics_refreshed = 0;
+
+    /* Last time the upload queue was checked, see upload_commands() */
+    std::time_t uploads_checked = 0;
+
   public:
     BackgroundWorker(job_info info);
     ~BackgroundWorker();
@@ -121,6 +170,96 @@ namespace pgbckctl {
      */
     virtual void prepareShutdown();
 
+    /**
+     * Creates the stream status queue of this launcher. Background
+     * workers attach to it to get their status updates written
+     * into the catalog in batches by the launcher.
+     */
+    virtual void establish_status_queue();
+
+    /**
+     * Receives queued stream status updates and writes them into
+     * the catalog if a flush is due. With force set, all pending
+     * updates are written immediately. Errors are logged, pending
+     * updates are retried by the next call then.
+     */
+    virtual size_t process_status_queue(bool force = false);
+
+    /**
+     * Number of milliseconds the launcher may block on its
+     * command queue before it has to look after its workers
+     * again. With busy set, something happened during the last
+     * round of the launcher loop, so stream status updates are
+     * expected to arrive soon and the flush interval of the status
+     * queue is used. Otherwise the timeout backs off up to
+     * LAUNCHER_IDLE_TIMEOUT_MS.
+     */
+    virtual unsigned int next_wakeup(bool busy);
+
+    /**
+     * Creates the worker pool of this launcher, if the job
+     * descriptor asks for one, and forks its workers.
+     */
+    virtual void establish_worker_pool();
+
+    /**
+     * Processes state changes of pool workers, drops pool workers
+     * which exited and forks replacements. Returns true if anything
+     * happened.
+     */
+    virtual bool maintain_worker_pool();
+
+    /**
+     * Hands the command over to an idle pool worker. Returns false
+     * if there's no worker pool or no idle pool worker, or the command
+     * can't be executed by a pool worker.
+     */
+    virtual bool dispatch_to_pool(std::string command);
+
+    /**
+     * Tells all pool workers to exit and removes the
+     * queues of the worker pool.
+     */
+    virtual void shutdown_worker_pool();
+
+    /**
+     * Creates the job scheduler of this launcher with the
+     * limits of the job descriptor.
+     */
+    virtual void establish_scheduler();
+
+    /**
+     * Adds the commands of all scheduled jobs which are due and
+     * can be started now to commands. Returns their number.
+     */
+    virtual size_t scheduled_commands(std::vector<std::string> &commands);
+
+    /**
+     * Adds an UPLOAD ARCHIVE command to commands for every archive
+     * with pending uploads and no uploader running. Checks the catalog
+     * every ObjectUploader::REFRESH_INTERVAL seconds at most. Returns
+     * the number of commands added.
+     */
+    virtual size_t upload_commands(std::vector<std::string> &commands);
+
+    /**
+     * Starts the metrics endpoint of this launcher, if the job
+     * descriptor configures a port for it.
+     */
+    virtual void establish_metrics_server();
+
+    /**
+     * Passes the archive statistics to the metrics endpoint every
+     * MetricsServer::REFRESH_INTERVAL seconds. This is the only place
+     * the metrics endpoint gets anything from the catalog.
+     */
+    virtual void refresh_metrics();
+
+    /**
+     * Stops the metrics endpoint of this launcher.
+     */
+    virtual void shutdown_metrics_server();
+
     /**
      * Returns a pointer to the worker shared memory segment.
      */
@@ -181,8 +320,20 @@ namespace pgbckctl {
   void establish_launcher_cmd_queue(job_info &info);
   void send_launcher_cmd(job_info& info, std::string command);
   std::string recv_launcher_cmd(job_info &info, bool &cmd_received);
+
+  /**
+   * Same as above, but blocks up to timeout_ms milliseconds
+   * until a command arrives.
+   */
+  std::string recv_launcher_cmd(job_info &info, bool &cmd_received,
+                                unsigned int timeout_ms);
   pid_t worker_command(BackgroundWorker &worker, std::string command);
 
+  /**
+   * Forks a pool worker of the launcher, see WorkerPool.
+   */
+  pid_t pool_worker(BackgroundWorker &worker, std::string catalog_name);
+
   /**
    * Returns true in case a background launcher process
    * for the given catalog instance is really running.
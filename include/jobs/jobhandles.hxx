@@ -111,6 +111,29 @@ namespace pgbckctl {
      */
     boost::interprocess::message_queue *command_queue = nullptr;
 
+    /*
+     * Number of pre-forked pool workers the launcher
+     * executes commands with, 0 disables the worker pool.
+     * See WorkerPool.
+     */
+    unsigned int worker_pool_size = 0;
+
+    /*
+     * Limits for jobs started from the schedule catalog
+     * table, see JobScheduler.
+     */
+    unsigned int schedule_max_basebackups = 1;
+    unsigned int schedule_max_verifies = 1;
+    unsigned int schedule_stagger = 0;
+    unsigned int schedule_max_wal_lag = 0;
+
+    /*
+     * Address and port of the metrics endpoint of the
+     * launcher, see MetricsServer. Port 0 disables it.
+     */
+    unsigned int metrics_port = 0;
+    std::string metrics_address = "127.0.0.1";
+
   } job_info;
 
 
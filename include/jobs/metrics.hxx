@@ -0,0 +1,123 @@
+#ifndef __HAVE_PGBCKCTL_METRICS__
+#define __HAVE_PGBCKCTL_METRICS__
+
+/*
+ * NOTE:
+ *
+ * Like server.hxx, this header doesn't include anything
+ * from pgbckctl-common, the boost::asio definitions are kept
+ * private in metrics.cxx.
+ */
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pgbckctl {
+
+  /* Forward class declarations */
+  class WorkerSHM;
+  class StatCatalogArchive;
+  class LauncherMetricsEndpoint;
+
+  /*
+   * Metrics server API exceptions
+   */
+  class MetricsServerFailure : public std::exception {
+  protected:
+
+    std::string errstr;
+
+  public:
+
+    MetricsServerFailure(const char *err) throw() : errstr() {
+      errstr = err;
+    }
+
+    MetricsServerFailure(std::string err) throw() : errstr() {
+      errstr = err;
+    }
+
+    virtual ~MetricsServerFailure() throw() {}
+
+    const char *what() const throw() {
+      return errstr.c_str();
+    }
+
+  };
+
+  /**
+   * HTTP endpoint of a launcher, exporting the state of its workers
+   * in the OpenMetrics text format. GET /metrics returns
+   *
+   * - the workers registered in the worker shared memory,
+   * - the statistics of the WAL streams, including their sync latency,
+   * - the progress of running basebackups,
+   * - backup counts and sizes of all archives in the catalog.
+   *
+   * Requests are answered by a thread of its own. The worker shared
+   * memory is read without locking, see WorkerSHM::read(), and the
+   * catalog isn't read by a request at all. Instead, the launcher passes
+   * the archive statistics with setCatalogStats() every REFRESH_INTERVAL
+   * seconds, which renders them once for all following requests. A
+   * scrape costs a pass over the worker slots then.
+   *
+   * The request thread doesn't log, since the launcher forks its
+   * workers while it might hold the lock of the logger.
+   */
+  class MetricsServer {
+  protected:
+    std::shared_ptr<LauncherMetricsEndpoint> instance = nullptr;
+  public:
+
+    /**
+     * Number of seconds after which the launcher should
+     * pass the archive statistics again.
+     */
+    const static unsigned int REFRESH_INTERVAL = 60;
+
+    /**
+     * worker_shm may be a nullptr, only the catalog statistics
+     * are exported then.
+     */
+    MetricsServer(std::string address, unsigned int port, WorkerSHM *worker_shm);
+    virtual ~MetricsServer();
+
+    /**
+     * Listens on the address and port of this server and starts
+     * answering requests. Throws a MetricsServerFailure if the
+     * address can't be bound.
+     */
+    virtual void start();
+
+    /**
+     * Stops answering requests and closes the listening socket.
+     */
+    virtual void stop();
+
+    /**
+     * Replaces the exported archive statistics, as returned
+     * by BackupCatalog::statCatalogArchives() at now.
+     */
+    virtual void setCatalogStats(std::vector<std::shared_ptr<StatCatalogArchive>> &list,
+                                 std::time_t now);
+
+    /**
+     * To be called by a process forked from the launcher. Closes
+     * the listening socket inherited from the launcher, without
+     * touching the state shared with the request thread, which
+     * doesn't exist in the forked process.
+     */
+    virtual void closeAfterFork();
+
+    /**
+     * Returns the metrics exposition as returned by GET /metrics.
+     */
+    virtual std::string render();
+
+  };
+
+}
+
+#endif
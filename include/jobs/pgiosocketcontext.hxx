@@ -2,6 +2,9 @@
 #define __HAVE_PGIOSOCKETCONTEXT_HXX_
 
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
+#include <memory>
 #include <exectx.hxx>
 
 namespace pgbckctl {
@@ -72,6 +75,11 @@ namespace pgbckctl {
      * COPY subprotocol doesn't need startup message processing, thus handlers
      * implementing that functionality just need to provide an empty callback
      * in this case.
+     *
+     * I/O contexts served by more than one thread of an io_service should
+     * set a strand, which serializes their callbacks, and return a reference
+     * to themselves by io_owner(), which keeps them alive until all
+     * their pending callbacks are done.
      */
     class PGSocketIOContextInterface : public ExecutableContext {
     protected:
@@ -79,6 +87,32 @@ namespace pgbckctl {
       ExecutableContextName name = EXECUTABLE_CONTEXT_SOCKET_IO;
       boost::asio::ip::tcp::socket *soc = nullptr;
 
+      /**
+       * If set, all callbacks are dispatched through this strand.
+       */
+      boost::asio::io_service::strand *strand = nullptr;
+
+      /**
+       * Returns a reference which is held by pending callbacks. The
+       * default implementation returns a nullptr, the caller has
+       * to keep the I/O context valid then.
+       */
+      virtual std::shared_ptr<void> io_owner();
+
+      /**
+       * Called with the exception thrown by a callback, from within
+       * its catch block. The default implementation rethrows the exception,
+       * which is then passed to the caller of io_service::run().
+       */
+      virtual void io_failure(std::exception &e);
+
+      /**
+       * Reads the contents of the specified buffer from the socket
+       * and passes the result to handler.
+       */
+      template<typename Handler>
+      void async_read_buffer(ProtocolBuffer &buffer, Handler handler);
+
       /**
        * Internal callback handler for outgoing protocol messages
        */
@@ -111,6 +145,12 @@ namespace pgbckctl {
 
     public:
 
+      /*
+       * Buffers of this connection borrow from this pool, so
+       * that the memory of messages is recycled.
+       */
+      std::shared_ptr<MemoryBufferPool> buffer_pool = std::make_shared<MemoryBufferPool>();
+
       /*
        * I/O buffers for protocol communication.
        */
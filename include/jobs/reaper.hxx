@@ -1,6 +1,8 @@
 #ifndef __HAVE_REAPER_HXX__
 #define __HAVE_REAPER_HXX__
 
+#include <csignal>
+
 #include <BackupCatalog.hxx>
 #include <shm.hxx>
 
@@ -9,6 +11,16 @@ namespace pgbckctl {
   class background_reaper {
   public:
     std::stack<pid_t> dead_pids;
+
+    /*
+     * All children of the launcher which terminated, for
+     * whatever reason. Used to replace pool workers, so only
+     * filled if track_exited is set, otherwise nobody would
+     * ever drain it.
+     */
+    std::stack<pid_t> exited_pids;
+    volatile sig_atomic_t track_exited = 0;
+
     virtual void reap() = 0;
   };
 
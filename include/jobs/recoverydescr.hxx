@@ -67,6 +67,18 @@ namespace pgbckctl {
      */
     std::string version;
 
+    /**
+     * Number of threads serving client connections. 0 forks
+     * a process for each connection instead.
+     */
+    unsigned int connection_threads = 4;
+
+    /**
+     * Size of the cache of decompressed WAL shared by all
+     * client connections, in MB. 0 disables the cache.
+     */
+    unsigned int wal_cache_size = 64;
+
   };
 }
 
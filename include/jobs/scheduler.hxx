@@ -0,0 +1,203 @@
+#ifndef __HAVE_SCHEDULER_HXX__
+#define __HAVE_SCHEDULER_HXX__
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <descr.hxx>
+
+namespace pgbckctl {
+
+  class BackupCatalog;
+  class WorkerSHM;
+
+  /**
+   * Limits a JobScheduler obeys when starting scheduled jobs.
+   */
+  typedef struct job_scheduler_limits {
+
+    /* Max number of basebackups running at the same time, 0 means no limit */
+    unsigned int max_basebackups = 1;
+
+    /* Max number of verifications running at the same time, 0 means no limit */
+    unsigned int max_verifies = 1;
+
+    /* Min number of seconds between the start of two scheduled jobs */
+    unsigned int stagger = 0;
+
+    /*
+     * Scheduled jobs are deferred as long as any WAL stream lags
+     * behind its upstream by more than this number of bytes, 0 disables
+     * this check.
+     */
+    unsigned long long max_wal_lag = 0;
+
+  } job_scheduler_limits;
+
+  /**
+   * Starts the basebackups and verifications of the schedule catalog
+   * table from within the launcher, see ScheduleDescr.
+   *
+   * Schedules are read from the catalog every REFRESH_INTERVAL seconds,
+   * the scheduler doesn't touch the catalog otherwise except for recording
+   * the next run of a job it started. Calling next() is cheap as long as no
+   * job is due.
+   *
+   * A job is due at its next run, delayed by a random amount of up to
+   * its jitter seconds. The delay is derived from the schedule and its next
+   * run, so it doesn't change when the launcher restarts and doesn't add up
+   * over time. A schedule without a next run yet, e.g. a new one, gets a first
+   * run spread over its interval by its archive, so that schedules created
+   * at the same time don't start all at once.
+   *
+   * Due jobs are started in the order of their priority, then in the order
+   * they got due. A job which can't be started right now stays due, it's
+   * deferred until
+   *
+   * - the number of running jobs of its type drops below the limit,
+   * - stagger seconds have passed since the last scheduled job was started,
+   * - no WAL stream of the launcher lags more than max_wal_lag bytes.
+   *
+   * If the same job is still running for the archive, the run is skipped
+   * instead. Running jobs are counted from the worker shared memory. Jobs
+   * started by the scheduler count before their worker shows up there,
+   * for DISPATCH_GRACE seconds at most.
+   */
+  class JobScheduler {
+  private:
+
+    /*
+     * A schedule known to the scheduler.
+     */
+    typedef struct {
+
+      std::shared_ptr<ScheduleDescr> descr;
+
+      /* next run without jitter, see jitterDelay() */
+      std::time_t next_run;
+
+      /* true if the job was deferred already, to log this once */
+      bool deferred;
+
+    } scheduled_job;
+
+    /*
+     * A job started by the scheduler, but probably
+     * not yet visible in the worker shared memory.
+     */
+    typedef struct {
+
+      int archive_id;
+      ScheduleJobType type;
+      std::time_t started;
+
+    } dispatched_job;
+
+    std::shared_ptr<BackupCatalog> catalog = nullptr;
+    WorkerSHM *worker_shm = nullptr;
+    job_scheduler_limits limits;
+
+    std::vector<scheduled_job> jobs;
+    std::vector<dispatched_job> dispatched;
+
+    std::time_t last_refresh = 0;
+    std::time_t last_start = 0;
+
+    /* Earliest time any known job is due, see next() */
+    std::time_t earliest_due = 0;
+
+    /*
+     * Returns true if a job of the specified type is running
+     * for the archive. Counts the running jobs of this type, too.
+     */
+    virtual bool running(ScheduleJobType type,
+                         int archive_id,
+                         unsigned int &count);
+
+    /*
+     * Returns true if any WAL stream lags more than the limit.
+     */
+    virtual bool walStreamLagging();
+
+    /*
+     * Records the next run of a job after it was started or
+     * skipped at now.
+     */
+    virtual void reschedule(scheduled_job &job, std::time_t now, bool started);
+
+    /*
+     * Recomputes earliest_due from the known jobs.
+     */
+    virtual void updateEarliestDue();
+
+  public:
+
+    /**
+     * Number of seconds after which schedules are read
+     * again from the catalog.
+     */
+    const static unsigned int REFRESH_INTERVAL = 60;
+
+    /**
+     * Max number of seconds a started job is counted as
+     * running without showing up in the worker shared memory.
+     */
+    const static unsigned int DISPATCH_GRACE = 60;
+
+    /**
+     * The catalog must be opened, worker_shm may be a nullptr. Running
+     * jobs and WAL streams aren't looked at then.
+     */
+    JobScheduler(std::shared_ptr<BackupCatalog> catalog,
+                 WorkerSHM *worker_shm,
+                 job_scheduler_limits limits);
+    virtual ~JobScheduler();
+
+    /**
+     * Reads the schedules from the catalog, if REFRESH_INTERVAL
+     * seconds have passed since the last time or force is set.
+     */
+    virtual void refresh(std::time_t now, bool force = false);
+
+    /**
+     * Returns the command of the next job to start at now in command,
+     * false if there is none. The job counts as running from now on and its
+     * next run is recorded in the catalog. Call this until it returns
+     * false to start all jobs which can be started.
+     */
+    virtual bool next(std::time_t now, std::string &command);
+
+    /**
+     * Number of schedules known to the scheduler.
+     */
+    virtual unsigned int getNumberOfSchedules();
+
+    /**
+     * Next run of the specified job after previous, skipping runs
+     * which were missed at now.
+     */
+    static std::time_t nextRun(std::time_t previous,
+                               std::time_t now,
+                               unsigned int interval);
+
+    /**
+     * Random, but stable delay of a run of a schedule, up
+     * to its jitter.
+     */
+    static unsigned int jitterDelay(std::shared_ptr<ScheduleDescr> schedule,
+                                    std::time_t next_run);
+
+    /**
+     * Local time conversions of catalog timestamps. strToTime()
+     * returns -1 if the timestamp can't be parsed.
+     */
+    static std::string timeToStr(std::time_t t);
+    static std::time_t strToTime(std::string ts);
+
+  };
+
+}
+
+#endif
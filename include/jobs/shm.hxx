@@ -8,7 +8,7 @@ namespace pgbckctl {
 
 #define WORKER_SHM_CRITICAL_SECTION_START_P(shm) \
   { \
-  boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex>(*((shm)->check_and_get_mutex()));
+  boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> worker_shm_section_lock(*((shm)->check_and_get_mutex()));
 
 #define WORKER_SHM_CRITICAL_SECTION_END }
 
@@ -35,6 +35,101 @@ namespace pgbckctl {
 
   } worker_instrumentation_item ;
 
+  /**
+   * Max length of an archive name stored into shared memory,
+   * including the terminating NUL byte. Longer names are truncated.
+   */
+#define SHM_ARCHIVE_NAME_LEN 64
+
+  /**
+   * Live statistics of a WAL stream, published by the WAL
+   * streamer of an archive into its worker slot.
+   *
+   * Readers don't lock the shared memory. Instead, the WAL streamer
+   * increments changecount before and after updating the statistics, so
+   * readers retry as long as changecount is odd or changed while
+   * copying, see WorkerSHM::readStreamStats().
+   */
+  typedef struct {
+
+    volatile uint64_t changecount = 0;
+
+    /* pid of the publishing process, 0 if nothing published yet */
+    pid_t pid = 0;
+
+    int archive_id = -1;
+    char archive_name[SHM_ARCHIVE_NAME_LEN] = "";
+
+    unsigned int timeline = 0;
+
+    /* seconds since epoch of the last update */
+    int64_t last_update = 0;
+
+    uint64_t bytes_received = 0;
+    uint64_t bytes_written = 0;
+
+    /* XLOG positions, as reported to upstream */
+    uint64_t write_position = 0;
+    uint64_t flush_position = 0;
+    uint64_t apply_position = 0;
+
+    /* last known XLOG position of upstream */
+    uint64_t server_position = 0;
+
+    uint64_t segments_synced = 0;
+    uint64_t syncs = 0;
+    uint64_t sync_time_us = 0;
+
+    /*
+     * Sync latency histogram, bucket N counts syncs
+     * which took less than 2^N milliseconds.
+     */
+    uint64_t sync_latency[WAL_SYNC_LATENCY_BUCKETS] = {};
+
+  } shm_stream_stats;
+
+  /**
+   * Progress of a basebackup, published by the worker streaming
+   * the basebackup into its worker slot. Accessed the same way as
+   * shm_stream_stats, see WorkerSHM::readBasebackupProgress().
+   */
+  typedef struct {
+
+    volatile uint64_t changecount = 0;
+
+    /* pid of the publishing process, 0 if nothing published yet */
+    pid_t pid = 0;
+
+    int archive_id = -1;
+    char archive_name[SHM_ARCHIVE_NAME_LEN] = "";
+
+    /* catalog id of the basebackup, -1 until it is registered */
+    int backup_id = -1;
+
+    /* seconds since epoch */
+    int64_t started = 0;
+    int64_t last_update = 0;
+
+    /*
+     * Size of the basebackup estimated by the server from
+     * the tablespace sizes, 0 if unknown.
+     */
+    uint64_t estimated_bytes = 0;
+
+    /*
+     * Bytes the server reported as done with PROGRESS messages,
+     * PostgreSQL 15 and above only.
+     */
+    uint64_t server_bytes = 0;
+
+    /* Bytes written into the tablespace archives */
+    uint64_t written_bytes = 0;
+
+    unsigned int tablespaces_total = 0;
+    unsigned int tablespaces_streamed = 0;
+
+  } shm_basebackup_progress;
+
   /**
    * Shared memory structure for launcher control data.
    */
@@ -49,8 +144,20 @@ namespace pgbckctl {
     /* Child PID. PID <= 0 means empty slot. */
     volatile pid_t pid;
 
+    /*
+     * Odd while the child slot is being written, see
+     * WorkerSHM::read(). Ignored by WorkerSHM::write().
+     */
+    volatile uint64_t changecount = 0;
+
   } sub_worker_info;
 
+  /**
+   * Number of 64 bit words of the free slot map
+   * of a worker shared memory segment.
+   */
+#define SHM_SLOT_MAP_WORDS(max_workers) (((max_workers) + 63) / 64)
+
   /**
    * Shared memory structure for worker control data.
    *
@@ -59,6 +166,14 @@ namespace pgbckctl {
    */
   typedef struct {
 
+    /*
+     * Incremented before and after the worker properties of
+     * this slot are changed, so it's odd during an update. Readers
+     * don't lock, they retry until they got a copy with the same
+     * even changecount before and after, see WorkerSHM::read().
+     */
+    volatile uint64_t changecount = 0;
+
     volatile pid_t pid = -1; /* -1 means unused slot */
     CatalogTag cmdType;
     int archive_id = -1; /* -1 means no archive attached */
@@ -72,12 +187,36 @@ namespace pgbckctl {
 
     /**
      * true if any sub worker has registered a basebackup for use.
+     * This is a hint only, it is updated by the sub workers outside
+     * of changecount. Consult the child slots for the details.
+     */
+    volatile bool basebackup_in_use = false;
+
+    /**
+     * true if the worker streams more than one archive from a
+     * single process, see START STREAMING FOR ARCHIVE. Such a worker
+     * owns one slot per archive, all with the same pid.
+     */
+    bool multiplexed = false;
+
+    /**
+     * Set by requestStop() to stop the stream of this slot only. Used
+     * for multiplexed workers, since they can't be signaled per archive.
      */
-    bool basebackup_in_use = false;
+    volatile bool stop_requested = false;
+
+    /**
+     * Bitmap of used child slots, bit N set means child_info[N]
+     * is taken. Sub workers claim and release their bit with atomic
+     * operations, since they register without holding the mutex.
+     */
+    volatile uint64_t child_map = 0;
 
     /**
      * Sub worker information is stored here. Currently
-     * MAX_WORKER_CHILDS can be used.
+     * MAX_WORKER_CHILDS can be used. Every child slot has its
+     * own changecount, since sub workers and the worker update
+     * them independently.
      */
     sub_worker_info child_info[MAX_WORKER_CHILDS];
 
@@ -87,6 +226,20 @@ namespace pgbckctl {
      */
     worker_instrumentation_item instr[MAX_WORKER_INSTRUMENTATION_SLOTS];
 
+    /**
+     * WAL stream statistics, only used by streaming workers. Use
+     * WorkerSHM::readStreamStats() and WorkerSHM::writeStreamStats()
+     * to access them.
+     */
+    shm_stream_stats stream_stats;
+
+    /**
+     * Basebackup progress, only used by basebackup workers. Use
+     * WorkerSHM::readBasebackupProgress() and
+     * WorkerSHM::writeBasebackupProgress() to access it.
+     */
+    shm_basebackup_progress backup_progress;
+
   } shm_worker_area;
 
   /**
@@ -267,6 +420,7 @@ namespace pgbckctl {
      *
      * (sizeof(shm_worker_area)) * max_workers
      *    + sizeof(boost::interprocess::interprocess_mutex)
+     *    + free slot map
      *    + 4
      */
     size_t calculateSHMsize();
@@ -276,6 +430,14 @@ namespace pgbckctl {
      */
     shm_worker_area *shm_mem_ptr = nullptr;
 
+    /**
+     * Map of free worker slots in shared memory, bit N set
+     * means slot N is free. Only changed with the mutex held, by
+     * allocate(), free() and reset(). getFreeIndex() looks up the
+     * first set bit instead of scanning all worker slots.
+     */
+    uint64_t *slot_map = nullptr;
+
     /**
      * Upper index for shm_mem_ptr. This is initialized
      * after allocating the shared memory area during
@@ -359,7 +521,8 @@ namespace pgbckctl {
      * Writes the specified items into the shared memory
      * slot on the specified index. Caller should
      * have locked the shared memory operation to protect
-     * against concurrent changes.
+     * against concurrent changes by other writers. Readers
+     * are never blocked.
      *
      * Throws in case we aren't attached.
      *
@@ -384,17 +547,24 @@ namespace pgbckctl {
     virtual unsigned int allocate(shm_worker_area &item);
 
     /**
-     * Returns a copy of the specified worker area at
-     * the specified shared memory slot. Caller should have locked
-     * the shared memory against concurrent changes.
+     * Returns a consistent copy of the specified worker area at
+     * the specified shared memory slot. Doesn't require a lock, the
+     * copy is retried while a writer changes the slot.
+     *
+     * The child slots and stream statistics within the copy are not
+     * covered by the slot's changecount, use the child version of
+     * read() and readStreamStats() for them.
      *
      * Throws in case we aren't attached.
      */
     virtual shm_worker_area read(unsigned int slot_index);
 
     /**
-     * Reads and returns a copy of the child information
-     * properties stored at the specified slot index.
+     * Reads and returns a consistent copy of the child information
+     * properties stored at the specified slot index. Doesn't
+     * require a lock.
+     *
+     * Throws if child_index exceeds MAX_WORKER_CHILDS.
      */
     virtual sub_worker_info read(unsigned int slot_index,
                                  unsigned int child_index);
@@ -425,6 +595,46 @@ namespace pgbckctl {
      */
     virtual void reset();
 
+    /**
+     * Requests the worker registered at the specified slot
+     * to stop the stream of this slot.
+     */
+    virtual void requestStop(unsigned int slot_index);
+
+    /**
+     * Returns true if requestStop() was called for the
+     * specified slot. Doesn't require a lock.
+     */
+    virtual bool stopRequested(unsigned int slot_index);
+
+    /**
+     * Publishes the specified WAL stream statistics into
+     * the specified slot. Doesn't require a lock, but there must
+     * be only one writer per slot.
+     */
+    virtual void writeStreamStats(unsigned int slot_index,
+                                  shm_stream_stats &stats);
+
+    /**
+     * Returns a consistent copy of the WAL stream statistics
+     * of the specified slot without locking the shared memory.
+     */
+    virtual shm_stream_stats readStreamStats(unsigned int slot_index);
+
+    /**
+     * Publishes the specified basebackup progress into the
+     * specified slot. Doesn't require a lock, but there must be only
+     * one writer per slot.
+     */
+    virtual void writeBasebackupProgress(unsigned int slot_index,
+                                         shm_basebackup_progress &progress);
+
+    /**
+     * Returns a consistent copy of the basebackup progress of
+     * the specified slot without locking the shared memory.
+     */
+    virtual shm_basebackup_progress readBasebackupProgress(unsigned int slot_index);
+
     /**
      * Tells whether the specified slot index
      * is empty.
@@ -433,7 +643,7 @@ namespace pgbckctl {
 
     /**
      * Returns a slot index usable by a new
-     * worker.
+     * worker. Caller must hold the lock.
      */
     virtual unsigned int getFreeIndex();
 
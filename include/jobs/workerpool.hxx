@@ -0,0 +1,207 @@
+#ifndef __HAVE_WORKERPOOL_HXX__
+#define __HAVE_WORKERPOOL_HXX__
+
+#include <sys/types.h>
+#include <boost/interprocess/ipc/message_queue.hpp>
+#include <chrono>
+#include <map>
+#include <string>
+
+namespace pgbckctl {
+
+  /**
+   * State of a pool worker, as reported to the launcher.
+   */
+  typedef enum {
+
+    POOL_WORKER_IDLE = 1,
+    POOL_WORKER_BUSY,
+    POOL_WORKER_EXIT
+
+  } PoolWorkerState;
+
+  /**
+   * A state change of a pool worker, as transferred through
+   * the state queue of a WorkerPool.
+   */
+  typedef struct {
+
+    pid_t pid = -1;
+    int state = POOL_WORKER_IDLE;
+
+  } worker_pool_state_msg;
+
+  /**
+   * Pre-forked worker processes of a launcher.
+   *
+   * Every command dispatched by the launcher used to be executed by
+   * a freshly forked worker, which has to set up its parser, attach
+   * the worker shared memory and open the catalog before it can start
+   * to do anything. For short jobs, this startup dominates. Pool workers
+   * are forked once, initialize all of that once and then execute jobs
+   * from the job queue of the pool one after another.
+   *
+   * The launcher owns the pool: it creates the queues with create(),
+   * forks the workers (see pgbckctl::pool_worker()) and keeps track of
+   * their state from the messages they send through the state queue,
+   * see receive(). dispatch() hands a command over to an idle worker,
+   * if there is one. Workers which exited, crashed or not, are dropped
+   * by exited() and respawned by the launcher.
+   *
+   * Pool workers call attach() and then take() jobs, reporting their
+   * state with report().
+   *
+   * Commands which don't terminate on their own, like streaming WAL or
+   * serving a recovery stream, would occupy a pool worker forever. They
+   * are never dispatched to the pool, see poolable().
+   */
+  class WorkerPool {
+  private:
+
+    /* Catalog name the queue names are derived from */
+    std::string catalog_name;
+
+    /* Number of workers the pool should have */
+    unsigned int size = 0;
+
+    boost::interprocess::message_queue *job_queue = nullptr;
+    boost::interprocess::message_queue *state_queue = nullptr;
+
+    /* Launcher side state of all pool workers */
+    std::map<pid_t, PoolWorkerState> workers;
+
+    /* Jobs dispatched, but not yet taken by a worker */
+    unsigned int queued = 0;
+
+    /* Time of the last respawn after a worker died early */
+    std::chrono::steady_clock::time_point last_failure;
+    bool failed = false;
+
+    /* Time the workers were spawned, see spawned() */
+    std::map<pid_t, std::chrono::steady_clock::time_point> started;
+
+    virtual void open(bool create);
+
+  public:
+
+    /**
+     * Max length of a job command.
+     */
+    const static unsigned int MAX_JOB_LEN = 255;
+
+    /**
+     * Max number of pool workers.
+     */
+    const static unsigned int MAX_SIZE = 64;
+
+    /**
+     * A worker exiting within this number of milliseconds
+     * after it was spawned is considered failing on startup.
+     * Its replacement is delayed by the same amount of time, so a
+     * broken setup doesn't end up in a fork loop.
+     */
+    const static unsigned int RESPAWN_DELAY = 1000;
+
+    WorkerPool(std::string catalog_name, unsigned int size);
+    virtual ~WorkerPool();
+
+    /**
+     * Creates the job and state queues. Used by the launcher.
+     */
+    virtual void create();
+
+    /**
+     * Opens the queues of a running launcher. Used by pool workers.
+     */
+    virtual void attach();
+
+    /**
+     * Configured number of pool workers.
+     */
+    virtual unsigned int getSize();
+
+    /**
+     * Number of workers currently in the pool.
+     */
+    virtual unsigned int getNumberOfWorkers();
+
+    /**
+     * Number of idle workers not yet promised a job.
+     */
+    virtual unsigned int available();
+
+    /**
+     * Number of workers to spawn now to fill up the
+     * pool. Respects RESPAWN_DELAY.
+     */
+    virtual unsigned int missing();
+
+    /**
+     * Registers a newly forked pool worker.
+     */
+    virtual void spawned(pid_t pid);
+
+    /**
+     * Drops a pool worker which exited. Returns true if
+     * the PID belonged to the pool.
+     */
+    virtual bool exited(pid_t pid);
+
+    /**
+     * Sends SIGTERM to all pool workers. Idle workers exit
+     * within LAUNCHER_IDLE_TIMEOUT_MS, busy ones stop their job
+     * the same way a forked worker would.
+     */
+    virtual void terminate();
+
+    /**
+     * Returns true if the PID belongs to a pool worker.
+     */
+    virtual bool isWorker(pid_t pid);
+
+    /**
+     * Receives all state changes reported by the pool
+     * workers without waiting. Returns the number of messages.
+     */
+    virtual size_t receive();
+
+    /**
+     * Returns true if the command may be executed by a pool
+     * worker, see class description.
+     */
+    static bool poolable(std::string command);
+
+    /**
+     * Hands the command over to an idle pool worker. Returns
+     * false if the command can't be handled by the pool, the caller
+     * is expected to fork a worker for it then.
+     */
+    virtual bool dispatch(std::string command);
+
+    /**
+     * Waits up to timeout_ms milliseconds for a job. Returns
+     * false if none arrived. Used by pool workers.
+     */
+    virtual bool take(std::string &command, unsigned int timeout_ms);
+
+    /**
+     * Reports a state change of the calling pool worker.
+     */
+    virtual void report(PoolWorkerState state);
+
+    /**
+     * Queue names used for the specified catalog.
+     */
+    static std::string jobQueueName(std::string catalog_name);
+    static std::string stateQueueName(std::string catalog_name);
+
+    /**
+     * Removes the queues of the specified catalog.
+     */
+    static void remove(std::string catalog_name);
+
+  };
+
+}
+
+#endif
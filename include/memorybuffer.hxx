@@ -2,14 +2,111 @@
 #define __HAVE_MEMORY_BUFFER__
 
 #include <memory>
+#include <mutex>
+#include <vector>
 
 namespace pgbckctl {
 
+  /**
+   * A pool of buffers for MemoryBuffer instances, e.g. per
+   * connection or per stream. Buffers are kept in size classes,
+   * powers of two from MIN_CLASS_SIZE to MAX_CLASS_SIZE. A
+   * MemoryBuffer using a pool borrows a buffer of the size class
+   * fitting its requested size and returns it when it's released,
+   * so buffers of messages of similar size are recycled instead of
+   * allocated again. Larger buffers aren't pooled.
+   *
+   * A pool can be shared between threads.
+   */
+  class MemoryBufferPool {
+  private:
+
+    std::mutex pool_mutex;
+
+    /* free buffers, one list per size class */
+    std::vector<std::vector<char *>> free_lists;
+
+    /* number of free buffers kept per size class */
+    unsigned int max_free;
+
+    unsigned long long allocations = 0;
+    unsigned long long reuses = 0;
+
+    /**
+     * Returns the size class for the specified size, -1 if
+     * it's larger than MAX_CLASS_SIZE.
+     */
+    static int sizeClass(size_t size);
+
+  public:
+
+    static const size_t MIN_CLASS_SIZE = 256;
+    static const size_t MAX_CLASS_SIZE = 1024 * 1024;
+
+    /**
+     * Default number of free buffers kept per size class.
+     */
+    static const unsigned int DEFAULT_MAX_FREE = 8;
+
+    explicit MemoryBufferPool(unsigned int max_free = DEFAULT_MAX_FREE);
+    virtual ~MemoryBufferPool();
+
+    /**
+     * Returns a buffer of at least size bytes, capacity is set
+     * to its real size.
+     */
+    virtual char *get(size_t size, size_t &capacity);
+
+    /**
+     * Returns a buffer formerly returned by get() to the pool.
+     */
+    virtual void put(char *buffer, size_t capacity);
+
+    /**
+     * Number of buffers allocated on the heap by get() and
+     * number of buffers get() recycled.
+     */
+    virtual unsigned long long countAllocations();
+    virtual unsigned long long countReuses();
+
+  };
+
+  /**
+   * Where the internal buffer of a MemoryBuffer comes from.
+   */
+  typedef enum {
+
+    MEMBUF_STORAGE_NONE,
+    MEMBUF_STORAGE_INLINE,
+    MEMBUF_STORAGE_HEAP,
+    MEMBUF_STORAGE_POOL,
+
+    /* managed by a derived class */
+    MEMBUF_STORAGE_EXTERNAL
+
+  } MemoryBufferStorage;
+
   /**
    * A very lightweight in-memory buffer
    * class
+   *
+   * The internal buffer is kept when a smaller one is allocated, so
+   * a MemoryBuffer reused for many messages allocates memory only
+   * when a message is larger than all before. Buffers of up to
+   * INLINE_SIZE bytes are kept inside the instance itself, larger
+   * ones are borrowed from a MemoryBufferPool if one was
+   * assigned, or allocated on the heap.
+   *
+   * MemoryBuffers can be moved, but not copied.
    */
   class MemoryBuffer {
+  public:
+
+    /**
+     * Buffers up to this size don't need an allocation.
+     */
+    static const size_t INLINE_SIZE = 64;
+
   protected:
     /**
      * Internal buffer array.
@@ -19,13 +116,37 @@ namespace pgbckctl {
     /**
      * Internal memory buffer size.
      */
-    size_t size;
+    size_t size = 0;
+
+    /**
+     * Usable size of the internal buffer, at least size.
+     */
+    size_t capacity = 0;
+
+    MemoryBufferStorage storage = MEMBUF_STORAGE_NONE;
+
+    /**
+     * Pool larger buffers are borrowed from, if set.
+     */
+    std::shared_ptr<MemoryBufferPool> pool = nullptr;
+
+    char inline_buffer[INLINE_SIZE];
 
     /**
      * Helper function to initialize internal buffer.
      */
     void alloc_internal(size_t size);
 
+    /**
+     * Frees or returns the internal buffer.
+     */
+    void release_internal();
+
+    /**
+     * Takes over the internal buffer of src, leaving src empty.
+     */
+    void move_internal(MemoryBuffer &src);
+
     /**
      * Guts of writing to internal buffer
      */
@@ -41,11 +162,27 @@ namespace pgbckctl {
     explicit MemoryBuffer();
     explicit MemoryBuffer(size_t initialsz);
     explicit MemoryBuffer(char *buf);
+    explicit MemoryBuffer(std::shared_ptr<MemoryBufferPool> pool);
+    MemoryBuffer(const MemoryBuffer &src) = delete;
+    MemoryBuffer(MemoryBuffer &&src);
     virtual ~MemoryBuffer();
 
     /**
-     * Allocate internal buffer. If an existing buffer exists,
-     * it will be deallocated, its contents being thrown away.
+     * Borrow buffers from the specified pool from now on, nullptr
+     * allocates them on the heap. Throws away the current contents.
+     */
+    virtual void setPool(std::shared_ptr<MemoryBufferPool> pool);
+
+    /**
+     * Returns the usable size of the internal buffer, which
+     * might be larger than getSize().
+     */
+    virtual size_t getCapacity();
+
+    /**
+     * Allocate internal buffer. The contents of an existing buffer
+     * are thrown away, the buffer itself is reused if it's
+     * large enough.
      */
     virtual void allocate(size_t size);
 
@@ -85,6 +222,7 @@ namespace pgbckctl {
 
     std::ostream& operator<<(std::ostream& out);
     MemoryBuffer& operator=(MemoryBuffer &src);
+    MemoryBuffer& operator=(MemoryBuffer &&src);
     MemoryBuffer& operator=(std::shared_ptr<MemoryBuffer> &src);
     char& operator[](unsigned int index);
 
@@ -113,6 +251,57 @@ namespace pgbckctl {
 
   };
 
+  /**
+   * A MemoryBuffer whose internal buffer starts at an address
+   * aligned to the specified alignment, as required e.g. for
+   * I/O on files opened with O_DIRECT.
+   */
+  class AlignedMemoryBuffer : public MemoryBuffer {
+  private:
+
+    size_t alignment;
+
+    /**
+     * Frees the internal buffer.
+     */
+    void free_internal();
+
+  public:
+
+    /**
+     * Default alignment, the page size on most platforms.
+     */
+    const static size_t DEFAULT_ALIGNMENT = 4096;
+
+    explicit AlignedMemoryBuffer(size_t initialsz,
+                                 size_t alignment = DEFAULT_ALIGNMENT);
+    virtual ~AlignedMemoryBuffer();
+
+    /**
+     * Allocate aligned internal buffer, contents of an existing
+     * buffer are thrown away.
+     */
+    virtual void allocate(size_t size);
+
+    /**
+     * Assigns contents of the specified buffer into a newly
+     * allocated aligned buffer.
+     */
+    virtual void assign(void *buf, size_t sz);
+
+    /**
+     * Not supported, since an aligned buffer can't own
+     * an arbitrary pointer. Throws.
+     */
+    virtual void own(char *buffer, size_t sz);
+
+    /**
+     * Returns the alignment of the internal buffer.
+     */
+    virtual size_t getAlignment();
+
+  };
+
 }
 
 #endif
@@ -16,10 +16,16 @@ namespace pgbckctl {
 
   /* forwarded declarations */
   class BackupCatalog;
+  class CatalogStatusQueue;
+  class RetentionPlan;
+  class RestorePlan;
   class PGStream;
   class BackupDirectory;
   class ArchiveLogDirectory;
   class TransactionLogBackup;
+  class WALStreamerProcess;
+  class WorkerSHM;
+  struct CompletedWALSegment;
 
   class BaseCatalogCommand : public CatalogDescr {
   protected:
@@ -190,15 +196,10 @@ namespace pgbckctl {
   private:
 
     /*
-     * List of basebackups where the retention policy should
-     * be applied on. Populated by execute().
+     * Prints the specified retention plan, used by
+     * APPLY RETENTION POLICY ... PREVIEW.
      */
-    std::vector<std::shared_ptr<BaseBackupDescr>> bblist;
-
-    /*
-     * Executes the retrieved retention policy.
-     */
-    std::shared_ptr<BackupCleanupDescr> applyRulesAndRemoveBasebackups(std::shared_ptr<CatalogDescr> archiveDescr);
+    virtual void printPlan(std::shared_ptr<RetentionPlan> plan);
 
   public:
 
@@ -301,6 +302,29 @@ namespace pgbckctl {
     virtual BackupCatalogErrorCode check(int archive_id,
                                          StreamIdentification ident);
 
+    /**
+     * Returns the basebackup an incremental basebackup should be
+     * based on. This is the newest valid basebackup of the archive
+     * with a matching systemid and major version, a complete chain
+     * of parent basebackups and a plain backup manifest.
+     *
+     * Returns a nullptr if no such basebackup exists or the
+     * connected server is not able to stream incremental
+     * basebackups. The caller has to stream a full basebackup
+     * then.
+     */
+    virtual std::shared_ptr<BaseBackupDescr> incrementalParent(int archive_id,
+                                                               StreamIdentification ident,
+                                                               int server_version);
+
+    /**
+     * Queues all files of a finished basebackup for upload, if
+     * the archive has an object storage. Must be called within a
+     * catalog transaction.
+     */
+    virtual void queueBasebackupUpload(std::shared_ptr<CatalogDescr> archive_descr,
+                                       std::shared_ptr<BaseBackupDescr> bbdescr);
+
   public:
     StartBasebackupCatalogCommand(std::shared_ptr<CatalogDescr> descr);
     StartBasebackupCatalogCommand(std::shared_ptr<BackupCatalog> catalog);
@@ -466,6 +490,12 @@ namespace pgbckctl {
 
   /*
    * Implements a START STREAMING FOR ARCHIVE command handler.
+   *
+   * If more than one archive was specified, the command
+   * streams all of them from a single worker process, using
+   * one WALStreamMultiplexer per streaming thread. Every archive is
+   * then handled by its own StartStreamingForArchiveCommand instance,
+   * driven through the public stream methods below.
    */
   class StartStreamingForArchiveCommand : public BaseCatalogCommand {
   private:
@@ -474,6 +504,29 @@ namespace pgbckctl {
      */
     PGStream *pgstream = nullptr;
 
+    /**
+     * WAL streamer instance, created by setupStream().
+     */
+    std::shared_ptr<WALStreamerProcess> walstreamer = nullptr;
+
+    /**
+     * Set by setupStream().
+     */
+    bool stream_setup = false;
+
+    /**
+     * Worker shared memory handle and slot used to
+     * check for stop requests of a multiplexed stream, see
+     * stopRequested().
+     */
+    std::shared_ptr<WorkerSHM> mux_shm = nullptr;
+    int mux_slot = -1;
+
+    /**
+     * Error message if the multiplexed stream failed.
+     */
+    std::string stream_error = "";
+
     /**
      * Internal handle for archive directory.
      */
@@ -499,11 +552,53 @@ namespace pgbckctl {
      */
     std::shared_ptr<CatalogDescr> temp_descr = nullptr;
 
+    /**
+     * Status queue of the launcher, if this command runs as
+     * a background worker, and the PID of the launcher we
+     * attached to.
+     */
+    std::shared_ptr<CatalogStatusQueue> status_queue = nullptr;
+    pid_t status_queue_launcher = -1;
+
+    /*
+     * Catalog handle used to maintain the WAL statistics of
+     * the archive, see recordCompletedSegment(). Segments might be
+     * completed by a WAL writer thread, so this is a separate catalog
+     * connection, serialized by stats_mtx.
+     */
+    std::shared_ptr<BackupCatalog> stats_catalog = nullptr;
+    std::mutex stats_mtx;
+
+    /**
+     * Initializes the WAL statistics of the archive from the
+     * segment index of its log directory, if the catalog doesn't
+     * have any yet.
+     */
+    virtual void initArchiveWALStats();
+
+    /**
+     * Accounts a completed segment in the WAL statistics of
+     * the archive. Called by the segment callback of the backup
+     * handler, errors are just logged.
+     */
+    virtual void recordCompletedSegment(const CompletedWALSegment &segment);
+
     /**
      * Helper function to update current status and XLOG position of stream.
+     *
+     * When running as a background worker, updates are
+     * queued to the launcher, which writes them in batches. The
+     * final shutdown status and any update which can't be queued are
+     * written into the catalog directly.
      */
     virtual void updateStreamCatalogStatus(StreamIdentification &ident);
 
+    /**
+     * Tries to queue a stream status update to the launcher.
+     * Returns false if the caller should write it by itself.
+     */
+    virtual bool queueStreamCatalogStatus(StreamIdentification &ident);
+
     /**
      * Prepare internal stream handle
      */
@@ -514,6 +609,18 @@ namespace pgbckctl {
      */
     virtual void finalizeStream();
 
+    /**
+     * Returns the catalog descriptor of the specified archive,
+     * throws a CCatalogIssue if it doesn't exist.
+     */
+    virtual std::shared_ptr<CatalogDescr> lookupArchive(std::string archive_name);
+
+    /**
+     * Legwork for multiple archives, streams all of them
+     * from this process.
+     */
+    virtual void executeMultiplexed();
+
   public:
     StartStreamingForArchiveCommand(std::shared_ptr<BackupCatalog> catalog);
     StartStreamingForArchiveCommand(std::shared_ptr<CatalogDescr> descr);
@@ -521,6 +628,57 @@ namespace pgbckctl {
     virtual ~StartStreamingForArchiveCommand();
 
     virtual void execute(bool noop);
+
+    /**
+     * Connects to the archive, prepares the archive directories, the
+     * catalog stream and the WAL streamer. Doesn't start streaming.
+     */
+    virtual void setupStream();
+
+    /**
+     * Assigns the worker shared memory slot registered for
+     * this stream. Used by multiplexed streams only.
+     */
+    virtual void setMultiplexedSlot(std::shared_ptr<WorkerSHM> shm, int slot);
+
+    /**
+     * Returns the error message if the stream failed while
+     * being multiplexed, otherwise an empty string.
+     */
+    virtual std::string streamError();
+
+    /**
+     * Name of the streamed archive.
+     */
+    virtual std::string streamName();
+
+    /**
+     * The WAL streamer instance, nullptr before setupStream().
+     */
+    virtual std::shared_ptr<WALStreamerProcess> walStreamer();
+
+    /**
+     * Fetches the timeline history file, if required, and starts
+     * the WAL streamer. Calls setupStream() if not done yet.
+     */
+    virtual void startStream();
+
+    /**
+     * Checks why receiving from the WAL streamer ended. Returns
+     * true if the stream needs to be restarted for a new timeline.
+     */
+    virtual bool streamEnded(bool can_continue);
+
+    /**
+     * Returns true if STOP STREAMING was requested for this
+     * archive while being multiplexed.
+     */
+    virtual bool stopRequested();
+
+    /**
+     * Records the error of a failed multiplexed stream.
+     */
+    virtual void streamFailed(std::string errmsg);
   };
 
   /**
@@ -537,6 +695,24 @@ namespace pgbckctl {
     virtual void execute(bool noop);
   };
 
+  /**
+   * Implements the SHOW STREAM STATISTICS command.
+   *
+   * Reads the statistics published by streaming workers from
+   * the worker shared memory without locking and without consulting
+   * the catalog, so it never waits on busy workers.
+   */
+  class ShowStreamStatisticsCommandHandle : public BaseCatalogCommand {
+  public:
+    ShowStreamStatisticsCommandHandle(std::shared_ptr<BackupCatalog> catalog);
+    ShowStreamStatisticsCommandHandle(std::shared_ptr<CatalogDescr> descr);
+    ShowStreamStatisticsCommandHandle();
+
+    virtual ~ShowStreamStatisticsCommandHandle();
+
+    virtual void execute(bool noop);
+  };
+
   /**
    * Implements the STOP STREAMING FOR ARCHIVE command.
    *
@@ -575,9 +751,18 @@ namespace pgbckctl {
   /**
    * Implements the RESTORE FROM ARCHIVE command.
    *
+   * With RECOVERY TARGET instead of a basebackup, the basebackup
+   * to restore is chosen by a RestorePlanner.
    */
   class RestoreFromArchiveCommandHandle : public BaseCatalogCommand {
   private:
+
+    /*
+     * Prints the specified restore plan, used by
+     * RESTORE ... RECOVERY TARGET.
+     */
+    virtual void printPlan(std::shared_ptr<RestorePlan> plan);
+
   public:
     RestoreFromArchiveCommandHandle(std::shared_ptr<BackupCatalog> catalog);
     RestoreFromArchiveCommandHandle(std::shared_ptr<CatalogDescr> descr);
@@ -603,6 +788,193 @@ namespace pgbckctl {
     virtual void execute(bool noop);
 
   };
+
+  /**
+   * Implements the VERIFY ARCHIVE ... BASEBACKUP command.
+   */
+  class VerifyBasebackupCatalogCommand : public BaseCatalogCommand {
+  public:
+
+    VerifyBasebackupCatalogCommand(std::shared_ptr<CatalogDescr> descr);
+    VerifyBasebackupCatalogCommand(std::shared_ptr<BackupCatalog> catalog);
+    VerifyBasebackupCatalogCommand();
+
+    virtual ~VerifyBasebackupCatalogCommand();
+
+    virtual void execute(bool noop);
+
+  };
+
+  /*
+   * Implements ALTER ARCHIVE ... SET LOG LAYOUT { SHARDED | FLAT }.
+   *
+   * Switches the log directory of an existing archive
+   * to the requested layout and moves completed XLOG segments
+   * accordingly. This can be done while a streamer is active.
+   */
+  class AlterArchiveLogLayoutCommand : public BaseCatalogCommand {
+  public:
+
+    AlterArchiveLogLayoutCommand(std::shared_ptr<CatalogDescr> descr);
+    AlterArchiveLogLayoutCommand(std::shared_ptr<BackupCatalog> catalog);
+    AlterArchiveLogLayoutCommand();
+
+    virtual ~AlterArchiveLogLayoutCommand();
+
+    virtual void execute(bool noop);
+
+  };
+
+  /*
+   * Implements ALTER ARCHIVE ... SET COLD DIRECTORY.
+   *
+   * Sets the cold tier of an archive, which MOVE retention rules
+   * move basebackups and WAL to. Basebackups moved before stay where
+   * they are when the directory changes.
+   */
+  class AlterArchiveColdTierCommand : public BaseCatalogCommand {
+  public:
+
+    AlterArchiveColdTierCommand(std::shared_ptr<CatalogDescr> descr);
+    AlterArchiveColdTierCommand(std::shared_ptr<BackupCatalog> catalog);
+    AlterArchiveColdTierCommand();
+
+    virtual ~AlterArchiveColdTierCommand();
+
+    virtual void execute(bool noop);
+
+  };
+
+  /*
+   * Implements CREATE SCHEDULE FOR ARCHIVE. The schedule is
+   * picked up by a running launcher within
+   * JobScheduler::REFRESH_INTERVAL seconds.
+   */
+  class CreateScheduleCatalogCommand : public BaseCatalogCommand {
+  public:
+
+    CreateScheduleCatalogCommand(std::shared_ptr<CatalogDescr> descr);
+    CreateScheduleCatalogCommand(std::shared_ptr<BackupCatalog> catalog);
+    CreateScheduleCatalogCommand();
+
+    virtual ~CreateScheduleCatalogCommand();
+
+    virtual void execute(bool noop);
+
+  };
+
+  /*
+   * Implements DROP SCHEDULE FOR ARCHIVE.
+   */
+  class DropScheduleCatalogCommand : public BaseCatalogCommand {
+  public:
+
+    DropScheduleCatalogCommand(std::shared_ptr<CatalogDescr> descr);
+    DropScheduleCatalogCommand(std::shared_ptr<BackupCatalog> catalog);
+    DropScheduleCatalogCommand();
+
+    virtual ~DropScheduleCatalogCommand();
+
+    virtual void execute(bool noop);
+
+  };
+
+  /*
+   * Implements LIST SCHEDULES.
+   */
+  class ListSchedulesCatalogCommand : public BaseCatalogCommand {
+  public:
+
+    ListSchedulesCatalogCommand(std::shared_ptr<CatalogDescr> descr);
+    ListSchedulesCatalogCommand(std::shared_ptr<BackupCatalog> catalog);
+    ListSchedulesCatalogCommand();
+
+    virtual ~ListSchedulesCatalogCommand();
+
+    virtual void execute(bool noop);
+
+  };
+
+  /*
+   * Implements CREATE STORAGE FOR ARCHIVE. From now on, finished
+   * WAL segments and basebackups of the archive are queued for upload.
+   */
+  class CreateArchiveStorageCatalogCommand : public BaseCatalogCommand {
+  public:
+
+    CreateArchiveStorageCatalogCommand(std::shared_ptr<CatalogDescr> descr);
+    CreateArchiveStorageCatalogCommand(std::shared_ptr<BackupCatalog> catalog);
+    CreateArchiveStorageCatalogCommand();
+
+    virtual ~CreateArchiveStorageCatalogCommand();
+
+    virtual void execute(bool noop);
+
+  };
+
+  /*
+   * Implements DROP STORAGE FOR ARCHIVE. Pending uploads are
+   * dropped, objects already uploaded are left in the bucket.
+   */
+  class DropArchiveStorageCatalogCommand : public BaseCatalogCommand {
+  public:
+
+    DropArchiveStorageCatalogCommand(std::shared_ptr<CatalogDescr> descr);
+    DropArchiveStorageCatalogCommand(std::shared_ptr<BackupCatalog> catalog);
+    DropArchiveStorageCatalogCommand();
+
+    virtual ~DropArchiveStorageCatalogCommand();
+
+    virtual void execute(bool noop);
+
+  };
+
+  /*
+   * Implements LIST UPLOADS [FOR ARCHIVE].
+   */
+  class ListUploadsCatalogCommand : public BaseCatalogCommand {
+  public:
+
+    ListUploadsCatalogCommand(std::shared_ptr<CatalogDescr> descr);
+    ListUploadsCatalogCommand(std::shared_ptr<BackupCatalog> catalog);
+    ListUploadsCatalogCommand();
+
+    virtual ~ListUploadsCatalogCommand();
+
+    virtual void execute(bool noop);
+
+  };
+
+  /*
+   * Implements UPLOAD ARCHIVE, uploading the pending uploads of
+   * an archive to its object storage until none are left. Started by
+   * the launcher for archives with pending uploads, see
+   * BackgroundWorker::upload_commands(), but can be run by
+   * hand as well.
+   *
+   * Uploaded WAL segments which were removed from the archive
+   * meanwhile are dropped from the upload queue.
+   */
+  class UploadArchiveCommand : public BaseCatalogCommand {
+  private:
+
+    /*
+     * Drops uploaded WAL segments from the queue which
+     * don't exist in the archive anymore.
+     */
+    virtual void purgeRemovedUploads(int archive_id);
+
+  public:
+
+    UploadArchiveCommand(std::shared_ptr<CatalogDescr> descr);
+    UploadArchiveCommand(std::shared_ptr<BackupCatalog> catalog);
+    UploadArchiveCommand();
+
+    virtual ~UploadArchiveCommand();
+
+    virtual void execute(bool noop);
+
+  };
 }
 
 #endif
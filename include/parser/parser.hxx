@@ -84,6 +84,15 @@ namespace pgbckctl {
      */
     virtual CatalogTag execute(std::string catalogDir);
 
+    /**
+     * Executes the command handle on the specified catalog, reopening
+     * it if a previous command closed it. Unlike execute(catalogDir),
+     * the catalog is left open afterwards, so several commands
+     * can share a catalog and a transaction (see
+     * BackupCatalog::setKeepOpen()).
+     */
+    virtual CatalogTag execute(std::shared_ptr<BackupCatalog> catalog);
+
     /**
      * Assigns a stop signal handler to a command instance.
      * This should be used to react on SIGTERM signals.
@@ -123,6 +132,9 @@ namespace pgbckctl {
     boost::filesystem::path sourceFile;
     std::shared_ptr<PGBackupCtlCommand> command;
 
+    /* All commands parsed by parseFile() or parseStream() */
+    std::vector<std::shared_ptr<PGBackupCtlCommand>> commands;
+
   public:
 
     /*
@@ -141,8 +153,32 @@ namespace pgbckctl {
     virtual void parseFile();
     virtual void parseLine(std::string line);
 
+    /**
+     * Parses all commands from the specified stream, separated
+     * by semicolons. Every command is parsed before this method
+     * returns, a syntax error in any of them throws a CParserIssue
+     * naming the command. getCommand() returns the last command
+     * afterwards, getCommands() all of them.
+     *
+     * parseFile() reads from stdin if the source file is "-".
+     */
+    virtual void parseStream(std::istream &in);
+
+    /**
+     * Splits the input of the specified stream into single commands.
+     * Semicolons within double quotes don't separate commands,
+     * lines starting with "--" are ignored.
+     */
+    static std::vector<std::string> splitCommands(std::istream &in);
+
     virtual shared_ptr<PGBackupCtlCommand> getCommand();
 
+    /**
+     * Returns the commands parsed by parseFile() or parseStream(),
+     * in order.
+     */
+    virtual std::vector<std::shared_ptr<PGBackupCtlCommand>> getCommands();
+
   };
 
 }
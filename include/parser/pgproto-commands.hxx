@@ -11,6 +11,9 @@
 #include <pgsql-proto.hxx>
 #include <proto-descr.hxx>
 #include <proto-catalog.hxx>
+#include <pgproto-copy.hxx>
+#include <fs-archive.hxx>
+#include <walcache.hxx>
 
 namespace pgbckctl {
 
@@ -159,6 +162,12 @@ namespace pgbckctl {
       /* Command tag identifier */
       std::string command_tag = "UNKNOWN";
 
+      /**
+       * Pool of the connection the command runs on, buffers
+       * the command creates borrow from it. Might be nullptr.
+       */
+      std::shared_ptr<MemoryBufferPool> buffer_pool = nullptr;
+
     public:
 
       PGProtoStreamingCommand(std::shared_ptr<PGProtoCmdDescr> descr,
@@ -179,7 +188,10 @@ namespace pgbckctl {
       virtual void execute(std::shared_ptr<ExecutableContext> context) = 0;
 
       /**
-       * Protocol execution steps.
+       * Protocol execution steps. The default implementation
+       * materializes the RowDescription of the result set first,
+       * then a chunk of its DataRow messages on each call, see
+       * PGProtoResultSet::dataChunk(). Returns -1 if done.
        */
       virtual int step(ProtocolBuffer &buffer);
 
@@ -193,6 +205,11 @@ namespace pgbckctl {
        */
       virtual std::string tag();
 
+      /**
+       * Sets the pool buffers created by this command borrow from.
+       */
+      virtual void setBufferPool(std::shared_ptr<MemoryBufferPool> pool);
+
     };
 
     /**
@@ -287,6 +304,526 @@ namespace pgbckctl {
       virtual void reset();
     };
 
+    /**
+     * Base class of streaming commands sending their results
+     * through the COPY subprotocol, see PGProtoStreamingSession::stream_start().
+     *
+     * The caller calls step() until it returns -1, sending each message
+     * before the next call. A command might ask the caller to send a
+     * region of a file after the message, see pendingFileRegion(), or
+     * to retry later by returning STEP_WAIT. Messages the client
+     * sends during the COPY are passed to feedback() and clientDone().
+     *
+     * The final CommandComplete message carrying tag() is sent by
+     * the caller, any other CommandComplete by step().
+     */
+    class PGProtoCopyStreamingCommand : public PGProtoStreamingCommand {
+    protected:
+
+      /**
+       * File region to be sent after the current message,
+       * see pendingFileRegion().
+       */
+      bool region_pending = false;
+      int region_fd = -1;
+      off_t region_offset = 0;
+      size_t region_len = 0;
+
+      /**
+       * Materializes a CommandComplete message with
+       * the specified tag.
+       */
+      static void commandComplete(ProtocolBuffer &buffer, std::string tag);
+
+    public:
+
+      /**
+       * Nothing to send at the moment, the caller
+       * should retry later.
+       */
+      static const int STEP_WAIT = 14;
+
+      /**
+       * step() materialized a CommandComplete message.
+       */
+      static const int STEP_COMMAND_COMPLETE = 15;
+
+      PGProtoCopyStreamingCommand(std::shared_ptr<PGProtoCmdDescr> descr,
+                                  std::shared_ptr<PGProtoCatalogHandler> catalogHandler,
+                                  std::shared_ptr<RuntimeConfiguration> rtc,
+                                  std::shared_ptr<WorkerSHM> worker_shm);
+
+      virtual ~PGProtoCopyStreamingCommand();
+
+      /**
+       * Returns true and the file region to send after the message
+       * materialized by the last call to step(), if any. fd stays valid
+       * until the next call to step().
+       */
+      virtual bool pendingFileRegion(int &fd, off_t &offset, size_t &len);
+
+      /**
+       * Processes the payload of a CopyData message received
+       * from the client. The default implementation ignores it.
+       */
+      virtual void feedback(ProtocolBuffer &payload);
+
+      /**
+       * Called when the client sent CopyDone. The default
+       * implementation ignores it.
+       */
+      virtual void clientDone();
+
+    };
+
+    /**
+     * Implements the START_REPLICATION streaming command, serving
+     * WAL of the archive the attached basebackup belongs to.
+     *
+     * After execute(), step() materializes the messages of the
+     * CopyBoth subprotocol one by one: the CopyBothResponse, XLogData
+     * and keepalive messages, and finally CopyDone. A timeline which
+     * was left by a timeline switch is streamed up to the switch
+     * point, followed by the result set telling the next timeline.
+     *
+     * Uncompressed segment files aren't copied into the protocol buffer.
+     * Instead, step() just materializes the XLogData header and the
+     * caller sends the segment data described by pendingFileRegion()
+     * directly from the file. Compressed segment files are decompressed
+     * into the protocol buffer, positioned by their frame table.
+     *
+     * Segments still written by a WAL stream of the archive (.partial
+     * files) are followed up to the flush position the streamer
+     * publishes in the worker shared memory. This requires an
+     * uncompressed archive, compressed partial segments are
+     * served once they are completed.
+     */
+    class PGProtoStartReplication : public PGProtoCopyStreamingCommand {
+    private:
+
+      /**
+       * Basebackup the catalog handler is attached to.
+       */
+      std::shared_ptr<BaseBackupDescr> basebackup = nullptr;
+
+      /**
+       * Log directory of the archive.
+       */
+      std::shared_ptr<ArchiveLogDirectory> archiveDir = nullptr;
+
+      /**
+       * CopyBoth subprotocol state and its buffers.
+       */
+      std::shared_ptr<PGProtoCopy> copy = nullptr;
+      std::shared_ptr<ProtocolBuffer> copy_buffer = nullptr;
+      std::shared_ptr<ProtocolBuffer> copy_data_buffer = nullptr;
+
+      unsigned long long wal_segment_size = 0;
+      unsigned int timeline = 0;
+
+      /**
+       * Next XLOG position to send.
+       */
+      XLogRecPtr sendpos = InvalidXLogRecPtr;
+
+      /**
+       * XLOG position up to which WAL is known to be
+       * available.
+       */
+      XLogRecPtr available = InvalidXLogRecPtr;
+
+      /**
+       * If the streamed timeline was left by a timeline switch,
+       * switchpoint is the position of the switch and next_tli
+       * the timeline switched to. next_tli is 0 otherwise.
+       */
+      XLogRecPtr switchpoint = InvalidXLogRecPtr;
+      unsigned int next_tli = 0;
+      std::time_t history_checked = 0;
+
+      /**
+       * The segment file sendpos belongs to, opened by
+       * openSegment(). Uncompressed segments are read by segment_fd,
+       * compressed ones by segment_reader.
+       */
+      unsigned long long segno = 0;
+      bool segment_open = false;
+      bool segment_partial = false;
+      int segment_fd = -1;
+      std::shared_ptr<FramedArchiveFile> segment_reader = nullptr;
+      XLogRecPtr reader_pos = InvalidXLogRecPtr;
+
+      /**
+       * Cache of decompressed WAL shared with other connections,
+       * nullptr if disabled. With a cache, compressed segments are
+       * read a page at a time into page_buffer, cached_page is the
+       * page of the current segment it holds, -1 if none.
+       */
+      std::shared_ptr<WALSegmentCache> wal_cache = nullptr;
+      std::vector<char> page_buffer;
+      long long cached_page = -1;
+
+      /*
+       * CopyBoth state.
+       */
+      bool client_done = false;
+      bool copy_done = false;
+      bool reply_requested = false;
+      bool streaming_done = false;
+      bool streaming_complete = false;
+      std::time_t last_send = 0;
+
+      /**
+       * Last flush position reported by the client.
+       */
+      XLogRecPtr client_flush = InvalidXLogRecPtr;
+
+      /**
+       * Returns the path of the file holding the current segment
+       * within the archive, preferring completed segments over partial
+       * ones. Returns an empty path if there is none.
+       */
+      path findSegmentFile(bool &partial, bool &compressed);
+
+      /**
+       * Opens the segment file sendpos belongs to. Returns false
+       * if the archive doesn't have it (yet).
+       */
+      bool openSegment();
+
+      /**
+       * Closes the current segment file.
+       */
+      void closeSegment();
+
+      /**
+       * Reads len bytes of the current compressed segment,
+       * starting at sendpos, into dest.
+       */
+      void readCompressed(char *dest, size_t len);
+
+      /**
+       * Makes page_buffer hold the specified page of the current
+       * compressed segment, from the WAL cache if it has it.
+       */
+      void loadPage(long long pageno);
+
+      /**
+       * Returns the XLOG position up to which WAL can be
+       * sent from the current segment.
+       */
+      XLogRecPtr availableEnd();
+
+      /**
+       * Returns the flush position of a WAL stream currently writing
+       * our timeline into the archive, InvalidXLogRecPtr if there
+       * is none.
+       */
+      XLogRecPtr liveFlushPosition();
+
+      /**
+       * Looks for a timeline history file telling that our timeline
+       * was left, initializing switchpoint and next_tli.
+       */
+      void checkTimelineSwitch();
+
+      /**
+       * Reads the history file of the specified timeline into
+       * content. Returns false if the archive doesn't have it.
+       */
+      bool readTimelineHistory(unsigned int tli, std::string &content);
+
+      /**
+       * Writes the header of an XLogData message, starting
+       * at sendpos, into buffer.
+       */
+      void xlogDataHeader(ProtocolBuffer &buffer);
+
+      /**
+       * Materializes a keepalive message.
+       */
+      void keepalive(ProtocolBuffer &buffer);
+
+      /**
+       * Materializes the result set sent after a stream
+       * ended by a timeline switch.
+       */
+      void prepareNextTimeline();
+
+    public:
+
+      /*
+       * Step codes returned by step() while streaming, in
+       * addition to the ones of the final result set.
+       */
+      static const int STEP_COPY_BOTH_RESPONSE = 10;
+      static const int STEP_XLOG_DATA = 11;
+      static const int STEP_KEEPALIVE = 12;
+      static const int STEP_COPY_DONE = 13;
+
+      /**
+       * Maximum number of WAL bytes sent by a single
+       * XLogData message.
+       */
+      static const size_t MAX_SEND_SIZE = 128 * 1024;
+
+      /**
+       * Seconds after which a keepalive message is sent
+       * if nothing else was sent.
+       */
+      static const unsigned int KEEPALIVE_INTERVAL = 10;
+
+      PGProtoStartReplication(std::shared_ptr<PGProtoCmdDescr> descr,
+                              std::shared_ptr<PGProtoCatalogHandler> catalogHandler,
+                              std::shared_ptr<RuntimeConfiguration> rtc,
+                              std::shared_ptr<WorkerSHM> worker_shm);
+
+      virtual ~PGProtoStartReplication();
+
+      /**
+       * Resolves the timeline and the segment file to
+       * start streaming from.
+       */
+      virtual void execute(std::shared_ptr<ExecutableContext> context);
+
+      /**
+       * Materializes the next protocol message, see the
+       * STEP_* codes.
+       */
+      virtual int step(ProtocolBuffer &buffer);
+
+      /**
+       * Processes the payload of a CopyData message
+       * received from the client.
+       */
+      virtual void feedback(ProtocolBuffer &payload);
+
+      /**
+       * Called when the client sent CopyDone.
+       */
+      virtual void clientDone();
+
+      /**
+       * Resets the internal protocol steps.
+       */
+      virtual void reset();
+
+    };
+
+    /**
+     * Implements the BASE_BACKUP streaming command, replaying the
+     * attached basebackup. The response consists of
+     *
+     * - a result set with the start position and timeline of the backup,
+     * - a result set listing its tablespaces, the base tablespace last,
+     * - the tablespace archives and the backup manifest, if requested,
+     * - a result set with the end position and timeline of the backup.
+     *
+     * With the syntax of PostgreSQL 14 and before, each archive is sent
+     * within a COPY OUT of its own, without the terminating zero blocks
+     * of the tar format. With the syntax of PostgreSQL 15 and later, all
+     * archives are sent within a single COPY OUT, each one started by a
+     * new archive (or manifest) message and its data wrapped into
+     * archive data messages. Archives are terminated then.
+     *
+     * Like START_REPLICATION, uncompressed tablespace archives are sent
+     * with pendingFileRegion(), step() just frames the CopyData messages.
+     * Compressed archives are decompressed into the protocol buffer.
+     * Either way, archives are sent up to their last member only, since
+     * they might have been stored with or without terminating blocks.
+     */
+    class PGProtoBaseBackup : public PGProtoCopyStreamingCommand {
+    private:
+
+      typedef enum {
+        BASEBACKUP_PHASE_START_POSITION,
+        BASEBACKUP_PHASE_TABLESPACES,
+        BASEBACKUP_PHASE_ARCHIVE,
+        BASEBACKUP_PHASE_END_POSITION,
+        BASEBACKUP_PHASE_DONE
+      } BaseBackupPhase;
+
+      BaseBackupPhase phase = BASEBACKUP_PHASE_START_POSITION;
+
+      /**
+       * Basebackup the catalog handler is attached to.
+       */
+      std::shared_ptr<BaseBackupDescr> basebackup = nullptr;
+
+      /**
+       * Files sent within a COPY OUT each, in the order of
+       * the tablespace result set. The manifest, if requested,
+       * comes last.
+       */
+      std::vector<path> archives;
+      unsigned int current_archive = 0;
+
+      /**
+       * Tablespace result set rows, materialized by execute(), and
+       * the name and tablespace location of each archive, as sent
+       * by new archive messages.
+       */
+      std::vector<std::vector<PGProtoColumnDataDescr>> tablespace_rows;
+      std::vector<std::pair<std::string, std::string>> archive_names;
+
+      /**
+       * Set if the archives are sent in the format of
+       * PostgreSQL 15 and later.
+       */
+      bool archive_stream = false;
+
+      /**
+       * COPY OUT subprotocol state of the current archive
+       * and its buffers.
+       */
+      std::shared_ptr<PGProtoCopy> copy = nullptr;
+      std::shared_ptr<ProtocolBuffer> copy_buffer = nullptr;
+      std::shared_ptr<ProtocolBuffer> copy_data_buffer = nullptr;
+
+      /**
+       * The current archive, opened by openArchive(). Uncompressed
+       * files are read by archive_fd, compressed ones by archive_reader.
+       */
+      bool archive_open = false;
+      bool archive_tar = false;
+      bool archive_eof = false;
+      bool archive_terminated = false;
+      int archive_fd = -1;
+      std::shared_ptr<BackupFile> archive_reader = nullptr;
+      std::vector<char> archive_buffer;
+
+      /**
+       * Number of (uncompressed) archive bytes sent so far, and the
+       * offset of the next member header within the archive. archive_end
+       * is the end of the last member of an uncompressed archive.
+       */
+      off_t archive_pos = 0;
+      off_t archive_end = 0;
+      off_t next_header = 0;
+
+      /**
+       * Returns the path of the archive with the specified name
+       * within the basebackup directory, in whatever compression
+       * it was stored. Returns an empty path if there is none.
+       */
+      path findArchive(std::string name);
+
+      /**
+       * Checks the options of the command, throws a
+       * PGProtoCmdFailure if one can't be honored.
+       */
+      void checkOptions();
+
+      /**
+       * Materializes a CopyData message of the current COPY
+       * with the len bytes at data.
+       */
+      void copyData(ProtocolBuffer &buffer, const char *data, size_t len);
+
+      /**
+       * Opens the current archive.
+       */
+      void openArchive();
+
+      /**
+       * Closes the current archive.
+       */
+      void closeArchive();
+
+      /**
+       * Walks the member headers of the len bytes of tar data at
+       * archive_pos. Returns the number of bytes in front of the
+       * end-of-archive marker, len if there is none.
+       */
+      size_t tarMembers(const char *data, size_t len);
+
+      /**
+       * Materializes the next message of the current
+       * archive.
+       */
+      int archiveStep(ProtocolBuffer &buffer);
+
+      /**
+       * Prepares the result set of the current phase.
+       */
+      void prepareResultSet();
+
+    public:
+
+      /*
+       * Step codes returned by step() while sending
+       * archives, in addition to the ones of the result sets.
+       */
+      static const int STEP_COPY_OUT_RESPONSE = 20;
+      static const int STEP_COPY_DATA = 21;
+      static const int STEP_COPY_DONE = 22;
+      static const int STEP_ARCHIVE_START = 23;
+
+      /**
+       * Maximum number of archive bytes sent by a single
+       * CopyData message. Must be a multiple of the tar block size.
+       */
+      static const size_t MAX_SEND_SIZE = 128 * 1024;
+
+      PGProtoBaseBackup(std::shared_ptr<PGProtoCmdDescr> descr,
+                        std::shared_ptr<PGProtoCatalogHandler> catalogHandler,
+                        std::shared_ptr<RuntimeConfiguration> rtc,
+                        std::shared_ptr<WorkerSHM> worker_shm);
+
+      virtual ~PGProtoBaseBackup();
+
+      /**
+       * Resolves the archives of the attached basebackup.
+       */
+      virtual void execute(std::shared_ptr<ExecutableContext> context);
+
+      /**
+       * Materializes the next protocol message, see
+       * the STEP_* codes.
+       */
+      virtual int step(ProtocolBuffer &buffer);
+
+      /**
+       * Resets the internal protocol steps.
+       */
+      virtual void reset();
+
+    };
+
+    /**
+     * Implements the SHOW streaming command for the settings
+     * pg_basebackup asks for, derived from the attached basebackup:
+     * wal_segment_size, data_directory_mode and server_version.
+     */
+    class PGProtoShow : public PGProtoStreamingCommand {
+    public:
+
+      PGProtoShow(std::shared_ptr<PGProtoCmdDescr> descr,
+                  std::shared_ptr<PGProtoCatalogHandler> catalogHandler,
+                  std::shared_ptr<RuntimeConfiguration> rtc,
+                  std::shared_ptr<WorkerSHM> worker_shm);
+
+      virtual ~PGProtoShow();
+
+      /**
+       * Materializes the result set with the value
+       * of the requested setting.
+       */
+      virtual void execute(std::shared_ptr<ExecutableContext> context);
+
+      /**
+       * Resets the internal protocol steps.
+       */
+      virtual void reset();
+
+      /**
+       * Formats a PostgreSQL version number like the
+       * server_version setting does, e.g. 150004 as 15.4.
+       */
+      static std::string versionString(int version_num);
+
+    };
+
   }
 }
 
@@ -0,0 +1,109 @@
+#ifndef __HAVE_PROBES_HXX__
+#define __HAVE_PROBES_HXX__
+
+#include <pg_backup_ctl.hxx>
+
+/*
+ * Static tracepoints (USDT) of pg_backup_ctl++.
+ *
+ * If sys/sdt.h from systemtap was found, each TRACE_PGBCKCTL_* macro
+ * compiles into a single nop plus a note in the ELF binary. Tools like
+ * bpftrace, perf or systemtap attach to them in a running process,
+ * without that, they cost nothing. Otherwise they are compiled out
+ * entirely.
+ *
+ * The provider is pg_backup_ctl, the probe names are the ones passed to
+ * PGBCKCTL_PROBE*() below (some tools show "__" as "-"), e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/bin/pg_backup_ctl++:pg_backup_ctl:xlog__write
+ *                { @bytes = hist(arg1); }'
+ *
+ * Pairs of *_START and *_DONE probes are meant to measure latency.
+ *
+ * Arguments should be cheap to evaluate, since they're evaluated
+ * even if nobody is tracing. Don't construct strings for them.
+ */
+
+#ifdef PG_BACKUP_CTL_HAS_SDT
+
+#include <sys/sdt.h>
+
+#define PGBCKCTL_PROBE1(name, a1) \
+  STAP_PROBE1(pg_backup_ctl, name, a1)
+#define PGBCKCTL_PROBE2(name, a1, a2) \
+  STAP_PROBE2(pg_backup_ctl, name, a1, a2)
+#define PGBCKCTL_PROBE3(name, a1, a2, a3) \
+  STAP_PROBE3(pg_backup_ctl, name, a1, a2, a3)
+#define PGBCKCTL_PROBE4(name, a1, a2, a3, a4) \
+  STAP_PROBE4(pg_backup_ctl, name, a1, a2, a3, a4)
+
+#else
+
+#define PGBCKCTL_PROBE1(name, a1) do {} while (0)
+#define PGBCKCTL_PROBE2(name, a1, a2) do {} while (0)
+#define PGBCKCTL_PROBE3(name, a1, a2, a3) do {} while (0)
+#define PGBCKCTL_PROBE4(name, a1, a2, a3, a4) do {} while (0)
+
+#endif
+
+/*
+ * WAL streaming
+ */
+
+/* A CopyData message from the WAL sender (int len, char msgtype) */
+#define TRACE_PGBCKCTL_XLOG_RECEIVE(len, msgtype) \
+  PGBCKCTL_PROBE2(xlog__receive, len, msgtype)
+
+/* XLOG written into a segment file (uint64 startpos, size_t len, uint timeline) */
+#define TRACE_PGBCKCTL_XLOG_WRITE(startpos, len, timeline) \
+  PGBCKCTL_PROBE3(xlog__write, startpos, len, timeline)
+
+/* Sync of pending segment files (size_t unsynced bytes) */
+#define TRACE_PGBCKCTL_XLOG_SYNC_START(unsynced) \
+  PGBCKCTL_PROBE1(xlog__sync__start, unsynced)
+#define TRACE_PGBCKCTL_XLOG_SYNC_DONE(unsynced) \
+  PGBCKCTL_PROBE1(xlog__sync__done, unsynced)
+
+/* Completed segment renamed into place, including its sync (const char *path) */
+#define TRACE_PGBCKCTL_XLOG_RENAME_START(path) \
+  PGBCKCTL_PROBE1(xlog__rename__start, path)
+#define TRACE_PGBCKCTL_XLOG_RENAME_DONE(path) \
+  PGBCKCTL_PROBE1(xlog__rename__done, path)
+
+/* Standby status update sent (uint64 written, uint64 flushed, int reply requested) */
+#define TRACE_PGBCKCTL_STATUS_UPDATE(written, flushed, reply) \
+  PGBCKCTL_PROBE3(status__update, written, flushed, reply)
+
+/*
+ * Streamed basebackups
+ */
+
+/* Data message written to the current archive file (size_t len) */
+#define TRACE_PGBCKCTL_BASEBACKUP_DATA_START(len) \
+  PGBCKCTL_PROBE1(basebackup__data__start, len)
+#define TRACE_PGBCKCTL_BASEBACKUP_DATA_DONE(len) \
+  PGBCKCTL_PROBE1(basebackup__data__done, len)
+
+/*
+ * Copy managers
+ */
+
+/* A chunk of a file copied by a copy item (int slot, const char *path, off_t offset, size_t len) */
+#define TRACE_PGBCKCTL_COPY_CHUNK_START(slot, path, offset, len) \
+  PGBCKCTL_PROBE4(copy__chunk__start, slot, path, offset, len)
+#define TRACE_PGBCKCTL_COPY_CHUNK_DONE(slot, path, offset, len) \
+  PGBCKCTL_PROBE4(copy__chunk__done, slot, path, offset, len)
+
+/*
+ * io_uring
+ */
+
+/* Submission queue entries submitted (int submitted) */
+#define TRACE_PGBCKCTL_URING_SUBMIT(submitted) \
+  PGBCKCTL_PROBE1(uring__submit, submitted)
+
+/* A completion reaped (int res, uint64 user_data) */
+#define TRACE_PGBCKCTL_URING_COMPLETE(res, user_data) \
+  PGBCKCTL_PROBE2(uring__complete, res, user_data)
+
+#endif
@@ -33,7 +33,8 @@ namespace pgbckctl {
                 PGPROTO_PROCESS_QUERY_START,
                 PGPROTO_PROCESS_QUERY_RESULT,
                 PGPROTO_PROCESS_QUERY_EXECUTE,
-                PGPROTO_PROCESS_QUERY_IN_PROGRESS
+                PGPROTO_PROCESS_QUERY_IN_PROGRESS,
+                PGPROTO_PROCESS_COPY
 
   } PostgreSQLProtocolState;
 
@@ -197,7 +198,10 @@ namespace pgbckctl {
                   INVALID_COMMAND,
                   IDENTIFY_SYSTEM,
                   LIST_BASEBACKUPS,
-                  TIMELINE_HISTORY
+                  TIMELINE_HISTORY,
+                  START_REPLICATION,
+                  BASE_BACKUP,
+                  SHOW
 
     } ProtocolCommandTag;
 
@@ -237,6 +241,7 @@ namespace pgbckctl {
     class PGProtoColumnDataDescr {
     public:
 
+      /* -1 marks a NULL value */
       int length;
       std::string data;
 
@@ -278,6 +283,8 @@ namespace pgbckctl {
       static const int PG_TYPELEN_VARLENA = -1;
       static const int PG_TYPEMOD_VARLENA = -1;
       static const int PG_TYPEOID_TEXT    = 25;
+      static const int PG_TYPEOID_INT8    = 20;
+      static const int PG_TYPEOID_OID     = 26;
       static const int PG_TYPEOID_INT4    = 23;
       static const int PG_TYPEOID_BYTEA   = 17;
 
@@ -362,6 +369,12 @@ namespace pgbckctl {
       static const int PGPROTO_ROW_DESCR_MESSAGE = 1;
       static const int PGPROTO_DATA_DESCR_MESSAGE = 2;
 
+      /**
+       * Size of the chunks of data rows written by
+       * PGProtoStreamingCommand::step(), in bytes.
+       */
+      static const size_t DATA_CHUNK_SIZE = 65536;
+
       PGProtoResultSet();
       virtual ~PGProtoResultSet();
 
@@ -379,8 +392,23 @@ namespace pgbckctl {
        * result set.
        */
       virtual int descriptor(ProtocolBuffer &buffer);
+
+      /**
+       * Write the DataRow message of the next row into the
+       * specified protocol buffer. Returns 0 if there are no
+       * more rows.
+       */
       virtual int data(ProtocolBuffer &buffer);
 
+      /**
+       * Like data(), but writes the DataRow messages of as many of the
+       * next rows as fit into max_size bytes, at least one. The buffer
+       * is allocated once with the sizes of the rows calculated by
+       * addRow(). Returns the number of bytes written, 0 if there
+       * are no more rows.
+       */
+      virtual int dataChunk(ProtocolBuffer &buffer, size_t max_size);
+
       /**
        * Adds a new column definition to the result set
        * header.
@@ -1,8 +1,13 @@
 #ifndef __HAVE_PROTO_BUFFER_HXX__
 #define __HAVE_PROTO_BUFFER_HXX__
 
+#include <cstring>
 #include <memorybuffer.hxx>
 
+extern "C" {
+#include <arpa/inet.h>
+}
+
 namespace pgbckctl {
 
   class ProtocolBuffer;
@@ -17,8 +22,13 @@ namespace pgbckctl {
 
     ProtocolBuffer();
     ProtocolBuffer(size_t size);
+    explicit ProtocolBuffer(std::shared_ptr<MemoryBufferPool> pool);
+    ProtocolBuffer(ProtocolBuffer &&src);
     virtual ~ProtocolBuffer();
 
+    using MemoryBuffer::operator=;
+    ProtocolBuffer& operator=(ProtocolBuffer &&src);
+
     /**
      * Write to the current cursor position. If the protocol buffer is full,
      * this will throw a CPGBackupCtlFailure.
@@ -123,6 +133,36 @@ namespace pgbckctl {
      */
      void own(char *buffer, size_t sz) override;
 
+    /*
+     * Stores values into raw memory in network byte order and
+     * return the position behind them. Unlike the write_*() methods,
+     * these aren't virtual and don't check any bounds, they are meant
+     * for encoders which have calculated the size of their messages
+     * before, see PGProtoResultSet::dataChunk().
+     */
+
+    static inline char *store_int(char *dest, const int value) {
+      uint32_t wv = htonl((uint32_t) value);
+      memcpy(dest, &wv, sizeof(wv));
+      return dest + sizeof(wv);
+    }
+
+    static inline char *store_short(char *dest, const short value) {
+      uint16_t wv = htons((uint16_t) value);
+      memcpy(dest, &wv, sizeof(wv));
+      return dest + sizeof(wv);
+    }
+
+    static inline char *store_byte(char *dest, const char c) {
+      *dest = c;
+      return dest + 1;
+    }
+
+    static inline char *store_buffer(char *dest, const void *buf, size_t bufsize) {
+      memcpy(dest, buf, bufsize);
+      return dest + bufsize;
+    }
+
   };
 
 }
@@ -1,7 +1,11 @@
 #ifndef __HAVE_PROTO_CATALOG_HXX__
 #define __HAVE_PROTO_CATALOG_HXX__
 
+#include <ctime>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <pgbckctl_exception.hxx>
 #include <descr.hxx>
 #include <shm.hxx>
@@ -10,6 +14,68 @@
 
 namespace pgbckctl {
 
+  class WALSegmentCache;
+
+  /**
+   * Catalog access shared by the connections of a streaming server.
+   *
+   * BackupCatalog handles can't be used by concurrent threads, so
+   * all connections served by the threads of a streaming server share
+   * a single catalog handle, serialized by a mutex. Archive descriptors
+   * rarely change while a streaming server is running, so they are cached
+   * for REFRESH_INTERVAL seconds.
+   */
+  class PGProtoArchiveCache {
+  private:
+
+    /**
+     * Shared catalog handle, protected by catalog_lock.
+     */
+    std::shared_ptr<BackupCatalog> catalog = nullptr;
+    std::mutex catalog_lock;
+
+    /**
+     * Cached archive descriptors by archive ID, along with
+     * the time they were read from the catalog.
+     */
+    std::map<int, std::pair<std::time_t, std::shared_ptr<CatalogDescr>>> archives;
+
+  public:
+
+    /**
+     * Number of seconds an archive descriptor is cached.
+     */
+    const static unsigned int REFRESH_INTERVAL = 30;
+
+    PGProtoArchiveCache(std::string catalog_name);
+    virtual ~PGProtoArchiveCache();
+
+    /**
+     * Returns the descriptor of the specified archive. The
+     * descriptor is shared with concurrent callers and must not
+     * be modified. If the archive doesn't exist, the id of
+     * the returned descriptor is -1.
+     */
+    virtual std::shared_ptr<CatalogDescr> getArchive(int archive_id);
+
+    /**
+     * Forgets all cached archive descriptors.
+     */
+    virtual void invalidate();
+
+    /**
+     * Calls fn with the shared catalog handle, while holding the
+     * catalog lock. fn must not keep a reference to the handle.
+     */
+    virtual void use(std::function<void(std::shared_ptr<BackupCatalog>)> fn);
+
+    /**
+     * Returns the identifier string of the shared catalog.
+     */
+    virtual std::string fullname();
+
+  };
+
   /**
    * A catalog handler instance encapsulates various
    * actions performed by PostgreSQL streaming API commands.
@@ -22,9 +88,16 @@ namespace pgbckctl {
   private:
 
     /**
-     * Internal catalog handle.
+     * Catalog access, possibly shared with other
+     * catalog handlers.
      */
-    std::unique_ptr<BackupCatalog> catalog = nullptr;
+    std::shared_ptr<PGProtoArchiveCache> archive_cache = nullptr;
+
+    /**
+     * Cache of decompressed WAL, shared with other
+     * catalog handlers. Might be a nullptr.
+     */
+    std::shared_ptr<WALSegmentCache> wal_cache = nullptr;
 
     /**
      * The basebackup a PGProtoCatalogHandler is connected
@@ -56,6 +129,12 @@ namespace pgbckctl {
 
     PGProtoCatalogHandler(std::string catalog_name);
 
+    /**
+     * Creates a catalog handler sharing the catalog
+     * access of archive_cache.
+     */
+    PGProtoCatalogHandler(std::shared_ptr<PGProtoArchiveCache> archive_cache);
+
     virtual ~PGProtoCatalogHandler();
 
     /**
@@ -87,6 +166,12 @@ namespace pgbckctl {
      */
     virtual bool isAttached();
 
+    /**
+     * Returns the descriptor of the attached basebackup, or
+     * a nullptr if isAttached() is false.
+     */
+    virtual std::shared_ptr<BaseBackupDescr> getAttachedBasebackup();
+
     /**
      * Detaches the internal basebackup reference.
      */
@@ -115,6 +200,23 @@ namespace pgbckctl {
      */
     virtual string getCatalogFullname();
 
+    /**
+     * Returns the catalog access used by this handler.
+     */
+    virtual std::shared_ptr<PGProtoArchiveCache> getArchiveCache();
+
+    /**
+     * Sets the cache of decompressed WAL used by
+     * streaming commands.
+     */
+    virtual void setWALCache(std::shared_ptr<WALSegmentCache> wal_cache);
+
+    /**
+     * Returns the cache of decompressed WAL, a nullptr
+     * if there is none.
+     */
+    virtual std::shared_ptr<WALSegmentCache> getWALCache();
+
   };
 
 }
@@ -1,3 +1,4 @@
+#include <map>
 #include <proto-catalog.hxx>
 
 namespace pgbckctl {
@@ -22,6 +23,31 @@ namespace pgbckctl {
        */
       unsigned int tli = 0;
 
+      /**
+       * XLOG start position of START_REPLICATION.
+       */
+      uint64_t startpos = 0;
+
+      /**
+       * Replication slot name of START_REPLICATION, empty
+       * if none was specified.
+       */
+      std::string slot_name = "";
+
+      /**
+       * Options of BASE_BACKUP by their lowercased name, options
+       * without a value map to an empty string. archive_stream is set
+       * if the options were specified in the parenthesized syntax
+       * of PostgreSQL 15 and later.
+       */
+      std::map<std::string, std::string> options;
+      bool archive_stream = false;
+
+      /**
+       * Name of the setting reported by SHOW.
+       */
+      std::string variable = "";
+
       void setCommandTag(ProtocolCommandTag const& tag);
 
     };
@@ -1,8 +1,16 @@
 #ifndef __RECOVERY_HXX__
 #define __RECOVERY_HXX__
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
 #include <common.hxx>
 #include <descr.hxx>
+#include <fs-archive.hxx>
 #include <io_uring_instance.hxx>
 
 namespace pgbckctl {
@@ -13,6 +21,10 @@ namespace pgbckctl {
    * A restore class should derive from this base class.
    */
   class Recovery : public CPGBackupCtlBase {
+  protected:
+
+    std::shared_ptr<RestoreDescr> restoreDescr = nullptr;
+
   public:
 
     Recovery();
@@ -26,23 +38,336 @@ namespace pgbckctl {
      * recovery methods.
      */
     virtual void init() = 0;
+
+    /*
+     * Abstract restore method, called after init().
+     */
+    virtual void start() = 0;
   };
 
+  /**
+   * Progress of a TarRecovery, see TarRecovery::setProgressCallback().
+   */
+  typedef struct tar_recovery_progress {
+
+    /* Uncompressed bytes extracted and written so far */
+    unsigned long long bytes = 0;
+
+    /*
+     * Expected number of bytes, taken from the tablespace sizes
+     * recorded in the catalog. 0 if unknown.
+     */
+    unsigned long long bytes_total = 0;
+
+    /* Files, directories and symlinks restored so far */
+    unsigned long long files = 0;
+
+    /* Time spent so far */
+    std::chrono::milliseconds elapsed = std::chrono::milliseconds(0);
+
+    /* Bytes per second since start */
+    unsigned long long throughput = 0;
+
+    /* Estimated time left, -1 if unknown */
+    std::chrono::seconds eta = std::chrono::seconds(-1);
+
+  } TarRecoveryProgress;
+
+  /**
+   * Target file of a TarRecovery pipeline, shared by all chunks
+   * of its contents.
+   */
+  typedef struct tar_recovery_file {
+
+    path name;
+    mode_t mode = 0600;
+
+    /* opened by the writer with the first chunk */
+    std::shared_ptr<ArchiveFile> file = nullptr;
+
+  } TarRecoveryFile;
+
+  /**
+   * A part of the contents of a tar member, passed from the
+   * decompressing thread of a pipeline to its writer.
+   */
+  typedef struct tar_recovery_chunk {
+
+    std::shared_ptr<TarRecoveryFile> target = nullptr;
+
+    /* position and length of the chunk within the target */
+    off_t offset = 0;
+    size_t len = 0;
+
+    /* set for the last chunk of a file, which closes it */
+    bool last = false;
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+    /* contents if written through io_uring */
+    std::shared_ptr<vectored_buffer> vbuf = nullptr;
+#endif
+
+    /* contents if written with pwrite() */
+    std::vector<char> data;
+
+  } TarRecoveryChunk;
+
+  /**
+   * A tar archive of a basebackup together with the directory
+   * it is extracted into.
+   */
+  typedef struct tar_recovery_pipeline {
+
+    path archive;
+
+    /* tablespace OID, 0 for the base archive */
+    unsigned int spcoid = 0;
+
+    path target;
+
+    /*
+     * Bounded queue of chunks between the decompressing
+     * thread and the writer.
+     */
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::deque<std::shared_ptr<TarRecoveryChunk>> queue;
+    bool done = false;
+
+  } TarRecoveryPipeline;
+
   /**
    * Recovers a tar basebackup from the archive.
+   *
+   * Every tar archive of the basebackup, the base archive and one
+   * for each tablespace, is extracted by its own pipeline: one thread
+   * reads and decompresses the archive and parses the tar stream, a
+   * second thread writes the file contents into the target directory.
+   * Both are connected by a bounded queue of chunks, so decompression
+   * and writing overlap instead of alternating, and the queue depth
+   * limits the memory a pipeline can use. Directories and symlinks
+   * are created by the decompressing thread directly.
+   *
+   * If built with io_uring support and io_uring is usable, the writer
+   * keeps up to queue depth writes in flight through an IOUringInstance,
+   * chunks are then decompressed directly into buffers of a shared
+   * vectored_buffer_pool. Otherwise chunks are written with pwrite().
+   *
+   * Files aren't fsynced one after another. Once all pipelines are
+   * done, the whole target directory and all tablespace locations are
+   * synced in one batch by a RecursiveSync.
+   *
+   * The tablespace_map file of the base archive and the symlinks in
+   * pg_tblspc/, depending on what the basebackup contains, are
+   * rewritten to the tablespace locations of the RestoreDescr.
+   *
+   * Incremental basebackups must be combined with their parents
+   * before they can be restored, so they are rejected.
    */
   class TarRecovery : public Recovery {
+  private:
+
+    /* One pipeline per archive, started in order */
+    std::vector<std::shared_ptr<TarRecoveryPipeline>> pipelines;
+    std::atomic<size_t> next_pipeline;
+
+    /* Number of pipelines running concurrently, 0 runs all at once */
+    unsigned int parallelism = 0;
+
+    /* Number of chunks a pipeline queue holds */
+    unsigned int queue_depth = DEFAULT_QUEUE_DEPTH;
+
+    /* Sync method and parallelism of the final RecursiveSync */
+    std::string sync_method = "auto";
+    unsigned int sync_parallelism = 0;
+
+    /* Tablespace OID -> target location */
+    std::map<unsigned int, path> locations;
+
+    bool use_io_uring = false;
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+    std::shared_ptr<vectored_buffer_pool> pool = nullptr;
+#endif
+
+    /* Progress counters, updated by all pipelines */
+    std::atomic<unsigned long long> bytes;
+    std::atomic<unsigned long long> files;
+    unsigned long long bytes_total = 0;
+    std::chrono::steady_clock::time_point start_time;
+
+    std::function<void(const TarRecoveryProgress &)> progress_cb = nullptr;
+    std::chrono::milliseconds progress_interval = std::chrono::milliseconds(5000);
+
+    /* Number of workers still running, start() waits on running_cond */
+    unsigned int running = 0;
+    std::mutex running_mtx;
+    std::condition_variable running_cond;
+
+    /* Set if any pipeline failed, the first error is kept */
+    std::atomic<bool> aborted;
+    std::string error = "";
+    std::mutex error_mtx;
+
+    /**
+     * Returns the target location of the specified tablespace,
+     * according to the tablespace map of the RestoreDescr.
+     */
+    virtual path tablespaceLocation(unsigned int spcoid);
+
+    /**
+     * Creates the specified target directory, which must
+     * be empty if it exists already.
+     */
+    virtual void prepareTarget(path const& target);
+
+    /**
+     * Runs pipelines until there are none left.
+     */
+    virtual void worker();
+
+    /**
+     * Reads, decompresses and parses the tar archive of a
+     * pipeline and queues the contents of its members.
+     */
+    virtual void extract(std::shared_ptr<TarRecoveryPipeline> pipeline);
+
+    /**
+     * Queues size bytes of contents for the specified target file,
+     * split into chunks, each one filled by calling fill.
+     */
+    virtual void queueFile(std::shared_ptr<TarRecoveryPipeline> pipeline,
+                           std::shared_ptr<TarRecoveryFile> target,
+                           size_t size,
+                           std::function<void(char *, size_t)> fill);
+
+    /**
+     * Writes the chunks queued for a pipeline.
+     */
+    virtual void writer(std::shared_ptr<TarRecoveryPipeline> pipeline);
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+    /**
+     * Like writer(), but keeps up to queue depth writes
+     * in flight through io_uring.
+     */
+    virtual void writerIOUring(std::shared_ptr<TarRecoveryPipeline> pipeline);
+#endif
+
+    /**
+     * Queues a chunk for the writer, blocks while the
+     * queue is full.
+     */
+    virtual void push(std::shared_ptr<TarRecoveryPipeline> pipeline,
+                      std::shared_ptr<TarRecoveryChunk> chunk);
+
+    /**
+     * Returns the next chunk queued or nullptr if the pipeline
+     * is done. With wait set to false, nullptr is also returned
+     * if the queue is currently empty.
+     */
+    virtual std::shared_ptr<TarRecoveryChunk> pop(std::shared_ptr<TarRecoveryPipeline> pipeline,
+                                                  bool wait);
+
+    /**
+     * Returns a chunk with room for len bytes.
+     */
+    virtual std::shared_ptr<TarRecoveryChunk> allocChunk(size_t len);
+
+    /**
+     * Returns the buffer the contents of a chunk are stored in.
+     */
+    virtual char *chunkData(std::shared_ptr<TarRecoveryChunk> chunk);
+
+    /**
+     * Opens the target of a chunk if not done yet.
+     */
+    virtual void openTarget(std::shared_ptr<TarRecoveryChunk> chunk);
+
+    /**
+     * Closes the target of a chunk after the last chunk
+     * was written and releases its buffer.
+     */
+    virtual void finishChunk(std::shared_ptr<TarRecoveryChunk> chunk);
+
+    /**
+     * Rewrites the contents of a tablespace_map file to the
+     * target locations.
+     */
+    virtual std::string rewriteTablespaceMap(std::string const& contents);
+
+    /**
+     * Records the first error and aborts all pipelines.
+     */
+    virtual void fail(std::string const& what);
+
+    /**
+     * Builds the current progress.
+     */
+    virtual TarRecoveryProgress progress();
+
   public:
 
+    /**
+     * Size of a chunk passed from a decompressing thread to its writer.
+     */
+    const static size_t CHUNK_SIZE = 1024 * 1024;
+
+    /**
+     * Default number of chunks queued per pipeline.
+     */
+    const static unsigned int DEFAULT_QUEUE_DEPTH = 16;
+
     TarRecovery(std::shared_ptr<RestoreDescr> restoreDescr);
     virtual ~TarRecovery();
 
+    /**
+     * Sets the number of pipelines running concurrently,
+     * 0 runs a pipeline for every archive at once.
+     */
+    virtual void setParallelism(unsigned int parallelism);
+
+    /**
+     * Sets the number of chunks queued per pipeline, which is
+     * also the number of writes in flight with io_uring.
+     */
+    virtual void setQueueDepth(unsigned int queue_depth);
+
+    /**
+     * Sets method and parallelism of the final sync, see
+     * RecursiveSync::methodFromString().
+     */
+    virtual void setSyncMethod(std::string method, unsigned int parallelism);
+
+    /**
+     * Installs a callback called with the current progress every
+     * interval while start() is running, and once when done.
+     */
+    virtual void setProgressCallback(std::function<void(const TarRecoveryProgress &)> cb,
+                                     std::chrono::milliseconds interval = std::chrono::milliseconds(5000));
+
     /*
      * Initializes tar recovery procedure. Must be called
      * before attempting start().
+     *
+     * Checks the basebackup of the RestoreDescr, finds its archives
+     * and prepares the target directories.
      */
     virtual void init();
 
+    /**
+     * Extracts the basebackup and syncs the restored files. Throws
+     * a CArchiveIssue if anything failed, files already restored are
+     * left in place then.
+     */
+    virtual void start();
+
+    /**
+     * Stops all pipelines, start() throws afterwards. Can be
+     * called from any thread.
+     */
+    virtual void abort();
+
   };
 
 }
@@ -0,0 +1,243 @@
+#ifndef __HAVE_RESTOREPLAN_HXX__
+#define __HAVE_RESTOREPLAN_HXX__
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <BackupCatalog.hxx>
+#include <fs-archive.hxx>
+#include <xlogdefs.hxx>
+
+namespace pgbckctl {
+
+  /**
+   * A timeline on the history of the recovery target timeline,
+   * with the XLOG positions it begins and ends at. The target
+   * timeline itself ends at InvalidXLogRecPtr.
+   */
+  typedef struct restore_plan_timeline {
+
+    unsigned int timeline = 0;
+    XLogRecPtr begin = InvalidXLogRecPtr;
+    XLogRecPtr end = InvalidXLogRecPtr;
+
+  } RestorePlanTimeline;
+
+  /**
+   * A basebackup considered by a RestorePlanner, together with
+   * what restoring it and replaying WAL up to the recovery
+   * target would cost.
+   */
+  class RestorePlanCandidate {
+  public:
+
+    std::shared_ptr<BaseBackupDescr> basebackup = nullptr;
+
+    /*
+     * Basebackups to restore, the full basebackup first. Just
+     * the basebackup itself if it isn't incremental.
+     */
+    std::vector<std::shared_ptr<BaseBackupDescr>> chain;
+
+    /* Bytes to extract, summed up over the chain */
+    unsigned long long extract_bytes = 0;
+
+    /* WAL to replay */
+    XLogRecPtr wal_start = InvalidXLogRecPtr;
+    XLogRecPtr wal_end = InvalidXLogRecPtr;
+    unsigned long long wal_bytes = 0;
+    unsigned long long wal_segments = 0;
+
+    /*
+     * Names of the segments to replay in order, each on the
+     * timeline recovery reads it from.
+     */
+    std::vector<std::string> wal_files;
+
+    /*
+     * First segment required but missing in the archive,
+     * empty if all WAL is there.
+     */
+    std::string missing_segment = "";
+
+    /* Estimated restore time in seconds */
+    double cost = 0.0;
+
+    /* Why this basebackup can't be used, empty if it can */
+    std::string reason = "";
+
+    /**
+     * True if the basebackup can be restored to the
+     * recovery target.
+     */
+    virtual bool usable();
+
+    /**
+     * True if the chain has to be combined with pg_combinebackup.
+     */
+    virtual bool incremental();
+
+  };
+
+  /**
+   * A RestorePlan describes how the archive would be restored to a
+   * recovery target: all basebackups considered, and the one with the
+   * lowest estimated restore time. Plans are created by
+   * RestorePlanner::plan() and printed by RESTORE ... RECOVERY TARGET
+   * before anything is restored (or just printed with PREVIEW).
+   */
+  class RestorePlan {
+  public:
+
+    RestoreTargetType target_type = RESTORE_TARGET_NONE;
+    std::string target = "";
+
+    /* Recovery target timeline */
+    unsigned int timeline = 0;
+
+    /*
+     * XLOG position to recover to. For LATEST, this is the end of
+     * the archived WAL. For a target time, it's estimated from the
+     * basebackups around it (or the end of the archived WAL), see
+     * target_lsn_estimated.
+     */
+    XLogRecPtr target_lsn = InvalidXLogRecPtr;
+    bool target_lsn_estimated = false;
+
+    /* History of the target timeline, oldest timeline first */
+    std::vector<RestorePlanTimeline> history;
+
+    /* Throughput assumed for extraction and WAL replay, bytes/s */
+    unsigned long long extract_rate = 0;
+    unsigned long long replay_rate = 0;
+
+    /* All basebackups considered, newest first */
+    std::vector<std::shared_ptr<RestorePlanCandidate>> candidates;
+
+    /* Cheapest usable candidate, nullptr if there's none */
+    std::shared_ptr<RestorePlanCandidate> chosen = nullptr;
+
+    /**
+     * Returns true if there's a basebackup to restore to the target.
+     */
+    virtual bool feasible();
+
+    /**
+     * Estimated restore time of the chosen candidate, in seconds.
+     */
+    virtual double estimatedDuration();
+
+    /**
+     * Names of the history files of all timelines on the
+     * history, recovery needs them to follow timeline switches.
+     */
+    virtual std::vector<std::string> historyFiles();
+
+    /**
+     * Configures the restored data directory datadir to recover up
+     * to the target of the plan and stop there: recovery.signal plus
+     * the recovery_target_* settings and the specified restore_command
+     * appended to postgresql.auto.conf, or a recovery.conf before
+     * PostgreSQL 12. A target time is written with the UTC offset of
+     * the local time zone, which the planner assumes it's in.
+     */
+    virtual void writeRecoveryConfig(path const& datadir,
+                                     int pg_version_num,
+                                     const std::string &restore_command);
+
+  };
+
+  /**
+   * A RestorePlanner picks the basebackup to restore for a recovery
+   * target given by time, XLOG position or as LATEST.
+   *
+   * Every basebackup in state "ready" is a candidate if it lies on the
+   * history of the target timeline and ends before the target. Its cost
+   * is the time to extract the basebackup, or all basebackups of its
+   * chain for incremental ones, plus the time to replay the WAL from
+   * its start up to the target. Both are estimated from the sizes
+   * recorded in the catalog and the configured throughput. The WAL
+   * required is looked up in the segment index of the log directory,
+   * following timeline switches. A candidate missing any segment is
+   * not usable.
+   *
+   * A target time is converted to an XLOG position by interpolating
+   * between the basebackups stopped right before and after it. Without
+   * a basebackup after it, all available WAL is assumed to be replayed.
+   *
+   * All methods throw a CArchiveIssue in case of errors.
+   */
+  class RestorePlanner {
+  private:
+
+    std::shared_ptr<BackupCatalog> catalog = nullptr;
+    std::shared_ptr<CatalogDescr> archiveDescr = nullptr;
+    std::shared_ptr<ArchiveLogDirectory> logdir = nullptr;
+
+    unsigned long long extract_rate = DEFAULT_EXTRACT_RATE;
+    unsigned long long replay_rate = DEFAULT_REPLAY_RATE;
+
+    /* Completed segments in the archive, by timeline and segment number */
+    std::set<std::pair<unsigned int, unsigned long long>> segments;
+
+    /**
+     * Reads the history of the specified timeline from its
+     * history file in the archive.
+     */
+    virtual std::vector<RestorePlanTimeline> readHistory(unsigned int timeline);
+
+    /**
+     * Returns the timeline of the history the specified segment
+     * is read from during recovery.
+     */
+    virtual unsigned int segmentTimeline(std::shared_ptr<RestorePlan> plan,
+                                         unsigned long long segno,
+                                         unsigned long long wal_segment_size);
+
+    /**
+     * Estimates the XLOG position of the target time of a plan.
+     */
+    virtual void estimateTargetLSN(std::shared_ptr<RestorePlan> plan,
+                                   std::vector<std::shared_ptr<BaseBackupDescr>> &list);
+
+    /**
+     * Checks the WAL required by a candidate and computes its cost.
+     */
+    virtual void evaluate(std::shared_ptr<RestorePlan> plan,
+                          std::shared_ptr<RestorePlanCandidate> candidate);
+
+  public:
+
+    /**
+     * Default throughput of extracting basebackups, 200MB/s.
+     */
+    static const unsigned long long DEFAULT_EXTRACT_RATE = 200ULL * 1024 * 1024;
+
+    /**
+     * Default throughput of WAL replay, 64MB/s.
+     */
+    static const unsigned long long DEFAULT_REPLAY_RATE = 64ULL * 1024 * 1024;
+
+    RestorePlanner(std::shared_ptr<BackupCatalog> catalog,
+                   std::shared_ptr<CatalogDescr> archiveDescr);
+    virtual ~RestorePlanner();
+
+    /**
+     * Sets the throughput in bytes per second the cost estimation
+     * assumes for extraction and WAL replay. 0 keeps the default.
+     */
+    virtual void setRates(unsigned long long extract_rate,
+                          unsigned long long replay_rate);
+
+    /**
+     * Plans restoring the archive to the recovery target of the
+     * specified RestoreDescr.
+     */
+    virtual std::shared_ptr<RestorePlan> plan(std::shared_ptr<RestoreDescr> restoreDescr);
+
+  };
+
+}
+
+#endif
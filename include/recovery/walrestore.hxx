@@ -0,0 +1,284 @@
+#ifndef __HAVE_WALRESTORE_HXX__
+#define __HAVE_WALRESTORE_HXX__
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <common.hxx>
+#include <fs-archive.hxx>
+
+namespace pgbckctl {
+
+  /**
+   * Restores XLOG segment and TLI history files from an archive
+   * for PostgreSQL's restore_command (--action restore-wal).
+   *
+   * PostgreSQL calls restore_command once per file and waits for it,
+   * so replay is bound by the latency of a single fetch. After a
+   * segment was restored, the next segments of the same timeline are
+   * fetched ahead by a detached process into a spool directory, using
+   * several threads. A later call finding its file in the spool just
+   * renames it into place, without even opening the catalog.
+   *
+   * The spool must be on the same filesystem as the restore target,
+   * otherwise a spooled file is copied instead of renamed. Spooled
+   * files are written under a temporary name and synced before they
+   * get their final name, so a crash never leaves a truncated segment
+   * in the spool. Only one prefetching process works on a spool at
+   * a time, guarded by an flock() on LOCK_FILENAME. Files of the
+   * spool outside of the current prefetch window, e.g. segments of a
+   * timeline recovery didn't follow, are removed by the next
+   * prefetch.
+   *
+   * All methods throw a CArchiveIssue in case of errors.
+   */
+  class WALRestore {
+  protected:
+
+    /* Catalog and archive to resolve the log directory from */
+    std::string catalog_file = "";
+    std::string archive_name = "";
+
+    /* Log directory of the archive, resolved on first use */
+    std::shared_ptr<ArchiveLogDirectory> logdir = nullptr;
+
+    path spooldir;
+
+    /* Number of segments fetched ahead, 0 disables prefetching */
+    unsigned int prefetch_segments = DEFAULT_PREFETCH;
+
+    /* Number of threads prefetching segments */
+    unsigned int parallelism = DEFAULT_PARALLELISM;
+
+    /**
+     * Returns the log directory of the archive, looking
+     * up the archive in the catalog if not done yet.
+     */
+    virtual std::shared_ptr<ArchiveLogDirectory> logDirectory();
+
+    /**
+     * Returns the file in the archive holding the specified completed
+     * XLOG segment or TLI history file, compressed or not. Returns an
+     * empty path if there's none.
+     */
+    virtual path findFile(const std::string &filename);
+
+    /**
+     * Decompresses or copies the specified archive file to target.
+     * The file is written under a temporary name first. If sync is
+     * true, it's synced before renamed to target. inspect, if set, is
+     * called with every block of the (decompressed) contents before
+     * it's written and may throw to fail the copy.
+     */
+    virtual void copyFile(path const& file, path const& target, bool sync,
+                          std::function<void(const char *, size_t)> inspect = nullptr);
+
+    /**
+     * Returns the names of the segments following the specified
+     * segment on its timeline, up to the number of segments to
+     * prefetch.
+     */
+    virtual std::vector<std::string> prefetchWindow(const std::string &filename,
+                                                    unsigned long long wal_segment_size);
+
+  public:
+
+    /**
+     * Default number of segments fetched ahead.
+     */
+    static const unsigned int DEFAULT_PREFETCH = 8;
+
+    /**
+     * Default number of prefetching threads.
+     */
+    static const unsigned int DEFAULT_PARALLELISM = 4;
+
+    /**
+     * Name of the lock file within the spool directory.
+     */
+    static const char *LOCK_FILENAME;
+
+    /**
+     * Restores files from the archive with the specified name,
+     * registered in the specified catalog.
+     */
+    WALRestore(std::string catalog_file,
+               std::string archive_name,
+               path spooldir);
+
+    /**
+     * Restores files from the specified log directory.
+     */
+    WALRestore(std::shared_ptr<ArchiveLogDirectory> logdir,
+               path spooldir);
+
+    virtual ~WALRestore();
+
+    /**
+     * Sets the number of segments fetched ahead by prefetch().
+     */
+    virtual void setPrefetch(unsigned int segments);
+
+    /**
+     * Sets the number of threads prefetch() fetches segments with.
+     */
+    virtual void setParallelism(unsigned int parallelism);
+
+    /**
+     * Returns the default spool directory for the specified
+     * restore target, a directory next to it.
+     */
+    static path defaultSpoolDirectory(path const& target);
+
+    /**
+     * Restores the specified file to target, taking it from the spool
+     * if it was prefetched already. Returns false if the file doesn't
+     * exist in the archive, which is what PostgreSQL expects at the
+     * end of the archived WAL.
+     */
+    virtual bool restore(const std::string &filename, path const& target);
+
+    /**
+     * Fetches the segments following the specified segment into
+     * the spool, skipping segments spooled already. Stops at the first
+     * segment missing in the archive. Returns immediately if another
+     * process is prefetching into the spool.
+     *
+     * Errors are logged, since prefetching is just an optimization.
+     */
+    virtual void prefetch(const std::string &filename,
+                          unsigned long long wal_segment_size);
+
+    /**
+     * Runs prefetch() in a detached child process and returns
+     * immediately.
+     */
+    virtual void startPrefetch(const std::string &filename,
+                               unsigned long long wal_segment_size);
+
+  };
+
+  /**
+   * Restores all XLOG segments recovery needs to reach a known target
+   * into pg_wal of a restored data directory before the instance is
+   * started. RESTORE ... RECOVERY TARGET runs it while the basebackup is
+   * extracted, so recovery finds all WAL locally and replays it without
+   * calling restore_command for each segment.
+   *
+   * The segments are passed in replay order, as computed by
+   * RestorePlanner along the timeline history, together with the
+   * history files of the timelines involved. Several threads take the
+   * files in order and decompress them into place like WALRestore does,
+   * each synced before it gets its final name. The XLOG page headers
+   * of a segment are checked while it's written (see WALPageValidator),
+   * which catches a segment holding other XLOG than its name says. If
+   * the segment index has a CRC-32C for it, that is compared, too.
+   * wait() checks that the segments form a gapless sequence of full
+   * segments on non-decreasing timelines.
+   *
+   * Errors of the restoring threads are thrown as a CArchiveIssue
+   * by wait().
+   */
+  class WALRangeRestore : public WALRestore {
+  private:
+
+    path waldir;
+    unsigned long long wal_segment_size = 0;
+
+    /* History files first, then the segments in replay order */
+    std::vector<std::string> files;
+    std::vector<std::string> segments;
+
+    /* Archive files and checksums looked up in the segment index */
+    std::map<std::string, path> located;
+    std::map<std::string, uint32_t> checksums;
+
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next { 0 };
+    std::atomic<bool> aborted { false };
+    std::atomic<unsigned int> restored { 0 };
+
+    std::mutex error_mtx;
+    std::string error = "";
+
+    /**
+     * Restores files until there are none left or
+     * the restore was aborted.
+     */
+    virtual void worker();
+
+    /**
+     * Restores and validates a single segment.
+     */
+    virtual void restoreSegment(const std::string &filename);
+
+    /**
+     * Checks that the restored segments are complete
+     * and continuous.
+     */
+    virtual void verify();
+
+  public:
+
+    /**
+     * Restores files from the specified log directory into waldir,
+     * the pg_wal directory of the restore target.
+     */
+    WALRangeRestore(std::shared_ptr<ArchiveLogDirectory> logdir,
+                    path waldir,
+                    unsigned long long wal_segment_size);
+
+    /**
+     * Aborts and waits for threads still running.
+     */
+    virtual ~WALRangeRestore();
+
+    /**
+     * Returns the WAL directory within the specified data
+     * directory, pg_xlog before PostgreSQL 10.
+     */
+    static path walDirectory(path const& target, int pg_version_num);
+
+    /**
+     * Starts restoring the specified history files and segments
+     * and returns immediately.
+     */
+    virtual void start(const std::vector<std::string> &segments,
+                       const std::vector<std::string> &history);
+
+    /**
+     * Waits for all files to be restored and verifies the segments.
+     */
+    virtual void wait();
+
+    /**
+     * Lets the restoring threads stop as soon as possible.
+     * Safe to call from any thread.
+     */
+    virtual void abort();
+
+    /**
+     * True if restoring a file failed or the restore was aborted.
+     */
+    virtual bool failed();
+
+    /**
+     * Number of segments restored so far.
+     */
+    virtual unsigned int countRestored();
+
+    /**
+     * Number of segments to restore.
+     */
+    virtual unsigned int countSegments();
+
+  };
+
+}
+
+#endif
@@ -1,5 +1,8 @@
 #include <common.hxx>
 #include <backup.hxx>
+#include <walindex.hxx>
+#include <checksum.hxx>
+#include <probes.hxx>
 #include <boost/log/trivial.hpp>
 
 using namespace pgbckctl;
@@ -12,6 +15,9 @@ TransactionLogBackup::TransactionLogBackup(const std::shared_ptr<CatalogDescr>&
 
   this->descr = descr;
 
+  for (unsigned int i = 0; i < WAL_SYNC_LATENCY_BUCKETS; i++)
+    this->sync_latency[i] = 0;
+
 }
 
 TransactionLogBackup::~TransactionLogBackup() {
@@ -47,11 +53,31 @@ XLogRecPtr TransactionLogBackup::write(XLOGDataStreamMessage *message,
                                        XLogRecPtr &flush_position,
                                        unsigned int timeline) {
 
+  /*
+   * If message isn't valid, throw an exception.
+   */
+  if (message == nullptr) {
+    throw CArchiveIssue("could not write uninitialized XLOG data message");
+  }
+
+  return this->write(message->getXLOGStartPos(),
+                     message->buffer(),
+                     message->dataBufferSize(),
+                     flush_position,
+                     timeline);
+
+}
+
+XLogRecPtr TransactionLogBackup::write(XLogRecPtr startpos,
+                                       const char *databuf,
+                                       size_t len,
+                                       XLogRecPtr &flush_position,
+                                       unsigned int timeline) {
+
   shared_ptr<TransactionLogListItem> item = nullptr;
   size_t message_written = 0;
   size_t message_left    = 0;
   int waloffset = 0;
-  char *databuf;
   XLogRecPtr position = InvalidXLogRecPtr;
 
   /*
@@ -66,21 +92,19 @@ XLogRecPtr TransactionLogBackup::write(XLOGDataStreamMessage *message,
   if (!this->isInitialized())
     throw CArchiveIssue("attempt to write into uninitialized TransactionLogBackup handle");
 
-  /*
-   * If message isn't valid, throw an exception.
-   */
-  if (message == nullptr) {
-    throw CArchiveIssue("could not write uninitialized XLOG data message");
+  if (databuf == nullptr && len > 0) {
+    throw CArchiveIssue("could not write uninitialized XLOG data buffer");
   }
 
+  TRACE_PGBCKCTL_XLOG_WRITE(startpos, len, timeline);
+
   /*
    * Calculate WAL position and offsets. The start position
-   * for the current write is obtained from the WAL position in this record.
+   * for the current write is the WAL position of the data block.
    */
-  position = message->getXLOGStartPos();
+  position = startpos;
   waloffset = PGStream::XLOGOffset(position, this->wal_segment_size);
-  databuf   = message->buffer();
-  message_left = message->dataBufferSize();
+  message_left = len;
 
   /*
    * Check if there is a stacked WAL segment file.
@@ -167,8 +191,20 @@ XLogRecPtr TransactionLogBackup::write(XLOGDataStreamMessage *message,
       this->stackFile(this->walfilename(timeline,
                                         position) + ".partial");
       item = this->fileList.back();
+
+      if (this->validator != nullptr)
+        this->validator->startSegment(position);
     }
 
+    /*
+     * Check the XLOG data before it ends up in the archive.
+     */
+    if (this->validator != nullptr)
+      this->validator->validate(position,
+                                databuf + message_written,
+                                bw,
+                                timeline);
+
     /*
      * Attempt to write the data message block ...
      *
@@ -179,11 +215,13 @@ XLogRecPtr TransactionLogBackup::write(XLOGDataStreamMessage *message,
      */
     item->fileHandle->write(databuf + message_written,
                             bw);
+    this->bytes_written += bw;
 
     /*
      * Mark them being unsynced
      */
     item->sync_pending = item->flush_pending = true;
+    this->unsynced_bytes += bw;
 
     /*
      * Calculate next offset to write from...
@@ -243,316 +281,1389 @@ XLogRecPtr TransactionLogBackup::write(XLOGDataStreamMessage *message,
 
   }
 
-  return position;
-}
-
-uint64_t TransactionLogBackup::countSynced() {
-
-  return this->wal_synced;
-
-}
-
-std::string TransactionLogBackup::walfilename(unsigned int timeline,
-                                              XLogRecPtr position) {
+  this->written_position = position;
 
-  char xlogfilename[MAXPGPATH];
-  XLogSegNo segment_number ;
-  string result;
+  /*
+   * Check whether the sync policy wants us to sync the
+   * current segment file. Segment boundaries have already
+   * synced everything above.
+   */
+  if (item != nullptr && this->syncDue()) {
 
-#if PG_VERSION_NUM < 110000
+    this->syncCurrentWALFile();
+    flush_position = this->written_position;
 
-  XLByteToSeg(position,
-              segment_number);
+  } else if (item != nullptr
+             && this->syncPolicy.method == WAL_SYNC_METHOD_SYNC_FILE_RANGE) {
 
-  XLogFileName(xlogfilename,
-               timeline,
-               segment_number);
-#else
-  XLByteToSeg(position,
-              segment_number,
-              wal_segment_size);
+    this->startWriteback();
 
-  XLogFileName(xlogfilename,
-               timeline,
-               segment_number,
-               wal_segment_size);
-#endif
+  }
 
-  result = string(xlogfilename);
-  return result;
+  return position;
 }
 
-std::shared_ptr<BackupFile> TransactionLogBackup::current_segment_file() {
+WALSyncMethod WALSyncPolicy::methodFromString(std::string method) {
 
-  std::shared_ptr<BackupFile> result = nullptr;
-  std::shared_ptr<TransactionLogListItem> item = nullptr;
+  if (method == "fsync")
+    return WAL_SYNC_METHOD_FSYNC;
 
-  if (this->fileList.empty())
-    return result;
+  if (method == "fdatasync")
+    return WAL_SYNC_METHOD_FDATASYNC;
 
-  item = this->fileList.back();
-  return item->fileHandle;
+  if (method == "sync_file_range")
+    return WAL_SYNC_METHOD_SYNC_FILE_RANGE;
 
-}
+  std::ostringstream oss;
+  oss << "unknown WAL sync method: \"" << method << "\"";
+  throw CArchiveIssue(oss.str());
 
-void TransactionLogBackup::finalize() {
+}
 
-  /*
-   * Sync all stacked file handles. Close all
-   * files.
-   *
-   * NOTE: we call sync_pending() here, which already does all
-   *       the necessary synchronisation here.
-   */
-  this->sync_pending();
+WALPageValidator::WALPageValidator(WALValidationMode mode,
+                                   uint64_t wal_segment_size) {
 
-  for (auto &item : this->fileList) {
-    item->fileHandle->close();
+  if (wal_segment_size == 0
+      || (wal_segment_size % XLOG_BLCKSZ) != 0) {
+    std::ostringstream oss;
+    oss << "invalid WAL segment size for WAL validation: " << wal_segment_size;
+    throw CArchiveIssue(oss.str());
   }
 
-  this->fileList.clear();
+  this->mode = mode;
+  this->wal_segment_size = wal_segment_size;
 
 }
 
-void TransactionLogBackup::initialize() {
+WALPageValidator::~WALPageValidator() {}
 
-  if (!this->isInitialized()) {
+WALValidationMode WALPageValidator::modeFromString(std::string mode) {
 
-    /* WAL segment size must be greater than 0 and
-     * a power of two! */
-    if ( (this->wal_segment_size == 0)
-         || ( (this->wal_segment_size % 2) != 0) ) {
-      std::ostringstream oss;
-      oss << "invalid configured wal segment size("
-          << this->wal_segment_size
-          << ") "
-          << "in transaction log backup handle: ";
-      throw CArchiveIssue(oss.str());
-    }
+  if (mode == "off")
+    return WAL_VALIDATE_OFF;
 
-    this->directory = new BackupDirectory(path(this->descr->directory));
-    this->logDirectory = this->directory->logdirectory();
-    this->initialized = true;
-  }
+  if (mode == "headers")
+    return WAL_VALIDATE_HEADERS;
 
-}
+  if (mode == "checksums")
+    return WAL_VALIDATE_CHECKSUMS;
 
-void TransactionLogBackup::setWalSegmentSize(uint32_t wal_segment_size) {
+  std::ostringstream oss;
+  oss << "unknown WAL validation mode: \"" << mode << "\"";
+  throw CArchiveIssue(oss.str());
 
-  if (this->isInitialized())
-    throw CArchiveIssue("cannot change WAL segment size on initialized transaction log backup handle");
+}
 
-  this->wal_segment_size = wal_segment_size;
+WALValidationMode WALPageValidator::getMode() {
+  return this->mode;
+}
 
+uint64_t WALPageValidator::countPages() {
+  return this->pages_validated;
 }
 
-std::string TransactionLogBackup::backupDirectoryString() {
-  return ((ArchiveLogDirectory *)this->directory)->getPath().string();
+uint32_t WALPageValidator::segmentChecksum() {
+  return this->crc ^ 0xFFFFFFFF;
 }
 
-void TransactionLogBackup::sync_pending() {
+void WALPageValidator::startSegment(XLogRecPtr segment_start) {
 
-  for (auto &item : this->fileList) {
-    if (item->sync_pending ||
-        item->flush_pending) {
-      item->fileHandle->fsync();
-      item->sync_pending = item->flush_pending = false;
-    }
+  if (xlog::segmentOffset(segment_start, this->wal_segment_size) != 0) {
+    std::ostringstream oss;
+    oss << "WAL validation must start at a segment boundary, got "
+        << PGStream::encodeXLOGPos(segment_start);
+    throw CArchiveIssue(oss.str());
   }
 
   /*
-   * Make sure directory meta information is also
-   * synced.
+   * After a timeline switch, the new timeline starts over
+   * at the beginning of the segment, carrying pages of the
+   * previous timeline.
    */
-  this->directory->fsync();
-}
+  this->next_pos = segment_start;
+  this->last_tli = 0;
+  this->crc = 0xFFFFFFFF;
 
-void TransactionLogBackup::flush_pending() {
-  /* currently a no-op, call sync_pending instead */
-  this->sync_pending();
 }
 
-void TransactionLogBackup::finalizeCurrentWALFile(bool forceWalSegSz) {
+void WALPageValidator::validate(XLogRecPtr startpos,
+                                const char *buf,
+                                size_t len,
+                                unsigned int timeline) {
 
-  shared_ptr<TransactionLogListItem> item = nullptr;
-  path finalName;
+  XLogRecPtr pos = startpos;
+  size_t done = 0;
 
-  /*
-   * Check if there is a currently stacked file...
-   */
-  if (this->fileList.empty()) {
-    throw CArchiveIssue("cannot finalize current file in transaction log backup: no file stacked");
+  if (startpos != this->next_pos) {
+    std::ostringstream oss;
+    oss << "XLOG data at " << PGStream::encodeXLOGPos(startpos)
+        << " doesn't continue the stream at "
+        << PGStream::encodeXLOGPos(this->next_pos);
+    throw CArchiveIssue(oss.str());
   }
 
-  item = this->fileList.back();
+  if (xlog::segmentOffset(startpos, this->wal_segment_size) + len
+      > this->wal_segment_size)
+    throw CArchiveIssue("XLOG data block for WAL validation crosses segment boundary");
 
   /*
-   * Rename the XLOG segment into final name without .partial suffix, but
-   * only if we reached the end of the current WAL file.
+   * Only the page headers are looked at. Either collect
+   * the (rest of the) header of the current page, or skip
+   * forward to the next page boundary.
    */
-  if (item->fileHandle->current_position() == this->wal_segment_size) {
+  while (done < len) {
 
-    finalName = change_extension(item->fileHandle->getFilePath(), "");
+    size_t page_off = pos % XLOG_BLCKSZ;
+    size_t hdr_size = (xlog::segmentOffset(pos, this->wal_segment_size) < XLOG_BLCKSZ)
+      ? SizeOfXLogLongPHD : SizeOfXLogShortPHD;
+    size_t n;
 
-    /*
-     * The current XLOG segment file is opened wb+, since we
-     * always want to write from the beginning when streaming is started.
-     *
-     * Change its open mode during rename(), since we then switch
-     * to read-only in this case. This also prevent rename() from truncating
-     * the file during rename(), since it wants to reopen the file with its
-     * new name.
-     */
-    item->fileHandle->setOpenMode("r+");
+    if (page_off < hdr_size) {
 
-    /* Do the rename() now ... */
-    item->fileHandle->rename(finalName);
+      n = std::min(hdr_size - page_off, len - done);
+      memcpy(this->header + page_off, buf + done, n);
 
-    /*
-     * rename() already synced the file, so no need to sync it again.
-     */
-    item->sync_pending = item->flush_pending = false;
+      if (page_off + n == hdr_size)
+        this->checkPageHeader(pos - page_off, timeline);
 
-  }
+    } else {
 
-  if ( forceWalSegSz && (item->fileHandle->size() != this->wal_segment_size) ) {
-    std::ostringstream oss;
+      n = std::min(XLOG_BLCKSZ - page_off, len - done);
+
+    }
+
+    done += n;
+    pos += n;
 
-    oss << "could not finalize current WAL segment: unexpected seek location at "
-        << item->fileHandle->current_position();
-    throw CArchiveIssue(oss.str());
   }
 
+  if (this->mode == WAL_VALIDATE_CHECKSUMS)
+    this->crc = CRC32C::update(this->crc, buf, len);
+
+  this->next_pos = pos;
+
 }
 
-std::shared_ptr<BackupFile> TransactionLogBackup::stackFile(std::string name) {
+void WALPageValidator::checkPageHeader(XLogRecPtr pageaddr,
+                                       unsigned int timeline) {
 
-  std::shared_ptr<TransactionLogListItem> logref = std::make_shared<TransactionLogListItem>();
+  XLogLongPageHeaderData hdr;
+  std::ostringstream oss;
+  bool segment_start = (xlog::segmentOffset(pageaddr, this->wal_segment_size) == 0);
+
+  memcpy(&hdr, this->header,
+         segment_start ? SizeOfXLogLongPHD : SizeOfXLogShortPHD);
 
   /*
-   * Stack a new transaction log segment file into
-   * current pending file list.
+   * The magic number depends on the PostgreSQL major version
+   * of the source, so we just require it to stay the same.
    */
-  if (!this->isInitialized()) {
-    throw CArchiveIssue("cannot create transaction log backup file: not initialized");
+  if (hdr.std.xlp_magic == 0
+      || (this->magic != 0 && hdr.std.xlp_magic != this->magic)) {
+    oss << "invalid XLOG page magic number " << std::hex << hdr.std.xlp_magic
+        << std::dec << " at " << PGStream::encodeXLOGPos(pageaddr);
+    throw CArchiveIssue(oss.str());
   }
 
-  /* Allocate new segment file handle */
-  this->file = this->directory->walfile(name, this->compression);
-  this->file->setOpenMode("wb+");
-  this->file->open();
+  this->magic = hdr.std.xlp_magic;
 
-  /*
-   * Make sure, we start at the beginning of the file.
-   */
-  this->file->lseek(0, SEEK_SET);
+  if (hdr.std.xlp_pageaddr != pageaddr) {
+    oss << "unexpected XLOG page address " << PGStream::encodeXLOGPos(hdr.std.xlp_pageaddr)
+        << " at " << PGStream::encodeXLOGPos(pageaddr);
+    throw CArchiveIssue(oss.str());
+  }
 
-  /*
-   * If we are in an uncompressed mode, pad the file.
-   */
-  // if (this->compression == BACKUP_COMPRESS_TYPE_NONE) {
+  if (hdr.std.xlp_tli > timeline || hdr.std.xlp_tli < this->last_tli) {
+    oss << "out-of-sequence timeline " << hdr.std.xlp_tli
+        << " in XLOG page at " << PGStream::encodeXLOGPos(pageaddr)
+        << " on timeline " << timeline;
+    throw CArchiveIssue(oss.str());
+  }
 
-  //   char *zerobuffer = new char[XLOG_BLCKSZ];
-  //   int   wbytes = 0; /* bytes written */
+  this->last_tli = hdr.std.xlp_tli;
 
-  //   memset(zerobuffer, 0, XLOG_BLCKSZ);
+  if (segment_start) {
 
-  //   for (wbytes = 0; i < this->wal_segment_size; wbytes += XLOG_BLCKSZ) {
+    if ((hdr.std.xlp_info & XLP_LONG_HEADER) == 0) {
+      oss << "missing long XLOG page header at " << PGStream::encodeXLOGPos(pageaddr);
+      throw CArchiveIssue(oss.str());
+    }
 
-  //     this->file->write(
-  //   }
-  // }
+    if (hdr.xlp_seg_size != this->wal_segment_size
+        || hdr.xlp_xlog_blcksz != XLOG_BLCKSZ) {
+      oss << "XLOG segment at " << PGStream::encodeXLOGPos(pageaddr)
+          << " has segment size " << hdr.xlp_seg_size
+          << " and block size " << hdr.xlp_xlog_blcksz
+          << ", expected " << this->wal_segment_size
+          << " and " << XLOG_BLCKSZ;
+      throw CArchiveIssue(oss.str());
+    }
 
-  /*
-   * Stack walfile reference into open file list.
-   */
-  logref->fileHandle = file;
-  logref->filename = name;
-  logref->sync_pending = true;
-  logref->flush_pending = true;
+  }
 
-  this->fileList.push_back(logref);
-  return this->file;
+  this->pages_validated++;
 
 }
 
-StreamBaseBackup::StreamBaseBackup(const std::shared_ptr<CatalogDescr>& descr)
-  : Backup(descr) {
+void TransactionLogBackup::setCompression(BackupProfileCompressType compression) {
 
-  this->descr = descr;
-  this->identifier = this->createMyIdentifier();
-  this->mode = SB_NOT_SET;
+  switch(compression) {
+  case BACKUP_COMPRESS_TYPE_NONE:
+  case BACKUP_COMPRESS_TYPE_GZIP:
+  case BACKUP_COMPRESS_TYPE_ZSTD:
+  case BACKUP_COMPRESS_TYPE_LZ4:
+    break;
+  default:
+    {
+      std::ostringstream oss;
+      oss << "unsupported compression type for transaction log backup: "
+          << compression;
+      throw CArchiveIssue(oss.str());
+    }
+  }
+
+  this->compression = compression;
 
 }
 
-StreamBaseBackup::StreamBaseBackup(const std::shared_ptr<CatalogDescr>& descr,
-                                   StreamDirectoryOperationMode mode)
-  : Backup(descr) {
+void TransactionLogBackup::setCompressionLevel(int level) {
+  this->compression_level = level;
+}
 
-  this->descr = descr;
-  this->identifier = this->createMyIdentifier();
-  this->mode = mode;
+void TransactionLogBackup::setCompressionFrameBlocks(unsigned int blocks) {
+  this->compression_frame_blocks = blocks;
+}
 
+void TransactionLogBackup::setDirectWrite(bool direct_write) {
+  this->direct_write = direct_write;
 }
 
-void StreamBaseBackup::setCompression(BackupProfileCompressType compression) {
-  this->compression = compression;
+void TransactionLogBackup::setSyncPolicy(WALSyncPolicy policy) {
+  this->syncPolicy = policy;
 }
 
-BackupProfileCompressType StreamBaseBackup::getCompression() {
-  return this->compression;
+bool TransactionLogBackup::syncDue() {
+
+  if (this->unsynced_bytes == 0)
+    return false;
+
+  if (this->syncPolicy.sync_threshold_bytes > 0
+      && this->unsynced_bytes >= this->syncPolicy.sync_threshold_bytes)
+    return true;
+
+  if (this->syncPolicy.sync_interval_ms > 0
+      && CPGBackupCtlBase::calculate_duration_ms(this->last_sync,
+                                                 CPGBackupCtlBase::current_hires_time_point())
+      >= std::chrono::milliseconds(this->syncPolicy.sync_interval_ms))
+    return true;
+
+  return false;
+
 }
 
-StreamBaseBackup::~StreamBaseBackup() {
+void TransactionLogBackup::syncCurrentWALFile() {
 
-  if (this->isInitialized()) {
-    this->finalize();
-    delete this->directory;
-  }
+  std::shared_ptr<TransactionLogListItem> item = nullptr;
+  std::shared_ptr<ArchiveFile> archfile = nullptr;
+  off_t current_offset;
 
-};
+  if (this->fileList.empty())
+    return;
 
-void StreamBaseBackup::setMode(StreamDirectoryOperationMode mode) {
+  std::chrono::high_resolution_clock::time_point start
+    = CPGBackupCtlBase::current_hires_time_point();
+
+  item = this->fileList.back();
+  current_offset = item->fileHandle->current_position();
+
+  TRACE_PGBCKCTL_XLOG_SYNC_START(this->unsynced_bytes);
 
   /*
-   * We allow changing operation mode on
-   * uninitialized instances!
+   * Only plain ArchiveFile handles support fdatasync() and
+   * sync_file_range(), use fsync() for anything else.
    */
-  if (this->isInitialized())
-    throw CArchiveIssue("cannot change stream directory operation mode if already initialized");
+  archfile = std::dynamic_pointer_cast<ArchiveFile>(item->fileHandle);
 
-  this->mode = mode;
+  if (archfile == nullptr) {
 
-}
+    item->fileHandle->fsync();
 
-StreamDirectoryOperationMode StreamBaseBackup::getMode() {
+  } else {
 
-  return this->mode;
+    switch(this->syncPolicy.method) {
+    /*
+     * Writeback was started by write() already, but the flush
+     * position must not be reported before the data is durable.
+     */
+    case WAL_SYNC_METHOD_SYNC_FILE_RANGE:
+    case WAL_SYNC_METHOD_FDATASYNC:
+      archfile->datasync();
+      break;
+
+    case WAL_SYNC_METHOD_FSYNC:
+    default:
+      archfile->fsync();
+      break;
+    }
 
-}
+  }
 
-std::string StreamBaseBackup::backupDirectoryString() {
+  item->sync_pending = item->flush_pending = false;
 
-  if (this->isInitialized()) {
-    return ((StreamingBaseBackupDirectory *)this->directory)->getPath().string();
-  } else {
-    return std::string("");
+  /*
+   * A newly created segment file needs its directory entry
+   * synced, too.
+   */
+  if (this->dir_sync_pending) {
+    this->syncLogDirectory();
+    this->dir_sync_pending = false;
   }
 
+  TRACE_PGBCKCTL_XLOG_SYNC_DONE(this->unsynced_bytes);
+
+  this->synced_offset = this->writeback_offset = current_offset;
+  this->unsynced_bytes = 0;
+  this->last_sync = CPGBackupCtlBase::current_hires_time_point();
+
+  this->countSync(start);
+
 }
 
-std::string StreamBaseBackup::createMyIdentifier() {
+void TransactionLogBackup::startWriteback() {
 
-  return "streambackup-"
-    + CPGBackupCtlBase::current_timestamp(true);
+  std::shared_ptr<ArchiveFile> archfile = nullptr;
+  off_t current_offset;
+
+  if (this->fileList.empty())
+    return;
+
+  /* compressed files don't map offsets to the file */
+  archfile = std::dynamic_pointer_cast<ArchiveFile>(this->fileList.back()->fileHandle);
+
+  if (archfile == nullptr)
+    return;
+
+  current_offset = archfile->current_position();
+
+  if (current_offset <= this->writeback_offset)
+    return;
+
+  archfile->startWriteback(this->writeback_offset,
+                           current_offset - this->writeback_offset);
+  this->writeback_offset = current_offset;
 
 }
 
-void StreamBaseBackup::create() {
+XLogRecPtr TransactionLogBackup::sync(bool force) {
 
-  if (this->mode == SB_READ) {
-    CArchiveIssue("stream backup is in read-only mode");
-  }
+  if (!this->isInitialized() || this->fileList.empty())
+    return InvalidXLogRecPtr;
+
+  if (this->unsynced_bytes == 0)
+    return InvalidXLogRecPtr;
+
+  if (!force && !this->syncDue())
+    return InvalidXLogRecPtr;
+
+  this->syncCurrentWALFile();
+  return this->written_position;
+
+}
+
+uint64_t TransactionLogBackup::countSynced() {
+
+  return this->wal_synced;
+
+}
+
+void TransactionLogBackup::countSync(std::chrono::high_resolution_clock::time_point start) {
+
+  uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(CPGBackupCtlBase::current_hires_time_point()
+                                                                     - start).count();
+  unsigned int bucket = 0;
+
+  /*
+   * Bucket N counts syncs below 2^N ms.
+   */
+  while (bucket < (WAL_SYNC_LATENCY_BUCKETS - 1)
+         && us >= ((uint64_t) 1000 << bucket)) {
+    bucket++;
+  }
+
+  this->syncs++;
+  this->sync_time_us += us;
+  this->sync_latency[bucket]++;
+
+}
+
+WALWriteStatistics TransactionLogBackup::writeStatistics() {
+
+  WALWriteStatistics stats;
+
+  stats.bytes_written   = this->bytes_written;
+  stats.segments_synced = this->wal_synced;
+  stats.syncs           = this->syncs;
+  stats.sync_time_us    = this->sync_time_us;
+
+  for (unsigned int i = 0; i < WAL_SYNC_LATENCY_BUCKETS; i++)
+    stats.sync_latency[i] = this->sync_latency[i];
+
+  return stats;
+
+}
+
+std::string TransactionLogBackup::walfilename(unsigned int timeline,
+                                              XLogRecPtr position) {
+
+  char xlogfilename[xlog::WAL_FILENAME_LEN + 1];
+
+  xlog::walFileName(xlogfilename,
+                    timeline,
+                    xlog::segmentNumber(position, wal_segment_size),
+                    wal_segment_size);
+
+  return string(xlogfilename, xlog::WAL_FILENAME_LEN);
+}
+
+std::shared_ptr<BackupFile> TransactionLogBackup::current_segment_file() {
+
+  std::shared_ptr<BackupFile> result = nullptr;
+  std::shared_ptr<TransactionLogListItem> item = nullptr;
+
+  if (this->fileList.empty())
+    return result;
+
+  item = this->fileList.back();
+  return item->fileHandle;
+
+}
+
+void TransactionLogBackup::finalize() {
+
+  /*
+   * Sync all stacked file handles. Close all
+   * files.
+   *
+   * NOTE: we call sync_pending() here, which already does all
+   *       the necessary synchronisation here.
+   */
+  this->sync_pending();
+
+  for (auto &item : this->fileList) {
+
+    /*
+     * Compressed segment files are already closed
+     * after being renamed into their final name.
+     */
+    if (item->fileHandle->isOpen())
+      item->fileHandle->close();
+
+  }
+
+  this->fileList.clear();
+
+}
+
+void TransactionLogBackup::initialize() {
+
+  if (!this->isInitialized()) {
+
+    /* WAL segment size must be greater than 0 and
+     * a power of two! */
+    if ( (this->wal_segment_size == 0)
+         || ( (this->wal_segment_size % 2) != 0) ) {
+      std::ostringstream oss;
+      oss << "invalid configured wal segment size("
+          << this->wal_segment_size
+          << ") "
+          << "in transaction log backup handle: ";
+      throw CArchiveIssue(oss.str());
+    }
+
+    this->directory = new BackupDirectory(path(this->descr->directory));
+    this->logDirectory = this->directory->logdirectory();
+    this->last_sync = CPGBackupCtlBase::current_hires_time_point();
+    this->initialized = true;
+
+    if (this->validation != WAL_VALIDATE_OFF)
+      this->validator = std::make_shared<WALPageValidator>(this->validation,
+                                                           this->wal_segment_size);
+
+    /*
+     * Validate the segment index against the log directory before
+     * we start changing it. Afterwards we maintain the index along
+     * with our changes, see updateSegmentIndex().
+     */
+    if (exists(this->logDirectory->getPath())) {
+
+      try {
+        this->logDirectory->segmentIndex(this->wal_segment_size)->load();
+      } catch (CArchiveIssue &ai) {
+        BOOST_LOG_TRIVIAL(warning) << "could not load WAL segment index: "
+                                   << ai.what();
+      }
+
+    }
+
+    /*
+     * Allocate spare WAL segment files, if configured.
+     */
+    this->preallocateSpareSegments();
+  }
+
+}
+
+void TransactionLogBackup::setWalSegmentSize(uint32_t wal_segment_size) {
+
+  if (this->isInitialized())
+    throw CArchiveIssue("cannot change WAL segment size on initialized transaction log backup handle");
+
+  this->wal_segment_size = wal_segment_size;
+
+}
+
+void TransactionLogBackup::setValidation(WALValidationMode mode) {
+
+  if (this->isInitialized())
+    throw CArchiveIssue("cannot change WAL validation on initialized transaction log backup handle");
+
+  this->validation = mode;
+
+}
+
+void TransactionLogBackup::setPreallocate(bool preallocate) {
+  this->preallocate = preallocate;
+}
+
+void TransactionLogBackup::setPreallocSegments(unsigned int prealloc_segments) {
+  this->prealloc_segments = prealloc_segments;
+}
+
+void TransactionLogBackup::preallocateSpareSegments() {
+
+  unsigned int spare_id = 0;
+  bool created = false;
+
+  if (!this->preallocate
+      || this->compression != BACKUP_COMPRESS_TYPE_NONE
+      || !this->isInitialized()
+      || !exists(this->logDirectory->getPath()))
+    return;
+
+  /*
+   * Spare segment files use a name which doesn't look like
+   * a WAL segment file, so getXlogStartPosition() and friends
+   * just ignore them. Leftovers from a previous run with the
+   * expected size are reused as-is.
+   */
+  for (spare_id = 0;
+       this->spareSegments.size() < this->prealloc_segments;
+       spare_id++) {
+
+    std::ostringstream spare_name;
+    path spare;
+    bool in_use = false;
+
+    spare_name << "xlogtemp.prealloc." << spare_id;
+    spare = this->logDirectory->getPath() / spare_name.str();
+
+    for (auto &p : this->spareSegments) {
+      if (p == spare) {
+        in_use = true;
+        break;
+      }
+    }
+
+    if (in_use)
+      continue;
+
+    if (!exists(spare) || file_size(spare) != this->wal_segment_size) {
+
+      std::shared_ptr<ArchiveFile> sparefile = std::make_shared<ArchiveFile>(spare);
+
+      sparefile->setOpenMode("wb+");
+      sparefile->open();
+      sparefile->allocate(this->wal_segment_size);
+      sparefile->fsync();
+      sparefile->close();
+      created = true;
+
+    }
+
+    this->spareSegments.push_back(spare);
+
+  }
+
+  if (created)
+    RootDirectory::fsync(this->logDirectory->getPath());
+
+}
+
+std::string TransactionLogBackup::backupDirectoryString() {
+  return ((ArchiveLogDirectory *)this->directory)->getPath().string();
+}
+
+void TransactionLogBackup::sync_pending() {
+
+  std::chrono::high_resolution_clock::time_point start
+    = CPGBackupCtlBase::current_hires_time_point();
+  bool synced = false;
+
+  TRACE_PGBCKCTL_XLOG_SYNC_START(this->unsynced_bytes);
+
+  for (auto &item : this->fileList) {
+    if (item->sync_pending ||
+        item->flush_pending) {
+      item->fileHandle->fsync();
+      item->sync_pending = item->flush_pending = false;
+      synced = true;
+    }
+  }
+
+  /*
+   * Make sure directory meta information is also
+   * synced, but only if a segment file was created or
+   * renamed since the last time.
+   */
+  if (this->dir_sync_pending) {
+    this->syncLogDirectory();
+    this->dir_sync_pending = false;
+  }
+
+  TRACE_PGBCKCTL_XLOG_SYNC_DONE(this->unsynced_bytes);
+
+  this->synced_offset = this->writeback_offset = 0;
+  this->unsynced_bytes = 0;
+  this->last_sync = CPGBackupCtlBase::current_hires_time_point();
+
+  if (synced)
+    this->countSync(start);
+}
+
+void TransactionLogBackup::syncLogDirectory() {
+
+  path logpath = this->logDirectory->getPath();
+
+  /*
+   * With a sharded log directory, segment files live in
+   * subdirectories. Spare segment files are moved from the log
+   * directory itself into them, so sync both.
+   */
+  RootDirectory::fsync(logpath);
+
+  for (auto &item : this->fileList) {
+
+    path dir = path(item->fileHandle->getFilePath()).parent_path();
+
+    if (dir != logpath)
+      RootDirectory::fsync(dir);
+
+  }
+
+}
+
+void TransactionLogBackup::flush_pending() {
+  /* currently a no-op, call sync_pending instead */
+  this->sync_pending();
+}
+
+void TransactionLogBackup::finalizeCurrentWALFile(bool forceWalSegSz) {
+
+  shared_ptr<TransactionLogListItem> item = nullptr;
+  path finalName;
+  off_t written;
+
+  /*
+   * Check if there is a currently stacked file...
+   */
+  if (this->fileList.empty()) {
+    throw CArchiveIssue("cannot finalize current file in transaction log backup: no file stacked");
+  }
+
+  item = this->fileList.back();
+  written = item->fileHandle->current_position();
+
+  /*
+   * Rename the XLOG segment into final name without .partial suffix, but
+   * only if we reached the end of the current WAL file.
+   */
+  if (written == this->wal_segment_size) {
+
+    path partialName = path(item->fileHandle->getFilePath());
+
+    if (item->fileHandle->isCompressed()) {
+
+      /*
+       * Compressed segment files carry their compression suffix
+       * after .partial, so strip the .partial in between.
+       */
+      finalName = partialName.parent_path()
+        / (change_extension(partialName.stem(), "").string()
+           + partialName.extension().string());
+
+    } else {
+
+      finalName = change_extension(partialName, "");
+
+    }
+
+    /*
+     * The current XLOG segment file is opened wb+, since we
+     * always want to write from the beginning when streaming is started.
+     *
+     * Change its open mode during rename(), since we then switch
+     * to read-only in this case. This also prevent rename() from truncating
+     * the file during rename(), since it wants to reopen the file with its
+     * new name.
+     */
+    item->fileHandle->setOpenMode("r+");
+
+    /*
+     * Do the rename() now ... since rename() syncs the segment
+     * before moving it into place, account this as a sync, too.
+     */
+    std::chrono::high_resolution_clock::time_point start
+      = CPGBackupCtlBase::current_hires_time_point();
+
+    TRACE_PGBCKCTL_XLOG_RENAME_START(finalName.c_str());
+    item->fileHandle->rename(finalName);
+    TRACE_PGBCKCTL_XLOG_RENAME_DONE(finalName.c_str());
+
+    this->countSync(start);
+
+    /*
+     * rename() already synced the file, so no need to sync it again.
+     * The directory entry changed, though.
+     */
+    item->sync_pending = item->flush_pending = false;
+    this->dir_sync_pending = true;
+
+    this->updateSegmentIndex(partialName.filename().string(),
+                             finalName.filename().string(),
+                             this->wal_segment_size);
+
+    this->segmentCompleted(finalName);
+
+  }
+
+  /*
+   * The physical size doesn't tell anything, neither for compressed
+   * nor for preallocated segment files, use the number of bytes
+   * written instead.
+   */
+  if (forceWalSegSz && (size_t) written != this->wal_segment_size) {
+    std::ostringstream oss;
+
+    oss << "could not finalize current WAL segment: unexpected seek location at "
+        << written;
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+void TransactionLogBackup::updateSegmentIndex(const std::string &oldname,
+                                              const std::string &newname,
+                                              unsigned long long size) {
+
+  std::shared_ptr<WALSegmentIndex> index = nullptr;
+
+  try {
+
+    index = this->logDirectory->segmentIndex(this->wal_segment_size);
+
+    if (oldname.empty())
+      index->add(newname, size);
+    else if (this->validator != nullptr
+             && this->validator->getMode() == WAL_VALIDATE_CHECKSUMS)
+      index->rename(oldname, newname, size,
+                    this->validator->segmentChecksum());
+    else
+      index->rename(oldname, newname, size);
+
+  } catch (CArchiveIssue &ai) {
+
+    BOOST_LOG_TRIVIAL(warning) << "could not update WAL segment index: "
+                               << ai.what();
+
+    if (index != nullptr)
+      index->invalidate();
+
+  }
+
+}
+
+void TransactionLogBackup::setSegmentCallback(std::function<void(const CompletedWALSegment &)> cb) {
+
+  this->segment_cb = cb;
+
+}
+
+void TransactionLogBackup::segmentCompleted(const boost::filesystem::path &segment) {
+
+  CompletedWALSegment completed;
+  TimeLineID tli = 0;
+  XLogSegNo segno = 0;
+  boost::system::error_code ec;
+
+  if (this->segment_cb == nullptr)
+    return;
+
+  completed.filename = segment.filename().string();
+  completed.path = segment.string();
+
+  if (!xlog::parseWalFileName(completed.filename.c_str(),
+                              completed.filename.length(),
+                              tli, segno, this->wal_segment_size))
+    return;
+
+  completed.timeline = tli;
+  completed.start = segno * (XLogRecPtr) this->wal_segment_size;
+  completed.end = completed.start + this->wal_segment_size;
+
+  /* physical size, compressed segments are smaller */
+  completed.size = boost::filesystem::file_size(segment, ec);
+
+  if (ec)
+    completed.size = 0;
+
+  try {
+
+    this->segment_cb(completed);
+
+  } catch (std::exception &e) {
+
+    BOOST_LOG_TRIVIAL(warning) << "segment callback failed for "
+                               << completed.filename << ": " << e.what();
+
+  }
+
+}
+
+std::shared_ptr<BackupFile> TransactionLogBackup::stackFile(std::string name) {
+
+  std::shared_ptr<TransactionLogListItem> logref = std::make_shared<TransactionLogListItem>();
+
+  /*
+   * Stack a new transaction log segment file into
+   * current pending file list.
+   */
+  if (!this->isInitialized()) {
+    throw CArchiveIssue("cannot create transaction log backup file: not initialized");
+  }
+
+  /* Allocate new segment file handle */
+  this->file = this->directory->walfile(name, this->compression,
+                                        this->compression_level);
+
+  /*
+   * Split compressed segments into frames, so they can be decoded
+   * starting at any frame later.
+   */
+  if (this->compression != BACKUP_COMPRESS_TYPE_NONE
+      && this->compression_frame_blocks > 0) {
+
+    this->file = std::make_shared<FramedArchiveFile>(this->file,
+                                                     (size_t) this->compression_frame_blocks
+                                                     * XLOG_BLCKSZ);
+
+  }
+
+  /*
+   * A restarted stream rewrites its partial segment from the
+   * beginning. After a migration of the log directory layout, the
+   * old partial segment might still live in the location of
+   * the previous layout, so drop it.
+   */
+  this->logDirectory->removeAlternateXLogFile(path(this->file->getFilePath()).filename().string());
+
+  if (this->direct_write
+      && this->compression == BACKUP_COMPRESS_TYPE_NONE) {
+
+    std::shared_ptr<ArchiveFile> archfile
+      = std::dynamic_pointer_cast<ArchiveFile>(this->file);
+
+    if (archfile != nullptr)
+      archfile->setBuffered(false);
+
+  }
+
+  if (this->preallocate
+      && this->compression == BACKUP_COMPRESS_TYPE_NONE) {
+
+    std::shared_ptr<ArchiveFile> archfile
+      = std::dynamic_pointer_cast<ArchiveFile>(this->file);
+
+    if (!this->spareSegments.empty()) {
+
+      /*
+       * Reuse a spare preallocated segment file. Rename it
+       * into its final .partial name and open it without
+       * truncating it, so the reserved space is kept.
+       */
+      path spare = this->spareSegments.front();
+      this->spareSegments.erase(this->spareSegments.begin());
+
+      boost::filesystem::rename(spare, path(this->file->getFilePath()));
+
+      this->file->setOpenMode("rb+");
+      this->file->open();
+
+    } else {
+
+      this->file->setOpenMode("wb+");
+      this->file->open();
+
+      /*
+       * Pad the file up to the full WAL segment size.
+       */
+      if (archfile != nullptr)
+        archfile->allocate(this->wal_segment_size);
+
+    }
+
+  } else {
+
+    /*
+     * Compressed streams can't be opened for update.
+     */
+    this->file->setOpenMode(this->file->isCompressed() ? "wb" : "wb+");
+    this->file->open();
+
+  }
+
+  /*
+   * Make sure, we start at the beginning of the file.
+   */
+  this->file->lseek(0, SEEK_SET);
+
+  /*
+   * New directory entry, needs to be synced along with the data.
+   */
+  this->dir_sync_pending = true;
+  this->synced_offset = this->writeback_offset = 0;
+
+  this->updateSegmentIndex("",
+                           path(this->file->getFilePath()).filename().string(),
+                           0);
+
+  /*
+   * Stack walfile reference into open file list.
+   */
+  logref->fileHandle = file;
+  logref->filename = name;
+  logref->sync_pending = true;
+  logref->flush_pending = true;
+
+  this->fileList.push_back(logref);
+  return this->file;
+
+}
+
+WALWriterPipeline::WALWriterPipeline(std::shared_ptr<TransactionLogBackup> backup,
+                                     unsigned int slots)
+  : head(0), tail(0),
+    written_position(InvalidXLogRecPtr),
+    flushed_position(InvalidXLogRecPtr),
+    sync_request(WAL_WRITER_SYNC_NONE),
+    running(false), failed(false) {
+
+  if (backup == nullptr)
+    throw CArchiveIssue("WAL writer pipeline requires a transaction log backup handle");
+
+  if (slots < 2) {
+    std::ostringstream oss;
+    oss << "WAL writer pipeline requires at least 2 slots, got " << slots;
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->backup = backup;
+  this->ring.resize(slots);
+
+}
+
+WALWriterPipeline::~WALWriterPipeline() {
+
+  /*
+   * Never throw from here, the caller might be in the middle
+   * of unwinding from another error. Just make sure the writer
+   * thread is gone.
+   */
+  if (this->writer != nullptr) {
+
+    this->running.store(false);
+    this->wakeup();
+
+    if (this->writer->joinable())
+      this->writer->join();
+
+  }
+
+}
+
+void WALWriterPipeline::wakeup() {
+
+  /*
+   * Notify while holding the mutex, otherwise a parked thread
+   * might miss a wakeup between evaluating its wait predicate and
+   * going to sleep.
+   */
+  std::lock_guard<std::mutex> lock(this->wait_mutex);
+  this->wait_cond.notify_all();
+
+}
+
+void WALWriterPipeline::checkFailed() {
+
+  if (this->failed.load(std::memory_order_acquire)) {
+
+    std::ostringstream oss;
+
+    {
+      std::lock_guard<std::mutex> lock(this->wait_mutex);
+      oss << "WAL writer failed: " << this->error_message;
+    }
+
+    throw CArchiveIssue(oss.str());
+
+  }
+
+}
+
+void WALWriterPipeline::start() {
+
+  if (this->writer != nullptr)
+    throw CArchiveIssue("WAL writer pipeline already started");
+
+  this->running.store(true);
+  this->writer = std::make_shared<std::thread>(&WALWriterPipeline::work, this);
+
+}
+
+bool WALWriterPipeline::isRunning() {
+  return (this->writer != nullptr && this->running.load());
+}
+
+XLogRecPtr WALWriterPipeline::writtenPosition() {
+  return this->written_position.load(std::memory_order_acquire);
+}
+
+XLogRecPtr WALWriterPipeline::flushedPosition() {
+  return this->flushed_position.load(std::memory_order_acquire);
+}
+
+size_t WALWriterPipeline::queued() {
+  return (size_t) (this->head.load(std::memory_order_acquire)
+                   - this->tail.load(std::memory_order_acquire));
+}
+
+void WALWriterPipeline::push(XLogRecPtr startpos,
+                             unsigned int timeline,
+                             const char *buf,
+                             size_t len) {
+
+  uint64_t slotno = this->head.load(std::memory_order_relaxed);
+
+  if (!this->isRunning())
+    throw CArchiveIssue("attempt to push into a stopped WAL writer pipeline");
+
+  this->checkFailed();
+
+  /*
+   * Park as long as the ring is full.
+   */
+  if ((slotno - this->tail.load(std::memory_order_acquire)) >= this->ring.size()) {
+
+    std::unique_lock<std::mutex> lock(this->wait_mutex);
+
+    this->wait_cond.wait(lock, [this, slotno] {
+        return ((slotno - this->tail.load(std::memory_order_acquire)) < this->ring.size())
+          || this->failed.load(std::memory_order_acquire);
+      });
+
+  }
+
+  this->checkFailed();
+
+  WALWriterSlot &slot = this->ring[slotno % this->ring.size()];
+
+  if (slot.data.size() < len)
+    slot.data.resize(len);
+
+  if (len > 0)
+    memcpy(slot.data.data(), buf, len);
+
+  slot.startpos = startpos;
+  slot.timeline = timeline;
+  slot.len      = len;
+
+  /* Publish the slot to the writer */
+  this->head.store(slotno + 1, std::memory_order_release);
+  this->wakeup();
+
+}
+
+void WALWriterPipeline::requestSync(bool force) {
+
+  int request = (force) ? WAL_WRITER_SYNC_FORCE : WAL_WRITER_SYNC_POLICY;
+  int current = this->sync_request.load();
+
+  this->checkFailed();
+
+  /*
+   * Never downgrade a pending forced sync request.
+   */
+  while (current < request
+         && !this->sync_request.compare_exchange_weak(current, request));
+
+  this->wakeup();
+
+}
+
+void WALWriterPipeline::drain() {
+
+  std::unique_lock<std::mutex> lock(this->wait_mutex);
+
+  this->wait_cond.wait(lock, [this] {
+      return (this->head.load(std::memory_order_acquire)
+              == this->tail.load(std::memory_order_acquire))
+        || this->failed.load(std::memory_order_acquire);
+    });
+
+  lock.unlock();
+  this->checkFailed();
+
+}
+
+void WALWriterPipeline::stop() {
+
+  if (this->writer == nullptr)
+    return;
+
+  /*
+   * The writer empties the ring before it exits.
+   */
+  this->running.store(false);
+  this->wakeup();
+
+  if (this->writer->joinable())
+    this->writer->join();
+
+  this->writer = nullptr;
+  this->checkFailed();
+
+}
+
+void WALWriterPipeline::handleSyncRequest() {
+
+  int request = this->sync_request.exchange(WAL_WRITER_SYNC_NONE);
+  XLogRecPtr synced = InvalidXLogRecPtr;
+
+  if (request == WAL_WRITER_SYNC_NONE)
+    return;
+
+  synced = this->backup->sync(request == WAL_WRITER_SYNC_FORCE);
+
+  if (synced != InvalidXLogRecPtr)
+    this->flushed_position.store(synced, std::memory_order_release);
+
+}
+
+void WALWriterPipeline::work() {
+
+  try {
+
+    while (true) {
+
+      uint64_t slotno = this->tail.load(std::memory_order_relaxed);
+
+      if (slotno == this->head.load(std::memory_order_acquire)) {
+
+        /*
+         * Nothing queued. Do pending syncs and exit in case
+         * we were asked to stop, otherwise park until there is something
+         * to do.
+         */
+        this->handleSyncRequest();
+
+        if (!this->running.load())
+          break;
+
+        /*
+         * The receiver keeps queueing meanwhile, so this is the
+         * place to replace the spare segment files used up.
+         */
+        this->backup->preallocateSpareSegments();
+
+        std::unique_lock<std::mutex> lock(this->wait_mutex);
+
+        this->wait_cond.wait(lock, [this, slotno] {
+            return (slotno != this->head.load(std::memory_order_acquire))
+              || !this->running.load()
+              || (this->sync_request.load() != WAL_WRITER_SYNC_NONE);
+          });
+
+        continue;
+
+      }
+
+      WALWriterSlot &slot = this->ring[slotno % this->ring.size()];
+      XLogRecPtr flush_position = InvalidXLogRecPtr;
+      XLogRecPtr position;
+
+      position = this->backup->write(slot.startpos,
+                                     slot.data.data(),
+                                     slot.len,
+                                     flush_position,
+                                     slot.timeline);
+
+      this->written_position.store(position, std::memory_order_release);
+
+      if (flush_position != InvalidXLogRecPtr)
+        this->flushed_position.store(flush_position, std::memory_order_release);
+
+      /* Hand back the slot to the receiver */
+      this->tail.store(slotno + 1, std::memory_order_release);
+      this->wakeup();
+
+      this->handleSyncRequest();
+
+    }
+
+  } catch (std::exception &e) {
+
+    {
+      std::lock_guard<std::mutex> lock(this->wait_mutex);
+      this->error_message = e.what();
+      this->failed.store(true, std::memory_order_release);
+      this->wait_cond.notify_all();
+    }
+
+  }
+
+}
+
+StreamBaseBackup::StreamBaseBackup(const std::shared_ptr<CatalogDescr>& descr)
+  : Backup(descr) {
+
+  this->descr = descr;
+  this->identifier = this->createMyIdentifier();
+  this->mode = SB_NOT_SET;
+
+}
+
+StreamBaseBackup::StreamBaseBackup(const std::shared_ptr<CatalogDescr>& descr,
+                                   StreamDirectoryOperationMode mode)
+  : Backup(descr) {
+
+  this->descr = descr;
+  this->identifier = this->createMyIdentifier();
+  this->mode = mode;
+
+}
+
+void StreamBaseBackup::setCompression(BackupProfileCompressType compression) {
+  this->compression = compression;
+}
+
+BackupProfileCompressType StreamBaseBackup::getCompression() {
+  return this->compression;
+}
+
+void StreamBaseBackup::setCompressionLevel(int level) {
+  this->compression_level = level;
+}
+
+void StreamBaseBackup::setCompressionWorkers(int workers) {
+  this->compression_workers = workers;
+}
+
+void StreamBaseBackup::setParallelWriters(unsigned int writers) {
+
+  if (this->isInitialized())
+    throw CArchiveIssue("cannot change number of archive writers if already initialized");
+
+  this->parallel_writers = writers;
+
+}
+
+void StreamBaseBackup::setRateLimiter(std::shared_ptr<ArchiveRateLimiter> limiter) {
+
+  this->rateLimiter = limiter;
+
+}
+
+void StreamBaseBackup::setArchiveIndex(bool enabled) {
+
+  this->archiveIndex = enabled;
+
+}
+
+void StreamBaseBackup::setDeduplicate(bool enabled) {
+
+  this->deduplicate = enabled;
+
+}
+
+StreamBaseBackup::~StreamBaseBackup() {
+
+  if (this->isInitialized()) {
+
+    /*
+     * A failed archive writer makes finalize() throw, which
+     * we must not propagate out of a destructor.
+     */
+    try {
+      this->finalize();
+    } catch(CArchiveIssue &e) {
+      BOOST_LOG_TRIVIAL(error) << e.what();
+    }
+
+    delete this->directory;
+  }
+
+};
+
+void StreamBaseBackup::setMode(StreamDirectoryOperationMode mode) {
+
+  /*
+   * We allow changing operation mode on
+   * uninitialized instances!
+   */
+  if (this->isInitialized())
+    throw CArchiveIssue("cannot change stream directory operation mode if already initialized");
+
+  this->mode = mode;
+
+}
+
+StreamDirectoryOperationMode StreamBaseBackup::getMode() {
+
+  return this->mode;
+
+}
+
+std::string StreamBaseBackup::backupDirectoryString() {
+
+  if (this->isInitialized()) {
+    return ((StreamingBaseBackupDirectory *)this->directory)->getPath().string();
+  } else {
+    return std::string("");
+  }
+
+}
+
+std::string StreamBaseBackup::createMyIdentifier() {
+
+  return "streambackup-"
+    + CPGBackupCtlBase::current_timestamp(true);
+
+}
+
+void StreamBaseBackup::create() {
+
+  if (this->mode == SB_READ) {
+    CArchiveIssue("stream backup is in read-only mode");
+  }
 
   if (this->isInitialized()) {
     /*
@@ -577,13 +1688,25 @@ void StreamBaseBackup::finalize() {
   if (this->mode == SB_WRITE) {
 
     /*
-     * Sync file handles and their contents.
+     * Sync file handles and their contents. With a writer pool,
+     * this just queues the remaining syncs, so wait for the writers
+     * to finish before syncing the directory.
      */
     for(auto& item : this->fileList) {
       item->fsync();
       item->close();
     }
 
+    if (this->writerPool != nullptr) {
+
+      std::shared_ptr<ArchiveWriterPool> pool = this->writerPool;
+
+      /* Don't get here again in case stop() throws */
+      this->writerPool = nullptr;
+      pool->stop();
+
+    }
+
     /*
      * Sync directory handle
      */
@@ -619,6 +1742,12 @@ void StreamBaseBackup::initialize() {
   if (!this->isInitialized()) {
     this->directory = new StreamingBaseBackupDirectory(this->identifier,
                                                        path(this->descr->directory));
+
+    if (this->mode == SB_WRITE && this->parallel_writers > 0) {
+      this->writerPool = std::make_shared<ArchiveWriterPool>(this->parallel_writers);
+      this->writerPool->start();
+    }
+
     this->initialized = true;
   }
 
@@ -630,11 +1759,65 @@ std::shared_ptr<BackupFile> StreamBaseBackup::stackFile(std::string name) {
     throw CArchiveIssue("cannot create stream backup files: not initialized");
   }
 
+  bool is_tar = (name.length() > 4
+                 && name.compare(name.length() - 4, 4, ".tar") == 0);
+
+  if (this->deduplicate && is_tar) {
+
+    /*
+     * Tablespace archives go into the chunk store of the archive,
+     * the file itself just records how to put them together again.
+     */
+    if (this->chunkStore == nullptr)
+      this->chunkStore
+        = std::make_shared<DedupChunkStore>(DedupChunkStore::forArchive(path(this->descr->directory)));
+
+    this->file = std::make_shared<DedupArchiveFile>(this->directory->getPath()
+                                                    / (name + DedupArchiveFile::SUFFIX),
+                                                    this->chunkStore,
+                                                    this->compression,
+                                                    this->compression_level);
+
+  } else {
+
+    /*
+     * Allocate a new basebackup file. This will overwrite
+     * the last used file reference.
+     */
+    this->file = this->directory->basebackup(name, this->compression,
+                                             this->compression_level,
+                                             this->compression_workers);
+
+    /*
+     * Record the members of tablespace archives. This must be done
+     * below the writer pool, so that the wrapped file is asked for sync
+     * points by the writer owning it.
+     */
+    if (this->archiveIndex && is_tar) {
+      this->file = std::make_shared<IndexedArchiveFile>(this->file);
+    }
+
+  }
+
+  /*
+   * Bind the new file to the next archive writer, if requested.
+   */
+  if (this->writerPool != nullptr) {
+    this->file = std::make_shared<PipelinedArchiveFile>(this->file,
+                                                        this->writerPool,
+                                                        this->fileList.size()
+                                                        % this->writerPool->size());
+  }
+
   /*
-   * Allocate a new basebackup file. This will overwrite
-   * the last used file reference.
+   * Throttle writes within the caller, so a limited basebackup
+   * slows down the stream itself and not just the writers.
    */
-  this->file = this->directory->basebackup(name, this->compression);
+  if (this->rateLimiter != nullptr) {
+    this->file = std::make_shared<ThrottledArchiveFile>(this->file,
+                                                        this->rateLimiter);
+  }
+
   this->file->setOpenMode("wb");
   this->file->open();
 
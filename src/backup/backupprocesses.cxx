@@ -3,12 +3,16 @@
 #include <backupprocesses.hxx>
 #include <xlogdefs.hxx>
 #include <proto-buffer.hxx>
+#include <probes.hxx>
 #include <boost/log/trivial.hpp>
 
+#include <algorithm>
+#include <fstream>
 #include <stack>
 
 /* Required for select() */
 extern "C" {
+#include <sys/epoll.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -139,6 +143,12 @@ ArchiverState WALStreamerProcess::sendStatusUpdate() {
 
   ReceiverStatusUpdateMessage rsum(this->pgconn);
 
+  /*
+   * Sync pending WAL data if the sync policy of our backup handler
+   * wants to, so we report the most recent durable position.
+   */
+  this->syncBackupHandler(false);
+
 #ifdef __DEBUG_XLOG__
   BOOST_LOG_TRIVIAL(debug) << " ... sending status update to primary ";
   BOOST_LOG_TRIVIAL(debug) << "     -> write position: "
@@ -173,6 +183,206 @@ ArchiverState WALStreamerProcess::sendStatusUpdate() {
 
 }
 
+void WALStreamerProcess::syncBackupHandler(bool force) {
+
+  XLogRecPtr synced;
+
+  if (this->backupHandler == nullptr)
+    return;
+
+  /*
+   * The writer thread owns the backup handler while the
+   * pipeline is running, so let it do the sync. The flush
+   * position will be picked up once it's published.
+   */
+  if (this->pipeline != nullptr) {
+
+    this->pipeline->requestSync(force);
+    this->updatePipelinePositions();
+    return;
+
+  }
+
+  synced = this->backupHandler->sync(force);
+
+  if (synced != InvalidXLogRecPtr) {
+
+    this->streamident.flush_position = synced;
+    this->streamident.last_reported_flush_position = synced;
+
+  }
+
+}
+
+void WALStreamerProcess::refillSpareSegments() {
+
+  if (this->backupHandler == nullptr || this->pipeline != nullptr)
+    return;
+
+  this->backupHandler->preallocateSpareSegments();
+
+}
+
+void WALStreamerProcess::updatePipelinePositions() {
+
+  XLogRecPtr pos;
+
+  if (this->pipeline == nullptr)
+    return;
+
+  pos = this->pipeline->writtenPosition();
+
+  if (pos != InvalidXLogRecPtr)
+    this->streamident.write_position = pos;
+
+  pos = this->pipeline->flushedPosition();
+
+  if (pos != InvalidXLogRecPtr) {
+
+    this->streamident.flush_position = pos;
+    this->streamident.last_reported_flush_position = pos;
+
+  }
+
+}
+
+void WALStreamerProcess::stopPipeline() {
+
+  if (this->pipeline == nullptr)
+    return;
+
+  /*
+   * Make sure everything queued is written before we report
+   * the final positions. stop() rethrows errors from the writer.
+   */
+  try {
+
+    this->pipeline->stop();
+    this->updatePipelinePositions();
+
+  } catch(CPGBackupCtlFailure &e) {
+
+    this->pipeline = nullptr;
+    throw e;
+
+  }
+
+  this->pipeline = nullptr;
+
+}
+
+void WALStreamerProcess::setPipelineSlots(unsigned int slots) {
+
+  if (slots == 1) {
+    throw StreamingFailure("WAL writer pipeline requires at least 2 slots");
+  }
+
+  this->pipeline_slots = slots;
+
+}
+
+void WALStreamerProcess::setStatisticsSlot(std::shared_ptr<WorkerSHM> shm,
+                                           int slot,
+                                           std::string archive_name,
+                                           int archive_id) {
+
+  this->stats_shm  = shm;
+  this->stats_slot = slot;
+
+  this->stats.pid = ::getpid();
+  this->stats.archive_id = archive_id;
+  strncpy(this->stats.archive_name, archive_name.c_str(), SHM_ARCHIVE_NAME_LEN - 1);
+  this->stats.archive_name[SHM_ARCHIVE_NAME_LEN - 1] = '\0';
+
+}
+
+void WALStreamerProcess::publishStatistics(bool force) {
+
+  std::chrono::high_resolution_clock::time_point now;
+
+  if (this->stats_shm == nullptr || this->stats_slot < 0)
+    return;
+
+  now = CPGBackupCtlBase::current_hires_time_point();
+
+  if (!force
+      && CPGBackupCtlBase::calculate_duration_ms(this->last_stats_update, now)
+         < std::chrono::milliseconds(1000)) {
+    return;
+  }
+
+  this->stats.timeline        = this->streamident.timeline;
+  this->stats.last_update     = (int64_t) ::time(NULL);
+  this->stats.write_position  = this->streamident.write_position;
+  this->stats.flush_position  = this->streamident.flush_position;
+  this->stats.apply_position  = this->streamident.apply_position;
+  this->stats.server_position = this->streamident.server_position;
+
+  if (this->backupHandler != nullptr) {
+
+    WALWriteStatistics wstats = this->backupHandler->writeStatistics();
+
+    this->stats.bytes_written   = wstats.bytes_written;
+    this->stats.segments_synced = wstats.segments_synced;
+    this->stats.syncs           = wstats.syncs;
+    this->stats.sync_time_us    = wstats.sync_time_us;
+
+    for (unsigned int i = 0; i < WAL_SYNC_LATENCY_BUCKETS; i++)
+      this->stats.sync_latency[i] = wstats.sync_latency[i];
+
+  }
+
+  this->stats_shm->writeStreamStats(this->stats_slot, this->stats);
+  this->last_stats_update = now;
+
+}
+
+XLOGStreamMessage *WALStreamerProcess::messageFromBuffer(const char *buffer,
+                                                         int bufferlen) {
+
+  if (buffer == NULL || bufferlen <= 0)
+    return nullptr;
+
+  this->stats.bytes_received += bufferlen;
+
+  switch(buffer[0]) {
+  case 'w':
+    {
+      if (this->dataMessage == nullptr) {
+        this->dataMessage
+          = std::make_shared<XLOGDataStreamMessage>(this->pgconn,
+                                                    this->streamident.wal_segment_size);
+      }
+
+      this->dataMessage->assignBuffer(buffer, bufferlen);
+      return this->dataMessage.get();
+    }
+  case 'k':
+    {
+      if (this->feedbackMessage == nullptr) {
+        this->feedbackMessage
+          = std::make_shared<PrimaryFeedbackMessage>(this->pgconn,
+                                                     this->streamident.wal_segment_size);
+      }
+
+      this->feedbackMessage->assignBuffer(buffer, bufferlen);
+      return this->feedbackMessage.get();
+    }
+  default:
+    /* unknown message type, bail out hard. */
+    {
+      std::ostringstream oss;
+
+      oss << "unknown message type: " << buffer[0];
+      throw XLOGMessageFailure(oss.str());
+    }
+  }
+
+  /* normally not reached */
+  return nullptr;
+
+}
+
 ArchiverState WALStreamerProcess::handleReceive(char **buffer, int *bufferlen) {
 
   /* Holds length of incoming buffer data */
@@ -257,6 +467,9 @@ ArchiverState WALStreamerProcess::handleReceive(char **buffer, int *bufferlen) {
 
   }
 
+  if (*bufferlen > 0)
+    TRACE_PGBCKCTL_XLOG_RECEIVE(*bufferlen, (*buffer)[0]);
+
   return status;
 }
 
@@ -326,7 +539,23 @@ void WALStreamerProcess::handleMessage(XLOGStreamMessage *message) {
       this->streamident.write_position = datamsg->getXLOGServerPos();
       this->streamident.updateStartSegmentWriteOffset();
 
-      if (this->backupHandler != nullptr) {
+      if (this->pipeline != nullptr) {
+
+        /*
+         * Queue the XLOG data block to the writer thread, which
+         * does the same as the synchronous case below. Positions
+         * reported upstream are the ones published by the writer, so we
+         * never report XLOG data as written or flushed which is still
+         * in the ring.
+         */
+        this->streamident.flush_position = InvalidXLogRecPtr;
+        this->pipeline->push(datamsg->getXLOGStartPos(),
+                             this->streamident.timeline,
+                             datamsg->buffer(),
+                             datamsg->dataBufferSize());
+        this->updatePipelinePositions();
+
+      } else if (this->backupHandler != nullptr) {
 
         /*
          * Everything should be in shape so far. A current
@@ -430,12 +659,7 @@ void WALStreamerProcess::setReceiverStatusTimeout(long value) {
 
 }
 
-bool WALStreamerProcess::receive() {
-
-  bool can_continue = false;
-  char *buffer = NULL; /* temporary recv buffer, handled by libpq */
-  int bufferlen = 0;
-  ArchiverState reason;
+void WALStreamerProcess::beginReceive() {
 
   /*
    * If we're not in streaming state, handle the state
@@ -456,18 +680,74 @@ bool WALStreamerProcess::receive() {
 
   BOOST_LOG_TRIVIAL(info) << "entering WAL streaming receive() ";
 
+  /*
+   * Start the writer thread, if requested. It lives until we
+   * leave the receive loop below.
+   */
+  if (this->pipeline_slots > 0 && this->backupHandler != nullptr) {
+
+    this->pipeline = std::make_shared<WALWriterPipeline>(this->backupHandler,
+                                                         this->pipeline_slots);
+    this->pipeline->start();
+
+  }
+
   /*
    * Initialize status update start interval.
    */
   this->last_status_update = CPGBackupCtlBase::current_hires_time_point();
+  this->last_data_received = this->last_status_update;
+
+}
+
+bool WALStreamerProcess::stateEndsReceive(ArchiverState state) {
+
+  return (state == ARCHIVER_END_POSITION
+          || state == ARCHIVER_SHUTDOWN
+          || state == ARCHIVER_STREAMING_ERROR
+          || state == ARCHIVER_TIMELINE_SWITCH
+          || state == ARCHIVER_STARTUP
+          || state == ARCHIVER_START_POSITION);
+
+}
+
+void WALStreamerProcess::statusUpdateIfDue() {
+
+  this->publishStatistics(false);
+
+  /*
+   * We should send a status update message to upstream if our
+   * internal timeout value forces us to do.
+   *
+   * Since we also poll on the socket with a specific timeout, we
+   * also recognize this timeout value here.
+   */
+  if (CPGBackupCtlBase::calculate_duration_ms(this->last_status_update
+                                              - std::chrono::milliseconds(this->timeout),
+                                              CPGBackupCtlBase::current_hires_time_point())
+      >= std::chrono::milliseconds(this->receiver_status_timeout)) {
+
+#ifdef __DEBUG_XLOG__
+    BOOST_LOG_TRIVIAL(debug) << "standby status update overdue";
+#endif
+
+    this->sendStatusUpdate();
+    this->last_status_update = CPGBackupCtlBase::current_hires_time_point();
+
+  }
+
+}
+
+bool WALStreamerProcess::receive() {
+
+  char *buffer = NULL; /* temporary recv buffer, handled by libpq */
+  int bufferlen = 0;
+  ArchiverState reason;
+
+  this->beginReceive();
 
   this->current_state = reason = this->handleReceive(&buffer, &bufferlen);
-  while (reason != ARCHIVER_END_POSITION
-         && reason != ARCHIVER_SHUTDOWN
-         && reason != ARCHIVER_STREAMING_ERROR
-         && reason != ARCHIVER_TIMELINE_SWITCH
-         && reason != ARCHIVER_STARTUP
-         && reason != ARCHIVER_START_POSITION) {
+  while (!WALStreamerProcess::stateEndsReceive(reason)) {
 
     XLOGStreamMessage *message = nullptr;
 
@@ -483,31 +763,27 @@ bool WALStreamerProcess::receive() {
 
     /*
      * Next we check whether we should send a status update message
-     * to upstream. This is always the case if our internal
-     * timeout value forces us to do.
-     *
-     * Since we also poll on the socket with a specific timeout, we
-     * also recognize this timeout value here.
+     * to upstream.
      */
-    if (CPGBackupCtlBase::calculate_duration_ms(this->last_status_update
-                                                - std::chrono::milliseconds(this->timeout),
-                                                CPGBackupCtlBase::current_hires_time_point())
-        >= std::chrono::milliseconds(this->receiver_status_timeout)) {
-
-#ifdef __DEBUG_XLOG__
-      BOOST_LOG_TRIVIAL(debug) << "standby status update overdue";
-#endif
-
-      this->sendStatusUpdate();
-      this->last_status_update = CPGBackupCtlBase::current_hires_time_point();
-
-    }
+    this->statusUpdateIfDue();
 
     /*
      * If not streaming, don't try to handle XLOG messages.
      */
     if (reason != ARCHIVER_STREAMING) {
 
+      /*
+       * Nothing received within our poll timeout, so the
+       * stream is idle. Make any pending WAL data durable now.
+       * ARCHIVER_STREAMING_NO_DATA just means a CopyData message
+       * isn't complete yet, which happens all the time under load,
+       * so leave that to the sync policy.
+       */
+      if (reason == ARCHIVER_STREAMING_TIMEOUT) {
+        this->syncBackupHandler(true);
+        this->refillSpareSegments();
+      }
+
       /*
        * Before trying next, copy local buffer ...
        */
@@ -522,49 +798,55 @@ bool WALStreamerProcess::receive() {
     }
 
     /*
-     * Interpret buffer, create a corresponding WAL message object.
-     */
-    this->receiveBuffer.allocate(bufferlen);
-    this->receiveBuffer.write(buffer, bufferlen, 0);
-
-    /*
-     * Free copy buffers, they are copied over
-     * into our local receive buffer, so we don't
-     * need them anymore.
+     * Interpret buffer. The message references the XLOG data
+     * in the libpq buffer directly, so we must not free it before
+     * the message was handled.
      */
-    if (buffer != NULL) {
-      PQfreemem(buffer);
-      buffer = NULL;
-    }
+    try {
 
-    message = XLOGStreamMessage::message(this->pgconn,
-                                         this->receiveBuffer,
-                                         this->streamident.wal_segment_size);
+      message = this->messageFromBuffer(buffer, bufferlen);
 
 #ifdef __DEBUG_XLOG__
-    BOOST_LOG_TRIVIAL(debug) << "write XLOG message ";
+      BOOST_LOG_TRIVIAL(debug) << "write XLOG message ";
 #endif
 
-    try {
       if (message != nullptr) {
 
         this->handleMessage(message);
 
       }
     } catch(CPGBackupCtlFailure &e) {
-      if (message != nullptr)
-        delete message;
+      if (buffer != NULL)
+        PQfreemem(buffer);
 
       throw e;
     }
 
-    delete message;
+    if (buffer != NULL) {
+      PQfreemem(buffer);
+      buffer = NULL;
+    }
 
     /* ..next try */
     this->current_state = reason = this->handleReceive(&buffer, &bufferlen);
 
   }
 
+  return this->endReceive();
+
+}
+
+bool WALStreamerProcess::endReceive() {
+
+  bool can_continue = false;
+
+  /*
+   * Internal handleReceive() loop exited, write out everything
+   * still queued before handling timeline switches or shutdown.
+   */
+  this->stopPipeline();
+  this->publishStatistics(true);
+
   /*
    * Internal handleReceive() loop exited, check
    * further actions depending on current state.
@@ -643,80 +925,207 @@ bool WALStreamerProcess::receive() {
   return can_continue;
 }
 
-XLogRecPtr WALStreamerProcess::getCurrentXLOGPos() {
-  return this->streamident.write_position;
-}
-
-unsigned int WALStreamerProcess::getCurrentTimeline() {
-  return this->streamident.timeline;
-}
-
-void WALStreamerProcess::endOfStreamTimelineSwitch(PGresult *result,
-                                                   unsigned int& timeline,
-                                                   std::string& xlogpos) {
+ArchiverState WALStreamerProcess::receiveAvailable(unsigned int max_messages) {
 
-  if (this->current_state != ARCHIVER_TIMELINE_SWITCH) {
-    throw StreamingFailure("timeline switch requested on unsupported state in streaming connection");
-  }
+  unsigned int handled = 0;
 
-  if (result == NULL) {
-    throw StreamingFailure("could not get timeline switch data from streaming connection: result is undefined");
-  }
+  if (WALStreamerProcess::stateEndsReceive(this->current_state))
+    return this->current_state;
 
   /*
-   * Get timeline and xlogpos from the next timeline.
+   * Read everything the socket has to offer into libpq's
+   * input buffer.
    */
-  if (PQnfields(result) < 2
-      || PQntuples(result) != 1) {
-    std::ostringstream oss;
-    oss << "unexpected result after timeline switch: got "
-        << "columns " << PQnfields(result) << " expected " << 2 << ", "
-        << "tuples " << PQntuples(result) << "expected " << 1;
-    throw StreamingFailure(oss.str());
+  if (PQconsumeInput(this->pgconn) == 0) {
+    return (this->current_state = ARCHIVER_STREAMING_ERROR);
   }
 
-  /*
-   * Read timeline
-   */
-  timeline = CPGBackupCtlBase::strToInt(PQgetvalue(result, 0, 0));
-
-  /*
-   * The XLOG position returned by the result set is encoded. We just
-   * return the encoded position, the caller is responsible to encode it
-   * into a proper representation.
-   */
-  xlogpos = PQgetvalue(result, 0, 1);
+  while (true) {
 
-  /* and we're done */
+    char *buffer = NULL;
+    int bufferlen;
 
-}
+    if (this->stopHandlerWantsExit()) {
+      this->requestShutdown();
+      break;
+    }
 
-PGresult *WALStreamerProcess::handleEndOfStream() {
+    /*
+     * Don't starve other streams driven by our caller. Tell them
+     * there might be more data buffered already, so the caller
+     * needs to call us again without waiting for the socket.
+     */
+    if (max_messages > 0 && handled >= max_messages) {
+      this->current_state = ARCHIVER_STREAMING;
+      break;
+    }
 
-  PGresult *result = NULL;
+    bufferlen = PQgetCopyData(this->pgconn, &buffer, 1);
 
-  if (this->current_state != ARCHIVER_END_POSITION) {
-    throw CPGBackupCtlFailure("could not call handleEndOfStream() on unterminated WAL stream");
-  }
+    if (bufferlen == 0) {
+      this->current_state = ARCHIVER_STREAMING_NO_DATA;
+      break;
+    }
 
-  result = PQgetResult(this->pgconn);
+    if (bufferlen == -1) {
+      this->current_state = ARCHIVER_END_POSITION;
+      break;
+    }
 
-  /*
-   * Check whether we are still in COPY IN mode.
-   */
-  if (result != NULL && (PQresultStatus(result) == PGRES_COPY_IN)) {
+    if (bufferlen < -1) {
+      this->current_state = ARCHIVER_STREAMING_ERROR;
+      break;
+    }
 
-    PQclear(result);
+    this->current_state = ARCHIVER_STREAMING;
+    this->last_data_received = CPGBackupCtlBase::current_hires_time_point();
 
     /*
-     * Finalize the COPY IN mode on our side. Iff the server is
-     * still alive this will succeed.
-     *
-     * We need to ackknowledge this case in order to get the
-     * timeline switch, if any in progress.
-     *
-     * end() will set the internal Archiver state to ARCHIVER_SHUTDOWN
-     * in case of success, but we need to check if we really want
+     * Same as in receive(), the message references the
+     * libpq buffer, so release it after the message was handled.
+     */
+    try {
+
+      XLOGStreamMessage *message = this->messageFromBuffer(buffer, bufferlen);
+
+      if (message != nullptr) {
+        this->handleMessage(message);
+      }
+
+    } catch(CPGBackupCtlFailure &e) {
+      PQfreemem(buffer);
+      throw e;
+    }
+
+    PQfreemem(buffer);
+    handled++;
+
+    this->statusUpdateIfDue();
+
+    /* handleMessage() might have changed our state */
+    if (WALStreamerProcess::stateEndsReceive(this->current_state))
+      break;
+
+  }
+
+  return this->current_state;
+
+}
+
+ArchiverState WALStreamerProcess::idle() {
+
+  if (WALStreamerProcess::stateEndsReceive(this->current_state))
+    return this->current_state;
+
+  if (this->stopHandlerWantsExit()) {
+    this->requestShutdown();
+    return this->current_state;
+  }
+
+  this->statusUpdateIfDue();
+
+  /*
+   * Same as receive() does on poll timeouts, make pending WAL
+   * data durable if nothing arrived for a while.
+   */
+  if (CPGBackupCtlBase::calculate_duration_ms(this->last_data_received,
+                                              CPGBackupCtlBase::current_hires_time_point())
+      >= std::chrono::milliseconds(this->timeout)) {
+    this->syncBackupHandler(true);
+    this->refillSpareSegments();
+  }
+
+  return this->current_state;
+
+}
+
+void WALStreamerProcess::requestShutdown() {
+
+  this->current_state = ARCHIVER_SHUTDOWN;
+  this->streamident.status = StreamIdentification::STREAM_PROGRESS_SHUTDOWN;
+
+}
+
+int WALStreamerProcess::socket() {
+
+  return PQsocket(this->pgconn);
+
+}
+
+XLogRecPtr WALStreamerProcess::getCurrentXLOGPos() {
+  return this->streamident.write_position;
+}
+
+unsigned int WALStreamerProcess::getCurrentTimeline() {
+  return this->streamident.timeline;
+}
+
+void WALStreamerProcess::endOfStreamTimelineSwitch(PGresult *result,
+                                                   unsigned int& timeline,
+                                                   std::string& xlogpos) {
+
+  if (this->current_state != ARCHIVER_TIMELINE_SWITCH) {
+    throw StreamingFailure("timeline switch requested on unsupported state in streaming connection");
+  }
+
+  if (result == NULL) {
+    throw StreamingFailure("could not get timeline switch data from streaming connection: result is undefined");
+  }
+
+  /*
+   * Get timeline and xlogpos from the next timeline.
+   */
+  if (PQnfields(result) < 2
+      || PQntuples(result) != 1) {
+    std::ostringstream oss;
+    oss << "unexpected result after timeline switch: got "
+        << "columns " << PQnfields(result) << " expected " << 2 << ", "
+        << "tuples " << PQntuples(result) << "expected " << 1;
+    throw StreamingFailure(oss.str());
+  }
+
+  /*
+   * Read timeline
+   */
+  timeline = CPGBackupCtlBase::strToInt(PQgetvalue(result, 0, 0));
+
+  /*
+   * The XLOG position returned by the result set is encoded. We just
+   * return the encoded position, the caller is responsible to encode it
+   * into a proper representation.
+   */
+  xlogpos = PQgetvalue(result, 0, 1);
+
+  /* and we're done */
+
+}
+
+PGresult *WALStreamerProcess::handleEndOfStream() {
+
+  PGresult *result = NULL;
+
+  if (this->current_state != ARCHIVER_END_POSITION) {
+    throw CPGBackupCtlFailure("could not call handleEndOfStream() on unterminated WAL stream");
+  }
+
+  result = PQgetResult(this->pgconn);
+
+  /*
+   * Check whether we are still in COPY IN mode.
+   */
+  if (result != NULL && (PQresultStatus(result) == PGRES_COPY_IN)) {
+
+    PQclear(result);
+
+    /*
+     * Finalize the COPY IN mode on our side. Iff the server is
+     * still alive this will succeed.
+     *
+     * We need to ackknowledge this case in order to get the
+     * timeline switch, if any in progress.
+     *
+     * end() will set the internal Archiver state to ARCHIVER_SHUTDOWN
+     * in case of success, but we need to check if we really want
      * to have a shutdown or to continue. This is indicated by
      * a PGRES_TUPLES_OK or PGRES_COMMAND_OK return flag
      * by the returned PGresult object. Check that and set the
@@ -931,714 +1340,1385 @@ void WALStreamerProcess::start() {
 }
 
 /* ****************************************************************************
- * Implementation TablespaceQueue
+ * Implementation WALStreamMultiplexer
  ******************************************************************************/
 
-TablespaceQueue::TablespaceQueue(PGconn *conn) {
-
-  this->conn = conn;
-
-}
-
-BaseBackupState TablespaceQueue::getTablespaceInfo(BaseBackupState &state) {
+WALStreamMultiplexer::WALStreamMultiplexer() {}
 
-  PGresult *res;
-  int i;
-  ExecStatusType es;
+WALStreamMultiplexer::~WALStreamMultiplexer() {
 
-  /*
-   * Stack tablespace meta info only if
-   * successfully started.
-   */
-  if (state != BASEBACKUP_STARTED)
-    throw StreamingFailure("reading tablespace meta information requires a started base backup process");
+  if (this->epoll_fd >= 0) {
+    ::close(this->epoll_fd);
+  }
 
-  state = BASEBACKUP_TABLESPACE_META;
+}
 
-  /*
-   * Read tablespace meta info from result set.
-   */
-  res = PQgetResult(this->conn);
+void WALStreamMultiplexer::addStream(std::shared_ptr<MultiplexedWALStream> stream) {
 
-  if ((es = PQresultStatus(res)) != PGRES_TUPLES_OK) {
-    std::string sqlstate(PQresultErrorField(res, PG_DIAG_SQLSTATE));
-    std::ostringstream oss;
+  multiplexed_stream_entry entry;
 
-    oss << "could not read tablespace meta info: "
-        << PQresultErrorMessage(res);
-    PQclear(res);
-    throw StreamingExecutionFailure(oss.str(), es, sqlstate);
+  if (stream == nullptr) {
+    throw StreamingFailure("cannot add undefined stream to WAL stream multiplexer");
   }
 
-  if (PQntuples(res) < 1) {
-    PQclear(res);
-    throw StreamingFailure("unexpected number of tuples for tablespace meta info");
+  if (this->epoll_fd >= 0) {
+    throw StreamingFailure("cannot add streams to an active WAL stream multiplexer");
   }
 
-  if (PQnfields(res) != 3) {
-    std::ostringstream oss;
-    oss << "unexpected number of fields for tablespace meta info, expected 3, got "
-        << PQnfields(res);
-    PQclear(res);
-    throw StreamingFailure(oss.str());
-  }
+  entry.stream = stream;
+  this->entries.push_back(entry);
 
-  for (i = 0; i < PQntuples(res); i++) {
+}
 
-    std::shared_ptr<BackupTablespaceDescr> descr = std::make_shared<BackupTablespaceDescr>();
+void WALStreamMultiplexer::setMaxMessagesPerRound(unsigned int max_messages) {
 
-    /*
-     * Tablespace OID
-     */
-    descr->spcoid = CPGBackupCtlBase::strToUInt(std::string(PQgetvalue(res, i, 0)));
+  this->max_messages = max_messages;
 
-    /*
-     * Tablespace location (path, can be NULL in case of base directory)
-     */
-    if (!PQgetisnull(res, i, 1))
-      descr->spclocation = std::string(PQgetvalue(res, i, 1));
-    else
-      descr->spclocation = "";
+}
 
-    /*
-     * Tablespace size.
-     *
-     * Since we rely on PROGRESS in the BASE_BACKUP command, this is
-     * assumed to be never NULL!
-     */
-    descr->spcsize = CPGBackupCtlBase::strToInt(std::string(PQgetvalue(res, i, 2)));
+void WALStreamMultiplexer::setWakeupInterval(int wakeup_interval) {
 
-    /*
-     * Push the new tablespace descriptor at the end of our internal
-     * tablespace queue. Please note that the order of the tablespaces
-     * retrieved via BASE_BACKUP does matter, so we use a FIFO concept here.
-     */
-    tablespaces.push(descr);
+  if (wakeup_interval <= 0) {
+    throw StreamingFailure("wakeup interval of WAL stream multiplexer must be greater than 0");
   }
 
-  /*
-   * Free result set
-   */
-  PQclear(res);
-
-  /*
-   * okay, looks like all meta information is there...
-   */
-  state = BASEBACKUP_TABLESPACE_READY;
-  return state;
+  this->wakeup_interval = wakeup_interval;
 
 }
 
-/* ****************************************************************************
- * Implementation TablespaceStreamer
- ******************************************************************************/
-
-TablespaceStreamer::TablespaceStreamer(std::shared_ptr<StreamBaseBackup> backupHandle,
-                                       PGconn *conn)
-                                       : TablespaceQueue(conn) {
+unsigned int WALStreamMultiplexer::activeStreams() {
 
-  this->conn = conn;
-  this->backupHandle = backupHandle;
+  return this->active_streams;
 
 }
 
-BaseBackupState TablespaceStreamer::getState() {
+void WALStreamMultiplexer::startEntry(unsigned int index) {
 
-  return this->current_state;
+  multiplexed_stream_entry &entry = this->entries[index];
+  std::shared_ptr<WALStreamerProcess> walstreamer;
+  struct epoll_event ev;
 
-}
+  entry.stream->startStream();
 
-void TablespaceStreamer::manifest() {
+  walstreamer = entry.stream->walStreamer();
 
-  std::shared_ptr<BackupFile> manifest_file = nullptr;
-  bool interrupted = false;
-  char *copybuf = NULL;
-  PGresult *res;
-  int rc;
+  if (walstreamer == nullptr) {
+    std::ostringstream oss;
 
-  if (!backupHandle->isInitialized())
-    throw StreamingFailure("could not receive backup manifest");
+    oss << "stream \"" << entry.stream->streamName() << "\" has no WAL streamer";
+    throw StreamingFailure(oss.str());
+  }
 
-  if (current_state != BASEBACKUP_EOB)
-    throw StreamingFailure("unexpected state while retrieving backup manifest");
+  walstreamer->beginReceive();
 
-  /* Should have a valid result set with copy data */
-  res = PQgetResult(conn);
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = index;
 
-  if (PQresultStatus(res) != PGRES_COPY_OUT) {
+  if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, walstreamer->socket(), &ev) < 0) {
     std::ostringstream oss;
 
-    oss << "could not get COPY data for backup manifest: ";
-    oss << PQerrorMessage(conn);
-    PQclear(res);
+    oss << "could not watch socket of stream \""
+        << entry.stream->streamName() << "\": " << strerror(errno);
     throw StreamingFailure(oss.str());
-
   }
 
+  entry.active = true;
+  this->active_streams++;
+
   /*
-   * Make the manifest file handle.
-   *
-   * The contents of a manifest are plain, so we have to
-   * make sure we get the right compression type and reset
-   * it to the former one to not confuse our callers.
+   * libpq might have received data already during start(), so don't
+   * wait for the socket before reading the first time.
    */
-  BackupProfileCompressType former_compression = backupHandle->getCompression();
-  backupHandle->setCompression(BACKUP_COMPRESS_TYPE_NONE);
-  manifest_file = backupHandle->stackFile("backup_manifest");
-  backupHandle->setCompression(former_compression);
+  entry.ready = true;
 
-  while(true) {
+  BOOST_LOG_TRIVIAL(debug) << "DEBUG: multiplexing stream \"" << entry.stream->streamName() << "\"";
 
-    if (copybuf != NULL) {
-      PQfreemem(copybuf);
-      copybuf = NULL;
-    }
+}
 
-    rc = PQgetCopyData(conn, &copybuf, 0);
+void WALStreamMultiplexer::unwatch(unsigned int index) {
 
-    if (rc == -1) {
-      /* end of copy data */
-      break;
-    } else if (rc == -2) {
-      std::ostringstream oss;
+  multiplexed_stream_entry &entry = this->entries[index];
 
-      oss << "could not read manifest COPY data: ";
-      oss << PQerrorMessage(conn);
-      throw StreamingFailure(oss.str());
-
-    }
-
-    manifest_file->write(copybuf, rc);
-
-    /*
-     * Check if we are requested to stop.
-     *
-     * If true, we remember that we were interrupted.
-     */
-    if (this->stopHandlerWantsExit()) {
-      interrupted = true;
-      break;
-    }
-
-  }
+  if (!entry.active)
+    return;
 
   /*
-   * Receiving the manifest is the last action during base backups,
-   * mark the internal start to finish backup.
+   * The socket might be gone already if upstream closed the
+   * connection, so errors are ignored here.
    */
-  if (!interrupted)
-    current_state = BASEBACKUP_EOB;
-  else
-    current_state = BASEBACKUP_MANIFEST_INTERRUPTED;
+  if (entry.stream->walStreamer() != nullptr) {
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, entry.stream->walStreamer()->socket(), NULL);
+  }
+
+  entry.active = false;
+  entry.ready  = false;
+  this->active_streams--;
 
 }
 
-void TablespaceStreamer::tablespace(std::shared_ptr<BackupElemDescr> &descr) {
+void WALStreamMultiplexer::finishEntry(unsigned int index) {
 
-  char *copybuf = nullptr;
-  bool interrupted = false;
-  int rc;
+  multiplexed_stream_entry &entry = this->entries[index];
+  bool can_continue;
 
-  while(true) {
+  this->unwatch(index);
 
-    if (copybuf != nullptr) {
-      PQfreemem(copybuf);
-      copybuf = nullptr;
-    }
+  can_continue = entry.stream->walStreamer()->endReceive();
 
-    rc = PQgetCopyData(this->conn, &copybuf, 0);
+  if (entry.stream->streamEnded(can_continue)) {
 
-    if (rc == -1) {
-      /*
-       * End of COPY data stream.
-       *
-       * PostgreSQL sends a tar format stream as defined in
-       * POSIX 1003.1-2008 standard, but omits the last two trailing
-       * 512-bytes zero chunks.
-       */
-      char zerochunk[1024];
-      memset(zerochunk, 0, sizeof(zerochunk));
+    BOOST_LOG_TRIVIAL(info) << "restarting stream \"" << entry.stream->streamName() << "\"";
+    this->startEntry(index);
 
-      this->stepInfo.file->write(zerochunk, sizeof(zerochunk));
-      PQfreemem(copybuf);
-      break;
-    }
+  } else {
 
-    /*
-     * ... else write the chunk to the file.
-     *
-     * NOTE: We don't need to free the copy buffer here,
-     *       since we go through the next loop where PQfreemem()
-     *       will do this when necessary.
-     */
-    this->stepInfo.file->write(copybuf, rc);
+    BOOST_LOG_TRIVIAL(info) << "stream \"" << entry.stream->streamName() << "\" ended";
 
-    /*
-     * Check if we are requested to stop.
-     *
-     * If true, we remember that we were interrupted.
-     */
-    if (this->stopHandlerWantsExit()) {
-      interrupted = true;
-      break;
-    }
   }
 
-  /*
-   * Mark this tablespace as ready, but only in case we weren't
-   * interrupted.
-   */
-  if (!interrupted)
-    this->current_state = BASEBACKUP_STEP_TABLESPACE;
-  else
-    this->current_state = BASEBACKUP_STEP_TABLESPACE_INTERRUPTED;
-
 }
 
-bool TablespaceStreamer::next(std::shared_ptr<BackupElemDescr> &next) {
-
-  std::shared_ptr<BackupTablespaceDescr> descr = nullptr;
+void WALStreamMultiplexer::failEntry(unsigned int index, std::string errmsg) {
 
-  if (tablespaces.empty()) {
-    this->current_state = BASEBACKUP_EOB;
-    next = nullptr;
-    return false;
-  }
+  multiplexed_stream_entry &entry = this->entries[index];
 
-  /*
-   * backupHandle must be initialized.
-   */
-  if (!backupHandle->isInitialized())
-    throw StreamingFailure("cannot write into uninitialized streaming backup handle");
+  this->unwatch(index);
 
-  /*
-   * Check, if we are starting to step into a fresh
-   * tablespace backup. This is indicated by an internal
-   * state of -1 stored in the stepInfo struct property.
-   *
-   * In case of -1, we need to initialize the PGresult
-   * handle of the current stepping.
-   */
-  this->incr();
+  BOOST_LOG_TRIVIAL(error) << "stream \"" << entry.stream->streamName()
+                           << "\" failed: " << errmsg;
 
   /*
-   * Dequeue the current tablespace from the
-   * internal queue, if any.
+   * Try to write out everything still queued, but don't let
+   * another error here take the other streams down.
    */
-  this->stepInfo.descr = tablespaces.front();
-  tablespaces.pop();
-  this->stepInfo.handle = PQgetResult(this->conn);
-
-  if (PQresultStatus(this->stepInfo.handle) != PGRES_COPY_OUT) {
+  try {
 
-    std::ostringstream oss;
-    oss << "could not get COPY data stream: " << PQerrorMessage(this->conn);
-    throw StreamingFailure(oss.str());
+    if (entry.stream->walStreamer() != nullptr)
+      entry.stream->walStreamer()->stopPipeline();
 
+  } catch(CPGBackupCtlFailure &e) {
+    BOOST_LOG_TRIVIAL(error) << "could not stop WAL writer of stream \""
+                             << entry.stream->streamName() << "\": " << e.what();
   }
 
-  next = descr = this->stepInfo.descr;
-
-  /*
-   * Make the file access handle.
-   */
-  this->stepInfo.file = backupHandle->stackFile(CPGBackupCtlBase::intToStr(descr->spcoid)
-                                                + ".tar");
-
-  if (descr->spclocation == "")
-    this->current_state = BASEBACKUP_STEP_TABLESPACE_BASE;
-  else
-    this->current_state = BASEBACKUP_STEP_TABLESPACE;
-
-  return true;
-
-}
-
-/******************************************************************************
- * Implementation of TablespaceIterator
- ******************************************************************************/
-
-size_t TablespaceIterator::consumed() {
-  return _consumed;
-}
+  entry.stream->streamFailed(errmsg);
 
-void TablespaceIterator::setConsumed(size_t bytes_consumed) {
-  this->_consumed += bytes_consumed;
 }
 
-void TablespaceIterator::reset() {
-  stepInfo.reset();
-}
+void WALStreamMultiplexer::run() {
 
-void TablespaceIterator::incr() {
-  this->stepInfo.current_step++;
-}
+  std::vector<struct epoll_event> events;
 
-/******************************************************************************
- * Implementation of MessageStreamer
- ******************************************************************************/
+  if (this->epoll_fd >= 0) {
+    throw StreamingFailure("WAL stream multiplexer is already running");
+  }
 
-MessageStreamer::MessageStreamer(std::shared_ptr<StreamBaseBackup> sb,
-                                 PGconn *pgconn) : TablespaceQueue(pgconn) {
+  if (this->entries.size() == 0)
+    return;
 
-  backupHandle = sb;
-  conn = pgconn;
+  if ((this->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    std::ostringstream oss;
 
-}
+    oss << "could not create epoll instance: " << strerror(errno);
+    throw StreamingFailure(oss.str());
+  }
 
-void MessageStreamer::data(std::shared_ptr<BaseBackupMessage> &msg) {
+  events.resize(this->entries.size());
 
-  /*
-   * Protocol state must be either BASEBACKUP_TABLESPACE_STREAM or
-   * BASEBACKUP_MANIFEST_STREAM
-   */
-  if ( (current_state != BASEBACKUP_TABLESPACE_STREAM)
-       && (current_state != BASEBACKUP_MANIFEST_STREAM) ) {
+  for (unsigned int i = 0; i < this->entries.size(); i++) {
 
-    throw StreamingFailure("invalid basebackup streaming state");
+    try {
+      this->startEntry(i);
+    } catch(CPGBackupCtlFailure &e) {
+      this->failEntry(i, e.what());
+    }
 
   }
 
-  /*
-   * This message should contain data for either manifest
-   * or archive. We don't care here about its type at the moment, so
-   * just write out its contents
-   */
-  stepInfo.file->write(msg->data(), msg->dataSize());
-
-}
+  while (this->active_streams > 0) {
 
-void MessageStreamer::startCopyStream() {
+    bool have_ready = false;
+    int nevents;
 
-  PGresult *res = PQgetResult(conn);
+    for (auto &entry : this->entries) {
+      if (entry.active && entry.ready) {
+        have_ready = true;
+        break;
+      }
+    }
 
-  if (PQresultStatus(res) != PGRES_COPY_OUT) {
-    std::ostringstream errormsg;
+    /*
+     * Don't block if there are streams with buffered input left
+     * from the last round.
+     */
+    nevents = epoll_wait(this->epoll_fd, events.data(), events.size(),
+                         have_ready ? 0 : this->wakeup_interval);
 
-    errormsg << "not in COPY mode: " << PQerrorMessage(conn);
-    throw StreamingFailure(errormsg.str());
-  }
+    if (nevents < 0) {
 
-  PQclear(res);
+      if (errno != EINTR) {
+        std::ostringstream oss;
 
-}
+        oss << "error waiting for WAL streams: " << strerror(errno);
+        throw StreamingFailure(oss.str());
+      }
 
-bool MessageStreamer::next(std::shared_ptr<BackupElemDescr> &next) {
+      /* interrupted, check stop requests below */
+      nevents = 0;
 
-  bool result      = false;
+    }
 
-  int rc; /* return code for PQgetCopyData() */
+    for (int i = 0; i < nevents; i++) {
 
-  /**
-   * Entering streaming loop. We process the whole message according to
-   * its kind. If done, we handle the content and return a proper BackupElemDescr.
-   */
-  while (true) {
+      unsigned int index = events[i].data.u32;
 
-    std::shared_ptr<BaseBackupMessage> msg = nullptr;
-    char *copy_buffer                      = nullptr;
+      if (index < this->entries.size() && this->entries[index].active)
+        this->entries[index].ready = true;
 
-    if (stopHandlerWantsExit()) {
-      current_state = BASEBACKUP_STEP_TABLESPACE_INTERRUPTED;
-      result = false;
-      break;
     }
 
-    rc = PQgetCopyData(this->conn, &copy_buffer, 0);
-
     /*
-     * PQgetCopyData() either returns -1 in case COPY has finished. There is no 0
-     * return expected, since that would mean we're in async mode waiting for additional
-     * data/start of data stream, which we're effectively aren't. -2 indicates an error, so
-     * throw accordingly.
+     * Serve each stream once per round.
      */
+    for (unsigned int i = 0; i < this->entries.size(); i++) {
 
-    if (rc == -2) {
-      std::ostringstream errormsg;
+      multiplexed_stream_entry &entry = this->entries[i];
+      ArchiverState state;
 
-      errormsg << "error streaming basebackup: " << PQerrorMessage(conn);
-      throw StreamingFailure(errormsg.str());
-    }
+      if (!entry.active)
+        continue;
 
-    if (rc == -1) {
-      PQfreemem(copy_buffer);
+      try {
 
-      /* We're done here, nothing more expected */
-      current_state = BASEBACKUP_EOB;
-      result = false;
-      break;
-    }
+        std::shared_ptr<WALStreamerProcess> walstreamer = entry.stream->walStreamer();
 
-    /* Create a message object representing the current contents. Since this copies
-     * the content of the current receive buffer, we deallocate it afterwards. The msg reference
-     * will hold a copy. */
-    msg = BaseBackupMessage::message(copy_buffer, rc);
-    PQfreemem(copy_buffer);
+        if (entry.stream->stopRequested()) {
+          walstreamer->requestShutdown();
+        }
 
-    /*
-     * Depending on message type, prepare further actions or, if a data stream
-     * was received, save it to the already prepared output sink.
-     */
-    switch(msg->msgType()) {
+        if (entry.ready) {
 
-      case BBMSG_TYPE_PROGRESS:
-      {
+          state = walstreamer->receiveAvailable(this->max_messages);
+          entry.ready = (state == ARCHIVER_STREAMING);
 
-        /*
-         * A process update message. Update the consumed byte counter but don't
-         * exit here after processing that message. We get a next turn to try...
-         *
-         * Don't bother with the streaming state here either.
-         */
-        this->setConsumed(dynamic_pointer_cast<BaseBackupProgressMsg>(msg)->getProgressBytes());
-        continue;
+        } else {
 
-      }
+          state = walstreamer->idle();
 
-      case BBMSG_TYPE_DATA:
-      {
+        }
 
-        /*
-         * Update streaming status
-         */
-        current_state = BASEBACKUP_TABLESPACE_STREAM;
-        data(msg);
+        if (WALStreamerProcess::stateEndsReceive(state)) {
+          this->finishEntry(i);
+        }
 
-        continue;
+      } catch(CPGBackupCtlFailure &e) {
+        this->failEntry(i, e.what());
       }
 
-      case BBMSG_TYPE_ARCHIVE_START:
-      {
-        string archive_name = dynamic_pointer_cast<BaseBackupArchiveStartMsg>(msg)->getArchiveName();
+    }
 
-        current_state = BASEBACKUP_STEP_TABLESPACE;
+  }
+
+  ::close(this->epoll_fd);
+  this->epoll_fd = -1;
+
+}
+
+/* ****************************************************************************
+ * Implementation TablespaceQueue
+ ******************************************************************************/
+
+TablespaceQueue::TablespaceQueue(PGconn *conn) {
+
+  this->conn = conn;
+
+}
+
+unsigned int TablespaceQueue::getNumTablespaces() {
+  return this->num_tablespaces;
+}
+
+uint64_t TablespaceQueue::getEstimatedSize() {
+  return this->estimated_size;
+}
+
+BaseBackupState TablespaceQueue::getTablespaceInfo(BaseBackupState &state) {
+
+  PGresult *res;
+  int i;
+  ExecStatusType es;
+
+  /*
+   * Stack tablespace meta info only if
+   * successfully started.
+   */
+  if (state != BASEBACKUP_STARTED)
+    throw StreamingFailure("reading tablespace meta information requires a started base backup process");
+
+  state = BASEBACKUP_TABLESPACE_META;
+
+  /*
+   * Read tablespace meta info from result set.
+   */
+  res = PQgetResult(this->conn);
+
+  if ((es = PQresultStatus(res)) != PGRES_TUPLES_OK) {
+    std::string sqlstate(PQresultErrorField(res, PG_DIAG_SQLSTATE));
+    std::ostringstream oss;
+
+    oss << "could not read tablespace meta info: "
+        << PQresultErrorMessage(res);
+    PQclear(res);
+    throw StreamingExecutionFailure(oss.str(), es, sqlstate);
+  }
+
+  if (PQntuples(res) < 1) {
+    PQclear(res);
+    throw StreamingFailure("unexpected number of tuples for tablespace meta info");
+  }
+
+  if (PQnfields(res) != 3) {
+    std::ostringstream oss;
+    oss << "unexpected number of fields for tablespace meta info, expected 3, got "
+        << PQnfields(res);
+    PQclear(res);
+    throw StreamingFailure(oss.str());
+  }
+
+  for (i = 0; i < PQntuples(res); i++) {
+
+    std::shared_ptr<BackupTablespaceDescr> descr = std::make_shared<BackupTablespaceDescr>();
+
+    /*
+     * Tablespace OID
+     */
+    descr->spcoid = CPGBackupCtlBase::strToUInt(std::string(PQgetvalue(res, i, 0)));
+
+    /*
+     * Tablespace location (path, can be NULL in case of base directory)
+     */
+    if (!PQgetisnull(res, i, 1))
+      descr->spclocation = std::string(PQgetvalue(res, i, 1));
+    else
+      descr->spclocation = "";
+
+    /*
+     * Tablespace size.
+     *
+     * Since we rely on PROGRESS in the BASE_BACKUP command, this is
+     * assumed to be never NULL!
+     */
+    descr->spcsize = CPGBackupCtlBase::strToInt(std::string(PQgetvalue(res, i, 2)));
+
+    /*
+     * Push the new tablespace descriptor at the end of our internal
+     * tablespace queue. Please note that the order of the tablespaces
+     * retrieved via BASE_BACKUP does matter, so we use a FIFO concept here.
+     */
+    tablespaces.push(descr);
+
+    /* The server reports the size in kB */
+    this->num_tablespaces++;
+    this->estimated_size += (uint64_t) descr->spcsize * 1024;
+  }
+
+  /*
+   * Free result set
+   */
+  PQclear(res);
+
+  /*
+   * okay, looks like all meta information is there...
+   */
+  state = BASEBACKUP_TABLESPACE_READY;
+  return state;
+
+}
+
+/* ****************************************************************************
+ * Implementation TablespaceStreamer
+ ******************************************************************************/
+
+TablespaceStreamer::TablespaceStreamer(std::shared_ptr<StreamBaseBackup> backupHandle,
+                                       PGconn *conn)
+                                       : TablespaceQueue(conn) {
+
+  this->conn = conn;
+  this->backupHandle = backupHandle;
+
+}
+
+BaseBackupState TablespaceStreamer::getState() {
+
+  return this->current_state;
+
+}
+
+void TablespaceStreamer::manifest() {
+
+  std::shared_ptr<BackupFile> manifest_file = nullptr;
+  bool interrupted = false;
+  char *copybuf = NULL;
+  PGresult *res;
+  int rc;
+
+  if (!backupHandle->isInitialized())
+    throw StreamingFailure("could not receive backup manifest");
+
+  if (current_state != BASEBACKUP_EOB)
+    throw StreamingFailure("unexpected state while retrieving backup manifest");
+
+  /* Should have a valid result set with copy data */
+  res = PQgetResult(conn);
+
+  if (PQresultStatus(res) != PGRES_COPY_OUT) {
+    std::ostringstream oss;
+
+    oss << "could not get COPY data for backup manifest: ";
+    oss << PQerrorMessage(conn);
+    PQclear(res);
+    throw StreamingFailure(oss.str());
+
+  }
+
+  /*
+   * Make the manifest file handle.
+   *
+   * The contents of a manifest are plain, so we have to
+   * make sure we get the right compression type and reset
+   * it to the former one to not confuse our callers.
+   */
+  BackupProfileCompressType former_compression = backupHandle->getCompression();
+  backupHandle->setCompression(BACKUP_COMPRESS_TYPE_NONE);
+  manifest_file = backupHandle->stackFile("backup_manifest");
+  backupHandle->setCompression(former_compression);
+
+  while(true) {
+
+    if (copybuf != NULL) {
+      PQfreemem(copybuf);
+      copybuf = NULL;
+    }
+
+    rc = PQgetCopyData(conn, &copybuf, 0);
+
+    if (rc == -1) {
+      /* end of copy data */
+      break;
+    } else if (rc == -2) {
+      std::ostringstream oss;
+
+      oss << "could not read manifest COPY data: ";
+      oss << PQerrorMessage(conn);
+      throw StreamingFailure(oss.str());
+
+    }
+
+    manifest_file->write(copybuf, rc);
+
+    /*
+     * Check if we are requested to stop.
+     *
+     * If true, we remember that we were interrupted.
+     */
+    if (this->stopHandlerWantsExit()) {
+      interrupted = true;
+      break;
+    }
+
+  }
+
+  /*
+   * Receiving the manifest is the last action during base backups,
+   * mark the internal start to finish backup.
+   */
+  if (!interrupted)
+    current_state = BASEBACKUP_EOB;
+  else
+    current_state = BASEBACKUP_MANIFEST_INTERRUPTED;
+
+}
+
+void TablespaceStreamer::tablespace(std::shared_ptr<BackupElemDescr> &descr) {
+
+  char *copybuf = nullptr;
+  bool interrupted = false;
+  int rc;
+
+  while(true) {
+
+    if (copybuf != nullptr) {
+      PQfreemem(copybuf);
+      copybuf = nullptr;
+    }
+
+    rc = PQgetCopyData(this->conn, &copybuf, 0);
+
+    if (rc == -1) {
+      /*
+       * End of COPY data stream.
+       *
+       * PostgreSQL sends a tar format stream as defined in
+       * POSIX 1003.1-2008 standard, but omits the last two trailing
+       * 512-bytes zero chunks.
+       */
+      char zerochunk[1024];
+      memset(zerochunk, 0, sizeof(zerochunk));
+
+      this->stepInfo.file->write(zerochunk, sizeof(zerochunk));
+      PQfreemem(copybuf);
+      break;
+    }
+
+    /*
+     * ... else write the chunk to the file.
+     *
+     * NOTE: We don't need to free the copy buffer here,
+     *       since we go through the next loop where PQfreemem()
+     *       will do this when necessary.
+     */
+    this->stepInfo.file->write(copybuf, rc);
+
+    /*
+     * Check if we are requested to stop.
+     *
+     * If true, we remember that we were interrupted.
+     */
+    if (this->stopHandlerWantsExit()) {
+      interrupted = true;
+      break;
+    }
+  }
+
+  /*
+   * Mark this tablespace as ready, but only in case we weren't
+   * interrupted.
+   */
+  if (!interrupted)
+    this->current_state = BASEBACKUP_STEP_TABLESPACE;
+  else
+    this->current_state = BASEBACKUP_STEP_TABLESPACE_INTERRUPTED;
+
+}
+
+bool TablespaceStreamer::next(std::shared_ptr<BackupElemDescr> &next) {
+
+  std::shared_ptr<BackupTablespaceDescr> descr = nullptr;
+
+  if (tablespaces.empty()) {
+    this->current_state = BASEBACKUP_EOB;
+    next = nullptr;
+    return false;
+  }
+
+  /*
+   * backupHandle must be initialized.
+   */
+  if (!backupHandle->isInitialized())
+    throw StreamingFailure("cannot write into uninitialized streaming backup handle");
+
+  /*
+   * Check, if we are starting to step into a fresh
+   * tablespace backup. This is indicated by an internal
+   * state of -1 stored in the stepInfo struct property.
+   *
+   * In case of -1, we need to initialize the PGresult
+   * handle of the current stepping.
+   */
+  this->incr();
+
+  /*
+   * Dequeue the current tablespace from the
+   * internal queue, if any.
+   */
+  this->stepInfo.descr = tablespaces.front();
+  tablespaces.pop();
+  this->stepInfo.handle = PQgetResult(this->conn);
+
+  if (PQresultStatus(this->stepInfo.handle) != PGRES_COPY_OUT) {
+
+    std::ostringstream oss;
+    oss << "could not get COPY data stream: " << PQerrorMessage(this->conn);
+    throw StreamingFailure(oss.str());
+
+  }
+
+  next = descr = this->stepInfo.descr;
+
+  /*
+   * Make the file access handle.
+   */
+  this->stepInfo.file = backupHandle->stackFile(CPGBackupCtlBase::intToStr(descr->spcoid)
+                                                + ".tar");
+
+  if (descr->spclocation == "")
+    this->current_state = BASEBACKUP_STEP_TABLESPACE_BASE;
+  else
+    this->current_state = BASEBACKUP_STEP_TABLESPACE;
+
+  return true;
+
+}
+
+/******************************************************************************
+ * Implementation of TablespaceIterator
+ ******************************************************************************/
+
+size_t TablespaceIterator::consumed() {
+  return _consumed.load();
+}
+
+void TablespaceIterator::setConsumed(size_t bytes_consumed) {
+  this->_consumed.store(bytes_consumed);
+}
+
+void TablespaceIterator::reset() {
+  stepInfo.reset();
+}
+
+void TablespaceIterator::incr() {
+  this->stepInfo.current_step++;
+}
+
+/******************************************************************************
+ * Implementation of MessageStreamer
+ ******************************************************************************/
+
+MessageStreamer::MessageStreamer(std::shared_ptr<StreamBaseBackup> sb,
+                                 PGconn *pgconn) : TablespaceQueue(pgconn) {
+
+  backupHandle = sb;
+  conn = pgconn;
+
+}
+
+void MessageStreamer::data(std::shared_ptr<BaseBackupMessage> &msg) {
+
+  /*
+   * Protocol state must be either BASEBACKUP_TABLESPACE_STREAM or
+   * BASEBACKUP_MANIFEST_STREAM
+   */
+  if ( (current_state != BASEBACKUP_TABLESPACE_STREAM)
+       && (current_state != BASEBACKUP_MANIFEST_STREAM) ) {
+
+    throw StreamingFailure("invalid basebackup streaming state");
+
+  }
+
+  /*
+   * This message should contain data for either manifest
+   * or archive. We don't care here about its type at the moment, so
+   * just write out its contents
+   */
+  TRACE_PGBCKCTL_BASEBACKUP_DATA_START(msg->dataSize());
+  stepInfo.file->write(msg->data(), msg->dataSize());
+  TRACE_PGBCKCTL_BASEBACKUP_DATA_DONE(msg->dataSize());
+
+}
+
+void MessageStreamer::startCopyStream() {
+
+  PGresult *res = PQgetResult(conn);
+
+  if (PQresultStatus(res) != PGRES_COPY_OUT) {
+    std::ostringstream errormsg;
+
+    errormsg << "not in COPY mode: " << PQerrorMessage(conn);
+    throw StreamingFailure(errormsg.str());
+  }
+
+  PQclear(res);
+
+}
+
+bool MessageStreamer::next(std::shared_ptr<BackupElemDescr> &next) {
+
+  bool result      = false;
+
+  int rc; /* return code for PQgetCopyData() */
+
+  /**
+   * Entering streaming loop. We process the whole message according to
+   * its kind. If done, we handle the content and return a proper BackupElemDescr.
+   */
+  while (true) {
+
+    std::shared_ptr<BaseBackupMessage> msg = nullptr;
+    char *copy_buffer                      = nullptr;
+
+    if (stopHandlerWantsExit()) {
+      current_state = BASEBACKUP_STEP_TABLESPACE_INTERRUPTED;
+      result = false;
+      break;
+    }
+
+    rc = PQgetCopyData(this->conn, &copy_buffer, 0);
+
+    /*
+     * PQgetCopyData() either returns -1 in case COPY has finished. There is no 0
+     * return expected, since that would mean we're in async mode waiting for additional
+     * data/start of data stream, which we're effectively aren't. -2 indicates an error, so
+     * throw accordingly.
+     */
+
+    if (rc == -2) {
+      std::ostringstream errormsg;
+
+      errormsg << "error streaming basebackup: " << PQerrorMessage(conn);
+      throw StreamingFailure(errormsg.str());
+    }
+
+    if (rc == -1) {
+      PQfreemem(copy_buffer);
+
+      /* We're done here, nothing more expected */
+      current_state = BASEBACKUP_EOB;
+      result = false;
+      break;
+    }
+
+    /* Create a message object representing the current contents. Since this copies
+     * the content of the current receive buffer, we deallocate it afterwards. The msg reference
+     * will hold a copy. */
+    msg = BaseBackupMessage::message(copy_buffer, rc);
+    PQfreemem(copy_buffer);
+
+    /*
+     * Depending on message type, prepare further actions or, if a data stream
+     * was received, save it to the already prepared output sink.
+     */
+    switch(msg->msgType()) {
+
+      case BBMSG_TYPE_PROGRESS:
+      {
+
+        /*
+         * A process update message. Update the consumed byte counter but don't
+         * exit here after processing that message. We get a next turn to try...
+         *
+         * Don't bother with the streaming state here either.
+         */
+        this->setConsumed(dynamic_pointer_cast<BaseBackupProgressMsg>(msg)->getProgressBytes());
+        continue;
+
+      }
+
+      case BBMSG_TYPE_DATA:
+      {
+
+        /*
+         * Update streaming status
+         */
+        current_state = BASEBACKUP_TABLESPACE_STREAM;
+        data(msg);
+
+        continue;
+      }
+
+      case BBMSG_TYPE_ARCHIVE_START:
+      {
+        string archive_name = dynamic_pointer_cast<BaseBackupArchiveStartMsg>(msg)->getArchiveName();
+
+        current_state = BASEBACKUP_STEP_TABLESPACE;
 
         BOOST_LOG_TRIVIAL(debug) << "processing archive " << archive_name;
 
-        /*
-         * If there is already a handle, finalize it.
-         */
-        if (stepInfo.file != nullptr) {
+        /*
+         * If there is already a handle, finalize it.
+         */
+        if (stepInfo.file != nullptr) {
+
+          stepInfo.file->fsync();
+          stepInfo.file->close();
+          stepInfo.reset();
+
+        }
+
+        /*
+         * We are starting to step into a fresh
+         * tablespace archive.
+         */
+        this->incr();
+
+        /*
+         * Prepare next descriptor
+         */
+        this->stepInfo.descr = tablespaces.front();
+        tablespaces.pop();
+
+
+        /* not required here, since we are in a COPY stream, still */
+        stepInfo.handle = nullptr;
+
+        /*
+         * Save this new descr handle. This is returned after having received the
+         * data messages for this specific archive.
+         */
+        next = stepInfo.descr;
+
+        /*
+         * Iterator and all other things are properly setup, stack the
+         * next file for streaming data.
+         */
+        stepInfo.file = backupHandle->stackFile(archive_name);
+
+        /*
+         * After having BBMSG_TYPE_ARCHIVE_START received, the next expected
+         * message is an BBSMSG_TYPE_DATA. At this point we return to the caller the current
+         * tablespace handle and tell him to proceed.
+         */
+        result = true;
+        break;
+
+      }
+      case BBMSG_TYPE_MANIFEST_START:
+      {
+        string archive_name = "backup.manifest";
+
+        BOOST_LOG_TRIVIAL(debug) << "processing backup manifest";
+
+        /*
+         * NOTE:
+         * There is no need to handle the iterator here, since we just need it to make
+         * sure we have all tablespaces consumed. Also we don't want to have
+         * the manifest data being compressed, so we need to take care that the backup
+         * stream target prepares a proper handle for us.
+         */
+        current_state = BASEBACKUP_MANIFEST_STREAM;
+
+        /* Save compression used for the archive data */
+        BackupProfileCompressType former_compression = backupHandle->getCompression();
+
+        /* Get a new uncompressed handle for manifest data */
+        backupHandle->setCompression(BACKUP_COMPRESS_TYPE_NONE);
+        stepInfo.file = backupHandle->stackFile(archive_name);
+
+        /* Make sure we set compression level back, whatever it was before */
+        backupHandle->setCompression(former_compression);
+
+        continue;
+
+      }
+      case BBMSG_TYPE_UNKNOWN:
+        throw StreamingFailure("cannot process unknown message type in basebackup stream");
+
+    }
+
+  }
+
+  return result;
+}
+
+/******************************************************************************
+ * Implementation of BaseBackupStream
+ ******************************************************************************/
+
+BaseBackupStream::BaseBackupStream(PGconn *prepared_con,
+                                   std::shared_ptr<StreamBaseBackup> sb,
+                                   std::shared_ptr<BackupProfileDescr> profileDescr) {
+
+  if (sb == nullptr) {
+    throw StreamingFailure("cannot use basebackup stream with undefined basebackup stream target");
+  }
+
+  if (profileDescr == nullptr) {
+    throw StreamingFailure("cannot use basebackup stream with undefined profile");
+  }
+
+  pgconn = prepared_con;
+  backupHandle = sb;
+  profile      = profileDescr;
+
+}
+
+void BaseBackupStream::getStartPosition(std::shared_ptr<BaseBackupDescr> &descr,
+                                        BaseBackupState &current_state) {
+
+  /* Initial state for reading tablespace info from result set */
+  PGresult *result   = nullptr;
+  ExecStatusType es;
+
+  current_state = BASEBACKUP_START_POSITION;
+  result = PQgetResult(this->pgconn);
+
+  /* Error checking */
+  if ((es = PQresultStatus(result)) != PGRES_TUPLES_OK) {
+    std::string sqlstate(PQresultErrorField(result, PG_DIAG_SQLSTATE));
+    std::ostringstream oss;
+
+    oss << "basebackup streaming failed: " << PQresultErrorMessage(result);
+    PQclear(result);
+    throw StreamingExecutionFailure(oss.str(), es, sqlstate);
+  }
+
+  if (PQntuples(result) != 1) {
+    std::ostringstream oss;
+    oss << "unexpected result for BASE_BACKUP command, expected(rows/fields) 1/2"
+        << " but got " << PQntuples(result) << "/" << PQnfields(result);
+    PQclear(result);
+    throw StreamingFailure(oss.str());
+  }
+
+  /* Initialize basebackup descriptor */
+  if (descr == nullptr) {
+    descr = std::make_shared<BaseBackupDescr>();
+  }
+
+  /*
+   * First result set is the starting position of
+   * the basebackup stream, with two columns:
+   * 1 - XLogRecPtr
+   * 2 - TimelineID
+   *
+   * This is also the time we record the start time and
+   * other properties into our internal basebackup descriptor.
+   */
+  descr->xlogpos = PQgetvalue(result, 0, 0);
 
-          stepInfo.file->fsync();
-          stepInfo.file->close();
-          stepInfo.reset();
+  /*
+   * We always expect the timeline from the server here. Older
+   * PostgreSQL instances than 9.3 don't send the timeline via
+   * the BASE_BACKUP result set, but those aren't supported anyways.
+   */
+  descr->timeline = CPGBackupCtlBase::strToInt(std::string(PQgetvalue(result, 0, 1)));
+  PQclear(result);
 
-        }
+  current_state = BASEBACKUP_STARTED;
 
-        /*
-         * We are starting to step into a fresh
-         * tablespace archive.
-         */
-        this->incr();
+}
 
-        /*
-         * Prepare next descriptor
-         */
-        this->stepInfo.descr = tablespaces.front();
-        tablespaces.pop();
+std::shared_ptr<BaseBackupStream>
+BaseBackupStream::makeStreamInstance(PGconn *prepared_conn,
+                                     std::shared_ptr<StreamBaseBackup> backupHandle,
+                                     std::shared_ptr<BackupProfileDescr> profileDescr) {
 
+  if (PQserverVersion(prepared_conn) < 130000) {
+    return std::make_shared<BaseBackupStream12>(prepared_conn, backupHandle, profileDescr);
+  } else if ((PQserverVersion(prepared_conn) >= 130000)
+      && (PQserverVersion(prepared_conn) < 150000)) {
+    return std::make_shared<BaseBackupStream14>(prepared_conn, backupHandle, profileDescr);
+  } else if ((PQserverVersion(prepared_conn) >= 150000)
+      && (PQserverVersion(prepared_conn) < 170000)) {
+    return std::make_shared<BaseBackupStream15>(prepared_conn, backupHandle, profileDescr);
+  } else if (PQserverVersion(prepared_conn) >= 170000) {
+    return std::make_shared<BaseBackupStream17>(prepared_conn, backupHandle, profileDescr);
+  } else {
+    std::ostringstream oss;
 
-        /* not required here, since we are in a COPY stream, still */
-        stepInfo.handle = nullptr;
+    oss << "unsupported PostgreSQL version "
+        << PQserverVersion(prepared_conn);
+    throw StreamingFailure(oss.str());
+  }
 
-        /*
-         * Save this new descr handle. This is returned after having received the
-         * data messages for this specific archive.
-         */
-        next = stepInfo.descr;
+}
 
-        /*
-         * Iterator and all other things are properly setup, stack the
-         * next file for streaming data.
-         */
-        stepInfo.file = backupHandle->stackFile(archive_name);
+void BaseBackupStream::setParentManifest(std::string const& manifest) {
 
-        /*
-         * After having BBMSG_TYPE_ARCHIVE_START received, the next expected
-         * message is an BBSMSG_TYPE_DATA. At this point we return to the caller the current
-         * tablespace handle and tell him to proceed.
-         */
-        result = true;
-        break;
+  std::ostringstream oss;
+
+  oss << "incremental basebackups require PostgreSQL 17 or above, server version is "
+      << PQserverVersion(this->pgconn);
+  throw StreamingFailure(oss.str());
+
+}
+
+void BaseBackupStream::uploadManifest() {
+
+  /* Full basebackups only, nothing to do */
+
+}
+
+/******************************************************************************
+ * Implementation of BaseBackupStream12
+ ******************************************************************************/
+
+BaseBackupStream12::BaseBackupStream12(PGconn *prepared_conn,
+                                       std::shared_ptr<StreamBaseBackup> backupHandle,
+                                       std::shared_ptr<BackupProfileDescr> profileDescr)
+        : BaseBackupStream(prepared_conn, backupHandle, profileDescr),
+          TablespaceStreamer(backupHandle, prepared_conn) {}
+
+BaseBackupStream12::~BaseBackupStream12() = default;
+
+BaseBackupState BaseBackupStream12::getTablespaceInfo(pgbckctl::BaseBackupState &state) {
+
+  return TablespaceQueue::getTablespaceInfo(state);
+
+}
+
+unsigned int BaseBackupStream12::numTablespaces() {
+  return TablespaceQueue::getNumTablespaces();
+}
+
+uint64_t BaseBackupStream12::estimatedSize() {
+  return TablespaceQueue::getEstimatedSize();
+}
+
+std::string BaseBackupStream12::query(std::shared_ptr<BackupProfileDescr> profile,
+                                      PGconn *prepared_conn,
+                                      BaseBackupQueryType type) {
+
+  std::ostringstream query;
+  char escapedlabel[MAXPGPATH];
+  int  escape_error;
+
+  switch(type) {
+    case BASEBACKUP_QUERY_TYPE_BASEBACKUP:
+    {
+
+      /* We need a profile in this case */
+      if (profile == nullptr) {
+        throw StreamingFailure("backup profile required for BASEBACKUP_QUERY_TYPE_BASEBACKUP");
+      }
+
+      /*
+       * Sanity check: profile is not a nullptr.
+       */
+      query << "BASE_BACKUP";
+
+      if (this->profile == nullptr)
+        throw StreamingFailure("backup profile not initialized for streaming basebackup");
+
+      /*
+       * Special LABEL requested?
+       */
+      if (this->profile->label != "") {
+        PQescapeStringConn(this->pgconn,
+                           escapedlabel,
+                           this->profile->label.c_str(),
+                           this->profile->label.length(),
+                           &escape_error);
+        query << " LABEL '" << escapedlabel << "'";
+      }
+
+      /*
+       * We always request PROGRESS
+       */
+      query << " PROGRESS ";
+
+      /*
+       * immediate CHECKPOINT requested?
+       */
+      if (this->profile->fast_checkpoint)
+        query << " FAST ";
+
+      /*
+       * WAL stream request for base backup?
+       */
+      if (this->profile->include_wal)
+        query << " WAL ";
+
+      /*
+       * We usually wait for WAL segments to be archived.
+       */
+      if (!this->profile->wait_for_wal)
+        query << " NOWAIT ";
+
+      /*
+       * MAX_RATE limits the used bandwidth of the stream.
+       * Check if this is requested. With adaptive rate control,
+       * the rate is enforced by ourselves instead.
+       */
+      if (this->profile->max_rate > 0 && !this->profile->adaptive_rate)
+        query << " MAX_RATE " << this->profile->max_rate;
+
+      /*
+       * Starting with PostgreSQL 11, we have the NOVERFIY_CHECKSUMS
+       * available.
+       */
+      if ( (this->profile->noverify_checksums)
+           && (PQserverVersion(this->pgconn) >= 110000) )
+        query << " NOVERIFY_CHECKSUMS ";
+
+      /*
+       * Backup manifests are supported starting with PostgreSQL 13 only.
+       * We don't throw an error here, since backup profiles are interchangeable, so
+       * give the caller just a hint via logging.
+       */
+      if (this->profile->manifest) {
+        BOOST_LOG_TRIVIAL(warning) << "manifests are support with PostgreSQL >= 13, ignoring";
+      }
+
+      /*
+       * We always request the tablespace map from the stream.
+       */
+      query << " TABLESPACE_MAP;";
+
+      break;
+    }
+    default:
+    {
+      throw StreamingFailure("unknown basebackup command type");
+    }
+  }
+
+  return query.str();
+
+}
+
+std::shared_ptr<BackupElemDescr>
+BaseBackupStream12::handleMessage(BaseBackupState &current_state) {
+
+  std::shared_ptr<BackupElemDescr> elem = nullptr;
+
+  if (current_state != BASEBACKUP_STEP_TABLESPACE) {
+    throw StreamingFailure("could not stream list of tablespaces");
+  }
+
+  /* There is nothing else to expect here than a tablespace archive.
+   * So just call next() until we have reached the end of stream. */
+  if (next(elem)) {
+
+    /* Check whether we are forced to abort */
+    if (current_state == BASEBACKUP_STEP_TABLESPACE_INTERRUPTED) {
+      throw StreamingFailure("streaming tablespace archive aborted");
+    }
+
+    current_state = BASEBACKUP_TABLESPACE_STREAM;
+
+    /*
+     * Store tablespace archive data
+     * There can't be anything else as a BackupTablespaceDescr carried
+     * by the backup element descriptor.
+     */
+
+    if (elem->getType() != BASEBACKUP_ELEM_TBLSPC) {
+      throw StreamingFailure("unexpected backup element from stream");
+    }
+
+    /* consume tablespace data from stream */
+    tablespace(elem);
+
+    current_state = BASEBACKUP_STEP_TABLESPACE;
+
+  } else {
+    current_state = BASEBACKUP_EOB;
+  }
+
+  return elem;
+
+}
+
+/******************************************************************************
+ * Implementation of BaseBackupStream14
+ ******************************************************************************/
+
+BaseBackupStream14::BaseBackupStream14(PGconn *prepared_conn,
+                                       std::shared_ptr<StreamBaseBackup> backupHandle,
+                                       std::shared_ptr<BackupProfileDescr> profileDescr)
+  : BaseBackupStream(prepared_conn, backupHandle, profileDescr),
+    TablespaceStreamer(backupHandle, prepared_conn) {}
+
+BaseBackupStream14::~BaseBackupStream14() noexcept {}
 
-      }
-      case BBMSG_TYPE_MANIFEST_START:
-      {
-        string archive_name = "backup.manifest";
+BaseBackupState BaseBackupStream14::getTablespaceInfo(pgbckctl::BaseBackupState &state) {
 
-        BOOST_LOG_TRIVIAL(debug) << "processing backup manifest";
+  return TablespaceQueue::getTablespaceInfo(state);
 
-        /*
-         * NOTE:
-         * There is no need to handle the iterator here, since we just need it to make
-         * sure we have all tablespaces consumed. Also we don't want to have
-         * the manifest data being compressed, so we need to take care that the backup
-         * stream target prepares a proper handle for us.
-         */
-        current_state = BASEBACKUP_MANIFEST_STREAM;
+}
 
-        /* Save compression used for the archive data */
-        BackupProfileCompressType former_compression = backupHandle->getCompression();
+unsigned int BaseBackupStream14::numTablespaces() {
+  return TablespaceQueue::getNumTablespaces();
+}
 
-        /* Get a new uncompressed handle for manifest data */
-        stepInfo.file = backupHandle->stackFile(archive_name);
+uint64_t BaseBackupStream14::estimatedSize() {
+  return TablespaceQueue::getEstimatedSize();
+}
 
-        /* Make sure we set compression level back, whatever it was before */
-        backupHandle->setCompression(former_compression);
+std::string BaseBackupStream14::query(std::shared_ptr<BackupProfileDescr> profile,
+                                      PGconn *prepared_conn, pgbckctl::BaseBackupQueryType type) {
 
-        continue;
+  std::ostringstream query;
+  char escapedlabel[MAXPGPATH];
+  int  escape_error;
+
+  switch(type) {
 
+    case BASEBACKUP_QUERY_TYPE_BASEBACKUP:
+    {
+
+      /* We need a profile in this case */
+      if (profile == nullptr) {
+        throw StreamingFailure("backup profile required for BASEBACKUP_QUERY_TYPE_BASEBACKUP");
       }
-      case BBMSG_TYPE_UNKNOWN:
-        throw StreamingFailure("cannot process unknown message type in basebackup stream");
 
-    }
+      query << "BASE_BACKUP";
 
-  }
+      if (this->profile == nullptr)
+        throw StreamingFailure("backup profile not initialized for streaming basebackup");
 
-  return result;
-}
+      /*
+       * Special LABEL requested?
+       */
+      if (this->profile->label != "") {
+        PQescapeStringConn(this->pgconn,
+                           escapedlabel,
+                           this->profile->label.c_str(),
+                           this->profile->label.length(),
+                           &escape_error);
+        query << " LABEL '" << escapedlabel << "'";
+      }
 
-/******************************************************************************
- * Implementation of BaseBackupStream
- ******************************************************************************/
+      /*
+       * We always request PROGRESS
+       */
+      query << " PROGRESS ";
 
-BaseBackupStream::BaseBackupStream(PGconn *prepared_con,
-                                   std::shared_ptr<StreamBaseBackup> sb,
-                                   std::shared_ptr<BackupProfileDescr> profileDescr) {
+      /*
+       * immediate CHECKPOINT requested?
+       */
+      if (this->profile->fast_checkpoint)
+        query << " FAST ";
 
-  if (sb == nullptr) {
-    throw StreamingFailure("cannot use basebackup stream with undefined basebackup stream target");
-  }
+      /*
+       * WAL stream request for base backup?
+       */
+      if (this->profile->include_wal)
+        query << " WAL ";
 
-  if (profileDescr == nullptr) {
-    throw StreamingFailure("cannot use basebackup stream with undefined profile");
-  }
+      /*
+       * We usually wait for WAL segments to be archived.
+       */
+      if (!this->profile->wait_for_wal)
+        query << " NOWAIT ";
 
-  pgconn = prepared_con;
-  backupHandle = sb;
-  profile      = profileDescr;
+      /*
+       * MAX_RATE limits the used bandwidth of the stream.
+       * Check if this is requested. With adaptive rate control,
+       * the rate is enforced by ourselves instead.
+       */
+      if (this->profile->max_rate > 0 && !this->profile->adaptive_rate)
+        query << " MAX_RATE " << this->profile->max_rate;
 
-}
+      /*
+       * Starting with PostgreSQL 11, we have the NOVERFIY_CHECKSUMS
+       * available.
+       */
+      if ( (this->profile->noverify_checksums)
+           && (PQserverVersion(this->pgconn) >= 110000) )
+        query << " NOVERIFY_CHECKSUMS ";
 
-void BaseBackupStream::getStartPosition(std::shared_ptr<BaseBackupDescr> &descr,
-                                        BaseBackupState &current_state) {
+      /*
+       * PostgreSQL 13 introduces backup manifests, check
+       * if the profile requested that feature and make sure
+       * we have a server version >= 13.
+       */
+      if ( (this->profile->manifest)
+           && (PQserverVersion(this->pgconn) >= 130000) ) {
 
-  /* Initial state for reading tablespace info from result set */
-  PGresult *result   = nullptr;
-  ExecStatusType es;
+        query << " MANIFEST 'yes' ";
+        query << " MANIFEST_CHECKSUMS "
+              << "'" << this->profile->manifest_checksums << "'";
 
-  current_state = BASEBACKUP_START_POSITION;
-  result = PQgetResult(this->pgconn);
+      }
 
-  /* Error checking */
-  if ((es = PQresultStatus(result)) != PGRES_TUPLES_OK) {
-    std::string sqlstate(PQresultErrorField(result, PG_DIAG_SQLSTATE));
-    std::ostringstream oss;
+      /*
+       * We always request the tablespace map from the stream.
+       */
+      query << " TABLESPACE_MAP;";
 
-    oss << "basebackup streaming failed: " << PQresultErrorMessage(result);
-    PQclear(result);
-    throw StreamingExecutionFailure(oss.str(), es, sqlstate);
-  }
+      break;
+    }
 
-  if (PQntuples(result) != 1) {
-    std::ostringstream oss;
-    oss << "unexpected result for BASE_BACKUP command, expected(rows/fields) 1/2"
-        << " but got " << PQntuples(result) << "/" << PQnfields(result);
-    PQclear(result);
-    throw StreamingFailure(oss.str());
-  }
+    default:
+    {
+      throw StreamingFailure("unknown basebackup command type");
+    }
 
-  /* Initialize basebackup descriptor */
-  if (descr == nullptr) {
-    descr = std::make_shared<BaseBackupDescr>();
   }
 
-  /*
-   * First result set is the starting position of
-   * the basebackup stream, with two columns:
-   * 1 - XLogRecPtr
-   * 2 - TimelineID
-   *
-   * This is also the time we record the start time and
-   * other properties into our internal basebackup descriptor.
-   */
-  descr->xlogpos = PQgetvalue(result, 0, 0);
+  return query.str();
 
-  /*
-   * We always expect the timeline from the server here. Older
-   * PostgreSQL instances than 9.3 don't send the timeline via
-   * the BASE_BACKUP result set, but those aren't supported anyways.
-   */
-  descr->timeline = CPGBackupCtlBase::strToInt(std::string(PQgetvalue(result, 0, 1)));
-  PQclear(result);
+}
 
-  current_state = BASEBACKUP_STARTED;
+std::shared_ptr<BackupElemDescr>
+BaseBackupStream14::handleMessage(BaseBackupState &current_state) {
 
-}
+  std::shared_ptr<BackupElemDescr> result = nullptr;
 
-std::shared_ptr<BaseBackupStream>
-BaseBackupStream::makeStreamInstance(PGconn *prepared_conn,
-                                     std::shared_ptr<StreamBaseBackup> backupHandle,
-                                     std::shared_ptr<BackupProfileDescr> profileDescr) {
+  if (current_state != BASEBACKUP_STEP_TABLESPACE) {
+    throw StreamingFailure("could not stream list of tablespaces");
+  }
+
+  /* Check when we reach the end of the tablespace archive stream. If a manifest
+   * is requested, return that instead of terminating the stream. Manifest streams after
+   * the very last tablespace, so if a manifest ist requested we expect after next() has
+   * done its job. */
+  if (next(result)) {
+
+    /* Get tablespace archive data */
+    tablespace(result);
 
-  if (PQserverVersion(prepared_conn) < 130000) {
-    return std::make_shared<BaseBackupStream12>(prepared_conn, backupHandle, profileDescr);
-  } else if ((PQserverVersion(prepared_conn) >= 130000)
-      && (PQserverVersion(prepared_conn) < 150000)) {
-    return std::make_shared<BaseBackupStream14>(prepared_conn, backupHandle, profileDescr);
-  } else if (PQserverVersion(prepared_conn) >= 150000) {
-    return std::make_shared<BaseBackupStream15>(prepared_conn, backupHandle, profileDescr);
   } else {
-    std::ostringstream oss;
 
-    oss << "unsupported PostgreSQL version "
-        << PQserverVersion(prepared_conn);
-    throw StreamingFailure(oss.str());
+    if (profile->manifest) {
+      manifest();
+      result = std::make_shared<BackupManifestDescr>();
+    }
+
   }
 
+  /* Return proper state to the caller */
+  current_state = this->getState();
+  return result;
+
 }
 
 /******************************************************************************
- * Implementation of BaseBackupStream12
+ * Implementation of BaseBackupStream15
  ******************************************************************************/
 
-BaseBackupStream12::BaseBackupStream12(PGconn *prepared_conn,
+BaseBackupStream15::BaseBackupStream15(PGconn *prepared_conn,
                                        std::shared_ptr<StreamBaseBackup> backupHandle,
                                        std::shared_ptr<BackupProfileDescr> profileDescr)
         : BaseBackupStream(prepared_conn, backupHandle, profileDescr),
-          TablespaceStreamer(backupHandle, prepared_conn) {}
+          MessageStreamer(backupHandle, prepared_conn){}
 
-BaseBackupStream12::~BaseBackupStream12() = default;
+BaseBackupStream15::~BaseBackupStream15() noexcept {}
 
-BaseBackupState BaseBackupStream12::getTablespaceInfo(pgbckctl::BaseBackupState &state) {
+BaseBackupState BaseBackupStream15::getTablespaceInfo(pgbckctl::BaseBackupState &state) {
 
-  return TablespaceQueue::getTablespaceInfo(state);
+  state = TablespaceQueue::getTablespaceInfo(state);
+
+  /*
+   * When arriving here we either already have processed archive or manifest
+   * start message.
+   */
+  startCopyStream();
+  return state;
 
 }
 
-std::string BaseBackupStream12::query(std::shared_ptr<BackupProfileDescr> profile,
-                                      PGconn *prepared_conn,
-                                      BaseBackupQueryType type) {
+unsigned int BaseBackupStream15::numTablespaces() {
+  return TablespaceQueue::getNumTablespaces();
+}
+
+uint64_t BaseBackupStream15::estimatedSize() {
+  return TablespaceQueue::getEstimatedSize();
+}
+
+uint64_t BaseBackupStream15::reportedProgress() {
+  return MessageStreamer::consumed();
+}
+
+std::string BaseBackupStream15::query(std::shared_ptr<BackupProfileDescr> profile,
+                                      PGconn *prepared_conn, pgbckctl::BaseBackupQueryType type) {
 
   std::ostringstream query;
   char escapedlabel[MAXPGPATH];
   int  escape_error;
+  std::stack<string> options;
 
-  switch(type) {
-    case BASEBACKUP_QUERY_TYPE_BASEBACKUP:
-    {
-
-      /* We need a profile in this case */
-      if (profile == nullptr) {
-        throw StreamingFailure("backup profile required for BASEBACKUP_QUERY_TYPE_BASEBACKUP");
-      }
+  /* We need a profile in this case */
+  if (profile == nullptr) {
+    throw StreamingFailure("backup profile required for BASEBACKUP_QUERY_TYPE_BASEBACKUP");
+  }
 
-      /*
-       * Sanity check: profile is not a nullptr.
-       */
-      query << "BASE_BACKUP";
+  switch(type) {
+    case BASEBACKUP_QUERY_TYPE_BASEBACKUP:
+    {
+      query << "BASE_BACKUP (";
 
       if (this->profile == nullptr)
         throw StreamingFailure("backup profile not initialized for streaming basebackup");
@@ -1652,67 +2732,129 @@ std::string BaseBackupStream12::query(std::shared_ptr<BackupProfileDescr> profil
                            this->profile->label.c_str(),
                            this->profile->label.length(),
                            &escape_error);
-        query << " LABEL '" << escapedlabel << "'";
+        options.push("LABEL " + string("'") + string(escapedlabel) + string("'"));
       }
 
       /*
        * We always request PROGRESS
        */
-      query << " PROGRESS ";
+      options.push("PROGRESS on");
 
       /*
        * immediate CHECKPOINT requested?
        */
       if (this->profile->fast_checkpoint)
-        query << " FAST ";
+        options.push("CHECKPOINT fast");
 
       /*
        * WAL stream request for base backup?
        */
       if (this->profile->include_wal)
-        query << " WAL ";
+        options.push(" WAL on");
 
       /*
        * We usually wait for WAL segments to be archived.
        */
       if (!this->profile->wait_for_wal)
-        query << " NOWAIT ";
+        options.push("WAIT off");
 
       /*
        * MAX_RATE limits the used bandwidth of the stream.
-       * Check if this is requested...
+       * Check if this is requested. With adaptive rate control,
+       * the rate is enforced by ourselves instead.
        */
-      if (this->profile->max_rate > 0)
-        query << " MAX_RATE " << this->profile->max_rate;
+      if (this->profile->max_rate > 0 && !this->profile->adaptive_rate) {
+        std::ostringstream conv;
+        conv << "MAX_RATE " << this->profile->max_rate;
+        options.push(conv.str());
+      }
+
 
       /*
        * Starting with PostgreSQL 11, we have the NOVERFIY_CHECKSUMS
        * available.
        */
-      if ( (this->profile->noverify_checksums)
-           && (PQserverVersion(this->pgconn) >= 110000) )
-        query << " NOVERIFY_CHECKSUMS ";
+      if (this->profile->noverify_checksums)
+        options.push("VERIFY_CHECKSUMS off");
 
       /*
-       * Backup manifests are supported starting with PostgreSQL 13 only.
-       * We don't throw an error here, since backup profiles are interchangeable, so
-       * give the caller just a hint via logging.
+       * PostgreSQL 13 introduces backup manifests, check
+       * if the profile requested that feature and make sure
+       * we have a server version >= 13.
        */
       if (this->profile->manifest) {
-        BOOST_LOG_TRIVIAL(warning) << "manifests are support with PostgreSQL >= 13, ignoring";
+
+        std::ostringstream oss;
+
+        oss << " MANIFEST on, ";
+        oss << " MANIFEST_CHECKSUMS "
+            << "'" << this->profile->manifest_checksums << "'";
+        options.push(oss.str());
+
+      }
+
+      /*
+       * Server-side compression requested? The tablespace archives
+       * are then sent compressed and stored as received, the server
+       * appends the matching file suffix to the archive names
+       * itself.
+       */
+      if (this->profile->server_compression) {
+
+        std::ostringstream oss;
+        std::ostringstream detail;
+
+        switch(this->profile->compress_type) {
+        case BACKUP_COMPRESS_TYPE_GZIP:
+          oss << "COMPRESSION 'gzip'";
+          break;
+        case BACKUP_COMPRESS_TYPE_LZ4:
+          oss << "COMPRESSION 'lz4'";
+          break;
+        case BACKUP_COMPRESS_TYPE_ZSTD:
+          oss << "COMPRESSION 'zstd'";
+          break;
+        default:
+          throw StreamingFailure("server-side compression requires GZIP, LZ4 or ZSTD");
+        }
+
+        if (this->profile->compress_level > 0)
+          detail << "level=" << this->profile->compress_level;
+
+        if (this->profile->compress_workers > 0)
+          detail << ((detail.tellp() > 0) ? "," : "")
+                 << "workers=" << this->profile->compress_workers;
+
+        if (detail.tellp() > 0)
+          oss << ", COMPRESSION_DETAIL '" << detail.str() << "'";
+
+        options.push(oss.str());
+
       }
 
       /*
        * We always request the tablespace map from the stream.
        */
-      query << " TABLESPACE_MAP;";
+      options.push("TABLESPACE_MAP on");
+
+      /* Make the list of options */
+      while (!options.empty()) {
+        query << " " << options.top();
+        options.pop();
+        query << (!options.empty() ? "," : "");
+      }
+
+      /* Close the options list */
+      query << ")";
 
       break;
     }
+
     default:
     {
       throw StreamingFailure("unknown basebackup command type");
     }
+
   }
 
   return query.str();
@@ -1720,374 +2862,470 @@ std::string BaseBackupStream12::query(std::shared_ptr<BackupProfileDescr> profil
 }
 
 std::shared_ptr<BackupElemDescr>
-BaseBackupStream12::handleMessage(BaseBackupState &current_state) {
+BaseBackupStream15::handleMessage(BaseBackupState &current_state) {
 
-  std::shared_ptr<BackupElemDescr> elem = nullptr;
+  std::shared_ptr<BackupElemDescr> result = nullptr;
 
+  /* Check for correct state */
   if (current_state != BASEBACKUP_STEP_TABLESPACE) {
-    throw StreamingFailure("could not stream list of tablespaces");
+    throw StreamingFailure("invalid protocol handler state");
   }
 
-  /* There is nothing else to expect here than a tablespace archive.
-   * So just call next() until we have reached the end of stream. */
-  if (next(elem)) {
+  /*
+   * We are in COPY mode now and need to dispatch the specific CopyOutResponse payloads.
+   * The first message bytes indicate the kind of message.
+   */
+  if (next(result)) {
 
-    /* Check whether we are forced to abort */
+    /* Checkt if we are interrupted by signal handler */
     if (current_state == BASEBACKUP_STEP_TABLESPACE_INTERRUPTED) {
       throw StreamingFailure("streaming tablespace archive aborted");
     }
 
-    current_state = BASEBACKUP_TABLESPACE_STREAM;
+  } else {
+    current_state = BASEBACKUP_EOB;
+  }
+
+  return result;
+
+}
+
+/******************************************************************************
+ * Implementation of BaseBackupStream17
+ ******************************************************************************/
+
+BaseBackupStream17::BaseBackupStream17(PGconn *prepared_conn,
+                                       std::shared_ptr<StreamBaseBackup> backupHandle,
+                                       std::shared_ptr<BackupProfileDescr> profileDescr)
+        : BaseBackupStream15(prepared_conn, backupHandle, profileDescr) {}
+
+BaseBackupStream17::~BaseBackupStream17() noexcept {}
+
+void BaseBackupStream17::setParentManifest(std::string const& manifest) {
+
+  this->parent_manifest = manifest;
+
+}
+
+void BaseBackupStream17::uploadManifest() {
+
+  PGresult *res = nullptr;
+  std::ifstream manifest;
+  std::vector<char> buffer(64 * 1024);
+
+  /* Full basebackup requested, nothing to upload */
+  if (this->parent_manifest.empty())
+    return;
+
+  manifest.open(this->parent_manifest, std::ios::in | std::ios::binary);
+
+  if (!manifest.is_open()) {
+    std::ostringstream oss;
+
+    oss << "could not open parent backup manifest \""
+        << this->parent_manifest << "\"";
+    throw StreamingFailure(oss.str());
+  }
+
+  BOOST_LOG_TRIVIAL(debug) << "uploading parent manifest " << this->parent_manifest;
+
+  /*
+   * UPLOAD_MANIFEST switches the connection into COPY IN mode,
+   * the manifest is sent as COPY data afterwards.
+   */
+  res = PQexec(this->pgconn, "UPLOAD_MANIFEST");
+
+  if (PQresultStatus(res) != PGRES_COPY_IN) {
+    std::ostringstream oss;
+
+    oss << "UPLOAD_MANIFEST command failed: " << PQerrorMessage(this->pgconn);
+    PQclear(res);
+    throw StreamingFailure(oss.str());
+  }
+
+  PQclear(res);
+
+  while (!manifest.eof()) {
+
+    std::streamsize len;
 
     /*
-     * Store tablespace archive data
-     * There can't be anything else as a BackupTablespaceDescr carried
-     * by the backup element descriptor.
+     * Abort the upload if requested, the server discards
+     * the manifest in this case.
      */
+    if (BaseBackupStream::stopHandlerWantsExit()) {
+      PQputCopyEnd(this->pgconn, "manifest upload interrupted");
+      PQclear(PQgetResult(this->pgconn));
+      throw StreamingFailure("manifest upload interrupted");
+    }
 
-    if (elem->getType() != BASEBACKUP_ELEM_TBLSPC) {
-      throw StreamingFailure("unexpected backup element from stream");
+    manifest.read(buffer.data(), buffer.size());
+    len = manifest.gcount();
+
+    if (manifest.bad()) {
+      std::ostringstream oss;
+
+      oss << "could not read parent backup manifest \""
+          << this->parent_manifest << "\"";
+
+      PQputCopyEnd(this->pgconn, oss.str().c_str());
+      PQclear(PQgetResult(this->pgconn));
+      throw StreamingFailure(oss.str());
     }
 
-    /* consume tablespace data from stream */
-    tablespace(elem);
+    if (len <= 0)
+      continue;
 
-    current_state = BASEBACKUP_STEP_TABLESPACE;
+    if (PQputCopyData(this->pgconn, buffer.data(), (int) len) != 1) {
+      std::ostringstream oss;
+
+      oss << "could not send backup manifest: " << PQerrorMessage(this->pgconn);
+      throw StreamingFailure(oss.str());
+    }
 
-  } else {
-    current_state = BASEBACKUP_EOB;
   }
 
-  return elem;
+  if (PQputCopyEnd(this->pgconn, NULL) != 1) {
+    std::ostringstream oss;
+
+    oss << "could not finish backup manifest upload: " << PQerrorMessage(this->pgconn);
+    throw StreamingFailure(oss.str());
+  }
+
+  /*
+   * The server verifies the manifest when the COPY has finished
+   * and reports any error in the command result.
+   */
+  while ((res = PQgetResult(this->pgconn)) != NULL) {
+
+    ExecStatusType es = PQresultStatus(res);
+
+    if ((es != PGRES_COMMAND_OK) && (es != PGRES_TUPLES_OK)) {
+      const char *sqlstate_field = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+      std::string sqlstate = (sqlstate_field != NULL) ? sqlstate_field : "XX000";
+      std::ostringstream oss;
+
+      oss << "parent backup manifest rejected: " << PQresultErrorMessage(res);
+      PQclear(res);
+      throw StreamingExecutionFailure(oss.str(), es, sqlstate);
+    }
+
+    PQclear(res);
+  }
+
+}
+
+std::string BaseBackupStream17::query(std::shared_ptr<BackupProfileDescr> profile,
+                                      PGconn *prepared_conn,
+                                      pgbckctl::BaseBackupQueryType type) {
+
+  std::string query = BaseBackupStream15::query(profile, prepared_conn, type);
+
+  /*
+   * Request an incremental basebackup, if a parent manifest was
+   * uploaded before. The option list generated by BaseBackupStream15
+   * always ends with the closing parenthesis.
+   */
+  if ( (type == BASEBACKUP_QUERY_TYPE_BASEBACKUP)
+       && (!this->parent_manifest.empty()) ) {
+    query.insert(query.rfind(')'), ", INCREMENTAL");
+  }
+
+  return query;
 
 }
 
 /******************************************************************************
- * Implementation of BaseBackupStream14
+ * Implementation of BaseBackupRateControl
  ******************************************************************************/
 
-BaseBackupStream14::BaseBackupStream14(PGconn *prepared_conn,
-                                       std::shared_ptr<StreamBaseBackup> backupHandle,
-                                       std::shared_ptr<BackupProfileDescr> profileDescr)
-  : BaseBackupStream(prepared_conn, backupHandle, profileDescr),
-    TablespaceStreamer(backupHandle, prepared_conn) {}
+BaseBackupRateControl::BaseBackupRateControl(std::shared_ptr<ArchiveRateLimiter> limiter,
+                                             std::shared_ptr<WorkerSHM> shm,
+                                             uint64_t ceiling,
+                                             uint64_t min_rate,
+                                             uint64_t lag_threshold) {
 
-BaseBackupStream14::~BaseBackupStream14() noexcept {}
+  if (limiter == nullptr)
+    throw StreamingFailure("basebackup rate control requires a rate limiter");
 
-BaseBackupState BaseBackupStream14::getTablespaceInfo(pgbckctl::BaseBackupState &state) {
+  this->limiter = limiter;
+  this->shm = shm;
+  this->ceiling = ceiling;
+  this->min_rate = min_rate;
+  this->lag_threshold = lag_threshold;
 
-  return TablespaceQueue::getTablespaceInfo(state);
+  this->limiter->setRate(this->ceiling);
 
 }
 
-std::string BaseBackupStream14::query(std::shared_ptr<BackupProfileDescr> profile,
-                                      PGconn *prepared_conn, pgbckctl::BaseBackupQueryType type) {
+BaseBackupRateControl::~BaseBackupRateControl() {
 
-  std::ostringstream query;
-  char escapedlabel[MAXPGPATH];
-  int  escape_error;
+  this->stop();
 
-  switch(type) {
+}
 
-    case BASEBACKUP_QUERY_TYPE_BASEBACKUP:
-    {
+uint64_t BaseBackupRateControl::maxWalLag() {
 
-      /* We need a profile in this case */
-      if (profile == nullptr) {
-        throw StreamingFailure("backup profile required for BASEBACKUP_QUERY_TYPE_BASEBACKUP");
-      }
+  uint64_t result = 0;
+  int64_t now = (int64_t) time(NULL);
 
-      query << "BASE_BACKUP";
+  for (unsigned int i = 0; i < this->shm->getMaxWorkers(); i++) {
 
-      if (this->profile == nullptr)
-        throw StreamingFailure("backup profile not initialized for streaming basebackup");
+    shm_stream_stats stats;
 
-      /*
-       * Special LABEL requested?
-       */
-      if (this->profile->label != "") {
-        PQescapeStringConn(this->pgconn,
-                           escapedlabel,
-                           this->profile->label.c_str(),
-                           this->profile->label.length(),
-                           &escape_error);
-        query << " LABEL '" << escapedlabel << "'";
-      }
+    if (this->shm->isEmpty(i))
+      continue;
 
-      /*
-       * We always request PROGRESS
-       */
-      query << " PROGRESS ";
+    stats = this->shm->readStreamStats(i);
 
-      /*
-       * immediate CHECKPOINT requested?
-       */
-      if (this->profile->fast_checkpoint)
-        query << " FAST ";
+    /*
+     * Ignore slots without published statistics and streams
+     * which didn't report for a while, their lag isn't meaningful.
+     */
+    if (stats.pid <= 0 || (now - stats.last_update) > 30)
+      continue;
 
-      /*
-       * WAL stream request for base backup?
-       */
-      if (this->profile->include_wal)
-        query << " WAL ";
+    if (stats.server_position > stats.flush_position)
+      result = std::max(result, stats.server_position - stats.flush_position);
 
-      /*
-       * We usually wait for WAL segments to be archived.
-       */
-      if (!this->profile->wait_for_wal)
-        query << " NOWAIT ";
+  }
 
-      /*
-       * MAX_RATE limits the used bandwidth of the stream.
-       * Check if this is requested...
-       */
-      if (this->profile->max_rate > 0)
-        query << " MAX_RATE " << this->profile->max_rate;
+  return result;
 
-      /*
-       * Starting with PostgreSQL 11, we have the NOVERFIY_CHECKSUMS
-       * available.
-       */
-      if ( (this->profile->noverify_checksums)
-           && (PQserverVersion(this->pgconn) >= 110000) )
-        query << " NOVERIFY_CHECKSUMS ";
+}
 
-      /*
-       * PostgreSQL 13 introduces backup manifests, check
-       * if the profile requested that feature and make sure
-       * we have a server version >= 13.
-       */
-      if ( (this->profile->manifest)
-           && (PQserverVersion(this->pgconn) >= 130000) ) {
+void BaseBackupRateControl::adjust(uint64_t throughput) {
+
+  uint64_t lag = this->maxWalLag();
+  uint64_t current = this->limiter->getRate();
+
+  if (lag > this->lag_threshold) {
 
-        query << " MANIFEST 'yes' ";
-        query << " MANIFEST_CHECKSUMS "
-              << "'" << this->profile->manifest_checksums << "'";
+    uint64_t base = current;
 
-      }
+    if (!this->backing_off) {
 
       /*
-       * We always request the tablespace map from the stream.
+       * An unlimited basebackup has no rate to start from, use
+       * what it achieved during the last second instead.
        */
-      query << " TABLESPACE_MAP;";
+      this->recover_rate = (this->ceiling > 0) ? this->ceiling
+        : std::max(throughput, this->min_rate);
+      this->backing_off = true;
+      base = this->recover_rate;
+
+      BOOST_LOG_TRIVIAL(info) << "WAL stream lag of " << (lag / 1024) << " KB exceeds threshold, "
+                              << "throttling basebackup";
 
-      break;
     }
 
-    default:
-    {
-      throw StreamingFailure("unknown basebackup command type");
+    this->limiter->setRate(std::max(this->min_rate, base / 2));
+
+  } else if (this->backing_off) {
+
+    uint64_t next = current + std::max(this->min_rate, this->recover_rate / 10);
+
+    if (next >= this->recover_rate) {
+
+      this->limiter->setRate(this->ceiling);
+      this->backing_off = false;
+
+      BOOST_LOG_TRIVIAL(info) << "WAL streams caught up, basebackup no longer throttled";
+
+    } else {
+
+      this->limiter->setRate(next);
+
     }
 
   }
 
-  return query.str();
+#ifdef __DEBUG__
+  BOOST_LOG_TRIVIAL(debug) << "DEBUG: basebackup throughput " << throughput
+                           << " bytes/s, WAL lag " << lag
+                           << " bytes, rate " << this->limiter->getRate() << " bytes/s";
+#endif
 
 }
 
-std::shared_ptr<BackupElemDescr>
-BaseBackupStream14::handleMessage(BaseBackupState &current_state) {
+void BaseBackupRateControl::run() {
 
-  std::shared_ptr<BackupElemDescr> result = nullptr;
+  std::unique_lock<std::mutex> lock(this->mtx);
+  uint64_t last_consumed = this->limiter->consumed();
 
-  if (current_state != BASEBACKUP_STEP_TABLESPACE) {
-    throw StreamingFailure("could not stream list of tablespaces");
-  }
+  while (!this->shutdown) {
 
-  /* Check when we reach the end of the tablespace archive stream. If a manifest
-   * is requested, return that instead of terminating the stream. Manifest streams after
-   * the very last tablespace, so if a manifest ist requested we expect after next() has
-   * done its job. */
-  if (next(result)) {
+    uint64_t consumed;
 
-    /* Get tablespace archive data */
-    tablespace(result);
+    this->cv.wait_for(lock, std::chrono::seconds(1),
+                      [this] { return this->shutdown; });
 
-  } else {
+    if (this->shutdown)
+      break;
 
-    if (profile->manifest) {
-      manifest();
-      result = std::make_shared<BackupManifestDescr>();
+    consumed = this->limiter->consumed();
+
+    lock.unlock();
+
+    try {
+      this->adjust(consumed - last_consumed);
+    } catch(std::exception &e) {
+      /* a failing rate control must not abort the basebackup */
+      BOOST_LOG_TRIVIAL(warning) << "WARNING: basebackup rate control: " << e.what();
     }
 
+    lock.lock();
+    last_consumed = consumed;
+
   }
 
-  /* Return proper state to the caller */
-  current_state = this->getState();
-  return result;
+}
+
+void BaseBackupRateControl::start() {
+
+  /* Nothing to adapt, the limiter keeps the ceiling rate */
+  if (this->shm == nullptr || this->lag_threshold == 0)
+    return;
+
+  if (this->monitor.joinable())
+    throw StreamingFailure("basebackup rate control already started");
+
+  this->shutdown = false;
+  this->monitor = std::thread(&BaseBackupRateControl::run, this);
+
+}
+
+void BaseBackupRateControl::stop() {
+
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->shutdown = true;
+  }
+
+  this->cv.notify_all();
+
+  if (this->monitor.joinable())
+    this->monitor.join();
 
 }
 
 /******************************************************************************
- * Implementation of BaseBackupStream15
+ * Implementation of BaseBackupProgressPublisher
  ******************************************************************************/
 
-BaseBackupStream15::BaseBackupStream15(PGconn *prepared_conn,
-                                       std::shared_ptr<StreamBaseBackup> backupHandle,
-                                       std::shared_ptr<BackupProfileDescr> profileDescr)
-        : BaseBackupStream(prepared_conn, backupHandle, profileDescr),
-          MessageStreamer(backupHandle, prepared_conn){}
-
-BaseBackupStream15::~BaseBackupStream15() noexcept {}
+BaseBackupProgressPublisher::BaseBackupProgressPublisher(std::shared_ptr<WorkerSHM> shm,
+                                                         unsigned int slot,
+                                                         std::shared_ptr<ArchiveRateLimiter> limiter,
+                                                         std::string archive_name,
+                                                         int archive_id) {
 
-BaseBackupState BaseBackupStream15::getTablespaceInfo(pgbckctl::BaseBackupState &state) {
+  if (shm == nullptr || limiter == nullptr)
+    throw StreamingFailure("basebackup progress requires worker shared memory and a rate limiter");
 
-  state = TablespaceQueue::getTablespaceInfo(state);
+  this->shm = shm;
+  this->slot = slot;
+  this->limiter = limiter;
 
-  /*
-   * When arriving here we either already have processed archive or manifest
-   * start message.
-   */
-  startCopyStream();
-  return state;
+  this->progress.pid = ::getpid();
+  this->progress.archive_id = archive_id;
+  strncpy(this->progress.archive_name, archive_name.c_str(), SHM_ARCHIVE_NAME_LEN - 1);
+  this->progress.archive_name[SHM_ARCHIVE_NAME_LEN - 1] = '\0';
+  this->progress.started = (int64_t) ::time(NULL);
 
 }
 
-std::string BaseBackupStream15::query(std::shared_ptr<BackupProfileDescr> profile,
-                                      PGconn *prepared_conn, pgbckctl::BaseBackupQueryType type) {
+BaseBackupProgressPublisher::~BaseBackupProgressPublisher() {
 
-  std::ostringstream query;
-  char escapedlabel[MAXPGPATH];
-  int  escape_error;
-  std::stack<string> options;
+  this->stop();
 
-  /* We need a profile in this case */
-  if (profile == nullptr) {
-    throw StreamingFailure("backup profile required for BASEBACKUP_QUERY_TYPE_BASEBACKUP");
-  }
+}
 
-  switch(type) {
-    case BASEBACKUP_QUERY_TYPE_BASEBACKUP:
-    {
-      query << "BASE_BACKUP (";
+void BaseBackupProgressPublisher::setBackupID(int backup_id) {
 
-      if (this->profile == nullptr)
-        throw StreamingFailure("backup profile not initialized for streaming basebackup");
+  std::lock_guard<std::mutex> lock(this->mtx);
+  this->progress.backup_id = backup_id;
 
-      /*
-       * Special LABEL requested?
-       */
-      if (this->profile->label != "") {
-        PQescapeStringConn(this->pgconn,
-                           escapedlabel,
-                           this->profile->label.c_str(),
-                           this->profile->label.length(),
-                           &escape_error);
-        options.push("LABEL " + string("'") + string(escapedlabel) + string("'"));
-      }
+}
 
-      /*
-       * We always request PROGRESS
-       */
-      options.push("PROGRESS on");
+void BaseBackupProgressPublisher::tablespaceStreamed() {
 
-      /*
-       * immediate CHECKPOINT requested?
-       */
-      if (this->profile->fast_checkpoint)
-        options.push("CHECKPOINT fast");
+  this->tablespaces_streamed++;
 
-      /*
-       * WAL stream request for base backup?
-       */
-      if (this->profile->include_wal)
-        options.push(" WAL on");
+}
 
-      /*
-       * We usually wait for WAL segments to be archived.
-       */
-      if (!this->profile->wait_for_wal)
-        options.push("WAIT off");
+void BaseBackupProgressPublisher::publish() {
 
-      /*
-       * MAX_RATE limits the used bandwidth of the stream.
-       * Check if this is requested...
-       */
-      if (this->profile->max_rate > 0) {
-        std::ostringstream conv;
-        conv << "MAX_RATE " << this->profile->max_rate;
-        options.push(conv.str());
-      }
+  this->progress.last_update = (int64_t) ::time(NULL);
+  this->progress.written_bytes = this->limiter->consumed();
+  this->progress.tablespaces_streamed = this->tablespaces_streamed.load();
 
+  if (this->stream != nullptr) {
 
-      /*
-       * Starting with PostgreSQL 11, we have the NOVERFIY_CHECKSUMS
-       * available.
-       */
-      if (this->profile->noverify_checksums)
-        options.push("VERIFY_CHECKSUMS off");
+    this->progress.tablespaces_total = this->stream->numTablespaces();
+    this->progress.estimated_bytes = this->stream->estimatedSize();
+    this->progress.server_bytes = this->stream->reportedProgress();
 
-      /*
-       * PostgreSQL 13 introduces backup manifests, check
-       * if the profile requested that feature and make sure
-       * we have a server version >= 13.
-       */
-      if (this->profile->manifest) {
+  }
 
-        std::ostringstream oss;
+  this->shm->writeBasebackupProgress(this->slot, this->progress);
 
-        oss << " MANIFEST on, ";
-        oss << " MANIFEST_CHECKSUMS "
-            << "'" << this->profile->manifest_checksums << "'";
-        options.push(oss.str());
+}
 
-      }
+void BaseBackupProgressPublisher::run() {
 
-      /*
-       * We always request the tablespace map from the stream.
-       */
-      options.push("TABLESPACE_MAP on");
+  std::unique_lock<std::mutex> lock(this->mtx);
 
-      /* Make the list of options */
-      while (!options.empty()) {
-        query << " " << options.top();
-        options.pop();
-        query << (!options.empty() ? "," : "");
-      }
+  while (!this->shutdown) {
 
-      /* Close the options list */
-      query << ")";
+    this->cv.wait_for(lock, std::chrono::seconds(1),
+                      [this] { return this->shutdown; });
 
+    if (this->shutdown)
       break;
-    }
 
-    default:
-    {
-      throw StreamingFailure("unknown basebackup command type");
+    try {
+      this->publish();
+    } catch(std::exception &e) {
+      /* failing to publish the progress must not abort the basebackup */
+      BOOST_LOG_TRIVIAL(warning) << "WARNING: basebackup progress: " << e.what();
     }
 
   }
 
-  return query.str();
-
 }
 
-std::shared_ptr<BackupElemDescr>
-BaseBackupStream15::handleMessage(BaseBackupState &current_state) {
+void BaseBackupProgressPublisher::start(std::shared_ptr<BaseBackupStream> stream) {
 
-  std::shared_ptr<BackupElemDescr> result = nullptr;
+  if (this->monitor.joinable())
+    throw StreamingFailure("basebackup progress publisher already started");
 
-  /* Check for correct state */
-  if (current_state != BASEBACKUP_STEP_TABLESPACE) {
-    throw StreamingFailure("invalid protocol handler state");
-  }
+  this->stream = stream;
+  this->shutdown = false;
+  this->publish();
 
-  /*
-   * We are in COPY mode now and need to dispatch the specific CopyOutResponse payloads.
-   * The first message bytes indicate the kind of message.
-   */
-  if (next(result)) {
+  this->monitor = std::thread(&BaseBackupProgressPublisher::run, this);
 
-    /* Checkt if we are interrupted by signal handler */
-    if (current_state == BASEBACKUP_STEP_TABLESPACE_INTERRUPTED) {
-      throw StreamingFailure("streaming tablespace archive aborted");
-    }
+}
 
-  } else {
-    current_state = BASEBACKUP_EOB;
+void BaseBackupProgressPublisher::stop() {
+
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->shutdown = true;
   }
 
-  return result;
+  this->cv.notify_all();
+
+  if (!this->monitor.joinable())
+    return;
+
+  this->monitor.join();
+
+  try {
+    this->publish();
+  } catch(std::exception &e) {
+    BOOST_LOG_TRIVIAL(warning) << "WARNING: basebackup progress: " << e.what();
+  }
 
 }
 
@@ -2147,6 +3385,12 @@ void BaseBackupProcess::start() {
     throw StreamingFailure("attempt to start an unprepared basebackup stream");
   }
 
+  /*
+   * Incremental basebackups need the parent manifest
+   * uploaded before BASE_BACKUP.
+   */
+  tinfo->uploadManifest();
+
   query = tinfo->query(profile, pgconn,
                        BASEBACKUP_QUERY_TYPE_BASEBACKUP);
 
@@ -2230,6 +3474,33 @@ void BaseBackupProcess::prepareStream(std::shared_ptr<StreamBaseBackup> &backupH
   /* We want to have a stop handler for the basebackup stream */
   this->tinfo->assignStopHandler(this->stopHandler);
 
+  /* Incremental basebackup requested? */
+  if (!this->parent_manifest.empty()) {
+    this->tinfo->setParentManifest(this->parent_manifest);
+  }
+
+}
+
+void BaseBackupProcess::setRateControl(std::shared_ptr<BaseBackupRateControl> control) {
+
+  this->rateControl = control;
+
+}
+
+void BaseBackupProcess::setProgressPublisher(std::shared_ptr<BaseBackupProgressPublisher> publisher) {
+
+  this->progressPublisher = publisher;
+
+}
+
+void BaseBackupProcess::setParentManifest(std::string const& manifest) {
+
+  if (this->tinfo != nullptr) {
+    throw StreamingFailure("parent manifest must be assigned before preparing the basebackup stream");
+  }
+
+  this->parent_manifest = manifest;
+
 }
 
 bool BaseBackupProcess::stream(std::shared_ptr<BackupCatalog> catalog) {
@@ -2243,39 +3514,100 @@ bool BaseBackupProcess::stream(std::shared_ptr<BackupCatalog> catalog) {
     throw StreamingFailure("cannot start data streaming from improper state");
   }
 
+  /*
+   * Tablespaces streamed so far. Their archives might still be
+   * written by the archive writers of the backup handle, so we register
+   * them in the catalog all together after the stream has finished.
+   */
+  std::vector<std::shared_ptr<BackupTablespaceDescr>> streamed_tablespaces;
+
   /* Prepare state to iterate through tablespaces */
   current_state = BASEBACKUP_STEP_TABLESPACE;
 
-  while(true) {
+  /* Adapt the throughput while receiving the archives */
+  if (this->rateControl != nullptr)
+    this->rateControl->start();
 
-    auto descr = tinfo->handleMessage(current_state);
+  if (this->progressPublisher != nullptr) {
 
-    /* Check state */
-    if (current_state == BASEBACKUP_STEP_TABLESPACE_INTERRUPTED) {
-      throw StreamingFailure("basebackup stream interrupted");
-    }
+    if (this->baseBackupDescr != nullptr)
+      this->progressPublisher->setBackupID(this->baseBackupDescr->id);
 
-    if (current_state == BASEBACKUP_EOB) {
-      BOOST_LOG_TRIVIAL(debug) << "end of backup stream reached";
-      break;
-    }
+    this->progressPublisher->start(this->tinfo);
 
-    if (descr->getType() == BASEBACKUP_ELEM_TBLSPC) {
+  }
 
-      /*
-       * The backup id is retrieved by the basebackup descriptor and not (obviously) not
-       * provided directly within the basebackup stream. So we need to reference
-       * it explictely here before saving the descriptor to disc.
-       */
-      dynamic_pointer_cast<BackupTablespaceDescr>(descr)->backup_id = baseBackupDescr->id;
-      catalog->registerTablespaceForBackup(dynamic_pointer_cast<BackupTablespaceDescr>(descr));
+  try {
+
+    while(true) {
+
+      auto descr = tinfo->handleMessage(current_state);
+
+      /* Check state */
+      if (current_state == BASEBACKUP_STEP_TABLESPACE_INTERRUPTED) {
+        throw StreamingFailure("basebackup stream interrupted");
+      }
+
+      if (current_state == BASEBACKUP_EOB) {
+        BOOST_LOG_TRIVIAL(debug) << "end of backup stream reached";
+        break;
+      }
+
+      if (descr->getType() == BASEBACKUP_ELEM_TBLSPC) {
+
+        /*
+         * The backup id is retrieved by the basebackup descriptor and not (obviously) not
+         * provided directly within the basebackup stream. So we need to reference
+         * it explictely here before saving the descriptor to disc.
+         */
+        dynamic_pointer_cast<BackupTablespaceDescr>(descr)->backup_id = baseBackupDescr->id;
+        streamed_tablespaces.push_back(dynamic_pointer_cast<BackupTablespaceDescr>(descr));
+
+        if (this->progressPublisher != nullptr)
+          this->progressPublisher->tablespaceStreamed();
+
+      }
 
+      /* Should we get another state than BASEBACKUP_STEP_TABLESPACE, error out */
+      if (current_state != BASEBACKUP_STEP_TABLESPACE) {
+        throw StreamingFailure("unexpected state in basebackup stream");
+      }
     }
 
-    /* Should we get another state than BASEBACKUP_STEP_TABLESPACE, error out */
-    if (current_state != BASEBACKUP_STEP_TABLESPACE) {
-      throw StreamingFailure("unexpected state in basebackup stream");
+  } catch(std::exception &e) {
+
+    if (this->rateControl != nullptr)
+      this->rateControl->stop();
+
+    if (this->progressPublisher != nullptr)
+      this->progressPublisher->stop();
+
+    throw;
+
+  }
+
+  if (this->rateControl != nullptr)
+    this->rateControl->stop();
+
+  if (this->progressPublisher != nullptr)
+    this->progressPublisher->stop();
+
+  /*
+   * Register all streamed tablespaces at once.
+   */
+  catalog->startTransaction();
+
+  try {
+
+    for (auto &tblspc : streamed_tablespaces) {
+      catalog->registerTablespaceForBackup(tblspc);
     }
+
+    catalog->commitTransaction();
+
+  } catch(CPGBackupCtlFailure &e) {
+    catalog->rollbackTransaction();
+    throw e;
   }
 
   /* success */
@@ -63,11 +63,11 @@ int StreamIdentification::updateStartSegmentWriteOffset() {
 
 #if PG_VERSION_NUM < 110000
   this->write_pos_start_offset
-    += this->write_position % XLOG_SEG_SIZE;
+    += xlog::WALSegment<XLOG_SEG_SIZE>::offset(this->write_position);
 #else
   this->write_pos_start_offset
-    += XLogSegmentOffset(this->write_position,
-                         this->wal_segment_size);
+    += xlog::segmentOffset(this->write_position,
+                           this->wal_segment_size);
 #endif
 
   return this->write_pos_start_offset;
@@ -122,8 +122,8 @@ int PGStream::compiledPGVersionNum() {
 int PGStream::XLOGOffset(XLogRecPtr pos) {
 
 #if PG_VERSION_NUM >= 110000
-  return XLogSegmentOffset(PGStream::decodeXLOGPos(this->streamident.xlogpos),
-                           this->walSegmentSize);
+  return xlog::segmentOffset(PGStream::decodeXLOGPos(this->streamident.xlogpos),
+                             this->walSegmentSize);
 #else
   return pos % this->walSegmentSize;
 #endif
@@ -133,20 +133,16 @@ int PGStream::XLOGOffset(XLogRecPtr pos) {
 int PGStream::XLOGOffset(XLogRecPtr pos,
                          uint32_t wal_segment_size) {
 
-#if PG_VERSION_NUM >= 110000
-  return XLogSegmentOffset(pos, wal_segment_size);
-#else
-  return pos % wal_segment_size;
-#endif
+  return xlog::segmentOffset(pos, wal_segment_size);
 
 }
 
 XLogRecPtr PGStream::XLOGSegmentStartPosition(XLogRecPtr pos) {
 
 #if PG_VERSION_NUM < 110000
-  return pos - (pos % XLOG_SEG_SIZE);
+  return xlog::WALSegment<XLOG_SEG_SIZE>::startPosition(pos);
 #else
-  return pos - XLogSegmentOffset(pos, this->walSegmentSize);
+  return xlog::segmentStartPosition(pos, this->walSegmentSize);
 #endif
 
 }
@@ -154,20 +150,16 @@ XLogRecPtr PGStream::XLOGSegmentStartPosition(XLogRecPtr pos) {
 XLogRecPtr PGStream::XLOGSegmentStartPosition(XLogRecPtr pos,
                                               uint32_t wal_segment_size) {
 
-#if PG_VERSION_NUM < 110000
-  return pos - (pos % wal_segment_size);
-#else
-  return pos - XLogSegmentOffset(pos, wal_segment_size);
-#endif
+  return xlog::segmentStartPosition(pos, wal_segment_size);
 
 }
 
 XLogRecPtr PGStream::XLOGNextSegmentStartPosition(XLogRecPtr pos) {
 
 #if PG_VERSION_NUM < 110000
-  return (pos - (pos % XLOG_SEG_SIZE)) + XLOG_SEG_SIZE +1;
+  return xlog::WALSegment<XLOG_SEG_SIZE>::startPosition(pos) + XLOG_SEG_SIZE + 1;
 #else
-  return (pos - XLogSegmentOffset(pos, this->walSegmentSize)) + this->walSegmentSize + 1;
+  return xlog::segmentStartPosition(pos, this->walSegmentSize) + this->walSegmentSize + 1;
 #endif
 
 }
@@ -175,96 +167,46 @@ XLogRecPtr PGStream::XLOGNextSegmentStartPosition(XLogRecPtr pos) {
 XLogRecPtr PGStream::XLOGNextSegmentStartPosition(XLogRecPtr pos,
                                                   uint32_t wal_segment_size) {
 
-#if PG_VERSION_NUM < 110000
-  return (pos - (pos % wal_segment_size)) + wal_segment_size +1;
-#else
-  return (pos - XLogSegmentOffset(pos, wal_segment_size)) + wal_segment_size + 1;
-#endif
+  return xlog::segmentStartPosition(pos, wal_segment_size) + wal_segment_size + 1;
 
 }
 
+/*
+ * Get the starting position of the current segment
+ * file, move the recptr then one byte backward and calculate
+ * the offset again. This gives us the starting offset
+ * of the previous XLOG segment the given XLogRecPtr belongs to.
+ */
 XLogRecPtr PGStream::XLOGPrevSegmentStartPosition(XLogRecPtr pos) {
 
-  XLogRecPtr prev_recptr = InvalidXLogRecPtr;
-
-  /*
-   * Get the starting position of the current segment
-   * file, move the recptr then one byte backward and calculate
-   * the offset again. This should give us the starting offset
-   * of the previous XLOG segment the given XLogRecPtr belongs to.
-   */
-
-#if PG_VERSION_NUM < 110000
-
-  prev_recptr = (pos - (pos % this->walSegmentSize)) - 1;
-  prev_recptr = (prev_recptr - (prev_recptr % this->walSegmentSize));
-
-#else
-
-  prev_recptr = (pos - XLogSegmentOffset(pos, this->walSegmentSize)) - 1 ;
-  prev_recptr = (prev_recptr - XLogSegmentOffset(prev_recptr, this->walSegmentSize));
-
-#endif
-
-  return prev_recptr;
+  return xlog::prevSegmentStartPosition(pos, this->walSegmentSize);
 
 }
 
 XLogRecPtr PGStream::XLOGPrevSegmentStartPosition(XLogRecPtr pos,
                                                   uint32_t wal_segment_size) {
 
-  XLogRecPtr prev_recptr = InvalidXLogRecPtr;
-
-  /*
-   * Get the starting position of the current segment
-   * file, move the recptr then one byte backward and calculate
-   * the offset again. This should give us the starting offset
-   * of the previous XLOG segment the given XLogRecPtr belongs to.
-   */
-
-#if PG_VERSION_NUM < 110000
-
-  prev_recptr = (pos - (pos % wal_segment_size)) - 1;
-  prev_recptr = (prev_recptr - (prev_recptr % wal_segment_size));
-
-#else
-
-  prev_recptr = (pos - XLogSegmentOffset(pos, wal_segment_size)) - 1 ;
-  prev_recptr = (prev_recptr - XLogSegmentOffset(prev_recptr, wal_segment_size));
-
-#endif
-
-  return prev_recptr;
+  return xlog::prevSegmentStartPosition(pos, wal_segment_size);
 
 }
 
 std::string PGStream::encodeXLOGPos(XLogRecPtr pos) {
 
-  std::string result = "";
-  std::ostringstream oss;
-  unsigned int hi, lo;
+  char buf[xlog::XLOGPOS_BUFSIZE];
+  size_t len = xlog::encodeXLogPos(buf, pos);
 
-  hi = (uint32_t)(pos >> 32);
-  lo = (uint32_t)(pos);
-
-  oss << std::hex << hi << "/" << std::hex << lo;
-
-  /* make sure we have a copy */
-  result = oss.str();
-  return result;
+  return std::string(buf, len);
 }
 
 XLogRecPtr PGStream::decodeXLOGPos(std::string pos) {
 
-  uint32_t     hi, lo;
+  XLogRecPtr result = InvalidXLogRecPtr;
 
-  if (sscanf(pos.c_str(), "%X/%X", &hi, &lo) != 2) {
-    std::ostringstream oss;
-    oss << "could not parse XLOG location string: " << pos;
-    throw StreamingFailure(oss.str());
+  if (!xlog::decodeXLogPos(pos.c_str(), pos.length(), result)) {
+    throw StreamingFailure("could not parse XLOG location string: " + pos);
   }
 
-  return ((uint64_t) hi << 32) | lo;
+  return result;
 }
 
 int PGStream::getServerVersion() {
@@ -0,0 +1,698 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include <verifybackup.hxx>
+#include <stream.hxx>
+
+using namespace pgbckctl;
+
+/*
+ * Reads len bytes from archive into buf, returns the number
+ * of bytes read, which is less than len at the end of the archive.
+ */
+static size_t verify_read(std::shared_ptr<BackupFile> archive, char *buf, size_t len) {
+
+  size_t total = 0;
+
+  /* ArchiveFile::read() returns the number of items read, not bytes */
+  if (!archive->isCompressed())
+    return (archive->read(buf, len) > 0) ? len : 0;
+
+  while (total < len) {
+
+    size_t rbytes = archive->read(buf + total, len - total);
+
+    if (rbytes == 0)
+      break;
+
+    total += rbytes;
+
+  }
+
+  return total;
+
+}
+
+/*
+ * Decodes the hex encoded Encoded-Path of a manifest entry.
+ */
+static std::string verify_decode_hex(std::string const& hex) {
+
+  std::string result;
+
+  if (hex.length() % 2 != 0)
+    throw CArchiveIssue("invalid Encoded-Path \"" + hex + "\" in backup manifest");
+
+  for (size_t i = 0; i < hex.length(); i += 2) {
+
+    try {
+      result.push_back((char) std::stoi(hex.substr(i, 2), nullptr, 16));
+    } catch (std::exception &e) {
+      throw CArchiveIssue("invalid Encoded-Path \"" + hex + "\" in backup manifest");
+    }
+
+  }
+
+  return result;
+
+}
+
+/******************************************************************************
+ * Implementation of BaseBackupVerifier
+ *****************************************************************************/
+
+BaseBackupVerifier::BaseBackupVerifier(std::shared_ptr<BaseBackupDescr> bbdescr,
+                                       path logdir) {
+
+  if (bbdescr == nullptr || bbdescr->id < 0)
+    throw CArchiveIssue("cannot verify basebackup: invalid basebackup descriptor");
+
+  this->bbdescr = bbdescr;
+  this->logdir = logdir;
+  this->next_task = 0;
+
+}
+
+BaseBackupVerifier::~BaseBackupVerifier() {}
+
+void BaseBackupVerifier::setWorkers(unsigned int workers) {
+  this->workers = workers;
+}
+
+void BaseBackupVerifier::setTaskSize(size_t task_size) {
+  this->task_size = task_size;
+}
+
+bool BaseBackupVerifier::ignoredFile(std::string const& name) {
+
+  /*
+   * Same files as ignored by pg_verifybackup, the server leaves
+   * them out of the manifest or they might be changed on purpose.
+   */
+  return (name == "backup_manifest"
+          || name == "pg_wal"
+          || name.compare(0, 7, "pg_wal/") == 0
+          || name == "postgresql.auto.conf"
+          || name == "recovery.signal"
+          || name == "standby.signal");
+
+}
+
+std::shared_ptr<BackupFile> BaseBackupVerifier::archiveFile(path archive) {
+
+  std::string ext = archive.extension().string();
+
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+  if (ext == ".gz")
+    return std::make_shared<CompressedArchiveFile>(archive);
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+  if (ext == ".zst")
+    return std::make_shared<ZstdArchiveFile>(archive);
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+  if (ext == ".lz4")
+    return std::make_shared<LZ4ArchiveFile>(archive);
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZMA
+  if (ext == ".xz")
+    return std::make_shared<XZArchiveFile>(archive);
+#endif
+
+  if (ext == ".tar")
+    return std::make_shared<ArchiveFile>(archive);
+
+  if (ext == DedupArchiveFile::SUFFIX)
+    return std::make_shared<DedupArchiveFile>(archive);
+
+  std::ostringstream oss;
+  oss << "no support for reading archive " << archive.string();
+  throw CArchiveIssue(oss.str());
+
+}
+
+void BaseBackupVerifier::error(std::string const& file, std::string const& message) {
+
+  std::lock_guard<std::mutex> lock(this->result_mtx);
+  this->result->errors.push_back(std::make_pair(file, message));
+
+}
+
+void BaseBackupVerifier::warning(std::string const& file, std::string const& message) {
+
+  std::lock_guard<std::mutex> lock(this->result_mtx);
+  this->result->warnings.push_back(std::make_pair(file, message));
+
+}
+
+void BaseBackupVerifier::loadManifest() {
+
+  namespace pt = boost::property_tree;
+
+  path manifest_path = path(this->bbdescr->fsentry) / "backup_manifest";
+  std::string contents;
+  pt::ptree manifest;
+
+  /*
+   * Basebackups with server side compression store
+   * the manifest under a different name.
+   */
+  if (!exists(manifest_path))
+    manifest_path = path(this->bbdescr->fsentry) / "backup.manifest";
+
+  if (!exists(manifest_path)) {
+    this->warning("backup_manifest",
+                  "basebackup has no manifest, checking archive structure only");
+    return;
+  }
+
+  /*
+   * The manifest is read into memory completely, since we
+   * need its contents to calculate the manifest checksum anyways.
+   */
+  {
+    std::ifstream in(manifest_path.string(), std::ios::in | std::ios::binary);
+    std::ostringstream buf;
+
+    if (!in.is_open()) {
+      std::ostringstream oss;
+      oss << "could not open backup manifest " << manifest_path.string();
+      throw CArchiveIssue(oss.str());
+    }
+
+    buf << in.rdbuf();
+    contents = buf.str();
+  }
+
+  try {
+
+    std::istringstream in(contents);
+    pt::read_json(in, manifest);
+
+  } catch (pt::json_parser_error &e) {
+
+    std::ostringstream oss;
+    oss << "could not parse backup manifest " << manifest_path.string()
+        << ": " << e.what();
+    throw CArchiveIssue(oss.str());
+
+  }
+
+  this->result->manifest_found = true;
+
+  /*
+   * The manifest checksum is a SHA256 over everything
+   * up to the line containing it.
+   */
+  {
+    std::string expected = manifest.get<std::string>("Manifest-Checksum", "");
+    size_t pos = contents.rfind("\"Manifest-Checksum\"");
+
+    if (expected.empty() || pos == std::string::npos) {
+
+      this->error("backup_manifest", "manifest has no checksum");
+
+    } else if (!FileChecksum::supported("SHA256")) {
+
+      this->warning("backup_manifest",
+                    "manifest checksum not verified, SHA256 not supported by this build");
+
+    } else {
+
+      std::shared_ptr<FileChecksum> checksum = FileChecksum::create("SHA256");
+      size_t nl = contents.rfind('\n', pos);
+
+      checksum->update(contents.data(), (nl == std::string::npos) ? 0 : nl + 1);
+
+      if (!boost::iequals(checksum->final(), expected))
+        this->error("backup_manifest", "manifest checksum mismatch");
+
+    }
+  }
+
+  /*
+   * Version 2 manifests (PostgreSQL 17) carry the system
+   * identifier, which must match the basebackup.
+   */
+  {
+    std::string sysid = manifest.get<std::string>("System-Identifier", "");
+
+    if (!sysid.empty()
+        && !this->bbdescr->systemid.empty()
+        && sysid != this->bbdescr->systemid) {
+
+      std::ostringstream oss;
+      oss << "manifest system identifier " << sysid
+          << " does not match system identifier " << this->bbdescr->systemid
+          << " of the basebackup";
+      this->error("backup_manifest", oss.str());
+
+    }
+  }
+
+  try {
+
+    for (auto &item : manifest.get_child("Files")) {
+
+      BackupManifestFile file;
+      pt::ptree &entry = item.second;
+
+      if (entry.count("Encoded-Path") > 0)
+        file.path = verify_decode_hex(entry.get<std::string>("Encoded-Path"));
+      else
+        file.path = entry.get<std::string>("Path");
+
+      file.size      = entry.get<size_t>("Size");
+      file.algorithm = entry.get<std::string>("Checksum-Algorithm", "NONE");
+      file.checksum  = entry.get<std::string>("Checksum", "");
+
+      this->manifest_files[file.path] = file;
+
+    }
+
+    for (auto &item : manifest.get_child("WAL-Ranges")) {
+
+      BackupManifestWALRange range;
+      pt::ptree &entry = item.second;
+
+      range.timeline = entry.get<unsigned int>("Timeline");
+      range.start    = PGStream::decodeXLOGPos(entry.get<std::string>("Start-LSN"));
+      range.end      = PGStream::decodeXLOGPos(entry.get<std::string>("End-LSN"));
+
+      this->manifest_wal_ranges.push_back(range);
+
+    }
+
+  } catch (pt::ptree_error &e) {
+
+    std::ostringstream oss;
+    oss << "invalid backup manifest " << manifest_path.string()
+        << ": " << e.what();
+    throw CArchiveIssue(oss.str());
+
+  }
+
+  BOOST_LOG_TRIVIAL(debug) << "DEBUG: backup manifest lists "
+                           << this->manifest_files.size() << " files and "
+                           << this->manifest_wal_ranges.size() << " WAL ranges";
+
+}
+
+void BaseBackupVerifier::planTasks() {
+
+  const boost::regex tar_archive("(.+)\\.tar(\\.(gz|zst|lz4|xz|dedup))?");
+  path fsentry(this->bbdescr->fsentry);
+
+  for (directory_iterator it(fsentry); it != directory_iterator(); ++it) {
+
+    boost::smatch what;
+    std::string filename = it->path().filename().string();
+    std::shared_ptr<BackupFile> archive = nullptr;
+    ArchiveMemberIndex index;
+    BaseBackupVerifyTask task;
+    off_t last_start = 0;
+
+    if (!is_regular_file(it->path())
+        || !boost::regex_match(filename, what, tar_archive))
+      continue;
+
+    /*
+     * The base archive contains the data directory, all others
+     * are tablespaces named by their OID.
+     */
+    task.archive = it->path();
+
+    if (what[1] != "base" && what[1] != "0")
+      task.prefix = "pg_tblspc/" + what[1] + "/";
+
+    archive = BaseBackupVerifier::archiveFile(task.archive);
+
+    /*
+     * Without a member index, a single worker reads the whole
+     * archive. Otherwise split the archive at its sync points, or
+     * at member headers for uncompressed archives.
+     */
+    if (exists(ArchiveMemberIndex::indexPath(task.archive))) {
+
+      try {
+
+        index.read(ArchiveMemberIndex::indexPath(task.archive));
+
+      } catch (CArchiveIssue &e) {
+
+        this->warning(filename,
+                      std::string("ignoring member index: ") + e.what());
+        index = ArchiveMemberIndex();
+
+      }
+
+    }
+
+    for (auto &entry : index.getEntries()) {
+
+      off_t sync_offset = archive->isCompressed() ? entry.sync_offset : entry.offset;
+      off_t sync_pos    = archive->isCompressed() ? entry.sync_pos : entry.offset;
+
+      if (sync_offset <= 0 || sync_pos - last_start < (off_t) this->task_size)
+        continue;
+
+      task.end = sync_pos;
+      this->tasks.push_back(task);
+
+      task.sync_offset = sync_offset;
+      task.start = sync_pos;
+      last_start = sync_pos;
+
+    }
+
+    task.end = -1;
+    this->tasks.push_back(task);
+
+  }
+
+}
+
+void BaseBackupVerifier::verifyMember(std::string const& name,
+                                      size_t size,
+                                      std::shared_ptr<FileChecksum> checksum) {
+
+  std::lock_guard<std::mutex> lock(this->result_mtx);
+  auto it = this->manifest_files.find(name);
+
+  this->result->files_checked++;
+  this->result->bytes_checked += size;
+
+  if (name.compare(0, 7, "pg_wal/") == 0)
+    this->archived_wal.insert(path(name).filename().string());
+
+  if (!this->result->manifest_found)
+    return;
+
+  if (it == this->manifest_files.end()) {
+
+    if (!BaseBackupVerifier::ignoredFile(name))
+      this->result->errors.push_back(std::make_pair(name, "present in archive but not in manifest"));
+
+    return;
+
+  }
+
+  it->second.seen = true;
+
+  if (it->second.size != size) {
+
+    std::ostringstream oss;
+    oss << "size " << size << " differs from manifest size " << it->second.size;
+    this->result->errors.push_back(std::make_pair(name, oss.str()));
+    return;
+
+  }
+
+  if (checksum != nullptr
+      && !boost::iequals(checksum->final(), it->second.checksum)) {
+
+    std::ostringstream oss;
+    oss << it->second.algorithm << " checksum mismatch";
+    this->result->errors.push_back(std::make_pair(name, oss.str()));
+
+  }
+
+}
+
+void BaseBackupVerifier::verifyTask(BaseBackupVerifyTask const& task) {
+
+  std::shared_ptr<BackupFile> archive = BaseBackupVerifier::archiveFile(task.archive);
+  std::vector<char> buffer(65536);
+  std::string filename = task.archive.filename().string();
+  off_t pos = task.start;
+
+  archive->setOpenMode("rb");
+  archive->open();
+
+  if (task.start > 0) {
+
+    if (archive->isCompressed())
+      archive->seekSyncPoint(task.sync_offset);
+    else
+      archive->lseek(task.start, SEEK_SET);
+
+  }
+
+  while (task.end < 0 || pos < task.end) {
+
+    ArchiveMemberIndexEntry entry;
+    std::shared_ptr<FileChecksum> checksum = nullptr;
+    char header[512];
+    size_t remaining;
+    size_t data_left;
+    bool regular;
+
+    if (verify_read(archive, header, sizeof(header)) < sizeof(header)) {
+
+      /* PostgreSQL terminates its archives, but tolerate a missing trailer */
+      if (task.end >= 0)
+        this->error(filename, "unexpected end of archive");
+
+      break;
+
+    }
+
+    try {
+
+      if (!ArchiveMemberIndex::parseTarHeader(header, entry))
+        break;
+
+    } catch (CArchiveIssue &e) {
+
+      std::ostringstream oss;
+      oss << e.what() << " at offset " << pos;
+      this->error(filename, oss.str());
+      break;
+
+    }
+
+    entry.name = task.prefix + entry.name;
+    regular = (entry.type == '0' || entry.type == '7' || entry.type == '\0');
+
+    if (regular && this->result->manifest_found) {
+
+      std::unique_lock<std::mutex> lock(this->result_mtx);
+      auto it = this->manifest_files.find(entry.name);
+
+      if (it != this->manifest_files.end()
+          && it->second.algorithm != "NONE") {
+
+        if (FileChecksum::supported(it->second.algorithm)) {
+
+          checksum = FileChecksum::create(it->second.algorithm);
+
+        } else if (this->unsupported_algorithms.insert(it->second.algorithm).second) {
+
+          this->result->warnings.push_back(std::make_pair(it->second.algorithm,
+                                                          "checksum algorithm not supported, checksums not verified"));
+
+        }
+
+      }
+
+    }
+
+    /* Contents are padded to a multiple of the tar block size */
+    remaining = (entry.size + 511) & ~((size_t) 511);
+    data_left = entry.size;
+    pos += sizeof(header) + remaining;
+
+    while (remaining > 0) {
+
+      size_t wanted = std::min(remaining, buffer.size());
+      size_t data = std::min(wanted, data_left);
+
+      if (verify_read(archive, buffer.data(), wanted) < wanted) {
+        this->error(entry.name, "unexpected end of archive " + filename);
+        archive->close();
+        return;
+      }
+
+      /* Don't checksum the padding */
+      if (checksum != nullptr && data > 0)
+        checksum->update(buffer.data(), data);
+
+      remaining -= wanted;
+      data_left -= data;
+
+    }
+
+    if (regular)
+      this->verifyMember(entry.name, entry.size, checksum);
+
+  }
+
+  archive->close();
+
+}
+
+void BaseBackupVerifier::worker() {
+
+  while (true) {
+
+    size_t task = this->next_task++;
+
+    if (task >= this->tasks.size())
+      break;
+
+    try {
+
+      this->verifyTask(this->tasks[task]);
+
+    } catch (std::exception &e) {
+
+      this->error(this->tasks[task].archive.filename().string(), e.what());
+
+    }
+
+  }
+
+}
+
+void BaseBackupVerifier::verifyWALRange(BackupManifestWALRange const& range) {
+
+  unsigned long long segsz = this->bbdescr->wal_segment_size;
+  const std::vector<std::string> suffixes = { "", ".gz", ".zst", ".lz4" };
+  WALLogLayout layout = ArchiveLogDirectory::readLogLayout(this->logdir);
+
+  if (segsz == 0)
+    segsz = 16 * 1024 * 1024;
+
+  /* the end position is exclusive */
+  XLogRecPtr last = (range.end > range.start) ? range.end - 1 : range.start;
+
+  for (XLogRecPtr segno = range.start / segsz; segno <= last / segsz; segno++) {
+
+    std::string segment = ArchiveLogDirectory::XLogFileByRecPtr(segno * segsz,
+                                                                range.timeline,
+                                                                segsz);
+    bool found = false;
+    bool partial = false;
+
+    {
+      std::lock_guard<std::mutex> lock(this->result_mtx);
+
+      this->result->wal_segments_checked++;
+      found = (this->archived_wal.count(segment) > 0);
+    }
+
+    for (auto &suffix : suffixes) {
+
+      if (found)
+        break;
+
+      found = exists(ArchiveLogDirectory::locateXLogFile(this->logdir, layout,
+                                                         segment + suffix));
+      partial = partial || exists(ArchiveLogDirectory::locateXLogFile(this->logdir, layout,
+                                                                      segment + ".partial" + suffix));
+
+    }
+
+    if (!found && partial)
+      this->warning(segment, "WAL segment only available as partial segment");
+    else if (!found)
+      this->error(segment, "WAL segment required by basebackup is missing");
+
+  }
+
+}
+
+std::shared_ptr<BaseBackupVerificationResult> BaseBackupVerifier::verify() {
+
+  std::vector<std::thread> threads;
+  unsigned int nworkers = this->workers;
+
+  this->result = std::make_shared<BaseBackupVerificationResult>();
+  this->result->basebackup_id = this->bbdescr->id;
+  this->result->crc32c_hardware = CRC32C::hardwareAccelerated();
+
+  this->manifest_files.clear();
+  this->manifest_wal_ranges.clear();
+  this->archived_wal.clear();
+  this->unsupported_algorithms.clear();
+  this->tasks.clear();
+  this->next_task = 0;
+
+  if (!exists(path(this->bbdescr->fsentry))) {
+    std::ostringstream oss;
+    oss << "basebackup directory " << this->bbdescr->fsentry << " does not exist";
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->loadManifest();
+  this->planTasks();
+
+  if (this->tasks.empty())
+    this->error(this->bbdescr->fsentry, "basebackup directory contains no tar archives");
+
+  if (nworkers == 0)
+    nworkers = std::max(1u, std::thread::hardware_concurrency());
+
+  nworkers = std::min(nworkers, (unsigned int) std::max((size_t) 1, this->tasks.size()));
+  this->result->workers = nworkers;
+
+  BOOST_LOG_TRIVIAL(debug) << "DEBUG: verifying basebackup " << this->bbdescr->id
+                           << " with " << this->tasks.size() << " tasks and "
+                           << nworkers << " workers";
+
+  for (unsigned int i = 0; i < nworkers; i++)
+    threads.push_back(std::thread(&BaseBackupVerifier::worker, this));
+
+  for (auto &thread : threads)
+    thread.join();
+
+  /*
+   * Everything recorded in the manifest must have
+   * been found in one of the archives.
+   */
+  for (auto &file : this->manifest_files) {
+
+    if (!file.second.seen && !BaseBackupVerifier::ignoredFile(file.first))
+      this->result->errors.push_back(std::make_pair(file.first,
+                                                    "present in manifest but not in archive"));
+
+  }
+
+  /*
+   * Check the WAL required by the basebackup. Without a
+   * manifest, the catalog has the WAL position range.
+   */
+  if (this->result->manifest_found) {
+
+    for (auto &range : this->manifest_wal_ranges)
+      this->verifyWALRange(range);
+
+  } else if (!this->bbdescr->xlogpos.empty()
+             && !this->bbdescr->xlogposend.empty()) {
+
+    BackupManifestWALRange range;
+
+    range.timeline = this->bbdescr->timeline;
+    range.start = PGStream::decodeXLOGPos(this->bbdescr->xlogpos);
+    range.end   = PGStream::decodeXLOGPos(this->bbdescr->xlogposend);
+
+    this->verifyWALRange(range);
+
+  }
+
+  std::sort(this->result->errors.begin(), this->result->errors.end());
+  std::sort(this->result->warnings.begin(), this->result->warnings.end());
+
+  return this->result;
+
+}
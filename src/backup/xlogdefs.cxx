@@ -1,4 +1,5 @@
 #include <xlogdefs.hxx>
+#include <probes.hxx>
 
 /* For PostgreSQL FE routines */
 #include <postgres_fe.h>
@@ -77,6 +78,16 @@ void XLOGStreamMessage::basicCheckMemoryBuffer(MemoryBuffer &mybuffer) {
 
 }
 
+void XLOGStreamMessage::basicCheckBuffer(const char *buf, size_t len) {
+
+  if (buf == NULL || len <= 0)
+    throw XLOGMessageFailure("attempt to interpret empty XLOG data buffer");
+
+  if (this->what() != (unsigned char) buf[0])
+    throw XLOGMessageFailure("buffer doesn't hold valid XLOGDataMessage data");
+
+}
+
 XLOGStreamMessage* XLOGStreamMessage::message(PGconn *pg_connection,
                                               MemoryBuffer &srcbuffer,
                                               unsigned long long wal_segment_size) {
@@ -153,52 +164,65 @@ XLogRecPtr XLOGDataStreamMessage::getXLOGServerPos() {
 
 void XLOGDataStreamMessage::assign(MemoryBuffer &mybuffer) {
 
-  char bytes[8];
-  XLogRecPtr xlog_pos;
-
   /*
    * Perform some basic checks.
    */
   this->basicCheckMemoryBuffer(mybuffer);
 
+  this->assignBuffer(mybuffer.ptr(), mybuffer.getSize());
+
   /*
-   * Enough room for a XLOG Data Message ?
+   * Message objects assigned from a MemoryBuffer keep their own copy
+   * of the XLOG data block. allocate() reuses the internal buffer if
+   * it is large enough already.
    */
-  if (mybuffer.getSize() < 25)
-    throw XLOGMessageFailure("buffer doesn't look like a XLOG data message: invalid size");
+  if (this->xlogdatalen > 0) {
+
+    this->xlogdata.allocate(this->xlogdatalen);
+    this->xlogdata.write(this->xlogdataptr, this->xlogdatalen, 0);
+    this->xlogdataptr = this->xlogdata.ptr();
+
+  }
+
+}
+
+void XLOGDataStreamMessage::assignBuffer(const char *buf, size_t len) {
+
+  uint64_t value;
 
   /*
-   * Copy over bytes into internal buffer.
+   * Perform some basic checks.
    */
+  this->basicCheckBuffer(buf, len);
+
+  /*
+   * Enough room for a XLOG Data Message ?
+   */
+  if (len < 25)
+    throw XLOGMessageFailure("buffer doesn't look like a XLOG data message: invalid size");
 
   /*
    * NOTE: Skip the first byte, since this is the message type identifier.
    * The next 8 bytes corresponds to the XLOG start position.
    */
-  mybuffer.read(bytes, 8, 1);
-  memcpy(&xlog_pos, bytes, 8);
-  this->xlogstartpos = SWAP_UINT64(xlog_pos);
+  memcpy(&value, buf + 1, 8);
+  this->xlogstartpos = SWAP_UINT64(value);
 
   /* XLOG server position */
-  mybuffer.read((char *)&bytes, 8, 9);
-  memcpy(&xlog_pos, bytes, 8);
-  this->xlogserverpos = SWAP_UINT64(xlog_pos);
+  memcpy(&value, buf + 9, 8);
+  this->xlogserverpos = SWAP_UINT64(value);
 
   /* XLOG timestamp */
-  mybuffer.read((char *)&bytes, 8, 17);
-  this->xlogstreamtime = (long long)(bytes);
-
-  /* Now copy over XLOG data blocks. This start at byte 25 */
-  if (mybuffer.getSize() > 25) {
-
-    char *xlogdatabytes = new char[mybuffer.getSize() - 25];
+  memcpy(&value, buf + 17, 8);
+  this->xlogstreamtime = (long long) SWAP_UINT64(value);
 
-    this->xlogdata.allocate(mybuffer.getSize() - 25);
-    mybuffer.read(xlogdatabytes, this->xlogdata.getSize(), 25);
-    this->xlogdata.write(xlogdatabytes, this->xlogdata.getSize(), 0);
+  /*
+   * XLOG data blocks start at byte 25. We don't copy them, but
+   * reference the caller's buffer.
+   */
+  this->xlogdatalen = len - 25;
+  this->xlogdataptr = (this->xlogdatalen > 0) ? buf + 25 : nullptr;
 
-    delete [] xlogdatabytes;
-  }
 }
 
 XLOGStreamMessage& XLOGDataStreamMessage::operator<<(MemoryBuffer &srcbuffer) {
@@ -208,12 +232,12 @@ XLOGStreamMessage& XLOGDataStreamMessage::operator<<(MemoryBuffer &srcbuffer) {
 
 }
 
-char * XLOGDataStreamMessage::buffer() {
-  return this->xlogdata.ptr();
+const char * XLOGDataStreamMessage::buffer() {
+  return this->xlogdataptr;
 }
 
 size_t XLOGDataStreamMessage::dataBufferSize() {
-  return this->xlogdata.getSize();
+  return this->xlogdatalen;
 }
 
 /******************************************************************************
@@ -285,6 +309,10 @@ void ReceiverStatusUpdateMessage::send() {
   else
     replydata[33] = 0;
 
+  TRACE_PGBCKCTL_STATUS_UPDATE(this->xlogPos_written,
+                               report_flush_position ? this->xlogPos_flushed : InvalidXLogRecPtr,
+                               replydata[33]);
+
   if (PQputCopyData(this->connection, replydata, sizeof(replydata)) <= 0
       || PQflush(this->connection)) {
     std::ostringstream oss;
@@ -418,17 +446,28 @@ uint64 PrimaryFeedbackMessage::getServerTime() {
 
 void PrimaryFeedbackMessage::assign(MemoryBuffer &mybuffer) {
 
-  char buffer[8];
-
   /*
    * Some basic checks on the input memory buffer.
    */
   this->basicCheckMemoryBuffer(mybuffer);
 
+  this->assignBuffer(mybuffer.ptr(), mybuffer.getSize());
+
+}
+
+void PrimaryFeedbackMessage::assignBuffer(const char *buf, size_t len) {
+
+  uint64_t value;
+
+  /*
+   * Some basic checks on the input buffer.
+   */
+  this->basicCheckBuffer(buf, len);
+
   /*
    * Enough room for a primary status message ?
    */
-  if (mybuffer.getSize() < 18) {
+  if (len < 18) {
     throw XLOGMessageFailure("input buffer does not look like a primary status message");
   }
 
@@ -436,23 +475,21 @@ void PrimaryFeedbackMessage::assign(MemoryBuffer &mybuffer) {
    * First byte is the message byte, so skip this and read
    * in the xlogserverendpos provided by this status message.
    */
-  mybuffer.read((char *)&buffer, 8, 1);
-  this->xlogserverendpos = (long long)buffer;
+  memcpy(&value, buf + 1, 8);
+  this->xlogserverendpos = SWAP_UINT64(value);
 
   /*
    * Starting at offset byte 9 we find the server time
    * as of starting the transmission of this message.
    */
-  mybuffer.read((char *)&buffer, 8, 9);
-  this->xlogservertime = (long long) buffer;
+  memcpy(&value, buf + 9, 8);
+  this->xlogservertime = SWAP_UINT64(value);
 
   /*
    * If the server wants a response, the last byte indicates
-   * this by setting it to '1'.
+   * this by setting it to 1. Reset the flag otherwise, since
+   * message objects might be reused.
    */
-
-  if (mybuffer[17] == '1') {
-    this->wantsResponse();
-  }
+  this->requestResponse = (buf[17] == 1);
 
 }
@@ -131,14 +131,13 @@ BackupLockInfoType SHMBackupLockInfo::locked(std::shared_ptr<BaseBackupDescr> ba
   }
 
   /*
-   * Get a lock on the shared memory segment, check if the
-   * requested basebackup ID is in use.
+   * Check if the requested basebackup ID is in use.
    *
    * We need to loop through all worker slots and have a look
-   * into possible child slots. This is rather expensive, but we
-   * expect the list not to be very long.
+   * into possible child slots. WorkerSHM::read() doesn't lock,
+   * and sub workers register their child slots without the lock
+   * anyways, so don't block the launcher and workers here.
    */
-  WORKER_SHM_CRITICAL_SECTION_START_P(worker_shm);
 
   for (unsigned int i = 0; i < worker_shm->getMaxWorkers(); i++) {
 
@@ -175,8 +174,6 @@ BackupLockInfoType SHMBackupLockInfo::locked(std::shared_ptr<BaseBackupDescr> ba
 
   } /* outer worker slot loop */
 
-  WORKER_SHM_CRITICAL_SECTION_END;
-
   return result;
 
 }
@@ -1,3 +1,7 @@
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <set>
 #include <sstream>
 /* required for string case insensitive comparison */
 #include <boost/algorithm/string/predicate.hpp>
@@ -55,6 +59,8 @@ std::vector<std::string> BackupCatalog::backupCatalogCols =
     "wal_segment_size",
     "used_profile",
     "pg_version_num",
+    "parent_id",
+    "compress_type",
 
     /* the following are computed columns with no materialized representation */
     "strftime('%H hours %M minutes %S seconds', julianday(stopped, 'utc') - julianday(started, 'utc'), '12:00') AS duration ",
@@ -87,7 +93,14 @@ std::vector<std::string>BackupCatalog::backupProfilesCatalogCols =
     "wait_for_wal",
     "noverify_checksums",
     "manifest",
-    "manifest_checksums"
+    "manifest_checksums",
+    "compress_level",
+    "compress_workers",
+    "parallel_writers",
+    "incremental",
+    "server_compression",
+    "adaptive_rate",
+    "deduplicate"
   };
 
 std::vector<std::string>BackupCatalog::backupTablespacesCatalogCols =
@@ -189,6 +202,23 @@ std::string BackupProfileDescr::compressionType(BackupProfileCompressType type)
 
 }
 
+int BackupProfileDescr::maxCompressionLevel(BackupProfileCompressType type) {
+
+  switch(type) {
+  case BACKUP_COMPRESS_TYPE_GZIP:
+  case BACKUP_COMPRESS_TYPE_XZ:
+    return 9;
+  case BACKUP_COMPRESS_TYPE_ZSTD:
+    return 22;
+  case BACKUP_COMPRESS_TYPE_LZ4:
+    return 12;
+  default:
+    /* NONE and PLAIN don't compress at all */
+    return 0;
+  }
+
+}
+
 BasicPinDescr::BasicPinDescr() {
   this->tag = EMPTY_DESCR;
 }
@@ -573,8 +603,13 @@ CatalogDescr& CatalogDescr::operator=(CatalogDescr& source) {
   this->compression = source.compression;
   this->directory = source.directory;
   this->check_connection = source.check_connection;
+  this->verify_workers = source.verify_workers;
+  this->log_layout_sharded = source.log_layout_sharded;
+  this->cold_directory = source.cold_directory;
+  this->retention_preview = source.retention_preview;
   this->force_systemid_update = source.force_systemid_update;
   this->forceXLOGPosRestart = source.forceXLOGPosRestart;
+  this->stream_archive_names = source.stream_archive_names;
   this->coninfo->pghost = source.coninfo->pghost;
   this->coninfo->pgport = source.coninfo->pgport;
   this->coninfo->pguser = source.coninfo->pguser;
@@ -640,6 +675,18 @@ CatalogDescr& CatalogDescr::operator=(CatalogDescr& source) {
   if (source.restoreDescr != nullptr)
     this->restoreDescr = source.restoreDescr;
 
+  /*
+   * Copy over schedule descriptor, if defined.
+   */
+  if (source.schedule != nullptr)
+    this->schedule = source.schedule;
+
+  /*
+   * Copy over object storage descriptor, if defined.
+   */
+  if (source.storage != nullptr)
+    this->storage = source.storage;
+
   /*
    * In case this instance was instantiated
    * by a SET <variable> parser command, copy
@@ -703,6 +750,43 @@ void CatalogDescr::restoreTablespaceAllFromParserState(std::string const& locati
 
 }
 
+void CatalogDescr::restoreTargetDirectoryFromParserState(std::string const& directory) {
+
+  if (this->restoreDescr == nullptr)
+    throw CCatalogIssue("cannot assign restore target directory, restore descriptor is undefined");
+
+  restoreDescr->target_directory = directory;
+
+}
+
+void CatalogDescr::createRestoreDescrByTarget(RestoreTargetType const& type,
+                                              std::string const& target) {
+
+  this->restoreDescr = std::make_shared<RestoreDescr>(type, target);
+
+}
+
+void CatalogDescr::restoreTargetTimelineFromParserState(std::string const& timeline) {
+
+  if (this->restoreDescr == nullptr)
+    throw CCatalogIssue("cannot assign recovery target timeline, restore descriptor is undefined");
+
+  restoreDescr->target_timeline = CPGBackupCtlBase::strToUInt(timeline);
+
+  if (restoreDescr->target_timeline == 0)
+    throw CCatalogIssue("invalid recovery target timeline 0");
+
+}
+
+void CatalogDescr::setRestorePreview(bool const& preview) {
+
+  if (this->restoreDescr == nullptr)
+    throw CCatalogIssue("cannot assign PREVIEW, restore descriptor is undefined");
+
+  restoreDescr->preview = preview;
+
+}
+
 void CatalogDescr::restoreTablespaceOidFromParserState(std::string const& oid) {
 
   if (this->restoreDescr == nullptr)
@@ -796,6 +880,9 @@ OutputFormatType CatalogDescr::getOutputFormat() {
   if (output_format == "json")
     return OUTPUT_JSON;
 
+  if (output_format == "ndjson")
+    return OUTPUT_JSON_LINES;
+
   if (output_format == "console")
     return OUTPUT_CONSOLE;
 
@@ -881,6 +968,10 @@ void CatalogDescr::setStreamingForceXLOGPositionRestart( bool const& restart ) {
   this->forceXLOGPosRestart = restart;
 }
 
+void CatalogDescr::pushStreamArchiveName( std::string const& archive_name ) {
+  this->stream_archive_names.push_back(archive_name);
+}
+
 PinOperationType CatalogDescr::pinOperation() {
 
   return this->pinDescr.getOperationType();
@@ -964,6 +1055,14 @@ void CatalogDescr::makeRuleFromParserState(string const &value) {
 
     break;
 
+  case RETENTION_ACTION_MOVE:
+
+    if (this->rps.modifier != RETENTION_MODIFIER_OLDER_DATETIME)
+      throw CCatalogIssue("a MOVE retention action requires OLDER THAN");
+
+    ruleId = RETENTION_MOVE_OLDER_BY_DATETIME;
+    break;
+
   default:
     throw CCatalogIssue("unexpected retention parser state");
   };
@@ -1129,6 +1228,17 @@ void CatalogDescr::retentionIntervalExprFromParserState(std::string const& expr_
       break;
     }
 
+  case RETENTION_ACTION_MOVE:
+    {
+
+      if (this->rps.modifier != RETENTION_MODIFIER_OLDER_DATETIME)
+        throw CCatalogIssue("unexpected retention action modifier in parser state");
+
+      operation = '-';
+      ruleid = RETENTION_MOVE_OLDER_BY_DATETIME;
+      break;
+    }
+
   default:
     throw CCatalogIssue("unexpected retention action in parser state");
   } /* switch */
@@ -1157,6 +1267,7 @@ void CatalogDescr::retentionIntervalExprFromParserState(std::string const& expr_
   case RETENTION_KEEP_OLDER_BY_DATETIME:
   case RETENTION_DROP_NEWER_BY_DATETIME:
   case RETENTION_DROP_OLDER_BY_DATETIME:
+  case RETENTION_MOVE_OLDER_BY_DATETIME:
     break;
   default:
     throw CCatalogIssue("interval expression requires DATETIME retention policy");
@@ -1317,6 +1428,28 @@ std::string CatalogDescr::commandTagName(CatalogTag tag) {
     return "RESTORE";
   case STAT_ARCHIVE_BASEBACKUP:
     return "STAT ARCHIVE";
+  case SHOW_STREAM_STATISTICS:
+    return "SHOW STREAM STATISTICS";
+  case VERIFY_BASEBACKUP:
+    return "VERIFY BASEBACKUP";
+  case ALTER_ARCHIVE_LOG_LAYOUT:
+    return "ALTER ARCHIVE LOG LAYOUT";
+  case CREATE_SCHEDULE:
+    return "CREATE SCHEDULE";
+  case DROP_SCHEDULE:
+    return "DROP SCHEDULE";
+  case LIST_SCHEDULES:
+    return "LIST SCHEDULES";
+  case CREATE_ARCHIVE_STORAGE:
+    return "CREATE STORAGE";
+  case DROP_ARCHIVE_STORAGE:
+    return "DROP STORAGE";
+  case LIST_UPLOADS:
+    return "LIST UPLOADS";
+  case UPLOAD_ARCHIVE:
+    return "UPLOAD ARCHIVE";
+  case ALTER_ARCHIVE_COLD_TIER:
+    return "ALTER ARCHIVE COLD TIER";
 
   default:
     return "UNKNOWN";
@@ -1384,6 +1517,41 @@ void CatalogDescr::setProfileCompressType(BackupProfileCompressType const& type)
   this->pushAffectedAttribute(SQL_BCK_PROF_COMPRESS_TYPE_ATTNO);
 }
 
+void CatalogDescr::setProfileCompressLevel(std::string const& level) {
+  this->backup_profile->compress_level = CPGBackupCtlBase::strToInt(level);
+  this->backup_profile->pushAffectedAttribute(SQL_BCK_PROF_COMPRESS_LEVEL_ATTNO);
+}
+
+void CatalogDescr::setProfileCompressWorkers(std::string const& workers) {
+  this->backup_profile->compress_workers = CPGBackupCtlBase::strToInt(workers);
+  this->backup_profile->pushAffectedAttribute(SQL_BCK_PROF_COMPRESS_WORKERS_ATTNO);
+}
+
+void CatalogDescr::setProfileParallelWriters(std::string const& writers) {
+  this->backup_profile->parallel_writers = CPGBackupCtlBase::strToInt(writers);
+  this->backup_profile->pushAffectedAttribute(SQL_BCK_PROF_PARALLEL_WRITERS_ATTNO);
+}
+
+void CatalogDescr::setProfileIncremental(bool const& incremental) {
+  this->backup_profile->incremental = incremental;
+  this->backup_profile->pushAffectedAttribute(SQL_BCK_PROF_INCREMENTAL_ATTNO);
+}
+
+void CatalogDescr::setProfileServerCompression(bool const& server_compression) {
+  this->backup_profile->server_compression = server_compression;
+  this->backup_profile->pushAffectedAttribute(SQL_BCK_PROF_SERVER_COMPRESSION_ATTNO);
+}
+
+void CatalogDescr::setProfileAdaptiveRate(bool const& adaptive_rate) {
+  this->backup_profile->adaptive_rate = adaptive_rate;
+  this->backup_profile->pushAffectedAttribute(SQL_BCK_PROF_ADAPTIVE_RATE_ATTNO);
+}
+
+void CatalogDescr::setProfileDeduplicate(bool const& deduplicate) {
+  this->backup_profile->deduplicate = deduplicate;
+  this->backup_profile->pushAffectedAttribute(SQL_BCK_PROF_DEDUPLICATE_ATTNO);
+}
+
 std::shared_ptr<BackupProfileDescr> CatalogDescr::getBackupProfileDescr() {
   return this->backup_profile;
 }
@@ -1437,6 +1605,243 @@ void CatalogDescr::setBasebackupID(std::string const &bbid) {
 
 }
 
+void CatalogDescr::setVerifyWorkers(std::string const& workers) {
+  this->verify_workers = CPGBackupCtlBase::strToInt(workers);
+}
+
+void CatalogDescr::setLogLayoutSharded(bool const& sharded) {
+  this->log_layout_sharded = sharded;
+}
+
+void CatalogDescr::setColdDirectory(std::string const& directory) {
+  this->cold_directory = directory;
+}
+
+void CatalogDescr::setRetentionPreview(bool const& preview) {
+  this->retention_preview = preview;
+}
+
+void CatalogDescr::makeScheduleDescr(ScheduleJobType const& type) {
+
+  if (this->schedule == nullptr)
+    this->schedule = std::make_shared<ScheduleDescr>();
+
+  this->schedule->type = type;
+
+}
+
+std::shared_ptr<ScheduleDescr> CatalogDescr::getScheduleDescr() {
+
+  return this->schedule;
+
+}
+
+void CatalogDescr::setScheduleInterval(std::string const& value) {
+
+  if (this->schedule == nullptr)
+    throw CCatalogIssue("schedule interval specified without a schedule");
+
+  this->schedule->interval = CPGBackupCtlBase::strToUInt(value);
+
+}
+
+void CatalogDescr::setScheduleIntervalUnit(unsigned int const& seconds) {
+
+  if (this->schedule == nullptr)
+    throw CCatalogIssue("schedule interval specified without a schedule");
+
+  this->schedule->interval *= seconds;
+
+}
+
+void CatalogDescr::setScheduleJitter(std::string const& value) {
+
+  if (this->schedule == nullptr)
+    throw CCatalogIssue("schedule jitter specified without a schedule");
+
+  this->schedule->jitter = CPGBackupCtlBase::strToUInt(value);
+
+}
+
+void CatalogDescr::setScheduleJitterUnit(unsigned int const& seconds) {
+
+  if (this->schedule == nullptr)
+    throw CCatalogIssue("schedule jitter specified without a schedule");
+
+  this->schedule->jitter *= seconds;
+
+}
+
+void CatalogDescr::setSchedulePriority(std::string const& value) {
+
+  if (this->schedule == nullptr)
+    throw CCatalogIssue("schedule priority specified without a schedule");
+
+  this->schedule->priority = CPGBackupCtlBase::strToInt(value);
+
+}
+
+std::string ScheduleDescr::typeName(ScheduleJobType type) {
+
+  switch(type) {
+  case SCHEDULE_BASEBACKUP:
+    return "basebackup";
+  case SCHEDULE_VERIFY:
+    return "verify";
+  }
+
+  return "unknown";
+
+}
+
+ScheduleJobType ScheduleDescr::typeFromName(std::string name) {
+
+  if (name == "basebackup")
+    return SCHEDULE_BASEBACKUP;
+
+  if (name == "verify")
+    return SCHEDULE_VERIFY;
+
+  throw CCatalogIssue("unknown schedule job type \"" + name + "\"");
+
+}
+
+void CatalogDescr::makeArchiveStorageDescr() {
+
+  if (this->storage == nullptr)
+    this->storage = std::make_shared<ArchiveStorageDescr>();
+
+}
+
+std::shared_ptr<ArchiveStorageDescr> CatalogDescr::getArchiveStorageDescr() {
+
+  return this->storage;
+
+}
+
+void CatalogDescr::setStorageEndpoint(std::string const& endpoint) {
+
+  if (this->storage == nullptr)
+    throw CCatalogIssue("storage endpoint specified without a storage");
+
+  this->storage->endpoint = endpoint;
+
+}
+
+void CatalogDescr::setStorageBucket(std::string const& bucket) {
+
+  if (this->storage == nullptr)
+    throw CCatalogIssue("storage bucket specified without a storage");
+
+  this->storage->bucket = bucket;
+
+}
+
+void CatalogDescr::setStoragePrefix(std::string const& prefix) {
+
+  if (this->storage == nullptr)
+    throw CCatalogIssue("storage prefix specified without a storage");
+
+  this->storage->prefix = prefix;
+
+}
+
+void CatalogDescr::setStorageRegion(std::string const& region) {
+
+  if (this->storage == nullptr)
+    throw CCatalogIssue("storage region specified without a storage");
+
+  this->storage->region = region;
+
+}
+
+void CatalogDescr::setStorageParallel(std::string const& parallel) {
+
+  if (this->storage == nullptr)
+    throw CCatalogIssue("storage parallel uploads specified without a storage");
+
+  this->storage->parallel = CPGBackupCtlBase::strToUInt(parallel);
+
+}
+
+void CatalogDescr::setStoragePartSize(std::string const& megabytes) {
+
+  if (this->storage == nullptr)
+    throw CCatalogIssue("storage part size specified without a storage");
+
+  this->storage->part_size = (unsigned long long) CPGBackupCtlBase::strToUInt(megabytes) * 1024 * 1024;
+
+}
+
+void CatalogDescr::setStorageMaxRate(std::string const& max_rate) {
+
+  if (this->storage == nullptr)
+    throw CCatalogIssue("storage max rate specified without a storage");
+
+  this->storage->max_rate = CPGBackupCtlBase::strToUInt(max_rate);
+
+}
+
+std::string UploadDescr::kindName(UploadKind kind) {
+
+  switch(kind) {
+  case UPLOAD_WAL:
+    return "wal";
+  case UPLOAD_BASEBACKUP:
+    return "basebackup";
+  }
+
+  return "unknown";
+
+}
+
+UploadKind UploadDescr::kindFromName(std::string name) {
+
+  if (name == "wal")
+    return UPLOAD_WAL;
+
+  if (name == "basebackup")
+    return UPLOAD_BASEBACKUP;
+
+  throw CCatalogIssue("unknown upload kind \"" + name + "\"");
+
+}
+
+std::string UploadDescr::statusName(UploadStatus status) {
+
+  switch(status) {
+  case UPLOAD_PENDING:
+    return "pending";
+  case UPLOAD_RUNNING:
+    return "uploading";
+  case UPLOAD_DONE:
+    return "uploaded";
+  case UPLOAD_FAILED:
+    return "failed";
+  }
+
+  return "unknown";
+
+}
+
+UploadStatus UploadDescr::statusFromName(std::string name) {
+
+  if (name == "pending")
+    return UPLOAD_PENDING;
+
+  if (name == "uploading")
+    return UPLOAD_RUNNING;
+
+  if (name == "uploaded")
+    return UPLOAD_DONE;
+
+  if (name == "failed")
+    return UPLOAD_FAILED;
+
+  throw CCatalogIssue("unknown upload status \"" + name + "\"");
+
+}
+
 void CatalogDescr::setForceSystemIDUpdate(bool const& force_sysid_update) {
   this->force_systemid_update = force_sysid_update;
 }
@@ -1574,12 +1979,25 @@ std::string BackupCatalog::name() {
 void BackupCatalog::startTransaction() {
 
   int rc;
+  std::string sql = "BEGIN TRANSACTION EXCLUSIVE;";
 
   if (!this->available())
     throw CCatalogIssue("catalog database not opened");
 
+  /*
+   * SQLite doesn't nest transactions, so a transaction started
+   * within another one is a savepoint. SQLite might have rolled
+   * back a transaction on its own after an error, so check
+   * whether there's one in progress at all.
+   */
+  if (sqlite3_get_autocommit(this->db_handle))
+    this->tx_depth = 0;
+
+  if (this->tx_depth > 0)
+    sql = "SAVEPOINT pgbckctl_tx_" + std::to_string(this->tx_depth) + ";";
+
   rc = sqlite3_exec(this->db_handle,
-                    "BEGIN TRANSACTION EXCLUSIVE;",
+                    sql.c_str(),
                     NULL,
                     NULL,
                     NULL);
@@ -1589,17 +2007,32 @@ void BackupCatalog::startTransaction() {
     oss << "error starting catalog transaction: " << sqlite3_errmsg(this->db_handle);
     throw CCatalogIssue(oss.str());
   }
+
+  this->tx_depth++;
+}
+
+bool BackupCatalog::inTransaction() {
+
+  return (this->available() && !sqlite3_get_autocommit(this->db_handle));
+
 }
 
 void BackupCatalog::commitTransaction() {
 
   int rc;
+  std::string sql = "COMMIT;";
 
   if (!this->available())
     throw CCatalogIssue("catalog database not opened");
 
+  if (sqlite3_get_autocommit(this->db_handle))
+    this->tx_depth = 0;
+
+  if (this->tx_depth > 1)
+    sql = "RELEASE pgbckctl_tx_" + std::to_string(this->tx_depth - 1) + ";";
+
   rc = sqlite3_exec(this->db_handle,
-                    "COMMIT;",
+                    sql.c_str(),
                     NULL, NULL, NULL);
 
   if (rc != SQLITE_OK) {
@@ -1608,18 +2041,30 @@ void BackupCatalog::commitTransaction() {
     throw CCatalogIssue(oss.str());
   }
 
+  if (this->tx_depth > 0)
+    this->tx_depth--;
+
 }
 
 void BackupCatalog::rollbackTransaction() {
 
   int rc;
+  std::string sql = "ROLLBACK;";
 
   if (!this->available()) {
     throw CCatalogIssue("catalog database not opened");
   }
 
+  if (sqlite3_get_autocommit(this->db_handle))
+    this->tx_depth = 0;
+
+  if (this->tx_depth > 1) {
+    std::string savepoint = "pgbckctl_tx_" + std::to_string(this->tx_depth - 1);
+    sql = "ROLLBACK TO " + savepoint + "; RELEASE " + savepoint + ";";
+  }
+
   rc = sqlite3_exec(this->db_handle,
-                    "ROLLBACK;",
+                    sql.c_str(),
                     NULL, NULL, NULL);
 
   if (rc != SQLITE_OK) {
@@ -1628,6 +2073,9 @@ void BackupCatalog::rollbackTransaction() {
     throw CCatalogIssue(oss.str());
   }
 
+  if (this->tx_depth > 0)
+    this->tx_depth--;
+
 }
 
 std::shared_ptr<CatalogProc> BackupCatalog::fetchCatalogProcData(sqlite3_stmt *stmt,
@@ -1932,6 +2380,25 @@ std::shared_ptr<BaseBackupDescr> BackupCatalog::fetchBackupIntoDescr(sqlite3_stm
       descr->used_profile = sqlite3_column_int(stmt, current_stmt_col);
       break;
 
+    case SQL_BACKUP_PG_VERSION_NUM_ATTNO:
+      descr->pg_version_num = sqlite3_column_int(stmt, current_stmt_col);
+      break;
+
+    case SQL_BACKUP_PARENT_ID_ATTNO:
+      {
+        /* NULL for full basebackups */
+        if (sqlite3_column_type(stmt, current_stmt_col) != SQLITE_NULL)
+          descr->parent_id = sqlite3_column_int(stmt, current_stmt_col);
+        else
+          descr->parent_id = -1;
+
+        break;
+      }
+
+    case SQL_BACKUP_COMPRESS_TYPE_ATTNO:
+      descr->compress_type = (BackupProfileCompressType) sqlite3_column_int(stmt, current_stmt_col);
+      break;
+
     case SQL_BACKUP_COMPUTED_RETENTION_DATETIME:
 
       /* this column tag identifies a computed value, be aware for nullable expressions */
@@ -2042,6 +2509,34 @@ std::shared_ptr<BackupProfileDescr> BackupCatalog::fetchBackupProfileIntoDescr(s
       descr->manifest_checksums = (char *)sqlite3_column_text(stmt, current_stmt_col);
       break;
 
+    case SQL_BCK_PROF_COMPRESS_LEVEL_ATTNO:
+      descr->compress_level = sqlite3_column_int(stmt, current_stmt_col);
+      break;
+
+    case SQL_BCK_PROF_COMPRESS_WORKERS_ATTNO:
+      descr->compress_workers = sqlite3_column_int(stmt, current_stmt_col);
+      break;
+
+    case SQL_BCK_PROF_PARALLEL_WRITERS_ATTNO:
+      descr->parallel_writers = sqlite3_column_int(stmt, current_stmt_col);
+      break;
+
+    case SQL_BCK_PROF_INCREMENTAL_ATTNO:
+      descr->incremental = sqlite3_column_int(stmt, current_stmt_col);
+      break;
+
+    case SQL_BCK_PROF_SERVER_COMPRESSION_ATTNO:
+      descr->server_compression = sqlite3_column_int(stmt, current_stmt_col);
+      break;
+
+    case SQL_BCK_PROF_ADAPTIVE_RATE_ATTNO:
+      descr->adaptive_rate = sqlite3_column_int(stmt, current_stmt_col);
+      break;
+
+    case SQL_BCK_PROF_DEDUPLICATE_ATTNO:
+      descr->deduplicate = sqlite3_column_int(stmt, current_stmt_col);
+      break;
+
     default:
       break;
     }
@@ -2357,9 +2852,15 @@ std::shared_ptr<StatCatalogArchive> BackupCatalog::statCatalog(std::string archi
           "END AS val_avg_duration "
    "FROM "
    "backup b "
-   "WHERE b.archive_id = a.id) AS avg_duration "
+   "WHERE b.archive_id = a.id) AS avg_duration, "
+  "COALESCE(s.wal_bytes, 0), "
+  "COALESCE(s.wal_segments, 0), "
+  "s.oldest_xlogpos, "
+  "s.newest_xlogpos, "
+  "COALESCE(s.backup_bytes, 0) "
 "FROM "
   "archive a JOIN connections c ON c.archive_id = a.id "
+  "LEFT JOIN archive_stats s ON s.archive_id = a.id "
 "WHERE "
   "a.name = ?1 AND c.type = 'basebackup';";
 
@@ -2413,13 +2914,28 @@ std::shared_ptr<StatCatalogArchive> BackupCatalog::statCatalog(std::string archi
   if (sqlite3_column_type(stmt, 6) != SQLITE_NULL)
     result->archive_host      = (char *) sqlite3_column_text(stmt, 6);
 
-  result->estimated_total_size = sqlite3_column_int(stmt, 7);
+  result->estimated_total_size = sqlite3_column_int64(stmt, 7);
 
   if (sqlite3_column_type(stmt, 8) != SQLITE_NULL)
     result->latest_finished      = (char *) sqlite3_column_text(stmt, 8);
 
   result->avg_backup_duration  = sqlite3_column_int(stmt, 9);
 
+  /*
+   * Materialised statistics, maintained by streamers, basebackups
+   * and retention, see getArchiveStats().
+   */
+  result->wal_bytes    = sqlite3_column_int64(stmt, 10);
+  result->wal_segments = sqlite3_column_int64(stmt, 11);
+
+  if (sqlite3_column_type(stmt, 12) != SQLITE_NULL)
+    result->oldest_xlogpos = (char *) sqlite3_column_text(stmt, 12);
+
+  if (sqlite3_column_type(stmt, 13) != SQLITE_NULL)
+    result->newest_xlogpos = (char *) sqlite3_column_text(stmt, 13);
+
+  result->backup_bytes = sqlite3_column_int64(stmt, 14);
+
   /*
    * We're done.
    */
@@ -2428,25 +2944,1251 @@ std::shared_ptr<StatCatalogArchive> BackupCatalog::statCatalog(std::string archi
   return result;
 }
 
-void BackupCatalog::dropRetentionPolicy(string retention_name) {
+void BackupCatalog::statCatalogArchives(std::vector<std::shared_ptr<StatCatalogArchive>> &list) {
 
-  sqlite3_stmt *stmt = NULL;
-  ostringstream delete_sql;
   int rc;
+  sqlite3_stmt *stmt;
 
-  /*
-   * Database available ?
-   */
   if (!this->available()) {
-    throw CArchiveIssue("catalog database not opened");
+    throw CCatalogIssue("catalog database not opened");
   }
 
-  if (retention_name.length() < 1) {
-    throw CArchiveIssue("cannot drop retention policy with empty identifier");
-  }
+  stmt = this->cachedStatement("statCatalogArchives", {}, []() {
+      return std::string("SELECT a.id, a.name, COUNT(b.id), "
+                         "COALESCE(SUM(b.status = 'aborted'), 0), "
+                         "COALESCE(SUM(b.status = 'in progress'), 0), "
+                         "MAX(b.stopped), "
+                         "COALESCE(s.wal_bytes, 0), "
+                         "COALESCE(s.wal_segments, 0), "
+                         "COALESCE(s.backup_bytes, 0) "
+                         "FROM archive a "
+                         "LEFT JOIN backup b ON b.archive_id = a.id "
+                         "LEFT JOIN archive_stats s ON s.archive_id = a.id "
+                         "GROUP BY a.id ORDER BY a.name;");
+    });
 
-  /*
-   * Compose SQL string for deletion...
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+
+    std::shared_ptr<StatCatalogArchive> stat = std::make_shared<StatCatalogArchive>();
+
+    stat->archive_id        = sqlite3_column_int(stmt, 0);
+    stat->archive_name      = (char *) sqlite3_column_text(stmt, 1);
+    stat->number_of_backups = sqlite3_column_int(stmt, 2);
+    stat->backups_failed    = sqlite3_column_int(stmt, 3);
+    stat->backups_running   = sqlite3_column_int(stmt, 4);
+
+    if (sqlite3_column_type(stmt, 5) != SQLITE_NULL)
+      stat->latest_finished = (char *) sqlite3_column_text(stmt, 5);
+
+    stat->wal_bytes    = sqlite3_column_int64(stmt, 6);
+    stat->wal_segments = sqlite3_column_int64(stmt, 7);
+    stat->backup_bytes = sqlite3_column_int64(stmt, 8);
+
+    list.push_back(stat);
+
+  }
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not read archive statistics: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+void BackupCatalog::initArchiveStats(int archive_id) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  std::string ts = CPGBackupCtlBase::current_timestamp();
+
+  stmt = this->cachedStatement("initArchiveStats", {}, []() {
+      return std::string("INSERT OR IGNORE INTO archive_stats(archive_id, updated) "
+                         "VALUES(?1, ?2);");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+  sqlite3_bind_text(stmt, 2, ts.c_str(), -1, SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not initialize archive statistics: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+std::shared_ptr<ArchiveStatsDescr> BackupCatalog::getArchiveStats(int archive_id) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  std::shared_ptr<ArchiveStatsDescr> result = std::make_shared<ArchiveStatsDescr>();
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("getArchiveStats", {}, []() {
+      return std::string("SELECT archive_id, wal_bytes, wal_segments, oldest_xlogpos, "
+                         "newest_xlogpos, backup_bytes, updated "
+                         "FROM archive_stats WHERE archive_id = ?1;");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc == SQLITE_ROW) {
+
+    result->archive_id   = sqlite3_column_int(stmt, 0);
+    result->wal_bytes    = sqlite3_column_int64(stmt, 1);
+    result->wal_segments = sqlite3_column_int64(stmt, 2);
+
+    if (sqlite3_column_type(stmt, 3) != SQLITE_NULL)
+      result->oldest_xlogpos = (char *) sqlite3_column_text(stmt, 3);
+
+    if (sqlite3_column_type(stmt, 4) != SQLITE_NULL)
+      result->newest_xlogpos = (char *) sqlite3_column_text(stmt, 4);
+
+    result->backup_bytes = sqlite3_column_int64(stmt, 5);
+    result->updated      = (char *) sqlite3_column_text(stmt, 6);
+
+  } else if (rc != SQLITE_DONE) {
+
+    std::ostringstream oss;
+    oss << "could not read archive statistics: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+
+  }
+
+  this->releaseStatement(stmt);
+  return result;
+
+}
+
+void BackupCatalog::setArchiveWALStats(std::shared_ptr<ArchiveStatsDescr> stats) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  std::string ts = CPGBackupCtlBase::current_timestamp();
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  if (stats == nullptr || stats->archive_id < 0)
+    throw CCatalogIssue("cannot set statistics of undefined archive");
+
+  this->initArchiveStats(stats->archive_id);
+
+  stmt = this->cachedStatement("setArchiveWALStats", {}, []() {
+      return std::string("UPDATE archive_stats SET wal_bytes = ?2, wal_segments = ?3, "
+                         "oldest_xlogpos = ?4, newest_xlogpos = ?5, updated = ?6 "
+                         "WHERE archive_id = ?1;");
+    });
+
+  sqlite3_bind_int(stmt, 1, stats->archive_id);
+  sqlite3_bind_int64(stmt, 2, stats->wal_bytes);
+  sqlite3_bind_int64(stmt, 3, stats->wal_segments);
+
+  if (stats->oldest_xlogpos.length() > 0)
+    sqlite3_bind_text(stmt, 4, stats->oldest_xlogpos.c_str(), -1, SQLITE_STATIC);
+  else
+    sqlite3_bind_null(stmt, 4);
+
+  if (stats->newest_xlogpos.length() > 0)
+    sqlite3_bind_text(stmt, 5, stats->newest_xlogpos.c_str(), -1, SQLITE_STATIC);
+  else
+    sqlite3_bind_null(stmt, 5);
+
+  sqlite3_bind_text(stmt, 6, ts.c_str(), -1, SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not update archive statistics: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+void BackupCatalog::updateArchiveWALStats(int archive_id,
+                                          unsigned long long bytes,
+                                          unsigned long long segments,
+                                          std::string oldest_xlogpos,
+                                          std::string newest_xlogpos) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  std::string ts = CPGBackupCtlBase::current_timestamp();
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  this->initArchiveStats(archive_id);
+
+  stmt = this->cachedStatement("updateArchiveWALStats", {}, []() {
+      return std::string("UPDATE archive_stats SET wal_bytes = wal_bytes + ?2, "
+                         "wal_segments = wal_segments + ?3, "
+                         "oldest_xlogpos = COALESCE(oldest_xlogpos, ?4), "
+                         "newest_xlogpos = COALESCE(?5, newest_xlogpos), "
+                         "updated = ?6 "
+                         "WHERE archive_id = ?1;");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+  sqlite3_bind_int64(stmt, 2, bytes);
+  sqlite3_bind_int64(stmt, 3, segments);
+
+  if (oldest_xlogpos.length() > 0)
+    sqlite3_bind_text(stmt, 4, oldest_xlogpos.c_str(), -1, SQLITE_STATIC);
+  else
+    sqlite3_bind_null(stmt, 4);
+
+  if (newest_xlogpos.length() > 0)
+    sqlite3_bind_text(stmt, 5, newest_xlogpos.c_str(), -1, SQLITE_STATIC);
+  else
+    sqlite3_bind_null(stmt, 5);
+
+  sqlite3_bind_text(stmt, 6, ts.c_str(), -1, SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not update archive statistics: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+void BackupCatalog::registerBackupStats(std::shared_ptr<BaseBackupDescr> bbdescr,
+                                        unsigned long long size) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  std::string ts = CPGBackupCtlBase::current_timestamp();
+  unsigned long long prev_size = 0;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  if (bbdescr == nullptr || bbdescr->id < 0 || bbdescr->archive_id < 0)
+    throw CCatalogIssue("cannot record statistics of undefined basebackup");
+
+  prev_size = this->getBackupSize(bbdescr->id);
+
+  stmt = this->cachedStatement("registerBackupStats", {}, []() {
+      return std::string("INSERT OR REPLACE INTO backup_stats(backup_id, size, updated) "
+                         "VALUES(?1, ?2, ?3);");
+    });
+
+  sqlite3_bind_int(stmt, 1, bbdescr->id);
+  sqlite3_bind_int64(stmt, 2, size);
+  sqlite3_bind_text(stmt, 3, ts.c_str(), -1, SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not record basebackup statistics: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+  /*
+   * Account the difference in the archive, a basebackup
+   * might have been measured before.
+   */
+  this->initArchiveStats(bbdescr->archive_id);
+
+  stmt = this->cachedStatement("updateArchiveBackupStats", {}, []() {
+      return std::string("UPDATE archive_stats SET backup_bytes = MAX(backup_bytes + ?2, 0), "
+                         "updated = ?3 WHERE archive_id = ?1;");
+    });
+
+  sqlite3_bind_int(stmt, 1, bbdescr->archive_id);
+  sqlite3_bind_int64(stmt, 2, (sqlite3_int64) size - (sqlite3_int64) prev_size);
+  sqlite3_bind_text(stmt, 3, ts.c_str(), -1, SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not update archive statistics: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+unsigned long long BackupCatalog::getBackupSize(int basebackup_id) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  unsigned long long result = 0;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("getBackupSize", {}, []() {
+      return std::string("SELECT size FROM backup_stats WHERE backup_id = ?1;");
+    });
+
+  sqlite3_bind_int(stmt, 1, basebackup_id);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc == SQLITE_ROW) {
+
+    result = sqlite3_column_int64(stmt, 0);
+
+  } else if (rc != SQLITE_DONE) {
+
+    std::ostringstream oss;
+    oss << "could not read basebackup statistics: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+
+  }
+
+  this->releaseStatement(stmt);
+  return result;
+
+}
+
+std::shared_ptr<ScheduleDescr> BackupCatalog::fetchSchedule(sqlite3_stmt *stmt) {
+
+  std::shared_ptr<ScheduleDescr> schedule = std::make_shared<ScheduleDescr>();
+
+  schedule->id           = sqlite3_column_int(stmt, 0);
+  schedule->archive_id   = sqlite3_column_int(stmt, 1);
+  schedule->archive_name = (char *) sqlite3_column_text(stmt, 2);
+  schedule->type         = ScheduleDescr::typeFromName((char *) sqlite3_column_text(stmt, 3));
+
+  if (sqlite3_column_type(stmt, 4) != SQLITE_NULL)
+    schedule->profile_name = (char *) sqlite3_column_text(stmt, 4);
+
+  schedule->interval = sqlite3_column_int(stmt, 5);
+  schedule->jitter   = sqlite3_column_int(stmt, 6);
+  schedule->priority = sqlite3_column_int(stmt, 7);
+
+  if (sqlite3_column_type(stmt, 8) != SQLITE_NULL)
+    schedule->next_run = (char *) sqlite3_column_text(stmt, 8);
+
+  if (sqlite3_column_type(stmt, 9) != SQLITE_NULL)
+    schedule->last_run = (char *) sqlite3_column_text(stmt, 9);
+
+  schedule->created = (char *) sqlite3_column_text(stmt, 10);
+
+  return schedule;
+
+}
+
+void BackupCatalog::createSchedule(std::shared_ptr<ScheduleDescr> schedule) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  if (schedule == nullptr || schedule->archive_id < 0)
+    throw CCatalogIssue("cannot create schedule for undefined archive");
+
+  if (schedule->interval == 0)
+    throw CCatalogIssue("schedule interval must be greater than zero");
+
+  schedule->created = CPGBackupCtlBase::current_timestamp();
+
+  stmt = this->cachedStatement("createSchedule", {}, []() {
+      return std::string("INSERT INTO schedule(archive_id, type, profile, interval, "
+                         "jitter, priority, created) "
+                         "VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7);");
+    });
+
+  std::string type_name = ScheduleDescr::typeName(schedule->type);
+
+  sqlite3_bind_int(stmt, 1, schedule->archive_id);
+  sqlite3_bind_text(stmt, 2, type_name.c_str(), -1, SQLITE_STATIC);
+
+  if (schedule->profile_name.length() > 0)
+    sqlite3_bind_text(stmt, 3, schedule->profile_name.c_str(), -1, SQLITE_STATIC);
+  else
+    sqlite3_bind_null(stmt, 3);
+
+  sqlite3_bind_int(stmt, 4, schedule->interval);
+  sqlite3_bind_int(stmt, 5, schedule->jitter);
+  sqlite3_bind_int(stmt, 6, schedule->priority);
+  sqlite3_bind_text(stmt, 7, schedule->created.c_str(), -1, SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not create schedule: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  schedule->id = sqlite3_last_insert_rowid(this->db_handle);
+  this->releaseStatement(stmt);
+
+}
+
+void BackupCatalog::dropSchedule(int archive_id, ScheduleJobType type) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  std::string type_name = ScheduleDescr::typeName(type);
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("dropSchedule", {}, []() {
+      return std::string("DELETE FROM schedule WHERE archive_id = ?1 AND type = ?2;");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+  sqlite3_bind_text(stmt, 2, type_name.c_str(), -1, SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not drop schedule: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+std::shared_ptr<ScheduleDescr> BackupCatalog::getSchedule(int archive_id, ScheduleJobType type) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  std::shared_ptr<ScheduleDescr> result = std::make_shared<ScheduleDescr>();
+  std::string type_name = ScheduleDescr::typeName(type);
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("getSchedule", {}, []() {
+      return std::string("SELECT s.id, s.archive_id, a.name, s.type, s.profile, s.interval, "
+                         "s.jitter, s.priority, s.next_run, s.last_run, s.created "
+                         "FROM schedule s JOIN archive a ON a.id = s.archive_id "
+                         "WHERE s.archive_id = ?1 AND s.type = ?2;");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+  sqlite3_bind_text(stmt, 2, type_name.c_str(), -1, SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc == SQLITE_ROW) {
+
+    try {
+      result = this->fetchSchedule(stmt);
+    } catch (CCatalogIssue &e) {
+      this->releaseStatement(stmt);
+      throw e;
+    }
+
+  } else if (rc != SQLITE_DONE) {
+
+    std::ostringstream oss;
+    oss << "could not read schedule: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+
+  }
+
+  this->releaseStatement(stmt);
+  return result;
+
+}
+
+void BackupCatalog::getSchedules(std::vector<std::shared_ptr<ScheduleDescr>> &list) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("getSchedules", {}, []() {
+      return std::string("SELECT s.id, s.archive_id, a.name, s.type, s.profile, s.interval, "
+                         "s.jitter, s.priority, s.next_run, s.last_run, s.created "
+                         "FROM schedule s JOIN archive a ON a.id = s.archive_id "
+                         "ORDER BY a.name, s.type;");
+    });
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+
+    try {
+      list.push_back(this->fetchSchedule(stmt));
+    } catch (CCatalogIssue &e) {
+      this->releaseStatement(stmt);
+      throw e;
+    }
+
+  }
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not read schedules: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+void BackupCatalog::updateScheduleRun(int schedule_id,
+                                      std::string next_run,
+                                      std::string last_run) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("updateScheduleRun", {}, []() {
+      return std::string("UPDATE schedule SET next_run = ?2, "
+                         "last_run = COALESCE(?3, last_run) WHERE id = ?1;");
+    });
+
+  sqlite3_bind_int(stmt, 1, schedule_id);
+  sqlite3_bind_text(stmt, 2, next_run.c_str(), -1, SQLITE_STATIC);
+
+  if (last_run.length() > 0)
+    sqlite3_bind_text(stmt, 3, last_run.c_str(), -1, SQLITE_STATIC);
+  else
+    sqlite3_bind_null(stmt, 3);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not update schedule: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+std::shared_ptr<ArchiveStorageDescr> BackupCatalog::fetchArchiveStorage(sqlite3_stmt *stmt) {
+
+  std::shared_ptr<ArchiveStorageDescr> storage = std::make_shared<ArchiveStorageDescr>();
+
+  storage->archive_id   = sqlite3_column_int(stmt, 0);
+  storage->archive_name = (char *) sqlite3_column_text(stmt, 1);
+  storage->endpoint     = (char *) sqlite3_column_text(stmt, 2);
+  storage->bucket       = (char *) sqlite3_column_text(stmt, 3);
+  storage->prefix       = (char *) sqlite3_column_text(stmt, 4);
+  storage->region       = (char *) sqlite3_column_text(stmt, 5);
+  storage->parallel     = sqlite3_column_int(stmt, 6);
+  storage->part_size    = sqlite3_column_int64(stmt, 7);
+  storage->max_rate     = sqlite3_column_int(stmt, 8);
+  storage->created      = (char *) sqlite3_column_text(stmt, 9);
+
+  return storage;
+
+}
+
+void BackupCatalog::createArchiveStorage(std::shared_ptr<ArchiveStorageDescr> storage) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  if (storage == nullptr || storage->archive_id < 0)
+    throw CCatalogIssue("cannot create storage for undefined archive");
+
+  storage->created = CPGBackupCtlBase::current_timestamp();
+
+  stmt = this->cachedStatement("createArchiveStorage", {}, []() {
+      return std::string("INSERT INTO archive_storage(archive_id, endpoint, bucket, prefix, "
+                         "region, parallel, part_size, max_rate, created) "
+                         "VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9);");
+    });
+
+  sqlite3_bind_int(stmt, 1, storage->archive_id);
+  sqlite3_bind_text(stmt, 2, storage->endpoint.c_str(), -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 3, storage->bucket.c_str(), -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 4, storage->prefix.c_str(), -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 5, storage->region.c_str(), -1, SQLITE_STATIC);
+  sqlite3_bind_int(stmt, 6, storage->parallel);
+  sqlite3_bind_int64(stmt, 7, storage->part_size);
+  sqlite3_bind_int(stmt, 8, storage->max_rate);
+  sqlite3_bind_text(stmt, 9, storage->created.c_str(), -1, SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not create storage: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+void BackupCatalog::dropArchiveStorage(int archive_id) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  /*
+   * Uploads without a storage would hold back retention
+   * forever, so they go, too.
+   */
+  stmt = this->cachedStatement("dropArchiveStorageUploads", {}, []() {
+      return std::string("DELETE FROM upload WHERE archive_id = ?1;");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not drop uploads: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+  stmt = this->cachedStatement("dropArchiveStorage", {}, []() {
+      return std::string("DELETE FROM archive_storage WHERE archive_id = ?1;");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not drop storage: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+std::shared_ptr<ArchiveStorageDescr> BackupCatalog::getArchiveStorage(int archive_id) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  std::shared_ptr<ArchiveStorageDescr> result = std::make_shared<ArchiveStorageDescr>();
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("getArchiveStorage", {}, []() {
+      return std::string("SELECT s.archive_id, a.name, s.endpoint, s.bucket, s.prefix, "
+                         "s.region, s.parallel, s.part_size, s.max_rate, s.created "
+                         "FROM archive_storage s JOIN archive a ON a.id = s.archive_id "
+                         "WHERE s.archive_id = ?1;");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc == SQLITE_ROW) {
+
+    result = this->fetchArchiveStorage(stmt);
+
+  } else if (rc != SQLITE_DONE) {
+
+    std::ostringstream oss;
+    oss << "could not read storage: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+
+  }
+
+  this->releaseStatement(stmt);
+  return result;
+
+}
+
+void BackupCatalog::getArchiveStoragesWithPendingUploads(std::vector<std::shared_ptr<ArchiveStorageDescr>> &list,
+                                                         unsigned int max_attempts) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("getArchiveStoragesWithPendingUploads", {}, []() {
+      return std::string("SELECT s.archive_id, a.name, s.endpoint, s.bucket, s.prefix, "
+                         "s.region, s.parallel, s.part_size, s.max_rate, s.created "
+                         "FROM archive_storage s JOIN archive a ON a.id = s.archive_id "
+                         "WHERE EXISTS(SELECT 1 FROM upload u WHERE u.archive_id = s.archive_id "
+                         "AND u.status <> 'uploaded' AND u.attempts < ?1) ORDER BY a.name;");
+    });
+
+  sqlite3_bind_int(stmt, 1, max_attempts);
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    list.push_back(this->fetchArchiveStorage(stmt));
+  }
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not read storages: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+std::shared_ptr<UploadDescr> BackupCatalog::fetchUpload(sqlite3_stmt *stmt) {
+
+  std::shared_ptr<UploadDescr> upload = std::make_shared<UploadDescr>();
+
+  upload->id           = sqlite3_column_int(stmt, 0);
+  upload->archive_id   = sqlite3_column_int(stmt, 1);
+  upload->archive_name = (char *) sqlite3_column_text(stmt, 2);
+  upload->kind         = UploadDescr::kindFromName((char *) sqlite3_column_text(stmt, 3));
+
+  if (sqlite3_column_type(stmt, 4) != SQLITE_NULL)
+    upload->basebackup_id = sqlite3_column_int(stmt, 4);
+
+  upload->path       = (char *) sqlite3_column_text(stmt, 5);
+  upload->object_key = (char *) sqlite3_column_text(stmt, 6);
+  upload->size       = sqlite3_column_int64(stmt, 7);
+  upload->status     = UploadDescr::statusFromName((char *) sqlite3_column_text(stmt, 8));
+
+  if (sqlite3_column_type(stmt, 9) != SQLITE_NULL)
+    upload->upload_id = (char *) sqlite3_column_text(stmt, 9);
+
+  upload->attempts = sqlite3_column_int(stmt, 10);
+
+  if (sqlite3_column_type(stmt, 11) != SQLITE_NULL)
+    upload->last_error = (char *) sqlite3_column_text(stmt, 11);
+
+  upload->queued  = (char *) sqlite3_column_text(stmt, 12);
+  upload->updated = (char *) sqlite3_column_text(stmt, 13);
+
+  return upload;
+
+}
+
+void BackupCatalog::queueUpload(std::shared_ptr<UploadDescr> upload) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  if (upload == nullptr || upload->archive_id < 0)
+    throw CCatalogIssue("cannot queue upload for undefined archive");
+
+  upload->queued = upload->updated = CPGBackupCtlBase::current_timestamp();
+
+  stmt = this->cachedStatement("queueUpload", {}, []() {
+      return std::string("INSERT OR IGNORE INTO upload(archive_id, kind, backup_id, path, "
+                         "object_key, size, status, queued, updated) "
+                         "VALUES(?1, ?2, ?3, ?4, ?5, ?6, 'pending', ?7, ?7);");
+    });
+
+  std::string kind_name = UploadDescr::kindName(upload->kind);
+
+  sqlite3_bind_int(stmt, 1, upload->archive_id);
+  sqlite3_bind_text(stmt, 2, kind_name.c_str(), -1, SQLITE_STATIC);
+
+  if (upload->basebackup_id >= 0)
+    sqlite3_bind_int(stmt, 3, upload->basebackup_id);
+  else
+    sqlite3_bind_null(stmt, 3);
+
+  sqlite3_bind_text(stmt, 4, upload->path.c_str(), -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 5, upload->object_key.c_str(), -1, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 6, upload->size);
+  sqlite3_bind_text(stmt, 7, upload->queued.c_str(), -1, SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not queue upload: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  upload->id = (sqlite3_changes(this->db_handle) > 0) ? sqlite3_last_insert_rowid(this->db_handle) : -1;
+  upload->status = UPLOAD_PENDING;
+  this->releaseStatement(stmt);
+
+}
+
+void BackupCatalog::getUploads(int archive_id,
+                               std::vector<std::shared_ptr<UploadDescr>> &list,
+                               bool pending_only,
+                               unsigned int limit) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("getUploads", {}, []() {
+      return std::string("SELECT u.id, u.archive_id, a.name, u.kind, u.backup_id, u.path, "
+                         "u.object_key, u.size, u.status, u.upload_id, u.attempts, "
+                         "u.last_error, u.queued, u.updated "
+                         "FROM upload u JOIN archive a ON a.id = u.archive_id "
+                         "WHERE (?1 < 0 OR u.archive_id = ?1) "
+                         "AND (?2 = 0 OR u.status <> 'uploaded') "
+                         "ORDER BY u.id LIMIT ?3;");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+  sqlite3_bind_int(stmt, 2, pending_only ? 1 : 0);
+  sqlite3_bind_int64(stmt, 3, (limit > 0) ? (sqlite3_int64) limit : -1);
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+
+    try {
+      list.push_back(this->fetchUpload(stmt));
+    } catch (CCatalogIssue &e) {
+      this->releaseStatement(stmt);
+      throw e;
+    }
+
+  }
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not read uploads: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+void BackupCatalog::updateUploadStatus(std::shared_ptr<UploadDescr> upload) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  upload->updated = CPGBackupCtlBase::current_timestamp();
+
+  stmt = this->cachedStatement("updateUploadStatus", {}, []() {
+      return std::string("UPDATE upload SET status = ?2, upload_id = ?3, attempts = ?4, "
+                         "last_error = ?5, updated = ?6, size = ?7 WHERE id = ?1;");
+    });
+
+  std::string status_name = UploadDescr::statusName(upload->status);
+
+  sqlite3_bind_int(stmt, 1, upload->id);
+  sqlite3_bind_text(stmt, 2, status_name.c_str(), -1, SQLITE_STATIC);
+
+  if (upload->upload_id.length() > 0)
+    sqlite3_bind_text(stmt, 3, upload->upload_id.c_str(), -1, SQLITE_STATIC);
+  else
+    sqlite3_bind_null(stmt, 3);
+
+  sqlite3_bind_int(stmt, 4, upload->attempts);
+
+  if (upload->last_error.length() > 0)
+    sqlite3_bind_text(stmt, 5, upload->last_error.c_str(), -1, SQLITE_STATIC);
+  else
+    sqlite3_bind_null(stmt, 5);
+
+  sqlite3_bind_text(stmt, 6, upload->updated.c_str(), -1, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 7, upload->size);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not update upload: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+void BackupCatalog::deleteUpload(int upload_id) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("deleteUpload", {}, []() {
+      return std::string("DELETE FROM upload WHERE id = ?1;");
+    });
+
+  sqlite3_bind_int(stmt, 1, upload_id);
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not delete upload: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+std::string BackupCatalog::getArchiveColdDirectory(int archive_id) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  std::string result = "";
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("getArchiveColdDirectory", {}, []() {
+      return std::string("SELECT directory FROM archive_tier WHERE archive_id = ?1;");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+  rc = sqlite3_step(stmt);
+
+  if (rc == SQLITE_ROW) {
+
+    result = (char *) sqlite3_column_text(stmt, 0);
+
+  } else if (rc != SQLITE_DONE) {
+
+    std::ostringstream oss;
+    oss << "could not read cold tier: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+
+  }
+
+  this->releaseStatement(stmt);
+  return result;
+
+}
+
+void BackupCatalog::setArchiveColdDirectory(int archive_id, std::string directory) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  std::string created = CPGBackupCtlBase::current_timestamp();
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("setArchiveColdDirectory", {}, []() {
+      return std::string("INSERT OR REPLACE INTO archive_tier(archive_id, directory, created) "
+                         "VALUES(?1, ?2, ?3);");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+  sqlite3_bind_text(stmt, 2, directory.c_str(), -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 3, created.c_str(), -1, SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not set cold tier: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+void BackupCatalog::updateBaseBackupFsentry(int basebackupId, std::string fsentry) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("updateBaseBackupFsentry", {}, []() {
+      return std::string("UPDATE backup SET fsentry = ?1 WHERE id = ?2;");
+    });
+
+  sqlite3_bind_text(stmt, 1, fsentry.c_str(), -1, SQLITE_STATIC);
+  sqlite3_bind_int(stmt, 2, basebackupId);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not update location of basebackup: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+void BackupCatalog::referenceChunks(int archive_id, std::set<std::string> const& ids) {
+
+  int rc;
+  sqlite3_stmt *insert_stmt;
+  sqlite3_stmt *update_stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  insert_stmt = this->cachedStatement("referenceChunksInsert", {}, []() {
+      return std::string("INSERT OR IGNORE INTO dedup_chunk(archive_id, id, refcount) "
+                         "VALUES(?1, ?2, 0);");
+    });
+
+  update_stmt = this->cachedStatement("referenceChunksUpdate", {}, []() {
+      return std::string("UPDATE dedup_chunk SET refcount = refcount + 1 "
+                         "WHERE archive_id = ?1 AND id = ?2;");
+    });
+
+  for (auto &id : ids) {
+
+    for (sqlite3_stmt *stmt : { insert_stmt, update_stmt }) {
+
+      sqlite3_bind_int(stmt, 1, archive_id);
+      sqlite3_bind_text(stmt, 2, id.c_str(), -1, SQLITE_STATIC);
+
+      rc = sqlite3_step(stmt);
+
+      if (rc != SQLITE_DONE) {
+        std::ostringstream oss;
+        oss << "could not reference chunk " << id << ": " << sqlite3_errmsg(this->db_handle);
+        this->releaseStatement(insert_stmt);
+        this->releaseStatement(update_stmt);
+        throw CCatalogIssue(oss.str());
+      }
+
+      this->releaseStatement(stmt);
+
+    }
+
+  }
+
+}
+
+void BackupCatalog::releaseChunks(int archive_id, std::set<std::string> const& ids) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("releaseChunks", {}, []() {
+      return std::string("UPDATE dedup_chunk SET refcount = refcount - 1 "
+                         "WHERE archive_id = ?1 AND id = ?2 AND refcount > 0;");
+    });
+
+  for (auto &id : ids) {
+
+    sqlite3_bind_int(stmt, 1, archive_id);
+    sqlite3_bind_text(stmt, 2, id.c_str(), -1, SQLITE_STATIC);
+
+    rc = sqlite3_step(stmt);
+
+    if (rc != SQLITE_DONE) {
+      std::ostringstream oss;
+      oss << "could not release chunk " << id << ": " << sqlite3_errmsg(this->db_handle);
+      this->releaseStatement(stmt);
+      throw CCatalogIssue(oss.str());
+    }
+
+    this->releaseStatement(stmt);
+
+  }
+
+}
+
+bool BackupCatalog::chunkReferenced(int archive_id, std::string const& id) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  bool result = false;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("chunkReferenced", {}, []() {
+      return std::string("SELECT refcount > 0 FROM dedup_chunk "
+                         "WHERE archive_id = ?1 AND id = ?2;");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+  sqlite3_bind_text(stmt, 2, id.c_str(), -1, SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc == SQLITE_ROW) {
+    result = (sqlite3_column_int(stmt, 0) != 0);
+  } else if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not look up chunk " << id << ": " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+  return result;
+
+}
+
+void BackupCatalog::deleteUnreferencedChunks(int archive_id) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("deleteUnreferencedChunks", {}, []() {
+      return std::string("DELETE FROM dedup_chunk WHERE archive_id = ?1 AND refcount = 0;");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    std::ostringstream oss;
+    oss << "could not delete unreferenced chunks: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+
+}
+
+bool BackupCatalog::hasBasebackupsInProgress(int archive_id) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+  bool result = false;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  stmt = this->cachedStatement("hasBasebackupsInProgress", {}, []() {
+      return std::string("SELECT EXISTS(SELECT 1 FROM backup "
+                         "WHERE archive_id = ?1 AND status = 'in progress');");
+    });
+
+  sqlite3_bind_int(stmt, 1, archive_id);
+
+  rc = sqlite3_step(stmt);
+
+  if (rc == SQLITE_ROW) {
+    result = (sqlite3_column_int(stmt, 0) != 0);
+  } else {
+    std::ostringstream oss;
+    oss << "could not check for basebackups in progress: " << sqlite3_errmsg(this->db_handle);
+    this->releaseStatement(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->releaseStatement(stmt);
+  return result;
+
+}
+
+void BackupCatalog::dropRetentionPolicy(string retention_name) {
+
+  sqlite3_stmt *stmt = NULL;
+  ostringstream delete_sql;
+  int rc;
+
+  /*
+   * Database available ?
+   */
+  if (!this->available()) {
+    throw CArchiveIssue("catalog database not opened");
+  }
+
+  if (retention_name.length() < 1) {
+    throw CArchiveIssue("cannot drop retention policy with empty identifier");
+  }
+
+  /*
+   * Compose SQL string for deletion...
    */
   delete_sql << "DELETE FROM retention WHERE name = ?1;";
 
@@ -2665,83 +4407,162 @@ void BackupCatalog::performPinAction(BasicPinDescr *descr,
     throw CCatalogIssue("catalog database not opened");
   }
 
-  if (descr->action() == PIN_BASEBACKUP)
-    update << "UPDATE backup SET pinned = 1 WHERE id IN (";
-  else
-    update << "UPDATE backup SET pinned = 0 WHERE id IN (";
+  if (descr->action() == PIN_BASEBACKUP)
+    update << "UPDATE backup SET pinned = 1 WHERE id IN (";
+  else
+    update << "UPDATE backup SET pinned = 0 WHERE id IN (";
+
+  /*
+   * Build basebackup ID bind list.
+   */
+  for (num_bind_id = 1; num_bind_id <= basebackupIds.size(); num_bind_id++) {
+
+    update << "?" << num_bind_id;
+
+    if (num_bind_id < basebackupIds.size())
+      update << ", ";
+
+  }
+
+  /*
+   * Finalize update statement
+   */
+  update << ");";
+
+#ifdef __DEBUG__
+  BOOST_LOG_TRIVIAL(debug) << "generate UPDATE SQL: "
+                           << update.str();
+#endif
+
+  rc = sqlite3_prepare_v2(this->db_handle,
+                          update.str().c_str(),
+                          -1,
+                          &stmt,
+                          NULL);
+
+  if (rc != SQLITE_OK) {
+    ostringstream oss;
+    oss << "cannot prepare query:" << sqlite3_errmsg(db_handle);
+
+    throw CCatalogIssue(oss.str());
+  }
+
+  /*
+   * Bind ID values.
+   */
+  for (num_bind_id = 1; num_bind_id <= basebackupIds.size(); num_bind_id++) {
+
+#ifdef __DEBUG__
+    BOOST_LOG_TRIVIAL(debug) << "DEBUG: binding basebackup ID "
+                             << basebackupIds[num_bind_id - 1];
+#endif
+
+    sqlite3_bind_int(stmt, num_bind_id, basebackupIds[num_bind_id - 1]);
+  }
+
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_DONE) {
+    ostringstream oss;
+    oss << "failed to pin/unpin basebackup IDs "
+        << ": " << sqlite3_errmsg(db_handle);
+    sqlite3_finalize(stmt);
+    throw CArchiveIssue(oss.str());
+  }
+
+  sqlite3_finalize(stmt);
+}
+
+void BackupCatalog::deleteBaseBackup(int basebackupId) {
+
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
+
+  /*
+   * The backup_stats row goes away by ON DELETE CASCADE, but
+   * the archive statistics must not account the basebackup anymore.
+   */
+  rc = sqlite3_prepare_v2(this->db_handle,
+                          "UPDATE archive_stats "
+                          "SET backup_bytes = MAX(backup_bytes - "
+                          "(SELECT COALESCE(SUM(size), 0) FROM backup_stats WHERE backup_id = ?1), 0) "
+                          "WHERE archive_id = (SELECT archive_id FROM backup WHERE id = ?1);",
+                          -1,
+                          &stmt,
+                          NULL);
+
+  if (rc != SQLITE_OK) {
+
+    std::ostringstream oss;
+
+    oss << "error preparing to update archive statistics: " << sqlite3_errmsg(this->db_handle);
+    throw CCatalogIssue(oss.str());
+
+  }
+
+  sqlite3_bind_int(stmt, 1, basebackupId);
 
-  /*
-   * Build basebackup ID bind list.
-   */
-  for (num_bind_id = 1; num_bind_id <= basebackupIds.size(); num_bind_id++) {
+  rc = sqlite3_step(stmt);
 
-    update << "?" << num_bind_id;
+  if (rc != SQLITE_DONE) {
+    ostringstream oss;
 
-    if (num_bind_id < basebackupIds.size())
-      update << ", ";
+    oss << "could not update archive statistics: " << sqlite3_errmsg(this->db_handle);
+    sqlite3_finalize(stmt);
+    throw CCatalogIssue(oss.str());
 
   }
 
-  /*
-   * Finalize update statement
-   */
-  update << ");";
-
-#ifdef __DEBUG__
-  BOOST_LOG_TRIVIAL(debug) << "generate UPDATE SQL: "
-                           << update.str();
-#endif
+  sqlite3_finalize(stmt);
 
   rc = sqlite3_prepare_v2(this->db_handle,
-                          update.str().c_str(),
+                          "DELETE FROM backup WHERE id = ?1;",
                           -1,
                           &stmt,
                           NULL);
 
   if (rc != SQLITE_OK) {
-    ostringstream oss;
-    oss << "cannot prepare query:" << sqlite3_errmsg(db_handle);
-
-    throw CCatalogIssue(oss.str());
-  }
 
-  /*
-   * Bind ID values.
-   */
-  for (num_bind_id = 1; num_bind_id <= basebackupIds.size(); num_bind_id++) {
+    std::ostringstream oss;
 
-#ifdef __DEBUG__
-    BOOST_LOG_TRIVIAL(debug) << "DEBUG: binding basebackup ID "
-                             << basebackupIds[num_bind_id - 1];
-#endif
+    oss << "error preparing to delete basebackup: " << sqlite3_errmsg(this->db_handle);
+    throw CCatalogIssue(oss.str());
 
-    sqlite3_bind_int(stmt, num_bind_id, basebackupIds[num_bind_id - 1]);
   }
 
+  sqlite3_bind_int(stmt, 1, basebackupId);
+
   rc = sqlite3_step(stmt);
 
   if (rc != SQLITE_DONE) {
     ostringstream oss;
-    oss << "failed to pin/unpin basebackup IDs "
-        << ": " << sqlite3_errmsg(db_handle);
+
+    oss << "could not delete basebackup: " << sqlite3_errmsg(this->db_handle);
     sqlite3_finalize(stmt);
-    throw CArchiveIssue(oss.str());
+    throw CCatalogIssue(oss.str());
+
   }
 
   sqlite3_finalize(stmt);
+
 }
 
-void BackupCatalog::deleteBaseBackup(int basebackupId) {
+std::vector<int> BackupCatalog::getDependentBasebackups(int basebackupId) {
 
   int rc;
   sqlite3_stmt *stmt;
+  std::vector<int> result;
 
   if (!this->available()) {
     throw CCatalogIssue("catalog database not opened");
   }
 
   rc = sqlite3_prepare_v2(this->db_handle,
-                          "DELETE FROM backup WHERE id = ?1;",
+                          "SELECT id FROM backup WHERE parent_id = ?1 ORDER BY id;",
                           -1,
                           &stmt,
                           NULL);
@@ -2750,25 +4571,28 @@ void BackupCatalog::deleteBaseBackup(int basebackupId) {
 
     std::ostringstream oss;
 
-    oss << "error preparing to delete basebackup: " << sqlite3_errmsg(this->db_handle);
+    oss << "error preparing to get dependent basebackups: " << sqlite3_errmsg(this->db_handle);
     throw CCatalogIssue(oss.str());
 
   }
 
   sqlite3_bind_int(stmt, 1, basebackupId);
 
-  rc = sqlite3_step(stmt);
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    result.push_back(sqlite3_column_int(stmt, 0));
+  }
 
   if (rc != SQLITE_DONE) {
     ostringstream oss;
 
-    oss << "could not delete basebackup: " << sqlite3_errmsg(this->db_handle);
+    oss << "could not get dependent basebackups: " << sqlite3_errmsg(this->db_handle);
     sqlite3_finalize(stmt);
     throw CCatalogIssue(oss.str());
 
   }
 
   sqlite3_finalize(stmt);
+  return result;
 
 }
 
@@ -2921,247 +4745,25 @@ void BackupCatalog::exceedsRetention(std::shared_ptr<BaseBackupDescr> basebackup
 
 }
 
-std::shared_ptr<BaseBackupDescr> BackupCatalog::getBaseBackup(std::string basebackup_fqfn,
-                                                              int archive_id) {
+std::string BackupCatalog::retentionDateTimeThreshold(RetentionIntervalDescr interval) {
 
+  std::ostringstream sql;
+  sqlite3_stmt *stmt = NULL;
+  std::string threshold = "";
   int rc;
-  sqlite3_stmt *stmt;
-  ostringstream query;
-  string backupCols;
-  shared_ptr<BaseBackupDescr> basebackup = make_shared<BaseBackupDescr>();
-  vector<int> backupAttrs;
-  vector<int> tblspcAttrs;
-
-    if (!this->available()) {
-    throw CCatalogIssue("catalog database not opened");
-  }
-
-  /* mark descriptor empty */
-  basebackup->id = -1;
-
-  /*
-   * Generate list of columns to retrieve...
-   */
-  backupAttrs.push_back(SQL_BACKUP_ID_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_ARCHIVE_ID_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_XLOGPOS_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_XLOGPOSEND_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_TIMELINE_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_LABEL_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_FSENTRY_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_STARTED_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_STOPPED_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_STATUS_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_SYSTEMID_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_PINNED_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_WAL_SEGMENT_SIZE_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_USED_PROFILE_ATTNO);
-
-  tblspcAttrs.push_back(SQL_BCK_TBLSPC_BCK_ID_ATTNO);
-  tblspcAttrs.push_back(SQL_BCK_TBLSPC_SPCOID_ATTNO);
-  tblspcAttrs.push_back(SQL_BCK_TBLSPC_SPCLOC_ATTNO);
-  tblspcAttrs.push_back(SQL_BCK_TBLSPC_SPCSZ_ATTNO);
-
-  backupCols = BackupCatalog::SQLgetColumnList(SQL_BACKUP_ENTITY,
-                                               backupAttrs);
-
-    query << "SELECT "
-        << backupCols
-        << ", "
-
-    /*
-     * IMPORTANT:
-     *
-     * We can't use SQLgetColumnList here(), since we want to
-     * prevent NULL
-     */
-
-        << "COALESCE(bt.backup_id, -1) AS backup_id, "
-        << "COALESCE(bt.spcoid, -1) AS spcoid, "
-        << "COALESCE(spclocation, 'no location') AS spclocation, "
-        << "COALESCE(spcsize, -1) AS spcsize, "
-        << "b.wal_segment_size AS wal_segment_size, "
-        << "b.used_profile AS backup_profile_id "
-        << "FROM "
-        << "backup b LEFT JOIN backup_tablespaces bt ON (b.id = bt.backup_id) "
-        << "WHERE b.fsentry = ?1 AND b.archive_id = ?2;";
-
-#ifdef __DEBUG__
-  BOOST_LOG_TRIVIAL(debug) << "generate SQL: " << query.str();
-#endif
-
-  rc = sqlite3_prepare_v2(this->db_handle,
-                          query.str().c_str(),
-                          -1,
-                          &stmt,
-                          NULL);
-
-  if (rc != SQLITE_OK) {
-    ostringstream oss;
-    oss << "cannot prepare query: " << sqlite3_errmsg(db_handle);
-    throw CCatalogIssue(oss.str());
-  }
-
-  /*
-   * Bind WHERE conditions.
-   */
-  sqlite3_bind_text(stmt, 1, basebackup_fqfn.c_str(), -1, SQLITE_STATIC);
-  sqlite3_bind_int(stmt, 2, archive_id);
-
-  /*
-   * Execute the statement.
-   */
-  rc = sqlite3_step(stmt);
 
-  /*
-   * If multiple tablespaces are in the basebackup,
-   * there are more than one row to process!
-   */
-
-  if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
-
-    ostringstream oss;
-
-    oss << "error retrieving backup list from catalog database: "
-        << sqlite3_errmsg(this->db_handle);
-    sqlite3_finalize(stmt);
-    throw CCatalogIssue(oss.str());
-
-  }
-
-  /*
-   * If no rows returned, there's effectively
-   * nothing more to do here (no basebackup by
-   * the specified ID found).
-   */
-  if (rc == SQLITE_DONE) {
-    sqlite3_finalize(stmt);
-    return basebackup;
+  if (interval.opr_list.size() == 0) {
+    throw CCatalogIssue("attempt to apply an empty retention interval to basebackup listing");
   }
 
-  /*
-   * If only a single tablespace is part of the
-   * basebackup, make sure we loop through it.
-   *
-   * Code here is doubled in getBackupList() (except the loop header),
-   * but it's not sure whether the code retains here this way. So just
-   * repeat it and leave it to some future work to optimize it.
-   */
-
-  do {
-
-    shared_ptr<BackupTablespaceDescr> tablespace = make_shared<BackupTablespaceDescr>();
-
-    basebackup->setAffectedAttributes(backupAttrs);
-    tablespace->setAffectedAttributes(tblspcAttrs);
-
-    /*
-     * If not initialized, retrieve properties into
-     * our BaseBackupDescr instance.
-     */
-    if (basebackup->id < 0) {
-      this->fetchBackupIntoDescr(stmt, basebackup, Range(0, backupAttrs.size() - 1));
-    }
-
-    /*
-     * Since we fetch tablespace and basebackup information in one
-     * query, we only push basebackup information if the last
-     * encountered backup_id differs into the our result list.
-     *
-     * In opposite to getBackupList(), we have only a single backup id
-     * here to fetch, so there's no need to check if we have to
-     * create a new BaseBackupDescr instance.
-     */
-    this->fetchBackupTablespaceIntoDescr(stmt,
-                                         tablespace,
-                                         Range(backupAttrs.size(), backupAttrs.size()
-                                               + tblspcAttrs.size() -1));
-
-    if (tablespace->backup_id >= 0) {
-      basebackup->tablespaces.push_back(tablespace);
-    }
-
-    rc = sqlite3_step(stmt);
-
-  } while(rc == SQLITE_ROW);
-
-  /* clean up */
-  sqlite3_finalize(stmt);
-
-  return basebackup;
-}
-
-std::shared_ptr<BaseBackupDescr> BackupCatalog::getBaseBackup(int basebackupId,
-                                                              int archive_id) {
-
-  int rc;
-  sqlite3_stmt *stmt;
-  ostringstream query;
-  string backupCols;
-  shared_ptr<BaseBackupDescr> basebackup = make_shared<BaseBackupDescr>();
-  vector<int> backupAttrs;
-  vector<int> tblspcAttrs;
-
   if (!this->available()) {
-    throw CCatalogIssue("catalog database not opened");
-  }
-
-  /* mark descriptor empty */
-  basebackup->id = -1;
-
-  /*
-   * Generate list of columns to retrieve...
-   */
-  backupAttrs.push_back(SQL_BACKUP_ID_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_ARCHIVE_ID_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_XLOGPOS_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_XLOGPOSEND_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_TIMELINE_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_LABEL_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_FSENTRY_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_STARTED_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_STOPPED_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_STATUS_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_SYSTEMID_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_PINNED_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_WAL_SEGMENT_SIZE_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_USED_PROFILE_ATTNO);
-
-  tblspcAttrs.push_back(SQL_BCK_TBLSPC_BCK_ID_ATTNO);
-  tblspcAttrs.push_back(SQL_BCK_TBLSPC_SPCOID_ATTNO);
-  tblspcAttrs.push_back(SQL_BCK_TBLSPC_SPCLOC_ATTNO);
-  tblspcAttrs.push_back(SQL_BCK_TBLSPC_SPCSZ_ATTNO);
-
-  backupCols = BackupCatalog::SQLgetColumnList(SQL_BACKUP_ENTITY,
-                                               backupAttrs);
-
-  query << "SELECT "
-        << backupCols
-        << ", "
-
-    /*
-     * IMPORTANT:
-     *
-     * We can't use SQLgetColumnList here(), since we want to
-     * prevent NULL
-     */
-
-        << "COALESCE(bt.backup_id, -1) AS backup_id, "
-        << "COALESCE(bt.spcoid, -1) AS spcoid, "
-        << "COALESCE(spclocation, 'no location') AS spclocation, "
-        << "COALESCE(spcsize, -1) AS spcsize, "
-        << "b.wal_segment_size AS wal_segment_size, "
-        << "b.used_profile AS backup_profile_id "
-        << "FROM "
-        << "backup b LEFT JOIN backup_tablespaces bt ON (b.id = bt.backup_id) "
-        << "WHERE b.id = ?1 AND b.archive_id = ?2;";
+    throw CCatalogIssue("catalog database not opened");
+  }
 
-#ifdef __DEBUG__
-  BOOST_LOG_TRIVIAL(debug) << "generate SQL: " << query.str();
-#endif
+  sql << "SELECT " << interval.sqlite3_datetime() << ";";
 
   rc = sqlite3_prepare_v2(this->db_handle,
-                          query.str().c_str(),
+                          sql.str().c_str(),
                           -1,
                           &stmt,
                           NULL);
@@ -3173,92 +4775,140 @@ std::shared_ptr<BaseBackupDescr> BackupCatalog::getBaseBackup(int basebackupId,
   }
 
   /*
-   * Bind WHERE conditions.
+   * Bind retention datetime values, see exceedsRetention().
    */
-  sqlite3_bind_int(stmt, 1, basebackupId);
-  sqlite3_bind_int(stmt, 2, archive_id);
+  for (std::vector<RetentionIntervalOperand>::size_type i = 0;
+       i != interval.opr_list.size(); i++) {
 
-  /*
-   * Execute the statement.
-   */
-  rc = sqlite3_step(stmt);
+    sqlite3_bind_text(stmt, (i + 1), interval.opr_list[i].str().c_str(), -1, SQLITE_TRANSIENT);
 
-  /*
-   * If multiple tablespaces are in the basebackup,
-   * there are more than one row to process!
-   */
+  }
 
-  if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+  rc = sqlite3_step(stmt);
+
+  if (rc != SQLITE_ROW) {
 
     ostringstream oss;
 
-    oss << "error retrieving backup list from catalog database: "
-        << sqlite3_errmsg(this->db_handle);
+    oss << "unexpected result when evaluating retention interval: " << sqlite3_errmsg(this->db_handle);
     sqlite3_finalize(stmt);
     throw CCatalogIssue(oss.str());
 
   }
 
+  /* datetime() returns NULL for invalid modifiers */
+  if (sqlite3_column_type(stmt, 0) == SQLITE_NULL) {
+    sqlite3_finalize(stmt);
+    throw CCatalogIssue("invalid retention interval expression \"" + interval.compile() + "\"");
+  }
+
+  threshold = (char *) sqlite3_column_text(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  return threshold;
+
+}
+
+std::shared_ptr<BaseBackupDescr> BackupCatalog::getBaseBackup(std::string basebackup_fqfn,
+                                                              int archive_id) {
+
+  shared_ptr<BaseBackupDescr> basebackup = make_shared<BaseBackupDescr>();
+  BaseBackupListFilter filter;
+
+  /* mark descriptor empty */
+  basebackup->id = -1;
+
+  /* an empty fsentry would be taken as no restriction by the cursor */
+  if (basebackup_fqfn.length() == 0)
+    return basebackup;
+
+  filter.archive_id = archive_id;
+  filter.fsentry = basebackup_fqfn;
+
   /*
-   * If no rows returned, there's effectively
-   * nothing more to do here (no basebackup by
-   * the specified ID found).
+   * If no rows returned, the descriptor stays empty (no
+   * basebackup by the specified fsentry found).
    */
-  if (rc == SQLITE_DONE) {
-    sqlite3_finalize(stmt);
+  this->openBackupCursor(filter)->next(basebackup);
+
+  return basebackup;
+}
+
+std::shared_ptr<BaseBackupDescr> BackupCatalog::getBaseBackup(int basebackupId,
+                                                              int archive_id) {
+
+  shared_ptr<BaseBackupDescr> basebackup = make_shared<BaseBackupDescr>();
+  BaseBackupListFilter filter;
+
+  /* mark descriptor empty */
+  basebackup->id = -1;
+
+  /* a negative ID would be taken as no restriction by the cursor */
+  if (basebackupId < 0)
     return basebackup;
-  }
+
+  filter.archive_id = archive_id;
+  filter.basebackup_id = basebackupId;
 
   /*
-   * If only a single tablespace is part of the
-   * basebackup, make sure we loop through it.
-   *
-   * Code here is doubled in getBackupList() (except the loop header),
-   * but it's not sure whether the code retains here this way. So just
-   * repeat it and leave it to some future work to optimize it.
+   * If no rows returned, the descriptor stays empty (no
+   * basebackup by the specified ID found).
    */
+  this->openBackupCursor(filter)->next(basebackup);
 
-  do {
+  return basebackup;
+}
 
-    shared_ptr<BackupTablespaceDescr> tablespace = make_shared<BackupTablespaceDescr>();
+std::vector<std::shared_ptr<BaseBackupDescr>>
+BackupCatalog::getBaseBackupChain(int basebackupId,
+                                  int archive_id) {
 
-    basebackup->setAffectedAttributes(backupAttrs);
-    tablespace->setAffectedAttributes(tblspcAttrs);
+  std::vector<std::shared_ptr<BaseBackupDescr>> chain;
+  std::set<int> visited;
+  int current_id = basebackupId;
 
-    /*
-     * If not initialized, retrieve properties into
-     * our BaseBackupDescr instance.
-     */
-    if (basebackup->id < 0) {
-      this->fetchBackupIntoDescr(stmt, basebackup, Range(0, backupAttrs.size() - 1));
+  /*
+   * Walk up the parents until we reach the full basebackup,
+   * every member of the chain is required for restore.
+   */
+  while (current_id >= 0) {
+
+    std::shared_ptr<BaseBackupDescr> bbdescr = nullptr;
+
+    /* Paranoia, a broken catalog must not loop forever */
+    if (visited.find(current_id) != visited.end()) {
+      ostringstream oss;
+      oss << "basebackup chain of basebackup ID \"" << basebackupId
+          << "\" references basebackup ID \"" << current_id << "\" twice";
+      throw CCatalogIssue(oss.str());
     }
 
-    /*
-     * Since we fetch tablespace and basebackup information in one
-     * query, we only push basebackup information if the last
-     * encountered backup_id differs into the our result list.
-     *
-     * In opposite to getBackupList(), we have only a single backup id
-     * here to fetch, so there's no need to check if we have to
-     * create a new BaseBackupDescr instance.
-     */
-    this->fetchBackupTablespaceIntoDescr(stmt,
-                                         tablespace,
-                                         Range(backupAttrs.size(), backupAttrs.size()
-                                               + tblspcAttrs.size() -1));
+    visited.insert(current_id);
+    bbdescr = this->getBaseBackup(current_id, archive_id);
 
-    if (tablespace->backup_id >= 0) {
-      basebackup->tablespaces.push_back(tablespace);
+    if (bbdescr->id < 0) {
+      ostringstream oss;
+      oss << "basebackup ID \"" << current_id
+          << "\" required by basebackup ID \"" << basebackupId
+          << "\" does not exist";
+      throw CCatalogIssue(oss.str());
     }
 
-    rc = sqlite3_step(stmt);
+    if (bbdescr->status != BaseBackupDescr::BASEBACKUP_STATUS_READY) {
+      ostringstream oss;
+      oss << "basebackup ID \"" << current_id
+          << "\" required by basebackup ID \"" << basebackupId
+          << "\" is not ready (status \"" << bbdescr->status << "\")";
+      throw CCatalogIssue(oss.str());
+    }
 
-  } while(rc == SQLITE_ROW);
+    chain.insert(chain.begin(), bbdescr);
+    current_id = bbdescr->parent_id;
 
-  /* clean up */
-  sqlite3_finalize(stmt);
+  }
+
+  return chain;
 
-  return basebackup;
 }
 
 std::shared_ptr<BaseBackupDescr> BackupCatalog::getBaseBackup(BaseBackupRetrieveMode mode,
@@ -3266,126 +4916,31 @@ std::shared_ptr<BaseBackupDescr> BackupCatalog::getBaseBackup(BaseBackupRetrieve
                                                               bool valid_only) {
 
   std::shared_ptr<BaseBackupDescr> result = std::make_shared<BaseBackupDescr>();
-  sqlite3_stmt *stmt = NULL;
-  string backupCols = "";
-  std::ostringstream query;
-  std::vector<int> backupAttrs;
-  int rc;
-
-  if (!this->available()) {
-    throw CCatalogIssue("catalog database not opened");
-  }
-
-  /* List of columns to retrieve */
-  backupAttrs.push_back(SQL_BACKUP_ID_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_ARCHIVE_ID_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_XLOGPOS_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_XLOGPOSEND_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_TIMELINE_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_LABEL_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_FSENTRY_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_STARTED_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_STOPPED_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_STATUS_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_SYSTEMID_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_PINNED_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_WAL_SEGMENT_SIZE_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_USED_PROFILE_ATTNO);
-  backupAttrs.push_back(SQL_BACKUP_PG_VERSION_NUM_ATTNO);
-
-  /* Safe column list to descriptor */
-  result->setAffectedAttributes(backupAttrs);
-
-  /* Column list */
-  backupCols = BackupCatalog::SQLgetColumnList(SQL_BACKUP_ENTITY,
-                                               backupAttrs);
-
-  /* Generate the query */
-  query << "SELECT "
-        << backupCols
-        << " FROM backup b ";
+  BaseBackupListFilter filter;
 
-  /*
-   * Check if we are instructed to consider every state
-   * of basebackup or just the ones with "ready"
-   */
-  if (valid_only) {
-    query << "WHERE status = 'ready' AND archive_id = ?1 ";
-  }
+  filter.archive_id = archive_id;
+  filter.valid_only = valid_only;
+  filter.limit = 1;
 
   /*
-   * Prepare the WHERE condition, depending on the
+   * Prepare the ordering, depending on the
    * specified retrieval mode.
    */
   switch(mode) {
   case BASEBACKUP_OLDEST:
     {
-      query << "ORDER BY stopped ASC LIMIT 1;";
+      filter.order = BASEBACKUP_LIST_STOPPED_ASC;
       break;
     }
   case BASEBACKUP_NEWEST:
     {
-      query << "ORDER BY stopped DESC LIMIT 1;";
+      filter.order = BASEBACKUP_LIST_STOPPED_DESC;
       break;
     }
   }
 
-#ifdef __DEBUG__
-  BOOST_LOG_TRIVIAL(debug) << "DEBUG: execute SQL " << query.str();
-#endif
-
-  /* Prepare the query */
-  rc = sqlite3_prepare(this->db_handle,
-                       query.str().c_str(),
-                       -1,
-                       &stmt,
-                       NULL);
-
-  if (rc != SQLITE_OK) {
-    ostringstream oss;
-    oss << "cannot prepare query: " << sqlite3_errmsg(this->db_handle);
-    throw CCatalogIssue(oss.str());
-  }
-
-  if (sqlite3_bind_int(stmt, 1, archive_id) != SQLITE_OK) {
-    ostringstream oss;
-
-    oss << "could not bind archive_id(\""
-        << archive_id << "\")"
-        << " in catalog query: "
-        << sqlite3_errmsg(this->db_handle);
-
-    sqlite3_finalize(stmt);
-    throw CCatalogIssue(oss.str());
-  }
-
-  /* Execute the query */
-  rc = sqlite3_step(stmt);
-
-  if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
-    ostringstream oss;
-
-    oss << "error retrieving basebackup candidate: "
-        << sqlite3_errmsg(this->db_handle);
-
-    sqlite3_finalize(stmt);
-    throw CCatalogIssue(oss.str());
-  }
-
-  /*
-   * We expect only one tuple so far
-   *
-   * XXX: This might change if we introduce other retrieval modes
-   *      in BaseBackupRetrieveMode...
-   */
-  if (rc == SQLITE_ROW) {
-
-    this->fetchBackupIntoDescr(stmt, result,
-                                 Range(0, backupAttrs.size() - 1));
+  this->openBackupCursor(filter)->next(result);
 
-  }
-
-  sqlite3_finalize(stmt);
   return result;
 }
 
@@ -3478,6 +5033,8 @@ BackupCatalog::getBackupListRetentionDateTime(std::string archive_name,
   backupAttrs.push_back(SQL_BACKUP_PINNED_ATTNO);
   backupAttrs.push_back(SQL_BACKUP_WAL_SEGMENT_SIZE_ATTNO);
   backupAttrs.push_back(SQL_BACKUP_USED_PROFILE_ATTNO);
+  backupAttrs.push_back(SQL_BACKUP_PARENT_ID_ATTNO);
+  backupAttrs.push_back(SQL_BACKUP_COMPRESS_TYPE_ATTNO);
 
   /* computed columns to fetch */
   backupAttrs.push_back(SQL_BACKUP_COMPUTED_DURATION);
@@ -3647,22 +5204,18 @@ BackupCatalog::getBackupListRetentionDateTime(std::string archive_name,
   return list;
 }
 
-std::vector<std::shared_ptr<BaseBackupDescr>>
-BackupCatalog::getBackupList(std::string archive_name) {
+BaseBackupCursor::BaseBackupCursor(BackupCatalog *catalog,
+                                   sqlite3 *db_handle,
+                                   BaseBackupListFilter filter) {
 
   std::ostringstream query;
-  std::vector<int> backupAttrs;
-  std::vector<int> tblspcAttrs;
-  sqlite3_stmt *stmt;
-
+  std::ostringstream cond;
   std::string backupCols;
-  std::vector<std::shared_ptr<BaseBackupDescr>> list;
-  int current_backup_id = -1;
-  int rc;
+  std::string order;
+  int bind_index = 1;
 
-  if (!this->available()) {
-    throw CCatalogIssue("catalog database not opened");
-  }
+  this->catalog = catalog;
+  this->db_handle = db_handle;
 
   /*
    * Generate list of columns to retrieve...
@@ -3681,6 +5234,9 @@ BackupCatalog::getBackupList(std::string archive_name) {
   backupAttrs.push_back(SQL_BACKUP_PINNED_ATTNO);
   backupAttrs.push_back(SQL_BACKUP_WAL_SEGMENT_SIZE_ATTNO);
   backupAttrs.push_back(SQL_BACKUP_USED_PROFILE_ATTNO);
+  backupAttrs.push_back(SQL_BACKUP_PARENT_ID_ATTNO);
+  backupAttrs.push_back(SQL_BACKUP_COMPRESS_TYPE_ATTNO);
+  backupAttrs.push_back(SQL_BACKUP_PG_VERSION_NUM_ATTNO);
 
   /* computed columns to fetch */
   backupAttrs.push_back(SQL_BACKUP_COMPUTED_DURATION);
@@ -3693,8 +5249,45 @@ BackupCatalog::getBackupList(std::string archive_name) {
   backupCols = BackupCatalog::SQLgetColumnList(SQL_BACKUP_ENTITY,
                                                backupAttrs);
 
+  switch(filter.order) {
+  case BASEBACKUP_LIST_STARTED_DESC:
+    order = "started DESC, id DESC";
+    break;
+  case BASEBACKUP_LIST_STARTED_ASC:
+    order = "started ASC, id ASC";
+    break;
+  case BASEBACKUP_LIST_STOPPED_DESC:
+    order = "stopped DESC, id DESC";
+    break;
+  case BASEBACKUP_LIST_STOPPED_ASC:
+    order = "stopped ASC, id ASC";
+    break;
+  }
+
   /*
-   * Get the list of backups for the specified archive.
+   * Build the WHERE condition, parameters are numbered in
+   * the same order they are bound below.
+   */
+  if (filter.archive_id >= 0) {
+    cond << "archive_id = ?" << bind_index++;
+  } else {
+    cond << "archive_id = (SELECT id FROM archive WHERE name = ?" << bind_index++ << ")";
+  }
+
+  if (filter.basebackup_id >= 0)
+    cond << " AND id = ?" << bind_index++;
+
+  if (filter.fsentry.length() > 0)
+    cond << " AND fsentry = ?" << bind_index++;
+
+  if (filter.valid_only)
+    cond << " AND status = 'ready'";
+
+  /*
+   * Ordering and LIMIT are applied to the basebackups within
+   * a subquery, before they are joined with their tablespaces. The
+   * outer query repeats the ordering, so all rows of a basebackup
+   * arrive one after another.
    */
   query << "SELECT "
         << backupCols
@@ -3710,12 +5303,22 @@ BackupCatalog::getBackupList(std::string archive_name) {
         << "COALESCE(bt.backup_id, -1) AS backup_id, "
         << "COALESCE(bt.spcoid, -1) AS spcoid, "
         << "COALESCE(spclocation, 'no location') AS spclocation, "
-        << "COALESCE(spcsize, -1) AS spcsize, "
-        << "b.wal_segment_size AS wal_segment_size, "
-        << "b.used_profile AS backup_profile_id "
+        << "COALESCE(spcsize, -1) AS spcsize "
         << "FROM "
-        << "backup b LEFT JOIN backup_tablespaces bt ON (b.id = bt.backup_id) "
-        << "WHERE archive_id = (SELECT id FROM archive WHERE name = ?1) ORDER BY b.started DESC;";
+        << "(SELECT * FROM backup WHERE " << cond.str()
+        << " ORDER BY " << order;
+
+  if (filter.limit > 0 || filter.offset > 0) {
+
+    /* SQLite requires a LIMIT clause with OFFSET, -1 means no limit */
+    query << " LIMIT ?" << bind_index++
+          << " OFFSET ?" << bind_index++;
+
+  }
+
+  query << ") b LEFT JOIN backup_tablespaces bt ON (b.id = bt.backup_id) "
+        << "ORDER BY b." << boost::replace_all_copy(order, ", ", ", b.")
+        << ", bt.spcoid;";
 
 #ifdef __DEBUG__
   BOOST_LOG_TRIVIAL(debug) << "generate SQL: " << query.str();
@@ -3729,11 +5332,34 @@ BackupCatalog::getBackupList(std::string archive_name) {
 
   if (rc != SQLITE_OK) {
     ostringstream oss;
-    oss << "cannot prepare query: " << sqlite3_errmsg(db_handle);
+    oss << "cannot prepare query: " << sqlite3_errmsg(this->db_handle);
+    stmt = nullptr;
     throw CCatalogIssue(oss.str());
   }
 
-  sqlite3_bind_text(stmt, 1, archive_name.c_str(), -1, SQLITE_STATIC);
+  /*
+   * Bind WHERE conditions. Text values are copied, since
+   * the filter goes out of scope before we're done.
+   */
+  bind_index = 1;
+
+  if (filter.archive_id >= 0) {
+    sqlite3_bind_int(stmt, bind_index++, filter.archive_id);
+  } else {
+    sqlite3_bind_text(stmt, bind_index++, filter.archive_name.c_str(), -1, SQLITE_TRANSIENT);
+  }
+
+  if (filter.basebackup_id >= 0)
+    sqlite3_bind_int(stmt, bind_index++, filter.basebackup_id);
+
+  if (filter.fsentry.length() > 0)
+    sqlite3_bind_text(stmt, bind_index++, filter.fsentry.c_str(), -1, SQLITE_TRANSIENT);
+
+  if (filter.limit > 0 || filter.offset > 0) {
+    sqlite3_bind_int64(stmt, bind_index++,
+                       (filter.limit > 0) ? (sqlite3_int64) filter.limit : -1);
+    sqlite3_bind_int64(stmt, bind_index++, (sqlite3_int64) filter.offset);
+  }
 
   rc = sqlite3_step(stmt);
 
@@ -3741,76 +5367,127 @@ BackupCatalog::getBackupList(std::string archive_name) {
 
     ostringstream oss;
 
-    oss << "error retrieving backup list from catalog database: " << sqlite3_errmsg(this->db_handle);
-    sqlite3_finalize(stmt);
+    oss << "error retrieving backup list from catalog database: "
+        << sqlite3_errmsg(this->db_handle);
+    this->close();
     throw CCatalogIssue(oss.str());
 
   }
 
+}
+
+BaseBackupCursor::~BaseBackupCursor() {
+
+  this->close();
+
+}
+
+void BaseBackupCursor::close() {
+
+  if (stmt != nullptr) {
+    sqlite3_finalize(stmt);
+    stmt = nullptr;
+  }
+
+  rc = SQLITE_DONE;
+
+}
+
+bool BaseBackupCursor::next(std::shared_ptr<BaseBackupDescr> &descr) {
+
+  shared_ptr<BaseBackupDescr> bbdescr = nullptr;
+
+  if (stmt == nullptr || rc != SQLITE_ROW) {
+    this->close();
+    return false;
+  }
+
+  bbdescr = make_shared<BaseBackupDescr>();
+  bbdescr->setAffectedAttributes(backupAttrs);
+
+  this->catalog->fetchBackupIntoDescr(stmt,
+                                      bbdescr,
+                                      Range(0, backupAttrs.size() - 1));
+
   /*
-   * Retrieve list of backups.
+   * Since we fetch tablespace and basebackup information in one
+   * query, a basebackup with more than one tablespace spans multiple
+   * rows. Collect them until the next basebackup shows up.
    */
-  while (rc == SQLITE_ROW) {
+  do {
 
-    shared_ptr<BaseBackupDescr> bbdescr = make_shared<BaseBackupDescr>();
     shared_ptr<BackupTablespaceDescr> tablespace = make_shared<BackupTablespaceDescr>();
 
-    /* pivot pointer */
-    shared_ptr<BaseBackupDescr> curr_descr = nullptr;
-
-    bbdescr->setAffectedAttributes(backupAttrs);
     tablespace->setAffectedAttributes(tblspcAttrs);
 
-    this->fetchBackupIntoDescr(stmt,
-                               bbdescr,
-                               Range(0, backupAttrs.size() - 1));
+    this->catalog->fetchBackupTablespaceIntoDescr(stmt,
+                                                  tablespace,
+
+                                                  /*
+                                                   * NOTE:
+                                                   *
+                                                   * The offset for tablespace columns always
+                                                   * starts after the attributes from the backup
+                                                   * catalog table
+                                                   */
+                                                  Range(backupAttrs.size(),
+                                                        backupAttrs.size() + tblspcAttrs.size() - 1));
+
+    if (tablespace->backup_id >= 0) {
+      /* Okay, looks like a valid tablespace entry */
+      bbdescr->tablespaces.push_back(tablespace);
+    }
+
+    /* Now move the result forward to the next row */
+    rc = sqlite3_step(stmt);
+
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
 
-    /*
-     * Since we fetch tablespace and basebackup information in one
-     * query, we only push basebackup information if the last
-     * encountered backup_id differs.
-     */
-    if (current_backup_id != bbdescr->id) {
+      ostringstream oss;
 
-      list.push_back(bbdescr);
-      current_backup_id = bbdescr->id;
+      oss << "error retrieving backup list from catalog database: "
+          << sqlite3_errmsg(this->db_handle);
+      this->close();
+      throw CCatalogIssue(oss.str());
 
     }
 
-    this->fetchBackupTablespaceIntoDescr(stmt,
-                                         tablespace,
+    /* backup ID is always the first column */
+  } while (rc == SQLITE_ROW && sqlite3_column_int(stmt, 0) == bbdescr->id);
 
-                                         /*
-                                          * NOTE:
-                                          *
-                                          * The offset for tablespace columns always
-                                          * starts after the attributes from the backup
-                                          * catalog table
-                                          */
+  descr = bbdescr;
+  return true;
 
-                                         Range(backupAttrs.size(), backupAttrs.size() + tblspcAttrs.size() - 1));
+}
 
-    if (tablespace->backup_id >= 0) {
+std::shared_ptr<BaseBackupCursor>
+BackupCatalog::openBackupCursor(BaseBackupListFilter filter) {
 
-      /* Okay, looks like a valid tablespace entry */
-      curr_descr = list.back();
+  if (!this->available()) {
+    throw CCatalogIssue("catalog database not opened");
+  }
 
-      if (curr_descr == nullptr) {
-        /* oops */
-        sqlite3_finalize(stmt);
-        throw CCatalogIssue("unexpected state in base backup list in getBackupList()");
-      }
+  return std::make_shared<BaseBackupCursor>(this, this->db_handle, filter);
 
-      curr_descr->tablespaces.push_back(tablespace);
+}
 
-    }
+std::vector<std::shared_ptr<BaseBackupDescr>>
+BackupCatalog::getBackupList(std::string archive_name) {
 
-    /* Now move the result forward to the next row */
-    rc = sqlite3_step(stmt);
+  std::vector<std::shared_ptr<BaseBackupDescr>> list;
+  std::shared_ptr<BaseBackupCursor> cursor = nullptr;
+  std::shared_ptr<BaseBackupDescr> bbdescr = nullptr;
+  BaseBackupListFilter filter;
+
+  filter.archive_name = archive_name;
+  filter.order = BASEBACKUP_LIST_STARTED_DESC;
 
+  cursor = this->openBackupCursor(filter);
+
+  while (cursor->next(bbdescr)) {
+    list.push_back(bbdescr);
   }
 
-  sqlite3_finalize(stmt);
   return list;
 }
 
@@ -3991,11 +5668,12 @@ BackupCatalog::getBackupProfiles() {
    * Build the query.
    */
   ostringstream query;
-  Range range(0, 10);
+  Range range(0, 17);
 
   query << "SELECT id, name, compress_type, max_rate, label, "
         << "fast_checkpoint, include_wal, wait_for_wal, noverify_checksums, "
-        << "manifest, manifest_checksums "
+        << "manifest, manifest_checksums, compress_level, compress_workers, "
+        << "parallel_writers, incremental, server_compression, adaptive_rate, deduplicate "
         << "FROM backup_profiles ORDER BY name;";
 
 #ifdef __DEBUG__
@@ -4014,6 +5692,13 @@ BackupCatalog::getBackupProfiles() {
   attr.push_back(SQL_BCK_PROF_NOVERIFY_CHECKSUMS_ATTNO);
   attr.push_back(SQL_BCK_PROF_MANIFEST_ATTNO);
   attr.push_back(SQL_BCK_PROF_MANIFEST_CHECKSUMS_ATTNO);
+  attr.push_back(SQL_BCK_PROF_COMPRESS_LEVEL_ATTNO);
+  attr.push_back(SQL_BCK_PROF_COMPRESS_WORKERS_ATTNO);
+  attr.push_back(SQL_BCK_PROF_PARALLEL_WRITERS_ATTNO);
+  attr.push_back(SQL_BCK_PROF_INCREMENTAL_ATTNO);
+  attr.push_back(SQL_BCK_PROF_SERVER_COMPRESSION_ATTNO);
+  attr.push_back(SQL_BCK_PROF_ADAPTIVE_RATE_ATTNO);
+  attr.push_back(SQL_BCK_PROF_DEDUPLICATE_ATTNO);
 
   int rc = sqlite3_prepare_v2(this->db_handle,
                               query.str().c_str(),
@@ -4066,7 +5751,7 @@ std::shared_ptr<BackupProfileDescr> BackupCatalog::getBackupProfile(int profile_
   sqlite3_stmt *stmt;
   int rc;
   std::ostringstream query;
-  Range range(0, 10);
+  Range range(0, 17);
 
   if (!this->available()) {
     throw CCatalogIssue("catalog database not opened");
@@ -4088,7 +5773,8 @@ std::shared_ptr<BackupProfileDescr> BackupCatalog::getBackupProfile(int profile_
    */
   query << "SELECT id, name, compress_type, max_rate, label, "
         << "fast_checkpoint, include_wal, wait_for_wal, noverify_checksums, "
-        << "manifest, manifest_checksums "
+        << "manifest, manifest_checksums, compress_level, compress_workers, "
+        << "parallel_writers, incremental, server_compression, adaptive_rate, deduplicate "
         << "FROM backup_profiles WHERE id = ?1;";
 
 #ifdef __DEBUG__
@@ -4116,6 +5802,13 @@ std::shared_ptr<BackupProfileDescr> BackupCatalog::getBackupProfile(int profile_
   descr->pushAffectedAttribute(SQL_BCK_PROF_NOVERIFY_CHECKSUMS_ATTNO);
   descr->pushAffectedAttribute(SQL_BCK_PROF_MANIFEST_ATTNO);
   descr->pushAffectedAttribute(SQL_BCK_PROF_MANIFEST_CHECKSUMS_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_COMPRESS_LEVEL_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_COMPRESS_WORKERS_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_PARALLEL_WRITERS_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_INCREMENTAL_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_SERVER_COMPRESSION_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_ADAPTIVE_RATE_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_DEDUPLICATE_ATTNO);
 
   if (rc != SQLITE_OK) {
     ostringstream oss;
@@ -4164,7 +5857,7 @@ std::shared_ptr<BackupProfileDescr> BackupCatalog::getBackupProfile(std::string
   sqlite3_stmt *stmt;
   int rc;
   std::ostringstream query;
-  Range range(0, 10);
+  Range range(0, 17);
 
   if (!this->available()) {
     throw CCatalogIssue("catalog database not opened");
@@ -4175,7 +5868,8 @@ std::shared_ptr<BackupProfileDescr> BackupCatalog::getBackupProfile(std::string
    */
   query << "SELECT id, name, compress_type, max_rate, label, "
         << "fast_checkpoint, include_wal, wait_for_wal, noverify_checksums, "
-        << "manifest, manifest_checksums "
+        << "manifest, manifest_checksums, compress_level, compress_workers, "
+        << "parallel_writers, incremental, server_compression, adaptive_rate, deduplicate "
         << "FROM backup_profiles WHERE name = ?1;";
 
 #ifdef __DEBUG__
@@ -4203,6 +5897,13 @@ std::shared_ptr<BackupProfileDescr> BackupCatalog::getBackupProfile(std::string
   descr->pushAffectedAttribute(SQL_BCK_PROF_NOVERIFY_CHECKSUMS_ATTNO);
   descr->pushAffectedAttribute(SQL_BCK_PROF_MANIFEST_ATTNO);
   descr->pushAffectedAttribute(SQL_BCK_PROF_MANIFEST_CHECKSUMS_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_COMPRESS_LEVEL_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_COMPRESS_WORKERS_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_PARALLEL_WRITERS_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_INCREMENTAL_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_SERVER_COMPRESSION_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_ADAPTIVE_RATE_ATTNO);
+  descr->pushAffectedAttribute(SQL_BCK_PROF_DEDUPLICATE_ATTNO);
 
   if (rc != SQLITE_OK) {
     ostringstream oss;
@@ -4254,8 +5955,10 @@ void BackupCatalog::createBackupProfile(std::shared_ptr<BackupProfileDescr> prof
 
   insert << "INSERT INTO backup_profiles("
          << "name, compress_type, max_rate, label, "
-         << "fast_checkpoint, include_wal, wait_for_wal, noverify_checksums, manifest, manifest_checksums) "
-         << "VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10);";
+         << "fast_checkpoint, include_wal, wait_for_wal, noverify_checksums, manifest, manifest_checksums, "
+         << "compress_level, compress_workers, parallel_writers, incremental, server_compression, "
+         << "adaptive_rate, deduplicate) "
+         << "VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17);";
 
 #ifdef __DEBUG__
   BOOST_LOG_TRIVIAL(debug) << "createBackupProfile query: " << insert.str();
@@ -4276,7 +5979,7 @@ void BackupCatalog::createBackupProfile(std::shared_ptr<BackupProfileDescr> prof
   /*
    * Bind new backup profile data.
    */
-  Range range(1, 10);
+  Range range(1, 17);
   this->SQLbindBackupProfileAttributes(profileDescr,
                                        profileDescr->getAffectedAttributes(),
                                        stmt,
@@ -4628,6 +6331,19 @@ int BackupCatalog::SQLbindBackupAttributes(std::shared_ptr<BaseBackupDescr> bbde
                        bbdescr->pg_version_num);
       break;
 
+    case SQL_BACKUP_PARENT_ID_ATTNO:
+      if (bbdescr->parent_id >= 0)
+        sqlite3_bind_int(stmt, result,
+                         bbdescr->parent_id);
+      else
+        sqlite3_bind_null(stmt, result);
+      break;
+
+    case SQL_BACKUP_COMPRESS_TYPE_ATTNO:
+      sqlite3_bind_int(stmt, result,
+                       bbdescr->compress_type);
+      break;
+
     case SQL_BACKUP_COMPUTED_RETENTION_DATETIME:
       /* computed values must not be bound */
       throw CCatalogIssue("attempt to bind expression column exceeds_retention_rule");
@@ -4810,6 +6526,34 @@ int BackupCatalog::SQLbindBackupProfileAttributes(std::shared_ptr<BackupProfileD
                         profileDescr->manifest_checksums.c_str(), -1, SQLITE_STATIC);
       break;
 
+    case SQL_BCK_PROF_COMPRESS_LEVEL_ATTNO:
+      sqlite3_bind_int(stmt, result, profileDescr->compress_level);
+      break;
+
+    case SQL_BCK_PROF_COMPRESS_WORKERS_ATTNO:
+      sqlite3_bind_int(stmt, result, profileDescr->compress_workers);
+      break;
+
+    case SQL_BCK_PROF_PARALLEL_WRITERS_ATTNO:
+      sqlite3_bind_int(stmt, result, profileDescr->parallel_writers);
+      break;
+
+    case SQL_BCK_PROF_INCREMENTAL_ATTNO:
+      sqlite3_bind_int(stmt, result, profileDescr->incremental);
+      break;
+
+    case SQL_BCK_PROF_SERVER_COMPRESSION_ATTNO:
+      sqlite3_bind_int(stmt, result, profileDescr->server_compression);
+      break;
+
+    case SQL_BCK_PROF_ADAPTIVE_RATE_ATTNO:
+      sqlite3_bind_int(stmt, result, profileDescr->adaptive_rate);
+      break;
+
+    case SQL_BCK_PROF_DEDUPLICATE_ATTNO:
+      sqlite3_bind_int(stmt, result, profileDescr->deduplicate);
+      break;
+
     default:
       {
         ostringstream oss;
@@ -4993,14 +6737,30 @@ int BackupCatalog::SQLbindArchiveAttributes(shared_ptr<CatalogDescr> descr,
 }
 
 
+void BackupCatalog::setKeepOpen(bool keep_open) {
+
+  this->keep_open = keep_open;
+
+}
+
 void BackupCatalog::close() {
+
+  if (this->keep_open)
+    return;
+
   if (available()) {
 
-    int rc = sqlite3_close(this->db_handle);
+    int rc;
+
+    /* open statements keep the connection busy */
+    this->clearStatementCache();
+
+    rc = sqlite3_close(this->db_handle);
 
     if (rc == SQLITE_OK) {
       this->isOpen    = false;
       this->db_handle = NULL;
+      this->tx_depth  = 0;
 
     } else if (rc == SQLITE_BUSY) {
       throw CCatalogIssue("attempt to close busy database connection");
@@ -5010,10 +6770,107 @@ void BackupCatalog::close() {
 }
 
 BackupCatalog::~BackupCatalog() {
+  this->keep_open = false;
+
   if (available())
     this->close();
 }
 
+sqlite3_stmt *BackupCatalog::cachedStatement(std::string operation,
+                                             const std::vector<int> &attrs,
+                                             std::function<std::string()> sql) {
+
+  CatalogStatementKey key(operation, attrs);
+  sqlite3_stmt *stmt = NULL;
+  std::string sqltext;
+  int rc;
+
+  if (!this->available())
+    throw CCatalogIssue("cannot prepare statement: database not opened");
+
+  auto it = this->stmt_cache.find(key);
+
+  if (it != this->stmt_cache.end()) {
+
+    /*
+     * Should have been released already, but make sure
+     * we never hand out a statement with stale state.
+     */
+    sqlite3_reset(it->second);
+    sqlite3_clear_bindings(it->second);
+
+    this->stmt_cache_hits++;
+    return it->second;
+
+  }
+
+  sqltext = sql();
+
+#ifdef __DEBUG__
+  BOOST_LOG_TRIVIAL(debug) << "prepare cached SQL " << sqltext;
+#endif
+
+  /*
+   * sqlite3_prepare_v2() statements are recompiled transparently
+   * by sqlite3_step() if the schema was changed by another
+   * connection, so they stay valid as long as the referenced
+   * tables and columns exist.
+   */
+  rc = sqlite3_prepare_v2(this->db_handle,
+                          sqltext.c_str(),
+                          -1,
+                          &stmt,
+                          NULL);
+
+  if (rc != SQLITE_OK) {
+    std::ostringstream oss;
+    oss << "error code "
+        << rc
+        << " when preparing catalog statement for "
+        << operation << ": "
+        << sqlite3_errmsg(this->db_handle);
+    sqlite3_finalize(stmt);
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->stmt_cache[key] = stmt;
+  this->stmt_cache_misses++;
+
+  return stmt;
+
+}
+
+void BackupCatalog::releaseStatement(sqlite3_stmt *stmt) {
+
+  if (stmt == NULL)
+    return;
+
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+
+}
+
+void BackupCatalog::clearStatementCache() {
+
+  for (auto &entry : this->stmt_cache)
+    sqlite3_finalize(entry.second);
+
+  this->stmt_cache.clear();
+
+}
+
+size_t BackupCatalog::statementCacheSize() {
+  return this->stmt_cache.size();
+}
+
+unsigned long long BackupCatalog::statementCacheHits() {
+  return this->stmt_cache_hits;
+}
+
+unsigned long long BackupCatalog::statementCacheMisses() {
+  return this->stmt_cache_misses;
+}
+
 std::string BackupCatalog::affectedColumnsToString(std::vector<int> affectedAttributes) {
 
   ostringstream result;
@@ -5344,8 +7201,8 @@ void BackupCatalog::registerBasebackup(int archive_id,
   }
 
   rc = sqlite3_prepare_v2(this->db_handle,
-                          "INSERT INTO backup(archive_id, xlogpos, timeline, label, fsentry, started, systemid, wal_segment_size, used_profile, pg_version_num) "
-                          "VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10);",
+                          "INSERT INTO backup(archive_id, xlogpos, timeline, label, fsentry, started, systemid, wal_segment_size, used_profile, pg_version_num, parent_id, compress_type) "
+                          "VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12);",
                           -1,
                           &stmt,
                           NULL);
@@ -5370,6 +7227,14 @@ void BackupCatalog::registerBasebackup(int archive_id,
   sqlite3_bind_int(stmt, 9, backupDescr->used_profile);
   sqlite3_bind_int(stmt, 10, backupDescr->pg_version_num);
 
+  /* Full basebackups don't have a parent */
+  if (backupDescr->parent_id >= 0)
+    sqlite3_bind_int(stmt, 11, backupDescr->parent_id);
+  else
+    sqlite3_bind_null(stmt, 11);
+
+  sqlite3_bind_int(stmt, 12, backupDescr->compress_type);
+
   /*
    * Execute the statement.
    */
@@ -5517,8 +7382,7 @@ void BackupCatalog::updateStream(int streamid,
 
   int rc;
   sqlite3_stmt *stmt;
-  ostringstream updateSQL;
-  unsigned int boundCols;
+  unsigned int boundCols = affectedColumns.size() + 1;
 
   if(!this->available()) {
     throw CCatalogIssue("could not update stream: database not opened");
@@ -5532,44 +7396,44 @@ void BackupCatalog::updateStream(int streamid,
     throw CCatalogIssue("cannot update stream with empty attribute list");
 
   /*
-   * Build UPDATE SQL command...
+   * Streamers update their status over and over again with the
+   * same attributes, so the UPDATE is generated and prepared only
+   * once per attribute list.
    */
-  updateSQL << "UPDATE stream SET ";
+  stmt = this->cachedStatement("updateStream", affectedColumns, [&affectedColumns]() {
 
-  /*
-   * Loop through the affected columns list and
-   * build a comma seprated list of col=? pairs.
-   */
+      ostringstream updateSQL;
+      unsigned int col;
 
-  for (boundCols = 0; boundCols < affectedColumns.size(); boundCols++) {
+      /*
+       * Build UPDATE SQL command...
+       */
+      updateSQL << "UPDATE stream SET ";
 
-    updateSQL << BackupCatalog::SQLgetUpdateColumnTarget(SQL_STREAM_ENTITY,
-                                                         affectedColumns[boundCols])
-              << (boundCols + 1);
+      /*
+       * Loop through the affected columns list and
+       * build a comma seprated list of col=? pairs.
+       */
+      for (col = 0; col < affectedColumns.size(); col++) {
 
-    if (boundCols < affectedColumns.size() -1 ) {
-      updateSQL << ", ";
-    }
+        updateSQL << BackupCatalog::SQLgetUpdateColumnTarget(SQL_STREAM_ENTITY,
+                                                             affectedColumns[col])
+                  << (col + 1);
 
-  }
+        if (col < affectedColumns.size() -1 ) {
+          updateSQL << ", ";
+        }
 
-  /*
-   * WHERE clause identifes tuple per stream id
-   */
-  updateSQL << " WHERE id = ?" << (++boundCols) << ";";
+      }
 
-#ifdef __DEBUG__
-  BOOST_LOG_TRIVIAL(debug) << "generate UPDATE SQL " << updateSQL.str();
-#endif
+      /*
+       * WHERE clause identifes tuple per stream id
+       */
+      updateSQL << " WHERE id = ?" << (col + 1) << ";";
 
-  /*
-   * Prepare the SQL statement.
-   */
-  rc = sqlite3_prepare_v2(this->db_handle,
-                          updateSQL.str().c_str(),
-                          -1,
-                          &stmt,
-                          NULL);
+      return updateSQL.str();
+
+    });
 
   /*
    * Bind UPDATE values. Please note that we rely
@@ -5595,11 +7459,11 @@ void BackupCatalog::updateStream(int streamid,
     ostringstream oss;
     oss << "error updating stream in catalog database: "
         << sqlite3_errmsg(this->db_handle);
-    sqlite3_finalize(stmt);
+    this->releaseStatement(stmt);
     throw CCatalogIssue(oss.str());
   }
 
-  sqlite3_finalize(stmt);
+  this->releaseStatement(stmt);
 }
 
 std::shared_ptr<CatalogProc> BackupCatalog::getProc(int archive_id, std::string type) {
@@ -5609,11 +7473,6 @@ std::shared_ptr<CatalogProc> BackupCatalog::getProc(int archive_id, std::string
   std::shared_ptr<CatalogProc> procInfo(nullptr);
   std::vector<int> attrs;
 
-  std::string query =
-    "SELECT pid, archive_id, type, "
-    "started, state, shm_key, shm_id FROM procs WHERE archive_id = ?1 "
-    "AND type = ?2;";
-
   procInfo = std::make_shared<CatalogProc>();
 
   if (!this->available()) {
@@ -5621,25 +7480,14 @@ std::shared_ptr<CatalogProc> BackupCatalog::getProc(int archive_id, std::string
   }
 
   /*
-   * Prepare the query...
+   * Prepare the query, the launcher polls this, so
+   * reuse the cached statement.
    */
-#ifdef __DEBUG__
-  BOOST_LOG_TRIVIAL(debug) << "SELECT SQL: " << query;
-#endif
-
-  rc = sqlite3_prepare_v2(this->db_handle,
-                          query.c_str(),
-                          -1,
-                          &stmt,
-                          NULL);
-
-  if (rc != SQLITE_OK) {
-    std::ostringstream oss;
-    oss << "error querying procs catalog table for archive ID "
-        << archive_id << ", type " << type
-        << ": " << sqlite3_errmsg(this->db_handle);
-    throw CCatalogIssue(oss.str());
-  }
+  stmt = this->cachedStatement("getProc", attrs, []() {
+      return std::string("SELECT pid, archive_id, type, "
+                         "started, state, shm_key, shm_id FROM procs WHERE archive_id = ?1 "
+                         "AND type = ?2;");
+    });
 
   /*
    * Record attributes we want to retrieve ...
@@ -5667,7 +7515,7 @@ std::shared_ptr<CatalogProc> BackupCatalog::getProc(int archive_id, std::string
     std::ostringstream oss;
     oss << "error selecting proc information :"
         << sqlite3_errmsg(this->db_handle);
-    sqlite3_finalize(stmt);
+    this->releaseStatement(stmt);
     throw CCatalogIssue(oss.str());
   }
 
@@ -5677,19 +7525,24 @@ std::shared_ptr<CatalogProc> BackupCatalog::getProc(int archive_id, std::string
   if(rc == SQLITE_ROW) {
 
     /* Fetch proc data into new CatalogProc handle */
-    procInfo = this->fetchCatalogProcData(stmt,
-                                          attrs);
+    try {
+      procInfo = this->fetchCatalogProcData(stmt,
+                                            attrs);
+    } catch (CCatalogIssue &e) {
+      this->releaseStatement(stmt);
+      throw e;
+    }
 
     if ((rc = sqlite3_step(stmt)) != SQLITE_DONE) {
       std::ostringstream oss;
       oss << "unexpected number for rows: getProc()";
-      sqlite3_finalize(stmt);
+      this->releaseStatement(stmt);
       throw CCatalogIssue(oss.str());
     }
 
   }
 
-  sqlite3_finalize(stmt);
+  this->releaseStatement(stmt);
   return procInfo;
 }
 
@@ -5846,49 +7699,49 @@ void BackupCatalog::updateProc(std::shared_ptr<CatalogProc> procInfo,
 
   int rc;
   sqlite3_stmt *stmt;
-  std::ostringstream updateSQL;
-  unsigned int boundCols = 0;
+  unsigned int boundCols = affectedAttributes.size() + 2;
 
   if (!this->available())
     throw CCatalogIssue("could not update process handle: database not opened");
 
-  /*
-   * Build UPDATE SQL command string.
-   */
-  updateSQL << "UPDATE procs SET ";
+  if (affectedAttributes.size() <= 0)
+    throw CCatalogIssue("cannot update process handle with empty attribute list");
 
   /*
-   * Prepare the update statement.
+   * Workers update their process handles repeatedly with
+   * the same attributes, reuse the prepared UPDATE.
    */
-  for (boundCols = 0; boundCols < affectedAttributes.size(); boundCols++) {
+  stmt = this->cachedStatement("updateProc", affectedAttributes, [&affectedAttributes]() {
 
-    /* boundCols must start at index 1 ! */
-    updateSQL << BackupCatalog::SQLgetUpdateColumnTarget(SQL_PROCS_ENTITY,
-                                                         affectedAttributes[boundCols])
-              << (boundCols + 1);
+      std::ostringstream updateSQL;
+      unsigned int col;
 
-    if (boundCols < affectedAttributes.size() -1 ) {
-      updateSQL << ", ";
-    }
-  }
+      /*
+       * Build UPDATE SQL command string.
+       */
+      updateSQL << "UPDATE procs SET ";
 
-  /*
-   * ... don't forget the WHERE clause ...
-   */
-  ++boundCols;
-  updateSQL << " WHERE pid = ?" << boundCols;
-  ++boundCols;
-  updateSQL << "AND archive_id = ?" << boundCols << ";";
+      for (col = 0; col < affectedAttributes.size(); col++) {
 
-#ifdef __DEBUG__
-  BOOST_LOG_TRIVIAL(debug) << "generate UPDATE SQL " << updateSQL.str();
-#endif
+        /* bind indexes must start at 1 ! */
+        updateSQL << BackupCatalog::SQLgetUpdateColumnTarget(SQL_PROCS_ENTITY,
+                                                             affectedAttributes[col])
+                  << (col + 1);
 
-  rc = sqlite3_prepare_v2(this->db_handle,
-                          updateSQL.str().c_str(),
-                          -1,
-                          &stmt,
-                          NULL);
+        if (col < affectedAttributes.size() -1 ) {
+          updateSQL << ", ";
+        }
+      }
+
+      /*
+       * ... don't forget the WHERE clause ...
+       */
+      updateSQL << " WHERE pid = ?" << (col + 1)
+                << " AND archive_id = ?" << (col + 2) << ";";
+
+      return updateSQL.str();
+
+    });
 
   /*
    * Assign bind variables. Please note that we rely
@@ -5910,17 +7763,17 @@ void BackupCatalog::updateProc(std::shared_ptr<CatalogProc> procInfo,
   /*
    * Execute the UPDATE statement.
    */
-  sqlite3_step(stmt);
+  rc = sqlite3_step(stmt);
 
   if (rc != SQLITE_DONE) {
     std::ostringstream oss;
     oss << "error updating catalog proc handle: "
         << sqlite3_errmsg(this->db_handle);
-    sqlite3_finalize(stmt);
+    this->releaseStatement(stmt);
     throw CCatalogIssue(oss.str());
   }
 
-  sqlite3_finalize(stmt);
+  this->releaseStatement(stmt);
 }
 
 void BackupCatalog::registerStream(int archive_id,
@@ -7242,6 +9095,9 @@ void BackupCatalog::checkCatalog() {
   if (!this->available())
     throw CCatalogIssue("catalog database not opened");
 
+  /* Don't keep statements prepared against an older schema */
+  this->clearStatementCache();
+
   if (!this->tableExists("version"))
     throw CCatalogIssue("catalog database doesn't have a \"version\" table");
 
@@ -7368,17 +9224,33 @@ void BackupCatalog::setPragma() {
     throw CCatalogIssue(oss.str());
   }
 
+  this->applySynchronous();
+
   /*
    * Doing catalog maintenance can cause large
    * delays in some cases, so it's okay to
-   * define a large value here.
+   * wait long for a lock, see busyHandler().
    *
    * We usually try hard to *not* hold SQLite transactions
    * very long, but this can't be guaranteed all over
    * the place.
    */
+  this->busy_waited_ms = 0;
+  sqlite3_busy_handler(this->db_handle, BackupCatalog::busyHandler, this);
+
+}
+
+void BackupCatalog::applySynchronous() {
+
+  int rc;
+  char *errmsg = NULL;
+  std::string pragma = "PRAGMA synchronous=" + this->synchronous + ";";
+
+  if (this->db_handle == NULL)
+    return;
+
   rc = sqlite3_exec(this->db_handle,
-                    "PRAGMA busy_timeout=60000;",
+                    pragma.c_str(),
                     NULL,
                     NULL,
                     &errmsg);
@@ -7392,6 +9264,75 @@ void BackupCatalog::setPragma() {
 
 }
 
+int BackupCatalog::busyHandler(void *arg, int count) {
+
+  BackupCatalog *catalog = (BackupCatalog *) arg;
+  unsigned int delay;
+
+  /* A new lock conflict starts a new wait */
+  if (count == 0)
+    catalog->busy_waited_ms = 0;
+
+  if (catalog->busy_waited_ms >= catalog->busy_timeout)
+    return 0;
+
+  /*
+   * Exponential backoff, starting at 1ms and capped at
+   * CATALOG_BUSY_MAX_DELAY_MS, plus up to 50% jitter so processes
+   * waiting for the same lock don't retry in lockstep.
+   */
+  delay = CATALOG_BUSY_MAX_DELAY_MS;
+
+  if (count < 8)
+    delay = std::min((unsigned int) CATALOG_BUSY_MAX_DELAY_MS, 1U << count);
+
+  delay += (unsigned int) rand() % (delay / 2 + 1);
+  delay = std::min(delay, catalog->busy_timeout - catalog->busy_waited_ms);
+
+  usleep(delay * 1000);
+
+  catalog->busy_waited_ms += delay;
+  catalog->busy_retries++;
+
+  return 1;
+
+}
+
+void BackupCatalog::setBusyTimeout(unsigned int timeout_ms) {
+  this->busy_timeout = timeout_ms;
+}
+
+unsigned int BackupCatalog::getBusyTimeout() {
+  return this->busy_timeout;
+}
+
+unsigned long long BackupCatalog::busyRetries() {
+  return this->busy_retries;
+}
+
+void BackupCatalog::setSynchronous(std::string level) {
+
+  std::string upper = boost::to_upper_copy(level);
+
+  if (upper != "OFF" && upper != "NORMAL"
+      && upper != "FULL" && upper != "EXTRA") {
+    std::ostringstream oss;
+    oss << "invalid catalog synchronous level \"" << level << "\"";
+    throw CCatalogIssue(oss.str());
+  }
+
+  this->synchronous = upper;
+
+  /* Takes effect immediately on an opened catalog */
+  if (this->available())
+    this->applySynchronous();
+
+}
+
+std::string BackupCatalog::getSynchronous() {
+  return this->synchronous;
+}
+
 void BackupCatalog::setCatalogDB(string sqliteDB) {
   /* we don't care whether the database exists already! */
   this->sqliteDB = sqliteDB;
@@ -88,24 +88,44 @@ std::shared_ptr<OutputFormatter> OutputFormatter::formatter(std::shared_ptr<Outp
     formatter = std::make_shared<JsonOutputFormatter>(config, catalog, catalog_descr);
     break;
 
+  case OUTPUT_JSON_LINES:
+
+    formatter = std::make_shared<JsonLinesOutputFormatter>(config, catalog, catalog_descr);
+    break;
+
   }
 
   return formatter;
 
 }
 
+void OutputFormatter::streamAs(std::shared_ptr<BaseBackupCursor> cursor,
+                               std::ostream &output) {
+
+  std::shared_ptr<BaseBackupDescr> basebackup = nullptr;
+
+  this->beginList(OUTPUT_LIST_BASEBACKUPS, output);
+
+  while (cursor->next(basebackup)) {
+    this->row(basebackup, output);
+  }
+
+  this->endList(output);
+
+}
+
 void OutputFormatter::nodeAs(std::exception &e,
                              std::ostringstream &output,
                              std::string output_type) {
 
   namespace pt = boost::property_tree;
 
-  if (output_type == "json") {
+  if (output_type == "json" || output_type == "ndjson") {
     pt::ptree head;
 
     head.put("severity", "error");
     head.put("message", e.what());
-    pt::write_json(output, head);
+    pt::write_json(output, head, (output_type == "json"));
   }
 
   if (output_type == "console") {
@@ -146,139 +166,137 @@ void ConsoleOutputFormatter::nodeAs(std::shared_ptr<std::list<directory_entry>>
 
 }
 
-void ConsoleOutputFormatter::listBackupsVerbose(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
-                                                std::ostringstream &output) {
+void ConsoleOutputFormatter::backupRowVerbose(std::shared_ptr<BaseBackupDescr> basebackup,
+                                              std::ostream &output) {
+
+  size_t upstream_total_size = 0;
 
   /*
-   * Format the output.
+   * Directory handle for basebackup directory on disk.
    */
-  output << CPGBackupCtlBase::makeHeader("Basebackups in archive " + catalog_descr->archive_name,
-                                       boost::format("%-20s\t%-60s") % "Property" % "Value",
-                                       80);
+  StreamingBaseBackupDirectory directory(path(basebackup->fsentry).filename().string(),
+                                         catalog_descr->directory);
 
-  for (auto &basebackup : list) {
-
-    size_t upstream_total_size = 0;
-
-    /*
-     * Directory handle for basebackup directory on disk.
-     */
-    StreamingBaseBackupDirectory directory(path(basebackup->fsentry).filename().string(),
-                                           catalog_descr->directory);
-
-    /*
-     * Details for the backup profile used by the current basebackup.
-     */
-    shared_ptr<BackupProfileDescr> backupProfile
-      = this->catalog->getBackupProfile(basebackup->used_profile);
-
-    /*
-     * Verify state of the current basebackup.
-     */
-    BaseBackupVerificationCode bbstatus
-      = StreamingBaseBackupDirectory::verify(basebackup);
-
-    output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
-                                       % "ID" % basebackup->id);
-    output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
-                                       % "Pinned" % ( (basebackup->pinned == 0) ? "NO" : "YES" ));
-    output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
-                                       % "Backup" % basebackup->fsentry);
-    output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
-                                       % "Catalog State" % basebackup->status);
-    output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
-                                       % "Label" % basebackup->label);
-    output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
-                                       % "WAL segment size" % basebackup->wal_segment_size);
-    output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
-                                       % "Started" % basebackup->started);
-    output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
-                                       % "Timeline" % basebackup->timeline);
-    output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
-                                       % "WAL start" % basebackup->xlogpos);
-    output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
-                                       % "WAL stop" % basebackup->xlogposend);
-    output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
-                                       % "System ID" % basebackup->systemid);
-    output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
-                                       % "Used Backup Profile" % backupProfile->name);
-
-    /*
-     * Print tablespace information belonging to the current basebackup
-     */
-    output << CPGBackupCtlBase::makeHeader("tablespaces",
-                                         boost::format("%-20s\t%-60s")
-                                         % "tablespace property"
-                                         % "value", 80);
+  /*
+   * Details for the backup profile used by the current basebackup.
+   */
+  shared_ptr<BackupProfileDescr> backupProfile
+    = this->catalog->getBackupProfile(basebackup->used_profile);
 
-    for (auto &tablespace : basebackup->tablespaces) {
+  /*
+   * Verify state of the current basebackup.
+   */
+  BaseBackupVerificationCode bbstatus
+    = StreamingBaseBackupDirectory::verify(basebackup);
+
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "ID" % basebackup->id);
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "Pinned" % ( (basebackup->pinned == 0) ? "NO" : "YES" ));
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "Backup Type"
+                                     % ( (basebackup->parent_id < 0)
+                                         ? std::string("full")
+                                         : ("incremental (parent ID "
+                                            + std::to_string(basebackup->parent_id) + ")") ));
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "Compression"
+                                     % BackupProfileDescr::compressionType(basebackup->compress_type));
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "Backup" % basebackup->fsentry);
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "Catalog State" % basebackup->status);
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "Label" % basebackup->label);
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "WAL segment size" % basebackup->wal_segment_size);
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "Started" % basebackup->started);
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "Timeline" % basebackup->timeline);
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "WAL start" % basebackup->xlogpos);
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "WAL stop" % basebackup->xlogposend);
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "System ID" % basebackup->systemid);
+  output << CPGBackupCtlBase::makeLine(boost::format("%-20s\t%-60s")
+                                     % "Used Backup Profile" % backupProfile->name);
 
-      output << "---" << std::endl;
+  /*
+   * Print tablespace information belonging to the current basebackup
+   */
+  output << CPGBackupCtlBase::makeHeader("tablespaces",
+                                       boost::format("%-20s\t%-60s")
+                                       % "tablespace property"
+                                       % "value", 80);
 
-      /* Check for parent tablespace (also known as pg_default) */
-      if (tablespace->spcoid == 0) {
+  for (auto &tablespace : basebackup->tablespaces) {
 
-        output << " - " << boost::format("%-20s\%-60s")
-          % "upstream location" % "pg_default" << std::endl;
-        output << " - " << boost::format("%-20s\%-60s")
-          % "upstream size" % tablespace->spcsize << std::endl;
+    output << "---" << std::endl;
 
-      } else {
+    /* Check for parent tablespace (also known as pg_default) */
+    if (tablespace->spcoid == 0) {
 
-        output << " - " << boost::format("%-20s\%-60s")
-          % "oid" % tablespace->spcoid << std::endl;
-        output << " - " << boost::format("%-20s\%-60s")
-          % "upstream location" % tablespace->spclocation << std::endl;
-        output << " - " << boost::format("%-20s\%-60s")
-          % "upstream size" % tablespace->spcsize << std::endl;
+      output << " - " << boost::format("%-20s\%-60s")
+        % "upstream location" % "pg_default" << std::endl;
+      output << " - " << boost::format("%-20s\%-60s")
+        % "upstream size" % tablespace->spcsize << std::endl;
 
-      }
+    } else {
 
-      output << "---" << std::endl;
+      output << " - " << boost::format("%-20s\%-60s")
+        % "oid" % tablespace->spcoid << std::endl;
+      output << " - " << boost::format("%-20s\%-60s")
+        % "upstream location" % tablespace->spclocation << std::endl;
+      output << " - " << boost::format("%-20s\%-60s")
+        % "upstream size" % tablespace->spcsize << std::endl;
 
-      upstream_total_size += tablespace->spcsize;
     }
 
-    output << "Summary:" << std::endl;
-    output << boost::format("%-25s\t%-40s")
-      % "Total size upstream:" % CPGBackupCtlBase::prettySize(upstream_total_size * 1024) << std::endl;
+    output << "---" << std::endl;
 
-    /*
-     * Display the state and local size of the basebackup. If the basebackup
-     * doesn't exist anymore, print a warning instead.
-     */
-    if (bbstatus != BASEBACKUP_OK) {
+    upstream_total_size += tablespace->spcsize;
+  }
 
-      output << boost::format("%-25s\t%-40s")
-        % CPGBackupCtlBase::stdout_red("Backup status (ON-DISK):", true)
-        % CPGBackupCtlBase::stdout_red(BackupDirectory::verificationCodeAsString(bbstatus), true) << std::endl;
+  output << "Summary:" << std::endl;
+  output << boost::format("%-25s\t%-40s")
+    % "Total size upstream:" % CPGBackupCtlBase::prettySize(upstream_total_size * 1024) << std::endl;
 
-      output << boost::format("%-25s\t%-40s")
-        % "Total local backup size:"
-        % "NOT AVAILABLE" << std::endl;
+  /*
+   * Display the state and local size of the basebackup. If the basebackup
+   * doesn't exist anymore, print a warning instead.
+   */
+  if (bbstatus != BASEBACKUP_OK) {
 
+    output << boost::format("%-25s\t%-40s")
+      % CPGBackupCtlBase::stdout_red("Backup status (ON-DISK):", true)
+      % CPGBackupCtlBase::stdout_red(BackupDirectory::verificationCodeAsString(bbstatus), true) << std::endl;
 
-    } else {
+    output << boost::format("%-25s\t%-40s")
+      % "Total local backup size:"
+      % "NOT AVAILABLE" << std::endl;
 
-      output << boost::format("%-25s\t%-40s")
-        % "Backup duration" % basebackup->duration << std::endl;
 
-      output << boost::format("%-25s\t%-40s")
-        % CPGBackupCtlBase::stdout_green("Backup status (ON-DISK):", true)
-        % CPGBackupCtlBase::stdout_green(BackupDirectory::verificationCodeAsString(bbstatus), true)
-             << std::endl;
+  } else {
 
-      output << boost::format("%-25s\t%-40s")
-        % "Total local backup size:"
-        % CPGBackupCtlBase::prettySize(directory.size()) << std::endl;
+    output << boost::format("%-25s\t%-40s")
+      % "Backup duration" % basebackup->duration << std::endl;
 
-    }
+    output << boost::format("%-25s\t%-40s")
+      % CPGBackupCtlBase::stdout_green("Backup status (ON-DISK):", true)
+      % CPGBackupCtlBase::stdout_green(BackupDirectory::verificationCodeAsString(bbstatus), true)
+           << std::endl;
 
-    output << CPGBackupCtlBase::makeLine(80) << std::endl;
-    output << std::endl;
+    output << boost::format("%-25s\t%-40s")
+      % "Total local backup size:"
+      % CPGBackupCtlBase::prettySize(directory.size()) << std::endl;
 
   }
 
+  output << CPGBackupCtlBase::makeLine(80) << std::endl;
+  output << std::endl;
+
 }
 
 void ConsoleOutputFormatter::nodeAs(std::vector<std::shared_ptr<ConnectionDescr>> connections,
@@ -318,114 +336,156 @@ void ConsoleOutputFormatter::nodeAs(std::vector<std::shared_ptr<ConnectionDescr>
 
 }
 
-void ConsoleOutputFormatter::listBackups(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
-                                         std::ostringstream &output) {
+void ConsoleOutputFormatter::backupRow(std::shared_ptr<BaseBackupDescr> basebackup,
+                                       std::ostream &output) {
 
-  output << CPGBackupCtlBase::makeHeader("Basebackups in archive " + catalog_descr->archive_name,
-                                         boost::format("%-5s\t%-35s\t%-40s") % "ID" % "Backup" % "Size",
-                                         80);
+  /*
+   * Verify state of the current basebackup.
+   */
+  BaseBackupVerificationCode bbstatus
+    = StreamingBaseBackupDirectory::verify(basebackup);
+  std::string status = "";
 
-  for (auto &basebackup : list) {
+  /*
+   * Directory handle for basebackup directory on disk.
+   */
+  StreamingBaseBackupDirectory directory(path(basebackup->fsentry).filename().string(),
+                                         catalog_descr->directory);
 
-    /*
-     * Verify state of the current basebackup.
-     */
-    BaseBackupVerificationCode bbstatus
-      = StreamingBaseBackupDirectory::verify(basebackup);
-    std::string status = "";
+  /*
+   * Transform basebackup status into its string representation.
+   */
+  if (bbstatus != BASEBACKUP_OK) {
 
-    /*
-     * Directory handle for basebackup directory on disk.
-     */
-    StreamingBaseBackupDirectory directory(path(basebackup->fsentry).filename().string(),
-                                           catalog_descr->directory);
+    status = CPGBackupCtlBase::stdout_red(BackupDirectory::verificationCodeAsString(bbstatus), true);
 
-    /*
-     * Transform basebackup status into its string representation.
-     */
-    if (bbstatus != BASEBACKUP_OK) {
+    output << boost::format("%-5s\t%-35s\t%-40s")
+      % basebackup->id
+      % basebackup->fsentry
+      % "N/A"
+         << std::endl;
 
-      status = CPGBackupCtlBase::stdout_red(BackupDirectory::verificationCodeAsString(bbstatus), true);
+  } else {
 
-      output << boost::format("%-5s\t%-35s\t%-40s")
-        % basebackup->id
-        % basebackup->fsentry
-        % "N/A"
-           << std::endl;
+    status = CPGBackupCtlBase::stdout_green(BackupDirectory::verificationCodeAsString(bbstatus), true);
 
-    } else {
+    output << boost::format("%-5s\t%-35s\t%-40s")
+      % basebackup->id
+      % basebackup->fsentry
+      % CPGBackupCtlBase::prettySize(directory.size())
+         << std::endl;
 
-      status = CPGBackupCtlBase::stdout_green(BackupDirectory::verificationCodeAsString(bbstatus), true);
+  }
 
-      output << boost::format("%-5s\t%-35s\t%-40s")
-        % basebackup->id
-        % basebackup->fsentry
-        % CPGBackupCtlBase::prettySize(directory.size())
-           << std::endl;
+  /* Print compact list of basebackups */
 
-    }
+  output << "- Details" << std::endl;
 
-    /* Print compact list of basebackups */
+  /* Duration */
+  output << boost::format("\t%-20s\t%-60s")
+    % "Duration" % basebackup->duration
+       << std::endl;
 
-    output << "- Details" << std::endl;
+  /* Datetime basebackup started */
+  output << boost::format("\t%-20s\t%-60s")
+    % "Started"
+    % basebackup->started
+       << std::endl;
 
-    /* Duration */
-    output << boost::format("\t%-20s\t%-60s")
-      % "Duration" % basebackup->duration
-         << std::endl;
+  output << boost::format("\t%-20s\t%-60s")
+    % "Stopped"
+    % basebackup->stopped
+       << std::endl;
 
-    /* Datetime basebackup started */
-    output << boost::format("\t%-20s\t%-60s")
-      % "Started"
-      % basebackup->started
-         << std::endl;
+  output << boost::format("\t%-20s\t%-60s")
+    %" Status"
+    % status
+       << std::endl;
 
-    output << boost::format("\t%-20s\t%-60s")
-      % "Stopped"
-      % basebackup->stopped
-         << std::endl;
+  output << CPGBackupCtlBase::makeLine(80);
+  output << std::endl;
 
-    output << boost::format("\t%-20s\t%-60s")
-      %" Status"
-      % status
-         << std::endl;
+}
+
+void ConsoleOutputFormatter::beginList(OutputListType type,
+                                       std::ostream &output) {
 
-    output << CPGBackupCtlBase::makeLine(80);
-    output << std::endl;
+  this->list_type = type;
+  this->list_rows = 0;
+
+  switch(type) {
+
+  case OUTPUT_LIST_BASEBACKUPS:
+
+    config->get("list_backups.verbose")->getValue(this->verbose);
+
+    if (this->verbose) {
+      output << CPGBackupCtlBase::makeHeader("Basebackups in archive " + catalog_descr->archive_name,
+                                             boost::format("%-20s\t%-60s") % "Property" % "Value",
+                                             80);
+    } else {
+      output << CPGBackupCtlBase::makeHeader("Basebackups in archive " + catalog_descr->archive_name,
+                                             boost::format("%-5s\t%-35s\t%-40s") % "ID" % "Backup" % "Size",
+                                             80);
+    }
+
+    break;
+
+  case OUTPUT_LIST_WORKERS:
+    /* no header */
+    break;
+
+  case OUTPUT_LIST_STREAMS:
+
+    output << CPGBackupCtlBase::makeHeader("WAL stream statistics",
+                                           boost::format("%-20s\t%-10s\t%-10s\t%-20s")
+                                           % "ARCHIVE" % "ID" % "PID" % "LAST UPDATE",
+                                           80);
+    break;
 
   }
 
 }
 
-void ConsoleOutputFormatter::nodeAs(std::vector<shm_worker_area> &slots,
-                                    std::ostringstream &output) {
+void ConsoleOutputFormatter::row(std::shared_ptr<BaseBackupDescr> basebackup,
+                                 std::ostream &output) {
 
-  for(auto &worker : slots) {
+  if (this->verbose)
+    this->backupRowVerbose(basebackup, output);
+  else
+    this->backupRow(basebackup, output);
 
-    string archive_name = "N/A";
+  this->list_rows++;
 
-    if (worker.archive_id >= 0) {
-      shared_ptr<CatalogDescr> archive_descr = this->catalog->existsById(worker.archive_id);
+}
 
-      if (archive_descr->id >= 0) {
-        archive_name = archive_descr->archive_name;
-      }
+void ConsoleOutputFormatter::row(shm_worker_area &worker,
+                                 std::ostream &output) {
+
+  string archive_name = "N/A";
+
+  if (worker.archive_id >= 0) {
+    shared_ptr<CatalogDescr> archive_descr = this->catalog->existsById(worker.archive_id);
+
+    if (archive_descr->id >= 0) {
+      archive_name = archive_descr->archive_name;
     }
+  }
 
-    cout << "WORKER PID " << worker.pid
+  output << "WORKER PID " << worker.pid
          << " | executing " << CatalogDescr::commandTagName(worker.cmdType)
          << " | archive name " << archive_name
          << " | archive ID " << worker.archive_id
          << " | started " << CPGBackupCtlBase::ptime_to_str(worker.started)
          << endl;
 
-    /* Print child info, if any */
-    for (unsigned int idx = 0; idx < MAX_WORKER_CHILDS; idx++) {
+  /* Print child info, if any */
+  for (unsigned int idx = 0; idx < MAX_WORKER_CHILDS; idx++) {
 
-      sub_worker_info child_info = worker.child_info[idx];
+    sub_worker_info child_info = worker.child_info[idx];
 
-      if (child_info.pid > 0) {
-        cout << " `-> CHILD "
+    if (child_info.pid > 0) {
+      output << " `-> CHILD "
              << idx
              << " | PID "
              << child_info.pid
@@ -433,11 +493,90 @@ void ConsoleOutputFormatter::nodeAs(std::vector<shm_worker_area> &slots,
              << ((child_info.backup_id < 0) ? "no backup in use" : "backup used: ID="
                  + CPGBackupCtlBase::intToStr(child_info.backup_id))
              << endl;
-      }
     }
+  }
+
+  this->list_rows++;
+
+}
+
+void ConsoleOutputFormatter::row(shm_stream_stats &stats,
+                                 std::ostream &output) {
+
+  uint64_t lag = 0;
+
+  if (stats.server_position > stats.flush_position)
+    lag = stats.server_position - stats.flush_position;
+
+  output << boost::format("%-20s\t%-10s\t%-10s\t%-20s")
+    % stats.archive_name % stats.archive_id % stats.pid
+    % CPGBackupCtlBase::ptime_to_str(boost::posix_time::from_time_t((time_t) stats.last_update))
+         << endl;
+
+  output << " `-> TLI " << stats.timeline
+         << " | received " << stats.bytes_received << " bytes"
+         << " | written " << stats.bytes_written << " bytes"
+         << " | segments synced " << stats.segments_synced
+         << endl;
+
+  output << " `-> write " << PGStream::encodeXLOGPos(stats.write_position)
+         << " | flush " << PGStream::encodeXLOGPos(stats.flush_position)
+         << " | apply " << PGStream::encodeXLOGPos(stats.apply_position)
+         << " | server " << PGStream::encodeXLOGPos(stats.server_position)
+         << " | flush lag " << lag << " bytes"
+         << endl;
+
+  output << " `-> syncs " << stats.syncs
+         << " | avg sync time "
+         << ((stats.syncs > 0) ? stats.sync_time_us / stats.syncs : 0) << " us"
+         << " | latency";
+
+  for (unsigned int i = 0; i < WAL_SYNC_LATENCY_BUCKETS; i++) {
+
+    if (i < WAL_SYNC_LATENCY_BUCKETS - 1)
+      output << " <" << (1 << i) << "ms:";
+    else
+      output << " >=" << (1 << (i - 1)) << "ms:";
+
+    output << stats.sync_latency[i];
 
   }
 
+  output << endl;
+
+  this->list_rows++;
+
+}
+
+void ConsoleOutputFormatter::endList(std::ostream &output) {
+
+  output.flush();
+
+}
+
+void ConsoleOutputFormatter::nodeAs(std::vector<shm_worker_area> &slots,
+                                    std::ostringstream &output) {
+
+  this->beginList(OUTPUT_LIST_WORKERS, output);
+
+  for (auto &worker : slots) {
+    this->row(worker, output);
+  }
+
+  this->endList(output);
+
+}
+
+void ConsoleOutputFormatter::nodeAs(std::vector<shm_stream_stats> &streams,
+                                    std::ostringstream &output) {
+
+  this->beginList(OUTPUT_LIST_STREAMS, output);
+
+  for (auto &stats : streams) {
+    this->row(stats, output);
+  }
+
+  this->endList(output);
 
 }
 
@@ -574,20 +713,14 @@ void ConsoleOutputFormatter::listArchiveDetail(std::shared_ptr<std::list<std::sh
 void ConsoleOutputFormatter::nodeAs(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
                                     std::ostringstream &output) {
 
-  bool verbose;
-
-  config->get("list_backups.verbose")->getValue(verbose);
-
-  if (verbose) {
-
-    this->listBackupsVerbose(list, output);
-
-  } else {
-
-    this->listBackups(list, output);
+  this->beginList(OUTPUT_LIST_BASEBACKUPS, output);
 
+  for (auto &basebackup : list) {
+    this->row(basebackup, output);
   }
 
+  this->endList(output);
+
 }
 
 void ConsoleOutputFormatter::nodeAs(std::shared_ptr<RuntimeConfiguration> rtc,
@@ -650,6 +783,18 @@ void ConsoleOutputFormatter::nodeAs(std::shared_ptr<BackupProfileDescr> profile,
   output << boost::format("%-25s\t%-30s") % "COMPRESSION"
     % BackupProfileDescr::compressionType(profile->compress_type) << endl;
 
+  /* Profile compression level and threads, 0 means defaults */
+  if (profile->compress_level <= 0) {
+    output << boost::format("%-25s\t%-30s") % "COMPRESSION LEVEL" % "DEFAULT" << endl;
+  } else {
+    output << boost::format("%-25s\t%-30s") % "COMPRESSION LEVEL" % profile->compress_level << endl;
+  }
+
+  output << boost::format("%-25s\t%-30s") % "COMPRESSION WORKERS" % profile->compress_workers << endl;
+  output << boost::format("%-25s\t%-30s") % "COMPRESSION LOCATION"
+    % (profile->server_compression ? "SERVER" : "CLIENT") << endl;
+  output << boost::format("%-25s\t%-30s") % "PARALLEL WRITERS" % profile->parallel_writers << endl;
+
   /* Profile max rate */
   if (profile->max_rate <= 0) {
     output << boost::format("%-25s\t%-30s") % "MAX RATE" % "NOT RATED"<< endl;
@@ -657,6 +802,9 @@ void ConsoleOutputFormatter::nodeAs(std::shared_ptr<BackupProfileDescr> profile,
     output << boost::format("%-25s\t%-30s") % "MAX RATE(KByte/s)" % profile->max_rate<< endl;
   }
 
+  output << boost::format("%-25s\t%-30s") % "RATE CONTROL"
+    % (profile->adaptive_rate ? "ADAPTIVE" : "SERVER") << endl;
+
   /* Profile backup label */
   output << boost::format("%-25s\t%-30s") % "LABEL" % profile->label<< endl;
 
@@ -678,6 +826,12 @@ void ConsoleOutputFormatter::nodeAs(std::shared_ptr<BackupProfileDescr> profile,
   /* Profile MANIFEST_CHECKSUMS */
   output << boost::format("%-25s\t%-30s") % "MANIFEST CHECKSUMS" % profile->manifest_checksums<< endl;
 
+  /* Profile INCREMENTAL */
+  output << boost::format("%-25s\t%-30s") % "INCREMENTAL" % profile->incremental << endl;
+
+  /* Profile DEDUPLICATE */
+  output << boost::format("%-25s\t%-30s") % "DEDUPLICATE" % profile->deduplicate << endl;
+
 }
 
 void ConsoleOutputFormatter::nodeAs(std::shared_ptr<std::list<std::shared_ptr<BackupProfileDescr>>> &list,
@@ -723,6 +877,133 @@ void ConsoleOutputFormatter::nodeAs(std::shared_ptr<StatCatalogArchive> stat,
     % stat->avg_backup_duration;
   output << endl;
 
+  /*
+   * Materialised storage statistics.
+   */
+  output << CPGBackupCtlBase::makeHeader("Storage",
+                                            boost::format("%-14s\t%-10s\t%-14s\t%-12s\t%-12s")
+                                            % "backup bytes" % "# WAL" % "WAL bytes"
+                                            % "oldest WAL" % "newest WAL", 80);
+  output << boost::format("%-14s\t%-10s\t%-14s\t%-12s\t%-12s")
+    % stat->backup_bytes % stat->wal_segments % stat->wal_bytes
+    % (stat->oldest_xlogpos.length() > 0 ? stat->oldest_xlogpos : "N/A")
+    % (stat->newest_xlogpos.length() > 0 ? stat->newest_xlogpos : "N/A");
+  output << endl;
+
+}
+
+void ConsoleOutputFormatter::nodeAs(std::shared_ptr<BaseBackupVerificationResult> result,
+                                    std::ostringstream &output) {
+
+  output << CPGBackupCtlBase::makeHeader("Basebackup Verification",
+                                            boost::format("%-10s\t%-20s\t%-8s\t%-10s")
+                                            % "ID" % "Archive" % "Workers" % "CRC32C", 80);
+  output << boost::format("%-10s\t%-20s\t%-8s\t%-10s")
+    % result->basebackup_id % result->archive_name % result->workers
+    % (result->crc32c_hardware ? "hardware" : "software");
+  output << endl;
+
+  output << CPGBackupCtlBase::makeHeader("Checked",
+                                            boost::format("%-9s\t%-9s\t%-14s\t%-9s")
+                                            % "Manifest" % "# files" % "bytes" % "# WAL", 80);
+  output << boost::format("%-9s\t%-9s\t%-14s\t%-9s")
+    % (result->manifest_found ? "yes" : "no")
+    % result->files_checked % result->bytes_checked
+    % result->wal_segments_checked;
+  output << endl;
+
+  if (!result->warnings.empty()) {
+
+    output << CPGBackupCtlBase::makeHeader("Warnings",
+                                              boost::format("%-30s\t%-40s")
+                                              % "File" % "Message", 80);
+
+    for (auto &warning : result->warnings) {
+      output << boost::format("%-30s\t%-40s") % warning.first % warning.second;
+      output << endl;
+    }
+
+  }
+
+  if (!result->errors.empty()) {
+
+    output << CPGBackupCtlBase::makeHeader("Errors",
+                                              boost::format("%-30s\t%-40s")
+                                              % "File" % "Message", 80);
+
+    for (auto &error : result->errors) {
+      output << boost::format("%-30s\t%-40s") % error.first % error.second;
+      output << endl;
+    }
+
+  }
+
+  output << (result->ok() ? "basebackup verified successfully" : "basebackup verification failed");
+  output << endl;
+
+}
+
+void ConsoleOutputFormatter::nodeAs(std::vector<std::shared_ptr<ScheduleDescr>> &schedules,
+                                    std::ostringstream &output) {
+
+  output << CPGBackupCtlBase::makeHeader("List of schedules",
+                                            boost::format("%-15s\t%-10s\t%-8s\t%-6s\t%-8s\t%-19s")
+                                            % "Archive" % "Job" % "Interval" % "Prio"
+                                            % "Jitter" % "Next run", 80);
+
+  for (auto &schedule : schedules) {
+
+    output << boost::format("%-15s\t%-10s\t%-8s\t%-6s\t%-8s\t%-19s")
+      % schedule->archive_name
+      % ScheduleDescr::typeName(schedule->type)
+      % schedule->interval
+      % schedule->priority
+      % schedule->jitter
+      % (schedule->next_run.length() > 0 ? schedule->next_run : "N/A");
+    output << endl;
+
+    if (schedule->profile_name.length() > 0 || schedule->last_run.length() > 0) {
+      output << boost::format("%-15s\t%-10s\t%-30s")
+        % ""
+        % (schedule->profile_name.length() > 0 ? schedule->profile_name : "")
+        % (schedule->last_run.length() > 0 ? "last run " + schedule->last_run : "");
+      output << endl;
+    }
+
+  }
+
+}
+
+void ConsoleOutputFormatter::nodeAs(std::vector<std::shared_ptr<UploadDescr>> &uploads,
+                                    std::ostringstream &output) {
+
+  output << CPGBackupCtlBase::makeHeader("List of uploads",
+                                            boost::format("%-15s\t%-10s\t%-8s\t%-12s\t%-19s")
+                                            % "Archive" % "Kind" % "Status" % "Size"
+                                            % "Updated", 80);
+
+  for (auto &upload : uploads) {
+
+    output << boost::format("%-15s\t%-10s\t%-8s\t%-12s\t%-19s")
+      % upload->archive_name
+      % UploadDescr::kindName(upload->kind)
+      % UploadDescr::statusName(upload->status)
+      % CPGBackupCtlBase::prettySize(upload->size)
+      % upload->updated;
+    output << endl;
+
+    output << boost::format("%-15s\t%-60s") % "" % upload->object_key;
+    output << endl;
+
+    if (upload->last_error.length() > 0) {
+      output << boost::format("%-15s\t%-60s")
+        % ""
+        % ("attempt " + std::to_string(upload->attempts) + ": " + upload->last_error);
+      output << endl;
+    }
+
+  }
+
 }
 
 /* ****************************************************************************
@@ -805,7 +1086,7 @@ void JsonOutputFormatter::nodeAs(std::shared_ptr<std::list<directory_entry>> fil
 
   }
 
-  pt::write_json(output, head);
+  pt::write_json(output, head, pretty);
 
 }
 
@@ -839,79 +1120,153 @@ void JsonOutputFormatter::nodeAs(std::vector<std::shared_ptr<ConnectionDescr>> c
   }
 
   head.add_child("connections", clist);
-  pt::write_json(output, head);
+  pt::write_json(output, head, pretty);
 
 }
 
-void JsonOutputFormatter::listBackups(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
-                                 std::ostringstream &output) {
+void JsonOutputFormatter::prepareList(OutputListType type) {
+
+  /*
+   * Sanity check, make sure we have a valid catalog descriptor.
+   */
+  if (type == OUTPUT_LIST_BASEBACKUPS) {
+
+    if (catalog_descr == nullptr)
+      throw CCatalogIssue("could not format basebackup list without valid catalog descriptor");
+
+    config->get("list_backups.verbose")->getValue(this->verbose);
+
+  }
+
+  this->list_type = type;
+  this->list_rows = 0;
+
+}
+
+void JsonOutputFormatter::beginList(OutputListType type,
+                                    std::ostream &output) {
+
+  this->prepareList(type);
+
+  /*
+   * The document is written piece by piece as the rows come in,
+   * so the number of items is known at the end of the listing
+   * only and follows the list.
+   */
+  output << "{" << (pretty ? "\n    " : "") << "\"";
+
+  switch(type) {
+  case OUTPUT_LIST_BASEBACKUPS:
+    output << "basebackups";
+    break;
+  case OUTPUT_LIST_WORKERS:
+    output << "background workers";
+    break;
+  case OUTPUT_LIST_STREAMS:
+    output << "streams";
+    break;
+  }
+
+  output << "\": [";
+
+}
+
+void JsonOutputFormatter::writeRow(boost::property_tree::ptree &node,
+                                   std::ostream &output) {
 
   namespace pt = boost::property_tree;
 
-  pt::ptree head;
-  pt::ptree basebackups;
   std::ostringstream oss;
+  std::string row;
 
-  oss << list.size();
+  pt::write_json(oss, node, false);
+  row = oss.str();
 
-  head.put("num_basebackups", oss.str());
+  /* write_json() terminates the object with a newline */
+  if (row.size() > 0 && row.back() == '\n')
+    row.pop_back();
 
-  BOOST_FOREACH(const std::shared_ptr<BaseBackupDescr> &descr, list) {
+  if (this->list_rows > 0)
+    output << ",";
 
-    StreamingBaseBackupDirectory directory(path(descr->fsentry).filename().string(),
-                                           catalog_descr->directory);
-    pt::ptree bbackup;
+  if (pretty)
+    output << "\n        ";
 
-    oss.str(std::string());
-    oss << descr->id;
+  output << row;
 
-    bbackup.put("id", oss.str());
-    bbackup.put("fsentry", descr->fsentry);
-    bbackup.put("started", descr->started);
-    bbackup.put("stopped", descr->stopped);
-    bbackup.put("duration", descr->duration);
+}
 
-    oss.str("");
-    oss.clear();
-    oss << descr->tablespaces.size();
+void JsonOutputFormatter::row(std::shared_ptr<BaseBackupDescr> basebackup,
+                              std::ostream &output) {
 
-    bbackup.put("num_tablespaces", oss.str());
-    bbackup.put("size", directory.size());
-    bbackup.put("status",
-                BackupDirectory::verificationCodeAsString(StreamingBaseBackupDirectory::verify(descr)));
+  boost::property_tree::ptree node = this->toPtree(basebackup);
 
-    basebackups.push_back(std::make_pair("", bbackup));
-  }
+  this->writeRow(node, output);
+  this->list_rows++;
+
+}
+
+void JsonOutputFormatter::row(shm_worker_area &worker,
+                              std::ostream &output) {
 
-  head.add_child("basebackups", basebackups);
+  boost::property_tree::ptree node = this->toPtree(worker);
 
-  pt::write_json(output, head);
+  this->writeRow(node, output);
+  this->list_rows++;
 
 }
 
-void JsonOutputFormatter::listBackupsVerbose(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
-                                             std::ostringstream &output) {
+void JsonOutputFormatter::row(shm_stream_stats &stats,
+                              std::ostream &output) {
 
-  namespace pt = boost::property_tree;
+  boost::property_tree::ptree node = this->toPtree(stats);
 
-  pt::ptree head;
-  pt::ptree basebackups;
-  std::ostringstream oss;
+  this->writeRow(node, output);
+  this->list_rows++;
 
-  oss << list.size();
-  head.put("num_basebackups", oss.str());
+}
 
-  BOOST_FOREACH(const std::shared_ptr<BaseBackupDescr> &descr, list) {
+void JsonOutputFormatter::endList(std::ostream &output) {
 
-    size_t upstream_total_size = 0;
-    pt::ptree bbackup;
-    pt::ptree tablespaces;
+  std::string indent = (pretty ? "\n    " : "");
 
-    /*
-     * Directory handle for basebackup directory on disk.
-     */
-    StreamingBaseBackupDirectory directory(path(descr->fsentry).filename().string(),
-                                           catalog_descr->directory);
+  if (pretty && this->list_rows > 0)
+    output << indent;
+
+  output << "]," << indent << "\"";
+
+  switch(this->list_type) {
+  case OUTPUT_LIST_BASEBACKUPS:
+    output << "num_basebackups";
+    break;
+  case OUTPUT_LIST_WORKERS:
+    output << "number of background workers";
+    break;
+  case OUTPUT_LIST_STREAMS:
+    output << "number of streams";
+    break;
+  }
+
+  output << "\": \"" << this->list_rows << "\"" << (pretty ? "\n" : "") << "}\n";
+  output.flush();
+
+}
+
+boost::property_tree::ptree JsonOutputFormatter::toPtree(std::shared_ptr<BaseBackupDescr> descr) {
+
+  namespace pt = boost::property_tree;
+
+  pt::ptree bbackup;
+
+  /*
+   * Directory handle for basebackup directory on disk.
+   */
+  StreamingBaseBackupDirectory directory(path(descr->fsentry).filename().string(),
+                                         catalog_descr->directory);
+
+  bbackup.put("id", descr->id);
+
+  if (this->verbose) {
 
     /*
      * Details for the backup profile used by the current basebackup.
@@ -919,28 +1274,41 @@ void JsonOutputFormatter::listBackupsVerbose(std::vector<std::shared_ptr<BaseBac
     shared_ptr<BackupProfileDescr> backupProfile
       = this->catalog->getBackupProfile(descr->used_profile);
 
-    bbackup.put("id", oss.str());
     bbackup.put("pinned", (descr->pinned ? "yes" : "no"));
-    bbackup.put("fsentry", descr->fsentry);
+    bbackup.put("parent id", descr->parent_id);
+    bbackup.put("compression", BackupProfileDescr::compressionType(descr->compress_type));
+    bbackup.put("used backup profile", backupProfile->name);
+
+  }
+
+  bbackup.put("fsentry", descr->fsentry);
+
+  if (this->verbose) {
     bbackup.put("catalog state", descr->status);
     bbackup.put("label", descr->label);
-    bbackup.put("started", descr->started);
-    bbackup.put("stopped", descr->stopped);
-    bbackup.put("duration", descr->duration);
+  }
+
+  bbackup.put("started", descr->started);
+  bbackup.put("stopped", descr->stopped);
+  bbackup.put("duration", descr->duration);
+
+  if (this->verbose) {
     bbackup.put("timeline", descr->timeline);
     bbackup.put("wal start location", descr->xlogpos);
     bbackup.put("wal stop location", descr->xlogposend);
     bbackup.put("system id", descr->systemid);
     bbackup.put("wal segment size", descr->wal_segment_size);
-    bbackup.put("size", directory.size());
-    bbackup.put("status",
-                BackupDirectory::verificationCodeAsString(StreamingBaseBackupDirectory::verify(descr)));
+  }
 
-    oss.str("");
-    oss.clear();
-    oss << descr->tablespaces.size();
+  bbackup.put("num_tablespaces", descr->tablespaces.size());
+  bbackup.put("size", directory.size());
+  bbackup.put("status",
+              BackupDirectory::verificationCodeAsString(StreamingBaseBackupDirectory::verify(descr)));
 
-    bbackup.put("num_tablespaces", oss.str());
+  if (this->verbose) {
+
+    size_t upstream_total_size = 0;
+    pt::ptree tablespaces;
 
     BOOST_FOREACH(const std::shared_ptr<BackupTablespaceDescr> &tblspc, descr->tablespaces) {
 
@@ -961,17 +1329,107 @@ void JsonOutputFormatter::listBackupsVerbose(std::vector<std::shared_ptr<BaseBac
 
     }
 
-    oss.str("");
-    oss.clear();
-    oss << upstream_total_size;
-    bbackup.put("upstream total size", oss.str());
-    bbackup.push_back(std::make_pair("", tablespaces));
-    basebackups.push_back(std::make_pair("", bbackup));
+    bbackup.put("upstream total size", upstream_total_size);
+    bbackup.add_child("tablespaces", tablespaces);
+
+  }
+
+  return bbackup;
+
+}
+
+boost::property_tree::ptree JsonOutputFormatter::toPtree(shm_worker_area &worker) {
+
+  namespace pt = boost::property_tree;
+
+  string archive_name      = "N/A";
+  unsigned int child_count = 0;
+  pt::ptree current;
+  pt::ptree childs;
+
+  if (worker.archive_id >= 0) {
+    shared_ptr<CatalogDescr> archive_descr = this->catalog->existsById(worker.archive_id);
+
+    if (archive_descr->id >= 0) {
+      archive_name = archive_descr->archive_name;
+    }
+  }
+
+  current.put("worker id", worker.pid);
+  current.put("command tag", CatalogDescr::commandTagName(worker.cmdType));
+  current.put("archive name", archive_name);
+  current.put("archive id", worker.archive_id);
+  current.put("started", CPGBackupCtlBase::ptime_to_str(worker.started));
+
+  /* Add child info, if any */
+  for (unsigned int idx = 0; idx < MAX_WORKER_CHILDS; idx++) {
+
+    sub_worker_info child_info = worker.child_info[idx];
+
+    if (child_info.pid > 0) {
+
+      pt::ptree child_node;
+
+      child_count++;
+
+      child_node.put("child id", idx);
+      child_node.put("child pid", child_info.pid);
+      child_node.put("attached basebackup id", child_info.backup_id);
+
+      childs.push_back(std::make_pair("", child_node));
+
+    }
+  }
+
+  if (child_count > 0) {
+    current.put("number of childs", child_count);
+    current.add_child("childs", childs);
+  }
+
+  return current;
+
+}
+
+boost::property_tree::ptree JsonOutputFormatter::toPtree(shm_stream_stats &stats) {
+
+  namespace pt = boost::property_tree;
+
+  pt::ptree current;
+  pt::ptree histogram;
+
+  current.put("archive name", stats.archive_name);
+  current.put("archive id", stats.archive_id);
+  current.put("worker pid", stats.pid);
+  current.put("timeline", stats.timeline);
+  current.put("last update",
+              CPGBackupCtlBase::ptime_to_str(boost::posix_time::from_time_t((time_t) stats.last_update)));
+  current.put("bytes received", stats.bytes_received);
+  current.put("bytes written", stats.bytes_written);
+  current.put("write position", PGStream::encodeXLOGPos(stats.write_position));
+  current.put("flush position", PGStream::encodeXLOGPos(stats.flush_position));
+  current.put("apply position", PGStream::encodeXLOGPos(stats.apply_position));
+  current.put("server position", PGStream::encodeXLOGPos(stats.server_position));
+  current.put("segments synced", stats.segments_synced);
+  current.put("syncs", stats.syncs);
+  current.put("sync time us", stats.sync_time_us);
+
+  for (unsigned int i = 0; i < WAL_SYNC_LATENCY_BUCKETS; i++) {
+
+    pt::ptree bucket;
+
+    if (i < WAL_SYNC_LATENCY_BUCKETS - 1)
+      bucket.put("less than ms", (1 << i));
+    else
+      bucket.put("at least ms", (1 << (i - 1)));
+
+    bucket.put("count", stats.sync_latency[i]);
+    histogram.push_back(std::make_pair("", bucket));
 
   }
 
-  head.add_child("basebackups", basebackups);
-  pt::write_json(output, head);
+  current.add_child("sync latency", histogram);
+
+  return current;
 
 }
 
@@ -1018,7 +1476,7 @@ void JsonOutputFormatter::nodeAs(std::vector<std::shared_ptr<RetentionDescr>> &r
   }
 
   head.add_child("retentions", item);
-  pt::write_json(output, head);
+  pt::write_json(output, head, pretty);
 
 }
 
@@ -1028,69 +1486,33 @@ void JsonOutputFormatter::nodeAs(std::shared_ptr<RetentionDescr> retentionDescr,
   namespace pt = boost::property_tree;
 
   pt::ptree result = this->toPtree(retentionDescr);
-  pt::write_json(output, result);
+  pt::write_json(output, result, pretty);
 
 }
 
 void JsonOutputFormatter::nodeAs(std::vector<shm_worker_area> &slots,
-                                    std::ostringstream &output) {
-
-  namespace pt = boost::property_tree;
-
-  pt::ptree head;
-  pt::ptree workers;
-
-  head.put("number of background workers", slots.size());
-
-  if (slots.size() > 0) {
-    for(auto &worker : slots) {
-
-      string archive_name      = "N/A";
-      unsigned int child_count = 0;
-      pt::ptree current;
-      pt::ptree child_node;
-
-      if (worker.archive_id >= 0) {
-        shared_ptr<CatalogDescr> archive_descr = this->catalog->existsById(worker.archive_id);
-
-        if (archive_descr->id >= 0) {
-          archive_name = archive_descr->archive_name;
-        }
-      }
-
-      current.put("worker id", worker.pid);
-      current.put("command tag", CatalogDescr::commandTagName(worker.cmdType));
-      current.put("archive name", archive_name);
-      current.put("archive id", worker.archive_id);
-      current.put("started", CPGBackupCtlBase::ptime_to_str(worker.started));
-
-      /* Print child info, if any */
-      for (unsigned int idx = 0; idx < MAX_WORKER_CHILDS; idx++) {
+                                 std::ostringstream &output) {
 
-        sub_worker_info child_info = worker.child_info[idx];
+  this->beginList(OUTPUT_LIST_WORKERS, output);
 
-        if (child_info.pid > 0) {
-          child_count++;
+  for (auto &worker : slots) {
+    this->row(worker, output);
+  }
 
-          child_node.put("child id", idx);
-          child_node.put("child pid", child_info.pid);
-          child_node.put("attached basebackup id", child_info.backup_id);
+  this->endList(output);
 
-        }
-      }
+}
 
-      if (child_count > 0) {
-        current.put("number of childs", child_count);
-        current.push_back(std::make_pair("", child_node));
-      }
+void JsonOutputFormatter::nodeAs(std::vector<shm_stream_stats> &streams,
+                                 std::ostringstream &output) {
 
-      workers.push_back(std::make_pair("", current));
-    }
+  this->beginList(OUTPUT_LIST_STREAMS, output);
 
-    head.add_child("background workers",  workers);
+  for (auto &stats : streams) {
+    this->row(stats, output);
   }
 
-  pt::write_json(output, head);
+  this->endList(output);
 
 }
 
@@ -1140,33 +1562,21 @@ void JsonOutputFormatter::nodeAs(std::shared_ptr<std::list<std::shared_ptr<Catal
   }
 
   head.add_child("archives", archives);
-  pt::write_json(output, head);
+  pt::write_json(output, head, pretty);
 
 }
 
 void JsonOutputFormatter::nodeAs(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
                                  std::ostringstream &output) {
 
-  bool verbose;
-
-  /*
-   * Sanity check, make sure we have a valid catalog descriptor.
-   */
-  if (catalog_descr == nullptr)
-    throw CCatalogIssue("could not format basebackup list without valid catalog descriptor");
-
-  config->get("list_backups.verbose")->getValue(verbose);
-
-  if (verbose) {
-
-    this->listBackupsVerbose(list, output);
-
-  } else {
-
-    this->listBackups(list, output);
+  this->beginList(OUTPUT_LIST_BASEBACKUPS, output);
 
+  for (auto &basebackup : list) {
+    this->row(basebackup, output);
   }
 
+  this->endList(output);
+
 }
 
 void JsonOutputFormatter::nodeAs(std::shared_ptr<RuntimeConfiguration> rtc,
@@ -1195,7 +1605,7 @@ void JsonOutputFormatter::nodeAs(std::shared_ptr<RuntimeConfiguration> rtc,
 
   }
 
-  pt::write_json(output, head);
+  pt::write_json(output, head, pretty);
 
 }
 
@@ -1213,7 +1623,7 @@ void JsonOutputFormatter::nodeAs(std::shared_ptr<ConfigVariable> var,
   item.put("value", str_value);
 
   head.add_child("config variable", item);
-  pt::write_json(output, head);
+  pt::write_json(output, head, pretty);
 
 }
 
@@ -1225,7 +1635,7 @@ void JsonOutputFormatter::nodeAs(std::string result_str,
   pt::ptree head;
   head.put("result", result_str);
 
-  pt::write_json(output, head);
+  pt::write_json(output, head, pretty);
 
 }
 
@@ -1233,7 +1643,12 @@ void JsonOutputFormatter::listBackupProfileDetail(std::shared_ptr<BackupProfileD
                                                   boost::property_tree::ptree &node) {
 
   node.put("compress type", BackupProfileDescr::compressionType(descr->compress_type));
+  node.put("compress level", descr->compress_level);
+  node.put("compress workers", descr->compress_workers);
+  node.put("compress location", (descr->server_compression ? "server" : "client"));
+  node.put("parallel writers", descr->parallel_writers);
   node.put("max rate", descr->max_rate);
+  node.put("rate control", (descr->adaptive_rate ? "adaptive" : "server"));
   node.put("backup label", descr->label);
   node.put("fast checkpoint", descr->fast_checkpoint);
   node.put("wal included", descr->include_wal);
@@ -1241,6 +1656,8 @@ void JsonOutputFormatter::listBackupProfileDetail(std::shared_ptr<BackupProfileD
   node.put("noverify checksums", descr->noverify_checksums);
   node.put("manifest", descr->manifest);
   node.put("manifest checksums", descr->manifest_checksums);
+  node.put("incremental", descr->incremental);
+  node.put("deduplicate", descr->deduplicate);
 
 }
 
@@ -1254,7 +1671,7 @@ void JsonOutputFormatter::nodeAs(std::shared_ptr<BackupProfileDescr> profile,
   head.put("profile name", profile->name);
   this->listBackupProfileDetail(profile, head);
 
-  pt::write_json(output, head);
+  pt::write_json(output, head, pretty);
 
 }
 
@@ -1275,7 +1692,7 @@ void JsonOutputFormatter::nodeAs(std::shared_ptr<std::list<std::shared_ptr<Backu
 
   }
 
-  pt::write_json(output, head);
+  pt::write_json(output, head, pretty);
 
 }
 
@@ -1285,6 +1702,7 @@ void JsonOutputFormatter::nodeAs(std::shared_ptr<StatCatalogArchive> stat,
   namespace pt = boost::property_tree;
   pt::ptree head;
   pt::ptree stats;
+  pt::ptree storage;
 
   head.put("archive name", stat->archive_name);
   head.put("directory", stat->archive_directory);
@@ -1297,6 +1715,163 @@ void JsonOutputFormatter::nodeAs(std::shared_ptr<StatCatalogArchive> stat,
 
   head.add_child("backup statistics", stats);
 
-  pt::write_json(output, head);
+  storage.put("backup bytes", stat->backup_bytes);
+  storage.put("wal segments", stat->wal_segments);
+  storage.put("wal bytes", stat->wal_bytes);
+  storage.put("oldest xlogpos", stat->oldest_xlogpos);
+  storage.put("newest xlogpos", stat->newest_xlogpos);
+
+  head.add_child("storage statistics", storage);
+
+  pt::write_json(output, head, pretty);
+
+}
+
+void JsonOutputFormatter::nodeAs(std::shared_ptr<BaseBackupVerificationResult> result,
+                                 std::ostringstream &output) {
+
+  namespace pt = boost::property_tree;
+  pt::ptree head;
+  pt::ptree checked;
+  pt::ptree errors;
+  pt::ptree warnings;
+
+  head.put("id", result->basebackup_id);
+  head.put("archive name", result->archive_name);
+  head.put("workers", result->workers);
+  head.put("crc32c", (result->crc32c_hardware ? "hardware" : "software"));
+  head.put("manifest", result->manifest_found);
+  head.put("verified", result->ok());
+
+  checked.put("files", result->files_checked);
+  checked.put("bytes", result->bytes_checked);
+  checked.put("wal segments", result->wal_segments_checked);
+
+  head.add_child("checked", checked);
+
+  for (auto &error : result->errors) {
+    pt::ptree entry;
+    entry.put("file", error.first);
+    entry.put("message", error.second);
+    errors.push_back(std::make_pair("", entry));
+  }
+
+  for (auto &warning : result->warnings) {
+    pt::ptree entry;
+    entry.put("file", warning.first);
+    entry.put("message", warning.second);
+    warnings.push_back(std::make_pair("", entry));
+  }
+
+  head.add_child("errors", errors);
+  head.add_child("warnings", warnings);
+
+  pt::write_json(output, head, pretty);
+
+}
+
+void JsonOutputFormatter::nodeAs(std::vector<std::shared_ptr<ScheduleDescr>> &schedules,
+                                 std::ostringstream &output) {
+
+  namespace pt = boost::property_tree;
+  pt::ptree head;
+  pt::ptree items;
+
+  head.put("number of schedules", schedules.size());
+
+  for (auto &schedule : schedules) {
+
+    pt::ptree item;
+
+    item.put("id", schedule->id);
+    item.put("archive name", schedule->archive_name);
+    item.put("archive id", schedule->archive_id);
+    item.put("job", ScheduleDescr::typeName(schedule->type));
+    item.put("profile", schedule->profile_name);
+    item.put("interval", schedule->interval);
+    item.put("jitter", schedule->jitter);
+    item.put("priority", schedule->priority);
+    item.put("next run", schedule->next_run);
+    item.put("last run", schedule->last_run);
+    item.put("created", schedule->created);
+
+    items.push_back(std::make_pair("", item));
+
+  }
+
+  head.add_child("schedules", items);
+  pt::write_json(output, head, pretty);
+
+}
+
+void JsonOutputFormatter::nodeAs(std::vector<std::shared_ptr<UploadDescr>> &uploads,
+                                 std::ostringstream &output) {
+
+  namespace pt = boost::property_tree;
+  pt::ptree head;
+  pt::ptree items;
+
+  head.put("number of uploads", uploads.size());
+
+  for (auto &upload : uploads) {
+
+    pt::ptree item;
+
+    item.put("id", upload->id);
+    item.put("archive name", upload->archive_name);
+    item.put("archive id", upload->archive_id);
+    item.put("kind", UploadDescr::kindName(upload->kind));
+    item.put("basebackup id", upload->basebackup_id);
+    item.put("path", upload->path);
+    item.put("object key", upload->object_key);
+    item.put("size", upload->size);
+    item.put("status", UploadDescr::statusName(upload->status));
+    item.put("attempts", upload->attempts);
+    item.put("last error", upload->last_error);
+    item.put("queued", upload->queued);
+    item.put("updated", upload->updated);
+
+    items.push_back(std::make_pair("", item));
+
+  }
+
+  head.add_child("uploads", items);
+  pt::write_json(output, head, pretty);
+
+}
+
+/* ****************************************************************************
+ * Implementation of JsonLinesOutputFormatter
+ * ****************************************************************************/
+
+JsonLinesOutputFormatter::JsonLinesOutputFormatter(std::shared_ptr<OutputFormatConfiguration> config,
+                                                   std::shared_ptr<BackupCatalog> catalog,
+                                                   std::shared_ptr<CatalogDescr> catalog_descr)
+  : JsonOutputFormatter(config, catalog, catalog_descr) {
+
+  this->pretty = false;
+
+}
+
+JsonLinesOutputFormatter::~JsonLinesOutputFormatter() {}
+
+void JsonLinesOutputFormatter::beginList(OutputListType type,
+                                         std::ostream &output) {
+
+  /* No enclosing document, just the rows */
+  this->prepareList(type);
+
+}
+
+void JsonLinesOutputFormatter::writeRow(boost::property_tree::ptree &node,
+                                        std::ostream &output) {
+
+  boost::property_tree::write_json(output, node, false);
+
+}
+
+void JsonLinesOutputFormatter::endList(std::ostream &output) {
+
+  output.flush();
 
 }
@@ -2,6 +2,8 @@
 #include <boost/pointer_cast.hpp>
 #include <boost/range/adaptor/reversed.hpp>
 #include <boost/log/trivial.hpp>
+#include <algorithm>
+#include <set>
 
 using namespace pgbckctl;
 
@@ -76,6 +78,10 @@ std::shared_ptr<BackupCatalog> Retention::getBackupCatalog() {
 
 }
 
+std::string Retention::planStamp(std::vector<std::shared_ptr<BaseBackupDescr>> &list) {
+  return this->asString();
+}
+
 RetentionRuleId Retention::getRetentionRuleType() {
   return this->ruleType;
 }
@@ -137,6 +143,12 @@ shared_ptr<Retention> Retention::get(shared_ptr<RetentionRuleDescr> ruleDescr) {
       break;
     }
 
+  case RETENTION_MOVE_OLDER_BY_DATETIME:
+    {
+      result = make_shared<TieringRetention>(ruleDescr);
+      break;
+    }
+
   default:
     {
       ostringstream oss;
@@ -240,6 +252,14 @@ std::vector<std::shared_ptr<Retention>> Retention::get(string retention_name,
 
             break;
           }
+
+        case RETENTION_MOVE_OLDER_BY_DATETIME:
+          {
+            retentionPtr = make_shared<TieringRetention>(ruleDescr->value,
+                                                         archiveDescr,
+                                                         catalog);
+            break;
+          }
         default:
 	  {
 	    ostringstream oss;
@@ -346,8 +366,83 @@ bool Retention::XLogCleanupOffsetKeep(shared_ptr<BackupCleanupDescr> cleanupDesc
 
 }
 
+unsigned int Retention::keepIncrementalParents(shared_ptr<BackupCleanupDescr> cleanupDescr,
+                                               shared_ptr<BackupCatalog> catalog) {
+
+  unsigned int kept = 0;
+  bool changed = true;
+
+  if (cleanupDescr == nullptr || catalog == nullptr)
+    return kept;
+
+  /*
+   * A basebackup elected for deletion must be kept as long as any
+   * incremental basebackup taken against it survives, otherwise that
+   * one can't be restored anymore. Keeping a parent might in turn require
+   * keeping its own parent, so repeat until the deletion list is stable.
+   */
+  while (changed) {
+
+    std::set<int> candidates;
+    vector<shared_ptr<BaseBackupDescr>>::iterator it;
+
+    changed = false;
+
+    for (auto &bbdescr : cleanupDescr->basebackups) {
+      candidates.insert(bbdescr->id);
+    }
+
+    it = cleanupDescr->basebackups.begin();
+
+    while (it != cleanupDescr->basebackups.end()) {
+
+      bool required = false;
+
+      for (auto &child_id : catalog->getDependentBasebackups((*it)->id)) {
+
+        if (candidates.find(child_id) == candidates.end()) {
+          required = true;
+          break;
+        }
+
+      }
+
+      if (required) {
+
+        BOOST_LOG_TRIVIAL(info) << "keeping basebackup \""
+                                << (*it)->fsentry
+                                << "\", incremental basebackups depend on it";
+
+        it = cleanupDescr->basebackups.erase(it);
+        changed = true;
+        kept++;
+
+      } else {
+        ++it;
+      }
+
+    }
+
+  }
+
+  /*
+   * Incremental basebackups are always registered after their
+   * parents, so deleting in descending ID order removes them before
+   * the basebackups they reference.
+   */
+  std::sort(cleanupDescr->basebackups.begin(),
+            cleanupDescr->basebackups.end(),
+            [](const shared_ptr<BaseBackupDescr> &a,
+               const shared_ptr<BaseBackupDescr> &b) {
+              return a->id > b->id;
+            });
+
+  return kept;
+
+}
+
 void Retention::move(vector<shared_ptr<BaseBackupDescr>> &target,
-                     vector<shared_ptr<BaseBackupDescr>> source,
+                     const vector<shared_ptr<BaseBackupDescr>> &source,
                      shared_ptr<BaseBackupDescr> bbdescr,
                      unsigned int index) {
 
@@ -483,7 +578,7 @@ void CountRetention::setRetentionRuleType(const RetentionRuleId ruleType) {
 
 }
 
-unsigned int CountRetention::apply(std::vector<std::shared_ptr<BaseBackupDescr>> list) {
+unsigned int CountRetention::apply(std::vector<std::shared_ptr<BaseBackupDescr>> &list) {
 
   unsigned int result = 0;
 
@@ -880,7 +975,7 @@ void CleanupRetention::setRetentionRuleType(const RetentionRuleId ruleType) {
 
 }
 
-unsigned int CleanupRetention::apply(std::vector<std::shared_ptr<BaseBackupDescr>> list) {
+unsigned int CleanupRetention::apply(std::vector<std::shared_ptr<BaseBackupDescr>> &list) {
 
   unsigned int currindex = 0;
   unsigned int result = 0;
@@ -1123,10 +1218,57 @@ void DateTimeRetention::init(std::shared_ptr<BackupCleanupDescr> prevCleanupDesc
 
 }
 
-unsigned int DateTimeRetention::apply(std::vector<std::shared_ptr<BaseBackupDescr>> list) {
+bool DateTimeRetention::exceeds(std::shared_ptr<BaseBackupDescr> bbdescr,
+                                const std::string &threshold) {
+
+  /*
+   * Timestamps compare as strings, as SQLite does. Basebackups
+   * without a stopped timestamp never exceed the interval.
+   */
+  if (bbdescr->stopped.length() == 0)
+    return false;
+
+  switch(this->ruleType) {
+
+  case RETENTION_KEEP_OLDER_BY_DATETIME:
+  case RETENTION_DROP_OLDER_BY_DATETIME:
+    return (bbdescr->stopped < threshold);
+
+  case RETENTION_KEEP_NEWER_BY_DATETIME:
+  case RETENTION_DROP_NEWER_BY_DATETIME:
+    return (bbdescr->stopped > threshold);
+
+  default:
+    throw CCatalogIssue("invalid retention mode when getting backup list");
+
+  }
+
+}
+
+std::string DateTimeRetention::planStamp(std::vector<std::shared_ptr<BaseBackupDescr>> &list) {
+
+  std::string threshold = this->catalog->retentionDateTimeThreshold(this->interval);
+  unsigned int exceeding = 0;
+
+  for (auto &bbdescr : list) {
+    if (this->exceeds(bbdescr, threshold))
+      exceeding++;
+  }
+
+  return this->asString() + "/" + std::to_string(exceeding);
+
+}
+
+unsigned int DateTimeRetention::apply(std::vector<std::shared_ptr<BaseBackupDescr>> &list) {
 
   unsigned int currindex = 0;
 
+  /*
+   * The threshold is computed once for the whole list,
+   * instead of asking the catalog for every basebackup.
+   */
+  std::string threshold = this->catalog->retentionDateTimeThreshold(this->interval);
+
   /*
    * Loop through the list of basebackups. We need to check
    * whether the stopped timestamp exceeds the specified datetime
@@ -1153,9 +1295,7 @@ unsigned int DateTimeRetention::apply(std::vector<std::shared_ptr<BaseBackupDesc
     BackupLockInfoType lockType = locked(bbdescr);
 
     /* Check whether retention policy is exceeded */
-    this->catalog->exceedsRetention(bbdescr,
-                                    this->ruleType,
-                                    this->interval);
+    bbdescr->exceeds_retention_rule = this->exceeds(bbdescr, threshold);
 
     if (bbdescr->exceeds_retention_rule) {
 
@@ -1294,6 +1434,176 @@ void DateTimeRetention::setRetentionRuleType(const RetentionRuleId ruleType) {
 
 }
 
+/* *****************************************************************************
+ * TieringRetention implementation
+ * ****************************************************************************/
+
+TieringRetention::TieringRetention() {}
+
+TieringRetention::TieringRetention(std::string datetime_expr,
+                                   std::shared_ptr<CatalogDescr> archiveDescr,
+                                   std::shared_ptr<BackupCatalog> catalog)
+  : Retention(archiveDescr, catalog) {
+
+  this->ruleType = RETENTION_MOVE_OLDER_BY_DATETIME;
+  this->interval.push(datetime_expr);
+
+}
+
+TieringRetention::TieringRetention(std::shared_ptr<RetentionRuleDescr> rule)
+  : Retention(rule) {
+
+  if (rule->type != RETENTION_MOVE_OLDER_BY_DATETIME) {
+    throw CCatalogIssue("tiering retention rule can only be created with MOVE OLDER THAN");
+  }
+
+  this->ruleType = rule->type;
+  this->interval.push(rule->value);
+
+}
+
+TieringRetention::~TieringRetention() {}
+
+void TieringRetention::init() {
+
+  this->cleanupDescr                 = make_shared<BackupCleanupDescr>();
+  this->cleanupDescr->mode           = NO_WAL_TO_DELETE;
+  this->cleanupDescr->basebackupMode = NO_BASEBACKUPS;
+
+}
+
+void TieringRetention::init(std::shared_ptr<BackupCleanupDescr> prevCleanupDescr) {
+
+  if (this->cleanupDescr != nullptr)
+    throw CArchiveIssue("cannot apply retention module repeatedly, "
+                        "call Retention::reset() before");
+
+  this->cleanupDescr = prevCleanupDescr;
+
+}
+
+bool TieringRetention::migrated(std::shared_ptr<BaseBackupDescr> bbdescr) {
+
+  path archive_dir = path(this->archiveDescr->directory).lexically_normal();
+  path fsentry = path(bbdescr->fsentry).lexically_normal();
+
+  /*
+   * Compare path components, a plain string prefix would
+   * take /archive2 for a subdirectory of /archive.
+   */
+  auto it = fsentry.begin();
+
+  for (auto &component : archive_dir) {
+
+    if (component == "." || component.empty())
+      continue;
+
+    if (it == fsentry.end() || *it != component)
+      return true;
+
+    ++it;
+
+  }
+
+  return false;
+
+}
+
+std::string TieringRetention::planStamp(std::vector<std::shared_ptr<BaseBackupDescr>> &list) {
+
+  std::string threshold = this->catalog->retentionDateTimeThreshold(this->interval);
+  unsigned int exceeding = 0;
+
+  for (auto &bbdescr : list) {
+    if (bbdescr->stopped.length() > 0 && bbdescr->stopped < threshold)
+      exceeding++;
+  }
+
+  return this->asString() + "/" + std::to_string(exceeding);
+
+}
+
+unsigned int TieringRetention::apply(std::vector<std::shared_ptr<BaseBackupDescr>> &list) {
+
+  std::shared_ptr<BackupCleanupDescr> migrateDescr = nullptr;
+  std::string threshold = this->catalog->retentionDateTimeThreshold(this->interval);
+  bool have_newest = false;
+  unsigned int result = 0;
+
+  if (this->cleanupDescr == nullptr) {
+    throw CArchiveIssue("cannot apply retention rule without initialization: call init() before");
+  }
+
+  if (this->cleanupDescr->migrateDescr == nullptr) {
+    this->cleanupDescr->migrateDescr = make_shared<BackupCleanupDescr>();
+    this->cleanupDescr->migrateDescr->basebackupMode = NO_BASEBACKUPS;
+  }
+
+  migrateDescr = this->cleanupDescr->migrateDescr;
+
+  /*
+   * The list is ordered newest first, so the first ready
+   * basebackup is the newest one.
+   */
+  for (auto &bbdescr : list) {
+
+    bool ready = (bbdescr->status == BaseBackupDescr::BASEBACKUP_STATUS_READY);
+    bool in_progress = (bbdescr->status == BaseBackupDescr::BASEBACKUP_STATUS_IN_PROGRESS);
+
+    /*
+     * Aborted basebackups and those moved before don't
+     * need anything in the archive directory.
+     */
+    if ((!ready && !in_progress) || this->migrated(bbdescr))
+      continue;
+
+    if (ready
+        && have_newest
+        && bbdescr->stopped.length() > 0
+        && bbdescr->stopped < threshold
+        && this->locked(bbdescr) != LOCKED_BY_SHM) {
+
+      migrateDescr->basebackups.push_back(bbdescr);
+      migrateDescr->basebackupMode = BASEBACKUP_KEEP;
+      result++;
+      continue;
+
+    }
+
+    if (ready)
+      have_newest = true;
+
+    /*
+     * The basebackup stays, and so does its WAL.
+     */
+    Retention::XLogCleanupOffsetKeep(migrateDescr,
+                                     PGStream::XLOGPrevSegmentStartPosition(PGStream::decodeXLOGPos(bbdescr->xlogpos),
+                                                                            bbdescr->wal_segment_size),
+                                     bbdescr->timeline,
+                                     bbdescr->wal_segment_size);
+    migrateDescr->mode = WAL_CLEANUP_OFFSET;
+
+  }
+
+  return result;
+
+}
+
+std::string TieringRetention::asString() {
+
+  return "MOVE OLDER THAN " + this->interval.getOperandsAsString();
+
+}
+
+void TieringRetention::setRetentionRuleType(const RetentionRuleId ruleType) {
+
+  if (ruleType != RETENTION_MOVE_OLDER_BY_DATETIME)
+    throw CCatalogIssue("tiering retention policy handles MOVE OLDER THAN rules only");
+
+  this->ruleType = ruleType;
+
+}
+
 /* *****************************************************************************
  * LabelRetention implementation
  * ****************************************************************************/
@@ -1379,7 +1689,7 @@ void LabelRetention::init() {
 
 }
 
-unsigned int LabelRetention::apply(vector<shared_ptr<BaseBackupDescr>> deleteList) {
+unsigned int LabelRetention::apply(vector<shared_ptr<BaseBackupDescr>> &deleteList) {
 
   unsigned int currindex = 0;
   unsigned int result = 0;
@@ -2060,7 +2370,7 @@ unsigned int PinRetention::dispatchPinAction(vector<shared_ptr<BaseBackupDescr>>
   return result;
 }
 
-unsigned int PinRetention::apply(vector<shared_ptr<BaseBackupDescr>> list) {
+unsigned int PinRetention::apply(vector<shared_ptr<BaseBackupDescr>> &list) {
 
   int result = 0;
 
@@ -0,0 +1,796 @@
+#include <retentionplan.hxx>
+#include <walindex.hxx>
+#include <fs-sync.hxx>
+#include <boost/log/trivial.hpp>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <set>
+
+using namespace pgbckctl;
+
+/*
+ * Plans of this process, see RetentionPlanner::cacheKey(). The
+ * launcher and an interactive shell live long enough to apply or
+ * preview the same policy over and over again.
+ */
+static std::map<std::string, std::shared_ptr<RetentionPlan>> retention_plan_cache;
+static std::mutex retention_plan_cache_mtx;
+
+/* *****************************************************************************
+ * RetentionPlan implementation
+ * ****************************************************************************/
+
+bool RetentionPlan::empty() {
+
+  return (this->cleanupDescr == nullptr
+          || this->cleanupDescr->basebackupMode == NO_BASEBACKUPS
+          || this->cleanupDescr->basebackups.size() == 0);
+
+}
+
+bool RetentionPlan::migrates() {
+
+  return (this->cleanupDescr != nullptr
+          && this->cleanupDescr->migrateDescr != nullptr
+          && (this->cleanupDescr->migrateDescr->basebackups.size() > 0
+              || this->wal_moved.files > 0));
+
+}
+
+unsigned long long RetentionPlan::bytesFreed() {
+
+  return this->basebackup_bytes + this->wal.bytes;
+
+}
+
+/* *****************************************************************************
+ * RetentionPlanner implementation
+ * ****************************************************************************/
+
+RetentionPlanner::RetentionPlanner(std::shared_ptr<BackupCatalog> catalog,
+                                   std::shared_ptr<CatalogDescr> archiveDescr,
+                                   std::string policy) {
+
+  if (catalog == nullptr)
+    throw CArchiveIssue("cannot plan retention with undefined catalog database handle");
+
+  if (archiveDescr == nullptr || archiveDescr->id < 0)
+    throw CArchiveIssue("cannot plan retention with undefined archive descriptor");
+
+  if (policy.length() == 0)
+    throw CArchiveIssue("cannot plan retention with empty retention policy name");
+
+  this->catalog = catalog;
+  this->archiveDescr = archiveDescr;
+  this->policy = policy;
+
+}
+
+RetentionPlanner::~RetentionPlanner() {}
+
+std::string RetentionPlanner::cacheKey() {
+
+  std::ostringstream oss;
+
+  oss << this->catalog->fullname() << ":" << this->archiveDescr->id << ":" << this->policy;
+  return oss.str();
+
+}
+
+std::string RetentionPlanner::fingerprint(std::vector<std::shared_ptr<BaseBackupDescr>> &list,
+                                          std::vector<std::shared_ptr<Retention>> &rules) {
+
+  std::ostringstream state;
+  std::ostringstream oss;
+
+  /*
+   * Everything a rule, the lock checks or the incremental chain
+   * resolution looks at. Lock state is included, since a basebackup
+   * in use by a worker is kept regardless of the policy.
+   */
+  for (auto &bbdescr : list) {
+
+    state << bbdescr->id << "|" << bbdescr->status << "|"
+          << bbdescr->pinned << "|" << this->locked(bbdescr) << "|"
+          << bbdescr->label << "|" << bbdescr->stopped << "|"
+          << bbdescr->xlogpos << "|" << bbdescr->xlogposend << "|"
+          << bbdescr->timeline << "|" << bbdescr->parent_id << ";";
+
+  }
+
+  for (auto &rule : rules) {
+    state << rule->planStamp(list) << ";";
+  }
+
+  for (auto &upload : this->pending_uploads) {
+    state << upload->id << "|" << upload->basebackup_id << ";";
+  }
+
+  oss << list.size() << "-" << std::hex << std::setw(16) << std::setfill('0')
+      << std::hash<std::string>()(state.str());
+
+  return oss.str();
+
+}
+
+void RetentionPlanner::evaluate(std::shared_ptr<RetentionPlan> plan,
+                                std::vector<std::shared_ptr<BaseBackupDescr>> &list,
+                                std::vector<std::shared_ptr<Retention>> &rules) {
+
+  std::shared_ptr<BackupCleanupDescr> cleanupDescr = nullptr;
+  std::set<int> elected;
+  std::vector<std::shared_ptr<BaseBackupDescr>> basebackups;
+
+  /*
+   * Apply all rules to the same list. Every rule continues with the
+   * cleanup descriptor of the rule before, even if that one didn't
+   * elect anything for deletion, so the WAL cleanup offsets of
+   * basebackups a rule wants to keep are never lost.
+   */
+  for (auto &rule : rules) {
+
+    for (auto &lockInfo : this->locks) {
+      rule->addLockInfo(lockInfo);
+    }
+
+    if (cleanupDescr == nullptr) {
+      rule->init();
+    } else {
+      rule->init(cleanupDescr);
+    }
+
+    rule->apply(list);
+
+    BOOST_LOG_TRIVIAL(debug) << "applied retention rule \"" << rule->asString() << "\"";
+
+    if (rule->getCleanupDescr() != nullptr)
+      cleanupDescr = rule->getCleanupDescr();
+
+  }
+
+  if (cleanupDescr == nullptr) {
+    cleanupDescr = std::make_shared<BackupCleanupDescr>();
+  }
+
+  /*
+   * Rules don't know of each other, so a basebackup might
+   * have been elected more than once.
+   */
+  for (auto &bbdescr : cleanupDescr->basebackups) {
+
+    if (elected.insert(bbdescr->id).second)
+      basebackups.push_back(bbdescr);
+
+  }
+
+  cleanupDescr->basebackups = basebackups;
+  plan->cleanupDescr = cleanupDescr;
+
+  /*
+   * Keep basebackups not uploaded yet. Before the incremental
+   * chains are resolved, so their parents are kept, too.
+   */
+  plan->kept_uploads = this->keepUploadingBasebackups(cleanupDescr);
+
+  this->evaluateMigration(plan);
+
+  if (cleanupDescr->basebackups.size() == 0) {
+    cleanupDescr->basebackupMode = NO_BASEBACKUPS;
+    return;
+  }
+
+  /*
+   * Don't break chains of incremental basebackups.
+   */
+  plan->kept_parents = Retention::keepIncrementalParents(cleanupDescr, this->catalog);
+
+  if (cleanupDescr->basebackups.size() == 0) {
+    cleanupDescr->basebackupMode = NO_BASEBACKUPS;
+    return;
+  }
+
+  for (auto &bbdescr : cleanupDescr->basebackups) {
+
+    if (plan->wal_segment_size == 0)
+      plan->wal_segment_size = bbdescr->wal_segment_size;
+
+    for (auto &tblspc : bbdescr->tablespaces) {
+      plan->basebackup_bytes += tblspc->spcsize;
+    }
+
+  }
+
+  this->keepUploadingWAL(cleanupDescr, plan->wal_segment_size);
+
+  /*
+   * Determine the WAL to remove once for the whole plan.
+   */
+  {
+    std::shared_ptr<BackupDirectory> backupDir
+      = std::make_shared<BackupDirectory>(path(this->archiveDescr->directory));
+    std::shared_ptr<ArchiveLogDirectory> archiveLogDir
+      = std::make_shared<ArchiveLogDirectory>(backupDir);
+
+    archiveLogDir->checkCleanupDescriptor(cleanupDescr);
+
+    if (archiveLogDir->exists()) {
+      plan->wal = archiveLogDir->removeXLogs(cleanupDescr, plan->wal_segment_size, true);
+    }
+  }
+
+}
+
+unsigned int RetentionPlanner::keepUploadingBasebackups(std::shared_ptr<BackupCleanupDescr> cleanupDescr) {
+
+  std::set<int> uploading;
+  std::vector<std::shared_ptr<BaseBackupDescr>> basebackups;
+  unsigned int kept = 0;
+
+  for (auto &upload : this->pending_uploads) {
+
+    if (upload->kind == UPLOAD_BASEBACKUP)
+      uploading.insert(upload->basebackup_id);
+
+  }
+
+  if (uploading.size() == 0)
+    return 0;
+
+  for (auto &bbdescr : cleanupDescr->basebackups) {
+
+    if (uploading.find(bbdescr->id) != uploading.end()) {
+
+      BOOST_LOG_TRIVIAL(info) << "basebackup \"" << bbdescr->fsentry
+                              << "\" is not uploaded yet, keeping it";
+      kept++;
+      continue;
+
+    }
+
+    basebackups.push_back(bbdescr);
+
+  }
+
+  cleanupDescr->basebackups = basebackups;
+  return kept;
+
+}
+
+void RetentionPlanner::keepUploadingWAL(std::shared_ptr<BackupCleanupDescr> cleanupDescr,
+                                        unsigned long long wal_segment_size) {
+
+  unsigned int lowest_tli = 0;
+
+  if (wal_segment_size == 0 || cleanupDescr->off_list.size() == 0)
+    return;
+
+  for (auto const &offset_item : cleanupDescr->off_list) {
+
+    if (lowest_tli == 0 || offset_item.first < lowest_tli)
+      lowest_tli = offset_item.first;
+
+  }
+
+  for (auto &upload : this->pending_uploads) {
+
+    std::string filename;
+    TimeLineID tli = 0;
+    XLogSegNo segno = 0;
+
+    if (upload->kind != UPLOAD_WAL)
+      continue;
+
+    filename = path(upload->path).filename().string();
+
+    if (!xlog::parseWalFileName(filename.c_str(), filename.length(),
+                                tli, segno, wal_segment_size)
+        || segno == 0)
+      continue;
+
+    /*
+     * Segments on timelines without a cleanup offset are removed
+     * only below the lowest timeline with one, see
+     * ArchiveLogDirectory::removeXLogs().
+     */
+    if (cleanupDescr->off_list.find(tli) == cleanupDescr->off_list.end()
+        && tli > lowest_tli)
+      continue;
+
+    /*
+     * Segments are removed up to and including the one starting
+     * at the cleanup offset, so stop at the previous segment.
+     */
+    Retention::XLogCleanupOffsetKeep(cleanupDescr,
+                                     xlog::segmentStart(segno - 1, wal_segment_size),
+                                     tli,
+                                     wal_segment_size);
+
+  }
+
+}
+
+void RetentionPlanner::evaluateMigration(std::shared_ptr<RetentionPlan> plan) {
+
+  std::shared_ptr<BackupCleanupDescr> migrateDescr = plan->cleanupDescr->migrateDescr;
+  std::vector<std::shared_ptr<BaseBackupDescr>> basebackups;
+  std::set<int> dropped;
+  unsigned long long wal_segment_size = 0;
+
+  if (migrateDescr == nullptr)
+    return;
+
+  plan->cold_directory = this->catalog->getArchiveColdDirectory(this->archiveDescr->id);
+
+  if (plan->cold_directory.length() == 0) {
+
+    std::ostringstream oss;
+
+    oss << "archive \"" << this->archiveDescr->archive_name
+        << "\" has no cold tier, use ALTER ARCHIVE ... SET COLD DIRECTORY";
+    throw CArchiveIssue(oss.str());
+
+  }
+
+  /*
+   * Basebackups dropped by another rule of the
+   * policy aren't worth moving.
+   */
+  for (auto &bbdescr : plan->cleanupDescr->basebackups)
+    dropped.insert(bbdescr->id);
+
+  for (auto &bbdescr : migrateDescr->basebackups) {
+
+    if (dropped.find(bbdescr->id) == dropped.end())
+      basebackups.push_back(bbdescr);
+
+  }
+
+  migrateDescr->basebackups = basebackups;
+  plan->kept_uploads += this->keepUploadingBasebackups(migrateDescr);
+
+  for (auto &bbdescr : migrateDescr->basebackups) {
+
+    for (auto &tblspc : bbdescr->tablespaces) {
+      plan->migrate_bytes += tblspc->spcsize;
+    }
+
+  }
+
+  for (auto &offset : migrateDescr->off_list) {
+    wal_segment_size = offset.second->wal_segment_size;
+  }
+
+  if (migrateDescr->mode == NO_WAL_TO_DELETE || wal_segment_size == 0)
+    return;
+
+  /*
+   * Determine the WAL to move, the same way as the
+   * WAL to remove.
+   */
+  {
+    std::shared_ptr<BackupDirectory> backupDir
+      = std::make_shared<BackupDirectory>(path(this->archiveDescr->directory));
+    std::shared_ptr<ArchiveLogDirectory> archiveLogDir
+      = std::make_shared<ArchiveLogDirectory>(backupDir);
+
+    archiveLogDir->checkCleanupDescriptor(migrateDescr);
+
+    if (archiveLogDir->exists() && migrateDescr->mode != NO_WAL_TO_DELETE) {
+      plan->wal_moved = archiveLogDir->moveXLogs(migrateDescr,
+                                                 wal_segment_size,
+                                                 path(plan->cold_directory) / "log",
+                                                 true);
+    }
+  }
+
+}
+
+std::shared_ptr<RetentionPlan> RetentionPlanner::plan() {
+
+  std::vector<std::shared_ptr<Retention>> rules = Retention::get(this->policy,
+                                                                 this->archiveDescr,
+                                                                 this->catalog);
+  std::vector<std::shared_ptr<BaseBackupDescr>> list;
+  std::shared_ptr<RetentionPlan> result = nullptr;
+  std::string key = this->cacheKey();
+  std::string stamp;
+
+  if (rules.size() == 0) {
+
+    std::ostringstream oss;
+
+    oss << "retention policy \"" << this->policy << "\" does not contain a rule";
+    throw CArchiveIssue(oss.str());
+
+  }
+
+  list = this->catalog->getBackupList(this->archiveDescr->archive_name);
+
+  this->pending_uploads.clear();
+  this->catalog->getUploads(this->archiveDescr->id, this->pending_uploads, true);
+  stamp = this->fingerprint(list, rules);
+
+  /*
+   * Nothing changed since the cached plan was made, reuse it.
+   */
+  {
+    std::lock_guard<std::mutex> guard(retention_plan_cache_mtx);
+    auto it = retention_plan_cache.find(key);
+
+    if (it != retention_plan_cache.end() && it->second->fingerprint == stamp) {
+
+      result = std::make_shared<RetentionPlan>(*(it->second));
+      result->cached = true;
+
+      BOOST_LOG_TRIVIAL(debug) << "using cached retention plan for policy \""
+                               << this->policy << "\"";
+
+      return result;
+
+    }
+  }
+
+  result = std::make_shared<RetentionPlan>();
+  result->policy = this->policy;
+  result->archive_id = this->archiveDescr->id;
+  result->fingerprint = stamp;
+
+  this->evaluate(result, list, rules);
+
+  {
+    std::lock_guard<std::mutex> guard(retention_plan_cache_mtx);
+    retention_plan_cache[key] = std::make_shared<RetentionPlan>(*result);
+  }
+
+  return result;
+
+}
+
+void RetentionPlanner::execute(std::shared_ptr<RetentionPlan> plan) {
+
+  std::shared_ptr<BackupDirectory> backupDir = nullptr;
+  std::shared_ptr<ArchiveLogDirectory> archiveLogDir = nullptr;
+
+  if (plan == nullptr)
+    throw CArchiveIssue("cannot execute undefined retention plan");
+
+  if (plan->archive_id != this->archiveDescr->id || plan->policy != this->policy)
+    throw CArchiveIssue("retention plan doesn't belong to this archive and policy");
+
+  /*
+   * The plan is gone after this, whether we succeed or not.
+   */
+  this->invalidate();
+
+  if (plan->empty())
+    return;
+
+  /*
+   * A worker might have started to use a basebackup of the
+   * plan in the meantime, plan again in this case. Pin and status
+   * are part of the fingerprint already and aborted basebackups
+   * are elected by CLEANUP rules on purpose, so only shared memory
+   * locks matter here.
+   */
+  for (auto &bbdescr : plan->cleanupDescr->basebackups) {
+
+    if (this->locked(bbdescr) == LOCKED_BY_SHM) {
+
+      BOOST_LOG_TRIVIAL(info) << "basebackup \"" << bbdescr->fsentry
+                              << "\" got locked, planning retention again";
+
+      *plan = *(this->plan());
+      this->invalidate();
+
+      if (plan->empty())
+        return;
+
+      break;
+
+    }
+
+  }
+
+  backupDir = std::make_shared<BackupDirectory>(path(this->archiveDescr->directory));
+  archiveLogDir = std::make_shared<ArchiveLogDirectory>(backupDir);
+
+  /*
+   * Drop the basebackups from the catalog database first, then
+   * unlink the file(s) and director(y|ies) physically.
+   */
+  for (auto &basebackup : plan->cleanupDescr->basebackups) {
+
+    boost::system::error_code ec;
+
+#ifdef __DEBUG__
+    BOOST_LOG_TRIVIAL(debug) << "deleting fs path " << basebackup->fsentry;
+#endif
+
+    DedupChunkStore::release(this->catalog, plan->archive_id, basebackup);
+
+    this->catalog->deleteBaseBackup(basebackup->id);
+    remove_all(path(basebackup->fsentry), ec);
+
+    /*
+     * Explicitely warn in case the file was already deleted.
+     */
+    if (ec.value() == boost::system::errc::no_such_file_or_directory) {
+
+      BOOST_LOG_TRIVIAL(debug) << "WARNING: basebackup in file/directory "
+                               << basebackup->fsentry
+                               << " already gone.";
+
+    } else if (ec.value() != boost::system::errc::success) {
+
+      throw CArchiveIssue(ec.message());
+
+    }
+
+  }
+
+  /*
+   * Archive cleanup is done once for all basebackups, the
+   * cleanup offsets already account for every one of them.
+   */
+#ifdef __DEBUG__
+  BOOST_LOG_TRIVIAL(debug) << "DEBUG: cleaning archive log directory "
+                           << archiveLogDir->getPath();
+#endif
+
+  /*
+   * Chunks only the deleted basebackups referenced.
+   */
+  DedupChunkStore(DedupChunkStore::forArchive(path(this->archiveDescr->directory))).sweep(this->catalog,
+                                                                                          plan->archive_id);
+
+  archiveLogDir->checkCleanupDescriptor(plan->cleanupDescr);
+
+  if (archiveLogDir->exists()) {
+    plan->wal = archiveLogDir->removeXLogs(plan->cleanupDescr, plan->wal_segment_size);
+    this->updateArchiveStats(plan, archiveLogDir);
+  }
+
+}
+
+/*
+ * Counts the regular files below dir and sums up their sizes.
+ */
+static void tree_size(path dir, unsigned long long &files, unsigned long long &bytes) {
+
+  files = 0;
+  bytes = 0;
+
+  for (recursive_directory_iterator it(dir); it != recursive_directory_iterator(); ++it) {
+
+    if (is_regular_file(it->symlink_status())) {
+      files++;
+      bytes += file_size(it->path());
+    }
+
+  }
+
+}
+
+bool RetentionPlanner::migrateBasebackup(std::shared_ptr<BaseBackupDescr> bbdescr,
+                                         path cold_base) {
+
+  path source(bbdescr->fsentry);
+  path target = cold_base / source.filename();
+  path temp = target.string() + ".migrating";
+  unsigned long long source_files, source_bytes;
+  unsigned long long target_files, target_bytes;
+  bool has_tx = false;
+
+  /*
+   * The catalog still refers to source, so anything at the
+   * target is left over by an interrupted run.
+   */
+  remove_all(temp);
+  remove_all(target);
+
+  {
+    BackupCopyManager copyMgr(std::make_shared<BackupDirectory>(source),
+                              std::make_shared<TargetDirectory>(temp));
+
+    copyMgr.start();
+    copyMgr.wait();
+  }
+
+  tree_size(source, source_files, source_bytes);
+  tree_size(temp, target_files, target_bytes);
+
+  if (source_files != target_files || source_bytes != target_bytes) {
+
+    std::ostringstream oss;
+
+    oss << "copy of basebackup \"" << source.string() << "\" is incomplete: "
+        << target_files << " of " << source_files << " files, "
+        << target_bytes << " of " << source_bytes << " bytes";
+    remove_all(temp);
+    throw CArchiveIssue(oss.str());
+
+  }
+
+  /*
+   * The copy manager syncs the files, but not the
+   * directories it created.
+   */
+  {
+    RecursiveSync sync(temp);
+    sync.sync();
+  }
+
+  rename(temp, target);
+  RootDirectory::fsync(cold_base);
+
+  try {
+
+    this->catalog->startTransaction();
+    has_tx = true;
+
+    if (this->locked(bbdescr) == LOCKED_BY_SHM) {
+
+      this->catalog->rollbackTransaction();
+      has_tx = false;
+
+      BOOST_LOG_TRIVIAL(info) << "basebackup \"" << bbdescr->fsentry
+                              << "\" got locked, not moving it";
+      remove_all(target);
+      return false;
+
+    }
+
+    this->catalog->updateBaseBackupFsentry(bbdescr->id, target.string());
+    this->catalog->commitTransaction();
+    has_tx = false;
+
+  } catch (CPGBackupCtlFailure &e) {
+
+    if (has_tx)
+      this->catalog->rollbackTransaction();
+
+    remove_all(target);
+    throw e;
+
+  }
+
+  bbdescr->fsentry = target.string();
+
+  remove_all(source);
+  RootDirectory::fsync(source.parent_path());
+
+  BOOST_LOG_TRIVIAL(info) << "moved basebackup \"" << source.string()
+                          << "\" to \"" << target.string() << "\"";
+
+  return true;
+
+}
+
+unsigned int RetentionPlanner::migrate(std::shared_ptr<RetentionPlan> plan) {
+
+  std::shared_ptr<BackupCleanupDescr> migrateDescr = nullptr;
+  unsigned long long wal_segment_size = 0;
+  unsigned int result = 0;
+  path cold;
+
+  if (plan == nullptr)
+    throw CArchiveIssue("cannot migrate undefined retention plan");
+
+  if (plan->archive_id != this->archiveDescr->id || plan->policy != this->policy)
+    throw CArchiveIssue("retention plan doesn't belong to this archive and policy");
+
+  this->invalidate();
+
+  if (!plan->migrates())
+    return 0;
+
+  migrateDescr = plan->cleanupDescr->migrateDescr;
+  cold = path(plan->cold_directory);
+
+  create_directories(cold / "base");
+
+  for (auto &bbdescr : migrateDescr->basebackups) {
+
+    if (this->locked(bbdescr) == LOCKED_BY_SHM) {
+
+      BOOST_LOG_TRIVIAL(info) << "basebackup \"" << bbdescr->fsentry
+                              << "\" is in use, not moving it";
+      continue;
+
+    }
+
+    if (this->migrateBasebackup(bbdescr, cold / "base"))
+      result++;
+
+  }
+
+  /*
+   * WAL needed by the basebackups staying in the archive
+   * directory stays, too. That's still true if a basebackup
+   * elected to move was left alone.
+   */
+  for (auto &offset : migrateDescr->off_list) {
+    wal_segment_size = offset.second->wal_segment_size;
+  }
+
+  plan->wal_moved = XLogRemovalResult();
+
+  if (migrateDescr->mode != NO_WAL_TO_DELETE && wal_segment_size > 0) {
+
+    std::shared_ptr<BackupDirectory> backupDir
+      = std::make_shared<BackupDirectory>(path(this->archiveDescr->directory));
+    std::shared_ptr<ArchiveLogDirectory> archiveLogDir
+      = std::make_shared<ArchiveLogDirectory>(backupDir);
+
+    if (archiveLogDir->exists()) {
+      plan->wal_moved = archiveLogDir->moveXLogs(migrateDescr,
+                                                 wal_segment_size,
+                                                 cold / "log");
+    }
+
+  }
+
+  return result;
+
+}
+
+void RetentionPlanner::updateArchiveStats(std::shared_ptr<RetentionPlan> plan,
+                                          std::shared_ptr<ArchiveLogDirectory> archiveLogDir) {
+
+  std::shared_ptr<ArchiveStatsDescr> stats = this->catalog->getArchiveStats(this->archiveDescr->id);
+  std::vector<WALSegmentIndexEntry> entries;
+
+  /*
+   * Nothing to maintain if the archive was never streamed into,
+   * the streamer initializes the statistics then.
+   */
+  if (stats->archive_id < 0 || plan->wal.files == 0)
+    return;
+
+  stats->wal_bytes = (stats->wal_bytes > plan->wal.bytes) ? stats->wal_bytes - plan->wal.bytes : 0;
+
+  /*
+   * The removed files might include TLI history files and
+   * partial segments, which aren't accounted as segments. The
+   * segment index knows what is left, without looking at the
+   * log directory again.
+   */
+  entries = archiveLogDir->segmentIndex(plan->wal_segment_size)->getEntries();
+  stats->wal_segments = 0;
+  stats->oldest_xlogpos = "";
+
+  for (auto &entry : entries) {
+
+    if (entry.status != WAL_SEGMENT_COMPLETE
+        && entry.status != WAL_SEGMENT_COMPLETE_COMPRESSED)
+      continue;
+
+    if (stats->wal_segments == 0)
+      stats->oldest_xlogpos = PGStream::encodeXLOGPos(entry.segno * plan->wal_segment_size);
+
+    stats->wal_segments++;
+
+  }
+
+  if (stats->wal_segments == 0)
+    stats->newest_xlogpos = "";
+
+  this->catalog->setArchiveWALStats(stats);
+
+}
+
+void RetentionPlanner::invalidate() {
+
+  std::lock_guard<std::mutex> guard(retention_plan_cache_mtx);
+  retention_plan_cache.erase(this->cacheKey());
+
+}
+
+void RetentionPlanner::clearCache() {
+
+  std::lock_guard<std::mutex> guard(retention_plan_cache_mtx);
+  retention_plan_cache.clear();
+
+}
@@ -0,0 +1,334 @@
+#include <cstring>
+#include <sstream>
+
+#include <checksum.hxx>
+#include <fs-archive.hxx>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define PG_BACKUP_CTL_CRC32C_SSE42 1
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define PG_BACKUP_CTL_CRC32C_ARMV8 1
+#endif
+
+using namespace pgbckctl;
+
+/******************************************************************************
+ * Implementation of CRC32C
+ *****************************************************************************/
+
+/*
+ * Lookup tables for the slicing-by-8 implementation, table[0] is
+ * the classic bytewise table of the reflected Castagnoli polynomial.
+ */
+struct crc32c_tables {
+
+  uint32_t table[8][256];
+
+  crc32c_tables() {
+
+    for (uint32_t i = 0; i < 256; i++) {
+
+      uint32_t crc = i;
+
+      for (int j = 0; j < 8; j++)
+        crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : (crc >> 1);
+
+      table[0][i] = crc;
+
+    }
+
+    for (uint32_t i = 0; i < 256; i++) {
+      for (int t = 1; t < 8; t++)
+        table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+    }
+
+  }
+
+};
+
+static uint32_t crc32c_sb8(uint32_t crc, const unsigned char *p, size_t len) {
+
+  /* initialized once, thread safe since C++11 */
+  static const crc32c_tables tables;
+  const uint32_t (*t)[256] = tables.table;
+
+  while (len > 0 && ((uintptr_t) p & 7) != 0) {
+    crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    len--;
+  }
+
+  while (len >= 8) {
+
+    uint32_t lo;
+    uint32_t hi;
+
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + 4, 4);
+
+#ifdef PG_BACKUP_CTL_BIG_ENDIAN
+    lo = __builtin_bswap32(lo);
+    hi = __builtin_bswap32(hi);
+#endif
+
+    lo ^= crc;
+
+    crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF]
+      ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+      ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF]
+      ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+
+    p += 8;
+    len -= 8;
+
+  }
+
+  while (len-- > 0)
+    crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+  return crc;
+
+}
+
+#ifdef PG_BACKUP_CTL_CRC32C_SSE42
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len) {
+
+  uint64_t crc64 = crc;
+
+  while (len > 0 && ((uintptr_t) p & 7) != 0) {
+    crc64 = _mm_crc32_u8((uint32_t) crc64, *p++);
+    len--;
+  }
+
+  while (len >= 8) {
+
+    uint64_t word;
+
+    memcpy(&word, p, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+
+    p += 8;
+    len -= 8;
+
+  }
+
+  while (len-- > 0)
+    crc64 = _mm_crc32_u8((uint32_t) crc64, *p++);
+
+  return (uint32_t) crc64;
+
+}
+
+#endif
+
+#ifdef PG_BACKUP_CTL_CRC32C_ARMV8
+
+static uint32_t crc32c_armv8(uint32_t crc, const unsigned char *p, size_t len) {
+
+  while (len > 0 && ((uintptr_t) p & 7) != 0) {
+    crc = __crc32cb(crc, *p++);
+    len--;
+  }
+
+  while (len >= 8) {
+
+    uint64_t word;
+
+    memcpy(&word, p, 8);
+    crc = __crc32cd(crc, word);
+
+    p += 8;
+    len -= 8;
+
+  }
+
+  while (len-- > 0)
+    crc = __crc32cb(crc, *p++);
+
+  return crc;
+
+}
+
+#endif
+
+bool CRC32C::hardwareAccelerated() {
+
+#if defined(PG_BACKUP_CTL_CRC32C_SSE42)
+  static const bool sse42 = __builtin_cpu_supports("sse4.2");
+  return sse42;
+#elif defined(PG_BACKUP_CTL_CRC32C_ARMV8)
+  return true;
+#else
+  return false;
+#endif
+
+}
+
+uint32_t CRC32C::update(uint32_t crc, const void *data, size_t len) {
+
+  const unsigned char *p = (const unsigned char *) data;
+
+#if defined(PG_BACKUP_CTL_CRC32C_SSE42)
+  if (CRC32C::hardwareAccelerated())
+    return crc32c_sse42(crc, p, len);
+#elif defined(PG_BACKUP_CTL_CRC32C_ARMV8)
+  return crc32c_armv8(crc, p, len);
+#endif
+
+  return crc32c_sb8(crc, p, len);
+
+}
+
+uint32_t CRC32C::compute(const void *data, size_t len) {
+
+  return CRC32C::update(0xFFFFFFFF, data, len) ^ 0xFFFFFFFF;
+
+}
+
+/******************************************************************************
+ * Implementation of FileChecksum
+ *****************************************************************************/
+
+FileChecksum::~FileChecksum() {}
+
+bool FileChecksum::supported(std::string algorithm) {
+
+  if (algorithm == "CRC32C")
+    return true;
+
+#ifdef PG_BACKUP_CTL_HAS_OPENSSL
+  if (algorithm == "SHA224" || algorithm == "SHA256"
+      || algorithm == "SHA384" || algorithm == "SHA512")
+    return true;
+#endif
+
+  return false;
+
+}
+
+std::shared_ptr<FileChecksum> FileChecksum::create(std::string algorithm) {
+
+  if (algorithm == "CRC32C")
+    return std::make_shared<CRC32CChecksum>();
+
+#ifdef PG_BACKUP_CTL_HAS_OPENSSL
+  if (FileChecksum::supported(algorithm))
+    return std::make_shared<SHAChecksum>(algorithm);
+#endif
+
+  std::ostringstream oss;
+  oss << "checksum algorithm \"" << algorithm << "\" not supported";
+  throw CArchiveIssue(oss.str());
+
+}
+
+std::string FileChecksum::toHex(const unsigned char *data, size_t len) {
+
+  static const char digits[] = "0123456789abcdef";
+  std::string result;
+
+  result.reserve(len * 2);
+
+  for (size_t i = 0; i < len; i++) {
+    result.push_back(digits[data[i] >> 4]);
+    result.push_back(digits[data[i] & 0x0F]);
+  }
+
+  return result;
+
+}
+
+/******************************************************************************
+ * Implementation of CRC32CChecksum
+ *****************************************************************************/
+
+CRC32CChecksum::CRC32CChecksum() {}
+
+CRC32CChecksum::~CRC32CChecksum() {}
+
+void CRC32CChecksum::update(const char *buf, size_t len) {
+
+  this->crc = CRC32C::update(this->crc, buf, len);
+
+}
+
+std::string CRC32CChecksum::final() {
+
+  uint32_t result = this->crc ^ 0xFFFFFFFF;
+  unsigned char bytes[sizeof(result)];
+
+  /*
+   * PostgreSQL hex encodes the in-memory representation
+   * of the CRC, so do the same.
+   */
+  memcpy(bytes, &result, sizeof(result));
+  return FileChecksum::toHex(bytes, sizeof(bytes));
+
+}
+
+std::string CRC32CChecksum::algorithm() {
+  return "CRC32C";
+}
+
+#ifdef PG_BACKUP_CTL_HAS_OPENSSL
+
+/******************************************************************************
+ * Implementation of SHAChecksum
+ *****************************************************************************/
+
+SHAChecksum::SHAChecksum(std::string algorithm) {
+
+  const EVP_MD *md = EVP_get_digestbyname(algorithm.c_str());
+
+  if (md == NULL) {
+    std::ostringstream oss;
+    oss << "checksum algorithm \"" << algorithm << "\" not supported by OpenSSL";
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->ctx = EVP_MD_CTX_new();
+
+  if (this->ctx == NULL || EVP_DigestInit_ex(this->ctx, md, NULL) != 1) {
+    EVP_MD_CTX_free(this->ctx);
+    throw CArchiveIssue("could not initialize checksum context for " + algorithm);
+  }
+
+  this->name = algorithm;
+
+}
+
+SHAChecksum::~SHAChecksum() {
+
+  EVP_MD_CTX_free(this->ctx);
+
+}
+
+void SHAChecksum::update(const char *buf, size_t len) {
+
+  if (EVP_DigestUpdate(this->ctx, buf, len) != 1)
+    throw CArchiveIssue("could not update " + this->name + " checksum");
+
+}
+
+std::string SHAChecksum::final() {
+
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int len = 0;
+
+  if (EVP_DigestFinal_ex(this->ctx, digest, &len) != 1)
+    throw CArchiveIssue("could not finalize " + this->name + " checksum");
+
+  return FileChecksum::toHex(digest, len);
+
+}
+
+std::string SHAChecksum::algorithm() {
+  return this->name;
+}
+
+#endif
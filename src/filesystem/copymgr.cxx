@@ -1,4 +1,16 @@
+#include <algorithm>
+#include <chrono>
+
 #include <fs-copy.hxx>
+#include <probes.hxx>
+
+#ifdef __linux__
+extern "C" {
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <unistd.h>
+}
+#endif
 
 using namespace pgbckctl;
 
@@ -15,6 +27,8 @@ TargetDirectory::~TargetDirectory() {}
  * BaseCopyManager
  * **************************************************************************/
 
+const size_t BaseCopyManager::DEFAULT_COPY_CHUNK_SIZE;
+
 BaseCopyManager::BaseCopyManager(std::shared_ptr<BackupDirectory> in,
                                  std::shared_ptr<TargetDirectory> out) {
   this->setSourceDirectory(in);
@@ -53,7 +67,20 @@ BaseCopyManager::get(std::shared_ptr<StreamingBaseBackupDirectory> in,
 
 }
 
-BaseCopyManager::~BaseCopyManager() {}
+BaseCopyManager::~BaseCopyManager() {
+
+  /*
+   * Copy items still running reference our operations
+   * handler, so make them exit before it goes away.
+   */
+  this->stop();
+
+  for (auto &item : ops.ops) {
+    if (item != nullptr)
+      item->join();
+  }
+
+}
 
 void BaseCopyManager::assignSigStopHandler(JobSignalHandler *handler) {
 
@@ -94,7 +121,11 @@ BaseCopyManager::_copyItem::_copyItem(int slot) {
 
 }
 
-BaseCopyManager::_copyItem::~_copyItem() {}
+BaseCopyManager::_copyItem::~_copyItem() {
+
+  this->join();
+
+}
 
 void BaseCopyManager::_copyItem::exitForced() {
 
@@ -102,182 +133,201 @@ void BaseCopyManager::_copyItem::exitForced() {
 
 }
 
-unsigned short BaseCopyManager::getNumberOfCopyInstances() {
-  return this->max_copy_instances;
-}
+void BaseCopyManager::_copyItem::setCopyStrategy(CopyStrategy strategy) {
 
-void BaseCopyManager::setNumberOfCopyInstances(unsigned short instances) {
+  this->strategy = strategy;
 
-  if (instances > MAX_PARALLEL_COPY_INSTANCES) {
-    std::ostringstream oss;
-    oss << "number of copy instances("
-        << instances
-        << ") exceeds allowed("
-        << MAX_PARALLEL_COPY_INSTANCES
-        << ")";
-    throw CArchiveIssue(oss.str());
-  }
+}
 
-  this->max_copy_instances = instances;
+void BaseCopyManager::_copyItem::setDirectIO(bool direct_io) {
+
+  this->direct_io = direct_io;
 
 }
 
-#ifdef PG_BACKUP_CTL_HAS_LIBURING
+void BaseCopyManager::_copyItem::setIOParameters(size_t io_size, unsigned int queue_depth) {
 
-/* **************************************************************************
- * IOUringCopyManager
- * **************************************************************************/
+  this->io_size = io_size;
+  this->io_queue_depth = queue_depth;
 
-IOUringCopyManager::_iouring_copyItem::_iouring_copyItem(unsigned int slot) noexcept
-  : BaseCopyManager::_copyItem::_copyItem(slot ){}
+}
 
-IOUringCopyManager::_iouring_copyItem::~_iouring_copyItem() noexcept{}
+void BaseCopyManager::setIOParameters(size_t io_size, unsigned int queue_depth) {
 
-void IOUringCopyManager::_iouring_copyItem::work(BaseCopyManager::_copyOperations &ops_handler,
-                                                 path inputFileName,
-                                                 path outputFileName) const {
+  this->io_size = io_size;
+  this->io_queue_depth = queue_depth;
 
-  std::shared_ptr<ArchiveFile> in  = std::make_shared<ArchiveFile>(inputFileName);
-  std::shared_ptr<ArchiveFile> out = std::make_shared<ArchiveFile>(outputFileName);
-  std::shared_ptr<vectored_buffer> rbuf = nullptr;
+}
 
-  /* io_uring instance belonging to this copy item, read queue */
-  IOUringInstance ring;
+size_t BaseCopyManager::getIOSize() {
 
-  size_t total_bytes_read = 0;
+  return this->io_size;
 
-  if ( (in == nullptr) || (out == nullptr) ) {
-    throw CArchiveIssue("undefined input/output file in copy thread");
-  }
+}
 
-  in->setOpenMode("rb");
-  in->open();
+unsigned int BaseCopyManager::getIOQueueDepth() {
 
-  out->setOpenMode("wb+");
-  out->open();
+  return this->io_queue_depth;
 
-  ring.setup();
+}
 
-  /* allocate input buffer according to current settings */
-  ring.alloc_buffer(rbuf, ring.getBlockSize() * ring.getQueueDepth());
+void BaseCopyManager::setDirectIO(bool direct_io) {
 
-  while(total_bytes_read < in->size()) {
+  this->direct_io = direct_io;
 
-    ssize_t recv_bytes = 0;
+}
 
-    /* start reading */
-    ring.read(in, rbuf, (off_t) total_bytes_read);
+bool BaseCopyManager::getDirectIO() {
 
-    /* wait till first read attempt is completed */
+  return this->direct_io;
 
-    recv_bytes = ring.handle_current_io(rbuf);
-    rbuf->setEffectiveSize(recv_bytes, true);
+}
 
-    if (recv_bytes > 0) {
+void BaseCopyManager::setCopyStrategy(CopyStrategy strategy) {
 
-      ssize_t write_bytes = 0;
+  this->copy_strategy = strategy;
 
-      /* issue write request to new file */
+}
 
-      while (write_bytes < recv_bytes) {
+CopyStrategy BaseCopyManager::getCopyStrategy() {
 
-        ring.write(out, rbuf, total_bytes_read);
-        write_bytes += ring.handle_current_io(rbuf, true);
+  return this->copy_strategy;
 
-      }
+}
 
-      total_bytes_read += recv_bytes;
+CopyStrategy BaseCopyManager::fastCopy(std::shared_ptr<ArchiveFile> in,
+                                       std::shared_ptr<ArchiveFile> out,
+                                       CopyStrategy strategy) {
 
-    }
+  if (!in->isOpen() || !out->isOpen())
+    throw CArchiveIssue("could not copy file: input or output file not opened");
 
-    /* schedule next read */
-    rbuf->clear();
+#ifdef __linux__
 
-    /*
-     * Check whether we are forced to exit.
-     *
-     * XXX: Checking just for the exit flag should be safe
-     *      without a critical section here.
-     */
-    if (ops_handler.exit)
-      break;
+#ifdef FICLONE
+  /*
+   * A reflink shares the extents of the source file, which
+   * requires both to be on the same filesystem supporting
+   * this (XFS, btrfs and others).
+   */
+  if (strategy == COPY_STRATEGY_AUTO || strategy == COPY_STRATEGY_REFLINK) {
+
+    if (::ioctl(out->getFileno(), FICLONE, in->getFileno()) == 0)
+      return COPY_STRATEGY_REFLINK;
+
+    BOOST_LOG_TRIVIAL(debug) << "DEBUG: could not clone \""
+                             << in->getFilePath() << "\": "
+                             << strerror(errno);
 
   }
+#endif
 
   /*
-   * Sync the out file ...
-   *
-   * We do this here so that the sync overhead is not located
-   * in the main process but delegated to its specific copy thread.
-   *
-   * But keep the file open, the close operation is finally done by the caller whether
-   * he needs the file for something else further.
+   * copy_file_range() copies within the kernel. Depending on the
+   * filesystem this clones, too, or does a server side copy. Any
+   * failure returns to copying through buffers, which starts
+   * over at the beginning of the file.
    */
-  out->fsync();
+  if ((strategy == COPY_STRATEGY_AUTO || strategy == COPY_STRATEGY_COPY_RANGE)
+      && BaseCopyManager::copyFileRange(in, out, 0, in->size()))
+    return COPY_STRATEGY_COPY_RANGE;
 
-  /* Sanity check */
-  if (out->size() < in->size())
-    throw CIOUringIssue("copied less bytes than file size");
+#endif
 
-  /* Tear down uring ... */
-  ring.exit();
+  return COPY_STRATEGY_STREAM;
+
+}
+
+bool BaseCopyManager::copyFileRange(std::shared_ptr<ArchiveFile> in,
+                                    std::shared_ptr<ArchiveFile> out,
+                                    off_t offset,
+                                    size_t len) {
+
+#ifdef __linux__
+
+  size_t remaining = len;
+  loff_t off_in  = offset;
+  loff_t off_out = offset;
+
+  while (remaining > 0) {
+
+    ssize_t rc = ::copy_file_range(in->getFileno(), &off_in,
+                                   out->getFileno(), &off_out,
+                                   remaining, 0);
+
+    if (rc < 0 && errno == EINTR)
+      continue;
+
+    if (rc < 0) {
+
+      BOOST_LOG_TRIVIAL(debug) << "DEBUG: could not copy range of \""
+                               << in->getFilePath() << "\": "
+                               << strerror(errno);
+      break;
+
+    }
+
+    /* File got shorter than it was before we started */
+    if (rc == 0)
+      break;
+
+    remaining -= rc;
 
-  /* There doesn't seem to be more work to do,
-   * so finalize this thread.
-   *
-   * We have to put our slot_id back onto the stack of available
-   * threads for our operations scheduler, this should happen
-   * in a critical section.
-   *
-   * We shouldn't forget to notify operations scheduler (our main thread)
-   * there is something to do for him...
-   */
-  {
-    unique_lock<std::mutex> lock(ops_handler.active_ops_mutex);
-    ops_handler.ops_free.push(slot);
-    ops_handler.needs_work = true;
-    ops_handler.notify_cv.notify_one();
   }
 
-}
+  return (remaining == 0);
 
-void IOUringCopyManager::_iouring_copyItem::go(BaseCopyManager::_copyOperations &ops_handler,
-                                       path inputFileName,
-                                       path outputFileName) {
+#else
 
-  BOOST_LOG_TRIVIAL(debug) << "setup copy thread with slot ID " << slot;
+  return false;
 
-  /*
-   * Initialize thread handle
-   *
-   * NOTE: Since operation handler ops_handler is passed by reference, we *have* to
-   *       make sure it can be passed as a rvalue to the threads' method. This is
-   *       done by using an instance of std::ref(), so the library can safely use them
-   *       accordingly. See
-   *
-   *       https://en.cppreference.com/w/cpp/thread/thread/thread#Notes
-   *
-   *       for an explanation.
-   */
-  this->io_thread = std::make_shared<std::thread> (&IOUringCopyManager::_iouring_copyItem::work,
-                                                   this, std::ref(ops_handler),
-                                                   inputFileName,
-                                                   outputFileName);
-  this->io_thread->detach();
+#endif
 
 }
 
-IOUringCopyManager::IOUringCopyManager(std::shared_ptr<BackupDirectory> in,
-                                       std::shared_ptr<TargetDirectory> out) : BaseCopyManager(std::move(in), out) {}
+unsigned short BaseCopyManager::getNumberOfCopyInstances() {
+  return this->max_copy_instances;
+}
+
+void BaseCopyManager::setNumberOfCopyInstances(unsigned short instances) {
+
+  if (instances > MAX_PARALLEL_COPY_INSTANCES) {
+    std::ostringstream oss;
+    oss << "number of copy instances("
+        << instances
+        << ") exceeds allowed("
+        << MAX_PARALLEL_COPY_INSTANCES
+        << ")";
+    throw CArchiveIssue(oss.str());
+  }
 
-IOUringCopyManager::IOUringCopyManager(std::shared_ptr<BackupDirectory> in,
-                                       std::shared_ptr<TargetDirectory> out,
-                                       unsigned short instances) : BaseCopyManager(in, out) {
   this->max_copy_instances = instances;
+
+}
+
+void BaseCopyManager::setChunkSize(size_t chunk_size) {
+
+  if (chunk_size == 0)
+    throw CArchiveIssue("chunk size of copy operations must be larger than 0");
+
+  this->chunk_size = chunk_size;
+
+}
+
+size_t BaseCopyManager::getChunkSize() {
+
+  return this->chunk_size;
+
+}
+
+unsigned long BaseCopyManager::getStolenChunks() {
+
+  return ops.stolen_chunks.load();
+
 }
 
-void IOUringCopyManager::makeCopyItem(const directory_entry &de,
-                                      const unsigned int slot) {
+void BaseCopyManager::planCopyItem(const directory_entry &de) {
+
   namespace bf = boost::filesystem;
 
   /*
@@ -301,19 +351,22 @@ void IOUringCopyManager::makeCopyItem(const directory_entry &de,
 
   new_target = this->target->getPath() / new_target;
 
-  BOOST_LOG_TRIVIAL(debug) << "copy \""
-                           << de.path().string()
-                           << "\" to \""
-                           << new_target.string()
-                           << "\"";
-
   /*
-   * Check whether this is a file or directory. The latter isn't handled by
-   * a _copyItem instance, instead, we are creating the target directory
-   * directly here.
+   * Check the symlink first, is_directory() and is_regular_file()
+   * follow it.
    */
-  if (bf::is_directory(de.path())) {
+  if (bf::is_symlink(de.path())) {
+
+    BOOST_LOG_TRIVIAL(warning) << "\"" << new_target.string() << "\" is a symlink, currently ignored";
 
+  } else if (bf::is_directory(de.path())) {
+
+    /*
+     * Directories aren't handled by a _copyItem instance, we are creating
+     * the target directory directly here. Since the walker returns
+     * parents before their contents, all directories exist before
+     * any copy item starts.
+     */
     BOOST_LOG_TRIVIAL(debug) << "copy item for directory \""
                              << de.path().string()
                              << "\", target \""
@@ -325,50 +378,26 @@ void IOUringCopyManager::makeCopyItem(const directory_entry &de,
       /* XXX: Should we throw here instead ? */
       BOOST_LOG_TRIVIAL(warning) << "directory \"" << new_target << "\" already exists";
 
-    /* give back slot ID, since we haven't delegated a thread */
-    ops.ops_free.push(slot);
-
-    /* make sure we get notified that there is a new slot ID available */
-    ops.needs_work = true;
-
   } else if (bf::is_regular_file(de.path())) {
 
-    /* extract the filename from current directory_entry and build an absolute path to the new target
-     * by creating a new ArchiveFile handle
-     */
-    std::shared_ptr<ArchiveFile> target_file
-            = std::make_shared<ArchiveFile>(new_target);
-
-    /* ... and finally the source file */
-    std::shared_ptr<ArchiveFile> source_file = std::make_shared<ArchiveFile>(de.path());
-
     BOOST_LOG_TRIVIAL(debug) << "copy item for file \""
                              << de.path().string()
                              << "\", target \""
                              << new_target.string() << "\"";
 
-                             /* Make a copy item */
-    ops.ops[slot] = std::make_shared<_iouring_copyItem>(slot);
-    ops.ops[slot]->go(ops, de.path(), new_target);
-
-  } else if (bf::is_symlink(de.path())) {
-
-    /* give back slot ID, since we haven't delegated a thread */
-    ops.ops_free.push(slot);
-
-    /* make sure we get notified that there is a new slot ID available */
-    ops.needs_work = true;
-
-    BOOST_LOG_TRIVIAL(warning) << "\"" << new_target.string() << "\" is a symlink, currently ignored";
+    ops.tasks.push_back(std::make_shared<_copyTask>(de.path(), new_target,
+                                                    bf::file_size(de.path())));
 
   }
 
 }
 
-void IOUringCopyManager::start() {
+void BaseCopyManager::start() {
 
   namespace bf = boost::filesystem;
 
+  unsigned int instances = std::max<unsigned int>(this->max_copy_instances, 1);
+
   /*
    * Initialize ops infrastructure.
    *
@@ -377,10 +406,28 @@ void IOUringCopyManager::start() {
    *       at this point there shouldn't be running any
    *       parallel copy operations yet.
    */
-  for (int i = 0; i < this->max_copy_instances; i++) {
+  for (unsigned int i = 0; i < this->max_copy_instances; i++) {
     ops.ops_free.push(i);
   }
 
+  ops.tasks.clear();
+  ops.next_task = 0;
+  ops.stolen_chunks = 0;
+  ops.chunk_size = this->chunk_size;
+  ops.error = "";
+
+  /* Chunks are copied at their offsets, which must be aligned then */
+  if (this->direct_io
+      && ((this->chunk_size % ArchiveFile::DIRECT_IO_ALIGNMENT) != 0
+          || (this->io_size % ArchiveFile::DIRECT_IO_ALIGNMENT) != 0)) {
+    std::ostringstream oss;
+    oss << "chunk size " << this->chunk_size
+        << " and I/O size " << this->io_size
+        << " must be a multiple of " << ArchiveFile::DIRECT_IO_ALIGNMENT
+        << " for direct I/O";
+    throw CArchiveIssue(oss.str());
+  }
+
   /*
    * Check target directory. If it already exists and is non-empty, throw.
    * If it's not present yet, create it.
@@ -396,74 +443,65 @@ void IOUringCopyManager::start() {
 
   /*
    * Get directory entries from our source directory we need to copy.
+   * We walk the whole tree before copying anything, so we know
+   * all files and their sizes in advance.
    */
   DirectoryTreeWalker walker = source->walker();
   walker.open();
 
-  /*
-   * IMPORTANT:
-   *
-   * At this point we enter the processing loop where we
-   * iterate through the contents of the source directory.
-   * Make sure we protect operations against concurrent changes, since
-   * we have to check, modify and probably terminate operations
-   * concurrently by copy threads.
-   */
-
   while (!walker.end()) {
 
-    unsigned int slot_id = -1;
+    /* Check signal handlers whether we're requested to exit immediately. */
+    if ((stopHandler != nullptr && stopHandler->check())
+        || (intHandler != nullptr && intHandler->check())) {
+      ops.exit = true;
+      break;
+    }
+
+    planCopyItem(walker.next());
 
-    /* Check if the list of free items has something for us */
-    {
-      std::unique_lock<std::mutex> lock(ops.active_ops_mutex);
+  }
 
-      /*
-       * Check signal handlers whether we're requested to exit immediately.
-       */
-      if (stopHandler != nullptr) {
-        ops.exit = stopHandler->check();
-      }
+  /*
+   * Copy largest files first. The copy items start with them,
+   * and the smaller ones fill the gaps until the large files are
+   * done instead of a large file seen last determining the time
+   * the whole copy takes.
+   */
+  std::stable_sort(ops.tasks.begin(), ops.tasks.end(),
+                   [](const std::shared_ptr<_copyTask> &a,
+                      const std::shared_ptr<_copyTask> &b) {
+                     return a->size > b->size;
+                   });
 
-      if (intHandler != nullptr) {
-        ops.exit = intHandler->check();
-      }
+  /*
+   * Start the copy items. More than one per chunk would
+   * just sit idle.
+   */
+  {
+    size_t chunks = 0;
 
-      /* if signal handlers are telling us to exit, do so. */
-      if (ops.exit) {
-        break;
-      }
+    for (auto &task : ops.tasks)
+      chunks += std::max<size_t>(1, (task->size + this->chunk_size - 1) / this->chunk_size);
 
-      /*
-       * Main work of the processing loop:
-       *
-       * Check if there are any remaining thread slots available in our
-       * operations handler.
-       * If not, wait below until a thread finishes and frees
-       * its slot. If more than one thread finishes, we try to consume all
-       * of the free slots at once.
-       */
+    instances = std::min<size_t>(instances, std::max<size_t>(chunks, 1));
+  }
 
-      if (ops.ops_free.empty()) {
-        /* wait until we are notified that thread(s) have finished. */
-        ops.notify_cv.wait(lock, [this] { return ops.needs_work; });
-      }
+  if (!ops.exit) {
 
-      /*
-       * Loop until no more free slots are available.
-       */
-      while (!ops.ops_free.empty() && !walker.end()) {
+    std::unique_lock<std::mutex> lock(ops.active_ops_mutex);
 
-        /* pop free copy item from stack */
-        slot_id = ops.ops_free.top();
-        ops.ops_free.pop();
+    for (unsigned int i = 0; i < instances && !ops.ops_free.empty(); i++) {
 
-        /* Make next copy operation */
-        makeCopyItem(walker.next(), slot_id);
+      unsigned int slot_id = ops.ops_free.top();
+      ops.ops_free.pop();
 
-      }
+      ops.ops[slot_id] = makeCopyItem(slot_id);
+      ops.ops[slot_id]->setCopyStrategy(this->copy_strategy);
+      ops.ops[slot_id]->setDirectIO(this->direct_io);
+      ops.ops[slot_id]->setIOParameters(this->io_size, this->io_queue_depth);
+      ops.ops[slot_id]->go(ops);
 
-      ops.needs_work = false;
     }
 
   }
@@ -473,20 +511,43 @@ void IOUringCopyManager::start() {
 
 }
 
-void IOUringCopyManager::wait() {
+void BaseCopyManager::wait() {
+
+  if (!ops.finalize)
+    return;
 
-  if (ops.finalize) {
+  {
+    std::unique_lock<std::mutex> lock(ops.active_ops_mutex);
 
     while (ops.ops_free.size() < getNumberOfCopyInstances()) {
-      unique_lock<std::mutex> lock(ops.active_ops_mutex);
-      ops.notify_cv.wait(lock, [this] { return ops.needs_work; });
+
+      /*
+       * Check signal handlers whether we're requested to exit immediately,
+       * copy items stop claiming chunks then.
+       */
+      if ((stopHandler != nullptr && stopHandler->check())
+          || (intHandler != nullptr && intHandler->check())) {
+        ops.exit = true;
+      }
+
+      ops.notify_cv.wait_for(lock, std::chrono::milliseconds(100),
+                             [this] { return ops.needs_work; });
+      ops.needs_work = false;
+
     }
+  }
 
+  for (auto &item : ops.ops) {
+    if (item != nullptr)
+      item->join();
   }
 
+  if (!ops.error.empty())
+    throw CArchiveIssue(ops.error);
+
 }
 
-void IOUringCopyManager::stop() {
+void BaseCopyManager::stop() {
 
   /*
    * The main task here is to safely set the exit
@@ -499,292 +560,269 @@ void IOUringCopyManager::stop() {
 
 }
 
-#else
-
 /* **************************************************************************
- * LegacyCopyManager
+ * BaseCopyManager::_copyTask, BaseCopyManager::_copyOperations
  * **************************************************************************/
 
-LegacyCopyManager::LegacyCopyManager(std::shared_ptr<BackupDirectory> in,
-                                     std::shared_ptr<TargetDirectory> out)
-        : BaseCopyManager(in, out) {
+BaseCopyManager::_copyTask::_copyTask(path source, path target, size_t size)
+  : next(0), copied(0), stealable(false), range_failed(false) {
+
+  this->source = source;
+  this->target = target;
+  this->size   = size;
 
 }
 
-void LegacyCopyManager::makeCopyItem(const boost::filesystem::directory_entry &de,
-                                     const unsigned int slot) {
+bool BaseCopyManager::_copyTask::claim(size_t chunk_size, off_t &offset, size_t &len) {
 
-  namespace bf = boost::filesystem;
+  size_t start = this->next.fetch_add(chunk_size);
 
-  /*
-   * Extract the relative path to the source file from
-   * the absolute archive path.
-   */
-  path new_target = BackupDirectory::relative_path(de.path(), this->source->getPath());
+  if (start >= this->size)
+    return false;
 
-  /* Sanity check: If new_target is empty or equals de.path(), throw an exception */
-  if (( new_target.string() == "") || (new_target.string() == de.path().string())) {
+  offset = start;
+  len = std::min(chunk_size, this->size - start);
 
-    std::ostringstream err;
-    err << "could not copy \""
-        << de.path().string()
-        << "\" to \""
-        << this->target->getPath() / new_target
-        << "\"";
-    throw CArchiveIssue(err.str());
+  return true;
 
-  }
+}
 
-  new_target = this->target->getPath() / new_target;
+size_t BaseCopyManager::_copyTask::unclaimed() {
 
-  BOOST_LOG_TRIVIAL(debug) << "copy \""
-                           << de.path().string()
-                           << "\" to \""
-                           << new_target.string()
-                           << "\"";
+  size_t claimed = this->next.load();
 
-  /* Check whether this is a file or directory. The latter isn't handled by
-   * a _copyItem instance, instead, we are creating the target directory
-   * directly here.
-   */
-  if (bf::is_directory(de.path())) {
+  return (claimed >= this->size) ? 0 : this->size - claimed;
 
-    BOOST_LOG_TRIVIAL(debug) << "copy item for directory \""
-                             << de.path().string()
-                             << "\", target \""
-                             << new_target.string() << "\"";
+}
 
-    if (!bf::exists(new_target))
-      bf::create_directories(new_target);
-    else
-      BOOST_LOG_TRIVIAL(warning) << "directory \"" << new_target << "\" already exists, ignoring";
+BaseCopyManager::_copyOperations::_copyOperations()
+  : next_task(0), stolen_chunks(0) {}
 
-    /* give back slot ID, since we haven't delegated a thread */
-    ops.ops_free.push(slot);
+/* **************************************************************************
+ * BaseCopyManager::_copyItem
+ * **************************************************************************/
 
-    /* make sure we get notified that there is a new slot ID available */
-    ops.needs_work = true;
+void BaseCopyManager::_copyItem::setup() {}
 
-  } else if (bf::is_regular_file(de.path())) {
+void BaseCopyManager::_copyItem::teardown() {}
 
-    /* extract the filename from current directory_entry and build an absolute path to the new target
-     * by creating a new ArchiveFile handle
-     */
-    std::shared_ptr<ArchiveFile> target_file
-            = std::make_shared<ArchiveFile>(new_target);
+bool BaseCopyManager::_copyItem::startTask(std::shared_ptr<_copyTask> task) {
 
-    /* ... and finally the source file */
-    std::shared_ptr<ArchiveFile> source_file = std::make_shared<ArchiveFile>(de.path());
+  std::shared_ptr<ArchiveFile> out = std::make_shared<ArchiveFile>(task->target);
 
-    BOOST_LOG_TRIVIAL(debug) << "copy item for file \""
-                             << de.path().string()
-                             << "\", target \""
-                             << new_target.string() << "\"";
+  /* Create the target, chunks are written into the existing file */
+  out->setOpenMode("wb");
+  out->open();
 
-    /* Make a copy item */
-    ops.ops[slot] = std::make_shared<_legacy_copyItem>(slot);
-    ops.ops[slot]->go(ops, de.path(), new_target);
+  if (task->size == 0) {
+    out->fsync();
+    out->close();
+    return false;
+  }
 
-  } else if (bf::is_symlink(de.path())) {
+  /*
+   * A clone copies the whole file at once, so there is nothing
+   * left for anybody to steal.
+   */
+  if (this->strategy == COPY_STRATEGY_AUTO || this->strategy == COPY_STRATEGY_REFLINK) {
 
-    /* give back slot ID, since we haven't delegated a thread */
-    ops.ops_free.push(slot);
+    std::shared_ptr<ArchiveFile> in = std::make_shared<ArchiveFile>(task->source);
 
-    /* make sure we get notified that there is a new slot ID available */
-    ops.needs_work = true;
+    in->setOpenMode("rb");
+    in->open();
 
-    BOOST_LOG_TRIVIAL(warning) << "\"" << new_target.string() << "\" is a symlink, currently ignored";
+    if (BaseCopyManager::fastCopy(in, out, COPY_STRATEGY_REFLINK) == COPY_STRATEGY_REFLINK) {
+
+      task->next = task->size;
+      task->copied = task->size;
+
+      out->fsync();
+      out->close();
+      in->close();
+
+      return false;
+
+    }
+
+    in->close();
 
   }
 
+  out->close();
+  task->stealable = true;
+
+  return true;
+
 }
 
-void LegacyCopyManager::start() {
+void BaseCopyManager::_copyItem::copyChunk(BaseCopyManager::_copyOperations &ops_handler,
+                                           std::shared_ptr<_copyTask> task,
+                                           off_t offset,
+                                           size_t len) {
 
-  namespace bf = boost::filesystem;
+  std::shared_ptr<ArchiveFile> in  = std::make_shared<ArchiveFile>(task->source);
+  std::shared_ptr<ArchiveFile> out = std::make_shared<ArchiveFile>(task->target);
+  bool copied = false;
 
-  /*
-   * Initialize ops infrastructure.
-   *
-   * NOTE: At this point we don't need to protect against
-   *       concurrent access to the ops infrastructure since
-   *       at this point there shouldn't be running any
-   *       parallel copy operations yet.
-   */
-  for (int i = 0; i < this->max_copy_instances; i++) {
-    ops.ops_free.push(i);
-  }
+  TRACE_PGBCKCTL_COPY_CHUNK_START(this->slot, task->source.c_str(), offset, len);
+
+  in->setOpenMode("rb");
+  in->setDirectIO(this->direct_io);
+  in->open();
+
+  /* Opens the file created by startTask() without truncating it */
+  out->setOpenMode("rb+");
+  out->setDirectIO(this->direct_io);
+  out->open();
 
   /*
-   * Check target directory. If it already exists and is non-empty, throw.
-   * If it's not present yet, create it.
+   * Try copy_file_range() first if the strategy allows it. If it fails
+   * for one chunk, it will for the others of the same file, too. With
+   * direct I/O, only try if requested explicitly.
    */
-  if (!bf::exists(target->getPath())) {
-    bf::create_directories(target->getPath());
-  } else {
-    if (!bf::is_empty(target->getPath())) {
-      throw CArchiveIssue("target directory \"" + target->getPath().string() + "\" is not empty");
-    }
+  if ((this->strategy == COPY_STRATEGY_COPY_RANGE
+       || (this->strategy == COPY_STRATEGY_AUTO && !this->direct_io))
+      && !task->range_failed) {
+
+    copied = BaseCopyManager::copyFileRange(in, out, offset, len);
+
+    if (!copied)
+      task->range_failed = true;
+
   }
 
-  /*
-   * Get directory entries from our source directory we need to copy.
-   */
-  DirectoryTreeWalker walker = source->walker();
-  walker.open();
+  if (!copied && this->copyRange(ops_handler, in, out, offset, len) < len && !ops_handler.exit) {
+    std::ostringstream oss;
+    oss << "copied less bytes than file size of \"" << task->source.string() << "\"";
+    throw CArchiveIssue(oss.str());
+  }
 
   /*
-   * IMPORTANT:
+   * Sync the out file if this was the last chunk outstanding. Other
+   * copy items which copied chunks of the file already closed their
+   * file handles, but syncing any handle flushes the whole file.
    *
-   * At this point we enter the processing loop where we
-   * iterate through the contents of the source directory.
-   * Make sure we protect operations against concurrent changes, since
-   * we have to check, modify and probably terminate operations
-   * concurrently by copy threads.
+   * We do this here so that the sync overhead is not located
+   * in the main process but delegated to the copy threads.
    */
+  if (task->copied.fetch_add(len) + len == task->size)
+    out->fsync();
 
-  while (!walker.end()) {
+  in->close();
+  out->close();
 
-    unsigned int slot_id = -1;
+  TRACE_PGBCKCTL_COPY_CHUNK_DONE(this->slot, task->source.c_str(), offset, len);
 
-    /* Check if the list of free items has something for us */
-    {
-      std::unique_lock<std::mutex> lock(ops.active_ops_mutex);
+}
 
-      /*
-       * Check signal handlers whether we're requested to exit immediately.
-       */
-      if (stopHandler != nullptr) {
-        ops.exit = stopHandler->check();
-      }
+void BaseCopyManager::_copyItem::work(BaseCopyManager::_copyOperations &ops_handler) {
 
-      if (intHandler != nullptr) {
-        ops.exit = intHandler->check();
-      }
+  std::shared_ptr<_copyTask> current = nullptr;
 
-      /* if signal handlers are telling us to exit, do so. */
-      if (ops.exit) {
-        break;
-      }
+  try {
 
-      /*
-       * Main work of the processing loop:
-       *
-       * Check if there are any remaining thread slots available in our
-       * operations handler.
-       * If not, wait below until a thread finishes and frees
-       * its slot. If more than one thread finishes, we try to consume all
-       * of the free slots at once.
-       */
+    this->setup();
 
-      if (ops.ops_free.empty()) {
-        /* wait until we are notified that thread(s) have finished. */
-        ops.notify_cv.wait(lock, [this] { return ops.needs_work; });
-      }
+    /*
+     * XXX: Checking just for the exit flag should be safe
+     *      without a critical section here.
+     */
+    while (!ops_handler.exit && !this->exit_forced) {
 
-      /*
-       * Loop until no more free slots are available.
-       */
-      while (!ops.ops_free.empty() && !walker.end()) {
+      off_t offset = 0;
+      size_t len = 0;
+      bool stolen = false;
 
-        /* pop free copy item from stack */
-        slot_id = ops.ops_free.top();
-        ops.ops_free.pop();
+      /* Continue with the file we're working on */
+      if (current == nullptr
+          || !current->claim(ops_handler.chunk_size, offset, len)) {
 
-        /* Make next copy operation */
-        makeCopyItem(walker.next(), slot_id);
+        size_t next;
 
-      }
+        current = nullptr;
 
-      ops.needs_work = false;
-    }
+        /* Start the next file nobody started yet ... */
+        while ((next = ops_handler.next_task.fetch_add(1)) < ops_handler.tasks.size()) {
 
-  }
+          std::shared_ptr<_copyTask> task = ops_handler.tasks[next];
 
-  /* Make sure we mark any operations as done. This allows to safely wait
-   * for any copy operations to shut everything down. */
-  ops.finalize = true;
+          if (this->startTask(task) && task->claim(ops_handler.chunk_size, offset, len)) {
+            current = task;
+            break;
+          }
 
-}
+        }
 
-void LegacyCopyManager::wait() {
+        /*
+         * ... or steal a chunk of the file in progress with the most bytes left,
+         * since the copy item working on it will need the longest to finish it.
+         */
+        while (current == nullptr && !ops_handler.exit) {
 
-  if (ops.finalize) {
+          std::shared_ptr<_copyTask> victim = nullptr;
+          bool pending = false;
 
-    while (ops.ops_free.size() < getNumberOfCopyInstances()) {
-      unique_lock<std::mutex> lock(ops.active_ops_mutex);
-      ops.notify_cv.wait(lock, [this] { return ops.needs_work; });
-    }
+          for (auto &task : ops_handler.tasks) {
 
-  }
+            /*
+             * Another copy item is just about to start this file,
+             * so there might be chunks to steal in a moment.
+             */
+            if (!task->stealable && task->copied < task->size)
+              pending = true;
 
-}
+            if (!task->stealable || task->unclaimed() == 0)
+              continue;
 
-void LegacyCopyManager::stop() {
+            if (victim == nullptr || task->unclaimed() > victim->unclaimed())
+              victim = task;
 
-  ops.exit = true;
+          }
 
-}
+          if (victim == nullptr && pending) {
+            std::this_thread::yield();
+            continue;
+          }
 
-/** I/O Thread legwork method */
-void LegacyCopyManager::_legacy_copyItem::work(BaseCopyManager::_copyOperations &ops_handler,
-                                               path inputFileName,
-                                               path outFileName) const {
+          /* Nothing left to do at all */
+          if (victim == nullptr)
+            break;
 
-  std::shared_ptr<ArchiveFile> in  = std::make_shared<ArchiveFile>(inputFileName);
-  std::shared_ptr<ArchiveFile> out = std::make_shared<ArchiveFile>(outFileName);
-  std::shared_ptr<MemoryBuffer> buf = std::make_shared<MemoryBuffer>(8192);
-  size_t read_bytes;
-  size_t total_bytes;
-  size_t write_bytes;
+          if (victim->claim(ops_handler.chunk_size, offset, len)) {
+            current = victim;
+            stolen = true;
+          }
 
-  /* Open source */
-  in->setOpenMode("rb");
-  in->open();
+        }
 
-  /* Open target, this will create the file automatically */
-  out->setOpenMode("wb+");
-  out->open();
+        if (current == nullptr)
+          break;
 
-  /* We always try to read 8K sizes */
-  total_bytes = in->size();
-  read_bytes = 0;
+      }
 
-  while (read_bytes < total_bytes) {
+      if (stolen)
+        ops_handler.stolen_chunks++;
 
-    read_bytes = in->read(buf->ptr(), buf->getSize());
+      this->copyChunk(ops_handler, current, offset, len);
 
-    if (read_bytes > 0) {
-      write_bytes = out->write(buf->ptr(), buf->getSize());
-    } else {
-      break;
     }
 
+  } catch (std::exception &e) {
+
     /*
-     * If we don't get read_bytes back from write(), we treat this as
-     * a severe error
+     * Remember the first error for wait() and make all
+     * other copy items stop, too.
      */
-    if (write_bytes < read_bytes) {
-      std::ostringstream oss;
-      oss << "short write: expected "
-          << read_bytes
-          << " got "
-          << write_bytes;
-      throw CArchiveIssue(oss.str());
-    }
+    unique_lock<std::mutex> lock(ops_handler.active_ops_mutex);
 
-    buf->clear();
+    if (ops_handler.error.empty())
+      ops_handler.error = e.what();
 
-    /* Check if we're forced to exit */
-    if (ops_handler.exit)
-      break;
+    ops_handler.exit = true;
 
   }
 
-  /* finish file, make sure everything hits storage */
-  out->fsync();
-  in->close();
-  out->close();
+  this->teardown();
 
   /* There doesn't seem to be more work to do,
    * so finalize this thread.
@@ -805,8 +843,7 @@ void LegacyCopyManager::_legacy_copyItem::work(BaseCopyManager::_copyOperations
 
 }
 
-void LegacyCopyManager::_legacy_copyItem::go(BaseCopyManager::_copyOperations &ops_handler, path inputFileName,
-                                             path outputFileName) {
+void BaseCopyManager::_copyItem::go(BaseCopyManager::_copyOperations &ops_handler) {
 
   BOOST_LOG_TRIVIAL(debug) << "setup copy thread with slot ID " << slot;
 
@@ -822,18 +859,241 @@ void LegacyCopyManager::_legacy_copyItem::go(BaseCopyManager::_copyOperations &o
    *
    *       for an explanation.
    */
-  this->io_thread = std::make_shared<std::thread> (&LegacyCopyManager::_legacy_copyItem::work,
-                                                   this,
-                                                   std::ref(ops_handler),
-                                                   inputFileName,
-                                                   outputFileName);
-  this->io_thread->detach();
+  this->io_thread = std::make_shared<std::thread> (&BaseCopyManager::_copyItem::work,
+                                                   this, std::ref(ops_handler));
+
+}
+
+void BaseCopyManager::_copyItem::join() {
+
+  if (this->io_thread != nullptr && this->io_thread->joinable()
+      && this->io_thread->get_id() != std::this_thread::get_id())
+    this->io_thread->join();
+
+}
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+
+/* **************************************************************************
+ * IOUringCopyManager
+ * **************************************************************************/
+
+IOUringCopyManager::_iouring_copyItem::_iouring_copyItem(unsigned int slot) noexcept
+  : BaseCopyManager::_copyItem::_copyItem(slot ){}
+
+IOUringCopyManager::_iouring_copyItem::~_iouring_copyItem() noexcept {
+
+  /* The thread uses our ring, so wait before it goes away */
+  this->join();
+
+}
+
+void IOUringCopyManager::_iouring_copyItem::setup() {
+
+  /*
+   * io_uring instance belonging to this copy item, used for
+   * all chunks it copies. Reads and writes of several parts of
+   * a chunk are kept in flight at once.
+   */
+  if (this->io_queue_depth > 0)
+    ring.setQueueDepth(this->io_queue_depth);
+
+  if (this->io_size > 0)
+    ring.setChunkSize(this->io_size);
+
+  ring.setup();
+
+}
+
+void IOUringCopyManager::_iouring_copyItem::teardown() {
+
+  /* Tear down uring ... */
+  if (ring.available())
+    ring.exit();
+
+}
+
+size_t IOUringCopyManager::_iouring_copyItem::copyRange(BaseCopyManager::_copyOperations &ops_handler,
+                                                        std::shared_ptr<ArchiveFile> in,
+                                                        std::shared_ptr<ArchiveFile> out,
+                                                        off_t offset,
+                                                        size_t len) {
+
+  /* The pipeline checks whether we are forced to exit before submitting new requests */
+  return ring.copy(in, out, offset, len, ops_handler.exit);
+
+}
+
+IOUringCopyManager::IOUringCopyManager(std::shared_ptr<BackupDirectory> in,
+                                       std::shared_ptr<TargetDirectory> out) : BaseCopyManager(std::move(in), out) {}
+
+IOUringCopyManager::IOUringCopyManager(std::shared_ptr<BackupDirectory> in,
+                                       std::shared_ptr<TargetDirectory> out,
+                                       unsigned short instances) : BaseCopyManager(in, out) {
+  this->max_copy_instances = instances;
+}
+
+std::string IOUringCopyManager::getEngineName() {
+
+  return "io_uring";
+
+}
+
+std::shared_ptr<BaseCopyManager::_copyItem> IOUringCopyManager::makeCopyItem(const unsigned int slot) {
+
+  return std::make_shared<_iouring_copyItem>(slot);
+
+}
+
+#else
+
+/* **************************************************************************
+ * LegacyCopyManager
+ * **************************************************************************/
+
+LegacyCopyManager::LegacyCopyManager(std::shared_ptr<BackupDirectory> in,
+                                     std::shared_ptr<TargetDirectory> out)
+        : BaseCopyManager(in, out) {
+
+}
+
+const size_t LegacyCopyManager::_legacy_copyItem::COPY_BUFFER_SIZE;
+
+std::string LegacyCopyManager::getEngineName() {
+
+  return "legacy";
+
+}
+
+std::shared_ptr<BaseCopyManager::_copyItem> LegacyCopyManager::makeCopyItem(const unsigned int slot) {
+
+  return std::make_shared<_legacy_copyItem>(slot);
+
+}
+
+void LegacyCopyManager::_legacy_copyItem::setup() {
+
+  /*
+   * Allocated once for all chunks copied by this thread, aligned
+   * for direct I/O.
+   */
+  this->buf = std::make_shared<AlignedMemoryBuffer>((this->io_size > 0) ? this->io_size : COPY_BUFFER_SIZE,
+                                                    ArchiveFile::DIRECT_IO_ALIGNMENT);
+
+}
+
+void LegacyCopyManager::_legacy_copyItem::teardown() {
+
+  this->buf = nullptr;
+
+}
+
+size_t LegacyCopyManager::_legacy_copyItem::copyRange(BaseCopyManager::_copyOperations &ops_handler,
+                                                      std::shared_ptr<ArchiveFile> in,
+                                                      std::shared_ptr<ArchiveFile> out,
+                                                      off_t offset,
+                                                      size_t len) {
+
+  const size_t alignment = ArchiveFile::DIRECT_IO_ALIGNMENT;
+  bool direct = in->isDirectIO() || out->isDirectIO();
+  size_t total_bytes = 0;
+
+  /*
+   * Use positioned I/O on the file descriptors, so that
+   * chunks of the same file can be copied concurrently.
+   */
+  while (total_bytes < len) {
+
+    size_t request = std::min(len - total_bytes, (size_t) buf->getSize());
+    ssize_t read_bytes;
+    size_t write_len;
+    size_t write_bytes = 0;
+
+    /*
+     * With direct I/O, the tail of a file is read padded to the
+     * alignment. The kernel returns less bytes then.
+     */
+    if (direct && (request % alignment) != 0)
+      request += alignment - (request % alignment);
+
+    read_bytes = ::pread(in->getFileno(), buf->ptr(), request,
+                         offset + total_bytes);
+
+    if (read_bytes < 0 && errno == EINTR)
+      continue;
+
+    if (read_bytes < 0) {
+      std::ostringstream oss;
+      oss << "could not read \"" << in->getFilePath() << "\": " << strerror(errno);
+      throw CArchiveIssue(oss.str());
+    }
+
+    /* File got shorter than it was before we started */
+    if (read_bytes == 0)
+      break;
+
+    read_bytes = std::min((size_t) read_bytes, len - total_bytes);
+    write_len = read_bytes;
+
+    /* ... and written padded, we truncate the file below */
+    if (direct && (write_len % alignment) != 0)
+      write_len += alignment - (write_len % alignment);
+
+    while (write_bytes < write_len) {
+
+      ssize_t rc = ::pwrite(out->getFileno(), buf->ptr() + write_bytes,
+                            write_len - write_bytes,
+                            offset + total_bytes + write_bytes);
+
+      if (rc < 0 && errno == EINTR)
+        continue;
+
+      /*
+       * If we can't write what we've read, we treat this as
+       * a severe error
+       */
+      if (rc <= 0) {
+        std::ostringstream oss;
+        oss << "short write: expected "
+            << read_bytes
+            << " got "
+            << write_bytes;
+        throw CArchiveIssue(oss.str());
+      }
+
+      write_bytes += rc;
+
+    }
+
+    total_bytes += read_bytes;
+
+    /* Check if we're forced to exit */
+    if (ops_handler.exit)
+      break;
+
+  }
+
+  /* Cut off the padding of a direct I/O tail */
+  if (direct && total_bytes == len && (size_t) offset + len == in->size()
+      && (in->size() % alignment) != 0
+      && ::ftruncate(out->getFileno(), in->size()) < 0) {
+    std::ostringstream oss;
+    oss << "could not truncate \"" << out->getFilePath() << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  return total_bytes;
 
 }
 
 LegacyCopyManager::_legacy_copyItem::_legacy_copyItem(unsigned int slot) noexcept
   : BaseCopyManager::_copyItem::_copyItem(slot) {}
 
-LegacyCopyManager::_legacy_copyItem::~_legacy_copyItem() {}
+LegacyCopyManager::_legacy_copyItem::~_legacy_copyItem() {
+
+  /* The thread uses our buffer, so wait before it goes away */
+  this->join();
+
+}
 
 #endif
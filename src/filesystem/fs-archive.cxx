@@ -1,7 +1,12 @@
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
 #include <iterator>
 #include <fstream>
+#include <set>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -11,6 +16,10 @@
 
 #include <fs-archive.hxx>
 #include <fs-pipe.hxx>
+#include <walindex.hxx>
+#include <xlogdefs.hxx>
+#include <fs-sync.hxx>
+#include <checksum.hxx>
 
 using namespace pgbckctl;
 using namespace boost::adaptors;
@@ -18,6 +27,84 @@ using namespace boost::filesystem;
 using namespace boost::iostreams;
 using boost::regex;
 
+/*
+ * Number of files a worker of ArchiveLogDirectory::removeXLogs()
+ * removes per batch, and the maximum number of workers.
+ */
+#define XLOG_REMOVE_BATCH_SIZE 512
+#define XLOG_REMOVE_MAX_WORKERS 4
+
+/*
+ * Copies source to target and syncs the copy. The copy is
+ * written under a temporary name and renamed afterwards, so
+ * target is either complete or missing. The directory of target
+ * isn't synced.
+ */
+static void copy_file_synced(const path &source, const path &target) {
+
+  path temp = target.string() + ".tmp";
+  std::vector<char> buf(1024 * 1024);
+  std::string error = "";
+  int in_fd;
+  int out_fd;
+
+  if ((in_fd = ::open(source.string().c_str(), O_RDONLY | O_CLOEXEC)) < 0) {
+    throw CArchiveIssue("could not open file \"" + source.string() + "\": " + strerror(errno));
+  }
+
+  if ((out_fd = ::open(temp.string().c_str(),
+                       O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0) {
+    error = "could not create file \"" + temp.string() + "\": " + strerror(errno);
+    ::close(in_fd);
+    throw CArchiveIssue(error);
+  }
+
+  while (error.empty()) {
+
+    ssize_t len = ::read(in_fd, buf.data(), buf.size());
+    ssize_t written = 0;
+
+    if (len < 0) {
+      error = "could not read file \"" + source.string() + "\": " + strerror(errno);
+      break;
+    }
+
+    if (len == 0)
+      break;
+
+    while (written < len) {
+
+      ssize_t rc = ::write(out_fd, buf.data() + written, len - written);
+
+      if (rc < 0) {
+        error = "could not write file \"" + temp.string() + "\": " + strerror(errno);
+        break;
+      }
+
+      written += rc;
+
+    }
+
+  }
+
+  if (error.empty() && ::fsync(out_fd) != 0)
+    error = "could not sync file \"" + temp.string() + "\": " + strerror(errno);
+
+  ::close(in_fd);
+
+  if (::close(out_fd) != 0 && error.empty())
+    error = "could not close file \"" + temp.string() + "\": " + strerror(errno);
+
+  if (error.empty() && ::rename(temp.string().c_str(), target.string().c_str()) < 0)
+    error = "could not rename file \"" + temp.string() + "\": " + strerror(errno);
+
+  if (!error.empty()) {
+    ::unlink(temp.string().c_str());
+    throw CArchiveIssue(error);
+  }
+
+}
+
 /******************************************************************************
  * StreamingBaseBackupDirectory Implementation
  ******************************************************************************/
@@ -134,7 +221,9 @@ BaseBackupVerificationCode StreamingBaseBackupDirectory::verify(std::shared_ptr<
   }
 
   /*
-   * TODO: Verify WAL start and end position.
+   * This is a cheap status check only, BaseBackupVerifier reads
+   * the archives and checks WAL start and end position
+   * (VERIFY ARCHIVE ... BASEBACKUP).
    */
 
   return BASEBACKUP_OK;
@@ -158,6 +247,24 @@ ssize_t StreamingBaseBackupDirectory::size() {
 std::shared_ptr<BackupFile> StreamingBaseBackupDirectory::basebackup(std::string name,
                                                                      BackupProfileCompressType compression) {
 
+  return this->basebackup(name, compression, 0, 0);
+
+}
+
+std::shared_ptr<BackupFile> StreamingBaseBackupDirectory::basebackup(std::string name,
+                                                                     BackupProfileCompressType compression,
+                                                                     int compression_level,
+                                                                     int compression_workers) {
+
+  /*
+   * Worker count for the compression binaries in case
+   * we need to fall back to them. Never let them use -T0, which
+   * would grab every core on the box, even though WAL streamers
+   * and other backups might run concurrently.
+   */
+  std::string threads = "-T" + CPGBackupCtlBase::intToStr((compression_workers > 0)
+                                                          ? compression_workers : 1);
+
   switch(compression) {
 
   case BACKUP_COMPRESS_TYPE_NONE:
@@ -168,13 +275,30 @@ std::shared_ptr<BackupFile> StreamingBaseBackupDirectory::basebackup(std::string
   case BACKUP_COMPRESS_TYPE_GZIP:
 
 #ifdef PG_BACKUP_CTL_HAS_ZLIB
-    return std::make_shared<CompressedArchiveFile>(this->streaming_subdir / (name + ".gz"));
+    {
+      std::shared_ptr<CompressedArchiveFile> myfile
+        = std::make_shared<CompressedArchiveFile>(this->streaming_subdir / (name + ".gz"));
+
+      myfile->setCompressionLevel(compression_level);
+      return myfile;
+    }
 #else
     throw CArchiveIssue("zlib compression support not compiled in");
 #endif
     break;
 
   case BACKUP_COMPRESS_TYPE_ZSTD:
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+    {
+      /* In-process compression via libzstd */
+      std::shared_ptr<ZstdArchiveFile> myfile
+        = std::make_shared<ZstdArchiveFile>(this->streaming_subdir / (name + ".zst"));
+
+      myfile->setCompressionLevel(compression_level);
+      myfile->setCompressionWorkers(compression_workers);
+      return myfile;
+    }
+#else
     {
       std::shared_ptr<ArchivePipedProcess> myfile
         = std::make_shared<ArchivePipedProcess>(this->streaming_subdir / (name + ".zst"));
@@ -185,16 +309,32 @@ std::shared_ptr<BackupFile> StreamingBaseBackupDirectory::basebackup(std::string
 
       myfile->setExecutable("zstd");
       myfile->pushExecArgument("-z");
-      myfile->pushExecArgument("-T0");
+
+      if (compression_level > 0)
+        myfile->pushExecArgument("-" + CPGBackupCtlBase::intToStr(compression_level));
+
+      myfile->pushExecArgument(threads);
       myfile->pushExecArgument("-");
       myfile->pushExecArgument("-o");
       myfile->pushExecArgument(filename);
 
       return myfile;
-      break;
     }
+#endif
+    break;
 
   case BACKUP_COMPRESS_TYPE_XZ:
+#ifdef PG_BACKUP_CTL_HAS_LIBLZMA
+    {
+      /* In-process compression via liblzma */
+      std::shared_ptr<XZArchiveFile> myfile
+        = std::make_shared<XZArchiveFile>(this->streaming_subdir / (name + ".xz"));
+
+      myfile->setCompressionLevel(compression_level);
+      myfile->setCompressionWorkers(compression_workers);
+      return myfile;
+    }
+#else
     {
       std::shared_ptr<ArchivePipedProcess> myfile
         = std::make_shared<ArchivePipedProcess>(this->streaming_subdir / (name + ".xz"));
@@ -205,15 +345,16 @@ std::shared_ptr<BackupFile> StreamingBaseBackupDirectory::basebackup(std::string
 
       myfile->setExecutable("xz");
       myfile->pushExecArgument("-z");
-      myfile->pushExecArgument("-0");
+      myfile->pushExecArgument("-" + CPGBackupCtlBase::intToStr(compression_level));
       myfile->pushExecArgument("-c");
-      myfile->pushExecArgument("-T0");
+      myfile->pushExecArgument(threads);
       myfile->pushExecArgument(">");
       myfile->pushExecArgument(filename);
 
       return myfile;
-      break;
     }
+#endif
+    break;
 
   case BACKUP_COMPRESS_TYPE_PLAIN:
     {
@@ -245,6 +386,20 @@ std::shared_ptr<BackupFile> StreamingBaseBackupDirectory::basebackup(std::string
     }
 
     case BACKUP_COMPRESS_TYPE_LZ4:
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+      {
+        /*
+         * In-process compression via the liblz4 frame API. lz4 is
+         * fast enough to keep up with the stream within a single
+         * thread, so compression_workers doesn't apply here.
+         */
+        std::shared_ptr<LZ4ArchiveFile> myfile
+          = std::make_shared<LZ4ArchiveFile>(this->streaming_subdir / (name + ".lz4"));
+
+        myfile->setCompressionLevel(compression_level);
+        return myfile;
+      }
+#else
       {
         /* Establish a compression pipe with lz4 */
         std::shared_ptr<ArchivePipedProcess> myfile
@@ -257,13 +412,18 @@ std::shared_ptr<BackupFile> StreamingBaseBackupDirectory::basebackup(std::string
         myfile->setExecutable("lz4");
         myfile->pushExecArgument("-q");
         myfile->pushExecArgument("-z");
+
+        if (compression_level > 0)
+          myfile->pushExecArgument("-" + CPGBackupCtlBase::intToStr(compression_level));
+
         myfile->pushExecArgument("-c");
         myfile->pushExecArgument(">");
         myfile->pushExecArgument(filename);
 
         return myfile;
-        break;
       }
+#endif
+      break;
   default:
     std::ostringstream oss;
     oss << "could not create archive file: invalid compression type: " << compression;
@@ -367,18 +527,13 @@ std::string ArchiveLogDirectory::XLogPrevFileByRecPtr(XLogRecPtr recptr,
                                                       unsigned int timeline,
                                                       unsigned long long wal_segment_size) {
 
-  unsigned int logSegNo;
-  char fname[MAXFNAMELEN];
+  char fname[xlog::WAL_FILENAME_LEN + 1];
 
-#if PG_VERSION_NUM < 110000
-  XLByteToPrevSeg(recptr, logSegNo);
-  XLogFileName(fname, timeline, logSegNo);
-#else
-  XLByteToPrevSeg(recptr, logSegNo, wal_segment_size);
-  XLogFileName(fname, timeline, logSegNo, wal_segment_size);
-#endif
+  xlog::walFileName(fname, timeline,
+                    xlog::prevSegmentNumber(recptr, wal_segment_size),
+                    wal_segment_size);
 
-  return string(fname);
+  return string(fname, xlog::WAL_FILENAME_LEN);
 
 }
 
@@ -406,18 +561,13 @@ string ArchiveLogDirectory::XLogFileByRecPtr(XLogRecPtr recptr,
                                              unsigned int timeline,
                                              unsigned long long wal_segment_size) {
 
-  unsigned int logSegNo;
-  char fname[MAXFNAMELEN];
+  char fname[xlog::WAL_FILENAME_LEN + 1];
 
-#if PG_VERSION_NUM < 110000
-  XLByteToSeg(recptr, logSegNo);
-  XLogFileName(fname, timeline, logSegNo);
-#else
-  XLByteToSeg(recptr, logSegNo, wal_segment_size);
-  XLogFileName(fname, timeline, logSegNo, wal_segment_size);
-#endif
+  xlog::walFileName(fname, timeline,
+                    xlog::segmentNumber(recptr, wal_segment_size),
+                    wal_segment_size);
 
-  return string(fname);
+  return string(fname, xlog::WAL_FILENAME_LEN);
 
 }
 
@@ -434,17 +584,11 @@ string ArchiveLogDirectory::getXlogStartPosition(unsigned int &timelineID,
                                                  unsigned int &segmentNumber,
                                                  unsigned long long xlogsegsize) {
 
-  /* Type of segment found */
-  WALSegmentFileStatus filestatus = WAL_SEGMENT_UNKNOWN;
-
   /* XLogRecPtr result to return */
   string result = "";
 
-  /* Found XLog filename */
-  string xlogfilename = "";
-
-  /* real, uncompressed file size */
-  unsigned long long fileSize = 0;
+  /* Last XLOG segment found in the archive */
+  WALSegmentIndexEntry last;
 
   /*
    * First check if logdir is a valid handle.
@@ -459,157 +603,334 @@ string ArchiveLogDirectory::getXlogStartPosition(unsigned int &timelineID,
   segmentNumber = 0;
 
   /*
-   * Loop through the archive log directory, examing each
-   * file there and check whether it might be a XLOG segment file.
+   * The segment index orders all XLOG segments by their segment
+   * number and timeline, so the last one there is the one we're
+   * interested in.
+   *
+   * We employ exactly the same algorithm than receivewal.c,
+   * extract the position from the *last* wal segment file found
+   * in the archive. See src/bin/pg_basebackup/pg_receivewal.c::FindStreamingStart()
+   * for details.
    *
-   * If something found, extract a XLogRecPtr from its name and store
-   * it.
+   * Looks like we haven't found anything ???
    */
-  for (auto& entry : boost::make_iterator_range(directory_iterator(this->log), {})) {
+  if (!this->segmentIndex(xlogsegsize)->last(last)) {
+    return "";
+  }
 
-    std::string direntname = entry.path().filename().string();
+#ifdef __DEBUG_XLOG__
+  BOOST_LOG_TRIVIAL(debug) << "xlog file=" << last.filename << " "
+                           << "tli=" << last.timeline << " "
+                           << "segmentNumber=" << last.segno << " "
+                           << "status=" << last.status;
+#endif
 
-    unsigned int current_tli = 0;
-    long unsigned int current_segno = 0;
-    WALSegmentFileStatus current_status = WAL_SEGMENT_UNKNOWN;
+  segmentNumber = last.segno;
+  timelineID    = last.timeline;
 
-    current_status = determineXlogSegmentStatus(entry.path());
+  /* If something found, calculate the XLogRecPtr */
+  if (segmentNumber > 0) {
 
-    switch (current_status) {
-    case WAL_SEGMENT_COMPLETE:
-    case WAL_SEGMENT_COMPLETE_COMPRESSED:
-    case WAL_SEGMENT_PARTIAL:
-    case WAL_SEGMENT_PARTIAL_COMPRESSED:
-      {
-        /* XLOG segment file, save its name */
-        xlogfilename = direntname;
-        break;
-      }
-    case WAL_SEGMENT_TLI_HISTORY_FILE:
-    case WAL_SEGMENT_TLI_HISTORY_FILE_COMPRESSED:
-      /*
-       * TLI history files aren't interesting here.
-       */
-      continue;
-    case WAL_SEGMENT_UNKNOWN:
-    case WAL_SEGMENT_INVALID_FILENAME:
+    /*
+     * The starting pointer is either
+     *
+     * a) the next segment after a completed one, or
+     * b) beginning of the current partial segment.
+     *
+     * Calculate offset into XLOG end (or start)
+     */
+    XLogRecPtr recptr = xlog::segmentStart(segmentNumber, xlogsegsize);
+
+    /* Format as string and set return value */
+    result = PGStream::encodeXLOGPos(recptr);
+
+  }
+
+  return result;
+}
+
+std::shared_ptr<WALSegmentIndex> ArchiveLogDirectory::segmentIndex(unsigned long long wal_segment_size) {
+
+  if (this->segindex == nullptr
+      || this->segindex->getWalSegmentSize() != wal_segment_size) {
+
+    this->segindex = std::make_shared<WALSegmentIndex>(this->log, wal_segment_size);
+
+  }
+
+  return this->segindex;
+
+}
+
+const char *ArchiveLogDirectory::LAYOUT_FILENAME = ".log_layout";
+
+bool ArchiveLogDirectory::isShardDirectoryName(const std::string &name) {
+
+  if (name.length() != 8)
+    return false;
+
+  for (auto c : name) {
+    if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F')))
+      return false;
+  }
+
+  return true;
+
+}
+
+WALLogLayout ArchiveLogDirectory::readLogLayout(path logdir) {
+
+  std::ifstream layoutfile((logdir / ArchiveLogDirectory::LAYOUT_FILENAME).string());
+  std::string layout;
+
+  /* No layout file means we have a flat log directory */
+  if (!layoutfile.is_open())
+    return WAL_LOG_LAYOUT_FLAT;
+
+  layoutfile >> layout;
+
+  if (layout == "sharded")
+    return WAL_LOG_LAYOUT_SHARDED;
+
+  if (layout == "flat" || layout.empty())
+    return WAL_LOG_LAYOUT_FLAT;
+
+  std::ostringstream oss;
+  oss << "unknown layout \"" << layout << "\" in log directory \""
+      << logdir.string() << "\"";
+  throw CArchiveIssue(oss.str());
+
+}
+
+path ArchiveLogDirectory::xlogFileDirectory(path logdir,
+                                            WALLogLayout layout,
+                                            const std::string &filename) {
+
+  if (layout != WAL_LOG_LAYOUT_SHARDED)
+    return logdir;
+
+  switch(xlogSegmentStatusByName(filename)) {
+  case WAL_SEGMENT_COMPLETE:
+  case WAL_SEGMENT_COMPLETE_COMPRESSED:
+  case WAL_SEGMENT_PARTIAL:
+  case WAL_SEGMENT_PARTIAL_COMPRESSED:
+    {
       /*
-       * We don't care about any files not really a segment
-       * file. It's strange that we found them in the log/ directory,
-       * but don't bother here
+       * XLOG segment filenames are TTTTTTTTXXXXXXXXYYYYYYYY, with T
+       * being the timeline and X the high digits of the segment.
        */
-      continue;
+      if (filename.length() < 24)
+        return logdir;
+
+      return logdir / filename.substr(0, 8) / filename.substr(8, 8);
     }
+  default:
+    return logdir;
+  }
+
+}
+
+path ArchiveLogDirectory::locateXLogFile(path logdir,
+                                         WALLogLayout layout,
+                                         const std::string &filename) {
+
+  path result = xlogFileDirectory(logdir, layout, filename) / filename;
+  path other;
+
+  if (boost::filesystem::exists(result))
+    return result;
+
+  other = xlogFileDirectory(logdir,
+                            (layout == WAL_LOG_LAYOUT_SHARDED) ? WAL_LOG_LAYOUT_FLAT : WAL_LOG_LAYOUT_SHARDED,
+                            filename) / filename;
+
+  if (boost::filesystem::exists(other))
+    return other;
+
+  return result;
+
+}
+
+WALLogLayout ArchiveLogDirectory::getLogLayout() {
+  return readLogLayout(this->log);
+}
+
+path ArchiveLogDirectory::xlogFilePath(const std::string &filename) {
+  return xlogFileDirectory(this->log, this->getLogLayout(), filename) / filename;
+}
+
+path ArchiveLogDirectory::locateXLogFile(const std::string &filename) {
+  return locateXLogFile(this->log, this->getLogLayout(), filename);
+}
+
+bool ArchiveLogDirectory::removeAlternateXLogFile(const std::string &filename) {
+
+  WALLogLayout layout = this->getLogLayout();
+  path other = xlogFileDirectory(this->log,
+                                 (layout == WAL_LOG_LAYOUT_SHARDED) ? WAL_LOG_LAYOUT_FLAT : WAL_LOG_LAYOUT_SHARDED,
+                                 filename) / filename;
+
+  /* Nothing to do if both layouts use the same location */
+  if (other == this->xlogFilePath(filename))
+    return false;
+
+  return boost::filesystem::remove(other);
+
+}
+
+unsigned long long ArchiveLogDirectory::migrateLogLayout(WALLogLayout layout) {
+
+  unsigned long long moved = 0;
+  std::set<path> touched;
+  std::vector<path> files;
+  path layoutfile = this->log / ArchiveLogDirectory::LAYOUT_FILENAME;
+  path tmpfile    = this->log / (std::string(ArchiveLogDirectory::LAYOUT_FILENAME) + ".tmp");
+  boost::system::error_code ec;
+
+  if (!this->exists()) {
+    std::ostringstream oss;
+    oss << "cannot migrate archive log directory \"" << this->log.string()
+        << "\": directory doesn't exist";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * Record the new layout first, so anything written from
+   * now on already uses it.
+   */
+  {
+    ArchiveFile file(tmpfile);
+    std::string content = (layout == WAL_LOG_LAYOUT_SHARDED) ? "sharded\n" : "flat\n";
+
+    file.setOpenMode("w");
+    file.open();
+    file.write(content.c_str(), content.length());
+    file.fsync();
+    file.close();
+
+    boost::filesystem::rename(tmpfile, layoutfile);
+    RootDirectory::fsync(this->log);
+  }
+
+  /*
+   * Collect files to move. Partial segments might be written
+   * by a streamer right now, leave them alone.
+   */
+  for (auto &entry : boost::make_iterator_range(directory_iterator(this->log), {})) {
+
+    std::string name = entry.path().filename().string();
+
+    if (layout == WAL_LOG_LAYOUT_SHARDED) {
+
+      WALSegmentFileStatus status = this->determineXlogSegmentStatus(entry.path());
+
+      if (status == WAL_SEGMENT_COMPLETE
+          || status == WAL_SEGMENT_COMPLETE_COMPRESSED)
+        files.push_back(entry.path());
+
+    } else if (is_directory(entry.path()) && isShardDirectoryName(name)) {
+
+      for (auto &shard : boost::make_iterator_range(directory_iterator(entry.path()), {})) {
+
+        if (!is_directory(shard.path())
+            || !isShardDirectoryName(shard.path().filename().string()))
+          continue;
+
+        for (auto &file : boost::make_iterator_range(directory_iterator(shard.path()), {})) {
+
+          WALSegmentFileStatus status = this->determineXlogSegmentStatus(file.path());
+
+          if (status == WAL_SEGMENT_COMPLETE
+              || status == WAL_SEGMENT_COMPLETE_COMPRESSED)
+            files.push_back(file.path());
+
+        }
+
+      }
 
-    /*
-     * Looks like we haven't found anything ???
-     */
-    if (xlogfilename.length() <= 0) {
-      timelineID = 0;
-      segmentNumber = 0;
-      return "";
     }
 
-    /* Determine Timeline and segment number of current xlog segment */
-#if PG_VERSION_NUM < 110000
-    XLogFromFileName(xlogfilename.c_str(), &current_tli, &current_segno);
-#else
-    XLogFromFileName(xlogfilename.c_str(), &current_tli,
-                     &current_segno, xlogsegsize);
-#endif
+  }
 
-    /* Get the *real* uncompressed file size */
-    fileSize = this->getXlogSegmentSize(entry.path(),
-                                        xlogsegsize,
-                                        current_status);
+  for (auto &file : files) {
 
-#ifdef __DEBUG_XLOG__
-    BOOST_LOG_TRIVIAL(debug) << "xlog file=" << xlogfilename << " "
-                             << "tli=" << current_tli << " "
-                             << "segmentNumber=" << current_segno << " "
-                             << "size=" << fileSize;
-#endif
+    std::string name = file.filename().string();
+    path target = xlogFileDirectory(this->log, layout, name);
 
-    if ((fileSize != xlogsegsize)
-        && (current_status == WAL_SEGMENT_COMPLETE)
-        && (current_status == WAL_SEGMENT_PARTIAL) ) {
-#ifdef __DEBUG_XLOG__
-      BOOST_LOG_TRIVIAL(debug) << "invalid file size ("
-                               << fileSize
-                               << "bytes) in segment "
-                               << direntname
-                               << ": skipping";
-#endif
-      continue;
+    if (!boost::filesystem::exists(target)) {
+      create_directories(target);
+      touched.insert(target.parent_path());
     }
 
     /*
-     * Remember current segment number and TLI
-     * in case its going forward.
-     *
-     * We employ exactly the same algorithm than receivewal.c,
-     * extract the position from the end of the *last* wal
-     * segment file found in the archive. If the highest one wasn't completed,
-     * we start streaming from the beginning of the partial segment we've
-     * found.
-     *
-     * See src/bin/pg_basebackup/pg_receivewal.c::FindStreamingStart()
-     * for details.
+     * Someone else might have been faster, e.g. a retention
+     * removing the file in the meantime.
      */
-    if ((current_segno > segmentNumber)
-        || (current_segno == segmentNumber && current_tli > timelineID)
-        || (current_segno == segmentNumber && current_tli == timelineID
-            && (filestatus == WAL_SEGMENT_PARTIAL
-                || filestatus == WAL_SEGMENT_PARTIAL_COMPRESSED)
-            && (current_status != WAL_SEGMENT_PARTIAL
-                || current_status != WAL_SEGMENT_PARTIAL_COMPRESSED) ) ) {
-
-#ifdef __DEBUG__XLOG__
-      BOOST_LOG_TRIVIAL(debug) << "HI TLI " << current_tli << " SEGNO "
-                               << current_segno << " STATUS "
-                               << current_status;
-#endif
+    if (::rename(file.string().c_str(), (target / name).string().c_str()) < 0) {
+
+      if (errno == ENOENT)
+        continue;
 
-      segmentNumber = current_segno;
-      timelineID    = current_tli;
-      filestatus    = current_status;
+      std::ostringstream oss;
+      oss << "could not move \"" << file.string() << "\" to \""
+          << (target / name).string() << "\": " << strerror(errno);
+      throw CArchiveIssue(oss.str());
 
     }
 
+    touched.insert(file.parent_path());
+    touched.insert(target);
+    moved++;
+
   }
 
-  /* If something found, calculate the XLogRecPtr */
-  if (segmentNumber > 0) {
+  /*
+   * Drop shard directories left empty when migrating
+   * back into the flat layout.
+   */
+  if (layout == WAL_LOG_LAYOUT_FLAT) {
 
-    XLogRecPtr recptr = InvalidXLogRecPtr;
-    std::ostringstream recptrstr;
+    for (auto &dir : touched) {
 
-    /*
-     * The starting pointer is either
-     *
-     * a) the next segment after a completed one, or
-     * b) beginning of the current partial segment.
-     *
-     * Calculate offset into XLOG end (or start)
-     */
-#if PG_VERSION_NUM >= 110000
-    XLogSegNoOffsetToRecPtr(segmentNumber, 0, xlogsegsize, recptr);
-    recptr -= XLogSegmentOffset(recptr, xlogsegsize);
-#else
-    XLogSegNoOffsetToRecPtr(segmentNumber, 0, recptr);
-    recptr -= recptr % XLOG_SEG_SIZE;
-#endif
+      if (dir == this->log || !isShardDirectoryName(dir.filename().string()))
+        continue;
 
-    /* Format as string and set return value */
-    result = PGStream::encodeXLOGPos(recptr);
+      if (boost::filesystem::remove(dir, ec)
+          && !boost::filesystem::remove(dir.parent_path(), ec))
+        RootDirectory::fsync(dir.parent_path());
+
+    }
 
   }
 
-  return result;
+  for (auto &dir : touched) {
+
+    if (boost::filesystem::exists(dir))
+      RootDirectory::fsync(dir);
+
+  }
+
+  RootDirectory::fsync(this->log);
+
+  /*
+   * Filenames don't change, but the index needs to be
+   * restamped. Just drop it, the next user rebuilds it.
+   */
+  boost::filesystem::remove(this->log / WALSegmentIndex::INDEX_FILENAME, ec);
+  this->segindex = nullptr;
+
+  BOOST_LOG_TRIVIAL(info) << "migrated archive log directory "
+                          << this->log.string()
+                          << " into " << ((layout == WAL_LOG_LAYOUT_SHARDED) ? "sharded" : "flat")
+                          << " layout, " << moved << " files moved";
+
+  return moved;
+
 }
 
-void ArchiveLogDirectory::removeXLogs(shared_ptr<BackupCleanupDescr> cleanupDescr,
-                                      unsigned long long wal_segment_size) {
+void ArchiveLogDirectory::selectXLogsToRemove(shared_ptr<BackupCleanupDescr> cleanupDescr,
+                                              unsigned long long wal_segment_size,
+                                              std::vector<WALSegmentIndexEntry> &victims) {
 
   /* TLI=0 doesn't exist, so take this as a starting value */
   unsigned int lowest_tli = 0;
@@ -658,113 +979,430 @@ void ArchiveLogDirectory::removeXLogs(shared_ptr<BackupCleanupDescr> cleanupDesc
 
   };
 
+  victims.clear();
+
   /*
-   * Establish directory iterator.
+   * The segment index knows about all XLOG segment and TLI history
+   * files, so we don't need to scan the directory here. Only those
+   * files are candidates, all other files are left untouched.
    */
-  for(auto & entry : boost::make_iterator_range(directory_iterator(this->getPath()),
-                                                {})) {
+  for (auto const &entry : this->segmentIndex(wal_segment_size)->getEntries()) {
 
-    std::string direntname     = entry.path().filename().string();
-    WALSegmentFileStatus fstat = WAL_SEGMENT_UNKNOWN;
+    /*
+     * Calculate the *starting* XLogRecPtr of this segment file. If this
+     * XLogRecPtr is lower than the requested deletion threshold
+     * we elect the segment for removal.
+     *
+     * TLI history files are indexed with segment number 0. They are
+     * tiny and needed to follow timeline switches, so we only remove
+     * them together with their unreachable timeline.
+     */
+    XLogRecPtr recptr = xlog::segmentStart(entry.segno, wal_segment_size);
+    tli_cleanup_offsets::iterator it;
 
 #ifdef __DEBUG_XLOG__
-    BOOST_LOG_TRIVIAL(debug) << "DEBUG XLOG: examining file: " << direntname;
+    BOOST_LOG_TRIVIAL(debug) << "DEBUG XLOG: examining file: " << entry.filename;
 #endif
 
     /*
-     * Retrieve the XLogRecPtr from this segment file.
+     * Get the offset for the specified timeline from
+     * the cleanup descriptor. If no offset can be found, then
+     * this means that the cleanup descriptor didn't see this
+     * during the retention initialization.
+     *
+     * In this case, if the timeline is in the past (so lower
+     * than any encountered timeline), we drop the XLOG segment,
+     * since there's no basebackup depending on it.
+     *
+     * If the encountered XLogRecPtr is on a timeline seen
+     * during retention initialization, we check whether the cleanup_start
+     * pos (which is the starting point from where we are going to
+     * remove XLOG segment files from the archive) is *equal* or *smaller*
+     * than the XLOG segment starting offset retrieved above.
+     *
+     * If true, then this means that the current XLOG segment file
+     * is older and can be removed.
      */
-    fstat = determineXlogSegmentStatus(entry.path());
+    it = cleanupDescr->off_list.find(entry.timeline);
 
-    /*
-     * unlink() is just called on real WAL segment and TLI history files.
-     * All other files are left untouched.
-     */
-    switch(fstat) {
-    case WAL_SEGMENT_COMPLETE:
-    case WAL_SEGMENT_COMPLETE_COMPRESSED:
-    case WAL_SEGMENT_PARTIAL:
-    case WAL_SEGMENT_PARTIAL_COMPRESSED:
-    case WAL_SEGMENT_TLI_HISTORY_FILE:
-    case WAL_SEGMENT_TLI_HISTORY_FILE_COMPRESSED:
-      {
-        /*
-         * Extract the TLI and segment number of this segment file and
-         * calculate the *starting* XLogRecPtr into it. If this
-         * XLogRecPtr is lower than the requested deletion threshold
-         * we unlink() the segment immediately.
-         */
-        unsigned int xlog_tli = 0;
-        long unsigned int xlog_segno = 0;
-        XLogRecPtr recptr = InvalidXLogRecPtr;
-        tli_cleanup_offsets::iterator it;
-
-#if PG_VERSION_NUM < 110000
-        XLogFromFileName(direntname.c_str(), &xlog_tli, &xlog_segno);
-        XLogSegNoOffsetToRecPtr(xlog_segno, 0, recptr);
-#else
-        XLogFromFileName(direntname.c_str(), &xlog_tli,
-                         &xlog_segno, wal_segment_size);
-        XLogSegNoOffsetToRecPtr(xlog_segno, 0, wal_segment_size, recptr);
+    if ((it == cleanupDescr->off_list.end()) && (lowest_tli > entry.timeline)) {
+
+#ifdef __DEBUG_XLOG__
+      BOOST_LOG_TRIVIAL(debug) << "TLI=" << entry.timeline
+                               << " older and not reachable anymore (treshold TLI="
+                               << lowest_tli << "), electing file "
+                               << entry.filename;
+#endif
+
+      victims.push_back(entry);
+
+    } else if ( (it != cleanupDescr->off_list.end())
+                && entry.isSegment()
+                && (recptr <= (it->second)->wal_cleanup_start_pos) ) {
+
+#ifdef __DEBUG_XLOG__
+      BOOST_LOG_TRIVIAL(debug) << "XLogRecPtr is older than requested position("
+                               << PGStream::encodeXLOGPos(recptr)
+                               << "), electing file "
+                               << entry.filename;
 #endif
 
+      victims.push_back(entry);
+
+    }
+
+  }
+
+  /*
+   * The index hands out files ordered by segment number first,
+   * but workers operate on batches of a single timeline.
+   */
+  std::stable_sort(victims.begin(), victims.end(),
+                   [](const WALSegmentIndexEntry &a, const WALSegmentIndexEntry &b) {
+                     return a.timeline < b.timeline;
+                   });
+
+}
+
+XLogRemovalResult ArchiveLogDirectory::removeXLogs(shared_ptr<BackupCleanupDescr> cleanupDescr,
+                                                   unsigned long long wal_segment_size,
+                                                   bool dry_run) {
+
+  XLogRemovalResult result;
+  std::vector<WALSegmentIndexEntry> victims;
+  WALLogLayout layout = this->getLogLayout();
+
+  /* Directory of each victim */
+  std::vector<path> dirs;
+  std::set<path> touched;
+
+  /* Batches of victims, each one a [begin, end) range of a single directory */
+  std::vector<std::pair<size_t, size_t>> batches;
+  std::atomic<size_t> next_batch(0);
+
+  /* Per victim results, written by the workers */
+  std::vector<char> removed;
+  std::vector<unsigned long long> sizes;
+
+  std::vector<std::thread> workers;
+  std::mutex error_mtx;
+  std::string error = "";
+  unsigned int num_workers = 0;
+
+  result.dry_run = dry_run;
+
+  this->selectXLogsToRemove(cleanupDescr, wal_segment_size, victims);
+
+  if (victims.empty())
+    return result;
+
+  /*
+   * Files might still live in the location of the previous
+   * layout, if the log directory is being migrated.
+   */
+  for (auto &entry : victims)
+    dirs.push_back(locateXLogFile(this->log, layout, entry.filename).parent_path());
+
+  for (size_t i = 0; i < victims.size(); ) {
+
+    size_t end = i;
+
+    while (end < victims.size()
+           && (end - i) < XLOG_REMOVE_BATCH_SIZE
+           && victims[end].timeline == victims[i].timeline
+           && dirs[end] == dirs[i])
+      end++;
+
+    batches.push_back(std::make_pair(i, end));
+    i = end;
+
+  }
+
+  removed.assign(victims.size(), 0);
+  sizes.assign(victims.size(), 0);
+
+  /*
+   * Each worker fetches the next batch, looks up the size of its files
+   * and unlinks them relative to the directory of the batch. Removing a
+   * file which is already gone isn't an error, some other cleanup
+   * might have been faster.
+   */
+  auto work = [&]() {
+
+    size_t batch;
+
+    while ((batch = next_batch.fetch_add(1)) < batches.size()) {
+
+      int dirfd = ::open(dirs[batches[batch].first].string().c_str(),
+                         O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+      if (dirfd < 0) {
+
+        if (errno != ENOENT) {
+          std::lock_guard<std::mutex> guard(error_mtx);
+          if (error.empty())
+            error = std::string("could not open directory \"")
+              + dirs[batches[batch].first].string() + "\": " + strerror(errno);
+        }
+
+        continue;
+
+      }
+
+      for (size_t i = batches[batch].first; i < batches[batch].second; i++) {
+
+        struct stat st;
+        const char *name = victims[i].filename.c_str();
+
+        char link_target[PATH_MAX];
+        ssize_t link_len = -1;
+
+        if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+
+          if (errno != ENOENT) {
+            std::lock_guard<std::mutex> guard(error_mtx);
+            if (error.empty())
+              error = std::string("could not stat file \"") + name + "\": " + strerror(errno);
+          }
+
+          continue;
+
+        }
+
         /*
-         * Get the offset for the specified timeline from
-         * the cleanup descriptor. If no offset can be found, then
-         * this means that the cleanup descriptor didn't see this
-         * during the retention initialization.
-         *
-         * In this case, if the timeline is in the past (so lower
-         * than any encountered timeline), we drop the XLOG segment,
-         * since there's no basebackup depending on it.
-         *
-         * If the encountered XLogRecPtr is on a timeline seen
-         * during retention initialization, we check whether the cleanup_start
-         * pos (which is the starting point from where we are going to
-         * remove XLOG segment files from the archive) is *equal* or *smaller*
-         * than the XLOG segment starting offset retrieved above.
-         *
-         * If true, then this means that the current XLOG segment file
-         * is older and can be removed.
+         * A segment moved to the cold tier by moveXLogs(), its
+         * copy goes, too. The size is the one of the copy.
          */
-        it = cleanupDescr->off_list.find(xlog_tli);
+        if (S_ISLNK(st.st_mode)) {
 
-        if ((it == cleanupDescr->off_list.end()) && (lowest_tli > xlog_tli)) {
+          struct stat target_st;
 
-          BOOST_LOG_TRIVIAL(warning) << "TLI=" << xlog_tli
-                                     << " older and not reachable anymore (treshold TLI="
-                                     << "lowest_tli";
-          BOOST_LOG_TRIVIAL(info) << "TLI not reachable, deleting file "
-                                  << direntname;
+          link_len = readlinkat(dirfd, name, link_target, sizeof(link_target) - 1);
 
-          /*
-           * TLI not seen in basebackup list and current segment
-           * has older TLI.
-           */
-          remove(entry.path());
+          if (link_len > 0) {
 
-        } else if ( (it->first == xlog_tli)
-                    && (recptr <= (it->second)->wal_cleanup_start_pos) ) {
+            link_target[link_len] = '\0';
 
-          BOOST_LOG_TRIVIAL(info) << "XLogRecPtr is older than requested position("
-                                   << PGStream::encodeXLOGPos(recptr)
-                                   << "), deleting file "
-                                   << direntname;
+            if (::stat(link_target, &target_st) == 0)
+              st.st_size = target_st.st_size;
 
-          remove(entry.path());
+          }
 
         }
 
-        break;
+        if (!dry_run && unlinkat(dirfd, name, 0) < 0) {
+
+          if (errno != ENOENT) {
+            std::lock_guard<std::mutex> guard(error_mtx);
+            if (error.empty())
+              error = std::string("could not remove file \"") + name + "\": " + strerror(errno);
+          }
+
+          continue;
+
+        }
+
+        if (!dry_run && link_len > 0
+            && ::unlink(link_target) < 0 && errno != ENOENT) {
+
+          std::lock_guard<std::mutex> guard(error_mtx);
+          if (error.empty())
+            error = std::string("could not remove file \"") + link_target + "\": " + strerror(errno);
+
+        }
+
+        sizes[i] = st.st_size;
+        removed[i] = 1;
+
       }
-    default:
+
+      ::close(dirfd);
+
+    }
+
+  };
+
+  num_workers = std::min((size_t) XLOG_REMOVE_MAX_WORKERS, batches.size());
+
+  for (unsigned int i = 1; i < num_workers; i++)
+    workers.push_back(std::thread(work));
+
+  /* The calling thread is a worker, too */
+  work();
+
+  for (auto &worker : workers)
+    worker.join();
+
+  for (size_t i = 0; i < victims.size(); i++) {
+
+    if (!removed[i])
       continue;
+
+    result.files++;
+    result.bytes += sizes[i];
+    result.filenames.push_back(victims[i].filename);
+    touched.insert(dirs[i]);
+
+  }
+
+  /*
+   * Make the removals durable with a single sync of each
+   * directory and tell the index about them. Shard directories
+   * left empty are removed.
+   */
+  if (!dry_run && result.files > 0) {
+
+    boost::system::error_code ec;
+
+    try {
+
+      for (auto &dir : touched) {
+
+        if (dir != this->log
+            && boost::filesystem::remove(dir, ec)) {
+
+          if (!boost::filesystem::remove(dir.parent_path(), ec))
+            RootDirectory::fsync(dir.parent_path());
+          else
+            RootDirectory::fsync(this->log);
+
+          continue;
+
+        }
+
+        RootDirectory::fsync(dir);
+
+      }
+
+    } catch(CArchiveIssue &ai) {
+
+      if (error.empty())
+        error = ai.what();
+
     }
+
+    this->segmentIndex(wal_segment_size)->remove(result.filenames);
+
   }
 
+  BOOST_LOG_TRIVIAL(info) << (dry_run ? "would remove " : "removed ")
+                          << result.files << " files ("
+                          << result.bytes << " bytes) from archive log directory "
+                          << this->getPath().string();
+
+  if (!error.empty())
+    throw CArchiveIssue(error);
+
+  return result;
+
 }
 
-WALSegmentFileStatus ArchiveLogDirectory::determineXlogSegmentStatus(path segmentFile) {
+XLogRemovalResult ArchiveLogDirectory::moveXLogs(shared_ptr<BackupCleanupDescr> cleanupDescr,
+                                                 unsigned long long wal_segment_size,
+                                                 path target_dir,
+                                                 bool dry_run) {
+
+  XLogRemovalResult result;
+  std::vector<WALSegmentIndexEntry> candidates;
+  std::vector<std::pair<path, path>> moved;
+  std::set<path> touched;
+  WALLogLayout layout = this->getLogLayout();
+
+  result.dry_run = dry_run;
+
+  this->selectXLogsToRemove(cleanupDescr, wal_segment_size, candidates);
+
+  for (auto &entry : candidates) {
+
+    struct stat st;
+    path source;
+
+    /*
+     * History files are needed to follow timeline switches and
+     * partial segments might still be written, both stay.
+     */
+    if (entry.status != WAL_SEGMENT_COMPLETE
+        && entry.status != WAL_SEGMENT_COMPLETE_COMPRESSED)
+      continue;
+
+    source = locateXLogFile(this->log, layout, entry.filename);
+
+    if (::lstat(source.string().c_str(), &st) < 0) {
+
+      if (errno == ENOENT)
+        continue;
+
+      throw CArchiveIssue("could not stat file \"" + source.string() + "\": " + strerror(errno));
+
+    }
+
+    /* moved before */
+    if (S_ISLNK(st.st_mode))
+      continue;
+
+    result.files++;
+    result.bytes += st.st_size;
+    result.filenames.push_back(entry.filename);
+
+    if (!dry_run)
+      moved.push_back(std::make_pair(source, target_dir / entry.filename));
+
+  }
+
+  if (moved.empty()) {
+
+    BOOST_LOG_TRIVIAL(info) << (dry_run ? "would move " : "moved ")
+                            << result.files << " files ("
+                            << result.bytes << " bytes) to "
+                            << target_dir.string();
+    return result;
+
+  }
+
+  /*
+   * Copy everything first and sync the target directory once,
+   * before any file in the log directory is replaced. A copy left
+   * over by an interrupted run is simply overwritten.
+   */
+  create_directories(target_dir);
+
+  for (auto &file : moved)
+    copy_file_synced(file.first, file.second);
+
+  RootDirectory::fsync(target_dir);
+
+  for (auto &file : moved) {
+
+    path link = file.first.string() + ".tier";
+
+    ::unlink(link.string().c_str());
+
+    if (::symlink(file.second.string().c_str(), link.string().c_str()) < 0) {
+      throw CArchiveIssue("could not create symlink \"" + link.string() + "\": " + strerror(errno));
+    }
+
+    if (::rename(link.string().c_str(), file.first.string().c_str()) < 0) {
+      std::string error = "could not rename symlink \"" + link.string() + "\": " + strerror(errno);
+      ::unlink(link.string().c_str());
+      throw CArchiveIssue(error);
+    }
+
+    touched.insert(file.first.parent_path());
+
+  }
+
+  for (auto &dir : touched)
+    RootDirectory::fsync(dir);
+
+  BOOST_LOG_TRIVIAL(info) << "moved " << result.files << " files ("
+                          << result.bytes << " bytes) to "
+                          << target_dir.string();
+
+  return result;
+
+}
+
+WALSegmentFileStatus ArchiveLogDirectory::xlogSegmentStatusByName(const std::string &xlogfilename) {
 
   /*
    * We need to try hard here to get the
@@ -776,48 +1414,48 @@ WALSegmentFileStatus ArchiveLogDirectory::determineXlogSegmentStatus(path segmen
    * d) partial compressed WAL segments (filter_partial_compressed)
    * e) TLI history file (timeline switch)
    * f) compressed TLI history file (timeline switch)
+   *
+   * The filters are compiled once, this is called for every
+   * file when scanning large log directories.
    */
-  WALSegmentFileStatus filestatus = WAL_SEGMENT_UNKNOWN;
-
-  const regex filter_complete("[0-9A-F]*");
-  const regex filter_complete_compressed("[0-9A-F]*.gz");
-  const regex filter_partial("[0-9A-F]*.partial");
-  const regex filter_partial_compressed("[0-9A-F]*.partial.gz");
-  const regex filter_tli_history_file("[0-9A-F]*.history");
-  const regex filter_tli_history_file_compressed("[0-9A-F]*.history.gz");
+  static const regex filter_complete("[0-9A-F]*");
+  static const regex filter_complete_compressed("[0-9A-F]*\\.(gz|zst|lz4)");
+  static const regex filter_partial("[0-9A-F]*.partial");
+  static const regex filter_partial_compressed("[0-9A-F]*\\.partial\\.(gz|zst|lz4)");
+  static const regex filter_tli_history_file("[0-9A-F]*.history");
+  static const regex filter_tli_history_file_compressed("[0-9A-F]*\\.history\\.(gz|zst|lz4)");
 
   /*
    * For filename filtering...
    */
   boost::smatch what;
 
-  /*
-   * Filename as string, used for regex evaluation
-   */
-  string xlogfilename = segmentFile.filename().string();
-
-  if (!is_regular_file(segmentFile))
-    return filestatus;
-
   /* Apply XLOG segment filename filters */
   if (regex_match(xlogfilename, what, filter_complete)) {
-    filestatus = WAL_SEGMENT_COMPLETE;
+    return WAL_SEGMENT_COMPLETE;
   } else if (regex_match(xlogfilename, what, filter_complete_compressed)) {
-    filestatus = WAL_SEGMENT_COMPLETE_COMPRESSED;
+    return WAL_SEGMENT_COMPLETE_COMPRESSED;
   } else if (regex_match(xlogfilename, what, filter_partial)) {
-    filestatus = WAL_SEGMENT_PARTIAL;
+    return WAL_SEGMENT_PARTIAL;
   } else if (regex_match(xlogfilename, what, filter_partial_compressed)) {
-    filestatus = WAL_SEGMENT_PARTIAL_COMPRESSED;
+    return WAL_SEGMENT_PARTIAL_COMPRESSED;
   } else if (regex_match(xlogfilename, what, filter_tli_history_file)) {
-    filestatus = WAL_SEGMENT_TLI_HISTORY_FILE;
+    return WAL_SEGMENT_TLI_HISTORY_FILE;
   } else if (regex_match(xlogfilename, what, filter_tli_history_file_compressed)) {
-    filestatus = WAL_SEGMENT_TLI_HISTORY_FILE_COMPRESSED;
-  } else {
-    /* Seems not a correctly named XLOG segment file. */
-    filestatus = WAL_SEGMENT_INVALID_FILENAME;
+    return WAL_SEGMENT_TLI_HISTORY_FILE_COMPRESSED;
   }
 
-  return filestatus;
+  /* Seems not a correctly named XLOG segment file. */
+  return WAL_SEGMENT_INVALID_FILENAME;
+
+}
+
+WALSegmentFileStatus ArchiveLogDirectory::determineXlogSegmentStatus(path segmentFile) {
+
+  if (!is_regular_file(segmentFile))
+    return WAL_SEGMENT_UNKNOWN;
+
+  return xlogSegmentStatusByName(segmentFile.filename().string());
 }
 
 unsigned long long ArchiveLogDirectory::getXlogSegmentSize(path segmentFile,
@@ -838,10 +1476,63 @@ unsigned long long ArchiveLogDirectory::getXlogSegmentSize(path segmentFile,
   case WAL_SEGMENT_COMPLETE_COMPRESSED:
   case WAL_SEGMENT_PARTIAL_COMPRESSED:
     {
+      BackupProfileCompressType compression = xlogCompressionType(segmentFile);
+
+      std::vector<CompressedFrame> frames;
+      uint64_t total_size;
+
+      /*
+       * Framed segment files record their uncompressed size in
+       * the frame table. This is also the only reliable source for
+       * framed gzip files, since the last gzip member is the
+       * envelope of the table itself.
+       */
+      if (FramedArchiveFile::readFrameTable(segmentFile, frames, total_size)) {
+        fileSize = total_size;
+        break;
+      }
+
+      /*
+       * zstd and lz4 frames written by a stream don't carry
+       * their content size, so we need to decompress them to
+       * get the real size.
+       */
+      if (compression == BACKUP_COMPRESS_TYPE_ZSTD
+          || compression == BACKUP_COMPRESS_TYPE_LZ4) {
+
+        std::shared_ptr<BackupFile> xlogseg = nullptr;
+        std::vector<char> buf(64 * 1024);
+        size_t rbytes;
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+        if (compression == BACKUP_COMPRESS_TYPE_ZSTD)
+          xlogseg = std::make_shared<ZstdArchiveFile>(segmentFile);
+#endif
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+        if (compression == BACKUP_COMPRESS_TYPE_LZ4)
+          xlogseg = std::make_shared<LZ4ArchiveFile>(segmentFile);
+#endif
+
+        if (xlogseg == nullptr)
+          throw CArchiveIssue("attempt to read compressed segment file "
+                              + segmentFile.string()
+                              + " without compression support compiled in");
+
+        xlogseg->setOpenMode("rb");
+        xlogseg->open();
+
+        while ((rbytes = xlogseg->read(buf.data(), buf.size())) > 0)
+          fileSize += rbytes;
+
+        xlogseg->close();
+        break;
+
+      }
+
       /*
-       * Since we have to deal with gzipped segment files
-       * only, we can rely on the last 4 bytes, which is used
-       * by gzip to stored the uncompressed size (ISIZE member).
+       * For gzipped segment files we can rely on the last 4 bytes,
+       * which is used by gzip to stored the uncompressed
+       * size (ISIZE member).
        *
        * We can't use the compressed physical size here, since this
        * is not a reliable check.
@@ -894,6 +1585,23 @@ unsigned long long ArchiveLogDirectory::getXlogSegmentSize(path segmentFile,
   return fileSize;
 }
 
+BackupProfileCompressType ArchiveLogDirectory::xlogCompressionType(path segmentFile) {
+
+  std::string ext = segmentFile.extension().string();
+
+  if (ext == ".gz")
+    return BACKUP_COMPRESS_TYPE_GZIP;
+
+  if (ext == ".zst")
+    return BACKUP_COMPRESS_TYPE_ZSTD;
+
+  if (ext == ".lz4")
+    return BACKUP_COMPRESS_TYPE_LZ4;
+
+  return BACKUP_COMPRESS_TYPE_NONE;
+
+}
+
 void ArchiveLogDirectory::checkCleanupDescriptor(std::shared_ptr<BackupCleanupDescr> cleanupDescr) {
 
   if (cleanupDescr == nullptr)
@@ -1167,48 +1875,17 @@ void RootDirectory::fsync() {
 
 void RootDirectory::fsync_recursive(path handle) {
 
-  if (is_directory(handle)) {
+  RecursiveSync sync(handle);
 
-    vector<path> listing;
-
-    copy(directory_iterator(handle), directory_iterator(), std::back_inserter(listing));
-
-    for (vector<path>::const_iterator it(listing.begin()), it_end(listing.end()); it != it_end; ++it) {
-      path subhandle = *it;
-
-      /*
-       * fsync() contents of current directory, call
-       * fsync_worker() recursively on subdir.
-       */
-      try {
-        RootDirectory::fsync(handle);
-      } catch(CArchiveIssue &e) {
-        /* ignore any errors while recursing */
-      }
-
-      BackupDirectory::fsync_recursive(subhandle);
-    }
-
-  } else if (is_regular_file(handle)) {
-
-    ArchiveFile file(handle);
-
-    file.setOpenMode("r");
-
-    try {
-      file.open();
-      file.fsync();
-      file.close();
-    } catch (CArchiveIssue &e) {
-      /*
-       * Ignore any errors while recursing, but don't
-       * leak possible opened file descriptors
-       */
-      if (file.isOpen())
-        file.close();
-    }
+  if (!boost::filesystem::exists(handle))
+    return;
 
-  }
+  /*
+   * Errors while recursing are logged, but ignored
+   * as before.
+   */
+  sync.setIgnoreErrors(true);
+  sync.sync();
 
 }
 
@@ -1444,24 +2121,64 @@ bool BackupDirectory::exists() {
 std::shared_ptr<BackupFile> BackupDirectory::walfile(std::string name,
                                                      BackupProfileCompressType compression) {
 
+  return this->walfile(name, compression, 0);
+
+}
+
+std::shared_ptr<BackupFile> BackupDirectory::walfile(std::string name,
+                                                     BackupProfileCompressType compression,
+                                                     int compression_level) {
+
+  /*
+   * Place the file according to the layout of the log directory,
+   * creating its shard directory if required.
+   */
+  path dir = ArchiveLogDirectory::xlogFileDirectory(this->log,
+                                                    ArchiveLogDirectory::readLogLayout(this->log),
+                                                    name);
+
+  if (dir != this->log && !boost::filesystem::exists(dir)) {
+
+    create_directories(dir);
+    RootDirectory::fsync(dir.parent_path());
+    RootDirectory::fsync(this->log);
+
+  }
+
   switch(compression) {
 
   case BACKUP_COMPRESS_TYPE_NONE:
-    return std::make_shared<ArchiveFile>(this->log / name);
+    return std::make_shared<ArchiveFile>(dir / name);
     break;
 
   case BACKUP_COMPRESS_TYPE_GZIP:
 #ifdef PG_BACKUP_CTL_HAS_ZLIB
-    return std::make_shared<CompressedArchiveFile>(this->log / (name + ".gz"));
+    {
+      std::shared_ptr<CompressedArchiveFile> myfile
+        = std::make_shared<CompressedArchiveFile>(dir / (name + ".gz"));
+
+      myfile->setCompressionLevel(compression_level);
+      return myfile;
+    }
 #else
     throw CArchiveIssue("zlib compression support not compiled in");
 #endif
     break;
 
   case BACKUP_COMPRESS_TYPE_ZSTD:
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+    {
+      /* In-process compression via libzstd */
+      std::shared_ptr<ZstdArchiveFile> myfile
+        = std::make_shared<ZstdArchiveFile>(dir / (name + ".zst"));
+
+      myfile->setCompressionLevel(compression_level);
+      return myfile;
+    }
+#else
     {
       std::shared_ptr<ArchivePipedProcess> myfile
-        = std::make_shared<ArchivePipedProcess>(this->log / (name + ".zst"));
+        = std::make_shared<ArchivePipedProcess>(dir / (name + ".zst"));
       std::string filename = myfile->getFilePath();
 
       if (!CPGBackupCtlBase::resolve_file_path("zstd"))
@@ -1475,12 +2192,28 @@ std::shared_ptr<BackupFile> BackupDirectory::walfile(std::string name,
       myfile->pushExecArgument(filename);
 
       return myfile;
-      break;
     }
+#endif
+    break;
 
-  default:
-    std::ostringstream oss;
-    oss << "could not create wal file: compression type unsupported: " << compression;
+  case BACKUP_COMPRESS_TYPE_LZ4:
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+    {
+      /* In-process compression via liblz4 */
+      std::shared_ptr<LZ4ArchiveFile> myfile
+        = std::make_shared<LZ4ArchiveFile>(dir / (name + ".lz4"));
+
+      myfile->setCompressionLevel(compression_level);
+      return myfile;
+    }
+#else
+    throw CArchiveIssue("lz4 compression support not compiled in");
+#endif
+    break;
+
+  default:
+    std::ostringstream oss;
+    oss << "could not create wal file: compression type unsupported: " << compression;
     throw CArchiveIssue(oss.str());
 
   }
@@ -1489,6 +2222,18 @@ std::shared_ptr<BackupFile> BackupDirectory::walfile(std::string name,
 std::shared_ptr<BackupFile> BackupDirectory::basebackup(std::string name,
                                                         BackupProfileCompressType compression) {
 
+  return this->basebackup(name, compression, 0, 0);
+
+}
+
+std::shared_ptr<BackupFile> BackupDirectory::basebackup(std::string name,
+                                                        BackupProfileCompressType compression,
+                                                        int compression_level,
+                                                        int compression_workers) {
+
+  /* compression_workers not used by any supported method here */
+  (void) compression_workers;
+
   switch(compression) {
 
   case BACKUP_COMPRESS_TYPE_NONE:
@@ -1499,7 +2244,13 @@ std::shared_ptr<BackupFile> BackupDirectory::basebackup(std::string name,
   case BACKUP_COMPRESS_TYPE_GZIP:
 
 #ifdef PG_BACKUP_CTL_HAS_ZLIB
-    return std::make_shared<CompressedArchiveFile>(this->basedir() / (name + ".gz"));
+    {
+      std::shared_ptr<CompressedArchiveFile> myfile
+        = std::make_shared<CompressedArchiveFile>(this->basedir() / (name + ".gz"));
+
+      myfile->setCompressionLevel(compression_level);
+      return myfile;
+    }
 #else
     throw CArchiveIssue("zlib compression support not compiled in");
 #endif
@@ -1769,6 +2520,19 @@ off_t BackupFile::current_position() {
   return this->currpos;
 }
 
+off_t BackupFile::syncPoint() {
+  return -1;
+}
+
+void BackupFile::seekSyncPoint(off_t offset) {
+
+  std::ostringstream oss;
+  oss << "file " << this->handle.string()
+      << " doesn't support sync points";
+  throw CArchiveIssue(oss.str());
+
+}
+
 /******************************************************************************
  * ArchivePipedProcess Implementation
  ******************************************************************************/
@@ -2247,6 +3011,65 @@ void ArchiveFile::rename(path& newname) {
   /* and we're done ... */
 }
 
+int ArchiveFile::fallocate(size_t len) {
+  return posix_fallocate(fileno(this->fp), 0, len);
+}
+
+void ArchiveFile::allocate(size_t len) {
+
+  int rc;
+
+  if (!this->isOpen()) {
+    std::ostringstream oss;
+    oss << "cannot allocate space for file "
+        << this->handle.string()
+        << ": not opened";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * Flush any buffered data before we operate on the
+   * file descriptor directly.
+   */
+  fflush(this->fp);
+
+  rc = this->fallocate(len);
+
+  if (rc == EOPNOTSUPP || rc == EINVAL) {
+
+    /*
+     * Filesystem doesn't support fallocate(), pad
+     * the file with zeroes instead.
+     */
+    char zerobuffer[8192];
+    size_t wbytes = 0;
+
+    memset(zerobuffer, 0, sizeof(zerobuffer));
+    this->lseek(0, SEEK_SET);
+
+    while (wbytes < len) {
+      size_t bw = ((len - wbytes) < sizeof(zerobuffer)) ? (len - wbytes) : sizeof(zerobuffer);
+      this->write(zerobuffer, bw);
+      wbytes += bw;
+    }
+
+    fflush(this->fp);
+
+  } else if (rc != 0) {
+    std::ostringstream oss;
+    oss << "could not allocate "
+        << len
+        << " bytes for file "
+        << this->handle.string()
+        << ": "
+        << strerror(rc);
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->lseek(0, SEEK_SET);
+
+}
+
 void ArchiveFile::open() {
 
   /* check if we already hold a valid file stream pointer */
@@ -2269,6 +3092,32 @@ void ArchiveFile::open() {
     throw CArchiveIssue(oss.str());
   }
 
+  if (!this->buffered
+      && setvbuf(this->fp, NULL, _IONBF, 0) != 0) {
+    std::ostringstream oss;
+    oss << "could not disable buffering for file " << this->handle.string();
+    ::fclose(this->fp);
+    this->fp = NULL;
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * stdio can't open with O_DIRECT, so set it on the descriptor
+   * afterwards. Filesystems like tmpfs might refuse this, then we
+   * continue with cached I/O.
+   */
+  if (this->direct_io) {
+
+    int flags = fcntl(fileno(this->fp), F_GETFL);
+
+    if (flags < 0 || fcntl(fileno(this->fp), F_SETFL, flags | O_DIRECT) < 0) {
+      BOOST_LOG_TRIVIAL(debug) << "DEBUG: could not enable O_DIRECT for file \""
+                               << this->handle.string() << "\": " << strerror(errno);
+      this->direct_io = false;
+    }
+
+  }
+
   if (this->temporary) {
     unlink(this->handle.c_str());
   }
@@ -2277,6 +3126,32 @@ void ArchiveFile::open() {
 
 }
 
+void ArchiveFile::setBuffered(bool buffered) {
+
+  if (this->fp != NULL)
+    throw CArchiveIssue("cannot change buffering of an opened file");
+
+  this->buffered = buffered;
+
+}
+
+const size_t ArchiveFile::DIRECT_IO_ALIGNMENT;
+
+void ArchiveFile::setDirectIO(bool direct_io) {
+
+  if (this->fp != NULL)
+    throw CArchiveIssue("cannot change direct I/O of an opened file");
+
+  this->direct_io = direct_io;
+
+}
+
+bool ArchiveFile::isDirectIO() {
+
+  return this->direct_io;
+
+}
+
 void ArchiveFile::remove() {
 
   int rc;
@@ -2415,6 +3290,12 @@ void ArchiveFile::fsync() {
     throw CArchiveIssue(oss.str());
   }
 
+  /*
+   * Make sure buffered stream data reaches the kernel
+   * before syncing the descriptor.
+   */
+  fflush(this->fp);
+
   if (::fsync(fileno(this->fp)) != 0) {
     std::ostringstream oss;
     oss << "error fsyncing file \""
@@ -2426,6 +3307,84 @@ void ArchiveFile::fsync() {
 
 }
 
+void ArchiveFile::datasync() {
+
+  if (this->fp == NULL) {
+    std::ostringstream oss;
+    oss << "attempt to fdatasync uninitialized file \""
+        << this->handle.string() << "\"";
+    throw CArchiveIssue(oss.str());
+  }
+
+  fflush(this->fp);
+
+  if (::fdatasync(fileno(this->fp)) != 0) {
+    std::ostringstream oss;
+    oss << "error fdatasyncing file \""
+        << this->handle.string()
+        << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+void ArchiveFile::startWriteback(off_t offset, off_t nbytes) {
+
+#ifdef SYNC_FILE_RANGE_WRITE
+
+  if (this->fp == NULL) {
+    std::ostringstream oss;
+    oss << "attempt to write back range of uninitialized file \""
+        << this->handle.string() << "\"";
+    throw CArchiveIssue(oss.str());
+  }
+
+  fflush(this->fp);
+
+  if (::sync_file_range(fileno(this->fp), offset, nbytes,
+                        SYNC_FILE_RANGE_WRITE) != 0) {
+    std::ostringstream oss;
+    oss << "error writing back range of file \""
+        << this->handle.string()
+        << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+#endif
+
+}
+
+off_t ArchiveFile::syncPoint() {
+
+  off_t pos;
+
+  if (this->fp == NULL) {
+    std::ostringstream oss;
+    oss << "cannot get position of uninitialized file \""
+        << this->handle.string() << "\"";
+    throw CArchiveIssue(oss.str());
+  }
+
+  if ((pos = ::ftello(this->fp)) < 0) {
+    std::ostringstream oss;
+    oss << "could not get position in file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  return pos;
+
+}
+
+void ArchiveFile::seekSyncPoint(off_t offset) {
+
+  this->lseek(offset, SEEK_SET);
+
+}
+
 void ArchiveFile::close() {
 
   if (this->fp == NULL) {
@@ -2487,7 +3446,41 @@ void CompressedArchiveFile::setCompressed(bool compressed) {
 }
 
 void CompressedArchiveFile::rename(path& newname) {
-  throw CArchiveIssue("rename() of compressed file name not yet implemented");
+
+  if (boost::filesystem::exists(status(newname))) {
+    std::ostringstream oss;
+    oss << "cannot rename "
+        << this->handle.string()
+        << " to "
+        << newname.string()
+        << ": file exists";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * Finish the gzip stream and make sure it's on disk
+   * before renaming it. The handle stays closed afterwards, since
+   * a gzip stream can't be continued.
+   */
+  if (this->isOpen()) {
+    this->close();
+    RootDirectory::fsync(this->handle);
+  }
+
+  if (::rename(this->handle.string().c_str(),
+               newname.string().c_str()) < 0) {
+    std::ostringstream oss;
+    oss << "could not rename file \""
+        << this->handle.string()
+        << "\" to \""
+        << newname.string()
+        << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->handle = newname;
+
 }
 
 void CompressedArchiveFile::setOpenMode(std::string mode) {
@@ -2502,7 +3495,87 @@ std::string CompressedArchiveFile::getOpenMode() {
 
 void CompressedArchiveFile::setCompressionLevel(int level) {
 
-  throw CArchiveIssue("overriding default compression level (9) not yet supported");
+  if (this->isOpen())
+    throw CArchiveIssue("cannot change compression level of opened file "
+                        + this->handle.string());
+
+  if (level < 0 || level > Z_BEST_COMPRESSION) {
+    std::ostringstream oss;
+    oss << "invalid gzip compression level " << level;
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->compressionLevel = level;
+
+}
+
+off_t CompressedArchiveFile::syncPoint() {
+
+  off_t pos;
+
+  if (!this->isOpen() || this->mode.find_first_of("wa") == std::string::npos) {
+    std::ostringstream oss;
+    oss << "attempt to finish gzip member of file not opened for writing "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * Z_FINISH completes the current gzip member, the next
+   * gzwrite() starts a new one. Each member can be inflated on its
+   * own, but gzread() also reads them as one consecutive stream.
+   */
+  if (gzflush(this->zh, Z_FINISH) != Z_OK) {
+    std::ostringstream oss;
+    int gzerrno;
+    oss << "could not finish gzip member of file \""
+        << this->handle.string() << "\": "
+        << gzerror(this->zh, &gzerrno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * zlib writes to the descriptor directly, the FILE stream
+   * doesn't know about its position.
+   */
+  if ((pos = ::lseek(fileno(this->fp), 0, SEEK_CUR)) < 0) {
+    std::ostringstream oss;
+    oss << "could not get position in file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  return pos;
+
+}
+
+void CompressedArchiveFile::seekSyncPoint(off_t offset) {
+
+  if (!this->isOpen() || this->mode.find_first_of("wa") != std::string::npos) {
+    std::ostringstream oss;
+    oss << "attempt to seek in gzip file not opened for reading "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * The gzip handle buffers input already read, so start over with
+   * a fresh one positioned at the member start. gzdopen() doesn't
+   * read anything before the next gzread().
+   */
+  this->close();
+  this->open();
+
+  if (::lseek(fileno(this->fp), offset, SEEK_SET) < 0) {
+    std::ostringstream oss;
+    oss << "could not seek in file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->currpos = 0;
 
 }
 
@@ -2577,15 +3650,25 @@ void CompressedArchiveFile::open() {
    */
   this->zh = gzdopen(fileno(this->fp), this->mode.c_str());
 
-  if (this->fp == NULL) {
+  if (this->zh == NULL) {
     std::ostringstream oss;
     oss << "could not open compressed file \""
         << this->handle.string() << " "
         << "for writing: "
         << strerror(errno);
+    fclose(this->fp);
+    this->fp = NULL;
     throw CArchiveIssue(oss.str());
   }
 
+  /*
+   * Apply a non-default compression level, if requested.
+   */
+  if (this->compressionLevel > 0
+      && this->mode.find_first_of("wa") != std::string::npos) {
+    gzsetparams(this->zh, this->compressionLevel, Z_DEFAULT_STRATEGY);
+  }
+
   this->opened = true;
 
 }
@@ -2636,6 +3719,13 @@ void CompressedArchiveFile::fsync() {
     throw CArchiveIssue(oss.str());
   }
 
+  /*
+   * Push data pending in the gzip stream to the file
+   * first, otherwise fsync() wouldn't cover it.
+   */
+  if (this->mode.find_first_of("wa") != std::string::npos)
+    gzflush(this->zh, Z_SYNC_FLUSH);
+
   if (::fsync(fileno(this->fp)) != 0) {
     std::ostringstream oss;
     oss << "error fsyncing file \""
@@ -2794,6 +3884,4473 @@ void CompressedArchiveFile::close() {
 
 #endif
 
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+
+/******************************************************************************
+ * Implementation of ZstdArchiveFile
+ *****************************************************************************/
+
+ZstdArchiveFile::ZstdArchiveFile(path pathHandle) : BackupFile(pathHandle) {
+  this->compressed = true;
+}
+
+ZstdArchiveFile::~ZstdArchiveFile() {
+
+  if (this->isOpen()) {
+
+    /*
+     * Don't leak file handles, but don't throw
+     * from a destructor either.
+     */
+    try {
+      this->close();
+    } catch(CArchiveIssue &e) {
+      BOOST_LOG_TRIVIAL(error) << e.what();
+    }
+
+  }
+
+  if (this->cctx != NULL)
+    ZSTD_freeCCtx(this->cctx);
+
+  if (this->dctx != NULL)
+    ZSTD_freeDCtx(this->dctx);
+
+}
+
+bool ZstdArchiveFile::isCompressed() {
+  return true;
+}
+
+void ZstdArchiveFile::setCompressed(bool compressed) {
+  if (!compressed)
+    throw CArchiveIssue("attempt to set uncompressed flag to compressed zstd file handle");
+}
+
+bool ZstdArchiveFile::isOpen() {
+  return this->opened;
+}
+
+void ZstdArchiveFile::setOpenMode(std::string mode) {
+  this->mode = mode;
+}
+
+std::string ZstdArchiveFile::getOpenMode() {
+  return this->mode;
+}
+
+void ZstdArchiveFile::setCompressionLevel(int level) {
+
+  if (this->isOpen())
+    throw CArchiveIssue("cannot change compression level of opened file "
+                        + this->handle.string());
+
+  if (level < 0 || level > ZSTD_maxCLevel()) {
+    std::ostringstream oss;
+    oss << "invalid zstd compression level " << level;
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->compressionLevel = level;
+
+}
+
+void ZstdArchiveFile::setCompressionWorkers(int workers) {
+
+  ZSTD_bounds bounds = ZSTD_cParam_getBounds(ZSTD_c_nbWorkers);
+
+  if (this->isOpen())
+    throw CArchiveIssue("cannot change compression workers of opened file "
+                        + this->handle.string());
+
+  /*
+   * A libzstd built without multithreading support reports
+   * an upper bound of 0 here.
+   */
+  if (workers < 0
+      || ZSTD_isError(bounds.error)
+      || workers > bounds.upperBound) {
+    std::ostringstream oss;
+    oss << "invalid number of zstd compression workers " << workers;
+
+    if (!ZSTD_isError(bounds.error) && bounds.upperBound == 0)
+      oss << ": libzstd was built without multithreading support";
+
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->compressionWorkers = workers;
+
+}
+
+void ZstdArchiveFile::open() {
+
+  if (this->fp != NULL) {
+    std::ostringstream oss;
+    oss << "error opening "
+        << "\""
+        << this->handle.string()
+        << "\": "
+        << "file handle already initialized";
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (this->temporary)
+    throw CArchiveIssue("temporary compressed archive files currently not supported");
+
+  this->writing = (this->mode.find_first_of("wa") != std::string::npos);
+
+  this->fp = fopen(this->handle.string().c_str(),
+                   this->mode.c_str());
+
+  if (this->fp == NULL) {
+    std::ostringstream oss;
+    oss << "could not open compressed file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (this->writing) {
+
+    if (this->cctx == NULL)
+      this->cctx = ZSTD_createCCtx();
+    else
+      ZSTD_CCtx_reset(this->cctx, ZSTD_reset_session_only);
+
+    if (this->cctx == NULL) {
+      fclose(this->fp);
+      this->fp = NULL;
+      throw CArchiveIssue("could not allocate zstd compression context");
+    }
+
+    if (this->compressionLevel > 0)
+      ZSTD_CCtx_setParameter(this->cctx, ZSTD_c_compressionLevel,
+                             this->compressionLevel);
+
+    /*
+     * With workers, libzstd compresses in its own thread pool
+     * and ZSTD_compressStream2() doesn't block anymore. Always set
+     * this, since a reused context keeps its former parameters.
+     */
+    size_t rc = ZSTD_CCtx_setParameter(this->cctx, ZSTD_c_nbWorkers,
+                                       this->compressionWorkers);
+
+    if (ZSTD_isError(rc)) {
+      std::ostringstream oss;
+      fclose(this->fp);
+      this->fp = NULL;
+      oss << "could not use " << this->compressionWorkers
+          << " zstd compression workers: "
+          << ZSTD_getErrorName(rc);
+      throw CArchiveIssue(oss.str());
+    }
+
+    this->buffer.resize(ZSTD_CStreamOutSize());
+
+  } else {
+
+    if (this->dctx == NULL)
+      this->dctx = ZSTD_createDCtx();
+    else
+      ZSTD_DCtx_reset(this->dctx, ZSTD_reset_session_only);
+
+    if (this->dctx == NULL) {
+      fclose(this->fp);
+      this->fp = NULL;
+      throw CArchiveIssue("could not allocate zstd decompression context");
+    }
+
+    this->buffer.resize(ZSTD_DStreamInSize());
+    this->input.src  = this->buffer.data();
+    this->input.size = 0;
+    this->input.pos  = 0;
+
+  }
+
+  this->currpos = 0;
+  this->opened = true;
+
+}
+
+void ZstdArchiveFile::flushStream(bool end) {
+
+  ZSTD_inBuffer in = { NULL, 0, 0 };
+  size_t remaining;
+
+  do {
+
+    ZSTD_outBuffer out = { this->buffer.data(), this->buffer.size(), 0 };
+
+    remaining = ZSTD_compressStream2(this->cctx, &out, &in,
+                                     end ? ZSTD_e_end : ZSTD_e_flush);
+
+    if (ZSTD_isError(remaining)) {
+      std::ostringstream oss;
+      oss << "could not flush compressed file \""
+          << this->handle.string() << "\": "
+          << ZSTD_getErrorName(remaining);
+      throw CArchiveIssue(oss.str());
+    }
+
+    if (out.pos > 0 && fwrite(out.dst, out.pos, 1, this->fp) != 1) {
+      std::ostringstream oss;
+      oss << "write error for file \""
+          << this->handle.string() << "\": "
+          << strerror(errno);
+      throw CArchiveIssue(oss.str());
+    }
+
+  } while (remaining > 0);
+
+}
+
+size_t ZstdArchiveFile::write(const char *buf, size_t len) {
+
+  ZSTD_inBuffer in = { buf, len, 0 };
+
+  if (!this->isOpen() || !this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to write into file not opened for writing "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  while (in.pos < in.size) {
+
+    ZSTD_outBuffer out = { this->buffer.data(), this->buffer.size(), 0 };
+    size_t rc = ZSTD_compressStream2(this->cctx, &out, &in, ZSTD_e_continue);
+
+    if (ZSTD_isError(rc)) {
+      std::ostringstream oss;
+      oss << "unable to compress "
+          << len << " "
+          << "bytes to file "
+          << "\"" << this->handle.string() << "\": "
+          << ZSTD_getErrorName(rc);
+      throw CArchiveIssue(oss.str());
+    }
+
+    if (out.pos > 0 && fwrite(out.dst, out.pos, 1, this->fp) != 1) {
+      std::ostringstream oss;
+      oss << "write error for file (size="
+          << len
+          << ")"
+          << this->handle.string()
+          << ": "
+          << strerror(errno);
+      throw CArchiveIssue(oss.str());
+    }
+
+  }
+
+  this->currpos += len;
+  return len;
+
+}
+
+size_t ZstdArchiveFile::read(char *buf, size_t len) {
+
+  size_t produced = 0;
+  bool eof = false;
+
+  if (!this->isOpen() || this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to read from file not opened for reading "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  while (produced < len) {
+
+    ZSTD_outBuffer out = { buf + produced, len - produced, 0 };
+    size_t rc;
+
+    if (this->input.pos == this->input.size && !eof) {
+
+      size_t rbytes = fread(this->buffer.data(), 1, this->buffer.size(), this->fp);
+
+      if (rbytes == 0) {
+
+        if (ferror(this->fp)) {
+          std::ostringstream oss;
+          oss << "read error for file \""
+              << this->handle.string() << "\": "
+              << strerror(errno);
+          throw CArchiveIssue(oss.str());
+        }
+
+        eof = true;
+
+      } else {
+
+        this->input.src  = this->buffer.data();
+        this->input.size = rbytes;
+        this->input.pos  = 0;
+
+      }
+
+    }
+
+    rc = ZSTD_decompressStream(this->dctx, &out, &this->input);
+
+    if (ZSTD_isError(rc)) {
+      std::ostringstream oss;
+      oss << "could not decompress file \""
+          << this->handle.string() << "\": "
+          << ZSTD_getErrorName(rc);
+      throw CArchiveIssue(oss.str());
+    }
+
+    produced += out.pos;
+
+    /* nothing left to decompress */
+    if (eof && out.pos == 0)
+      break;
+
+  }
+
+  this->currpos += produced;
+  return produced;
+
+}
+
+void ZstdArchiveFile::fsync() {
+
+  if (this->fp == NULL) {
+    std::ostringstream oss;
+    oss << "attempt to fsync uninitialized file \""
+        << this->handle.string() << "\"";
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (this->writing)
+    this->flushStream(false);
+
+  fflush(this->fp);
+
+  if (::fsync(fileno(this->fp)) != 0) {
+    std::ostringstream oss;
+    oss << "error fsyncing file \""
+        << this->handle.string()
+        << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+void ZstdArchiveFile::close() {
+
+  /* nothing to do, e.g. after rename() */
+  if (!this->isOpen())
+    return;
+
+  this->opened = false;
+
+  if (this->writing) {
+
+    try {
+      this->flushStream(true);
+    } catch(CArchiveIssue &e) {
+      fclose(this->fp);
+      this->fp = NULL;
+      throw e;
+    }
+
+  }
+
+  if (fclose(this->fp) != 0) {
+    std::ostringstream oss;
+    this->fp = NULL;
+    oss << "could not close file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->fp = NULL;
+  this->currpos = 0;
+
+}
+
+void ZstdArchiveFile::rename(path& newname) {
+
+  if (boost::filesystem::exists(status(newname))) {
+    std::ostringstream oss;
+    oss << "cannot rename "
+        << this->handle.string()
+        << " to "
+        << newname.string()
+        << ": file exists";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * Finish the compressed stream and make sure
+   * it's on disk before renaming it.
+   */
+  if (this->isOpen()) {
+    this->close();
+    RootDirectory::fsync(this->handle);
+  }
+
+  if (::rename(this->handle.string().c_str(),
+               newname.string().c_str()) < 0) {
+    std::ostringstream oss;
+    oss << "could not rename file \""
+        << this->handle.string()
+        << "\" to \""
+        << newname.string()
+        << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->handle = newname;
+
+}
+
+off_t ZstdArchiveFile::lseek(off_t offset, int whence) {
+
+  if (!this->isOpen()) {
+    std::ostringstream oss;
+    oss << "cannot seek in file "
+        << this->handle.string()
+        << ": not opened";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * We can't seek into a compressed stream, but allow
+   * no-op requests, e.g. rewinding a new file.
+   */
+  if (offset == 0
+      && (whence == SEEK_CUR || (whence == SEEK_SET && this->currpos == 0)))
+    return 0;
+
+  throw CArchiveIssue("seeking in zstd compressed file "
+                      + this->handle.string()
+                      + " not supported");
+
+}
+
+off_t ZstdArchiveFile::syncPoint() {
+
+  off_t pos;
+
+  if (!this->isOpen() || !this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to finish zstd frame of file not opened for writing "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * Ending the frame doesn't end the stream, the next write()
+   * starts a new frame, which doesn't reference the former one.
+   */
+  this->flushStream(true);
+
+  if ((pos = ::ftello(this->fp)) < 0) {
+    std::ostringstream oss;
+    oss << "could not get position in file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  return pos;
+
+}
+
+void ZstdArchiveFile::seekSyncPoint(off_t offset) {
+
+  if (!this->isOpen() || this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to seek in zstd file not opened for reading "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (::fseeko(this->fp, offset, SEEK_SET) < 0) {
+    std::ostringstream oss;
+    oss << "could not seek in file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  /* Forget about buffered input of the former frame */
+  ZSTD_DCtx_reset(this->dctx, ZSTD_reset_session_only);
+  this->input.src  = this->buffer.data();
+  this->input.size = 0;
+  this->input.pos  = 0;
+  this->currpos = 0;
+
+}
+
+void ZstdArchiveFile::remove() {
+
+  if (this->isOpen())
+    throw CArchiveIssue("cannot remove file still referenced by handle");
+
+  if (unlink(this->handle.string().c_str()) != 0) {
+    std::ostringstream oss;
+    oss << "cannot unlink file \"" << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+
+/******************************************************************************
+ * Implementation of LZ4ArchiveFile
+ *****************************************************************************/
+
+/*
+ * Size of input chunks we pass to LZ4F_compressUpdate().
+ */
+#define LZ4_ARCHIVE_CHUNK_SIZE (64 * 1024)
+
+LZ4ArchiveFile::LZ4ArchiveFile(path pathHandle) : BackupFile(pathHandle) {
+  this->compressed = true;
+}
+
+LZ4ArchiveFile::~LZ4ArchiveFile() {
+
+  if (this->isOpen()) {
+
+    try {
+      this->close();
+    } catch(CArchiveIssue &e) {
+      BOOST_LOG_TRIVIAL(error) << e.what();
+    }
+
+  }
+
+  if (this->cctx != NULL)
+    LZ4F_freeCompressionContext(this->cctx);
+
+  if (this->dctx != NULL)
+    LZ4F_freeDecompressionContext(this->dctx);
+
+}
+
+bool LZ4ArchiveFile::isCompressed() {
+  return true;
+}
+
+void LZ4ArchiveFile::setCompressed(bool compressed) {
+  if (!compressed)
+    throw CArchiveIssue("attempt to set uncompressed flag to compressed lz4 file handle");
+}
+
+bool LZ4ArchiveFile::isOpen() {
+  return this->opened;
+}
+
+void LZ4ArchiveFile::setOpenMode(std::string mode) {
+  this->mode = mode;
+}
+
+std::string LZ4ArchiveFile::getOpenMode() {
+  return this->mode;
+}
+
+void LZ4ArchiveFile::setCompressionLevel(int level) {
+
+  if (this->isOpen())
+    throw CArchiveIssue("cannot change compression level of opened file "
+                        + this->handle.string());
+
+  if (level < 0 || level > LZ4F_compressionLevel_max()) {
+    std::ostringstream oss;
+    oss << "invalid lz4 compression level " << level;
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->compressionLevel = level;
+
+}
+
+void LZ4ArchiveFile::writeBuffer(size_t len) {
+
+  if (len > 0 && fwrite(this->buffer.data(), len, 1, this->fp) != 1) {
+    std::ostringstream oss;
+    oss << "write error for file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+void LZ4ArchiveFile::open() {
+
+  LZ4F_errorCode_t rc;
+
+  if (this->fp != NULL) {
+    std::ostringstream oss;
+    oss << "error opening "
+        << "\""
+        << this->handle.string()
+        << "\": "
+        << "file handle already initialized";
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (this->temporary)
+    throw CArchiveIssue("temporary compressed archive files currently not supported");
+
+  this->writing = (this->mode.find_first_of("wa") != std::string::npos);
+
+  this->fp = fopen(this->handle.string().c_str(),
+                   this->mode.c_str());
+
+  if (this->fp == NULL) {
+    std::ostringstream oss;
+    oss << "could not open compressed file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (this->writing) {
+
+    LZ4F_preferences_t prefs;
+    size_t hdrlen;
+
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.compressionLevel = this->compressionLevel;
+
+    if (this->cctx == NULL) {
+      rc = LZ4F_createCompressionContext(&this->cctx, LZ4F_VERSION);
+
+      if (LZ4F_isError(rc)) {
+        fclose(this->fp);
+        this->fp = NULL;
+        throw CArchiveIssue(std::string("could not allocate lz4 compression context: ")
+                            + LZ4F_getErrorName(rc));
+      }
+    }
+
+    /*
+     * LZ4F_compressBound() covers the worst case including
+     * a flush, make sure the frame header fits in, too.
+     */
+    this->buffer.resize(LZ4F_compressBound(LZ4_ARCHIVE_CHUNK_SIZE, &prefs)
+                        + LZ4F_HEADER_SIZE_MAX);
+
+    hdrlen = LZ4F_compressBegin(this->cctx,
+                                this->buffer.data(), this->buffer.size(),
+                                &prefs);
+
+    if (LZ4F_isError(hdrlen)) {
+      fclose(this->fp);
+      this->fp = NULL;
+      throw CArchiveIssue(std::string("could not start lz4 frame: ")
+                          + LZ4F_getErrorName(hdrlen));
+    }
+
+    this->writeBuffer(hdrlen);
+
+  } else {
+
+    if (this->dctx == NULL) {
+      rc = LZ4F_createDecompressionContext(&this->dctx, LZ4F_VERSION);
+
+      if (LZ4F_isError(rc)) {
+        fclose(this->fp);
+        this->fp = NULL;
+        throw CArchiveIssue(std::string("could not allocate lz4 decompression context: ")
+                            + LZ4F_getErrorName(rc));
+      }
+    } else {
+      LZ4F_resetDecompressionContext(this->dctx);
+    }
+
+    this->buffer.resize(LZ4_ARCHIVE_CHUNK_SIZE);
+    this->input_pos = this->input_size = 0;
+
+  }
+
+  this->currpos = 0;
+  this->opened = true;
+
+}
+
+size_t LZ4ArchiveFile::write(const char *buf, size_t len) {
+
+  size_t written = 0;
+
+  if (!this->isOpen() || !this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to write into file not opened for writing "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  while (written < len) {
+
+    size_t chunk = std::min((size_t) LZ4_ARCHIVE_CHUNK_SIZE, len - written);
+    size_t clen  = LZ4F_compressUpdate(this->cctx,
+                                       this->buffer.data(), this->buffer.size(),
+                                       buf + written, chunk, NULL);
+
+    if (LZ4F_isError(clen)) {
+      std::ostringstream oss;
+      oss << "unable to compress "
+          << len << " "
+          << "bytes to file "
+          << "\"" << this->handle.string() << "\": "
+          << LZ4F_getErrorName(clen);
+      throw CArchiveIssue(oss.str());
+    }
+
+    this->writeBuffer(clen);
+    written += chunk;
+
+  }
+
+  this->currpos += len;
+  return len;
+
+}
+
+size_t LZ4ArchiveFile::read(char *buf, size_t len) {
+
+  size_t produced = 0;
+  bool eof = false;
+
+  if (!this->isOpen() || this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to read from file not opened for reading "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  while (produced < len) {
+
+    size_t dstlen = len - produced;
+    size_t srclen;
+    size_t rc;
+
+    if (this->input_pos == this->input_size && !eof) {
+
+      size_t rbytes = fread(this->buffer.data(), 1, this->buffer.size(), this->fp);
+
+      if (rbytes == 0) {
+
+        if (ferror(this->fp)) {
+          std::ostringstream oss;
+          oss << "read error for file \""
+              << this->handle.string() << "\": "
+              << strerror(errno);
+          throw CArchiveIssue(oss.str());
+        }
+
+        eof = true;
+
+      } else {
+
+        this->input_pos  = 0;
+        this->input_size = rbytes;
+
+      }
+
+    }
+
+    srclen = this->input_size - this->input_pos;
+    rc = LZ4F_decompress(this->dctx, buf + produced, &dstlen,
+                         this->buffer.data() + this->input_pos, &srclen,
+                         NULL);
+
+    if (LZ4F_isError(rc)) {
+      std::ostringstream oss;
+      oss << "could not decompress file \""
+          << this->handle.string() << "\": "
+          << LZ4F_getErrorName(rc);
+      throw CArchiveIssue(oss.str());
+    }
+
+    this->input_pos += srclen;
+    produced += dstlen;
+
+    /* nothing left to decompress */
+    if (eof && dstlen == 0)
+      break;
+
+  }
+
+  this->currpos += produced;
+  return produced;
+
+}
+
+void LZ4ArchiveFile::fsync() {
+
+  if (this->fp == NULL) {
+    std::ostringstream oss;
+    oss << "attempt to fsync uninitialized file \""
+        << this->handle.string() << "\"";
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (this->writing) {
+
+    size_t clen = LZ4F_flush(this->cctx,
+                             this->buffer.data(), this->buffer.size(),
+                             NULL);
+
+    if (LZ4F_isError(clen)) {
+      std::ostringstream oss;
+      oss << "could not flush compressed file \""
+          << this->handle.string() << "\": "
+          << LZ4F_getErrorName(clen);
+      throw CArchiveIssue(oss.str());
+    }
+
+    this->writeBuffer(clen);
+
+  }
+
+  fflush(this->fp);
+
+  if (::fsync(fileno(this->fp)) != 0) {
+    std::ostringstream oss;
+    oss << "error fsyncing file \""
+        << this->handle.string()
+        << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+void LZ4ArchiveFile::close() {
+
+  /* nothing to do, e.g. after rename() */
+  if (!this->isOpen())
+    return;
+
+  this->opened = false;
+
+  if (this->writing) {
+
+    size_t clen = LZ4F_compressEnd(this->cctx,
+                                   this->buffer.data(), this->buffer.size(),
+                                   NULL);
+
+    try {
+
+      if (LZ4F_isError(clen)) {
+        throw CArchiveIssue(std::string("could not finish lz4 frame: ")
+                            + LZ4F_getErrorName(clen));
+      }
+
+      this->writeBuffer(clen);
+
+    } catch(CArchiveIssue &e) {
+      fclose(this->fp);
+      this->fp = NULL;
+      throw e;
+    }
+
+  }
+
+  if (fclose(this->fp) != 0) {
+    std::ostringstream oss;
+    this->fp = NULL;
+    oss << "could not close file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->fp = NULL;
+  this->currpos = 0;
+
+}
+
+void LZ4ArchiveFile::rename(path& newname) {
+
+  if (boost::filesystem::exists(status(newname))) {
+    std::ostringstream oss;
+    oss << "cannot rename "
+        << this->handle.string()
+        << " to "
+        << newname.string()
+        << ": file exists";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * Finish the compressed frame and make sure
+   * it's on disk before renaming it.
+   */
+  if (this->isOpen()) {
+    this->close();
+    RootDirectory::fsync(this->handle);
+  }
+
+  if (::rename(this->handle.string().c_str(),
+               newname.string().c_str()) < 0) {
+    std::ostringstream oss;
+    oss << "could not rename file \""
+        << this->handle.string()
+        << "\" to \""
+        << newname.string()
+        << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->handle = newname;
+
+}
+
+off_t LZ4ArchiveFile::lseek(off_t offset, int whence) {
+
+  if (!this->isOpen()) {
+    std::ostringstream oss;
+    oss << "cannot seek in file "
+        << this->handle.string()
+        << ": not opened";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * We can't seek into a compressed stream, but allow
+   * no-op requests, e.g. rewinding a new file.
+   */
+  if (offset == 0
+      && (whence == SEEK_CUR || (whence == SEEK_SET && this->currpos == 0)))
+    return 0;
+
+  throw CArchiveIssue("seeking in lz4 compressed file "
+                      + this->handle.string()
+                      + " not supported");
+
+}
+
+off_t LZ4ArchiveFile::syncPoint() {
+
+  LZ4F_preferences_t prefs;
+  size_t clen;
+  off_t pos;
+
+  if (!this->isOpen() || !this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to finish lz4 frame of file not opened for writing "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * End the current frame and start a new one with the same
+   * preferences. lz4 decompresses concatenated frames as one
+   * stream, but each frame can also be decompressed on its own.
+   */
+  clen = LZ4F_compressEnd(this->cctx,
+                          this->buffer.data(), this->buffer.size(),
+                          NULL);
+
+  if (LZ4F_isError(clen)) {
+    throw CArchiveIssue(std::string("could not finish lz4 frame: ")
+                        + LZ4F_getErrorName(clen));
+  }
+
+  this->writeBuffer(clen);
+
+  if ((pos = ::ftello(this->fp)) < 0) {
+    std::ostringstream oss;
+    oss << "could not get position in file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  memset(&prefs, 0, sizeof(prefs));
+  prefs.compressionLevel = this->compressionLevel;
+
+  clen = LZ4F_compressBegin(this->cctx,
+                            this->buffer.data(), this->buffer.size(),
+                            &prefs);
+
+  if (LZ4F_isError(clen)) {
+    throw CArchiveIssue(std::string("could not start lz4 frame: ")
+                        + LZ4F_getErrorName(clen));
+  }
+
+  this->writeBuffer(clen);
+  return pos;
+
+}
+
+void LZ4ArchiveFile::seekSyncPoint(off_t offset) {
+
+  if (!this->isOpen() || this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to seek in lz4 file not opened for reading "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (::fseeko(this->fp, offset, SEEK_SET) < 0) {
+    std::ostringstream oss;
+    oss << "could not seek in file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  /* Forget about buffered input of the former frame */
+  LZ4F_resetDecompressionContext(this->dctx);
+  this->input_pos = this->input_size = 0;
+  this->currpos = 0;
+
+}
+
+void LZ4ArchiveFile::remove() {
+
+  if (this->isOpen())
+    throw CArchiveIssue("cannot remove file still referenced by handle");
+
+  if (unlink(this->handle.string().c_str()) != 0) {
+    std::ostringstream oss;
+    oss << "cannot unlink file \"" << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZMA
+
+/******************************************************************************
+ * Implementation of XZArchiveFile
+ *****************************************************************************/
+
+/*
+ * Size of the compressed data buffer.
+ */
+#define XZ_ARCHIVE_BUFFER_SIZE (64 * 1024)
+
+XZArchiveFile::XZArchiveFile(path pathHandle) : BackupFile(pathHandle) {
+  this->compressed = true;
+}
+
+XZArchiveFile::~XZArchiveFile() {
+
+  if (this->isOpen()) {
+
+    /*
+     * Don't leak file handles, but don't throw
+     * from a destructor either.
+     */
+    try {
+      this->close();
+    } catch(CArchiveIssue &e) {
+      BOOST_LOG_TRIVIAL(error) << e.what();
+    }
+
+  }
+
+  lzma_end(&this->strm);
+
+}
+
+std::string XZArchiveFile::errorMessage(lzma_ret rc) {
+
+  switch(rc) {
+  case LZMA_MEM_ERROR:
+    return "out of memory";
+  case LZMA_MEMLIMIT_ERROR:
+    return "memory usage limit reached";
+  case LZMA_FORMAT_ERROR:
+    return "file format not recognized";
+  case LZMA_OPTIONS_ERROR:
+    return "unsupported compression options";
+  case LZMA_DATA_ERROR:
+    return "compressed data is corrupt";
+  case LZMA_BUF_ERROR:
+    return "compressed data is truncated or corrupt";
+  case LZMA_UNSUPPORTED_CHECK:
+    return "unsupported integrity check";
+  default:
+    {
+      std::ostringstream oss;
+      oss << "liblzma error " << rc;
+      return oss.str();
+    }
+  }
+
+}
+
+bool XZArchiveFile::isCompressed() {
+  return true;
+}
+
+void XZArchiveFile::setCompressed(bool compressed) {
+  if (!compressed)
+    throw CArchiveIssue("attempt to set uncompressed flag to compressed xz file handle");
+}
+
+bool XZArchiveFile::isOpen() {
+  return this->opened;
+}
+
+void XZArchiveFile::setOpenMode(std::string mode) {
+  this->mode = mode;
+}
+
+std::string XZArchiveFile::getOpenMode() {
+  return this->mode;
+}
+
+void XZArchiveFile::setCompressionLevel(int level) {
+
+  if (this->isOpen())
+    throw CArchiveIssue("cannot change compression level of opened file "
+                        + this->handle.string());
+
+  if (level < 0 || level > 9) {
+    std::ostringstream oss;
+    oss << "invalid xz compression level " << level;
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->compressionLevel = level;
+
+}
+
+void XZArchiveFile::setCompressionWorkers(int workers) {
+
+  if (this->isOpen())
+    throw CArchiveIssue("cannot change compression workers of opened file "
+                        + this->handle.string());
+
+  /*
+   * liblzma itself rejects too many threads when
+   * initializing the encoder in open().
+   */
+  if (workers < 0) {
+    std::ostringstream oss;
+    oss << "invalid number of xz compression workers " << workers;
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->compressionWorkers = workers;
+
+}
+
+void XZArchiveFile::open() {
+
+  lzma_ret rc;
+
+  if (this->fp != NULL) {
+    std::ostringstream oss;
+    oss << "error opening "
+        << "\""
+        << this->handle.string()
+        << "\": "
+        << "file handle already initialized";
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (this->temporary)
+    throw CArchiveIssue("temporary compressed archive files currently not supported");
+
+  this->writing = (this->mode.find_first_of("wa") != std::string::npos);
+
+  this->fp = fopen(this->handle.string().c_str(),
+                   this->mode.c_str());
+
+  if (this->fp == NULL) {
+    std::ostringstream oss;
+    oss << "could not open compressed file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * Initializing an already used lzma_stream again is fine,
+   * liblzma reuses its allocations if possible.
+   */
+  if (this->writing) {
+
+    if (this->compressionWorkers > 1) {
+
+      /*
+       * The multithreaded encoder splits the input into
+       * blocks (three times the dictionary size of the preset by
+       * default) and compresses them in parallel.
+       */
+      lzma_mt mt;
+
+      memset(&mt, 0, sizeof(mt));
+      mt.threads = this->compressionWorkers;
+      mt.preset  = this->compressionLevel;
+      mt.check   = LZMA_CHECK_CRC64;
+
+      rc = lzma_stream_encoder_mt(&this->strm, &mt);
+
+    } else {
+
+      rc = lzma_easy_encoder(&this->strm, this->compressionLevel, LZMA_CHECK_CRC64);
+
+    }
+
+  } else {
+
+    rc = lzma_stream_decoder(&this->strm, UINT64_MAX, LZMA_CONCATENATED);
+
+  }
+
+  if (rc != LZMA_OK) {
+    std::ostringstream oss;
+    fclose(this->fp);
+    this->fp = NULL;
+    oss << "could not initialize xz stream for file \""
+        << this->handle.string() << "\": "
+        << XZArchiveFile::errorMessage(rc);
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->buffer.resize(XZ_ARCHIVE_BUFFER_SIZE);
+  this->strm.next_in  = NULL;
+  this->strm.avail_in = 0;
+
+  this->stream_end = false;
+  this->currpos = 0;
+  this->opened = true;
+
+}
+
+void XZArchiveFile::code(lzma_action action) {
+
+  lzma_ret rc;
+
+  do {
+
+    this->strm.next_out  = (uint8_t *) this->buffer.data();
+    this->strm.avail_out = this->buffer.size();
+
+    rc = lzma_code(&this->strm, action);
+
+    if (rc != LZMA_OK && rc != LZMA_STREAM_END) {
+      std::ostringstream oss;
+      oss << "could not compress data into file \""
+          << this->handle.string() << "\": "
+          << XZArchiveFile::errorMessage(rc);
+      throw CArchiveIssue(oss.str());
+    }
+
+    size_t produced = this->buffer.size() - this->strm.avail_out;
+
+    if (produced > 0 && fwrite(this->buffer.data(), produced, 1, this->fp) != 1) {
+      std::ostringstream oss;
+      oss << "write error for file \""
+          << this->handle.string() << "\": "
+          << strerror(errno);
+      throw CArchiveIssue(oss.str());
+    }
+
+    /*
+     * LZMA_RUN is done as soon as all input was consumed, flushing
+     * and finishing the stream is done once liblzma tells us so.
+     */
+    if (action == LZMA_RUN && this->strm.avail_in == 0)
+      break;
+
+  } while (rc != LZMA_STREAM_END);
+
+}
+
+size_t XZArchiveFile::write(const char *buf, size_t len) {
+
+  if (!this->isOpen() || !this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to write into file not opened for writing "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->strm.next_in  = (const uint8_t *) buf;
+  this->strm.avail_in = len;
+
+  this->code(LZMA_RUN);
+
+  this->currpos += len;
+  return len;
+
+}
+
+size_t XZArchiveFile::read(char *buf, size_t len) {
+
+  size_t produced = 0;
+  bool eof = false;
+
+  if (!this->isOpen() || this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to read from file not opened for reading "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  while (produced < len && !this->stream_end) {
+
+    lzma_ret rc;
+
+    if (this->strm.avail_in == 0 && !eof) {
+
+      size_t rbytes = fread(this->buffer.data(), 1, this->buffer.size(), this->fp);
+
+      if (rbytes == 0) {
+
+        if (ferror(this->fp)) {
+          std::ostringstream oss;
+          oss << "read error for file \""
+              << this->handle.string() << "\": "
+              << strerror(errno);
+          throw CArchiveIssue(oss.str());
+        }
+
+        eof = true;
+
+      } else {
+
+        this->strm.next_in  = (const uint8_t *) this->buffer.data();
+        this->strm.avail_in = rbytes;
+
+      }
+
+    }
+
+    this->strm.next_out  = (uint8_t *) (buf + produced);
+    this->strm.avail_out = len - produced;
+
+    rc = lzma_code(&this->strm, eof ? LZMA_FINISH : LZMA_RUN);
+    produced = len - this->strm.avail_out;
+
+    if (rc == LZMA_STREAM_END) {
+      this->stream_end = true;
+    } else if (rc != LZMA_OK) {
+      std::ostringstream oss;
+      oss << "could not decompress file \""
+          << this->handle.string() << "\": "
+          << XZArchiveFile::errorMessage(rc);
+      throw CArchiveIssue(oss.str());
+    }
+
+  }
+
+  this->currpos += produced;
+  return produced;
+
+}
+
+void XZArchiveFile::fsync() {
+
+  if (this->fp == NULL) {
+    std::ostringstream oss;
+    oss << "attempt to fsync uninitialized file \""
+        << this->handle.string() << "\"";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * xz doesn't support sync flushes, LZMA_FULL_FLUSH finishes
+   * the current block instead. Both encoders support this.
+   */
+  if (this->writing)
+    this->code(LZMA_FULL_FLUSH);
+
+  fflush(this->fp);
+
+  if (::fsync(fileno(this->fp)) != 0) {
+    std::ostringstream oss;
+    oss << "error fsyncing file \""
+        << this->handle.string()
+        << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+void XZArchiveFile::close() {
+
+  /* nothing to do, e.g. after rename() */
+  if (!this->isOpen())
+    return;
+
+  this->opened = false;
+
+  if (this->writing) {
+
+    try {
+      this->strm.next_in  = NULL;
+      this->strm.avail_in = 0;
+      this->code(LZMA_FINISH);
+    } catch(CArchiveIssue &e) {
+      fclose(this->fp);
+      this->fp = NULL;
+      throw e;
+    }
+
+  }
+
+  if (fclose(this->fp) != 0) {
+    std::ostringstream oss;
+    this->fp = NULL;
+    oss << "could not close file \""
+        << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->fp = NULL;
+  this->currpos = 0;
+
+}
+
+void XZArchiveFile::rename(path& newname) {
+
+  if (boost::filesystem::exists(status(newname))) {
+    std::ostringstream oss;
+    oss << "cannot rename "
+        << this->handle.string()
+        << " to "
+        << newname.string()
+        << ": file exists";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * Finish the compressed stream and make sure
+   * it's on disk before renaming it.
+   */
+  if (this->isOpen()) {
+    this->close();
+    RootDirectory::fsync(this->handle);
+  }
+
+  if (::rename(this->handle.string().c_str(),
+               newname.string().c_str()) < 0) {
+    std::ostringstream oss;
+    oss << "could not rename file \""
+        << this->handle.string()
+        << "\" to \""
+        << newname.string()
+        << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->handle = newname;
+
+}
+
+off_t XZArchiveFile::lseek(off_t offset, int whence) {
+
+  if (!this->isOpen()) {
+    std::ostringstream oss;
+    oss << "cannot seek in file "
+        << this->handle.string()
+        << ": not opened";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * We can't seek into a compressed stream, but allow
+   * no-op requests, e.g. rewinding a new file.
+   */
+  if (offset == 0
+      && (whence == SEEK_CUR || (whence == SEEK_SET && this->currpos == 0)))
+    return 0;
+
+  throw CArchiveIssue("seeking in xz compressed file "
+                      + this->handle.string()
+                      + " not supported");
+
+}
+
+void XZArchiveFile::remove() {
+
+  if (this->isOpen())
+    throw CArchiveIssue("cannot remove file still referenced by handle");
+
+  if (unlink(this->handle.string().c_str()) != 0) {
+    std::ostringstream oss;
+    oss << "cannot unlink file \"" << this->handle.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+#endif
+
+/******************************************************************************
+ * Implementation of ArchiveWriterPool
+ ******************************************************************************/
+
+ArchiveWriterPool::ArchiveWriterPool(unsigned int num_writers) {
+
+  if (num_writers == 0)
+    throw CArchiveIssue("archive writer pool requires at least one writer");
+
+  this->writers.resize(num_writers);
+
+}
+
+ArchiveWriterPool::~ArchiveWriterPool() {
+
+  /*
+   * Don't leave any threads behind, but don't throw
+   * from a destructor either.
+   */
+  try {
+    this->stop();
+  } catch(CArchiveIssue &e) {
+    BOOST_LOG_TRIVIAL(error) << e.what();
+  }
+
+}
+
+unsigned int ArchiveWriterPool::size() {
+  return this->writers.size();
+}
+
+void ArchiveWriterPool::checkFailed() {
+
+  if (this->failed) {
+
+    std::ostringstream oss;
+    oss << "archive writer failed: " << this->error_message;
+    throw CArchiveIssue(oss.str());
+
+  }
+
+}
+
+void ArchiveWriterPool::start() {
+
+  std::lock_guard<std::mutex> lock(this->pool_mutex);
+
+  if (this->running)
+    throw CArchiveIssue("archive writer pool already started");
+
+  this->running = true;
+
+  for (unsigned int i = 0; i < this->writers.size(); i++) {
+    this->writers[i].thread = std::make_shared<std::thread>(&ArchiveWriterPool::work, this, i);
+  }
+
+}
+
+void ArchiveWriterPool::push(unsigned int writer_id,
+                             ArchiveWriteRequest &request) {
+
+  std::unique_lock<std::mutex> lock(this->pool_mutex);
+  size_t len = request.data.size();
+
+  if (writer_id >= this->writers.size()) {
+    std::ostringstream oss;
+    oss << "invalid archive writer id " << writer_id;
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->checkFailed();
+
+  if (!this->running)
+    throw CArchiveIssue("attempt to push into a stopped archive writer pool");
+
+  ArchiveWriter &writer = this->writers[writer_id];
+
+  /*
+   * Park as long as the writer has too much queued. A single
+   * request is always accepted by an empty queue, regardless of its
+   * size.
+   */
+  this->receiver_cond.wait(lock, [this, &writer, len] {
+      return this->failed
+        || writer.queued_bytes == 0
+        || (writer.queued_bytes + len) <= ARCHIVE_WRITER_MAX_QUEUED;
+    });
+
+  this->checkFailed();
+
+  writer.queued_bytes += len;
+  writer.queue.push_back(std::move(request));
+  this->writer_cond.notify_all();
+
+}
+
+void ArchiveWriterPool::drain() {
+
+  std::unique_lock<std::mutex> lock(this->pool_mutex);
+
+  this->receiver_cond.wait(lock, [this] {
+
+      if (this->failed)
+        return true;
+
+      for (auto &writer : this->writers) {
+        if (!writer.queue.empty() || writer.busy)
+          return false;
+      }
+
+      return true;
+
+    });
+
+  this->checkFailed();
+
+}
+
+void ArchiveWriterPool::stop() {
+
+  {
+    std::lock_guard<std::mutex> lock(this->pool_mutex);
+
+    if (!this->running)
+      return;
+
+    /*
+     * Writers empty their queues before they exit.
+     */
+    this->running = false;
+    this->writer_cond.notify_all();
+  }
+
+  for (auto &writer : this->writers) {
+
+    if (writer.thread != nullptr && writer.thread->joinable())
+      writer.thread->join();
+
+    writer.thread = nullptr;
+
+  }
+
+  std::lock_guard<std::mutex> lock(this->pool_mutex);
+  this->checkFailed();
+
+}
+
+void ArchiveWriterPool::work(unsigned int writer_id) {
+
+  ArchiveWriter &writer = this->writers[writer_id];
+
+  while (true) {
+
+    ArchiveWriteRequest request;
+    std::unique_lock<std::mutex> lock(this->pool_mutex);
+
+    this->writer_cond.wait(lock, [this, &writer] {
+        return !writer.queue.empty() || !this->running || this->failed;
+      });
+
+    /*
+     * Another writer failed, the whole backup is lost
+     * anyways, so don't bother to write anything more.
+     */
+    if (this->failed)
+      break;
+
+    if (writer.queue.empty()) {
+
+      /* empty queue and asked to stop */
+      break;
+
+    }
+
+    request = std::move(writer.queue.front());
+    writer.queue.pop_front();
+    writer.busy = true;
+
+    lock.unlock();
+
+    try {
+
+      switch(request.op) {
+
+      case ARCHIVE_WRITE_DATA:
+        request.file->write(request.data.data(), request.data.size());
+        break;
+
+      case ARCHIVE_WRITE_FSYNC:
+        request.file->fsync();
+        break;
+
+      case ARCHIVE_WRITE_CLOSE:
+        request.file->close();
+        break;
+
+      }
+
+    } catch (std::exception &e) {
+
+      lock.lock();
+      this->error_message = e.what();
+      this->failed = true;
+      writer.busy = false;
+      this->receiver_cond.notify_all();
+      this->writer_cond.notify_all();
+      break;
+
+    }
+
+    lock.lock();
+    writer.queued_bytes -= request.data.size();
+    writer.busy = false;
+    this->receiver_cond.notify_all();
+
+  }
+
+}
+
+/******************************************************************************
+ * Implementation of PipelinedArchiveFile
+ ******************************************************************************/
+
+PipelinedArchiveFile::PipelinedArchiveFile(std::shared_ptr<BackupFile> file,
+                                           std::shared_ptr<ArchiveWriterPool> pool,
+                                           unsigned int writer_id)
+  : BackupFile(path(file->getFilePath())) {
+
+  if (pool == nullptr)
+    throw CArchiveIssue("pipelined archive file requires a writer pool");
+
+  this->file = file;
+  this->pool = pool;
+  this->writer_id = writer_id;
+  this->compressed = file->isCompressed();
+
+}
+
+PipelinedArchiveFile::~PipelinedArchiveFile() {}
+
+bool PipelinedArchiveFile::isCompressed() {
+  return this->file->isCompressed();
+}
+
+bool PipelinedArchiveFile::isOpen() {
+  return this->opened;
+}
+
+void PipelinedArchiveFile::setOpenMode(std::string mode) {
+  this->file->setOpenMode(mode);
+}
+
+std::string PipelinedArchiveFile::getOpenMode() {
+  return this->file->getOpenMode();
+}
+
+void PipelinedArchiveFile::open() {
+
+  /*
+   * Nothing queued for a file not opened yet, so
+   * do this directly.
+   */
+  this->file->open();
+  this->opened = true;
+  this->currpos = 0;
+
+}
+
+size_t PipelinedArchiveFile::write(const char *buf, size_t len) {
+
+  ArchiveWriteRequest request;
+
+  if (!this->opened) {
+    std::ostringstream oss;
+    oss << "attempt to write into file not opened for writing "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  request.op = ARCHIVE_WRITE_DATA;
+  request.file = this->file;
+  request.data.assign(buf, buf + len);
+
+  this->pool->push(this->writer_id, request);
+
+  this->currpos += len;
+  return len;
+
+}
+
+void PipelinedArchiveFile::fsync() {
+
+  ArchiveWriteRequest request;
+
+  /*
+   * Nothing to do after close(), the writer already
+   * executed or queued everything for this file.
+   */
+  if (!this->opened)
+    return;
+
+  request.op = ARCHIVE_WRITE_FSYNC;
+  request.file = this->file;
+
+  this->pool->push(this->writer_id, request);
+
+}
+
+void PipelinedArchiveFile::close() {
+
+  ArchiveWriteRequest request;
+
+  if (!this->opened)
+    return;
+
+  request.op = ARCHIVE_WRITE_CLOSE;
+  request.file = this->file;
+
+  this->pool->push(this->writer_id, request);
+  this->opened = false;
+
+}
+
+size_t PipelinedArchiveFile::read(char *buf, size_t len) {
+
+  this->pool->drain();
+  return this->file->read(buf, len);
+
+}
+
+void PipelinedArchiveFile::rename(path& newname) {
+
+  this->pool->drain();
+  this->file->rename(newname);
+  this->handle = newname;
+
+}
+
+off_t PipelinedArchiveFile::lseek(off_t offset, int whence) {
+
+  this->pool->drain();
+  return this->file->lseek(offset, whence);
+
+}
+
+void PipelinedArchiveFile::remove() {
+
+  this->pool->drain();
+  this->file->remove();
+
+}
+
+size_t PipelinedArchiveFile::size() {
+
+  this->pool->drain();
+  return this->file->size();
+
+}
+
+/******************************************************************************
+ * Implementation of ArchiveRateLimiter
+ *****************************************************************************/
+
+ArchiveRateLimiter::ArchiveRateLimiter(uint64_t bytes_per_second) {
+
+  this->rate = bytes_per_second;
+  this->tokens = this->burst();
+  this->last_refill = std::chrono::steady_clock::now();
+
+}
+
+ArchiveRateLimiter::~ArchiveRateLimiter() {}
+
+double ArchiveRateLimiter::burst() {
+
+  /*
+   * Allow bursts of 100ms worth of data, but not below
+   * the size of a single COPY data message.
+   */
+  return std::max((double) this->rate / 10.0, 65536.0);
+
+}
+
+void ArchiveRateLimiter::setRate(uint64_t bytes_per_second) {
+
+  std::lock_guard<std::mutex> lock(this->mtx);
+
+  this->rate = bytes_per_second;
+
+  /* Forget any debt or savings made under the former rate */
+  this->tokens = std::min(this->tokens, this->burst());
+
+  if (this->tokens < 0)
+    this->tokens = 0;
+
+  this->last_refill = std::chrono::steady_clock::now();
+
+}
+
+uint64_t ArchiveRateLimiter::getRate() {
+
+  std::lock_guard<std::mutex> lock(this->mtx);
+  return this->rate;
+
+}
+
+uint64_t ArchiveRateLimiter::consumed() {
+  return this->consumed_bytes.load();
+}
+
+void ArchiveRateLimiter::consume(size_t len) {
+
+  double wait_seconds = 0;
+
+  this->consumed_bytes += len;
+
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    if (this->rate == 0) {
+      this->last_refill = now;
+      return;
+    }
+
+    /* Refill the bucket for the time passed since the last call */
+    this->tokens += std::chrono::duration<double>(now - this->last_refill).count()
+      * (double) this->rate;
+    this->tokens = std::min(this->tokens, this->burst());
+    this->last_refill = now;
+
+    this->tokens -= (double) len;
+
+    if (this->tokens < 0)
+      wait_seconds = -this->tokens / (double) this->rate;
+  }
+
+  /*
+   * Sleep without holding the lock, so the rate can be
+   * changed by others in the meantime.
+   */
+  if (wait_seconds > 0)
+    std::this_thread::sleep_for(std::chrono::duration<double>(wait_seconds));
+
+}
+
+/******************************************************************************
+ * Implementation of ThrottledArchiveFile
+ *****************************************************************************/
+
+ThrottledArchiveFile::ThrottledArchiveFile(std::shared_ptr<BackupFile> file,
+                                           std::shared_ptr<ArchiveRateLimiter> limiter)
+  : BackupFile(path(file->getFilePath())) {
+
+  if (limiter == nullptr)
+    throw CArchiveIssue("throttled archive file requires a rate limiter");
+
+  this->file = file;
+  this->limiter = limiter;
+  this->compressed = file->isCompressed();
+
+}
+
+ThrottledArchiveFile::~ThrottledArchiveFile() {}
+
+bool ThrottledArchiveFile::isCompressed() {
+  return this->file->isCompressed();
+}
+
+bool ThrottledArchiveFile::isOpen() {
+  return this->file->isOpen();
+}
+
+void ThrottledArchiveFile::setOpenMode(std::string mode) {
+  this->file->setOpenMode(mode);
+}
+
+std::string ThrottledArchiveFile::getOpenMode() {
+  return this->file->getOpenMode();
+}
+
+void ThrottledArchiveFile::open() {
+  this->file->open();
+  this->currpos = 0;
+}
+
+size_t ThrottledArchiveFile::write(const char *buf, size_t len) {
+
+  size_t result;
+
+  this->limiter->consume(len);
+  result = this->file->write(buf, len);
+
+  this->currpos += result;
+  return result;
+
+}
+
+void ThrottledArchiveFile::fsync() {
+  this->file->fsync();
+}
+
+void ThrottledArchiveFile::close() {
+  this->file->close();
+}
+
+size_t ThrottledArchiveFile::read(char *buf, size_t len) {
+  return this->file->read(buf, len);
+}
+
+void ThrottledArchiveFile::rename(path& newname) {
+  this->file->rename(newname);
+  this->handle = newname;
+}
+
+off_t ThrottledArchiveFile::lseek(off_t offset, int whence) {
+  return this->file->lseek(offset, whence);
+}
+
+void ThrottledArchiveFile::remove() {
+  this->file->remove();
+}
+
+size_t ThrottledArchiveFile::size() {
+  return this->file->size();
+}
+
+/******************************************************************************
+ * Implementation of ArchiveMemberIndex
+ *****************************************************************************/
+
+#define ARCHIVE_MEMBER_INDEX_HEADER "# pg_backup_ctl++ archive member index 1"
+
+ArchiveMemberIndex::ArchiveMemberIndex() {}
+
+ArchiveMemberIndex::~ArchiveMemberIndex() {}
+
+path ArchiveMemberIndex::indexPath(path archive) {
+  return path(archive.string() + ".index");
+}
+
+size_t ArchiveMemberIndex::tarNumber(const char *field, size_t len) {
+
+  size_t result = 0;
+
+  /* base-256, used by PostgreSQL for members of 8GB and more */
+  if (field[0] & 0x80) {
+
+    result = field[0] & 0x3f;
+
+    for (size_t i = 1; i < len; i++)
+      result = (result << 8) | (unsigned char) field[i];
+
+    return result;
+
+  }
+
+  for (size_t i = 0; i < len; i++) {
+
+    if (field[i] == ' ')
+      continue;
+
+    if (field[i] < '0' || field[i] > '7')
+      break;
+
+    result = (result << 3) | (size_t) (field[i] - '0');
+
+  }
+
+  return result;
+
+}
+
+bool ArchiveMemberIndex::parseTarHeader(const char *header,
+                                        ArchiveMemberIndexEntry &entry) {
+
+  size_t checksum = 0;
+
+  /*
+   * A zero block marks the end of the archive.
+   */
+  if (std::all_of(header, header + 512, [](char c) { return c == 0; }))
+    return false;
+
+  /*
+   * Check the header checksum, which is calculated with
+   * the checksum field itself filled by blanks.
+   */
+  for (size_t i = 0; i < 512; i++)
+    checksum += (i >= 148 && i < 156) ? ' ' : (unsigned char) header[i];
+
+  if (checksum != tarNumber(header + 148, 8))
+    throw CArchiveIssue("invalid tar header checksum");
+
+  entry.name.assign(header, strnlen(header, 100));
+
+  /* ustar splits long names into prefix and name */
+  if (memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0') {
+    entry.name = std::string(header + 345, strnlen(header + 345, 155))
+      + "/" + entry.name;
+  }
+
+  entry.type = (header[156] == '\0') ? '0' : header[156];
+  entry.size = tarNumber(header + 124, 12);
+
+  return true;
+
+}
+
+void ArchiveMemberIndex::add(ArchiveMemberIndexEntry const& entry) {
+
+  /* A member archived twice is restored from its last copy */
+  this->names[entry.name] = this->entries.size();
+  this->entries.push_back(entry);
+
+}
+
+size_t ArchiveMemberIndex::count() {
+  return this->entries.size();
+}
+
+std::vector<ArchiveMemberIndexEntry> ArchiveMemberIndex::getEntries() {
+  return this->entries;
+}
+
+bool ArchiveMemberIndex::lookup(std::string name, ArchiveMemberIndexEntry &entry) {
+
+  auto it = this->names.find(name);
+
+  if (it == this->names.end())
+    return false;
+
+  entry = this->entries[it->second];
+  return true;
+
+}
+
+void ArchiveMemberIndex::write(path indexfile) {
+
+  ArchiveFile out(indexfile);
+  std::ostringstream oss;
+  std::string contents;
+
+  oss << ARCHIVE_MEMBER_INDEX_HEADER << "\n";
+
+  for (auto const& entry : this->entries) {
+    oss << entry.type << " "
+        << entry.offset << " "
+        << entry.size << " "
+        << entry.sync_offset << " "
+        << entry.sync_pos << " "
+        << entry.name << "\n";
+  }
+
+  contents = oss.str();
+
+  out.setOpenMode("w");
+  out.open();
+  out.write(contents.c_str(), contents.length());
+  out.fsync();
+  out.close();
+
+}
+
+void ArchiveMemberIndex::read(path indexfile) {
+
+  std::ifstream in(indexfile.string());
+  std::string line;
+  unsigned int lineno = 1;
+
+  if (!in.is_open()) {
+    std::ostringstream oss;
+    oss << "could not open archive index \"" << indexfile.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (!std::getline(in, line) || line != ARCHIVE_MEMBER_INDEX_HEADER) {
+    std::ostringstream oss;
+    oss << "file \"" << indexfile.string() << "\" is not an archive index";
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->entries.clear();
+  this->names.clear();
+
+  while (std::getline(in, line)) {
+
+    std::istringstream ls(line);
+    ArchiveMemberIndexEntry entry;
+
+    lineno++;
+
+    if (line.empty())
+      continue;
+
+    ls >> entry.type >> entry.offset >> entry.size
+       >> entry.sync_offset >> entry.sync_pos;
+
+    /* the name is the rest of the line, it might contain spaces */
+    if (ls.fail() || ls.get() != ' ' || !std::getline(ls, entry.name)
+        || entry.name.empty()) {
+      std::ostringstream oss;
+      oss << "malformed entry in archive index \"" << indexfile.string()
+          << "\", line " << lineno;
+      throw CArchiveIssue(oss.str());
+    }
+
+    this->add(entry);
+
+  }
+
+}
+
+size_t ArchiveMemberIndex::extract(std::shared_ptr<BackupFile> archive,
+                                   ArchiveMemberIndexEntry const& entry,
+                                   std::shared_ptr<BackupFile> target) {
+
+  std::vector<char> buffer(65536);
+  off_t skip;
+  size_t copied = 0;
+
+  /*
+   * Position the archive at the sync point before the member. Without
+   * one, start decompressing from the beginning of the archive.
+   * Uncompressed archives are positioned at the contents directly.
+   */
+  if (!archive->isCompressed()) {
+
+    archive->lseek(entry.offset, SEEK_SET);
+    skip = 0;
+
+  } else if (entry.sync_offset > 0) {
+
+    archive->seekSyncPoint(entry.sync_offset);
+    skip = entry.offset - entry.sync_pos;
+
+  } else {
+
+    archive->close();
+    archive->open();
+    skip = entry.offset;
+
+  }
+
+  /* Contents start after the member header */
+  skip += 512;
+
+  while (skip > 0) {
+
+    size_t wanted = std::min((size_t) skip, buffer.size());
+    size_t rbytes = archive->read(buffer.data(), wanted);
+
+    if (rbytes > 0 && !archive->isCompressed())
+      rbytes = wanted;
+
+    if (rbytes == 0) {
+      std::ostringstream oss;
+      oss << "unexpected end of archive " << archive->getFilePath()
+          << " while looking for member \"" << entry.name << "\"";
+      throw CArchiveIssue(oss.str());
+    }
+
+    skip -= rbytes;
+
+  }
+
+  while (copied < entry.size) {
+
+    size_t wanted = std::min(entry.size - copied, buffer.size());
+    size_t rbytes = archive->read(buffer.data(), wanted);
+
+    /* ArchiveFile::read() returns the number of items read, not bytes */
+    if (rbytes > 0 && !archive->isCompressed())
+      rbytes = wanted;
+
+    if (rbytes == 0) {
+      std::ostringstream oss;
+      oss << "unexpected end of archive " << archive->getFilePath()
+          << " while extracting member \"" << entry.name << "\"";
+      throw CArchiveIssue(oss.str());
+    }
+
+    target->write(buffer.data(), rbytes);
+    copied += rbytes;
+
+  }
+
+  return copied;
+
+}
+
+/******************************************************************************
+ * Implementation of IndexedArchiveFile
+ *****************************************************************************/
+
+IndexedArchiveFile::IndexedArchiveFile(std::shared_ptr<BackupFile> file)
+  : BackupFile(path(file->getFilePath())) {
+
+  this->file = file;
+  this->compressed = file->isCompressed();
+
+}
+
+IndexedArchiveFile::~IndexedArchiveFile() {}
+
+void IndexedArchiveFile::setSyncInterval(size_t interval) {
+  this->syncInterval = interval;
+}
+
+ArchiveMemberIndex IndexedArchiveFile::getIndex() {
+  return this->index;
+}
+
+bool IndexedArchiveFile::isCompressed() {
+  return this->file->isCompressed();
+}
+
+bool IndexedArchiveFile::isOpen() {
+  return this->opened;
+}
+
+void IndexedArchiveFile::setOpenMode(std::string mode) {
+  this->file->setOpenMode(mode);
+}
+
+std::string IndexedArchiveFile::getOpenMode() {
+  return this->file->getOpenMode();
+}
+
+void IndexedArchiveFile::member() {
+
+  ArchiveMemberIndexEntry entry;
+
+  try {
+
+    if (!ArchiveMemberIndex::parseTarHeader(this->header, entry)) {
+      this->eof = true;
+      return;
+    }
+
+  } catch (CArchiveIssue &e) {
+
+    BOOST_LOG_TRIVIAL(warning) << "WARNING: invalid tar header in "
+                               << this->file->getFilePath()
+                               << " at offset " << (this->stream_pos - 512)
+                               << ", not writing a member index";
+    this->valid = false;
+    return;
+
+  }
+
+  entry.offset = this->stream_pos - 512;
+  entry.sync_offset = this->sync_offset;
+  entry.sync_pos = this->sync_pos;
+
+  this->index.add(entry);
+
+  /* contents are padded to full 512 byte blocks */
+  this->remaining = (entry.size + 511) & ~((size_t) 511);
+
+}
+
+void IndexedArchiveFile::open() {
+
+  this->file->open();
+  this->opened = true;
+  this->currpos = 0;
+
+}
+
+size_t IndexedArchiveFile::write(const char *buf, size_t len) {
+
+  size_t pos = 0;
+  size_t flushed = 0;
+
+  if (!this->opened) {
+    std::ostringstream oss;
+    oss << "attempt to write into file not opened for writing "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  while (pos < len && !this->eof && this->valid) {
+
+    size_t n;
+
+    /* Skip member contents */
+    if (this->remaining > 0) {
+
+      n = std::min(this->remaining, len - pos);
+
+      this->remaining -= n;
+      this->stream_pos += n;
+      pos += n;
+      continue;
+
+    }
+
+    /*
+     * Request a sync point right before the next member header, if
+     * enough data was written since the last one. Everything up to
+     * here must be passed to the wrapped file before.
+     */
+    if (this->header_fill == 0 && this->can_sync && this->syncInterval > 0
+        && (size_t) (this->stream_pos - this->sync_pos) >= this->syncInterval) {
+
+      off_t offset;
+
+      if (pos > flushed)
+        this->file->write(buf + flushed, pos - flushed);
+
+      flushed = pos;
+
+      if ((offset = this->file->syncPoint()) < 0) {
+        this->can_sync = false;
+      } else {
+        this->sync_offset = offset;
+        this->sync_pos = this->stream_pos;
+      }
+
+    }
+
+    n = std::min(sizeof(this->header) - this->header_fill, len - pos);
+    memcpy(this->header + this->header_fill, buf + pos, n);
+
+    this->header_fill += n;
+    this->stream_pos += n;
+    pos += n;
+
+    if (this->header_fill == sizeof(this->header)) {
+      this->header_fill = 0;
+      this->member();
+    }
+
+  }
+
+  if (len > flushed)
+    this->file->write(buf + flushed, len - flushed);
+
+  this->currpos += len;
+  return len;
+
+}
+
+void IndexedArchiveFile::fsync() {
+  this->file->fsync();
+}
+
+void IndexedArchiveFile::close() {
+
+  bool was_open = this->opened;
+
+  this->opened = false;
+  this->file->close();
+
+  /*
+   * Write the index only once, in case we're closed again,
+   * and only if we understood the archive contents.
+   */
+  if (was_open && this->valid) {
+    this->index.write(ArchiveMemberIndex::indexPath(path(this->file->getFilePath())));
+  }
+
+}
+
+size_t IndexedArchiveFile::read(char *buf, size_t len) {
+  return this->file->read(buf, len);
+}
+
+void IndexedArchiveFile::rename(path& newname) {
+
+  path indexfile = ArchiveMemberIndex::indexPath(path(this->file->getFilePath()));
+
+  this->file->rename(newname);
+  this->handle = newname;
+
+  /* An index already written follows its archive */
+  if (boost::filesystem::exists(indexfile))
+    boost::filesystem::rename(indexfile, ArchiveMemberIndex::indexPath(newname));
+
+}
+
+off_t IndexedArchiveFile::lseek(off_t offset, int whence) {
+  return this->file->lseek(offset, whence);
+}
+
+void IndexedArchiveFile::remove() {
+
+  this->file->remove();
+  boost::filesystem::remove(ArchiveMemberIndex::indexPath(path(this->file->getFilePath())));
+
+}
+
+size_t IndexedArchiveFile::size() {
+  return this->file->size();
+}
+
+/******************************************************************************
+ * Implementation of FramedArchiveFile
+ *****************************************************************************/
+
+/*
+ * Frame table trailer. The payload consists of the frame table
+ * entries (uncompressed and compressed offset, 8 bytes each) followed
+ * by a footer with the number of entries, the format version, the
+ * uncompressed size and a magic. All values are little endian, the
+ * footer is located at the very end of the payload, so readers find it
+ * relative to the end of the file.
+ */
+#define FRAME_TABLE_MAGIC        "PGBF"
+#define FRAME_TABLE_VERSION      1
+#define FRAME_TABLE_ENTRY_SIZE   16
+#define FRAME_TABLE_FOOTER_SIZE  20
+
+/*
+ * gzip envelope, see writeFrameTable(): member header with FEXTRA
+ * set, extra field header, subfield header, and the empty deflate
+ * block plus CRC32 and ISIZE. The payload is limited by the 16 bit
+ * length of the extra field.
+ */
+#define FRAME_TABLE_GZIP_HEADER_SIZE   16
+#define FRAME_TABLE_GZIP_TRAILER_SIZE  10
+#define FRAME_TABLE_GZIP_MAX_PAYLOAD   (65535 - 4)
+
+/* Skippable frame envelope, magic and frame size */
+#define FRAME_TABLE_SKIPPABLE_HEADER_SIZE 8
+
+static void framed_put_le(std::vector<unsigned char> &buf, uint64_t value, int bytes) {
+
+  for (int i = 0; i < bytes; i++)
+    buf.push_back((unsigned char) ((value >> (8 * i)) & 0xFF));
+
+}
+
+static uint64_t framed_get_le(const unsigned char *buf, int bytes) {
+
+  uint64_t value = 0;
+
+  for (int i = bytes - 1; i >= 0; i--)
+    value = (value << 8) | buf[i];
+
+  return value;
+
+}
+
+/*
+ * Reads len bytes at offset, returns false on short reads.
+ */
+static bool framed_pread(int fd, unsigned char *buf, size_t len, off_t offset) {
+
+  size_t done = 0;
+
+  while (done < len) {
+
+    ssize_t rc = ::pread(fd, buf + done, len - done, offset + done);
+
+    if (rc < 0 && errno == EINTR)
+      continue;
+
+    if (rc <= 0)
+      return false;
+
+    done += rc;
+
+  }
+
+  return true;
+
+}
+
+FramedArchiveFile::FramedArchiveFile(std::shared_ptr<BackupFile> file, size_t frameSize)
+  : BackupFile(path(file->getFilePath())) {
+
+  this->file = file;
+  this->frameSize = frameSize;
+  this->compressed = file->isCompressed();
+  this->envelope = FramedArchiveFile::envelopeFor(file);
+
+}
+
+FramedArchiveFile::~FramedArchiveFile() {
+
+  if (this->opened) {
+
+    try {
+      this->close();
+    } catch(CArchiveIssue &e) {
+      BOOST_LOG_TRIVIAL(error) << e.what();
+    }
+
+  }
+
+}
+
+FramedArchiveFile::FrameEnvelope FramedArchiveFile::envelopeFor(std::shared_ptr<BackupFile> file) {
+
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+  if (std::dynamic_pointer_cast<CompressedArchiveFile>(file) != nullptr)
+    return FRAME_ENVELOPE_GZIP;
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+  if (std::dynamic_pointer_cast<ZstdArchiveFile>(file) != nullptr)
+    return FRAME_ENVELOPE_SKIPPABLE;
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+  if (std::dynamic_pointer_cast<LZ4ArchiveFile>(file) != nullptr)
+    return FRAME_ENVELOPE_SKIPPABLE;
+#endif
+
+  /* Uncompressed or compressed by an external program */
+  return FRAME_ENVELOPE_NONE;
+
+}
+
+FramedArchiveFile::FrameEnvelope FramedArchiveFile::envelopeFor(path file) {
+
+  std::string ext = file.extension().string();
+
+  if (ext == ".gz")
+    return FRAME_ENVELOPE_GZIP;
+
+  if (ext == ".zst" || ext == ".lz4")
+    return FRAME_ENVELOPE_SKIPPABLE;
+
+  return FRAME_ENVELOPE_NONE;
+
+}
+
+std::shared_ptr<FramedArchiveFile> FramedArchiveFile::forReading(path file) {
+
+  std::shared_ptr<BackupFile> inner = nullptr;
+  std::string ext = file.extension().string();
+
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+  if (ext == ".gz")
+    inner = std::make_shared<CompressedArchiveFile>(file);
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+  if (ext == ".zst")
+    inner = std::make_shared<ZstdArchiveFile>(file);
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+  if (ext == ".lz4")
+    inner = std::make_shared<LZ4ArchiveFile>(file);
+#endif
+
+  if (inner == nullptr) {
+
+    if (FramedArchiveFile::envelopeFor(file) != FRAME_ENVELOPE_NONE)
+      throw CArchiveIssue("attempt to read compressed file "
+                          + file.string()
+                          + " without compression support compiled in");
+
+    inner = std::make_shared<ArchiveFile>(file);
+
+  }
+
+  inner->setOpenMode("rb");
+  return std::make_shared<FramedArchiveFile>(inner);
+
+}
+
+bool FramedArchiveFile::readFrameTable(path file,
+                                       std::vector<CompressedFrame> &frames,
+                                       uint64_t &total_size) {
+
+  return FramedArchiveFile::readFrameTable(file,
+                                           FramedArchiveFile::envelopeFor(file),
+                                           frames, total_size);
+
+}
+
+bool FramedArchiveFile::readFrameTable(path file,
+                                       FrameEnvelope envelope,
+                                       std::vector<CompressedFrame> &frames,
+                                       uint64_t &total_size) {
+
+  int fd;
+  struct stat st;
+  bool result = false;
+
+  if (envelope == FRAME_ENVELOPE_NONE)
+    return false;
+
+  if ((fd = ::open(file.string().c_str(), O_RDONLY)) < 0) {
+    std::ostringstream oss;
+    oss << "could not open file \"" << file.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * Anything not looking like a frame table we've written means
+   * there is none, readers fall back to sequential decompression then.
+   */
+  do {
+
+    unsigned char footer[FRAME_TABLE_FOOTER_SIZE];
+    std::vector<unsigned char> entries;
+    off_t footer_end;
+    off_t payload_start;
+    off_t envelope_start;
+    uint64_t count;
+    uint64_t payload;
+
+    if (fstat(fd, &st) != 0)
+      break;
+
+    footer_end = st.st_size;
+
+    if (envelope == FRAME_ENVELOPE_GZIP)
+      footer_end -= FRAME_TABLE_GZIP_TRAILER_SIZE;
+
+    if (footer_end < FRAME_TABLE_FOOTER_SIZE)
+      break;
+
+    if (!framed_pread(fd, footer, sizeof(footer), footer_end - FRAME_TABLE_FOOTER_SIZE))
+      break;
+
+    if (memcmp(footer + 16, FRAME_TABLE_MAGIC, 4) != 0
+        || framed_get_le(footer + 4, 4) != FRAME_TABLE_VERSION)
+      break;
+
+    count = framed_get_le(footer, 4);
+    payload = count * FRAME_TABLE_ENTRY_SIZE + FRAME_TABLE_FOOTER_SIZE;
+
+    if (count == 0 || payload > (uint64_t) footer_end)
+      break;
+
+    payload_start = footer_end - payload;
+
+    if (envelope == FRAME_ENVELOPE_GZIP) {
+
+      unsigned char hdr[FRAME_TABLE_GZIP_HEADER_SIZE];
+      unsigned char trailer[FRAME_TABLE_GZIP_TRAILER_SIZE];
+      const unsigned char empty[FRAME_TABLE_GZIP_TRAILER_SIZE] = { 0x03, 0x00 };
+
+      if (payload > FRAME_TABLE_GZIP_MAX_PAYLOAD
+          || payload_start < FRAME_TABLE_GZIP_HEADER_SIZE)
+        break;
+
+      envelope_start = payload_start - FRAME_TABLE_GZIP_HEADER_SIZE;
+
+      if (!framed_pread(fd, hdr, sizeof(hdr), envelope_start)
+          || !framed_pread(fd, trailer, sizeof(trailer), footer_end))
+        break;
+
+      if (hdr[0] != 0x1f || hdr[1] != 0x8b || hdr[2] != 0x08 || hdr[3] != 0x04
+          || framed_get_le(hdr + 10, 2) != payload + 4
+          || hdr[12] != 'P' || hdr[13] != 'F'
+          || framed_get_le(hdr + 14, 2) != payload
+          || memcmp(trailer, empty, sizeof(empty)) != 0)
+        break;
+
+    } else {
+
+      unsigned char hdr[FRAME_TABLE_SKIPPABLE_HEADER_SIZE];
+
+      if (payload_start < FRAME_TABLE_SKIPPABLE_HEADER_SIZE)
+        break;
+
+      envelope_start = payload_start - FRAME_TABLE_SKIPPABLE_HEADER_SIZE;
+
+      if (!framed_pread(fd, hdr, sizeof(hdr), envelope_start))
+        break;
+
+      if (framed_get_le(hdr, 4) != FramedArchiveFile::SKIPPABLE_FRAME_MAGIC
+          || framed_get_le(hdr + 4, 4) != payload)
+        break;
+
+    }
+
+    entries.resize(count * FRAME_TABLE_ENTRY_SIZE);
+
+    if (!framed_pread(fd, entries.data(), entries.size(), payload_start))
+      break;
+
+    frames.clear();
+    total_size = framed_get_le(footer + 8, 8);
+
+    for (uint64_t i = 0; i < count; i++) {
+
+      CompressedFrame frame;
+
+      frame.uncompressed_offset = framed_get_le(entries.data() + i * FRAME_TABLE_ENTRY_SIZE, 8);
+      frame.compressed_offset = framed_get_le(entries.data() + i * FRAME_TABLE_ENTRY_SIZE + 8, 8);
+
+      /* Frames must be ordered and located before the table */
+      if ((i == 0 && (frame.uncompressed_offset != 0 || frame.compressed_offset != 0))
+          || (i > 0 && (frame.uncompressed_offset <= frames.back().uncompressed_offset
+                        || frame.compressed_offset <= frames.back().compressed_offset))
+          || frame.uncompressed_offset > total_size
+          || frame.compressed_offset >= (uint64_t) envelope_start) {
+        frames.clear();
+        break;
+      }
+
+      frames.push_back(frame);
+
+    }
+
+    result = !frames.empty();
+
+  } while (false);
+
+  ::close(fd);
+
+  if (!result) {
+    frames.clear();
+    total_size = 0;
+  }
+
+  return result;
+
+}
+
+void FramedArchiveFile::writeFrameTable() {
+
+  std::vector<unsigned char> payload;
+  std::vector<unsigned char> buf;
+  size_t done = 0;
+  int fd;
+
+  for (auto &frame : this->frames) {
+    framed_put_le(payload, frame.uncompressed_offset, 8);
+    framed_put_le(payload, frame.compressed_offset, 8);
+  }
+
+  framed_put_le(payload, this->frames.size(), 4);
+  framed_put_le(payload, FRAME_TABLE_VERSION, 4);
+  framed_put_le(payload, this->currpos, 8);
+  payload.insert(payload.end(), FRAME_TABLE_MAGIC, FRAME_TABLE_MAGIC + 4);
+
+  if (this->envelope == FRAME_ENVELOPE_GZIP) {
+
+    if (payload.size() > FRAME_TABLE_GZIP_MAX_PAYLOAD) {
+      BOOST_LOG_TRIVIAL(debug) << "DEBUG: too many frames in "
+                               << this->handle.string()
+                               << ", not writing a frame table";
+      return;
+    }
+
+    /*
+     * An empty gzip member, carrying the table in a "PF" subfield of
+     * its extra field. Decompressors skip extra fields and produce
+     * no output for the empty deflate block, CRC32 and ISIZE are 0.
+     */
+    const unsigned char hdr[] = { 0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff };
+
+    buf.insert(buf.end(), hdr, hdr + sizeof(hdr));
+    framed_put_le(buf, payload.size() + 4, 2);
+    buf.push_back('P');
+    buf.push_back('F');
+    framed_put_le(buf, payload.size(), 2);
+    buf.insert(buf.end(), payload.begin(), payload.end());
+    buf.push_back(0x03);
+    buf.push_back(0x00);
+    framed_put_le(buf, 0, 4);
+    framed_put_le(buf, 0, 4);
+
+  } else {
+
+    /*
+     * zstd and lz4 share the range of skippable frame magics,
+     * both skip such frames when decompressing.
+     */
+    framed_put_le(buf, FramedArchiveFile::SKIPPABLE_FRAME_MAGIC, 4);
+    framed_put_le(buf, payload.size(), 4);
+    buf.insert(buf.end(), payload.begin(), payload.end());
+
+  }
+
+  if ((fd = ::open(this->handle.string().c_str(), O_WRONLY | O_APPEND)) < 0) {
+    std::ostringstream oss;
+    oss << "could not open file \"" << this->handle.string()
+        << "\" to write frame table: " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  while (done < buf.size()) {
+
+    ssize_t rc = ::write(fd, buf.data() + done, buf.size() - done);
+
+    if (rc < 0 && errno == EINTR)
+      continue;
+
+    if (rc <= 0) {
+      std::ostringstream oss;
+      oss << "could not write frame table to file \""
+          << this->handle.string() << "\": " << strerror(errno);
+      ::close(fd);
+      throw CArchiveIssue(oss.str());
+    }
+
+    done += rc;
+
+  }
+
+  if (::fsync(fd) != 0) {
+    std::ostringstream oss;
+    oss << "error fsyncing file \"" << this->handle.string() << "\": "
+        << strerror(errno);
+    ::close(fd);
+    throw CArchiveIssue(oss.str());
+  }
+
+  ::close(fd);
+
+}
+
+std::vector<CompressedFrame> FramedArchiveFile::getFrames() {
+  return this->frames;
+}
+
+bool FramedArchiveFile::hasFrameTable() {
+  return this->has_table;
+}
+
+bool FramedArchiveFile::isCompressed() {
+  return this->file->isCompressed();
+}
+
+bool FramedArchiveFile::isOpen() {
+  return this->opened;
+}
+
+void FramedArchiveFile::setOpenMode(std::string mode) {
+  this->file->setOpenMode(mode);
+}
+
+std::string FramedArchiveFile::getOpenMode() {
+  return this->file->getOpenMode();
+}
+
+void FramedArchiveFile::open() {
+
+  std::string mode = this->file->getOpenMode();
+
+  this->file->open();
+
+  this->opened = true;
+  this->writing = (mode.find_first_of("wa+") != std::string::npos);
+  this->currpos = 0;
+  this->frame_start = 0;
+  this->frames.clear();
+  this->total_size = 0;
+  this->has_table = false;
+
+  if (this->writing) {
+
+    /*
+     * We don't know the frames of data already in a file
+     * we append to, so don't write a table for it.
+     */
+    if (mode.find('a') != std::string::npos)
+      this->envelope = FRAME_ENVELOPE_NONE;
+
+    if (this->envelope != FRAME_ENVELOPE_NONE)
+      this->frames.push_back(CompressedFrame());
+
+  } else {
+
+    this->has_table = FramedArchiveFile::readFrameTable(path(this->file->getFilePath()),
+                                                        this->envelope,
+                                                        this->frames,
+                                                        this->total_size);
+
+  }
+
+}
+
+void FramedArchiveFile::finishFrame() {
+
+  off_t offset;
+  CompressedFrame frame;
+
+  if ((offset = this->file->syncPoint()) < 0) {
+
+    /* The wrapped file can't do this, give up framing */
+    this->envelope = FRAME_ENVELOPE_NONE;
+    this->frames.clear();
+    return;
+
+  }
+
+  frame.uncompressed_offset = this->currpos;
+  frame.compressed_offset = offset;
+
+  this->frames.push_back(frame);
+  this->frame_start = this->currpos;
+
+}
+
+size_t FramedArchiveFile::write(const char *buf, size_t len) {
+
+  size_t pos = 0;
+
+  if (!this->opened || !this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to write into file not opened for writing "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (this->envelope == FRAME_ENVELOPE_NONE || this->frameSize == 0) {
+    this->currpos += this->file->write(buf, len);
+    return len;
+  }
+
+  /*
+   * Split the data at frame boundaries. A new frame is started
+   * only if there's more data to write, so we never end up with an
+   * empty frame at the end of the file.
+   */
+  while (pos < len) {
+
+    size_t n;
+
+    if ((size_t) (this->currpos - this->frame_start) >= this->frameSize) {
+
+      this->finishFrame();
+
+      if (this->envelope == FRAME_ENVELOPE_NONE) {
+        this->currpos += this->file->write(buf + pos, len - pos);
+        return len;
+      }
+
+    }
+
+    n = std::min(len - pos, this->frameSize - (size_t) (this->currpos - this->frame_start));
+
+    this->file->write(buf + pos, n);
+    this->currpos += n;
+    pos += n;
+
+  }
+
+  return len;
+
+}
+
+size_t FramedArchiveFile::read(char *buf, size_t len) {
+
+  size_t rbytes = this->file->read(buf, len);
+
+  this->currpos += rbytes;
+  return rbytes;
+
+}
+
+void FramedArchiveFile::skip(off_t len) {
+
+  std::vector<char> buf(std::min((off_t) (64 * 1024), std::max(len, (off_t) 1)));
+
+  while (len > 0) {
+
+    size_t rbytes = this->read(buf.data(), std::min((off_t) buf.size(), len));
+
+    if (rbytes == 0) {
+      std::ostringstream oss;
+      oss << "cannot seek beyond end of file "
+          << this->handle.string();
+      throw CArchiveIssue(oss.str());
+    }
+
+    len -= rbytes;
+
+  }
+
+}
+
+off_t FramedArchiveFile::lseek(off_t offset, int whence) {
+
+  off_t target;
+
+  if (!this->opened) {
+    std::ostringstream oss;
+    oss << "cannot seek in file "
+        << this->handle.string()
+        << ": not opened";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /* Uncompressed files and writers position the file directly */
+  if (this->writing || !this->file->isCompressed()) {
+
+    off_t rc = this->file->lseek(offset, whence);
+
+    if (!this->writing) {
+
+      if (whence == SEEK_SET)
+        this->currpos = offset;
+      else if (whence == SEEK_CUR)
+        this->currpos += offset;
+      else
+        this->currpos = this->file->size() + offset;
+
+    }
+
+    return rc;
+
+  }
+
+  switch (whence) {
+  case SEEK_SET:
+    target = offset;
+    break;
+  case SEEK_CUR:
+    target = this->currpos + offset;
+    break;
+  case SEEK_END:
+    if (!this->has_table) {
+      throw CArchiveIssue("cannot seek relative to the end of compressed file "
+                          + this->handle.string()
+                          + " without frame table");
+    }
+    target = this->total_size + offset;
+    break;
+  default:
+    throw CArchiveIssue("invalid seek mode");
+  }
+
+  if (target < 0 || (this->has_table && (uint64_t) target > this->total_size)) {
+    std::ostringstream oss;
+    oss << "cannot seek to offset " << target
+        << " in file " << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (this->has_table) {
+
+    /* Last frame starting at or before the target */
+    auto it = std::upper_bound(this->frames.begin(), this->frames.end(),
+                               (uint64_t) target,
+                               [](uint64_t off, const CompressedFrame &frame) {
+                                 return off < frame.uncompressed_offset;
+                               });
+    --it;
+
+    /*
+     * Just move forward if the target is ahead of us within the
+     * current frame, otherwise restart decompression at the frame
+     * start.
+     */
+    if (target < this->currpos
+        || (uint64_t) this->currpos < it->uncompressed_offset) {
+
+      this->file->seekSyncPoint(it->compressed_offset);
+      this->currpos = it->uncompressed_offset;
+
+    }
+
+  } else if (target < this->currpos) {
+
+    /* No frames known, decompress from the start */
+    this->file->close();
+    this->file->open();
+    this->currpos = 0;
+
+  }
+
+  this->skip(target - this->currpos);
+  return this->currpos;
+
+}
+
+off_t FramedArchiveFile::seekLSN(XLogRecPtr lsn, unsigned long long wal_segment_size) {
+
+  if (wal_segment_size == 0)
+    throw CArchiveIssue("cannot seek to LSN with WAL segment size 0");
+
+  return this->lseek((off_t) (lsn % wal_segment_size), SEEK_SET);
+
+}
+
+void FramedArchiveFile::fsync() {
+  this->file->fsync();
+}
+
+void FramedArchiveFile::close() {
+
+  bool was_open = this->opened;
+
+  this->opened = false;
+  this->file->close();
+
+  /* The table is appended once the compressed stream is complete */
+  if (was_open && this->writing && this->envelope != FRAME_ENVELOPE_NONE)
+    this->writeFrameTable();
+
+  this->writing = false;
+
+}
+
+void FramedArchiveFile::rename(path& newname) {
+
+  if (this->opened)
+    this->close();
+
+  this->file->rename(newname);
+  this->handle = newname;
+
+}
+
+void FramedArchiveFile::remove() {
+  this->file->remove();
+}
+
+size_t FramedArchiveFile::size() {
+  return this->file->size();
+}
+
+off_t FramedArchiveFile::syncPoint() {
+
+  if (!this->opened || !this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to finish frame of file not opened for writing "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (this->envelope == FRAME_ENVELOPE_NONE)
+    return this->file->syncPoint();
+
+  /* Nothing written into the current frame yet */
+  if (this->currpos == this->frame_start)
+    return this->frames.back().compressed_offset;
+
+  this->finishFrame();
+
+  if (this->envelope == FRAME_ENVELOPE_NONE)
+    return -1;
+
+  return this->frames.back().compressed_offset;
+
+}
+
+void FramedArchiveFile::seekSyncPoint(off_t offset) {
+
+  for (auto &frame : this->frames) {
+
+    if (frame.compressed_offset == (uint64_t) offset) {
+      this->file->seekSyncPoint(offset);
+      this->currpos = frame.uncompressed_offset;
+      return;
+    }
+
+  }
+
+  std::ostringstream oss;
+  oss << "offset " << offset << " is not a frame start in file "
+      << this->handle.string();
+  throw CArchiveIssue(oss.str());
+
+}
+
+/******************************************************************************
+ * Implementation of DedupChunkStore
+ *****************************************************************************/
+
+std::atomic<unsigned long long> DedupChunkStore::temp_seq { 0 };
+
+DedupChunkStore::DedupChunkStore(path directory) {
+  this->directory = directory;
+}
+
+DedupChunkStore::~DedupChunkStore() {}
+
+path DedupChunkStore::forArchive(path archiveDir) {
+  return archiveDir / "chunks";
+}
+
+bool DedupChunkStore::supported(BackupProfileCompressType compression) {
+
+#ifdef PG_BACKUP_CTL_HAS_OPENSSL
+  switch(compression) {
+
+  case BACKUP_COMPRESS_TYPE_NONE:
+    return true;
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+  case BACKUP_COMPRESS_TYPE_GZIP:
+    return true;
+#endif
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+  case BACKUP_COMPRESS_TYPE_ZSTD:
+    return true;
+#endif
+#ifdef PG_BACKUP_CTL_HAS_LIBLZMA
+  case BACKUP_COMPRESS_TYPE_XZ:
+    return true;
+#endif
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+  case BACKUP_COMPRESS_TYPE_LZ4:
+    return true;
+#endif
+  default:
+    return false;
+
+  }
+#else
+  (void) compression;
+  return false;
+#endif
+
+}
+
+std::string DedupChunkStore::suffix(BackupProfileCompressType compression) {
+
+  switch(compression) {
+
+  case BACKUP_COMPRESS_TYPE_NONE:
+    return "";
+  case BACKUP_COMPRESS_TYPE_GZIP:
+    return ".gz";
+  case BACKUP_COMPRESS_TYPE_ZSTD:
+    return ".zst";
+  case BACKUP_COMPRESS_TYPE_XZ:
+    return ".xz";
+  case BACKUP_COMPRESS_TYPE_LZ4:
+    return ".lz4";
+  default:
+    std::ostringstream oss;
+    oss << "compression type unsupported for deduplicated archives: " << compression;
+    throw CArchiveIssue(oss.str());
+
+  }
+
+}
+
+BackupProfileCompressType DedupChunkStore::compressionOf(std::string const& id) {
+
+  std::string ext = path(id).extension().string();
+
+  if (ext == "")
+    return BACKUP_COMPRESS_TYPE_NONE;
+  if (ext == ".gz")
+    return BACKUP_COMPRESS_TYPE_GZIP;
+  if (ext == ".zst")
+    return BACKUP_COMPRESS_TYPE_ZSTD;
+  if (ext == ".xz")
+    return BACKUP_COMPRESS_TYPE_XZ;
+  if (ext == ".lz4")
+    return BACKUP_COMPRESS_TYPE_LZ4;
+
+  throw CArchiveIssue("invalid chunk ID \"" + id + "\"");
+
+}
+
+std::shared_ptr<BackupFile> DedupChunkStore::chunkFile(path file,
+                                                       BackupProfileCompressType compression,
+                                                       int compression_level) {
+
+  /* compression_level isn't used by every method */
+  (void) compression_level;
+
+  switch(compression) {
+
+  case BACKUP_COMPRESS_TYPE_NONE:
+    return std::make_shared<ArchiveFile>(file);
+
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+  case BACKUP_COMPRESS_TYPE_GZIP:
+    {
+      std::shared_ptr<CompressedArchiveFile> myfile
+        = std::make_shared<CompressedArchiveFile>(file);
+
+      myfile->setCompressionLevel(compression_level);
+      return myfile;
+    }
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+  case BACKUP_COMPRESS_TYPE_ZSTD:
+    {
+      std::shared_ptr<ZstdArchiveFile> myfile
+        = std::make_shared<ZstdArchiveFile>(file);
+
+      myfile->setCompressionLevel(compression_level);
+      return myfile;
+    }
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZMA
+  case BACKUP_COMPRESS_TYPE_XZ:
+    {
+      std::shared_ptr<XZArchiveFile> myfile
+        = std::make_shared<XZArchiveFile>(file);
+
+      myfile->setCompressionLevel(compression_level);
+      return myfile;
+    }
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+  case BACKUP_COMPRESS_TYPE_LZ4:
+    {
+      std::shared_ptr<LZ4ArchiveFile> myfile
+        = std::make_shared<LZ4ArchiveFile>(file);
+
+      myfile->setCompressionLevel(compression_level);
+      return myfile;
+    }
+#endif
+
+  default:
+    std::ostringstream oss;
+    oss << "chunk " << file.string()
+        << ": compression type not supported by this build: " << compression;
+    throw CArchiveIssue(oss.str());
+
+  }
+
+}
+
+std::set<std::string> DedupChunkStore::referencedChunks(path basebackup_dir) {
+
+  std::set<std::string> ids;
+
+  if (!boost::filesystem::is_directory(basebackup_dir))
+    return ids;
+
+  for (auto &entry : boost::make_iterator_range(directory_iterator(basebackup_dir), {})) {
+
+    if (boost::filesystem::is_regular_file(entry.path())
+        && entry.path().extension().string() == DedupArchiveFile::SUFFIX)
+      DedupArchiveFile::chunks(entry.path(), ids);
+
+  }
+
+  return ids;
+
+}
+
+void DedupChunkStore::release(std::shared_ptr<BackupCatalog> catalog,
+                              int archive_id,
+                              std::shared_ptr<BaseBackupDescr> basebackup) {
+
+  std::set<std::string> ids;
+
+  if (basebackup->status != BaseBackupDescr::BASEBACKUP_STATUS_READY)
+    return;
+
+  try {
+
+    ids = referencedChunks(path(basebackup->fsentry));
+
+  } catch (CArchiveIssue &e) {
+
+    BOOST_LOG_TRIVIAL(warning) << "WARNING: could not read chunks of basebackup "
+                               << basebackup->fsentry << ", keeping them: " << e.what();
+    return;
+
+  }
+
+  if (!ids.empty())
+    catalog->releaseChunks(archive_id, ids);
+
+}
+
+path DedupChunkStore::getPath() {
+  return this->directory;
+}
+
+path DedupChunkStore::chunkPath(std::string const& id) {
+  return this->directory / id.substr(0, 2) / id;
+}
+
+bool DedupChunkStore::exists(std::string const& id) {
+  return boost::filesystem::exists(this->chunkPath(id));
+}
+
+path DedupChunkStore::write(std::string const& id,
+                            const char *buf,
+                            size_t len,
+                            int compression_level) {
+
+  path target = this->chunkPath(id);
+  path temp = path(target.string()
+                   + ".tmp." + std::to_string(::getpid())
+                   + "." + std::to_string(temp_seq++));
+  std::shared_ptr<BackupFile> file = chunkFile(temp,
+                                               compressionOf(id),
+                                               compression_level);
+
+  if (!boost::filesystem::exists(target.parent_path()))
+    create_directories(target.parent_path());
+
+  file->setOpenMode("wb");
+  file->open();
+
+  try {
+
+    file->write(buf, len);
+    file->close();
+
+  } catch (CArchiveIssue &e) {
+
+    if (file->isOpen())
+      file->close();
+    boost::filesystem::remove(temp);
+    throw e;
+
+  }
+
+  return temp;
+
+}
+
+void DedupChunkStore::commit(std::vector<std::pair<path, std::string>> const& pending) {
+
+  std::set<path> directories;
+
+  if (pending.empty())
+    return;
+
+  /*
+   * Chunk contents must be durable before they show up
+   * under their ID, a recipe might reference them right away.
+   */
+  for (auto &chunk : pending) {
+    RootDirectory::fsync(chunk.first);
+  }
+
+  for (auto &chunk : pending) {
+
+    path target = this->chunkPath(chunk.second);
+
+    boost::filesystem::rename(chunk.first, target);
+    directories.insert(target.parent_path());
+
+  }
+
+  for (auto &dir : directories) {
+    RootDirectory::fsync(dir);
+  }
+
+  /* new shard directories */
+  RootDirectory::fsync(this->directory);
+
+}
+
+void DedupChunkStore::read(std::string const& id, std::vector<char> &buf) {
+
+  path file = this->chunkPath(id);
+  BackupProfileCompressType compression = compressionOf(id);
+  std::shared_ptr<BackupFile> chunk = nullptr;
+  std::shared_ptr<FileChecksum> checksum = nullptr;
+  size_t len = 0;
+
+  if (!boost::filesystem::exists(file)) {
+    std::ostringstream oss;
+    oss << "chunk " << id << " is missing in chunk store " << this->directory.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  chunk = chunkFile(file, compression);
+  chunk->setOpenMode("rb");
+  chunk->open();
+
+  try {
+
+    if (compression == BACKUP_COMPRESS_TYPE_NONE) {
+
+      /* ArchiveFile reads exactly len bytes or nothing */
+      buf.resize(boost::filesystem::file_size(file));
+      len = buf.size();
+
+      if (len > 0 && chunk->read(buf.data(), len) == 0) {
+        std::ostringstream oss;
+        oss << "could not read chunk " << file.string();
+        throw CArchiveIssue(oss.str());
+      }
+
+    } else {
+
+      buf.resize(DedupArchiveFile::CHUNK_SIZE);
+
+      while (true) {
+
+        size_t n;
+
+        if (len == buf.size())
+          buf.resize(buf.size() * 2);
+
+        if ((n = chunk->read(buf.data() + len, buf.size() - len)) == 0)
+          break;
+
+        len += n;
+
+      }
+
+      buf.resize(len);
+
+    }
+
+  } catch (CArchiveIssue &e) {
+
+    chunk->close();
+    throw e;
+
+  }
+
+  chunk->close();
+
+  checksum = FileChecksum::create("SHA256");
+  checksum->update(buf.data(), buf.size());
+
+  if (checksum->final() != id.substr(0, id.length() - suffix(compression).length())) {
+    std::ostringstream oss;
+    oss << "chunk " << file.string() << " is corrupted: checksum mismatch";
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+bool DedupChunkStore::empty() {
+
+  if (!boost::filesystem::is_directory(this->directory))
+    return true;
+
+  /* sweep() leaves the subdirectories behind */
+  for (auto &entry : boost::make_iterator_range(recursive_directory_iterator(this->directory), {})) {
+    if (boost::filesystem::is_regular_file(entry.symlink_status()))
+      return false;
+  }
+
+  return true;
+
+}
+
+int DedupChunkStore::lock(int operation) {
+
+  int fd = ::open(this->directory.string().c_str(), O_RDONLY);
+
+  if (fd < 0) {
+    throw CArchiveIssue("could not open chunk store \"" + this->directory.string() + "\": "
+                        + strerror(errno));
+  }
+
+  while (::flock(fd, operation) < 0) {
+
+    int err = errno;
+
+    if (err == EINTR)
+      continue;
+
+    ::close(fd);
+
+    if (err == EWOULDBLOCK)
+      return -1;
+
+    throw CArchiveIssue("could not lock chunk store \"" + this->directory.string() + "\": "
+                        + strerror(err));
+
+  }
+
+  return fd;
+
+}
+
+void DedupChunkStore::unlock(int fd) {
+
+  /* closing the descriptor releases the lock */
+  if (fd >= 0)
+    ::close(fd);
+
+}
+
+unsigned long long DedupChunkStore::sweep(std::shared_ptr<BackupCatalog> catalog,
+                                          int archive_id) {
+
+  unsigned long long removed = 0;
+  int lockfd;
+
+  if (!boost::filesystem::is_directory(this->directory))
+    return 0;
+
+  lockfd = this->lock(LOCK_EX | LOCK_NB);
+
+  if (lockfd < 0) {
+    BOOST_LOG_TRIVIAL(info) << "chunk store " << this->directory.string()
+                            << " in use, not sweeping";
+    return 0;
+  }
+
+  try {
+
+    /*
+     * Checked with the lock held, a basebackup registered afterwards
+     * can't write into the store before we are done.
+     */
+    if (catalog->hasBasebackupsInProgress(archive_id)) {
+      BOOST_LOG_TRIVIAL(info) << "basebackup in progress, not sweeping chunk store "
+                              << this->directory.string();
+      unlock(lockfd);
+      return 0;
+    }
+
+    removed = this->sweepLocked(catalog, archive_id);
+
+  } catch (std::exception &) {
+    unlock(lockfd);
+    throw;
+  }
+
+  unlock(lockfd);
+  return removed;
+
+}
+
+unsigned long long DedupChunkStore::sweepLocked(std::shared_ptr<BackupCatalog> catalog,
+                                                int archive_id) {
+
+  std::vector<path> victims;
+  std::set<path> directories;
+  unsigned long long removed = 0;
+
+  for (auto &entry : boost::make_iterator_range(recursive_directory_iterator(this->directory), {})) {
+
+    std::string id = entry.path().filename().string();
+
+    if (!boost::filesystem::is_regular_file(entry.symlink_status()))
+      continue;
+
+    /* leftovers of aborted basebackups */
+    if (id.find(".tmp.") != std::string::npos) {
+      victims.push_back(entry.path());
+      continue;
+    }
+
+    if (!catalog->chunkReferenced(archive_id, id)) {
+      victims.push_back(entry.path());
+      removed++;
+    }
+
+  }
+
+  for (auto &victim : victims) {
+
+    BOOST_LOG_TRIVIAL(debug) << "DEBUG: removing chunk " << victim.string();
+
+    boost::filesystem::remove(victim);
+    directories.insert(victim.parent_path());
+
+  }
+
+  for (auto &dir : directories) {
+    RootDirectory::fsync(dir);
+  }
+
+  catalog->deleteUnreferencedChunks(archive_id);
+
+  return removed;
+
+}
+
+/******************************************************************************
+ * Implementation of DedupArchiveFile
+ *****************************************************************************/
+
+const size_t DedupArchiveFile::CHUNK_SIZE;
+const size_t DedupArchiveFile::MIN_CHUNK_SIZE;
+const size_t DedupArchiveFile::COMMIT_BATCH;
+constexpr const char *DedupArchiveFile::SUFFIX;
+
+#define DEDUP_RECIPE_MAGIC "PGBCKDEDUP 1\n"
+
+/*
+ * Big endian encoding of the numbers within recipes.
+ */
+static void dedup_encode(char *out, uint64_t value, size_t bytes) {
+
+  for (size_t i = 0; i < bytes; i++)
+    out[i] = (char) ((value >> (8 * (bytes - i - 1))) & 0xFF);
+
+}
+
+static uint64_t dedup_decode(const char *in, size_t bytes) {
+
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < bytes; i++)
+    value = (value << 8) | (unsigned char) in[i];
+
+  return value;
+
+}
+
+DedupArchiveFile::DedupArchiveFile(path file) : BackupFile(file) {
+
+  this->file = std::make_shared<ArchiveFile>(file);
+  this->compressed = true;
+
+}
+
+DedupArchiveFile::DedupArchiveFile(path file,
+                                   std::shared_ptr<DedupChunkStore> store,
+                                   BackupProfileCompressType compression,
+                                   int compression_level) : BackupFile(file) {
+
+  this->file = std::make_shared<ArchiveFile>(file);
+  this->store = store;
+  this->compression = compression;
+  this->compression_level = compression_level;
+  this->compressed = true;
+
+}
+
+DedupArchiveFile::~DedupArchiveFile() {
+
+  /* an archive abandoned without close() */
+  DedupChunkStore::unlock(this->store_lock);
+
+}
+
+uint64_t DedupArchiveFile::bytesStored() {
+  return this->bytes_stored;
+}
+
+uint64_t DedupArchiveFile::bytesReused() {
+  return this->bytes_reused;
+}
+
+bool DedupArchiveFile::isCompressed() {
+  return true;
+}
+
+bool DedupArchiveFile::isOpen() {
+  return this->opened;
+}
+
+void DedupArchiveFile::setOpenMode(std::string mode) {
+  this->mode = mode;
+}
+
+std::string DedupArchiveFile::getOpenMode() {
+  return this->mode;
+}
+
+path DedupArchiveFile::readHeader(std::shared_ptr<ArchiveFile> recipe) {
+
+  char magic[sizeof(DEDUP_RECIPE_MAGIC) - 1];
+  char len[4];
+  std::vector<char> dir;
+
+  if (recipe->read(magic, sizeof(magic)) == 0
+      || memcmp(magic, DEDUP_RECIPE_MAGIC, sizeof(magic)) != 0) {
+    std::ostringstream oss;
+    oss << "file " << recipe->getFilePath() << " is not a deduplicated archive";
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (recipe->read(len, sizeof(len)) != 0)
+    dir.resize(dedup_decode(len, sizeof(len)));
+
+  if (dir.empty() || recipe->read(dir.data(), dir.size()) == 0) {
+    std::ostringstream oss;
+    oss << "invalid header in deduplicated archive " << recipe->getFilePath();
+    throw CArchiveIssue(oss.str());
+  }
+
+  return path(std::string(dir.data(), dir.size()));
+
+}
+
+bool DedupArchiveFile::readRecord(std::shared_ptr<ArchiveFile> recipe,
+                                  char &type,
+                                  uint64_t &len,
+                                  std::string &id,
+                                  std::vector<char> *literal) {
+
+  char head[5];
+  bool truncated = false;
+
+  if (recipe->read(head, sizeof(head)) == 0) {
+    std::ostringstream oss;
+    oss << "unexpected end of deduplicated archive " << recipe->getFilePath();
+    throw CArchiveIssue(oss.str());
+  }
+
+  type = head[0];
+  len = dedup_decode(head + 1, 4);
+
+  switch(type) {
+
+  case 'L':
+  case 'E':
+    {
+      size_t payload = (size_t) len;
+
+      if (type == 'E' && payload != sizeof(uint64_t)) {
+        truncated = true;
+        break;
+      }
+
+      if (literal != nullptr) {
+        literal->resize(payload);
+        truncated = (payload > 0 && recipe->read(literal->data(), payload) == 0);
+      } else {
+        recipe->lseek(payload, SEEK_CUR);
+      }
+
+      break;
+    }
+
+  case 'C':
+    {
+      unsigned char idlen = 0;
+      char idbuf[256];
+
+      truncated = (recipe->read((char *) &idlen, 1) == 0
+                   || idlen == 0
+                   || recipe->read(idbuf, idlen) == 0);
+
+      if (!truncated)
+        id.assign(idbuf, idlen);
+
+      break;
+    }
+
+  default:
+    {
+      std::ostringstream oss;
+      oss << "invalid record type in deduplicated archive " << recipe->getFilePath();
+      throw CArchiveIssue(oss.str());
+    }
+
+  }
+
+  if (truncated) {
+    std::ostringstream oss;
+    oss << "invalid record in deduplicated archive " << recipe->getFilePath();
+    throw CArchiveIssue(oss.str());
+  }
+
+  return (type != 'E');
+
+}
+
+void DedupArchiveFile::chunks(path file, std::set<std::string> &ids) {
+
+  std::shared_ptr<ArchiveFile> recipe = std::make_shared<ArchiveFile>(file);
+  char type;
+  uint64_t len;
+  std::string id;
+
+  recipe->setOpenMode("rb");
+  recipe->open();
+
+  try {
+
+    readHeader(recipe);
+
+    while (readRecord(recipe, type, len, id, nullptr)) {
+
+      if (type == 'C')
+        ids.insert(id);
+
+    }
+
+  } catch (CArchiveIssue &e) {
+
+    recipe->close();
+    throw e;
+
+  }
+
+  recipe->close();
+
+}
+
+void DedupArchiveFile::open() {
+
+  if (this->opened) {
+    std::ostringstream oss;
+    oss << "deduplicated archive " << this->handle.string() << " already opened";
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->writing = (this->mode.find_first_of("wa") != std::string::npos);
+  this->currpos = 0;
+
+  if (this->writing) {
+
+    std::string dir;
+    char len[4];
+
+    if (this->store == nullptr) {
+      std::ostringstream oss;
+      oss << "cannot write deduplicated archive " << this->handle.string()
+          << " without a chunk store";
+      throw CArchiveIssue(oss.str());
+    }
+
+    /* throws on unsupported compression before anything is created */
+    DedupChunkStore::suffix(this->compression);
+
+    if (!boost::filesystem::exists(this->store->getPath())) {
+      create_directories(this->store->getPath());
+      RootDirectory::fsync(this->store->getPath().parent_path());
+    }
+
+    /* waits for a running sweep, chunks found now stay until we're done */
+    this->store_lock = this->store->lock(LOCK_SH);
+
+    try {
+      this->file->setOpenMode("wb");
+      this->file->open();
+    } catch (CArchiveIssue &e) {
+      DedupChunkStore::unlock(this->store_lock);
+      this->store_lock = -1;
+      throw e;
+    }
+
+    dir = this->store->getPath().string();
+    dedup_encode(len, dir.length(), sizeof(len));
+
+    this->file->write(DEDUP_RECIPE_MAGIC, strlen(DEDUP_RECIPE_MAGIC));
+    this->file->write(len, sizeof(len));
+    this->file->write(dir.c_str(), dir.length());
+
+    this->header_fill = 0;
+    this->remaining = 0;
+    this->padding = 0;
+    this->chunking = false;
+    this->eof = false;
+    this->literal.clear();
+    this->chunk.clear();
+    this->stream_size = 0;
+
+  } else {
+
+    this->file->setOpenMode("rb");
+    this->file->open();
+
+    try {
+      this->store = std::make_shared<DedupChunkStore>(readHeader(this->file));
+    } catch (CArchiveIssue &e) {
+      this->file->close();
+      throw e;
+    }
+
+    this->data.clear();
+    this->data_pos = 0;
+    this->end = false;
+
+  }
+
+  this->opened = true;
+
+}
+
+void DedupArchiveFile::member() {
+
+  ArchiveMemberIndexEntry entry;
+
+  try {
+
+    if (!ArchiveMemberIndex::parseTarHeader(this->header, entry)) {
+      this->eof = true;
+      return;
+    }
+
+  } catch (CArchiveIssue &e) {
+
+    BOOST_LOG_TRIVIAL(warning) << "WARNING: invalid tar header in "
+                               << this->handle.string()
+                               << ", not deduplicating the rest of the archive";
+    this->eof = true;
+    return;
+
+  }
+
+  this->remaining = entry.size;
+  this->padding = (512 - (entry.size % 512)) % 512;
+  this->chunking = (entry.size >= MIN_CHUNK_SIZE);
+
+}
+
+void DedupArchiveFile::writeRecord(char type, uint32_t len, const char *buf, size_t buflen) {
+
+  char head[5];
+
+  head[0] = type;
+  dedup_encode(head + 1, len, 4);
+
+  this->file->write(head, sizeof(head));
+
+  if (buflen > 0)
+    this->file->write(buf, buflen);
+
+}
+
+void DedupArchiveFile::writeLiteral() {
+
+  size_t pos = 0;
+
+  while (pos < this->literal.size()) {
+
+    size_t n = std::min(this->literal.size() - pos, CHUNK_SIZE);
+
+    this->writeRecord('L', n, this->literal.data() + pos, n);
+    pos += n;
+
+  }
+
+  this->literal.clear();
+
+}
+
+void DedupArchiveFile::writeChunk() {
+
+  std::shared_ptr<FileChecksum> checksum = nullptr;
+  std::string id;
+  std::vector<char> ref;
+
+  if (this->chunk.empty())
+    return;
+
+  /* keep the stream in order */
+  this->writeLiteral();
+
+  checksum = FileChecksum::create("SHA256");
+  checksum->update(this->chunk.data(), this->chunk.size());
+  id = checksum->final() + DedupChunkStore::suffix(this->compression);
+
+  if (this->pending_ids.count(id) > 0 || this->store->exists(id)) {
+
+    this->bytes_reused += this->chunk.size();
+
+  } else {
+
+    this->pending.push_back(std::make_pair(this->store->write(id,
+                                                              this->chunk.data(),
+                                                              this->chunk.size(),
+                                                              this->compression_level),
+                                           id));
+    this->pending_ids.insert(id);
+    this->bytes_stored += this->chunk.size();
+
+  }
+
+  ref.push_back((char) id.length());
+  ref.insert(ref.end(), id.begin(), id.end());
+
+  this->writeRecord('C', this->chunk.size(), ref.data(), ref.size());
+  this->chunk.clear();
+
+  if (this->pending.size() >= COMMIT_BATCH)
+    this->commitChunks();
+
+}
+
+void DedupArchiveFile::commitChunks() {
+
+  this->store->commit(this->pending);
+  this->pending.clear();
+  this->pending_ids.clear();
+
+}
+
+size_t DedupArchiveFile::write(const char *buf, size_t len) {
+
+  size_t pos = 0;
+
+  if (!this->opened || !this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to write into file not opened for writing "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  while (pos < len) {
+
+    size_t n;
+
+    /* Rest of the stream goes into the recipe as is */
+    if (this->eof) {
+
+      this->literal.insert(this->literal.end(), buf + pos, buf + len);
+      pos = len;
+      break;
+
+    }
+
+    /* Member contents */
+    if (this->remaining > 0) {
+
+      n = std::min(this->remaining, len - pos);
+
+      if (this->chunking) {
+
+        n = std::min(n, CHUNK_SIZE - this->chunk.size());
+        this->chunk.insert(this->chunk.end(), buf + pos, buf + pos + n);
+
+      } else {
+
+        this->literal.insert(this->literal.end(), buf + pos, buf + pos + n);
+
+      }
+
+      this->remaining -= n;
+      pos += n;
+
+      if (this->chunking
+          && (this->chunk.size() == CHUNK_SIZE || this->remaining == 0))
+        this->writeChunk();
+
+      continue;
+
+    }
+
+    /* Padding up to the next 512 byte block */
+    if (this->padding > 0) {
+
+      n = std::min(this->padding, len - pos);
+      this->literal.insert(this->literal.end(), buf + pos, buf + pos + n);
+
+      this->padding -= n;
+      pos += n;
+      continue;
+
+    }
+
+    n = std::min(sizeof(this->header) - this->header_fill, len - pos);
+    memcpy(this->header + this->header_fill, buf + pos, n);
+    this->literal.insert(this->literal.end(), buf + pos, buf + pos + n);
+
+    this->header_fill += n;
+    pos += n;
+
+    if (this->header_fill == sizeof(this->header)) {
+      this->header_fill = 0;
+      this->member();
+    }
+
+  }
+
+  if (this->literal.size() >= CHUNK_SIZE)
+    this->writeLiteral();
+
+  this->stream_size += len;
+  this->currpos += len;
+  return len;
+
+}
+
+void DedupArchiveFile::fsync() {
+
+  if (this->opened && this->writing) {
+    this->writeLiteral();
+    this->commitChunks();
+  }
+
+  this->file->fsync();
+
+}
+
+void DedupArchiveFile::close() {
+
+  if (!this->opened)
+    return;
+
+  this->opened = false;
+
+  if (this->writing) {
+
+    char total[8];
+
+    /* a stream ending within a member */
+    this->writeChunk();
+    this->writeLiteral();
+
+    dedup_encode(total, this->stream_size, sizeof(total));
+    this->writeRecord('E', sizeof(total), total, sizeof(total));
+
+    this->commitChunks();
+    this->file->fsync();
+
+    DedupChunkStore::unlock(this->store_lock);
+    this->store_lock = -1;
+
+    BOOST_LOG_TRIVIAL(debug) << "DEBUG: deduplicated archive " << this->handle.string()
+                             << ": " << this->bytes_reused << " of "
+                             << (this->bytes_stored + this->bytes_reused)
+                             << " bytes of chunk data found in chunk store";
+
+  }
+
+  this->file->close();
+
+}
+
+bool DedupArchiveFile::nextRecord() {
+
+  char type;
+  uint64_t len;
+  std::string id;
+
+  if (this->end)
+    return false;
+
+  this->data_pos = 0;
+
+  if (!readRecord(this->file, type, len, id, &this->data)) {
+
+    if (dedup_decode(this->data.data(), sizeof(uint64_t)) != (uint64_t) this->currpos) {
+      std::ostringstream oss;
+      oss << "deduplicated archive " << this->handle.string()
+          << " is incomplete: stream size mismatch";
+      throw CArchiveIssue(oss.str());
+    }
+
+    this->data.clear();
+    this->end = true;
+    return false;
+
+  }
+
+  if (type == 'C') {
+
+    this->store->read(id, this->data);
+
+    if (this->data.size() != len) {
+      std::ostringstream oss;
+      oss << "chunk " << id << " referenced by " << this->handle.string()
+          << " has an unexpected size";
+      throw CArchiveIssue(oss.str());
+    }
+
+  }
+
+  return true;
+
+}
+
+size_t DedupArchiveFile::read(char *buf, size_t len) {
+
+  size_t copied = 0;
+
+  if (!this->opened || this->writing) {
+    std::ostringstream oss;
+    oss << "attempt to read from file not opened for reading "
+        << this->handle.string();
+    throw CArchiveIssue(oss.str());
+  }
+
+  while (copied < len) {
+
+    size_t n;
+
+    if (this->data_pos == this->data.size()) {
+
+      if (!this->nextRecord())
+        break;
+
+      continue;
+
+    }
+
+    n = std::min(len - copied, this->data.size() - this->data_pos);
+    memcpy(buf + copied, this->data.data() + this->data_pos, n);
+
+    this->data_pos += n;
+    this->currpos += n;
+    copied += n;
+
+  }
+
+  return copied;
+
+}
+
+off_t DedupArchiveFile::lseek(off_t offset, int whence) {
+
+  off_t target;
+  std::vector<char> scratch;
+
+  if (!this->opened || this->writing) {
+    std::ostringstream oss;
+    oss << "cannot seek in file " << this->handle.string()
+        << ": not opened for reading";
+    throw CArchiveIssue(oss.str());
+  }
+
+  switch(whence) {
+
+  case SEEK_SET:
+    target = offset;
+    break;
+  case SEEK_CUR:
+    target = this->currpos + offset;
+    break;
+  default:
+    {
+      std::ostringstream oss;
+      oss << "cannot seek in deduplicated archive " << this->handle.string()
+          << ": whence not supported";
+      throw CArchiveIssue(oss.str());
+    }
+
+  }
+
+  if (target < 0) {
+    std::ostringstream oss;
+    oss << "cannot seek in file " << this->handle.string()
+        << ": invalid offset " << target;
+    throw CArchiveIssue(oss.str());
+  }
+
+  /* no way back, start over */
+  if (target < this->currpos) {
+    this->close();
+    this->open();
+  }
+
+  scratch.resize(std::min((off_t) CHUNK_SIZE, target - this->currpos));
+
+  while (this->currpos < target) {
+
+    if (this->read(scratch.data(),
+                   std::min(scratch.size(), (size_t) (target - this->currpos))) == 0)
+      break;
+
+  }
+
+  return this->currpos;
+
+}
+
+void DedupArchiveFile::rename(path& newname) {
+
+  this->file->rename(newname);
+  this->handle = newname;
+
+}
+
+void DedupArchiveFile::remove() {
+
+  if (this->opened)
+    this->close();
+
+  this->file->remove();
+
+}
+
 /******************************************************************************
  * Implementation of BackupHistoryFile
  *****************************************************************************/
@@ -0,0 +1,528 @@
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+#include <boost/log/trivial.hpp>
+
+#include <fs-sync.hxx>
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+#include <io_uring_instance.hxx>
+#endif
+
+using namespace pgbckctl;
+
+/******************************************************************************
+ * RecursiveSync Implementation
+ ******************************************************************************/
+
+const unsigned int RecursiveSync::DEFAULT_PARALLELISM;
+const unsigned int RecursiveSync::MAX_PARALLELISM;
+
+RecursiveSync::RecursiveSync(path root) {
+
+  this->root = root;
+  this->synced = 0;
+  this->errors = 0;
+
+}
+
+RecursiveSync::~RecursiveSync() {}
+
+void RecursiveSync::setMethod(RecursiveSyncMethod method) {
+  this->method = method;
+}
+
+RecursiveSyncMethod RecursiveSync::getMethod() {
+  return this->method;
+}
+
+void RecursiveSync::setParallelism(unsigned int parallelism) {
+
+  if (parallelism > RecursiveSync::MAX_PARALLELISM) {
+    std::ostringstream oss;
+    oss << "number of parallel sync requests must not exceed "
+        << RecursiveSync::MAX_PARALLELISM;
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->parallelism = (parallelism == 0) ? RecursiveSync::DEFAULT_PARALLELISM : parallelism;
+
+}
+
+void RecursiveSync::setIgnoreErrors(bool ignore) {
+  this->ignore_errors = ignore;
+}
+
+void RecursiveSync::setProgressCallback(std::function<void(const RecursiveSyncProgress &)> cb,
+                                        std::chrono::milliseconds interval) {
+
+  this->progress_cb = cb;
+  this->progress_interval = interval;
+
+}
+
+RecursiveSyncMethod RecursiveSync::methodFromString(std::string method) {
+
+  if (method == "auto")
+    return RECURSIVE_SYNC_AUTO;
+
+  if (method == "fsync")
+    return RECURSIVE_SYNC_FSYNC;
+
+  if (method == "io_uring")
+    return RECURSIVE_SYNC_IO_URING;
+
+  if (method == "syncfs")
+    return RECURSIVE_SYNC_SYNCFS;
+
+  std::ostringstream oss;
+  oss << "invalid recursive sync method \"" << method << "\"";
+  throw CArchiveIssue(oss.str());
+
+}
+
+std::string RecursiveSync::methodToString(RecursiveSyncMethod method) {
+
+  switch(method) {
+  case RECURSIVE_SYNC_AUTO:
+    return "auto";
+  case RECURSIVE_SYNC_FSYNC:
+    return "fsync";
+  case RECURSIVE_SYNC_IO_URING:
+    return "io_uring";
+  case RECURSIVE_SYNC_SYNCFS:
+    return "syncfs";
+  }
+
+  return "unknown";
+
+}
+
+bool RecursiveSync::isMountPoint(const path &p) {
+
+  struct stat st;
+  struct stat parent_st;
+
+  if (::stat(p.string().c_str(), &st) < 0)
+    return false;
+
+  if (::stat((p / "..").string().c_str(), &parent_st) < 0)
+    return false;
+
+  /* Either on another device than its parent, or "/" */
+  return (st.st_dev != parent_st.st_dev)
+    || (st.st_ino == parent_st.st_ino);
+
+}
+
+void RecursiveSync::recordError(const path &entry, const std::string &what, int err) {
+
+  std::lock_guard<std::mutex> lock(this->mtx);
+  std::ostringstream oss;
+
+  oss << "could not " << what << " \"" << entry.string() << "\": " << strerror(err);
+
+  BOOST_LOG_TRIVIAL(warning) << oss.str();
+
+  if (this->error.empty())
+    this->error = oss.str();
+
+  this->errors++;
+
+}
+
+void RecursiveSync::collect(const path &dir, dev_t dev) {
+
+  boost::system::error_code ec;
+
+  if (std::find(this->devices.begin(), this->devices.end(), dev) == this->devices.end())
+    this->devices.push_back(dev);
+
+  this->directories.push_back(dir);
+
+  for (directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+
+    struct stat st;
+    path entry = it->path();
+
+    /*
+     * stat() follows symlinks, so symlinked tablespace
+     * directories are synced, too.
+     */
+    if (::stat(entry.string().c_str(), &st) < 0) {
+
+      /* vanished in the meantime */
+      if (errno != ENOENT)
+        this->recordError(entry, "stat", errno);
+      continue;
+
+    }
+
+    if (S_ISDIR(st.st_mode))
+      this->collect(entry, st.st_dev);
+    else if (S_ISREG(st.st_mode))
+      this->files.push_back(entry);
+
+  }
+
+  if (ec && ec.value() != ENOENT)
+    this->recordError(dir, "read directory", ec.value());
+
+}
+
+bool RecursiveSync::syncEntry(const path &entry, bool directory) {
+
+  int fd = ::open(entry.string().c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0) {
+
+    /*
+     * Files removed in the meantime don't need to be synced anymore.
+     * Some filesystems don't allow to open directories, see fsync_fname()
+     * in PostgreSQL.
+     */
+    if (errno == ENOENT
+        || (directory && (errno == EACCES || errno == EISDIR)))
+      return true;
+
+    this->recordError(entry, "open", errno);
+    return false;
+
+  }
+
+  if (::fsync(fd) < 0
+      && !(directory && (errno == EBADF || errno == EINVAL))) {
+
+    int err = errno;
+
+    ::close(fd);
+    this->recordError(entry, "fsync", err);
+    return false;
+
+  }
+
+  ::close(fd);
+  return true;
+
+}
+
+RecursiveSyncProgress RecursiveSync::progress() {
+
+  RecursiveSyncProgress result;
+
+  result.method  = this->active;
+  result.total   = this->files.size() + this->directories.size();
+  result.synced  = this->synced;
+  result.errors  = this->errors;
+  result.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()
+                                                                         - this->start);
+
+  return result;
+
+}
+
+void RecursiveSync::report(bool force) {
+
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+  if (this->progress_cb == nullptr)
+    return;
+
+  if (!force && (now - this->last_report) < this->progress_interval)
+    return;
+
+  this->last_report = now;
+  this->progress_cb(this->progress());
+
+}
+
+void RecursiveSync::syncThreaded() {
+
+  std::vector<std::thread> workers;
+  std::atomic<unsigned long long> next(0);
+  std::atomic<unsigned int> running(0);
+  unsigned long long total = this->files.size() + this->directories.size();
+  unsigned int num_workers = (unsigned int) std::min<unsigned long long>(this->parallelism,
+                                                                         total);
+  std::chrono::milliseconds poll = std::min(this->progress_interval,
+                                            std::chrono::milliseconds(100));
+
+  /*
+   * Files first, so directories are usually synced
+   * after their contents.
+   */
+  auto work = [this, &next, &running, total]() {
+
+    unsigned long long i;
+
+    while ((i = next++) < total) {
+
+      bool directory = (i >= this->files.size());
+      const path &entry = directory ? this->directories[i - this->files.size()] : this->files[i];
+
+      if (this->syncEntry(entry, directory))
+        this->synced++;
+
+    }
+
+    running--;
+
+  };
+
+  running = num_workers;
+
+  for (unsigned int w = 0; w < num_workers; w++)
+    workers.push_back(std::thread(work));
+
+  while (this->progress_cb != nullptr && running > 0) {
+
+    std::this_thread::sleep_for(poll);
+    this->report(false);
+
+  }
+
+  for (auto &t : workers)
+    t.join();
+
+}
+
+void RecursiveSync::syncIOUring() {
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+
+  IOUringInstance ring(this->parallelism, IOUringInstance::DEFAULT_BLOCK_SIZE);
+  unsigned long long total = this->files.size() + this->directories.size();
+  unsigned long long next = 0;
+  unsigned int inflight = 0;
+
+  /* file descriptor and entry index of every request in flight, by slot */
+  std::vector<int> slot_fd(this->parallelism, -1);
+  std::vector<unsigned long long> slot_entry(this->parallelism, 0);
+  std::vector<unsigned int> free_slots;
+
+  try {
+    ring.setup();
+  } catch (CIOUringIssue &e) {
+
+    BOOST_LOG_TRIVIAL(warning) << "io_uring not usable, syncing with threads: " << e.what();
+    this->active = RECURSIVE_SYNC_FSYNC;
+    this->syncThreaded();
+    return;
+
+  }
+
+  for (unsigned int s = this->parallelism; s > 0; s--)
+    free_slots.push_back(s - 1);
+
+  while (next < total || inflight > 0) {
+
+    struct io_uring_cqe *cqe = NULL;
+    unsigned int prepared = 0;
+
+    /*
+     * Fill up all free slots. Opening the files happens here,
+     * only the fsync requests are handled by the kernel.
+     */
+    while (next < total && !free_slots.empty()) {
+
+      bool directory = (next >= this->files.size());
+      const path &entry = directory ? this->directories[next - this->files.size()] : this->files[next];
+      unsigned int slot;
+      int fd = ::open(entry.string().c_str(), O_RDONLY | O_CLOEXEC);
+
+      if (fd < 0) {
+
+        if (errno == ENOENT
+            || (directory && (errno == EACCES || errno == EISDIR)))
+          this->synced++;
+        else
+          this->recordError(entry, "open", errno);
+
+        next++;
+        continue;
+
+      }
+
+      slot = free_slots.back();
+      free_slots.pop_back();
+
+      slot_fd[slot] = fd;
+      slot_entry[slot] = next;
+
+      ring.prepare_fsync(fd, slot);
+      prepared++;
+      next++;
+
+    }
+
+    if (prepared > 0) {
+      ring.submit();
+      inflight += prepared;
+    }
+
+    if (inflight == 0)
+      continue;
+
+    ring.wait(&cqe);
+
+    {
+      unsigned int slot = (unsigned int) cqe->user_data;
+      unsigned long long i = slot_entry[slot];
+      bool directory = (i >= this->files.size());
+      int res = cqe->res;
+
+      ring.seen(&cqe);
+
+      ::close(slot_fd[slot]);
+      slot_fd[slot] = -1;
+      free_slots.push_back(slot);
+      inflight--;
+
+      if (res < 0 && !(directory && (res == -EBADF || res == -EINVAL)))
+        this->recordError(directory ? this->directories[i - this->files.size()] : this->files[i],
+                          "fsync", -res);
+      else
+        this->synced++;
+    }
+
+    this->report(false);
+
+  }
+
+  ring.exit();
+
+#else
+
+  BOOST_LOG_TRIVIAL(debug) << "compiled without io_uring support, syncing with threads";
+  this->active = RECURSIVE_SYNC_FSYNC;
+  this->syncThreaded();
+
+#endif
+
+}
+
+void RecursiveSync::syncFilesystems() {
+
+  /*
+   * syncfs() needs a file descriptor of any file on
+   * the filesystem, use the first directory found on
+   * every device.
+   */
+  for (auto &dev : this->devices) {
+
+    for (auto &dir : this->directories) {
+
+      struct stat st;
+      int fd;
+
+      if (::stat(dir.string().c_str(), &st) < 0 || st.st_dev != dev)
+        continue;
+
+      fd = ::open(dir.string().c_str(), O_RDONLY | O_CLOEXEC);
+
+      if (fd < 0) {
+        this->recordError(dir, "open", errno);
+        break;
+      }
+
+      if (::syncfs(fd) < 0)
+        this->recordError(dir, "syncfs", errno);
+
+      ::close(fd);
+      break;
+
+    }
+
+  }
+
+  /* syncfs() doesn't tell about single files */
+  this->synced = (this->files.size() + this->directories.size()) - this->errors;
+
+}
+
+RecursiveSyncProgress RecursiveSync::sync() {
+
+  struct stat st;
+  RecursiveSyncProgress result;
+
+  this->files.clear();
+  this->directories.clear();
+  this->devices.clear();
+  this->synced = 0;
+  this->errors = 0;
+  this->error = "";
+  this->start = std::chrono::steady_clock::now();
+  this->last_report = this->start;
+
+  if (::stat(this->root.string().c_str(), &st) < 0) {
+    std::ostringstream oss;
+    oss << "could not sync \"" << this->root.string() << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (S_ISDIR(st.st_mode))
+    this->collect(this->root, st.st_dev);
+  else
+    this->files.push_back(this->root);
+
+  /*
+   * syncfs() is only chosen automatically if the whole tree is on
+   * a filesystem of its own, since it also flushes everything else
+   * written to the same filesystem.
+   */
+  this->active = this->method;
+
+  if (this->active == RECURSIVE_SYNC_AUTO) {
+
+    if (S_ISDIR(st.st_mode)
+        && this->devices.size() == 1
+        && RecursiveSync::isMountPoint(this->root)) {
+      this->active = RECURSIVE_SYNC_SYNCFS;
+    } else {
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+      this->active = RECURSIVE_SYNC_IO_URING;
+#else
+      this->active = RECURSIVE_SYNC_FSYNC;
+#endif
+    }
+
+  }
+
+  /* syncfs() requires something to open on the filesystem */
+  if (this->active == RECURSIVE_SYNC_SYNCFS && this->directories.empty())
+    this->active = RECURSIVE_SYNC_FSYNC;
+
+  BOOST_LOG_TRIVIAL(debug) << "syncing " << this->files.size() << " files and "
+                           << this->directories.size() << " directories below \""
+                           << this->root.string() << "\" using "
+                           << RecursiveSync::methodToString(this->active);
+
+  switch(this->active) {
+  case RECURSIVE_SYNC_SYNCFS:
+    this->syncFilesystems();
+    break;
+  case RECURSIVE_SYNC_IO_URING:
+    this->syncIOUring();
+    break;
+  default:
+    this->syncThreaded();
+    break;
+  }
+
+  this->report(true);
+  result = this->progress();
+
+  if (result.errors > 0 && !this->ignore_errors) {
+    std::ostringstream oss;
+    oss << "sync of \"" << this->root.string() << "\" failed for "
+        << result.errors << " files: " << this->error;
+    throw CArchiveIssue(oss.str());
+  }
+
+  return result;
+
+}
@@ -1,11 +1,13 @@
 #include <io_uring_instance.hxx>
+#include <probes.hxx>
 
 #ifdef PG_BACKUP_CTL_HAS_LIBURING
 
 using namespace pgbckctl;
 
 vectored_buffer::vectored_buffer(size_t total_size,
-                                 unsigned int bufsize) {
+                                 unsigned int bufsize,
+                                 size_t alignment) {
 
   unsigned int i;
   unsigned int extra_bytes = 0;
@@ -33,7 +35,11 @@ vectored_buffer::vectored_buffer(size_t total_size,
 
     /* Prepare IO vectors suitable for preadv()/pwritev() */
 
-    if (i < (num_buffers)) {
+    if (alignment > 0) {
+      buffers.push_back(std::make_shared<AlignedMemoryBuffer>(buffer_size, alignment));
+      iovecs[i].iov_base = buffers[i]->ptr();
+      iovecs[i].iov_len = buffer_size;
+    } else if (i < (num_buffers)) {
       buffers.push_back(std::make_shared<MemoryBuffer>(buffer_size));
       iovecs[i].iov_base = buffers[i]->ptr();
       iovecs[i].iov_len = buffer_size;
@@ -81,7 +87,7 @@ void vectored_buffer::setEffectiveSize(const ssize_t usable, bool adjust_buflen)
 
       /* Prepare IO vectors suitable for preadv()/pwritev() */
 
-      if (i < (num_buffers - 1)) {
+      if (i < (num_buffers - 1) || extra_bytes == 0) {
         iovecs[i].iov_len = buffer_size;
       } else {
         iovecs[i].iov_len = extra_bytes;
@@ -238,6 +244,104 @@ vectored_buffer::~vectored_buffer() {
 
 }
 
+/* **************************************************************************
+ * vectored_buffer_pool
+ * **************************************************************************/
+
+const unsigned int vectored_buffer_pool::DEFAULT_MAX_IDLE;
+
+vectored_buffer_pool::vectored_buffer_pool(unsigned int block_size,
+                                           size_t alignment,
+                                           unsigned int max_idle) {
+
+  if (block_size == 0)
+    throw CIOUringIssue("block size of vectored buffer pool must not be 0");
+
+  if (alignment > 0 && (block_size % alignment) != 0) {
+    std::ostringstream oss;
+    oss << "block size of vectored buffer pool(" << block_size
+        << ") must be a multiple of its alignment(" << alignment << ")";
+    throw CIOUringIssue(oss.str());
+  }
+
+  this->block_size = block_size;
+  this->alignment  = alignment;
+  this->max_idle   = max_idle;
+
+}
+
+vectored_buffer_pool::~vectored_buffer_pool() {}
+
+std::shared_ptr<vectored_buffer> vectored_buffer_pool::get(size_t total_size) {
+
+  {
+    std::lock_guard<std::mutex> lock(this->pool_mtx);
+
+    for (auto it = this->idle.begin(); it != this->idle.end(); it++) {
+
+      if ((size_t) (*it)->getSize() == total_size) {
+
+        std::shared_ptr<vectored_buffer> buf = *it;
+
+        this->idle.erase(it);
+
+        /* Undo offsets and effective sizes of the previous user */
+        buf->clear();
+        buf->setEffectiveSize(total_size);
+
+        return buf;
+
+      }
+
+    }
+
+    this->allocated++;
+  }
+
+  return std::make_shared<vectored_buffer>(total_size, this->block_size, this->alignment);
+
+}
+
+void vectored_buffer_pool::release(std::shared_ptr<vectored_buffer> buf) {
+
+  if (buf == nullptr)
+    return;
+
+  if (buf->getBufferSize() != this->block_size)
+    throw CIOUringIssue("cannot release vectored buffer with foreign block size into pool");
+
+  std::lock_guard<std::mutex> lock(this->pool_mtx);
+
+  /* Just let the buffer go if we have enough of them */
+  if (this->idle.size() < this->max_idle)
+    this->idle.push_back(buf);
+
+}
+
+unsigned int vectored_buffer_pool::getBlockSize() {
+
+  return this->block_size;
+
+}
+
+unsigned long vectored_buffer_pool::getAllocated() {
+
+  std::lock_guard<std::mutex> lock(this->pool_mtx);
+  return this->allocated;
+
+}
+
+size_t vectored_buffer_pool::getIdle() {
+
+  std::lock_guard<std::mutex> lock(this->pool_mtx);
+  return this->idle.size();
+
+}
+
+/* **************************************************************************
+ * IOUringInstance
+ * **************************************************************************/
+
 IOUringInstance::IOUringInstance(unsigned int     queue_depth,
                                  size_t           block_size,
                                  struct io_uring  ring) {
@@ -305,6 +409,7 @@ void IOUringInstance::read(std::shared_ptr<ArchiveFile> file,
                            off_t pos) {
 
   struct io_uring_sqe *sqe = NULL;
+  int rc;
 
   /*
    * Is this a valid archive file handle?
@@ -322,6 +427,9 @@ void IOUringInstance::read(std::shared_ptr<ArchiveFile> file,
 
   }
 
+  if (file->isDirectIO())
+    this->prepare_direct_io(buf, pos);
+
   /* get a submission queue entry item */
   sqe = io_uring_get_sqe(&ring);
 
@@ -336,7 +444,8 @@ void IOUringInstance::read(std::shared_ptr<ArchiveFile> file,
                       buf->getEffectiveNumberOfBuffers(),
                       pos);
 
-  io_uring_submit(&ring);
+  rc = io_uring_submit(&ring);
+  TRACE_PGBCKCTL_URING_SUBMIT(rc);
 
 }
 
@@ -386,6 +495,7 @@ void IOUringInstance::write(std::shared_ptr<ArchiveFile> file,
                             off_t pos) {
 
   struct io_uring_sqe *sqe = NULL;
+  int rc;
 
   /*
    * File needs to be valid and opened.
@@ -402,6 +512,9 @@ void IOUringInstance::write(std::shared_ptr<ArchiveFile> file,
 
   }
 
+  if (file->isDirectIO())
+    this->prepare_direct_io(buf, pos);
+
   sqe = io_uring_get_sqe(&ring);
 
   if (!sqe) {
@@ -415,7 +528,8 @@ void IOUringInstance::write(std::shared_ptr<ArchiveFile> file,
                        buf->getEffectiveNumberOfBuffers(),
                        pos);
 
-  io_uring_submit(&ring);
+  rc = io_uring_submit(&ring);
+  TRACE_PGBCKCTL_URING_SUBMIT(rc);
 }
 
 void IOUringInstance::setBlockSize(size_t block_size) {
@@ -437,12 +551,80 @@ size_t IOUringInstance::getBlockSize() {
 
 }
 
+void IOUringInstance::prepare_direct_io(std::shared_ptr<vectored_buffer> buf,
+                                        off_t pos) {
+
+  const size_t alignment = ArchiveFile::DIRECT_IO_ALIGNMENT;
+  struct iovec *iov = buf->iovec_ptr();
+  unsigned int n = buf->getEffectiveNumberOfBuffers();
+
+  if ((pos % alignment) != 0) {
+    std::ostringstream oss;
+    oss << "file offset " << pos << " not aligned for direct I/O";
+    throw CIOUringIssue(oss.str());
+  }
+
+  for (unsigned int i = 0; i < n; i++) {
+
+    unsigned int index = (iov + i) - buf->iovecs;
+    char *start = buf->buffers[index]->ptr();
+    size_t len = iov[i].iov_len;
+
+    if (((uintptr_t) iov[i].iov_base % alignment) != 0)
+      throw CIOUringIssue("buffer not aligned for direct I/O");
+
+    /*
+     * Only the last vector might be unaligned, it's the tail
+     * of a file. Pad it, that's what the buffer has room for.
+     */
+    if ((len % alignment) != 0) {
+
+      len = len + alignment - (len % alignment);
+
+      if (i < n - 1
+          || ((char *) iov[i].iov_base - start) + len > buf->buffers[index]->getSize())
+        throw CIOUringIssue("buffer length not aligned for direct I/O");
+
+      iov[i].iov_len = len;
+
+    }
+
+  }
+
+}
+
 void IOUringInstance::alloc_buffer(std::shared_ptr<vectored_buffer> &vbuf, size_t total_size) {
 
   if (!available())
     throw CIOUringIssue("cannot allocate buffer if IOUringInstance is not setup correctly");
 
-  vbuf = std::make_shared<vectored_buffer>(total_size, block_size);
+  /*
+   * Buffers are always page aligned, so they can be used
+   * with files opened with O_DIRECT.
+   */
+  if (this->pool != nullptr)
+    vbuf = this->pool->get(total_size);
+  else
+    vbuf = std::make_shared<vectored_buffer>(total_size, block_size,
+                                             ArchiveFile::DIRECT_IO_ALIGNMENT);
+
+}
+
+void IOUringInstance::release_buffer(std::shared_ptr<vectored_buffer> &vbuf) {
+
+  if (this->pool != nullptr)
+    this->pool->release(vbuf);
+
+  vbuf = nullptr;
+
+}
+
+void IOUringInstance::setBufferPool(std::shared_ptr<vectored_buffer_pool> pool) {
+
+  if (pool != nullptr && pool->getBlockSize() != this->block_size)
+    throw CIOUringIssue("block size of buffer pool doesn't match io_uring instance");
+
+  this->pool = pool;
 
 }
 
@@ -459,6 +641,43 @@ bool IOUringInstance::available() {
   return initialized;
 }
 
+void IOUringInstance::prepare_fsync(int fd, unsigned long long user_data) {
+
+  struct io_uring_sqe *sqe = NULL;
+
+  if (!available())
+    throw CIOUringIssue("could not prepare fsync request, uring not available");
+
+  sqe = io_uring_get_sqe(&ring);
+
+  if (!sqe) {
+    throw CIOUringIssue("could not get a submission queue entry");
+  }
+
+  io_uring_prep_fsync(sqe, fd, 0);
+  io_uring_sqe_set_data(sqe, (void *) (uintptr_t) user_data);
+
+}
+
+int IOUringInstance::submit() {
+
+  int rc;
+
+  if (!available())
+    throw CIOUringIssue("could not submit requests, uring not available");
+
+  rc = io_uring_submit(&ring);
+
+  if (rc < 0) {
+    throw CIOUringIssue(strerror(-rc), rc);
+  }
+
+  TRACE_PGBCKCTL_URING_SUBMIT(rc);
+
+  return rc;
+
+}
+
 int IOUringInstance::wait(struct io_uring_cqe **cqe) {
 
   int rc = io_uring_wait_cqe(&ring, cqe);
@@ -467,6 +686,8 @@ int IOUringInstance::wait(struct io_uring_cqe **cqe) {
     throw CIOUringIssue(strerror(rc));
   }
 
+  TRACE_PGBCKCTL_URING_COMPLETE((*cqe)->res, (*cqe)->user_data);
+
   return rc;
 
 }
@@ -481,4 +702,361 @@ void IOUringInstance::exit() {
 
 }
 
+/* **************************************************************************
+ * IOUringCopyPipeline
+ * **************************************************************************/
+
+/*
+ * Encoding of the user data attached to submitted requests,
+ * the slot number and whether a request is a write.
+ */
+#define COPY_REQUEST_DATA(slot, write) ((void *) (uintptr_t) (((slot) << 1) | ((write) ? 1 : 0)))
+#define COPY_REQUEST_SLOT(data) ((unsigned int) (((uintptr_t) (data)) >> 1))
+#define COPY_REQUEST_IS_WRITE(data) ((((uintptr_t) (data)) & 1) == 1)
+
+IOUringCopyPipeline::IOUringCopyPipeline()
+  : IOUringInstance(DEFAULT_COPY_QUEUE_DEPTH, DEFAULT_BLOCK_SIZE) {}
+
+IOUringCopyPipeline::IOUringCopyPipeline(unsigned int queue_depth, size_t chunk_size)
+  : IOUringInstance(queue_depth, DEFAULT_BLOCK_SIZE) {
+
+  this->setChunkSize(chunk_size);
+
+}
+
+IOUringCopyPipeline::~IOUringCopyPipeline() {}
+
+void IOUringCopyPipeline::setChunkSize(size_t chunk_size) {
+
+  if (available())
+    throw CIOUringIssue("could not set chunk size: io_uring instance already setup");
+
+  if (chunk_size == 0)
+    throw CIOUringIssue("chunk size for io_uring copy must not be 0");
+
+  this->chunk_size = chunk_size;
+
+}
+
+bool IOUringCopyPipeline::usesFixedBuffers() {
+  return this->fixed_buffers;
+}
+
+void IOUringCopyPipeline::setup() {
+
+  std::vector<struct iovec> iovecs;
+  unsigned int nslots = getQueueDepth() / 2;
+  int rc;
+
+  /* Each slot needs two SQEs, the read and the linked write */
+  if (nslots == 0)
+    throw CIOUringIssue("queue depth for io_uring copy must be at least 2");
+
+  IOUringInstance::setup();
+
+  this->slots.clear();
+  this->slots.resize(nslots);
+
+  for (auto &slot : this->slots) {
+
+    struct iovec iov;
+
+    slot.buffer = std::make_shared<AlignedMemoryBuffer>(this->chunk_size,
+                                                        ArchiveFile::DIRECT_IO_ALIGNMENT);
+
+    iov.iov_base = slot.buffer->ptr();
+    iov.iov_len  = slot.buffer->getSize();
+    iovecs.push_back(iov);
+
+  }
+
+  /*
+   * Registering the buffers pins them in memory, which is
+   * limited by RLIMIT_MEMLOCK. Fall back to unregistered buffers
+   * if we're not allowed to.
+   */
+  rc = io_uring_register_buffers(&ring, iovecs.data(), iovecs.size());
+  this->fixed_buffers = (rc == 0);
+
+  if (!this->fixed_buffers) {
+    BOOST_LOG_TRIVIAL(debug) << "DEBUG: could not register io_uring buffers, using unregistered buffers: "
+                             << strerror(-rc);
+  }
+
+}
+
+void IOUringCopyPipeline::prepare(unsigned int slot, bool write,
+                                  size_t start, size_t len,
+                                  bool link) {
+
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+  copy_slot &s = this->slots[slot];
+  char *buf = s.buffer->ptr() + start;
+  off_t pos = s.offset + start;
+  int fd;
+  unsigned int flags = 0;
+
+  if (!sqe) {
+    throw CIOUringIssue("could not get a submission queue entry");
+  }
+
+  /*
+   * With O_DIRECT, the tail of a file is read and written
+   * padded to the alignment, the slot buffer has room for it.
+   */
+  if (this->direct_io && (len % ArchiveFile::DIRECT_IO_ALIGNMENT) != 0)
+    len += ArchiveFile::DIRECT_IO_ALIGNMENT - (len % ArchiveFile::DIRECT_IO_ALIGNMENT);
+
+  /* Registered files are addressed by their index, 0 is input */
+  if (this->fixed_files) {
+    fd = write ? 1 : 0;
+    flags |= IOSQE_FIXED_FILE;
+  } else {
+    fd = write ? this->fd_out : this->fd_in;
+  }
+
+  if (this->fixed_buffers) {
+
+    if (write)
+      io_uring_prep_write_fixed(sqe, fd, buf, len, pos, slot);
+    else
+      io_uring_prep_read_fixed(sqe, fd, buf, len, pos, slot);
+
+  } else {
+
+    if (write)
+      io_uring_prep_write(sqe, fd, buf, len, pos);
+    else
+      io_uring_prep_read(sqe, fd, buf, len, pos);
+
+  }
+
+  if (link)
+    flags |= IOSQE_IO_LINK;
+
+  io_uring_sqe_set_flags(sqe, flags);
+  io_uring_sqe_set_data(sqe, COPY_REQUEST_DATA(slot, write));
+
+  s.inflight++;
+  this->inflight++;
+
+}
+
+void IOUringCopyPipeline::resume(unsigned int slot) {
+
+  copy_slot &s = this->slots[slot];
+
+  /*
+   * Write out what was read but not written yet first. Only if
+   * everything read was written, continue reading the rest of
+   * the chunk, again with a linked write.
+   */
+  if (s.done_write < s.done_read) {
+
+    this->prepare(slot, true, s.done_write, s.done_read - s.done_write, false);
+
+  } else if (s.done_read < s.len) {
+
+    this->prepare(slot, false, s.done_read, s.len - s.done_read, true);
+    this->prepare(slot, true, s.done_read, s.len - s.done_read, false);
+
+  }
+
+}
+
+size_t IOUringCopyPipeline::complete(struct io_uring_cqe *cqe) {
+
+  void *data = io_uring_cqe_get_data(cqe);
+  unsigned int slot = COPY_REQUEST_SLOT(data);
+  copy_slot &s = this->slots[slot];
+  int res = cqe->res;
+
+  s.inflight--;
+  this->inflight--;
+
+  if (res == -ECANCELED) {
+
+    /*
+     * The linked read was short, so its write was canceled. resume()
+     * takes care of the remaining bytes below.
+     */
+
+  } else if (res < 0) {
+
+    if (this->error.empty()) {
+      std::ostringstream oss;
+      oss << "could not handle I/O request: " << strerror(-res);
+      this->error = oss.str();
+    }
+
+  } else if (COPY_REQUEST_IS_WRITE(data)) {
+
+    /* Padding of a direct I/O tail doesn't count */
+    s.done_write = std::min(s.done_write + res, s.len);
+
+  } else {
+
+    /* The file got shorter than its size when we started copying */
+    if (res == 0 && this->error.empty())
+      this->error = "unexpected end of file during copy";
+
+    s.done_read = std::min(s.done_read + res, s.len);
+
+  }
+
+  if (s.inflight > 0)
+    return 0;
+
+  if (s.done_write == s.len) {
+    s.busy = false;
+    return s.len;
+  }
+
+  /* Short read or write, submit the remainder unless we failed */
+  if (this->error.empty())
+    this->resume(slot);
+  else
+    s.busy = false;
+
+  return 0;
+
+}
+
+size_t IOUringCopyPipeline::copy(std::shared_ptr<ArchiveFile> in,
+                                 std::shared_ptr<ArchiveFile> out,
+                                 const bool &abort) {
+
+  if (!in->isOpen() || !out->isOpen())
+    throw CIOUringIssue("file not opened");
+
+  return this->copy(in, out, 0, in->size(), abort);
+
+}
+
+size_t IOUringCopyPipeline::copy(std::shared_ptr<ArchiveFile> in,
+                                 std::shared_ptr<ArchiveFile> out,
+                                 off_t offset,
+                                 size_t len,
+                                 const bool &abort) {
+
+  size_t total = 0;
+  size_t copied = 0;
+  off_t next = offset;
+  int fds[2];
+  int rc;
+
+  if (!available())
+    throw CIOUringIssue("could not copy: io_uring instance not initialized");
+
+  if (!in->isOpen() || !out->isOpen())
+    throw CIOUringIssue("file not opened");
+
+  /* end of the range to copy */
+  total = (size_t) offset + len;
+
+  this->fd_in  = in->getFileno();
+  this->fd_out = out->getFileno();
+  this->inflight = 0;
+  this->error = "";
+
+  /* The kernel rejects unaligned direct I/O with EINVAL */
+  this->direct_io = in->isDirectIO() || out->isDirectIO();
+
+  if (this->direct_io
+      && ((offset % ArchiveFile::DIRECT_IO_ALIGNMENT) != 0
+          || (this->chunk_size % ArchiveFile::DIRECT_IO_ALIGNMENT) != 0))
+    throw CIOUringIssue("offset and chunk size of direct I/O copy must be aligned");
+
+  fds[0] = this->fd_in;
+  fds[1] = this->fd_out;
+
+  rc = io_uring_register_files(&ring, fds, 2);
+  this->fixed_files = (rc == 0);
+
+  while (true) {
+
+    struct io_uring_cqe *cqe = NULL;
+
+    /*
+     * Assign the next chunks to all free slots, unless
+     * we're about to stop.
+     */
+    for (unsigned int i = 0; i < this->slots.size(); i++) {
+
+      copy_slot &s = this->slots[i];
+
+      if (s.busy || abort || !this->error.empty() || (size_t) next >= total)
+        continue;
+
+      s.busy = true;
+      s.offset = next;
+      s.len = std::min(this->chunk_size, total - (size_t) next);
+      s.done_read = 0;
+      s.done_write = 0;
+
+      this->prepare(i, false, 0, s.len, true);
+      this->prepare(i, true, 0, s.len, false);
+
+      next += s.len;
+
+    }
+
+    if (this->inflight == 0)
+      break;
+
+    rc = io_uring_submit_and_wait(&ring, 1);
+    TRACE_PGBCKCTL_URING_SUBMIT(rc);
+
+    if (rc < 0 && rc != -EINTR) {
+      /* nothing was submitted, so only wait for what's in flight */
+      if (this->error.empty())
+        this->error = strerror(-rc);
+    }
+
+    /* Reap all completions available before submitting the next chunks */
+    while (io_uring_peek_cqe(&ring, &cqe) == 0 && cqe != NULL) {
+      TRACE_PGBCKCTL_URING_COMPLETE(cqe->res, cqe->user_data);
+      copied += this->complete(cqe);
+      seen(&cqe);
+    }
+
+  }
+
+  if (this->fixed_files)
+    io_uring_unregister_files(&ring);
+
+  this->fixed_files = false;
+
+  if (!this->error.empty())
+    throw CIOUringIssue(this->error);
+
+  /*
+   * A padded direct I/O tail was written beyond the end of
+   * the input file, so cut it off again.
+   */
+  if (this->direct_io && !abort && total == in->size()
+      && (total % ArchiveFile::DIRECT_IO_ALIGNMENT) != 0
+      && ::ftruncate(this->fd_out, total) < 0) {
+    std::ostringstream oss;
+    oss << "could not truncate copied file: " << strerror(errno);
+    throw CIOUringIssue(oss.str());
+  }
+
+  return copied;
+
+}
+
+void IOUringCopyPipeline::exit() {
+
+  if (available() && this->fixed_buffers)
+    io_uring_unregister_buffers(&ring);
+
+  this->fixed_buffers = false;
+
+  IOUringInstance::exit();
+
+  this->slots.clear();
+
+}
+
 #endif
@@ -0,0 +1,1075 @@
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <boost/log/trivial.hpp>
+
+#include <objectstorage.hxx>
+#include <checksum.hxx>
+
+#if defined(PG_BACKUP_CTL_HAS_LIBCURL) && defined(PG_BACKUP_CTL_HAS_OPENSSL)
+#include <curl/curl.h>
+#include <openssl/hmac.h>
+#endif
+
+using namespace pgbckctl;
+
+/*
+ * Size of the chunks a part is read in. The rate limiter is
+ * consulted for every chunk, so a part isn't throttled in one go.
+ */
+#define OBJECT_UPLOAD_READ_CHUNK (1024 * 1024)
+
+/* S3 doesn't accept more parts for a single object */
+#define OBJECT_UPLOAD_MAX_PARTS 10000
+
+namespace pgbckctl {
+
+  /*
+   * File descriptor of a file being uploaded, closed
+   * on all paths out of ObjectUploader::upload().
+   */
+  class ObjectUploadFile {
+  public:
+
+    int fd = -1;
+
+    ObjectUploadFile(const std::string &path) {
+
+      this->fd = ::open(path.c_str(), O_RDONLY);
+
+      if (this->fd < 0) {
+        std::ostringstream oss;
+        oss << "could not open file \"" << path << "\" for upload: " << strerror(errno);
+        throw CArchiveIssue(oss.str());
+      }
+
+    }
+
+    ~ObjectUploadFile() {
+
+      if (this->fd >= 0)
+        ::close(this->fd);
+
+    }
+
+  };
+
+}
+
+/*
+ * Writes len bytes to fd, throws on errors.
+ */
+static void object_write_all(int fd, const char *data, size_t len, const std::string &path) {
+
+  while (len > 0) {
+
+    ssize_t rc = ::write(fd, data, len);
+
+    if (rc < 0) {
+
+      if (errno == EINTR)
+        continue;
+
+      std::ostringstream oss;
+      oss << "could not write object file \"" << path << "\": " << strerror(errno);
+      throw CArchiveIssue(oss.str());
+
+    }
+
+    data += rc;
+    len -= rc;
+
+  }
+
+}
+
+/******************************************************************************
+ * Implementation of ObjectStorageClient
+ *****************************************************************************/
+
+ObjectStorageClient::ObjectStorageClient(std::shared_ptr<ArchiveStorageDescr> storage) {
+
+  if (storage == nullptr)
+    throw CArchiveIssue("object storage client requires a storage descriptor");
+
+  this->storage = storage;
+
+}
+
+ObjectStorageClient::~ObjectStorageClient() {}
+
+bool ObjectStorageClient::s3Supported() {
+
+#if defined(PG_BACKUP_CTL_HAS_LIBCURL) && defined(PG_BACKUP_CTL_HAS_OPENSSL)
+  return true;
+#else
+  return false;
+#endif
+
+}
+
+std::shared_ptr<ObjectStorageClient> ObjectStorageClient::create(std::shared_ptr<ArchiveStorageDescr> storage) {
+
+  if (storage == nullptr)
+    throw CArchiveIssue("object storage client requires a storage descriptor");
+
+  if (storage->endpoint.compare(0, 7, "file://") == 0)
+    return std::make_shared<DirectoryStorageClient>(storage);
+
+#if defined(PG_BACKUP_CTL_HAS_LIBCURL) && defined(PG_BACKUP_CTL_HAS_OPENSSL)
+  return std::make_shared<S3StorageClient>(storage);
+#else
+  throw CArchiveIssue("S3 object storage not supported: compiled without libcurl and OpenSSL");
+#endif
+
+}
+
+/******************************************************************************
+ * Implementation of DirectoryStorageClient
+ *****************************************************************************/
+
+DirectoryStorageClient::DirectoryStorageClient(std::shared_ptr<ArchiveStorageDescr> storage)
+  : ObjectStorageClient(storage) {
+
+  boost::system::error_code ec;
+
+  if (storage->endpoint.compare(0, 7, "file://") != 0)
+    throw CArchiveIssue("not a file:// endpoint: \"" + storage->endpoint + "\"");
+
+  this->root = boost::filesystem::path(storage->endpoint.substr(7)) / storage->bucket;
+
+  boost::filesystem::create_directories(this->root / ".uploads", ec);
+
+  if (ec) {
+    std::ostringstream oss;
+    oss << "could not create bucket directory " << this->root.string() << ": " << ec.message();
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+DirectoryStorageClient::~DirectoryStorageClient() {}
+
+boost::filesystem::path DirectoryStorageClient::objectPath(const std::string &key) {
+
+  boost::filesystem::path keypath(key);
+
+  /* Keys must stay within the bucket */
+  for (auto &component : keypath) {
+
+    if (component == ".." || component == ".uploads") {
+      std::ostringstream oss;
+      oss << "invalid object key \"" << key << "\"";
+      throw CArchiveIssue(oss.str());
+    }
+
+  }
+
+  return this->root / keypath.relative_path();
+
+}
+
+boost::filesystem::path DirectoryStorageClient::uploadPath(const std::string &upload_id) {
+
+  if (upload_id.empty() || upload_id.find('/') != std::string::npos
+      || upload_id.find("..") != std::string::npos)
+    throw CArchiveIssue("invalid upload id \"" + upload_id + "\"");
+
+  return this->root / ".uploads" / upload_id;
+
+}
+
+void DirectoryStorageClient::writeFile(const boost::filesystem::path &path,
+                                       const char *data,
+                                       size_t len) {
+
+  boost::filesystem::path temp = path;
+  boost::system::error_code ec;
+  int fd;
+
+  temp += ".tmp";
+
+  boost::filesystem::create_directories(path.parent_path(), ec);
+
+  if (ec) {
+    std::ostringstream oss;
+    oss << "could not create directory " << path.parent_path().string() << ": " << ec.message();
+    throw CArchiveIssue(oss.str());
+  }
+
+  fd = ::open(temp.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+  if (fd < 0) {
+    std::ostringstream oss;
+    oss << "could not create object file \"" << temp.string() << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  try {
+
+    object_write_all(fd, data, len, temp.string());
+
+    if (::fsync(fd) < 0) {
+      std::ostringstream oss;
+      oss << "could not sync object file \"" << temp.string() << "\": " << strerror(errno);
+      throw CArchiveIssue(oss.str());
+    }
+
+  } catch (CArchiveIssue &e) {
+    ::close(fd);
+    boost::filesystem::remove(temp, ec);
+    throw e;
+  }
+
+  ::close(fd);
+
+  boost::filesystem::rename(temp, path, ec);
+
+  if (ec) {
+    std::ostringstream oss;
+    oss << "could not rename object file \"" << temp.string() << "\": " << ec.message();
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+void DirectoryStorageClient::putObject(const std::string &key,
+                                       const char *data,
+                                       size_t len) {
+
+  this->writeFile(this->objectPath(key), data, len);
+
+}
+
+std::string DirectoryStorageClient::createMultipartUpload(const std::string &key) {
+
+  std::ostringstream upload_id;
+  boost::system::error_code ec;
+
+  /* validates the key */
+  this->objectPath(key);
+
+  upload_id << ::getpid() << "-" << std::time(NULL) << "-" << this->upload_seq++;
+
+  boost::filesystem::create_directories(this->uploadPath(upload_id.str()), ec);
+
+  if (ec) {
+    std::ostringstream oss;
+    oss << "could not create multipart upload for \"" << key << "\": " << ec.message();
+    throw CArchiveIssue(oss.str());
+  }
+
+  return upload_id.str();
+
+}
+
+std::string DirectoryStorageClient::uploadPart(const std::string &key,
+                                               const std::string &upload_id,
+                                               unsigned int part_number,
+                                               const char *data,
+                                               size_t len) {
+
+  std::ostringstream etag;
+  boost::filesystem::path dir = this->uploadPath(upload_id);
+
+  if (!boost::filesystem::is_directory(dir))
+    throw CArchiveIssue("no such multipart upload \"" + upload_id + "\"");
+
+  this->writeFile(dir / ("part." + std::to_string(part_number)), data, len);
+
+  etag << std::hex << CRC32C::compute(data, len);
+  return etag.str();
+
+}
+
+void DirectoryStorageClient::completeMultipartUpload(const std::string &key,
+                                                     const std::string &upload_id,
+                                                     const std::vector<std::string> &etags) {
+
+  boost::filesystem::path dir = this->uploadPath(upload_id);
+  boost::filesystem::path target = this->objectPath(key);
+  boost::filesystem::path temp = target;
+  boost::system::error_code ec;
+  std::vector<char> buffer(OBJECT_UPLOAD_READ_CHUNK);
+  int fd;
+
+  temp += ".tmp";
+
+  boost::filesystem::create_directories(target.parent_path(), ec);
+
+  fd = ::open(temp.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+  if (fd < 0) {
+    std::ostringstream oss;
+    oss << "could not create object file \"" << temp.string() << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  try {
+
+    /*
+     * Concatenate the parts in the order of their part numbers,
+     * checking each one against the ETag the caller has.
+     */
+    for (unsigned int i = 0; i < etags.size(); i++) {
+
+      boost::filesystem::path part = dir / ("part." + std::to_string(i + 1));
+      ObjectUploadFile in(part.string());
+      uint32_t crc = 0xFFFFFFFF;
+      std::ostringstream etag;
+      ssize_t rc;
+
+      while ((rc = ::read(in.fd, buffer.data(), buffer.size())) != 0) {
+
+        if (rc < 0) {
+
+          if (errno == EINTR)
+            continue;
+
+          std::ostringstream oss;
+          oss << "could not read part file \"" << part.string() << "\": " << strerror(errno);
+          throw CArchiveIssue(oss.str());
+
+        }
+
+        crc = CRC32C::update(crc, buffer.data(), rc);
+        object_write_all(fd, buffer.data(), rc, temp.string());
+
+      }
+
+      etag << std::hex << (crc ^ 0xFFFFFFFF);
+
+      if (etag.str() != etags[i]) {
+        std::ostringstream oss;
+        oss << "part " << (i + 1) << " of multipart upload \"" << upload_id
+            << "\" doesn't match its ETag";
+        throw CArchiveIssue(oss.str());
+      }
+
+    }
+
+    if (::fsync(fd) < 0) {
+      std::ostringstream oss;
+      oss << "could not sync object file \"" << temp.string() << "\": " << strerror(errno);
+      throw CArchiveIssue(oss.str());
+    }
+
+  } catch (CArchiveIssue &e) {
+    ::close(fd);
+    boost::filesystem::remove(temp, ec);
+    throw e;
+  }
+
+  ::close(fd);
+
+  boost::filesystem::rename(temp, target, ec);
+
+  if (ec) {
+    std::ostringstream oss;
+    oss << "could not rename object file \"" << temp.string() << "\": " << ec.message();
+    throw CArchiveIssue(oss.str());
+  }
+
+  boost::filesystem::remove_all(dir, ec);
+
+}
+
+void DirectoryStorageClient::abortMultipartUpload(const std::string &key,
+                                                  const std::string &upload_id) {
+
+  boost::system::error_code ec;
+
+  boost::filesystem::remove_all(this->uploadPath(upload_id), ec);
+
+  if (ec) {
+    std::ostringstream oss;
+    oss << "could not abort multipart upload \"" << upload_id << "\": " << ec.message();
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+#if defined(PG_BACKUP_CTL_HAS_LIBCURL) && defined(PG_BACKUP_CTL_HAS_OPENSSL)
+
+/******************************************************************************
+ * Implementation of S3StorageClient
+ *****************************************************************************/
+
+static std::once_flag s3_curl_init;
+
+static size_t s3_write_response(char *data, size_t size, size_t nmemb, void *userdata) {
+
+  static_cast<std::string *>(userdata)->append(data, size * nmemb);
+  return size * nmemb;
+
+}
+
+static size_t s3_read_header(char *data, size_t size, size_t nmemb, void *userdata) {
+
+  std::string line(data, size * nmemb);
+  std::string *etag = static_cast<std::string *>(userdata);
+
+  if (line.size() > 5 && strncasecmp(line.c_str(), "etag:", 5) == 0) {
+
+    size_t start = line.find_first_not_of(" \t", 5);
+    size_t end = line.find_last_not_of(" \t\r\n");
+
+    if (start != std::string::npos && end != std::string::npos && end >= start)
+      *etag = line.substr(start, end - start + 1);
+
+  }
+
+  return size * nmemb;
+
+}
+
+static std::string s3_sha256_hex(const std::string &data) {
+
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned int mdlen = 0;
+
+  if (EVP_Digest(data.data(), data.size(), md, &mdlen, EVP_sha256(), NULL) != 1)
+    throw CArchiveIssue("could not compute SHA-256 for request signature");
+
+  return FileChecksum::toHex(md, mdlen);
+
+}
+
+static std::string s3_hmac(const std::string &key, const std::string &data) {
+
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned int mdlen = 0;
+
+  if (HMAC(EVP_sha256(), key.data(), (int) key.size(),
+           (const unsigned char *) data.data(), data.size(), md, &mdlen) == NULL)
+    throw CArchiveIssue("could not compute HMAC for request signature");
+
+  return std::string((const char *) md, mdlen);
+
+}
+
+/*
+ * Returns the text of the first XML element with the
+ * specified name, empty if there's none.
+ */
+static std::string s3_xml_element(const std::string &xml, const std::string &name) {
+
+  std::string open = "<" + name + ">";
+  std::string close = "</" + name + ">";
+  size_t start = xml.find(open);
+  size_t end;
+
+  if (start == std::string::npos)
+    return "";
+
+  start += open.size();
+  end = xml.find(close, start);
+
+  if (end == std::string::npos)
+    return "";
+
+  return xml.substr(start, end - start);
+
+}
+
+S3StorageClient::S3StorageClient(std::shared_ptr<ArchiveStorageDescr> storage)
+  : ObjectStorageClient(storage) {
+
+  const char *value;
+  size_t scheme;
+  size_t slash;
+
+  std::call_once(s3_curl_init, []() {
+      curl_global_init(CURL_GLOBAL_DEFAULT);
+    });
+
+  if ((value = getenv("AWS_ACCESS_KEY_ID")) != NULL)
+    this->access_key = value;
+
+  if ((value = getenv("AWS_SECRET_ACCESS_KEY")) != NULL)
+    this->secret_key = value;
+
+  if ((value = getenv("AWS_SESSION_TOKEN")) != NULL)
+    this->session_token = value;
+
+  if (this->access_key.empty() || this->secret_key.empty())
+    throw CArchiveIssue("S3 credentials missing: AWS_ACCESS_KEY_ID and AWS_SECRET_ACCESS_KEY must be set");
+
+  this->base_url = storage->endpoint;
+
+  while (this->base_url.size() > 0 && this->base_url.back() == '/')
+    this->base_url.pop_back();
+
+  scheme = this->base_url.find("://");
+
+  if (scheme == std::string::npos)
+    throw CArchiveIssue("invalid storage endpoint \"" + storage->endpoint + "\"");
+
+  slash = this->base_url.find('/', scheme + 3);
+  this->host = this->base_url.substr(scheme + 3,
+                                     (slash == std::string::npos) ? std::string::npos
+                                                                  : slash - scheme - 3);
+
+}
+
+S3StorageClient::~S3StorageClient() {}
+
+std::string S3StorageClient::uriEncode(const std::string &in, bool encode_slash) {
+
+  static const char digits[] = "0123456789ABCDEF";
+  std::string result;
+
+  result.reserve(in.size() * 3);
+
+  for (unsigned char c : in) {
+
+    if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')
+        || c == '-' || c == '_' || c == '.' || c == '~'
+        || (c == '/' && !encode_slash)) {
+      result.push_back(c);
+    } else {
+      result.push_back('%');
+      result.push_back(digits[c >> 4]);
+      result.push_back(digits[c & 0x0F]);
+    }
+
+  }
+
+  return result;
+
+}
+
+std::string S3StorageClient::authorization(const std::string &method,
+                                           const std::string &uri,
+                                           const std::string &query,
+                                           const std::string &amz_date) {
+
+  std::string date = amz_date.substr(0, 8);
+  std::string scope = date + "/" + this->storage->region + "/s3/aws4_request";
+  std::string signed_headers = "host;x-amz-content-sha256;x-amz-date";
+  std::ostringstream canonical;
+  std::ostringstream to_sign;
+  std::string key;
+
+  canonical << method << "\n"
+            << uri << "\n"
+            << query << "\n"
+            << "host:" << this->host << "\n"
+            << "x-amz-content-sha256:UNSIGNED-PAYLOAD\n"
+            << "x-amz-date:" << amz_date << "\n";
+
+  if (!this->session_token.empty()) {
+    canonical << "x-amz-security-token:" << this->session_token << "\n";
+    signed_headers += ";x-amz-security-token";
+  }
+
+  canonical << "\n" << signed_headers << "\n" << "UNSIGNED-PAYLOAD";
+
+  to_sign << "AWS4-HMAC-SHA256\n"
+          << amz_date << "\n"
+          << scope << "\n"
+          << s3_sha256_hex(canonical.str());
+
+  key = s3_hmac("AWS4" + this->secret_key, date);
+  key = s3_hmac(key, this->storage->region);
+  key = s3_hmac(key, "s3");
+  key = s3_hmac(key, "aws4_request");
+
+  std::string signature = s3_hmac(key, to_sign.str());
+
+  return "AWS4-HMAC-SHA256 Credential=" + this->access_key + "/" + scope
+    + ", SignedHeaders=" + signed_headers
+    + ", Signature=" + FileChecksum::toHex((const unsigned char *) signature.data(),
+                                           signature.size());
+
+}
+
+long S3StorageClient::request(const std::string &method,
+                              const std::string &key,
+                              const std::string &query,
+                              const char *data,
+                              size_t len,
+                              std::string &response,
+                              std::string &etag) {
+
+  CURL *curl;
+  CURLcode rc;
+  struct curl_slist *headers = NULL;
+  long status = 0;
+  char amz_date[17];
+  std::time_t now = std::time(NULL);
+  struct tm tm_now;
+  std::string base_path;
+  std::string uri;
+  std::string url;
+  size_t scheme = this->base_url.find("://");
+  size_t slash = this->base_url.find('/', scheme + 3);
+
+  gmtime_r(&now, &tm_now);
+  strftime(amz_date, sizeof(amz_date), "%Y%m%dT%H%M%SZ", &tm_now);
+
+  if (slash != std::string::npos)
+    base_path = this->base_url.substr(slash);
+
+  uri = base_path + "/" + S3StorageClient::uriEncode(this->storage->bucket)
+    + "/" + S3StorageClient::uriEncode(key, false);
+  url = this->base_url.substr(0, (slash == std::string::npos) ? std::string::npos : slash) + uri;
+
+  if (!query.empty())
+    url += "?" + query;
+
+  response.clear();
+  etag.clear();
+
+  if ((curl = curl_easy_init()) == NULL)
+    throw CArchiveIssue("could not initialize S3 request");
+
+  headers = curl_slist_append(headers, ("Host: " + this->host).c_str());
+  headers = curl_slist_append(headers, "x-amz-content-sha256: UNSIGNED-PAYLOAD");
+  headers = curl_slist_append(headers, (std::string("x-amz-date: ") + amz_date).c_str());
+
+  if (!this->session_token.empty())
+    headers = curl_slist_append(headers, ("x-amz-security-token: " + this->session_token).c_str());
+
+  headers = curl_slist_append(headers, ("Authorization: "
+                                        + this->authorization(method, uri, query, amz_date)).c_str());
+
+  /* don't wait for a 100-continue on every part */
+  headers = curl_slist_append(headers, "Expect:");
+
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 60L);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, s3_write_response);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, s3_read_header);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, &etag);
+
+  if (method == "PUT" || method == "POST") {
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (data != NULL) ? data : "");
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) len);
+  }
+
+  curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method.c_str());
+
+  rc = curl_easy_perform(curl);
+
+  if (rc == CURLE_OK)
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+
+  curl_slist_free_all(headers);
+  curl_easy_cleanup(curl);
+
+  if (rc != CURLE_OK) {
+    std::ostringstream oss;
+    oss << method << " " << url << " failed: " << curl_easy_strerror(rc);
+    throw CArchiveIssue(oss.str());
+  }
+
+  return status;
+
+}
+
+void S3StorageClient::failed(const std::string &what,
+                             long status,
+                             const std::string &response) {
+
+  std::ostringstream oss;
+  std::string code = s3_xml_element(response, "Code");
+  std::string message = s3_xml_element(response, "Message");
+
+  oss << what << ": HTTP status " << status;
+
+  if (!code.empty())
+    oss << ", " << code;
+
+  if (!message.empty())
+    oss << ": " << message;
+
+  throw CArchiveIssue(oss.str());
+
+}
+
+void S3StorageClient::putObject(const std::string &key,
+                                const char *data,
+                                size_t len) {
+
+  std::string response;
+  std::string etag;
+  long status = this->request("PUT", key, "", data, len, response, etag);
+
+  if (status != 200)
+    this->failed("could not upload object \"" + key + "\"", status, response);
+
+}
+
+std::string S3StorageClient::createMultipartUpload(const std::string &key) {
+
+  std::string response;
+  std::string etag;
+  std::string upload_id;
+  long status = this->request("POST", key, "uploads=", NULL, 0, response, etag);
+
+  if (status != 200)
+    this->failed("could not create multipart upload for \"" + key + "\"", status, response);
+
+  upload_id = s3_xml_element(response, "UploadId");
+
+  if (upload_id.empty())
+    throw CArchiveIssue("no upload id in response to multipart upload of \"" + key + "\"");
+
+  return upload_id;
+
+}
+
+std::string S3StorageClient::uploadPart(const std::string &key,
+                                        const std::string &upload_id,
+                                        unsigned int part_number,
+                                        const char *data,
+                                        size_t len) {
+
+  std::string response;
+  std::string etag;
+  std::string query = "partNumber=" + std::to_string(part_number)
+    + "&uploadId=" + S3StorageClient::uriEncode(upload_id);
+  long status = this->request("PUT", key, query, data, len, response, etag);
+
+  if (status != 200)
+    this->failed("could not upload part " + std::to_string(part_number)
+                 + " of \"" + key + "\"", status, response);
+
+  if (etag.empty())
+    throw CArchiveIssue("no ETag in response to part " + std::to_string(part_number)
+                        + " of \"" + key + "\"");
+
+  return etag;
+
+}
+
+void S3StorageClient::completeMultipartUpload(const std::string &key,
+                                              const std::string &upload_id,
+                                              const std::vector<std::string> &etags) {
+
+  std::ostringstream body;
+  std::string response;
+  std::string etag;
+  std::string query = "uploadId=" + S3StorageClient::uriEncode(upload_id);
+  long status;
+
+  body << "<CompleteMultipartUpload>";
+
+  for (unsigned int i = 0; i < etags.size(); i++) {
+    body << "<Part><PartNumber>" << (i + 1) << "</PartNumber>"
+         << "<ETag>" << etags[i] << "</ETag></Part>";
+  }
+
+  body << "</CompleteMultipartUpload>";
+
+  std::string payload = body.str();
+
+  status = this->request("POST", key, query, payload.data(), payload.size(), response, etag);
+
+  /*
+   * Completing an upload might fail after the status was
+   * sent already, the error is in the response body then.
+   */
+  if (status != 200 || response.find("<Error>") != std::string::npos)
+    this->failed("could not complete multipart upload of \"" + key + "\"", status, response);
+
+}
+
+void S3StorageClient::abortMultipartUpload(const std::string &key,
+                                           const std::string &upload_id) {
+
+  std::string response;
+  std::string etag;
+  std::string query = "uploadId=" + S3StorageClient::uriEncode(upload_id);
+  long status = this->request("DELETE", key, query, NULL, 0, response, etag);
+
+  if (status != 204 && status != 200 && status != 404)
+    this->failed("could not abort multipart upload of \"" + key + "\"", status, response);
+
+}
+
+#endif
+
+/******************************************************************************
+ * Implementation of ObjectUploader
+ *****************************************************************************/
+
+ObjectUploader::ObjectUploader(std::shared_ptr<ArchiveStorageDescr> storage,
+                               std::shared_ptr<ObjectStorageClient> client)
+  : limiter((uint64_t) (storage != nullptr ? storage->max_rate : 0) * 1024) {
+
+  if (storage == nullptr)
+    throw CArchiveIssue("object uploader requires a storage descriptor");
+
+  this->storage = storage;
+  this->client = (client != nullptr) ? client : ObjectStorageClient::create(storage);
+
+}
+
+ObjectUploader::~ObjectUploader() {}
+
+std::string ObjectUploader::objectKey(std::shared_ptr<ArchiveStorageDescr> storage,
+                                      const std::string &relative_path) {
+
+  std::string key = relative_path;
+
+  while (key.size() > 0 && key.front() == '/')
+    key.erase(0, 1);
+
+  return storage->prefix + key;
+
+}
+
+void ObjectUploader::cancel() {
+
+  this->cancelled = true;
+
+}
+
+uint64_t ObjectUploader::bytesUploaded() {
+
+  return this->limiter.consumed();
+
+}
+
+std::string ObjectUploader::uploadPart(const std::string &key,
+                                       const std::string &upload_id,
+                                       unsigned int part_number,
+                                       const char *data,
+                                       size_t len) {
+
+  for (unsigned int attempt = 1; ; attempt++) {
+
+    try {
+
+      return this->client->uploadPart(key, upload_id, part_number, data, len);
+
+    } catch (CArchiveIssue &e) {
+
+      if (attempt >= ObjectUploader::PART_ATTEMPTS || this->cancelled)
+        throw e;
+
+      BOOST_LOG_TRIVIAL(warning) << "retrying part " << part_number << " of \""
+                                 << key << "\": " << e.what();
+
+      std::this_thread::sleep_for(std::chrono::seconds(attempt));
+
+    }
+
+  }
+
+}
+
+/*
+ * Reads len bytes at offset into buffer, throttled
+ * by limiter.
+ */
+static void object_read_part(int fd,
+                             const std::string &path,
+                             off_t offset,
+                             size_t len,
+                             char *buffer,
+                             ArchiveRateLimiter &limiter,
+                             std::atomic<bool> &cancelled) {
+
+  size_t done = 0;
+
+  while (done < len) {
+
+    size_t chunk = std::min((size_t) OBJECT_UPLOAD_READ_CHUNK, len - done);
+    ssize_t rc;
+
+    if (cancelled)
+      throw CArchiveIssue("upload cancelled");
+
+    limiter.consume(chunk);
+
+    while (chunk > 0) {
+
+      rc = ::pread(fd, buffer + done, chunk, offset + done);
+
+      if (rc < 0 && errno == EINTR)
+        continue;
+
+      if (rc <= 0) {
+        std::ostringstream oss;
+        oss << "could not read \"" << path << "\" at offset " << (offset + done) << ": "
+            << ((rc < 0) ? strerror(errno) : "unexpected end of file");
+        throw CArchiveIssue(oss.str());
+      }
+
+      done += rc;
+      chunk -= rc;
+
+    }
+
+  }
+
+}
+
+void ObjectUploader::upload(std::shared_ptr<UploadDescr> upload,
+                            std::function<void(std::shared_ptr<UploadDescr>)> started) {
+
+  struct stat st;
+  unsigned long long part_size = this->storage->part_size;
+  unsigned long long parts;
+  unsigned int nthreads;
+
+  if (upload == nullptr)
+    throw CArchiveIssue("nothing to upload");
+
+  ObjectUploadFile file(upload->path);
+
+  if (::fstat(file.fd, &st) < 0) {
+    std::ostringstream oss;
+    oss << "could not stat file \"" << upload->path << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  upload->size = st.st_size;
+
+  /*
+   * A multipart upload left over by a former attempt would
+   * keep its parts in the bucket forever.
+   */
+  if (!upload->upload_id.empty()) {
+
+    try {
+      this->client->abortMultipartUpload(upload->object_key, upload->upload_id);
+    } catch (CArchiveIssue &e) {
+      BOOST_LOG_TRIVIAL(warning) << "could not abort former upload of \""
+                                 << upload->object_key << "\": " << e.what();
+    }
+
+    upload->upload_id = "";
+
+  }
+
+  if (part_size == 0 || upload->size <= part_size) {
+
+    MemoryBuffer buffer(std::max((size_t) upload->size, (size_t) 1));
+
+    object_read_part(file.fd, upload->path, 0, upload->size, buffer.ptr(),
+                     this->limiter, this->cancelled);
+    this->client->putObject(upload->object_key, buffer.ptr(), upload->size);
+    return;
+
+  }
+
+  parts = (upload->size + part_size - 1) / part_size;
+
+  if (parts > OBJECT_UPLOAD_MAX_PARTS) {
+    std::ostringstream oss;
+    oss << "file \"" << upload->path << "\" needs " << parts
+        << " parts, increase the part size of the storage";
+    throw CArchiveIssue(oss.str());
+  }
+
+  upload->upload_id = this->client->createMultipartUpload(upload->object_key);
+
+  if (started)
+    started(upload);
+
+  std::vector<std::string> etags(parts);
+  std::vector<std::thread> threads;
+  std::atomic<unsigned long long> next_part { 0 };
+  std::atomic<bool> failed { false };
+  std::mutex error_mtx;
+  std::string error = "";
+
+  nthreads = (unsigned int) std::min((unsigned long long) std::max(this->storage->parallel, 1u),
+                                     parts);
+
+  for (unsigned int i = 0; i < nthreads; i++) {
+
+    threads.emplace_back([&]() {
+
+        MemoryBuffer buffer(part_size);
+
+        while (!failed && !this->cancelled) {
+
+          unsigned long long part = next_part++;
+          off_t offset;
+          size_t len;
+
+          if (part >= parts)
+            break;
+
+          offset = part * part_size;
+          len = std::min(part_size, upload->size - offset);
+
+          try {
+
+            object_read_part(file.fd, upload->path, offset, len, buffer.ptr(),
+                             this->limiter, this->cancelled);
+            etags[part] = this->uploadPart(upload->object_key, upload->upload_id,
+                                           part + 1, buffer.ptr(), len);
+
+          } catch (std::exception &e) {
+
+            std::lock_guard<std::mutex> guard(error_mtx);
+
+            if (error.empty())
+              error = e.what();
+
+            failed = true;
+
+          }
+
+        }
+
+      });
+
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  if (!failed && this->cancelled) {
+    failed = true;
+    error = "upload cancelled";
+  }
+
+  if (!failed) {
+
+    try {
+      this->client->completeMultipartUpload(upload->object_key, upload->upload_id, etags);
+    } catch (CArchiveIssue &e) {
+      failed = true;
+      error = e.what();
+    }
+
+  }
+
+  if (failed) {
+
+    try {
+      this->client->abortMultipartUpload(upload->object_key, upload->upload_id);
+      upload->upload_id = "";
+    } catch (CArchiveIssue &e) {
+      /* keep the upload ID, the next attempt aborts it */
+      BOOST_LOG_TRIVIAL(warning) << "could not abort upload of \""
+                                 << upload->object_key << "\": " << e.what();
+    }
+
+    throw CArchiveIssue(error);
+
+  }
+
+  upload->upload_id = "";
+
+}
@@ -0,0 +1,238 @@
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <walcache.hxx>
+
+using namespace pgbckctl;
+
+const size_t WALSegmentCache::PAGE_SIZE;
+const unsigned int WALSegmentCache::WAYS;
+
+/*
+ * Layout of the shared mapping: the header, followed by the
+ * slot table and the pages, which start at a page boundary.
+ */
+typedef struct wal_cache_header {
+
+  boost::interprocess::interprocess_mutex mtx;
+
+  /* Bumped by every access, recorded in the slot used */
+  uint64_t clock = 0;
+
+  wal_segment_cache_stats stats;
+
+} wal_cache_header;
+
+typedef struct wal_cache_slot {
+
+  bool valid = false;
+  int archive_id = -1;
+  unsigned int timeline = 0;
+  unsigned long long segno = 0;
+  unsigned long long pageno = 0;
+  uint64_t last_used = 0;
+
+} wal_cache_slot;
+
+#define WAL_CACHE_ALIGN 4096
+
+#define WAL_CACHE_SLOTS_OFFSET \
+  ((sizeof(wal_cache_header) + alignof(wal_cache_slot) - 1) & ~(alignof(wal_cache_slot) - 1))
+
+#define WAL_CACHE_PAGES_OFFSET(nslots) \
+  ((WAL_CACHE_SLOTS_OFFSET + (nslots) * sizeof(wal_cache_slot) + WAL_CACHE_ALIGN - 1) \
+   & ~((size_t) WAL_CACHE_ALIGN - 1))
+
+#define WAL_CACHE_HEADER(mapping) ((wal_cache_header *) (mapping))
+#define WAL_CACHE_SLOT(mapping, i) \
+  ((wal_cache_slot *) ((char *) (mapping) + WAL_CACHE_SLOTS_OFFSET) + (i))
+#define WAL_CACHE_PAGE(mapping, nslots, i) \
+  ((char *) (mapping) + WAL_CACHE_PAGES_OFFSET(nslots) + (i) * WALSegmentCache::PAGE_SIZE)
+
+static inline bool slot_holds(wal_cache_slot *slot,
+                              int archive_id,
+                              unsigned int timeline,
+                              unsigned long long segno,
+                              unsigned long long pageno) {
+
+  return (slot->valid
+          && slot->pageno == pageno
+          && slot->segno == segno
+          && slot->timeline == timeline
+          && slot->archive_id == archive_id);
+
+}
+
+WALSegmentCache::WALSegmentCache(size_t size) {
+
+  unsigned long long nslots;
+
+  nsets = size / (PAGE_SIZE * WAYS);
+
+  if (nsets == 0) {
+    std::ostringstream oss;
+    oss << "WAL cache size must be at least " << (PAGE_SIZE * WAYS) << " bytes";
+    throw CArchiveIssue(oss.str());
+  }
+
+  nslots = nsets * WAYS;
+  mapping_size = WAL_CACHE_PAGES_OFFSET(nslots) + nslots * PAGE_SIZE;
+
+  mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (mapping == MAP_FAILED) {
+    mapping = nullptr;
+    throw CArchiveIssue(std::string("could not create WAL cache: ") + strerror(errno));
+  }
+
+  /*
+   * The mapping is zero filled, but the mutex and
+   * slots need to be constructed.
+   */
+  new (mapping) wal_cache_header();
+
+  for (unsigned long long i = 0; i < nslots; i++)
+    new (WAL_CACHE_SLOT(mapping, i)) wal_cache_slot();
+
+  BOOST_LOG_TRIVIAL(debug) << "WAL cache created with " << nslots << " pages";
+
+}
+
+WALSegmentCache::~WALSegmentCache() {
+
+  /*
+   * Other processes might still use the cache, so leave
+   * the mutex alone and just drop our mapping.
+   */
+  if (mapping != nullptr)
+    munmap(mapping, mapping_size);
+
+}
+
+unsigned long long WALSegmentCache::findSet(int archive_id,
+                                            unsigned int timeline,
+                                            unsigned long long segno,
+                                            unsigned long long pageno) {
+
+  uint64_t x;
+
+  /*
+   * Mix the key with the splitmix64 finalizer, consecutive
+   * pages of a segment should spread over all sets.
+   */
+  x = ((uint64_t) archive_id << 32 | timeline) * 0x9E3779B97F4A7C15ULL;
+  x ^= segno * 0xC2B2AE3D27D4EB4FULL;
+  x ^= pageno;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  x = x ^ (x >> 31);
+
+  return x % nsets;
+
+}
+
+bool WALSegmentCache::read(int archive_id,
+                           unsigned int timeline,
+                           unsigned long long segno,
+                           unsigned long long pageno,
+                           char *buf) {
+
+  wal_cache_header *hdr = WAL_CACHE_HEADER(mapping);
+  unsigned long long first = findSet(archive_id, timeline, segno, pageno) * WAYS;
+  boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> lock(hdr->mtx);
+
+  for (unsigned long long i = first; i < first + WAYS; i++) {
+
+    wal_cache_slot *slot = WAL_CACHE_SLOT(mapping, i);
+
+    if (slot_holds(slot, archive_id, timeline, segno, pageno)) {
+
+      memcpy(buf, WAL_CACHE_PAGE(mapping, nsets * WAYS, i), PAGE_SIZE);
+
+      slot->last_used = ++hdr->clock;
+      hdr->stats.hits++;
+      return true;
+
+    }
+
+  }
+
+  hdr->stats.misses++;
+  return false;
+
+}
+
+void WALSegmentCache::insert(int archive_id,
+                             unsigned int timeline,
+                             unsigned long long segno,
+                             unsigned long long pageno,
+                             const char *buf) {
+
+  wal_cache_header *hdr = WAL_CACHE_HEADER(mapping);
+  unsigned long long first = findSet(archive_id, timeline, segno, pageno) * WAYS;
+  unsigned long long victim = first;
+  boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> lock(hdr->mtx);
+
+  /*
+   * Use the slot already holding the page, if inserted by a
+   * concurrent reader, else a free one or the least recently
+   * used one of the set.
+   */
+  for (unsigned long long i = first; i < first + WAYS; i++) {
+
+    wal_cache_slot *slot = WAL_CACHE_SLOT(mapping, i);
+
+    if (slot_holds(slot, archive_id, timeline, segno, pageno)) {
+      victim = i;
+      break;
+    }
+
+    if (!slot->valid) {
+      if (WAL_CACHE_SLOT(mapping, victim)->valid)
+        victim = i;
+      continue;
+    }
+
+    if (WAL_CACHE_SLOT(mapping, victim)->valid
+        && slot->last_used < WAL_CACHE_SLOT(mapping, victim)->last_used)
+      victim = i;
+
+  }
+
+  wal_cache_slot *slot = WAL_CACHE_SLOT(mapping, victim);
+
+  if (slot->valid && !slot_holds(slot, archive_id, timeline, segno, pageno))
+    hdr->stats.evictions++;
+
+  memcpy(WAL_CACHE_PAGE(mapping, nsets * WAYS, victim), buf, PAGE_SIZE);
+
+  slot->valid = true;
+  slot->archive_id = archive_id;
+  slot->timeline = timeline;
+  slot->segno = segno;
+  slot->pageno = pageno;
+  slot->last_used = ++hdr->clock;
+
+}
+
+unsigned long long WALSegmentCache::getPages() {
+
+  return nsets * WAYS;
+
+}
+
+wal_segment_cache_stats WALSegmentCache::stats() {
+
+  wal_cache_header *hdr = WAL_CACHE_HEADER(mapping);
+  boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> lock(hdr->mtx);
+
+  return hdr->stats;
+
+}
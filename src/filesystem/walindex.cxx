@@ -0,0 +1,935 @@
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <boost/log/trivial.hpp>
+#include <boost/range/iterator_range.hpp>
+
+#include <walindex.hxx>
+#include <xlogdefs.hxx>
+
+using namespace pgbckctl;
+
+/*
+ * On-disk format of the WAL segment index, see walindex.hxx
+ * for a description.
+ */
+#define WAL_INDEX_MAGIC "PGBWIDX"
+#define WAL_INDEX_VERSION 2
+
+#define WAL_INDEX_OP_ADD 1
+#define WAL_INDEX_OP_DEL 2
+
+/* Record flags */
+#define WAL_INDEX_FLAG_CHECKSUM 0x0001
+
+/* Number of records read or written at once */
+#define WAL_INDEX_IO_RECORDS 1024
+
+/*
+ * Compact the index file if it carries more than twice
+ * the records required to describe the current entries.
+ */
+#define WAL_INDEX_COMPACT_SLACK 1024
+
+typedef struct wal_index_header {
+
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t wal_segment_size;
+  uint64_t generation;
+  int64_t dir_stamp_1;
+  int64_t dir_stamp_2;
+  char reserved[16];
+
+} wal_index_header;
+
+typedef struct wal_index_record {
+
+  uint8_t op;
+  uint8_t status;
+  uint16_t flags;
+  uint32_t timeline;
+  uint64_t segno;
+  uint64_t size;
+  char filename[40];
+  uint32_t crc32c;
+  uint32_t reserved;
+
+} wal_index_record;
+
+static_assert(sizeof(wal_index_header) == 64,
+              "unexpected size of WAL index header");
+static_assert(sizeof(wal_index_record) == 72,
+              "unexpected size of WAL index record");
+
+const char *WALSegmentIndex::INDEX_FILENAME = ".wal_segment_index";
+
+static void dir_mtime(path dir, int64_t &sec, int64_t &nsec) {
+
+  struct stat st;
+
+  if (stat(dir.string().c_str(), &st) < 0) {
+    std::ostringstream oss;
+    oss << "could not stat log directory \"" << dir.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  sec = st.st_mtim.tv_sec;
+  nsec = st.st_mtim.tv_nsec;
+
+}
+
+/*
+ * Calculates the stamp of the log directory, something which changes
+ * whenever files are added, renamed or removed.
+ *
+ * For a flat log directory this is its modification time. A sharded
+ * log directory keeps segments in subdirectories, so we combine the
+ * modification times of all directories into a hash, ignoring
+ * the order we encounter them. The second value is the number
+ * of directories then.
+ */
+static void dir_stamp(path logdir, int64_t &stamp_1, int64_t &stamp_2) {
+
+  uint64_t hash = 0;
+  int64_t count = 0;
+
+  auto combine = [&hash, &count](path dir) {
+
+    int64_t sec, nsec;
+    uint64_t h = 14695981039346656037ULL;
+    std::string name = dir.string();
+
+    dir_mtime(dir, sec, nsec);
+
+    /* FNV-1a over the name and modification time */
+    for (auto c : name)
+      h = (h ^ (unsigned char) c) * 1099511628211ULL;
+
+    h = (h ^ (uint64_t) sec) * 1099511628211ULL;
+    h = (h ^ (uint64_t) nsec) * 1099511628211ULL;
+
+    hash += h;
+    count++;
+
+  };
+
+  if (ArchiveLogDirectory::readLogLayout(logdir) != WAL_LOG_LAYOUT_SHARDED) {
+    dir_mtime(logdir, stamp_1, stamp_2);
+    return;
+  }
+
+  combine(logdir);
+
+  for (auto &tli : boost::make_iterator_range(directory_iterator(logdir), {})) {
+
+    if (!is_directory(tli.path())
+        || !ArchiveLogDirectory::isShardDirectoryName(tli.path().filename().string()))
+      continue;
+
+    combine(tli.path());
+
+    for (auto &shard : boost::make_iterator_range(directory_iterator(tli.path()), {})) {
+
+      if (is_directory(shard.path())
+          && ArchiveLogDirectory::isShardDirectoryName(shard.path().filename().string()))
+        combine(shard.path());
+
+    }
+
+  }
+
+  stamp_1 = (int64_t) hash;
+  stamp_2 = count;
+
+}
+
+/******************************************************************************
+ * WALSegmentIndexEntry Implementation
+ ******************************************************************************/
+
+bool WALSegmentIndexEntry::isSegment() const {
+
+  switch(this->status) {
+  case WAL_SEGMENT_COMPLETE:
+  case WAL_SEGMENT_COMPLETE_COMPRESSED:
+  case WAL_SEGMENT_PARTIAL:
+  case WAL_SEGMENT_PARTIAL_COMPRESSED:
+    return true;
+  default:
+    return false;
+  }
+
+}
+
+/******************************************************************************
+ * WALSegmentIndex Implementation
+ ******************************************************************************/
+
+bool WALSegmentIndex::WALSegmentIndexKey::operator<(const WALSegmentIndexKey &other) const {
+
+  if (this->segno != other.segno)
+    return this->segno < other.segno;
+
+  if (this->timeline != other.timeline)
+    return this->timeline < other.timeline;
+
+  return this->filename < other.filename;
+
+}
+
+WALSegmentIndex::WALSegmentIndex(path logdir,
+                                 unsigned long long wal_segment_size) {
+
+  if (wal_segment_size == 0)
+    throw CArchiveIssue("WAL segment index requires a valid WAL segment size");
+
+  this->logdir = logdir;
+  this->indexfile = logdir / WALSegmentIndex::INDEX_FILENAME;
+  this->wal_segment_size = wal_segment_size;
+
+}
+
+WALSegmentIndex::~WALSegmentIndex() {
+
+  if (this->fd >= 0)
+    this->unlock();
+
+}
+
+path WALSegmentIndex::getIndexPath() {
+  return this->indexfile;
+}
+
+unsigned long long WALSegmentIndex::getWalSegmentSize() {
+  return this->wal_segment_size;
+}
+
+bool WALSegmentIndex::makeEntry(const std::string &filename,
+                                unsigned long long size,
+                                WALSegmentIndexEntry &entry) {
+
+  entry.status = ArchiveLogDirectory::xlogSegmentStatusByName(filename);
+  entry.filename = filename;
+  entry.size = size;
+  entry.timeline = 0;
+  entry.segno = 0;
+  entry.has_checksum = false;
+  entry.crc32c = 0;
+
+  /* Must fit into an index record, including its terminating NUL */
+  if (filename.length() >= sizeof(((wal_index_record *)0)->filename))
+    return false;
+
+  switch(entry.status) {
+  case WAL_SEGMENT_COMPLETE:
+  case WAL_SEGMENT_COMPLETE_COMPRESSED:
+  case WAL_SEGMENT_PARTIAL:
+  case WAL_SEGMENT_PARTIAL_COMPRESSED:
+    {
+      TimeLineID tli = 0;
+      XLogSegNo segno = 0;
+
+      if (!xlog::parseWalFileName(filename.c_str(), filename.length(),
+                                  tli, segno, this->wal_segment_size))
+        return false;
+
+      entry.timeline = tli;
+      entry.segno = segno;
+      return true;
+    }
+  case WAL_SEGMENT_TLI_HISTORY_FILE:
+  case WAL_SEGMENT_TLI_HISTORY_FILE_COMPRESSED:
+    {
+      uint32_t tli = 0;
+
+      if (xlog::decodeHex32(filename.c_str(), filename.length(), 8, tli) == 0)
+        return false;
+
+      entry.timeline = tli;
+      return true;
+    }
+  default:
+    return false;
+  }
+
+}
+
+void WALSegmentIndex::insertEntry(const WALSegmentIndexEntry &entry) {
+
+  WALSegmentIndexKey key = { entry.segno, entry.timeline, entry.filename };
+  this->entries[key] = entry;
+
+}
+
+void WALSegmentIndex::eraseEntry(const WALSegmentIndexEntry &entry) {
+
+  WALSegmentIndexKey key = { entry.segno, entry.timeline, entry.filename };
+  this->entries.erase(key);
+
+}
+
+void WALSegmentIndex::lock(bool check_stamp, bool force_scan) {
+
+  this->fd = ::open(this->indexfile.string().c_str(),
+                    O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+  if (this->fd < 0) {
+    std::ostringstream oss;
+    oss << "could not open WAL segment index \"" << this->indexfile.string()
+        << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (flock(this->fd, LOCK_EX) < 0) {
+    std::ostringstream oss;
+    oss << "could not lock WAL segment index \"" << this->indexfile.string()
+        << "\": " << strerror(errno);
+    ::close(this->fd);
+    this->fd = -1;
+    throw CArchiveIssue(oss.str());
+  }
+
+  try {
+
+    if (force_scan || !this->readIndex(check_stamp)) {
+
+      BOOST_LOG_TRIVIAL(debug) << "rebuilding WAL segment index in "
+                               << this->logdir.string();
+      this->scan();
+
+    } else if (this->loaded_size > (off_t) sizeof(wal_index_header)
+               && ((this->loaded_size - sizeof(wal_index_header)) / sizeof(wal_index_record))
+               > (2 * this->entries.size() + WAL_INDEX_COMPACT_SLACK)) {
+
+      this->rewrite();
+
+    }
+
+  } catch(CArchiveIssue &ai) {
+    this->unlock();
+    throw ai;
+  }
+
+}
+
+void WALSegmentIndex::unlock() {
+
+  if (this->fd < 0)
+    return;
+
+  flock(this->fd, LOCK_UN);
+  ::close(this->fd);
+  this->fd = -1;
+
+}
+
+bool WALSegmentIndex::readIndex(bool check_stamp) {
+
+  struct stat st;
+  wal_index_header hdr;
+  off_t pos = sizeof(wal_index_header);
+  std::vector<wal_index_record> buf(WAL_INDEX_IO_RECORDS);
+
+  if (fstat(this->fd, &st) < 0) {
+    std::ostringstream oss;
+    oss << "could not stat WAL segment index \"" << this->indexfile.string()
+        << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (st.st_size < (off_t) sizeof(hdr)
+      || pread(this->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+    return false;
+
+  /*
+   * An invalid magic means the file is new or a rewrite
+   * didn't finish. A trailing partial record means an
+   * append didn't finish.
+   */
+  if (memcmp(hdr.magic, WAL_INDEX_MAGIC, sizeof(hdr.magic)) != 0
+      || hdr.version != WAL_INDEX_VERSION
+      || hdr.record_size != sizeof(wal_index_record)
+      || hdr.wal_segment_size != this->wal_segment_size
+      || ((st.st_size - sizeof(hdr)) % sizeof(wal_index_record)) != 0)
+    return false;
+
+  if (check_stamp) {
+
+    int64_t stamp_1, stamp_2;
+
+    dir_stamp(this->logdir, stamp_1, stamp_2);
+
+    if (stamp_1 != hdr.dir_stamp_1 || stamp_2 != hdr.dir_stamp_2)
+      return false;
+
+  }
+
+  /*
+   * If the file is still the one we've read before, just
+   * replay what was appended since then.
+   */
+  if (this->loaded_ino == st.st_ino
+      && this->loaded_generation == hdr.generation
+      && this->loaded_size >= (off_t) sizeof(hdr)
+      && this->loaded_size <= st.st_size) {
+    pos = this->loaded_size;
+  } else {
+    this->entries.clear();
+  }
+
+  while (pos < st.st_size) {
+
+    size_t count = std::min((size_t) ((st.st_size - pos) / sizeof(wal_index_record)),
+                            buf.size());
+    ssize_t rc = pread(this->fd, buf.data(), count * sizeof(wal_index_record), pos);
+
+    if (rc != (ssize_t) (count * sizeof(wal_index_record))) {
+      std::ostringstream oss;
+      oss << "could not read WAL segment index \"" << this->indexfile.string()
+          << "\": " << ((rc < 0) ? strerror(errno) : "short read");
+      throw CArchiveIssue(oss.str());
+    }
+
+    for (size_t i = 0; i < count; i++) {
+
+      WALSegmentIndexEntry entry;
+      wal_index_record &rec = buf[i];
+
+      rec.filename[sizeof(rec.filename) - 1] = '\0';
+
+      entry.timeline = rec.timeline;
+      entry.segno = rec.segno;
+      entry.status = (WALSegmentFileStatus) rec.status;
+      entry.size = rec.size;
+      entry.filename = rec.filename;
+      entry.has_checksum = (rec.flags & WAL_INDEX_FLAG_CHECKSUM) != 0;
+      entry.crc32c = rec.crc32c;
+
+      if (rec.op == WAL_INDEX_OP_ADD) {
+        this->insertEntry(entry);
+      } else if (rec.op == WAL_INDEX_OP_DEL) {
+        this->eraseEntry(entry);
+      } else {
+        return false;
+      }
+
+    }
+
+    pos += rc;
+
+  }
+
+  this->loaded_size = st.st_size;
+  this->loaded_ino = st.st_ino;
+  this->loaded_generation = hdr.generation;
+
+  return true;
+
+}
+
+void WALSegmentIndex::scan() {
+
+  /*
+   * Checksums were recorded while streaming and can't be
+   * derived from the directory, so remember them.
+   */
+  std::map<WALSegmentIndexKey, WALSegmentIndexEntry> known;
+
+  known.swap(this->entries);
+
+  if (!boost::filesystem::exists(this->logdir)) {
+    std::ostringstream oss;
+    oss << "could not scan archive log directory \"" << this->logdir.string()
+        << "\": log doesn't exist";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * Segment files of a sharded log directory live in
+   * log/<timeline>/<high digits>/. Look there in any case, a
+   * layout migration might have left files in both places.
+   */
+  std::vector<path> dirs = { this->logdir };
+
+  for (size_t i = 0; i < dirs.size(); i++) {
+
+    /* depth of the current directory below log/ */
+    size_t depth = (dirs[i] == this->logdir) ? 0
+      : ((dirs[i].parent_path() == this->logdir) ? 1 : 2);
+
+    for (auto &dirent : boost::make_iterator_range(directory_iterator(dirs[i]), {})) {
+
+      WALSegmentIndexEntry entry;
+      std::string filename = dirent.path().filename().string();
+      file_status status = dirent.status();
+      unsigned long long size = 0;
+
+      if (is_directory(status)) {
+
+        if (depth < 2 && ArchiveLogDirectory::isShardDirectoryName(filename))
+          dirs.push_back(dirent.path());
+
+        continue;
+
+      }
+
+      if (!is_regular_file(status) || depth == 1)
+        continue;
+
+      if (!this->makeEntry(filename, 0, entry))
+        continue;
+
+      /*
+       * Don't open compressed files here, that's exactly what
+       * the index wants to avoid. A completed segment has the
+       * configured WAL segment size, the size of partial segments
+       * isn't known until they are finalized.
+       */
+      switch(entry.status) {
+      case WAL_SEGMENT_COMPLETE:
+      case WAL_SEGMENT_TLI_HISTORY_FILE:
+        size = file_size(dirent.path());
+        break;
+      case WAL_SEGMENT_COMPLETE_COMPRESSED:
+        size = this->wal_segment_size;
+        break;
+      default:
+        size = 0;
+        break;
+      }
+
+      entry.size = size;
+
+      auto it = known.find({ entry.segno, entry.timeline, entry.filename });
+
+      if (it != known.end() && it->second.has_checksum) {
+        entry.has_checksum = true;
+        entry.crc32c = it->second.crc32c;
+      }
+
+      this->insertEntry(entry);
+
+    }
+
+  }
+
+  this->rewrite();
+
+}
+
+void WALSegmentIndex::writeHeader(bool valid) {
+
+  wal_index_header hdr;
+
+  memset(&hdr, 0, sizeof(hdr));
+
+  if (valid)
+    memcpy(hdr.magic, WAL_INDEX_MAGIC, sizeof(hdr.magic));
+
+  hdr.version = WAL_INDEX_VERSION;
+  hdr.record_size = sizeof(wal_index_record);
+  hdr.wal_segment_size = this->wal_segment_size;
+  hdr.generation = this->loaded_generation;
+  dir_stamp(this->logdir, hdr.dir_stamp_1, hdr.dir_stamp_2);
+
+  if (pwrite(this->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+    std::ostringstream oss;
+    oss << "could not write WAL segment index header \"" << this->indexfile.string()
+        << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+void WALSegmentIndex::rewrite() {
+
+  std::vector<wal_index_record> buf;
+  off_t pos = sizeof(wal_index_header);
+  struct stat st;
+
+  buf.reserve(WAL_INDEX_IO_RECORDS);
+
+  /*
+   * Invalidate the header first, so a crash in between
+   * leaves an index which is rebuilt on the next access.
+   */
+  this->loaded_generation++;
+  this->writeHeader(false);
+
+  if (ftruncate(this->fd, sizeof(wal_index_header)) < 0) {
+    std::ostringstream oss;
+    oss << "could not truncate WAL segment index \"" << this->indexfile.string()
+        << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  auto flush = [this, &buf, &pos]() {
+
+    ssize_t len = buf.size() * sizeof(wal_index_record);
+
+    if (len == 0)
+      return;
+
+    if (pwrite(this->fd, buf.data(), len, pos) != len) {
+      std::ostringstream oss;
+      oss << "could not write WAL segment index \"" << this->indexfile.string()
+          << "\": " << strerror(errno);
+      throw CArchiveIssue(oss.str());
+    }
+
+    pos += len;
+    buf.clear();
+
+  };
+
+  for (auto &item : this->entries) {
+
+    wal_index_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.op = WAL_INDEX_OP_ADD;
+    rec.status = item.second.status;
+    rec.timeline = item.second.timeline;
+    rec.segno = item.second.segno;
+    rec.size = item.second.size;
+    strncpy(rec.filename, item.second.filename.c_str(), sizeof(rec.filename) - 1);
+
+    if (item.second.has_checksum) {
+      rec.flags |= WAL_INDEX_FLAG_CHECKSUM;
+      rec.crc32c = item.second.crc32c;
+    }
+
+    buf.push_back(rec);
+
+    if (buf.size() >= WAL_INDEX_IO_RECORDS)
+      flush();
+
+  }
+
+  flush();
+
+  if (fdatasync(this->fd) < 0) {
+    std::ostringstream oss;
+    oss << "could not sync WAL segment index \"" << this->indexfile.string()
+        << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->writeHeader(true);
+
+  if (fstat(this->fd, &st) == 0)
+    this->loaded_ino = st.st_ino;
+
+  this->loaded_size = pos;
+
+}
+
+void WALSegmentIndex::append(const std::vector<WALSegmentIndexEntry> &add,
+                             const std::vector<WALSegmentIndexEntry> &del) {
+
+  std::vector<wal_index_record> recs;
+  ssize_t len;
+
+  for (auto &entry : del) {
+
+    wal_index_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.op = WAL_INDEX_OP_DEL;
+    rec.status = entry.status;
+    rec.timeline = entry.timeline;
+    rec.segno = entry.segno;
+    strncpy(rec.filename, entry.filename.c_str(), sizeof(rec.filename) - 1);
+    recs.push_back(rec);
+
+  }
+
+  for (auto &entry : add) {
+
+    wal_index_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.op = WAL_INDEX_OP_ADD;
+    rec.status = entry.status;
+    rec.timeline = entry.timeline;
+    rec.segno = entry.segno;
+    rec.size = entry.size;
+    strncpy(rec.filename, entry.filename.c_str(), sizeof(rec.filename) - 1);
+
+    if (entry.has_checksum) {
+      rec.flags |= WAL_INDEX_FLAG_CHECKSUM;
+      rec.crc32c = entry.crc32c;
+    }
+
+    recs.push_back(rec);
+
+  }
+
+  if (recs.empty())
+    return;
+
+  len = recs.size() * sizeof(wal_index_record);
+
+  /*
+   * Records must be on disk before the header claims the
+   * index being in sync with the directory, otherwise a crash
+   * could leave a stamped index missing the records.
+   */
+  if (pwrite(this->fd, recs.data(), len, this->loaded_size) != len
+      || fdatasync(this->fd) < 0) {
+    std::ostringstream oss;
+    oss << "could not append to WAL segment index \"" << this->indexfile.string()
+        << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+  this->loaded_size += len;
+  this->writeHeader(true);
+
+  for (auto &entry : del)
+    this->eraseEntry(entry);
+
+  for (auto &entry : add)
+    this->insertEntry(entry);
+
+}
+
+void WALSegmentIndex::load() {
+
+  std::lock_guard<std::recursive_mutex> guard(this->mtx);
+
+  this->lock(true);
+  this->unlock();
+
+}
+
+void WALSegmentIndex::rebuild() {
+
+  std::lock_guard<std::recursive_mutex> guard(this->mtx);
+
+  this->lock(false, true);
+  this->unlock();
+
+}
+
+void WALSegmentIndex::invalidate() {
+
+  std::lock_guard<std::recursive_mutex> guard(this->mtx);
+  boost::system::error_code ec;
+
+  boost::filesystem::remove(this->indexfile, ec);
+
+  this->entries.clear();
+  this->loaded_size = 0;
+  this->loaded_ino = 0;
+  this->loaded_generation = 0;
+
+}
+
+void WALSegmentIndex::add(const std::string &filename,
+                          unsigned long long size) {
+
+  std::lock_guard<std::recursive_mutex> guard(this->mtx);
+  std::vector<WALSegmentIndexEntry> add;
+  WALSegmentIndexEntry entry;
+
+  if (!this->makeEntry(filename, size, entry))
+    return;
+
+  add.push_back(entry);
+
+  /*
+   * We just changed the directory ourselves, so don't check
+   * the directory stamp here.
+   */
+  this->lock(false);
+
+  try {
+    this->append(add, std::vector<WALSegmentIndexEntry>());
+  } catch(CArchiveIssue &ai) {
+    this->unlock();
+    throw ai;
+  }
+
+  this->unlock();
+
+}
+
+void WALSegmentIndex::rename(const std::string &oldname,
+                             const std::string &newname,
+                             unsigned long long size) {
+
+  std::lock_guard<std::recursive_mutex> guard(this->mtx);
+  std::vector<WALSegmentIndexEntry> add;
+  std::vector<WALSegmentIndexEntry> del;
+  WALSegmentIndexEntry entry;
+
+  if (this->makeEntry(oldname, 0, entry))
+    del.push_back(entry);
+
+  if (this->makeEntry(newname, size, entry))
+    add.push_back(entry);
+
+  this->lock(false);
+
+  try {
+    this->append(add, del);
+  } catch(CArchiveIssue &ai) {
+    this->unlock();
+    throw ai;
+  }
+
+  this->unlock();
+
+}
+
+void WALSegmentIndex::rename(const std::string &oldname,
+                             const std::string &newname,
+                             unsigned long long size,
+                             uint32_t crc32c) {
+
+  std::lock_guard<std::recursive_mutex> guard(this->mtx);
+  std::vector<WALSegmentIndexEntry> add;
+  std::vector<WALSegmentIndexEntry> del;
+  WALSegmentIndexEntry entry;
+
+  if (this->makeEntry(oldname, 0, entry))
+    del.push_back(entry);
+
+  if (this->makeEntry(newname, size, entry)) {
+    entry.has_checksum = true;
+    entry.crc32c = crc32c;
+    add.push_back(entry);
+  }
+
+  this->lock(false);
+
+  try {
+    this->append(add, del);
+  } catch(CArchiveIssue &ai) {
+    this->unlock();
+    throw ai;
+  }
+
+  this->unlock();
+
+}
+
+void WALSegmentIndex::remove(const std::vector<std::string> &filenames) {
+
+  std::lock_guard<std::recursive_mutex> guard(this->mtx);
+
+  if (filenames.empty())
+    return;
+
+  this->lock(false);
+
+  try {
+
+    for (auto &filename : filenames) {
+
+      WALSegmentIndexEntry entry;
+
+      if (this->makeEntry(filename, 0, entry))
+        this->eraseEntry(entry);
+
+    }
+
+    /*
+     * Removals usually come in large batches from retention,
+     * so compact the index instead of appending tombstones.
+     */
+    this->rewrite();
+
+  } catch(CArchiveIssue &ai) {
+    this->unlock();
+    throw ai;
+  }
+
+  this->unlock();
+
+}
+
+bool WALSegmentIndex::last(WALSegmentIndexEntry &entry) {
+
+  std::lock_guard<std::recursive_mutex> guard(this->mtx);
+  bool found = false;
+
+  this->lock(true);
+
+  for (auto it = this->entries.rbegin(); it != this->entries.rend(); ++it) {
+
+    if (it->second.isSegment()) {
+      entry = it->second;
+      found = true;
+      break;
+    }
+
+  }
+
+  this->unlock();
+  return found;
+
+}
+
+std::vector<WALSegmentIndexEntry> WALSegmentIndex::range(unsigned int timeline,
+                                                         unsigned long long startSegno,
+                                                         unsigned long long endSegno) {
+
+  std::lock_guard<std::recursive_mutex> guard(this->mtx);
+  std::vector<WALSegmentIndexEntry> result;
+  WALSegmentIndexKey start = { startSegno, timeline, "" };
+
+  this->lock(true);
+
+  for (auto it = this->entries.lower_bound(start);
+       it != this->entries.end() && it->first.segno <= endSegno;
+       ++it) {
+
+    if (it->second.timeline == timeline && it->second.isSegment())
+      result.push_back(it->second);
+
+  }
+
+  this->unlock();
+  return result;
+
+}
+
+std::vector<WALSegmentIndexEntry> WALSegmentIndex::getEntries() {
+
+  std::lock_guard<std::recursive_mutex> guard(this->mtx);
+  std::vector<WALSegmentIndexEntry> result;
+
+  this->lock(true);
+
+  result.reserve(this->entries.size());
+
+  for (auto &item : this->entries)
+    result.push_back(item.second);
+
+  this->unlock();
+  return result;
+
+}
+
+size_t WALSegmentIndex::size() {
+
+  std::lock_guard<std::recursive_mutex> guard(this->mtx);
+  size_t result;
+
+  this->lock(true);
+  result = this->entries.size();
+  this->unlock();
+
+  return result;
+
+}
@@ -0,0 +1,259 @@
+#include <string.h>
+#include <boost/log/trivial.hpp>
+
+#include <BackupCatalog.hxx>
+#include <catalogqueue.hxx>
+
+using namespace pgbckctl;
+
+CatalogStatusQueue::CatalogStatusQueue(std::string catalog_name) {
+
+  this->name = CatalogStatusQueue::queueName(catalog_name);
+  this->last_flush = std::chrono::steady_clock::now();
+
+}
+
+CatalogStatusQueue::~CatalogStatusQueue() {
+
+  if (this->queue != nullptr)
+    delete this->queue;
+
+}
+
+std::string CatalogStatusQueue::queueName(std::string catalog_name) {
+  return "pg_backup_ctl::status_queue::" + catalog_name;
+}
+
+void CatalogStatusQueue::remove(std::string catalog_name) {
+  boost::interprocess::message_queue::remove(CatalogStatusQueue::queueName(catalog_name).c_str());
+}
+
+void CatalogStatusQueue::create() {
+
+  using namespace boost::interprocess;
+
+  if (this->queue != nullptr)
+    return;
+
+  try {
+
+    this->queue = new message_queue(open_or_create,
+                                    this->name.c_str(),
+                                    QUEUE_SIZE,
+                                    sizeof(catalog_stream_status_msg));
+
+  } catch(interprocess_exception &e) {
+
+    std::ostringstream oss;
+    oss << "could not create catalog status queue \""
+        << this->name << "\": " << e.what();
+    throw CPGBackupCtlFailure(oss.str());
+
+  }
+
+  /*
+   * A queue left over by a crashed launcher might have been
+   * created with a different message size, don't use it then.
+   */
+  if (this->queue->get_max_msg_size() != sizeof(catalog_stream_status_msg)) {
+
+    delete this->queue;
+    this->queue = nullptr;
+
+    message_queue::remove(this->name.c_str());
+    this->create();
+
+  }
+
+}
+
+bool CatalogStatusQueue::attach() {
+
+  using namespace boost::interprocess;
+
+  if (this->queue != nullptr)
+    return true;
+
+  try {
+    this->queue = new message_queue(open_only, this->name.c_str());
+  } catch(interprocess_exception &e) {
+    this->queue = nullptr;
+    return false;
+  }
+
+  if (this->queue->get_max_msg_size() != sizeof(catalog_stream_status_msg)) {
+    delete this->queue;
+    this->queue = nullptr;
+    return false;
+  }
+
+  return true;
+
+}
+
+bool CatalogStatusQueue::isAvailable() {
+  return (this->queue != nullptr);
+}
+
+bool CatalogStatusQueue::send(StreamIdentification &ident,
+                              unsigned int timeout_ms) {
+
+  using namespace boost::interprocess;
+
+  catalog_stream_status_msg msg;
+
+  if (this->queue == nullptr)
+    return false;
+
+  if (ident.xlogpos.length() >= CATALOG_STATUS_MSG_FIELD_LEN
+      || ident.status.length() >= CATALOG_STATUS_MSG_FIELD_LEN)
+    return false;
+
+  msg.stream_id = ident.id;
+  msg.timeline = ident.timeline;
+  strncpy(msg.xlogpos, ident.xlogpos.c_str(), CATALOG_STATUS_MSG_FIELD_LEN - 1);
+  strncpy(msg.status, ident.status.c_str(), CATALOG_STATUS_MSG_FIELD_LEN - 1);
+
+  try {
+
+    boost::posix_time::ptime deadline
+      = boost::posix_time::microsec_clock::universal_time()
+      + boost::posix_time::milliseconds(timeout_ms);
+
+    return this->queue->timed_send(&msg, sizeof(msg), 0, deadline);
+
+  } catch(interprocess_exception &e) {
+
+    BOOST_LOG_TRIVIAL(warning) << "WARNING: could not queue stream status: "
+                               << e.what();
+    return false;
+
+  }
+
+}
+
+size_t CatalogStatusQueue::receive() {
+
+  using namespace boost::interprocess;
+
+  catalog_stream_status_msg msg;
+  message_queue::size_type recv_size;
+  unsigned int prio;
+  size_t received = 0;
+
+  if (this->queue == nullptr)
+    return 0;
+
+  try {
+
+    while (this->queue->try_receive(&msg, sizeof(msg), recv_size, prio)) {
+
+      if (recv_size != sizeof(msg))
+        continue;
+
+      /* fields are NUL terminated by the sender, but don't trust that */
+      msg.xlogpos[CATALOG_STATUS_MSG_FIELD_LEN - 1] = '\0';
+      msg.status[CATALOG_STATUS_MSG_FIELD_LEN - 1] = '\0';
+
+      /* messages are received in order, so later ones win */
+      this->pending[msg.stream_id] = msg;
+      received++;
+
+    }
+
+  } catch(interprocess_exception &e) {
+    throw CPGBackupCtlFailure(e.what());
+  }
+
+  return received;
+
+}
+
+bool CatalogStatusQueue::flushDue() {
+
+  if (this->pending.empty())
+    return false;
+
+  if (this->pending.size() >= FLUSH_THRESHOLD)
+    return true;
+
+  return (std::chrono::steady_clock::now() - this->last_flush
+          >= std::chrono::milliseconds(this->flush_interval));
+
+}
+
+unsigned int CatalogStatusQueue::msUntilFlush() {
+
+  std::chrono::milliseconds elapsed;
+
+  if (this->pending.empty())
+    return this->flush_interval;
+
+  if (this->pending.size() >= FLUSH_THRESHOLD)
+    return 0;
+
+  elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()
+                                                                  - this->last_flush);
+
+  if (elapsed.count() >= this->flush_interval)
+    return 0;
+
+  return this->flush_interval - elapsed.count();
+
+}
+
+size_t CatalogStatusQueue::flush(std::shared_ptr<BackupCatalog> catalog) {
+
+  std::vector<int> affectedAttrs = { SQL_STREAM_XLOGPOS_ATTNO,
+                                     SQL_STREAM_TIMELINE_ATTNO,
+                                     SQL_STREAM_STATUS_ATTNO };
+  size_t updated = 0;
+
+  this->last_flush = std::chrono::steady_clock::now();
+
+  if (this->pending.empty())
+    return 0;
+
+  if (catalog == nullptr || !catalog->available())
+    throw CCatalogIssue("cannot flush stream status updates: catalog not opened");
+
+  catalog->startTransaction();
+
+  try {
+
+    for (auto &entry : this->pending) {
+
+      StreamIdentification ident;
+
+      ident.id = entry.second.stream_id;
+      ident.timeline = entry.second.timeline;
+      ident.xlogpos = entry.second.xlogpos;
+      ident.status = entry.second.status;
+
+      catalog->updateStream(ident.id, affectedAttrs, ident);
+      updated++;
+
+    }
+
+    catalog->commitTransaction();
+
+  } catch (CPGBackupCtlFailure &e) {
+
+    /* keep pending updates, the next flush retries them */
+    catalog->rollbackTransaction();
+    throw e;
+
+  }
+
+  this->pending.clear();
+  return updated;
+
+}
+
+size_t CatalogStatusQueue::pendingUpdates() {
+  return this->pending.size();
+}
+
+void CatalogStatusQueue::setFlushInterval(unsigned int interval_ms) {
+  this->flush_interval = interval_ms;
+}
@@ -16,8 +16,11 @@ extern "C" {
 
 /* logging */
 #include <boost/log/trivial.hpp>
+#include <atomic>
 #include <istream>
+#include <set>
 #include <stack>
+#include <thread>
 
 #include <bgrndroletype.hxx>
 #include <daemon.hxx>
@@ -25,6 +28,11 @@ extern "C" {
 #include <commands.hxx>
 #include <reaper.hxx>
 #include <server.hxx>
+#include <catalogqueue.hxx>
+#include <workerpool.hxx>
+#include <scheduler.hxx>
+#include <metrics.hxx>
+#include <objectstorage.hxx>
 
 #define MSG_QUEUE_MAX_TOKEN_SZ 255
 
@@ -91,6 +99,20 @@ void BackgroundWorker::release_launcher_role() {
 
   this->my_shm.detach();
 
+  /*
+   * The status queue belongs to the launcher, a forked worker
+   * attaches to it like any other worker process does.
+   */
+  this->status_queue = nullptr;
+
+  /*
+   * Don't keep the metrics port of the launcher open, but leave
+   * the metrics endpoint alone otherwise, its thread didn't make it
+   * into this process.
+   */
+  if (this->metrics_server != nullptr)
+    this->metrics_server->closeAfterFork();
+
 }
 
 LauncherStatus BackgroundWorker::status() {
@@ -152,6 +174,24 @@ void BackgroundWorker::prepareShutdown() {
 
   this->launcher_status = LAUNCHER_SHUTDOWN;
 
+  /*
+   * Tell pool workers to exit, the launcher isn't
+   * going to dispatch anything anymore.
+   */
+  this->shutdown_worker_pool();
+  this->shutdown_metrics_server();
+
+  /*
+   * Write out stream status updates still queued, workers
+   * won't be able to reach us anymore.
+   */
+  this->process_status_queue(true);
+
+  if (this->status_queue != nullptr) {
+    this->status_queue = nullptr;
+    CatalogStatusQueue::remove(this->catalog->name());
+  }
+
   /*
    * NOTE: We don't catch any exceptions here,
    * this is done by the initialize() caller, since
@@ -177,11 +217,361 @@ void BackgroundWorker::prepareShutdown() {
   catalog->close();
 }
 
+void BackgroundWorker::establish_status_queue() {
+
+  this->status_queue = std::make_shared<CatalogStatusQueue>(this->catalog->name());
+  this->status_queue->create();
+
+}
+
+size_t BackgroundWorker::process_status_queue(bool force) {
+
+  size_t received = 0;
+
+  if (this->status_queue == nullptr)
+    return 0;
+
+  try {
+
+    received = this->status_queue->receive();
+
+    if (force || this->status_queue->flushDue()) {
+      this->status_queue->flush(this->catalog);
+    }
+
+  } catch (std::exception &e) {
+    BOOST_LOG_TRIVIAL(error) << "could not write queued stream status updates: "
+                             << e.what();
+  }
+
+  return received;
+
+}
+
+unsigned int BackgroundWorker::next_wakeup(bool busy) {
+
+  unsigned int interval = CatalogStatusQueue::DEFAULT_FLUSH_INTERVAL;
+
+  /*
+   * Pending status updates must be written in time, regardless
+   * of anything else.
+   */
+  if (this->status_queue != nullptr) {
+
+    if (this->status_queue->pendingUpdates() > 0)
+      return this->status_queue->msUntilFlush();
+
+    interval = this->status_queue->msUntilFlush();
+
+  }
+
+  /*
+   * Workers streaming WAL send their status updates
+   * continuously, so as long as something happens, check the
+   * status queue every flush interval. Back off from there
+   * once the launcher gets idle.
+   */
+  if (busy || this->idle_wait == 0) {
+    this->idle_wait = interval;
+  } else {
+    this->idle_wait = std::min(this->idle_wait * 2,
+                               (unsigned int) LAUNCHER_IDLE_TIMEOUT_MS);
+  }
+
+  return this->idle_wait;
+
+}
+
+void BackgroundWorker::establish_worker_pool() {
+
+  if (this->ji.worker_pool_size == 0)
+    return;
+
+  this->worker_pool = std::make_shared<WorkerPool>(this->catalog->name(),
+                                                   this->ji.worker_pool_size);
+  this->worker_pool->create();
+
+  /* Exited children are collected for maintain_worker_pool() from now on */
+  if (this->reaper != nullptr)
+    this->reaper->track_exited = 1;
+  this->maintain_worker_pool();
+
+  BOOST_LOG_TRIVIAL(info) << "launcher worker pool started with "
+                          << this->worker_pool->getNumberOfWorkers() << " workers";
+
+}
+
+bool BackgroundWorker::maintain_worker_pool() {
+
+  bool busy = false;
+  unsigned int missing;
+
+  if (this->worker_pool == nullptr)
+    return false;
+
+  /*
+   * Pool workers which terminated, crashed or not, leave
+   * the pool. The stack is filled by our SIGCHLD handler, so
+   * block SIGCHLD while we're looking at it.
+   */
+  if (this->reaper != nullptr) {
+
+    sigset_t mask;
+    sigset_t oldmask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldmask);
+
+    while (!this->reaper->exited_pids.empty()) {
+
+      pid_t pid = this->reaper->exited_pids.top();
+      this->reaper->exited_pids.pop();
+
+      if (this->worker_pool->exited(pid)) {
+        BOOST_LOG_TRIVIAL(info) << "pool worker at PID " << pid << " exited";
+        busy = true;
+      }
+
+    }
+
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+
+  }
+
+  try {
+
+    if (this->worker_pool->receive() > 0)
+      busy = true;
+
+  } catch (std::exception &e) {
+    BOOST_LOG_TRIVIAL(error) << "could not receive pool worker states: " << e.what();
+  }
+
+  /*
+   * Don't replace pool workers if we're about to exit.
+   */
+  if (this->launcher_status == LAUNCHER_SHUTDOWN)
+    return busy;
+
+  missing = this->worker_pool->missing();
+
+  for (unsigned int i = 0; i < missing; i++) {
+
+    pid_t pid;
+
+    try {
+
+      pid = pool_worker(*this, this->catalog->name());
+
+    } catch (WorkerFailure &e) {
+
+      BOOST_LOG_TRIVIAL(error) << "could not fork pool worker: " << e.what();
+      break;
+
+    }
+
+    if (pid > 0) {
+      this->worker_pool->spawned(pid);
+      busy = true;
+    }
+
+  }
+
+  return busy;
+
+}
+
+bool BackgroundWorker::dispatch_to_pool(std::string command) {
+
+  if (this->worker_pool == nullptr)
+    return false;
+
+  return this->worker_pool->dispatch(command);
+
+}
+
+void BackgroundWorker::shutdown_worker_pool() {
+
+  if (this->worker_pool == nullptr)
+    return;
+
+  this->worker_pool->terminate();
+  WorkerPool::remove(this->catalog->name());
+  this->worker_pool = nullptr;
+
+}
+
+void BackgroundWorker::establish_scheduler() {
+
+  job_scheduler_limits limits;
+
+  limits.max_basebackups = this->ji.schedule_max_basebackups;
+  limits.max_verifies = this->ji.schedule_max_verifies;
+  limits.stagger = this->ji.schedule_stagger;
+  limits.max_wal_lag = (unsigned long long) this->ji.schedule_max_wal_lag * 1024 * 1024;
+
+  this->scheduler = std::make_shared<JobScheduler>(this->catalog,
+                                                   this->worker_shm,
+                                                   limits);
+  this->scheduler->refresh(std::time(NULL), true);
+
+  BOOST_LOG_TRIVIAL(info) << "launcher scheduler started with "
+                          << this->scheduler->getNumberOfSchedules() << " schedules";
+
+}
+
+void BackgroundWorker::establish_metrics_server() {
+
+  if (this->ji.metrics_port == 0)
+    return;
+
+  this->metrics_server = std::make_shared<MetricsServer>(this->ji.metrics_address,
+                                                         this->ji.metrics_port,
+                                                         this->worker_shm);
+  this->refresh_metrics();
+  this->metrics_server->start();
+
+  BOOST_LOG_TRIVIAL(info) << "launcher exports metrics on "
+                          << this->ji.metrics_address << ":" << this->ji.metrics_port;
+
+}
+
+void BackgroundWorker::refresh_metrics() {
+
+  std::vector<std::shared_ptr<StatCatalogArchive>> stats;
+  std::time_t now = std::time(NULL);
+
+  if (this->metrics_server == nullptr
+      || (this->metrics_refreshed > 0
+          && now < this->metrics_refreshed + (std::time_t) MetricsServer::REFRESH_INTERVAL))
+    return;
+
+  this->metrics_refreshed = now;
+
+  try {
+
+    this->catalog->statCatalogArchives(stats);
+    this->metrics_server->setCatalogStats(stats, now);
+
+  } catch (std::exception &e) {
+
+    /*
+     * Keep exporting the statistics we have, retried
+     * with the next refresh.
+     */
+    BOOST_LOG_TRIVIAL(error) << "could not read archive statistics for metrics: " << e.what();
+
+  }
+
+}
+
+void BackgroundWorker::shutdown_metrics_server() {
+
+  if (this->metrics_server == nullptr)
+    return;
+
+  this->metrics_server->stop();
+  this->metrics_server = nullptr;
+
+}
+
+size_t BackgroundWorker::scheduled_commands(std::vector<std::string> &commands) {
+
+  std::string command;
+  size_t count = 0;
+
+  if (this->scheduler == nullptr
+      || this->launcher_status == LAUNCHER_SHUTDOWN)
+    return 0;
+
+  while (this->scheduler->next(std::time(NULL), command)) {
+
+    BOOST_LOG_TRIVIAL(info) << "launcher starts scheduled job: " << command;
+    commands.push_back(command);
+    count++;
+
+  }
+
+  return count;
+
+}
+
+size_t BackgroundWorker::upload_commands(std::vector<std::string> &commands) {
+
+  std::vector<std::shared_ptr<ArchiveStorageDescr>> storages;
+  std::set<int> running;
+  std::time_t now = std::time(NULL);
+  size_t count = 0;
+
+  if (this->launcher_status == LAUNCHER_SHUTDOWN
+      || (this->uploads_checked > 0
+          && now < this->uploads_checked + (std::time_t) ObjectUploader::REFRESH_INTERVAL))
+    return 0;
+
+  this->uploads_checked = now;
+
+  try {
+
+    this->catalog->getArchiveStoragesWithPendingUploads(storages,
+                                                        ObjectUploader::MAX_ATTEMPTS);
+
+  } catch (std::exception &e) {
+
+    BOOST_LOG_TRIVIAL(error) << "could not read upload queue: " << e.what();
+    return 0;
+
+  }
+
+  if (storages.size() == 0)
+    return 0;
+
+  /*
+   * Worker slots are read without locking, see
+   * WorkerSHM::read(). An uploader which was just dispatched but
+   * isn't registered yet has the interval to show up.
+   */
+  for (unsigned int i = 0; i < this->worker_shm->getMaxWorkers(); i++) {
+
+    shm_worker_area area;
+
+    if (this->worker_shm->isEmpty(i))
+      continue;
+
+    area = this->worker_shm->read(i);
+
+    if (area.pid > 0 && area.cmdType == UPLOAD_ARCHIVE)
+      running.insert(area.archive_id);
+
+  }
+
+  for (auto &storage : storages) {
+
+    if (running.find(storage->archive_id) != running.end())
+      continue;
+
+    BOOST_LOG_TRIVIAL(info) << "launcher starts uploader for archive \""
+                            << storage->archive_name << "\"";
+    commands.push_back("UPLOAD ARCHIVE " + storage->archive_name);
+    count++;
+
+  }
+
+  return count;
+
+}
+
 void BackgroundWorker::assign_reaper(background_reaper *reaper) {
 
-  if (reaper != nullptr)
+  if (reaper != nullptr) {
+
     this->reaper = reaper;
 
+    if (this->worker_pool != nullptr)
+      this->reaper->track_exited = 1;
+
+  }
+
 }
 
 void BackgroundWorker::execute_reaper() {
@@ -487,6 +877,107 @@ std::string ProcessSHM::getIdent() {
  * WorkerSHM & objects implementation start
  ******************************************************************************/
 
+/*
+ * Child slots are claimed by sub workers through a 64 bit map per
+ * worker slot.
+ */
+static_assert(MAX_WORKER_CHILDS <= 64,
+              "MAX_WORKER_CHILDS exceeds the size of the child slot map");
+
+#define SHM_CHILD_MAP_MASK \
+  ((MAX_WORKER_CHILDS >= 64) ? ~((uint64_t) 0) : ((((uint64_t) 1) << MAX_WORKER_CHILDS) - 1))
+
+/*
+ * Makes the specified changecount odd, readers copying
+ * the data protected by it will retry until shm_end_change()
+ * was called. There must be only one writer at a time.
+ */
+static inline void shm_begin_change(volatile uint64_t *changecount) {
+
+  *changecount = *changecount + 1;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+}
+
+static inline void shm_end_change(volatile uint64_t *changecount) {
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  *changecount = *changecount + 1;
+
+}
+
+/*
+ * Copies the payload of a changecount protected structure
+ * into shared memory, i.e. everything but the leading changecount.
+ * Copying the caller's changecount would reset the live one and let
+ * readers accept a torn copy. Call between shm_begin_change() and
+ * shm_end_change().
+ */
+template<typename T>
+static inline void shm_copy_payload(T *dest, const T &src) {
+
+  static_assert(offsetof(T, changecount) == 0,
+                "changecount must be the first member");
+
+  memcpy((char *) dest + sizeof(dest->changecount),
+         (const char *) &src + sizeof(src.changecount),
+         sizeof(T) - sizeof(dest->changecount));
+
+}
+
+/*
+ * Copies size bytes from src to dest, retrying as long
+ * as the specified changecount indicates a concurrent change.
+ */
+static void shm_consistent_copy(void *dest,
+                                const volatile void *src,
+                                size_t size,
+                                const volatile uint64_t *changecount) {
+
+  while (true) {
+
+    uint64_t before = *changecount;
+
+    if (before % 2 != 0) {
+      /* writer active, try again */
+      std::this_thread::yield();
+      continue;
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    memcpy(dest, (const void *) src, size);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (*changecount == before)
+      break;
+
+  }
+
+}
+
+/*
+ * Returns true if any used child slot of the specified worker
+ * slot has a basebackup registered.
+ */
+static bool shm_child_basebackup_in_use(shm_worker_area *ptr) {
+
+  uint64_t map = __atomic_load_n(&ptr->child_map, __ATOMIC_SEQ_CST);
+
+  while (map != 0) {
+
+    unsigned int idx = __builtin_ctzll(map);
+
+    if (ptr->child_info[idx].backup_id >= 0)
+      return true;
+
+    map &= map - 1;
+
+  }
+
+  return false;
+
+}
+
 WorkerSHM::WorkerSHM() : ProcessSHM() {
 
   this->shm = nullptr;
@@ -512,6 +1003,7 @@ size_t WorkerSHM::calculateSHMsize() {
    */
   return 2 * (sizeof(shm_worker_area) * this->max_workers)
     + sizeof(boost::interprocess::interprocess_mutex)
+    + SHM_SLOT_MAP_WORDS(this->max_workers) * sizeof(uint64_t)
     + ( 4096 - ( (sizeof(shm_worker_area) * this->max_workers)
                  + sizeof(boost::interprocess::interprocess_mutex) ) );
 
@@ -537,6 +1029,7 @@ bool WorkerSHM::attach(std::string catalog, bool attach_only) {
   xsi_key key = xsi_key(keystr.str().c_str(), 2);
   std::ostringstream shm_ctl_name;
   std::ostringstream mtx_ctl_name;
+  std::ostringstream map_ctl_name;
 
   /*
    * Calculate requested shared memory size.
@@ -593,6 +1086,14 @@ bool WorkerSHM::attach(std::string catalog, bool attach_only) {
 
   this->upper = this->max_workers - 1;
 
+  /*
+   * The free slot map is initialized by reset(), which the
+   * launcher calls before any worker is started.
+   */
+  map_ctl_name << catalog << "_slot_map";
+  this->slot_map
+    = this->shm->find_or_construct<uint64_t>(map_ctl_name.str().c_str())[SHM_SLOT_MAP_WORDS(this->max_workers)](0);
+
   /*
    * Don't forget identifiers...
    */
@@ -651,10 +1152,15 @@ void WorkerSHM::write(unsigned int slot_index,
 
   if (ptr != NULL) {
 
+    shm_begin_change(&ptr->changecount);
+
     ptr->pid = item.pid;
     ptr->cmdType = item.cmdType;
     ptr->archive_id = item.archive_id;
     ptr->started = item.started;
+    ptr->multiplexed = item.multiplexed;
+
+    shm_end_change(&ptr->changecount);
 
   }
 
@@ -675,24 +1181,13 @@ bool WorkerSHM::detach_basebackup(unsigned int slot_index,
    * We have to check whether the shortcut basebackup_in_use
    * is still valid.
    *
-   * This means we need to loop through our child slots, checking whether
-   * there are still basebackups attached. We modify the
+   * This means we need to loop through our used child slots, checking
+   * whether there are still basebackups attached. We modify the
    * basebackup_is_use flag in place.
    */
   ptr = (shm_worker_area *) (this->shm_mem_ptr + slot_index);
 
-  for(unsigned int idx = 0; idx < MAX_WORKER_CHILDS; idx++) {
-
-    /* As soon as we found an active basebackup, we're done */
-    if (ptr->child_info[idx].backup_id > 0) {
-
-      shortcut_still_valid = true;
-      break;
-
-    }
-
-  }
-
+  shortcut_still_valid = shm_child_basebackup_in_use(ptr);
   ptr->basebackup_in_use = shortcut_still_valid;
   return ptr->basebackup_in_use;
 
@@ -730,37 +1225,44 @@ void WorkerSHM::write(unsigned int slot_index,
    */
   if (child_index < 0) {
 
+    uint64_t map = __atomic_load_n(&ptr->child_map, __ATOMIC_SEQ_CST);
+
     /*
-     * Search free child worker slot. We do this
-     * in a small plain loop, MAX_WORKER_CHILDS isn't
-     * so large....
+     * Claim the first free bit of the child map. Concurrent
+     * sub workers might do the same without holding the lock,
+     * so retry if someone else was faster.
      */
-    for (unsigned int idx = 0; idx < MAX_WORKER_CHILDS; idx++) {
+    while (true) {
 
-      if (ptr->child_info[idx].pid <= 0) {
+      uint64_t free_map = ~map & SHM_CHILD_MAP_MASK;
+      unsigned int idx;
 
-        child_index = idx;
-        break;
+      if (free_map == 0) {
 
-      }
+        std::ostringstream oss;
 
-    }
+        oss << "could not register sub worker child: out of slots";
+        throw SHMFailure(oss.str());
 
-    /*
-     * Check whether we've found one.
-     */
-    if (child_index < 0) {
+      }
 
-      std::ostringstream oss;
+      idx = __builtin_ctzll(free_map);
 
-      oss << "could not register sub worker child: out of slots";
-      throw SHMFailure(oss.str());
+      if (__atomic_compare_exchange_n(&ptr->child_map, &map,
+                                      map | (((uint64_t) 1) << idx),
+                                      false,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        child_index = idx;
+        break;
+      }
 
     }
 
     /* Store child information into slot */
+    shm_begin_change(&ptr->child_info[child_index].changecount);
     ptr->child_info[child_index].pid = child_info.pid;
     ptr->child_info[child_index].backup_id = child_info.backup_id;
+    shm_end_change(&ptr->child_info[child_index].changecount);
 
     /* Adjust parent slot information, and we're done */
     if (ptr->child_info[child_index].backup_id != -1)
@@ -783,8 +1285,10 @@ void WorkerSHM::write(unsigned int slot_index,
     }
 
     /* Everything looks sane, modify the entry. */
+    shm_begin_change(&ptr->child_info[child_index].changecount);
     ptr->child_info[child_index].pid = child_info.pid;
     ptr->child_info[child_index].backup_id = child_info.backup_id;
+    shm_end_change(&ptr->child_info[child_index].changecount);
 
     if (child_info.backup_id != -1)
       ptr->basebackup_in_use = true;
@@ -818,6 +1322,166 @@ bool WorkerSHM::isEmpty(unsigned int slot_index) {
 
 }
 
+void WorkerSHM::requestStop(unsigned int slot_index) {
+
+  shm_worker_area *ptr;
+
+  if ( (this->shm == nullptr)
+       || (this->shm_mem_ptr == nullptr)) {
+    throw SHMFailure("attempt to write worker slot from uninitialized shared memory");
+  }
+
+  if (slot_index > this->upper) {
+    ostringstream oss;
+
+    oss << "requested slot index "
+        << slot_index
+        << " exceeds shared memory upper limit";
+    throw SHMFailure(oss.str());
+  }
+
+  ptr = (shm_worker_area *)(this->shm_mem_ptr + slot_index);
+  ptr->stop_requested = true;
+
+}
+
+bool WorkerSHM::stopRequested(unsigned int slot_index) {
+
+  shm_worker_area *ptr;
+
+  if ( (this->shm == nullptr)
+       || (this->shm_mem_ptr == nullptr)) {
+    throw SHMFailure("attempt to read worker slot from uninitialized shared memory");
+  }
+
+  if (slot_index > this->upper) {
+    ostringstream oss;
+
+    oss << "requested slot index "
+        << slot_index
+        << " exceeds shared memory upper limit";
+    throw SHMFailure(oss.str());
+  }
+
+  ptr = (shm_worker_area *)(this->shm_mem_ptr + slot_index);
+  return ptr->stop_requested;
+
+}
+
+void WorkerSHM::writeStreamStats(unsigned int slot_index,
+                                 shm_stream_stats &stats) {
+
+  shm_worker_area *ptr;
+
+  if ( (this->shm == nullptr)
+       || (this->shm_mem_ptr == nullptr)) {
+    throw SHMFailure("attempt to write worker slot from uninitialized shared memory");
+  }
+
+  if (slot_index > this->upper) {
+    ostringstream oss;
+
+    oss << "requested slot index "
+        << slot_index
+        << " exceeds shared memory upper limit";
+    throw SHMFailure(oss.str());
+  }
+
+  ptr = (shm_worker_area *)(this->shm_mem_ptr + slot_index);
+
+  /*
+   * Make changecount odd while updating, readers will
+   * retry until it's even again.
+   */
+  shm_begin_change(&ptr->stream_stats.changecount);
+  shm_copy_payload(&ptr->stream_stats, stats);
+  shm_end_change(&ptr->stream_stats.changecount);
+
+}
+
+shm_stream_stats WorkerSHM::readStreamStats(unsigned int slot_index) {
+
+  shm_worker_area *ptr;
+  shm_stream_stats result;
+
+  if ( (this->shm == nullptr)
+       || (this->shm_mem_ptr == nullptr)) {
+    throw SHMFailure("attempt to read worker slot from uninitialized shared memory");
+  }
+
+  if (slot_index > this->upper) {
+    ostringstream oss;
+
+    oss << "requested slot index "
+        << slot_index
+        << " exceeds shared memory upper limit";
+    throw SHMFailure(oss.str());
+  }
+
+  ptr = (shm_worker_area *)(this->shm_mem_ptr + slot_index);
+
+  shm_consistent_copy(&result, &ptr->stream_stats, sizeof(shm_stream_stats),
+                      &ptr->stream_stats.changecount);
+
+  return result;
+
+}
+
+void WorkerSHM::writeBasebackupProgress(unsigned int slot_index,
+                                        shm_basebackup_progress &progress) {
+
+  shm_worker_area *ptr;
+
+  if ( (this->shm == nullptr)
+       || (this->shm_mem_ptr == nullptr)) {
+    throw SHMFailure("attempt to write worker slot from uninitialized shared memory");
+  }
+
+  if (slot_index > this->upper) {
+    ostringstream oss;
+
+    oss << "requested slot index "
+        << slot_index
+        << " exceeds shared memory upper limit";
+    throw SHMFailure(oss.str());
+  }
+
+  ptr = (shm_worker_area *)(this->shm_mem_ptr + slot_index);
+
+  shm_begin_change(&ptr->backup_progress.changecount);
+  shm_copy_payload(&ptr->backup_progress, progress);
+  shm_end_change(&ptr->backup_progress.changecount);
+
+}
+
+shm_basebackup_progress WorkerSHM::readBasebackupProgress(unsigned int slot_index) {
+
+  shm_worker_area *ptr;
+  shm_basebackup_progress result;
+
+  if ( (this->shm == nullptr)
+       || (this->shm_mem_ptr == nullptr)) {
+    throw SHMFailure("attempt to read worker slot from uninitialized shared memory");
+  }
+
+  if (slot_index > this->upper) {
+    ostringstream oss;
+
+    oss << "requested slot index "
+        << slot_index
+        << " exceeds shared memory upper limit";
+    throw SHMFailure(oss.str());
+  }
+
+  ptr = (shm_worker_area *)(this->shm_mem_ptr + slot_index);
+
+  shm_consistent_copy(&result, &ptr->backup_progress, sizeof(shm_basebackup_progress),
+                      &ptr->backup_progress.changecount);
+
+  return result;
+
+}
+
 void WorkerSHM::reset() {
 
   shm_worker_area *ptr;
@@ -833,30 +1497,55 @@ void WorkerSHM::reset() {
 
     if (ptr != NULL) {
 
+      shm_begin_change(&ptr->changecount);
+
       ptr->pid = 0;
       ptr->cmdType = EMPTY_DESCR;
       ptr->archive_id = -1;
       ptr->started = boost::posix_time::ptime();
       ptr->basebackup_in_use = false;
+      ptr->multiplexed = false;
+      ptr->stop_requested = false;
+      ptr->stream_stats = shm_stream_stats();
+      ptr->backup_progress = shm_basebackup_progress();
 
       for (int child_index = 0; child_index < MAX_WORKER_CHILDS; child_index++) {
 
+        shm_begin_change(&ptr->child_info[child_index].changecount);
         ptr->child_info[child_index].pid = -1;
         ptr->child_info[child_index].backup_id = -1;
+        shm_end_change(&ptr->child_info[child_index].changecount);
 
       }
 
+      __atomic_store_n(&ptr->child_map, 0, __ATOMIC_SEQ_CST);
+
+      shm_end_change(&ptr->changecount);
+
     }
 
   }
 
+  /*
+   * All slots are free now. Bits beyond the upper
+   * index stay cleared, so getFreeIndex() never returns them.
+   */
+  for (unsigned int word = 0; word < SHM_SLOT_MAP_WORDS(this->max_workers); word++) {
+    this->slot_map[word] = 0;
+  }
+
+  for (unsigned int i = 0; i <= this->upper; i++) {
+    this->slot_map[i / 64] |= ((uint64_t) 1) << (i % 64);
+  }
+
+
 }
 
 void WorkerSHM::free_child_by_pid(unsigned int slot_index,
                                   pid_t child_pid) {
 
   shm_worker_area *ptr = nullptr;
-  unsigned int free_idx;
+  uint64_t map;
 
   if ( (this->shm == nullptr)
        || (this->shm_mem_ptr == nullptr)) {
@@ -880,30 +1569,26 @@ void WorkerSHM::free_child_by_pid(unsigned int slot_index,
   ptr = (shm_worker_area *)(this->shm_mem_ptr + slot_index);
 
   /*
-   * We need to search the child_pid
-   * within our child_info array. Since the array
-   * isn't considered to grow very large, just use
-   * plain stupid for loop.
-   *
-   * We don't free the child slot directly here, since
-   * we are going to call free_child(), which would mean
-   * to have to indirectly iterate over the child_info
-   * array again. So just remember the pid and do the
-   * call afterwards.
+   * We need to search the child_pid within our used
+   * child slots only, so look at the bits set in the child map.
+   * This is called from signal handlers, too, so don't lock here.
    */
-  for (unsigned int idx = 0; idx < MAX_WORKER_CHILDS; idx++) {
+  map = __atomic_load_n(&ptr->child_map, __ATOMIC_SEQ_CST);
+
+  while (map != 0) {
+
+    unsigned int idx = __builtin_ctzll(map);
 
     if (ptr->child_info[idx].pid == child_pid) {
 
-      free_idx = idx;
+      free_child(slot_index, idx);
       break;
 
     }
 
-  }
+    map &= map - 1;
 
-  if (free_idx >= 0)
-    free_child(slot_index, free_idx);
+  }
 
 }
 
@@ -912,7 +1597,6 @@ void WorkerSHM::free_child(unsigned int slot_index,
 
   unsigned int free_child_index = child_index;
   shm_worker_area *ptr = nullptr;
-  bool basebackup_in_use = false;
 
   if ( (this->shm == nullptr)
        || (this->shm_mem_ptr == nullptr)) {
@@ -948,33 +1632,29 @@ void WorkerSHM::free_child(unsigned int slot_index,
    * Since we might call this method lockless,
    * make sure the pid stays the first modification here.
    */
+  shm_begin_change(&ptr->child_info[free_child_index].changecount);
   ptr->child_info[free_child_index].pid = 0;
-
   ptr->child_info[free_child_index].backup_id = -1;
+  shm_end_change(&ptr->child_info[free_child_index].changecount);
+
+  /* The child slot can be claimed again */
+  __atomic_fetch_and(&ptr->child_map,
+                     ~(((uint64_t) 1) << free_child_index),
+                     __ATOMIC_SEQ_CST);
 
   /*
    * We need to check whether any backup ID is still registered
-   * within the current child slots. Loop through the list (which
-   * is small, so this isn't a caveat here).
+   * within the remaining child slots.
    */
-  for (unsigned int idx = 0; idx < MAX_WORKER_CHILDS; idx++) {
-
-    if (ptr->child_info[idx].backup_id >= 0) {
-      ptr->basebackup_in_use = true;
-
-      /* exit, since we have the info we need */
-      break;
-    }
-
-  }
-
-  ptr->basebackup_in_use = basebackup_in_use;
+  ptr->basebackup_in_use = shm_child_basebackup_in_use(ptr);
 
 }
 
 void WorkerSHM::free(unsigned int slot_index) {
 
   shm_worker_area *ptr;
+  shm_stream_stats empty_stats;
+  shm_basebackup_progress empty_progress;
 
   if ( (this->shm == nullptr)
        || (this->shm_mem_ptr == nullptr)) {
@@ -992,19 +1672,36 @@ void WorkerSHM::free(unsigned int slot_index) {
 
   ptr = (shm_worker_area *)(this->shm_mem_ptr + slot_index);
 
+  shm_begin_change(&ptr->changecount);
+
   ptr->pid = 0;
   ptr->cmdType = EMPTY_DESCR;
   ptr->archive_id = -1;
   ptr->started = boost::posix_time::ptime();
   ptr->basebackup_in_use = false;
+  ptr->multiplexed = false;
+  ptr->stop_requested = false;
+
+  shm_end_change(&ptr->changecount);
+
+  /* stream statistics are read lockless, so keep changecount going */
+  this->writeStreamStats(slot_index, empty_stats);
+  this->writeBasebackupProgress(slot_index, empty_progress);
 
   for (int child_index = 0; child_index < MAX_WORKER_CHILDS; child_index++) {
 
+    shm_begin_change(&ptr->child_info[child_index].changecount);
     ptr->child_info[child_index].pid = -1;
     ptr->child_info[child_index].backup_id = -1;
+    shm_end_change(&ptr->child_info[child_index].changecount);
 
   }
 
+  __atomic_store_n(&ptr->child_map, 0, __ATOMIC_SEQ_CST);
+
+  /* Slot can be handed out by getFreeIndex() again */
+  this->slot_map[slot_index / 64] |= ((uint64_t) 1) << (slot_index % 64);
+
   this->allocated--;
 
 }
@@ -1020,6 +1717,7 @@ unsigned int WorkerSHM::allocate(shm_worker_area &item) {
 
   result = this->getFreeIndex();
   this->write(result, item);
+  this->slot_map[result / 64] &= ~(((uint64_t) 1) << (result % 64));
   this->allocated++;
 
   return result;
@@ -1028,20 +1726,21 @@ unsigned int WorkerSHM::allocate(shm_worker_area &item) {
 
 unsigned int WorkerSHM::getFreeIndex() {
 
-  shm_worker_area *ptr = nullptr;
-
   if ( (this->shm == nullptr)
        || (this->shm_mem_ptr == nullptr)) {
     throw SHMFailure("attempt to read worker slot from uninitialized shared memory");
   }
 
-  for (unsigned int i = 0; i <= this->upper; i++) {
-
-    ptr = (shm_worker_area *)(this->shm_mem_ptr + i);
+  /*
+   * Look up the first free slot in the slot map. Bits beyond
+   * the upper index are never set, see reset().
+   */
+  for (unsigned int word = 0; word < SHM_SLOT_MAP_WORDS(this->max_workers); word++) {
 
-    if (ptr->pid == 0) {
-      return i;
+    if (this->slot_map[word] != 0) {
+      return word * 64 + __builtin_ctzll(this->slot_map[word]);
     }
+
   }
 
   throw SHMFailure("no worker slot available");
@@ -1073,30 +1772,24 @@ sub_worker_info WorkerSHM::read(unsigned int slot_index,
 
   ptr = (shm_worker_area *)(this->shm_mem_ptr + slot_index);
 
-  /**
-   * Extract child info slot information, if valid
-   * child_index present.
-   */
-  if (ptr != NULL) {
-
-    if (child_index >= 0 || child_index < MAX_WORKER_CHILDS) {
-
-      /* Copy information and we're done */
-      result = ptr->child_info[child_index];
-
-    } else {
-
-      std::ostringstream oss;
+  if (child_index >= MAX_WORKER_CHILDS) {
 
-      oss << "child slot index("
-          << child_index
-          << ") out of bounds";
-      SHMFailure(oss.str());
+    std::ostringstream oss;
 
-    }
+    oss << "child slot index("
+        << child_index
+        << ") out of bounds";
+    throw SHMFailure(oss.str());
 
   }
 
+  /**
+   * Copy child info slot information, retried while
+   * its owner changes it.
+   */
+  shm_consistent_copy(&result, &ptr->child_info[child_index], sizeof(sub_worker_info),
+                      &ptr->child_info[child_index].changecount);
+
   return result;
 
 }
@@ -1121,7 +1814,7 @@ shm_worker_area WorkerSHM::read(unsigned int slot_index) {
   }
 
   ptr = (shm_worker_area *)(this->shm_mem_ptr + slot_index);
-  result = (*ptr);
+  shm_consistent_copy(&result, ptr, sizeof(shm_worker_area), &ptr->changecount);
 
   return result;
 
@@ -1137,6 +1830,7 @@ void WorkerSHM::detach() {
     this->upper = 0;
     this->mtx = nullptr;
     this->shm_mem_ptr = nullptr;
+    this->slot_map = nullptr;
 
     /*
      * Now detach. We don't remove it
@@ -1317,6 +2011,16 @@ static void _pgbckctl_sigchld_handler(int sig) {
 
   while ((pid = waitpid(-1, &wait_status, WNOHANG)) != -1) {
 
+    /* children left, but none of them terminated */
+    if (pid == 0)
+      break;
+
+    if ( (_pgbckctl_job_type == BACKGROUND_LAUNCHER)
+         && (launcher_reaper != nullptr)
+         && launcher_reaper->track_exited ) {
+      launcher_reaper->exited_pids.push(pid);
+    }
+
     if (WIFSIGNALED(wait_status)) {
 
       /*
@@ -1507,6 +2211,22 @@ static pid_t daemonize(job_info &info) {
       }
     }
 
+    /*
+     * Block the signals we're waiting for, so that none of
+     * them can arrive between checking the shutdown mode and
+     * sigsuspend(), which unblocks them atomically.
+     */
+    sigset_t waitmask;
+    sigset_t oldmask;
+
+    sigemptyset(&waitmask);
+    sigaddset(&waitmask, SIGTERM);
+    sigaddset(&waitmask, SIGINT);
+    sigaddset(&waitmask, SIGQUIT);
+    sigaddset(&waitmask, SIGHUP);
+    sigaddset(&waitmask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &waitmask, &oldmask);
+
     /*
      * Launcher processing loop.
      */
@@ -1528,10 +2248,14 @@ static pid_t daemonize(job_info &info) {
        */
       if (info.detach)
         break;
-      usleep(10000);
+
+      /* sleep until a signal arrives */
+      sigsuspend(&oldmask);
 
     } while(true);
 
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+
     exit(_pgbckctl_shutdown_mode);
   }
 
@@ -1549,6 +2273,12 @@ static pid_t daemonize(job_info &info) {
      */
     bool cmd_ok;
 
+    /*
+     * Flag, indicating that the last round of the processing
+     * loop had something to do, see BackgroundWorker::next_wakeup().
+     */
+    bool busy = true;
+
     /*
      * If initialization got exit signal, exit. Do this here before
      * doing any initialization stuff.
@@ -1641,6 +2371,29 @@ static pid_t daemonize(job_info &info) {
      * Setup message queue.
      */
     establish_launcher_cmd_queue(info);
+    worker.establish_status_queue();
+
+    try {
+      worker.establish_worker_pool();
+    } catch (std::exception &e) {
+      /* not fatal, commands are executed by forked workers then */
+      BOOST_LOG_TRIVIAL(error) << "could not start worker pool: " << e.what();
+    }
+
+    try {
+      worker.establish_scheduler();
+    } catch (std::exception &e) {
+      /* not fatal, just no scheduled jobs */
+      BOOST_LOG_TRIVIAL(error) << "could not start scheduler: " << e.what();
+    }
+
+    try {
+      worker.establish_metrics_server();
+    } catch (std::exception &e) {
+      /* not fatal, just no metrics */
+      BOOST_LOG_TRIVIAL(error) << "could not start metrics endpoint: " << e.what();
+      worker.shutdown_metrics_server();
+    }
 
     /*
      * Mark background worker running.
@@ -1655,9 +2408,28 @@ static pid_t daemonize(job_info &info) {
       /*
        * Reap dead workers, if any.
        */
-      worker.execute_reaper();
+      if (launcher_reaper->dead_pids.size() > 0) {
+        worker.execute_reaper();
+        busy = true;
+      }
+
+      /*
+       * Write stream status updates of our workers.
+       */
+      if (worker.process_status_queue() > 0)
+        busy = true;
 
-      usleep(1000);
+      /*
+       * Replace pool workers which exited.
+       */
+      if (worker.maintain_worker_pool())
+        busy = true;
+
+      /*
+       * Keep the archive statistics of the metrics endpoint
+       * recent.
+       */
+      worker.refresh_metrics();
 
       if (_pgbckctl_shutdown_mode == DAEMON_TERM_NORMAL) {
         BOOST_LOG_TRIVIAL(info) << "shutdown request received";
@@ -1681,11 +2453,37 @@ static pid_t daemonize(job_info &info) {
       }
 
       /*
-       * Check message queue whether there is something to do.
+       * Block on the message queue until there is something to
+       * do or we have to look after our workers again. We used to
+       * poll the queue every millisecond here, which kept every
+       * idle launcher busy. A command is dispatched as soon as it
+       * arrives.
        */
-      std::string command = recv_launcher_cmd(info, cmd_ok);
+      std::string received = recv_launcher_cmd(info, cmd_ok,
+                                              worker.next_wakeup(busy));
+
+      busy = cmd_ok;
+
+      std::vector<std::string> commands;
 
       if (cmd_ok) {
+        commands.push_back(received);
+      } else {
+
+        /*
+         * Start scheduled jobs only once the command queue is
+         * drained, so queued commands like streaming WAL go
+         * first.
+         */
+        if (worker.scheduled_commands(commands) > 0)
+          busy = true;
+
+        if (worker.upload_commands(commands) > 0)
+          busy = true;
+
+      }
+
+      for (auto &command : commands) {
 
         /*
          * We got a command string. Establish a command
@@ -1699,6 +2497,15 @@ static pid_t daemonize(job_info &info) {
 
           BOOST_LOG_TRIVIAL(debug) << "BACKGROUND COMMAND: " << command;
 
+          /*
+           * An idle pool worker saves us the fork and its
+           * initialization.
+           */
+          if (worker.dispatch_to_pool(command)) {
+            BOOST_LOG_TRIVIAL(info) << "launcher dispatched command to worker pool";
+            continue;
+          }
+
           /*
            * Execute the command.
            *
@@ -1751,6 +2558,8 @@ static pid_t daemonize(job_info &info) {
 
     }
 
+    worker.shutdown_metrics_server();
+
     exit(_pgbckctl_shutdown_mode);
   } /* child execution code */
 
@@ -1872,6 +2681,13 @@ void pgbckctl::send_launcher_cmd(job_info& info, std::string command) {
 
 std::string pgbckctl::recv_launcher_cmd(job_info &info, bool &cmd_received) {
 
+  return recv_launcher_cmd(info, cmd_received, 0);
+
+}
+
+std::string pgbckctl::recv_launcher_cmd(job_info &info, bool &cmd_received,
+                                        unsigned int timeout_ms) {
+
   using namespace boost::interprocess;
 
   std::string command = "";
@@ -1894,10 +2710,25 @@ std::string pgbckctl::recv_launcher_cmd(job_info &info, bool &cmd_received) {
     unsigned int prio;
 
     memset(recvbuffer, 0, MSG_QUEUE_MAX_TOKEN_SZ);
-    if (info.command_queue->try_receive(&recvbuffer, MSG_QUEUE_MAX_TOKEN_SZ, recv_size, prio)) {
-      cmd_received = true;
+
+    if (timeout_ms == 0) {
+
+      cmd_received = info.command_queue->try_receive(&recvbuffer, MSG_QUEUE_MAX_TOKEN_SZ,
+                                                     recv_size, prio);
+
     } else {
-      cmd_received = false;
+
+      /*
+       * interprocess timeouts are absolute and
+       * based on universal time.
+       */
+      boost::posix_time::ptime deadline
+        = boost::posix_time::microsec_clock::universal_time()
+        + boost::posix_time::milliseconds(timeout_ms);
+
+      cmd_received = info.command_queue->timed_receive(&recvbuffer, MSG_QUEUE_MAX_TOKEN_SZ,
+                                                       recv_size, prio, deadline);
+
     }
 
     command = recvbuffer;
@@ -1922,6 +2753,180 @@ pid_t pgbckctl::launch(job_info& info) {
 
 }
 
+/**
+ * Prepares a forked process to execute commands as a
+ * background worker: switches the background job context and
+ * attaches the worker shared memory area. Used by worker_command()
+ * and pool workers, which do this once for all their jobs.
+ */
+static void worker_setup(BackgroundWorker &worker) {
+
+  job_info info = worker.jobInfo();
+  WorkerSHM *worker_shm;
+
+  /*
+   * Make sure we have the right background job context.
+   */
+  _pgbckctl_job_type = BACKGROUND_WORKER;
+
+  /*
+   * Reset SIGCHLD signal handler. Not required
+   * in a background worker process.
+   */
+  signal(SIGCHLD, SIG_DFL);
+
+  /*
+   * Tell our background worker handle that we
+   * aren't longer a launcher instance.
+   */
+  worker.release_launcher_role();
+
+  /*
+   * Attach to the worker shared memory area, we register
+   * ourselves there when executing a command.
+   */
+  worker_shm = worker.workerSHM();
+  if (!worker_shm->attach(info.cmdHandle->getCatalog()->fullname(), true)) {
+    /* could not attach to shared memory segment */
+    throw WorkerFailure("could not attach to worker shared memory area");
+  }
+
+}
+
+/**
+ * Executes a single command in a background worker prepared
+ * by worker_setup(). The worker is registered in the worker
+ * shared memory area while the command is running.
+ */
+static void worker_execute(BackgroundWorker &worker,
+                           PGBackupCtlParser &parser,
+                           std::string command) {
+
+  job_info info = worker.jobInfo();
+  std::shared_ptr<PGBackupCtlCommand> bgrnd_cmd_handler;
+  JobSignalHandler *cmdSignalHandler;
+  WorkerSHM *worker_shm = worker.workerSHM();
+  unsigned int worker_slot_index = 0;
+  shm_worker_area worker_info;
+
+  BOOST_LOG_TRIVIAL(info) << "background job executing command " << command;
+
+  worker_info.pid = ::getpid();
+  worker_info.started = CPGBackupCtlBase::ISO8601_strTo_ptime(CPGBackupCtlBase::current_timestamp());
+
+  /*
+   * Parse command.
+   */
+  parser.parseLine(command);
+
+  /*
+   * Parser has instantiated a command handler
+   * iff success.
+   */
+  bgrnd_cmd_handler = parser.getCommand();
+
+  /*
+   * Remember parsed command tag.
+   */
+  worker_info.cmdType = bgrnd_cmd_handler->getCommandTag();
+
+  /*
+   * If the PGBackupCtlCommand handler encapsulates a
+   * command attached to an archive, we record the archive id
+   * in the shared memory, too.
+   */
+  if (bgrnd_cmd_handler->archive_name().length() > 0) {
+
+    /*
+     * catalog access can throw here, don't suppress errors
+     * at this point but remap that to a WorkerFailure exception.
+     */
+    try {
+
+      std::shared_ptr<CatalogDescr> temp_descr
+        = info.cmdHandle->getCatalog()->existsByName(bgrnd_cmd_handler->archive_name());
+
+      if (temp_descr->id >= 0) {
+        worker_info.archive_id = temp_descr->id;
+      }
+
+    } catch(CPGBackupCtlFailure &e) {
+
+      throw WorkerFailure(e.what());
+
+    }
+  }
+
+  /*
+   * Set signal handlers.
+   */
+  cmdSignalHandler = dynamic_cast<JobSignalHandler *>(termHandler);
+  bgrnd_cmd_handler->assignSigStopHandler(cmdSignalHandler);
+
+  cmdSignalHandler = dynamic_cast<JobSignalHandler *>(emergencyHandler);
+  bgrnd_cmd_handler->assignSigIntHandler(cmdSignalHandler);
+
+  /*
+   * Now it's time to execute the command. Since everything is setup now,
+   * it's overdue to register the process into the worker shared memory
+   * area. This needs to be done in a critical section, to protect us
+   * against concurrent workers doing the same.
+   *
+   * WorkerSHM::allocate() can throw, but since
+   * the real memory allocation is done before we're
+   * probably safe here.
+   */
+  worker_shm->lock();
+  worker_slot_index = worker_shm->allocate(worker_info);
+  worker_shm->unlock();
+
+#ifdef __DEBUG__
+  BOOST_LOG_TRIVIAL(debug) << "WORKER SLOT " << worker_slot_index;
+#endif
+
+  /* Save worker slot index as its worker ID to command handler */
+  bgrnd_cmd_handler->setWorkerID(worker_slot_index);
+
+  try {
+    bgrnd_cmd_handler->execute(info.cmdHandle->getCatalog()->fullname());
+  } catch(exception &e) {
+
+    /*
+     * In any case, detach from the shared memory but clear
+     * our slot before, but only if this is *NOT* a BACKGROUND_WORKER_CHILD.
+     *
+     * Background: BaseCatalogCommand derived classes might fork within
+     * their execute() methods, to employ additional child processes. To
+     * make sure they don't clear the Worker SHM, they set the
+     * background job type flag to BACKGROUND_WORKER_CHILD. It's okay
+     * to just test for that flag, since others are unlikely to occur here.
+     *
+     * WorkerSHM::free() can throw itself if there's no valid shared
+     * memory handle here. But that seems unlikely, since the
+     * actions before should have failed before.
+     */
+    if (_pgbckctl_job_type != BACKGROUND_WORKER_CHILD) {
+      worker_shm->lock();
+      worker_shm->free(worker_slot_index);
+      worker_shm->unlock();
+    }
+
+    /* re-throw */
+    throw WorkerFailure(e.what());
+
+  }
+
+  /* only reached if everything went okay */
+  if (_pgbckctl_job_type != BACKGROUND_WORKER_CHILD) {
+
+    worker_shm->lock();
+    worker_shm->free(worker_slot_index);
+    worker_shm->unlock();
+
+  }
+
+}
+
 /**
  * worker_command() runs from the launcher and
  * forks a new process executing the
@@ -1952,181 +2957,153 @@ pid_t pgbckctl::worker_command(BackgroundWorker &worker, std::string command) {
     /* Worker child */
 
     PGBackupCtlParser parser;
-    std::shared_ptr<PGBackupCtlCommand> bgrnd_cmd_handler;
-    JobSignalHandler *cmdSignalHandler;
-    WorkerSHM *worker_shm;
-    unsigned int worker_slot_index = 0;
-    shm_worker_area worker_info;
 
-    /*
-     * Make sure we have the right background job context.
-     */
-    _pgbckctl_job_type = BACKGROUND_WORKER;
+    worker_setup(worker);
+    worker_execute(worker, parser, command);
 
-    /*
-     * Reset SIGCHLD signal handler. Not required
-     * in a background worker process.
-     */
-    signal(SIGCHLD, SIG_DFL);
+#ifdef __DEBUG__
+    BOOST_LOG_TRIVIAL(debug) << "WORKER EXIT";
+#endif
+
+    /* Exit, if done */
+    exit(0);
+
+  } else if (pid < (pid_t) 0) {
 
     /*
-     * Tell our background worker handle that we
-     * aren't longer a launcher instance.
+     * fork() error, this is severe, so report
+     * that by throwing a worker exception. This
+     * affects the launcher process directly!
      */
-    worker.release_launcher_role();
+    std::ostringstream oss;
 
-    BOOST_LOG_TRIVIAL(info) << "background job executing command " << command;
+    oss << "could not fork new worker: " << strerror(errno);
+    throw WorkerFailure(oss.str());
 
-    worker_info.pid = ::getpid();
-    worker_info.started = CPGBackupCtlBase::ISO8601_strTo_ptime(CPGBackupCtlBase::current_timestamp());
+  } else {
 
     /*
-     * Parse command.
+     * Launcher process, here's actually
+     * nothing to do.
      */
-    parser.parseLine(command);
 
-    /*
-     * Parser has instantiated a command handler
-     * iff success.
-     */
-    bgrnd_cmd_handler = parser.getCommand();
+  }
 
-    /*
-     * Remember parsed command tag.
-     */
-    worker_info.cmdType = bgrnd_cmd_handler->getCommandTag();
+  return pid;
+}
 
-    /*
-     * If the PGBackupCtlCommand handler encapsulates a
-     * command attached to an archive, we record the archive id
-     * in the shared memory, too.
-     */
-    if (bgrnd_cmd_handler->archive_name().length() > 0) {
+/**
+ * pool_worker() runs from the launcher and forks a new
+ * pool worker, which executes jobs dispatched to the worker pool
+ * one after another until it's told to shut down.
+ *
+ * Everything a forked worker needs is set up once: the background
+ * job context, the worker shared memory area, the job queue and the
+ * command parser. Errors of a job are logged and the worker continues
+ * with the next one. If the worker can't continue, it exits and is
+ * replaced by the launcher.
+ */
+pid_t pgbckctl::pool_worker(BackgroundWorker &worker, std::string catalog_name) {
 
-      /*
-       * catalog access can throw here, don't suppress errors
-       * at this point but remap that to a WorkerFailure exception.
-       */
-      try {
+  job_info info = worker.jobInfo();
+  pid_t pid;
 
-        std::shared_ptr<CatalogDescr> temp_descr
-          = info.cmdHandle->getCatalog()->existsByName(bgrnd_cmd_handler->archive_name());
+  if (info.cmdHandle == nullptr)
+    return (pid_t) -1;
 
-        if (temp_descr->id >= 0) {
-          worker_info.archive_id = temp_descr->id;
-        }
+  if ((pid = fork()) == (pid_t) 0) {
 
-      } catch(CPGBackupCtlFailure &e) {
+    /* Pool worker child */
 
-        throw WorkerFailure(e.what());
+    PGBackupCtlParser parser;
+    WorkerPool pool(catalog_name, 0);
+    std::string command;
 
-      }
-    }
+    try {
 
-    /*
-     * Set signal handlers.
-     */
-    cmdSignalHandler = dynamic_cast<JobSignalHandler *>(termHandler);
-    bgrnd_cmd_handler->assignSigStopHandler(cmdSignalHandler);
+      worker_setup(worker);
+      pool.attach();
+      pool.report(POOL_WORKER_IDLE);
 
-    cmdSignalHandler = dynamic_cast<JobSignalHandler *>(emergencyHandler);
-    bgrnd_cmd_handler->assignSigIntHandler(cmdSignalHandler);
+    } catch (std::exception &e) {
+
+      BOOST_LOG_TRIVIAL(fatal) << "could not initialize pool worker: " << e.what();
+      exit(DAEMON_FAILURE);
 
-    /*
-     * Now it's time to execute the command. Since everything is setup now,
-     * it's overdue to register the forked process into the
-     * worker shared memory area. This needs to be done in a critical
-     * section, to protect us against concurrent workers doing the same.
-     */
-    worker_shm = worker.workerSHM();
-    if (!worker_shm->attach(info.cmdHandle->getCatalog()->fullname(), true)) {
-      /* could not attach to shared memory segment */
-      throw WorkerFailure("could not attach to worker shared memory area");
     }
 
-    /*
-     * WorkerSHM::allocate() can throw, but since
-     * the real memory allocation is done before we're
-     * probably safe here.
-     */
-    worker_shm->lock();
-    worker_slot_index = worker_shm->allocate(worker_info);
-    worker_shm->unlock();
+    BOOST_LOG_TRIVIAL(debug) << "pool worker ready at PID " << ::getpid();
 
-#ifdef __DEBUG__
-    BOOST_LOG_TRIVIAL(debug) << "WORKER SLOT " << worker_slot_index;
-#endif
+    while (_pgbckctl_shutdown_mode != DAEMON_TERM_NORMAL
+           && _pgbckctl_shutdown_mode != DAEMON_TERM_EMERGENCY) {
 
-    /* Save worker slot index as its worker ID to command handler */
-    bgrnd_cmd_handler->setWorkerID(worker_slot_index);
+      try {
 
-    try {
-      bgrnd_cmd_handler->execute(info.cmdHandle->getCatalog()->fullname());
-    } catch(exception &e) {
+        if (!pool.take(command, LAUNCHER_IDLE_TIMEOUT_MS))
+          continue;
+
+        pool.report(POOL_WORKER_BUSY);
+
+      } catch (std::exception &e) {
+
+        BOOST_LOG_TRIVIAL(fatal) << "pool worker lost its job queue: " << e.what();
+        exit(DAEMON_FAILURE);
 
-      /*
-       * In any case, detach from the shared memory but clear
-       * our slot before, but only if this is *NOT* a BACKGROUND_WORKER_CHILD.
-       *
-       * Background: BaseCatalogCommand derived classes might fork within
-       * their execute() methods, to employ additional child processes. To
-       * make sure they don't clear the Worker SHM, they set the
-       * background job type flag to BACKGROUND_WORKER_CHILD. It's okay
-       * to just test for that flag, since others are unlikely to occur here.
-       *
-       * WorkerSHM::free() can throw itself if there's no valid shared
-       * memory handle here. But that seems unlikely, since the
-       * actions before should have failed before.
-       */
-      if (_pgbckctl_job_type != BACKGROUND_WORKER_CHILD) {
-        worker_shm->lock();
-        worker_shm->free(worker_slot_index);
-        worker_shm->unlock();
       }
 
-      /* re-throw */
-      throw WorkerFailure(e.what());
+      try {
 
-    }
+        worker_execute(worker, parser, command);
 
-    /* only reached if everything went okay */
-    if (_pgbckctl_job_type != BACKGROUND_WORKER_CHILD) {
+      } catch (std::exception &e) {
 
-      worker_shm->lock();
-      worker_shm->free(worker_slot_index);
-      worker_shm->unlock();
+        BOOST_LOG_TRIVIAL(error) << "pool worker job \"" << command
+                                 << "\" failed: " << e.what();
+
+      }
+
+      /*
+       * Child processes forked by a command return here,
+       * they must not continue as pool workers.
+       */
+      if (_pgbckctl_job_type == BACKGROUND_WORKER_CHILD)
+        exit(0);
+
+      /*
+       * A command stopped by a signal leaves the shutdown
+       * mode behind, we're done then, too.
+       */
+      if (_pgbckctl_shutdown_mode != DAEMON_RUN
+          && _pgbckctl_shutdown_mode != DAEMON_STATUS_UPDATE)
+        break;
+
+      try {
+        pool.report(POOL_WORKER_IDLE);
+      } catch (std::exception &e) {
+        exit(DAEMON_FAILURE);
+      }
 
     }
 
-#ifdef __DEBUG__
-    BOOST_LOG_TRIVIAL(debug) << "WORKER EXIT";
-#endif
+    try {
+      pool.report(POOL_WORKER_EXIT);
+    } catch (std::exception &e) {
+      /* launcher is gone already */
+    }
 
-    /* Exit, if done */
     exit(0);
 
   } else if (pid < (pid_t) 0) {
 
-    /*
-     * fork() error, this is severe, so report
-     * that by throwing a worker exception. This
-     * affects the launcher process directly!
-     */
     std::ostringstream oss;
 
-    oss << "could not fork new worker: " << strerror(errno);
+    oss << "could not fork new pool worker: " << strerror(errno);
     throw WorkerFailure(oss.str());
 
-  } else {
-
-    /*
-     * Launcher process, here's actually
-     * nothing to do.
-     */
-
   }
 
   return pid;
+
 }
 
 /**
@@ -0,0 +1,791 @@
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+extern "C" {
+#include <unistd.h>
+}
+
+#include <common.hxx>
+#include <descr.hxx>
+#include <shm.hxx>
+#include <scheduler.hxx>
+#include <metrics.hxx>
+
+using namespace pgbckctl;
+
+const unsigned int MetricsServer::REFRESH_INTERVAL;
+
+/**
+ * pg_backup_ctl++ launcher metrics endpoint implementation.
+ */
+namespace pgbckctl {
+
+  namespace ba = boost::asio;
+  namespace ip = boost::asio::ip;
+
+  /* Max size of a request header */
+#define METRICS_MAX_REQUEST_SIZE 8192
+
+  /* Max number of seconds a client may take to send its request */
+#define METRICS_REQUEST_TIMEOUT 5
+
+  class LauncherMetricsEndpoint;
+
+  /*
+   * A single HTTP request. We answer one request per connection
+   * and close it afterwards.
+   */
+  class LauncherMetricsSession : public std::enable_shared_from_this<LauncherMetricsSession> {
+  private:
+
+    LauncherMetricsEndpoint *endpoint = nullptr;
+    ba::streambuf request;
+    ba::deadline_timer timer;
+    std::string response = "";
+
+    void close();
+    void handle_request(const boost::system::error_code &ec);
+
+  public:
+
+    ip::tcp::socket soc;
+
+    LauncherMetricsSession(ba::io_service &ios, LauncherMetricsEndpoint *endpoint)
+      : endpoint(endpoint),
+        request(METRICS_MAX_REQUEST_SIZE),
+        timer(ios),
+        soc(ios) {}
+
+    void start();
+
+  };
+
+  /*
+   * Implementation of MetricsServer.
+   */
+  class LauncherMetricsEndpoint {
+  private:
+
+    std::string address = "";
+    unsigned int port = 0;
+    WorkerSHM *worker_shm = nullptr;
+
+    /*
+     * Internal boost::asio handles. Kept as pointers, since
+     * a forked launcher worker must not release them, see
+     * closeAfterFork().
+     */
+    ba::io_service *ios     = nullptr;
+    ip::tcp::acceptor *acpt = nullptr;
+    std::thread *runner     = nullptr;
+
+    /* true in a process forked from the launcher */
+    bool forked = false;
+
+    /*
+     * Rendered archive statistics, protected by
+     * catalog_mtx.
+     */
+    std::mutex catalog_mtx;
+    std::string catalog_metrics = "";
+
+    void accept();
+
+  public:
+
+    LauncherMetricsEndpoint(std::string address, unsigned int port, WorkerSHM *worker_shm);
+    virtual ~LauncherMetricsEndpoint();
+
+    void start();
+    void stop();
+    void closeAfterFork();
+
+    void setCatalogStats(std::vector<std::shared_ptr<StatCatalogArchive>> &list,
+                         std::time_t now);
+
+    std::string render();
+
+    /*
+     * Builds the complete HTTP response to the specified
+     * request line.
+     */
+    std::string respond(std::string method, std::string target);
+
+    /*
+     * Formatting helpers.
+     */
+    static std::string escape(std::string value);
+    static std::string seconds(uint64_t us);
+    static void family(std::ostringstream &out,
+                       std::string name,
+                       std::string type,
+                       std::string help);
+
+  };
+
+}
+
+/******************************************************************************
+ * Implementation of LauncherMetricsSession
+ ******************************************************************************/
+
+void LauncherMetricsSession::start() {
+
+  std::shared_ptr<LauncherMetricsSession> self = shared_from_this();
+
+  this->timer.expires_from_now(boost::posix_time::seconds(METRICS_REQUEST_TIMEOUT));
+  this->timer.async_wait([self](const boost::system::error_code &ec) {
+
+      /* Cancelled timers are fine, the request was answered */
+      if (!ec)
+        self->close();
+
+    });
+
+  ba::async_read_until(this->soc, this->request, "\r\n\r\n",
+                       [self](const boost::system::error_code &ec, std::size_t) {
+                         self->handle_request(ec);
+                       });
+
+}
+
+void LauncherMetricsSession::close() {
+
+  boost::system::error_code ignored;
+
+  /*
+   * Shut down the connection explicitly, a worker forked in
+   * the meantime still holds a copy of the socket.
+   */
+  this->soc.shutdown(ip::tcp::socket::shutdown_both, ignored);
+  this->soc.close(ignored);
+  this->timer.cancel(ignored);
+
+}
+
+void LauncherMetricsSession::handle_request(const boost::system::error_code &ec) {
+
+  std::shared_ptr<LauncherMetricsSession> self = shared_from_this();
+  std::istream is(&this->request);
+  std::string method = "";
+  std::string target = "";
+
+  /*
+   * Also catches requests exceeding METRICS_MAX_REQUEST_SIZE
+   * and timed out requests.
+   */
+  if (ec) {
+    this->close();
+    return;
+  }
+
+  is >> method >> target;
+
+  try {
+    this->response = this->endpoint->respond(method, target);
+  } catch (std::exception &e) {
+    this->response = "HTTP/1.1 500 Internal Server Error\r\n"
+      "Content-Length: 0\r\nConnection: close\r\n\r\n";
+  }
+
+  ba::async_write(this->soc, ba::buffer(this->response),
+                  [self](const boost::system::error_code &, std::size_t) {
+                    self->close();
+                  });
+
+}
+
+/******************************************************************************
+ * Implementation of LauncherMetricsEndpoint
+ ******************************************************************************/
+
+LauncherMetricsEndpoint::LauncherMetricsEndpoint(std::string address,
+                                                 unsigned int port,
+                                                 WorkerSHM *worker_shm) {
+
+  this->address = address;
+  this->port = port;
+  this->worker_shm = worker_shm;
+
+}
+
+LauncherMetricsEndpoint::~LauncherMetricsEndpoint() {
+
+  /*
+   * The request thread doesn't exist in a forked process, and
+   * releasing the asio handles would deregister the sockets of
+   * the launcher from the reactor it shares with us.
+   */
+  if (this->forked)
+    return;
+
+  this->stop();
+
+  if (this->acpt != nullptr)
+    delete this->acpt;
+
+  if (this->ios != nullptr)
+    delete this->ios;
+
+}
+
+void LauncherMetricsEndpoint::start() {
+
+  boost::system::error_code ec;
+  ip::address listen_on;
+
+  if (this->runner != nullptr)
+    throw MetricsServerFailure("metrics server already started");
+
+  listen_on = ip::address::from_string(this->address, ec);
+
+  if (ec)
+    throw MetricsServerFailure("invalid metrics listen address \"" + this->address + "\"");
+
+  if (this->ios == nullptr)
+    this->ios = new ba::io_service();
+
+  if (this->acpt == nullptr)
+    this->acpt = new ip::tcp::acceptor(*(this->ios));
+
+  ip::tcp::endpoint ep(listen_on, this->port);
+
+  this->acpt->open(ep.protocol(), ec);
+
+  if (!ec)
+    this->acpt->set_option(ip::tcp::acceptor::reuse_address(true), ec);
+
+  if (!ec)
+    this->acpt->bind(ep, ec);
+
+  if (!ec)
+    this->acpt->listen(ba::socket_base::max_connections, ec);
+
+  if (ec) {
+
+    std::ostringstream oss;
+    boost::system::error_code ignored;
+
+    oss << "could not listen on " << this->address << ":" << this->port
+        << ": " << ec.message();
+    this->acpt->close(ignored);
+    throw MetricsServerFailure(oss.str());
+
+  }
+
+  this->accept();
+
+  this->runner = new std::thread([this]() {
+
+      try {
+        this->ios->run();
+      } catch (std::exception &e) {
+        /* nothing we can do, the endpoint stops answering */
+      }
+
+    });
+
+}
+
+void LauncherMetricsEndpoint::accept() {
+
+  std::shared_ptr<LauncherMetricsSession> session
+    = std::make_shared<LauncherMetricsSession>(*(this->ios), this);
+
+  this->acpt->async_accept(session->soc,
+                           [this, session](const boost::system::error_code &ec) {
+
+                             if (ec == ba::error::operation_aborted
+                                 || !this->acpt->is_open())
+                               return;
+
+                             if (!ec)
+                               session->start();
+
+                             this->accept();
+
+                           });
+
+}
+
+void LauncherMetricsEndpoint::stop() {
+
+  boost::system::error_code ignored;
+
+  if (this->forked)
+    return;
+
+  if (this->ios != nullptr)
+    this->ios->stop();
+
+  if (this->runner != nullptr) {
+
+    if (this->runner->joinable())
+      this->runner->join();
+
+    delete this->runner;
+    this->runner = nullptr;
+
+  }
+
+  if (this->acpt != nullptr)
+    this->acpt->close(ignored);
+
+}
+
+void LauncherMetricsEndpoint::closeAfterFork() {
+
+  this->forked = true;
+
+  /*
+   * Close the inherited descriptor only, see the destructor. The
+   * launcher keeps listening on its own copy.
+   */
+  if (this->acpt != nullptr && this->acpt->is_open())
+    ::close(this->acpt->native_handle());
+
+}
+
+void LauncherMetricsEndpoint::setCatalogStats(std::vector<std::shared_ptr<StatCatalogArchive>> &list,
+                                              std::time_t now) {
+
+  std::ostringstream out;
+
+  family(out, "pgbckctl_archive_backups", "gauge",
+         "Number of basebackups in the catalog.");
+  for (auto &stat : list)
+    out << "pgbckctl_archive_backups{archive=\"" << escape(stat->archive_name) << "\"} "
+        << stat->number_of_backups << "\n";
+
+  family(out, "pgbckctl_archive_backups_failed", "gauge",
+         "Number of aborted basebackups in the catalog.");
+  for (auto &stat : list)
+    out << "pgbckctl_archive_backups_failed{archive=\"" << escape(stat->archive_name) << "\"} "
+        << stat->backups_failed << "\n";
+
+  family(out, "pgbckctl_archive_backups_running", "gauge",
+         "Number of basebackups in progress according to the catalog.");
+  for (auto &stat : list)
+    out << "pgbckctl_archive_backups_running{archive=\"" << escape(stat->archive_name) << "\"} "
+        << stat->backups_running << "\n";
+
+  family(out, "pgbckctl_archive_backup_bytes", "gauge",
+         "Size of all basebackups of the archive on disk.");
+  for (auto &stat : list)
+    out << "pgbckctl_archive_backup_bytes{archive=\"" << escape(stat->archive_name) << "\"} "
+        << stat->backup_bytes << "\n";
+
+  family(out, "pgbckctl_archive_wal_bytes", "gauge",
+         "Size of all WAL segments of the archive on disk.");
+  for (auto &stat : list)
+    out << "pgbckctl_archive_wal_bytes{archive=\"" << escape(stat->archive_name) << "\"} "
+        << stat->wal_bytes << "\n";
+
+  family(out, "pgbckctl_archive_wal_segments", "gauge",
+         "Number of WAL segments in the archive.");
+  for (auto &stat : list)
+    out << "pgbckctl_archive_wal_segments{archive=\"" << escape(stat->archive_name) << "\"} "
+        << stat->wal_segments << "\n";
+
+  family(out, "pgbckctl_archive_last_backup_timestamp_seconds", "gauge",
+         "Time the newest basebackup of the archive finished.");
+  for (auto &stat : list) {
+
+    std::time_t finished = JobScheduler::strToTime(stat->latest_finished);
+
+    if (finished < 0)
+      continue;
+
+    out << "pgbckctl_archive_last_backup_timestamp_seconds{archive=\""
+        << escape(stat->archive_name) << "\"} " << finished << "\n";
+
+  }
+
+  family(out, "pgbckctl_catalog_refresh_timestamp_seconds", "gauge",
+         "Time the archive statistics were read from the catalog.");
+  out << "pgbckctl_catalog_refresh_timestamp_seconds " << now << "\n";
+
+  std::lock_guard<std::mutex> lock(this->catalog_mtx);
+
+  this->catalog_metrics = out.str();
+
+}
+
+std::string LauncherMetricsEndpoint::escape(std::string value) {
+
+  std::string result;
+
+  for (auto c : value) {
+
+    switch (c) {
+    case '\\':
+      result += "\\\\";
+      break;
+    case '"':
+      result += "\\\"";
+      break;
+    case '\n':
+      result += "\\n";
+      break;
+    default:
+      result += c;
+    }
+
+  }
+
+  return result;
+
+}
+
+std::string LauncherMetricsEndpoint::seconds(uint64_t us) {
+
+  std::ostringstream oss;
+  std::string result;
+
+  oss << us / 1000000 << "." << std::setw(6) << std::setfill('0') << us % 1000000;
+  result = oss.str();
+
+  /* strip insignificant zeros, but keep a decimal */
+  while (result.back() == '0' && result[result.length() - 2] != '.')
+    result.pop_back();
+
+  return result;
+
+}
+
+void LauncherMetricsEndpoint::family(std::ostringstream &out,
+                                     std::string name,
+                                     std::string type,
+                                     std::string help) {
+
+  out << "# TYPE " << name << " " << type << "\n"
+      << "# HELP " << name << " " << help << "\n";
+
+}
+
+std::string LauncherMetricsEndpoint::render() {
+
+  std::ostringstream out;
+  std::vector<shm_worker_area> workers;
+  std::vector<shm_stream_stats> streams;
+  std::vector<shm_basebackup_progress> backups;
+  std::map<std::string, unsigned int> per_command;
+  unsigned int max_workers = 0;
+
+  /*
+   * Take lock-free copies of all used worker slots first, every
+   * metric family must be contiguous in the exposition.
+   */
+  if (this->worker_shm != nullptr) {
+
+    max_workers = this->worker_shm->getMaxWorkers();
+
+    for (unsigned int i = 0; i < max_workers; i++) {
+
+      shm_worker_area area;
+      shm_stream_stats stats;
+      shm_basebackup_progress progress;
+
+      if (this->worker_shm->isEmpty(i))
+        continue;
+
+      area = this->worker_shm->read(i);
+
+      if (area.pid <= 0)
+        continue;
+
+      workers.push_back(area);
+      per_command[CatalogDescr::commandTagName(area.cmdType)]++;
+
+      stats = this->worker_shm->readStreamStats(i);
+
+      if (stats.pid != 0)
+        streams.push_back(stats);
+
+      progress = this->worker_shm->readBasebackupProgress(i);
+
+      if (progress.pid != 0)
+        backups.push_back(progress);
+
+    }
+
+  }
+
+  /*
+   * Workers
+   */
+  family(out, "pgbckctl_worker_slots", "gauge",
+         "Number of worker slots of the launcher.");
+  out << "pgbckctl_worker_slots " << max_workers << "\n";
+
+  family(out, "pgbckctl_workers", "gauge",
+         "Number of workers by command.");
+  for (auto &count : per_command)
+    out << "pgbckctl_workers{command=\"" << escape(count.first) << "\"} "
+        << count.second << "\n";
+
+  family(out, "pgbckctl_worker", "info",
+         "Workers registered with the launcher.");
+  for (auto &area : workers)
+    out << "pgbckctl_worker_info{pid=\"" << area.pid
+        << "\",command=\"" << escape(CatalogDescr::commandTagName(area.cmdType))
+        << "\",archive_id=\"" << area.archive_id << "\"} 1\n";
+
+  family(out, "pgbckctl_worker_start_time_seconds", "gauge",
+         "Time the worker was started.");
+  for (auto &area : workers) {
+
+    struct tm tm;
+
+    if (area.started.is_special())
+      continue;
+
+    /* started is local time, see CPGBackupCtlBase::current_timestamp() */
+    tm = boost::posix_time::to_tm(area.started);
+    tm.tm_isdst = -1;
+
+    out << "pgbckctl_worker_start_time_seconds{pid=\"" << area.pid
+        << "\",archive_id=\"" << area.archive_id << "\"} " << mktime(&tm) << "\n";
+
+  }
+
+  /*
+   * WAL streams
+   */
+  family(out, "pgbckctl_wal_received_bytes", "counter",
+         "Bytes of WAL received from upstream.");
+  for (auto &stats : streams)
+    out << "pgbckctl_wal_received_bytes_total{archive=\"" << escape(stats.archive_name) << "\"} "
+        << stats.bytes_received << "\n";
+
+  family(out, "pgbckctl_wal_written_bytes", "counter",
+         "Bytes of WAL written into the archive.");
+  for (auto &stats : streams)
+    out << "pgbckctl_wal_written_bytes_total{archive=\"" << escape(stats.archive_name) << "\"} "
+        << stats.bytes_written << "\n";
+
+  family(out, "pgbckctl_wal_segments_synced", "counter",
+         "WAL segments completed and synced to disk.");
+  for (auto &stats : streams)
+    out << "pgbckctl_wal_segments_synced_total{archive=\"" << escape(stats.archive_name) << "\"} "
+        << stats.segments_synced << "\n";
+
+  family(out, "pgbckctl_wal_sync_seconds", "histogram",
+         "Latency of WAL syncs.");
+  for (auto &stats : streams) {
+
+    std::string archive = escape(stats.archive_name);
+    uint64_t cumulative = 0;
+
+    /*
+     * The last bucket of the stream statistics has no upper
+     * bound, so it is counted by +Inf only.
+     */
+    for (unsigned int i = 0; i < WAL_SYNC_LATENCY_BUCKETS - 1; i++) {
+
+      cumulative += stats.sync_latency[i];
+      out << "pgbckctl_wal_sync_seconds_bucket{archive=\"" << archive
+          << "\",le=\"" << seconds((uint64_t) (1 << i) * 1000) << "\"} "
+          << cumulative << "\n";
+
+    }
+
+    cumulative += stats.sync_latency[WAL_SYNC_LATENCY_BUCKETS - 1];
+
+    out << "pgbckctl_wal_sync_seconds_bucket{archive=\"" << archive
+        << "\",le=\"+Inf\"} " << cumulative << "\n"
+        << "pgbckctl_wal_sync_seconds_count{archive=\"" << archive << "\"} "
+        << cumulative << "\n"
+        << "pgbckctl_wal_sync_seconds_sum{archive=\"" << archive << "\"} "
+        << seconds(stats.sync_time_us) << "\n";
+
+  }
+
+  family(out, "pgbckctl_wal_position_bytes", "gauge",
+         "XLOG positions of the stream, as reported to upstream, and of upstream.");
+  for (auto &stats : streams) {
+
+    std::string archive = escape(stats.archive_name);
+
+    out << "pgbckctl_wal_position_bytes{archive=\"" << archive << "\",position=\"write\"} "
+        << stats.write_position << "\n"
+        << "pgbckctl_wal_position_bytes{archive=\"" << archive << "\",position=\"flush\"} "
+        << stats.flush_position << "\n"
+        << "pgbckctl_wal_position_bytes{archive=\"" << archive << "\",position=\"apply\"} "
+        << stats.apply_position << "\n"
+        << "pgbckctl_wal_position_bytes{archive=\"" << archive << "\",position=\"server\"} "
+        << stats.server_position << "\n";
+
+  }
+
+  family(out, "pgbckctl_wal_flush_lag_bytes", "gauge",
+         "Bytes of WAL upstream is ahead of the flushed position.");
+  for (auto &stats : streams)
+    out << "pgbckctl_wal_flush_lag_bytes{archive=\"" << escape(stats.archive_name) << "\"} "
+        << ((stats.server_position > stats.flush_position)
+            ? stats.server_position - stats.flush_position : 0) << "\n";
+
+  family(out, "pgbckctl_wal_timeline", "gauge",
+         "Timeline of the stream.");
+  for (auto &stats : streams)
+    out << "pgbckctl_wal_timeline{archive=\"" << escape(stats.archive_name) << "\"} "
+        << stats.timeline << "\n";
+
+  family(out, "pgbckctl_wal_last_update_timestamp_seconds", "gauge",
+         "Time the stream statistics were updated last.");
+  for (auto &stats : streams)
+    out << "pgbckctl_wal_last_update_timestamp_seconds{archive=\"" << escape(stats.archive_name) << "\"} "
+        << stats.last_update << "\n";
+
+  /*
+   * Basebackups
+   */
+  family(out, "pgbckctl_basebackup_start_time_seconds", "gauge",
+         "Time the running basebackup was started.");
+  for (auto &progress : backups)
+    out << "pgbckctl_basebackup_start_time_seconds{archive=\"" << escape(progress.archive_name)
+        << "\",backup_id=\"" << progress.backup_id << "\"} " << progress.started << "\n";
+
+  family(out, "pgbckctl_basebackup_estimated_bytes", "gauge",
+         "Size of the running basebackup estimated by the server.");
+  for (auto &progress : backups)
+    out << "pgbckctl_basebackup_estimated_bytes{archive=\"" << escape(progress.archive_name)
+        << "\",backup_id=\"" << progress.backup_id << "\"} " << progress.estimated_bytes << "\n";
+
+  family(out, "pgbckctl_basebackup_server_bytes", "gauge",
+         "Bytes of the running basebackup the server reported as done.");
+  for (auto &progress : backups)
+    out << "pgbckctl_basebackup_server_bytes{archive=\"" << escape(progress.archive_name)
+        << "\",backup_id=\"" << progress.backup_id << "\"} " << progress.server_bytes << "\n";
+
+  family(out, "pgbckctl_basebackup_written_bytes", "gauge",
+         "Bytes of the running basebackup written into the archive.");
+  for (auto &progress : backups)
+    out << "pgbckctl_basebackup_written_bytes{archive=\"" << escape(progress.archive_name)
+        << "\",backup_id=\"" << progress.backup_id << "\"} " << progress.written_bytes << "\n";
+
+  family(out, "pgbckctl_basebackup_tablespaces", "gauge",
+         "Number of tablespaces of the running basebackup.");
+  for (auto &progress : backups)
+    out << "pgbckctl_basebackup_tablespaces{archive=\"" << escape(progress.archive_name)
+        << "\",backup_id=\"" << progress.backup_id << "\"} " << progress.tablespaces_total << "\n";
+
+  family(out, "pgbckctl_basebackup_tablespaces_streamed", "gauge",
+         "Number of tablespaces of the running basebackup streamed completely.");
+  for (auto &progress : backups)
+    out << "pgbckctl_basebackup_tablespaces_streamed{archive=\"" << escape(progress.archive_name)
+        << "\",backup_id=\"" << progress.backup_id << "\"} " << progress.tablespaces_streamed << "\n";
+
+  family(out, "pgbckctl_basebackup_last_update_timestamp_seconds", "gauge",
+         "Time the basebackup progress was updated last.");
+  for (auto &progress : backups)
+    out << "pgbckctl_basebackup_last_update_timestamp_seconds{archive=\"" << escape(progress.archive_name)
+        << "\",backup_id=\"" << progress.backup_id << "\"} " << progress.last_update << "\n";
+
+  /*
+   * Archives, rendered by setCatalogStats() already
+   */
+  {
+    std::lock_guard<std::mutex> lock(this->catalog_mtx);
+    out << this->catalog_metrics;
+  }
+
+  out << "# EOF\n";
+
+  return out.str();
+
+}
+
+std::string LauncherMetricsEndpoint::respond(std::string method, std::string target) {
+
+  std::ostringstream response;
+  std::string body = "";
+  std::string::size_type query = target.find('?');
+
+  if (query != std::string::npos)
+    target = target.substr(0, query);
+
+  if (method != "GET" && method != "HEAD") {
+
+    response << "HTTP/1.1 405 Method Not Allowed\r\n"
+             << "Allow: GET, HEAD\r\n"
+             << "Content-Length: 0\r\n"
+             << "Connection: close\r\n\r\n";
+    return response.str();
+
+  }
+
+  if (target != "/metrics" && target != "/") {
+
+    response << "HTTP/1.1 404 Not Found\r\n"
+             << "Content-Length: 0\r\n"
+             << "Connection: close\r\n\r\n";
+    return response.str();
+
+  }
+
+  body = this->render();
+
+  response << "HTTP/1.1 200 OK\r\n"
+           << "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+           << "Content-Length: " << body.length() << "\r\n"
+           << "Connection: close\r\n\r\n";
+
+  if (method == "GET")
+    response << body;
+
+  return response.str();
+
+}
+
+/******************************************************************************
+ * Implementation of MetricsServer
+ ******************************************************************************/
+
+MetricsServer::MetricsServer(std::string address, unsigned int port, WorkerSHM *worker_shm) {
+
+  this->instance = std::make_shared<LauncherMetricsEndpoint>(address, port, worker_shm);
+
+}
+
+MetricsServer::~MetricsServer() {}
+
+void MetricsServer::start() {
+
+  this->instance->start();
+
+}
+
+void MetricsServer::stop() {
+
+  this->instance->stop();
+
+}
+
+void MetricsServer::setCatalogStats(std::vector<std::shared_ptr<StatCatalogArchive>> &list,
+                                    std::time_t now) {
+
+  this->instance->setCatalogStats(list, now);
+
+}
+
+void MetricsServer::closeAfterFork() {
+
+  this->instance->closeAfterFork();
+
+}
+
+std::string MetricsServer::render() {
+
+  return this->instance->render();
+
+}
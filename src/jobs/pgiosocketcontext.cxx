@@ -13,8 +13,14 @@ using namespace pgbckctl::pgprotocol;
 
 #define SOCKET_P(ptr) (*((ptr)->soc))
 
-/* c'tor and d'tor without anything to do atm */
-PGSocketIOContextInterface::PGSocketIOContextInterface() {}
+PGSocketIOContextInterface::PGSocketIOContextInterface() {
+
+  write_buffer.setPool(buffer_pool);
+  read_header_buffer.setPool(buffer_pool);
+  read_body_buffer.setPool(buffer_pool);
+
+}
+
 PGSocketIOContextInterface::~PGSocketIOContextInterface() {}
 
 PGSocketIOContextInterface::PGSocketIOContextInterface(boost::asio::ip::tcp::socket *soc)
@@ -26,6 +32,10 @@ PGSocketIOContextInterface::PGSocketIOContextInterface(boost::asio::ip::tcp::soc
 
   this->soc = soc;
 
+  write_buffer.setPool(buffer_pool);
+  read_header_buffer.setPool(buffer_pool);
+  read_body_buffer.setPool(buffer_pool);
+
 }
 
 boost::asio::ip::tcp::socket *PGSocketIOContextInterface::socket() {
@@ -34,16 +44,59 @@ boost::asio::ip::tcp::socket *PGSocketIOContextInterface::socket() {
 
 }
 
+std::shared_ptr<void> PGSocketIOContextInterface::io_owner() {
+
+  return nullptr;
+
+}
+
+void PGSocketIOContextInterface::io_failure(std::exception &e) {
+
+  throw;
+
+}
+
+template<typename Handler>
+void PGSocketIOContextInterface::async_read_buffer(ProtocolBuffer &buffer,
+                                                   Handler handler) {
+
+  std::shared_ptr<void> owner = this->io_owner();
+  auto callback = [this, owner, handler](const boost::system::error_code &ec,
+                                         std::size_t len) {
+
+    try {
+      handler(ec, len);
+    } catch (std::exception &e) {
+      this->io_failure(e);
+    }
+
+  };
+
+  if (this->strand != nullptr) {
+
+    boost::asio::async_read(SOCKET_P(this), boost::asio::buffer(buffer.ptr(),
+                                                                buffer.getSize()),
+                            boost::asio::transfer_exactly(buffer.getSize()),
+                            this->strand->wrap(callback));
+
+  } else {
+
+    boost::asio::async_read(SOCKET_P(this), boost::asio::buffer(buffer.ptr(),
+                                                                buffer.getSize()),
+                            boost::asio::transfer_exactly(buffer.getSize()),
+                            callback);
+
+  }
+
+}
+
 void PGSocketIOContextInterface::start_read_msg() {
 
   BOOST_LOG_TRIVIAL(debug) << "PG PROTO start_read_msg with " << read_body_buffer.getSize() << " bytes";
 
-  boost::asio::async_read(SOCKET_P(this), boost::asio::buffer(this->read_body_buffer.ptr(),
-                                                              this->read_body_buffer.getSize()),
-                          boost::asio::transfer_exactly(read_body_buffer.getSize()),
-                          boost::bind(&PGSocketIOContextInterface::pgproto_msg_in,
-                                      this, _1, _2));
-
+  async_read_buffer(this->read_body_buffer,
+                    boost::bind(&PGSocketIOContextInterface::pgproto_msg_in,
+                                this, _1, _2));
 
 }
 
@@ -51,11 +104,9 @@ void PGSocketIOContextInterface::initial_read() {
 
   BOOST_LOG_TRIVIAL(debug) << "PG PROTO initial_read with " << read_header_buffer.getSize() << " bytes";
 
-  boost::asio::async_read(SOCKET_P(this), boost::asio::buffer(this->read_header_buffer.ptr(),
-                                                              this->read_header_buffer.getSize()),
-                          boost::asio::transfer_exactly(read_header_buffer.getSize()),
-                          boost::bind(&PGSocketIOContextInterface::startup_msg_in,
-                                      this, _1, _2));
+  async_read_buffer(this->read_header_buffer,
+                    boost::bind(&PGSocketIOContextInterface::startup_msg_in,
+                                this, _1, _2));
 
 }
 
@@ -63,11 +114,9 @@ void PGSocketIOContextInterface::initial_read_body() {
 
   BOOST_LOG_TRIVIAL(debug) << "PG PROTO initial_read with " << read_body_buffer.getSize() << " bytes";
 
-  boost::asio::async_read(SOCKET_P(this), boost::asio::buffer(this->read_body_buffer.ptr(),
-                                                              this->read_body_buffer.getSize()),
-                          boost::asio::transfer_exactly(read_body_buffer.getSize()),
-                          boost::bind(&PGSocketIOContextInterface::startup_msg_body,
-                                      this, _1, _2));
+  async_read_buffer(this->read_body_buffer,
+                    boost::bind(&PGSocketIOContextInterface::startup_msg_body,
+                                this, _1, _2));
 
 }
 
@@ -76,22 +125,42 @@ void PGSocketIOContextInterface::start_read_header() {
 
   BOOST_LOG_TRIVIAL(debug) << "PG PROTO start_read_header with " << read_header_buffer.getSize() << " bytes";
 
-  boost::asio::async_read(SOCKET_P(this), boost::asio::buffer(this->read_header_buffer.ptr(),
-                                                              this->read_header_buffer.getSize()),
-                          boost::asio::transfer_exactly(read_header_buffer.getSize()),
-                          boost::bind(&PGSocketIOContextInterface::pgproto_header_in,
-                                      this, _1, _2));
+  async_read_buffer(this->read_header_buffer,
+                    boost::bind(&PGSocketIOContextInterface::pgproto_header_in,
+                                this, _1, _2));
 
 }
 
 void PGSocketIOContextInterface::start_write() {
 
+  std::shared_ptr<void> owner = this->io_owner();
+  auto callback = [this, owner](const boost::system::error_code &ec,
+                                std::size_t len) {
+
+    try {
+      this->pgproto_msg_out(ec);
+    } catch (std::exception &e) {
+      this->io_failure(e);
+    }
+
+  };
+
   BOOST_LOG_TRIVIAL(debug) << "PG PROTO start_write with " << this->write_buffer.getSize() << " bytes";
 
-  boost::asio::async_write(SOCKET_P(this), boost::asio::buffer(this->write_buffer.ptr(),
-                                                               this->write_buffer.getSize()),
-                           boost::asio::transfer_exactly(write_buffer.getSize()),
-                           boost::bind(&PGSocketIOContextInterface::pgproto_msg_out,
-                                       this, _1));
+  if (this->strand != nullptr) {
+
+    boost::asio::async_write(SOCKET_P(this), boost::asio::buffer(this->write_buffer.ptr(),
+                                                                 this->write_buffer.getSize()),
+                             boost::asio::transfer_exactly(write_buffer.getSize()),
+                             this->strand->wrap(callback));
+
+  } else {
+
+    boost::asio::async_write(SOCKET_P(this), boost::asio::buffer(this->write_buffer.ptr(),
+                                                                 this->write_buffer.getSize()),
+                             boost::asio::transfer_exactly(write_buffer.getSize()),
+                             callback);
+
+  }
 
 }
@@ -0,0 +1,434 @@
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <boost/log/trivial.hpp>
+
+#include <common.hxx>
+#include <BackupCatalog.hxx>
+#include <shm.hxx>
+#include <scheduler.hxx>
+
+using namespace pgbckctl;
+
+const unsigned int JobScheduler::REFRESH_INTERVAL;
+const unsigned int JobScheduler::DISPATCH_GRACE;
+
+JobScheduler::JobScheduler(std::shared_ptr<BackupCatalog> catalog,
+                           WorkerSHM *worker_shm,
+                           job_scheduler_limits limits) {
+
+  if (catalog == nullptr)
+    throw CPGBackupCtlFailure("job scheduler requires a catalog");
+
+  this->catalog = catalog;
+  this->worker_shm = worker_shm;
+  this->limits = limits;
+
+}
+
+JobScheduler::~JobScheduler() {}
+
+std::string JobScheduler::timeToStr(std::time_t t) {
+
+  char buf[32];
+  struct tm tm;
+
+  memset(buf, 0, sizeof(buf));
+  localtime_r(&t, &tm);
+
+  if (strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm) == 0)
+    return "";
+
+  return std::string(buf);
+
+}
+
+std::time_t JobScheduler::strToTime(std::string ts) {
+
+  struct tm tm;
+
+  if (ts.length() == 0)
+    return (std::time_t) -1;
+
+  memset(&tm, 0, sizeof(tm));
+
+  if (strptime(ts.c_str(), "%Y-%m-%d %H:%M:%S", &tm) == NULL)
+    return (std::time_t) -1;
+
+  /* let mktime() figure out daylight saving time */
+  tm.tm_isdst = -1;
+
+  return mktime(&tm);
+
+}
+
+std::time_t JobScheduler::nextRun(std::time_t previous,
+                                  std::time_t now,
+                                  unsigned int interval) {
+
+  std::time_t next;
+
+  if (interval == 0)
+    return now;
+
+  next = previous + interval;
+
+  /*
+   * Runs missed, e.g. because the launcher wasn't running, aren't
+   * made up for, but the schedule keeps its time of day.
+   */
+  if (next <= now)
+    next += ((now - next) / interval + 1) * interval;
+
+  return next;
+
+}
+
+unsigned int JobScheduler::jitterDelay(std::shared_ptr<ScheduleDescr> schedule,
+                                       std::time_t next_run) {
+
+  uint64_t x;
+
+  if (schedule->jitter == 0)
+    return 0;
+
+  /* splitmix64 finalizer */
+  x = ((uint64_t) schedule->id * 0x9E3779B97F4A7C15ULL) ^ (uint64_t) next_run;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  x = x ^ (x >> 31);
+
+  return (unsigned int) (x % ((uint64_t) schedule->jitter + 1));
+
+}
+
+unsigned int JobScheduler::getNumberOfSchedules() {
+
+  return this->jobs.size();
+
+}
+
+void JobScheduler::updateEarliestDue() {
+
+  this->earliest_due = 0;
+
+  for (auto &job : this->jobs) {
+
+    std::time_t due = job.next_run + jitterDelay(job.descr, job.next_run);
+
+    if (this->earliest_due == 0 || due < this->earliest_due)
+      this->earliest_due = due;
+
+  }
+
+}
+
+void JobScheduler::refresh(std::time_t now, bool force) {
+
+  std::vector<std::shared_ptr<ScheduleDescr>> schedules;
+  std::vector<scheduled_job> refreshed;
+
+  if (!force && this->last_refresh > 0
+      && now < this->last_refresh + (std::time_t) REFRESH_INTERVAL)
+    return;
+
+  this->last_refresh = now;
+
+  try {
+
+    this->catalog->getSchedules(schedules);
+
+  } catch (std::exception &e) {
+
+    /* keep the schedules we know, retried with the next refresh */
+    BOOST_LOG_TRIVIAL(error) << "could not read schedules: " << e.what();
+    return;
+
+  }
+
+  for (auto &descr : schedules) {
+
+    scheduled_job job;
+
+    job.descr = descr;
+    job.deferred = false;
+    job.next_run = strToTime(descr->next_run);
+
+    for (auto &known : this->jobs) {
+      if (known.descr->id == descr->id)
+        job.deferred = known.deferred;
+    }
+
+    if (job.next_run < 0) {
+
+      /*
+       * Spread the first runs of new schedules over their
+       * interval, based on their archive.
+       */
+      uint64_t spread = ((uint64_t) descr->archive_id * 2 + descr->type) * 2654435761ULL;
+
+      job.next_run = now + (std::time_t) (spread % descr->interval);
+      descr->next_run = timeToStr(job.next_run);
+
+      try {
+        this->catalog->updateScheduleRun(descr->id, descr->next_run, "");
+      } catch (std::exception &e) {
+        BOOST_LOG_TRIVIAL(error) << "could not record next run of schedule "
+                                 << descr->id << ": " << e.what();
+      }
+
+    }
+
+    refreshed.push_back(job);
+
+  }
+
+  this->jobs.swap(refreshed);
+  this->updateEarliestDue();
+
+}
+
+bool JobScheduler::running(ScheduleJobType type,
+                           int archive_id,
+                           unsigned int &count) {
+
+  CatalogTag tag = (type == SCHEDULE_BASEBACKUP) ? START_BASEBACKUP : VERIFY_BASEBACKUP;
+  bool archive_running = false;
+
+  count = 0;
+
+  if (this->worker_shm != nullptr) {
+
+    /*
+     * Worker slots are read without locking, see
+     * WorkerSHM::read().
+     */
+    for (unsigned int i = 0; i < this->worker_shm->getMaxWorkers(); i++) {
+
+      shm_worker_area area;
+
+      if (this->worker_shm->isEmpty(i))
+        continue;
+
+      area = this->worker_shm->read(i);
+
+      if (area.pid <= 0 || area.cmdType != tag)
+        continue;
+
+      count++;
+
+      if (area.archive_id == archive_id)
+        archive_running = true;
+
+      /* A job we started showed up, don't count it twice */
+      this->dispatched.erase(std::remove_if(this->dispatched.begin(),
+                                            this->dispatched.end(),
+                                            [&area, type](dispatched_job &job) {
+                                              return (job.type == type
+                                                      && job.archive_id == area.archive_id);
+                                            }),
+                             this->dispatched.end());
+
+    }
+
+  }
+
+  for (auto &job : this->dispatched) {
+
+    if (job.type != type)
+      continue;
+
+    count++;
+
+    if (job.archive_id == archive_id)
+      archive_running = true;
+
+  }
+
+  return archive_running;
+
+}
+
+bool JobScheduler::walStreamLagging() {
+
+  if (this->worker_shm == nullptr || this->limits.max_wal_lag == 0)
+    return false;
+
+  for (unsigned int i = 0; i < this->worker_shm->getMaxWorkers(); i++) {
+
+    shm_stream_stats stats;
+
+    if (this->worker_shm->isEmpty(i))
+      continue;
+
+    stats = this->worker_shm->readStreamStats(i);
+
+    if (stats.pid == 0)
+      continue;
+
+    if (stats.server_position > stats.flush_position
+        && stats.server_position - stats.flush_position > this->limits.max_wal_lag)
+      return true;
+
+  }
+
+  return false;
+
+}
+
+void JobScheduler::reschedule(scheduled_job &job, std::time_t now, bool started) {
+
+  job.next_run = nextRun(job.next_run, now, job.descr->interval);
+  job.deferred = false;
+  job.descr->next_run = timeToStr(job.next_run);
+
+  if (started)
+    job.descr->last_run = timeToStr(now);
+
+  try {
+
+    this->catalog->updateScheduleRun(job.descr->id,
+                                     job.descr->next_run,
+                                     (started) ? job.descr->last_run : "");
+
+  } catch (std::exception &e) {
+
+    /*
+     * Not fatal, we know the next run. A launcher
+     * started later might run the job once more, though.
+     */
+    BOOST_LOG_TRIVIAL(error) << "could not record next run of schedule "
+                             << job.descr->id << ": " << e.what();
+
+  }
+
+  this->updateEarliestDue();
+
+}
+
+bool JobScheduler::next(std::time_t now, std::string &command) {
+
+  std::vector<scheduled_job *> due;
+  bool stagger_wait;
+  bool lagging;
+
+  this->refresh(now);
+
+  if (this->jobs.empty() || now < this->earliest_due)
+    return false;
+
+  /*
+   * Forget about started jobs which should have
+   * shown up in the worker shared memory by now. Either
+   * they did already or they failed early.
+   */
+  this->dispatched.erase(std::remove_if(this->dispatched.begin(),
+                                        this->dispatched.end(),
+                                        [now](dispatched_job &job) {
+                                          return (job.started + (std::time_t) DISPATCH_GRACE <= now);
+                                        }),
+                         this->dispatched.end());
+
+  for (auto &job : this->jobs) {
+    if (job.next_run + (std::time_t) jitterDelay(job.descr, job.next_run) <= now)
+      due.push_back(&job);
+  }
+
+  std::stable_sort(due.begin(), due.end(),
+                   [](scheduled_job *a, scheduled_job *b) {
+                     if (a->descr->priority != b->descr->priority)
+                       return (a->descr->priority > b->descr->priority);
+                     return (a->next_run < b->next_run);
+                   });
+
+  stagger_wait = (this->limits.stagger > 0 && this->last_start > 0
+                  && now < this->last_start + (std::time_t) this->limits.stagger);
+  lagging = (!due.empty() && this->walStreamLagging());
+
+  for (auto job : due) {
+
+    unsigned int count = 0;
+    unsigned int limit = (job->descr->type == SCHEDULE_BASEBACKUP)
+      ? this->limits.max_basebackups : this->limits.max_verifies;
+    std::string type_name = ScheduleDescr::typeName(job->descr->type);
+    std::ostringstream cmd;
+
+    if (this->running(job->descr->type, job->descr->archive_id, count)) {
+
+      BOOST_LOG_TRIVIAL(info) << "scheduled " << type_name << " of archive \""
+                              << job->descr->archive_name
+                              << "\" skipped, still running since the last run";
+      this->reschedule(*job, now, false);
+      continue;
+
+    }
+
+    if (stagger_wait || lagging || (limit > 0 && count >= limit)) {
+
+      if (!job->deferred) {
+
+        BOOST_LOG_TRIVIAL(info) << "scheduled " << type_name << " of archive \""
+                                << job->descr->archive_name << "\" deferred: "
+                                << (lagging ? "WAL streaming lags behind"
+                                    : (stagger_wait ? "another job started recently"
+                                       : "too many jobs running"));
+        job->deferred = true;
+
+      }
+
+      continue;
+
+    }
+
+    if (job->descr->type == SCHEDULE_BASEBACKUP) {
+
+      cmd << "START BASEBACKUP FOR ARCHIVE " << job->descr->archive_name;
+
+      if (job->descr->profile_name.length() > 0)
+        cmd << " PROFILE " << job->descr->profile_name;
+
+    } else {
+
+      std::shared_ptr<BaseBackupDescr> newest = nullptr;
+
+      try {
+        newest = this->catalog->getBaseBackup(BASEBACKUP_NEWEST,
+                                              job->descr->archive_id,
+                                              true);
+      } catch (std::exception &e) {
+        BOOST_LOG_TRIVIAL(error) << "could not look up basebackup to verify: " << e.what();
+      }
+
+      if (newest == nullptr || newest->id < 0) {
+
+        BOOST_LOG_TRIVIAL(info) << "scheduled verify of archive \""
+                                << job->descr->archive_name
+                                << "\" skipped, no basebackup to verify";
+        this->reschedule(*job, now, false);
+        continue;
+
+      }
+
+      cmd << "VERIFY ARCHIVE " << job->descr->archive_name
+          << " BASEBACKUP " << newest->id;
+
+    }
+
+    dispatched_job started;
+
+    started.archive_id = job->descr->archive_id;
+    started.type = job->descr->type;
+    started.started = now;
+
+    this->dispatched.push_back(started);
+    this->last_start = now;
+    this->reschedule(*job, now, true);
+
+    command = cmd.str();
+    return true;
+
+  }
+
+  return false;
+
+}
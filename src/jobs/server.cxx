@@ -1,4 +1,5 @@
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/signal_set.hpp>
 #include <boost/asio/read.hpp>
@@ -8,11 +9,19 @@
 #include <boost/bind.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
 #include <boost/log/trivial.hpp>
+#include <cerrno>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 
 extern "C" {
 #include <sys/types.h>
+#include <sys/sendfile.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <iostream>
@@ -26,6 +35,7 @@ extern "C" {
 #include <proto-buffer.hxx>
 #include <pgproto-parser.hxx>
 #include <pgproto-commands.hxx>
+#include <walcache.hxx>
 #include <shm.hxx>
 #include <server.hxx>
 #include <pgiosocketcontext.hxx>
@@ -52,24 +62,23 @@ namespace pgbckctl {
   namespace ba = boost::asio;
   namespace ip = boost::asio::ip;
 
+  class PGProtoStreamingSession;
+
   /*
    * Base class for streaming server implementation.
+   *
+   * The server accepts connections and hands each of them over to a
+   * session, created by new_session(). Depending on the connection_threads
+   * setting of the recovery stream descriptor, sessions are either served
+   * by a pool of threads sharing the io_service of the server, each
+   * session serialized by a strand of its own, or by a process forked
+   * for each connection. The latter isolates connections from each other
+   * at the cost of a fork() for each of them.
    */
-  class PGBackupCtlStreamingServer : public pgprotocol::PGSocketIOContextInterface {
+  class PGBackupCtlStreamingServer {
   private:
   protected:
 
-    /**
-     * Runtime configuration private to this server
-     * instance.
-     */
-    std::shared_ptr<RuntimeVariableEnvironment> server_env = std::make_shared<RuntimeVariableEnvironment>();
-
-    /**
-     * The worker child ID we are registered at.
-     */
-    int child_id = -1;
-
     /*
      * The parent worker ID we are belonging to.
      */
@@ -95,6 +104,19 @@ namespace pgbckctl {
      */
     std::shared_ptr<RecoveryStreamDescr> streamDescr = nullptr;
 
+    /**
+     * Threads running the io_service, empty if connections
+     * are served by forked processes.
+     */
+    std::vector<std::thread> threads;
+
+    /**
+     * Sessions currently served by threads, protected
+     * by sessions_lock.
+     */
+    std::set<std::shared_ptr<PGProtoStreamingSession>> sessions;
+    std::mutex sessions_lock;
+
     void start_signal_wait() {
 
       sset->async_wait(boost::bind(&PGBackupCtlStreamingServer::handle_signal_wait,
@@ -136,151 +158,169 @@ namespace pgbckctl {
 
     }
 
-    void start_accept() {
-      this->acpt->async_accept(SOCKET_P(this),
-                               boost::bind(&PGBackupCtlStreamingServer::handle_accept,
-                                           this,
-                                           _1));
-    }
-
-    void handle_accept(const boost::system::error_code& ec) {
-      if (!ec)
-        {
-          /*
-           * Inform the io_service that we are about to fork. The io_service cleans
-           * up any internal resources, such as threads, that may interfere with
-           * forking.
-           */
-          ios->notify_fork(boost::asio::io_service::fork_prepare);
+    /**
+     * Creates the session for the next accepted connection.
+     */
+    virtual std::shared_ptr<PGProtoStreamingSession> new_session() = 0;
 
-          if (fork() == 0)
-            {
-              /*
-               * This is a worker subchild, tell global worker state about
-               * this to prevent cleanup if important worker resources on exit.
-               */
-              _pgbckctl_job_type = BACKGROUND_WORKER_CHILD;
-              ios->notify_fork(boost::asio::io_service::fork_child);
+    void start_accept();
 
-              /*
-               * Inform the io_service that the fork is finished and that this is the
-               * child process. The io_service uses this opportunity to create any
-               * internal file descriptors that must be private to the new process.
-               * this->ios->notify_fork(boost::asio::io_service::fork_child);
-               */
+    void handle_accept(std::shared_ptr<PGProtoStreamingSession> session,
+                       const boost::system::error_code& ec);
 
-              /*
-               * The child won't be accepting new connections, so we can close the
-               * acceptor. It remains open in the parent.
-               */
-              acpt->close();
+    /**
+     * Runs the io_service from a thread of the pool.
+     */
+    void run_thread();
 
-              /* The child process is not interested in processing the SIGCHLD signal. */
-              sset->cancel();
+  public:
 
-              /*
-               * Everything in shape, attach to parent shared memory slot
-               * and save its childs information there.
-               */
-              worker_shm->attach(streamDescr->catalog_name, false);
+    PGBackupCtlStreamingServer() {}
 
-              try {
+    /*
+     * C'tor
+     */
+    PGBackupCtlStreamingServer(std::shared_ptr<RecoveryStreamDescr> streamDescr);
 
-                {
-                  shm_worker_area worker_info;
-                  sub_worker_info child_info;
+    /*
+     * D'tor
+     */
+    virtual ~PGBackupCtlStreamingServer();
 
-                  child_info.pid = ::getpid();
+    /*
+     * Run the io service.
+     */
+    virtual void run();
 
-                  /* we use a scoped lock */
-                  boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex>(*(worker_shm->check_and_get_mutex()));
+    /**
+     * Returns true if sessions are served by threads.
+     */
+    bool threaded();
 
-                  worker_shm->write(streamDescr->worker_id, child_id, child_info);
+    /**
+     * Forgets about a session served by a thread. Called
+     * by the session when its connection is closed.
+     */
+    void release(std::shared_ptr<PGProtoStreamingSession> session);
 
-                }
+    ba::io_service &getIOService();
+    std::shared_ptr<WorkerSHM> getWorkerSHM();
+    std::shared_ptr<RecoveryStreamDescr> getStreamDescr();
 
-                /*
-                 * Save child id within runtime configuration, so it can easily
-                 * referenced by subsequent command handlers.
-                 */
-                server_env->getRuntimeConfiguration()->create("recovery_instance.child_id",
-                                                              child_id,
-                                                              child_id);
+  };
 
-                BOOST_LOG_TRIVIAL(debug) << "registered worker id="
-                                         << worker_id << ", child_id="
-                                         << child_id;
+  class PGProtoStreamingServer : public PGBackupCtlStreamingServer {
+  private:
 
-                /*
-                 * Setup connection.
-                 */
-                initial_read();
+    /**
+     * Catalog access shared by all sessions of this server.
+     */
+    std::shared_ptr<PGProtoArchiveCache> archive_cache = nullptr;
 
-              } catch(TCPServerFailure &failure) {
+    /**
+     * Cache of decompressed WAL shared by all sessions, nullptr
+     * if disabled.
+     */
+    std::shared_ptr<WALSegmentCache> wal_cache = nullptr;
 
-                BOOST_LOG_TRIVIAL(fatal) << failure.what();
-                soc->close();
-                ios->stop();
+  protected:
 
-              }
+    virtual std::shared_ptr<PGProtoStreamingSession> new_session();
 
-              catch (SHMFailure &failure) {
+  public:
 
-                BOOST_LOG_TRIVIAL(fatal) << failure.what();
-                soc->close();
-                ios->stop();
+    PGProtoStreamingServer(std::shared_ptr<RecoveryStreamDescr> streamDescr);
+    virtual ~PGProtoStreamingServer();
 
-              }
+    std::shared_ptr<PGProtoArchiveCache> getArchiveCache();
+    std::shared_ptr<WALSegmentCache> getWALCache();
 
-            }
+    /*
+     * Run the io service.
+     */
+    virtual void run();
 
-          else
+  };
 
-            {
-              /*
-               * Inform the io_service that the fork is finished (or failed) and that
-               * this is the parent process. The io_service uses this opportunity to
-               * recreate any internal resources that were cleaned up during
-               * preparation for the fork.
-               */
-              ios->notify_fork(boost::asio::io_service::fork_parent);
+  /**
+   * A client connection of a PGProtoStreamingServer, implementing
+   * the PostgreSQL streaming protocol.
+   */
+  class PGProtoStreamingSession : public pgprotocol::PGSocketIOContextInterface,
+                                  public std::enable_shared_from_this<PGProtoStreamingSession> {
+  private:
 
-              soc->close();
-              start_accept();
+    /**
+     * The server this session belongs to.
+     */
+    PGProtoStreamingServer *server = nullptr;
 
-            }
+    /**
+     * Runtime configuration private to this session.
+     */
+    std::shared_ptr<RuntimeVariableEnvironment> server_env = std::make_shared<RuntimeVariableEnvironment>();
 
-        }
-      else
-        {
-          BOOST_LOG_TRIVIAL(fatal) << "Accept error: " << ec.message();
-          start_accept();
-        }
-    }
+    /**
+     * The worker child ID we are registered at.
+     */
+    int child_id = -1;
 
-  public:
+    /*
+     * The parent worker ID we are belonging to.
+     */
+    int worker_id = -1;
 
-    PGBackupCtlStreamingServer() {}
+    /**
+     * Shared memory segment for background workers, shared
+     * with the server.
+     */
+    std::shared_ptr<WorkerSHM> worker_shm = nullptr;
 
     /*
-     * C'tor
+     * Recovery handle.
      */
-    PGBackupCtlStreamingServer(std::shared_ptr<RecoveryStreamDescr> streamDescr);
+    std::shared_ptr<RecoveryStreamDescr> streamDescr = nullptr;
 
-    /*
-     * D'tor
+    /**
+     * Set by close().
      */
-    virtual ~PGBackupCtlStreamingServer();
+    bool closed = false;
 
-    /*
-     * Run the io service.
+    /**
+     * The query currently executed, its commands not executed
+     * yet and the command whose result set is currently written,
+     * see query_next().
      */
-    virtual void run();
+    std::string query_string = "";
+    pgprotocol::PGProtoCommandExecutionQueue query_queue;
+    std::shared_ptr<pgprotocol::PGProtoStreamingCommand> query_command = nullptr;
 
-  };
+    /**
+     * Small messages of the query collected to be written
+     * at once, and the chunk of data rows written behind them.
+     */
+    std::string query_out = "";
+    ProtocolBuffer query_buffer;
+
+    /**
+     * Command currently streaming through the COPY
+     * subprotocol, see stream_start().
+     */
+    std::shared_ptr<pgprotocol::PGProtoCopyStreamingCommand> copy_command = nullptr;
+
+    /**
+     * Messages of the stream are written from this buffer, one at
+     * a time, since WAL or archive data might fill up the socket buffer.
+     */
+    ProtocolBuffer stream_buffer;
+
+    /**
+     * Timer to retry a stream waiting for WAL, stream_waiting
+     * is set while it is armed.
+     */
+    ba::deadline_timer *stream_timer = nullptr;
+    bool stream_waiting = false;
 
-  class PGProtoStreamingServer : public PGBackupCtlStreamingServer {
-  private:
 
     /**
      * The internal query descriptor initialized
@@ -388,6 +428,70 @@ namespace pgbckctl {
      */
     void _send_command_complete(pgprotocol::PGProtoCmdTag tag,
                                 unsigned int rowcount);
+    void _send_command_complete(std::string tag);
+
+    /**
+     * Wraps a callback of the stream like the callbacks of
+     * PGSocketIOContextInterface.
+     */
+    std::function<void(const boost::system::error_code&, std::size_t)>
+    stream_callback(std::function<void(const boost::system::error_code&)> fn);
+
+    /**
+     * Enters the COPY subprotocol of the specified
+     * command and starts streaming.
+     */
+    void stream_start(std::shared_ptr<pgprotocol::PGProtoStreamingCommand> cmd);
+
+    /**
+     * Writes the next message of the stream. Each message is
+     * written after the previous one was sent completely.
+     */
+    void stream_next();
+
+    /**
+     * Sends a region of a file with sendfile(),
+     * continues the stream afterwards.
+     */
+    void stream_sendfile(int fd, off_t offset, size_t len);
+
+    /**
+     * Retries a stream waiting for WAL immediately, called after
+     * a message from the client arrived.
+     */
+    void stream_wakeup();
+
+    /**
+     * Executes the remaining commands of the current query and
+     * writes their results, see PGProtoStreamingCommand::step(). Sends
+     * ReadyForQuery once all commands are done.
+     */
+    void query_next();
+
+    /**
+     * Writes the messages collected in query_out, followed by the
+     * chunk of data rows in query_buffer if with_chunk is set. Continues
+     * with query_next() unless the query is done.
+     */
+    void query_write(bool with_chunk, bool done);
+
+    /**
+     * Aborts the current query with an error response
+     * and ReadyForQuery.
+     */
+    void query_error(std::string error_string, std::string detail = "");
+
+    /**
+     * Writes the messages in out after the stream
+     * was ended.
+     */
+    void stream_end(std::string out);
+
+    /**
+     * Ends the stream with the CommandComplete of the command and
+     * ReadyForQuery, or with an error response if error_string is set.
+     */
+    void stream_finish(std::string error_string = "");
 
     /**
      * Sends a AuthenticationOK response.
@@ -471,15 +575,33 @@ namespace pgbckctl {
 
     virtual void set_sqlstate(std::string state);
 
+    /**
+     * Keeps the session alive while callbacks are pending.
+     */
+    virtual std::shared_ptr<void> io_owner();
+
+    /**
+     * A session served by a thread logs errors of its callbacks and
+     * closes its connection, instead of passing them to the io_service.
+     */
+    virtual void io_failure(std::exception &e);
+
   public:
 
-    PGProtoStreamingServer(std::shared_ptr<RecoveryStreamDescr> streamDescr);
-    virtual ~PGProtoStreamingServer();
+    PGProtoStreamingSession(PGProtoStreamingServer *server);
+    virtual ~PGProtoStreamingSession();
 
-    /*
-     * Run the io service.
+    /**
+     * Registers the session in the worker shared memory
+     * and starts reading the startup message of the client.
      */
-    virtual void run();
+    virtual void start();
+
+    /**
+     * Closes the connection. A session served by a forked
+     * process exits.
+     */
+    virtual void close();
 
   };
 
@@ -537,25 +659,12 @@ PGBackupCtlStreamingServer::PGBackupCtlStreamingServer(std::shared_ptr<RecoveryS
                                                          streamDescr->port));
   }
 
-  /*
-   * Instantiate the socket
-   *
-   * The socket itself is derived from PGIOSocketContextInterface, but
-   * not yet initialized.
-   */
-  this->soc = new ip::tcp::socket(*(this->ios));
-
-  /* Create and assign runtime configuration */
-
-  server_env->assignRuntimeConfiguration(RuntimeVariableEnvironment::createRuntimeConfiguration());
-  BOOST_LOG_TRIVIAL(debug) << "created runtime configuration";
-
 }
 
 PGBackupCtlStreamingServer::~PGBackupCtlStreamingServer() {
 
-  if (this->soc != nullptr)
-    delete this->soc;
+  /* Sessions own sockets of our io_service */
+  sessions.clear();
 
   if (this->acpt != nullptr)
     delete this->acpt;
@@ -571,6 +680,158 @@ PGBackupCtlStreamingServer::~PGBackupCtlStreamingServer() {
 
 }
 
+bool PGBackupCtlStreamingServer::threaded() {
+
+  return (streamDescr->connection_threads > 0);
+
+}
+
+ba::io_service &PGBackupCtlStreamingServer::getIOService() {
+
+  return *(this->ios);
+
+}
+
+std::shared_ptr<WorkerSHM> PGBackupCtlStreamingServer::getWorkerSHM() {
+
+  return worker_shm;
+
+}
+
+std::shared_ptr<RecoveryStreamDescr> PGBackupCtlStreamingServer::getStreamDescr() {
+
+  return streamDescr;
+
+}
+
+void PGBackupCtlStreamingServer::release(std::shared_ptr<PGProtoStreamingSession> session) {
+
+  std::lock_guard<std::mutex> guard(sessions_lock);
+
+  sessions.erase(session);
+
+}
+
+void PGBackupCtlStreamingServer::start_accept() {
+
+  std::shared_ptr<PGProtoStreamingSession> session = new_session();
+
+  this->acpt->async_accept(*(session->socket()),
+                           boost::bind(&PGBackupCtlStreamingServer::handle_accept,
+                                       this,
+                                       session,
+                                       _1));
+
+}
+
+void PGBackupCtlStreamingServer::handle_accept(std::shared_ptr<PGProtoStreamingSession> session,
+                                               const boost::system::error_code& ec) {
+
+  if (ec) {
+
+    BOOST_LOG_TRIVIAL(fatal) << "Accept error: " << ec.message();
+
+    /* The acceptor is closed on shutdown */
+    if (acpt->is_open())
+      start_accept();
+
+    return;
+
+  }
+
+  if (threaded()) {
+
+    {
+      std::lock_guard<std::mutex> guard(sessions_lock);
+      sessions.insert(session);
+    }
+
+    /* Accept the next connection before serving this one */
+    start_accept();
+    session->start();
+
+    return;
+
+  }
+
+  /*
+   * Inform the io_service that we are about to fork. The io_service cleans
+   * up any internal resources, such as threads, that may interfere with
+   * forking.
+   */
+  ios->notify_fork(boost::asio::io_service::fork_prepare);
+
+  if (fork() == 0)
+    {
+      /*
+       * This is a worker subchild, tell global worker state about
+       * this to prevent cleanup if important worker resources on exit.
+       */
+      _pgbckctl_job_type = BACKGROUND_WORKER_CHILD;
+
+      /*
+       * Inform the io_service that the fork is finished and that this is the
+       * child process. The io_service uses this opportunity to create any
+       * internal file descriptors that must be private to the new process.
+       */
+      ios->notify_fork(boost::asio::io_service::fork_child);
+
+      /*
+       * The child won't be accepting new connections, so we can close the
+       * acceptor. It remains open in the parent.
+       */
+      acpt->close();
+
+      /* The child process is not interested in processing the SIGCHLD signal. */
+      sset->cancel();
+
+      /*
+       * Everything in shape, attach to parent shared memory slot
+       * and save its childs information there.
+       */
+      worker_shm->attach(streamDescr->catalog_name, false);
+
+      session->start();
+
+    }
+
+  else
+
+    {
+      /*
+       * Inform the io_service that the fork is finished (or failed) and that
+       * this is the parent process. The io_service uses this opportunity to
+       * recreate any internal resources that were cleaned up during
+       * preparation for the fork.
+       */
+      ios->notify_fork(boost::asio::io_service::fork_parent);
+
+      session->socket()->close();
+      start_accept();
+
+    }
+
+}
+
+void PGBackupCtlStreamingServer::run_thread() {
+
+  for (;;) {
+
+    try {
+
+      this->ios->run();
+      break;
+
+    } catch (std::exception &e) {
+
+      /* Sessions handle their own errors, keep serving the others */
+      BOOST_LOG_TRIVIAL(fatal) << "streaming server thread: " << e.what();
+
+    }
+
+  }
+
+}
 
 void PGBackupCtlStreamingServer::run() {
 
@@ -579,33 +840,73 @@ void PGBackupCtlStreamingServer::run() {
   start_signal_wait();
   start_accept();
 
-  this->ios->run();
+  if (!threaded()) {
+
+    this->ios->run();
+    return;
+
+  }
+
+  BOOST_LOG_TRIVIAL(debug) << "serving connections with "
+                           << streamDescr->connection_threads << " threads";
+
+  for (unsigned int i = 0; i < streamDescr->connection_threads; i++) {
+    threads.push_back(std::thread(&PGBackupCtlStreamingServer::run_thread, this));
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  threads.clear();
+
+  /*
+   * The io_service was stopped, release the child slots
+   * of the sessions still connected.
+   */
+  {
+    std::set<std::shared_ptr<PGProtoStreamingSession>> remaining;
+
+    {
+      std::lock_guard<std::mutex> guard(sessions_lock);
+      remaining = sessions;
+    }
+
+    for (auto &session : remaining) {
+      session->close();
+    }
+  }
 
 }
 
 /* ****************************************************************************
  * Implementation PGProtoStreamingServer
- * (Implements PostgreSQL Streaming protocol)
  * ****************************************************************************/
 
-#define INITIAL_STARTUP_BUFFER_SIZE 8
-
 PGProtoStreamingServer::PGProtoStreamingServer(std::shared_ptr<RecoveryStreamDescr> streamDescr)
-  : PGBackupCtlStreamingServer(streamDescr) {
+  : PGBackupCtlStreamingServer(streamDescr) {}
 
-  /*
-   * Initialize command handler
-   */
-  cmd = std::make_shared<pgprotocol::PGProtoCmdDescr>();
+PGProtoStreamingServer::~PGProtoStreamingServer() {}
+
+std::shared_ptr<PGProtoArchiveCache> PGProtoStreamingServer::getArchiveCache() {
+
+  return archive_cache;
 
 }
 
-PGProtoStreamingServer::~PGProtoStreamingServer() {}
+std::shared_ptr<WALSegmentCache> PGProtoStreamingServer::getWALCache() {
 
-void PGProtoStreamingServer::run() {
+  return wal_cache;
+
+}
 
-  std::shared_ptr<RuntimeConfiguration> runtime_configuration
-    = server_env->getRuntimeConfiguration();
+std::shared_ptr<PGProtoStreamingSession> PGProtoStreamingServer::new_session() {
+
+  return std::make_shared<PGProtoStreamingSession>(this);
+
+}
+
+void PGProtoStreamingServer::run() {
 
   /*
    * Attach to worker shared memory area.
@@ -615,6 +916,68 @@ void PGProtoStreamingServer::run() {
   /* initialization stuff */
   worker_id = streamDescr->worker_id;
 
+  /*
+   * Catalog access for all sessions. Sessions served by threads
+   * share its catalog handle and cached archive descriptors, forked
+   * sessions inherit a copy of it.
+   */
+  archive_cache = std::make_shared<PGProtoArchiveCache>(streamDescr->catalog_name);
+
+  /*
+   * The WAL cache is a shared mapping, so it must be created
+   * before any session is forked.
+   */
+  if (streamDescr->wal_cache_size > 0) {
+    wal_cache = std::make_shared<WALSegmentCache>((size_t) streamDescr->wal_cache_size * 1024 * 1024);
+  }
+
+  PGBackupCtlStreamingServer::run();
+
+}
+
+/* ****************************************************************************
+ * Implementation PGProtoStreamingSession
+ * (Implements PostgreSQL Streaming protocol)
+ * ****************************************************************************/
+
+#define INITIAL_STARTUP_BUFFER_SIZE 8
+
+/*
+ * Milliseconds a stream waits for WAL
+ * to arrive in the archive.
+ */
+#define STREAM_WAIT_INTERVAL 200
+
+PGProtoStreamingSession::PGProtoStreamingSession(PGProtoStreamingServer *server) {
+
+  std::shared_ptr<RuntimeConfiguration> runtime_configuration = nullptr;
+
+  this->server = server;
+  this->streamDescr = server->getStreamDescr();
+  this->worker_shm = server->getWorkerSHM();
+  this->worker_id = streamDescr->worker_id;
+
+  /*
+   * The socket is owned by the session, the strand serializes
+   * its callbacks in case we are served by more than one thread.
+   */
+  this->soc = new ip::tcp::socket(server->getIOService());
+
+  query_buffer.setPool(buffer_pool);
+  stream_buffer.setPool(buffer_pool);
+
+  if (server->threaded())
+    this->strand = new ba::io_service::strand(server->getIOService());
+
+  /*
+   * Initialize command handler
+   */
+  cmd = std::make_shared<pgprotocol::PGProtoCmdDescr>();
+
+  /* Create and assign runtime configuration */
+  server_env->assignRuntimeConfiguration(RuntimeVariableEnvironment::createRuntimeConfiguration());
+  runtime_configuration = server_env->getRuntimeConfiguration();
+
   /*
    * Create global runtime parameters.
    */
@@ -636,19 +999,152 @@ void PGProtoStreamingServer::run() {
   /*
    * Handler for catalog database access.
    */
-  catalogHandler = make_shared<PGProtoCatalogHandler>(streamDescr->catalog_name);
+  catalogHandler = make_shared<PGProtoCatalogHandler>(server->getArchiveCache());
+  catalogHandler->setWALCache(server->getWALCache());
 
   /* Internal startup buffer */
   this->read_header_buffer.allocate(INITIAL_STARTUP_BUFFER_SIZE);
 
-  start_signal_wait();
-  start_accept();
+}
+
+PGProtoStreamingSession::~PGProtoStreamingSession() {
+
+  if (this->stream_timer != nullptr)
+    delete this->stream_timer;
 
-  this->ios->run();
+  if (this->strand != nullptr)
+    delete this->strand;
+
+  if (this->soc != nullptr)
+    delete this->soc;
 
 }
 
-void PGProtoStreamingServer::_parameter_to_buffer(ProtocolBuffer &dest,
+std::shared_ptr<void> PGProtoStreamingSession::io_owner() {
+
+  return shared_from_this();
+
+}
+
+void PGProtoStreamingSession::io_failure(std::exception &e) {
+
+  /* A forked session dies with its error, as before */
+  if (!server->threaded())
+    throw;
+
+  BOOST_LOG_TRIVIAL(fatal) << e.what();
+  close();
+
+}
+
+void PGProtoStreamingSession::start() {
+
+  try {
+
+    {
+      sub_worker_info child_info;
+
+      child_info.pid = ::getpid();
+
+      /*
+       * No lock required, the child slot is claimed
+       * atomically by write(). Sessions served by threads all
+       * register with the pid of the server.
+       */
+      worker_shm->write(worker_id, child_id, child_info);
+
+    }
+
+    /*
+     * Save child id within runtime configuration, so it can easily
+     * referenced by subsequent command handlers.
+     */
+    server_env->getRuntimeConfiguration()->create("recovery_instance.child_id",
+                                                  child_id,
+                                                  child_id);
+
+    BOOST_LOG_TRIVIAL(debug) << "registered worker id="
+                             << worker_id << ", child_id="
+                             << child_id;
+
+    /*
+     * Setup connection.
+     */
+    initial_read();
+
+  } catch(TCPServerFailure &failure) {
+
+    BOOST_LOG_TRIVIAL(fatal) << failure.what();
+    close();
+
+  }
+
+  catch (SHMFailure &failure) {
+
+    BOOST_LOG_TRIVIAL(fatal) << failure.what();
+    close();
+
+  }
+
+}
+
+void PGProtoStreamingSession::close() {
+
+  boost::system::error_code ec;
+
+  if (closed)
+    return;
+
+  closed = true;
+
+  if (stream_timer != nullptr)
+    stream_timer->cancel(ec);
+
+  copy_command = nullptr;
+
+  if (!server->threaded()) {
+
+    /*
+     * The parent process releases our child slot
+     * when reaping us.
+     */
+    soc->close(ec);
+    server->getIOService().stop();
+
+    std::exit(0);
+
+  }
+
+  if (child_id >= 0) {
+
+    try {
+
+      WORKER_SHM_CRITICAL_SECTION_START_P(worker_shm);
+
+      /* Also releases the basebackup we might be attached to */
+      worker_shm->free_child(worker_id, child_id);
+
+      WORKER_SHM_CRITICAL_SECTION_END;
+
+    } catch (SHMFailure &failure) {
+
+      BOOST_LOG_TRIVIAL(error) << "could not release child slot "
+                               << child_id << ": " << failure.what();
+
+    }
+
+    child_id = -1;
+
+  }
+
+  soc->shutdown(ip::tcp::socket::shutdown_both, ec);
+  soc->close(ec);
+
+  server->release(shared_from_this());
+
+}
+
+void PGProtoStreamingSession::_parameter_to_buffer(ProtocolBuffer &dest,
                                                   std::string key,
                                                   std::string val) {
 
@@ -679,7 +1175,7 @@ void PGProtoStreamingServer::_parameter_to_buffer(ProtocolBuffer &dest,
   /* ... and done */
 }
 
-void PGProtoStreamingServer::_read_startup_gucs() {
+void PGProtoStreamingSession::_read_startup_gucs() {
 
   std::ostringstream sbuf;
   std::string key = "";
@@ -751,7 +1247,7 @@ void PGProtoStreamingServer::_read_startup_gucs() {
 
 }
 
-void PGProtoStreamingServer::_startup_header() {
+void PGProtoStreamingSession::_startup_header() {
 
   int msglen = 0;
   int protocolVersion;
@@ -807,7 +1303,7 @@ void PGProtoStreamingServer::_startup_header() {
 
 }
 
-void PGProtoStreamingServer::_send_AuthenticationOK() {
+void PGProtoStreamingSession::_send_AuthenticationOK() {
 
   pgprotocol::pg_protocol_auth authreq;
 
@@ -824,7 +1320,7 @@ void PGProtoStreamingServer::_send_AuthenticationOK() {
 
 }
 
-void PGProtoStreamingServer::_send_BackendKey() {
+void PGProtoStreamingSession::_send_BackendKey() {
 
   pgprotocol::pg_protocol_backendkey keydata;
 
@@ -857,23 +1353,19 @@ void PGProtoStreamingServer::_send_BackendKey() {
  * which will finally execute the corresponding actions.
  *
  * Since the PostgreSQLStreamingParser can parse and execute multi statement
- * command strings (separated by ';'), we must do the execution within a
- * loop.
- *
- * Please note that an executable command object (a descendant of class
- * PGProtoStreamingCommand) never does I/O itself. Instead, it calls
- * the protocol interface method PGProtoStreamingCommand::step(), which
- * fills the specified ProtocolBuffer and leaves the I/O to the response
- * handler itself. This is in normal cases the StreamingServer instance.
+ * command strings (separated by ';'), the commands are queued and executed
+ * one after another by query_next(), which also answers the query with
+ * ReadyForQuery.
  */
-std::string PGProtoStreamingServer::_process_query_execute(size_t qsize) {
+std::string PGProtoStreamingSession::_process_query_execute(size_t qsize) {
 
   char *qbuf;
-  std::string query_string = "";
-  std::string error_string = "";
 
   BOOST_LOG_TRIVIAL(debug) << "PG PROTO query string length: " << qsize;
 
+  state = PGPROTO_PROCESS_QUERY_IN_PROGRESS;
+  query_string = "";
+
   /**
    * Make sure we allocate an reasonable sized
    * buffer for the input query. If we have a buffer
@@ -881,12 +1373,9 @@ std::string PGProtoStreamingServer::_process_query_execute(size_t qsize) {
    */
   if (qsize > PGPROTO_MAX_QUERY_SIZE) {
 
-    msg(pgprotocol::PG_ERR_ERROR, "could not process invalid query string");
-    msg(pgprotocol::PG_ERR_DETAIL, "query exceeds maximum query length");
-    set_sqlstate("42601");
-    _send_error();
-
-    state = PGPROTO_ERROR_AFTER_QUERY;
+    query_error("could not process invalid query string",
+                "query exceeds maximum query length");
+    return query_string;
 
   }
 
@@ -902,138 +1391,250 @@ std::string PGProtoStreamingServer::_process_query_execute(size_t qsize) {
    * Extract the query length from the buffer and convert it
    * to a std::string. Then call the parser to handle the query.
    */
-  query_string = std::string(qbuf);
+  query_string = std::string(qbuf);
+
+  delete[] qbuf;
+
+  BOOST_LOG_TRIVIAL(debug) << "query " << query_string;
+
+  try {
+
+    /* Parse the query */
+    pgprotocol::PostgreSQLStreamingParser pgparser(server_env->getRuntimeConfiguration());
+
+    /*
+     * The PostgreSQLStreamingParser::parse() method will
+     * materialize a command execution queue with executable
+     * command handlers.
+     */
+    query_queue = pgparser.parse(catalogHandler,
+                                 query_string);
+
+    BOOST_LOG_TRIVIAL(debug) << "parser exited successfully";
+
+    if (query_queue.empty()) {
+
+      query_error("empty command execution queue, nothing to do");
+      return query_string;
+
+    }
+
+  } catch (std::exception &e) {
+
+    query_error(e.what());
+    return query_string;
+
+  }
+
+  /*
+   * We're not bothered with a PGProtoCmdFailure, so
+   * proceed and execute the successfully parsed commands.
+   */
+  query_next();
 
-  delete[] qbuf;
+  return query_string;
+}
 
-  BOOST_LOG_TRIVIAL(debug) << "query " << query_string;
+/*
+ * Executes the commands of a query, one after another.
+ *
+ * Please note that an executable command object (a descendant of class
+ * PGProtoStreamingCommand) never does I/O itself. Instead, it calls
+ * the protocol interface method PGProtoStreamingCommand::step(), which
+ * fills the specified ProtocolBuffer and leaves the I/O to us.
+ *
+ * Small messages, like RowDescription or CommandComplete, are collected
+ * in query_out and written together with the next chunk of data rows,
+ * as one buffer sequence. Thus a result set is never materialized as a
+ * whole in the protocol buffers, and the client gets the first rows of
+ * a large result set while we're still encoding the rest. The next chunk
+ * is encoded once the previous one was written completely.
+ */
+void PGProtoStreamingSession::query_next() {
+
+  if (closed)
+    return;
 
   try {
 
-    /* Parse the query */
-    pgprotocol::PostgreSQLStreamingParser pgparser(server_env->getRuntimeConfiguration());
-    std::shared_ptr<pgprotocol::ProtocolCommandHandler> handler = nullptr;
-    std::shared_ptr<pgprotocol::PGProtoStreamingCommand> cmd = nullptr;
-    pgprotocol::PGProtoCommandExecutionQueue execQueue;
+    while (true) {
 
-    /*
-     * The PostgreSQLStreamingParser::parse() method will
-     * materialize a command execution queue with executable
-     * command handlers.
-     */
-    execQueue = pgparser.parse(catalogHandler,
-                               query_string);
+      int step;
 
-    BOOST_LOG_TRIVIAL(debug) << "parser exited successfully";
+      if (query_command == nullptr) {
 
-    /* We're not bothered with a PGProtoCmdFailure, so
-     * proceed and execute the successfully parsed command.
-     */
-    if (!execQueue.empty()) {
+        std::shared_ptr<pgprotocol::ProtocolCommandHandler> handler = nullptr;
+        std::shared_ptr<pgprotocol::ExecutableContext> exec_context = nullptr;
+        std::shared_ptr<pgprotocol::PGProtoStreamingCommand> next_cmd = nullptr;
 
-      while (!execQueue.empty()) {
+        if (query_queue.empty()) {
 
-        std::shared_ptr<pgprotocol::ExecutableContext> exec_context = nullptr;
+          /* Query processing done, finalize the request */
+          _send_ReadyForQuery();
+          query_out.append(write_buffer.ptr(), write_buffer.getSize());
+
+          query_write(false, true);
 
-        int step;
+          /* Reset stateful query properties */
+          resetQueryState();
+          return;
+
+        }
 
-        handler = execQueue.front();
-        execQueue.pop();
+        handler = query_queue.front();
+        query_queue.pop();
 
         BOOST_LOG_TRIVIAL(debug) << "executing command";
 
-        cmd = handler->getExecutable(worker_shm);
+        next_cmd = handler->getExecutable(worker_shm);
+        next_cmd->setBufferPool(buffer_pool);
 
         /*
          * If authentication procedure has sucessfully passed, we
          * send some NOTICE message indicating special startup settings.
          */
-        if (cmd->needsArchive() && disable_streaming_commands) {
-
-          error_string = "connected to catalog only, streaming API commands disabled";
-          state = PGPROTO_ERROR_AFTER_QUERY;
-          break;
-
+        if (next_cmd->needsArchive() && disable_streaming_commands) {
+          throw pgprotocol::PGProtoCmdFailure("connected to catalog only, streaming API commands disabled");
         }
 
         /*
          * Execute the command handler. We need a suitable executable context
          * for this, so get the right one requested by the command handler.
          */
-        exec_context = pgprotocol::ExecutableContext::create(cmd->getExecutableContextName());
-        cmd->execute(exec_context);
+        exec_context = pgprotocol::ExecutableContext::create(next_cmd->getExecutableContextName());
+        next_cmd->execute(exec_context);
+
+        /*
+         * Commands using the COPY subprotocol are streamed by
+         * stream_start(), which takes over the connection until the
+         * client or the command ends the COPY.
+         */
+        if (next_cmd->getExecutableContextName() == pgprotocol::EXECUTABLE_CONTEXT_COPY) {
+
+          if (!query_queue.empty() || !query_out.empty()) {
+            throw pgprotocol::PGProtoCmdFailure(next_cmd->tag() + " must be the only command of a query");
+          }
 
-        while((step = cmd->step(write_buffer)) != -1) {
+          stream_start(next_cmd);
+          return;
 
-          state = PGPROTO_PROCESS_QUERY_IN_PROGRESS;
+        }
 
-          BOOST_LOG_TRIVIAL(debug) << "PG PROTO sent query message buffer "
-                                   << write_buffer.getSize();
+        query_command = next_cmd;
 
-          start_write();
+      }
 
-          BOOST_LOG_TRIVIAL(debug) << "stepping protocol message "
-                                   << step;
+      step = query_command->step(query_buffer);
 
-        }
+      if (step == -1) {
 
-        /* Query processing done, prepare a command complete message */
+        /* Command done, prepare a command complete message */
         _send_command_complete(pgprotocol::SELECT_CMD, 0);
-        start_write();
+        query_out.append(write_buffer.ptr(), write_buffer.getSize());
+
+        query_command = nullptr;
+        continue;
 
       }
 
-    } else {
+      BOOST_LOG_TRIVIAL(debug) << "stepping protocol message "
+                               << step;
 
-      error_string = "empty command execution queue, nothing to do";
-      state = PGPROTO_ERROR_AFTER_QUERY;
+      /*
+       * Collect small messages, a full chunk
+       * is written as it is.
+       */
+      if (query_buffer.getSize() < pgprotocol::PGProtoResultSet::DATA_CHUNK_SIZE) {
 
-    }
+        query_out.append(query_buffer.ptr(), query_buffer.getSize());
 
-  } catch(pgprotocol::PGProtoCmdFailure &failure) {
+        if (query_out.length() < pgprotocol::PGProtoResultSet::DATA_CHUNK_SIZE)
+          continue;
 
-    /* protocol specific exception handling */
+        query_write(false, false);
 
-    BOOST_LOG_TRIVIAL(fatal) << failure.what();
-    state = PGPROTO_ERROR_AFTER_QUERY;
-    error_string = failure.what();
+      } else {
 
-  } catch(CPGBackupCtlFailure &failure) {
+        query_write(true, false);
 
-    BOOST_LOG_TRIVIAL(fatal) << failure.what();
-    state = PGPROTO_ERROR_AFTER_QUERY;
-    error_string = failure.what();
+      }
 
-  } catch (std::exception &e) {
+      return;
 
-    /* generic exception handling */
+    }
 
-    BOOST_LOG_TRIVIAL(fatal) << e.what();
-    error_string = e.what();
-    state = PGPROTO_ERROR_AFTER_QUERY;
+  } catch (std::exception &e) {
+
+    query_error(e.what());
 
   }
 
+}
+
+void PGProtoStreamingSession::query_write(bool with_chunk, bool done) {
+
+  std::shared_ptr<std::string> out = std::make_shared<std::string>();
+  std::vector<ba::const_buffer> buffers;
+
   /*
-   * If an error condition was met, prepare
-   * the error response and exit.
+   * The messages collected so far are owned by the callback, a new
+   * query might collect new ones before it is called.
    */
-  if (state == PGPROTO_ERROR_AFTER_QUERY) {
+  out->swap(query_out);
 
-    msg(pgprotocol::PG_ERR_ERROR, error_string);
-    msg(pgprotocol::PG_ERR_DETAIL, "query was: " + query_string);
-    set_sqlstate("42601");
-    _send_error();
-    start_write();
+  buffers.push_back(ba::buffer(*out));
 
-    state = PGPROTO_ERROR_AFTER_QUERY;
+  if (with_chunk)
+    buffers.push_back(ba::buffer(query_buffer.ptr(), query_buffer.getSize()));
 
-  }
+  BOOST_LOG_TRIVIAL(debug) << "PG PROTO sent query message buffer "
+                           << ba::buffer_size(buffers);
+
+  ba::async_write(SOCKET_P(this), buffers,
+                  stream_callback([this, out, done](const boost::system::error_code &ec) {
+
+                      if (ec) {
+                        throw TCPServerFailure("error on writing to server socket");
+                      }
+
+                      if (!done)
+                        query_next();
+
+                    }));
+
+}
+
+void PGProtoStreamingSession::query_error(std::string error_string,
+                                          std::string detail) {
+
+  BOOST_LOG_TRIVIAL(fatal) << error_string;
+
+  query_command = nullptr;
+  query_queue = pgprotocol::PGProtoCommandExecutionQueue();
+
+  state = PGPROTO_ERROR_AFTER_QUERY;
+
+  /*
+   * Prepare the error response, behind the messages
+   * of the commands done so far.
+   */
+  msg(pgprotocol::PG_ERR_ERROR, error_string);
+  msg(pgprotocol::PG_ERR_DETAIL, (detail.length() > 0) ? detail : "query was: " + query_string);
+  set_sqlstate("42601");
+  _send_error();
+  query_out.append(write_buffer.ptr(), write_buffer.getSize());
+
+  /* Finalize the request */
+  _send_ReadyForQuery();
+  query_out.append(write_buffer.ptr(), write_buffer.getSize());
+
+  query_write(false, true);
+
+  resetQueryState();
 
-  return query_string;
 }
 
-int PGProtoStreamingServer::_process_query_start(int hdr_len) {
+int PGProtoStreamingSession::_process_query_start(int hdr_len) {
 
   /*
    * Read message body length.
@@ -1073,7 +1674,7 @@ int PGProtoStreamingServer::_process_query_start(int hdr_len) {
 
 }
 
-void PGProtoStreamingServer::_send_ParameterStatus() {
+void PGProtoStreamingSession::_send_ParameterStatus() {
 
   pgprotocol::pg_protocol_param_status status;
 
@@ -1087,12 +1688,24 @@ void PGProtoStreamingServer::_send_ParameterStatus() {
    * terminated string into the buffer.
    */
   ProtocolBuffer temp_buf;
+  std::string server_version = this->streamDescr->version;
+  std::shared_ptr<BaseBackupDescr> basebackup = catalogHandler->getAttachedBasebackup();
+
+  /*
+   * Connected to a basebackup, report the PostgreSQL version it
+   * was taken from in front of ours, as packagers of PostgreSQL do.
+   * Clients like pg_basebackup choose their protocol by it.
+   */
+  if (basebackup != nullptr && basebackup->pg_version_num > 0) {
+    server_version = pgprotocol::PGProtoShow::versionString(basebackup->pg_version_num)
+      + " (" + server_version + ")";
+  }
 
   /*
    * Send server_version
    */
   this->_parameter_to_buffer(temp_buf, "server_version",
-                             this->streamDescr->version);
+                             server_version);
 
   // this->_parameter_to_buffer(temp_buf, "integer_datetimes",
   //                            "on");
@@ -1120,7 +1733,7 @@ void PGProtoStreamingServer::_send_ParameterStatus() {
 
 }
 
-void PGProtoStreamingServer::clearErrorStack() {
+void PGProtoStreamingSession::clearErrorStack() {
 
   if (this->errm.empty())
     return;
@@ -1130,7 +1743,7 @@ void PGProtoStreamingServer::clearErrorStack() {
 
 }
 
-void PGProtoStreamingServer::msg(pgprotocol::PGErrorSeverity severity,
+void PGProtoStreamingSession::msg(pgprotocol::PGErrorSeverity severity,
                                  std::string msg,
                                  bool translatable) {
 
@@ -1187,19 +1800,16 @@ void PGProtoStreamingServer::msg(pgprotocol::PGErrorSeverity severity,
 
 }
 
-void PGProtoStreamingServer::set_sqlstate(std::string state) {
+void PGProtoStreamingSession::set_sqlstate(std::string state) {
 
   errm.push('C', state);
 
 }
 
-void PGProtoStreamingServer::_send_command_complete(pgprotocol::PGProtoCmdTag tag,
+void PGProtoStreamingSession::_send_command_complete(pgprotocol::PGProtoCmdTag tag,
                                                     unsigned int rowcount) {
-  pgprotocol::pg_protocol_msg_header hdr;
   std::ostringstream message_buffer;
 
-  hdr.type = pgprotocol::CommandCompleteMessage;
-
   /*
    * Generate command tag
    */
@@ -1246,24 +1856,34 @@ void PGProtoStreamingServer::_send_command_complete(pgprotocol::PGProtoCmdTag ta
     }
   }
 
+  _send_command_complete(message_buffer.str());
+
+}
+
+void PGProtoStreamingSession::_send_command_complete(std::string tag) {
+
+  pgprotocol::pg_protocol_msg_header hdr;
+
+  hdr.type = pgprotocol::CommandCompleteMessage;
+
   /*
    * NOTE: We need a extra byte at the end of the command tag!
    */
-  hdr.length = MESSAGE_HDR_LENGTH_SIZE + message_buffer.str().length() + 1;
+  hdr.length = MESSAGE_HDR_LENGTH_SIZE + tag.length() + 1;
 
-  BOOST_LOG_TRIVIAL(debug) << "PG PROTO command completion tag " << message_buffer.str();
+  BOOST_LOG_TRIVIAL(debug) << "PG PROTO command completion tag " << tag;
   BOOST_LOG_TRIVIAL(debug) << "PG PROTO message buffer length " << hdr.length;
 
   write_buffer.allocate(hdr.length + MESSAGE_HDR_BYTE);
   write_buffer.write_byte(hdr.type);
   write_buffer.write_int(hdr.length);
-  write_buffer.write_buffer(message_buffer.str().c_str(), message_buffer.str().length());
+  write_buffer.write_buffer(tag.c_str(), tag.length());
   write_buffer.write_byte('\0');
 
   state = PGPROTO_COMMAND_COMPLETE;
 }
 
-void PGProtoStreamingServer::_send_error() {
+void PGProtoStreamingSession::_send_error() {
 
   /*
    * Slurp in error stack.
@@ -1277,7 +1897,7 @@ void PGProtoStreamingServer::_send_error() {
 
 }
 
-void PGProtoStreamingServer::_send_notice() {
+void PGProtoStreamingSession::_send_notice() {
 
   /*
    * Slurp in error stack.
@@ -1293,7 +1913,7 @@ void PGProtoStreamingServer::_send_notice() {
 }
 
 
-void PGProtoStreamingServer::_send_ReadyForQuery() {
+void PGProtoStreamingSession::_send_ReadyForQuery() {
 
   pgprotocol::pg_protocol_ready_for_query rfq;
 
@@ -1312,7 +1932,7 @@ void PGProtoStreamingServer::_send_ReadyForQuery() {
 
 }
 
-void PGProtoStreamingServer::startup_msg_in(const boost::system::error_code& ec,
+void PGProtoStreamingSession::startup_msg_in(const boost::system::error_code& ec,
                                             std::size_t len) {
 
   if (ec) {
@@ -1366,9 +1986,19 @@ void PGProtoStreamingServer::startup_msg_in(const boost::system::error_code& ec,
 
 }
 
-void PGProtoStreamingServer::pgproto_header_in(const boost::system::error_code& ec,
+void PGProtoStreamingSession::pgproto_header_in(const boost::system::error_code& ec,
                                                std::size_t len) {
-  if (!ec) {
+
+  if (ec) {
+
+    /* Client went away without a termination message */
+    BOOST_LOG_TRIVIAL(debug) << "PG PROTO connection closed: " << ec.message();
+    close();
+    return;
+
+  }
+
+  {
 
     BOOST_LOG_TRIVIAL(debug) << "PG PROTO incoming msg header completion handler, transferred "
                              << len << " bytes";
@@ -1397,16 +2027,18 @@ void PGProtoStreamingServer::pgproto_header_in(const boost::system::error_code&
 
           BOOST_LOG_TRIVIAL(debug) << "PG PROTO termination message, exiting";
 
-          soc->close();
-          ios->stop();
-
-          std::exit(0);
+          close();
 
           /* Equivalent to TerminationMessage */
           break;
 
         }
 
+      case pgprotocol::CopyDoneMessage:
+
+        process_message();
+        break;
+
       }
 
     }
@@ -1415,7 +2047,7 @@ void PGProtoStreamingServer::pgproto_header_in(const boost::system::error_code&
 
 }
 
-void PGProtoStreamingServer::process_startup_guc() {
+void PGProtoStreamingSession::process_startup_guc() {
 
   /*
    * Check if a specific value for the "dbname" parameter was set.
@@ -1514,7 +2146,7 @@ void PGProtoStreamingServer::process_startup_guc() {
 
 }
 
-void PGProtoStreamingServer::resetQueryState() {
+void PGProtoStreamingSession::resetQueryState() {
 
   processed_rows = 0;
   last_cmd_tag = pgprotocol::UNKNOWN_CMD;
@@ -1522,7 +2154,7 @@ void PGProtoStreamingServer::resetQueryState() {
 
 }
 
-void PGProtoStreamingServer::startup_msg_body(const boost::system::error_code& ec,
+void PGProtoStreamingSession::startup_msg_body(const boost::system::error_code& ec,
                                          std::size_t len) {
 
   _read_startup_gucs();
@@ -1598,7 +2230,7 @@ void PGProtoStreamingServer::startup_msg_body(const boost::system::error_code& e
 
 }
 
-void PGProtoStreamingServer::pgproto_msg_in(const boost::system::error_code& ec,
+void PGProtoStreamingSession::pgproto_msg_in(const boost::system::error_code& ec,
                                             std::size_t len) {
 
   if (ec) {
@@ -1612,7 +2244,7 @@ void PGProtoStreamingServer::pgproto_msg_in(const boost::system::error_code& ec,
 
 }
 
-bool PGProtoStreamingServer::process_message() {
+bool PGProtoStreamingSession::process_message() {
 
   using namespace pgprotocol;
 
@@ -1660,23 +2292,11 @@ bool PGProtoStreamingServer::process_message() {
        */
       _process_query_execute(query_str_len);
 
-      if (state == PGPROTO_ERROR_AFTER_QUERY) {
-
-        /* Finalize the request */
-        _send_ReadyForQuery();
-        start_write();
-
-        break;
-
-      }
-
-      /* Finalize the request */
-      _send_ReadyForQuery();
-      start_write();
-
-      /* Reset stateful query properties */
-      resetQueryState();
-
+      /*
+       * The results of the query, and ReadyForQuery once
+       * it's done, are written by query_next() or a
+       * streaming command.
+       */
       break;
 
     }
@@ -1697,6 +2317,33 @@ bool PGProtoStreamingServer::process_message() {
   case CopyFailMessage:
     break;
 
+  case CopyDataMessage:
+    {
+      if (state == PGPROTO_PROCESS_COPY && copy_command != nullptr) {
+
+        /* Standby status updates */
+        copy_command->feedback(read_body_buffer);
+        stream_wakeup();
+
+      }
+
+      break;
+    }
+
+  case CopyDoneMessage:
+    {
+      if (state == PGPROTO_PROCESS_COPY && copy_command != nullptr) {
+
+        BOOST_LOG_TRIVIAL(debug) << "PG PROTO client ended COPY";
+
+        copy_command->clientDone();
+        stream_wakeup();
+
+      }
+
+      break;
+    }
+
   case '\0':
     break;
 
@@ -1718,7 +2365,7 @@ bool PGProtoStreamingServer::process_message() {
 
 }
 
-pgprotocol::PGMessageType PGProtoStreamingServer::_read_message_header() {
+pgprotocol::PGMessageType PGProtoStreamingSession::_read_message_header() {
 
   BOOST_LOG_TRIVIAL(debug) << "PG PROTO extracting message header values";
 
@@ -1748,7 +2395,7 @@ pgprotocol::PGMessageType PGProtoStreamingServer::_read_message_header() {
 
 }
 
-void PGProtoStreamingServer::pgproto_msg_out(const boost::system::error_code &ec) {
+void PGProtoStreamingSession::pgproto_msg_out(const boost::system::error_code &ec) {
 
   if (ec) {
     throw TCPServerFailure("error on writing to server socket");
@@ -1758,3 +2405,224 @@ void PGProtoStreamingServer::pgproto_msg_out(const boost::system::error_code &ec
 
 }
 
+
+/* ****************************************************************************
+ * PGProtoStreamingSession, CopyBoth streaming
+ * ****************************************************************************/
+
+std::function<void(const boost::system::error_code&, std::size_t)>
+PGProtoStreamingSession::stream_callback(std::function<void(const boost::system::error_code&)> fn) {
+
+  std::shared_ptr<void> owner = this->io_owner();
+  auto callback = [this, owner, fn](const boost::system::error_code &ec,
+                                    std::size_t len) {
+
+    try {
+      fn(ec);
+    } catch (std::exception &e) {
+      this->io_failure(e);
+    }
+
+  };
+
+  if (this->strand != nullptr)
+    return this->strand->wrap(callback);
+
+  return callback;
+
+}
+
+void PGProtoStreamingSession::stream_start(std::shared_ptr<pgprotocol::PGProtoStreamingCommand> cmd) {
+
+  copy_command = std::dynamic_pointer_cast<pgprotocol::PGProtoCopyStreamingCommand>(cmd);
+
+  if (copy_command == nullptr) {
+    throw pgprotocol::PGProtoCmdFailure(cmd->tag() + " doesn't support the COPY subprotocol");
+  }
+
+  if (stream_timer == nullptr)
+    stream_timer = new ba::deadline_timer(server->getIOService());
+
+  /* sendfile() must not block the thread serving us */
+  soc->non_blocking(true);
+
+  state = PGPROTO_PROCESS_COPY;
+  stream_next();
+
+}
+
+void PGProtoStreamingSession::stream_next() {
+
+  int step;
+
+  if (closed || copy_command == nullptr)
+    return;
+
+  try {
+
+    step = copy_command->step(stream_buffer);
+
+  } catch (std::exception &e) {
+
+    BOOST_LOG_TRIVIAL(error) << "streaming failed: " << e.what();
+    stream_finish(e.what());
+    return;
+
+  }
+
+  if (step == -1) {
+    stream_finish();
+    return;
+  }
+
+  if (step == pgprotocol::PGProtoCopyStreamingCommand::STEP_WAIT) {
+
+    auto callback = stream_callback([this](const boost::system::error_code &ec) {
+
+        /* A cancelled timer means we have something to do */
+        stream_waiting = false;
+        stream_next();
+
+      });
+
+    stream_waiting = true;
+    stream_timer->expires_from_now(boost::posix_time::milliseconds(STREAM_WAIT_INTERVAL));
+    stream_timer->async_wait([callback](const boost::system::error_code &ec) {
+        callback(ec, 0);
+      });
+
+    return;
+
+  }
+
+  ba::async_write(SOCKET_P(this), ba::buffer(stream_buffer.ptr(), stream_buffer.getSize()),
+                  stream_callback([this](const boost::system::error_code &ec) {
+
+                      int fd;
+                      off_t offset;
+                      size_t len;
+
+                      if (ec) {
+                        throw TCPServerFailure("error on writing to server socket");
+                      }
+
+                      if (copy_command == nullptr)
+                        return;
+
+                      if (copy_command->pendingFileRegion(fd, offset, len))
+                        stream_sendfile(fd, offset, len);
+                      else
+                        stream_next();
+
+                    }));
+
+}
+
+void PGProtoStreamingSession::stream_sendfile(int fd, off_t offset, size_t len) {
+
+  if (closed)
+    return;
+
+  while (len > 0) {
+
+    ssize_t rc = ::sendfile(soc->native_handle(), fd, &offset, len);
+
+    if (rc < 0) {
+
+      if (errno == EINTR)
+        continue;
+
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+
+        /* Socket buffer full, continue once it's writable again */
+        auto callback = stream_callback([this, fd, offset, len](const boost::system::error_code &ec) {
+
+            if (ec) {
+              throw TCPServerFailure("error on writing to server socket");
+            }
+
+            stream_sendfile(fd, offset, len);
+
+          });
+
+        soc->async_wait(ip::tcp::socket::wait_write,
+                        [callback](const boost::system::error_code &ec) {
+                          callback(ec, 0);
+                        });
+        return;
+
+      }
+
+      throw TCPServerFailure(std::string("could not send file data: ") + strerror(errno));
+
+    }
+
+    if (rc == 0) {
+      throw TCPServerFailure("unexpected end of file");
+    }
+
+    len -= rc;
+
+  }
+
+  stream_next();
+
+}
+
+void PGProtoStreamingSession::stream_wakeup() {
+
+  boost::system::error_code ec;
+
+  if (stream_waiting)
+    stream_timer->cancel(ec);
+
+}
+
+void PGProtoStreamingSession::stream_end(std::string out) {
+
+  stream_buffer.assign(&out[0], out.length());
+
+  ba::async_write(SOCKET_P(this), ba::buffer(stream_buffer.ptr(), stream_buffer.getSize()),
+                  stream_callback([this](const boost::system::error_code &ec) {
+
+                      if (ec) {
+                        throw TCPServerFailure("error on writing to server socket");
+                      }
+
+                    }));
+
+}
+
+void PGProtoStreamingSession::stream_finish(std::string error_string) {
+
+  std::string out = "";
+  std::string tag = (copy_command != nullptr) ? copy_command->tag() : "";
+
+  copy_command = nullptr;
+
+  /*
+   * Collect the final messages, so they are written
+   * in one go.
+   */
+  if (error_string.length() > 0) {
+
+    msg(pgprotocol::PG_ERR_ERROR, error_string);
+    set_sqlstate("XX000");
+    _send_error();
+    out.append(write_buffer.ptr(), write_buffer.getSize());
+
+  } else {
+
+    _send_command_complete(tag);
+    out.append(write_buffer.ptr(), write_buffer.getSize());
+
+  }
+
+  _send_ReadyForQuery();
+  out.append(write_buffer.ptr(), write_buffer.getSize());
+
+  stream_end(out);
+
+  resetQueryState();
+
+}
@@ -0,0 +1,385 @@
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <common.hxx>
+#include <workerpool.hxx>
+
+using namespace pgbckctl;
+
+const unsigned int WorkerPool::MAX_JOB_LEN;
+const unsigned int WorkerPool::MAX_SIZE;
+const unsigned int WorkerPool::RESPAWN_DELAY;
+
+WorkerPool::WorkerPool(std::string catalog_name, unsigned int size) {
+
+  if (size > MAX_SIZE) {
+
+    std::ostringstream oss;
+
+    oss << "worker pool size " << size << " exceeds maximum of " << MAX_SIZE;
+    throw CPGBackupCtlFailure(oss.str());
+
+  }
+
+  this->catalog_name = catalog_name;
+  this->size = size;
+
+}
+
+WorkerPool::~WorkerPool() {
+
+  if (this->job_queue != nullptr)
+    delete this->job_queue;
+
+  if (this->state_queue != nullptr)
+    delete this->state_queue;
+
+}
+
+std::string WorkerPool::jobQueueName(std::string catalog_name) {
+  return "pg_backup_ctl::job_queue::" + catalog_name;
+}
+
+std::string WorkerPool::stateQueueName(std::string catalog_name) {
+  return "pg_backup_ctl::pool_state_queue::" + catalog_name;
+}
+
+void WorkerPool::remove(std::string catalog_name) {
+
+  boost::interprocess::message_queue::remove(WorkerPool::jobQueueName(catalog_name).c_str());
+  boost::interprocess::message_queue::remove(WorkerPool::stateQueueName(catalog_name).c_str());
+
+}
+
+void WorkerPool::open(bool create) {
+
+  using namespace boost::interprocess;
+
+  std::string job_name = WorkerPool::jobQueueName(this->catalog_name);
+  std::string state_name = WorkerPool::stateQueueName(this->catalog_name);
+
+  if (this->job_queue != nullptr)
+    return;
+
+  try {
+
+    if (create) {
+
+      /*
+       * Jobs left over by a crashed launcher must not be
+       * executed by the workers of this one.
+       */
+      WorkerPool::remove(this->catalog_name);
+
+      this->job_queue = new message_queue(create_only, job_name.c_str(),
+                                          MAX_SIZE, MAX_JOB_LEN);
+      this->state_queue = new message_queue(create_only, state_name.c_str(),
+                                            MAX_SIZE * 4, sizeof(worker_pool_state_msg));
+
+    } else {
+
+      this->job_queue = new message_queue(open_only, job_name.c_str());
+      this->state_queue = new message_queue(open_only, state_name.c_str());
+
+    }
+
+  } catch(interprocess_exception &e) {
+
+    std::ostringstream oss;
+
+    if (this->job_queue != nullptr) {
+      delete this->job_queue;
+      this->job_queue = nullptr;
+    }
+
+    oss << "could not " << (create ? "create" : "open")
+        << " worker pool queues: " << e.what();
+    throw CPGBackupCtlFailure(oss.str());
+
+  }
+
+}
+
+void WorkerPool::create() {
+
+  this->open(true);
+
+}
+
+void WorkerPool::attach() {
+
+  this->open(false);
+
+}
+
+unsigned int WorkerPool::getSize() {
+
+  return this->size;
+
+}
+
+unsigned int WorkerPool::getNumberOfWorkers() {
+
+  return this->workers.size();
+
+}
+
+unsigned int WorkerPool::available() {
+
+  unsigned int idle = 0;
+
+  for (auto &worker : this->workers) {
+
+    if (worker.second == POOL_WORKER_IDLE)
+      idle++;
+
+  }
+
+  return (idle > this->queued) ? idle - this->queued : 0;
+
+}
+
+unsigned int WorkerPool::missing() {
+
+  if (this->workers.size() >= this->size)
+    return 0;
+
+  if (this->failed
+      && (std::chrono::steady_clock::now() - this->last_failure
+          < std::chrono::milliseconds(RESPAWN_DELAY)))
+    return 0;
+
+  this->failed = false;
+  return this->size - this->workers.size();
+
+}
+
+void WorkerPool::spawned(pid_t pid) {
+
+  /*
+   * The worker reports itself idle once it's initialized,
+   * until then it's not available for jobs.
+   */
+  this->workers[pid] = POOL_WORKER_BUSY;
+  this->started[pid] = std::chrono::steady_clock::now();
+
+}
+
+void WorkerPool::terminate() {
+
+  for (auto &worker : this->workers) {
+
+    if (::kill(worker.first, SIGTERM) < 0 && errno != ESRCH) {
+      BOOST_LOG_TRIVIAL(warning) << "WARNING: could not terminate pool worker "
+                                 << worker.first << ": " << strerror(errno);
+    }
+
+  }
+
+}
+
+bool WorkerPool::isWorker(pid_t pid) {
+
+  return (this->workers.find(pid) != this->workers.end());
+
+}
+
+bool WorkerPool::exited(pid_t pid) {
+
+  auto it = this->workers.find(pid);
+
+  if (it == this->workers.end())
+    return false;
+
+  if (std::chrono::steady_clock::now() - this->started[pid]
+      < std::chrono::milliseconds(RESPAWN_DELAY)) {
+
+    BOOST_LOG_TRIVIAL(warning) << "pool worker " << pid << " exited right after startup, "
+                               << "delaying its replacement";
+    this->failed = true;
+    this->last_failure = std::chrono::steady_clock::now();
+
+  }
+
+  this->workers.erase(it);
+  this->started.erase(pid);
+
+  /*
+   * A job still queued is taken by the remaining
+   * workers or the replacement.
+   */
+  if (this->queued > this->workers.size())
+    this->queued = this->workers.size();
+
+  return true;
+
+}
+
+size_t WorkerPool::receive() {
+
+  using namespace boost::interprocess;
+
+  worker_pool_state_msg msg;
+  message_queue::size_type recv_size;
+  unsigned int prio;
+  size_t received = 0;
+
+  if (this->state_queue == nullptr)
+    return 0;
+
+  try {
+
+    while (this->state_queue->try_receive(&msg, sizeof(msg), recv_size, prio)) {
+
+      auto it = this->workers.find(msg.pid);
+
+      received++;
+
+      if (recv_size != sizeof(msg) || it == this->workers.end())
+        continue;
+
+      switch (msg.state) {
+
+      case POOL_WORKER_BUSY:
+
+        /* worker took a queued job */
+        if (this->queued > 0)
+          this->queued--;
+
+        it->second = POOL_WORKER_BUSY;
+        break;
+
+      case POOL_WORKER_IDLE:
+        it->second = POOL_WORKER_IDLE;
+        break;
+
+      default:
+        /* POOL_WORKER_EXIT, SIGCHLD does the rest */
+        it->second = POOL_WORKER_EXIT;
+        break;
+
+      }
+
+    }
+
+  } catch(interprocess_exception &e) {
+    throw CPGBackupCtlFailure(e.what());
+  }
+
+  return received;
+
+}
+
+bool WorkerPool::poolable(std::string command) {
+
+  boost::algorithm::trim(command);
+
+  /*
+   * These run until they are stopped, see class description.
+   */
+  if (boost::algorithm::istarts_with(command, "START STREAMING")
+      || boost::algorithm::istarts_with(command, "START RECOVERY STREAM"))
+    return false;
+
+  return true;
+
+}
+
+bool WorkerPool::dispatch(std::string command) {
+
+  using namespace boost::interprocess;
+
+  if (this->job_queue == nullptr)
+    return false;
+
+  if (command.length() == 0 || command.length() > MAX_JOB_LEN)
+    return false;
+
+  if (!WorkerPool::poolable(command) || this->available() == 0)
+    return false;
+
+  try {
+
+    if (!this->job_queue->try_send(command.data(), command.length(), 0))
+      return false;
+
+  } catch(interprocess_exception &e) {
+
+    BOOST_LOG_TRIVIAL(warning) << "WARNING: could not dispatch job to worker pool: "
+                               << e.what();
+    return false;
+
+  }
+
+  this->queued++;
+  return true;
+
+}
+
+bool WorkerPool::take(std::string &command, unsigned int timeout_ms) {
+
+  using namespace boost::interprocess;
+
+  char buffer[MAX_JOB_LEN + 1];
+  message_queue::size_type recv_size = 0;
+  unsigned int prio;
+  bool received = false;
+
+  if (this->job_queue == nullptr)
+    throw CPGBackupCtlFailure("worker pool queues not attached");
+
+  memset(buffer, 0, sizeof(buffer));
+
+  try {
+
+    boost::posix_time::ptime deadline
+      = boost::posix_time::microsec_clock::universal_time()
+      + boost::posix_time::milliseconds(timeout_ms);
+
+    received = this->job_queue->timed_receive(buffer, MAX_JOB_LEN,
+                                              recv_size, prio, deadline);
+
+  } catch(interprocess_exception &e) {
+    throw CPGBackupCtlFailure(e.what());
+  }
+
+  if (received)
+    command = std::string(buffer, std::min((size_t) recv_size, (size_t) MAX_JOB_LEN));
+
+  return received;
+
+}
+
+void WorkerPool::report(PoolWorkerState state) {
+
+  using namespace boost::interprocess;
+
+  worker_pool_state_msg msg;
+
+  if (this->state_queue == nullptr)
+    throw CPGBackupCtlFailure("worker pool queues not attached");
+
+  msg.pid = ::getpid();
+  msg.state = state;
+
+  try {
+
+    boost::posix_time::ptime deadline
+      = boost::posix_time::microsec_clock::universal_time()
+      + boost::posix_time::milliseconds(1000);
+
+    if (!this->state_queue->timed_send(&msg, sizeof(msg), 0, deadline)) {
+      BOOST_LOG_TRIVIAL(warning) << "WARNING: could not report pool worker state";
+    }
+
+  } catch(interprocess_exception &e) {
+    throw CPGBackupCtlFailure(e.what());
+  }
+
+}
@@ -1,11 +1,136 @@
 #include <iostream>
 #include <sstream>
+#include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <pgbckctl_exception.hxx>
 #include <memorybuffer.hxx>
 
 using namespace pgbckctl;
 
+/* **************************************************************************
+ * MemoryBufferPool
+ * **************************************************************************/
+
+const size_t MemoryBufferPool::MIN_CLASS_SIZE;
+const size_t MemoryBufferPool::MAX_CLASS_SIZE;
+const unsigned int MemoryBufferPool::DEFAULT_MAX_FREE;
+
+MemoryBufferPool::MemoryBufferPool(unsigned int max_free) {
+
+  this->max_free = max_free;
+  this->free_lists.resize(sizeClass(MAX_CLASS_SIZE) + 1);
+
+}
+
+MemoryBufferPool::~MemoryBufferPool() {
+
+  for (auto &list : this->free_lists) {
+    for (auto buffer : list)
+      delete [] buffer;
+  }
+
+}
+
+int MemoryBufferPool::sizeClass(size_t size) {
+
+  int result = 0;
+  size_t class_size = MIN_CLASS_SIZE;
+
+  if (size > MAX_CLASS_SIZE)
+    return -1;
+
+  while (class_size < size) {
+    class_size <<= 1;
+    result++;
+  }
+
+  return result;
+
+}
+
+char *MemoryBufferPool::get(size_t size, size_t &capacity) {
+
+  int index = sizeClass(size);
+
+  if (index < 0) {
+
+    /* Too large to be pooled */
+    capacity = size;
+
+    std::lock_guard<std::mutex> lock(this->pool_mutex);
+    this->allocations++;
+    return new char[size];
+
+  }
+
+  capacity = MIN_CLASS_SIZE << index;
+
+  {
+    std::lock_guard<std::mutex> lock(this->pool_mutex);
+    std::vector<char *> &list = this->free_lists[index];
+
+    if (!list.empty()) {
+
+      char *buffer = list.back();
+
+      list.pop_back();
+      this->reuses++;
+      return buffer;
+
+    }
+
+    this->allocations++;
+  }
+
+  return new char[capacity];
+
+}
+
+void MemoryBufferPool::put(char *buffer, size_t capacity) {
+
+  int index = sizeClass(capacity);
+
+  if (buffer == nullptr)
+    return;
+
+  /* Only buffers of exactly a class size came from a free list */
+  if (index >= 0 && capacity == (MIN_CLASS_SIZE << index)) {
+
+    std::lock_guard<std::mutex> lock(this->pool_mutex);
+    std::vector<char *> &list = this->free_lists[index];
+
+    if (list.size() < this->max_free) {
+      list.push_back(buffer);
+      return;
+    }
+
+  }
+
+  delete [] buffer;
+
+}
+
+unsigned long long MemoryBufferPool::countAllocations() {
+
+  std::lock_guard<std::mutex> lock(this->pool_mutex);
+  return this->allocations;
+
+}
+
+unsigned long long MemoryBufferPool::countReuses() {
+
+  std::lock_guard<std::mutex> lock(this->pool_mutex);
+  return this->reuses;
+
+}
+
+/* **************************************************************************
+ * MemoryBuffer
+ * **************************************************************************/
+
+const size_t MemoryBuffer::INLINE_SIZE;
+
 MemoryBuffer::MemoryBuffer(char *buf) {
 
   if (buf == nullptr) {
@@ -32,31 +157,132 @@ MemoryBuffer::MemoryBuffer(size_t initialsz) {
 
 MemoryBuffer::MemoryBuffer() {}
 
+MemoryBuffer::MemoryBuffer(std::shared_ptr<MemoryBufferPool> pool) {
+
+  this->pool = pool;
+
+}
+
+MemoryBuffer::MemoryBuffer(MemoryBuffer &&src) {
+
+  this->move_internal(src);
+
+}
+
 MemoryBuffer::~MemoryBuffer() {
 
-  if (this->memory_buffer != NULL) {
+  this->release_internal();
+
+}
+
+void MemoryBuffer::release_internal() {
+
+  switch(this->storage) {
+
+  case MEMBUF_STORAGE_HEAP:
     delete [] this->memory_buffer;
+    break;
+
+  case MEMBUF_STORAGE_POOL:
+    this->pool->put(this->memory_buffer, this->capacity);
+    break;
+
+  default:
+    /* nothing to free, or a derived class does it */
+    break;
+
   }
 
+  this->memory_buffer = nullptr;
+  this->size = 0;
+  this->capacity = 0;
+  this->storage = MEMBUF_STORAGE_NONE;
+
+}
+
+void MemoryBuffer::move_internal(MemoryBuffer &src) {
+
+  if (src.storage == MEMBUF_STORAGE_EXTERNAL)
+    throw CPGBackupCtlFailure("cannot move memory buffer with externally managed storage");
+
+  this->release_internal();
+
+  /* A pooled buffer has to go back to the pool it came from */
+  this->pool = src.pool;
+
+  if (src.storage == MEMBUF_STORAGE_INLINE) {
+    memcpy(this->inline_buffer, src.inline_buffer, src.size);
+    this->memory_buffer = this->inline_buffer;
+  } else {
+    this->memory_buffer = src.memory_buffer;
+  }
+
+  this->size = src.size;
+  this->capacity = src.capacity;
+  this->storage = src.storage;
+
+  src.memory_buffer = nullptr;
+  src.size = 0;
+  src.capacity = 0;
+  src.storage = MEMBUF_STORAGE_NONE;
+
 }
 
 void MemoryBuffer::alloc_internal(size_t size) {
 
-  if (this->memory_buffer != NULL) {
-    delete [] this->memory_buffer;
-    this->memory_buffer = NULL;
-    this->size          = 0;
+  /*
+   * Reuse the current buffer if it's large enough.
+   */
+  if (this->memory_buffer != nullptr
+      && this->storage != MEMBUF_STORAGE_EXTERNAL
+      && size <= this->capacity) {
+    this->size = size;
+    return;
+  }
+
+  this->release_internal();
+
+  if (size <= INLINE_SIZE) {
+
+    this->memory_buffer = this->inline_buffer;
+    this->capacity = INLINE_SIZE;
+    this->storage = MEMBUF_STORAGE_INLINE;
+
+  } else if (this->pool != nullptr) {
+
+    this->memory_buffer = this->pool->get(size, this->capacity);
+    this->storage = MEMBUF_STORAGE_POOL;
+
+  } else {
+
+    this->memory_buffer = new char[size];
+    this->capacity = size;
+    this->storage = MEMBUF_STORAGE_HEAP;
+
   }
 
-  this->memory_buffer = new char[size];
   this->size = size;
 
 }
 
+void MemoryBuffer::setPool(std::shared_ptr<MemoryBufferPool> pool) {
+
+  if (this->storage == MEMBUF_STORAGE_EXTERNAL)
+    throw CPGBackupCtlFailure("cannot assign a pool to memory buffer with externally managed storage");
+
+  this->release_internal();
+  this->pool = pool;
+
+}
+
 size_t MemoryBuffer::getSize() {
   return this->size;
 }
 
+size_t MemoryBuffer::getCapacity() {
+  return this->capacity;
+}
+
 void MemoryBuffer::allocate(size_t size) {
 
   this->alloc_internal(size);
@@ -66,7 +292,9 @@ void MemoryBuffer::allocate(size_t size) {
 size_t MemoryBuffer::_write(const void *buf, size_t bufsize, size_t off) {
 
   char *buf_ptr = this->memory_buffer + off;
-  memcpy(buf_ptr, buf, bufsize);
+
+  /* buf might point into the reused internal buffer */
+  memmove(buf_ptr, buf, bufsize);
 
   return bufsize;
 
@@ -141,12 +369,12 @@ void MemoryBuffer::own(char *buf, size_t sz) {
     throw CPGBackupCtlFailure("memory buffer cannot own undefined pointer");
   }
 
-  if (memory_buffer != nullptr) {
-    delete [] memory_buffer;
-  }
+  this->release_internal();
 
   this->memory_buffer = buf;
   this->size = sz;
+  this->capacity = sz;
+  this->storage = MEMBUF_STORAGE_HEAP;
 
 }
 
@@ -197,6 +425,17 @@ MemoryBuffer& MemoryBuffer::operator=(MemoryBuffer& src) {
 
 }
 
+MemoryBuffer& MemoryBuffer::operator=(MemoryBuffer &&src) {
+
+  if (this == &src) {
+    throw CPGBackupCtlFailure("request for memory buffer self assignment");
+  }
+
+  this->move_internal(src);
+  return *this;
+
+}
+
 MemoryBuffer& MemoryBuffer::operator=(std::shared_ptr<MemoryBuffer> &src) {
 
   if (this == src.get()) {
@@ -228,3 +467,82 @@ std::ostream& MemoryBuffer::operator<<(std::ostream& out) {
   return out;
 
 }
+
+/* **************************************************************************
+ * AlignedMemoryBuffer
+ * **************************************************************************/
+
+const size_t AlignedMemoryBuffer::DEFAULT_ALIGNMENT;
+
+AlignedMemoryBuffer::AlignedMemoryBuffer(size_t initialsz, size_t alignment)
+  : MemoryBuffer() {
+
+  /* posix_memalign() requires a power of two multiple of sizeof(void *) */
+  if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+    std::ostringstream oss;
+    oss << "invalid memory buffer alignment " << alignment;
+    throw CPGBackupCtlFailure(oss.str());
+  }
+
+  this->alignment = alignment;
+  this->allocate(initialsz);
+
+}
+
+AlignedMemoryBuffer::~AlignedMemoryBuffer() {
+
+  /* Make sure the MemoryBuffer destructor doesn't delete[] our buffer */
+  this->free_internal();
+
+}
+
+void AlignedMemoryBuffer::free_internal() {
+
+  if (this->memory_buffer != nullptr) {
+    free(this->memory_buffer);
+    this->memory_buffer = nullptr;
+  }
+
+  this->size = 0;
+  this->capacity = 0;
+  this->storage = MEMBUF_STORAGE_NONE;
+
+}
+
+void AlignedMemoryBuffer::allocate(size_t size) {
+
+  void *buf = nullptr;
+
+  this->free_internal();
+
+  if (posix_memalign(&buf, this->alignment, std::max<size_t>(size, 1)) != 0) {
+    std::ostringstream oss;
+    oss << "could not allocate " << size << " bytes of aligned memory";
+    throw CPGBackupCtlFailure(oss.str());
+  }
+
+  this->memory_buffer = (char *) buf;
+  this->size = size;
+  this->capacity = size;
+  this->storage = MEMBUF_STORAGE_EXTERNAL;
+
+}
+
+void AlignedMemoryBuffer::assign(void *buf, size_t sz) {
+
+  this->allocate(sz);
+  _write(buf, sz, 0);
+
+}
+
+void AlignedMemoryBuffer::own(char *buffer, size_t sz) {
+
+  throw CPGBackupCtlFailure("aligned memory buffer cannot own a foreign pointer");
+
+}
+
+size_t AlignedMemoryBuffer::getAlignment() {
+
+  return this->alignment;
+
+}
@@ -22,6 +22,7 @@
 #include <output.hxx>
 #include <parser.hxx>
 #include <rtconfig.hxx>
+#include <walrestore.hxx>
 
 using namespace pgbckctl;
 using namespace std;
@@ -70,9 +71,14 @@ typedef struct PGBackupCtlArgs {
   char *actionFile; /* commands read from file */
   char *catalogDir; /* mandatory or compiled in default */
   char **variables = NULL; /* list of runtime variables to set */
+  char *walFile; /* restore-wal: requested file (%f) */
+  char *walTarget; /* restore-wal: target path (%p) */
+  char *spoolDir; /* restore-wal: prefetch spool directory */
+  int   prefetch = -1; /* restore-wal: segments to prefetch */
   bool  useCompression;
   int   start_launcher = 0;
   int   start_wal_streaming = 0;
+  int   single_transaction = 0; /* run command file in one transaction */
 } PGBackupCtlArgs;
 
 static void handle_signal_on_input(int sig) {
@@ -113,6 +119,9 @@ static void printActionHelp() {
        << "\n"
        << "   start-streaming: start WAL streaming for the specified archive (requires --archive-name)\n"
        << "\n"
+       << "   restore-wal: restores a WAL file from the specified archive, to be used as\n"
+       << "                restore_command (requires --archive-name, --wal-file and --wal-target)\n"
+       << "\n"
        << "   help            : this screen\n"
        << "\n";
 }
@@ -137,6 +146,11 @@ static void processCmdLineArgs(int argc,
   handle->start_launcher = 0;
   handle->start_wal_streaming = 0;
   handle->backup_profile      = NULL;
+  handle->walFile             = NULL;
+  handle->walTarget           = NULL;
+  handle->spoolDir            = NULL;
+  handle->prefetch            = -1;
+  handle->single_transaction  = 0;
 
   /*
    * Set libpopt options.
@@ -154,7 +168,9 @@ static void processCmdLineArgs(int argc,
     { "catalog", 'C', POPT_ARG_STRING,
       &handle->catalogDir, 0, PG_BACKUP_CTL_SQLITE},
     { "action-file", 'F', POPT_ARG_STRING,
-      &handle->actionFile, 0, "command file"},
+      &handle->actionFile, 0, "command file, - reads commands from stdin"},
+    { "single-transaction", '\0', POPT_ARG_NONE,
+      &handle->single_transaction, 0, "execute the command file within a single catalog transaction" },
     { "launcher", 'L', POPT_ARG_NONE,
       &handle->start_launcher, 0, "start background launcher and exit" },
     { "wal-streamer", 'W', POPT_ARG_NONE,
@@ -163,6 +179,14 @@ static void processCmdLineArgs(int argc,
       &handle->backup_profile, 0, "specifies a backup profile used by specified actions" },
     { "variable", 'V', POPT_ARG_ARGV,
       &handle->variables, 0, "runtime variables to be set during execution" },
+    { "wal-file", '\0', POPT_ARG_STRING,
+      &handle->walFile, 0, "WAL file to restore (restore-wal action, %f)" },
+    { "wal-target", '\0', POPT_ARG_STRING,
+      &handle->walTarget, 0, "path to restore the WAL file to (restore-wal action, %p)" },
+    { "spool-directory", '\0', POPT_ARG_STRING,
+      &handle->spoolDir, 0, "directory WAL segments are prefetched into (restore-wal action)" },
+    { "prefetch", '\0', POPT_ARG_INT,
+      &handle->prefetch, 0, "number of WAL segments to prefetch (restore-wal action)" },
 
     POPT_AUTOHELP { NULL, 0, 0, NULL, 0 }
   };
@@ -204,6 +228,7 @@ void init_RtCfg() {
    * Output format
    */
   enums.insert("json");
+  enums.insert("ndjson");
   enums.insert("console");
 
   RtCfg->create("output.format", "console", "console", enums);
@@ -214,6 +239,163 @@ void init_RtCfg() {
    */
   RtCfg->create("walstreamer.wait_timeout", 60, 60, 0, 86400);
 
+  /*
+   * walstreamer.preallocate enables preallocation of uncompressed
+   * WAL segment files, walstreamer.prealloc_segments the number of
+   * spare segment files kept ready in the log directory.
+   */
+  RtCfg->create("walstreamer.preallocate", true, true);
+  RtCfg->create("walstreamer.prealloc_segments", 1, 1, 0, 2);
+
+  /*
+   * WAL durability policy of the walstreamer, see WALSyncPolicy.
+   *
+   * walstreamer.sync_interval syncs streamed WAL within a segment after the
+   * specified number of milliseconds, walstreamer.sync_bytes after the
+   * specified amount of unsynced bytes. 0 disables each trigger.
+   */
+  RtCfg->create("walstreamer.sync_interval", 0, 0, 0, 3600000);
+  RtCfg->create("walstreamer.sync_bytes", 0, 0, 0, 1073741824);
+
+  enums.insert("fsync");
+  enums.insert("fdatasync");
+  enums.insert("sync_file_range");
+
+  RtCfg->create("walstreamer.sync_method", "fsync", "fsync", enums);
+  enums.clear();
+
+  /*
+   * Compression of streamed WAL segment files. If set to "none", WAL
+   * is compressed with gzip in case the archive has compression enabled.
+   * walstreamer.compression_level 0 uses the default level of
+   * the compression method.
+   */
+  enums.insert("none");
+  enums.insert("gzip");
+  enums.insert("zstd");
+  enums.insert("lz4");
+
+  RtCfg->create("walstreamer.compression", "none", "none", enums);
+  enums.clear();
+
+  RtCfg->create("walstreamer.compression_level", 0, 0, 0, 22);
+
+  /*
+   * walstreamer.compression_frame_blocks > 0 writes compressed WAL
+   * segments as independently decodable frames of the specified
+   * number of XLOG blocks plus a frame table, so readers can start
+   * at any LSN without decompressing the segment from its start.
+   */
+  RtCfg->create("walstreamer.compression_frame_blocks", 0, 0, 0, 8192);
+
+  /*
+   * walstreamer.pipeline_slots > 0 writes streamed WAL from a
+   * dedicated writer thread, queueing up to the specified number of
+   * XLOG data messages. 0 writes WAL synchronously from the receiver.
+   */
+  RtCfg->create("walstreamer.pipeline_slots", 0, 0, 0, 65536);
+
+  /*
+   * walstreamer.direct_write writes uncompressed WAL segment files
+   * unbuffered, passing received XLOG data straight to the kernel.
+   */
+  RtCfg->create("walstreamer.direct_write", false, false);
+
+  /*
+   * walstreamer.validate checks the XLOG page headers of streamed WAL
+   * before it's written into the archive, "checksums" additionally records
+   * a CRC-32C per completed segment in the WAL segment index.
+   */
+  enums.insert("off");
+  enums.insert("headers");
+  enums.insert("checksums");
+
+  RtCfg->create("walstreamer.validate", "off", "off", enums);
+  enums.clear();
+
+  /*
+   * Settings for streaming more than one archive from a single
+   * worker (START STREAMING FOR ARCHIVE a, b, ...).
+   *
+   * walstreamer.mux_threads is the number of streaming threads the
+   * archives are distributed over, walstreamer.mux_max_messages limits
+   * the XLOG messages handled per stream before serving the next one
+   * (0 means no limit). walstreamer.mux_pin_cpus pins each streaming thread
+   * to its own CPU.
+   */
+  RtCfg->create("walstreamer.mux_threads", 1, 1, 1, 256);
+  RtCfg->create("walstreamer.mux_max_messages", 64, 64, 0, 65536);
+  RtCfg->create("walstreamer.mux_pin_cpus", false, false);
+
+  /*
+   * Adaptive rate control of basebackups (RATE_CONTROL ADAPTIVE).
+   *
+   * basebackup.max_rate overrides the MAX_RATE of the backup profile
+   * in KByte/s, 0 keeps the profile setting. If any WAL stream lags
+   * behind by more than basebackup.wal_lag_threshold MByte, the rate
+   * is reduced down to basebackup.min_rate KByte/s until the WAL
+   * streams caught up again. A threshold of 0 disables backing off.
+   */
+  RtCfg->create("basebackup.max_rate", 0, 0, 0, 1048576);
+  RtCfg->create("basebackup.min_rate", 1024, 1024, 32, 1048576);
+  RtCfg->create("basebackup.wal_lag_threshold", 64, 64, 0, 1048576);
+
+  /*
+   * Syncing whole directory trees, e.g. a basebackup directory
+   * after applying a retention policy. See RecursiveSync for the
+   * methods, recursive_sync.parallelism is the number of fsync
+   * requests in flight.
+   */
+  enums.insert("auto");
+  enums.insert("fsync");
+  enums.insert("io_uring");
+  enums.insert("syncfs");
+
+  RtCfg->create("recursive_sync.method", "auto", "auto", enums);
+  enums.clear();
+
+  RtCfg->create("recursive_sync.parallelism", 32, 32, 1, 1024);
+
+  /*
+   * RESTORE extracts every archive of a basebackup by its own
+   * pipeline. restore.parallelism limits the number of pipelines
+   * running at once, 0 runs all of them. restore.queue_depth is
+   * the number of 1MB chunks queued between the decompressing and
+   * the writing thread of a pipeline.
+   */
+  RtCfg->create("restore.parallelism", 0, 0, 0, 64);
+  RtCfg->create("restore.queue_depth", 16, 16, 1, 256);
+
+  /*
+   * Throughput in MB/s RESTORE ... RECOVERY TARGET assumes for
+   * extracting basebackups and replaying WAL when choosing the
+   * basebackup with the shortest estimated restore time.
+   */
+  RtCfg->create("restore.extract_rate", 200, 200, 1, 100000);
+  RtCfg->create("restore.replay_rate", 64, 64, 1, 100000);
+
+  /*
+   * RESTORE ... RECOVERY TARGET restores the WAL up to the target
+   * into pg_wal while extracting the basebackup, using
+   * restore.wal_parallelism threads.
+   */
+  RtCfg->create("restore.prepare_wal", true, true);
+  RtCfg->create("restore.wal_parallelism", 4, 4, 1, 64);
+
+  /*
+   * Number of threads a recovery stream serves its client
+   * connections with (START RECOVERY STREAM). 0 forks a process
+   * for each connection, isolating connections from each other.
+   */
+  RtCfg->create("recovery.connection_threads", 4, 4, 0, 64);
+
+  /*
+   * Size in MB of the cache of decompressed WAL shared by the client
+   * connections of a recovery stream, so standbys reading the same
+   * compressed segments decompress them only once. 0 disables it.
+   */
+  RtCfg->create("recovery.wal_cache_size", 64, 64, 0, 65536);
+
   /*
    * The on-error-exit bool parameter causes pg_backup_ctl++ to
    * exit immediately if it gets an error. This most of the time is
@@ -221,6 +403,38 @@ void init_RtCfg() {
    */
   RtCfg->create("interactive.on_error_exit", false, false);
 
+  /*
+   * Number of pre-forked workers a launcher executes its
+   * commands with. 0 forks a new worker for every command. Commands
+   * running until they are stopped, like streaming WAL, are always
+   * executed by a worker of their own.
+   */
+  RtCfg->create("launcher.worker_pool_size", 0, 0, 0, 64);
+
+  /*
+   * Limits for basebackups and verifications started by the
+   * launcher from schedules, see CREATE SCHEDULE.
+   *
+   * launcher.max_basebackups and launcher.max_verifies limit the
+   * number of scheduled jobs running at the same time, 0 means no limit.
+   * launcher.schedule_stagger is the number of seconds between the
+   * start of two scheduled jobs. Scheduled jobs are deferred while a WAL
+   * stream lags more than launcher.schedule_max_wal_lag MB behind,
+   * 0 disables this.
+   */
+  RtCfg->create("launcher.max_basebackups", 1, 1, 0, 64);
+  RtCfg->create("launcher.max_verifies", 1, 1, 0, 64);
+  RtCfg->create("launcher.schedule_stagger", 300, 300, 0, 86400);
+  RtCfg->create("launcher.schedule_max_wal_lag", 0, 0, 0, 1048576);
+
+  /*
+   * The launcher exports the state of its workers in the OpenMetrics
+   * format on launcher.metrics_port, see MetricsServer. 0 disables
+   * the metrics endpoint.
+   */
+  RtCfg->create("launcher.metrics_port", 0, 0, 0, 65535);
+  RtCfg->create("launcher.metrics_address", std::string("127.0.0.1"), std::string("127.0.0.1"));
+
   /*
    * The log_level parameter tells pg_backup_ctl++ what to log.
    */
@@ -364,15 +578,43 @@ static int handle_inputfile(PGBackupCtlArgs *args) {
 
   PGBackupCtlParser parser(path(string(args->actionFile)),
                            RtCfg);
-  shared_ptr<PGBackupCtlCommand> command;
+  std::vector<shared_ptr<PGBackupCtlCommand>> commands;
+  shared_ptr<BackupCatalog> catalog = nullptr;
+  unsigned int num = 0;
 
   try {
 
     /*
-     * Read in the file.
+     * Read in the file. All commands are parsed before the
+     * first one is executed.
      */
     parser.parseFile();
-    command = parser.getCommand();
+    commands = parser.getCommands();
+
+    if (args->single_transaction) {
+
+      /*
+       * Commands starting background or long running processes
+       * open their own catalog connections and can't be part
+       * of a transaction.
+       */
+      for (auto &command : commands) {
+
+        switch(command->getCommandTag()) {
+        case START_BASEBACKUP:
+        case START_LAUNCHER:
+        case START_STREAMING_FOR_ARCHIVE:
+        case START_RECOVERY_STREAM_FOR_ARCHIVE:
+        case UPLOAD_ARCHIVE:
+          throw CParserIssue(CatalogDescr::commandTagName(command->getCommandTag())
+                             + " cannot be executed with --single-transaction");
+        default:
+          break;
+        }
+
+      }
+
+    }
 
   } catch (CPGBackupCtlFailure& e) {
 
@@ -386,15 +628,57 @@ static int handle_inputfile(PGBackupCtlArgs *args) {
   }
 
   /*
-   * Parser should have created a valid
-   * command handle, suitable to be executed within
-   * the current catalog.
+   * Parser should have created valid command handles,
+   * suitable to be executed within the current catalog.
+   * They all share a single catalog connection, which
+   * stays open until the last command is done.
    */
   try {
-    command->execute(string(args->catalogDir));
-  } catch(CPGBackupCtlFailure& e) {
 
-    BOOST_LOG_TRIVIAL(error) << "command execution failure: " << e.what();
+    catalog = make_shared<BackupCatalog>(string(args->catalogDir));
+    catalog->setKeepOpen(true);
+
+    if (args->single_transaction)
+      catalog->startTransaction();
+
+    for (auto &command : commands) {
+
+      num++;
+
+      BOOST_LOG_TRIVIAL(debug) << "executing command " << num << ": "
+                               << CatalogDescr::commandTagName(command->getCommandTag());
+      command->execute(catalog);
+
+    }
+
+    if (args->single_transaction)
+      catalog->commitTransaction();
+
+    catalog->setKeepOpen(false);
+    catalog->close();
+
+  } catch(std::exception& e) {
+
+    BOOST_LOG_TRIVIAL(error) << "command execution failure (command "
+                             << num << "): " << e.what();
+
+    if (catalog != nullptr) {
+
+      try {
+
+        /* Also rolls back savepoints left over by the failed command */
+        while (catalog->inTransaction())
+          catalog->rollbackTransaction();
+
+        catalog->setKeepOpen(false);
+        catalog->close();
+
+      } catch(std::exception &ce) {
+        BOOST_LOG_TRIVIAL(error) << "could not close catalog: " << ce.what();
+      }
+
+    }
+
     return PG_BACKUP_CTL_CATALOG_ERROR;
 
   }
@@ -453,6 +737,45 @@ static void executeCommand(PGBackupCtlArgs *args) {
 
   }
 
+  if (strcmp(args->action, "restore-wal") == 0) {
+
+    /*
+     * Called by PostgreSQL as restore_command, e.g.
+     *
+     * restore_command = 'pg_backup_ctl++ --catalog ... --archive-name ...
+     *   --action restore-wal --wal-file %f --wal-target %p'
+     *
+     * The catalog is only opened if the file wasn't prefetched
+     * already. A nonzero exit code tells PostgreSQL the file doesn't
+     * exist, so don't complain loudly about missing files.
+     */
+    if (args->archive_name == NULL
+        || args->walFile == NULL
+        || args->walTarget == NULL) {
+      throw CPGBackupCtlFailure("--archive-name, --wal-file and --wal-target required for command \"restore-wal\"");
+    }
+
+    path target(args->walTarget);
+    path spooldir = (args->spoolDir != NULL)
+      ? path(args->spoolDir) : WALRestore::defaultSpoolDirectory(target);
+    WALRestore restore(string(args->catalogDir), string(args->archive_name), spooldir);
+
+    if (args->prefetch >= 0)
+      restore.setPrefetch(args->prefetch);
+
+    if (!restore.restore(string(args->walFile), target))
+      exit(PG_BACKUP_CTL_ARCHIVE_ERROR);
+
+    /*
+     * A restored segment has the WAL segment size of the
+     * cluster, which tells us the names of the following ones.
+     */
+    restore.startPrefetch(string(args->walFile), file_size(target));
+
+    exit(0);
+
+  }
+
   if (strcmp(args->action, "init-old-archive") == 0) {
 
     bool is_new_archive = false;
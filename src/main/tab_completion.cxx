@@ -436,9 +436,14 @@ completion_word retention_rule_compl[]
     { "+<number of basebackups>", COMPL_IDENTIFIER, COMPL_STATIC_ARRAY, NULL, NULL },
     { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
 
+completion_word retention_move_rule_compl[]
+= { { "OLDER", COMPL_KEYWORD, COMPL_STATIC_ARRAY, retention_than_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
 completion_word create_retention_rule_compl[]
 = { { "KEEP", COMPL_KEYWORD, COMPL_STATIC_ARRAY, retention_rule_compl, NULL },
     { "DROP", COMPL_KEYWORD, COMPL_STATIC_ARRAY, retention_rule_compl, NULL },
+    { "MOVE", COMPL_KEYWORD, COMPL_STATIC_ARRAY, retention_move_rule_compl, NULL },
     { "CLEANUP", COMPL_KEYWORD, COMPL_STATIC_ARRAY, NULL, NULL },
     { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
 
@@ -450,11 +455,71 @@ completion_word create_retention_completion[]
 = { { "POLICY", COMPL_KEYWORD, COMPL_STATIC_ARRAY, create_retention_ident, NULL },
     { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
 
+completion_word schedule_priority_compl[]
+= { { "PRIORITY", COMPL_KEYWORD, COMPL_STATIC_ARRAY, NULL, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word schedule_jitter_unit_compl[]
+= { { "MINUTES", COMPL_KEYWORD, COMPL_STATIC_ARRAY, schedule_priority_compl, NULL },
+    { "HOURS", COMPL_KEYWORD, COMPL_STATIC_ARRAY, schedule_priority_compl, NULL },
+    { "DAYS", COMPL_KEYWORD, COMPL_STATIC_ARRAY, schedule_priority_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word schedule_nn_jitter_compl[]
+= { { "[0-9]*", COMPL_IDENTIFIER, COMPL_STATIC_ARRAY, schedule_jitter_unit_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word schedule_jitter_compl[]
+= { { "JITTER", COMPL_KEYWORD, COMPL_STATIC_ARRAY, schedule_nn_jitter_compl, NULL },
+    { "PRIORITY", COMPL_KEYWORD, COMPL_STATIC_ARRAY, NULL, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word schedule_interval_unit_compl[]
+= { { "MINUTES", COMPL_KEYWORD, COMPL_STATIC_ARRAY, schedule_jitter_compl, NULL },
+    { "HOURS", COMPL_KEYWORD, COMPL_STATIC_ARRAY, schedule_jitter_compl, NULL },
+    { "DAYS", COMPL_KEYWORD, COMPL_STATIC_ARRAY, schedule_jitter_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word schedule_nn_interval_compl[]
+= { { "[0-9]*", COMPL_IDENTIFIER, COMPL_STATIC_ARRAY, schedule_interval_unit_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word schedule_every_compl[]
+= { { "EVERY", COMPL_KEYWORD, COMPL_STATIC_ARRAY, schedule_nn_interval_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word schedule_profile_ident_compl[]
+= { { "<identifier>", COMPL_IDENTIFIER, COMPL_STATIC_ARRAY, schedule_every_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word schedule_basebackup_compl[]
+= { { "PROFILE", COMPL_KEYWORD, COMPL_STATIC_ARRAY, schedule_profile_ident_compl, NULL },
+    { "EVERY", COMPL_KEYWORD, COMPL_STATIC_ARRAY, schedule_nn_interval_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word create_schedule_type_compl[]
+= { { "BASEBACKUP", COMPL_KEYWORD, COMPL_STATIC_ARRAY, schedule_basebackup_compl, NULL },
+    { "VERIFY", COMPL_KEYWORD, COMPL_STATIC_ARRAY, schedule_every_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word create_schedule_ident_compl[]
+= { { "<identifier>", COMPL_IDENTIFIER, COMPL_STATIC_ARRAY, create_schedule_type_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word create_schedule_archive_compl[]
+= { { "ARCHIVE", COMPL_KEYWORD, COMPL_STATIC_ARRAY, create_schedule_ident_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word create_schedule_completion[]
+= { { "FOR", COMPL_KEYWORD, COMPL_STATIC_ARRAY, create_schedule_archive_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
 completion_word create_completion[]
 = { { "ARCHIVE", COMPL_KEYWORD, COMPL_STATIC_ARRAY, create_archive_ident_completion, NULL  },
     { "STREAMING", COMPL_KEYWORD, COMPL_STATIC_ARRAY, create_connection_completion, NULL },
     { "BACKUP", COMPL_KEYWORD, COMPL_STATIC_ARRAY, create_backup_profile_completion, NULL },
     { "RETENTION", COMPL_KEYWORD, COMPL_STATIC_ARRAY, create_retention_completion, NULL },
+    { "SCHEDULE", COMPL_KEYWORD, COMPL_STATIC_ARRAY, create_schedule_completion, NULL },
     { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } /* marks end of list */ };
 
 completion_word list_backup_completion[]
@@ -488,6 +553,7 @@ completion_word list_completion[]
     { "BASEBACKUPS", COMPL_KEYWORD, COMPL_STATIC_ARRAY, list_backup_list_completion, NULL },
     { "CONNECTION", COMPL_KEYWORD, COMPL_STATIC_ARRAY, list_connection_for_completion, NULL },
     { "RETENTION", COMPL_KEYWORD, COMPL_STATIC_ARRAY, list_retention_completion, NULL },
+    { "SCHEDULES", COMPL_KEYWORD, COMPL_STATIC_ARRAY, NULL, NULL },
     { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } /* marks end of list */ };
 
 completion_word start_basebackup_opt_force_sysid_upd[]
@@ -581,8 +647,17 @@ completion_word start_completion[]
     { "RECOVERY", COMPL_KEYWORD, COMPL_STATIC_ARRAY, start_recovery_compl, NULL },
     { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
 
+completion_word verify_basebackup_parallel[]
+= { { "PARALLEL", COMPL_KEYWORD, COMPL_STATIC_ARRAY, NULL, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word verify_basebackup_id[]
+= { { "<BASEBACKUP ID>", COMPL_IDENTIFIER, COMPL_STATIC_ARRAY, verify_basebackup_parallel, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
 completion_word verify_archive_options[]
 = { { "CONNECTION", COMPL_KEYWORD, COMPL_STATIC_ARRAY, NULL, NULL },
+    { "BASEBACKUP", COMPL_KEYWORD, COMPL_STATIC_ARRAY, verify_basebackup_id, NULL },
     { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
 
 completion_word verify_archive_ident_completion[]
@@ -637,16 +712,54 @@ completion_word drop_retention_policy_compl[]
 = { { "POLICY", COMPL_KEYWORD, COMPL_STATIC_ARRAY, drop_retention_ident_compl, NULL },
     { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
 
+completion_word drop_schedule_type_compl[]
+= { { "BASEBACKUP", COMPL_KEYWORD, COMPL_STATIC_ARRAY, NULL, NULL },
+    { "VERIFY", COMPL_KEYWORD, COMPL_STATIC_ARRAY, NULL, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word drop_schedule_ident_compl[]
+= { { "<identifier>", COMPL_IDENTIFIER, COMPL_STATIC_ARRAY, drop_schedule_type_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word drop_schedule_archive_compl[]
+= { { "ARCHIVE", COMPL_KEYWORD, COMPL_STATIC_ARRAY, drop_schedule_ident_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word drop_schedule_completion[]
+= { { "FOR", COMPL_KEYWORD, COMPL_STATIC_ARRAY, drop_schedule_archive_compl, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
 completion_word drop_completion[]
 = { { "ARCHIVE", COMPL_KEYWORD, COMPL_STATIC_ARRAY, list_archive_ident_completion, NULL },
     { "STREAMING", COMPL_KEYWORD, COMPL_STATIC_ARRAY, drop_connection_completion, NULL },
     { "BACKUP", COMPL_KEYWORD, COMPL_STATIC_ARRAY, drop_profile_completion, NULL },
     { "BASEBACKUP", COMPL_KEYWORD, COMPL_STATIC_ARRAY, drop_basebackup_completion, NULL },
     { "RETENTION", COMPL_KEYWORD, COMPL_STATIC_ARRAY, drop_retention_policy_compl, NULL },
+    { "SCHEDULE", COMPL_KEYWORD, COMPL_STATIC_ARRAY, drop_schedule_completion, NULL },
     { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
 
+completion_word alter_archive_layout_mode_completion[]
+= { { "SHARDED", COMPL_END, COMPL_STATIC_ARRAY, NULL, NULL },
+    { "FLAT", COMPL_END, COMPL_STATIC_ARRAY, NULL, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word alter_archive_layout_completion[]
+= { { "LAYOUT", COMPL_KEYWORD, COMPL_STATIC_ARRAY, alter_archive_layout_mode_completion, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word alter_archive_cold_directory_completion[]
+= { { "DIRECTORY", COMPL_END, COMPL_STATIC_ARRAY, NULL, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
+completion_word alter_archive_set_param_completion[]
+= { { "DSN", COMPL_END, COMPL_STATIC_ARRAY, NULL,  NULL },
+    { "PGHOST", COMPL_KEYWORD, COMPL_STATIC_ARRAY, param_pgdatabase_completion, NULL },
+    { "LOG", COMPL_KEYWORD, COMPL_STATIC_ARRAY, alter_archive_layout_completion, NULL },
+    { "COLD", COMPL_KEYWORD, COMPL_STATIC_ARRAY, alter_archive_cold_directory_completion, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL,  NULL } };
+
 completion_word alter_archive_set_completion[]
-= { { "SET", COMPL_KEYWORD, COMPL_STATIC_ARRAY, param_start_completion, NULL },
+= { { "SET", COMPL_KEYWORD, COMPL_STATIC_ARRAY, alter_archive_set_param_completion, NULL },
     { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
 
 completion_word alter_archive_ident_completion[]
@@ -709,8 +822,12 @@ completion_word pin_completion[]
     { "<BASEBACKUP ID>", COMPL_KEYWORD, COMPL_STATIC_ARRAY, pin_completion_in, NULL },
     { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
 
+completion_word apply_retention_preview[]
+= { { "PREVIEW", COMPL_END, COMPL_STATIC_ARRAY, NULL, NULL },
+    { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
+
 completion_word apply_retention_archive_name[]
-= { { "<identifier>", COMPL_IDENTIFIER, COMPL_STATIC_ARRAY, NULL, NULL },
+= { { "<identifier>", COMPL_IDENTIFIER, COMPL_STATIC_ARRAY, apply_retention_preview, NULL },
     { "", COMPL_EOL, COMPL_STATIC_ARRAY, NULL, NULL } };
 
 completion_word apply_retention_archive[]
@@ -5,15 +5,88 @@
 #include <daemon.hxx>
 #include <stream.hxx>
 #include <fs-pipe.hxx>
+#include <fs-sync.hxx>
+#include <walindex.hxx>
+#include <objectstorage.hxx>
 #include <output.hxx>
 #include <shm.hxx>
 #include <retention.hxx>
+#include <retentionplan.hxx>
 #include <rtconfig.hxx>
+#include <verifybackup.hxx>
+#include <recovery.hxx>
+#include <restoreplan.hxx>
+#include <walrestore.hxx>
 
 #include <server.hxx>
+#include <bgrndroletype.hxx>
+#include <catalogqueue.hxx>
 
 using namespace pgbckctl;
 
+/*
+ * Import external global variable to tell
+ * in which worker state this module was called.
+ */
+extern BackgroundJobType _pgbckctl_job_type;
+
+namespace pgbckctl {
+
+  /**
+   * Drives a START STREAMING FOR ARCHIVE command instance
+   * from a WALStreamMultiplexer.
+   */
+  class MultiplexedArchiveStream : public MultiplexedWALStream {
+  private:
+
+    std::shared_ptr<StartStreamingForArchiveCommand> cmd = nullptr;
+
+  public:
+
+    MultiplexedArchiveStream(std::shared_ptr<StartStreamingForArchiveCommand> cmd) {
+      this->cmd = cmd;
+    }
+
+    virtual ~MultiplexedArchiveStream() {}
+
+    virtual std::string streamName() { return this->cmd->streamName(); }
+
+    virtual std::shared_ptr<WALStreamerProcess> walStreamer() { return this->cmd->walStreamer(); }
+
+    virtual void startStream() { this->cmd->startStream(); }
+
+    virtual bool streamEnded(bool can_continue) { return this->cmd->streamEnded(can_continue); }
+
+    virtual bool stopRequested() { return this->cmd->stopRequested(); }
+
+    virtual void streamFailed(std::string errmsg) { this->cmd->streamFailed(errmsg); }
+
+  };
+
+}
+
+/*
+ * Returns the path of file relative to the archive directory
+ * for its object key, see ObjectUploader::objectKey().
+ */
+static std::string archive_relative_path(const std::string &archive_directory,
+                                         const boost::filesystem::path &file) {
+
+  std::string dir = archive_directory;
+  std::string path = file.string();
+
+  while (dir.length() > 1 && dir[dir.length() - 1] == '/')
+    dir.erase(dir.length() - 1);
+
+  if (path.compare(0, dir.length(), dir) == 0
+      && path.length() > dir.length()
+      && path[dir.length()] == '/')
+    return path.substr(dir.length() + 1);
+
+  return file.filename().string();
+
+}
+
 BaseCatalogCommand::~BaseCatalogCommand() {}
 
 void BaseCatalogCommand::copy(CatalogDescr& source) {
@@ -30,8 +103,13 @@ void BaseCatalogCommand::copy(CatalogDescr& source) {
   this->compression  = source.compression;
   this->directory    = source.directory;
   this->check_connection = source.check_connection;
+  this->verify_workers = source.verify_workers;
+  this->log_layout_sharded = source.log_layout_sharded;
+  this->cold_directory = source.cold_directory;
+  this->retention_preview = source.retention_preview;
   this->force_systemid_update = source.force_systemid_update;
   this->forceXLOGPosRestart = source.forceXLOGPosRestart;
+  this->stream_archive_names = source.stream_archive_names;
   this->verbose_output = source.verbose_output;
 
   /*
@@ -105,6 +183,14 @@ void BaseCatalogCommand::copy(CatalogDescr& source) {
   if (source.getRecoveryStreamDescr() != nullptr)
     this->recoveryStream = source.getRecoveryStreamDescr();
 
+  /* Schedule descriptor, if defined */
+  if (source.getScheduleDescr() != nullptr)
+    this->schedule = source.getScheduleDescr();
+
+  /* Object storage descriptor, if defined */
+  if (source.getArchiveStorageDescr() != nullptr)
+    this->storage = source.getArchiveStorageDescr();
+
   /*
    * In case this instance was instantiated
    * by a SET <variable> parser command, copy
@@ -154,21 +240,393 @@ void BaseCatalogCommand::assignSigIntHandler(JobSignalHandler *handler) {
 
 RestoreFromArchiveCommandHandle::RestoreFromArchiveCommandHandle(std::shared_ptr<BackupCatalog> catalog) {
 
+  this->catalog = catalog;
+  this->tag = RESTORE_BACKUP;
+
 }
 
 RestoreFromArchiveCommandHandle::RestoreFromArchiveCommandHandle(std::shared_ptr<CatalogDescr> descr) {
 
+  this->copy(*(descr.get()));
+  this->tag = RESTORE_BACKUP;
+
 }
 
+RestoreFromArchiveCommandHandle::RestoreFromArchiveCommandHandle() {
+
+  this->tag = RESTORE_BACKUP;
+
+}
 
 RestoreFromArchiveCommandHandle::~RestoreFromArchiveCommandHandle() {
 
 }
 
+void RestoreFromArchiveCommandHandle::printPlan(std::shared_ptr<RestorePlan> plan) {
+
+  ostringstream oss;
+
+  oss << "restore plan for archive \"" << this->archive_name << "\"" << endl;
+
+  switch (plan->target_type) {
+  case RESTORE_TARGET_TIME:
+    oss << "recovery target time: " << plan->target << endl;
+    break;
+  case RESTORE_TARGET_LSN:
+    oss << "recovery target LSN: " << plan->target << endl;
+    break;
+  default:
+    oss << "recovery target: latest" << endl;
+    break;
+  }
+
+  oss << "recovery target timeline: " << plan->timeline << endl;
+
+  if (plan->target_type != RESTORE_TARGET_LSN && plan->target_lsn != InvalidXLogRecPtr) {
+
+    oss << (plan->target_lsn_estimated ? "estimated target LSN: " : "end of archived WAL: ")
+        << PGStream::encodeXLOGPos(plan->target_lsn) << endl;
+
+  }
+
+  oss << "candidates:" << endl;
+
+  for (auto &candidate : plan->candidates) {
+
+    oss << ((candidate == plan->chosen) ? "* " : "  ")
+        << "id " << candidate->basebackup->id
+        << ", timeline " << candidate->basebackup->timeline
+        << ", stopped " << (candidate->basebackup->stopped.length() > 0
+                            ? candidate->basebackup->stopped : "N/A");
+
+    if (candidate->usable()) {
+
+      oss << ", extract " << (candidate->extract_bytes / (1024 * 1024)) << " MB"
+          << (candidate->incremental()
+              ? " (chain of " + std::to_string(candidate->chain.size()) + ")"
+              : std::string(""))
+          << ", replay " << (candidate->wal_bytes / (1024 * 1024)) << " MB"
+          << " (" << candidate->wal_segments << " segments)"
+          << ", cost " << (unsigned long long) candidate->cost << "s";
+
+    } else {
+      oss << ", not usable: " << candidate->reason;
+    }
+
+    oss << endl;
+
+  }
+
+  if (plan->feasible()) {
+
+    oss << "chosen basebackup: " << plan->chosen->basebackup->id << endl;
+    oss << "WAL replay: " << PGStream::encodeXLOGPos(plan->chosen->wal_start)
+        << " - " << PGStream::encodeXLOGPos(plan->chosen->wal_end) << endl;
+    oss << "estimated duration: " << (unsigned long long) plan->estimatedDuration() << "s"
+        << " (extract " << (plan->extract_rate / (1024 * 1024)) << " MB/s"
+        << ", replay " << (plan->replay_rate / (1024 * 1024)) << " MB/s)" << endl;
+
+  } else {
+    oss << "no basebackup can be restored to the recovery target" << endl;
+  }
+
+  cout << oss.str();
+
+}
+
 void RestoreFromArchiveCommandHandle::execute(bool noop) {
 
-  if (this->restoreDescr != nullptr)
-    cout << "descriptor!" << endl;
+  std::shared_ptr<CatalogDescr> archive_descr   = nullptr;
+  std::shared_ptr<BaseBackupDescr> backup_descr = nullptr;
+  std::shared_ptr<RestorePlan> plan = nullptr;
+  std::shared_ptr<WALRangeRestore> walrestore = nullptr;
+
+  /* Catalog access required */
+  if (catalog == NULL) {
+    throw CArchiveIssue("could not execute restore command: no catalog");
+  }
+
+  if (this->restoreDescr == nullptr) {
+    throw CArchiveIssue("could not execute restore command: no restore descriptor");
+  }
+
+  /*
+   * Open the catalog if not done yet, read only access is sufficient.
+   */
+  if (!catalog->available()) {
+    catalog->open_ro();
+  }
+
+  archive_descr = catalog->existsByName(this->archive_name);
+
+  if (archive_descr->id < 0) {
+
+    std::ostringstream oss;
+    oss << "archive \"" << this->archive_name << "\" does not exist";
+    throw CArchiveIssue(oss.str());
+
+  }
+
+  /*
+   * The basebackup is either specified by its ID, by one of the
+   * keywords LATEST, NEWEST, CURRENT or OLDEST or chosen for the
+   * recovery target by the planner.
+   */
+  if (this->restoreDescr->id.type == RESTORE_BASEBACKUP_BY_TARGET) {
+
+    RestorePlanner planner(this->catalog, archive_descr);
+
+    if (this->runtime_config != nullptr) {
+
+      int extract_rate = 0;
+      int replay_rate = 0;
+
+      this->runtime_config->get("restore.extract_rate")->getValue(extract_rate);
+      this->runtime_config->get("restore.replay_rate")->getValue(replay_rate);
+
+      planner.setRates((unsigned long long) extract_rate * 1024 * 1024,
+                       (unsigned long long) replay_rate * 1024 * 1024);
+
+    }
+
+    plan = planner.plan(this->restoreDescr);
+    this->printPlan(plan);
+
+    if (this->restoreDescr->preview)
+      return;
+
+    if (!plan->feasible()) {
+      throw CArchiveIssue("no basebackup in archive \"" + this->archive_name
+                          + "\" can be restored to the recovery target");
+    }
+
+    if (plan->chosen->incremental()) {
+
+      std::ostringstream oss;
+
+      oss << "basebackup " << plan->chosen->basebackup->id << " is incremental, "
+          << "restore the basebackups of its chain and combine them with pg_combinebackup";
+      throw CArchiveIssue(oss.str());
+
+    }
+
+    backup_descr = plan->chosen->basebackup;
+
+    /* Don't extract anything we can't configure recovery for */
+    if (plan->target_type == RESTORE_TARGET_LSN
+        && backup_descr->pg_version_num > 0
+        && backup_descr->pg_version_num < 100000) {
+      throw CArchiveIssue("recovery target LSN requires PostgreSQL 10 or above");
+    }
+
+  } else if (this->restoreDescr->id.type == RESTORE_BASEBACKUP_BY_ID) {
+
+    int id;
+
+    this->restoreDescr->id.getId(id);
+    backup_descr = catalog->getBaseBackup(id, archive_descr->id);
+
+  } else {
+
+    std::string name;
+
+    this->restoreDescr->id.getId(name);
+    backup_descr = catalog->getBaseBackup(RestoreDescrID::basebackupRetrieveMode(name),
+                                          archive_descr->id,
+                                          true);
+
+  }
+
+  if (backup_descr->id < 0) {
+
+    std::ostringstream oss;
+    oss << "requested basebackup does not exist in archive \""
+        << this->archive_name << "\"";
+    throw CArchiveIssue(oss.str());
+
+  }
+
+  this->restoreDescr->basebackup = backup_descr;
+
+  if (this->restoreDescr->preview) {
+
+    cout << "would restore basebackup ID " << backup_descr->id
+         << " of archive \"" << this->archive_name << "\""
+         << " to \"" << this->restoreDescr->target_directory << "\"" << endl;
+    return;
+
+  }
+
+  TarRecovery recovery(this->restoreDescr);
+
+  if (this->runtime_config != nullptr) {
+
+    std::string method;
+    int parallelism = 0;
+    int sync_parallelism = 0;
+    int queue_depth = 0;
+
+    this->runtime_config->get("restore.parallelism")->getValue(parallelism);
+    this->runtime_config->get("restore.queue_depth")->getValue(queue_depth);
+    this->runtime_config->get("recursive_sync.method")->getValue(method);
+    this->runtime_config->get("recursive_sync.parallelism")->getValue(sync_parallelism);
+
+    recovery.setParallelism(parallelism);
+    recovery.setQueueDepth(queue_depth);
+    recovery.setSyncMethod(method, sync_parallelism);
+
+  }
+
+  /*
+   * With a recovery target, the WAL to replay is known already.
+   * Restore it into pg_wal while the basebackup is extracted, so
+   * recovery finds it locally.
+   */
+  if (plan != nullptr) {
+
+    bool prepare_wal = true;
+    int wal_parallelism = WALRestore::DEFAULT_PARALLELISM;
+
+    if (this->runtime_config != nullptr) {
+      this->runtime_config->get("restore.prepare_wal")->getValue(prepare_wal);
+      this->runtime_config->get("restore.wal_parallelism")->getValue(wal_parallelism);
+    }
+
+    if (prepare_wal) {
+
+      walrestore = std::make_shared<WALRangeRestore>(std::make_shared<BackupDirectory>(path(archive_descr->directory))->logdirectory(),
+                                                     WALRangeRestore::walDirectory(path(this->restoreDescr->target_directory),
+                                                                                   backup_descr->pg_version_num),
+                                                     backup_descr->wal_segment_size);
+      walrestore->setParallelism(wal_parallelism);
+
+    }
+
+  }
+
+  /*
+   * Report progress and stop extracting if we were
+   * interrupted.
+   */
+  recovery.setProgressCallback([this, &recovery, walrestore](const TarRecoveryProgress &progress) {
+
+      if (this->intHandler != nullptr && this->intHandler->check()) {
+
+        recovery.abort();
+
+        if (walrestore != nullptr)
+          walrestore->abort();
+
+      }
+
+      /* No use extracting the basebackup without its WAL */
+      if (walrestore != nullptr && walrestore->failed())
+        recovery.abort();
+
+      BOOST_LOG_TRIVIAL(info) << "restored " << (progress.bytes / (1024 * 1024)) << " MB"
+                              << ((progress.bytes_total > 0)
+                                  ? " of " + std::to_string(progress.bytes_total / (1024 * 1024)) + " MB"
+                                  : std::string(""))
+                              << ", " << progress.files << " files, "
+                              << (progress.throughput / (1024 * 1024)) << " MB/s"
+                              << ((progress.eta.count() >= 0)
+                                  ? ", ETA " + std::to_string(progress.eta.count()) + "s"
+                                  : std::string(""))
+                              << ((walrestore != nullptr)
+                                  ? ", WAL " + std::to_string(walrestore->countRestored())
+                                  + " of " + std::to_string(walrestore->countSegments()) + " segments"
+                                  : std::string(""));
+
+    }, std::chrono::milliseconds(5000));
+
+  if (noop)
+    return;
+
+  recovery.init();
+
+  if (walrestore != nullptr)
+    walrestore->start(plan->chosen->wal_files, plan->historyFiles());
+
+  try {
+    recovery.start();
+  } catch(CArchiveIssue &e) {
+
+    /*
+     * Stop restoring WAL as well. If restoring WAL failed first, it
+     * aborted the extraction and its error is the one to report.
+     */
+    if (walrestore != nullptr) {
+
+      bool wal_failed = walrestore->failed();
+
+      walrestore->abort();
+
+      try {
+        walrestore->wait();
+      } catch(CArchiveIssue &we) {
+
+        if (wal_failed)
+          throw we;
+
+      }
+
+    }
+
+    throw e;
+
+  }
+
+  if (walrestore != nullptr)
+    walrestore->wait();
+
+  /*
+   * Without a recovery target in the configuration, the instance
+   * would replay everything it finds. restore_command fetches WAL through
+   * the restore-wal action; WAL restored above is taken from pg_wal
+   * first, so it mustn't be prefetched away.
+   */
+  if (plan != nullptr) {
+
+    std::ostringstream restore_command;
+    char exe[PATH_MAX];
+    ssize_t exe_len = ::readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+
+    restore_command << "\"" << ((exe_len > 0) ? std::string(exe, exe_len) : std::string("pg_backup_ctl++")) << "\""
+                    << " --catalog \"" << catalog->fullname() << "\""
+                    << " --archive-name \"" << this->archive_name << "\""
+                    << " --action restore-wal --wal-file %f --wal-target %p";
+
+    if (walrestore != nullptr) {
+      restore_command << " --spool-directory "
+                      << WALRangeRestore::walDirectory(path("."), backup_descr->pg_version_num).string()
+                      << " --prefetch 0";
+    }
+
+    plan->writeRecoveryConfig(path(this->restoreDescr->target_directory),
+                              backup_descr->pg_version_num,
+                              restore_command.str());
+
+  }
+
+  cout << "restored basebackup ID " << backup_descr->id
+       << " of archive \"" << this->archive_name << "\""
+       << " to \"" << this->restoreDescr->target_directory << "\"" << endl;
+
+  if (walrestore != nullptr) {
+
+    cout << "restored " << walrestore->countSegments() << " WAL segments "
+         << PGStream::encodeXLOGPos(plan->chosen->wal_start)
+         << " - " << PGStream::encodeXLOGPos(plan->chosen->wal_end)
+         << " to \"" << WALRangeRestore::walDirectory(path(this->restoreDescr->target_directory),
+                                                      backup_descr->pg_version_num).string()
+         << "\"" << endl;
+
+  }
+
+  if (plan != nullptr) {
+    cout << "recovery target written to the configuration in \""
+         << this->restoreDescr->target_directory << "\"" << endl;
+  }
 
 }
 
@@ -253,6 +711,18 @@ void DropBasebackupCatalogCommand::execute(bool flag) {
       throw CArchiveIssue(oss.str());
     }
 
+    /*
+     * Incremental basebackups taken against this basebackup
+     * can't be restored without it, refuse to drop it.
+     */
+    if (this->catalog->getDependentBasebackups(bbDescr->id).size() > 0) {
+      std::ostringstream oss;
+
+      oss << "basebackup with ID \"" << bbDescr->id
+          << "\" is required by incremental basebackups";
+      throw CArchiveIssue(oss.str());
+    }
+
     /*
      * Referenced archive and basebackup exist, unlink the physical
      * files associated with the current basebackup descriptor.
@@ -265,6 +735,8 @@ void DropBasebackupCatalogCommand::execute(bool flag) {
      * this issue and proceed, but print a WARNING indicating that there was an
      * orphaned catalog entry.
      */
+    DedupChunkStore::release(this->catalog, archiveDescr->id, bbDescr);
+
     try {
 
       BackupDirectory::unlink_path(path(bbDescr->fsentry));
@@ -281,6 +753,13 @@ void DropBasebackupCatalogCommand::execute(bool flag) {
 
     this->catalog->deleteBaseBackup(bbDescr->id);
 
+    /*
+     * Chunks of a deduplicated basebackup might not be
+     * needed by any other basebackup anymore.
+     */
+    DedupChunkStore(DedupChunkStore::forArchive(path(archiveDescr->directory))).sweep(this->catalog,
+                                                                                      archiveDescr->id);
+
     /* And we're done */
     this->catalog->commitTransaction();
 
@@ -565,7 +1044,7 @@ void StartRecoveryArchiveCommand::execute(bool flag) {
     shm.attach(this->catalog->fullname(), true);
 
     {
-      boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex>(*(shm.check_and_get_mutex()));
+      boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> shm_lock(*(shm.check_and_get_mutex()));
       worker_slot_index = shm.allocate(wa);
       this->worker_id = worker_slot_index;
       streamDescr->worker_id = this->worker_id;
@@ -590,6 +1069,19 @@ void StartRecoveryArchiveCommand::execute(bool flag) {
 
   }
 
+  if (this->runtime_config != nullptr) {
+
+    int connection_threads = 4;
+    int wal_cache_size = 64;
+
+    this->runtime_config->get("recovery.connection_threads")->getValue(connection_threads);
+    streamDescr->connection_threads = connection_threads;
+
+    this->runtime_config->get("recovery.wal_cache_size")->getValue(wal_cache_size);
+    streamDescr->wal_cache_size = wal_cache_size;
+
+  }
+
   /*
    * Start the background streaming server for the specified archive.
    */
@@ -773,70 +1265,117 @@ void ShowWorkersCommandHandle::execute(bool noop) {
    * area for background workers.
    *
    * We fetch all occupied worker shared memory
-   * slots into a local vector in one step to avoid
-   * doing catalog lookups while holding the shared memory
-   * lock.
+   * slots into a local vector in one step. WorkerSHM::read()
+   * doesn't lock, so we never block the launcher or workers
+   * updating their slots.
    */
   WorkerSHM shm;
-  vector<shm_worker_area> slots_used;
+  shared_ptr<OutputFormatConfiguration> output_config
+    = std::make_shared<OutputFormatConfiguration>();
+  shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(output_config,
+                                                                     catalog,
+                                                                     getOutputFormat());
 
   shm.attach(this->catalog->fullname(), true);
 
   /*
-   * New scope for scoped_lock...
+   * Every occupied slot is printed as soon as it's read. Since
+   * WorkerSHM::read() doesn't lock, we can do whatever we want
+   * in between.
    */
-  {
-    boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex>(*(shm.check_and_get_mutex()));
-    for (unsigned int i = 0; i < shm.getMaxWorkers(); i++) {
-
-      try {
-
-        shm_worker_area worker = shm.read(i);
+  formatter->beginList(OUTPUT_LIST_WORKERS, cout);
 
-        if (worker.pid > 0) {
+  for (unsigned int i = 0; i < shm.getMaxWorkers(); i++) {
 
-          slots_used.push_back(worker);
-
-        }
+    shm_worker_area worker = shm.read(i);
 
-      } catch(SHMFailure &e) {
+    if (worker.pid > 0) {
 
-        throw e;
-      }
+      formatter->row(worker, cout);
 
     }
+
   }
 
+  formatter->endList(cout);
+
   shm.detach();
 
-  /*
-   * Now it's time to print the contents. We can do
-   * whatever we want now, since no critical locks
-   * are held.
-   */
-  shared_ptr<OutputFormatConfiguration> output_config
-    = std::make_shared<OutputFormatConfiguration>();
-  shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(output_config,
-                                                                     catalog,
-                                                                     getOutputFormat());
-  ostringstream output;
-  formatter->nodeAs(slots_used, output);
-  cout << output.str();
+}
 
+ShowStreamStatisticsCommandHandle::ShowStreamStatisticsCommandHandle(std::shared_ptr<BackupCatalog> catalog) {
+  this->tag = SHOW_STREAM_STATISTICS;
+  this->catalog = catalog;
 }
 
-ExecCommandCatalogCommand::ExecCommandCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+ShowStreamStatisticsCommandHandle::ShowStreamStatisticsCommandHandle(std::shared_ptr<CatalogDescr> descr) {
 
   this->copy(*(descr.get()));
 
 }
 
-ExecCommandCatalogCommand::ExecCommandCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
-  this->setCommandTag(tag);
-  this->catalog = catalog;
-}
+ShowStreamStatisticsCommandHandle::ShowStreamStatisticsCommandHandle(){}
 
-void ExecCommandCatalogCommand::execute(bool flag) {
+ShowStreamStatisticsCommandHandle::~ShowStreamStatisticsCommandHandle() {}
+
+void ShowStreamStatisticsCommandHandle::execute(bool noop) {
+
+  /*
+   * Statistics are published by the WAL streamers into their
+   * worker slots. Both, the slot pid and the statistics, can
+   * be read without holding the shared memory lock. Archive names
+   * are part of the statistics, so no catalog lookups are required
+   * either.
+   */
+  WorkerSHM shm;
+
+  if (!shm.attach(this->catalog->fullname(), true)) {
+    throw CArchiveIssue("could not attach to worker shared memory area, launcher not running?");
+  }
+
+  shared_ptr<OutputFormatConfiguration> output_config
+    = std::make_shared<OutputFormatConfiguration>();
+  shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(output_config,
+                                                                     catalog,
+                                                                     getOutputFormat());
+
+  formatter->beginList(OUTPUT_LIST_STREAMS, cout);
+
+  for (unsigned int i = 0; i < shm.getMaxWorkers(); i++) {
+
+    shm_stream_stats stats;
+
+    if (shm.isEmpty(i))
+      continue;
+
+    stats = shm.readStreamStats(i);
+
+    /* nothing published yet or stale */
+    if (stats.pid <= 0)
+      continue;
+
+    formatter->row(stats, cout);
+
+  }
+
+  formatter->endList(cout);
+
+  shm.detach();
+
+}
+
+ExecCommandCatalogCommand::ExecCommandCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+
+}
+
+ExecCommandCatalogCommand::ExecCommandCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
+  this->setCommandTag(tag);
+  this->catalog = catalog;
+}
+
+void ExecCommandCatalogCommand::execute(bool flag) {
 
   shared_ptr<OutputFormatter> formatter
     = OutputFormatter::formatter(make_shared<OutputFormatConfiguration>(),
@@ -1239,6 +1778,38 @@ void StartLauncherCatalogCommand::execute(bool flag) {
    */
   job_info.cmdHandle = std::make_shared<BackgroundWorkerCommandHandle>(this->catalog);
 
+  /*
+   * Number of pre-forked pool workers, see WorkerPool.
+   */
+  if (this->runtime_config != nullptr) {
+
+    int worker_pool_size = 0;
+
+    this->runtime_config->get("launcher.worker_pool_size")->getValue(worker_pool_size);
+    job_info.worker_pool_size = worker_pool_size;
+
+    int schedule_limit = 0;
+
+    this->runtime_config->get("launcher.max_basebackups")->getValue(schedule_limit);
+    job_info.schedule_max_basebackups = schedule_limit;
+
+    this->runtime_config->get("launcher.max_verifies")->getValue(schedule_limit);
+    job_info.schedule_max_verifies = schedule_limit;
+
+    this->runtime_config->get("launcher.schedule_stagger")->getValue(schedule_limit);
+    job_info.schedule_stagger = schedule_limit;
+
+    this->runtime_config->get("launcher.schedule_max_wal_lag")->getValue(schedule_limit);
+    job_info.schedule_max_wal_lag = schedule_limit;
+
+    int metrics_port = 0;
+
+    this->runtime_config->get("launcher.metrics_port")->getValue(metrics_port);
+    job_info.metrics_port = metrics_port;
+    this->runtime_config->get("launcher.metrics_address")->getValue(job_info.metrics_address);
+
+  }
+
   /*
    * Finally launch the background worker.
    */
@@ -1299,6 +1870,11 @@ void StopStreamingForArchiveCommandHandle::execute(bool noop) {
    */
   pid_t archive_pid = -1;
 
+  /*
+   * Set if the archive is streamed by a multiplexed worker.
+   */
+  bool multiplexed = false;
+
   /*
    * Shared memory handle.
    */
@@ -1336,6 +1912,16 @@ void StopStreamingForArchiveCommandHandle::execute(bool noop) {
 
         /* Matching archive ID, store it away and exit loop */
         archive_pid = worker_info.pid;
+
+        /*
+         * A multiplexed worker streams other archives too, so just
+         * ask it to stop the stream of this archive.
+         */
+        if (worker_info.multiplexed) {
+          shmhandle.requestStop(i);
+          multiplexed = true;
+        }
+
         break;
 
       }
@@ -1354,7 +1940,9 @@ void StopStreamingForArchiveCommandHandle::execute(bool noop) {
   shmhandle.unlock();
   shmhandle.detach();
 
-  if (archive_pid > 0) {
+  if (archive_pid > 0 && multiplexed) {
+    BOOST_LOG_TRIVIAL(info) << "requested multiplexed worker pid " << archive_pid << " to stop streaming archive " << temp_descr->archive_name << endl;
+  } else if (archive_pid > 0) {
     ::kill(archive_pid, SIGTERM);
     BOOST_LOG_TRIVIAL(info) << "terminated worker pid " << archive_pid << " for archive " << temp_descr->archive_name << endl;
   } else {
@@ -1376,6 +1964,9 @@ StartStreamingForArchiveCommand::StartStreamingForArchiveCommand(std::shared_ptr
 
 StartStreamingForArchiveCommand::~StartStreamingForArchiveCommand() {
 
+  /* the WAL streamer references the connection of pgstream */
+  this->walstreamer = nullptr;
+
   if (this->pgstream != nullptr) {
 
     if (this->pgstream->connected())
@@ -1674,10 +2265,63 @@ void StartStreamingForArchiveCommand::prepareStream() {
 
 }
 
+bool StartStreamingForArchiveCommand::queueStreamCatalogStatus(StreamIdentification &ident) {
+
+  /*
+   * Only background workers forked by a launcher have got
+   * someone to talk to.
+   */
+  if (_pgbckctl_job_type != BACKGROUND_WORKER)
+    return false;
+
+  /*
+   * The shutdown status goes through the queue as well, so it is
+   * ordered after STREAMING updates still queued, which would
+   * overwrite it otherwise. See updateStreamCatalogStatus().
+   */
+
+  /*
+   * Don't queue anything if our launcher went away, the queue
+   * isn't consumed anymore then.
+   */
+  if (this->status_queue != nullptr
+      && getppid() != this->status_queue_launcher) {
+    this->status_queue = nullptr;
+    return false;
+  }
+
+  if (this->status_queue == nullptr) {
+
+    std::shared_ptr<CatalogStatusQueue> queue
+      = std::make_shared<CatalogStatusQueue>(this->catalog->name());
+
+    if (!queue->attach())
+      return false;
+
+    this->status_queue = queue;
+    this->status_queue_launcher = getppid();
+
+  }
+
+  return this->status_queue->send(ident);
+
+}
+
 void StartStreamingForArchiveCommand::updateStreamCatalogStatus(StreamIdentification &ident) {
 
   std::vector<int> affectedAttrs;
 
+  /*
+   * The shutdown status tells the next START STREAMING whether the
+   * stream was stopped cleanly. Once queued, it is written directly,
+   * too, in case the launcher already did its final flush: anything
+   * queued before it is either flushed already or superseded by the
+   * queued copy.
+   */
+  if (this->queueStreamCatalogStatus(ident)
+      && ident.status != StreamIdentification::STREAM_PROGRESS_SHUTDOWN)
+    return;
+
   affectedAttrs.clear();
   affectedAttrs.push_back(SQL_STREAM_XLOGPOS_ATTNO);
   affectedAttrs.push_back(SQL_STREAM_TIMELINE_ATTNO);
@@ -1691,94 +2335,179 @@ void StartStreamingForArchiveCommand::updateStreamCatalogStatus(StreamIdentifica
 
 }
 
-void StartStreamingForArchiveCommand::finalizeStream() {
+void StartStreamingForArchiveCommand::initArchiveWALStats() {
 
-  /* this is a no-op yet */
+  std::shared_ptr<ArchiveStatsDescr> stats = nullptr;
+  unsigned long long wal_segment_size = this->pgstream->getWalSegmentSize();
 
-}
+  this->catalog->startTransaction();
 
-void StartStreamingForArchiveCommand::execute(bool noop) {
-  /*
-   * Die hard in case launcher process is not running.
-   */
-  shared_ptr<CatalogProc> procInfo = catalog->getProc(
-    -1,
-    CatalogProc::PROC_TYPE_LAUNCHER
-  );
+  try {
 
-  if (!launcher_is_running(procInfo)) {
-    throw CArchiveIssue("could not execute catalog command: launcher not running");
-  }
+    stats = this->catalog->getArchiveStats(this->temp_descr->id);
+
+    /*
+     * Statistics are maintained incrementally once they exist,
+     * so the log directory is looked at only the very first time
+     * an archive is streamed into. The segment index answers this
+     * without opening any segment file.
+     */
+    if (stats->archive_id < 0) {
+
+      std::vector<WALSegmentIndexEntry> entries
+        = this->logdir->segmentIndex(wal_segment_size)->getEntries();
+      bool first = true;
+
+      stats->archive_id = this->temp_descr->id;
+
+      for (auto &entry : entries) {
+
+        XLogRecPtr pos = InvalidXLogRecPtr;
+        boost::system::error_code ec;
+        unsigned long long size = 0;
+
+        /* partial segments are accounted once they are completed */
+        if (entry.status != WAL_SEGMENT_COMPLETE
+            && entry.status != WAL_SEGMENT_COMPLETE_COMPRESSED)
+          continue;
+
+        /*
+         * The index records uncompressed sizes, but statistics
+         * are about the space occupied within the archive.
+         */
+        size = file_size(this->logdir->getPath() / entry.filename, ec);
+
+        if (ec)
+          size = entry.size;
+
+        /* entries are ordered by segment number */
+        if (first) {
+
+          pos = entry.segno * wal_segment_size;
+          stats->oldest_xlogpos = PGStream::encodeXLOGPos(pos);
+          first = false;
+
+        }
+
+        pos = (entry.segno + 1) * wal_segment_size;
+        stats->newest_xlogpos = PGStream::encodeXLOGPos(pos);
+
+        stats->wal_segments++;
+        stats->wal_bytes += size;
+
+      }
+
+      this->catalog->setArchiveWALStats(stats);
+
+    }
+
+    this->catalog->commitTransaction();
+
+  } catch (CPGBackupCtlFailure &e) {
+
+    this->catalog->rollbackTransaction();
+
+    /* statistics aren't worth to stop streaming for */
+    BOOST_LOG_TRIVIAL(warning) << "could not initialize archive statistics: " << e.what();
 
-  /*
-   * Die hard in case no catalog available.
-   */
-  if (this->catalog == nullptr) {
-    throw CArchiveIssue("could not execute catalog command: no catalog");
   }
 
-  if (!this->catalog->available()) {
-    this->catalog->open_rw();
+}
+
+void StartStreamingForArchiveCommand::recordCompletedSegment(const CompletedWALSegment &segment) {
+
+  std::lock_guard<std::mutex> guard(this->stats_mtx);
+
+  try {
+
+    if (this->stats_catalog == nullptr) {
+      this->stats_catalog = std::make_shared<BackupCatalog>(this->catalog->fullname());
+    }
+
+    this->stats_catalog->startTransaction();
+
+    try {
+
+      this->stats_catalog->updateArchiveWALStats(this->temp_descr->id,
+                                                 segment.size,
+                                                 1,
+                                                 PGStream::encodeXLOGPos(segment.start),
+                                                 PGStream::encodeXLOGPos(segment.end));
+
+      /* Queue the segment for upload, if the archive has an object storage */
+      if (segment.path.length() > 0) {
+
+        std::shared_ptr<ArchiveStorageDescr> storage
+          = this->stats_catalog->getArchiveStorage(this->temp_descr->id);
+
+        if (storage->archive_id >= 0) {
+
+          std::shared_ptr<UploadDescr> upload = std::make_shared<UploadDescr>();
+
+          upload->archive_id = this->temp_descr->id;
+          upload->kind = UPLOAD_WAL;
+          upload->path = segment.path;
+          upload->object_key
+            = ObjectUploader::objectKey(storage,
+                                        archive_relative_path(this->temp_descr->directory,
+                                                              segment.path));
+          upload->size = segment.size;
+          this->stats_catalog->queueUpload(upload);
+
+        }
+
+      }
+
+      this->stats_catalog->commitTransaction();
+
+    } catch (CPGBackupCtlFailure &e) {
+
+      this->stats_catalog->rollbackTransaction();
+      throw e;
+
+    }
+
+  } catch (CPGBackupCtlFailure &e) {
+
+    BOOST_LOG_TRIVIAL(warning) << "could not update archive statistics or upload queue for segment "
+                               << segment.filename << ": " << e.what();
+
   }
 
-  /*
-   * IMPORTANT:
-   *
-   * Don't employ transactions here! Status updates will
-   * be lost otherwise!
-   */
+}
 
-  /*
-   * Check, if archive exists.
-   */
-  temp_descr = this->catalog->existsByName(this->archive_name);
+void StartStreamingForArchiveCommand::finalizeStream() {
 
-  if (temp_descr->id < 0) {
+  /* this is a no-op yet */
+
+}
+
+std::shared_ptr<CatalogDescr> StartStreamingForArchiveCommand::lookupArchive(std::string archive_name) {
+
+  std::shared_ptr<CatalogDescr> descr = this->catalog->existsByName(archive_name);
+
+  if (descr->id < 0) {
     /*
      * Don't need to rollback, outer exception handler will do this
      */
     std::ostringstream oss;
     oss << "archive\""
-        << this->archive_name
+        << archive_name
         << "\" does not exist";
 
     throw CCatalogIssue(oss.str());
   }
 
-  /*
-   * Check if we are supposed to run a background streaming
-   * process via launcher.
-   */
-  if (this->detach) {
-
-    job_info jobDescr;
-
-    /*
-     * Rebuild the command from scratch.
-     */
-    std::string archive_name = this->archive_name;
-    std::ostringstream cmd_str;
-
-    BOOST_LOG_TRIVIAL(info) << "DETACHING requested";
-
-    cmd_str << "START STREAMING FOR ARCHIVE "
-            << archive_name;
-
-    if (this->forceXLOGPosRestart) {
-      cmd_str << " RESTART";
-    }
+  return descr;
 
-    /* Make sure background worker won't detach again ... */
-    cmd_str << " NODETACH";
+}
 
-    /* Assign a dummy catalog command handle to the job descriptor */
-    jobDescr.cmdHandle = std::make_shared<BackgroundWorkerCommandHandle>(this->catalog);
-    establish_launcher_cmd_queue(jobDescr);
-    send_launcher_cmd(jobDescr, cmd_str.str());
+void StartStreamingForArchiveCommand::setupStream() {
 
-    /* All done, we should exit this command handler */
-    return;
+  XLogRecPtr startpos = InvalidXLogRecPtr;
 
+  if (this->temp_descr == nullptr) {
+    this->temp_descr = this->lookupArchive(this->archive_name);
   }
 
   /*
@@ -1798,937 +2527,2753 @@ void StartStreamingForArchiveCommand::execute(bool noop) {
   /* Make sure target directories exists */
   this->archivedir->create();
 
-  /* prepare stream and start streaming */
-  try {
-
-    XLogRecPtr startpos = InvalidXLogRecPtr;
+  /*
+   * Get the streaming connection for this archive. Please note that we
+   * have to fallback to archive default connection.
+   */
 
-    /*
-     * Get the streaming connection for this archive. Please note that we
-     * have to fallback to archive default connection.
-     */
+  temp_descr->coninfo->pushAffectedAttribute(SQL_CON_ARCHIVE_ID_ATTNO);
+  temp_descr->coninfo->pushAffectedAttribute(SQL_CON_TYPE_ATTNO);
+  temp_descr->coninfo->pushAffectedAttribute(SQL_CON_DSN_ATTNO);
+  temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGHOST_ATTNO);
+  temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGPORT_ATTNO);
+  temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGUSER_ATTNO);
+  temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGDATABASE_ATTNO);
 
-    temp_descr->coninfo->pushAffectedAttribute(SQL_CON_ARCHIVE_ID_ATTNO);
-    temp_descr->coninfo->pushAffectedAttribute(SQL_CON_TYPE_ATTNO);
-    temp_descr->coninfo->pushAffectedAttribute(SQL_CON_DSN_ATTNO);
-    temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGHOST_ATTNO);
-    temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGPORT_ATTNO);
-    temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGUSER_ATTNO);
-    temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGDATABASE_ATTNO);
+  /*
+   * We need to try harder here, if anynone has defined a separate
+   * streaming connection for this archive. If no streamer type is found,
+   * switch back to basebackup type and use that.
+   */
+  this->catalog->getCatalogConnection(temp_descr->coninfo,
+                                      temp_descr->id,
+                                      ConnectionDescr::CONNECTION_TYPE_STREAMER);
 
-    /*
-     * We need to try harder here, if anynone has defined a separate
-     * streaming connection for this archive. If no streamer type is found,
-     * switch back to basebackup type and use that.
-     */
+  if (temp_descr->coninfo->archive_id < 0
+      && temp_descr->coninfo->type == ConnectionDescr::CONNECTION_TYPE_UNKNOWN) {
+    /* use archive default connection */
     this->catalog->getCatalogConnection(temp_descr->coninfo,
                                         temp_descr->id,
-                                        ConnectionDescr::CONNECTION_TYPE_STREAMER);
+                                        ConnectionDescr::CONNECTION_TYPE_BASEBACKUP);
+  }
 
-    if (temp_descr->coninfo->archive_id < 0
-        && temp_descr->coninfo->type == ConnectionDescr::CONNECTION_TYPE_UNKNOWN) {
-      /* use archive default connection */
-      this->catalog->getCatalogConnection(temp_descr->coninfo,
-                                          temp_descr->id,
-                                          ConnectionDescr::CONNECTION_TYPE_BASEBACKUP);
-    }
+  BOOST_LOG_TRIVIAL(debug) << "streaming connection DSN " << temp_descr->coninfo->dsn;
 
-    BOOST_LOG_TRIVIAL(debug) << "streaming connection DSN " << temp_descr->coninfo->dsn;
+  /*
+   * Connection definition should be ready now, create PGStream
+   * connection handle and go further.
+   */
+  this->pgstream = new PGStream(temp_descr);
+  pgstream->connect();
 
-    /*
-     * Connection definition should be ready now, create PGStream
-     * connection handle and go further.
-     */
-    std::shared_ptr<WALStreamerProcess> walstreamer = nullptr;
+  /*
+   * Prepare backup handler
+   *
+   * We cannot do this earlier, since we need to
+   * know the WAL segment size of the source instance.
+   */
+  this->backup = make_shared<TransactionLogBackup>(temp_descr);
+  this->backup->setWalSegmentSize(pgstream->getWalSegmentSize());
 
-    this->pgstream = new PGStream(temp_descr);
-    pgstream->connect();
+  /*
+   * Archives with compression enabled get gzip compressed WAL,
+   * unless overridden by walstreamer.compression below.
+   */
+  if (temp_descr->compression)
+    this->backup->setCompression(BACKUP_COMPRESS_TYPE_GZIP);
+
+  if (this->runtime_config != nullptr) {
+
+    bool preallocate = false;
+    bool direct_write = false;
+    int  prealloc_segments = 0;
+    int  sync_interval = 0;
+    int  sync_bytes = 0;
+    std::string sync_method;
+    std::string wal_validate;
+    WALSyncPolicy sync_policy;
+    std::string wal_compression;
+    int compression_level = 0;
+    int compression_frame_blocks = 0;
+
+    this->runtime_config->get("walstreamer.preallocate")->getValue(preallocate);
+    this->runtime_config->get("walstreamer.prealloc_segments")->getValue(prealloc_segments);
+    this->runtime_config->get("walstreamer.sync_interval")->getValue(sync_interval);
+    this->runtime_config->get("walstreamer.sync_bytes")->getValue(sync_bytes);
+    this->runtime_config->get("walstreamer.sync_method")->getValue(sync_method);
+
+    this->backup->setPreallocate(preallocate);
+    this->backup->setPreallocSegments(prealloc_segments);
+
+    this->runtime_config->get("walstreamer.direct_write")->getValue(direct_write);
+    this->backup->setDirectWrite(direct_write);
+
+    this->runtime_config->get("walstreamer.validate")->getValue(wal_validate);
+    this->backup->setValidation(WALPageValidator::modeFromString(wal_validate));
+
+    sync_policy.sync_interval_ms = sync_interval;
+    sync_policy.sync_threshold_bytes = sync_bytes;
+    sync_policy.method = WALSyncPolicy::methodFromString(sync_method);
+    this->backup->setSyncPolicy(sync_policy);
+
+    this->runtime_config->get("walstreamer.compression")->getValue(wal_compression);
+    this->runtime_config->get("walstreamer.compression_level")->getValue(compression_level);
+
+    if (wal_compression != "none") {
+      this->backup->setCompression(BackupProfileDescr::compressionType(wal_compression));
+      this->backup->setCompressionLevel(compression_level);
+    }
 
-    /*
-     * Prepare backup handler
-     *
-     * We cannot do this earlier, since we need to
-     * know the WAL segment size of the source instance.
-     */
-    this->backup = make_shared<TransactionLogBackup>(temp_descr);
-    this->backup->setWalSegmentSize(pgstream->getWalSegmentSize());
-    this->backup->initialize();
+    this->runtime_config->get("walstreamer.compression_frame_blocks")->getValue(compression_frame_blocks);
+    this->backup->setCompressionFrameBlocks(compression_frame_blocks);
 
-    /*
-     * Identify system
-     */
-    pgstream->identify();
+  }
 
-    /*
-     * Since we always want to start from the _beginning_ of
-     * a XLOG segment, we need to setup the current server's
-     * XLOG position to segment start.
-     */
-    BOOST_LOG_TRIVIAL(debug)
-      << "IDENTIFY XLOG says: "
-      << pgstream->streamident.xlogpos;
-    startpos = pgstream->streamident.xlogposDecoded();
-    BOOST_LOG_TRIVIAL(debug)
-      << "IDENTIFY XLOG after decode says: "
-      << PGStream::encodeXLOGPos(startpos);
-    startpos = pgstream->XLOGSegmentStartPosition(startpos);
-    BOOST_LOG_TRIVIAL(debug)
-      << "XLOG start position "
-      << PGStream::encodeXLOGPos(startpos);
-    pgstream->streamident.xlogpos = PGStream::encodeXLOGPos(startpos);
+  this->backup->initialize();
+
+  /*
+   * Maintain the WAL statistics of the archive while streaming.
+   */
+  this->initArchiveWALStats();
+  this->backup->setSegmentCallback([this](const CompletedWALSegment &segment) {
+      this->recordCompletedSegment(segment);
+    });
+
+  /*
+   * Identify system
+   */
+  pgstream->identify();
+
+  /*
+   * Since we always want to start from the _beginning_ of
+   * a XLOG segment, we need to setup the current server's
+   * XLOG position to segment start.
+   */
+  BOOST_LOG_TRIVIAL(debug)
+    << "IDENTIFY XLOG says: "
+    << pgstream->streamident.xlogpos;
+  startpos = pgstream->streamident.xlogposDecoded();
+  BOOST_LOG_TRIVIAL(debug)
+    << "IDENTIFY XLOG after decode says: "
+    << PGStream::encodeXLOGPos(startpos);
+  startpos = pgstream->XLOGSegmentStartPosition(startpos);
+  BOOST_LOG_TRIVIAL(debug)
+    << "XLOG start position "
+    << PGStream::encodeXLOGPos(startpos);
+  pgstream->streamident.xlogpos = PGStream::encodeXLOGPos(startpos);
 
 
 #ifdef __DEBUG_XLOG__
-    BOOST_LOG_TRIVIAL(debug)
-      << "IDENTIFICATION (TLI/XLOGPOS) "
-      << pgstream->streamident.timeline
-      << "/"
-      << pgstream->streamident.xlogpos
-      << " XLOG_SEG_SIZE "
-      << pgstream->getWalSegmentSize()
-      << " SYSID "
-      << pgstream->streamident.systemid;
+  BOOST_LOG_TRIVIAL(debug)
+    << "IDENTIFICATION (TLI/XLOGPOS) "
+    << pgstream->streamident.timeline
+    << "/"
+    << pgstream->streamident.xlogpos
+    << " XLOG_SEG_SIZE "
+    << pgstream->getWalSegmentSize()
+    << " SYSID "
+    << pgstream->streamident.systemid;
 #endif
 
-    /*
-     * Before calling prepareStream() we need to
-     * set the archive_id to the Stream Identification. This
-     * will engage the stream with the archive information.
-     *
-     * After having instantiated the walstreamer, we don't rely anymore
-     * on the information there, since the walstreamer stream identification
-     * is maintained by the streaming instance itself.
-     *
-     * This is just here to setup the initial stream.
-     */
-    pgstream->streamident.stype = ConnectionDescr::CONNECTION_TYPE_STREAMER;
-    pgstream->streamident.archive_id = temp_descr->coninfo->archive_id;
-    pgstream->streamident.status = StreamIdentification::STREAM_PROGRESS_IDENTIFIED;
+  /*
+   * Before calling prepareStream() we need to
+   * set the archive_id to the Stream Identification. This
+   * will engage the stream with the archive information.
+   *
+   * After having instantiated the walstreamer, we don't rely anymore
+   * on the information there, since the walstreamer stream identification
+   * is maintained by the streaming instance itself.
+   *
+   * This is just here to setup the initial stream.
+   */
+  pgstream->streamident.stype = ConnectionDescr::CONNECTION_TYPE_STREAMER;
+  pgstream->streamident.archive_id = temp_descr->coninfo->archive_id;
+  pgstream->streamident.status = StreamIdentification::STREAM_PROGRESS_IDENTIFIED;
 
-    /*
-     * Now prepare the stream.
-     */
-    prepareStream();
+  /*
+   * Now prepare the stream.
+   */
+  prepareStream();
 
-    /*
-     * Create a walstreamer handle.
-     */
-    walstreamer = pgstream->walstreamer();
+  /*
+   * Create a walstreamer handle.
+   */
+  this->walstreamer = pgstream->walstreamer();
 
-    /*
-     * Assign stop handler, this is just a reference
-     * to our own stop handler.
-     */
-    walstreamer->assignStopHandler(this->stopHandler);
+  /*
+   * Assign stop handler, this is just a reference
+   * to our own stop handler.
+   */
+  this->walstreamer->assignStopHandler(this->stopHandler);
 
-    /*
-     * We want the walstreamer to stream into our current log archive.
-     */
-    walstreamer->setBackupHandler(this->backup);
+  /*
+   * We want the walstreamer to stream into our current log archive.
+   */
+  this->walstreamer->setBackupHandler(this->backup);
 
-    /*
-     * Enter infinite loop as long as receive() tells
-     * us that we can continue.
-     */
-    while (1) {
+  /*
+   * Decouple disk writes from the receiver, if requested.
+   */
+  if (this->runtime_config != nullptr) {
+
+    int pipeline_slots = 0;
+
+    this->runtime_config->get("walstreamer.pipeline_slots")->getValue(pipeline_slots);
+
+    if (pipeline_slots == 1) {
+      BOOST_LOG_TRIVIAL(warning) << "walstreamer.pipeline_slots requires at least 2 slots, using 2";
+      pipeline_slots = 2;
+    }
+
+    this->walstreamer->setPipelineSlots(pipeline_slots);
+
+  }
+
+  /*
+   * Publish live statistics of the stream into our worker
+   * shared memory slot, see SHOW STREAM STATISTICS.
+   */
+  if (this->mux_slot >= 0) {
+
+    this->walstreamer->setStatisticsSlot(this->mux_shm, this->mux_slot,
+                                         this->archive_name, this->id);
+
+  } else if (this->worker_id >= 0) {
+
+    std::shared_ptr<WorkerSHM> stats_shm = std::make_shared<WorkerSHM>();
+
+    if (stats_shm->attach(this->catalog->fullname(), true)) {
+      this->walstreamer->setStatisticsSlot(stats_shm, this->worker_id,
+                                           this->archive_name, this->id);
+    } else {
+      BOOST_LOG_TRIVIAL(warning) << "could not attach to worker shared memory, no stream statistics available";
+    }
+
+  }
+
+  this->stream_setup = true;
+
+}
 
-      string historyFilename;
-      StreamIdentification walstreamerIdent;
+void StartStreamingForArchiveCommand::startStream() {
+
+  string historyFilename;
+  StreamIdentification walstreamerIdent;
+
+  if (!this->stream_setup) {
+    this->setupStream();
+  }
 
 #ifdef __DEBUG_XLOG__
-      BOOST_LOG_TRIVIAL(debug)
-        << "DEBUG: WAL streaming on timeline "
-        << walstreamer->getCurrentTimeline();
+  BOOST_LOG_TRIVIAL(debug)
+    << "DEBUG: WAL streaming on timeline "
+    << this->walstreamer->getCurrentTimeline();
 #endif
 
-      /*
-       * Get the timeline history file content, but only if we
-       * are on a timeline greater than 1. The first timeline
-       * never writes a history file, thus ignore it.
-       *
-       * Rely on the timeline previously identified
-       * by prepareStream(), but check if we had missed
-       * a switch by upstream.
-       */
-      if (walstreamer->getCurrentTimeline() > 1) {
+  /*
+   * Get the timeline history file content, but only if we
+   * are on a timeline greater than 1. The first timeline
+   * never writes a history file, thus ignore it.
+   *
+   * Rely on the timeline previously identified
+   * by prepareStream(), but check if we had missed
+   * a switch by upstream.
+   */
+  if (this->walstreamer->getCurrentTimeline() > 1) {
 
-        /* physical TLI history file handle */
-        shared_ptr<BackupFile> tli_history_file = nullptr;
+    /* physical TLI history file handle */
+    shared_ptr<BackupFile> tli_history_file = nullptr;
 
-        /* Buffer holding timeline history file data */
-        MemoryBuffer timelineHistory;
+    /* Buffer holding timeline history file data */
+    MemoryBuffer timelineHistory;
 
 #ifdef __DEBUG_XLOG__
-        BOOST_LOG_TRIVIAL(debug)
-          << "DEBUG: checking timeline "
-          << walstreamer->getCurrentTimeline()
-          << " history";
+    BOOST_LOG_TRIVIAL(debug)
+      << "DEBUG: checking timeline "
+      << this->walstreamer->getCurrentTimeline()
+      << " history";
 #endif
 
-        /*
-         * If the requested timeline history file already exists,
-         * we move forward.
-         */
-        if (!this->logdir->historyFileExists(walstreamer->getCurrentTimeline(),
-                                             temp_descr->compression)) {
+    /*
+     * If the requested timeline history file already exists,
+     * we move forward.
+     */
+    if (!this->logdir->historyFileExists(this->walstreamer->getCurrentTimeline(),
+                                         temp_descr->compression)) {
 
-          pgstream->timelineHistoryFileContent(timelineHistory,
-                                               historyFilename,
-                                               walstreamer->getCurrentTimeline());
+      pgstream->timelineHistoryFileContent(timelineHistory,
+                                           historyFilename,
+                                           this->walstreamer->getCurrentTimeline());
 
-          /*
-           * Okay, ready to write TLI history content to disk.
-           */
-          try {
+      /*
+       * Okay, ready to write TLI history content to disk.
+       */
+      try {
 
-            tli_history_file = this->logdir->allocateHistoryFile(walstreamer->getCurrentTimeline(),
-                                                                 temp_descr->compression);
-            tli_history_file->write(timelineHistory.ptr(),
-                                    timelineHistory.getSize());
+        tli_history_file = this->logdir->allocateHistoryFile(this->walstreamer->getCurrentTimeline(),
+                                                             temp_descr->compression);
+        tli_history_file->write(timelineHistory.ptr(),
+                                timelineHistory.getSize());
 
-            /* not really critical, but make sure it lands on the disk */
-            tli_history_file->fsync();
-            tli_history_file->close();
+        /* not really critical, but make sure it lands on the disk */
+        tli_history_file->fsync();
+        tli_history_file->close();
 
 #ifdef __DEBUG_XLOG_
-            BOOST_LOG_TRIVIAL(debug)
-              << "got history file " << historyFilename
-              << " and its content";
+        BOOST_LOG_TRIVIAL(debug)
+          << "got history file " << historyFilename
+          << " and its content";
 #endif
 
-          } catch (CArchiveIssue &ai) {
+      } catch (CArchiveIssue &ai) {
 
-            if ((tli_history_file != nullptr) && (tli_history_file->isOpen())) {
-              /* don't leak descriptor here */
-              tli_history_file->close();
-            }
+        if ((tli_history_file != nullptr) && (tli_history_file->isOpen())) {
+          /* don't leak descriptor here */
+          tli_history_file->close();
+        }
 
-            throw ai;
+        throw ai;
 
-          }
-        }
       }
+    }
+  }
 
-      walstreamer->start();
+  this->walstreamer->start();
 
-      /*
-       * Set catalog state to streaming
-       */
-      walstreamerIdent = walstreamer->identification();
-      this->updateStreamCatalogStatus(walstreamerIdent);
+  /*
+   * Set catalog state to streaming
+   */
+  walstreamerIdent = this->walstreamer->identification();
+  this->updateStreamCatalogStatus(walstreamerIdent);
 
+}
+
+bool StartStreamingForArchiveCommand::streamEnded(bool can_continue) {
+
+  ArchiverState reason = this->walstreamer->reason();
+
+  if (can_continue) {
+
+    /*
+     * Receive exited for some reason. Check out why.
+     * We need to check of mostly three reasons here:
+     *
+     * 1) The connected upstream disconnected the stream for some reason,
+     *    so we need to shutdown.
+     * 2) We are instructed to shutdown. This is not that different
+     *    from 1).
+     * 3) The stream changed its timeline. Handle this and restart
+     *    the stream.
+     */
+    if (reason == ARCHIVER_TIMELINE_SWITCH) {
+
+#ifdef __DEBUG_XLOG_
+      BOOST_LOG_TRIVIAL(debug) << "timeline switch detected";
+#endif
       /*
-       * Now everything is set up, start receiving data
-       * from the stream.
+       * The walstreamer already did all the necessary legwork
+       * to properly shutdown the stream, so that we can go forward.
        *
-       * receive() will tell us (by returning false) if the
-       * stream can be continued or we are required to shut down.
+       * The next step is to retrieve the new timeline history file and
+       * then restart the stream, which is done by startStream().
        */
-      if (walstreamer->receive()) {
+      return true;
 
-        ArchiverState reason = walstreamer->reason();
+    }
 
-        /*
-         * Receive exited for some reason. Check out why.
-         * We need to check of mostly three reasons here:
-         *
-         * 1) The connected upstream disconnected the stream for some reason,
-         *    so we need to shutdown.
-         * 2) We are instructed to shutdown. This is not that different
-         *    from 1).
-         * 3) The stream changed its timeline. Handle this and restart
-         *    the stream.
-         */
-        if (reason == ARCHIVER_TIMELINE_SWITCH) {
+  } else if (reason == ARCHIVER_SHUTDOWN) {
 
-#ifdef __DEBUG_XLOG_
-          BOOST_LOG_TRIVIAL(debug) << "timeline switch detected";
+    StreamIdentification currentIdent;
+
+#ifdef __DEBUG_XLOG__
+    BOOST_LOG_TRIVIAL(debug) << "preparing WAL streamer for shutdown";
 #endif
-          /*
-           * The walstreamer already did all the necessary legwork
-           * to properly shutdown the stream, so that we can go forward.
-           *
-           * The next step is to retrieve the new timeline history file and
-           * then restart the stream.
-           *
-           * We don't do this here, the next loop will retrieve
-           * the timeline history file content and restart the stream.
-           */
-          continue;
 
-        } else {
+    currentIdent = this->walstreamer->identification();
+    this->updateStreamCatalogStatus(currentIdent);
+    return false;
 
-          /* oops, this is unexpected here */
-          BOOST_LOG_TRIVIAL(debug)
-            << "unexpected WAL streamer state: " << reason;
-          break;
+  }
 
-        }
+  /* oops, this is unexpected here */
+  BOOST_LOG_TRIVIAL(debug)
+    << "unexpected WAL streamer state: " << reason;
+  return false;
 
-      } else {
+}
 
-        ArchiverState reason = walstreamer->reason();
+std::string StartStreamingForArchiveCommand::streamName() {
 
-        if (reason == ARCHIVER_SHUTDOWN) {
+  return this->archive_name;
 
-          StreamIdentification currentIdent;
+}
 
-#ifdef __DEBUG_XLOG__
-          BOOST_LOG_TRIVIAL(debug) << "preparing WAL streamer for shutdown";
-#endif
+std::shared_ptr<WALStreamerProcess> StartStreamingForArchiveCommand::walStreamer() {
 
-          currentIdent = walstreamer->identification();
-          this->updateStreamCatalogStatus(currentIdent);
-          break;
+  return this->walstreamer;
 
-        } else {
+}
 
-          /* oops, this is unexpected here */
-          BOOST_LOG_TRIVIAL(debug)
-            << "unexpected WAL streamer state: " << reason;
-          break;
+void StartStreamingForArchiveCommand::setMultiplexedSlot(std::shared_ptr<WorkerSHM> shm,
+                                                         int slot) {
 
-        }
+  this->mux_shm  = shm;
+  this->mux_slot = slot;
 
-      }
+}
 
-    }
+bool StartStreamingForArchiveCommand::stopRequested() {
 
-    BOOST_LOG_TRIVIAL(warning) <<  "recv aborted, WAL streamer state: " << walstreamer->reason();
+  if (this->mux_shm == nullptr || this->mux_slot < 0)
+    return false;
 
-    /*
-     * Usually receive() above will catch us in a loop,
-     * if we arrive here this means we need to exit safely.
-     */
-    finalizeStream();
+  return this->mux_shm->stopRequested(this->mux_slot);
 
-  } catch(CPGBackupCtlFailure &e) {
-    throw e;
-  }
 }
 
-ListBackupListCommand::ListBackupListCommand(shared_ptr<CatalogDescr> descr) {
+void StartStreamingForArchiveCommand::streamFailed(std::string errmsg) {
 
-  this->copy(*(descr.get()));
+  this->stream_error = errmsg;
 
 }
 
-void ListBackupListCommand::execute(bool flag) {
+std::string StartStreamingForArchiveCommand::streamError() {
 
-  /*
-   * Die hard in case no catalog available.
-   */
-  if (this->catalog == nullptr)
-    throw CArchiveIssue("could not execute catalog command: no catalog");
+  return this->stream_error;
 
-  if (!this->catalog->available())
-    this->catalog->open_rw();
+}
 
-  /*
-   * Check if the requested archive identifier is known
-   * to the backup catalog.
-   */
-  shared_ptr<CatalogDescr> temp_descr = this->catalog->existsByName(this->archive_name);
+void StartStreamingForArchiveCommand::executeMultiplexed() {
+
+  std::vector<std::shared_ptr<StartStreamingForArchiveCommand>> streams;
+  std::vector<std::string> archives;
+  std::vector<int> extra_slots;
+  std::shared_ptr<WorkerSHM> shm = nullptr;
+  std::vector<std::thread> threads;
+  std::vector<std::string> thread_errors;
+  std::ostringstream errors;
+  bool failed = false;
+  int mux_threads = 1;
+  int max_messages = 64;
+  bool pin_cpus = false;
+
+  if (this->runtime_config != nullptr) {
+
+    this->runtime_config->get("walstreamer.mux_threads")->getValue(mux_threads);
+    this->runtime_config->get("walstreamer.mux_max_messages")->getValue(max_messages);
+    this->runtime_config->get("walstreamer.mux_pin_cpus")->getValue(pin_cpus);
 
-  if (temp_descr->id < 0) {
-    this->catalog->close();
-    throw CArchiveIssue("archive \"" + this->archive_name + "\" does not exist");
   }
 
-  /*
-   * NOTE: Use the temp_descr for catalog lookups now, since this is the only
-   *       one having a full fletched catalog descriptor content.
-   *
-   *       The local command object instance just carries the parser
-   *       information.
-   */
+  archives.push_back(this->archive_name);
+  archives.insert(archives.end(),
+                  this->stream_archive_names.begin(),
+                  this->stream_archive_names.end());
 
   /*
-   * Get a vector with all basebackups listed.
-   *
-   * This also includes all tablespaces and additional information
-   * we need to give a detailed overview about the stored backups.
-   *
-   * NOTE: We don't close the catalog afterwards immediately, since
-   *       OutputFormatter are still doing catalog lookup using
-   *       the catalog instance.
+   * Every archive gets its own command instance, owning the
+   * streaming connection, backup handler and catalog stream of
+   * its archive.
    */
-  vector<shared_ptr<BaseBackupDescr>> backupList
-    = this->catalog->getBackupList(temp_descr->archive_name);
-  shared_ptr<OutputFormatConfiguration> output_config
-    = std::make_shared<OutputFormatConfiguration>();
-
-  /* Print list, check if VERBOSE was requested */
-  if (this->verbose_output) {
+  for (auto &name : archives) {
 
-    output_config->create("list_backups.verbose", true, false);
+    std::shared_ptr<StartStreamingForArchiveCommand> stream
+      = std::make_shared<StartStreamingForArchiveCommand>(this->catalog);
 
-  } else {
+    stream->setIdent(name);
+    stream->forceXLOGPosRestart = this->forceXLOGPosRestart;
+    stream->detach = false;
+    stream->assignRuntimeConfiguration(this->runtime_config);
+    stream->assignSigStopHandler(this->stopHandler);
+    stream->assignSigIntHandler(this->intHandler);
+    stream->temp_descr = this->lookupArchive(name);
 
-    output_config->create("list_backups.verbose", false, false);
+    streams.push_back(stream);
 
   }
 
-  std::shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(output_config,
-                                                                          catalog,
-                                                                          temp_descr,
-                                                                          getOutputFormat());
-  std::ostringstream output;
-  formatter->nodeAs(backupList, output);
-
   /*
-   * Now we can close the backup catalog safely.
+   * If running as a background worker, the launcher registered
+   * ourselves with the first archive in the worker shared memory.
+   * Register the other archives as well, so that they show up in
+   * SHOW WORKERS and can be stopped individually by STOP STREAMING.
    */
-  this->catalog->close();
+  if (this->worker_id >= 0) {
 
-  cout << output.str();
-
-}
+    shm = std::make_shared<WorkerSHM>();
 
-ListBackupCatalogCommand::ListBackupCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
-  this->tag = LIST_BACKUP_CATALOG;
-  this->catalog = catalog;
-}
+    if (!shm->attach(this->catalog->fullname(), true)) {
+      throw CArchiveIssue("could not attach to worker shared memory area");
+    }
 
-ListBackupCatalogCommand::ListBackupCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+    shm->lock();
 
-  this->copy(*(descr.get()));
+    try {
 
-}
+      shm_worker_area worker_info = shm->read(this->worker_id);
 
-void ListBackupCatalogCommand::execute(bool flag) {
+      worker_info.multiplexed = true;
+      shm->write(this->worker_id, worker_info);
+      streams[0]->setMultiplexedSlot(shm, this->worker_id);
 
-  /*
-   * Die hard in case no catalog available.
-   */
-  if (this->catalog == nullptr)
-    throw CArchiveIssue("could not execute catalog command: no catalog");
+      for (unsigned int i = 1; i < streams.size(); i++) {
 
-  if (!this->catalog->available())
-    this->catalog->open_rw();
+        int slot;
 
-  /*
-   * Enter transaction
-   */
-  try {
+        worker_info.archive_id = streams[i]->temp_descr->id;
+        slot = shm->allocate(worker_info);
+        extra_slots.push_back(slot);
+        streams[i]->setMultiplexedSlot(shm, slot);
 
-    std::shared_ptr<StatCatalogArchive> stat = nullptr;
-    std::shared_ptr<CatalogDescr> temp_descr = nullptr;
-    std::ostringstream output;
+      }
 
-    this->catalog->startTransaction();
+    } catch(SHMFailure &shme) {
 
-    /*
-     * Check if requested archive exists in the catalog.
-     */
-    temp_descr = this->catalog->existsByName(this->archive_name);
+      for (auto &slot : extra_slots)
+        shm->free(slot);
 
-    if (temp_descr->id < 0) {
-      /*
-       * Don't need to rollback, outer exception handler will do this
-       */
-      std::ostringstream oss;
-      oss << "cannot stat catalog: archive\""
-          << this->archive_name
-          << "\" does not exist";
+      shm->unlock();
+      throw CArchiveIssue(shme.what());
 
-      throw CCatalogIssue(oss.str());
     }
-    /* list of all backups in every archive */
-    stat = this->catalog->statCatalog(this->archive_name);
-    this->catalog->commitTransaction();
 
-    OutputFormatter::formatter(make_shared<OutputFormatConfiguration>(),
-                               catalog,
-                               getOutputFormat())->nodeAs(stat, output);
-    cout << output.str();
+    shm->unlock();
 
-  } catch (CPGBackupCtlFailure &e) {
-    this->catalog->rollbackTransaction();
-    throw e; /* don't hide exception from caller */
   }
-}
 
-StartBasebackupCatalogCommand::StartBasebackupCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
-  this->tag = START_BASEBACKUP;
-  this->catalog = catalog;
-}
+  if (mux_threads < 1)
+    mux_threads = 1;
 
-StartBasebackupCatalogCommand::StartBasebackupCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+  if ((unsigned int) mux_threads > streams.size())
+    mux_threads = streams.size();
 
-  this->copy(*(descr.get()));
+  thread_errors.resize(mux_threads);
 
-}
+  BOOST_LOG_TRIVIAL(info) << "multiplexing " << streams.size()
+                          << " WAL streams over " << mux_threads << " thread(s)";
 
-BackupCatalogErrorCode StartBasebackupCatalogCommand::check(int archive_id,
-                                                            StreamIdentification ident) {
+  /*
+   * Distribute the streams round robin over the streaming threads.
+   * Each thread uses its own catalog connection.
+   */
+  for (int t = 0; t < mux_threads; t++) {
 
-  shared_ptr<BaseBackupDescr> bbdescr = nullptr;
-  BackupCatalogErrorCode result = BASEBACKUP_CATALOG_OK;
+    std::vector<std::shared_ptr<StartStreamingForArchiveCommand>> thread_streams;
 
-  /*
-   * Check if a previous basebackup exists. If true, check
-   * it's systemid. We allow the check to succeed if the systemid
-   * matches. In case of a mismatch, return BASEBACKUP_INVALID_SYSTEMID.
-   *
-   * Only consider valid basebackups, since aborted or errorneous
-   * basebackups aren't real backups ;)
-   */
-  bbdescr = this->catalog->getBaseBackup(BASEBACKUP_NEWEST, archive_id, true);
+    for (unsigned int i = t; i < streams.size(); i += mux_threads)
+      thread_streams.push_back(streams[i]);
 
-  if (bbdescr->id < 0) {
+    threads.push_back(std::thread([this, t, thread_streams, max_messages, &thread_errors]() {
 
-    /* Not a valid descriptor, so nothing found */
-    return result;
+      try {
 
-  }
+        std::shared_ptr<BackupCatalog> thread_catalog
+          = std::make_shared<BackupCatalog>(this->catalog->fullname());
+        WALStreamMultiplexer mux;
 
-  /* Descriptor seems valid, check systemid. */
-  if (ident.systemid != bbdescr->systemid) {
+        thread_catalog->open_rw();
 
-    /*
-     * If this command handle has force_systemid_update
-     * set, ignore this mismatch, but return an appropiate
-     * BackupCatalogErrCode.
-     */
-    if (this->force_systemid_update)
-      result = BASEBACKUP_CATALOG_FORCE_SYSTEMID_UPDATE;
-    else
-      result = BASEBACKUP_CATALOG_INVALID_SYSTEMID;
+        mux.setMaxMessagesPerRound(max_messages);
 
-  }
+        for (auto &stream : thread_streams) {
+          stream->setCatalog(thread_catalog);
+          mux.addStream(std::make_shared<MultiplexedArchiveStream>(stream));
+        }
 
-  return result;
+        mux.run();
 
-}
+        thread_catalog->close();
 
-void StartBasebackupCatalogCommand::execute(bool background) {
+      } catch(std::exception &e) {
+        thread_errors[t] = e.what();
+      }
 
-  std::shared_ptr<CatalogDescr> temp_descr(nullptr);
-  std::shared_ptr<BackupProfileDescr> backupProfile(nullptr);
+    }));
 
-  /*
-   * Basebackup stream process handler.
-   */
-  std::shared_ptr<BaseBackupProcess> bbp(nullptr);
+    if (pin_cpus) {
 
-  /* Track if basebackup was registered already */
-  bool basebackup_registered = false;
+      cpu_set_t cpuset;
+      unsigned int ncpus = std::thread::hardware_concurrency();
 
-  /*
-   * Die hard in case no catalog descriptor available.
-   */
-  if (this->catalog == nullptr)
-    throw CArchiveIssue("could not execute archive command: no catalog");
+      CPU_ZERO(&cpuset);
+      CPU_SET((ncpus > 0) ? (t % ncpus) : 0, &cpuset);
+
+      if (pthread_setaffinity_np(threads.back().native_handle(),
+                                 sizeof(cpu_set_t), &cpuset) != 0) {
+        BOOST_LOG_TRIVIAL(warning) << "could not pin streaming thread " << t << " to CPU";
+      }
+
+    }
+
+  }
+
+  for (auto &thread : threads)
+    thread.join();
 
   /*
-   * Open the catalog, if not done yet.
+   * Streams are done, unregister the additional worker slots. Our
+   * own slot is released by the launcher.
    */
-  if (!this->catalog->available()) {
-    this->catalog->open_rw();
+  if (shm != nullptr) {
+
+    shm->lock();
+
+    for (auto &slot : extra_slots)
+      shm->free(slot);
+
+    shm->unlock();
+    shm->detach();
+
   }
 
-  this->catalog->startTransaction();
+  for (auto &errmsg : thread_errors) {
 
-  try {
-    /*
-     * Check if the specified archive_name is present, get
-     * its descriptor.
-     */
-    temp_descr = this->catalog->existsByName(this->archive_name);
+    if (errmsg.length() > 0) {
+      errors << " " << errmsg;
+      failed = true;
+    }
 
-    /*
-     * existsByName() doesn't retrieve the archive
-     * database connection specification into our
-     * catalog descriptor, we need to do it ourselves.
-     */
-    if (temp_descr->id >= 0) {
+  }
 
-      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_ARCHIVE_ID_ATTNO);
-      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_TYPE_ATTNO);
-      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_DSN_ATTNO);
-      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGHOST_ATTNO);
-      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGPORT_ATTNO);
-      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGUSER_ATTNO);
-      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGDATABASE_ATTNO);
+  for (auto &stream : streams) {
 
-      this->catalog->getCatalogConnection(temp_descr->coninfo,
-                                          temp_descr->id,
-                                          ConnectionDescr::CONNECTION_TYPE_BASEBACKUP);
+    if (stream->streamError().length() > 0) {
+      errors << " archive \"" << stream->streamName() << "\": " << stream->streamError();
+      failed = true;
     }
-    this->catalog->commitTransaction();
 
-  } catch(CPGBackupCtlFailure& e) {
-    /* oops */
-    this->catalog->rollbackTransaction();
-    throw e;
   }
 
-  if (temp_descr->id < 0) {
-    /* Requested archive doesn't exist, error out */
-    std::ostringstream oss;
+  if (failed) {
+    throw StreamingFailure("multiplexed WAL streaming failed:" + errors.str());
+  }
 
-    oss << "archive " << this->archive_name << " does not exist";
-    throw CArchiveIssue(oss.str());
+}
+
+void StartStreamingForArchiveCommand::execute(bool noop) {
+  /*
+   * Die hard in case launcher process is not running.
+   */
+  shared_ptr<CatalogProc> procInfo = catalog->getProc(
+    -1,
+    CatalogProc::PROC_TYPE_LAUNCHER
+  );
+
+  if (!launcher_is_running(procInfo)) {
+    throw CArchiveIssue("could not execute catalog command: launcher not running");
   }
 
   /*
-   * If the PROFILE keyword was specified, select
-   * the requested profile from the catalog. If it doesn't
-   * exist, throw an error.
+   * Die hard in case no catalog available.
+   */
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute catalog command: no catalog");
+  }
+
+  if (!this->catalog->available()) {
+    this->catalog->open_rw();
+  }
+
+  /*
+   * IMPORTANT:
    *
-   * Iff PROFILE was omitted, select the default profile.
+   * Don't employ transactions here! Status updates will
+   * be lost otherwise!
    */
-  if (this->backup_profile->name != "") {
 
-    BOOST_LOG_TRIVIAL(debug)
-      << "DEBUG: checking for profile "
-      << this->backup_profile->name;
+  /*
+   * Check, if archives exist.
+   */
+  temp_descr = this->lookupArchive(this->archive_name);
 
-    this->catalog->startTransaction();
+  for (auto &name : this->stream_archive_names) {
+    this->lookupArchive(name);
+  }
 
-    try {
-      backupProfile = catalog->getBackupProfile(this->backup_profile->name);
-      this->catalog->commitTransaction();
-    } catch(CPGBackupCtlFailure &e) {
-      this->catalog->rollbackTransaction();
-      throw e;
-    }
+  /*
+   * Check if we are supposed to run a background streaming
+   * process via launcher.
+   */
+  if (this->detach) {
+
+    job_info jobDescr;
 
     /*
-     * If the requested backup profile was not found, raise
-     * an exception.
+     * Rebuild the command from scratch.
      */
-    if (backupProfile->profile_id < 0) {
-      std::ostringstream oss;
-      oss << "backup profile \"" << this->backup_profile->name << "\" does not exist";
-      throw CArchiveIssue(oss.str());
-    }
-
-  } else {
+    std::string archive_name = this->archive_name;
+    std::ostringstream cmd_str;
 
-    this->catalog->startTransaction();
+    BOOST_LOG_TRIVIAL(info) << "DETACHING requested";
 
-    try {
+    cmd_str << "START STREAMING FOR ARCHIVE "
+            << archive_name;
 
-      /*
-       * The PROFILE keyword wasn't specified to
-       * the START BASEBACKUP command. Request the default
-       * profile...
-       */
-      backupProfile = catalog->getBackupProfile("default");
-      this->catalog->commitTransaction();
+    for (auto &name : this->stream_archive_names) {
+      cmd_str << ", " << name;
+    }
 
-    } catch(CPGBackupCtlFailure &e) {
-      this->catalog->rollbackTransaction();
-      throw e;
+    if (this->forceXLOGPosRestart) {
+      cmd_str << " RESTART";
     }
 
-    BOOST_LOG_TRIVIAL(debug)
-      << "PROFILE keyword not specified, using \"default\" backup profile";
+    /* Make sure background worker won't detach again ... */
+    cmd_str << " NODETACH";
 
-    /*
-     * Iff the "default" profile doesn't exist, tell
-     * the user that this is an unexpected error condition.
-     */
-    if (backupProfile->profile_id < 0) {
-      std::ostringstream oss;
-      oss << "\"default\" profile not found: please check your backup catalog or create a new one";
-      throw CArchiveIssue(oss.str());
-    }
+    /* Assign a dummy catalog command handle to the job descriptor */
+    jobDescr.cmdHandle = std::make_shared<BackgroundWorkerCommandHandle>(this->catalog);
+    establish_launcher_cmd_queue(jobDescr);
+    send_launcher_cmd(jobDescr, cmd_str.str());
+
+    /* All done, we should exit this command handler */
+    return;
 
   }
 
-  try {
+  /*
+   * More than one archive requested, stream them all
+   * from this process.
+   */
+  if (this->stream_archive_names.size() > 0) {
+    this->executeMultiplexed();
+    return;
+  }
 
-    PGStream pgstream(temp_descr);
+  /* prepare stream and start streaming */
+  this->setupStream();
 
-    /*
-     * Create base backup stream handler.
-     */
-    std::shared_ptr<StreamBaseBackup> backupHandle
-      = std::make_shared<StreamBaseBackup>(temp_descr, SB_WRITE);
+  /*
+   * Enter infinite loop as long as receive() tells
+   * us that we can continue.
+   *
+   * receive() will tell us (by returning false) if the
+   * stream can be continued or we are required to shut down.
+   */
+  do {
 
-    /*
-     * Meta information handle for streamed tablespace.
-     */
-    std::shared_ptr<BackupTablespaceDescr> tablespaceDescr = nullptr;
+    this->startStream();
 
-    std::shared_ptr<BaseBackupDescr> basebackupDescr = nullptr;
+  } while (this->streamEnded(this->walstreamer->receive()));
 
-    /*
-     * Backup profile tells us the compression mode to use...
-     */
-    backupHandle->setCompression(backupProfile->compress_type);
+  BOOST_LOG_TRIVIAL(warning) <<  "recv aborted, WAL streamer state: " << this->walstreamer->reason();
 
-    /*
-     * Prepare backup handler. Should successfully create
-     * target streaming directory...
-     */
-    backupHandle->initialize();
-    backupHandle->create();
+  /*
+   * Usually receive() above will catch us in a loop,
+   * if we arrive here this means we need to exit safely.
+   */
+  finalizeStream();
 
-    /*
-     * Get connection to the PostgreSQL instance.
-     */
-    pgstream.connect();
+}
 
-    BOOST_LOG_TRIVIAL(debug)
-      << "DEBUG: connecting stream";
+ListBackupListCommand::ListBackupListCommand(shared_ptr<CatalogDescr> descr) {
 
-    /*
-     * Identify this replication connection.
-     */
-    pgstream.identify();
+  this->copy(*(descr.get()));
 
-    BOOST_LOG_TRIVIAL(debug) << "DEBUG: identify stream";
+}
+
+void ListBackupListCommand::execute(bool flag) {
+
+  /*
+   * Die hard in case no catalog available.
+   */
+  if (this->catalog == nullptr)
+    throw CArchiveIssue("could not execute catalog command: no catalog");
+
+  if (!this->catalog->available())
+    this->catalog->open_rw();
+
+  /*
+   * Check if the requested archive identifier is known
+   * to the backup catalog.
+   */
+  shared_ptr<CatalogDescr> temp_descr = this->catalog->existsByName(this->archive_name);
+
+  if (temp_descr->id < 0) {
+    this->catalog->close();
+    throw CArchiveIssue("archive \"" + this->archive_name + "\" does not exist");
+  }
+
+  /*
+   * NOTE: Use the temp_descr for catalog lookups now, since this is the only
+   *       one having a full fletched catalog descriptor content.
+   *
+   *       The local command object instance just carries the parser
+   *       information.
+   */
+
+  /*
+   * Open a cursor over all basebackups of the archive.
+   *
+   * This also includes all tablespaces and additional information
+   * we need to give a detailed overview about the stored backups.
+   * Every basebackup is printed as soon as it's read from the cursor,
+   * so the whole list is never held in memory.
+   *
+   * NOTE: We don't close the catalog afterwards immediately, since
+   *       OutputFormatter are still doing catalog lookup using
+   *       the catalog instance.
+   */
+  BaseBackupListFilter filter;
+  shared_ptr<BaseBackupCursor> cursor = nullptr;
+  shared_ptr<OutputFormatConfiguration> output_config
+    = std::make_shared<OutputFormatConfiguration>();
+
+  filter.archive_id = temp_descr->id;
+  filter.order = BASEBACKUP_LIST_STARTED_DESC;
+
+  /* Print list, check if VERBOSE was requested */
+  if (this->verbose_output) {
+
+    output_config->create("list_backups.verbose", true, false);
+
+  } else {
+
+    output_config->create("list_backups.verbose", false, false);
+
+  }
+
+  std::shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(output_config,
+                                                                          catalog,
+                                                                          temp_descr,
+                                                                          getOutputFormat());
+  cursor = this->catalog->openBackupCursor(filter);
+  formatter->streamAs(cursor, cout);
+  cursor->close();
+
+  /*
+   * Now we can close the backup catalog safely.
+   */
+  this->catalog->close();
+
+}
+
+ListBackupCatalogCommand::ListBackupCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
+  this->tag = LIST_BACKUP_CATALOG;
+  this->catalog = catalog;
+}
+
+ListBackupCatalogCommand::ListBackupCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+
+}
+
+void ListBackupCatalogCommand::execute(bool flag) {
+
+  /*
+   * Die hard in case no catalog available.
+   */
+  if (this->catalog == nullptr)
+    throw CArchiveIssue("could not execute catalog command: no catalog");
+
+  if (!this->catalog->available())
+    this->catalog->open_rw();
+
+  /*
+   * Enter transaction
+   */
+  try {
+
+    std::shared_ptr<StatCatalogArchive> stat = nullptr;
+    std::shared_ptr<CatalogDescr> temp_descr = nullptr;
+    std::ostringstream output;
+
+    this->catalog->startTransaction();
+
+    /*
+     * Check if requested archive exists in the catalog.
+     */
+    temp_descr = this->catalog->existsByName(this->archive_name);
+
+    if (temp_descr->id < 0) {
+      /*
+       * Don't need to rollback, outer exception handler will do this
+       */
+      std::ostringstream oss;
+      oss << "cannot stat catalog: archive\""
+          << this->archive_name
+          << "\" does not exist";
+
+      throw CCatalogIssue(oss.str());
+    }
+    /* list of all backups in every archive */
+    stat = this->catalog->statCatalog(this->archive_name);
+    this->catalog->commitTransaction();
+
+    OutputFormatter::formatter(make_shared<OutputFormatConfiguration>(),
+                               catalog,
+                               getOutputFormat())->nodeAs(stat, output);
+    cout << output.str();
+
+  } catch (CPGBackupCtlFailure &e) {
+    this->catalog->rollbackTransaction();
+    throw e; /* don't hide exception from caller */
+  }
+}
+
+StartBasebackupCatalogCommand::StartBasebackupCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
+  this->tag = START_BASEBACKUP;
+  this->catalog = catalog;
+}
+
+StartBasebackupCatalogCommand::StartBasebackupCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+
+}
+
+BackupCatalogErrorCode StartBasebackupCatalogCommand::check(int archive_id,
+                                                            StreamIdentification ident) {
+
+  shared_ptr<BaseBackupDescr> bbdescr = nullptr;
+  BackupCatalogErrorCode result = BASEBACKUP_CATALOG_OK;
+
+  /*
+   * Check if a previous basebackup exists. If true, check
+   * it's systemid. We allow the check to succeed if the systemid
+   * matches. In case of a mismatch, return BASEBACKUP_INVALID_SYSTEMID.
+   *
+   * Only consider valid basebackups, since aborted or errorneous
+   * basebackups aren't real backups ;)
+   */
+  bbdescr = this->catalog->getBaseBackup(BASEBACKUP_NEWEST, archive_id, true);
+
+  if (bbdescr->id < 0) {
+
+    /* Not a valid descriptor, so nothing found */
+    return result;
+
+  }
+
+  /* Descriptor seems valid, check systemid. */
+  if (ident.systemid != bbdescr->systemid) {
+
+    /*
+     * If this command handle has force_systemid_update
+     * set, ignore this mismatch, but return an appropiate
+     * BackupCatalogErrCode.
+     */
+    if (this->force_systemid_update)
+      result = BASEBACKUP_CATALOG_FORCE_SYSTEMID_UPDATE;
+    else
+      result = BASEBACKUP_CATALOG_INVALID_SYSTEMID;
+
+  }
+
+  return result;
+
+}
+
+std::shared_ptr<BaseBackupDescr>
+StartBasebackupCatalogCommand::incrementalParent(int archive_id,
+                                                 StreamIdentification ident,
+                                                 int server_version) {
+
+  namespace fs = boost::filesystem;
+
+  std::shared_ptr<BaseBackupDescr> parent(nullptr);
+
+  if (server_version < 170000) {
+    BOOST_LOG_TRIVIAL(warning) << "WARNING: incremental basebackups require PostgreSQL 17 or above, "
+                               << "streaming a full basebackup";
+    return nullptr;
+  }
+
+  this->catalog->startTransaction();
+
+  try {
+
+    parent = this->catalog->getBaseBackup(BASEBACKUP_NEWEST, archive_id, true);
+
+    if (parent->id >= 0) {
+
+      /*
+       * Make sure the whole chain is still usable, otherwise
+       * the new basebackup could never be restored.
+       */
+      this->catalog->getBaseBackupChain(parent->id, archive_id);
+
+    }
+
+    this->catalog->commitTransaction();
+
+  } catch(CCatalogIssue &e) {
+
+    this->catalog->rollbackTransaction();
+
+    BOOST_LOG_TRIVIAL(warning) << "WARNING: " << e.what() << ", streaming a full basebackup";
+    return nullptr;
+
+  } catch(CPGBackupCtlFailure &e) {
+    this->catalog->rollbackTransaction();
+    throw e;
+  }
+
+  if (parent->id < 0) {
+    BOOST_LOG_TRIVIAL(info) << "no previous basebackup found, streaming a full basebackup";
+    return nullptr;
+  }
+
+  if (parent->systemid != ident.systemid) {
+    BOOST_LOG_TRIVIAL(warning) << "WARNING: systemid of basebackup ID " << parent->id
+                               << " does not match, streaming a full basebackup";
+    return nullptr;
+  }
+
+  if ((parent->pg_version_num / 10000) != (server_version / 10000)) {
+    BOOST_LOG_TRIVIAL(warning) << "WARNING: basebackup ID " << parent->id
+                               << " was taken from a different major version, "
+                               << "streaming a full basebackup";
+    return nullptr;
+  }
+
+  if (!fs::exists(fs::path(parent->fsentry) / "backup.manifest")) {
+    BOOST_LOG_TRIVIAL(warning) << "WARNING: basebackup ID " << parent->id
+                               << " has no plain backup manifest, streaming a full basebackup";
+    return nullptr;
+  }
+
+  return parent;
+
+}
+
+void StartBasebackupCatalogCommand::execute(bool background) {
+
+  std::shared_ptr<CatalogDescr> temp_descr(nullptr);
+  std::shared_ptr<BackupProfileDescr> backupProfile(nullptr);
+
+  /*
+   * Basebackup stream process handler.
+   */
+  std::shared_ptr<BaseBackupProcess> bbp(nullptr);
+
+  /* Track if basebackup was registered already */
+  bool basebackup_registered = false;
+
+  /* Size of the finished basebackup, -1 if unknown */
+  ssize_t bbsize = -1;
+
+  /* Chunks referenced by a deduplicated basebackup */
+  std::set<std::string> chunks;
+
+  /* Parent of an incremental basebackup, nullptr for full basebackups */
+  std::shared_ptr<BaseBackupDescr> parent(nullptr);
+
+  /* Adaptive rate control, if requested by the backup profile */
+  std::shared_ptr<BaseBackupRateControl> rateControl(nullptr);
+
+  /* Progress in the worker shared memory, if started by the launcher */
+  std::shared_ptr<BaseBackupProgressPublisher> progressPublisher(nullptr);
+
+  /*
+   * Die hard in case no catalog descriptor available.
+   */
+  if (this->catalog == nullptr)
+    throw CArchiveIssue("could not execute archive command: no catalog");
+
+  /*
+   * Open the catalog, if not done yet.
+   */
+  if (!this->catalog->available()) {
+    this->catalog->open_rw();
+  }
+
+  this->catalog->startTransaction();
+
+  try {
+    /*
+     * Check if the specified archive_name is present, get
+     * its descriptor.
+     */
+    temp_descr = this->catalog->existsByName(this->archive_name);
+
+    /*
+     * existsByName() doesn't retrieve the archive
+     * database connection specification into our
+     * catalog descriptor, we need to do it ourselves.
+     */
+    if (temp_descr->id >= 0) {
+
+      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_ARCHIVE_ID_ATTNO);
+      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_TYPE_ATTNO);
+      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_DSN_ATTNO);
+      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGHOST_ATTNO);
+      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGPORT_ATTNO);
+      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGUSER_ATTNO);
+      temp_descr->coninfo->pushAffectedAttribute(SQL_CON_PGDATABASE_ATTNO);
+
+      this->catalog->getCatalogConnection(temp_descr->coninfo,
+                                          temp_descr->id,
+                                          ConnectionDescr::CONNECTION_TYPE_BASEBACKUP);
+    }
+    this->catalog->commitTransaction();
+
+  } catch(CPGBackupCtlFailure& e) {
+    /* oops */
+    this->catalog->rollbackTransaction();
+    throw e;
+  }
+
+  if (temp_descr->id < 0) {
+    /* Requested archive doesn't exist, error out */
+    std::ostringstream oss;
+
+    oss << "archive " << this->archive_name << " does not exist";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * If the PROFILE keyword was specified, select
+   * the requested profile from the catalog. If it doesn't
+   * exist, throw an error.
+   *
+   * Iff PROFILE was omitted, select the default profile.
+   */
+  if (this->backup_profile->name != "") {
+
+    BOOST_LOG_TRIVIAL(debug)
+      << "DEBUG: checking for profile "
+      << this->backup_profile->name;
+
+    this->catalog->startTransaction();
+
+    try {
+      backupProfile = catalog->getBackupProfile(this->backup_profile->name);
+      this->catalog->commitTransaction();
+    } catch(CPGBackupCtlFailure &e) {
+      this->catalog->rollbackTransaction();
+      throw e;
+    }
+
+    /*
+     * If the requested backup profile was not found, raise
+     * an exception.
+     */
+    if (backupProfile->profile_id < 0) {
+      std::ostringstream oss;
+      oss << "backup profile \"" << this->backup_profile->name << "\" does not exist";
+      throw CArchiveIssue(oss.str());
+    }
+
+  } else {
+
+    this->catalog->startTransaction();
+
+    try {
+
+      /*
+       * The PROFILE keyword wasn't specified to
+       * the START BASEBACKUP command. Request the default
+       * profile...
+       */
+      backupProfile = catalog->getBackupProfile("default");
+      this->catalog->commitTransaction();
+
+    } catch(CPGBackupCtlFailure &e) {
+      this->catalog->rollbackTransaction();
+      throw e;
+    }
+
+    BOOST_LOG_TRIVIAL(debug)
+      << "PROFILE keyword not specified, using \"default\" backup profile";
+
+    /*
+     * Iff the "default" profile doesn't exist, tell
+     * the user that this is an unexpected error condition.
+     */
+    if (backupProfile->profile_id < 0) {
+      std::ostringstream oss;
+      oss << "\"default\" profile not found: please check your backup catalog or create a new one";
+      throw CArchiveIssue(oss.str());
+    }
+
+  }
+
+  /*
+   * Uploads and the cold tier copy the basebackup directory, which
+   * holds the recipes of a deduplicated basebackup only.
+   */
+  if (backupProfile->deduplicate) {
+
+    if (this->catalog->getArchiveStorage(temp_descr->id)->archive_id >= 0
+        || this->catalog->getArchiveColdDirectory(temp_descr->id) != "") {
+
+      std::ostringstream oss;
+      oss << "DEDUPLICATE can't be used with archive \"" << this->archive_name
+          << "\", it has an object storage or a cold tier";
+      throw CArchiveIssue(oss.str());
+
+    }
+
+  }
+
+  try {
+
+    PGStream pgstream(temp_descr);
+
+    /*
+     * Create base backup stream handler.
+     */
+    std::shared_ptr<StreamBaseBackup> backupHandle
+      = std::make_shared<StreamBaseBackup>(temp_descr, SB_WRITE);
+
+    /*
+     * Meta information handle for streamed tablespace.
+     */
+    std::shared_ptr<BackupTablespaceDescr> tablespaceDescr = nullptr;
+
+    std::shared_ptr<BaseBackupDescr> basebackupDescr = nullptr;
+
+    /* Counts the bytes written, throttles with adaptive rate control */
+    std::shared_ptr<ArchiveRateLimiter> limiter = nullptr;
+
+    /*
+     * Backup profile tells us the compression mode to use...
+     */
+    backupHandle->setCompression(backupProfile->compress_type);
+    backupHandle->setCompressionLevel(backupProfile->compress_level);
+    backupHandle->setCompressionWorkers(backupProfile->compress_workers);
+
+    /*
+     * ... and how many threads write the tablespace archives.
+     */
+    backupHandle->setParallelWriters(backupProfile->parallel_writers);
+
+    /*
+     * Tablespace archives go into the chunk store of the archive.
+     */
+    backupHandle->setDeduplicate(backupProfile->deduplicate);
+
+    /*
+     * With adaptive rate control, we throttle the stream ourselves.
+     * basebackup.max_rate overrides the MAX_RATE of the profile, and
+     * the WAL streams publishing their statistics in the worker shared
+     * memory tell us when to back off.
+     */
+    if (backupProfile->adaptive_rate) {
+
+      int max_rate = 0;
+      int min_rate = 0;
+      int lag_threshold = 0;
+      uint64_t ceiling;
+      std::shared_ptr<WorkerSHM> shm = std::make_shared<WorkerSHM>();
+
+      this->runtime_config->get("basebackup.max_rate")->getValue(max_rate);
+      this->runtime_config->get("basebackup.min_rate")->getValue(min_rate);
+      this->runtime_config->get("basebackup.wal_lag_threshold")->getValue(lag_threshold);
+
+      ceiling = ((max_rate > 0) ? (uint64_t) max_rate : (uint64_t) backupProfile->max_rate) * 1024;
+
+      if (!shm->attach(this->catalog->fullname(), true)) {
+        BOOST_LOG_TRIVIAL(info) << "launcher not running, basebackup won't adapt to WAL stream lag";
+        shm = nullptr;
+      }
+
+      limiter = std::make_shared<ArchiveRateLimiter>(ceiling);
+      backupHandle->setRateLimiter(limiter);
+
+      rateControl = std::make_shared<BaseBackupRateControl>(limiter,
+                                                            shm,
+                                                            ceiling,
+                                                            (uint64_t) min_rate * 1024,
+                                                            (uint64_t) lag_threshold * 1024 * 1024);
+
+    }
+
+    /*
+     * A basebackup running in a launcher worker publishes its
+     * progress in the worker shared memory, so the launcher can export it
+     * without asking anyone. A rate limiter with no rate just counts
+     * the bytes written.
+     */
+    if (this->worker_id >= 0) {
+
+      std::shared_ptr<WorkerSHM> progress_shm = std::make_shared<WorkerSHM>();
+
+      if (progress_shm->attach(this->catalog->fullname(), true)) {
+
+        if (limiter == nullptr) {
+          limiter = std::make_shared<ArchiveRateLimiter>(0);
+          backupHandle->setRateLimiter(limiter);
+        }
+
+        progressPublisher = std::make_shared<BaseBackupProgressPublisher>(progress_shm,
+                                                                          this->worker_id,
+                                                                          limiter,
+                                                                          this->archive_name,
+                                                                          temp_descr->id);
+
+      } else {
+        BOOST_LOG_TRIVIAL(warning) << "could not attach to worker shared memory, no basebackup progress available";
+      }
+
+    }
+
+    /*
+     * Prepare backup handler. Should successfully create
+     * target streaming directory...
+     */
+    backupHandle->initialize();
+    backupHandle->create();
+
+    /*
+     * Get connection to the PostgreSQL instance.
+     */
+    pgstream.connect();
+
+    BOOST_LOG_TRIVIAL(debug)
+      << "DEBUG: connecting stream";
+
+    /*
+     * Identify this replication connection.
+     */
+    pgstream.identify();
+
+    BOOST_LOG_TRIVIAL(debug) << "DEBUG: identify stream";
+
+    /*
+     * With server-side compression the tablespace archives arrive
+     * compressed already, so store them as they are. Servers before
+     * PostgreSQL 15 can't do this, compress them ourselves instead.
+     */
+    if (backupProfile->server_compression) {
+
+      if (pgstream.getServerVersion() >= 150000) {
+
+        backupHandle->setCompression(BACKUP_COMPRESS_TYPE_NONE);
+
+        /* We can't look into compressed tar streams */
+        backupHandle->setArchiveIndex(false);
+
+      } else {
+
+        BOOST_LOG_TRIVIAL(warning) << "WARNING: server-side compression requires PostgreSQL 15 or above, "
+                                   << "compressing basebackup locally";
+        backupProfile->server_compression = false;
+
+      }
+
+    }
+
+    /*
+     * Check if we have a compatible previous
+     * basebackup already in the catalog. check() doesn't
+     * throw, but will return a BaseBackupErrorCode flag
+     * telling us what went wrong.
+     */
+    switch(this->check(temp_descr->id, pgstream.streamident)) {
+    case BASEBACKUP_CATALOG_FORCE_SYSTEMID_UPDATE:
+      {
+        BOOST_LOG_TRIVIAL(warning)
+          << "WARNING: we are streaming a basebackup with a new systemid\n"
+          << "         new systemid = "
+          << pgstream.streamident.systemid;
+        break;
+      }
+    case BASEBACKUP_CATALOG_INVALID_SYSTEMID:
+      {
+        /*
+         * There is a previous basebackup with a different
+         * systemid. we don't want to implicitely migrate
+         * any basebackup here to another cluster, so tell the
+         * caller that this is wrong.
+         *
+         * NOTE: We are already within a try..catch block,
+         *       so we don't do any cleanup here and leave it
+         *       up to the exception handler to clean everything
+         *       behind us.
+         */
+
+        ostringstream oss;
+
+        oss << "systemid("
+            << pgstream.streamident.systemid
+            << ") of last basebackup in the catalog does not match";
+        throw CCatalogIssue(oss.str());
+
+      }
+
+    default:
+      /* nothing to do here */
+      break;
+    }
+
+    /*
+     * Get basebackup stream handle.
+     */
+    bbp = pgstream.basebackup(backupProfile);
+
+    /*
+     * Set signal handler
+     */
+    bbp->assignStopHandler(this->stopHandler);
+    bbp->setRateControl(rateControl);
+    bbp->setProgressPublisher(progressPublisher);
+
+    /*
+     * If the profile requests incremental basebackups, look
+     * for a suitable parent. This is the newest valid basebackup
+     * of this archive streamed from the same cluster and major
+     * version, with its whole chain of parents still intact.
+     * If there is none, we fall back to a full basebackup, so
+     * the very first basebackup of an incremental profile is
+     * always a full one.
+     */
+    if (backupProfile->incremental) {
+
+      parent = this->incrementalParent(temp_descr->id,
+                                       pgstream.streamident,
+                                       pgstream.getServerVersion());
+
+      if (parent != nullptr) {
+
+        namespace fs = boost::filesystem;
+
+        fs::path parent_manifest = fs::path(parent->fsentry) / "backup.manifest";
+
+        BOOST_LOG_TRIVIAL(info) << "streaming incremental basebackup based on basebackup ID "
+                                << parent->id;
+
+        bbp->setParentManifest(parent_manifest.string());
+
+      }
+
+    }
+
+    /*
+     * Enter basebackup stream.
+     */
+    bbp->prepareStream(backupHandle);
+    bbp->start();
+
+    /*
+     * Now its time to register this basebackup handle to
+     * the catalog. Do the rollback in our own exception handler
+     * in case of errors.
+     *
+     * NOTE: Since the streaming directory handle is just passed to
+     *       stepTablespace(), but we need to register the basebackup
+     *       before, we must set the fsentry to the basebackup descriptor
+     *       ourselves!
+     */
+    basebackupDescr = bbp->getBaseBackupDescr();
+
+    this->catalog->startTransaction();
+
+    try {
+
+      basebackupDescr->archive_id = temp_descr->id;
+      basebackupDescr->fsentry = backupHandle->backupDirectoryString();
+      basebackupDescr->pg_version_num = pgstream.getServerVersion();
+      basebackupDescr->parent_id = (parent != nullptr) ? parent->id : -1;
+      basebackupDescr->compress_type = backupProfile->compress_type;
+
+      BOOST_LOG_TRIVIAL(debug) << "directory handle path " << basebackupDescr->fsentry;
+
+      this->catalog->registerBasebackup(temp_descr->id,
+                                        basebackupDescr);
+      this->catalog->commitTransaction();
+
+    } catch(CPGBackupCtlFailure &e) {
+      this->catalog->rollbackTransaction();
+      throw e;
+    }
+
+    /*
+     * Remember successful registration of this basebackup.
+     */
+    basebackup_registered = true;
+
+    BOOST_LOG_TRIVIAL(debug) << "basebackup stream started";
+
+    /*
+     * Initialize list of tablespaces, if any.
+     */
+    bbp->readTablespaceInfo();
+
+    BOOST_LOG_TRIVIAL(debug) << "basebackup tablespace meta info requested";
+
+    /*
+     * Loop through tablespaces and stream their contents.
+     */
+    bbp->stream(catalog);
+
+    /*
+     * Call end position in backup stream.
+     */
+    bbp->end();
+
+    /*
+     * And disconnect
+     */
+    BOOST_LOG_TRIVIAL(debug) << "DEBUG: disconnecting stream";
+    pgstream.disconnect();
+
+  } catch(CPGBackupCtlFailure& e) {
+
+    bool txinprogress = false;
+
+    /*
+     * If the basebackup was already registered, mark it
+     * as aborted. This is sad even if all went through, but only
+     * disconnecting from the server throws an error, but we treat this
+     * as an error nevertheless. We must be careful here, since catalog
+     * operations itself can throw exceptions and we don't mask
+     * those errors with the current one.
+     */
+    try {
+      if (basebackup_registered) {
+        this->catalog->startTransaction();
+        txinprogress = true;
+
+#ifdef __DEBUG__
+        BOOST_LOG_TRIVIAL(debug) << "marking basebackup as aborted";
+#endif
+
+        this->catalog->abortBasebackup(bbp->getBaseBackupDescr());
+        this->catalog->commitTransaction();
+      }
+    } catch (CPGBackupCtlFailure &e) {
+      if (txinprogress)
+        this->catalog->rollbackTransaction();
+    }
+
+    /* re-throw ... */
+    throw e;
+
+  }
+
+  /*
+   * Size of the finished basebackup on disk, recorded
+   * in the catalog together with the finalized registration. This
+   * is the only time the basebackup directory is walked for
+   * statistics.
+   */
+  try {
+
+    StreamingBaseBackupDirectory bbdir(path(bbp->getBaseBackupDescr()->fsentry));
+    bbsize = bbdir.size();
+
+  } catch (CArchiveIssue &e) {
+
+    BOOST_LOG_TRIVIAL(warning) << "could not determine size of basebackup: " << e.what();
+    bbsize = -1;
+
+  }
+
+  /*
+   * Chunks referenced by a deduplicated basebackup. They're
+   * referenced in the catalog together with the finalized
+   * registration, so a ready basebackup always holds its chunks.
+   */
+  if (backupProfile->deduplicate) {
+
+    try {
+
+      chunks = DedupChunkStore::referencedChunks(path(bbp->getBaseBackupDescr()->fsentry));
+
+    } catch (CArchiveIssue &e) {
+
+      this->catalog->startTransaction();
+      this->catalog->abortBasebackup(bbp->getBaseBackupDescr());
+      this->catalog->commitTransaction();
+      throw e;
+
+    }
+
+  }
+
+  /*
+   * Everything seems okay for now, finalize the backup
+   * registration.
+   */
+  this->catalog->startTransaction();
+
+  try {
+
+    this->catalog->finalizeBasebackup(bbp->getBaseBackupDescr());
+
+    if (!chunks.empty())
+      this->catalog->referenceChunks(temp_descr->id, chunks);
+
+    if (bbsize >= 0)
+      this->catalog->registerBackupStats(bbp->getBaseBackupDescr(), bbsize);
+
+    this->queueBasebackupUpload(temp_descr, bbp->getBaseBackupDescr());
+
+    this->catalog->commitTransaction();
+
+  } catch (CPGBackupCtlFailure &e) {
+    this->catalog->rollbackTransaction();
+    throw e;
+  }
+
+}
+
+void StartBasebackupCatalogCommand::queueBasebackupUpload(std::shared_ptr<CatalogDescr> archive_descr,
+                                                          std::shared_ptr<BaseBackupDescr> bbdescr) {
+
+  std::shared_ptr<ArchiveStorageDescr> storage
+    = this->catalog->getArchiveStorage(archive_descr->id);
+  boost::system::error_code ec;
+  unsigned int queued = 0;
+
+  if (storage->archive_id < 0)
+    return;
+
+  for (boost::filesystem::recursive_directory_iterator it(path(bbdescr->fsentry), ec), end;
+       !ec && it != end;
+       it.increment(ec)) {
+
+    std::shared_ptr<UploadDescr> upload = nullptr;
+    boost::system::error_code size_ec;
+
+    if (!boost::filesystem::is_regular_file(it->status()))
+      continue;
+
+    upload = std::make_shared<UploadDescr>();
+    upload->archive_id = archive_descr->id;
+    upload->kind = UPLOAD_BASEBACKUP;
+    upload->basebackup_id = bbdescr->id;
+    upload->path = it->path().string();
+    upload->object_key
+      = ObjectUploader::objectKey(storage,
+                                  archive_relative_path(archive_descr->directory, it->path()));
+    upload->size = boost::filesystem::file_size(it->path(), size_ec);
+
+    if (size_ec)
+      upload->size = 0;
+
+    this->catalog->queueUpload(upload);
+    queued++;
+
+  }
+
+  /* Not worth failing the finished basebackup for */
+  if (ec) {
+    BOOST_LOG_TRIVIAL(warning) << "could not queue all files of basebackup \""
+                               << bbdescr->fsentry << "\" for upload: " << ec.message();
+  }
+
+  BOOST_LOG_TRIVIAL(debug) << "queued " << queued << " files of basebackup "
+                           << bbdescr->id << " for upload";
+
+}
+
+DropBackupProfileCatalogCommand::DropBackupProfileCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
+  this->tag = DROP_BACKUP_PROFILE;
+  this->catalog = catalog;
+}
+
+DropBackupProfileCatalogCommand::DropBackupProfileCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+
+}
+
+void DropBackupProfileCatalogCommand::execute(bool extended) {
+
+  /*
+   * Die hard in case no catalog available.
+   */
+  if (this->catalog == nullptr)
+    throw CArchiveIssue("could not execute archive command: no catalog");
+
+  /*
+   * Open the catalog, if not yet done.
+   */
+  if (!this->catalog->available()) {
+    this->catalog->open_rw();
+  }
+
+  try {
+
+    catalog->startTransaction();
+
+    /*
+     * Check if the specified backup profile exists. Error
+     * out with an exception if not found.
+     */
+    std::shared_ptr<BackupProfileDescr> profileDescr = this->getBackupProfileDescr();
+    std::shared_ptr<BackupProfileDescr> temp_descr = catalog->getBackupProfile(profileDescr->name);
+
+    /*
+     * NOTE: BackupCatalog::getBackupProfile() always returns an
+     *       BackupProfileDescr, but in case the specified
+     *       name doesn't exists it is initialized with profile_id = -1
+     */
+    if (temp_descr->profile_id < 0) {
+      std::ostringstream oss;
+      oss << "backup profile \"" << profileDescr->name << "\"" << endl;
+      throw CCatalogIssue(oss.str());
+    }
+
+    catalog->dropBackupProfile(profileDescr->name);
+    catalog->commitTransaction();
+
+  } catch(exception& e) {
+    catalog->rollbackTransaction();
+    /* re-throw exception */
+    throw e;
+  }
+}
+
+ListBackupProfileCatalogCommand::ListBackupProfileCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
+  this->tag = LIST_BACKUP_PROFILE;
+  this->catalog = catalog;
+}
+
+ListBackupProfileCatalogCommand::ListBackupProfileCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+
+}
+
+void ListBackupProfileCatalogCommand::execute(bool extended) {
+
+  shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(make_shared<OutputFormatConfiguration>(),
+                                                                     catalog,
+                                                                     getOutputFormat());
+  shared_ptr<CatalogDescr> temp_descr(nullptr);
+  ostringstream output;
+
+  /*
+   * Die hard in case no catalog available.
+   */
+  if (this->catalog == nullptr)
+    throw CArchiveIssue("could not execute archive command: no catalog");
+
+  /*
+   * Open the catalog, if not yet done.
+   */
+  if (!this->catalog->available()) {
+    this->catalog->open_rw();
+  }
+
+  try {
+
+    catalog->startTransaction();
+
+    /*
+     * Get a list of current backup profiles. If the name is requested,
+     * show the details only.
+     */
+    if (this->tag == LIST_BACKUP_PROFILE) {
+
+      auto profileList = catalog->getBackupProfiles();
+
+      formatter->nodeAs(profileList, output);
+
+
+    } else if (this->tag == LIST_BACKUP_PROFILE_DETAIL) {
+
+      std::shared_ptr<BackupProfileDescr> profile
+        = this->catalog->getBackupProfile(this->getBackupProfileDescr()->name);
+
+      formatter->nodeAs(profile, output);
+
+
+    }
+
+    catalog->commitTransaction();
+
+    /* finally output results */
+    cout << output.str();
+
+  } catch (exception& e) {
+    this->catalog->rollbackTransaction();
+    throw e;
+  }
+
+}
+
+DropRetentionPolicyCommand::DropRetentionPolicyCommand() {}
+
+DropRetentionPolicyCommand::DropRetentionPolicyCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+
+}
+
+DropRetentionPolicyCommand::DropRetentionPolicyCommand(std::shared_ptr<BackupCatalog> catalog) {
+
+  this->tag = DROP_RETENTION_POLICY;
+  this->catalog = catalog;
+
+}
+
+DropRetentionPolicyCommand::~DropRetentionPolicyCommand() {}
+
+void DropRetentionPolicyCommand::execute(bool flag) {
+
+  bool have_tx = false;
+
+  /*
+   * Check catalog.
+   */
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
+  }
+
+  try {
+
+    shared_ptr<RetentionDescr> retention = nullptr;
+
+    this->catalog->startTransaction();
+    have_tx = true;
+
+    retention = this->catalog->getRetentionPolicy(this->archive_name);
+
+    if (retention != nullptr && retention->id >= 0) {
+
+      /* delete the retention policy */
+      this->catalog->dropRetentionPolicy(retention->name);
+    } else {
+
+      ostringstream oss;
+
+      oss << "retention policy \""
+          << this->archive_name
+          << "\" does not exist";
+
+      /*
+       * Throw a CArchiveIssue, telling that the retention
+       * policy wasn't found in the catalog. We don't
+       * handle the transaction here, since we catch this
+       * in the outer exception handler and re-throw there.
+       */
+      throw CArchiveIssue(oss.str());
+
+    }
+
+    this->catalog->commitTransaction();
+    have_tx = false;
+
+  } catch (CPGBackupCtlFailure &e) {
+
+    if (have_tx) {
+      this->catalog->rollbackTransaction();
+      have_tx = false;
+    }
+
+    throw e;
+  }
+}
+
+ListRetentionPolicyCommand::ListRetentionPolicyCommand() {
+
+  this->tag = LIST_RETENTION_POLICY;
+
+}
+
+ListRetentionPolicyCommand::ListRetentionPolicyCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+
+}
+
+ListRetentionPolicyCommand::ListRetentionPolicyCommand(std::shared_ptr<BackupCatalog> catalog) {
+
+  this->tag = LIST_RETENTION_POLICY;
+  this->catalog = catalog;
+
+}
+
+ListRetentionPolicyCommand::~ListRetentionPolicyCommand() {}
+
+void ListRetentionPolicyCommand::execute(bool flag) {
+
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
+  }
+
+  /* Retention name is mandatory for this command. */
+
+  if (this->retention_name.length() == 0)
+    throw CArchiveIssue("retention name required");
+
+  try {
+
+    shared_ptr<RetentionDescr> retentionDescr = nullptr;
+    shared_ptr<OutputFormatConfiguration> output_config
+      = std::make_shared<OutputFormatConfiguration>();
+    shared_ptr<OutputFormatter> formatter
+      = OutputFormatter::formatter(output_config,
+                                   catalog,
+                                   getOutputFormat());
+    std::ostringstream output;
+
+    this->catalog->startTransaction();
+
+    retentionDescr = this->catalog->getRetentionPolicy(this->retention_name);
+
+    if (retentionDescr->id < 0) {
+
+      ostringstream oss;
+
+      oss << "retention policy \"" << this->retention_name << "\" does not exist";
+
+      /* TX exit on error is handled by the exception handler below */
+      throw CArchiveIssue(oss.str());
+
+    }
+
+    this->catalog->commitTransaction();
+
+    /* Print contents of this policy */
+
+    formatter->nodeAs(retentionDescr, output);
+    std::cout << output.str();
+
+  } catch(CPGBackupCtlFailure &e) {
+
+    this->catalog->rollbackTransaction();
+    throw e; /* don't hide errors */
+
+  }
+
+}
+
+ListRetentionPoliciesCommand::ListRetentionPoliciesCommand() {
+
+  this->tag = LIST_RETENTION_POLICIES;
+
+}
+
+ListRetentionPoliciesCommand::ListRetentionPoliciesCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+
+}
+
+ListRetentionPoliciesCommand::~ListRetentionPoliciesCommand() {}
+
+ListRetentionPoliciesCommand::ListRetentionPoliciesCommand(std::shared_ptr<BackupCatalog> catalog) {
+
+  this->tag = LIST_RETENTION_POLICIES;
+  this->catalog = catalog;
+
+}
+
+void ListRetentionPoliciesCommand::execute(bool flag) {
+
+  bool have_tx = false;
+
+  /*
+   * Check catalog.
+   */
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
+  }
+
+  try {
+
+    vector<shared_ptr<RetentionDescr>> retentionList;
+    vector<int> attrsRetention;
+    vector<int> attrsRules;
+
+    /*
+     * Start a database transaction. Though we're just reading,
+     * we want to have a TX for synchronization purposes.
+     */
+    this->catalog->startTransaction();
+    have_tx = true;
+
+    /*
+     * Specify which attributes we want from the catalog.
+     */
+    attrsRetention.push_back(SQL_RETENTION_ID_ATTNO);
+    attrsRetention.push_back(SQL_RETENTION_NAME_ATTNO);
+    attrsRetention.push_back(SQL_RETENTION_CREATED_ATTNO);
+
+    attrsRules.push_back(SQL_RETENTION_RULES_ID_ATTNO);
+    attrsRules.push_back(SQL_RETENTION_RULES_TYPE_ATTNO);
+    attrsRules.push_back(SQL_RETENTION_RULES_VALUE_ATTNO);
+
+    /*
+     * Get policies...
+     */
+    this->catalog->getRetentionPolicies(retentionList,
+                                        attrsRetention,
+                                        attrsRules);
+
+    if (retentionList.size() < 1) {
+
+      /*
+       * NOTE: Transaction rollback happens in the outer
+       *       exception handler, since we re-throw there.
+       */
+      throw CArchiveIssue("no retention policies found");
+
+    }
+
+    this->catalog->commitTransaction();
+    have_tx = false;
+
+    /*
+     * Print out details.
+     */
+    shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(make_shared<OutputFormatConfiguration>(),
+                                                                       catalog,
+                                                                       getOutputFormat());
+    ostringstream output;
+    formatter->nodeAs(retentionList, output);
+    cout << output.str();
+
+  } catch (CPGBackupCtlFailure &e) {
+    if (have_tx) {
+
+      have_tx = false;
+      this->catalog->rollbackTransaction();
+
+    }
+
+    /* don't hide original exception from caller */
+    throw e;
+  }
+}
+
+ApplyRetentionPolicyCommand::ApplyRetentionPolicyCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+
+}
+
+ApplyRetentionPolicyCommand::ApplyRetentionPolicyCommand(std::shared_ptr<BackupCatalog> catalog) {
+
+  this->tag = APPLY_RETENTION_POLICY;
+  this->catalog = catalog;
+
+}
+
+ApplyRetentionPolicyCommand::ApplyRetentionPolicyCommand() {
+
+  this->tag = APPLY_RETENTION_POLICY;
+
+}
+
+ApplyRetentionPolicyCommand::~ApplyRetentionPolicyCommand() {}
+
+void ApplyRetentionPolicyCommand::printPlan(std::shared_ptr<RetentionPlan> plan) {
+
+  ostringstream oss;
+
+  oss << "retention plan for policy \"" << plan->policy << "\" on archive \""
+      << this->archive_name << "\""
+      << (plan->cached ? " (cached)" : "") << endl;
+
+  if (plan->migrates()) {
+
+    oss << "basebackups to move to \"" << plan->cold_directory << "\": "
+        << plan->cleanupDescr->migrateDescr->basebackups.size() << endl;
+
+    for (auto &bbdescr : plan->cleanupDescr->migrateDescr->basebackups) {
+
+      oss << "  id " << bbdescr->id
+          << ", stopped " << (bbdescr->stopped.length() > 0 ? bbdescr->stopped : "N/A")
+          << ", " << bbdescr->fsentry << endl;
+
+    }
+
+    oss << "WAL files to move: " << plan->wal_moved.files
+        << " (" << plan->wal_moved.bytes << " bytes)" << endl;
+    oss << "estimated bytes moved: " << (plan->migrate_bytes + plan->wal_moved.bytes) << endl;
+
+  }
+
+  if (plan->empty()) {
+
+    if (!plan->migrates())
+      oss << "no basebackups matches retention policy" << endl;
+
+    if (plan->kept_parents > 0)
+      oss << "basebackups kept for incremental basebackups: " << plan->kept_parents << endl;
+
+    if (plan->kept_uploads > 0)
+      oss << "basebackups kept for pending uploads: " << plan->kept_uploads << endl;
+
+    cout << oss.str();
+    return;
+
+  }
+
+  oss << "basebackups to drop: " << plan->cleanupDescr->basebackups.size() << endl;
+
+  for (auto &bbdescr : plan->cleanupDescr->basebackups) {
+
+    oss << "  id " << bbdescr->id
+        << ", stopped " << (bbdescr->stopped.length() > 0 ? bbdescr->stopped : "N/A")
+        << ", " << bbdescr->fsentry << endl;
+
+  }
+
+  oss << "basebackups kept for incremental basebackups: " << plan->kept_parents << endl;
+
+  if (plan->kept_uploads > 0)
+    oss << "basebackups kept for pending uploads: " << plan->kept_uploads << endl;
+
+  if (plan->cleanupDescr->mode != NO_WAL_TO_DELETE) {
+
+    for (auto &offset : plan->cleanupDescr->off_list) {
+
+      oss << "WAL cleanup offset on timeline " << offset.first << ": "
+          << PGStream::encodeXLOGPos(offset.second->wal_cleanup_start_pos) << endl;
+
+    }
+
+  }
+
+  oss << "WAL files to remove: " << plan->wal.files
+      << " (" << plan->wal.bytes << " bytes)" << endl;
+  oss << "estimated bytes freed: " << plan->bytesFreed() << endl;
+
+  cout << oss.str();
+
+}
+
+void ApplyRetentionPolicyCommand::execute(bool flag) {
+
+  shared_ptr<CatalogDescr> archiveDescr      = nullptr;
+  shared_ptr<RetentionPlanner> planner = nullptr;
+  shared_ptr<RetentionPlan> plan = nullptr;
+  bool has_tx = false; /* stores state of current TX */
+
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
+  }
+
+  /*
+   * Empty retention identifier doesn't make sense here.
+   */
+  if (this->retention_name.length() == 0) {
+    throw CArchiveIssue("empty retention name not allowed here");
+  }
+
+  /**
+   * Enter the cleanup procedure. This is done within one transaction
+   * to make sure no other write operations interfere with us.
+   */
+  try {
+
+    shared_ptr<BackupDirectory> backupDir = nullptr;
+
+#ifdef __DEBUG__
+    BOOST_LOG_TRIVIAL(debug) << "DEBUG: operating on directory "
+                             << this->directory;
+#endif
+
+    this->catalog->startTransaction();
+
+    /* remember state of this TX */
+    has_tx = true;
+
+    /**
+     * Archive name really exists ?
+     */
+    archiveDescr = this->catalog->existsByName(this->archive_name);
+
+    if (archiveDescr->id < 0) {
+
+      ostringstream oss;
+
+      oss << "archive \"" << this->archive_name << "\" does not exist";
+
+      /* throw, this will be handled by the exception handler below
+       * and re-thrown to the caller */
+      throw CArchiveIssue(oss.str());
+
+    }
+
+    /*
+     * Initialize directory handle needed to sync the archive afterwards.
+     */
+    backupDir = make_shared<BackupDirectory>(path(archiveDescr->directory));
+
+    /*
+     * Assign the archive id within this command handler
+     * (we might need it later) and assign the LIST_ARCHIVE tag
+     * to it. This will tell catalog lookup methods that we
+     * have a descriptor carrying all information for the archive
+     */
+    this->id = archiveDescr->id;
+    archiveDescr->tag = LIST_ARCHIVE;
+
+    /*
+     * Plan the retention run. Lock info is required to synchronize
+     * against pinning, invalid (or in-progress) basebackups and
+     * shared memory locks. The latter is only true if there's a background
+     * launcher running which maintains the worker shared memory area.
+     *
+     * NOTE: worker SHM might not yet be initialized, so we are careful
+     *       to check for a running launcher process.
+     */
+    {
+      shared_ptr<CatalogProc> procInfo = catalog->getProc(-1,
+                                                          CatalogProc::PROC_TYPE_LAUNCHER);
+
+      planner = make_shared<RetentionPlanner>(this->catalog, archiveDescr, this->retention_name);
+      planner->addLockInfo(make_shared<BackupPinnedValidLockInfo>());
+
+      if (launcher_is_running(procInfo)) {
+
+        shared_ptr<WorkerSHM> worker_shm = make_shared<WorkerSHM>();
+
+        worker_shm->attach(this->catalog->fullname(), true);
+        planner->addLockInfo(make_shared<SHMBackupLockInfo>(worker_shm));
 
-    /*
-     * Check if we have a compatible previous
-     * basebackup already in the catalog. check() doesn't
-     * throw, but will return a BaseBackupErrorCode flag
-     * telling us what went wrong.
-     */
-    switch(this->check(temp_descr->id, pgstream.streamident)) {
-    case BASEBACKUP_CATALOG_FORCE_SYSTEMID_UPDATE:
-      {
-        BOOST_LOG_TRIVIAL(warning)
-          << "WARNING: we are streaming a basebackup with a new systemid\n"
-          << "         new systemid = "
-          << pgstream.streamident.systemid;
-        break;
       }
-    case BASEBACKUP_CATALOG_INVALID_SYSTEMID:
-      {
-        /*
-         * There is a previous basebackup with a different
-         * systemid. we don't want to implicitely migrate
-         * any basebackup here to another cluster, so tell the
-         * caller that this is wrong.
-         *
-         * NOTE: We are already within a try..catch block,
-         *       so we don't do any cleanup here and leave it
-         *       up to the exception handler to clean everything
-         *       behind us.
-         */
 
-        ostringstream oss;
+      plan = planner->plan();
 
-        oss << "systemid("
-            << pgstream.streamident.systemid
-            << ") of last basebackup in the catalog does not match";
-        throw CCatalogIssue(oss.str());
+      /*
+       * PREVIEW just prints the plan, which stays cached for
+       * a subsequent APPLY without PREVIEW.
+       */
+      if (this->retention_preview) {
+
+        this->printPlan(plan);
+
+        this->catalog->rollbackTransaction();
+        has_tx = false;
+        return;
 
       }
 
-    default:
-      /* nothing to do here */
-      break;
+      /* In case nothing to do, exit */
+      if (plan->empty() && !plan->migrates()) {
+
+        cout << "no basebackups matches retention policy" << endl;
+
+        this->catalog->rollbackTransaction();
+        has_tx = false;
+        return;
+
+      }
+
+      planner->execute(plan);
+
     }
 
     /*
-     * Get basebackup stream handle.
+     * Now it's time to commit all database work. It might
+     * happen that we fail here, but redoing the whole work
+     * should be possible.
+     */
+    this->catalog->commitTransaction();
+    has_tx = false;
+
+    /*
+     * Fsync backup directory contents. Errors are ignored
+     * as before, the catalog changes are already committed.
+     */
+    {
+      RecursiveSync sync(backupDir->getArchiveDir());
+      RecursiveSyncProgress result;
+
+      if (this->runtime_config != nullptr) {
+
+        std::string method;
+        int parallelism = 0;
+
+        this->runtime_config->get("recursive_sync.method")->getValue(method);
+        this->runtime_config->get("recursive_sync.parallelism")->getValue(parallelism);
+
+        sync.setMethod(RecursiveSync::methodFromString(method));
+        sync.setParallelism(parallelism);
+
+      }
+
+      sync.setIgnoreErrors(true);
+      sync.setProgressCallback([](const RecursiveSyncProgress &progress) {
+          BOOST_LOG_TRIVIAL(info) << "synced " << progress.synced
+                                  << " of " << progress.total << " files and directories";
+        }, std::chrono::milliseconds(5000));
+
+      result = sync.sync();
+
+      BOOST_LOG_TRIVIAL(debug) << "synced archive directory using "
+                               << RecursiveSync::methodToString(result.method)
+                               << " in " << result.elapsed.count() << "ms, "
+                               << result.errors << " errors";
+    }
+
+    /*
+     * Moving to the cold tier copies whole basebackups, which
+     * must not block the catalog. The planning transaction is done
+     * already, every basebackup moved is committed on its own.
+     */
+    if (plan->migrates()) {
+
+      unsigned int moved = planner->migrate(plan);
+
+      cout << "moved " << moved << " basebackups and "
+           << plan->wal_moved.files << " WAL files to \""
+           << plan->cold_directory << "\"" << endl;
+
+    }
+
+  } catch (CPGBackupCtlFailure &e) {
+
+    if (has_tx)
+      this->catalog->rollbackTransaction();
+
+    /* don't hide any errors to caller */
+    throw e;
+
+  } catch(filesystem_error &e) {
+
+    if (has_tx)
+      this->catalog->rollbackTransaction();
+
+    /* remap to internal pg_backup_ctl++ exception */
+    throw CPGBackupCtlFailure(e.what());
+
+  }
+
+
+}
+
+CreateRetentionPolicyCommand::CreateRetentionPolicyCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+
+}
+
+CreateRetentionPolicyCommand::CreateRetentionPolicyCommand(std::shared_ptr<BackupCatalog> catalog) {
+
+  this->tag     = CREATE_RETENTION_POLICY;
+  this->catalog = catalog;
+
+}
+
+CreateRetentionPolicyCommand::CreateRetentionPolicyCommand() {
+
+  this->tag = CREATE_RETENTION_POLICY;
+
+}
+
+void CreateRetentionPolicyCommand::execute(bool flag) {
+
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
+  }
+
+  try {
+
+    /*
+     * Checkout if a retention policy with this name exists.
+     *
+     * Returns a completely initialized RetentionDescr instance,
+     * which is thrown away in case there is a conflict. We might
+     * want a cheaper operation than getRetentionPolicy(), though
+     * it's not available yet.
      */
-    bbp = pgstream.basebackup(backupProfile);
+    shared_ptr<RetentionDescr> retentionPolicy = nullptr;
 
     /*
-     * Set signal handler
+     * Catalog changes involves multiple entities, so use
+     * a transaction here.
      */
-    bbp->assignStopHandler(this->stopHandler);
+    this->catalog->startTransaction();
 
     /*
-     * Enter basebackup stream.
+     * Yes, it's ugly, but currently the parser bound the
+     * retention policy identifier as an archive_name to the
+     * CatalogDescr.
+     *
+     * XXX: Replace the identifier <-> parser schema with something
+     *      more sophisticated.
      */
-    bbp->prepareStream(backupHandle);
-    bbp->start();
+    retentionPolicy = this->catalog->getRetentionPolicy(this->archive_name);
+
+    if (retentionPolicy->id >= 0) {
+
+      /*
+       * whoops, this identifier already exists. This exception
+       * is catched by the try..catch block below, but will be re-thrown.
+       */
+      throw CCatalogIssue("retention policy with name\""
+                          + retentionPolicy->name
+                          + "\" already exists");
+    }
 
     /*
-     * Now its time to register this basebackup handle to
-     * the catalog. Do the rollback in our own exception handler
-     * in case of errors.
-     *
-     * NOTE: Since the streaming directory handle is just passed to
-     *       stepTablespace(), but we need to register the basebackup
-     *       before, we must set the fsentry to the basebackup descriptor
-     *       ourselves!
+     * Okay, policy seems to be new, go forward and try
+     * to create it.
      */
-    basebackupDescr = bbp->getBaseBackupDescr();
+#ifdef __DEBUG__
+    BOOST_LOG_TRIVIAL(debug) << "creating retention rule with identifier "
+                             << this->retention->name;
+#endif
 
-    this->catalog->startTransaction();
+    this->catalog->createRetentionPolicy(this->retention);
 
-    try {
+    /* and we're done ... */
+    this->catalog->commitTransaction();
 
-      basebackupDescr->archive_id = temp_descr->id;
-      basebackupDescr->fsentry = backupHandle->backupDirectoryString();
-      basebackupDescr->pg_version_num = pgstream.getServerVersion();
+  } catch(CPGBackupCtlFailure &e) {
 
-      BOOST_LOG_TRIVIAL(debug) << "directory handle path " << basebackupDescr->fsentry;
+    this->catalog->rollbackTransaction();
 
-      this->catalog->registerBasebackup(temp_descr->id,
-                                        basebackupDescr);
-      this->catalog->commitTransaction();
+    /* don't hide this exception */
+    throw e;
 
-    } catch(CPGBackupCtlFailure &e) {
-      this->catalog->rollbackTransaction();
-      throw e;
+  }
+}
+
+CreateBackupProfileCatalogCommand::CreateBackupProfileCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+
+  /*
+   * BaseCatalogCommand::copy() has no idea of submodule objects belongig
+   * to a given catalog descriptor. We need to copy them explicitely.
+   */
+  this->profileDescr = descr->getBackupProfileDescr();
+
+}
+
+CreateBackupProfileCatalogCommand::CreateBackupProfileCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
+  this->tag = CREATE_BACKUP_PROFILE;
+  this->catalog = catalog;
+}
+
+CreateBackupProfileCatalogCommand::CreateBackupProfileCatalogCommand() {
+  this->tag = CREATE_BACKUP_PROFILE;
+}
+
+void CreateBackupProfileCatalogCommand::setProfile(std::shared_ptr<BackupProfileDescr> profileDescr) {
+  this->profileDescr = profileDescr;
+}
+
+void CreateBackupProfileCatalogCommand::verify(bool print_version) {
+
+  job_info jobDescr;
+
+  namespace bf = boost::filesystem;
+
+  jobDescr.background_exec = true;
+
+  /*
+   * Check the compression level against the
+   * selected compression method.
+   */
+  if (this->profileDescr->compress_level < 0
+      || this->profileDescr->compress_level
+      > BackupProfileDescr::maxCompressionLevel(this->profileDescr->compress_type)) {
+    std::ostringstream oss;
+    oss << "invalid compression level "
+        << this->profileDescr->compress_level
+        << " for compression "
+        << BackupProfileDescr::compressionType(this->profileDescr->compress_type);
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (this->profileDescr->compress_workers < 0) {
+    throw CArchiveIssue("number of compression workers must not be negative");
+  }
+
+  if (this->profileDescr->parallel_writers < 0
+      || this->profileDescr->parallel_writers > BACKUP_PROFILE_MAX_PARALLEL_WRITERS) {
+    std::ostringstream oss;
+    oss << "number of parallel archive writers must be between 0 and "
+        << BACKUP_PROFILE_MAX_PARALLEL_WRITERS;
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * Incremental basebackups are computed by the server against
+   * the manifest of its parent, so without a manifest stored
+   * along with each basebackup there is nothing to upload later.
+   */
+  if (this->profileDescr->incremental && !this->profileDescr->manifest) {
+    throw CArchiveIssue("incremental basebackups require MANIFEST INCLUDED");
+  }
+
+  /*
+   * The server only knows about gzip, lz4 and zstd, and only
+   * zstd is able to use worker threads.
+   */
+  if (this->profileDescr->server_compression) {
+
+    switch(this->profileDescr->compress_type) {
+    case BACKUP_COMPRESS_TYPE_GZIP:
+    case BACKUP_COMPRESS_TYPE_LZ4:
+    case BACKUP_COMPRESS_TYPE_ZSTD:
+      break;
+    default:
+      throw CArchiveIssue("compression LOCATION SERVER requires GZIP, LZ4 or ZSTD");
     }
 
-    /*
-     * Remember successful registration of this basebackup.
-     */
-    basebackup_registered = true;
+    if (this->profileDescr->compress_workers > 0
+        && this->profileDescr->compress_type != BACKUP_COMPRESS_TYPE_ZSTD) {
+      throw CArchiveIssue("compression WORKERS with LOCATION SERVER requires ZSTD");
+    }
 
-    BOOST_LOG_TRIVIAL(debug) << "basebackup stream started";
+  }
 
-    /*
-     * Initialize list of tablespaces, if any.
-     */
-    bbp->readTablespaceInfo();
+  /*
+   * Chunks are hashed and compressed by ourselves, a tar stream
+   * compressed by the server or by a command line tool can't be
+   * deduplicated.
+   */
+  if (this->profileDescr->deduplicate) {
 
-    BOOST_LOG_TRIVIAL(debug) << "basebackup tablespace meta info requested";
+    if (this->profileDescr->server_compression) {
+      throw CArchiveIssue("DEDUPLICATE can't be used with compression LOCATION SERVER");
+    }
 
-    /*
-     * Loop through tablespaces and stream their contents.
-     */
-    bbp->stream(catalog);
+    if (!DedupChunkStore::supported(this->profileDescr->compress_type)) {
+      std::ostringstream oss;
+      oss << "DEDUPLICATE is not supported with compression "
+          << BackupProfileDescr::compressionType(this->profileDescr->compress_type)
+          << " by this build";
+      throw CArchiveIssue(oss.str());
+    }
 
-    /*
-     * Call end position in backup stream.
-     */
-    bbp->end();
+  }
 
-    /*
-     * And disconnect
-     */
-    BOOST_LOG_TRIVIAL(debug) << "DEBUG: disconnecting stream";
-    pgstream.disconnect();
+  /*
+   * When creating a backup profile we check
+   * if certain compression methods are possible
+   * since they are backed by command line tools. Atm
+   * these are:
+   *
+   * XZ - requires XZ command line tool without liblzma
+   * ZSTD - requires the ZSTD command line tool without libzstd
+   * LZ4 - requires the lz4 command line tool without liblz4
+   * PLAIN - requires the tar command line tool
+   */
+  switch(this->profileDescr->compress_type) {
 
-  } catch(CPGBackupCtlFailure& e) {
+  case BACKUP_COMPRESS_TYPE_PLAIN:
+    {
+      path tar("tar");
+      ArchivePipedProcess app(tar);
+      char buf[4];
 
-    bool txinprogress = false;
+      if (!CPGBackupCtlBase::resolve_file_path(tar.string())) {
+        throw CArchiveIssue("cannot resolve path for binary tar");
+      }
 
-    /*
-     * If the basebackup was already registered, mark it
-     * as aborted. This is sad even if all went through, but only
-     * disconnecting from the server throws an error, but we treat this
-     * as an error nevertheless. We must be careful here, since catalog
-     * operations itself can throw exceptions and we don't mask
-     * those errors with the current one.
-     */
-    try {
-      if (basebackup_registered) {
-        this->catalog->startTransaction();
-        txinprogress = true;
+      app.setExecutable(tar);
+      app.pushExecArgument("--version");
 
-#ifdef __DEBUG__
-        BOOST_LOG_TRIVIAL(debug) << "marking basebackup as aborted";
+      app.setOpenMode("r");
+      app.open();
+
+      while(app.read(buf, 1) >= 1)
+        cout << buf;
+
+      app.close();
+      break;
+    }
+
+#ifndef PG_BACKUP_CTL_HAS_LIBZSTD
+  case BACKUP_COMPRESS_TYPE_ZSTD:
+    {
+      path zstd("zstd");
+      ArchivePipedProcess app(zstd);
+      char buf[4];
+
+      if (!CPGBackupCtlBase::resolve_file_path(zstd.string())) {
+        throw CArchiveIssue("cannot resolve path for binary zstd");
+      }
+
+      app.setExecutable(zstd);
+      app.pushExecArgument("--version");
+
+      app.setOpenMode("r");
+      app.open();
+
+      while(app.read(buf, 1) >= 1)
+        cout << buf;
+
+      app.close();
+      break;
+
+    }
 #endif
 
-        this->catalog->abortBasebackup(bbp->getBaseBackupDescr());
-        this->catalog->commitTransaction();
+#ifndef PG_BACKUP_CTL_HAS_LIBLZMA
+  case BACKUP_COMPRESS_TYPE_XZ:
+    {
+      path xz("xz");
+      ArchivePipedProcess app(xz);
+      char buf[4];
+
+      if (!CPGBackupCtlBase::resolve_file_path(xz.string())) {
+        throw CArchiveIssue("cannot resolve path for binary xz");
       }
-    } catch (CPGBackupCtlFailure &e) {
-      if (txinprogress)
-        this->catalog->rollbackTransaction();
+
+      app.setExecutable(xz);
+      app.pushExecArgument("--version");
+
+      app.setOpenMode("r");
+      app.open();
+
+      while(app.read(buf, 1) >= 1)
+        cout << buf;
+
+      app.close();
+      break;
+    }
+#endif
+
+#ifndef PG_BACKUP_CTL_HAS_LIBLZ4
+  case BACKUP_COMPRESS_TYPE_LZ4:
+  {
+    path lz("lz4");
+    ArchivePipedProcess app(lz);
+    char buf[4];
+
+    if (!CPGBackupCtlBase::resolve_file_path(lz.string())) {
+      throw CArchiveIssue("cannot resolv path for binary lz");
     }
 
-    /* re-throw ... */
-    throw e;
+    app.setExecutable(lz);
+    app.pushExecArgument("--version");
 
-  }
+    app.setOpenMode("r");
+    app.open();
 
-  /*
-   * Everything seems okay for now, finalize the backup
-   * registration.
-   */
-  this->catalog->startTransaction();
+    while (app.read(buf, 1) >= 1)
+      cout << buf;
 
-  try {
-    this->catalog->finalizeBasebackup(bbp->getBaseBackupDescr());
-    this->catalog->commitTransaction();
-  } catch (CPGBackupCtlFailure &e) {
-    this->catalog->rollbackTransaction();
-    throw e;
+    app.close();
+    break;
   }
+#endif
 
-}
-
-DropBackupProfileCatalogCommand::DropBackupProfileCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
-  this->tag = DROP_BACKUP_PROFILE;
-  this->catalog = catalog;
-}
-
-DropBackupProfileCatalogCommand::DropBackupProfileCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
-
-  this->copy(*(descr.get()));
+  default:
+    break; /* nothing to do here */
+  }
 
 }
 
-void DropBackupProfileCatalogCommand::execute(bool extended) {
+void CreateBackupProfileCatalogCommand::execute(bool existsOk) {
 
-  /*
-   * Die hard in case no catalog available.
-   */
   if (this->catalog == nullptr)
     throw CArchiveIssue("could not execute archive command: no catalog");
 
+#ifdef __DEBUG__
+  BOOST_LOG_TRIVIAL(debug) << "profile attributes";
+  BOOST_LOG_TRIVIAL(debug) << "name: " << this->profileDescr->name;
+  BOOST_LOG_TRIVIAL(debug) << "compression: " << this->profileDescr->compress_type;
+  BOOST_LOG_TRIVIAL(debug) << "max rate: " << this->profileDescr->max_rate;
+  BOOST_LOG_TRIVIAL(debug) << "label: " << this->profileDescr->label;
+  BOOST_LOG_TRIVIAL(debug) << "wal included: " << this->profileDescr->include_wal;
+  BOOST_LOG_TRIVIAL(debug) << "wait for wal: " << this->profileDescr->wait_for_wal;
+  BOOST_LOG_TRIVIAL(debug) << "manifest: " << this->profileDescr->manifest;
+  BOOST_LOG_TRIVIAL(debug) << "manifest checksums: " << this->profileDescr->manifest_checksums;
+  BOOST_LOG_TRIVIAL(debug) << "compression level: " << this->profileDescr->compress_level;
+  BOOST_LOG_TRIVIAL(debug) << "compression workers: " << this->profileDescr->compress_workers;
+  BOOST_LOG_TRIVIAL(debug) << "parallel writers: " << this->profileDescr->parallel_writers;
+  BOOST_LOG_TRIVIAL(debug) << "incremental: " << this->profileDescr->incremental;
+  BOOST_LOG_TRIVIAL(debug) << "server compression: " << this->profileDescr->server_compression;
+  BOOST_LOG_TRIVIAL(debug) << "adaptive rate: " << this->profileDescr->adaptive_rate;
+  BOOST_LOG_TRIVIAL(debug) << "deduplicate: " << this->profileDescr->deduplicate;
+#endif
+
   /*
-   * Open the catalog, if not yet done.
+   * Open the catalog, if necessary.
    */
   if (!this->catalog->available()) {
     this->catalog->open_rw();
   }
 
-  try {
+  /*
+   * Do some preliminary checks...
+   */
+  this->verify();
 
-    catalog->startTransaction();
+  try {
 
     /*
-     * Check if the specified backup profile exists. Error
-     * out with an exception if not found.
+     * Start catalog transaction.
      */
-    std::shared_ptr<BackupProfileDescr> profileDescr = this->getBackupProfileDescr();
-    std::shared_ptr<BackupProfileDescr> temp_descr = catalog->getBackupProfile(profileDescr->name);
+    this->catalog->startTransaction();
 
     /*
-     * NOTE: BackupCatalog::getBackupProfile() always returns an
-     *       BackupProfileDescr, but in case the specified
-     *       name doesn't exists it is initialized with profile_id = -1
+     * Check if the specified backup profile already exists
      */
+    std::shared_ptr<BackupProfileDescr> temp_descr = catalog->getBackupProfile(this->profileDescr->name);
+
     if (temp_descr->profile_id < 0) {
-      std::ostringstream oss;
-      oss << "backup profile \"" << profileDescr->name << "\"" << endl;
-      throw CCatalogIssue(oss.str());
+
+      /*
+       * Create the new profile.
+       *
+       * NOTE: we can't bindly use the new BackupProfileDescr passed down
+       *       from the parser, since it might not have seen all
+       *       the attributes, the user might decided not to overwrite its default.
+       *       Hence, pass down all attributes which are required to create
+       *       a new entry.
+       */
+
+      std::vector<int> attr;
+      attr.push_back(SQL_BCK_PROF_NAME_ATTNO);
+      attr.push_back(SQL_BCK_PROF_COMPRESS_TYPE_ATTNO);
+      attr.push_back(SQL_BCK_PROF_MAX_RATE_ATTNO);
+      attr.push_back(SQL_BCK_PROF_LABEL_ATTNO);
+      attr.push_back(SQL_BCK_PROF_FAST_CHKPT_ATTNO);
+      attr.push_back(SQL_BCK_PROF_INCL_WAL_ATTNO);
+      attr.push_back(SQL_BCK_PROF_WAIT_FOR_WAL_ATTNO);
+      attr.push_back(SQL_BCK_PROF_NOVERIFY_CHECKSUMS_ATTNO);
+      attr.push_back(SQL_BCK_PROF_MANIFEST_ATTNO);
+      attr.push_back(SQL_BCK_PROF_MANIFEST_CHECKSUMS_ATTNO);
+      attr.push_back(SQL_BCK_PROF_COMPRESS_LEVEL_ATTNO);
+      attr.push_back(SQL_BCK_PROF_COMPRESS_WORKERS_ATTNO);
+      attr.push_back(SQL_BCK_PROF_PARALLEL_WRITERS_ATTNO);
+      attr.push_back(SQL_BCK_PROF_INCREMENTAL_ATTNO);
+      attr.push_back(SQL_BCK_PROF_SERVER_COMPRESSION_ATTNO);
+      attr.push_back(SQL_BCK_PROF_ADAPTIVE_RATE_ATTNO);
+      attr.push_back(SQL_BCK_PROF_DEDUPLICATE_ATTNO);
+
+      this->profileDescr->setAffectedAttributes(attr);
+      this->catalog->createBackupProfile(this->profileDescr);
+
+    } else {
+
+      /* profile already exists! */
+      if (!existsOk) {
+        ostringstream oss;
+        oss << "backup profile " << this->profileDescr->name << " already exists";
+        throw CCatalogIssue(oss.str());
+      }
+
     }
 
-    catalog->dropBackupProfile(profileDescr->name);
-    catalog->commitTransaction();
+    this->catalog->commitTransaction();
 
-  } catch(exception& e) {
-    catalog->rollbackTransaction();
-    /* re-throw exception */
+  } catch(CPGBackupCtlFailure& e) {
+    this->catalog->rollbackTransaction();
     throw e;
   }
-}
 
-ListBackupProfileCatalogCommand::ListBackupProfileCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
-  this->tag = LIST_BACKUP_PROFILE;
-  this->catalog = catalog;
 }
 
-ListBackupProfileCatalogCommand::ListBackupProfileCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+VerifyArchiveCatalogCommand::VerifyArchiveCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
 
   this->copy(*(descr.get()));
 
 }
 
-void ListBackupProfileCatalogCommand::execute(bool extended) {
+VerifyArchiveCatalogCommand::VerifyArchiveCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
+  this->tag = VERIFY_ARCHIVE;
+  this->catalog = catalog;
+}
 
-  shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(make_shared<OutputFormatConfiguration>(),
-                                                                     catalog,
-                                                                     getOutputFormat());
+VerifyArchiveCatalogCommand::VerifyArchiveCatalogCommand() {
+  this->tag = VERIFY_ARCHIVE;
+}
+
+void VerifyArchiveCatalogCommand::execute(bool missingOK) {
+
+  /*
+   * Check if the specified archive really exists.
+   */
   shared_ptr<CatalogDescr> temp_descr(nullptr);
-  ostringstream output;
 
   /*
    * Die hard in case no catalog available.
@@ -2743,1539 +5288,1412 @@ void ListBackupProfileCatalogCommand::execute(bool extended) {
     this->catalog->open_rw();
   }
 
+  /*
+   * Check archive directory structure.
+   */
   try {
 
     catalog->startTransaction();
 
+    temp_descr = catalog->existsByName(this->archive_name);
+
+    if (temp_descr->id < 0) {
+      ostringstream oss;
+      oss << "archive " << this->archive_name << " does not exist";
+      throw CCatalogIssue(oss.str());
+    }
+
     /*
-     * Get a list of current backup profiles. If the name is requested,
-     * show the details only.
+     * There is an archive with the specified identifier registered.
+     * Get an archive directory handle and check whether its directory structure
+     * is intact.
      */
-    if (this->tag == LIST_BACKUP_PROFILE) {
+    shared_ptr<BackupDirectory> archivedir = CPGBackupCtlFS::getArchiveDirectoryDescr(temp_descr->directory);
+    std::ostringstream output;
 
-      auto profileList = catalog->getBackupProfiles();
+    archivedir->exists();
+    this->catalog->commitTransaction();
 
-      formatter->nodeAs(profileList, output);
+    (OutputFormatter::formatter(make_shared<OutputFormatConfiguration>(),
+                                catalog,
+                                getOutputFormat()))->nodeAs("OK",
+                                                            output);
+    cout << output.str();
 
+  } catch(CPGBackupCtlFailure& e) {
 
-    } else if (this->tag == LIST_BACKUP_PROFILE_DETAIL) {
+    this->catalog->rollbackTransaction();
+    throw e;
 
-      std::shared_ptr<BackupProfileDescr> profile
-        = this->catalog->getBackupProfile(this->getBackupProfileDescr()->name);
+  }
 
-      formatter->nodeAs(profile, output);
+  /*
+   * If requested, check connection of the specified archive.
+   * We won't reached this in case the directory has failed.
+   *
+   * We get a list of all connections specified for
+   * the given archive ID and test CONNECTION_TYPE_BASEBACKUP
+   * and CONNECTION_TYPE_STREAMER.
+   */
+  if (this->check_connection) {
+
+    /*
+     * Get the list of (possible) streaming or basebackup connections.
+     * Other types are ignored (if any).
+     *
+     * We rely on existsByName() to have initialized temp_descr properly, if
+     * the specified archive exists.
+     */
+    if (temp_descr != nullptr && temp_descr->id >= 0) {
 
+      vector<shared_ptr<ConnectionDescr>> connection_list;
 
-    }
+      connection_list = catalog->getCatalogConnection(temp_descr->id);
 
-    catalog->commitTransaction();
+      /*
+       * At least on connection (type basebackup is expected)
+       */
+      if (connection_list.size() == 0) {
+        throw CArchiveIssue("specified archive does not have a database connection");
+      }
 
-    /* finally output results */
-    cout << output.str();
+      for (auto &con : connection_list) {
 
-  } catch (exception& e) {
-    this->catalog->rollbackTransaction();
-    throw e;
+        temp_descr->coninfo = con;
+
+        if (con->type == ConnectionDescr::CONNECTION_TYPE_BASEBACKUP) {
+
+
+          PGStream stream(temp_descr);
+
+          cout << "check basebackup database connection: ";
+          stream.testConnection();
+          cout << "OK" << endl;
+
+        }
+
+        if (con->type == ConnectionDescr::CONNECTION_TYPE_STREAMER) {
+
+          PGStream stream(temp_descr);
+
+          cout << "check streaming database connection: ";
+          stream.testConnection();
+          cout << "OK" << endl;
+        }
+
+      }
+    }
   }
 
 }
 
-DropRetentionPolicyCommand::DropRetentionPolicyCommand() {}
-
-DropRetentionPolicyCommand::DropRetentionPolicyCommand(std::shared_ptr<CatalogDescr> descr) {
+ListArchiveCatalogCommand::ListArchiveCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
 
   this->copy(*(descr.get()));
 
 }
 
-DropRetentionPolicyCommand::DropRetentionPolicyCommand(std::shared_ptr<BackupCatalog> catalog) {
-
-  this->tag = DROP_RETENTION_POLICY;
+ListArchiveCatalogCommand::ListArchiveCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
+  this->tag = LIST_ARCHIVE;
   this->catalog = catalog;
+}
 
+ListArchiveCatalogCommand::ListArchiveCatalogCommand() {
+  this->tag = LIST_ARCHIVE;
 }
 
-DropRetentionPolicyCommand::~DropRetentionPolicyCommand() {}
+void ListArchiveCatalogCommand::execute(bool extendedOutput) {
+
+  shared_ptr<OutputFormatConfiguration> output_config
+    = make_shared<OutputFormatConfiguration>();
+  shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(output_config,
+                                                                     catalog,
+                                                                     getOutputFormat());
+  shared_ptr<list<shared_ptr<CatalogDescr>>> archiveList(nullptr);
+  shared_ptr<CatalogDescr> temp_descr(nullptr);
 
-void DropRetentionPolicyCommand::execute(bool flag) {
+  std::ostringstream output;
 
-  bool have_tx = false;
+  /*
+   * Die hard in case no catalog available.
+   */
+  if (this->catalog == nullptr)
+    throw CArchiveIssue("could not execute archive command: no catalog");
 
   /*
-   * Check catalog.
+   * Open the catalog, if not yet done.
    */
-  if (this->catalog == nullptr) {
-    throw CArchiveIssue("could not execute command: no catalog");
+  if (!this->catalog->available()) {
+    this->catalog->open_rw();
   }
 
   try {
+    catalog->startTransaction();
 
-    shared_ptr<RetentionDescr> retention = nullptr;
+    if (this->mode == ARCHIVE_LIST) {
 
-    this->catalog->startTransaction();
-    have_tx = true;
+      output_config->create("list_archive.mode",
+                            std::string("full"),
+                            std::string("full"));
 
-    retention = this->catalog->getRetentionPolicy(this->archive_name);
+      /*
+       * Get a list of current registered archives in the catalog.
+       */
+      archiveList = catalog->getArchiveList();
 
-    if (retention != nullptr && retention->id >= 0) {
+    }
+    else if (this->mode == ARCHIVE_FILTERED_LIST) {
 
-      /* delete the retention policy */
-      this->catalog->dropRetentionPolicy(retention->name);
-    } else {
+      /*
+       * Get a filtered list for the specified properties.
+       *
+       * This is not really employed here atm, but may change
+       * in the future.
+       */
+      archiveList = catalog->getArchiveList(make_shared<CatalogDescr>(*this),
+                                            this->affectedAttributes);
 
-      ostringstream oss;
+      output_config->create("list_archive.mode",
+                            std::string("filtered"),
+                            std::string("filtered"));
 
-      oss << "retention policy \""
-          << this->archive_name
-          << "\" does not exist";
+    } else if (this->mode == ARCHIVE_DETAIL_LIST) {
+      /*
+       * Parser has marked this as a detailed view, which
+       * means that we just had to display the details
+       * of the specified archive NAME.
+       *
+       * NOTE: In this case we usually don't
+       * expect multiple results, however, the code supports this
+       * at this point nevertheless, since we just call
+       * getArchiveList with the affected NAME property attached only.
+       */
+      output_config->create("list_archive.mode",
+                            std::string("detail"),
+                            std::string("detail"));
 
       /*
-       * Throw a CArchiveIssue, telling that the retention
-       * policy wasn't found in the catalog. We don't
-       * handle the transaction here, since we catch this
-       * in the outer exception handler and re-throw there.
+       * Get a filtered list for the specified properties.
        */
-      throw CArchiveIssue(oss.str());
+      archiveList = catalog->getArchiveList(make_shared<CatalogDescr>(*this),
+                                            this->affectedAttributes);
 
     }
 
-    this->catalog->commitTransaction();
-    have_tx = false;
-
-  } catch (CPGBackupCtlFailure &e) {
-
-    if (have_tx) {
-      this->catalog->rollbackTransaction();
-      have_tx = false;
-    }
+    catalog->commitTransaction();
 
+  } catch (CPGBackupCtlFailure& e) {
+    /* rollback transaction */
+    catalog->rollbackTransaction();
     throw e;
   }
-}
 
-ListRetentionPolicyCommand::ListRetentionPolicyCommand() {
+  catalog->close();
 
-  this->tag = LIST_RETENTION_POLICY;
+  /* Print results */
+  formatter->nodeAs(archiveList, output);
+  cout << output.str();
 
 }
 
-ListRetentionPolicyCommand::ListRetentionPolicyCommand(std::shared_ptr<CatalogDescr> descr) {
-
-  this->copy(*(descr.get()));
+void ListArchiveCatalogCommand::setOutputMode(ListArchiveOutputMode mode) {
+  this->mode = mode;
+}
 
+AlterArchiveCatalogCommand::AlterArchiveCatalogCommand() {
+  this->tag = ALTER_ARCHIVE;
 }
 
-ListRetentionPolicyCommand::ListRetentionPolicyCommand(std::shared_ptr<BackupCatalog> catalog) {
+AlterArchiveCatalogCommand::AlterArchiveCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
 
-  this->tag = LIST_RETENTION_POLICY;
-  this->catalog = catalog;
+  this->copy(*(descr.get()));
+}
 
+AlterArchiveCatalogCommand::AlterArchiveCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
+  this->tag = ALTER_ARCHIVE;
+  this->catalog = catalog;
 }
 
-ListRetentionPolicyCommand::~ListRetentionPolicyCommand() {}
+void AlterArchiveCatalogCommand::execute(bool ignoreMissing) {
 
-void ListRetentionPolicyCommand::execute(bool flag) {
+  shared_ptr<CatalogDescr> temp_descr(nullptr);
 
-  if (this->catalog == nullptr) {
-    throw CArchiveIssue("could not execute command: no catalog");
-  }
+  /*
+   * Die hard in case no catalog available.
+   */
+  if (this->catalog == nullptr)
+    throw CArchiveIssue("could not execute archive command: no catalog");
 
-  /* Retention name is mandatory for this command. */
+  /*
+   * Open the catalog, if not yet done.
+   */
+  if (!this->catalog->available()) {
+    this->catalog->open_rw();
+  }
 
-  if (this->retention_name.length() == 0)
-    throw CArchiveIssue("retention name required");
+  catalog->startTransaction();
 
   try {
 
-    shared_ptr<RetentionDescr> retentionDescr = nullptr;
-    shared_ptr<OutputFormatConfiguration> output_config
-      = std::make_shared<OutputFormatConfiguration>();
-    shared_ptr<OutputFormatter> formatter
-      = OutputFormatter::formatter(output_config,
-                                   catalog,
-                                   getOutputFormat());
-    std::ostringstream output;
-
-    this->catalog->startTransaction();
-
-    retentionDescr = this->catalog->getRetentionPolicy(this->retention_name);
-
-    if (retentionDescr->id < 0) {
-
-      ostringstream oss;
+    /*
+     * Check if the specified archive name really exists.
+     * If false and ignoreMissing is false, error out. Otherwise
+     * proceed, which turns this action into a no-op, effectively.
+     */
+    temp_descr = this->catalog->existsByName(this->archive_name);
+    if (temp_descr->id >= 0) {
 
-      oss << "retention policy \"" << this->retention_name << "\" does not exist";
+      this->id = temp_descr->id;
+      this->catalog->updateArchiveAttributes(make_shared<CatalogDescr>(*this),
+                                             this->affectedAttributes);
+    } else {
 
-      /* TX exit on error is handled by the exception handler below */
-      throw CArchiveIssue(oss.str());
+      if (!ignoreMissing) {
+        ostringstream oss;
+        oss << "could not alter archive: archive name \"" << this->archive_name << "\" does not exists";
+        throw CArchiveIssue(oss.str());
+      }
 
     }
 
     this->catalog->commitTransaction();
 
-    /* Print contents of this policy */
-
-    formatter->nodeAs(retentionDescr, output);
-    std::cout << output.str();
-
-  } catch(CPGBackupCtlFailure &e) {
-
+  } catch(CPGBackupCtlFailure& e) {
     this->catalog->rollbackTransaction();
-    throw e; /* don't hide errors */
-
+    throw e;
   }
 
 }
 
-ListRetentionPoliciesCommand::ListRetentionPoliciesCommand() {
-
-  this->tag = LIST_RETENTION_POLICIES;
-
-}
-
-ListRetentionPoliciesCommand::ListRetentionPoliciesCommand(std::shared_ptr<CatalogDescr> descr) {
+DropArchiveCatalogCommand::DropArchiveCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
 
   this->copy(*(descr.get()));
-
 }
 
-ListRetentionPoliciesCommand::~ListRetentionPoliciesCommand() {}
-
-ListRetentionPoliciesCommand::ListRetentionPoliciesCommand(std::shared_ptr<BackupCatalog> catalog) {
-
-  this->tag = LIST_RETENTION_POLICIES;
+DropArchiveCatalogCommand::DropArchiveCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
   this->catalog = catalog;
+  this->tag     = DROP_ARCHIVE;
+}
 
+DropArchiveCatalogCommand::DropArchiveCatalogCommand() {
+  this->tag = DROP_ARCHIVE;
 }
 
-void ListRetentionPoliciesCommand::execute(bool flag) {
+void DropArchiveCatalogCommand::execute(bool existsOk) {
 
-  bool have_tx = false;
+  shared_ptr<CatalogDescr> temp_descr(nullptr);
 
   /*
-   * Check catalog.
+   * Die hard in case no catalog available.
    */
-  if (this->catalog == nullptr) {
-    throw CArchiveIssue("could not execute command: no catalog");
-  }
-
-  try {
+  if (this->catalog == nullptr)
+    throw CArchiveIssue("could not execute archive command: no catalog");
 
-    vector<shared_ptr<RetentionDescr>> retentionList;
-    vector<int> attrsRetention;
-    vector<int> attrsRules;
+  /*
+   * Open the catalog, if not yet done.
+   */
+  if (!this->catalog->available()) {
+    this->catalog->open_rw();
+  }
 
-    /*
-     * Start a database transaction. Though we're just reading,
-     * we want to have a TX for synchronization purposes.
-     */
-    this->catalog->startTransaction();
-    have_tx = true;
+  catalog->startTransaction();
 
+  try {
     /*
-     * Specify which attributes we want from the catalog.
+     * existsOk means in this case we check whether
+     * the archive exists. If false, raise an error, otherwise
+     * just pass which turns this method into a no-op.
      */
-    attrsRetention.push_back(SQL_RETENTION_ID_ATTNO);
-    attrsRetention.push_back(SQL_RETENTION_NAME_ATTNO);
-    attrsRetention.push_back(SQL_RETENTION_CREATED_ATTNO);
-
-    attrsRules.push_back(SQL_RETENTION_RULES_ID_ATTNO);
-    attrsRules.push_back(SQL_RETENTION_RULES_TYPE_ATTNO);
-    attrsRules.push_back(SQL_RETENTION_RULES_VALUE_ATTNO);
+    temp_descr = catalog->existsByName(this->archive_name);
 
-    /*
-     * Get policies...
-     */
-    this->catalog->getRetentionPolicies(retentionList,
-                                        attrsRetention,
-                                        attrsRules);
+    if (temp_descr->id >= 0) {
 
-    if (retentionList.size() < 1) {
+      /* archive name exists, so drop it... */
+      catalog->dropArchive(this->archive_name);
 
-      /*
-       * NOTE: Transaction rollback happens in the outer
-       *       exception handler, since we re-throw there.
-       */
-      throw CArchiveIssue("no retention policies found");
+    } else {
+
+      if (!existsOk) {
+        ostringstream oss;
+        oss << "specified archive name \"" << this->archive_name << "\" does not exists";
 
+        /*
+         * Note: cleanup handled below in exception handler.
+         */
+        throw CArchiveIssue(oss.str());
+      }
     }
 
-    this->catalog->commitTransaction();
-    have_tx = false;
+    catalog->dropArchive(this->archive_name);
+    catalog->commitTransaction();
+
+  } catch (CPGBackupCtlFailure& e) {
 
     /*
-     * Print out details.
+     * handle error condition, but don't suppress the
+     * exception from the caller
      */
-    shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(make_shared<OutputFormatConfiguration>(),
-                                                                       catalog,
-                                                                       getOutputFormat());
-    ostringstream output;
-    formatter->nodeAs(retentionList, output);
-    cout << output.str();
-
-  } catch (CPGBackupCtlFailure &e) {
-    if (have_tx) {
+    catalog->rollbackTransaction();
+    throw e;
 
-      have_tx = false;
-      this->catalog->rollbackTransaction();
+  }
 
-    }
+}
 
-    /* don't hide original exception from caller */
-    throw e;
-  }
+CreateArchiveCatalogCommand::CreateArchiveCatalogCommand() {
+  this->tag = CREATE_ARCHIVE;
 }
 
-ApplyRetentionPolicyCommand::ApplyRetentionPolicyCommand(std::shared_ptr<CatalogDescr> descr) {
+CreateArchiveCatalogCommand::CreateArchiveCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
 
   this->copy(*(descr.get()));
 
 }
 
-ApplyRetentionPolicyCommand::ApplyRetentionPolicyCommand(std::shared_ptr<BackupCatalog> catalog) {
+std::shared_ptr<BackupCatalog> BaseCatalogCommand::getCatalog() {
+  return this->catalog;
+}
 
-  this->tag = APPLY_RETENTION_POLICY;
+void BaseCatalogCommand::setCatalog(std::shared_ptr<BackupCatalog> catalog) {
   this->catalog = catalog;
-
 }
 
-ApplyRetentionPolicyCommand::ApplyRetentionPolicyCommand() {
+CreateArchiveCatalogCommand::CreateArchiveCatalogCommand(shared_ptr<BackupCatalog> catalog) {
 
-  this->tag = APPLY_RETENTION_POLICY;
+  this->catalog = catalog;
+  this->tag = CREATE_ARCHIVE;
 
 }
 
-ApplyRetentionPolicyCommand::~ApplyRetentionPolicyCommand() {}
-
-shared_ptr<BackupCleanupDescr> ApplyRetentionPolicyCommand::applyRulesAndRemoveBasebackups(shared_ptr<CatalogDescr> archiveDescr) {
+void CreateArchiveCatalogCommand::execute(bool existsOk) {
 
-  /*
-   * Build the executable retention object instance.
-   */
-  vector<shared_ptr<Retention>> rules = Retention::get(this->retention_name,
-                                                       archiveDescr,
-                                                       this->catalog);
+  shared_ptr<CatalogDescr> temp_descr(nullptr);
 
   /*
-   * Create lock info objects for the retention object. We must synchronize
-   * against pinning, invalid (or in-progress) basebackups and
-   * shared memory locks. The latter is only true if there's a background
-   * launcher running which maintains the worker shared memory area.
+   * Die hard in case no catalog available.
    */
-  shared_ptr<BackupPinnedValidLockInfo> pinLockInfo = make_shared<BackupPinnedValidLockInfo>();
-  shared_ptr<SHMBackupLockInfo> shmLockInfo = nullptr;
+  if (this->catalog == NULL)
+    throw CArchiveIssue("could not execute archive command: no catalog");
 
   /*
-   * Attach to background worker shared memory segment. We need this
-   * below for basebackup locking synchronization.
-   *
-   * NOTE: worker SHM might not yet be initialized, so we are careful
-   *       to check for a running launcher process.
+   * Open the catalog, if not yet done
    */
-  shared_ptr<CatalogProc> procInfo = catalog->getProc(-1,
-                                                      CatalogProc::PROC_TYPE_LAUNCHER);
-
-  if (launcher_is_running(procInfo)) {
-
-    shared_ptr<WorkerSHM> worker_shm = make_shared<WorkerSHM>();
-
-    worker_shm->attach(this->catalog->fullname(), true);
-    shmLockInfo = make_shared<SHMBackupLockInfo>(worker_shm);
-
+  if (!this->catalog->available()) {
+    this->catalog->open_rw();
   }
 
-  /*
-   * WAL cleanup descr gets initialized during retention rule
-   * validation.
-   */
-  shared_ptr<BackupCleanupDescr> cleanupDescr = nullptr;
-
-  unsigned int deleted = 0;
-  map<string, shared_ptr<BaseBackupDescr>> fslookuptable;
-  map<string, shared_ptr<BaseBackupDescr>>::iterator it;
-
-  if (rules.size() == 0) {
-
-    ostringstream oss;
-
-    oss << "retention policy \"" << this->retention_name << "\" does not contain a rule";
-    throw CArchiveIssue(oss.str());
-
-  }
+  this->catalog->startTransaction();
 
   /*
-   * Apply the rule(s) on the given basebackup set.
-   *
-   * XXX: The code here is prepared to deal with multiple
-   *      applicable rules, but for now we expect only
-   *      one rule per APPLY run.
+   * If existsOk is TRUE and we have an
+   * existing archive entry in the catalog, proceed.
+   * Otherwise we die a hard and unpleasent immediate
+   * death...
    */
-  for(auto &retention_rule : rules) {
-
-    /*
-     * Add lock info requests to the retention object. We must synchronize
-     * against pinning, invalid (or in-progress) basebackups and
-     * shared memory locks.
-     */
-    retention_rule->addLockInfo(pinLockInfo);
-
-    if (shmLockInfo != nullptr)
-      retention_rule->addLockInfo(shmLockInfo);
+  temp_descr = this->catalog->exists(this->directory);
 
-    /*
-     * Check if the cleanupDescr was not yet
-     * initialized. If still a nullptr reference,
-     * no rule was applied before, so we have to do
-     * it first. This is achieved by calling init()
-     * without arguments on the current rule. The
-     * cleanupDescr is then reused in subsequent iterations.
-     */
-    if (cleanupDescr == nullptr) {
+  try {
+    if (temp_descr->id < 0) {
 
-      retention_rule->init();
+      /*
+       * This is a new archive entry.
+       */
+      this->catalog->createArchive((temp_descr = make_shared<CatalogDescr>(*this)));
 
-    } else {
+      /*
+       * Create the corresponding database connection entry.
+       *
+       * NOTE: createArchive() should have set the archive id
+       *       in the catalog descriptor if successful.
+       */
+      temp_descr->setConnectionType(ConnectionDescr::CONNECTION_TYPE_BASEBACKUP);
+      this->catalog->createCatalogConnection(temp_descr->coninfo);
 
-      retention_rule->init(cleanupDescr);
+      this->catalog->commitTransaction();
 
     }
+    else {
 
-    /*
-     * Now we're ready to execute the rule.
-     */
-    deleted += retention_rule->apply(this->bblist);
-
-#ifdef __DEBUG__
-    BOOST_LOG_TRIVIAL(debug)
-      << "DEBUG: deletion candidates: "
-      << deleted
-      << " basebackups with rule \""
-      << retention_rule->asString()
-      << "\"";
-#endif
+      if (!existsOk) {
+        ostringstream oss;
+        oss << "archive already exists: \"" << this->directory << "\"";
+        throw CArchiveIssue(oss.str());
+      }
 
-    /*
-     * Retention::apply() will return 0 in case nothing
-     * to do...
-     */
-    if (deleted == 0) {
-      continue;
-    }
+      /*
+       * ID of the existing catalog entry needed.
+       */
+      this->id = temp_descr->id;
+      this->catalog->startTransaction();
 
-    /*
-     * Get the BackupCleanupDescr instance from the
-     * retention rule initialized after having called apply(). This
-     * will guide us through the backup cleanup procedure.
-     */
-    cleanupDescr = retention_rule->getCleanupDescr();
+      /*
+       * Update the existing archive catalog entry.
+       */
+      this->catalog->updateArchiveAttributes(make_shared<CatalogDescr>(*this),
+                                             this->affectedAttributes);
 
-    /* Check if the cleanup descr is still valid */
-    if (cleanupDescr == nullptr) {
-      throw CArchiveIssue("unexpected nullptr for cleanup descriptor, cannot clean backups");
+      /*
+       * ... and we're done.
+       */
+      this->catalog->commitTransaction();
     }
+  } catch(CPGBackupCtlFailure& e) {
+    this->catalog->rollbackTransaction();
+    /* re-throw ... */
+    throw e;
+  }
 
-   /*
-     * Emplace basebackup descriptor into the filesystem
-     * lookup table, but only if it's not already there.
-     *
-     * Also save the basebackup descriptor in the final
-     * cleanup descriptor instance.
-     */
-    for(auto &bbdescr : cleanupDescr->basebackups) {
-
-      it = fslookuptable.find(bbdescr->fsentry);
-
-      if (it == fslookuptable.end() ) {
-
-#ifdef __DEBUG__
-        BOOST_LOG_TRIVIAL(debug) << "DEBUG: preparing file "
-                                 << bbdescr->fsentry
-                                 << " for FS lookup table "
-                                 << endl;
-#endif
+}
 
-        fslookuptable.emplace(bbdescr->fsentry, bbdescr);
-      }
+BackgroundWorkerCommandHandle::BackgroundWorkerCommandHandle(std::shared_ptr<BackupCatalog> catalog) {
+  this->tag = BACKGROUND_WORKER_COMMAND;
+  this->subTag = EMPTY_DESCR;
+  this->catalog = catalog;
+}
 
-    }
+BackgroundWorkerCommandHandle::BackgroundWorkerCommandHandle(std::shared_ptr<CatalogDescr> descr) {
 
-  }
+  this->copy(*(descr.get()));
 
   /*
-   * If nothing was deleted, we need to create
-   * a dummy cleanup descriptor, telling the caller
-   * that there's nothing to do.
+   * Rewrite identity command tag, subTag transports
+   * the encapsulated catalog command.
    */
-  if (deleted == 0 && cleanupDescr == nullptr) {
-
-    cleanupDescr = make_shared<BackupCleanupDescr>();
-    cleanupDescr->basebackupMode = NO_BASEBACKUPS;
-
-  }
-
-  return cleanupDescr;
+  this->subTag = this->tag;
+  this->tag = BACKGROUND_WORKER_COMMAND;
 
 }
 
-void ApplyRetentionPolicyCommand::execute(bool flag) {
-
-  shared_ptr<CatalogDescr> archiveDescr      = nullptr;
-  bool has_tx = false; /* stores state of current TX */
+void BackgroundWorkerCommandHandle::execute(bool noop) {
 
-  if (this->catalog == nullptr) {
-    throw CArchiveIssue("could not execute command: no catalog");
-  }
+}
 
-  /*
-   * Empty retention identifier doesn't make sense here.
-   */
-  if (this->retention_name.length() == 0) {
-    throw CArchiveIssue("empty retention name not allowed here");
-  }
+StatArchiveBaseBackupCommand::StatArchiveBaseBackupCommand(std::shared_ptr<BackupCatalog> catalog) {
 
-  /**
-   * Enter the cleanup procedure. This is done within one transaction
-   * to make sure no other write operations interfere with us.
-   */
-  try {
+  this->catalog = catalog;
+  this->tag = STAT_ARCHIVE_BASEBACKUP;
 
-    shared_ptr<BackupCleanupDescr> archiveCleanupDescr = nullptr;
-    shared_ptr<BackupDirectory> backupDir              = nullptr;
-    shared_ptr<ArchiveLogDirectory> archiveLogDir      = nullptr;
-    unsigned long long wal_segment_size = 0;
+}
 
-#ifdef __DEBUG__
-    BOOST_LOG_TRIVIAL(debug) << "DEBUG: operating on directory "
-                             << this->directory;
-#endif
 
-    this->catalog->startTransaction();
+StatArchiveBaseBackupCommand::StatArchiveBaseBackupCommand(std::shared_ptr<CatalogDescr> descr) {
 
-    /* remember state of this TX */
-    has_tx = true;
+  this->copy(*(descr.get()));
+  this->tag = STAT_ARCHIVE_BASEBACKUP;
 
-    /**
-     * Archive name really exists ?
-     */
-    archiveDescr = this->catalog->existsByName(this->archive_name);
+}
 
-    if (archiveDescr->id < 0) {
+StatArchiveBaseBackupCommand::StatArchiveBaseBackupCommand() {
 
-      ostringstream oss;
+  this->tag = STAT_ARCHIVE_BASEBACKUP;
 
-      oss << "archive \"" << this->archive_name << "\" does not exist";
+}
 
-      /* throw, this will be handled by the exception handler below
-       * and re-thrown to the caller */
-      throw CArchiveIssue(oss.str());
+StatArchiveBaseBackupCommand::~StatArchiveBaseBackupCommand() {}
 
-    }
+void StatArchiveBaseBackupCommand::execute(bool noop) {
 
-    /*
-     * Initialize directory handles needed for physical cleanup.
-     */
-    backupDir = make_shared<BackupDirectory>(path(archiveDescr->directory));
-    archiveLogDir = make_shared<ArchiveLogDirectory>(backupDir);
+  std::shared_ptr<CatalogDescr> archive_descr   = nullptr;
+  std::shared_ptr<BaseBackupDescr> backup_descr = nullptr;
+  std::shared_ptr<std::list<boost::filesystem::directory_entry>> contents;
 
-    /*
-     * Assign the archive id within this command handler
-     * (we might need it later) and assign the LIST_ARCHIVE tag
-     * to it. This will tell catalog lookup methods that we
-     * have a descriptor carrying all information for the archive
-     */
-    this->id = archiveDescr->id;
-    archiveDescr->tag = LIST_ARCHIVE;
+  /* Catalog access required */
+  if (catalog == NULL) {
+    throw CArchiveIssue("could not execute archive command: no catalog");
+  }
 
-    /* get the list of current basebackups */
+  /*
+   * Open the catalog if not done yet, read only access is sufficient.
+   */
+  if (!catalog->available()) {
+    catalog->open_ro();
+  }
 
-    this->bblist = this->catalog->getBackupList(this->archive_name);
+  /*
+   * Get the archive catalog descr, error
+   * out if the specified archive does not exist.x
+   */
+  archive_descr = catalog->existsByName(this->archive_name);
 
-    /*
-     * Apply the rule(s) attached to this policy.
-     */
-    archiveCleanupDescr = this->applyRulesAndRemoveBasebackups(archiveDescr);
+  if (archive_descr->id < 0) {
 
-    /* In case nothing to do, exit */
-    if (archiveCleanupDescr->basebackupMode == NO_BASEBACKUPS) {
-      cout << "no basebackups matches retention policy" << endl;
-      return;
-    }
+    std::ostringstream oss;
+    oss << "archive \"" << this->archive_name << "\" does not exist";
+    throw CArchiveIssue(oss.str());
 
-    /*
-     * Loop through the final cleanup descriptor. During this loop
-     * we delete the basebackup physically and from the catalog.
-     *
-     * Archive cleanup is performed afterwards.
-     */
-    for(auto &basebackup : archiveCleanupDescr->basebackups) {
+  }
 
-      boost::system::error_code ec;
+  /*
+   * Okay, archive_name exists, get the basebackup descriptor.
+   */
+  backup_descr = catalog->getBaseBackup(this->basebackup_id, archive_descr->id);
 
-#ifdef __DEBUG__
-      BOOST_LOG_TRIVIAL(debug) << "deleting fs path " << basebackup->fsentry;
-#endif
+  /*
+   * Check if the specified basebackup_id was valid.
+   */
+  if (backup_descr->id < 0) {
 
-      if (wal_segment_size == 0) {
-        wal_segment_size = basebackup->wal_segment_size;
-      }
+    std::ostringstream oss;
+    oss << "basebackup ID \"" << this->basebackup_id << "\" "
+        << "does not exist in archive \""
+        << this->archive_name << "\"";
+    throw CArchiveIssue(oss.str());
 
-#ifdef __DEBUG_XLOG__
-      BOOST_LOG_TRIVIAL(debug) << "DEBUG: cleaning with wal_segment_size="
-                               << wal_segment_size;
-#endif
+  }
 
-      /*
-       * Drop the basebackup from the catalog database. If this
-       * succeeds we go over and unlink the file(s) and director(y|ies)
-       * physically.
-       */
-      this->catalog->deleteBaseBackup(basebackup->id);
-      remove_all(path(basebackup->fsentry), ec);
+  BOOST_LOG_TRIVIAL(debug) << "STAT on directory \""
+                           << backup_descr->fsentry
+                           << "\"";
 
-      /*
-       * Explicitely warn in case the file was already deleted.
-       */
-      if (ec.value() == boost::system::errc::no_such_file_or_directory) {
+  /* Basebackup exists, dump its contents */
+  StreamingBaseBackupDirectory bbdir(path(backup_descr->fsentry));
+  contents = bbdir.stat();
 
-        BOOST_LOG_TRIVIAL(debug) << "WARNING: basebackup in file/directory "
-                                 << basebackup->fsentry
-                                 << " already gone.";
+  /*
+   * Print out file list
+   */
+  shared_ptr<OutputFormatConfiguration> output_config
+    = std::make_shared<OutputFormatConfiguration>();
+  shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(output_config,
+                                                                     catalog,
+                                                                     getOutputFormat());
+  ostringstream output;
+  formatter->nodeAs(contents, output);
+  cout << output.str();
 
-      } else if (ec.value() != boost::system::errc::success) {
+}
 
-        throw CArchiveIssue(ec.message());
+VerifyBasebackupCatalogCommand::VerifyBasebackupCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
 
-      }
+  this->catalog = catalog;
+  this->tag = VERIFY_BASEBACKUP;
 
-      /*
-       * Perform archive cleanup procedures...
-       */
-#ifdef __DEBUG__
-      BOOST_LOG_TRIVIAL(debug) << "DEBUG: cleaning archive log directory "
-                               << archiveLogDir->getPath();
-#endif
+}
 
-      archiveLogDir->checkCleanupDescriptor(archiveCleanupDescr);
-      if (archiveLogDir->exists()){
-        archiveLogDir->removeXLogs(archiveCleanupDescr, wal_segment_size);
-      }
-    }
+VerifyBasebackupCatalogCommand::VerifyBasebackupCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
 
-    /*
-     * Now it's time to commit all database work. It might
-     * happen that we fail here, but redoing the whole work
-     * should be possible.
-     */
-    this->catalog->commitTransaction();
-    has_tx = false;
+  this->copy(*(descr.get()));
+  this->tag = VERIFY_BASEBACKUP;
 
-    /*
-     * Fsync backup directory contents.
-     */
-    BackupDirectory::fsync_recursive(backupDir->getArchiveDir());
+}
 
-  } catch (CPGBackupCtlFailure &e) {
+VerifyBasebackupCatalogCommand::VerifyBasebackupCatalogCommand() {
 
-    if (has_tx)
-      this->catalog->rollbackTransaction();
+  this->tag = VERIFY_BASEBACKUP;
 
-    /* don't hide any errors to caller */
-    throw e;
+}
 
-  } catch(filesystem_error &e) {
+VerifyBasebackupCatalogCommand::~VerifyBasebackupCatalogCommand() {}
 
-    if (has_tx)
-      this->catalog->rollbackTransaction();
+void VerifyBasebackupCatalogCommand::execute(bool noop) {
 
-    /* remap to internal pg_backup_ctl++ exception */
-    throw CPGBackupCtlFailure(e.what());
+  std::shared_ptr<CatalogDescr> archive_descr   = nullptr;
+  std::shared_ptr<BaseBackupDescr> backup_descr = nullptr;
+  std::shared_ptr<BaseBackupVerificationResult> result = nullptr;
+  std::shared_ptr<ArchiveLogDirectory> logdir = nullptr;
 
+  /* Catalog access required */
+  if (catalog == NULL) {
+    throw CArchiveIssue("could not execute archive command: no catalog");
   }
 
+  /*
+   * Open the catalog if not done yet, read only access is sufficient.
+   */
+  if (!catalog->available()) {
+    catalog->open_ro();
+  }
 
-}
-
-CreateRetentionPolicyCommand::CreateRetentionPolicyCommand(std::shared_ptr<CatalogDescr> descr) {
+  archive_descr = catalog->existsByName(this->archive_name);
 
-  this->copy(*(descr.get()));
+  if (archive_descr->id < 0) {
 
-}
+    std::ostringstream oss;
+    oss << "archive \"" << this->archive_name << "\" does not exist";
+    throw CArchiveIssue(oss.str());
 
-CreateRetentionPolicyCommand::CreateRetentionPolicyCommand(std::shared_ptr<BackupCatalog> catalog) {
+  }
 
-  this->tag     = CREATE_RETENTION_POLICY;
-  this->catalog = catalog;
+  backup_descr = catalog->getBaseBackup(this->basebackup_id, archive_descr->id);
 
-}
+  if (backup_descr->id < 0) {
 
-CreateRetentionPolicyCommand::CreateRetentionPolicyCommand() {
+    std::ostringstream oss;
+    oss << "basebackup ID \"" << this->basebackup_id << "\" "
+        << "does not exist in archive \""
+        << this->archive_name << "\"";
+    throw CArchiveIssue(oss.str());
 
-  this->tag = CREATE_RETENTION_POLICY;
+  }
 
-}
+  /*
+   * Verifying a basebackup still being streamed
+   * or one which was aborted doesn't make sense.
+   */
+  if (backup_descr->status != "ready") {
 
-void CreateRetentionPolicyCommand::execute(bool flag) {
+    std::ostringstream oss;
+    oss << "basebackup ID \"" << this->basebackup_id << "\" "
+        << "cannot be verified, status is \"" << backup_descr->status << "\"";
+    throw CArchiveIssue(oss.str());
 
-  if (this->catalog == nullptr) {
-    throw CArchiveIssue("could not execute command: no catalog");
   }
 
-  try {
-
-    /*
-     * Checkout if a retention policy with this name exists.
-     *
-     * Returns a completely initialized RetentionDescr instance,
-     * which is thrown away in case there is a conflict. We might
-     * want a cheaper operation than getRetentionPolicy(), though
-     * it's not available yet.
-     */
-    shared_ptr<RetentionDescr> retentionPolicy = nullptr;
+  logdir = CPGBackupCtlFS::getArchiveDirectoryDescr(archive_descr->directory)->logdirectory();
 
-    /*
-     * Catalog changes involves multiple entities, so use
-     * a transaction here.
-     */
-    this->catalog->startTransaction();
+  BOOST_LOG_TRIVIAL(debug) << "VERIFY basebackup in directory \""
+                           << backup_descr->fsentry
+                           << "\"";
 
-    /*
-     * Yes, it's ugly, but currently the parser bound the
-     * retention policy identifier as an archive_name to the
-     * CatalogDescr.
-     *
-     * XXX: Replace the identifier <-> parser schema with something
-     *      more sophisticated.
-     */
-    retentionPolicy = this->catalog->getRetentionPolicy(this->archive_name);
+  BaseBackupVerifier verifier(backup_descr, logdir->getPath());
 
-    if (retentionPolicy->id >= 0) {
+  verifier.setWorkers(this->verify_workers);
+  result = verifier.verify();
+  result->archive_name = this->archive_name;
 
-      /*
-       * whoops, this identifier already exists. This exception
-       * is catched by the try..catch block below, but will be re-thrown.
-       */
-      throw CCatalogIssue("retention policy with name\""
-                          + retentionPolicy->name
-                          + "\" already exists");
-    }
+  shared_ptr<OutputFormatConfiguration> output_config
+    = std::make_shared<OutputFormatConfiguration>();
+  shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(output_config,
+                                                                     catalog,
+                                                                     getOutputFormat());
+  ostringstream output;
+  formatter->nodeAs(result, output);
+  cout << output.str();
 
-    /*
-     * Okay, policy seems to be new, go forward and try
-     * to create it.
-     */
-#ifdef __DEBUG__
-    BOOST_LOG_TRIVIAL(debug) << "creating retention rule with identifier "
-                             << this->retention->name;
-#endif
+  if (!result->ok()) {
 
-    this->catalog->createRetentionPolicy(this->retention);
+    std::ostringstream oss;
+    oss << "verification of basebackup ID \"" << this->basebackup_id << "\" "
+        << "failed with " << result->errors.size() << " errors";
+    throw CArchiveIssue(oss.str());
 
-    /* and we're done ... */
-    this->catalog->commitTransaction();
+  }
 
-  } catch(CPGBackupCtlFailure &e) {
+}
 
-    this->catalog->rollbackTransaction();
+AlterArchiveLogLayoutCommand::AlterArchiveLogLayoutCommand(std::shared_ptr<BackupCatalog> catalog) {
 
-    /* don't hide this exception */
-    throw e;
+  this->catalog = catalog;
+  this->tag = ALTER_ARCHIVE_LOG_LAYOUT;
 
-  }
 }
 
-CreateBackupProfileCatalogCommand::CreateBackupProfileCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+AlterArchiveLogLayoutCommand::AlterArchiveLogLayoutCommand(std::shared_ptr<CatalogDescr> descr) {
 
   this->copy(*(descr.get()));
-
-  /*
-   * BaseCatalogCommand::copy() has no idea of submodule objects belongig
-   * to a given catalog descriptor. We need to copy them explicitely.
-   */
-  this->profileDescr = descr->getBackupProfileDescr();
+  this->tag = ALTER_ARCHIVE_LOG_LAYOUT;
 
 }
 
-CreateBackupProfileCatalogCommand::CreateBackupProfileCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
-  this->tag = CREATE_BACKUP_PROFILE;
-  this->catalog = catalog;
-}
+AlterArchiveLogLayoutCommand::AlterArchiveLogLayoutCommand() {
 
-CreateBackupProfileCatalogCommand::CreateBackupProfileCatalogCommand() {
-  this->tag = CREATE_BACKUP_PROFILE;
-}
+  this->tag = ALTER_ARCHIVE_LOG_LAYOUT;
 
-void CreateBackupProfileCatalogCommand::setProfile(std::shared_ptr<BackupProfileDescr> profileDescr) {
-  this->profileDescr = profileDescr;
 }
 
-void CreateBackupProfileCatalogCommand::verify(bool print_version) {
+AlterArchiveLogLayoutCommand::~AlterArchiveLogLayoutCommand() {}
 
-  job_info jobDescr;
+void AlterArchiveLogLayoutCommand::execute(bool noop) {
 
-  namespace bf = boost::filesystem;
+  std::shared_ptr<CatalogDescr> archive_descr = nullptr;
+  std::shared_ptr<ArchiveLogDirectory> logdir = nullptr;
+  WALLogLayout layout = (this->log_layout_sharded) ? WAL_LOG_LAYOUT_SHARDED : WAL_LOG_LAYOUT_FLAT;
+  unsigned long long moved = 0;
 
-  jobDescr.background_exec = true;
+  /* Catalog access required */
+  if (catalog == NULL) {
+    throw CArchiveIssue("could not execute archive command: no catalog");
+  }
 
   /*
-   * When creating a backup profile we check
-   * if certain compression methods are possible
-   * since they are backed by command line tools. Atm
-   * these are:
-   *
-   * XZ - requires XZ command line tool
-   * ZSTD - requires the ZSTD command line tool
-   * PLAIN - requires the tar command line tool
+   * The layout is a property of the archive directory only,
+   * the catalog isn't modified. Read only access is sufficient.
    */
-  switch(this->profileDescr->compress_type) {
-
-  case BACKUP_COMPRESS_TYPE_PLAIN:
-    {
-      path tar("tar");
-      ArchivePipedProcess app(tar);
-      char buf[4];
-
-      if (!CPGBackupCtlBase::resolve_file_path(tar.string())) {
-        throw CArchiveIssue("cannot resolve path for binary tar");
-      }
-
-      app.setExecutable(tar);
-      app.pushExecArgument("--version");
+  if (!catalog->available()) {
+    catalog->open_ro();
+  }
 
-      app.setOpenMode("r");
-      app.open();
+  archive_descr = catalog->existsByName(this->archive_name);
 
-      while(app.read(buf, 1) >= 1)
-        cout << buf;
+  if (archive_descr->id < 0) {
 
-      app.close();
-      break;
-    }
+    std::ostringstream oss;
+    oss << "archive \"" << this->archive_name << "\" does not exist";
+    throw CArchiveIssue(oss.str());
 
-  case BACKUP_COMPRESS_TYPE_ZSTD:
-    {
-      path zstd("zstd");
-      ArchivePipedProcess app(zstd);
-      char buf[4];
+  }
 
-      if (!CPGBackupCtlBase::resolve_file_path(zstd.string())) {
-        throw CArchiveIssue("cannot resolve path for binary zstd");
-      }
+  logdir = CPGBackupCtlFS::getArchiveDirectoryDescr(archive_descr->directory)->logdirectory();
 
-      app.setExecutable(zstd);
-      app.pushExecArgument("--version");
+  if (noop)
+    return;
 
-      app.setOpenMode("r");
-      app.open();
+  moved = logdir->migrateLogLayout(layout);
 
-      while(app.read(buf, 1) >= 1)
-        cout << buf;
+  cout << "log directory of archive \"" << this->archive_name << "\" "
+       << "now uses the "
+       << ((layout == WAL_LOG_LAYOUT_SHARDED) ? "sharded" : "flat")
+       << " layout, moved " << moved << " files" << endl;
 
-      app.close();
-      break;
+}
 
-    }
+AlterArchiveColdTierCommand::AlterArchiveColdTierCommand(std::shared_ptr<BackupCatalog> catalog) {
 
-  case BACKUP_COMPRESS_TYPE_XZ:
-    {
-      path xz("xz");
-      ArchivePipedProcess app(xz);
-      char buf[4];
+  this->catalog = catalog;
+  this->tag = ALTER_ARCHIVE_COLD_TIER;
 
-      if (!CPGBackupCtlBase::resolve_file_path(xz.string())) {
-        throw CArchiveIssue("cannot resolve path for binary xz");
-      }
+}
 
-      app.setExecutable(xz);
-      app.pushExecArgument("--version");
+AlterArchiveColdTierCommand::AlterArchiveColdTierCommand(std::shared_ptr<CatalogDescr> descr) {
 
-      app.setOpenMode("r");
-      app.open();
+  this->copy(*(descr.get()));
+  this->tag = ALTER_ARCHIVE_COLD_TIER;
 
-      while(app.read(buf, 1) >= 1)
-        cout << buf;
+}
 
-      app.close();
-      break;
-    }
+AlterArchiveColdTierCommand::AlterArchiveColdTierCommand() {
 
-  case BACKUP_COMPRESS_TYPE_LZ4:
-  {
-    path lz("lz4");
-    ArchivePipedProcess app(lz);
-    char buf[4];
+  this->tag = ALTER_ARCHIVE_COLD_TIER;
 
-    if (!CPGBackupCtlBase::resolve_file_path(lz.string())) {
-      throw CArchiveIssue("cannot resolv path for binary lz");
-    }
+}
 
-    app.setExecutable(lz);
-    app.pushExecArgument("--version");
+AlterArchiveColdTierCommand::~AlterArchiveColdTierCommand() {}
 
-    app.setOpenMode("r");
-    app.open();
+void AlterArchiveColdTierCommand::execute(bool noop) {
 
-    while (app.read(buf, 1) >= 1)
-      cout << buf;
+  std::shared_ptr<CatalogDescr> archive_descr = nullptr;
+  path cold = path(this->cold_directory).lexically_normal();
+  path archive_dir;
+  bool have_tx = false;
 
-    app.close();
-    break;
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
   }
 
-  default:
-    break; /* nothing to do here */
+  if (!cold.is_absolute()) {
+    throw CArchiveIssue("cold directory must be an absolute path");
   }
 
-}
+  try {
 
-void CreateBackupProfileCatalogCommand::execute(bool existsOk) {
+    this->catalog->startTransaction();
+    have_tx = true;
 
-  if (this->catalog == nullptr)
-    throw CArchiveIssue("could not execute archive command: no catalog");
+    archive_descr = this->catalog->existsByName(this->archive_name);
 
-#ifdef __DEBUG__
-  BOOST_LOG_TRIVIAL(debug) << "profile attributes";
-  BOOST_LOG_TRIVIAL(debug) << "name: " << this->profileDescr->name;
-  BOOST_LOG_TRIVIAL(debug) << "compression: " << this->profileDescr->compress_type;
-  BOOST_LOG_TRIVIAL(debug) << "max rate: " << this->profileDescr->max_rate;
-  BOOST_LOG_TRIVIAL(debug) << "label: " << this->profileDescr->label;
-  BOOST_LOG_TRIVIAL(debug) << "wal included: " << this->profileDescr->include_wal;
-  BOOST_LOG_TRIVIAL(debug) << "wait for wal: " << this->profileDescr->wait_for_wal;
-  BOOST_LOG_TRIVIAL(debug) << "manifest: " << this->profileDescr->manifest;
-  BOOST_LOG_TRIVIAL(debug) << "manifest checksums: " << this->profileDescr->manifest_checksums;
-#endif
+    if (archive_descr->id < 0) {
 
-  /*
-   * Open the catalog, if necessary.
-   */
-  if (!this->catalog->available()) {
-    this->catalog->open_rw();
-  }
+      std::ostringstream oss;
+      oss << "archive \"" << this->archive_name << "\" does not exist";
+      throw CArchiveIssue(oss.str());
 
-  /*
-   * Do some preliminary checks...
-   */
-  this->verify();
+    }
 
-  try {
+    /* Moving would leave the chunks of deduplicated basebackups behind */
+    if (!DedupChunkStore(DedupChunkStore::forArchive(path(archive_descr->directory))).empty()) {
 
-    /*
-     * Start catalog transaction.
-     */
-    this->catalog->startTransaction();
+      std::ostringstream oss;
+      oss << "archive \"" << this->archive_name << "\" has deduplicated basebackups, "
+          << "which can't be moved to a cold tier";
+      throw CArchiveIssue(oss.str());
+
+    }
 
     /*
-     * Check if the specified backup profile already exists
+     * Retention tells moved basebackups by their location
+     * outside of the archive directory.
      */
-    std::shared_ptr<BackupProfileDescr> temp_descr = catalog->getBackupProfile(this->profileDescr->name);
+    archive_dir = path(archive_descr->directory).lexically_normal();
 
-    if (temp_descr->profile_id < 0) {
+    if (cold == archive_dir
+        || cold.string().compare(0, archive_dir.string().length() + 1,
+                                 archive_dir.string() + "/") == 0) {
 
-      /*
-       * Create the new profile.
-       *
-       * NOTE: we can't bindly use the new BackupProfileDescr passed down
-       *       from the parser, since it might not have seen all
-       *       the attributes, the user might decided not to overwrite its default.
-       *       Hence, pass down all attributes which are required to create
-       *       a new entry.
-       */
+      std::ostringstream oss;
+      oss << "cold directory must not be within the archive directory \""
+          << archive_descr->directory << "\"";
+      throw CArchiveIssue(oss.str());
 
-      std::vector<int> attr;
-      attr.push_back(SQL_BCK_PROF_NAME_ATTNO);
-      attr.push_back(SQL_BCK_PROF_COMPRESS_TYPE_ATTNO);
-      attr.push_back(SQL_BCK_PROF_MAX_RATE_ATTNO);
-      attr.push_back(SQL_BCK_PROF_LABEL_ATTNO);
-      attr.push_back(SQL_BCK_PROF_FAST_CHKPT_ATTNO);
-      attr.push_back(SQL_BCK_PROF_INCL_WAL_ATTNO);
-      attr.push_back(SQL_BCK_PROF_WAIT_FOR_WAL_ATTNO);
-      attr.push_back(SQL_BCK_PROF_NOVERIFY_CHECKSUMS_ATTNO);
-      attr.push_back(SQL_BCK_PROF_MANIFEST_ATTNO);
-      attr.push_back(SQL_BCK_PROF_MANIFEST_CHECKSUMS_ATTNO);
+    }
 
-      this->profileDescr->setAffectedAttributes(attr);
-      this->catalog->createBackupProfile(this->profileDescr);
+    if (!noop) {
 
-    } else {
+      create_directories(cold / "base");
+      create_directories(cold / "log");
+      RootDirectory::fsync(cold);
 
-      /* profile already exists! */
-      if (!existsOk) {
-        ostringstream oss;
-        oss << "backup profile " << this->profileDescr->name << " already exists";
-        throw CCatalogIssue(oss.str());
-      }
+      this->catalog->setArchiveColdDirectory(archive_descr->id, cold.string());
 
     }
 
     this->catalog->commitTransaction();
+    have_tx = false;
+
+  } catch (filesystem_error &e) {
+
+    if (have_tx)
+      this->catalog->rollbackTransaction();
+
+    throw CArchiveIssue(e.what());
+
+  } catch (CPGBackupCtlFailure &e) {
+
+    if (have_tx)
+      this->catalog->rollbackTransaction();
 
-  } catch(CPGBackupCtlFailure& e) {
-    this->catalog->rollbackTransaction();
     throw e;
+
   }
 
+  cout << "cold tier of archive \"" << this->archive_name << "\" is now \""
+       << cold.string() << "\"" << endl;
+
 }
 
-VerifyArchiveCatalogCommand::VerifyArchiveCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+CreateScheduleCatalogCommand::CreateScheduleCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
 
-  this->copy(*(descr.get()));
+  this->catalog = catalog;
+  this->tag = CREATE_SCHEDULE;
 
 }
 
-VerifyArchiveCatalogCommand::VerifyArchiveCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
-  this->tag = VERIFY_ARCHIVE;
-  this->catalog = catalog;
+CreateScheduleCatalogCommand::CreateScheduleCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+  this->tag = CREATE_SCHEDULE;
+
 }
 
-VerifyArchiveCatalogCommand::VerifyArchiveCatalogCommand() {
-  this->tag = VERIFY_ARCHIVE;
+CreateScheduleCatalogCommand::CreateScheduleCatalogCommand() {
+
+  this->tag = CREATE_SCHEDULE;
+
 }
 
-void VerifyArchiveCatalogCommand::execute(bool missingOK) {
+CreateScheduleCatalogCommand::~CreateScheduleCatalogCommand() {}
 
-  /*
-   * Check if the specified archive really exists.
-   */
-  shared_ptr<CatalogDescr> temp_descr(nullptr);
+void CreateScheduleCatalogCommand::execute(bool noop) {
 
-  /*
-   * Die hard in case no catalog available.
-   */
-  if (this->catalog == nullptr)
-    throw CArchiveIssue("could not execute archive command: no catalog");
+  std::shared_ptr<CatalogDescr> archive_descr = nullptr;
+  bool have_tx = false;
 
-  /*
-   * Open the catalog, if not yet done.
-   */
-  if (!this->catalog->available()) {
-    this->catalog->open_rw();
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
+  }
+
+  if (this->schedule == nullptr) {
+    throw CArchiveIssue("no schedule specified");
+  }
+
+  if (this->schedule->interval == 0) {
+    throw CArchiveIssue("schedule interval must be greater than zero");
   }
 
   /*
-   * Check archive directory structure.
+   * The scheduler adds a random delay of up to jitter seconds to
+   * every run, which must not push the next run beyond the one after.
    */
+  if (this->schedule->jitter >= this->schedule->interval) {
+    throw CArchiveIssue("schedule jitter must be less than its interval");
+  }
+
+  if (this->schedule->type == SCHEDULE_BASEBACKUP)
+    this->schedule->profile_name = this->backup_profile->name;
+
   try {
 
-    catalog->startTransaction();
+    this->catalog->startTransaction();
+    have_tx = true;
 
-    temp_descr = catalog->existsByName(this->archive_name);
+    archive_descr = this->catalog->existsByName(this->archive_name);
+
+    if (archive_descr->id < 0) {
+
+      std::ostringstream oss;
+      oss << "archive \"" << this->archive_name << "\" does not exist";
+      throw CArchiveIssue(oss.str());
 
-    if (temp_descr->id < 0) {
-      ostringstream oss;
-      oss << "archive " << this->archive_name << " does not exist";
-      throw CCatalogIssue(oss.str());
     }
 
-    /*
-     * There is an archive with the specified identifier registered.
-     * Get an archive directory handle and check whether its directory structure
-     * is intact.
-     */
-    shared_ptr<BackupDirectory> archivedir = CPGBackupCtlFS::getArchiveDirectoryDescr(temp_descr->directory);
-    std::ostringstream output;
+    if (this->schedule->profile_name.length() > 0
+        && this->catalog->getBackupProfile(this->schedule->profile_name)->profile_id < 0) {
+
+      std::ostringstream oss;
+      oss << "backup profile \"" << this->schedule->profile_name << "\" does not exist";
+      throw CArchiveIssue(oss.str());
+
+    }
+
+    if (this->catalog->getSchedule(archive_descr->id, this->schedule->type)->id >= 0) {
+
+      std::ostringstream oss;
+      oss << "archive \"" << this->archive_name << "\" already has a "
+          << ScheduleDescr::typeName(this->schedule->type) << " schedule";
+      throw CArchiveIssue(oss.str());
+
+    }
+
+    this->schedule->archive_id = archive_descr->id;
+    this->catalog->createSchedule(this->schedule);
 
-    archivedir->exists();
     this->catalog->commitTransaction();
+    have_tx = false;
 
-    (OutputFormatter::formatter(make_shared<OutputFormatConfiguration>(),
-                                catalog,
-                                getOutputFormat()))->nodeAs("OK",
-                                                            output);
-    cout << output.str();
+  } catch (CPGBackupCtlFailure &e) {
 
-  } catch(CPGBackupCtlFailure& e) {
+    if (have_tx)
+      this->catalog->rollbackTransaction();
 
-    this->catalog->rollbackTransaction();
     throw e;
 
   }
 
-  /*
-   * If requested, check connection of the specified archive.
-   * We won't reached this in case the directory has failed.
-   *
-   * We get a list of all connections specified for
-   * the given archive ID and test CONNECTION_TYPE_BASEBACKUP
-   * and CONNECTION_TYPE_STREAMER.
-   */
-  if (this->check_connection) {
+}
 
-    /*
-     * Get the list of (possible) streaming or basebackup connections.
-     * Other types are ignored (if any).
-     *
-     * We rely on existsByName() to have initialized temp_descr properly, if
-     * the specified archive exists.
-     */
-    if (temp_descr != nullptr && temp_descr->id >= 0) {
+DropScheduleCatalogCommand::DropScheduleCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
+
+  this->catalog = catalog;
+  this->tag = DROP_SCHEDULE;
+
+}
+
+DropScheduleCatalogCommand::DropScheduleCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+  this->tag = DROP_SCHEDULE;
+
+}
 
-      vector<shared_ptr<ConnectionDescr>> connection_list;
+DropScheduleCatalogCommand::DropScheduleCatalogCommand() {
 
-      connection_list = catalog->getCatalogConnection(temp_descr->id);
+  this->tag = DROP_SCHEDULE;
 
-      /*
-       * At least on connection (type basebackup is expected)
-       */
-      if (connection_list.size() == 0) {
-        throw CArchiveIssue("specified archive does not have a database connection");
-      }
+}
 
-      for (auto &con : connection_list) {
+DropScheduleCatalogCommand::~DropScheduleCatalogCommand() {}
 
-        temp_descr->coninfo = con;
+void DropScheduleCatalogCommand::execute(bool noop) {
 
-        if (con->type == ConnectionDescr::CONNECTION_TYPE_BASEBACKUP) {
+  std::shared_ptr<CatalogDescr> archive_descr = nullptr;
+  bool have_tx = false;
 
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
+  }
 
-          PGStream stream(temp_descr);
+  if (this->schedule == nullptr) {
+    throw CArchiveIssue("no schedule specified");
+  }
 
-          cout << "check basebackup database connection: ";
-          stream.testConnection();
-          cout << "OK" << endl;
+  try {
 
-        }
+    this->catalog->startTransaction();
+    have_tx = true;
 
-        if (con->type == ConnectionDescr::CONNECTION_TYPE_STREAMER) {
+    archive_descr = this->catalog->existsByName(this->archive_name);
 
-          PGStream stream(temp_descr);
+    if (archive_descr->id < 0) {
 
-          cout << "check streaming database connection: ";
-          stream.testConnection();
-          cout << "OK" << endl;
-        }
+      std::ostringstream oss;
+      oss << "archive \"" << this->archive_name << "\" does not exist";
+      throw CArchiveIssue(oss.str());
+
+    }
+
+    if (this->catalog->getSchedule(archive_descr->id, this->schedule->type)->id < 0) {
+
+      std::ostringstream oss;
+      oss << "archive \"" << this->archive_name << "\" has no "
+          << ScheduleDescr::typeName(this->schedule->type) << " schedule";
+      throw CArchiveIssue(oss.str());
 
-      }
     }
+
+    this->catalog->dropSchedule(archive_descr->id, this->schedule->type);
+
+    this->catalog->commitTransaction();
+    have_tx = false;
+
+  } catch (CPGBackupCtlFailure &e) {
+
+    if (have_tx)
+      this->catalog->rollbackTransaction();
+
+    throw e;
+
   }
 
 }
 
-ListArchiveCatalogCommand::ListArchiveCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+ListSchedulesCatalogCommand::ListSchedulesCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
 
-  this->copy(*(descr.get()));
+  this->catalog = catalog;
+  this->tag = LIST_SCHEDULES;
 
 }
 
-ListArchiveCatalogCommand::ListArchiveCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
-  this->tag = LIST_ARCHIVE;
-  this->catalog = catalog;
+ListSchedulesCatalogCommand::ListSchedulesCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+  this->tag = LIST_SCHEDULES;
+
 }
 
-ListArchiveCatalogCommand::ListArchiveCatalogCommand() {
-  this->tag = LIST_ARCHIVE;
+ListSchedulesCatalogCommand::ListSchedulesCatalogCommand() {
+
+  this->tag = LIST_SCHEDULES;
+
 }
 
-void ListArchiveCatalogCommand::execute(bool extendedOutput) {
+ListSchedulesCatalogCommand::~ListSchedulesCatalogCommand() {}
+
+void ListSchedulesCatalogCommand::execute(bool noop) {
+
+  vector<shared_ptr<ScheduleDescr>> schedules;
+
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
+  }
+
+  if (!catalog->available()) {
+    catalog->open_ro();
+  }
+
+  this->catalog->getSchedules(schedules);
 
   shared_ptr<OutputFormatConfiguration> output_config
-    = make_shared<OutputFormatConfiguration>();
+    = std::make_shared<OutputFormatConfiguration>();
   shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(output_config,
                                                                      catalog,
                                                                      getOutputFormat());
-  shared_ptr<list<shared_ptr<CatalogDescr>>> archiveList(nullptr);
-  shared_ptr<CatalogDescr> temp_descr(nullptr);
+  ostringstream output;
+  formatter->nodeAs(schedules, output);
+  cout << output.str();
 
-  std::ostringstream output;
+}
 
-  /*
-   * Die hard in case no catalog available.
-   */
-  if (this->catalog == nullptr)
-    throw CArchiveIssue("could not execute archive command: no catalog");
+CreateArchiveStorageCatalogCommand::CreateArchiveStorageCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
 
-  /*
-   * Open the catalog, if not yet done.
-   */
-  if (!this->catalog->available()) {
-    this->catalog->open_rw();
-  }
+  this->catalog = catalog;
+  this->tag = CREATE_ARCHIVE_STORAGE;
 
-  try {
-    catalog->startTransaction();
+}
 
-    if (this->mode == ARCHIVE_LIST) {
+CreateArchiveStorageCatalogCommand::CreateArchiveStorageCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
 
-      output_config->create("list_archive.mode",
-                            std::string("full"),
-                            std::string("full"));
+  this->copy(*(descr.get()));
+  this->tag = CREATE_ARCHIVE_STORAGE;
 
-      /*
-       * Get a list of current registered archives in the catalog.
-       */
-      archiveList = catalog->getArchiveList();
+}
 
-    }
-    else if (this->mode == ARCHIVE_FILTERED_LIST) {
+CreateArchiveStorageCatalogCommand::CreateArchiveStorageCatalogCommand() {
 
-      /*
-       * Get a filtered list for the specified properties.
-       *
-       * This is not really employed here atm, but may change
-       * in the future.
-       */
-      archiveList = catalog->getArchiveList(make_shared<CatalogDescr>(*this),
-                                            this->affectedAttributes);
+  this->tag = CREATE_ARCHIVE_STORAGE;
 
-      output_config->create("list_archive.mode",
-                            std::string("filtered"),
-                            std::string("filtered"));
+}
 
-    } else if (this->mode == ARCHIVE_DETAIL_LIST) {
-      /*
-       * Parser has marked this as a detailed view, which
-       * means that we just had to display the details
-       * of the specified archive NAME.
-       *
-       * NOTE: In this case we usually don't
-       * expect multiple results, however, the code supports this
-       * at this point nevertheless, since we just call
-       * getArchiveList with the affected NAME property attached only.
-       */
-      output_config->create("list_archive.mode",
-                            std::string("detail"),
-                            std::string("detail"));
+CreateArchiveStorageCatalogCommand::~CreateArchiveStorageCatalogCommand() {}
 
-      /*
-       * Get a filtered list for the specified properties.
-       */
-      archiveList = catalog->getArchiveList(make_shared<CatalogDescr>(*this),
-                                            this->affectedAttributes);
+void CreateArchiveStorageCatalogCommand::execute(bool noop) {
 
-    }
+  std::shared_ptr<CatalogDescr> archive_descr = nullptr;
+  bool have_tx = false;
 
-    catalog->commitTransaction();
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
+  }
 
-  } catch (CPGBackupCtlFailure& e) {
-    /* rollback transaction */
-    catalog->rollbackTransaction();
-    throw e;
+  if (this->storage == nullptr) {
+    throw CArchiveIssue("no storage specified");
   }
 
-  catalog->close();
+  if (this->storage->endpoint.compare(0, 7, "file://") != 0
+      && this->storage->endpoint.compare(0, 7, "http://") != 0
+      && this->storage->endpoint.compare(0, 8, "https://") != 0) {
 
-  /* Print results */
-  formatter->nodeAs(archiveList, output);
-  cout << output.str();
+    std::ostringstream oss;
+    oss << "unsupported storage endpoint \"" << this->storage->endpoint
+        << "\", expected a file://, http:// or https:// URL";
+    throw CArchiveIssue(oss.str());
 
-}
+  }
 
-void ListArchiveCatalogCommand::setOutputMode(ListArchiveOutputMode mode) {
-  this->mode = mode;
-}
+  if (this->storage->endpoint.compare(0, 7, "file://") != 0
+      && !ObjectStorageClient::s3Supported()) {
+    throw CArchiveIssue("S3 object storage not supported: compiled without libcurl and OpenSSL");
+  }
 
-AlterArchiveCatalogCommand::AlterArchiveCatalogCommand() {
-  this->tag = ALTER_ARCHIVE;
-}
+  if (this->storage->parallel < 1 || this->storage->parallel > 64) {
+    throw CArchiveIssue("storage PARALLEL must be between 1 and 64");
+  }
 
-AlterArchiveCatalogCommand::AlterArchiveCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+  /* S3 doesn't accept smaller parts */
+  if (this->storage->part_size < 5ULL * 1024 * 1024) {
+    throw CArchiveIssue("storage PART_SIZE must be at least 5 MB");
+  }
 
-  this->copy(*(descr.get()));
-}
+  try {
 
-AlterArchiveCatalogCommand::AlterArchiveCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
-  this->tag = ALTER_ARCHIVE;
-  this->catalog = catalog;
-}
+    this->catalog->startTransaction();
+    have_tx = true;
 
-void AlterArchiveCatalogCommand::execute(bool ignoreMissing) {
+    archive_descr = this->catalog->existsByName(this->archive_name);
 
-  shared_ptr<CatalogDescr> temp_descr(nullptr);
+    if (archive_descr->id < 0) {
 
-  /*
-   * Die hard in case no catalog available.
-   */
-  if (this->catalog == nullptr)
-    throw CArchiveIssue("could not execute archive command: no catalog");
+      std::ostringstream oss;
+      oss << "archive \"" << this->archive_name << "\" does not exist";
+      throw CArchiveIssue(oss.str());
 
-  /*
-   * Open the catalog, if not yet done.
-   */
-  if (!this->catalog->available()) {
-    this->catalog->open_rw();
-  }
+    }
 
-  catalog->startTransaction();
+    if (this->catalog->getArchiveStorage(archive_descr->id)->archive_id >= 0) {
 
-  try {
+      std::ostringstream oss;
+      oss << "archive \"" << this->archive_name << "\" already has a storage";
+      throw CArchiveIssue(oss.str());
 
-    /*
-     * Check if the specified archive name really exists.
-     * If false and ignoreMissing is false, error out. Otherwise
-     * proceed, which turns this action into a no-op, effectively.
-     */
-    temp_descr = this->catalog->existsByName(this->archive_name);
-    if (temp_descr->id >= 0) {
+    }
 
-      this->id = temp_descr->id;
-      this->catalog->updateArchiveAttributes(make_shared<CatalogDescr>(*this),
-                                             this->affectedAttributes);
-    } else {
+    /* Uploads would leave the chunks of deduplicated basebackups behind */
+    if (!DedupChunkStore(DedupChunkStore::forArchive(path(archive_descr->directory))).empty()) {
 
-      if (!ignoreMissing) {
-        ostringstream oss;
-        oss << "could not alter archive: archive name \"" << this->archive_name << "\" does not exists";
-        throw CArchiveIssue(oss.str());
-      }
+      std::ostringstream oss;
+      oss << "archive \"" << this->archive_name << "\" has deduplicated basebackups, "
+          << "which can't be uploaded";
+      throw CArchiveIssue(oss.str());
 
     }
 
+    this->storage->archive_id = archive_descr->id;
+    this->catalog->createArchiveStorage(this->storage);
+
     this->catalog->commitTransaction();
+    have_tx = false;
+
+  } catch (CPGBackupCtlFailure &e) {
+
+    if (have_tx)
+      this->catalog->rollbackTransaction();
 
-  } catch(CPGBackupCtlFailure& e) {
-    this->catalog->rollbackTransaction();
     throw e;
+
   }
 
 }
 
-DropArchiveCatalogCommand::DropArchiveCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
-
-  this->copy(*(descr.get()));
-}
+DropArchiveStorageCatalogCommand::DropArchiveStorageCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
 
-DropArchiveCatalogCommand::DropArchiveCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
   this->catalog = catalog;
-  this->tag     = DROP_ARCHIVE;
+  this->tag = DROP_ARCHIVE_STORAGE;
+
 }
 
-DropArchiveCatalogCommand::DropArchiveCatalogCommand() {
-  this->tag = DROP_ARCHIVE;
+DropArchiveStorageCatalogCommand::DropArchiveStorageCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+  this->tag = DROP_ARCHIVE_STORAGE;
+
 }
 
-void DropArchiveCatalogCommand::execute(bool existsOk) {
+DropArchiveStorageCatalogCommand::DropArchiveStorageCatalogCommand() {
 
-  shared_ptr<CatalogDescr> temp_descr(nullptr);
+  this->tag = DROP_ARCHIVE_STORAGE;
 
-  /*
-   * Die hard in case no catalog available.
-   */
-  if (this->catalog == nullptr)
-    throw CArchiveIssue("could not execute archive command: no catalog");
+}
 
-  /*
-   * Open the catalog, if not yet done.
-   */
-  if (!this->catalog->available()) {
-    this->catalog->open_rw();
-  }
+DropArchiveStorageCatalogCommand::~DropArchiveStorageCatalogCommand() {}
+
+void DropArchiveStorageCatalogCommand::execute(bool noop) {
 
-  catalog->startTransaction();
+  std::shared_ptr<CatalogDescr> archive_descr = nullptr;
+  bool have_tx = false;
+
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
+  }
 
   try {
-    /*
-     * existsOk means in this case we check whether
-     * the archive exists. If false, raise an error, otherwise
-     * just pass which turns this method into a no-op.
-     */
-    temp_descr = catalog->existsByName(this->archive_name);
 
-    if (temp_descr->id >= 0) {
+    this->catalog->startTransaction();
+    have_tx = true;
 
-      /* archive name exists, so drop it... */
-      catalog->dropArchive(this->archive_name);
+    archive_descr = this->catalog->existsByName(this->archive_name);
 
-    } else {
+    if (archive_descr->id < 0) {
 
-      if (!existsOk) {
-        ostringstream oss;
-        oss << "specified archive name \"" << this->archive_name << "\" does not exists";
+      std::ostringstream oss;
+      oss << "archive \"" << this->archive_name << "\" does not exist";
+      throw CArchiveIssue(oss.str());
 
-        /*
-         * Note: cleanup handled below in exception handler.
-         */
-        throw CArchiveIssue(oss.str());
-      }
     }
 
-    catalog->dropArchive(this->archive_name);
-    catalog->commitTransaction();
+    if (this->catalog->getArchiveStorage(archive_descr->id)->archive_id < 0) {
 
-  } catch (CPGBackupCtlFailure& e) {
+      std::ostringstream oss;
+      oss << "archive \"" << this->archive_name << "\" has no storage";
+      throw CArchiveIssue(oss.str());
+
+    }
+
+    this->catalog->dropArchiveStorage(archive_descr->id);
+
+    this->catalog->commitTransaction();
+    have_tx = false;
+
+  } catch (CPGBackupCtlFailure &e) {
+
+    if (have_tx)
+      this->catalog->rollbackTransaction();
 
-    /*
-     * handle error condition, but don't suppress the
-     * exception from the caller
-     */
-    catalog->rollbackTransaction();
     throw e;
 
   }
 
 }
 
-CreateArchiveCatalogCommand::CreateArchiveCatalogCommand() {
-  this->tag = CREATE_ARCHIVE;
-}
-
-CreateArchiveCatalogCommand::CreateArchiveCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+ListUploadsCatalogCommand::ListUploadsCatalogCommand(std::shared_ptr<BackupCatalog> catalog) {
 
-  this->copy(*(descr.get()));
+  this->catalog = catalog;
+  this->tag = LIST_UPLOADS;
 
 }
 
-std::shared_ptr<BackupCatalog> BaseCatalogCommand::getCatalog() {
-  return this->catalog;
-}
+ListUploadsCatalogCommand::ListUploadsCatalogCommand(std::shared_ptr<CatalogDescr> descr) {
+
+  this->copy(*(descr.get()));
+  this->tag = LIST_UPLOADS;
 
-void BaseCatalogCommand::setCatalog(std::shared_ptr<BackupCatalog> catalog) {
-  this->catalog = catalog;
 }
 
-CreateArchiveCatalogCommand::CreateArchiveCatalogCommand(shared_ptr<BackupCatalog> catalog) {
+ListUploadsCatalogCommand::ListUploadsCatalogCommand() {
 
-  this->catalog = catalog;
-  this->tag = CREATE_ARCHIVE;
+  this->tag = LIST_UPLOADS;
 
 }
 
-void CreateArchiveCatalogCommand::execute(bool existsOk) {
+ListUploadsCatalogCommand::~ListUploadsCatalogCommand() {}
 
-  shared_ptr<CatalogDescr> temp_descr(nullptr);
+void ListUploadsCatalogCommand::execute(bool noop) {
 
-  /*
-   * Die hard in case no catalog available.
-   */
-  if (this->catalog == NULL)
-    throw CArchiveIssue("could not execute archive command: no catalog");
+  vector<shared_ptr<UploadDescr>> uploads;
+  int archive_id = -1;
 
-  /*
-   * Open the catalog, if not yet done
-   */
-  if (!this->catalog->available()) {
-    this->catalog->open_rw();
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
   }
 
-  this->catalog->startTransaction();
-
-  /*
-   * If existsOk is TRUE and we have an
-   * existing archive entry in the catalog, proceed.
-   * Otherwise we die a hard and unpleasent immediate
-   * death...
-   */
-  temp_descr = this->catalog->exists(this->directory);
+  if (!catalog->available()) {
+    catalog->open_ro();
+  }
 
-  try {
-    if (temp_descr->id < 0) {
+  if (this->archive_name.length() > 0) {
 
-      /*
-       * This is a new archive entry.
-       */
-      this->catalog->createArchive((temp_descr = make_shared<CatalogDescr>(*this)));
+    std::shared_ptr<CatalogDescr> archive_descr = this->catalog->existsByName(this->archive_name);
 
-      /*
-       * Create the corresponding database connection entry.
-       *
-       * NOTE: createArchive() should have set the archive id
-       *       in the catalog descriptor if successful.
-       */
-      temp_descr->setConnectionType(ConnectionDescr::CONNECTION_TYPE_BASEBACKUP);
-      this->catalog->createCatalogConnection(temp_descr->coninfo);
+    if (archive_descr->id < 0) {
 
-      this->catalog->commitTransaction();
+      std::ostringstream oss;
+      oss << "archive \"" << this->archive_name << "\" does not exist";
+      throw CArchiveIssue(oss.str());
 
     }
-    else {
 
-      if (!existsOk) {
-        ostringstream oss;
-        oss << "archive already exists: \"" << this->directory << "\"";
-        throw CArchiveIssue(oss.str());
-      }
+    archive_id = archive_descr->id;
 
-      /*
-       * ID of the existing catalog entry needed.
-       */
-      this->id = temp_descr->id;
-      this->catalog->startTransaction();
+  }
 
-      /*
-       * Update the existing archive catalog entry.
-       */
-      this->catalog->updateArchiveAttributes(make_shared<CatalogDescr>(*this),
-                                             this->affectedAttributes);
+  this->catalog->getUploads(archive_id, uploads);
 
-      /*
-       * ... and we're done.
-       */
-      this->catalog->commitTransaction();
-    }
-  } catch(CPGBackupCtlFailure& e) {
-    this->catalog->rollbackTransaction();
-    /* re-throw ... */
-    throw e;
-  }
+  shared_ptr<OutputFormatConfiguration> output_config
+    = std::make_shared<OutputFormatConfiguration>();
+  shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(output_config,
+                                                                     catalog,
+                                                                     getOutputFormat());
+  ostringstream output;
+  formatter->nodeAs(uploads, output);
+  cout << output.str();
 
 }
 
-BackgroundWorkerCommandHandle::BackgroundWorkerCommandHandle(std::shared_ptr<BackupCatalog> catalog) {
-  this->tag = BACKGROUND_WORKER_COMMAND;
-  this->subTag = EMPTY_DESCR;
+UploadArchiveCommand::UploadArchiveCommand(std::shared_ptr<BackupCatalog> catalog) {
+
   this->catalog = catalog;
+  this->tag = UPLOAD_ARCHIVE;
+
 }
 
-BackgroundWorkerCommandHandle::BackgroundWorkerCommandHandle(std::shared_ptr<CatalogDescr> descr) {
+UploadArchiveCommand::UploadArchiveCommand(std::shared_ptr<CatalogDescr> descr) {
 
   this->copy(*(descr.get()));
-
-  /*
-   * Rewrite identity command tag, subTag transports
-   * the encapsulated catalog command.
-   */
-  this->subTag = this->tag;
-  this->tag = BACKGROUND_WORKER_COMMAND;
+  this->tag = UPLOAD_ARCHIVE;
 
 }
 
-void BackgroundWorkerCommandHandle::execute(bool noop) {
+UploadArchiveCommand::UploadArchiveCommand() {
+
+  this->tag = UPLOAD_ARCHIVE;
 
 }
 
-StatArchiveBaseBackupCommand::StatArchiveBaseBackupCommand(std::shared_ptr<BackupCatalog> catalog) {
+UploadArchiveCommand::~UploadArchiveCommand() {}
 
-  this->catalog = catalog;
-  this->tag = STAT_ARCHIVE_BASEBACKUP;
+void UploadArchiveCommand::purgeRemovedUploads(int archive_id) {
 
-}
+  std::vector<std::shared_ptr<UploadDescr>> uploads;
+  unsigned int purged = 0;
 
+  this->catalog->getUploads(archive_id, uploads);
+  this->catalog->startTransaction();
 
-StatArchiveBaseBackupCommand::StatArchiveBaseBackupCommand(std::shared_ptr<CatalogDescr> descr) {
+  try {
 
-  this->copy(*(descr.get()));
-  this->tag = STAT_ARCHIVE_BASEBACKUP;
+    for (auto &upload : uploads) {
 
-}
+      boost::system::error_code ec;
 
-StatArchiveBaseBackupCommand::StatArchiveBaseBackupCommand() {
+      if (upload->kind != UPLOAD_WAL || upload->status != UPLOAD_DONE)
+        continue;
 
-  this->tag = STAT_ARCHIVE_BASEBACKUP;
+      if (boost::filesystem::exists(upload->path, ec) || ec)
+        continue;
 
-}
+      this->catalog->deleteUpload(upload->id);
+      purged++;
 
-StatArchiveBaseBackupCommand::~StatArchiveBaseBackupCommand() {}
+    }
 
-void StatArchiveBaseBackupCommand::execute(bool noop) {
+    this->catalog->commitTransaction();
 
-  std::shared_ptr<CatalogDescr> archive_descr   = nullptr;
-  std::shared_ptr<BaseBackupDescr> backup_descr = nullptr;
-  std::shared_ptr<std::list<boost::filesystem::directory_entry>> contents;
+  } catch (CPGBackupCtlFailure &e) {
+    this->catalog->rollbackTransaction();
+    throw e;
+  }
 
-  /* Catalog access required */
-  if (catalog == NULL) {
-    throw CArchiveIssue("could not execute archive command: no catalog");
+  if (purged > 0)
+    BOOST_LOG_TRIVIAL(debug) << "dropped " << purged << " removed WAL segments from upload queue";
+
+}
+
+void UploadArchiveCommand::execute(bool noop) {
+
+  std::shared_ptr<CatalogDescr> archive_descr = nullptr;
+  std::shared_ptr<ArchiveStorageDescr> storage = nullptr;
+  std::shared_ptr<ObjectUploader> uploader = nullptr;
+  std::set<int> tried;
+  unsigned int uploaded = 0;
+  unsigned int failed = 0;
+  bool more = true;
+
+  if (this->catalog == nullptr) {
+    throw CArchiveIssue("could not execute command: no catalog");
   }
 
-  /*
-   * Open the catalog if not done yet, read only access is sufficient.
-   */
-  if (!catalog->available()) {
-    catalog->open_ro();
+  if (!this->catalog->available()) {
+    this->catalog->open_rw();
   }
 
-  /*
-   * Get the archive catalog descr, error
-   * out if the specified archive does not exist.x
-   */
-  archive_descr = catalog->existsByName(this->archive_name);
+  archive_descr = this->catalog->existsByName(this->archive_name);
 
   if (archive_descr->id < 0) {
 
@@ -4285,42 +6703,82 @@ void StatArchiveBaseBackupCommand::execute(bool noop) {
 
   }
 
-  /*
-   * Okay, archive_name exists, get the basebackup descriptor.
-   */
-  backup_descr = catalog->getBaseBackup(this->basebackup_id, archive_descr->id);
+  storage = this->catalog->getArchiveStorage(archive_descr->id);
 
-  /*
-   * Check if the specified basebackup_id was valid.
-   */
-  if (backup_descr->id < 0) {
+  if (storage->archive_id < 0) {
 
     std::ostringstream oss;
-    oss << "basebackup ID \"" << this->basebackup_id << "\" "
-        << "does not exist in archive \""
-        << this->archive_name << "\"";
+    oss << "archive \"" << this->archive_name << "\" has no storage";
     throw CArchiveIssue(oss.str());
 
   }
 
-  BOOST_LOG_TRIVIAL(debug) << "STAT on directory \""
-                           << backup_descr->fsentry
-                           << "\"";
+  uploader = std::make_shared<ObjectUploader>(storage);
 
-  /* Basebackup exists, dump its contents */
-  StreamingBaseBackupDirectory bbdir(path(backup_descr->fsentry));
-  contents = bbdir.stat();
+  this->purgeRemovedUploads(archive_descr->id);
 
   /*
-   * Print out file list
+   * Files queued while we're uploading are picked up by reading
+   * the queue again, until a pass doesn't find anything new. Every
+   * upload is tried once per run at most.
    */
-  shared_ptr<OutputFormatConfiguration> output_config
-    = std::make_shared<OutputFormatConfiguration>();
-  shared_ptr<OutputFormatter> formatter = OutputFormatter::formatter(output_config,
-                                                                     catalog,
-                                                                     getOutputFormat());
-  ostringstream output;
-  formatter->nodeAs(contents, output);
-  cout << output.str();
+  while (more) {
+
+    std::vector<std::shared_ptr<UploadDescr>> uploads;
+
+    more = false;
+    this->catalog->getUploads(archive_descr->id, uploads, true);
+
+    for (auto &upload : uploads) {
+
+      if (this->stopHandler != nullptr && this->stopHandler->check()) {
+        BOOST_LOG_TRIVIAL(info) << "upload of archive \"" << this->archive_name
+                                << "\" interrupted";
+        more = false;
+        break;
+      }
+
+      if (tried.find(upload->id) != tried.end()
+          || upload->attempts >= ObjectUploader::MAX_ATTEMPTS)
+        continue;
+
+      tried.insert(upload->id);
+      more = true;
+
+      upload->status = UPLOAD_RUNNING;
+      upload->attempts++;
+      upload->last_error = "";
+      this->catalog->updateUploadStatus(upload);
+
+      try {
+
+        uploader->upload(upload, [this](std::shared_ptr<UploadDescr> started) {
+            this->catalog->updateUploadStatus(started);
+          });
+
+        upload->status = UPLOAD_DONE;
+        uploaded++;
+
+      } catch (CArchiveIssue &e) {
+
+        upload->status = UPLOAD_FAILED;
+        upload->last_error = e.what();
+        failed++;
+
+        BOOST_LOG_TRIVIAL(warning) << "could not upload \"" << upload->path << "\" (attempt "
+                                   << upload->attempts << " of " << ObjectUploader::MAX_ATTEMPTS
+                                   << "): " << e.what();
+
+      }
+
+      this->catalog->updateUploadStatus(upload);
+
+    }
+
+  }
+
+  BOOST_LOG_TRIVIAL(info) << "uploaded " << uploaded << " files ("
+                          << uploader->bytesUploaded() << " bytes) of archive \""
+                          << this->archive_name << "\", " << failed << " failed";
 
 }
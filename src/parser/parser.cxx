@@ -59,6 +59,22 @@ namespace pgbckctl {
 
       pgbckctl::CatalogDescr getCommand() { return this->cmd; }
 
+      /*
+       * Resets the state left by the last command, so the grammar
+       * can be reused. The semantic actions are bound to the address
+       * of cmd, so it's reinitialized in place.
+       */
+      void reset(shared_ptr<RuntimeConfiguration> rtc) {
+
+        this->cmd.~CatalogDescr();
+        new (&this->cmd) pgbckctl::CatalogDescr();
+        this->cmd.assignRuntimeConfiguration(rtc);
+
+        this->parser_error.str("");
+        this->parser_error.clear();
+
+      }
+
       PGBackupCtlBoostParser(shared_ptr<RuntimeConfiguration> rtc)
         : PGBackupCtlBoostParser::base_type(start, "pg_backup_ctl command") {
 
@@ -129,6 +145,8 @@ namespace pgbckctl {
                                               | cmd_create_backup_profile
                                               | cmd_create_connection
                                               | cmd_create_retention
+                                              | cmd_create_schedule
+                                              | cmd_create_storage
                                               )
                           )
 
@@ -140,6 +158,8 @@ namespace pgbckctl {
                                               | cmd_list_connection
                                               | cmd_list_backup_list
                                               | cmd_list_retention
+                                              | cmd_list_schedules
+                                              | cmd_list_uploads
                                               )
                             )
 
@@ -176,16 +196,23 @@ namespace pgbckctl {
                                               | cmd_drop_retention
 
                                               /* DROP BASEBACKUP */
-                                              | cmd_drop_basebackup )
+                                              | cmd_drop_basebackup
+
+                                              /* DROP SCHEDULE */
+                                              | cmd_drop_schedule
+
+                                              /* DROP STORAGE */
+                                              | cmd_drop_storage )
                             )
 
                          /*
-                          * VERIFY ARCHIVE <name> command
+                          * VERIFY ARCHIVE <name> [ CONNECTION | BASEBACKUP <ID> [PARALLEL <n>] ] command
                           */
                          | ( cmd_verify_archive > eps > identifier
                              [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ]
-                             > eps > -verify_check_connection
-                             [ boost::bind(&CatalogDescr::setVerifyOption, &cmd, VERIFY_DATABASE_CONNECTION) ] )
+                             > eps > -( verify_check_connection
+                                        [ boost::bind(&CatalogDescr::setVerifyOption, &cmd, VERIFY_DATABASE_CONNECTION) ]
+                                        | verify_basebackup ) )
 
                          /*
                           * START command
@@ -232,6 +259,13 @@ namespace pgbckctl {
                          | (
                             cmd_stat
                             )
+
+                         /*
+                          * UPLOAD ARCHIVE <name>
+                          */
+                         | (
+                            cmd_upload_archive
+                            )
                          ); /* start rule end */
 
         /*
@@ -247,9 +281,13 @@ namespace pgbckctl {
           [ boost::bind(&CatalogDescr::setBasebackupID, &cmd, ::_1) ];
 
         /*
-         * RESTORE FROM ARCHIVE <name> BASEBACKUP { <ID> | { LATEST|NEWEST|CURRENT|OLDEST } }
+         * RESTORE FROM ARCHIVE <name>
+         * { BASEBACKUP { <ID> | { LATEST|NEWEST|CURRENT|OLDEST } }
+         *   | RECOVERY TARGET { TIME "<timestamp>" | LSN "<XLOG position>" | LATEST }
+         *     [ TIMELINE <TLI> ] }
          * TO DIRECTORY <directory>
          * [ TABLESPACE MAP { <OID>=<directory>, [ ... ] | ALL=<DIRECTORY> } ]
+         * [ PREVIEW ]
          */
         cmd_restore = no_case[ lexeme[ lit("RESTORE") ] ]
           [ boost::bind(&CatalogDescr::setCommandTag, &cmd, RESTORE_BACKUP) ]
@@ -260,7 +298,7 @@ namespace pgbckctl {
           > eps > cmd_restore_type
           > eps > cmd_restore_action;
 
-        cmd_restore_type = no_case[ lexeme[ lit("BASEBACKUP") ] ]
+        cmd_restore_type = ( no_case[ lexeme[ lit("BASEBACKUP") ] ]
           >> ( ( ( no_case[ lexeme[ lit("LATEST") ] ]
                    [ boost::bind(&CatalogDescr::createRestoreDescrByBaseBackupName, &cmd, std::string("LATEST")) ]
                    )
@@ -280,13 +318,38 @@ namespace pgbckctl {
                |
                ( number_ID
                  [ boost::bind(&CatalogDescr::createRestoreDescrByBaseBackupID, &cmd, ::_1) ] )
-               );
+               ) )
+          | restore_recovery_target;
+
+        restore_recovery_target = no_case[ lexeme[ lit("RECOVERY") ] ]
+          > eps > no_case[ lexeme[ lit("TARGET") ] ]
+          > eps > ( ( no_case[ lexeme[ lit("TIME") ] ]
+                      > eps > -(no_case[ lexeme[ lit("=") ] ])
+                      > eps > label_string
+                      [ boost::bind(&CatalogDescr::createRestoreDescrByTarget, &cmd,
+                                    RESTORE_TARGET_TIME, ::_1) ] )
+                    |
+                    ( no_case[ lexeme[ lit("LSN") ] ]
+                      > eps > -(no_case[ lexeme[ lit("=") ] ])
+                      > eps > label_string
+                      [ boost::bind(&CatalogDescr::createRestoreDescrByTarget, &cmd,
+                                    RESTORE_TARGET_LSN, ::_1) ] )
+                    |
+                    ( no_case[ lexeme[ lit("LATEST") ] ]
+                      [ boost::bind(&CatalogDescr::createRestoreDescrByTarget, &cmd,
+                                    RESTORE_TARGET_LATEST, std::string("")) ] ) )
+          >> eps >> -( no_case[ lexeme[ lit("TIMELINE") ] ]
+                       > eps > number_ID
+                       [ boost::bind(&CatalogDescr::restoreTargetTimelineFromParserState, &cmd, ::_1) ] );
 
         cmd_restore_action = eps > no_case[ lexeme[ lit("TO") ] ]
           > eps > no_case[ lexeme[ lit("DIRECTORY") ] ]
           > eps > no_case[ lexeme[ lit("=") ] ]
           > eps > directory_string
-          > eps >> -(tablespace_map);
+          [ boost::bind(&CatalogDescr::restoreTargetDirectoryFromParserState, &cmd, ::_1) ]
+          > eps >> -(tablespace_map)
+          >> eps >> -(no_case[ lexeme[ lit("PREVIEW") ] ]
+                      [ boost::bind(&CatalogDescr::setRestorePreview, &cmd, true) ]);
 
         tablespace_map = no_case[ lexeme[ lit("TABLESPACE") ] ]
           > eps > no_case[ lexeme[ lit("MAP") ] ]
@@ -362,12 +425,36 @@ namespace pgbckctl {
         /* parses ID */
         number_ID = +char_("0-9");
 
+        /*
+         * ALTER ARCHIVE <name> SET LOG LAYOUT { SHARDED | FLAT }
+         */
+        alter_archive_log_layout = no_case[ lexeme[ lit("SET") ] ]
+          >> no_case[ lexeme[ lit("LOG") ] ]
+          [ boost::bind(&CatalogDescr::setCommandTag, &cmd, ALTER_ARCHIVE_LOG_LAYOUT) ]
+          > eps > no_case[ lexeme[ lit("LAYOUT") ] ]
+          > eps > ( no_case[ lexeme[ lit("SHARDED") ] ]
+                    [ boost::bind(&CatalogDescr::setLogLayoutSharded, &cmd, true) ]
+                    | no_case[ lexeme[ lit("FLAT") ] ]
+                    [ boost::bind(&CatalogDescr::setLogLayoutSharded, &cmd, false) ] );
+
+        /*
+         * ALTER ARCHIVE <name> SET COLD DIRECTORY "<path>"
+         */
+        alter_archive_cold_tier = no_case[ lexeme[ lit("SET") ] ]
+          >> no_case[ lexeme[ lit("COLD") ] ]
+          [ boost::bind(&CatalogDescr::setCommandTag, &cmd, ALTER_ARCHIVE_COLD_TIER) ]
+          > eps > no_case[ lexeme[ lit("DIRECTORY") ] ]
+          > eps > directory_string
+          [ boost::bind(&CatalogDescr::setColdDirectory, &cmd, ::_1) ];
+
         /*
          * ALTER ARCHIVE <name> command
          */
         cmd_alter_archive_opt = eps > identifier
           [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ]
-          > eps > ( no_case[ lexeme[ lit("SET") ] ] > eps
+          > eps > ( alter_archive_log_layout
+                    | alter_archive_cold_tier
+                    | ( no_case[ lexeme[ lit("SET") ] ] > eps
               ^ ( directory
                   [ boost::bind(&CatalogDescr::setDirectory, &cmd, ::_1) ] )
               ^ ( ( hostname
@@ -380,7 +467,7 @@ namespace pgbckctl {
                     [ boost::bind(&CatalogDescr::setPort, &cmd, ::_1) ] )
                   |
                   ( no_case[ lexeme[ lit("DSN") ]] > eps > -lit("=") > eps > dsn_connection_string
-                    [ boost::bind(&CatalogDescr::setDSN, &cmd, ::_1) ] ) ) );
+                    [ boost::bind(&CatalogDescr::setDSN, &cmd, ::_1) ] ) ) ) );
 
         /*
          * START LAUNCHER command
@@ -397,7 +484,7 @@ namespace pgbckctl {
           > eps > cmd_apply_retention;
 
         /*
-         * APPLY RETENTION POLICY <identifier> TO ARCHIVE <identifier>
+         * APPLY RETENTION POLICY <identifier> TO ARCHIVE <identifier> [PREVIEW]
          */
         cmd_apply_retention = no_case[ lexeme[ lit("RETENTION") ]]
           > eps > no_case[ lexeme[ lit("POLICY") ]]
@@ -407,7 +494,9 @@ namespace pgbckctl {
           > eps > no_case[ lexeme[ lit("TO") ]]
           > eps > no_case[ lexeme[ lit("ARCHIVE") ]]
           > eps > identifier
-          [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ];
+          [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ]
+          > eps > -(no_case[ lexeme[ lit("PREVIEW") ] ])
+          [ boost::bind(&CatalogDescr::setRetentionPreview, &cmd, true) ];
 
         /* SET <class.variable name> = <variable value> */
         cmd_set = no_case[ lexeme[ lit("SET") ]]
@@ -453,7 +542,7 @@ namespace pgbckctl {
           > eps > variable_name
           [ boost::bind(&CatalogDescr::setVariableName, &cmd, ::_1) ];
 
-        /* SHOW ( VARIABLES | WORKERS | <runtime variable> ) */
+        /* SHOW ( VARIABLES | WORKERS | STREAM STATISTICS | <runtime variable> ) */
         cmd_show = no_case[lexeme[ lit("SHOW") ]]
           > eps > show_command_type;
 
@@ -463,6 +552,12 @@ namespace pgbckctl {
 
           |
 
+          ( no_case[lexeme[ lit("STREAM") ]]
+            > eps > no_case[lexeme[ lit("STATISTICS") ]]
+            [ boost::bind(&CatalogDescr::setCommandTag, &cmd, SHOW_STREAM_STATISTICS) ] )
+
+          |
+
           ( no_case[lexeme[ lit("VARIABLES") ]]
             [ boost::bind(&CatalogDescr::setCommandTag, &cmd, SHOW_VARIABLES) ] )
 
@@ -513,6 +608,8 @@ namespace pgbckctl {
           > eps > no_case[ lexeme[ lit("FOR ARCHIVE") ] ]
           > eps > identifier
           [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ]
+          > eps > *( lit(',') > identifier
+                     [ boost::bind(&CatalogDescr::pushStreamArchiveName, &cmd, ::_1) ] )
           > eps > -( no_case[lexeme[ lit("RESTART") ]]
                [ boost::bind(&CatalogDescr::setStreamingForceXLOGPositionRestart, &cmd, true) ] )
           > eps > -( no_case[lexeme[ lit("NODETACH") ]]
@@ -535,6 +632,17 @@ namespace pgbckctl {
 
         verify_check_connection = no_case[lexeme[ lit("CONNECTION") ]];
 
+        /*
+         * VERIFY ARCHIVE <name> BASEBACKUP <ID> [PARALLEL <n>]
+         */
+        verify_basebackup = no_case[lexeme[ lit("BASEBACKUP") ]]
+          [ boost::bind(&CatalogDescr::setCommandTag, &cmd, VERIFY_BASEBACKUP) ]
+          > eps > number_ID
+          [ boost::bind(&CatalogDescr::setBasebackupID, &cmd, ::_1) ]
+          > eps > -( no_case[lexeme[ lit("PARALLEL") ]] > eps > -lit("=")
+                     > eps > number_ID
+                     [ boost::bind(&CatalogDescr::setVerifyWorkers, &cmd, ::_1) ] );
+
         /*
          * LIST RETENTION { POLICIES | POLICY <identifier> }
          */
@@ -547,6 +655,31 @@ namespace pgbckctl {
                 > eps > identifier
                 [ boost::bind(&CatalogDescr::setRetentionName, &cmd, ::_1) ] ) );
 
+        /*
+         * LIST SCHEDULES
+         */
+        cmd_list_schedules = no_case[ lexeme[ lit("SCHEDULES") ] ]
+          [ boost::bind(&CatalogDescr::setCommandTag, &cmd, LIST_SCHEDULES) ];
+
+        /*
+         * LIST UPLOADS [ FOR ARCHIVE <identifier> ]
+         */
+        cmd_list_uploads = no_case[ lexeme[ lit("UPLOADS") ] ]
+          [ boost::bind(&CatalogDescr::setCommandTag, &cmd, LIST_UPLOADS) ]
+          > eps > -( no_case[ lexeme[ lit("FOR") ] ]
+                     > eps > no_case[ lexeme[ lit("ARCHIVE") ] ]
+                     > eps > identifier
+                     [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ] );
+
+        /*
+         * UPLOAD ARCHIVE <identifier>
+         */
+        cmd_upload_archive = no_case[ lexeme[ lit("UPLOAD") ] ]
+          [ boost::bind(&CatalogDescr::setCommandTag, &cmd, UPLOAD_ARCHIVE) ]
+          > eps > no_case[ lexeme[ lit("ARCHIVE") ] ]
+          > eps > identifier
+          [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ];
+
         /*
          * LIST CONNECTION FOR ARCHIVE <archive name > command
          */
@@ -602,15 +735,25 @@ namespace pgbckctl {
           > eps >> backup_profile_opts;
 
         backup_profile_opts =
-          -(profile_compression_option)
+          -(profile_compression_option
+            >> -(profile_compression_level_option
+                 [ boost::bind(&CatalogDescr::setProfileCompressLevel, &cmd, ::_1) ])
+            >> -(profile_compression_workers_option
+                 [ boost::bind(&CatalogDescr::setProfileCompressWorkers, &cmd, ::_1) ])
+            >> -(profile_compression_location_option))
           >> -(profile_max_rate_option
               [ boost::bind(&CatalogDescr::setProfileMaxRate, &cmd, ::_1) ])
+          >> -(profile_rate_control_option)
+          >> -(profile_parallel_option
+               [ boost::bind(&CatalogDescr::setProfileParallelWriters, &cmd, ::_1) ])
           >> -(profile_backup_label_option)
           >> -(profile_wal_option)
           >> -(profile_checkpoint_option)
           >> -(profile_wait_for_wal_option)
           >> -(profile_noverify_checksums_option)
-          >> -(profile_manifest_option);
+          >> -(profile_manifest_option)
+          >> -(profile_incremental_option)
+          >> -(profile_deduplicate_option);
 
         /*
          * CREATE RETENTION POLICY <identifier>
@@ -623,6 +766,7 @@ namespace pgbckctl {
           [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ]
           > eps > ( retention_keep_action
                     | retention_drop_action
+                    | retention_move_action
                     | retention_cleanup_basebackups
                     /*
                      * CREATE RETENTION POLICY ... CLEANUP is a DROP action
@@ -634,6 +778,81 @@ namespace pgbckctl {
                      */
                     [ boost::bind(&CatalogDescr::makeRetentionRule, &cmd, RETENTION_CLEANUP, string("cleanup")) ] );
 
+        /*
+         * CREATE SCHEDULE FOR ARCHIVE <identifier>
+         *   { BASEBACKUP [PROFILE <identifier>] | VERIFY }
+         *   EVERY <n> { MINUTES | HOURS | DAYS }
+         *   [ JITTER <n> { MINUTES | HOURS | DAYS } ] [ PRIORITY <n> ]
+         */
+        cmd_create_schedule = no_case[ lexeme[ lit("SCHEDULE") ] ]
+          [ boost::bind(&CatalogDescr::setCommandTag, &cmd, CREATE_SCHEDULE) ]
+          > eps > no_case[ lexeme[ lit("FOR") ] ]
+          > eps > no_case[ lexeme[ lit("ARCHIVE") ] ]
+          > eps > identifier
+          [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ]
+          > eps > ( ( no_case[ lexeme[ lit("BASEBACKUP") ] ]
+                      [ boost::bind(&CatalogDescr::makeScheduleDescr, &cmd, SCHEDULE_BASEBACKUP) ]
+                      > eps > -(with_profile) )
+                    | schedule_verify )
+          > eps > no_case[ lexeme[ lit("EVERY") ] ]
+          > eps > number_ID
+          [ boost::bind(&CatalogDescr::setScheduleInterval, &cmd, ::_1) ]
+          > eps > ( no_case[ lexeme[ lit("MINUTES") ] ]
+                    [ boost::bind(&CatalogDescr::setScheduleIntervalUnit, &cmd, 60u) ]
+                    | no_case[ lexeme[ lit("HOURS") ] ]
+                    [ boost::bind(&CatalogDescr::setScheduleIntervalUnit, &cmd, 3600u) ]
+                    | no_case[ lexeme[ lit("DAYS") ] ]
+                    [ boost::bind(&CatalogDescr::setScheduleIntervalUnit, &cmd, 86400u) ] )
+          > eps > -( no_case[ lexeme[ lit("JITTER") ] ]
+                     > eps > number_ID
+                     [ boost::bind(&CatalogDescr::setScheduleJitter, &cmd, ::_1) ]
+                     > eps > ( no_case[ lexeme[ lit("MINUTES") ] ]
+                               [ boost::bind(&CatalogDescr::setScheduleJitterUnit, &cmd, 60u) ]
+                               | no_case[ lexeme[ lit("HOURS") ] ]
+                               [ boost::bind(&CatalogDescr::setScheduleJitterUnit, &cmd, 3600u) ]
+                               | no_case[ lexeme[ lit("DAYS") ] ]
+                               [ boost::bind(&CatalogDescr::setScheduleJitterUnit, &cmd, 86400u) ] ) )
+          > eps > -( no_case[ lexeme[ lit("PRIORITY") ] ]
+                     > eps > number_ID
+                     [ boost::bind(&CatalogDescr::setSchedulePriority, &cmd, ::_1) ] );
+
+        schedule_verify = no_case[ lexeme[ lit("VERIFY") ] ]
+          [ boost::bind(&CatalogDescr::makeScheduleDescr, &cmd, SCHEDULE_VERIFY) ];
+
+        /*
+         * CREATE STORAGE FOR ARCHIVE <identifier>
+         *   ENDPOINT "<url>" BUCKET <name> [ PREFIX "<prefix>" ] [ REGION <region> ]
+         *   [ PARALLEL <n> ] [ PART_SIZE <megabytes> ] [ MAX_RATE <kb/s> ]
+         */
+        cmd_create_storage = no_case[ lexeme[ lit("STORAGE") ] ]
+          [ boost::bind(&CatalogDescr::setCommandTag, &cmd, CREATE_ARCHIVE_STORAGE) ]
+          [ boost::bind(&CatalogDescr::makeArchiveStorageDescr, &cmd) ]
+          > eps > no_case[ lexeme[ lit("FOR") ] ]
+          > eps > no_case[ lexeme[ lit("ARCHIVE") ] ]
+          > eps > identifier
+          [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ]
+          > eps > no_case[ lexeme[ lit("ENDPOINT") ] ]
+          > eps > directory_string
+          [ boost::bind(&CatalogDescr::setStorageEndpoint, &cmd, ::_1) ]
+          > eps > no_case[ lexeme[ lit("BUCKET") ] ]
+          > eps > property_string
+          [ boost::bind(&CatalogDescr::setStorageBucket, &cmd, ::_1) ]
+          > eps > -( no_case[ lexeme[ lit("PREFIX") ] ]
+                     > eps > directory_string
+                     [ boost::bind(&CatalogDescr::setStoragePrefix, &cmd, ::_1) ] )
+          > eps > -( no_case[ lexeme[ lit("REGION") ] ]
+                     > eps > property_string
+                     [ boost::bind(&CatalogDescr::setStorageRegion, &cmd, ::_1) ] )
+          > eps > -( no_case[ lexeme[ lit("PARALLEL") ] ]
+                     > eps > number_ID
+                     [ boost::bind(&CatalogDescr::setStorageParallel, &cmd, ::_1) ] )
+          > eps > -( no_case[ lexeme[ lit("PART_SIZE") ] ]
+                     > eps > number_ID
+                     [ boost::bind(&CatalogDescr::setStoragePartSize, &cmd, ::_1) ] )
+          > eps > -( no_case[ lexeme[ lit("MAX_RATE") ] ]
+                     > eps > number_ID
+                     [ boost::bind(&CatalogDescr::setStorageMaxRate, &cmd, ::_1) ] );
+
         retention_keep_action =
           no_case[ lexeme[ lit("KEEP") ] ]
           [ boost::bind(&CatalogDescr::setRetentionAction, &cmd, RETENTION_ACTION_KEEP) ]
@@ -657,6 +876,15 @@ namespace pgbckctl {
                      retention_rule_num_basebackups
                      );
 
+        /*
+         * MOVE OLDER THAN <interval>, moves basebackups and WAL
+         * to the cold tier of the archive.
+         */
+        retention_move_action =
+          no_case[ lexeme[ lit("MOVE") ] ]
+          [ boost::bind(&CatalogDescr::setRetentionAction, &cmd, RETENTION_ACTION_MOVE) ]
+          > eps > retention_rule_older_datetime;
+
         retention_cleanup_basebackups = no_case[lexeme[ lit("CLEANUP") ]];
 
         retention_rule_num_basebackups = lexeme[ lit("+") ] > eps > number_ID
@@ -780,6 +1008,29 @@ namespace pgbckctl {
           > eps > identifier
           [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ];
 
+        /*
+         * DROP SCHEDULE FOR ARCHIVE <identifier> { BASEBACKUP | VERIFY }
+         */
+        cmd_drop_schedule = no_case[ lexeme[ lit("SCHEDULE") ] ]
+          [ boost::bind(&CatalogDescr::setCommandTag, &cmd, DROP_SCHEDULE) ]
+          > eps > no_case[ lexeme[ lit("FOR") ] ]
+          > eps > no_case[ lexeme[ lit("ARCHIVE") ] ]
+          > eps > identifier
+          [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ]
+          > eps > ( no_case[ lexeme[ lit("BASEBACKUP") ] ]
+                    [ boost::bind(&CatalogDescr::makeScheduleDescr, &cmd, SCHEDULE_BASEBACKUP) ]
+                    | schedule_verify );
+
+        /*
+         * DROP STORAGE FOR ARCHIVE <identifier>
+         */
+        cmd_drop_storage = no_case[ lexeme[ lit("STORAGE") ] ]
+          [ boost::bind(&CatalogDescr::setCommandTag, &cmd, DROP_ARCHIVE_STORAGE) ]
+          > eps > no_case[ lexeme[ lit("FOR") ] ]
+          > eps > no_case[ lexeme[ lit("ARCHIVE") ] ]
+          > eps > identifier
+          [ boost::bind(&CatalogDescr::setIdent, &cmd, ::_1) ];
+
         /*
          * DROP RETENTION POLICY <identifier>
          */
@@ -857,6 +1108,31 @@ namespace pgbckctl {
                    [ boost::bind(&CatalogDescr ::setProfileCompressType, &cmd,
                                  BACKUP_COMPRESS_TYPE_LZ4)]);
 
+        /*
+         * CREATE BACKUP PROFILE ... COMPRESSION=<type> LEVEL=<level>
+         */
+        profile_compression_level_option = no_case[lexeme[ lit("LEVEL") ]]
+          > eps > -lit("=")
+          > eps > +(char_("0-9"));
+
+        /*
+         * CREATE BACKUP PROFILE ... COMPRESSION=<type> [LEVEL=<level>] WORKERS=<threads>
+         */
+        profile_compression_workers_option = no_case[lexeme[ lit("WORKERS") ]]
+          > eps > -lit("=")
+          > eps > +(char_("0-9"));
+
+        /*
+         * CREATE BACKUP PROFILE ... COMPRESSION=<type> ... LOCATION={ CLIENT | SERVER }
+         */
+        profile_compression_location_option = no_case[lexeme[ lit("LOCATION") ]]
+          > eps > -lit("=")
+          > eps > (no_case[lexeme[ lit("CLIENT") ]]
+                   [ boost::bind(&CatalogDescr::setProfileServerCompression, &cmd, false) ]
+                   | no_case[lexeme[ lit("SERVER") ]]
+                   [ boost::bind(&CatalogDescr::setProfileServerCompression, &cmd, true) ]
+                   );
+
         /*
          * CREATE BACKUP PROFILE ...  MAX_RATE=<kbps>
          */
@@ -864,6 +1140,24 @@ namespace pgbckctl {
           > eps > -lit("=")
           > eps > +(char_("0-9"));
 
+        /*
+         * CREATE BACKUP PROFILE ... RATE_CONTROL={ SERVER | ADAPTIVE }
+         */
+        profile_rate_control_option = no_case[lexeme[ lit("RATE_CONTROL") ]]
+          > eps > -lit("=")
+          > eps > (no_case[lexeme[ lit("SERVER") ]]
+                   [ boost::bind(&CatalogDescr::setProfileAdaptiveRate, &cmd, false) ]
+                   | no_case[lexeme[ lit("ADAPTIVE") ]]
+                   [ boost::bind(&CatalogDescr::setProfileAdaptiveRate, &cmd, true) ]
+                   );
+
+        /*
+         * CREATE BACKUP PROFILE ... PARALLEL=<writers>
+         */
+        profile_parallel_option = no_case[lexeme[ lit("PARALLEL") ]]
+          > eps > -lit("=")
+          > eps > +(char_("0-9"));
+
         /*
          * CREATE BACKUP PROFILE ... LABEL="<label>"
          *
@@ -957,6 +1251,28 @@ namespace pgbckctl {
                     )
            );
 
+        /*
+         * CREATE BACKUP PROFILE ... INCREMENTAL { TRUE | FALSE }
+         */
+        profile_incremental_option = no_case[lexeme[ lit("INCREMENTAL") ]]
+          > eps > -lit("=")
+          > eps > (no_case[lexeme[ lit("TRUE") ]]
+                   [ boost::bind(&CatalogDescr::setProfileIncremental, &cmd, true) ]
+                   | no_case[lexeme[ lit("FALSE") ]]
+                   [ boost::bind(&CatalogDescr::setProfileIncremental, &cmd, false) ]
+                   );
+
+        /*
+         * CREATE BACKUP PROFILE ... DEDUPLICATE { TRUE | FALSE }
+         */
+        profile_deduplicate_option = no_case[lexeme[ lit("DEDUPLICATE") ]]
+          > eps > -lit("=")
+          > eps > (no_case[lexeme[ lit("TRUE") ]]
+                   [ boost::bind(&CatalogDescr::setProfileDeduplicate, &cmd, true) ]
+                   | no_case[lexeme[ lit("FALSE") ]]
+                   [ boost::bind(&CatalogDescr::setProfileDeduplicate, &cmd, false) ]
+                   );
+
         /*
          * We try to support both, quoted and unquoted identifiers. With quoted
          * identifiers, we disallow any embedded double quotes, too.
@@ -1014,28 +1330,40 @@ namespace pgbckctl {
         cmd_create_backup_profile.name("BACKUP PROFILE");
         cmd_create_connection.name("STREAMING CONNECTION");
         cmd_create_retention.name("RETENTION POLICY");
+        cmd_create_schedule.name("SCHEDULE FOR ARCHIVE");
+        schedule_verify.name("VERIFY");
         cmd_verify_archive.name("VERIFY ARCHIVE");
         cmd_drop_archive.name("ARCHIVE");
         cmd_drop_backup_profile.name("BACKUP_PROFILE");
         cmd_drop_connection.name("STREAMING CONNECTION");
         cmd_drop_retention.name("RETENTION POLICY");
+        cmd_drop_schedule.name("SCHEDULE FOR ARCHIVE");
+        cmd_drop_storage.name("STORAGE FOR ARCHIVE");
+        cmd_create_storage.name("STORAGE FOR ARCHIVE");
+        cmd_upload_archive.name("UPLOAD ARCHIVE");
         cmd_alter_archive.name("ALTER ARCHIVE");
         cmd_alter_archive_opt.name("ALTER ARCHIVE options");
+        alter_archive_log_layout.name("SET LOG LAYOUT { SHARDED | FLAT }");
+        alter_archive_cold_tier.name("SET COLD DIRECTORY");
         cmd_start_basebackup.name("BASEBACKUP");
         cmd_list_archive.name("ARCHIVE");
         cmd_list_backup.name("BACKUP CATALOG");
         cmd_list_backup_list.name("BASEBACKUPS");
         cmd_list_connection.name("CONNECTION");
         cmd_list_retention.name("RETENTION");
+        cmd_list_schedules.name("SCHEDULES");
+        cmd_list_uploads.name("UPLOADS");
         cmd_restore.name("RESTORE FROM ARCHIVE");
         cmd_stat.name("STAT");
-        cmd_restore_type.name("BASEBACKUP");
+        cmd_restore_type.name("BASEBACKUP | RECOVERY TARGET");
+        restore_recovery_target.name("RECOVERY TARGET");
         cmd_restore_action.name("TO");
         tablespace_map.name("TABLESPACE MAP");
         tablespace_map_oid.name("<OID>=<DIRECTORY>");
         label_string.name("<label string>");
         retention_keep_action.name("KEEP");
         retention_drop_action.name("DROP");
+        retention_move_action.name("MOVE");
         retention_rule_older_datetime.name("OLDER THAN");
         retention_rule_newer_datetime.name("NEWER THAN");
         retention_datetime_spec.name("[nnn YEARS] [nn MONTHS] [nnn DAYS] [nn HOURS] [nn MINUTES]");
@@ -1045,7 +1373,12 @@ namespace pgbckctl {
         executable.name("executable name");
         hostname.name("ip or hostname");
         profile_compression_option.name("COMPRESSION=GZIP|NONE");
+        profile_compression_level_option.name("LEVEL=compression level");
+        profile_compression_workers_option.name("WORKERS=number of compression threads");
+        profile_compression_location_option.name("LOCATION=CLIENT|SERVER");
+        profile_rate_control_option.name("RATE_CONTROL=SERVER|ADAPTIVE");
         profile_max_rate_option.name("MAX_RATE=maximum transfer rate in KB/s");
+        profile_parallel_option.name("PARALLEL=number of archive writers");
         profile_wal_option.name("WAL=INCLUDED|EXCLUDED");
         profile_backup_label_option.name("LABEL=label string");
         profile_checkpoint_option.name("CHECKPOINT=FAST|DELAYED");
@@ -1060,7 +1393,10 @@ namespace pgbckctl {
         backup_profile_opts.name("backup profile parameters");
         with_profile.name("backup profile name");
         verify_check_connection.name("CONNECTION");
+        verify_basebackup.name("BASEBACKUP <ID> [PARALLEL <n>]");
         profile_noverify_checksums_option.name("NOVERIFY");
+        profile_incremental_option.name("INCREMENTAL");
+        profile_deduplicate_option.name("DEDUPLICATE");
         profile_manifest_option.name("MANIFEST");
         profile_manifest_exclude_option.name("EXCLUDED");
         profile_manifest_include_option.name("INCLUDED");
@@ -1085,8 +1421,8 @@ namespace pgbckctl {
       qi::rule<Iterator, ascii::space_type> start;
       qi::rule<Iterator, ascii::space_type> cmd_create,
         cmd_drop, cmd_list, cmd_alter, cmd_restore, cmd_restore_action,
-        cmd_restore_type, tablespace_map, tablespace_map_oid,
-        cmd_stat;
+        cmd_restore_type, restore_recovery_target, tablespace_map,
+        tablespace_map_oid, cmd_stat;
       qi::rule<Iterator, ascii::space_type> cmd_create_archive,
                           cmd_verify_archive,
                           cmd_drop_archive,
@@ -1095,6 +1431,8 @@ namespace pgbckctl {
                           cmd_start_command,
                           cmd_stop_command,
                           cmd_alter_archive_opt,
+                          alter_archive_log_layout,
+                          alter_archive_cold_tier,
                           cmd_start_basebackup,
                           cmd_start_launcher,
                           cmd_start_streaming,
@@ -1111,9 +1449,17 @@ namespace pgbckctl {
                           cmd_drop_backup_profile,
                           cmd_drop_retention,
                           cmd_drop_basebackup,
+                          cmd_drop_schedule,
+                          cmd_drop_storage,
                           cmd_alter_backup_profile,
                           cmd_create_connection,
                           cmd_create_retention,
+                          cmd_create_schedule,
+                          cmd_list_schedules,
+                          cmd_create_storage,
+                          cmd_list_uploads,
+                          cmd_upload_archive,
+                          schedule_verify,
                           cmd_show,
                           cmd_set,
                           cmd_set_variable,
@@ -1121,14 +1467,20 @@ namespace pgbckctl {
                           cmd_apply,
                           cmd_apply_retention,
                           verify_check_connection,
+                          verify_basebackup,
                           show_command_type,
                           profile_noverify_checksums_option,
                           profile_manifest_option,
                           profile_manifest_include_option,
                           profile_manifest_exclude_option,
+                          profile_incremental_option,
+                          profile_deduplicate_option,
+                          profile_compression_location_option,
+                          profile_rate_control_option,
                           backup_profile_opts,
                           retention_keep_action,
                           retention_drop_action,
+                          retention_move_action,
                           retention_rule_older_datetime,
                           retention_rule_newer_datetime,
                           retention_datetime_spec,
@@ -1150,6 +1502,9 @@ namespace pgbckctl {
                           profile_checkpoint_option,
                           profile_max_rate_option,
                           profile_compression_option,
+                          profile_compression_level_option,
+                          profile_compression_workers_option,
+                          profile_parallel_option,
                           profile_backup_label_option,
                           with_profile,
                           executable,
@@ -1233,7 +1588,6 @@ void PGBackupCtlCommand::assignSigIntHandler(JobSignalHandler *handler) {
 
 CatalogTag PGBackupCtlCommand::execute(std::string catalogDir) {
 
-  shared_ptr<CatalogDescr> descr = nullptr;
   CatalogTag result = EMPTY_DESCR;
 
   /*
@@ -1245,6 +1599,43 @@ CatalogTag PGBackupCtlCommand::execute(std::string catalogDir) {
     throw CPGBackupCtlFailure("catalog descriptor is not executable");
   }
 
+  /*
+   * Now establish the catalog instance.
+   */
+  shared_ptr<BackupCatalog> catalog
+    = make_shared<BackupCatalog>(catalogDir);
+
+  try {
+
+    result = this->execute(catalog);
+
+    /*
+     * And we're done...
+     */
+    catalog->close();
+
+  } catch (exception &e) {
+    /*
+     * Don't suppress any exceptions from here, but
+     * make sure, we close the catalog safely.
+     */
+    if (catalog->available())
+      catalog->close();
+    throw CCatalogIssue(e.what());
+  }
+
+  return result;
+}
+
+CatalogTag PGBackupCtlCommand::execute(std::shared_ptr<BackupCatalog> catalog) {
+
+  shared_ptr<CatalogDescr> descr = nullptr;
+  BaseCatalogCommand *execCmd;
+
+  if (this->catalogDescr->tag == EMPTY_DESCR) {
+    throw CPGBackupCtlFailure("catalog descriptor is not executable");
+  }
+
   /*
    * First at all we need to create a catalog descriptor
    * which will then support initializing the backup catalog.
@@ -1255,17 +1646,14 @@ CatalogTag PGBackupCtlCommand::execute(std::string catalogDir) {
     throw CPGBackupCtlFailure("cannot execute uninitialized descriptor handle");
   }
 
-  result = descr->tag;
-
   /*
-   * Now establish the catalog instance.
+   * Commands close the catalog when they're done, unless it's kept
+   * open. Reopen it for the next command then.
    */
-  shared_ptr<BackupCatalog> catalog
-    = make_shared<BackupCatalog>(catalogDir);
+  if (!catalog->available())
+    catalog->open_rw();
 
-  try {
-
-    BaseCatalogCommand *execCmd;
+  {
 
     /*
      * Must cast to derived class.
@@ -1288,22 +1676,9 @@ CatalogTag PGBackupCtlCommand::execute(std::string catalogDir) {
     execCmd->setCatalog(catalog);
     execCmd->execute(false);
 
-    /*
-     * And we're done...
-     */
-    catalog->close();
-
-  } catch (exception &e) {
-    /*
-     * Don't suppress any exceptions from here, but
-     * make sure, we close the catalog safely.
-     */
-    if (catalog->available())
-      catalog->close();
-    throw CCatalogIssue(e.what());
   }
 
-  return result;
+  return descr->tag;
 }
 
 shared_ptr<CatalogDescr> PGBackupCtlCommand::getExecutableDescr() {
@@ -1473,6 +1848,50 @@ shared_ptr<CatalogDescr> PGBackupCtlCommand::getExecutableDescr() {
     result = make_shared<StatArchiveBaseBackupCommand>(this->catalogDescr);
     break;
 
+  case VERIFY_BASEBACKUP:
+    result = make_shared<VerifyBasebackupCatalogCommand>(this->catalogDescr);
+    break;
+
+  case CREATE_SCHEDULE:
+    result = make_shared<CreateScheduleCatalogCommand>(this->catalogDescr);
+    break;
+
+  case DROP_SCHEDULE:
+    result = make_shared<DropScheduleCatalogCommand>(this->catalogDescr);
+    break;
+
+  case LIST_SCHEDULES:
+    result = make_shared<ListSchedulesCatalogCommand>(this->catalogDescr);
+    break;
+
+  case CREATE_ARCHIVE_STORAGE:
+    result = make_shared<CreateArchiveStorageCatalogCommand>(this->catalogDescr);
+    break;
+
+  case DROP_ARCHIVE_STORAGE:
+    result = make_shared<DropArchiveStorageCatalogCommand>(this->catalogDescr);
+    break;
+
+  case LIST_UPLOADS:
+    result = make_shared<ListUploadsCatalogCommand>(this->catalogDescr);
+    break;
+
+  case UPLOAD_ARCHIVE:
+    result = make_shared<UploadArchiveCommand>(this->catalogDescr);
+    break;
+
+  case SHOW_STREAM_STATISTICS:
+    result = make_shared<ShowStreamStatisticsCommandHandle>(this->catalogDescr);
+    break;
+
+  case ALTER_ARCHIVE_LOG_LAYOUT:
+    result = make_shared<AlterArchiveLogLayoutCommand>(this->catalogDescr);
+    break;
+
+  case ALTER_ARCHIVE_COLD_TIER:
+    result = make_shared<AlterArchiveColdTierCommand>(this->catalogDescr);
+    break;
+
   default:
     /* no-op, but we return nullptr ! */
     break;
@@ -1531,23 +1950,113 @@ void PGBackupCtlParser::parseLine(std::string in) {
   typedef pgbckctl::boostparser::PGBackupCtlBoostParser<iterator_type> PGBackupCtlBoostParser;
 
   /*
-   * establish internal boost parser instance.
+   * Building the grammar costs far more than parsing a command
+   * with it, so the grammar is built once per thread and reset
+   * before each command.
    */
-  PGBackupCtlBoostParser myparser(this->runtime_config);
+  static thread_local std::unique_ptr<PGBackupCtlBoostParser> myparser;
+
+  if (myparser == nullptr)
+    myparser.reset(new PGBackupCtlBoostParser(this->runtime_config));
+  else
+    myparser->reset(this->runtime_config);
 
   std::string::iterator iter = in.begin();
 
-  bool parse_result = phrase_parse(iter, in.end(), myparser, space);
+  bool parse_result = phrase_parse(iter, in.end(), *myparser, space);
 
   if (parse_result && iter == in.end()) {
 
-    CatalogDescr cmd = myparser.getCommand();
+    CatalogDescr cmd = myparser->getCommand();
     this->command = make_shared<PGBackupCtlCommand>(cmd);
     this->command->assignRuntimeConfiguration(this->runtime_config);
 
   }
   else
-    throw CParserIssue("parsing command failed: " + myparser.parser_error.str());
+    throw CParserIssue("parsing command failed: " + myparser->parser_error.str());
+
+}
+
+std::vector<std::string> PGBackupCtlParser::splitCommands(std::istream &in) {
+
+  std::vector<std::string> result;
+  std::string current = "";
+  std::string line;
+  bool quoted = false;
+
+  auto finish = [&result, &current]() {
+
+    if (current.find_first_not_of(" \t\r") != std::string::npos)
+      result.push_back(current);
+
+    current = "";
+
+  };
+
+  while (std::getline(in, line)) {
+
+    size_t start = line.find_first_not_of(" \t\r");
+
+    /* Lines starting with -- are comments */
+    if (!quoted && start != std::string::npos && line.compare(start, 2, "--") == 0)
+      continue;
+
+    for (auto c : line) {
+
+      if (c == '"')
+        quoted = !quoted;
+
+      if (c == ';' && !quoted) {
+        finish();
+        continue;
+      }
+
+      current += c;
+
+    }
+
+    /*
+     * The parser doesn't handle carriage returns et al, so
+     * lines are joined by a blank.
+     */
+    current += " ";
+
+  }
+
+  finish();
+
+  return result;
+
+}
+
+void PGBackupCtlParser::parseStream(std::istream &in) {
+
+  std::vector<std::shared_ptr<PGBackupCtlCommand>> parsed;
+  unsigned int num = 0;
+
+  /*
+   * Parse all commands before returning any, so a syntax
+   * error anywhere doesn't leave half of a script executed.
+   */
+  for (auto &cmdStr : splitCommands(in)) {
+
+    num++;
+
+    try {
+      this->parseLine(cmdStr);
+    } catch(CParserIssue &pe) {
+      throw CParserIssue("command " + std::to_string(num) + ": " + pe.what());
+    }
+
+    parsed.push_back(this->command);
+
+  }
+
+  if (parsed.size() == 0) {
+    throw CParserIssue("no command found");
+  }
+
+  this->commands = parsed;
 
 }
 
@@ -1556,8 +2065,14 @@ void PGBackupCtlParser::parseFile() {
   std::ifstream fileHandle;
   std::stringstream fs;
   bool compressed = false;
-  std::string line;
-  std::ostringstream cmdStr;
+
+  /*
+   * "-" reads the commands from stdin.
+   */
+  if (this->sourceFile.string() == "-") {
+    this->parseStream(std::cin);
+    return;
+  }
 
   /*
    * Check state of the source file. Throws
@@ -1574,16 +2089,10 @@ void PGBackupCtlParser::parseFile() {
                  this->sourceFile,
                  &compressed);
 
-  /*
-   * Read input into a single command string:
-   * The parser doesn't handle carriage returns et al.
-   */
-  while (std::getline(fs, line)) {
-    if (cmdStr.tellp() > 0)
-      cmdStr << " ";
-    cmdStr << line;
-  }
+  this->parseStream(fs);
+
+}
 
-  cout << cmdStr.str() << endl;
-  this->parseLine(cmdStr.str());
+std::vector<std::shared_ptr<PGBackupCtlCommand>> PGBackupCtlParser::getCommands() {
+  return this->commands;
 }
@@ -1,8 +1,22 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
+#include <sstream>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/format.hpp>
 #include <boost/log/trivial.hpp>
 
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+}
+
 #include <pgproto-commands.hxx>
 #include <proto-catalog.hxx>
+#include <verifybackup.hxx>
 
 using namespace pgbckctl;
 using namespace pgbckctl::pgprotocol;
@@ -76,6 +90,12 @@ bool PGProtoStreamingCommand::needsArchive() {
 
 }
 
+void PGProtoStreamingCommand::setBufferPool(std::shared_ptr<MemoryBufferPool> pool) {
+
+  this->buffer_pool = pool;
+
+}
+
 int PGProtoStreamingCommand::step(ProtocolBuffer &buffer) {
 
   switch(current_step) {
@@ -98,9 +118,9 @@ int PGProtoStreamingCommand::step(ProtocolBuffer &buffer) {
 
       /*
        * Row descriptor already materialized, create
-       * the DataRow message now.
+       * the DataRow messages of the next chunk of rows now.
        */
-      if (resultSet->data(buffer) <= 0) {
+      if (resultSet->dataChunk(buffer, PGProtoResultSet::DATA_CHUNK_SIZE) <= 0) {
 
         /* no more data, we're done */
         current_step = -1;
@@ -235,9 +255,9 @@ void PGProtoListBasebackups::reset() {
 
 void PGProtoListBasebackups::prepareListOfBackups() {
 
-  /* Get list of basebackups */
-  std::vector<std::shared_ptr<BaseBackupDescr>> list
-    = catalog->getBackupList(archive_descr->archive_name);
+  std::shared_ptr<BaseBackupCursor> cursor = nullptr;
+  std::shared_ptr<BaseBackupDescr> it = nullptr;
+  BaseBackupListFilter filter;
 
   /* Check if a buffer aggregation step() was called before.
    * If true, die hard */
@@ -279,12 +299,26 @@ void PGProtoListBasebackups::prepareListOfBackups() {
                        -1,
                        0);
 
+  resultSet->addColumn("parent_id",
+                       0,
+                       0,
+                       PGProtoColumnDescr::PG_TYPEOID_TEXT,
+                       -1,
+                       0);
+
   /*
    * Loop through the list. We only consider valid basebackups here, since
    * the command is supposed to inform the caller which basebackups are valid
    * to be used for recovery.
+   *
+   * Basebackups are fetched one by one from the catalog and
+   * go directly into the result set, newest first.
    */
-  for(auto &it : list) {
+  filter.archive_id = archive_descr->id;
+  filter.order = BASEBACKUP_LIST_STARTED_DESC;
+  cursor = catalog->openBackupCursor(filter);
+
+  while (cursor->next(it)) {
 
     std::ostringstream converter;
     std::vector<PGProtoColumnDataDescr> data;
@@ -325,6 +359,18 @@ void PGProtoListBasebackups::prepareListOfBackups() {
      */
     data.push_back(colvalue);
 
+    /*
+     * Full basebackups don't have a parent, report
+     * an empty string for them.
+     */
+    colvalue.data   = (it->parent_id < 0) ? "" : std::to_string(it->parent_id);
+    colvalue.length = colvalue.data.length();
+
+    /*
+     * Add column data to list.
+     */
+    data.push_back(colvalue);
+
     /*
      * Save the column data list within the result set.
      */
@@ -361,28 +407,1605 @@ void PGProtoListBasebackups::execute(std::shared_ptr<ExecutableContext> context)
 
   try {
 
-    /* Prepare catalog lookups */
-    openCatalog();
+    /*
+     * Catalog lookups use the catalog handle of our catalog handler,
+     * which is shared with concurrent connections of the streaming
+     * server.
+     */
+    std::shared_ptr<PGProtoArchiveCache> archive_cache = catalogHandler->getArchiveCache();
 
     /* Lookup archive data */
-    archive_descr = catalog->existsById(archive_id);
+    archive_descr = archive_cache->getArchive(archive_id);
 
     BOOST_LOG_TRIVIAL(debug) << "recovery instance attached to archive "
                              << archive_descr->archive_name;
 
     /* Now do the legwork... */
+    archive_cache->use([this](std::shared_ptr<BackupCatalog> shared_catalog) {
+
+        catalog = shared_catalog;
+        prepareListOfBackups();
 
-    prepareListOfBackups();
+      });
 
-    catalog->close();
+    catalog = nullptr;
 
   } catch (CPGBackupCtlFailure &e) {
 
-    if (catalog->opened())
-      catalog->close();
+    catalog = nullptr;
 
     /* re-throw as protocol command failure */
     throw PGProtoCmdFailure(e.what());
   }
 
 }
+
+/* ****************************************************************************
+ * PGProtoCopyStreamingCommand base class
+ * ***************************************************************************/
+
+const int PGProtoCopyStreamingCommand::STEP_WAIT;
+const int PGProtoCopyStreamingCommand::STEP_COMMAND_COMPLETE;
+
+PGProtoCopyStreamingCommand::PGProtoCopyStreamingCommand(std::shared_ptr<PGProtoCmdDescr> descr,
+                                                         std::shared_ptr<PGProtoCatalogHandler> catalogHandler,
+                                                         std::shared_ptr<RuntimeConfiguration> rtc,
+                                                         std::shared_ptr<WorkerSHM> worker_shm)
+  : PGProtoStreamingCommand(descr, catalogHandler, rtc, worker_shm) {
+
+  executable_context_name = EXECUTABLE_CONTEXT_COPY;
+
+}
+
+PGProtoCopyStreamingCommand::~PGProtoCopyStreamingCommand() {}
+
+void PGProtoCopyStreamingCommand::commandComplete(ProtocolBuffer &buffer, std::string tag) {
+
+  buffer.allocate(MESSAGE_HDR_SIZE + tag.length() + 1);
+  buffer.write_byte(CommandCompleteMessage);
+  buffer.write_int(MESSAGE_HDR_LENGTH_SIZE + tag.length() + 1);
+  buffer.write_buffer(tag.c_str(), tag.length() + 1);
+
+}
+
+bool PGProtoCopyStreamingCommand::pendingFileRegion(int &fd, off_t &offset, size_t &len) {
+
+  if (!region_pending)
+    return false;
+
+  fd = region_fd;
+  offset = region_offset;
+  len = region_len;
+
+  region_pending = false;
+  return true;
+
+}
+
+void PGProtoCopyStreamingCommand::feedback(ProtocolBuffer &payload) {}
+
+void PGProtoCopyStreamingCommand::clientDone() {}
+
+/* ****************************************************************************
+ * PGProtoStartReplication command ... START_REPLICATION
+ * ***************************************************************************/
+
+/*
+ * Seconds between the Unix epoch and the PostgreSQL
+ * epoch (2000-01-01).
+ */
+#define POSTGRES_EPOCH_OFFSET 946684800LL
+
+/*
+ * Length of the XLogData header within a CopyData
+ * message: type byte, start, end and send time.
+ */
+#define XLOG_DATA_HEADER_SIZE 25
+
+static void write_int64(ProtocolBuffer &buffer, uint64_t value) {
+
+  buffer.write_int((int) (value >> 32));
+  buffer.write_int((int) (value & 0xFFFFFFFF));
+
+}
+
+static uint64_t read_int64(ProtocolBuffer &buffer) {
+
+  unsigned int hi = 0;
+  unsigned int lo = 0;
+
+  buffer.read_int(hi);
+  buffer.read_int(lo);
+
+  return ((uint64_t) hi << 32) | lo;
+
+}
+
+/*
+ * Current time in microseconds since the PostgreSQL epoch,
+ * as used by the replication protocol.
+ */
+static int64_t pg_timestamp_now() {
+
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return ((int64_t) tv.tv_sec - POSTGRES_EPOCH_OFFSET) * 1000000LL + tv.tv_usec;
+
+}
+
+const int PGProtoStartReplication::STEP_COPY_BOTH_RESPONSE;
+const int PGProtoStartReplication::STEP_XLOG_DATA;
+const int PGProtoStartReplication::STEP_KEEPALIVE;
+const int PGProtoStartReplication::STEP_COPY_DONE;
+const size_t PGProtoStartReplication::MAX_SEND_SIZE;
+const unsigned int PGProtoStartReplication::KEEPALIVE_INTERVAL;
+
+PGProtoStartReplication::PGProtoStartReplication(std::shared_ptr<PGProtoCmdDescr> descr,
+                                                 std::shared_ptr<PGProtoCatalogHandler> catalogHandler,
+                                                 std::shared_ptr<RuntimeConfiguration> rtc,
+                                                 std::shared_ptr<WorkerSHM> worker_shm)
+  : PGProtoCopyStreamingCommand(descr, catalogHandler, rtc, worker_shm) {
+
+  command_tag = "START_REPLICATION";
+  needs_archive_access = true;
+  current_step = 0;
+
+}
+
+PGProtoStartReplication::~PGProtoStartReplication() {
+
+  closeSegment();
+
+}
+
+void PGProtoStartReplication::execute(std::shared_ptr<ExecutableContext> context) {
+
+  std::shared_ptr<CatalogDescr> archive_descr = nullptr;
+  PGProtoCopyContext copy_context;
+
+  basebackup = catalogHandler->getAttachedBasebackup();
+
+  if (basebackup == nullptr) {
+    throw PGProtoCmdFailure("START_REPLICATION requires a connection to a basebackup");
+  }
+
+  archive_descr = catalogHandler->getArchiveCache()->getArchive(basebackup->archive_id);
+
+  if (archive_descr->id < 0) {
+    throw PGProtoCmdFailure("could not get a valid catalog descriptor for attached basebackup");
+  }
+
+  archiveDir = make_shared<BackupDirectory>(path(archive_descr->directory))->logdirectory();
+  wal_cache = catalogHandler->getWALCache();
+
+  wal_segment_size = basebackup->wal_segment_size;
+
+  if (wal_segment_size == 0)
+    wal_segment_size = 16 * 1024 * 1024;
+
+  /*
+   * Without an explicit timeline, stream the timeline
+   * reported by IDENTIFY_SYSTEM.
+   */
+  timeline = (command_handle->tli > 0) ? command_handle->tli : basebackup->timeline;
+  sendpos = available = command_handle->startpos;
+
+  if (command_handle->slot_name.length() > 0) {
+    BOOST_LOG_TRIVIAL(debug) << "START_REPLICATION: ignoring replication slot \""
+                             << command_handle->slot_name << "\"";
+  }
+
+  checkTimelineSwitch();
+
+  if (next_tli > 0 && sendpos > switchpoint) {
+
+    std::ostringstream oss;
+
+    oss << "requested starting point "
+        << (boost::format("%X/%X") % (uint32_t) (sendpos >> 32) % (uint32_t) sendpos)
+        << " on timeline " << timeline
+        << " is not in this server's history";
+    throw PGProtoCmdFailure(oss.str());
+
+  }
+
+  BOOST_LOG_TRIVIAL(debug) << "START_REPLICATION: streaming timeline " << timeline
+                           << " from archive " << archive_descr->archive_name;
+
+  /*
+   * Replication uses a CopyBothResponse without any columns.
+   */
+  copy_buffer = std::make_shared<ProtocolBuffer>(buffer_pool);
+  copy_data_buffer = std::make_shared<ProtocolBuffer>(buffer_pool);
+
+  copy_context.formats = std::make_shared<PGProtoCopyFormat>(0, false);
+  copy_context.output_buffer = copy_buffer;
+  copy_context.output_data_buffer = copy_data_buffer;
+  copy_context.state = std::make_shared<PGProtoCopyBothResponseState>();
+
+  copy = std::make_shared<PGProtoCopy>(copy_context);
+
+}
+
+path PGProtoStartReplication::findSegmentFile(bool &partial, bool &compressed) {
+
+  const std::vector<std::string> suffixes = { "", ".gz", ".zst", ".lz4" };
+  std::string segment = ArchiveLogDirectory::XLogFileByRecPtr(segno * wal_segment_size,
+                                                              timeline,
+                                                              wal_segment_size);
+  path file;
+
+  for (auto &suffix : suffixes) {
+
+    file = archiveDir->locateXLogFile(segment + suffix);
+
+    if (exists(file)) {
+      partial = false;
+      compressed = (suffix.length() > 0);
+      return file;
+    }
+
+  }
+
+  /*
+   * Compressed partial segments can't be read before
+   * they are completed, so don't bother.
+   */
+  file = archiveDir->locateXLogFile(segment + ".partial");
+
+  if (exists(file)) {
+    partial = true;
+    compressed = false;
+    return file;
+  }
+
+  return path();
+
+}
+
+bool PGProtoStartReplication::openSegment() {
+
+  bool compressed = false;
+  path file;
+
+  segno = sendpos / wal_segment_size;
+  file = findSegmentFile(segment_partial, compressed);
+
+  if (file.empty())
+    return false;
+
+  if (compressed) {
+
+    segment_reader = FramedArchiveFile::forReading(file);
+    segment_reader->open();
+    reader_pos = segno * wal_segment_size;
+
+  } else {
+
+    segment_fd = ::open(file.string().c_str(), O_RDONLY);
+
+    if (segment_fd < 0) {
+      throw CArchiveIssue("could not open segment file "
+                          + file.string() + ": " + strerror(errno));
+    }
+
+  }
+
+  segment_open = true;
+
+  BOOST_LOG_TRIVIAL(debug) << "START_REPLICATION: opened segment file " << file.string();
+
+  return true;
+
+}
+
+void PGProtoStartReplication::closeSegment() {
+
+  if (segment_fd >= 0) {
+    ::close(segment_fd);
+    segment_fd = -1;
+  }
+
+  if (segment_reader != nullptr) {
+    segment_reader->close();
+    segment_reader = nullptr;
+  }
+
+  segment_open = false;
+  segment_partial = false;
+  cached_page = -1;
+
+}
+
+void PGProtoStartReplication::loadPage(long long pageno) {
+
+  XLogRecPtr start = segno * wal_segment_size + pageno * WALSegmentCache::PAGE_SIZE;
+  size_t done = 0;
+
+  page_buffer.resize(WALSegmentCache::PAGE_SIZE);
+
+  if (wal_cache->read(basebackup->archive_id, timeline, segno, pageno, page_buffer.data())) {
+    cached_page = pageno;
+    return;
+  }
+
+  /*
+   * Not cached, decompress the page and share it. Completed
+   * segments always consist of whole pages.
+   */
+  cached_page = -1;
+
+  if (reader_pos != start) {
+    segment_reader->seekLSN(start, wal_segment_size);
+    reader_pos = start;
+  }
+
+  while (done < WALSegmentCache::PAGE_SIZE) {
+
+    size_t rc = segment_reader->read(page_buffer.data() + done,
+                                     WALSegmentCache::PAGE_SIZE - done);
+
+    if (rc == 0) {
+      throw CArchiveIssue("unexpected end of segment file at "
+                          + PGStream::encodeXLOGPos(start + done));
+    }
+
+    done += rc;
+
+  }
+
+  reader_pos += done;
+
+  wal_cache->insert(basebackup->archive_id, timeline, segno, pageno, page_buffer.data());
+  cached_page = pageno;
+
+}
+
+void PGProtoStartReplication::readCompressed(char *dest, size_t len) {
+
+  size_t done = 0;
+
+  while (done < len) {
+
+    XLogRecPtr pos = sendpos + done;
+    size_t rc;
+
+    if (wal_cache == nullptr) {
+
+      if (reader_pos != pos) {
+        segment_reader->seekLSN(pos, wal_segment_size);
+        reader_pos = pos;
+      }
+
+      rc = segment_reader->read(dest + done, len - done);
+
+      if (rc == 0) {
+        throw CArchiveIssue("unexpected end of segment file at "
+                            + PGStream::encodeXLOGPos(pos));
+      }
+
+      reader_pos += rc;
+
+    } else {
+
+      unsigned long long offset = pos % wal_segment_size;
+      size_t page_offset = offset % WALSegmentCache::PAGE_SIZE;
+
+      if (cached_page != (long long) (offset / WALSegmentCache::PAGE_SIZE))
+        loadPage(offset / WALSegmentCache::PAGE_SIZE);
+
+      rc = std::min(len - done, WALSegmentCache::PAGE_SIZE - page_offset);
+      memcpy(dest + done, page_buffer.data() + page_offset, rc);
+
+    }
+
+    done += rc;
+
+  }
+
+}
+
+XLogRecPtr PGProtoStartReplication::liveFlushPosition() {
+
+  XLogRecPtr result = InvalidXLogRecPtr;
+
+  if (worker_shm == nullptr)
+    return result;
+
+  /*
+   * Worker slots are read without locking, see
+   * WorkerSHM::readStreamStats().
+   */
+  for (unsigned int i = 0; i < worker_shm->getMaxWorkers(); i++) {
+
+    shm_stream_stats stats;
+
+    if (worker_shm->isEmpty(i))
+      continue;
+
+    stats = worker_shm->readStreamStats(i);
+
+    if (stats.pid == 0
+        || stats.archive_id != basebackup->archive_id
+        || stats.timeline != timeline)
+      continue;
+
+    if (stats.flush_position > result)
+      result = stats.flush_position;
+
+  }
+
+  return result;
+
+}
+
+XLogRecPtr PGProtoStartReplication::availableEnd() {
+
+  XLogRecPtr segment_start;
+  XLogRecPtr segment_end;
+  XLogRecPtr end;
+
+  /* Segment done, move on to the next one */
+  if (segment_open && segno != sendpos / wal_segment_size)
+    closeSegment();
+
+  if (!segment_open && !openSegment())
+    return sendpos;
+
+  segment_start = segno * wal_segment_size;
+  segment_end = segment_start + wal_segment_size;
+  end = segment_end;
+
+  if (segment_partial) {
+
+    /*
+     * The contents of a partial segment are valid up to the position
+     * flushed by its streamer, or up to the switch point if the
+     * timeline was left.
+     */
+    end = (next_tli > 0) ? switchpoint : liveFlushPosition();
+
+    if (end <= sendpos) {
+
+      bool partial = true;
+      bool compressed = false;
+
+      /* Maybe the streamer has completed the segment meanwhile */
+      if (!findSegmentFile(partial, compressed).empty() && !partial) {
+
+        closeSegment();
+
+        if (openSegment())
+          end = segment_end;
+
+      }
+
+    }
+
+  }
+
+  if (next_tli > 0 && switchpoint < end)
+    end = switchpoint;
+
+  if (end > segment_end)
+    end = segment_end;
+
+  if (end < sendpos)
+    end = sendpos;
+
+  return end;
+
+}
+
+bool PGProtoStartReplication::readTimelineHistory(unsigned int tli, std::string &content) {
+
+  const std::vector<std::string> suffixes = { "", ".gz", ".zst", ".lz4" };
+  std::string filename = ArchiveLogDirectory::timelineHistoryFilename(tli, false);
+
+  for (auto &suffix : suffixes) {
+
+    path file = archiveDir->locateXLogFile(filename + suffix);
+    std::shared_ptr<FramedArchiveFile> history = nullptr;
+    char buf[4096];
+    size_t len;
+
+    if (!exists(file))
+      continue;
+
+    history = FramedArchiveFile::forReading(file);
+    history->open();
+
+    content = "";
+
+    while ((len = history->read(buf, sizeof(buf))) > 0)
+      content.append(buf, len);
+
+    history->close();
+    return true;
+
+  }
+
+  return false;
+
+}
+
+void PGProtoStartReplication::checkTimelineSwitch() {
+
+  std::time_t now = std::time(NULL);
+  std::string content = "";
+  std::string line;
+  unsigned int newest = timeline;
+  bool found = false;
+
+  /* Once a second is enough */
+  if (next_tli > 0 || history_checked == now)
+    return;
+
+  history_checked = now;
+
+  /*
+   * Timelines are allocated one after another, so probe for
+   * history files until the first one missing, like PostgreSQL's
+   * findNewestTimeLine() does. The history of the newest timeline
+   * lists all its ancestors.
+   */
+  for (unsigned int tli = timeline + 1; ; tli++) {
+
+    std::string history;
+
+    if (!readTimelineHistory(tli, history))
+      break;
+
+    newest = tli;
+    content = history;
+
+  }
+
+  if (newest == timeline)
+    return;
+
+  std::istringstream lines(content);
+
+  while (std::getline(lines, line)) {
+
+    std::istringstream fields(line);
+    unsigned int parent_tli;
+    std::string pos;
+
+    if (!(fields >> parent_tli >> pos))
+      continue;
+
+    /* The entry after ours tells the timeline switched to */
+    if (found) {
+      next_tli = parent_tli;
+      break;
+    }
+
+    if (parent_tli == timeline) {
+      switchpoint = PGStream::decodeXLOGPos(pos);
+      next_tli = newest;
+      found = true;
+    }
+
+  }
+
+  if (next_tli > 0) {
+    BOOST_LOG_TRIVIAL(debug) << "START_REPLICATION: timeline " << timeline
+                             << " switched to timeline " << next_tli
+                             << " at " << PGStream::encodeXLOGPos(switchpoint);
+  }
+
+}
+
+void PGProtoStartReplication::xlogDataHeader(ProtocolBuffer &buffer) {
+
+  buffer.write_byte('w');
+  write_int64(buffer, sendpos);
+  write_int64(buffer, available);
+  write_int64(buffer, pg_timestamp_now());
+
+}
+
+void PGProtoStartReplication::keepalive(ProtocolBuffer &buffer) {
+
+  copy_data_buffer->allocate(18);
+  copy_data_buffer->write_byte('k');
+  write_int64(*copy_data_buffer, available);
+  write_int64(*copy_data_buffer, pg_timestamp_now());
+  copy_data_buffer->write_byte((char) 0);
+
+  copy->write();
+  buffer.assign(copy_buffer->ptr(), copy_buffer->getSize());
+
+}
+
+void PGProtoStartReplication::prepareNextTimeline() {
+
+  std::vector<PGProtoColumnDataDescr> data;
+  PGProtoColumnDataDescr colvalue;
+
+  resultSet = std::make_shared<PGProtoResultSet>();
+
+  resultSet->addColumn("next_tli",
+                       0,
+                       0,
+                       PGProtoColumnDescr::PG_TYPEOID_INT8,
+                       8,
+                       0);
+
+  resultSet->addColumn("next_tli_startpos",
+                       0,
+                       0,
+                       PGProtoColumnDescr::PG_TYPEOID_TEXT,
+                       -1,
+                       0);
+
+  colvalue.data   = std::to_string(next_tli);
+  colvalue.length = colvalue.data.length();
+  data.push_back(colvalue);
+
+  colvalue.data   = (boost::format("%X/%X")
+                     % (uint32_t) (switchpoint >> 32)
+                     % (uint32_t) switchpoint).str();
+  colvalue.length = colvalue.data.length();
+  data.push_back(colvalue);
+
+  resultSet->addRow(data);
+
+}
+
+int PGProtoStartReplication::step(ProtocolBuffer &buffer) {
+
+  std::time_t now = std::time(NULL);
+  size_t len;
+
+  region_pending = false;
+
+  /*
+   * Streaming is over, continue with the result set
+   * telling the next timeline, if any. Like PostgreSQL, end
+   * the streaming with a CommandComplete of its own, libpq
+   * based clients expect it in front of the one ending
+   * the command.
+   */
+  if (streaming_done) {
+
+    if (resultSet != nullptr && PGProtoStreamingCommand::step(buffer) != -1)
+      return current_step;
+
+    if (streaming_complete)
+      return -1;
+
+    commandComplete(buffer, "START_STREAMING");
+    streaming_complete = true;
+
+    return (current_step = STEP_COMMAND_COMPLETE);
+
+  }
+
+  if (current_step == 0) {
+
+    copy->write();
+    buffer.assign(copy_buffer->ptr(), copy_buffer->getSize());
+
+    last_send = now;
+    return (current_step = STEP_COPY_BOTH_RESPONSE);
+
+  }
+
+  if (copy_done) {
+
+    /* Wait until the client ends the COPY, too */
+    if (!client_done)
+      return (current_step = STEP_WAIT);
+
+    closeSegment();
+    streaming_done = true;
+    current_step = 0;
+
+    if (next_tli > 0 && sendpos >= switchpoint)
+      prepareNextTimeline();
+
+    return step(buffer);
+
+  }
+
+  if (client_done || (next_tli > 0 && sendpos >= switchpoint)) {
+
+    /* An empty CopyData buffer makes the COPY state emit CopyDone */
+    copy_data_buffer->allocate(0);
+    copy->write();
+    buffer.assign(copy_buffer->ptr(), copy_buffer->getSize());
+
+    copy_done = true;
+    return (current_step = STEP_COPY_DONE);
+
+  }
+
+  if (reply_requested || now - last_send >= (std::time_t) KEEPALIVE_INTERVAL) {
+
+    keepalive(buffer);
+
+    reply_requested = false;
+    last_send = now;
+    return (current_step = STEP_KEEPALIVE);
+
+  }
+
+  if (sendpos >= available) {
+
+    available = availableEnd();
+
+    if (sendpos >= available) {
+
+      checkTimelineSwitch();
+
+      if (next_tli > 0 && sendpos >= switchpoint)
+        return step(buffer);
+
+      return (current_step = STEP_WAIT);
+
+    }
+
+  }
+
+  len = std::min((size_t) (available - sendpos), MAX_SEND_SIZE);
+
+  if (segment_fd >= 0) {
+
+    /*
+     * The segment data is sent directly from the file by
+     * the caller, so frame the CopyData message by hand and
+     * leave the data out.
+     */
+    buffer.allocate(MESSAGE_HDR_SIZE + XLOG_DATA_HEADER_SIZE);
+    buffer.write_byte(CopyDataMessage);
+    buffer.write_int(MESSAGE_HDR_LENGTH_SIZE + XLOG_DATA_HEADER_SIZE + len);
+    xlogDataHeader(buffer);
+
+    region_pending = true;
+    region_fd = segment_fd;
+    region_offset = sendpos % wal_segment_size;
+    region_len = len;
+
+  } else {
+
+    copy_data_buffer->allocate(XLOG_DATA_HEADER_SIZE + len);
+    xlogDataHeader(*copy_data_buffer);
+
+    readCompressed(copy_data_buffer->ptr() + XLOG_DATA_HEADER_SIZE, len);
+
+    copy->write();
+    buffer.assign(copy_buffer->ptr(), copy_buffer->getSize());
+
+  }
+
+  sendpos += len;
+  last_send = now;
+
+  return (current_step = STEP_XLOG_DATA);
+
+}
+
+void PGProtoStartReplication::feedback(ProtocolBuffer &payload) {
+
+  char kind = '\0';
+
+  payload.read_byte(kind);
+
+  switch (kind) {
+
+  case 'r':
+    {
+      /* Standby status update */
+      unsigned char reply = 0;
+
+      read_int64(payload); /* write position */
+      client_flush = read_int64(payload);
+      read_int64(payload); /* apply position */
+      read_int64(payload); /* client time */
+      payload.read_byte(reply);
+
+      reply_requested = (reply != 0);
+
+      BOOST_LOG_TRIVIAL(debug) << "START_REPLICATION: client flushed up to "
+                               << PGStream::encodeXLOGPos(client_flush);
+      break;
+    }
+
+  case 'h':
+    /* Hot standby feedback, nothing to do for us */
+    break;
+
+  default:
+    {
+      std::ostringstream oss;
+
+      oss << "unexpected standby message type \"" << kind << "\"";
+      throw PGProtoCmdFailure(oss.str());
+    }
+
+  }
+
+}
+
+void PGProtoStartReplication::clientDone() {
+
+  client_done = true;
+
+}
+
+void PGProtoStartReplication::reset() {
+
+  closeSegment();
+
+  current_step    = 0;
+  resultSet       = nullptr;
+  copy            = nullptr;
+  client_done     = false;
+  copy_done       = false;
+  streaming_done  = false;
+  streaming_complete = false;
+  reply_requested = false;
+  region_pending  = false;
+  next_tli        = 0;
+
+}
+
+
+/* ****************************************************************************
+ * PGProtoBaseBackup command ... BASE_BACKUP
+ * ***************************************************************************/
+
+/*
+ * Size of the blocks terminating a tar archive.
+ */
+#define TAR_TRAILER_SIZE 1024
+
+/*
+ * Interprets the value of a boolean BASE_BACKUP option, an
+ * option without a value is true.
+ */
+static bool option_true(std::string const& value) {
+
+  if (value.length() == 0
+      || boost::iequals(value, "true")
+      || boost::iequals(value, "on")
+      || boost::iequals(value, "yes")
+      || value == "1")
+    return true;
+
+  if (boost::iequals(value, "false")
+      || boost::iequals(value, "off")
+      || boost::iequals(value, "no")
+      || value == "0")
+    return false;
+
+  throw PGProtoCmdFailure("invalid boolean value \"" + value + "\"");
+
+}
+
+const int PGProtoBaseBackup::STEP_COPY_OUT_RESPONSE;
+const int PGProtoBaseBackup::STEP_COPY_DATA;
+const int PGProtoBaseBackup::STEP_COPY_DONE;
+const int PGProtoBaseBackup::STEP_ARCHIVE_START;
+const size_t PGProtoBaseBackup::MAX_SEND_SIZE;
+
+PGProtoBaseBackup::PGProtoBaseBackup(std::shared_ptr<PGProtoCmdDescr> descr,
+                                     std::shared_ptr<PGProtoCatalogHandler> catalogHandler,
+                                     std::shared_ptr<RuntimeConfiguration> rtc,
+                                     std::shared_ptr<WorkerSHM> worker_shm)
+  : PGProtoCopyStreamingCommand(descr, catalogHandler, rtc, worker_shm) {
+
+  command_tag = "BASE_BACKUP";
+  needs_archive_access = true;
+  current_step = 0;
+
+}
+
+PGProtoBaseBackup::~PGProtoBaseBackup() {
+
+  closeArchive();
+
+}
+
+path PGProtoBaseBackup::findArchive(std::string name) {
+
+  const std::vector<std::string> suffixes = { "", ".gz", ".zst", ".lz4", ".xz", DedupArchiveFile::SUFFIX };
+
+  for (auto &suffix : suffixes) {
+
+    path file = path(basebackup->fsentry) / (name + suffix);
+
+    if (exists(file))
+      return file;
+
+  }
+
+  return path();
+
+}
+
+void PGProtoBaseBackup::checkOptions() {
+
+  /*
+   * Options controlling how a backup is taken don't apply
+   * to replaying an archived one, they are accepted but ignored.
+   */
+  const std::vector<std::string> legacy_options = {
+    "label", "progress", "fast", "wal", "nowait", "max_rate",
+    "tablespace_map", "noverify_checksums", "manifest", "manifest_checksums"
+  };
+  const std::vector<std::string> stream_options = {
+    "label", "progress", "checkpoint", "wal", "wait", "max_rate",
+    "tablespace_map", "verify_checksums", "manifest", "manifest_checksums",
+    "target", "target_detail", "compression", "compression_detail", "incremental"
+  };
+  const std::vector<std::string> &known = (archive_stream) ? stream_options : legacy_options;
+  std::map<std::string, std::string> &options = command_handle->options;
+
+  for (auto &option : options) {
+
+    if (std::find(known.begin(), known.end(), option.first) == known.end()) {
+      throw PGProtoCmdFailure("unrecognized BASE_BACKUP option \"" + option.first + "\"");
+    }
+
+  }
+
+  /*
+   * Our archives don't carry WAL, it's served by
+   * START_REPLICATION instead.
+   */
+  if (options.count("wal") > 0 && option_true(options["wal"])) {
+    throw PGProtoCmdFailure("BASE_BACKUP option WAL is not supported, use START_REPLICATION to get WAL");
+  }
+
+  if (options.count("target") > 0 && !boost::iequals(options["target"], "client")) {
+    throw PGProtoCmdFailure("BASE_BACKUP target \"" + options["target"] + "\" is not supported");
+  }
+
+  if (options.count("compression") > 0 && !boost::iequals(options["compression"], "none")) {
+    throw PGProtoCmdFailure("BASE_BACKUP doesn't support server side compression");
+  }
+
+  if (options.count("incremental") > 0 && option_true(options["incremental"])) {
+    throw PGProtoCmdFailure("BASE_BACKUP doesn't support incremental backups");
+  }
+
+}
+
+void PGProtoBaseBackup::execute(std::shared_ptr<ExecutableContext> context) {
+
+  std::vector<std::shared_ptr<BackupTablespaceDescr>> tablespaces;
+  std::shared_ptr<BackupTablespaceDescr> base = nullptr;
+  std::map<std::string, std::string> &options = command_handle->options;
+
+  basebackup = catalogHandler->getAttachedBasebackup();
+
+  if (basebackup == nullptr) {
+    throw PGProtoCmdFailure("BASE_BACKUP requires a connection to a basebackup");
+  }
+
+  if (basebackup->parent_id >= 0) {
+    throw PGProtoCmdFailure("BASE_BACKUP cannot replay an incremental basebackup");
+  }
+
+  archive_stream = command_handle->archive_stream;
+  checkOptions();
+
+  BOOST_LOG_TRIVIAL(debug) << "BASE_BACKUP: replaying basebackup " << basebackup->fsentry
+                           << ", label \"" << options["label"] << "\"";
+
+  /*
+   * Like PostgreSQL, list the base tablespace last. Basebackups
+   * recorded without any tablespace consist of the base
+   * archive only.
+   */
+  for (auto &tablespace : basebackup->tablespaces) {
+
+    if (tablespace->spclocation.length() == 0)
+      base = tablespace;
+    else
+      tablespaces.push_back(tablespace);
+
+  }
+
+  if (base == nullptr) {
+    base = std::make_shared<BackupTablespaceDescr>();
+    base->spcoid = 0;
+    base->spcsize = 0;
+  }
+
+  tablespaces.push_back(base);
+
+  for (auto &tablespace : tablespaces) {
+
+    std::vector<PGProtoColumnDataDescr> row;
+    PGProtoColumnDataDescr colvalue;
+    std::string name = CPGBackupCtlBase::intToStr(tablespace->spcoid) + ".tar";
+    path file;
+
+    if (tablespace == base) {
+
+      file = findArchive("base.tar");
+
+      if (file.empty())
+        file = findArchive(name);
+
+      name = "base.tar";
+
+      /* spcoid and spclocation of the base tablespace are NULL */
+      colvalue.length = -1;
+      row.push_back(colvalue);
+      row.push_back(colvalue);
+
+    } else {
+
+      file = findArchive(name);
+
+      colvalue.data   = CPGBackupCtlBase::intToStr(tablespace->spcoid);
+      colvalue.length = colvalue.data.length();
+      row.push_back(colvalue);
+
+      colvalue.data   = tablespace->spclocation;
+      colvalue.length = colvalue.data.length();
+      row.push_back(colvalue);
+
+    }
+
+    if (file.empty()) {
+
+      std::ostringstream oss;
+
+      oss << "could not find archive of tablespace " << tablespace->spcoid
+          << " in basebackup " << basebackup->fsentry;
+      throw PGProtoCmdFailure(oss.str());
+
+    }
+
+    colvalue.data   = std::to_string(tablespace->spcsize);
+    colvalue.length = colvalue.data.length();
+    row.push_back(colvalue);
+
+    archives.push_back(file);
+    archive_names.push_back(std::make_pair(name, tablespace->spclocation));
+    tablespace_rows.push_back(row);
+
+  }
+
+  /*
+   * MANIFEST 'no' is the same as not asking for a manifest at all.
+   */
+  if (options.count("manifest") > 0 && !boost::iequals(options["manifest"], "no")) {
+
+    path file = path(basebackup->fsentry) / "backup_manifest";
+
+    if (!exists(file))
+      file = path(basebackup->fsentry) / "backup.manifest";
+
+    if (!exists(file)) {
+      throw PGProtoCmdFailure("basebackup " + basebackup->fsentry
+                              + " doesn't have a backup manifest, request none instead");
+    }
+
+    archives.push_back(file);
+
+  }
+
+}
+
+void PGProtoBaseBackup::openArchive() {
+
+  path file = archives[current_archive];
+  std::shared_ptr<BackupFile> handle = nullptr;
+
+  archive_tar = (current_archive < tablespace_rows.size());
+  archive_eof = false;
+  archive_terminated = false;
+  archive_pos = 0;
+  next_header = 0;
+
+  /* The manifest is always stored uncompressed */
+  if (archive_tar)
+    handle = BaseBackupVerifier::archiveFile(file);
+
+  if (handle != nullptr && handle->isCompressed()) {
+
+    archive_reader = handle;
+    archive_reader->setOpenMode("rb");
+    archive_reader->open();
+
+  } else {
+
+    struct stat st;
+
+    archive_fd = ::open(file.string().c_str(), O_RDONLY);
+
+    if (archive_fd < 0 || fstat(archive_fd, &st) < 0) {
+      throw CArchiveIssue("could not open archive "
+                          + file.string() + ": " + strerror(errno));
+    }
+
+    archive_end = st.st_size;
+
+    /*
+     * Find the end of the last member by walking along the
+     * member headers, the data is sent without looking at it.
+     */
+    while (archive_tar && next_header + 512 <= archive_end) {
+
+      char header[512];
+
+      if (::pread(archive_fd, header, sizeof(header), next_header) != sizeof(header)) {
+        throw CArchiveIssue("could not read archive "
+                            + file.string() + ": " + strerror(errno));
+      }
+
+      archive_pos = next_header;
+
+      if (tarMembers(header, sizeof(header)) == 0) {
+        archive_end = next_header;
+        break;
+      }
+
+    }
+
+    archive_pos = 0;
+
+  }
+
+  archive_open = true;
+
+  BOOST_LOG_TRIVIAL(debug) << "BASE_BACKUP: opened archive " << file.string();
+
+}
+
+void PGProtoBaseBackup::closeArchive() {
+
+  if (archive_fd >= 0) {
+    ::close(archive_fd);
+    archive_fd = -1;
+  }
+
+  if (archive_reader != nullptr) {
+    archive_reader->close();
+    archive_reader = nullptr;
+  }
+
+  archive_open = false;
+
+}
+
+size_t PGProtoBaseBackup::tarMembers(const char *data, size_t len) {
+
+  while (next_header + 512 <= archive_pos + (off_t) len) {
+
+    ArchiveMemberIndexEntry entry;
+
+    if (!ArchiveMemberIndex::parseTarHeader(data + (next_header - archive_pos), entry))
+      return next_header - archive_pos;
+
+    /* member contents are padded to full blocks */
+    next_header += 512 + ((entry.size + 511) & ~((size_t) 511));
+
+  }
+
+  return len;
+
+}
+
+void PGProtoBaseBackup::copyData(ProtocolBuffer &buffer, const char *data, size_t len) {
+
+  /* An empty CopyData buffer makes the COPY state emit CopyDone */
+  if (len > 0)
+    copy_data_buffer->assign((void *) data, len);
+  else
+    copy_data_buffer->allocate(0);
+
+  copy->write();
+  buffer.assign(copy_buffer->ptr(), copy_buffer->getSize());
+
+}
+
+int PGProtoBaseBackup::archiveStep(ProtocolBuffer &buffer) {
+
+  /* archive data messages of the archive stream start with 'd' */
+  size_t prefix = (archive_stream) ? 1 : 0;
+  size_t len = 0;
+
+  if (copy == nullptr) {
+
+    PGProtoCopyContext copy_context;
+
+    /*
+     * Start the COPY OUT with the empty column list
+     * PostgreSQL uses for it.
+     */
+    copy_buffer = std::make_shared<ProtocolBuffer>(buffer_pool);
+    copy_data_buffer = std::make_shared<ProtocolBuffer>(buffer_pool);
+
+    copy_context.formats = std::make_shared<PGProtoCopyFormat>(0, false);
+    copy_context.output_buffer = copy_buffer;
+    copy_context.output_data_buffer = copy_data_buffer;
+    copy_context.state = std::make_shared<PGProtoCopyOutResponseState>();
+
+    copy = std::make_shared<PGProtoCopy>(copy_context);
+
+    copy->write();
+    buffer.assign(copy_buffer->ptr(), copy_buffer->getSize());
+
+    return (current_step = STEP_COPY_OUT_RESPONSE);
+
+  }
+
+  /*
+   * All archives sent, the archive stream ends
+   * with its COPY.
+   */
+  if (current_archive >= archives.size()) {
+
+    copyData(buffer, NULL, 0);
+
+    copy = nullptr;
+    phase = BASEBACKUP_PHASE_END_POSITION;
+
+    return (current_step = STEP_COPY_DONE);
+
+  }
+
+  if (!archive_open) {
+
+    openArchive();
+
+    if (archive_stream) {
+
+      std::string msg;
+
+      if (archive_tar) {
+
+        /* new archive message: archive name and tablespace location */
+        msg.push_back('n');
+        msg.append(archive_names[current_archive].first);
+        msg.push_back('\0');
+        msg.append(archive_names[current_archive].second);
+        msg.push_back('\0');
+
+      } else {
+
+        /* manifest message */
+        msg.push_back('m');
+
+      }
+
+      copyData(buffer, msg.c_str(), msg.length());
+
+      return (current_step = STEP_ARCHIVE_START);
+
+    }
+
+  }
+
+  if (archive_fd >= 0 && archive_pos < archive_end) {
+
+    len = std::min((size_t) (archive_end - archive_pos), MAX_SEND_SIZE);
+
+    /*
+     * The archive data is sent directly from the file by
+     * the caller, so frame the CopyData message by hand and
+     * leave the data out.
+     */
+    buffer.allocate(MESSAGE_HDR_SIZE + prefix);
+    buffer.write_byte(CopyDataMessage);
+    buffer.write_int(MESSAGE_HDR_LENGTH_SIZE + prefix + len);
+
+    if (archive_stream)
+      buffer.write_byte('d');
+
+    region_pending = true;
+    region_fd = archive_fd;
+    region_offset = archive_pos;
+    region_len = len;
+
+    archive_pos += len;
+
+    return (current_step = STEP_COPY_DATA);
+
+  }
+
+  if (archive_reader != nullptr && !archive_eof) {
+
+    /*
+     * Fill the buffer completely, so member headers
+     * never span two messages.
+     */
+    archive_buffer.resize(prefix + MAX_SEND_SIZE);
+
+    if (archive_stream)
+      archive_buffer[0] = 'd';
+
+    while (len < MAX_SEND_SIZE) {
+
+      size_t rc = archive_reader->read(&archive_buffer[prefix + len], MAX_SEND_SIZE - len);
+
+      if (rc == 0) {
+        archive_eof = true;
+        break;
+      }
+
+      len += rc;
+
+    }
+
+    if (archive_tar) {
+
+      size_t end = tarMembers(&archive_buffer[prefix], len);
+
+      if (end < len) {
+        archive_eof = true;
+        len = end;
+      }
+
+    }
+
+    if (len > 0) {
+
+      copyData(buffer, &archive_buffer[0], prefix + len);
+      archive_pos += len;
+
+      return (current_step = STEP_COPY_DATA);
+
+    }
+
+  }
+
+  /*
+   * The archive stream carries terminated tar archives.
+   */
+  if (archive_stream && archive_tar && !archive_terminated) {
+
+    archive_buffer.assign(prefix + TAR_TRAILER_SIZE, '\0');
+    archive_buffer[0] = 'd';
+
+    copyData(buffer, &archive_buffer[0], archive_buffer.size());
+    archive_terminated = true;
+
+    return (current_step = STEP_COPY_DATA);
+
+  }
+
+  closeArchive();
+  current_archive++;
+
+  if (archive_stream)
+    return archiveStep(buffer);
+
+  copyData(buffer, NULL, 0);
+  copy = nullptr;
+
+  if (current_archive >= archives.size())
+    phase = BASEBACKUP_PHASE_END_POSITION;
+
+  return (current_step = STEP_COPY_DONE);
+
+}
+void PGProtoBaseBackup::prepareResultSet() {
+
+  resultSet = std::make_shared<PGProtoResultSet>();
+
+  if (phase == BASEBACKUP_PHASE_TABLESPACES) {
+
+    resultSet->addColumn("spcoid",
+                         0,
+                         0,
+                         PGProtoColumnDescr::PG_TYPEOID_OID,
+                         4,
+                         0);
+
+    resultSet->addColumn("spclocation",
+                         0,
+                         0,
+                         PGProtoColumnDescr::PG_TYPEOID_TEXT,
+                         -1,
+                         0);
+
+    resultSet->addColumn("size",
+                         0,
+                         0,
+                         PGProtoColumnDescr::PG_TYPEOID_INT8,
+                         8,
+                         0);
+
+    for (auto &row : tablespace_rows)
+      resultSet->addRow(row);
+
+  } else {
+
+    std::vector<PGProtoColumnDataDescr> data;
+    PGProtoColumnDataDescr colvalue;
+
+    resultSet->addColumn("recptr",
+                         0,
+                         0,
+                         PGProtoColumnDescr::PG_TYPEOID_TEXT,
+                         -1,
+                         0);
+
+    resultSet->addColumn("tli",
+                         0,
+                         0,
+                         PGProtoColumnDescr::PG_TYPEOID_INT8,
+                         8,
+                         0);
+
+    colvalue.data   = (phase == BASEBACKUP_PHASE_START_POSITION)
+      ? basebackup->xlogpos : basebackup->xlogposend;
+    colvalue.length = colvalue.data.length();
+    data.push_back(colvalue);
+
+    colvalue.data   = std::to_string(basebackup->timeline);
+    colvalue.length = colvalue.data.length();
+    data.push_back(colvalue);
+
+    resultSet->addRow(data);
+
+  }
+
+}
+
+int PGProtoBaseBackup::step(ProtocolBuffer &buffer) {
+
+  region_pending = false;
+
+  switch (phase) {
+
+  case BASEBACKUP_PHASE_START_POSITION:
+  case BASEBACKUP_PHASE_TABLESPACES:
+  case BASEBACKUP_PHASE_END_POSITION:
+    {
+
+      if (resultSet == nullptr) {
+        prepareResultSet();
+        current_step = 0;
+      }
+
+      if (PGProtoStreamingCommand::step(buffer) != -1)
+        return current_step;
+
+      /*
+       * Each result set is ended by a CommandComplete
+       * of its own, as PostgreSQL does.
+       */
+      commandComplete(buffer, "SELECT");
+
+      resultSet = nullptr;
+
+      if (phase == BASEBACKUP_PHASE_START_POSITION)
+        phase = BASEBACKUP_PHASE_TABLESPACES;
+      else if (phase == BASEBACKUP_PHASE_TABLESPACES)
+        phase = BASEBACKUP_PHASE_ARCHIVE;
+      else
+        phase = BASEBACKUP_PHASE_DONE;
+
+      return (current_step = STEP_COMMAND_COMPLETE);
+
+    }
+
+  case BASEBACKUP_PHASE_ARCHIVE:
+    return archiveStep(buffer);
+
+  case BASEBACKUP_PHASE_DONE:
+  default:
+    break;
+
+  }
+
+  return -1;
+
+}
+
+void PGProtoBaseBackup::reset() {
+
+  closeArchive();
+
+  phase           = BASEBACKUP_PHASE_START_POSITION;
+  current_step    = 0;
+  current_archive = 0;
+  resultSet       = nullptr;
+  copy            = nullptr;
+  region_pending  = false;
+
+}
+
+/* ****************************************************************************
+ * PGProtoShow command ... SHOW
+ * ***************************************************************************/
+
+PGProtoShow::PGProtoShow(std::shared_ptr<PGProtoCmdDescr> descr,
+                         std::shared_ptr<PGProtoCatalogHandler> catalogHandler,
+                         std::shared_ptr<RuntimeConfiguration> rtc,
+                         std::shared_ptr<WorkerSHM> worker_shm)
+  : PGProtoStreamingCommand(descr, catalogHandler, rtc, worker_shm) {
+
+  command_tag = "SHOW";
+  needs_archive_access = false;
+  current_step = 0;
+
+}
+
+PGProtoShow::~PGProtoShow() {}
+
+std::string PGProtoShow::versionString(int version_num) {
+
+  std::ostringstream oss;
+
+  /* Since PostgreSQL 10, versions have two parts only */
+  if (version_num >= 100000)
+    oss << version_num / 10000 << "." << version_num % 10000;
+  else
+    oss << version_num / 10000 << "." << (version_num / 100) % 100
+        << "." << version_num % 100;
+
+  return oss.str();
+
+}
+
+void PGProtoShow::execute(std::shared_ptr<ExecutableContext> context) {
+
+  std::shared_ptr<BaseBackupDescr> basebackup = catalogHandler->getAttachedBasebackup();
+  std::vector<PGProtoColumnDataDescr> data;
+  PGProtoColumnDataDescr colvalue;
+  std::string variable = command_handle->variable;
+
+  if (variable == "wal_segment_size") {
+
+    unsigned long long size = 16 * 1024 * 1024;
+
+    if (basebackup != nullptr && basebackup->wal_segment_size > 0)
+      size = basebackup->wal_segment_size;
+
+    /* Formatted like PostgreSQL does, clients parse the unit */
+    if (size % (1024 * 1024 * 1024) == 0)
+      colvalue.data = std::to_string(size / (1024 * 1024 * 1024)) + "GB";
+    else
+      colvalue.data = std::to_string(size / (1024 * 1024)) + "MB";
+
+  } else if (variable == "data_directory_mode") {
+
+    colvalue.data = "0700";
+
+  } else if (variable == "server_version") {
+
+    if (basebackup != nullptr && basebackup->pg_version_num > 0)
+      colvalue.data = versionString(basebackup->pg_version_num);
+    else
+      colvalue.data = CPGBackupCtlBase::getVersionString();
+
+  } else {
+
+    throw PGProtoCmdFailure("unrecognized configuration parameter \"" + variable + "\"");
+
+  }
+
+  resultSet = std::make_shared<PGProtoResultSet>();
+
+  resultSet->addColumn(variable,
+                       0,
+                       0,
+                       PGProtoColumnDescr::PG_TYPEOID_TEXT,
+                       -1,
+                       0);
+
+  colvalue.length = colvalue.data.length();
+  data.push_back(colvalue);
+
+  resultSet->addRow(data);
+
+}
+
+void PGProtoShow::reset() {
+
+  current_step = 0;
+  resultSet    = nullptr;
+
+}
@@ -4,6 +4,7 @@
 
 /* required for string case insensitive comparison */
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
 
 /*
  * For the boost builtin parser.
@@ -76,6 +77,67 @@ namespace pgbckctl {
 
       }
 
+      void storeStartPosition(std::string const& pos) {
+
+        if (cmd == nullptr)
+          throw PGProtoCmdFailure("could not reference undefined cmd handle in parser");
+
+        cmd->startpos = PGStream::decodeXLOGPos(pos);
+
+      }
+
+      void storeSlotName(std::string const& slot_name) {
+
+        if (cmd == nullptr)
+          throw PGProtoCmdFailure("could not reference undefined cmd handle in parser");
+
+        cmd->slot_name = slot_name;
+
+      }
+
+      /**
+       * Name of the option parsed last, storeOptionValue()
+       * assigns its value.
+       */
+      std::string option_name = "";
+
+      void storeOptionName(std::string const& name) {
+
+        if (cmd == nullptr)
+          throw PGProtoCmdFailure("could not reference undefined cmd handle in parser");
+
+        option_name = boost::algorithm::to_lower_copy(name);
+        cmd->options[option_name] = "";
+
+      }
+
+      void storeOptionValue(std::string const& value) {
+
+        if (cmd == nullptr)
+          throw PGProtoCmdFailure("could not reference undefined cmd handle in parser");
+
+        cmd->options[option_name] = value;
+
+      }
+
+      void storeArchiveStream() {
+
+        if (cmd == nullptr)
+          throw PGProtoCmdFailure("could not reference undefined cmd handle in parser");
+
+        cmd->archive_stream = true;
+
+      }
+
+      void storeVariable(std::string const& variable) {
+
+        if (cmd == nullptr)
+          throw PGProtoCmdFailure("could not reference undefined cmd handle in parser");
+
+        cmd->variable = boost::algorithm::to_lower_copy(variable);
+
+      }
+
       void newCommand(ProtocolCommandTag const& tag) {
 
         cmd = std::make_shared<PGProtoCmdDescr>();
@@ -102,6 +164,17 @@ namespace pgbckctl {
       qi::rule<Iterator, ascii::space_type> cmd_identify_system;
       qi::rule<Iterator, ascii::space_type> cmd_list_basebackups;
       qi::rule<Iterator, ascii::space_type> cmd_timeline_history;
+      qi::rule<Iterator, ascii::space_type> cmd_start_replication;
+      qi::rule<Iterator, ascii::space_type> cmd_base_backup;
+      qi::rule<Iterator, ascii::space_type> cmd_show;
+      qi::rule<Iterator, ascii::space_type> legacy_option;
+      qi::rule<Iterator, ascii::space_type> generic_option;
+      qi::rule<Iterator, std::string(), ascii::space_type> xlogpos;
+      qi::rule<Iterator, std::string(), ascii::space_type> slot_name;
+      qi::rule<Iterator, std::string(), ascii::space_type> identifier;
+      qi::rule<Iterator, std::string(), ascii::space_type> quoted_string;
+      qi::rule<Iterator, std::string(), ascii::space_type> option_value;
+      qi::rule<Iterator, std::string(), ascii::space_type> legacy_value;
 
     public:
 
@@ -174,6 +247,62 @@ namespace pgbckctl {
           >> boost::spirit::qi::uint_
           [ boost::bind(&PGProtoStreamingParser::storeTimelineID, this, ::_1) ];
 
+        /*
+         * START_REPLICATION [ SLOT slot_name ] [ PHYSICAL ] XXX/XXX [ TIMELINE tli ]
+         *
+         * Only physical replication is supported, a slot name
+         * is accepted but ignored.
+         */
+        xlogpos = lexeme[ +ascii::xdigit >> char_('/') >> +ascii::xdigit ];
+        slot_name = lexeme[ +(ascii::alnum | char_('_')) ];
+
+        cmd_start_replication = no_case[ lexeme[ lit("START_REPLICATION") ] ]
+          [ boost::bind(&PGProtoStreamingParser::newCommand, this, START_REPLICATION) ]
+          >> -( no_case[ lexeme[ lit("SLOT") ] ]
+                >> slot_name [ boost::bind(&PGProtoStreamingParser::storeSlotName, this, ::_1) ] )
+          >> -( no_case[ lexeme[ lit("PHYSICAL") ] ] )
+          >> xlogpos [ boost::bind(&PGProtoStreamingParser::storeStartPosition, this, ::_1) ]
+          >> -( no_case[ lexeme[ lit("TIMELINE") ] ]
+                >> boost::spirit::qi::uint_
+                [ boost::bind(&PGProtoStreamingParser::storeTimelineID, this, ::_1) ] );
+
+        /*
+         * BASE_BACKUP [ LABEL 'label' ] [ PROGRESS ] [ FAST ] [ WAL ] ...
+         * BASE_BACKUP [ ( option [ value ] [, ...] ) ]
+         *
+         * The first form is the syntax of PostgreSQL 14 and before, whose
+         * option values are quoted strings or numbers. The second one
+         * is the syntax of PostgreSQL 15 and later. Options are checked
+         * by PGProtoBaseBackup.
+         */
+        identifier = lexeme[ ascii::alpha >> *(ascii::alnum | char_('_')) ];
+        quoted_string = lexeme[ lit('\'') >> *(char_ - lit('\'')) >> lit('\'') ];
+        option_value = quoted_string | lexeme[ +(ascii::alnum | char_('_') | char_('.') | char_('-')) ];
+        legacy_value = quoted_string | lexeme[ +ascii::digit ];
+
+        legacy_option = identifier [ boost::bind(&PGProtoStreamingParser::storeOptionName, this, ::_1) ]
+          >> -( legacy_value [ boost::bind(&PGProtoStreamingParser::storeOptionValue, this, ::_1) ] );
+
+        generic_option = identifier [ boost::bind(&PGProtoStreamingParser::storeOptionName, this, ::_1) ]
+          >> -( option_value [ boost::bind(&PGProtoStreamingParser::storeOptionValue, this, ::_1) ] );
+
+        cmd_base_backup = no_case[ lexeme[ lit("BASE_BACKUP") ] ]
+          [ boost::bind(&PGProtoStreamingParser::newCommand, this, BASE_BACKUP) ]
+          >> ( ( lit('(') [ boost::bind(&PGProtoStreamingParser::storeArchiveStream, this) ]
+                 >> -( generic_option % ',' ) >> lit(')') )
+               | *( legacy_option ) );
+
+        /*
+         * SHOW name
+         */
+        cmd_show = no_case[ lexeme[ lit("SHOW") ] ]
+          [ boost::bind(&PGProtoStreamingParser::newCommand, this, SHOW) ]
+          >> identifier [ boost::bind(&PGProtoStreamingParser::storeVariable, this, ::_1) ];
+
+        /*
+         * Like PostgreSQL, a single command doesn't need
+         * a terminating ';'.
+         */
         start %= eps >> (
                          cmd_identify_system
 
@@ -185,8 +314,19 @@ namespace pgbckctl {
 
                          cmd_timeline_history
 
-                         ) >> lit(";")
-                     >> -(start);
+                         |
+
+                         cmd_start_replication
+
+                         |
+
+                         cmd_base_backup
+
+                         |
+
+                         cmd_show
+
+                         ) >> ( ( lit(";") >> -(start) ) | qi::eoi );
 
         /*
          * error handling
@@ -207,6 +347,17 @@ namespace pgbckctl {
         cmd_identify_system.name("IDENTIFY_SYSTEM");
         cmd_list_basebackups.name("LIST_BASEBACKUPS");
         cmd_timeline_history.name("TIMELINE_HISTORY");
+        cmd_start_replication.name("START_REPLICATION");
+        cmd_base_backup.name("BASE_BACKUP");
+        cmd_show.name("SHOW");
+        legacy_option.name("BASE_BACKUP option");
+        generic_option.name("BASE_BACKUP option");
+        identifier.name("identifier");
+        quoted_string.name("quoted string");
+        option_value.name("option value");
+        legacy_value.name("option value");
+        xlogpos.name("XLOG position");
+        slot_name.name("slot name");
 
       }
 
@@ -169,8 +169,34 @@ ProtocolBuffer::ProtocolBuffer(size_t size) : MemoryBuffer(size) {
 
 }
 
+ProtocolBuffer::ProtocolBuffer(std::shared_ptr<MemoryBufferPool> pool)
+  : MemoryBuffer(pool) {
+
+  this->curr_pos = (size_t) 0;
+
+}
+
+ProtocolBuffer::ProtocolBuffer(ProtocolBuffer &&src)
+  : MemoryBuffer(std::move(src)) {
+
+  this->curr_pos = src.curr_pos;
+  src.curr_pos = (size_t) 0;
+
+}
+
 ProtocolBuffer::~ProtocolBuffer() {}
 
+ProtocolBuffer& ProtocolBuffer::operator=(ProtocolBuffer &&src) {
+
+  MemoryBuffer::operator=(std::move(src));
+
+  this->curr_pos = src.curr_pos;
+  src.curr_pos = (size_t) 0;
+
+  return *this;
+
+}
+
 size_t ProtocolBuffer::write_buffer(const void *buf, size_t bufsize) {
 
   size_t bw = 0;
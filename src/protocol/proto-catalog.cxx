@@ -6,14 +6,94 @@
 using namespace pgbckctl;
 using namespace pgbckctl::pgprotocol;
 
+/* ****************************************************************************
+ * PGProtoArchiveCache
+ * ****************************************************************************/
+
+const unsigned int PGProtoArchiveCache::REFRESH_INTERVAL;
+
+PGProtoArchiveCache::PGProtoArchiveCache(std::string catalog_name) {
+
+  /* Create the shared backup catalog instance and open it */
+  catalog = std::make_shared<BackupCatalog>(catalog_name);
+
+}
+
+PGProtoArchiveCache::~PGProtoArchiveCache() {
+
+  if (catalog->opened())
+    catalog->close();
+
+}
+
+std::string PGProtoArchiveCache::fullname() {
+
+  return catalog->fullname();
+
+}
+
+std::shared_ptr<CatalogDescr> PGProtoArchiveCache::getArchive(int archive_id) {
+
+  std::lock_guard<std::mutex> guard(catalog_lock);
+  std::time_t now = std::time(NULL);
+  std::shared_ptr<CatalogDescr> descr = nullptr;
+  auto cached = archives.find(archive_id);
+
+  if (cached != archives.end()
+      && now < cached->second.first + (std::time_t) REFRESH_INTERVAL) {
+    return cached->second.second;
+  }
+
+  descr = catalog->existsById(archive_id);
+
+  /* Don't remember archives which don't exist (yet) */
+  if (descr->id < 0) {
+    archives.erase(archive_id);
+  } else {
+    archives[archive_id] = std::make_pair(now, descr);
+  }
+
+  return descr;
+
+}
+
+void PGProtoArchiveCache::invalidate() {
+
+  std::lock_guard<std::mutex> guard(catalog_lock);
+
+  archives.clear();
+
+}
+
+void PGProtoArchiveCache::use(std::function<void(std::shared_ptr<BackupCatalog>)> fn) {
+
+  std::lock_guard<std::mutex> guard(catalog_lock);
+
+  fn(catalog);
+
+}
+
+/* ****************************************************************************
+ * PGProtoCatalogHandler
+ * ****************************************************************************/
+
 PGProtoCatalogHandler::PGProtoCatalogHandler(std::string catalog_name) {
 
   /*
-   * Create internal backup catalog instance and open it
-   *
-   * NOTE: std::make_unique is C++14, but we still have C++11....:(
+   * Create a private catalog access instance, opening
+   * the backup catalog.
    */
-  catalog = std::unique_ptr<BackupCatalog>(new BackupCatalog(catalog_name));
+  archive_cache = std::make_shared<PGProtoArchiveCache>(catalog_name);
+
+}
+
+PGProtoCatalogHandler::PGProtoCatalogHandler(std::shared_ptr<PGProtoArchiveCache> archive_cache) {
+
+  if (archive_cache == nullptr) {
+    throw CCatalogIssue("cannot create catalog handler without catalog access");
+  }
+
+  this->archive_cache = archive_cache;
 
 }
 
@@ -25,11 +105,10 @@ PGProtoCatalogHandler::PGProtoCatalogHandler(std::string catalog_name,
                                              std::shared_ptr<WorkerSHM> shm) {
 
   /*
-   * Create internal backup catalog instance and open it
-   *
-   * NOTE: std::make_unique is C++14, but we still rely on C++11....:(
+   * Create a private catalog access instance, opening
+   * the backup catalog.
    */
-  catalog = std::unique_ptr<BackupCatalog>(new BackupCatalog(catalog_name));
+  archive_cache = std::make_shared<PGProtoArchiveCache>(catalog_name);
 
   /*
    * Attach this catalog handler to the specified archive/basebackup.
@@ -43,17 +122,32 @@ PGProtoCatalogHandler::PGProtoCatalogHandler(std::string catalog_name,
 
 PGProtoCatalogHandler::~PGProtoCatalogHandler() {
 
-  if (catalog->opened())
-    catalog->close();
-
-  /* should dispose catalog handle */
-  catalog = nullptr;
+  /* The catalog is closed by the last handler using it */
+  archive_cache = nullptr;
 
 }
 
 string PGProtoCatalogHandler::getCatalogFullname() {
 
-  return catalog->fullname();
+  return archive_cache->fullname();
+
+}
+
+std::shared_ptr<PGProtoArchiveCache> PGProtoCatalogHandler::getArchiveCache() {
+
+  return archive_cache;
+
+}
+
+void PGProtoCatalogHandler::setWALCache(std::shared_ptr<WALSegmentCache> wal_cache) {
+
+  this->wal_cache = wal_cache;
+
+}
+
+std::shared_ptr<WALSegmentCache> PGProtoCatalogHandler::getWALCache() {
+
+  return wal_cache;
 
 }
 
@@ -102,21 +196,25 @@ std::shared_ptr<BaseBackupDescr> PGProtoCatalogHandler::attach(std::string baseb
    * if basebackup_fqfn is either newest, latest or oldest, we
    * have to do additional work.
    */
-  if ( (basebackup_fqfn == "latest") || (basebackup_fqfn == "newest") ) {
+  archive_cache->use([this, &basebackup_fqfn, archive_id](std::shared_ptr<BackupCatalog> catalog) {
 
-    attached_basebackup = catalog->getBaseBackup(BASEBACKUP_NEWEST,
-                                                 archive_id,
-                                                 true);
+      if ( (basebackup_fqfn == "latest") || (basebackup_fqfn == "newest") ) {
 
-  } else if (basebackup_fqfn == "oldest") {
+        attached_basebackup = catalog->getBaseBackup(BASEBACKUP_NEWEST,
+                                                     archive_id,
+                                                     true);
 
-    attached_basebackup = catalog->getBaseBackup(BASEBACKUP_OLDEST,
-                                                 archive_id,
-                                                 true);
+      } else if (basebackup_fqfn == "oldest") {
 
-  } else {
-    attached_basebackup = catalog->getBaseBackup(basebackup_fqfn, archive_id);
-  }
+        attached_basebackup = catalog->getBaseBackup(BASEBACKUP_OLDEST,
+                                                     archive_id,
+                                                     true);
+
+      } else {
+        attached_basebackup = catalog->getBaseBackup(basebackup_fqfn, archive_id);
+      }
+
+    });
 
   /*
    * If successful, register the basebackup into our shared
@@ -185,6 +283,15 @@ bool PGProtoCatalogHandler::isAttached() {
 
 }
 
+std::shared_ptr<BaseBackupDescr> PGProtoCatalogHandler::getAttachedBasebackup() {
+
+  if (!isAttached())
+    return nullptr;
+
+  return attached_basebackup;
+
+}
+
 void PGProtoCatalogHandler::queryTimelineHistory(std::shared_ptr<PGProtoResultSet> set,
                                                  unsigned int tli) {
 
@@ -207,14 +314,14 @@ void PGProtoCatalogHandler::queryTimelineHistory(std::shared_ptr<PGProtoResultSe
   /*
    * Get a backup directory handle.
    */
-  backupDir = make_shared<BackupDirectory>(catalog->fullname());
+  backupDir = make_shared<BackupDirectory>(archive_cache->fullname());
   archiveDir = backupDir->logdirectory();
 
   /*
    * Archive our basebackup is attached to. We need this to
    * get the catalog parent directory for basebackups.
    */
-  catalogDescr = catalog->existsById(attached_basebackup->archive_id);
+  catalogDescr = archive_cache->getArchive(attached_basebackup->archive_id);
 
   /*
    * We got a valid descriptor?
@@ -61,6 +61,34 @@ std::shared_ptr<PGProtoStreamingCommand> ProtocolCommandHandler::getExecutable(s
                                                      worker_shm);
       break;
     }
+
+  case START_REPLICATION:
+    {
+      cmd = std::make_shared<PGProtoStartReplication>(cmdDescr,
+                                                      catalogHandler,
+                                                      runtime_configuration,
+                                                      worker_shm);
+      break;
+    }
+
+  case BASE_BACKUP:
+    {
+      cmd = std::make_shared<PGProtoBaseBackup>(cmdDescr,
+                                                catalogHandler,
+                                                runtime_configuration,
+                                                worker_shm);
+      break;
+    }
+
+  case SHOW:
+    {
+      cmd = std::make_shared<PGProtoShow>(cmdDescr,
+                                          catalogHandler,
+                                          runtime_configuration,
+                                          worker_shm);
+      break;
+    }
+
   default:
 
     throw PGProtoCmdFailure("unknown streaming protocol command");
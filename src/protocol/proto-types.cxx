@@ -40,74 +40,87 @@ int PGProtoResultSet::data(ProtocolBuffer &buffer) {
 
 }
 
-int PGProtoResultSet::prepareSend(ProtocolBuffer &buffer,
-                                  int type) {
+int PGProtoResultSet::dataChunk(ProtocolBuffer &buffer,
+                                size_t max_size) {
 
-  int message_size = 0;
+  std::vector<PGProtoColumns>::iterator chunk_end = row_iterator;
+  size_t chunk_size = 0;
+  char *p;
 
-  switch(type) {
+  /*
+   * NOTE: on the very first call, we will find the iterator
+   *       positioned on the very first data row, if descriptor()
+   *       was called before.
+   *
+   *       If positioned behind the last row, return 0,
+   *       indicating the end of data row messages.
+   */
+  if (row_iterator == data_descr.row_values.end()) {
 
-  case PGPROTO_DATA_DESCR_MESSAGE:
-    {
-      /*
-       * Check if we are positioned on the last element.
-       * If true, message_size will return 0, indicating the end of
-       * data row messages.
-       */
-      if (row_iterator == data_descr.row_values.end()) {
+    BOOST_LOG_TRIVIAL(debug) << "result set iterator reached end of data rows";
+    return 0;
 
-        BOOST_LOG_TRIVIAL(debug) << "result set iterator reached end of data rows";
-        break;
+  }
 
-      }
+  /*
+   * Collect the rows of this chunk. Their sizes were
+   * calculated by addRow() already.
+   */
+  do {
 
-      message_size = MESSAGE_HDR_SIZE + sizeof(short)
-        + row_iterator->row_size;
-      buffer.allocate(message_size);
+    size_t message_size = MESSAGE_HDR_SIZE + sizeof(short) + chunk_end->row_size;
 
-      BOOST_LOG_TRIVIAL(debug) << "PG PROTO write data row size "
-                               << message_size
-                               << ", buffer size "
-                               << buffer.getSize();
+    if (chunk_size > 0 && chunk_size + message_size > max_size)
+      break;
 
-      /*
-       * Prepare message header.
-       */
-      buffer.write_byte(DescribeMessage);
-      buffer.write_int(message_size - MESSAGE_HDR_BYTE);
+    chunk_size += message_size;
+    chunk_end++;
 
-      /* Number of columns */
-      buffer.write_short(row_iterator->fieldCount());
+  } while (chunk_end != data_descr.row_values.end());
 
-      BOOST_LOG_TRIVIAL(debug) << "PG PROTO data row message has "
-                               << row_iterator->values.size()
-                               << " columns";
+  buffer.allocate(chunk_size);
+  p = buffer.ptr();
 
-      /*
-       * NOTE: on the very first call to data(), we will
-       *       find the iterator positioned on the very first
-       *       data row, if descriptor() was called before.
-       *
-       *       Just advance the iterator unless we have seen
-       *       the last data row.
-       */
+  BOOST_LOG_TRIVIAL(debug) << "PG PROTO write data rows chunk size "
+                           << chunk_size;
 
-      /* Loop through the column values list */
-      for (auto &colval : row_iterator->values) {
+  for (; row_iterator != chunk_end; row_iterator++) {
 
-        BOOST_LOG_TRIVIAL(debug) << "PG PROTO write col data len "
-                                 << colval.length << " bytes";
+    /* Message header, the length includes itself */
+    p = ProtocolBuffer::store_byte(p, DescribeMessage);
+    p = ProtocolBuffer::store_int(p, MESSAGE_HDR_LENGTH_SIZE + sizeof(short)
+                                  + row_iterator->row_size);
 
-        buffer.write_int(colval.length);
-        buffer.write_buffer(colval.data.c_str(), colval.length);
+    /* Number of columns */
+    p = ProtocolBuffer::store_short(p, row_iterator->fieldCount());
 
-      }
+    /* The column values, NULL values don't have any bytes */
+    for (auto &colval : row_iterator->values) {
 
-      /*
-       * Position the data row iterator on the next data row.
-       */
-      row_iterator++;
+      p = ProtocolBuffer::store_int(p, colval.length);
+
+      if (colval.length > 0)
+        p = ProtocolBuffer::store_buffer(p, colval.data.c_str(), colval.length);
+
+    }
+
+  }
+
+  return chunk_size;
+
+}
 
+int PGProtoResultSet::prepareSend(ProtocolBuffer &buffer,
+                                  int type) {
+
+  int message_size = 0;
+
+  switch(type) {
+
+  case PGPROTO_DATA_DESCR_MESSAGE:
+    {
+      /* A chunk of a single row */
+      message_size = dataChunk(buffer, 0);
       break;
     }
 
@@ -225,7 +238,11 @@ void PGProtoResultSet::addRow(std::vector<PGProtoColumnDataDescr> column_values)
 
     /* The row size includes bytes of the column value _and_
      * the 4 byte length value! */
-    columns.row_size += (sizeof(col.length) + col.length);
+    columns.row_size += sizeof(col.length);
+
+    /* NULL values don't have any bytes */
+    if (col.length > 0)
+      columns.row_size += col.length;
 
   }
 
@@ -1,5 +1,22 @@
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <boost/log/trivial.hpp>
+#include <boost/regex.hpp>
+
 #include <recovery.hxx>
 #include <fs-archive.hxx>
+#include <fs-sync.hxx>
+#include <verifybackup.hxx>
+
+extern "C" {
+#include <unistd.h>
+}
 
 using namespace pgbckctl;
 
@@ -7,6 +24,15 @@ using namespace pgbckctl;
  * Implementation of class RestoreDescrID
  * *************************************************************************** */
 
+RestoreDescrID::~RestoreDescrID() {
+
+  if (this->type == RESTORE_BASEBACKUP_BY_NAME) {
+    using std::string;
+    this->ident.name.~string();
+  }
+
+}
+
 void RestoreDescrID::getId(int &id) {
 
   if (this->type != RESTORE_BASEBACKUP_BY_ID)
@@ -28,28 +54,32 @@ void RestoreDescrID::getId(std::string &name) {
 void RestoreDescrID::setId(RestoreDescrIdentificationType type,
                            std::string const& name) {
 
-  if (this->type != RESTORE_BASEBACKUP_BY_UNDEF)
-    this->ident.~_restoredescr_ident();
-
   if (type != RESTORE_BASEBACKUP_BY_NAME)
     throw CArchiveIssue("invalid access to restore backup descriptor by name");
 
-  this->ident.~_restoredescr_ident();
+  if (this->type == RESTORE_BASEBACKUP_BY_NAME) {
+    this->ident.name = name;
+    return;
+  }
+
   new(&(this->ident.name)) std::string(name);
+  this->type = type;
 
 }
 
 void RestoreDescrID::setId(RestoreDescrIdentificationType type,
                            int const& id) {
 
-  if (this->type != RESTORE_BASEBACKUP_BY_UNDEF)
-    this->ident.~_restoredescr_ident();
-
   if (type != RESTORE_BASEBACKUP_BY_ID)
     throw CArchiveIssue("invalid access to restore backup descriptor by ID");
 
-  new(&(this->ident.id)) int;
+  if (this->type == RESTORE_BASEBACKUP_BY_NAME) {
+    using std::string;
+    this->ident.name.~string();
+  }
+
   this->ident.id = id;
+  this->type = type;
 
 }
 
@@ -85,6 +115,14 @@ RestoreDescr::RestoreDescr(int id) {
 
 }
 
+RestoreDescr::RestoreDescr(RestoreTargetType target_type, std::string target) {
+
+  this->id.type = RESTORE_BASEBACKUP_BY_TARGET;
+  this->target_type = target_type;
+  this->target = target;
+
+}
+
 RestoreDescr::~RestoreDescr() {}
 
 void RestoreDescr::prepareTablespaceDescrForMap(unsigned int oid) {
@@ -136,12 +174,18 @@ void RestoreDescr::stackTablespaceDescrForMap(std::string location) {
 
 }
 
+
 /* *************************************************************************** *
  * Implementation of class Recovery
  * *************************************************************************** */
 
 Recovery::Recovery() {}
-Recovery::Recovery(std::shared_ptr<RestoreDescr> restoreDescr) {}
+
+Recovery::Recovery(std::shared_ptr<RestoreDescr> restoreDescr) {
+
+  this->restoreDescr = restoreDescr;
+
+}
 
 Recovery::~Recovery() {}
 
@@ -149,8 +193,949 @@ Recovery::~Recovery() {}
  * Implementation of class TarRecovery
  * *************************************************************************** */
 
-TarRecovery::TarRecovery(std::shared_ptr<RestoreDescr> restoreDescr) {}
+const size_t TarRecovery::CHUNK_SIZE;
+const unsigned int TarRecovery::DEFAULT_QUEUE_DEPTH;
+
+/*
+ * Reads len bytes from archive into buf, returns the number
+ * of bytes read, which is less than len at the end of the archive.
+ */
+static size_t restore_read(std::shared_ptr<BackupFile> archive, char *buf, size_t len) {
+
+  size_t total = 0;
+
+  /* ArchiveFile::read() returns the number of items read, not bytes */
+  if (!archive->isCompressed())
+    return (archive->read(buf, len) > 0) ? len : 0;
+
+  while (total < len) {
+
+    size_t rbytes = archive->read(buf + total, len - total);
+
+    if (rbytes == 0)
+      break;
+
+    total += rbytes;
+
+  }
+
+  return total;
+
+}
+
+/*
+ * Returns the path of a tar member below root. Absolute member
+ * names or names leaving root are refused.
+ */
+static path restore_member_path(path const& root, std::string const& name) {
+
+  /* Directory members carry a trailing slash */
+  path member(name.substr(0, name.find_last_not_of('/') + 1));
+
+  if (member.is_absolute())
+    throw CArchiveIssue("refusing to restore absolute path \"" + name + "\"");
+
+  for (auto &elem : member) {
+
+    if (elem == "..")
+      throw CArchiveIssue("refusing to restore path \"" + name + "\" outside of target directory");
+
+  }
+
+  return root / member;
+
+}
+
+/*
+ * Creates a directory and its parents, remembering the
+ * directories already created in created.
+ */
+static void restore_mkdir(path const& dir, mode_t mode, std::set<path> &created) {
+
+  if (created.find(dir) != created.end())
+    return;
+
+  if (dir.has_parent_path())
+    restore_mkdir(dir.parent_path(), 0700, created);
+
+  /* We must be able to create files within the directory */
+  if (mkdir(dir.string().c_str(), mode | 0700) < 0 && errno != EEXIST) {
+
+    std::ostringstream oss;
+    oss << "could not create directory \"" << dir.string() << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+
+  }
+
+  created.insert(dir);
+
+}
+
+/*
+ * Returns true if name is a symlink of a tablespace
+ * in pg_tblspc/, setting spcoid to its OID.
+ */
+static bool restore_tablespace_link(std::string const& name, unsigned int &spcoid) {
+
+  const boost::regex tablespace_link("pg_tblspc/([0-9]+)/?");
+  boost::smatch what;
+
+  if (!boost::regex_match(name, what, tablespace_link))
+    return false;
+
+  spcoid = CPGBackupCtlBase::strToUInt(what[1]);
+  return true;
+
+}
+
+TarRecovery::TarRecovery(std::shared_ptr<RestoreDescr> restoreDescr)
+  : Recovery(restoreDescr) {
+
+  this->next_pipeline = 0;
+  this->bytes = 0;
+  this->files = 0;
+  this->aborted = false;
+
+}
 
 TarRecovery::~TarRecovery() {}
 
-void TarRecovery::init() {}
+void TarRecovery::setParallelism(unsigned int parallelism) {
+  this->parallelism = parallelism;
+}
+
+void TarRecovery::setQueueDepth(unsigned int queue_depth) {
+
+  if (queue_depth == 0)
+    throw CArchiveIssue("restore queue depth must be greater than 0");
+
+  this->queue_depth = queue_depth;
+
+}
+
+void TarRecovery::setSyncMethod(std::string method, unsigned int parallelism) {
+
+  this->sync_method = method;
+  this->sync_parallelism = parallelism;
+
+}
+
+void TarRecovery::setProgressCallback(std::function<void(const TarRecoveryProgress &)> cb,
+                                      std::chrono::milliseconds interval) {
+
+  this->progress_cb = cb;
+  this->progress_interval = interval;
+
+}
+
+path TarRecovery::tablespaceLocation(unsigned int spcoid) {
+
+  std::map<unsigned int, std::shared_ptr<BackupTablespaceDescr>>::iterator it;
+
+  /* Explicitly mapped by TABLESPACE MAP <OID>=<DIRECTORY> */
+  it = this->restoreDescr->tablespace_map.find(spcoid);
+
+  if (it != this->restoreDescr->tablespace_map.end())
+    return path(it->second->spclocation);
+
+  /* TABLESPACE MAP ALL=<DIRECTORY>, each tablespace gets a subdirectory */
+  it = this->restoreDescr->tablespace_map.find((unsigned int) CPGBackupCtlBase::invalid_oid);
+
+  if (it != this->restoreDescr->tablespace_map.end())
+    return path(it->second->spclocation) / CPGBackupCtlBase::uintToStr(spcoid);
+
+  /* Otherwise restore into the original location */
+  for (auto &tablespace : this->restoreDescr->basebackup->tablespaces) {
+
+    if (tablespace->spcoid == spcoid && tablespace->spclocation.length() > 0)
+      return path(tablespace->spclocation);
+
+  }
+
+  std::ostringstream oss;
+  oss << "no location to restore tablespace OID " << spcoid << " to";
+  throw CArchiveIssue(oss.str());
+
+}
+
+void TarRecovery::prepareTarget(path const& target) {
+
+  if (exists(target)) {
+
+    if (!is_directory(target)) {
+      std::ostringstream oss;
+      oss << "restore target \"" << target.string() << "\" is not a directory";
+      throw CArchiveIssue(oss.str());
+    }
+
+    /* Never mix a restored cluster with existing files */
+    if (directory_iterator(target) != directory_iterator()) {
+      std::ostringstream oss;
+      oss << "restore target directory \"" << target.string() << "\" is not empty";
+      throw CArchiveIssue(oss.str());
+    }
+
+  } else {
+
+    create_directories(target);
+
+  }
+
+  /* PostgreSQL refuses to start with a group or world writable data directory */
+  if (chmod(target.string().c_str(), 0700) < 0) {
+    std::ostringstream oss;
+    oss << "could not change permissions of \"" << target.string() << "\": " << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+void TarRecovery::init() {
+
+  const boost::regex tar_archive("(.+)\\.tar(\\.(gz|zst|lz4|xz|dedup))?");
+  std::shared_ptr<BaseBackupDescr> bbdescr = nullptr;
+  std::set<path> targets;
+  bool has_base = false;
+
+  if (this->restoreDescr == nullptr || this->restoreDescr->basebackup == nullptr)
+    throw CArchiveIssue("cannot restore basebackup: invalid restore descriptor");
+
+  bbdescr = this->restoreDescr->basebackup;
+
+  if (bbdescr->id < 0)
+    throw CArchiveIssue("cannot restore basebackup: invalid basebackup descriptor");
+
+  if (bbdescr->status != BaseBackupDescr::BASEBACKUP_STATUS_READY) {
+    std::ostringstream oss;
+    oss << "basebackup ID \"" << bbdescr->id << "\" "
+        << "cannot be restored, status is \"" << bbdescr->status << "\"";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /*
+   * The archives of an incremental basebackup contain incremental
+   * relation files only, which need to be combined with the
+   * basebackups it depends on.
+   */
+  if (bbdescr->parent_id >= 0) {
+    std::ostringstream oss;
+    oss << "basebackup ID \"" << bbdescr->id << "\" is incremental, "
+        << "restore the basebackups it depends on and combine them with pg_combinebackup";
+    throw CArchiveIssue(oss.str());
+  }
+
+  if (this->restoreDescr->target_directory.length() == 0)
+    throw CArchiveIssue("cannot restore basebackup: no target directory");
+
+  for (directory_iterator it(path(bbdescr->fsentry)); it != directory_iterator(); ++it) {
+
+    boost::smatch what;
+    std::string filename = it->path().filename().string();
+    std::shared_ptr<TarRecoveryPipeline> pipeline = nullptr;
+
+    if (!is_regular_file(it->path())
+        || !boost::regex_match(filename, what, tar_archive))
+      continue;
+
+    pipeline = std::make_shared<TarRecoveryPipeline>();
+    pipeline->archive = it->path();
+
+    /*
+     * The base archive contains the data directory, all others
+     * are tablespaces named by their OID.
+     */
+    if (what[1] == "base" || what[1] == "0") {
+
+      has_base = true;
+      pipeline->target = path(this->restoreDescr->target_directory);
+
+    } else {
+
+      pipeline->spcoid = CPGBackupCtlBase::strToUInt(what[1]);
+      pipeline->target = this->tablespaceLocation(pipeline->spcoid);
+      this->locations[pipeline->spcoid] = pipeline->target;
+
+    }
+
+    if (!targets.insert(pipeline->target).second) {
+      std::ostringstream oss;
+      oss << "restore target directory \"" << pipeline->target.string()
+          << "\" is used by more than one archive";
+      throw CArchiveIssue(oss.str());
+    }
+
+    /* Start the big base archive first, it usually takes longest */
+    if (pipeline->spcoid == 0)
+      this->pipelines.insert(this->pipelines.begin(), pipeline);
+    else
+      this->pipelines.push_back(pipeline);
+
+  }
+
+  if (!has_base) {
+    std::ostringstream oss;
+    oss << "basebackup ID \"" << bbdescr->id << "\" has no base archive in \""
+        << bbdescr->fsentry << "\"";
+    throw CArchiveIssue(oss.str());
+  }
+
+  /* A mapped tablespace which isn't part of the basebackup is most likely a typo */
+  for (auto &mapped : this->restoreDescr->tablespace_map) {
+
+    if (mapped.first != CPGBackupCtlBase::invalid_oid
+        && this->locations.find(mapped.first) == this->locations.end()) {
+      std::ostringstream oss;
+      oss << "tablespace OID " << mapped.first << " is not part of basebackup ID \""
+          << bbdescr->id << "\"";
+      throw CArchiveIssue(oss.str());
+    }
+
+  }
+
+  for (auto &tablespace : bbdescr->tablespaces) {
+
+    if (tablespace->spcsize > 0)
+      this->bytes_total += tablespace->spcsize * 1024;
+
+  }
+
+  for (auto &pipeline : this->pipelines)
+    this->prepareTarget(pipeline->target);
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+  /*
+   * io_uring might be compiled in but not be usable, e.g.
+   * within containers, so try a ring before relying on it.
+   */
+  try {
+
+    IOUringInstance probe(this->queue_depth, TarRecovery::CHUNK_SIZE);
+
+    probe.setup();
+    probe.exit();
+
+    this->pool = std::make_shared<vectored_buffer_pool>(TarRecovery::CHUNK_SIZE);
+    this->use_io_uring = true;
+
+  } catch (CIOUringIssue &e) {
+
+    BOOST_LOG_TRIVIAL(debug) << "DEBUG: io_uring not usable for restore, using pwrite(): "
+                             << e.what();
+
+  }
+#endif
+
+  BOOST_LOG_TRIVIAL(debug) << "DEBUG: restoring basebackup ID " << bbdescr->id
+                           << " from " << this->pipelines.size() << " archives"
+                           << (this->use_io_uring ? " using io_uring" : "");
+
+}
+
+void TarRecovery::fail(std::string const& what) {
+
+  std::lock_guard<std::mutex> lock(this->error_mtx);
+
+  if (this->error.length() == 0)
+    this->error = what;
+
+  this->abort();
+
+}
+
+void TarRecovery::abort() {
+
+  this->aborted = true;
+
+  /* Wake up every thread waiting on a pipeline queue */
+  for (auto &pipeline : this->pipelines) {
+
+    std::lock_guard<std::mutex> lock(pipeline->mtx);
+    pipeline->cond.notify_all();
+
+  }
+
+}
+
+std::shared_ptr<TarRecoveryChunk> TarRecovery::allocChunk(size_t len) {
+
+  std::shared_ptr<TarRecoveryChunk> chunk = std::make_shared<TarRecoveryChunk>();
+
+  chunk->len = len;
+
+  if (len == 0)
+    return chunk;
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+  if (this->use_io_uring) {
+
+    /* Always take full chunks, so the pool can hand them out again */
+    chunk->vbuf = this->pool->get(TarRecovery::CHUNK_SIZE);
+    chunk->vbuf->setEffectiveSize(len, true);
+    return chunk;
+
+  }
+#endif
+
+  chunk->data.resize(len);
+  return chunk;
+
+}
+
+char *TarRecovery::chunkData(std::shared_ptr<TarRecoveryChunk> chunk) {
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+  if (chunk->vbuf != nullptr)
+    return chunk->vbuf->buffers[0]->ptr();
+#endif
+
+  return chunk->data.data();
+
+}
+
+void TarRecovery::push(std::shared_ptr<TarRecoveryPipeline> pipeline,
+                       std::shared_ptr<TarRecoveryChunk> chunk) {
+
+  std::unique_lock<std::mutex> lock(pipeline->mtx);
+
+  pipeline->cond.wait(lock, [&]() {
+      return (this->aborted || pipeline->queue.size() < this->queue_depth);
+    });
+
+  if (this->aborted)
+    throw CArchiveIssue("restore aborted");
+
+  pipeline->queue.push_back(chunk);
+  pipeline->cond.notify_all();
+
+}
+
+std::shared_ptr<TarRecoveryChunk> TarRecovery::pop(std::shared_ptr<TarRecoveryPipeline> pipeline,
+                                                   bool wait) {
+
+  std::shared_ptr<TarRecoveryChunk> chunk = nullptr;
+  std::unique_lock<std::mutex> lock(pipeline->mtx);
+
+  if (wait) {
+    pipeline->cond.wait(lock, [&]() {
+        return (this->aborted || pipeline->done || !pipeline->queue.empty());
+      });
+  }
+
+  if (this->aborted || pipeline->queue.empty())
+    return nullptr;
+
+  chunk = pipeline->queue.front();
+  pipeline->queue.pop_front();
+  pipeline->cond.notify_all();
+
+  return chunk;
+
+}
+
+void TarRecovery::queueFile(std::shared_ptr<TarRecoveryPipeline> pipeline,
+                            std::shared_ptr<TarRecoveryFile> target,
+                            size_t size,
+                            std::function<void(char *, size_t)> fill) {
+
+  off_t offset = 0;
+
+  /* Empty files still need a chunk to get created */
+  do {
+
+    std::shared_ptr<TarRecoveryChunk> chunk
+      = this->allocChunk(std::min(size - offset, TarRecovery::CHUNK_SIZE));
+
+    chunk->target = target;
+    chunk->offset = offset;
+
+    if (chunk->len > 0)
+      fill(this->chunkData(chunk), chunk->len);
+
+    offset += chunk->len;
+    chunk->last = ((size_t) offset == size);
+
+    this->push(pipeline, chunk);
+
+  } while ((size_t) offset < size);
+
+}
+
+std::string TarRecovery::rewriteTablespaceMap(std::string const& contents) {
+
+  std::istringstream in(contents);
+  std::ostringstream out;
+  std::string line;
+
+  /*
+   * Every line is "<OID> <location>". Tablespaces we don't
+   * restore are left alone.
+   */
+  while (std::getline(in, line)) {
+
+    size_t sep = line.find(' ');
+    unsigned int spcoid;
+
+    if (sep == std::string::npos) {
+      out << line << "\n";
+      continue;
+    }
+
+    try {
+      spcoid = CPGBackupCtlBase::strToUInt(line.substr(0, sep));
+    } catch (std::exception &e) {
+      out << line << "\n";
+      continue;
+    }
+
+    if (this->locations.find(spcoid) != this->locations.end())
+      out << spcoid << " " << this->locations[spcoid].string() << "\n";
+    else
+      out << line << "\n";
+
+  }
+
+  return out.str();
+
+}
+
+void TarRecovery::extract(std::shared_ptr<TarRecoveryPipeline> pipeline) {
+
+  std::shared_ptr<BackupFile> archive = BaseBackupVerifier::archiveFile(pipeline->archive);
+  std::set<path> created;
+  char padding[512];
+
+  archive->setOpenMode("rb");
+  archive->open();
+
+  created.insert(pipeline->target);
+
+  while (!this->aborted) {
+
+    ArchiveMemberIndexEntry entry;
+    std::shared_ptr<TarRecoveryFile> target = nullptr;
+    char header[512];
+    size_t padlen;
+    mode_t mode;
+    path name;
+
+    /* PostgreSQL terminates its archives, but tolerate a missing trailer */
+    if (restore_read(archive, header, sizeof(header)) < sizeof(header))
+      break;
+
+    if (!ArchiveMemberIndex::parseTarHeader(header, entry))
+      break;
+
+    name = restore_member_path(pipeline->target, entry.name);
+    mode = (mode_t) (ArchiveMemberIndex::tarNumber(header + 100, 8) & 07777);
+    padlen = ((entry.size + 511) & ~((size_t) 511)) - entry.size;
+
+    switch (entry.type) {
+
+    case '5':
+      {
+        restore_mkdir(name, mode, created);
+        this->files++;
+        break;
+      }
+
+    case '2':
+      {
+        std::string link(header + 157, strnlen(header + 157, 100));
+        unsigned int spcoid;
+
+        /* Tablespace links point to the restored locations */
+        if (pipeline->spcoid == 0
+            && restore_tablespace_link(entry.name, spcoid)
+            && this->locations.find(spcoid) != this->locations.end())
+          link = this->locations[spcoid].string();
+
+        restore_mkdir(name.parent_path(), 0700, created);
+
+        if (symlink(link.c_str(), name.string().c_str()) < 0) {
+          std::ostringstream oss;
+          oss << "could not create symlink \"" << name.string() << "\": " << strerror(errno);
+          throw CArchiveIssue(oss.str());
+        }
+
+        this->files++;
+        break;
+      }
+
+    case '0':
+    case '7':
+      {
+        target = std::make_shared<TarRecoveryFile>();
+        target->name = name;
+        target->mode = mode;
+
+        restore_mkdir(name.parent_path(), 0700, created);
+
+        if (pipeline->spcoid == 0 && entry.name == "tablespace_map") {
+
+          std::string contents(entry.size, '\0');
+
+          if (restore_read(archive, &contents[0], entry.size) < entry.size)
+            throw CArchiveIssue("unexpected end of archive " + pipeline->archive.string());
+
+          size_t pos = 0;
+
+          contents = this->rewriteTablespaceMap(contents);
+
+          this->queueFile(pipeline, target, contents.length(),
+                          [&](char *buf, size_t len) {
+                            memcpy(buf, contents.data() + pos, len);
+                            pos += len;
+                          });
+
+          break;
+        }
+
+        this->queueFile(pipeline, target, entry.size,
+                        [&](char *buf, size_t len) {
+                          if (restore_read(archive, buf, len) < len)
+                            throw CArchiveIssue("unexpected end of archive "
+                                                + pipeline->archive.string());
+                        });
+
+        break;
+      }
+
+    default:
+      {
+        std::ostringstream oss;
+        oss << "unsupported type '" << entry.type << "' of member \"" << entry.name
+            << "\" in archive " << pipeline->archive.string();
+        throw CArchiveIssue(oss.str());
+      }
+
+    }
+
+    if (padlen > 0 && restore_read(archive, padding, padlen) < padlen)
+      throw CArchiveIssue("unexpected end of archive " + pipeline->archive.string());
+
+  }
+
+  archive->close();
+
+}
+
+void TarRecovery::openTarget(std::shared_ptr<TarRecoveryChunk> chunk) {
+
+  std::shared_ptr<TarRecoveryFile> target = chunk->target;
+
+  if (target->file != nullptr)
+    return;
+
+  /*
+   * Chunks are written straight through the file descriptor,
+   * so don't bother with a stdio buffer.
+   */
+  target->file = std::make_shared<ArchiveFile>(target->name);
+  target->file->setOpenMode("wb");
+  target->file->setBuffered(false);
+  target->file->open();
+
+  if (fchmod(target->file->getFileno(), target->mode) < 0) {
+    std::ostringstream oss;
+    oss << "could not change permissions of \"" << target->name.string() << "\": "
+        << strerror(errno);
+    throw CArchiveIssue(oss.str());
+  }
+
+}
+
+void TarRecovery::finishChunk(std::shared_ptr<TarRecoveryChunk> chunk) {
+
+  this->bytes += chunk->len;
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+  if (chunk->vbuf != nullptr) {
+    this->pool->release(chunk->vbuf);
+    chunk->vbuf = nullptr;
+  }
+#endif
+
+  /* Synced in a batch by start() */
+  if (chunk->last) {
+    chunk->target->file->close();
+    chunk->target->file = nullptr;
+    this->files++;
+  }
+
+}
+
+void TarRecovery::writer(std::shared_ptr<TarRecoveryPipeline> pipeline) {
+
+  std::shared_ptr<TarRecoveryChunk> chunk = nullptr;
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+  if (this->use_io_uring) {
+    this->writerIOUring(pipeline);
+    return;
+  }
+#endif
+
+  while ((chunk = this->pop(pipeline, true)) != nullptr) {
+
+    char *data = this->chunkData(chunk);
+    size_t written = 0;
+
+    this->openTarget(chunk);
+
+    while (written < chunk->len) {
+
+      ssize_t rc = pwrite(chunk->target->file->getFileno(),
+                          data + written,
+                          chunk->len - written,
+                          chunk->offset + written);
+
+      if (rc < 0) {
+
+        if (errno == EINTR)
+          continue;
+
+        std::ostringstream oss;
+        oss << "could not write file \"" << chunk->target->name.string() << "\": "
+            << strerror(errno);
+        throw CArchiveIssue(oss.str());
+
+      }
+
+      written += rc;
+
+    }
+
+    this->finishChunk(chunk);
+
+  }
+
+}
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+void TarRecovery::writerIOUring(std::shared_ptr<TarRecoveryPipeline> pipeline) {
+
+  IOUringInstance ring(this->queue_depth, TarRecovery::CHUNK_SIZE);
+  std::vector<std::shared_ptr<TarRecoveryChunk>> inflight;
+
+  ring.setup();
+
+  while (true) {
+
+    /*
+     * Wait for chunks only if nothing is in flight, otherwise
+     * complete the writes in flight before waiting.
+     */
+    std::shared_ptr<TarRecoveryChunk> chunk = this->pop(pipeline, inflight.empty());
+
+    if (chunk != nullptr) {
+
+      this->openTarget(chunk);
+
+      if (chunk->len > 0)
+        ring.write(chunk->target->file, chunk->vbuf, chunk->offset);
+
+      inflight.push_back(chunk);
+
+      if (inflight.size() < this->queue_depth)
+        continue;
+
+    }
+
+    if (inflight.empty())
+      break;
+
+    /*
+     * Completions don't tell which request they belong to, but a
+     * short write on a regular file means we ran out of space anyways.
+     * Files are closed only after all writes in flight completed.
+     */
+    {
+      size_t expected = 0;
+      size_t written = 0;
+
+      for (auto &item : inflight) {
+
+        if (item->len == 0)
+          continue;
+
+        expected += item->len;
+        written += ring.handle_current_io(item->vbuf);
+
+      }
+
+      if (written != expected) {
+        std::ostringstream oss;
+        oss << "short write while restoring into \"" << pipeline->target.string() << "\": "
+            << written << " of " << expected << " bytes";
+        throw CIOUringIssue(oss.str());
+      }
+
+      for (auto &item : inflight)
+        this->finishChunk(item);
+
+      inflight.clear();
+    }
+
+  }
+
+  ring.exit();
+
+}
+#endif
+
+void TarRecovery::worker() {
+
+  while (!this->aborted) {
+
+    size_t next = this->next_pipeline++;
+    std::shared_ptr<TarRecoveryPipeline> pipeline = nullptr;
+
+    if (next >= this->pipelines.size())
+      break;
+
+    pipeline = this->pipelines[next];
+
+    BOOST_LOG_TRIVIAL(debug) << "DEBUG: extracting " << pipeline->archive.string()
+                             << " into \"" << pipeline->target.string() << "\"";
+
+    /* The writer runs in its own thread, while we decompress */
+    std::thread writer([this, pipeline]() {
+        try {
+          this->writer(pipeline);
+        } catch (std::exception &e) {
+          this->fail(e.what());
+        }
+      });
+
+    try {
+      this->extract(pipeline);
+    } catch (std::exception &e) {
+      this->fail(e.what());
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(pipeline->mtx);
+      pipeline->done = true;
+      pipeline->cond.notify_all();
+    }
+
+    writer.join();
+
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(this->running_mtx);
+    this->running--;
+    this->running_cond.notify_all();
+  }
+
+}
+
+TarRecoveryProgress TarRecovery::progress() {
+
+  TarRecoveryProgress progress;
+  double seconds;
+
+  progress.bytes = this->bytes;
+  progress.bytes_total = this->bytes_total;
+  progress.files = this->files;
+  progress.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()
+                                                                           - this->start_time);
+
+  seconds = progress.elapsed.count() / 1000.0;
+
+  if (seconds > 0)
+    progress.throughput = (unsigned long long) (progress.bytes / seconds);
+
+  /* The catalog size is an estimate, so we might exceed it */
+  if (progress.throughput > 0 && progress.bytes_total > 0) {
+
+    unsigned long long left = (progress.bytes_total > progress.bytes)
+      ? progress.bytes_total - progress.bytes : 0;
+
+    progress.eta = std::chrono::seconds(left / progress.throughput);
+
+  }
+
+  return progress;
+
+}
+
+void TarRecovery::start() {
+
+  std::vector<std::thread> workers;
+  std::set<path> targets;
+  unsigned int nworkers = this->parallelism;
+  path manifest;
+
+  if (this->pipelines.empty())
+    throw CArchiveIssue("cannot start restore: init() must be called before");
+
+  if (nworkers == 0 || nworkers > this->pipelines.size())
+    nworkers = this->pipelines.size();
+
+  this->start_time = std::chrono::steady_clock::now();
+  this->running = nworkers;
+
+  for (unsigned int i = 0; i < nworkers; i++)
+    workers.push_back(std::thread(&TarRecovery::worker, this));
+
+  {
+    std::unique_lock<std::mutex> lock(this->running_mtx);
+
+    while (this->running > 0) {
+
+      this->running_cond.wait_for(lock, this->progress_interval);
+
+      if (this->running > 0 && this->progress_cb != nullptr) {
+        lock.unlock();
+        this->progress_cb(this->progress());
+        lock.lock();
+      }
+
+    }
+  }
+
+  for (auto &worker : workers)
+    worker.join();
+
+  if (this->aborted) {
+    std::lock_guard<std::mutex> lock(this->error_mtx);
+    throw CArchiveIssue("could not restore basebackup: "
+                        + ((this->error.length() > 0) ? this->error : std::string("aborted")));
+  }
+
+  /*
+   * pg_verifybackup expects the manifest within the
+   * data directory, as written by pg_basebackup.
+   */
+  manifest = path(this->restoreDescr->basebackup->fsentry) / "backup_manifest";
+
+  if (!exists(manifest))
+    manifest = path(this->restoreDescr->basebackup->fsentry) / "backup.manifest";
+
+  if (exists(manifest))
+    copy_file(manifest, path(this->restoreDescr->target_directory) / "backup_manifest");
+
+  /*
+   * Now make everything durable at once. Tablespace locations
+   * are synced separately, the base archive might not contain
+   * symlinks to them.
+   */
+  for (auto &pipeline : this->pipelines) {
+
+    RecursiveSync sync(pipeline->target);
+
+    if (!targets.insert(pipeline->target).second)
+      continue;
+
+    sync.setMethod(RecursiveSync::methodFromString(this->sync_method));
+    sync.setParallelism(this->sync_parallelism);
+    sync.sync();
+
+  }
+
+  if (this->progress_cb != nullptr)
+    this->progress_cb(this->progress());
+
+}
@@ -0,0 +1,686 @@
+#include <ctime>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <boost/log/trivial.hpp>
+
+#include <restoreplan.hxx>
+#include <walindex.hxx>
+#include <stream.hxx>
+
+using namespace pgbckctl;
+
+/*
+ * Converts a timestamp as recorded for basebackups into
+ * a time_t, -1 if it can't be parsed.
+ */
+static std::time_t restore_plan_time(std::string ts) {
+
+  struct tm tm;
+
+  if (ts.length() == 0)
+    return (std::time_t) -1;
+
+  memset(&tm, 0, sizeof(tm));
+
+  if (strptime(ts.c_str(), "%Y-%m-%d %H:%M:%S", &tm) == NULL)
+    return (std::time_t) -1;
+
+  /* let mktime() figure out daylight saving time */
+  tm.tm_isdst = -1;
+
+  return mktime(&tm);
+
+}
+
+/*
+ * Quotes a string as a configuration parameter value.
+ */
+static std::string restore_plan_quote(const std::string &value) {
+
+  std::string result = "'";
+
+  for (auto c : value) {
+
+    if (c == '\'')
+      result += '\'';
+
+    result += c;
+
+  }
+
+  return result + "'";
+
+}
+
+/* *****************************************************************************
+ * RestorePlanCandidate implementation
+ * ****************************************************************************/
+
+bool RestorePlanCandidate::usable() {
+
+  return (this->reason.length() == 0);
+
+}
+
+bool RestorePlanCandidate::incremental() {
+
+  return (this->chain.size() > 1);
+
+}
+
+/* *****************************************************************************
+ * RestorePlan implementation
+ * ****************************************************************************/
+
+bool RestorePlan::feasible() {
+
+  return (this->chosen != nullptr);
+
+}
+
+double RestorePlan::estimatedDuration() {
+
+  if (this->chosen == nullptr)
+    return 0.0;
+
+  return this->chosen->cost;
+
+}
+
+std::vector<std::string> RestorePlan::historyFiles() {
+
+  std::vector<std::string> files;
+
+  /* Timeline 1 has no history file */
+  for (auto &tli : this->history) {
+
+    if (tli.timeline > 1)
+      files.push_back(ArchiveLogDirectory::timelineHistoryFilename(tli.timeline, false));
+
+  }
+
+  return files;
+
+}
+
+void RestorePlan::writeRecoveryConfig(path const& datadir,
+                                      int pg_version_num,
+                                      const std::string &restore_command) {
+
+  std::ostringstream conf;
+  std::vector<path> written;
+  path file;
+
+  conf << "restore_command = " << restore_plan_quote(restore_command) << std::endl;
+
+  switch (this->target_type) {
+
+  case RESTORE_TARGET_LSN:
+
+    if (pg_version_num > 0 && pg_version_num < 100000) {
+      throw CArchiveIssue("recovery target LSN requires PostgreSQL 10 or above");
+    }
+
+    conf << "recovery_target_lsn = " << restore_plan_quote(this->target) << std::endl;
+    break;
+
+  case RESTORE_TARGET_TIME:
+    {
+      std::time_t target_time = restore_plan_time(this->target);
+      struct tm tm;
+      char offset[16];
+
+      if (target_time == (std::time_t) -1
+          || localtime_r(&target_time, &tm) == NULL
+          || strftime(offset, sizeof(offset), "%z", &tm) == 0) {
+        throw CArchiveIssue("invalid recovery target time \"" + this->target + "\"");
+      }
+
+      conf << "recovery_target_time = "
+           << restore_plan_quote(this->target + offset) << std::endl;
+      break;
+    }
+
+  default:
+    /* LATEST recovers up to the end of the WAL */
+    break;
+
+  }
+
+  if (this->timeline > 0)
+    conf << "recovery_target_timeline = "
+         << restore_plan_quote(std::to_string(this->timeline)) << std::endl;
+
+  /*
+   * Before PostgreSQL 12, recovery.conf starts archive recovery.
+   * Afterwards, recovery.signal does, and the settings are regular
+   * configuration parameters.
+   */
+  if (pg_version_num > 0 && pg_version_num < 120000) {
+
+    file = datadir / "recovery.conf";
+    std::ofstream out(file.string(), std::ios::out | std::ios::trunc);
+
+    out << conf.str();
+    out.close();
+
+    if (!out) {
+      throw CArchiveIssue("could not write \"" + file.string() + "\"");
+    }
+
+    written.push_back(file);
+
+  } else {
+
+    file = datadir / "postgresql.auto.conf";
+    std::ofstream out(file.string(), std::ios::out | std::ios::app);
+
+    out << "# recovery target of RESTORE by pg_backup_ctl++" << std::endl
+        << conf.str();
+    out.close();
+
+    if (!out) {
+      throw CArchiveIssue("could not write \"" + file.string() + "\"");
+    }
+
+    written.push_back(file);
+
+    file = datadir / "recovery.signal";
+    std::ofstream signal(file.string(), std::ios::out | std::ios::trunc);
+
+    signal.close();
+
+    if (!signal) {
+      throw CArchiveIssue("could not create \"" + file.string() + "\"");
+    }
+
+    written.push_back(file);
+
+  }
+
+  /* The restored files were synced already, these weren't */
+  for (auto &p : written)
+    RootDirectory::fsync(p);
+
+  RootDirectory::fsync(datadir);
+
+}
+
+/* *****************************************************************************
+ * RestorePlanner implementation
+ * ****************************************************************************/
+
+const unsigned long long RestorePlanner::DEFAULT_EXTRACT_RATE;
+const unsigned long long RestorePlanner::DEFAULT_REPLAY_RATE;
+
+RestorePlanner::RestorePlanner(std::shared_ptr<BackupCatalog> catalog,
+                               std::shared_ptr<CatalogDescr> archiveDescr) {
+
+  if (catalog == nullptr || archiveDescr == nullptr) {
+    throw CArchiveIssue("restore planner requires a catalog and an archive");
+  }
+
+  this->catalog = catalog;
+  this->archiveDescr = archiveDescr;
+
+}
+
+RestorePlanner::~RestorePlanner() {}
+
+void RestorePlanner::setRates(unsigned long long extract_rate,
+                              unsigned long long replay_rate) {
+
+  this->extract_rate = (extract_rate > 0) ? extract_rate : DEFAULT_EXTRACT_RATE;
+  this->replay_rate = (replay_rate > 0) ? replay_rate : DEFAULT_REPLAY_RATE;
+
+}
+
+std::vector<RestorePlanTimeline> RestorePlanner::readHistory(unsigned int timeline) {
+
+  std::vector<RestorePlanTimeline> history;
+  std::string filename = ArchiveLogDirectory::timelineHistoryFilename(timeline, false);
+  std::string content = "";
+  std::istringstream iss;
+  std::string line;
+  RestorePlanTimeline current;
+  XLogRecPtr begin = InvalidXLogRecPtr;
+  path file;
+
+  /*
+   * There's no history before timeline 1.
+   */
+  if (timeline > 1) {
+
+    for (auto &suffix : { "", ".gz", ".zst", ".lz4" }) {
+
+      path candidate = this->logdir->getPath() / (filename + suffix);
+
+      if (exists(candidate)) {
+        file = candidate;
+        break;
+      }
+
+    }
+
+    if (file.empty()) {
+      throw CArchiveIssue("history file of timeline " + std::to_string(timeline)
+                          + " not found in archive");
+    }
+
+    if (ArchiveLogDirectory::xlogCompressionType(file) == BACKUP_COMPRESS_TYPE_NONE) {
+
+      std::ifstream in(file.string());
+      std::ostringstream oss;
+
+      if (!in) {
+        throw CArchiveIssue("could not open \"" + file.string() + "\"");
+      }
+
+      oss << in.rdbuf();
+      content = oss.str();
+
+    } else {
+
+      std::shared_ptr<FramedArchiveFile> reader = FramedArchiveFile::forReading(file);
+      char buf[4096];
+      size_t len;
+
+      reader->open();
+
+      while ((len = reader->read(buf, sizeof(buf))) > 0)
+        content.append(buf, len);
+
+      reader->close();
+
+    }
+
+  }
+
+  /*
+   * Each line of a history file is "<parent TLI> <switchpoint> <reason>",
+   * see PostgreSQL's src/backend/access/transam/timeline.c. Comments
+   * and empty lines are ignored.
+   */
+  iss.str(content);
+
+  while (std::getline(iss, line)) {
+
+    std::istringstream fields(line);
+    RestorePlanTimeline entry;
+    std::string switchpoint;
+
+    if (!(fields >> entry.timeline) || line[0] == '#')
+      continue;
+
+    if (!(fields >> switchpoint)) {
+      throw CArchiveIssue("invalid line in history file of timeline "
+                          + std::to_string(timeline) + ": " + line);
+    }
+
+    entry.begin = begin;
+    entry.end = PGStream::decodeXLOGPos(switchpoint);
+    begin = entry.end;
+
+    history.push_back(entry);
+
+  }
+
+  current.timeline = timeline;
+  current.begin = begin;
+  current.end = InvalidXLogRecPtr;
+  history.push_back(current);
+
+  return history;
+
+}
+
+unsigned int RestorePlanner::segmentTimeline(std::shared_ptr<RestorePlan> plan,
+                                             unsigned long long segno,
+                                             unsigned long long wal_segment_size) {
+
+  /*
+   * Like recovery, read a segment from the newest timeline beginning
+   * at or before it. The segment containing a switchpoint exists
+   * on both timelines, the newer one has the records after it.
+   */
+  for (auto it = plan->history.rbegin(); it != plan->history.rend(); ++it) {
+
+    if (it->begin / wal_segment_size <= segno)
+      return it->timeline;
+
+  }
+
+  return plan->history.front().timeline;
+
+}
+
+void RestorePlanner::estimateTargetLSN(std::shared_ptr<RestorePlan> plan,
+                                       std::vector<std::shared_ptr<BaseBackupDescr>> &list) {
+
+  std::time_t target = restore_plan_time(plan->target);
+  std::shared_ptr<BaseBackupDescr> before = nullptr;
+  std::shared_ptr<BaseBackupDescr> after = nullptr;
+  std::time_t before_time = 0;
+  std::time_t after_time = 0;
+
+  plan->target_lsn_estimated = true;
+
+  /*
+   * Find the basebackups stopped closest before and after
+   * the target time.
+   */
+  for (auto &bbdescr : list) {
+
+    std::time_t stopped = restore_plan_time(bbdescr->stopped);
+
+    if (stopped == (std::time_t) -1)
+      continue;
+
+    if (stopped <= target && (before == nullptr || stopped > before_time)) {
+      before = bbdescr;
+      before_time = stopped;
+    }
+
+    if (stopped > target && (after == nullptr || stopped < after_time)) {
+      after = bbdescr;
+      after_time = stopped;
+    }
+
+  }
+
+  /*
+   * Without a basebackup after the target, there's no telling
+   * how much WAL was written up to then, so all WAL is replayed,
+   * see plan().
+   */
+  if (before == nullptr || after == nullptr) {
+    plan->target_lsn = InvalidXLogRecPtr;
+    return;
+  }
+
+  XLogRecPtr lsn_before = PGStream::decodeXLOGPos(before->xlogposend);
+  XLogRecPtr lsn_after = PGStream::decodeXLOGPos(after->xlogposend);
+
+  if (lsn_after <= lsn_before || after_time <= before_time) {
+    plan->target_lsn = lsn_after;
+    return;
+  }
+
+  plan->target_lsn = lsn_before
+    + (XLogRecPtr) ((double) (lsn_after - lsn_before)
+                    * (double) (target - before_time)
+                    / (double) (after_time - before_time));
+
+}
+
+void RestorePlanner::evaluate(std::shared_ptr<RestorePlan> plan,
+                              std::shared_ptr<RestorePlanCandidate> candidate) {
+
+  std::shared_ptr<BaseBackupDescr> bbdescr = candidate->basebackup;
+  unsigned long long wal_segment_size = bbdescr->wal_segment_size;
+  unsigned long long start_segno;
+  unsigned long long end_segno;
+
+  if (wal_segment_size == 0) {
+    candidate->reason = "unknown WAL segment size";
+    return;
+  }
+
+  if (plan->target_lsn == InvalidXLogRecPtr) {
+    candidate->reason = "no WAL in archive";
+    return;
+  }
+
+  /*
+   * Recovery must at least reach the end of the
+   * basebackup to be consistent.
+   */
+  if (plan->target_lsn < PGStream::decodeXLOGPos(bbdescr->xlogposend)) {
+    candidate->reason = "basebackup ends after recovery target";
+    return;
+  }
+
+  candidate->wal_start = PGStream::decodeXLOGPos(bbdescr->xlogpos);
+  candidate->wal_end = plan->target_lsn;
+  candidate->wal_bytes = candidate->wal_end - candidate->wal_start;
+
+  /*
+   * A target at a segment boundary doesn't need the
+   * segment starting there.
+   */
+  start_segno = candidate->wal_start / wal_segment_size;
+  end_segno = (candidate->wal_end - 1) / wal_segment_size;
+
+  for (unsigned long long segno = start_segno; segno <= end_segno; segno++) {
+
+    unsigned int timeline = this->segmentTimeline(plan, segno, wal_segment_size);
+    std::string filename = ArchiveLogDirectory::XLogFileByRecPtr(segno * wal_segment_size,
+                                                                 timeline,
+                                                                 wal_segment_size);
+
+    if (this->segments.find(std::make_pair(timeline, segno)) == this->segments.end()) {
+
+      candidate->missing_segment = filename;
+      candidate->reason = "WAL segment " + candidate->missing_segment + " missing";
+      return;
+
+    }
+
+    candidate->wal_files.push_back(filename);
+    candidate->wal_segments++;
+
+  }
+
+  candidate->cost = (double) candidate->extract_bytes / (double) this->extract_rate
+    + (double) candidate->wal_bytes / (double) this->replay_rate;
+
+}
+
+std::shared_ptr<RestorePlan> RestorePlanner::plan(std::shared_ptr<RestoreDescr> restoreDescr) {
+
+  std::shared_ptr<RestorePlan> plan = std::make_shared<RestorePlan>();
+  std::vector<std::shared_ptr<BaseBackupDescr>> list;
+  std::shared_ptr<WALSegmentIndex> index = nullptr;
+  unsigned long long wal_segment_size = 0;
+  std::time_t target_time = (std::time_t) -1;
+
+  if (restoreDescr == nullptr || restoreDescr->target_type == RESTORE_TARGET_NONE) {
+    throw CArchiveIssue("no recovery target to plan a restore for");
+  }
+
+  plan->target_type = restoreDescr->target_type;
+  plan->target = restoreDescr->target;
+  plan->extract_rate = this->extract_rate;
+  plan->replay_rate = this->replay_rate;
+
+  switch (plan->target_type) {
+
+  case RESTORE_TARGET_TIME:
+
+    target_time = restore_plan_time(plan->target);
+
+    if (target_time == (std::time_t) -1) {
+      throw CArchiveIssue("invalid recovery target time \"" + plan->target
+                          + "\", expected YYYY-MM-DD HH:MM:SS");
+    }
+
+    break;
+
+  case RESTORE_TARGET_LSN:
+
+    plan->target_lsn = PGStream::decodeXLOGPos(plan->target);
+
+    if (plan->target_lsn == InvalidXLogRecPtr) {
+      throw CArchiveIssue("invalid recovery target LSN \"" + plan->target + "\"");
+    }
+
+    break;
+
+  default:
+    break;
+
+  }
+
+  for (auto &bbdescr : this->catalog->getBackupList(this->archiveDescr->archive_name)) {
+
+    if (bbdescr->status != "ready")
+      continue;
+
+    if (wal_segment_size == 0)
+      wal_segment_size = bbdescr->wal_segment_size;
+
+    list.push_back(bbdescr);
+
+  }
+
+  if (list.size() == 0) {
+    throw CArchiveIssue("archive \"" + this->archiveDescr->archive_name
+                        + "\" has no basebackups to restore");
+  }
+
+  /*
+   * Collect the completed segments of the archive. Partial segments
+   * can't be restored by restore_command, so they don't count.
+   */
+  this->logdir = std::make_shared<BackupDirectory>(path(this->archiveDescr->directory))->logdirectory();
+  this->segments.clear();
+
+  if (wal_segment_size > 0) {
+
+    index = this->logdir->segmentIndex(wal_segment_size);
+
+    for (auto &entry : index->getEntries()) {
+
+      if (entry.status == WAL_SEGMENT_COMPLETE
+          || entry.status == WAL_SEGMENT_COMPLETE_COMPRESSED) {
+        this->segments.insert(std::make_pair(entry.timeline, entry.segno));
+      }
+
+      /*
+       * Without an explicit target timeline, recover along the
+       * latest timeline in the archive, like recovery_target_timeline
+       * = 'latest' does.
+       */
+      if (entry.timeline > plan->timeline)
+        plan->timeline = entry.timeline;
+
+    }
+
+  }
+
+  if (restoreDescr->target_timeline > 0)
+    plan->timeline = restoreDescr->target_timeline;
+
+  if (plan->timeline == 0) {
+
+    for (auto &bbdescr : list) {
+
+      if ((unsigned int) bbdescr->timeline > plan->timeline)
+        plan->timeline = bbdescr->timeline;
+
+    }
+
+  }
+
+  plan->history = this->readHistory(plan->timeline);
+
+  if (plan->target_type == RESTORE_TARGET_TIME)
+    this->estimateTargetLSN(plan, list);
+
+  /*
+   * LATEST, or a target time we couldn't place, recovers up to the
+   * end of the last segment archived on the history of the target
+   * timeline.
+   */
+  if (plan->target_lsn == InvalidXLogRecPtr && wal_segment_size > 0) {
+
+    for (auto &segment : this->segments) {
+
+      if (this->segmentTimeline(plan, segment.second, wal_segment_size) != segment.first)
+        continue;
+
+      if ((segment.second + 1) * wal_segment_size > plan->target_lsn)
+        plan->target_lsn = (segment.second + 1) * wal_segment_size;
+
+    }
+
+  }
+
+  for (auto &bbdescr : list) {
+
+    std::shared_ptr<RestorePlanCandidate> candidate = std::make_shared<RestorePlanCandidate>();
+    XLogRecPtr backup_end = PGStream::decodeXLOGPos(bbdescr->xlogposend);
+    bool on_history = false;
+
+    candidate->basebackup = bbdescr;
+    plan->candidates.push_back(candidate);
+
+    /*
+     * The basebackup must have been taken on the history of the
+     * target timeline, before its timeline was left.
+     */
+    for (auto &tli : plan->history) {
+
+      if ((unsigned int) bbdescr->timeline == tli.timeline
+          && (tli.end == InvalidXLogRecPtr || backup_end <= tli.end)) {
+        on_history = true;
+        break;
+      }
+
+    }
+
+    if (!on_history) {
+      candidate->reason = "not on history of timeline " + std::to_string(plan->timeline);
+      continue;
+    }
+
+    if (plan->target_type == RESTORE_TARGET_TIME) {
+
+      std::time_t stopped = restore_plan_time(bbdescr->stopped);
+
+      if (stopped == (std::time_t) -1 || stopped > target_time) {
+        candidate->reason = "basebackup ends after recovery target";
+        continue;
+      }
+
+    }
+
+    try {
+      candidate->chain = this->catalog->getBaseBackupChain(bbdescr->id, this->archiveDescr->id);
+    } catch(CCatalogIssue &ci) {
+      candidate->reason = ci.what();
+      continue;
+    }
+
+    for (auto &member : candidate->chain) {
+
+      for (auto &tblspc : member->tablespaces)
+        candidate->extract_bytes += tblspc->spcsize;
+
+    }
+
+    this->evaluate(plan, candidate);
+
+    if (!candidate->usable())
+      continue;
+
+    /*
+     * The list is sorted newest first, so on equal cost
+     * the newer basebackup wins.
+     */
+    if (plan->chosen == nullptr || candidate->cost < plan->chosen->cost)
+      plan->chosen = candidate;
+
+  }
+
+  BOOST_LOG_TRIVIAL(debug) << "restore plan for timeline " << plan->timeline
+                           << ": " << plan->candidates.size() << " candidates, "
+                           << (plan->feasible()
+                               ? "basebackup " + std::to_string(plan->chosen->basebackup->id)
+                               : std::string("no basebackup usable"));
+
+  return plan;
+
+}
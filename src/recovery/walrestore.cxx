@@ -0,0 +1,883 @@
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <atomic>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <boost/log/trivial.hpp>
+#include <boost/range/iterator_range.hpp>
+
+#include <walrestore.hxx>
+#include <walindex.hxx>
+#include <xlogdefs.hxx>
+#include <BackupCatalog.hxx>
+#include <backup.hxx>
+
+extern "C" {
+#include <unistd.h>
+}
+
+using namespace pgbckctl;
+
+const char *WALRestore::LOCK_FILENAME = "prefetch.lock";
+
+const unsigned int WALRestore::DEFAULT_PREFETCH;
+const unsigned int WALRestore::DEFAULT_PARALLELISM;
+
+/*
+ * Extracts timeline and segment number from a XLOG segment filename.
+ */
+static void wal_restore_parse(const std::string &filename,
+                              unsigned long long wal_segment_size,
+                              unsigned int &timeline,
+                              unsigned long long &segno) {
+
+  TimeLineID tli = 0;
+  XLogSegNo xlogsegno = 0;
+
+  xlog::parseWalFileName(filename.c_str(), filename.length(),
+                         tli, xlogsegno, wal_segment_size);
+
+  timeline = tli;
+  segno = xlogsegno;
+
+}
+
+/*
+ * Rejects filenames which would leave the spool or
+ * log directory.
+ */
+static void wal_restore_check_filename(const std::string &filename) {
+
+  if (filename.empty()
+      || filename == "."
+      || filename == ".."
+      || filename.find('/') != std::string::npos) {
+    throw CArchiveIssue("invalid WAL file name \"" + filename + "\"");
+  }
+
+}
+
+WALRestore::WALRestore(std::string catalog_file,
+                       std::string archive_name,
+                       path spooldir) {
+
+  this->catalog_file = catalog_file;
+  this->archive_name = archive_name;
+  this->spooldir = spooldir;
+
+}
+
+WALRestore::WALRestore(std::shared_ptr<ArchiveLogDirectory> logdir,
+                       path spooldir) {
+
+  this->logdir = logdir;
+  this->spooldir = spooldir;
+
+}
+
+WALRestore::~WALRestore() {}
+
+void WALRestore::setPrefetch(unsigned int segments) {
+
+  this->prefetch_segments = segments;
+
+}
+
+void WALRestore::setParallelism(unsigned int parallelism) {
+
+  this->parallelism = (parallelism > 0) ? parallelism : 1;
+
+}
+
+path WALRestore::defaultSpoolDirectory(path const& target) {
+
+  path parent = target.parent_path();
+
+  if (parent.empty())
+    parent = path(".");
+
+  return parent / "pg_backup_ctl.spool";
+
+}
+
+std::shared_ptr<ArchiveLogDirectory> WALRestore::logDirectory() {
+
+  if (this->logdir != nullptr)
+    return this->logdir;
+
+  if (this->catalog_file.empty())
+    throw CArchiveIssue("cannot restore WAL without a catalog");
+
+  BackupCatalog catalog(this->catalog_file);
+  std::shared_ptr<CatalogDescr> descr = catalog.existsByName(this->archive_name);
+
+  if (descr == nullptr || descr->id < 0) {
+    catalog.close();
+    throw CArchiveIssue("archive \"" + this->archive_name + "\" does not exist");
+  }
+
+  this->logdir = std::make_shared<BackupDirectory>(path(descr->directory))->logdirectory();
+  catalog.close();
+
+  return this->logdir;
+
+}
+
+path WALRestore::findFile(const std::string &filename) {
+
+  const std::vector<std::string> suffixes = { "", ".gz", ".zst", ".lz4" };
+  std::shared_ptr<ArchiveLogDirectory> dir = this->logDirectory();
+
+  for (auto &suffix : suffixes) {
+
+    path file = dir->locateXLogFile(filename + suffix);
+
+    if (exists(file))
+      return file;
+
+  }
+
+  return path();
+
+}
+
+void WALRestore::copyFile(path const& file, path const& target, bool sync,
+                          std::function<void(const char *, size_t)> inspect) {
+
+  std::shared_ptr<FramedArchiveFile> reader = nullptr;
+  path tmp = target.parent_path() / (target.filename().string() + ".tmp");
+  std::vector<char> buf(1024 * 1024);
+  size_t len;
+  int infd = -1;
+  int fd;
+
+  /*
+   * Uncompressed files are read directly, FramedArchiveFile
+   * takes care of the compressed ones.
+   */
+  if (ArchiveLogDirectory::xlogCompressionType(file) == BACKUP_COMPRESS_TYPE_NONE) {
+
+    infd = ::open(file.string().c_str(), O_RDONLY);
+
+    if (infd < 0) {
+      throw CArchiveIssue("could not open \"" + file.string() + "\": "
+                          + strerror(errno));
+    }
+
+  } else {
+    reader = FramedArchiveFile::forReading(file);
+  }
+
+  fd = ::open(tmp.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+  if (fd < 0) {
+
+    if (infd >= 0)
+      ::close(infd);
+
+    throw CArchiveIssue("could not create \"" + tmp.string() + "\": "
+                        + strerror(errno));
+  }
+
+  try {
+
+    auto read_next = [&]() -> size_t {
+
+      ssize_t rc;
+
+      if (reader != nullptr)
+        return reader->read(buf.data(), buf.size());
+
+      while ((rc = ::read(infd, buf.data(), buf.size())) < 0) {
+
+        if (errno != EINTR)
+          throw CArchiveIssue("could not read \"" + file.string() + "\": "
+                              + strerror(errno));
+
+      }
+
+      return rc;
+
+    };
+
+    if (reader != nullptr)
+      reader->open();
+
+    while ((len = read_next()) > 0) {
+
+      size_t written = 0;
+
+      if (inspect != nullptr)
+        inspect(buf.data(), len);
+
+      while (written < len) {
+
+        ssize_t rc = ::write(fd, buf.data() + written, len - written);
+
+        if (rc < 0) {
+
+          if (errno == EINTR)
+            continue;
+
+          throw CArchiveIssue("could not write \"" + tmp.string() + "\": "
+                              + strerror(errno));
+
+        }
+
+        written += rc;
+
+      }
+
+    }
+
+    if (reader != nullptr)
+      reader->close();
+    else
+      ::close(infd);
+
+    infd = -1;
+
+    if (sync && ::fsync(fd) < 0) {
+      throw CArchiveIssue("could not sync \"" + tmp.string() + "\": "
+                          + strerror(errno));
+    }
+
+    if (::close(fd) < 0) {
+      fd = -1;
+      throw CArchiveIssue("could not close \"" + tmp.string() + "\": "
+                          + strerror(errno));
+    }
+
+    fd = -1;
+
+    if (::rename(tmp.string().c_str(), target.string().c_str()) < 0) {
+      throw CArchiveIssue("could not rename \"" + tmp.string() + "\" to \""
+                          + target.string() + "\": " + strerror(errno));
+    }
+
+  } catch(CPGBackupCtlFailure &e) {
+
+    if (fd >= 0)
+      ::close(fd);
+
+    if (infd >= 0)
+      ::close(infd);
+
+    ::unlink(tmp.string().c_str());
+    throw;
+
+  }
+
+}
+
+std::vector<std::string> WALRestore::prefetchWindow(const std::string &filename,
+                                                    unsigned long long wal_segment_size) {
+
+  std::vector<std::string> window;
+  unsigned int timeline;
+  unsigned long long segno;
+
+  /*
+   * Only completed segments are followed by others, history and
+   * backup history files are restored on their own.
+   */
+  if (ArchiveLogDirectory::xlogSegmentStatusByName(filename) != WAL_SEGMENT_COMPLETE
+      || filename.length() != XLOG_FNAME_LEN)
+    return window;
+
+#if PG_VERSION_NUM >= 110000
+  if (!IsValidWalSegSize(wal_segment_size))
+    return window;
+#endif
+
+  wal_restore_parse(filename, wal_segment_size, timeline, segno);
+
+  for (unsigned int i = 1; i <= this->prefetch_segments; i++) {
+
+    char fname[xlog::WAL_FILENAME_LEN + 1];
+
+    xlog::walFileName(fname, timeline, segno + i, wal_segment_size);
+    window.push_back(std::string(fname, xlog::WAL_FILENAME_LEN));
+
+  }
+
+  return window;
+
+}
+
+bool WALRestore::restore(const std::string &filename, path const& target) {
+
+  path spooled = this->spooldir / filename;
+  path file;
+
+  wal_restore_check_filename(filename);
+
+  /*
+   * A prefetched file just needs to be moved into place. The
+   * spool is expected on the same filesystem, but copy the file
+   * if it isn't.
+   */
+  if (::rename(spooled.string().c_str(), target.string().c_str()) == 0) {
+    BOOST_LOG_TRIVIAL(debug) << "restored " << filename << " from spool";
+    return true;
+  }
+
+  if (errno == EXDEV) {
+    this->copyFile(spooled, target, false);
+    remove(spooled);
+    return true;
+  }
+
+  if (errno != ENOENT) {
+    throw CArchiveIssue("could not rename \"" + spooled.string() + "\" to \""
+                        + target.string() + "\": " + strerror(errno));
+  }
+
+  file = this->findFile(filename);
+
+  if (file.empty()) {
+    BOOST_LOG_TRIVIAL(debug) << "WAL file " << filename << " not found in archive";
+    return false;
+  }
+
+  /*
+   * PostgreSQL reads the file right away and requests it
+   * again after a crash, so there's no need to sync it.
+   */
+  this->copyFile(file, target, false);
+
+  BOOST_LOG_TRIVIAL(debug) << "restored " << filename << " from " << file.string();
+  return true;
+
+}
+
+void WALRestore::prefetch(const std::string &filename,
+                          unsigned long long wal_segment_size) {
+
+  std::vector<std::string> window = this->prefetchWindow(filename, wal_segment_size);
+  std::set<std::string> wanted(window.begin(), window.end());
+  std::map<std::string, path> located;
+  std::vector<std::string> fetch;
+  std::vector<std::thread> threads;
+  std::atomic<size_t> next(0);
+  std::atomic<size_t> missing;
+  path lockfile = this->spooldir / LOCK_FILENAME;
+  int lockfd = -1;
+  int dirfd;
+
+  if (window.empty())
+    return;
+
+  try {
+
+    create_directories(this->spooldir);
+
+    lockfd = ::open(lockfile.string().c_str(), O_RDWR | O_CREAT, 0600);
+
+    if (lockfd < 0) {
+      throw CArchiveIssue("could not open \"" + lockfile.string() + "\": "
+                          + strerror(errno));
+    }
+
+    /*
+     * Someone else is prefetching already, its window
+     * overlaps with ours.
+     */
+    if (::flock(lockfd, LOCK_EX | LOCK_NB) < 0) {
+
+      if (errno != EWOULDBLOCK) {
+        throw CArchiveIssue("could not lock \"" + lockfile.string() + "\": "
+                            + strerror(errno));
+      }
+
+      ::close(lockfd);
+      return;
+
+    }
+
+    /*
+     * Drop everything not in the current window, including
+     * temporary files left behind by a crashed prefetch.
+     */
+    for (auto &entry : boost::make_iterator_range(directory_iterator(this->spooldir), {})) {
+
+      std::string name = entry.path().filename().string();
+
+      if (name == LOCK_FILENAME || wanted.count(name) > 0)
+        continue;
+
+      BOOST_LOG_TRIVIAL(debug) << "removing " << name << " from spool";
+      remove_all(entry.path());
+
+    }
+
+    for (auto &name : window) {
+      if (!exists(this->spooldir / name))
+        fetch.push_back(name);
+    }
+
+    /*
+     * Resolve the segments through the segment index of the log
+     * directory, so we don't need to probe for every compression
+     * suffix. If the index can't be used, findFile() does.
+     */
+    if (fetch.size() > 0) {
+
+      try {
+
+        std::shared_ptr<ArchiveLogDirectory> dir = this->logDirectory();
+        unsigned int timeline;
+        unsigned long long first;
+        unsigned long long last;
+
+        wal_restore_parse(window.front(), wal_segment_size, timeline, first);
+        wal_restore_parse(window.back(), wal_segment_size, timeline, last);
+
+        for (auto &entry : dir->segmentIndex(wal_segment_size)->range(timeline, first, last)) {
+
+          if (entry.status != WAL_SEGMENT_COMPLETE
+              && entry.status != WAL_SEGMENT_COMPLETE_COMPRESSED)
+            continue;
+
+          located.insert(std::make_pair(entry.filename.substr(0, XLOG_FNAME_LEN),
+                                        dir->locateXLogFile(entry.filename)));
+
+        }
+
+      } catch(CArchiveIssue &e) {
+        BOOST_LOG_TRIVIAL(warning) << "could not use WAL segment index: " << e.what();
+      }
+
+    }
+
+    /*
+     * Fetch the window in parallel, segments are taken in order.
+     * Segments after the first one missing in the archive are
+     * skipped, they'd be useless to recovery anyway.
+     */
+    missing = fetch.size();
+
+    for (unsigned int i = 0; i < this->parallelism && i < fetch.size(); i++) {
+
+      threads.push_back(std::thread([&]() {
+
+            size_t idx;
+
+            while ((idx = next++) < fetch.size() && idx < missing) {
+
+              auto it = located.find(fetch[idx]);
+              path file = (it != located.end() && exists(it->second)) ? it->second : path();
+
+              try {
+
+                if (file.empty())
+                  file = this->findFile(fetch[idx]);
+
+                if (file.empty()) {
+
+                  size_t cur = missing;
+
+                  while (idx < cur && !missing.compare_exchange_weak(cur, idx)) {}
+                  continue;
+
+                }
+
+                this->copyFile(file, this->spooldir / fetch[idx], true);
+                BOOST_LOG_TRIVIAL(debug) << "prefetched " << fetch[idx];
+
+              } catch(CPGBackupCtlFailure &e) {
+                BOOST_LOG_TRIVIAL(warning) << "could not prefetch " << fetch[idx]
+                                           << ": " << e.what();
+                return;
+              }
+
+            }
+
+          }));
+
+    }
+
+    for (auto &thread : threads)
+      thread.join();
+
+    /* Make the final names of the spooled files durable */
+    dirfd = ::open(this->spooldir.string().c_str(), O_RDONLY);
+
+    if (dirfd >= 0) {
+      ::fsync(dirfd);
+      ::close(dirfd);
+    }
+
+  } catch(std::exception &e) {
+    BOOST_LOG_TRIVIAL(warning) << "WAL prefetch failed: " << e.what();
+  }
+
+  if (lockfd >= 0)
+    ::close(lockfd);
+
+}
+
+void WALRestore::startPrefetch(const std::string &filename,
+                               unsigned long long wal_segment_size) {
+
+  pid_t pid;
+
+  if (this->prefetch_segments == 0
+      || this->prefetchWindow(filename, wal_segment_size).empty())
+    return;
+
+  pid = fork();
+
+  if (pid < 0) {
+    BOOST_LOG_TRIVIAL(warning) << "could not fork WAL prefetch process: " << strerror(errno);
+    return;
+  }
+
+  if (pid > 0)
+    return;
+
+  /*
+   * Child: detach from restore_command's session, so PostgreSQL
+   * doesn't wait for us and we survive the parent.
+   */
+  setsid();
+
+  int devnull = ::open("/dev/null", O_RDWR);
+
+  if (devnull >= 0) {
+    dup2(devnull, STDIN_FILENO);
+    dup2(devnull, STDOUT_FILENO);
+    ::close(devnull);
+  }
+
+  this->prefetch(filename, wal_segment_size);
+  _exit(0);
+
+}
+
+WALRangeRestore::WALRangeRestore(std::shared_ptr<ArchiveLogDirectory> logdir,
+                                 path waldir,
+                                 unsigned long long wal_segment_size)
+  : WALRestore(logdir, path()) {
+
+  if (wal_segment_size == 0 || (wal_segment_size % XLOG_BLCKSZ) != 0) {
+    throw CArchiveIssue("cannot restore WAL range: invalid WAL segment size "
+                        + std::to_string(wal_segment_size));
+  }
+
+  this->waldir = waldir;
+  this->wal_segment_size = wal_segment_size;
+
+}
+
+WALRangeRestore::~WALRangeRestore() {
+
+  this->aborted = true;
+
+  for (auto &thread : this->threads) {
+    if (thread.joinable())
+      thread.join();
+  }
+
+}
+
+path WALRangeRestore::walDirectory(path const& target, int pg_version_num) {
+
+  if (pg_version_num > 0 && pg_version_num < 100000)
+    return target / "pg_xlog";
+
+  return target / "pg_wal";
+
+}
+
+void WALRangeRestore::abort() {
+
+  this->aborted = true;
+
+}
+
+bool WALRangeRestore::failed() {
+
+  return this->aborted;
+
+}
+
+unsigned int WALRangeRestore::countRestored() {
+
+  return this->restored;
+
+}
+
+unsigned int WALRangeRestore::countSegments() {
+
+  return this->segments.size();
+
+}
+
+void WALRangeRestore::start(const std::vector<std::string> &segments,
+                            const std::vector<std::string> &history) {
+
+  std::set<std::string> wanted(segments.begin(), segments.end());
+
+  if (this->threads.size() > 0)
+    throw CArchiveIssue("WAL range restore was started already");
+
+  for (auto &filename : history)
+    wal_restore_check_filename(filename);
+
+  for (auto &filename : segments) {
+
+    TimeLineID tli;
+    XLogSegNo segno;
+
+    wal_restore_check_filename(filename);
+
+    if (!xlog::parseWalFileName(filename.c_str(), filename.length(),
+                                tli, segno, this->wal_segment_size)) {
+      throw CArchiveIssue("invalid WAL segment name \"" + filename + "\"");
+    }
+
+  }
+
+  this->segments = segments;
+  this->files = history;
+  this->files.insert(this->files.end(), segments.begin(), segments.end());
+
+  /*
+   * The tar archive creates the directory again later, which
+   * is fine. PostgreSQL wants it accessible by its owner only.
+   */
+  if (::mkdir(this->waldir.string().c_str(), 0700) < 0 && errno != EEXIST) {
+    throw CArchiveIssue("could not create \"" + this->waldir.string() + "\": "
+                        + strerror(errno));
+  }
+
+  /*
+   * Resolve the segments and their checksums through the segment
+   * index. Segments the index doesn't know are looked up by
+   * findFile(), without a checksum to compare.
+   */
+  try {
+
+    std::shared_ptr<ArchiveLogDirectory> dir = this->logDirectory();
+
+    for (auto &entry : dir->segmentIndex(this->wal_segment_size)->getEntries()) {
+
+      std::string name;
+
+      if (entry.status != WAL_SEGMENT_COMPLETE
+          && entry.status != WAL_SEGMENT_COMPLETE_COMPRESSED)
+        continue;
+
+      name = entry.filename.substr(0, xlog::WAL_FILENAME_LEN);
+
+      if (wanted.count(name) == 0)
+        continue;
+
+      this->located.insert(std::make_pair(name, dir->locateXLogFile(entry.filename)));
+
+      if (entry.has_checksum)
+        this->checksums.insert(std::make_pair(name, entry.crc32c));
+
+    }
+
+  } catch(CArchiveIssue &e) {
+    BOOST_LOG_TRIVIAL(warning) << "could not use WAL segment index: " << e.what();
+  }
+
+  BOOST_LOG_TRIVIAL(info) << "restoring " << segments.size() << " WAL segments"
+                          << (segments.size() > 0
+                              ? " " + segments.front() + " - " + segments.back()
+                              : std::string(""))
+                          << " into \"" << this->waldir.string() << "\"";
+
+  for (unsigned int i = 0; i < this->parallelism && i < this->files.size(); i++)
+    this->threads.push_back(std::thread(&WALRangeRestore::worker, this));
+
+}
+
+void WALRangeRestore::worker() {
+
+  size_t idx;
+
+  while (!this->aborted && (idx = this->next++) < this->files.size()) {
+
+    const std::string &filename = this->files[idx];
+
+    try {
+
+      if (idx < this->files.size() - this->segments.size()) {
+
+        path file = this->findFile(filename);
+
+        if (file.empty()) {
+          throw CArchiveIssue("history file " + filename + " not found in archive");
+        }
+
+        this->copyFile(file, this->waldir / filename, true);
+
+      } else {
+        this->restoreSegment(filename);
+      }
+
+    } catch(std::exception &e) {
+
+      std::lock_guard<std::mutex> lock(this->error_mtx);
+
+      /* Only the first error counts, the others follow from the abort */
+      if (!this->aborted)
+        this->error = e.what();
+
+      this->aborted = true;
+      return;
+
+    }
+
+  }
+
+}
+
+void WALRangeRestore::restoreSegment(const std::string &filename) {
+
+  auto checksum = this->checksums.find(filename);
+  auto it = this->located.find(filename);
+  WALPageValidator validator((checksum != this->checksums.end())
+                             ? WAL_VALIDATE_CHECKSUMS : WAL_VALIDATE_HEADERS,
+                             this->wal_segment_size);
+  path target = this->waldir / filename;
+  TimeLineID tli;
+  XLogSegNo segno;
+  XLogRecPtr segment_start;
+  XLogRecPtr pos;
+  path file;
+
+  xlog::parseWalFileName(filename.c_str(), filename.length(),
+                         tli, segno, this->wal_segment_size);
+
+  segment_start = xlog::segmentStart(segno, this->wal_segment_size);
+  pos = segment_start;
+
+  validator.startSegment(segment_start);
+
+  file = (it != this->located.end() && exists(it->second)) ? it->second : this->findFile(filename);
+
+  if (file.empty()) {
+    throw CArchiveIssue("WAL segment " + filename + " not found in archive");
+  }
+
+  this->copyFile(file, target, true, [&](const char *buf, size_t len) {
+
+      if (this->aborted)
+        throw CArchiveIssue("WAL restore aborted");
+
+      if (pos - segment_start + len > this->wal_segment_size) {
+        throw CArchiveIssue("WAL segment " + filename + " in archive exceeds the WAL segment size");
+      }
+
+      validator.validate(pos, buf, len, tli);
+      pos += len;
+
+    });
+
+  if (pos - segment_start != this->wal_segment_size) {
+    remove(target);
+    throw CArchiveIssue("WAL segment " + filename + " in archive is truncated");
+  }
+
+  if (checksum != this->checksums.end()
+      && validator.segmentChecksum() != checksum->second) {
+
+    std::ostringstream oss;
+
+    remove(target);
+    oss << "checksum mismatch in WAL segment " << filename
+        << ": expected " << std::hex << checksum->second
+        << ", got " << validator.segmentChecksum();
+    throw CArchiveIssue(oss.str());
+
+  }
+
+  this->restored++;
+  BOOST_LOG_TRIVIAL(debug) << "restored " << filename << " from " << file.string();
+
+}
+
+void WALRangeRestore::verify() {
+
+  TimeLineID last_tli = 0;
+  XLogSegNo last_segno = 0;
+  int dirfd;
+
+  /*
+   * The page headers proved every segment holds the XLOG its name
+   * says, so it's left to check there's no gap between them and
+   * recovery never goes back to an older timeline.
+   */
+  for (size_t i = 0; i < this->segments.size(); i++) {
+
+    const std::string &filename = this->segments[i];
+    TimeLineID tli;
+    XLogSegNo segno;
+    path file = this->waldir / filename;
+
+    xlog::parseWalFileName(filename.c_str(), filename.length(),
+                           tli, segno, this->wal_segment_size);
+
+    if (i > 0 && segno != last_segno + 1) {
+      throw CArchiveIssue("WAL range has a gap between segments "
+                          + this->segments[i - 1] + " and " + filename);
+    }
+
+    if (tli < last_tli) {
+      throw CArchiveIssue("WAL segment " + filename + " goes back to timeline "
+                          + std::to_string(tli) + " from timeline "
+                          + std::to_string(last_tli));
+    }
+
+    if (!exists(file) || file_size(file) != this->wal_segment_size) {
+      throw CArchiveIssue("WAL segment \"" + file.string() + "\" is missing or incomplete");
+    }
+
+    last_tli = tli;
+    last_segno = segno;
+
+  }
+
+  /* Make the final names durable */
+  dirfd = ::open(this->waldir.string().c_str(), O_RDONLY);
+
+  if (dirfd >= 0) {
+    ::fsync(dirfd);
+    ::close(dirfd);
+  }
+
+}
+
+void WALRangeRestore::wait() {
+
+  for (auto &thread : this->threads) {
+    if (thread.joinable())
+      thread.join();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(this->error_mtx);
+
+    if (this->aborted) {
+      throw CArchiveIssue("could not restore WAL: "
+                          + ((this->error.length() > 0) ? this->error : std::string("aborted")));
+    }
+  }
+
+  this->verify();
+
+  BOOST_LOG_TRIVIAL(info) << "restored " << this->restored << " WAL segments into \""
+                          << this->waldir.string() << "\"";
+
+}
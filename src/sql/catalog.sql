@@ -33,12 +33,16 @@ CREATE TABLE backup(
        wal_segment_size int not null,
        used_profile int not null,
        pg_version_num int not null,
+       parent_id integer null,
+       compress_type integer not null default 0,
        FOREIGN KEY(archive_id) REFERENCES archive(id) ON DELETE CASCADE,
+       FOREIGN KEY(parent_id) REFERENCES backup(id),
        FOREIGN KEY(used_profile) REFERENCES backup_profiles(id) ON DELETE RESTRICT ON UPDATE RESTRICT
 );
 
 CREATE INDEX backup_id_idx ON backup(id);
 CREATE INDEX backup_archive_id_idx ON backup(archive_id);
+CREATE INDEX backup_parent_id_idx ON backup(parent_id);
 
 CREATE TABLE backup_tablespaces(
        backup_id integer not null,
@@ -49,6 +53,117 @@ CREATE TABLE backup_tablespaces(
        FOREIGN KEY(backup_id) REFERENCES backup(id) ON DELETE CASCADE
 );
 
+/*
+ * Materialised size statistics of archives and basebackups, maintained
+ * by streamers, basebackups and retention, see BackupCatalog::getArchiveStats().
+ */
+CREATE TABLE archive_stats(
+       archive_id integer not null primary key,
+       wal_bytes bigint not null default 0,
+       wal_segments integer not null default 0,
+       oldest_xlogpos text null,
+       newest_xlogpos text null,
+       backup_bytes bigint not null default 0,
+       updated text not null,
+       FOREIGN KEY(archive_id) REFERENCES archive(id) ON DELETE CASCADE
+);
+
+CREATE TABLE backup_stats(
+       backup_id integer not null primary key,
+       size bigint not null default 0,
+       updated text not null,
+       FOREIGN KEY(backup_id) REFERENCES backup(id) ON DELETE CASCADE
+);
+
+/*
+ * Basebackups and verifications started by the launcher on its own,
+ * see JobScheduler. interval and jitter are in seconds, next_run and
+ * last_run are local timestamps like every other timestamp in the catalog.
+ */
+CREATE TABLE schedule(
+       id integer not null primary key,
+       archive_id integer not null,
+       type text not null CHECK(type IN ('basebackup', 'verify')),
+       profile text null,
+       interval integer not null CHECK(interval > 0),
+       jitter integer not null default 0 CHECK(jitter >= 0),
+       priority integer not null default 0,
+       next_run text null,
+       last_run text null,
+       created text not null,
+       FOREIGN KEY(archive_id) REFERENCES archive(id) ON DELETE CASCADE
+);
+
+CREATE UNIQUE INDEX schedule_archive_id_type_idx ON schedule(archive_id, type);
+
+/*
+ * Object storage an archive is uploaded to and the finished WAL segments
+ * and basebackup files queued for upload, see ObjectUploader. Only files
+ * with status 'uploaded' may be removed by retention. part_size is
+ * in bytes, max_rate in kilobytes per second.
+ */
+CREATE TABLE archive_storage(
+       archive_id integer not null primary key,
+       endpoint text not null,
+       bucket text not null,
+       prefix text not null default '',
+       region text not null,
+       parallel integer not null default 4 CHECK(parallel BETWEEN 1 AND 64),
+       part_size bigint not null CHECK(part_size >= 5242880),
+       max_rate integer not null default 0 CHECK(max_rate >= 0),
+       created text not null,
+       FOREIGN KEY(archive_id) REFERENCES archive(id) ON DELETE CASCADE
+);
+
+CREATE TABLE upload(
+       id integer not null primary key,
+       archive_id integer not null,
+       kind text not null CHECK(kind IN ('wal', 'basebackup')),
+       backup_id integer null,
+       path text not null,
+       object_key text not null,
+       size bigint not null default 0,
+       status text not null default 'pending'
+              CHECK(status IN ('pending', 'uploading', 'uploaded', 'failed')),
+       upload_id text null,
+       attempts integer not null default 0,
+       last_error text null,
+       queued text not null,
+       updated text not null,
+       FOREIGN KEY(archive_id) REFERENCES archive(id) ON DELETE CASCADE,
+       FOREIGN KEY(backup_id) REFERENCES backup(id) ON DELETE CASCADE
+);
+
+CREATE UNIQUE INDEX upload_archive_id_path_idx ON upload(archive_id, path);
+CREATE INDEX upload_archive_id_status_idx ON upload(archive_id, status);
+
+/*
+ * Cold tier of an archive, a directory on slower storage. Retention
+ * rules with a MOVE action migrate basebackups there, the fsentry of
+ * a migrated basebackup points into it. Migrated WAL segments are
+ * replaced by symlinks within the log directory of the archive.
+ */
+CREATE TABLE archive_tier(
+       archive_id integer not null primary key,
+       directory text not null,
+       created text not null,
+       FOREIGN KEY(archive_id) REFERENCES archive(id) ON DELETE CASCADE
+);
+
+/*
+ * Chunks of deduplicated basebackups in the chunk store of an
+ * archive, see DedupChunkStore. refcount is the number of ready
+ * basebackups referencing a chunk. Chunks with a refcount of 0 are
+ * removed by the next sweep of the chunk store.
+ */
+CREATE TABLE dedup_chunk(
+       archive_id integer not null,
+       id text not null,
+       refcount integer not null default 0 CHECK(refcount >= 0),
+       PRIMARY KEY(archive_id, id),
+       FOREIGN KEY(archive_id) REFERENCES archive(id) ON DELETE CASCADE
+);
+
 CREATE TABLE stream(
        id integer primary key not null,
        archive_id integer not null,
@@ -71,7 +186,7 @@ CREATE TABLE version(
        create_date text not null);
 
 /* NOTE: version number must match CATALOG_MAGIC from include/catalog/catalog.hxx */
-INSERT INTO version VALUES(108, datetime('now'));
+INSERT INTO version VALUES(118, datetime('now'));
 
 CREATE TABLE backup_profiles(
        id integer not null,
@@ -85,6 +200,13 @@ CREATE TABLE backup_profiles(
        noverify_checksums integer not null default false,
        manifest boolean not null default false,
        manifest_checksums text not null default 'CRC32C',
+       compress_level integer not null default 0 CHECK(compress_level >= 0),
+       compress_workers integer not null default 0 CHECK(compress_workers >= 0),
+       parallel_writers integer not null default 0 CHECK(parallel_writers BETWEEN 0 AND 64),
+       incremental boolean not null default false,
+       server_compression boolean not null default false,
+       adaptive_rate boolean not null default false,
+       deduplicate boolean not null default false,
        PRIMARY KEY(id)
 );
 
@@ -1,7 +1,17 @@
 #define BOOST_TEST_MODULE TestBackupCatalog
+#include <fstream>
 #include <boost/test/unit_test.hpp>
 #include <common.hxx>
 #include <BackupCatalog.hxx>
+#include <catalogqueue.hxx>
+#include <retentionplan.hxx>
+#include <restoreplan.hxx>
+#include <workerpool.hxx>
+#include <scheduler.hxx>
+#include <metrics.hxx>
+#include <proto-catalog.hxx>
+#include <output.hxx>
+#include <boost/property_tree/json_parser.hpp>
 
 using namespace pgbckctl;
 
@@ -125,3 +135,1253 @@ BOOST_AUTO_TEST_CASE(TestBackupCatalogCreateArchive)
   BOOST_TEST( !catalog->available() );
 
 }
+
+BOOST_AUTO_TEST_CASE(TestBackupCatalogNestedTransactions)
+{
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+  std::shared_ptr<CatalogDescr> check_desc = nullptr;
+
+  auto create = [&catalog](std::string name) {
+    std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+    desc->archive_name = name;
+    desc->directory = "/tmp/" + name;
+    desc->compression = false;
+    desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+    catalog->createArchive(desc);
+  };
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+  BOOST_TEST( !catalog->inTransaction() );
+
+  /* 1 Outer transaction */
+  BOOST_REQUIRE_NO_THROW( catalog->startTransaction() );
+  BOOST_TEST( catalog->inTransaction() );
+  BOOST_REQUIRE_NO_THROW( create("nested_outer") );
+
+  /* 2 Inner transaction rolled back, keeps the outer one */
+  BOOST_REQUIRE_NO_THROW( catalog->startTransaction() );
+  BOOST_REQUIRE_NO_THROW( create("nested_inner") );
+  BOOST_REQUIRE_NO_THROW( catalog->rollbackTransaction() );
+  BOOST_TEST( catalog->inTransaction() );
+
+  BOOST_REQUIRE_NO_THROW( check_desc = catalog->existsByName("nested_inner") );
+  BOOST_TEST( check_desc->id == -1 );
+  BOOST_REQUIRE_NO_THROW( check_desc = catalog->existsByName("nested_outer") );
+  BOOST_TEST( check_desc->id > -1 );
+
+  /* 3 Inner transaction committed, becomes part of the outer one */
+  BOOST_REQUIRE_NO_THROW( catalog->startTransaction() );
+  BOOST_REQUIRE_NO_THROW( create("nested_inner") );
+  BOOST_REQUIRE_NO_THROW( catalog->commitTransaction() );
+  BOOST_TEST( catalog->inTransaction() );
+
+  /* 4 A kept open catalog isn't closed, but can be closed afterwards */
+  catalog->setKeepOpen(true);
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+  BOOST_TEST( catalog->available() );
+  BOOST_TEST( catalog->inTransaction() );
+
+  /* 5 Rolling back the outer transaction discards both archives */
+  BOOST_REQUIRE_NO_THROW( catalog->rollbackTransaction() );
+  BOOST_TEST( !catalog->inTransaction() );
+
+  BOOST_REQUIRE_NO_THROW( check_desc = catalog->existsByName("nested_outer") );
+  BOOST_TEST( check_desc->id == -1 );
+  BOOST_REQUIRE_NO_THROW( check_desc = catalog->existsByName("nested_inner") );
+  BOOST_TEST( check_desc->id == -1 );
+
+  catalog->setKeepOpen(false);
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+  BOOST_TEST( !catalog->available() );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestStreamingOutput)
+{
+
+  namespace pt = boost::property_tree;
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+  std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+  std::shared_ptr<OutputFormatConfiguration> config
+    = std::make_shared<OutputFormatConfiguration>();
+  std::shared_ptr<OutputFormatter> formatter = nullptr;
+  std::vector<shm_stream_stats> streams(3);
+  BaseBackupListFilter filter;
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+
+  desc->archive_name = "output_test";
+  desc->directory = "/tmp/output_test";
+  desc->compression = false;
+  desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+  BOOST_REQUIRE_NO_THROW( catalog->startTransaction() );
+  BOOST_REQUIRE_NO_THROW( catalog->createArchive(desc) );
+  BOOST_REQUIRE_NO_THROW( desc = catalog->existsByName("output_test") );
+
+  config->create("list_backups.verbose", false, false);
+
+  for (unsigned int i = 0; i < streams.size(); i++) {
+    streams[i].pid = 100 + i;
+    streams[i].archive_id = i;
+  }
+
+  /* 1 Streamed JSON listing is a single valid document */
+  {
+    std::ostringstream output;
+    pt::ptree doc;
+
+    BOOST_REQUIRE_NO_THROW( formatter = OutputFormatter::formatter(config, catalog, desc,
+                                                                   OUTPUT_JSON) );
+
+    BOOST_REQUIRE_NO_THROW( formatter->nodeAs(streams, output) );
+    std::istringstream input(output.str());
+    BOOST_REQUIRE_NO_THROW( pt::read_json(input, doc) );
+    BOOST_TEST( doc.get<std::string>("number of streams") == "3" );
+    BOOST_TEST( doc.get_child("streams").size() == 3 );
+    BOOST_TEST( doc.get_child("streams").back().second.get<int>("worker pid") == 102 );
+  }
+
+  /* 2 Empty basebackup listing from a cursor */
+  {
+    std::ostringstream output;
+    pt::ptree doc;
+
+    filter.archive_id = desc->id;
+
+    BOOST_REQUIRE_NO_THROW( formatter->streamAs(catalog->openBackupCursor(filter), output) );
+    std::istringstream input(output.str());
+    BOOST_REQUIRE_NO_THROW( pt::read_json(input, doc) );
+    BOOST_TEST( doc.get<std::string>("num_basebackups") == "0" );
+  }
+
+  /* 3 ndjson prints one document per row */
+  {
+    std::ostringstream output;
+    std::string line;
+    unsigned int lines = 0;
+
+    BOOST_REQUIRE_NO_THROW( formatter = OutputFormatter::formatter(config, catalog, desc,
+                                                                   OUTPUT_JSON_LINES) );
+    BOOST_REQUIRE_NO_THROW( formatter->nodeAs(streams, output) );
+
+    std::istringstream input(output.str());
+
+    while (std::getline(input, line)) {
+      pt::ptree doc;
+      std::istringstream row(line);
+
+      BOOST_REQUIRE_NO_THROW( pt::read_json(row, doc) );
+      BOOST_TEST( doc.get<int>("worker pid") == (int) (100 + lines) );
+      lines++;
+    }
+
+    BOOST_TEST( lines == 3 );
+  }
+
+  BOOST_REQUIRE_NO_THROW( catalog->rollbackTransaction() );
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestBackupCatalogStatementCache)
+{
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+  std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+  std::shared_ptr<CatalogDescr> check_desc;
+  std::vector<std::shared_ptr<StreamIdentification>> streams;
+  std::vector<int> statusCols = { SQL_STREAM_STATUS_ATTNO };
+  std::vector<int> positionCols = { SQL_STREAM_XLOGPOS_ATTNO, SQL_STREAM_STATUS_ATTNO };
+  StreamIdentification ident;
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+
+  /* 1 Nothing cached after opening the catalog */
+  BOOST_TEST( catalog->statementCacheSize() == (size_t) 0 );
+
+  BOOST_REQUIRE_NO_THROW( catalog->startTransaction() );
+
+  desc->archive_name = "stmtcache";
+  desc->directory = "/tmp";
+  desc->compression = false;
+  desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+  BOOST_REQUIRE_NO_THROW( catalog->createArchive(desc) );
+  BOOST_REQUIRE_NO_THROW( check_desc = catalog->existsByName("stmtcache") );
+  BOOST_REQUIRE( check_desc->id > -1 );
+
+  ident.systemid = "6000000000000000001";
+  ident.timeline = 1;
+  ident.xlogpos  = "0/1000000";
+  ident.dbname   = "";
+  BOOST_REQUIRE_NO_THROW( catalog->registerStream(check_desc->id, "walstreamer", ident) );
+
+  /* 2 Repeated updates with the same attributes prepare only once */
+  for (unsigned int i = 0; i < 3; i++) {
+    ident.status = StreamIdentification::STREAM_PROGRESS_STREAMING;
+    BOOST_REQUIRE_NO_THROW( catalog->updateStream(ident.id, statusCols, ident) );
+  }
+
+  BOOST_TEST( catalog->statementCacheSize() == (size_t) 1 );
+  BOOST_TEST( catalog->statementCacheMisses() == (unsigned long long) 1 );
+  BOOST_TEST( catalog->statementCacheHits() == (unsigned long long) 2 );
+
+  /* 3 Another attribute list is a different statement */
+  ident.xlogpos = "0/2000000";
+  ident.status = StreamIdentification::STREAM_PROGRESS_SHUTDOWN;
+  BOOST_REQUIRE_NO_THROW( catalog->updateStream(ident.id, positionCols, ident) );
+  BOOST_TEST( catalog->statementCacheSize() == (size_t) 2 );
+
+  /* 4 Reused statements must have applied their values */
+  BOOST_REQUIRE_NO_THROW( catalog->getStreams("stmtcache", streams) );
+  BOOST_REQUIRE( streams.size() == (size_t) 1 );
+  BOOST_CHECK_EQUAL( streams[0]->xlogpos, "0/2000000" );
+  BOOST_CHECK_EQUAL( streams[0]->status, std::string(StreamIdentification::STREAM_PROGRESS_SHUTDOWN) );
+
+  /* 5 Cached SELECTs don't hold on to their results */
+  BOOST_TEST( catalog->getProc(check_desc->id, "launcher")->pid < 0 );
+  BOOST_TEST( catalog->getProc(check_desc->id, "launcher")->pid < 0 );
+  BOOST_TEST( catalog->statementCacheSize() == (size_t) 3 );
+
+  BOOST_REQUIRE_NO_THROW( catalog->dropArchive("stmtcache") );
+  BOOST_REQUIRE_NO_THROW( catalog->commitTransaction() );
+
+  /* 6 Invalidation finalizes everything */
+  catalog->clearStatementCache();
+  BOOST_TEST( catalog->statementCacheSize() == (size_t) 0 );
+
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestBackupCatalogConcurrency)
+{
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+
+  /* 1 Defaults */
+  BOOST_CHECK_EQUAL( catalog->getSynchronous(), "NORMAL" );
+  BOOST_TEST( catalog->getBusyTimeout() == (unsigned int) CATALOG_BUSY_TIMEOUT_MS );
+
+  /* 2 Synchronous levels are validated and applied to the open catalog */
+  BOOST_REQUIRE_NO_THROW( catalog->setSynchronous("full") );
+  BOOST_CHECK_EQUAL( catalog->getSynchronous(), "FULL" );
+  BOOST_CHECK_THROW( catalog->setSynchronous("sometimes"), CCatalogIssue );
+  BOOST_CHECK_EQUAL( catalog->getSynchronous(), "FULL" );
+  BOOST_REQUIRE_NO_THROW( catalog->setSynchronous("NORMAL") );
+
+  /* 3 Busy timeout */
+  catalog->setBusyTimeout(500);
+  BOOST_TEST( catalog->getBusyTimeout() == (unsigned int) 500 );
+  BOOST_TEST( catalog->busyRetries() == (unsigned long long) 0 );
+
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestCatalogStatusQueue)
+{
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+  std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+  std::shared_ptr<CatalogDescr> check_desc;
+  std::vector<std::shared_ptr<StreamIdentification>> streams;
+  StreamIdentification ident;
+  std::string queue_name = "test_catalog_status_queue";
+
+  CatalogStatusQueue::remove(queue_name);
+
+  CatalogStatusQueue launcher(queue_name);
+  CatalogStatusQueue worker(queue_name);
+
+  /* 1 Workers can't attach without a launcher */
+  BOOST_TEST( !worker.attach() );
+  BOOST_TEST( !worker.send(ident) );
+
+  BOOST_REQUIRE_NO_THROW( launcher.create() );
+  BOOST_REQUIRE( worker.attach() );
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+
+  BOOST_REQUIRE_NO_THROW( catalog->startTransaction() );
+
+  desc->archive_name = "statusqueue";
+  desc->directory = "/tmp";
+  desc->compression = false;
+  desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+  BOOST_REQUIRE_NO_THROW( catalog->createArchive(desc) );
+  BOOST_REQUIRE_NO_THROW( check_desc = catalog->existsByName("statusqueue") );
+
+  ident.systemid = "6000000000000000001";
+  ident.timeline = 1;
+  ident.xlogpos  = "0/1000000";
+  ident.dbname   = "";
+  BOOST_REQUIRE_NO_THROW( catalog->registerStream(check_desc->id, "walstreamer", ident) );
+  BOOST_REQUIRE_NO_THROW( catalog->commitTransaction() );
+
+  /* 2 Updates of the same stream are coalesced, the latest wins */
+  ident.status = StreamIdentification::STREAM_PROGRESS_IDENTIFIED;
+  BOOST_TEST( worker.send(ident) );
+
+  ident.timeline = 2;
+  ident.xlogpos = "0/3000000";
+  ident.status = StreamIdentification::STREAM_PROGRESS_STREAMING;
+  BOOST_TEST( worker.send(ident) );
+
+  BOOST_TEST( launcher.receive() == (size_t) 2 );
+  BOOST_TEST( launcher.pendingUpdates() == (size_t) 1 );
+
+  /* 3 Nothing is due before the flush interval elapsed */
+  launcher.setFlushInterval(60000);
+  BOOST_TEST( !launcher.flushDue() );
+  BOOST_TEST( launcher.msUntilFlush() > (unsigned int) 0 );
+  BOOST_TEST( launcher.msUntilFlush() <= (unsigned int) 60000 );
+
+  launcher.setFlushInterval(0);
+  BOOST_TEST( launcher.flushDue() );
+  BOOST_TEST( launcher.msUntilFlush() == (unsigned int) 0 );
+
+  /* 4 Flushing writes the updates into the catalog */
+  BOOST_TEST( launcher.flush(catalog) == (size_t) 1 );
+  BOOST_TEST( launcher.pendingUpdates() == (size_t) 0 );
+  BOOST_TEST( !launcher.flushDue() );
+
+  /* 5 Without pending updates, the launcher waits a whole interval */
+  launcher.setFlushInterval(100);
+  BOOST_TEST( launcher.msUntilFlush() == (unsigned int) 100 );
+
+  BOOST_REQUIRE_NO_THROW( catalog->getStreams("statusqueue", streams) );
+  BOOST_REQUIRE( streams.size() == (size_t) 1 );
+  BOOST_CHECK_EQUAL( streams[0]->xlogpos, "0/3000000" );
+  BOOST_TEST( streams[0]->timeline == (unsigned int) 2 );
+  BOOST_CHECK_EQUAL( streams[0]->status, std::string(StreamIdentification::STREAM_PROGRESS_STREAMING) );
+
+  /*
+   * 6 A shutdown status queued after a STREAMING update still
+   *   pending wins, as when the launcher flushes after its workers exited
+   */
+  ident.xlogpos = "0/4000000";
+  ident.status = StreamIdentification::STREAM_PROGRESS_STREAMING;
+  BOOST_TEST( worker.send(ident) );
+  BOOST_TEST( launcher.receive() == (size_t) 1 );
+
+  ident.xlogpos = "0/5000000";
+  ident.status = StreamIdentification::STREAM_PROGRESS_SHUTDOWN;
+  BOOST_TEST( worker.send(ident) );
+  BOOST_TEST( launcher.receive() == (size_t) 1 );
+  BOOST_TEST( launcher.flush(catalog) == (size_t) 1 );
+
+  streams.clear();
+  BOOST_REQUIRE_NO_THROW( catalog->getStreams("statusqueue", streams) );
+  BOOST_REQUIRE( streams.size() == (size_t) 1 );
+  BOOST_CHECK_EQUAL( streams[0]->xlogpos, "0/5000000" );
+  BOOST_CHECK_EQUAL( streams[0]->status, std::string(StreamIdentification::STREAM_PROGRESS_SHUTDOWN) );
+
+  /* 7 Oversized values can't be queued */
+  ident.status = std::string(CATALOG_STATUS_MSG_FIELD_LEN, 'x');
+  BOOST_TEST( !worker.send(ident) );
+
+  BOOST_REQUIRE_NO_THROW( catalog->startTransaction() );
+  BOOST_REQUIRE_NO_THROW( catalog->dropArchive("statusqueue") );
+  BOOST_REQUIRE_NO_THROW( catalog->commitTransaction() );
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+
+  CatalogStatusQueue::remove(queue_name);
+
+}
+
+BOOST_AUTO_TEST_CASE(TestWorkerPool)
+{
+
+  std::string catalog_name = "test_worker_pool";
+  std::string command;
+
+  WorkerPool::remove(catalog_name);
+
+  WorkerPool launcher(catalog_name, 2);
+  WorkerPool worker(catalog_name, 0);
+
+  /* 1 Pool workers can't attach without a launcher */
+  BOOST_CHECK_THROW( worker.attach(), CPGBackupCtlFailure );
+
+  BOOST_REQUIRE_NO_THROW( launcher.create() );
+  BOOST_REQUIRE_NO_THROW( worker.attach() );
+  BOOST_TEST( launcher.missing() == (unsigned int) 2 );
+
+  /*
+   * 2 A spawned worker isn't available before it reported
+   * itself idle. This process plays the pool worker.
+   */
+  launcher.spawned(::getpid());
+  BOOST_TEST( launcher.missing() == (unsigned int) 1 );
+  BOOST_TEST( launcher.available() == (unsigned int) 0 );
+  BOOST_TEST( !launcher.dispatch("APPLY RETENTION POLICY test TO ARCHIVE test") );
+
+  BOOST_REQUIRE_NO_THROW( worker.report(POOL_WORKER_IDLE) );
+  BOOST_TEST( launcher.receive() == (size_t) 1 );
+  BOOST_TEST( launcher.available() == (unsigned int) 1 );
+
+  /* 3 Commands which don't terminate on their own are never pooled */
+  BOOST_TEST( !WorkerPool::poolable("start streaming for archive test NODETACH") );
+  BOOST_TEST( !WorkerPool::poolable(" START RECOVERY STREAM FOR ARCHIVE test PORT 7000") );
+  BOOST_TEST( !launcher.dispatch("START STREAMING FOR ARCHIVE test NODETACH") );
+
+  /* 4 A dispatched job is promised to the idle worker */
+  BOOST_TEST( launcher.dispatch("APPLY RETENTION POLICY test TO ARCHIVE test") );
+  BOOST_TEST( launcher.available() == (unsigned int) 0 );
+  BOOST_TEST( !launcher.dispatch("APPLY RETENTION POLICY test TO ARCHIVE test") );
+
+  BOOST_TEST( worker.take(command, 100) );
+  BOOST_CHECK_EQUAL( command, "APPLY RETENTION POLICY test TO ARCHIVE test" );
+  BOOST_TEST( !worker.take(command, 10) );
+
+  BOOST_REQUIRE_NO_THROW( worker.report(POOL_WORKER_BUSY) );
+  BOOST_TEST( launcher.receive() == (size_t) 1 );
+  BOOST_TEST( launcher.available() == (unsigned int) 0 );
+
+  BOOST_REQUIRE_NO_THROW( worker.report(POOL_WORKER_IDLE) );
+  BOOST_TEST( launcher.receive() == (size_t) 1 );
+  BOOST_TEST( launcher.available() == (unsigned int) 1 );
+
+  /* 5 A worker exiting right after startup delays its replacement */
+  BOOST_TEST( launcher.exited(::getpid()) );
+  BOOST_TEST( !launcher.exited(::getpid()) );
+  BOOST_TEST( launcher.getNumberOfWorkers() == (unsigned int) 0 );
+  BOOST_TEST( launcher.missing() == (unsigned int) 0 );
+
+  /* 6 Pool size is limited */
+  BOOST_CHECK_THROW( WorkerPool(catalog_name, WorkerPool::MAX_SIZE + 1), CPGBackupCtlFailure );
+
+  WorkerPool::remove(catalog_name);
+
+}
+
+BOOST_AUTO_TEST_CASE(TestBackupCatalogBackupCursor)
+{
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+  std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+  std::shared_ptr<CatalogDescr> check_desc;
+  std::shared_ptr<BackupProfileDescr> profile;
+  std::shared_ptr<BaseBackupCursor> cursor;
+  std::shared_ptr<BaseBackupDescr> bbdescr;
+  std::vector<std::shared_ptr<BaseBackupDescr>> list;
+  std::vector<int> ids;
+  BaseBackupListFilter filter;
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+
+  BOOST_REQUIRE_NO_THROW( catalog->startTransaction() );
+
+  desc->archive_name = "cursor";
+  desc->directory = "/tmp";
+  desc->compression = false;
+  desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+  BOOST_REQUIRE_NO_THROW( catalog->createArchive(desc) );
+  BOOST_REQUIRE_NO_THROW( check_desc = catalog->existsByName("cursor") );
+  BOOST_REQUIRE_NO_THROW( profile = catalog->getBackupProfile("default") );
+
+  /* Four basebackups, the second one with two tablespaces */
+  for (int i = 1; i <= 4; i++) {
+
+    std::shared_ptr<BaseBackupDescr> backup = std::make_shared<BaseBackupDescr>();
+
+    backup->archive_id = check_desc->id;
+    backup->xlogpos = "0/" + std::to_string(i) + "000000";
+    backup->timeline = 1;
+    backup->label = "cursor test";
+    backup->fsentry = "/tmp/cursor/backup" + std::to_string(i);
+    backup->started = "2024-01-0" + std::to_string(i) + " 10:00:00";
+    backup->systemid = "6000000000000000001";
+    backup->wal_segment_size = 16777216;
+    backup->used_profile = profile->profile_id;
+    backup->pg_version_num = 160000;
+
+    BOOST_REQUIRE_NO_THROW( catalog->registerBasebackup(check_desc->id, backup) );
+    ids.push_back(backup->id);
+
+    if (i == 2) {
+
+      for (unsigned int spcoid = 16400; spcoid <= 16401; spcoid++) {
+
+        std::shared_ptr<BackupTablespaceDescr> tblspc = std::make_shared<BackupTablespaceDescr>();
+
+        tblspc->backup_id = backup->id;
+        tblspc->spcoid = spcoid;
+        tblspc->spclocation = "/tmp/spc" + std::to_string(spcoid);
+        tblspc->spcsize = 1024;
+
+        BOOST_REQUIRE_NO_THROW( catalog->registerTablespaceForBackup(tblspc) );
+
+      }
+
+    }
+
+    if (i % 2 == 1) {
+      backup->xlogposend = "0/" + std::to_string(i) + "800000";
+      BOOST_REQUIRE_NO_THROW( catalog->finalizeBasebackup(backup) );
+    }
+
+  }
+
+  /* 1 Default ordering is newest first, tablespaces are grouped */
+  filter.archive_name = "cursor";
+  BOOST_REQUIRE_NO_THROW( cursor = catalog->openBackupCursor(filter) );
+
+  while (cursor->next(bbdescr))
+    list.push_back(bbdescr);
+
+  BOOST_REQUIRE( list.size() == (size_t) 4 );
+  BOOST_TEST( list[0]->id == ids[3] );
+  BOOST_TEST( list[3]->id == ids[0] );
+  BOOST_TEST( list[2]->tablespaces.size() == (size_t) 2 );
+  BOOST_TEST( list[2]->tablespaces[0]->spcoid == (unsigned int) 16400 );
+  BOOST_TEST( list[1]->tablespaces.size() == (size_t) 0 );
+
+  /* 2 An exhausted cursor stays exhausted */
+  BOOST_TEST( !cursor->next(bbdescr) );
+
+  /* 3 getBackupList() returns the same */
+  BOOST_REQUIRE_NO_THROW( list = catalog->getBackupList("cursor") );
+  BOOST_REQUIRE( list.size() == (size_t) 4 );
+  BOOST_TEST( list[2]->tablespaces.size() == (size_t) 2 );
+
+  /*
+   * 4 LIMIT and OFFSET count basebackups, not joined rows. Skipping
+   * the oldest one makes the second basebackup the first row
+   */
+  list.clear();
+  filter.archive_name = "";
+  filter.archive_id = check_desc->id;
+  filter.order = BASEBACKUP_LIST_STARTED_ASC;
+  filter.offset = 1;
+  filter.limit = 2;
+  BOOST_REQUIRE_NO_THROW( cursor = catalog->openBackupCursor(filter) );
+
+  while (cursor->next(bbdescr))
+    list.push_back(bbdescr);
+
+  BOOST_REQUIRE( list.size() == (size_t) 2 );
+  BOOST_TEST( list[0]->id == ids[1] );
+  BOOST_TEST( list[0]->tablespaces.size() == (size_t) 2 );
+  BOOST_TEST( list[1]->id == ids[2] );
+
+  /* 5 Only ready basebackups */
+  list.clear();
+  filter.offset = 0;
+  filter.limit = 0;
+  filter.valid_only = true;
+  BOOST_REQUIRE_NO_THROW( cursor = catalog->openBackupCursor(filter) );
+
+  while (cursor->next(bbdescr))
+    list.push_back(bbdescr);
+
+  BOOST_REQUIRE( list.size() == (size_t) 2 );
+  BOOST_TEST( list[0]->id == ids[0] );
+  BOOST_TEST( list[1]->id == ids[2] );
+
+  /* 6 Single basebackup lookups */
+  BOOST_TEST( catalog->getBaseBackup(ids[1], check_desc->id)->tablespaces.size() == (size_t) 2 );
+  BOOST_TEST( catalog->getBaseBackup("/tmp/cursor/backup3", check_desc->id)->id == ids[2] );
+  BOOST_TEST( catalog->getBaseBackup(-2, check_desc->id)->id < 0 );
+  BOOST_TEST( catalog->getBaseBackup(BASEBACKUP_OLDEST, check_desc->id, true)->id == ids[0] );
+  BOOST_TEST( catalog->getBaseBackup(BASEBACKUP_NEWEST, check_desc->id, true)->id == ids[2] );
+
+  BOOST_REQUIRE_NO_THROW( catalog->dropArchive("cursor") );
+  BOOST_REQUIRE_NO_THROW( catalog->commitTransaction() );
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestArchiveStats)
+{
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+  std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+  std::shared_ptr<CatalogDescr> check_desc;
+  std::shared_ptr<BackupProfileDescr> profile;
+  std::shared_ptr<ArchiveStatsDescr> stats;
+  std::shared_ptr<StatCatalogArchive> stat;
+  std::shared_ptr<BaseBackupDescr> backup = std::make_shared<BaseBackupDescr>();
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+
+  BOOST_REQUIRE_NO_THROW( catalog->startTransaction() );
+
+  desc->archive_name = "stats";
+  desc->directory = "/tmp";
+  desc->compression = false;
+  desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+  BOOST_REQUIRE_NO_THROW( catalog->createArchive(desc) );
+  BOOST_REQUIRE_NO_THROW( check_desc = catalog->existsByName("stats") );
+  BOOST_REQUIRE_NO_THROW( profile = catalog->getBackupProfile("default") );
+
+  /* STAT ARCHIVE needs the basebackup connection of the archive */
+  check_desc->coninfo->pushAffectedAttribute(SQL_CON_DSN_ATTNO);
+  check_desc->coninfo->pushAffectedAttribute(SQL_CON_ARCHIVE_ID_ATTNO);
+  check_desc->coninfo->pushAffectedAttribute(SQL_CON_TYPE_ATTNO);
+  check_desc->coninfo->dsn = "host=stats.server.name dbname=foo user=test";
+  check_desc->coninfo->archive_id = check_desc->id;
+  check_desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+  BOOST_REQUIRE_NO_THROW( catalog->createCatalogConnection(check_desc->coninfo) );
+
+  /* 1 No statistics yet */
+  BOOST_REQUIRE_NO_THROW( stats = catalog->getArchiveStats(check_desc->id) );
+  BOOST_TEST( stats->archive_id < 0 );
+
+  /* 2 Completed segments accumulate, the oldest position is kept */
+  BOOST_REQUIRE_NO_THROW( catalog->updateArchiveWALStats(check_desc->id, 1000, 1,
+                                                         "0/1000000", "0/2000000") );
+  BOOST_REQUIRE_NO_THROW( catalog->updateArchiveWALStats(check_desc->id, 500, 1,
+                                                         "0/2000000", "0/3000000") );
+  BOOST_REQUIRE_NO_THROW( stats = catalog->getArchiveStats(check_desc->id) );
+  BOOST_TEST( stats->archive_id == check_desc->id );
+  BOOST_TEST( stats->wal_bytes == (unsigned long long) 1500 );
+  BOOST_TEST( stats->wal_segments == (unsigned long long) 2 );
+  BOOST_TEST( stats->oldest_xlogpos == "0/1000000" );
+  BOOST_TEST( stats->newest_xlogpos == "0/3000000" );
+
+  /* 3 Basebackup sizes are added to the archive */
+  backup->archive_id = check_desc->id;
+  backup->xlogpos = "0/1000000";
+  backup->timeline = 1;
+  backup->label = "stats test";
+  backup->fsentry = "/tmp/stats/backup1";
+  backup->started = "2024-01-01 10:00:00";
+  backup->systemid = "6000000000000000001";
+  backup->wal_segment_size = 16777216;
+  backup->used_profile = profile->profile_id;
+  backup->pg_version_num = 160000;
+
+  BOOST_REQUIRE_NO_THROW( catalog->registerBasebackup(check_desc->id, backup) );
+  BOOST_REQUIRE_NO_THROW( catalog->registerBackupStats(backup, 4096) );
+  BOOST_TEST( catalog->getBackupSize(backup->id) == (unsigned long long) 4096 );
+
+  /* 4 Registering again replaces the size */
+  BOOST_REQUIRE_NO_THROW( catalog->registerBackupStats(backup, 8192) );
+  BOOST_TEST( catalog->getBackupSize(backup->id) == (unsigned long long) 8192 );
+  BOOST_TEST( catalog->getArchiveStats(check_desc->id)->backup_bytes == (unsigned long long) 8192 );
+
+  /* 5 STAT ARCHIVE reads the materialised statistics */
+  BOOST_REQUIRE_NO_THROW( stat = catalog->statCatalog("stats") );
+  BOOST_TEST( stat->wal_bytes == (unsigned long long) 1500 );
+  BOOST_TEST( stat->wal_segments == (unsigned long long) 2 );
+  BOOST_TEST( stat->oldest_xlogpos == "0/1000000" );
+  BOOST_TEST( stat->backup_bytes == (unsigned long long) 8192 );
+
+  /* 6 Dropping the basebackup subtracts its size */
+  BOOST_REQUIRE_NO_THROW( catalog->deleteBaseBackup(backup->id) );
+  BOOST_TEST( catalog->getArchiveStats(check_desc->id)->backup_bytes == (unsigned long long) 0 );
+
+  BOOST_REQUIRE_NO_THROW( catalog->dropArchive("stats") );
+  BOOST_TEST( catalog->getArchiveStats(check_desc->id)->archive_id < 0 );
+  BOOST_REQUIRE_NO_THROW( catalog->commitTransaction() );
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestRetentionPlanner)
+{
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+  std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+  std::shared_ptr<CatalogDescr> check_desc;
+  std::shared_ptr<BackupProfileDescr> profile;
+  std::shared_ptr<RetentionPlan> plan;
+  std::shared_ptr<RetentionPlanner> planner;
+  std::vector<int> ids;
+  std::string threshold;
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+
+  BOOST_REQUIRE_NO_THROW( catalog->startTransaction() );
+
+  /* The archive directory doesn't have a log/ directory, so there's no WAL to plan for */
+  desc->archive_name = "retention";
+  desc->directory = "/tmp/pg_backup_ctl_test_retention_planner";
+  BOOST_REQUIRE_NO_THROW( boost::filesystem::create_directories(desc->directory) );
+  desc->compression = false;
+  desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+  BOOST_REQUIRE_NO_THROW( catalog->createArchive(desc) );
+  BOOST_REQUIRE_NO_THROW( check_desc = catalog->existsByName("retention") );
+  BOOST_REQUIRE_NO_THROW( profile = catalog->getBackupProfile("default") );
+  check_desc->tag = LIST_ARCHIVE;
+
+  for (int i = 1; i <= 4; i++) {
+
+    std::shared_ptr<BaseBackupDescr> backup = std::make_shared<BaseBackupDescr>();
+
+    backup->archive_id = check_desc->id;
+    backup->xlogpos = "0/" + std::to_string(i) + "000000";
+    backup->timeline = 1;
+    backup->label = "retention test";
+    backup->fsentry = desc->directory + "/backup" + std::to_string(i);
+    backup->started = "2024-01-0" + std::to_string(i) + " 10:00:00";
+    backup->systemid = "6000000000000000001";
+    backup->wal_segment_size = 16777216;
+    backup->used_profile = profile->profile_id;
+    backup->pg_version_num = 160000;
+
+    BOOST_REQUIRE_NO_THROW( catalog->registerBasebackup(check_desc->id, backup) );
+    ids.push_back(backup->id);
+
+    /* The last one is finalized later */
+    if (i < 4) {
+      backup->xlogposend = "0/" + std::to_string(i) + "800000";
+      BOOST_REQUIRE_NO_THROW( catalog->finalizeBasebackup(backup) );
+    }
+
+  }
+
+  /* A count policy and a datetime policy matching everything stopped within a day */
+  {
+    std::shared_ptr<RetentionDescr> keepnewest = std::make_shared<RetentionDescr>();
+    std::shared_ptr<RetentionDescr> dropnewer = std::make_shared<RetentionDescr>();
+    std::shared_ptr<RetentionRuleDescr> rule = std::make_shared<RetentionRuleDescr>();
+
+    keepnewest->name = "plankeepnewest";
+    rule->type = RETENTION_KEEP_NUM;
+    rule->value = "2";
+    keepnewest->rules.push_back(rule);
+    BOOST_REQUIRE_NO_THROW( catalog->createRetentionPolicy(keepnewest) );
+
+    rule = std::make_shared<RetentionRuleDescr>();
+    dropnewer->name = "plandropnewer";
+    rule->type = RETENTION_DROP_NEWER_BY_DATETIME;
+    rule->value = "-1 days";
+    dropnewer->rules.push_back(rule);
+    BOOST_REQUIRE_NO_THROW( catalog->createRetentionPolicy(dropnewer) );
+  }
+
+  /* 1 The datetime threshold is computed by the catalog */
+  BOOST_REQUIRE_NO_THROW( threshold = catalog->retentionDateTimeThreshold(RetentionIntervalDescr("-1 days")) );
+  BOOST_TEST( threshold.length() > 0 );
+  BOOST_TEST( threshold < CPGBackupCtlBase::current_timestamp() );
+
+  /* 2 Keeping the two newest ready basebackups drops the oldest one */
+  RetentionPlanner::clearCache();
+  planner = std::make_shared<RetentionPlanner>(catalog, check_desc, "plankeepnewest");
+  planner->addLockInfo(std::make_shared<BackupPinnedValidLockInfo>());
+
+  BOOST_REQUIRE_NO_THROW( plan = planner->plan() );
+  BOOST_TEST( !plan->cached );
+  BOOST_REQUIRE( !plan->empty() );
+  BOOST_REQUIRE( plan->cleanupDescr->basebackups.size() == (size_t) 1 );
+  BOOST_TEST( plan->cleanupDescr->basebackups[0]->id == ids[0] );
+  BOOST_TEST( plan->wal.files == (unsigned long long) 0 );
+
+  /* 3 Nothing changed, the plan comes from the cache */
+  BOOST_REQUIRE_NO_THROW( plan = planner->plan() );
+  BOOST_TEST( plan->cached );
+  BOOST_REQUIRE( plan->cleanupDescr->basebackups.size() == (size_t) 1 );
+
+  /* 4 Finalizing another basebackup invalidates the cached plan */
+  {
+    std::shared_ptr<BaseBackupDescr> backup = catalog->getBaseBackup(ids[3], check_desc->id);
+
+    backup->xlogposend = "0/4800000";
+    BOOST_REQUIRE_NO_THROW( catalog->finalizeBasebackup(backup) );
+  }
+
+  BOOST_REQUIRE_NO_THROW( plan = planner->plan() );
+  BOOST_TEST( !plan->cached );
+  BOOST_REQUIRE( plan->cleanupDescr->basebackups.size() == (size_t) 2 );
+
+  /* 5 Every basebackup was stopped within the last day */
+  {
+    RetentionPlanner dtplanner(catalog, check_desc, "plandropnewer");
+
+    dtplanner.addLockInfo(std::make_shared<BackupPinnedValidLockInfo>());
+    BOOST_REQUIRE_NO_THROW( plan = dtplanner.plan() );
+    BOOST_TEST( plan->cleanupDescr->basebackups.size() == (size_t) 4 );
+  }
+
+  /* 6 Executing the plan drops the planned basebackups and the cached plan */
+  BOOST_REQUIRE_NO_THROW( plan = planner->plan() );
+  BOOST_TEST( plan->cached );
+  BOOST_REQUIRE_NO_THROW( planner->execute(plan) );
+  BOOST_TEST( catalog->getBackupList("retention").size() == (size_t) 2 );
+
+  BOOST_REQUIRE_NO_THROW( plan = planner->plan() );
+  BOOST_TEST( !plan->cached );
+  BOOST_TEST( plan->empty() );
+
+  BOOST_REQUIRE_NO_THROW( catalog->dropRetentionPolicy("plankeepnewest") );
+  BOOST_REQUIRE_NO_THROW( catalog->dropRetentionPolicy("plandropnewer") );
+  BOOST_REQUIRE_NO_THROW( catalog->dropArchive("retention") );
+  BOOST_REQUIRE_NO_THROW( catalog->commitTransaction() );
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+  BOOST_REQUIRE_NO_THROW( boost::filesystem::remove_all(desc->directory) );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestRestorePlanner)
+{
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+  std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+  std::shared_ptr<CatalogDescr> check_desc;
+  std::shared_ptr<BackupProfileDescr> profile;
+  std::shared_ptr<RestorePlan> plan;
+  std::vector<int> ids;
+  boost::filesystem::path logdir;
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+
+  BOOST_REQUIRE_NO_THROW( catalog->startTransaction() );
+
+  desc->archive_name = "restoreplan";
+  desc->directory = "/tmp/pg_backup_ctl_test_restore_planner";
+  desc->compression = false;
+  desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+  /* Segments 1 to 5 of timeline 1 */
+  logdir = boost::filesystem::path(desc->directory) / "log";
+  BOOST_REQUIRE_NO_THROW( boost::filesystem::create_directories(logdir) );
+
+  for (int i = 1; i <= 5; i++) {
+    std::ofstream segment((logdir / ("00000001000000000000000" + std::to_string(i))).string());
+  }
+
+  BOOST_REQUIRE_NO_THROW( catalog->createArchive(desc) );
+  BOOST_REQUIRE_NO_THROW( check_desc = catalog->existsByName("restoreplan") );
+  BOOST_REQUIRE_NO_THROW( profile = catalog->getBackupProfile("default") );
+
+  /* Basebackups within segments 1 and 3 */
+  for (int i = 1; i <= 3; i += 2) {
+
+    std::shared_ptr<BaseBackupDescr> backup = std::make_shared<BaseBackupDescr>();
+
+    backup->archive_id = check_desc->id;
+    backup->xlogpos = "0/" + std::to_string(i) + "000028";
+    backup->timeline = 1;
+    backup->label = "restore planner test";
+    backup->fsentry = desc->directory + "/backup" + std::to_string(i);
+    backup->started = "2024-01-0" + std::to_string(i) + " 10:00:00";
+    backup->systemid = "6000000000000000001";
+    backup->wal_segment_size = 16777216;
+    backup->used_profile = profile->profile_id;
+    backup->pg_version_num = 160000;
+
+    BOOST_REQUIRE_NO_THROW( catalog->registerBasebackup(check_desc->id, backup) );
+    backup->xlogposend = "0/" + std::to_string(i) + "800000";
+    BOOST_REQUIRE_NO_THROW( catalog->finalizeBasebackup(backup) );
+    ids.push_back(backup->id);
+
+  }
+
+  RestorePlanner planner(catalog, check_desc);
+
+  /* 1 Both basebackups reach the target, the newer one replays less WAL */
+  BOOST_REQUIRE_NO_THROW( plan = planner.plan(std::make_shared<RestoreDescr>(RESTORE_TARGET_LSN,
+                                                                             "0/4000100")) );
+  BOOST_TEST( plan->timeline == (unsigned int) 1 );
+  BOOST_REQUIRE( plan->candidates.size() == (size_t) 2 );
+  BOOST_REQUIRE( plan->feasible() );
+  BOOST_TEST( plan->chosen->basebackup->id == ids[1] );
+  BOOST_TEST( plan->chosen->wal_segments == (unsigned long long) 2 );
+  BOOST_TEST( plan->chosen->wal_bytes == (unsigned long long) (0x4000100 - 0x3000028) );
+  BOOST_REQUIRE( plan->chosen->wal_files.size() == (size_t) 2 );
+  BOOST_TEST( plan->chosen->wal_files[0] == "000000010000000000000003" );
+  BOOST_TEST( plan->chosen->wal_files[1] == "000000010000000000000004" );
+  BOOST_TEST( plan->historyFiles().size() == (size_t) 0 );
+
+  for (auto &candidate : plan->candidates) {
+    BOOST_TEST( candidate->usable() );
+  }
+
+  /* 2 The newer basebackup ends after the target */
+  BOOST_REQUIRE_NO_THROW( plan = planner.plan(std::make_shared<RestoreDescr>(RESTORE_TARGET_LSN,
+                                                                             "0/2000000")) );
+  BOOST_REQUIRE( plan->feasible() );
+  BOOST_TEST( plan->chosen->basebackup->id == ids[0] );
+
+  /* 3 Without segment 2, only the newer basebackup is usable */
+  BOOST_REQUIRE( boost::filesystem::remove(logdir / "000000010000000000000002") );
+  BOOST_REQUIRE_NO_THROW( plan = planner.plan(std::make_shared<RestoreDescr>(RESTORE_TARGET_LSN,
+                                                                             "0/4000100")) );
+  BOOST_REQUIRE( plan->feasible() );
+  BOOST_TEST( plan->chosen->basebackup->id == ids[1] );
+
+  for (auto &candidate : plan->candidates) {
+
+    if (candidate->basebackup->id == ids[0]) {
+      BOOST_TEST( !candidate->usable() );
+      BOOST_TEST( candidate->missing_segment == "000000010000000000000002" );
+    }
+
+  }
+
+  /* 4 LATEST replays up to the end of segment 5 */
+  BOOST_REQUIRE_NO_THROW( plan = planner.plan(std::make_shared<RestoreDescr>(RESTORE_TARGET_LATEST, "")) );
+  BOOST_REQUIRE( plan->feasible() );
+  BOOST_TEST( plan->chosen->wal_end == (XLogRecPtr) 0x6000000 );
+
+  /* 5 There's no history file for timeline 2 */
+  {
+    std::shared_ptr<RestoreDescr> restoreDescr = std::make_shared<RestoreDescr>(RESTORE_TARGET_LATEST, "");
+
+    restoreDescr->target_timeline = 2;
+    BOOST_CHECK_THROW( planner.plan(restoreDescr), CArchiveIssue );
+  }
+
+  /* 6 The recovery target is written to the restored data directory */
+  {
+    boost::filesystem::path datadir = boost::filesystem::path(desc->directory) / "restored";
+    std::string line;
+    std::vector<std::string> lines;
+
+    BOOST_REQUIRE_NO_THROW( boost::filesystem::create_directories(datadir) );
+    BOOST_REQUIRE_NO_THROW( plan = planner.plan(std::make_shared<RestoreDescr>(RESTORE_TARGET_LSN,
+                                                                               "0/4000100")) );
+    BOOST_REQUIRE_NO_THROW( plan->writeRecoveryConfig(datadir, 160000, "restore-wal '%f' %p") );
+    BOOST_TEST( boost::filesystem::exists(datadir / "recovery.signal") );
+    BOOST_TEST( !boost::filesystem::exists(datadir / "recovery.conf") );
+
+    std::ifstream conf((datadir / "postgresql.auto.conf").string());
+
+    while (std::getline(conf, line))
+      lines.push_back(line);
+
+    BOOST_REQUIRE( lines.size() == (size_t) 4 );
+    BOOST_TEST( lines[1] == "restore_command = 'restore-wal ''%f'' %p'" );
+    BOOST_TEST( lines[2] == "recovery_target_lsn = '0/4000100'" );
+    BOOST_TEST( lines[3] == "recovery_target_timeline = '1'" );
+
+    /* Before PostgreSQL 12 there's recovery.conf, no LSN targets before 10 */
+    BOOST_REQUIRE_NO_THROW( plan->writeRecoveryConfig(datadir, 110000, "restore-wal") );
+    BOOST_TEST( boost::filesystem::exists(datadir / "recovery.conf") );
+    BOOST_CHECK_THROW( plan->writeRecoveryConfig(datadir, 90600, "restore-wal"), CArchiveIssue );
+  }
+
+  BOOST_REQUIRE_NO_THROW( catalog->dropArchive("restoreplan") );
+  BOOST_REQUIRE_NO_THROW( catalog->commitTransaction() );
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+  BOOST_REQUIRE_NO_THROW( boost::filesystem::remove_all(desc->directory) );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestSchedules)
+{
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+  std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+  std::shared_ptr<CatalogDescr> check_desc;
+  std::shared_ptr<ScheduleDescr> schedule = std::make_shared<ScheduleDescr>();
+  std::shared_ptr<ScheduleDescr> check_schedule;
+  std::vector<std::shared_ptr<ScheduleDescr>> schedules;
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+
+  desc->archive_name = "schedules";
+  desc->directory = "/tmp";
+  desc->compression = false;
+  desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+  BOOST_REQUIRE_NO_THROW( catalog->createArchive(desc) );
+  BOOST_REQUIRE_NO_THROW( check_desc = catalog->existsByName("schedules") );
+
+  /* 1 No schedule yet */
+  BOOST_REQUIRE_NO_THROW( check_schedule = catalog->getSchedule(check_desc->id,
+                                                                SCHEDULE_BASEBACKUP) );
+  BOOST_TEST( check_schedule->id < 0 );
+
+  /* 2 Create a basebackup schedule */
+  schedule->archive_id = check_desc->id;
+  schedule->type = SCHEDULE_BASEBACKUP;
+  schedule->profile_name = "default";
+  schedule->interval = 86400;
+  schedule->jitter = 3600;
+  schedule->priority = 5;
+
+  BOOST_REQUIRE_NO_THROW( catalog->createSchedule(schedule) );
+  BOOST_TEST( schedule->id >= 0 );
+
+  BOOST_REQUIRE_NO_THROW( check_schedule = catalog->getSchedule(check_desc->id,
+                                                                SCHEDULE_BASEBACKUP) );
+  BOOST_TEST( check_schedule->id == schedule->id );
+  BOOST_TEST( check_schedule->archive_name == "schedules" );
+  BOOST_TEST( check_schedule->profile_name == "default" );
+  BOOST_TEST( check_schedule->interval == (unsigned int) 86400 );
+  BOOST_TEST( check_schedule->jitter == (unsigned int) 3600 );
+  BOOST_TEST( check_schedule->priority == 5 );
+  BOOST_TEST( check_schedule->next_run == "" );
+
+  /* 3 Only one schedule per job type and archive */
+  BOOST_CHECK_THROW( catalog->createSchedule(schedule), CCatalogIssue );
+
+  /* 4 Recording a skipped run keeps the last run */
+  BOOST_REQUIRE_NO_THROW( catalog->updateScheduleRun(schedule->id,
+                                                     "2024-01-02 10:00:00",
+                                                     "2024-01-01 10:00:00") );
+  BOOST_REQUIRE_NO_THROW( catalog->updateScheduleRun(schedule->id,
+                                                     "2024-01-03 10:00:00",
+                                                     "") );
+  BOOST_REQUIRE_NO_THROW( check_schedule = catalog->getSchedule(check_desc->id,
+                                                                SCHEDULE_BASEBACKUP) );
+  BOOST_TEST( check_schedule->next_run == "2024-01-03 10:00:00" );
+  BOOST_TEST( check_schedule->last_run == "2024-01-01 10:00:00" );
+
+  /* 5 A verify schedule of the same archive */
+  schedule = std::make_shared<ScheduleDescr>();
+  schedule->archive_id = check_desc->id;
+  schedule->type = SCHEDULE_VERIFY;
+  schedule->interval = 604800;
+
+  BOOST_REQUIRE_NO_THROW( catalog->createSchedule(schedule) );
+  BOOST_REQUIRE_NO_THROW( catalog->getSchedules(schedules) );
+  BOOST_TEST( std::count_if(schedules.begin(), schedules.end(),
+                            [&check_desc](std::shared_ptr<ScheduleDescr> s) {
+                              return s->archive_id == check_desc->id;
+                            }) == 2 );
+
+  /* 6 Drop the verify schedule, dropping the archive drops the rest */
+  BOOST_REQUIRE_NO_THROW( catalog->dropSchedule(check_desc->id, SCHEDULE_VERIFY) );
+  BOOST_TEST( catalog->getSchedule(check_desc->id, SCHEDULE_VERIFY)->id < 0 );
+
+  BOOST_REQUIRE_NO_THROW( catalog->dropArchive("schedules") );
+  BOOST_TEST( catalog->getSchedule(check_desc->id, SCHEDULE_BASEBACKUP)->id < 0 );
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestJobScheduler)
+{
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+  std::shared_ptr<JobScheduler> scheduler = nullptr;
+  job_scheduler_limits limits;
+  std::vector<std::shared_ptr<CatalogDescr>> archives;
+  std::string command;
+  std::time_t now = std::time(NULL);
+  std::time_t due;
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+
+  /* 1 Next runs keep their time of day and skip missed runs */
+  BOOST_TEST( JobScheduler::nextRun(1000, 1500, 3600) == 4600 );
+  BOOST_TEST( JobScheduler::nextRun(1000, 4600, 3600) == 8200 );
+  BOOST_TEST( JobScheduler::nextRun(1000, 20000, 3600) == 22600 );
+
+  /* 2 The jitter delay is stable and limited */
+  {
+    std::shared_ptr<ScheduleDescr> schedule = std::make_shared<ScheduleDescr>();
+
+    schedule->id = 42;
+    BOOST_TEST( JobScheduler::jitterDelay(schedule, now) == (unsigned int) 0 );
+
+    schedule->jitter = 600;
+    BOOST_TEST( JobScheduler::jitterDelay(schedule, now)
+                == JobScheduler::jitterDelay(schedule, now) );
+    BOOST_TEST( JobScheduler::jitterDelay(schedule, now) <= (unsigned int) 600 );
+    BOOST_TEST( JobScheduler::strToTime(JobScheduler::timeToStr(now)) == now );
+    BOOST_TEST( JobScheduler::strToTime("no timestamp") == (std::time_t) -1 );
+  }
+
+  /* 3 Two archives with an hourly basebackup schedule each */
+  for (auto name : { "scheduled1", "scheduled2" }) {
+
+    std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+    std::shared_ptr<ScheduleDescr> schedule = std::make_shared<ScheduleDescr>();
+
+    desc->archive_name = name;
+    desc->directory = "/tmp";
+    desc->compression = false;
+    desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+    BOOST_REQUIRE_NO_THROW( catalog->createArchive(desc) );
+    BOOST_REQUIRE_NO_THROW( desc = catalog->existsByName(name) );
+
+    schedule->archive_id = desc->id;
+    schedule->type = SCHEDULE_BASEBACKUP;
+    schedule->interval = 3600;
+
+    BOOST_REQUIRE_NO_THROW( catalog->createSchedule(schedule) );
+    archives.push_back(desc);
+
+  }
+
+  /* 4 First runs are spread within the interval and recorded */
+  limits.max_basebackups = 1;
+  limits.stagger = 0;
+
+  BOOST_REQUIRE_NO_THROW( scheduler = std::make_shared<JobScheduler>(catalog, nullptr, limits) );
+  BOOST_REQUIRE_NO_THROW( scheduler->refresh(now, true) );
+  BOOST_TEST( scheduler->getNumberOfSchedules() >= (unsigned int) 2 );
+
+  for (auto &desc : archives) {
+
+    std::shared_ptr<ScheduleDescr> schedule = catalog->getSchedule(desc->id, SCHEDULE_BASEBACKUP);
+    std::time_t next_run = JobScheduler::strToTime(schedule->next_run);
+
+    BOOST_TEST( next_run >= now );
+    BOOST_TEST( next_run < now + 3600 );
+
+  }
+
+  /* 5 Only one basebackup at a time, the other one is deferred */
+  due = now + 3600;
+
+  BOOST_TEST( scheduler->next(due, command) );
+  BOOST_TEST( command.find("START BASEBACKUP FOR ARCHIVE scheduled") == 0 );
+  BOOST_TEST( !scheduler->next(due, command) );
+  BOOST_TEST( !scheduler->next(due + 30, command) );
+
+  /* 6 The started job doesn't show up, so it's forgotten after a while */
+  BOOST_TEST( scheduler->next(due + JobScheduler::DISPATCH_GRACE, command) );
+  BOOST_TEST( command.find("START BASEBACKUP FOR ARCHIVE scheduled") == 0 );
+  BOOST_TEST( !scheduler->next(due + JobScheduler::DISPATCH_GRACE, command) );
+
+  /* 7 Both jobs got their next run recorded */
+  for (auto &desc : archives) {
+
+    std::shared_ptr<ScheduleDescr> schedule = catalog->getSchedule(desc->id, SCHEDULE_BASEBACKUP);
+
+    BOOST_TEST( JobScheduler::strToTime(schedule->next_run) > due );
+    BOOST_TEST( schedule->last_run != "" );
+
+  }
+
+  BOOST_REQUIRE_NO_THROW( catalog->dropArchive("scheduled1") );
+  BOOST_REQUIRE_NO_THROW( catalog->dropArchive("scheduled2") );
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestMetricsExport)
+{
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+  std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+  std::vector<std::shared_ptr<StatCatalogArchive>> stats;
+  std::shared_ptr<StatCatalogArchive> found = nullptr;
+  std::string exposition;
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+
+  desc->archive_name = "metrics1";
+  desc->directory = "/tmp";
+  desc->compression = false;
+  desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+  BOOST_REQUIRE_NO_THROW( catalog->createArchive(desc) );
+
+  /* 1 Aggregates of all archives, a new archive has no backups */
+  BOOST_REQUIRE_NO_THROW( catalog->statCatalogArchives(stats) );
+
+  for (auto &stat : stats) {
+    if (stat->archive_name == "metrics1")
+      found = stat;
+  }
+
+  BOOST_REQUIRE( found != nullptr );
+  BOOST_TEST( found->archive_id >= 0 );
+  BOOST_TEST( found->number_of_backups == 0 );
+  BOOST_TEST( found->backups_failed == 0 );
+  BOOST_TEST( found->latest_finished == "" );
+
+  /* 2 Without worker shared memory, only the catalog is exported */
+  {
+    MetricsServer metrics("127.0.0.1", 1, nullptr);
+
+    exposition = metrics.render();
+    BOOST_TEST( exposition.find("pgbckctl_worker_slots 0\n") != std::string::npos );
+    BOOST_TEST( exposition.find("pgbckctl_archive_backups{") == std::string::npos );
+    BOOST_TEST( exposition.substr(exposition.length() - 6) == "# EOF\n" );
+
+    metrics.setCatalogStats(stats, 1000);
+
+    exposition = metrics.render();
+    BOOST_TEST( exposition.find("pgbckctl_archive_backups{archive=\"metrics1\"} 0\n")
+                != std::string::npos );
+    BOOST_TEST( exposition.find("pgbckctl_catalog_refresh_timestamp_seconds 1000\n")
+                != std::string::npos );
+    BOOST_TEST( exposition.find("pgbckctl_archive_last_backup_timestamp_seconds{archive=\"metrics1\"}")
+                == std::string::npos );
+    BOOST_TEST( exposition.substr(exposition.length() - 6) == "# EOF\n" );
+  }
+
+  BOOST_REQUIRE_NO_THROW( catalog->dropArchive("metrics1") );
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestProtoArchiveCache)
+{
+
+  std::shared_ptr<BackupCatalog> catalog = nullptr;
+  std::shared_ptr<PGProtoArchiveCache> cache = nullptr;
+  std::shared_ptr<CatalogDescr> desc = std::make_shared<CatalogDescr>();
+  std::shared_ptr<CatalogDescr> cached = nullptr;
+  int archive_id = -1;
+
+  BOOST_REQUIRE_NO_THROW( catalog
+                          = std::make_shared<BackupCatalog>(".pg_backup_ctl.sqlite") );
+
+  desc->archive_name = "protocache1";
+  desc->directory = "/tmp";
+  desc->compression = false;
+  desc->coninfo->type = ConnectionDescr::CONNECTION_TYPE_BASEBACKUP;
+
+  BOOST_REQUIRE_NO_THROW( catalog->createArchive(desc) );
+  archive_id = catalog->existsByName("protocache1")->id;
+  BOOST_REQUIRE( archive_id >= 0 );
+
+  BOOST_REQUIRE_NO_THROW( cache
+                          = std::make_shared<PGProtoArchiveCache>(".pg_backup_ctl.sqlite") );
+
+  /* 1 Archive descriptors are read once and shared */
+  BOOST_REQUIRE_NO_THROW( cached = cache->getArchive(archive_id) );
+  BOOST_TEST( cached->archive_name == "protocache1" );
+  BOOST_TEST( cache->getArchive(archive_id) == cached );
+
+  /* 2 invalidate() reads the archive from the catalog again */
+  cache->invalidate();
+  BOOST_TEST( cache->getArchive(archive_id) != cached );
+
+  /* 3 Catalog handlers sharing the cache share its catalog */
+  {
+    PGProtoCatalogHandler handler(cache);
+    int backups = -1;
+
+    BOOST_TEST( handler.getArchiveCache() == cache );
+    BOOST_TEST( handler.getCatalogFullname() == catalog->fullname() );
+    BOOST_TEST( !handler.isAttached() );
+
+    BOOST_REQUIRE_NO_THROW( cache->use([&backups](std::shared_ptr<BackupCatalog> shared) {
+          backups = shared->getBackupList("protocache1").size();
+        }) );
+    BOOST_TEST( backups == 0 );
+  }
+
+  BOOST_REQUIRE_NO_THROW( catalog->dropArchive("protocache1") );
+
+  /* 4 Archives which don't exist aren't cached */
+  cache->invalidate();
+  BOOST_TEST( cache->getArchive(archive_id)->id < 0 );
+
+  BOOST_REQUIRE_NO_THROW( catalog->close() );
+
+}
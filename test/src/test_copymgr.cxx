@@ -3,6 +3,7 @@
 #include <boost/test/unit_test.hpp>
 #include <common.hxx>
 #include <fs-copy.hxx>
+#include <fs-sync.hxx>
 
 using namespace pgbckctl;
 
@@ -162,3 +163,341 @@ BOOST_AUTO_TEST_CASE(TestCopyManager)
   boost::filesystem::remove_all(targetPath);
 
 }
+
+BOOST_AUTO_TEST_CASE(TestCopyManagerStealChunks)
+{
+
+  path sourcePath = path(BackupDirectory::system_temp_directory() / "_copyMgrStealSource");
+  path targetPath = path(BackupDirectory::system_temp_directory() / "_copyMgrStealTarget");
+  std::map<path, std::vector<char>> test_files;
+
+  boost::filesystem::remove_all(sourcePath);
+  boost::filesystem::remove_all(targetPath);
+  boost::filesystem::create_directories(sourcePath / "base" / "1");
+  boost::filesystem::create_directories(targetPath);
+
+  /*
+   * A single large file, found last by the walker, and some small
+   * ones. With a small chunk size, idle copy threads must steal
+   * chunks of the large file once the small ones are copied.
+   */
+  test_files[sourcePath / "base" / "1" / "zzz_large"] = std::vector<char>(32 * 1024 * 1024 + 4711);
+
+  for (int i = 0; i < 8; i++) {
+    test_files[sourcePath / "base" / ("small_" + std::to_string(i))]
+      = std::vector<char>(1000 * (i + 1));
+  }
+
+  test_files[sourcePath / "empty"] = std::vector<char>();
+
+  for (auto &tf : test_files) {
+
+    std::shared_ptr<ArchiveFile> fh = std::make_shared<ArchiveFile>(tf.first);
+
+    for (size_t i = 0; i < tf.second.size(); i++)
+      tf.second[i] = (char) ((i + tf.second.size()) % 251);
+
+    fh->setOpenMode("w+");
+    fh->open();
+
+    if (tf.second.size() > 0)
+      fh->write(tf.second.data(), tf.second.size());
+
+    fh->fsync();
+    fh->close();
+
+  }
+
+  std::shared_ptr<BackupCopyManager> copyMgr
+    = std::make_shared<BackupCopyManager>(std::make_shared<BackupDirectory>(sourcePath),
+                                          std::make_shared<TargetDirectory>(targetPath));
+
+  copyMgr->setNumberOfCopyInstances(4);
+  copyMgr->setChunkSize(64 * 1024);
+  copyMgr->setCopyStrategy(COPY_STRATEGY_STREAM);
+  copyMgr->start();
+  copyMgr->wait();
+
+  BOOST_TEST(copyMgr->getStolenChunks() > 0);
+
+  for (auto &tf : test_files) {
+
+    path copied = targetPath / BackupDirectory::relative_path(tf.first, sourcePath);
+    std::vector<char> readback(tf.second.size());
+
+    BOOST_REQUIRE(boost::filesystem::exists(copied));
+    BOOST_TEST(boost::filesystem::file_size(copied) == tf.second.size());
+
+    if (tf.second.size() > 0) {
+
+      std::shared_ptr<ArchiveFile> fh = std::make_shared<ArchiveFile>(copied);
+
+      fh->setOpenMode("rb");
+      fh->open();
+      fh->read(readback.data(), readback.size());
+      fh->close();
+
+      BOOST_TEST((readback == tf.second));
+
+    }
+
+  }
+
+  boost::filesystem::remove_all(sourcePath);
+  boost::filesystem::remove_all(targetPath);
+
+}
+
+BOOST_AUTO_TEST_CASE(TestCopyManagerDirectIO)
+{
+
+  path sourcePath = path(BackupDirectory::system_temp_directory() / "_copyMgrDirectSource");
+  path targetPath = path(BackupDirectory::system_temp_directory() / "_copyMgrDirectTarget");
+  std::map<path, std::vector<char>> test_files;
+  AlignedMemoryBuffer aligned(10000);
+
+  /* Buffers for direct I/O must be aligned */
+  BOOST_TEST(((uintptr_t) aligned.ptr() % ArchiveFile::DIRECT_IO_ALIGNMENT) == 0);
+  BOOST_TEST(aligned.getSize() == 10000);
+
+  boost::filesystem::remove_all(sourcePath);
+  boost::filesystem::remove_all(targetPath);
+  boost::filesystem::create_directories(sourcePath);
+  boost::filesystem::create_directories(targetPath);
+
+  /* Aligned and unaligned sizes, with tails shorter than a chunk */
+  test_files[sourcePath / "unaligned_large"] = std::vector<char>(1024 * 1024 + 4711);
+  test_files[sourcePath / "aligned"]         = std::vector<char>(3 * ArchiveFile::DIRECT_IO_ALIGNMENT);
+  test_files[sourcePath / "tiny"]            = std::vector<char>(17);
+
+  for (auto &tf : test_files) {
+
+    std::shared_ptr<ArchiveFile> fh = std::make_shared<ArchiveFile>(tf.first);
+
+    for (size_t i = 0; i < tf.second.size(); i++)
+      tf.second[i] = (char) ((i * 7 + tf.second.size()) % 253);
+
+    fh->setOpenMode("w+");
+    fh->open();
+    fh->write(tf.second.data(), tf.second.size());
+    fh->fsync();
+    fh->close();
+
+  }
+
+  std::shared_ptr<BackupCopyManager> copyMgr
+    = std::make_shared<BackupCopyManager>(std::make_shared<BackupDirectory>(sourcePath),
+                                          std::make_shared<TargetDirectory>(targetPath));
+
+  /* Chunks must be aligned for direct I/O */
+  copyMgr->setDirectIO(true);
+  copyMgr->setChunkSize(1000);
+  BOOST_CHECK_THROW(copyMgr->start(), CArchiveIssue);
+
+  copyMgr = std::make_shared<BackupCopyManager>(std::make_shared<BackupDirectory>(sourcePath),
+                                                std::make_shared<TargetDirectory>(targetPath));
+  copyMgr->setNumberOfCopyInstances(2);
+  copyMgr->setDirectIO(true);
+  copyMgr->setChunkSize(128 * 1024);
+  copyMgr->setCopyStrategy(COPY_STRATEGY_STREAM);
+  copyMgr->start();
+  copyMgr->wait();
+
+  for (auto &tf : test_files) {
+
+    path copied = targetPath / BackupDirectory::relative_path(tf.first, sourcePath);
+    std::vector<char> readback(tf.second.size());
+    std::shared_ptr<ArchiveFile> fh = std::make_shared<ArchiveFile>(copied);
+
+    /* The padding of unaligned tails must be gone */
+    BOOST_REQUIRE(boost::filesystem::exists(copied));
+    BOOST_TEST(boost::filesystem::file_size(copied) == tf.second.size());
+
+    fh->setOpenMode("rb");
+    fh->open();
+    fh->read(readback.data(), readback.size());
+    fh->close();
+
+    BOOST_TEST((readback == tf.second));
+
+  }
+
+  boost::filesystem::remove_all(sourcePath);
+  boost::filesystem::remove_all(targetPath);
+
+}
+
+BOOST_AUTO_TEST_CASE(TestFastCopy)
+{
+
+  path sourceFile = BackupDirectory::system_temp_directory() / BackupDirectory::temp_filename();
+  path targetFile = BackupDirectory::system_temp_directory() / BackupDirectory::temp_filename();
+  std::vector<char> data(100000);
+  CopyStrategy used;
+
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (char) (i % 251);
+
+  std::shared_ptr<ArchiveFile> in = std::make_shared<ArchiveFile>(sourceFile);
+  std::shared_ptr<ArchiveFile> out = std::make_shared<ArchiveFile>(targetFile);
+
+  in->setOpenMode("w+");
+  in->open();
+  in->write(data.data(), data.size());
+  in->fsync();
+  in->close();
+
+  in->setOpenMode("rb");
+  in->open();
+  out->setOpenMode("wb+");
+  out->open();
+
+  /* Streaming leaves the copy to the caller */
+  BOOST_TEST((BaseCopyManager::fastCopy(in, out, COPY_STRATEGY_STREAM) == COPY_STRATEGY_STREAM));
+  BOOST_TEST(out->size() == 0);
+
+  /*
+   * Whether the kernel can copy depends on the filesystem
+   * of the temp directory, but if it did, contents must match.
+   */
+  used = BaseCopyManager::fastCopy(in, out, COPY_STRATEGY_AUTO);
+
+  if (used != COPY_STRATEGY_STREAM) {
+
+    std::vector<char> readback(data.size());
+
+    out->fsync();
+    BOOST_TEST(out->size() == data.size());
+
+    out->lseek(0, SEEK_SET);
+    out->read(readback.data(), readback.size());
+    BOOST_TEST((readback == data));
+
+  }
+
+  in->close();
+  out->close();
+
+  boost::filesystem::remove(sourceFile);
+  boost::filesystem::remove(targetFile);
+
+}
+
+BOOST_AUTO_TEST_CASE(TestRecursiveSync)
+{
+
+  path root = BackupDirectory::system_temp_directory() / BackupDirectory::temp_filename();
+  std::vector<RecursiveSyncMethod> methods = { RECURSIVE_SYNC_AUTO,
+                                               RECURSIVE_SYNC_FSYNC,
+                                               RECURSIVE_SYNC_IO_URING,
+                                               RECURSIVE_SYNC_SYNCFS };
+
+  /* 3 directories with 100 files each, plus the root */
+  for (int d = 0; d < 3; d++) {
+
+    path dir = root / "base" / std::to_string(d);
+
+    boost::filesystem::create_directories(dir);
+
+    for (int f = 0; f < 100; f++) {
+
+      ArchiveFile file(dir / std::to_string(f));
+
+      file.setOpenMode("w");
+      file.open();
+      file.write("x", 1);
+      file.close();
+
+    }
+  }
+
+  for (auto &method : methods) {
+
+    RecursiveSync sync(root);
+    RecursiveSyncProgress result;
+    unsigned int reports = 0;
+
+    sync.setMethod(method);
+    sync.setParallelism(8);
+    sync.setProgressCallback([&reports](const RecursiveSyncProgress &progress) {
+        reports++;
+      });
+
+    BOOST_REQUIRE_NO_THROW( result = sync.sync() );
+
+    BOOST_TEST(result.total == (300 + 3 + 2));
+    BOOST_TEST(result.synced == result.total);
+    BOOST_TEST(result.errors == 0);
+    BOOST_TEST(result.method != RECURSIVE_SYNC_AUTO);
+    BOOST_TEST(reports >= 1);
+
+  }
+
+  BOOST_TEST((RecursiveSync::methodFromString("io_uring") == RECURSIVE_SYNC_IO_URING));
+  BOOST_TEST(RecursiveSync::methodToString(RECURSIVE_SYNC_SYNCFS) == "syncfs");
+  BOOST_CHECK_THROW(RecursiveSync::methodFromString("fdatasync"), CArchiveIssue);
+
+  /* A missing directory is an error */
+  {
+    RecursiveSync sync(root / "missing");
+    BOOST_CHECK_THROW(sync.sync(), CArchiveIssue);
+  }
+
+  /* ... but not for fsync_recursive() */
+  BOOST_REQUIRE_NO_THROW( RootDirectory::fsync_recursive(root / "missing") );
+  BOOST_REQUIRE_NO_THROW( RootDirectory::fsync_recursive(root) );
+
+  boost::filesystem::remove_all(root);
+
+}
+
+#ifdef PG_BACKUP_CTL_HAS_LIBURING
+BOOST_AUTO_TEST_CASE(TestIOUringCopyPipeline)
+{
+
+  path sourceFile = BackupDirectory::system_temp_directory() / BackupDirectory::temp_filename();
+  path targetFile = BackupDirectory::system_temp_directory() / BackupDirectory::temp_filename();
+  std::vector<char> data(1000000 + 333);
+  std::vector<char> readback(data.size());
+  bool abort = false;
+
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (char) (i % 251);
+
+  std::shared_ptr<ArchiveFile> in = std::make_shared<ArchiveFile>(sourceFile);
+  std::shared_ptr<ArchiveFile> out = std::make_shared<ArchiveFile>(targetFile);
+
+  in->setOpenMode("w+");
+  in->open();
+  in->write(data.data(), data.size());
+  in->fsync();
+  in->close();
+
+  in->setOpenMode("rb");
+  in->open();
+  out->setOpenMode("wb+");
+  out->open();
+
+  /* small chunks, so that the file needs many rounds through all slots */
+  IOUringCopyPipeline pipeline(8, 65536);
+  pipeline.setup();
+
+  BOOST_TEST(pipeline.copy(in, out, abort) == data.size());
+
+  pipeline.exit();
+  out->fsync();
+
+  BOOST_TEST(out->size() == data.size());
+
+  out->lseek(0, SEEK_SET);
+  out->read(readback.data(), readback.size());
+  BOOST_TEST((readback == data));
+
+  in->close();
+  out->close();
+
+  boost::filesystem::remove(sourceFile);
+  boost::filesystem::remove(targetFile);
+
+}
+#endif
@@ -0,0 +1,144 @@
+#define BOOST_TEST_MODULE TestMemoryBuffer
+#include <boost/test/unit_test.hpp>
+#include <common.hxx>
+#include <memorybuffer.hxx>
+#include <proto-buffer.hxx>
+#include <cstring>
+#include <utility>
+
+using namespace pgbckctl;
+
+BOOST_AUTO_TEST_CASE(TestMemoryBufferInline)
+{
+  MemoryBuffer buffer;
+
+  /* Small buffers live inside the instance */
+  buffer.allocate(16);
+  BOOST_TEST(buffer.getSize() == 16);
+  BOOST_TEST(buffer.getCapacity() == MemoryBuffer::INLINE_SIZE);
+
+  BOOST_REQUIRE_NO_THROW( buffer.write("0123456789abcdef", 16, 0) );
+  BOOST_TEST(std::string(buffer.ptr(), 16) == "0123456789abcdef");
+}
+
+BOOST_AUTO_TEST_CASE(TestMemoryBufferReuse)
+{
+  MemoryBuffer buffer;
+  char *ptr;
+
+  buffer.allocate(8192);
+  ptr = buffer.ptr();
+
+  /* Smaller buffers reuse the allocation */
+  buffer.allocate(100);
+  BOOST_TEST(buffer.getSize() == 100);
+  BOOST_TEST(buffer.getCapacity() == 8192);
+  BOOST_TEST(buffer.ptr() == ptr);
+
+  /* Writes are still limited by the requested size */
+  BOOST_CHECK_THROW( buffer.write(ptr, 101, 0), CPGBackupCtlFailure );
+}
+
+BOOST_AUTO_TEST_CASE(TestMemoryBufferMove)
+{
+  MemoryBuffer small;
+  MemoryBuffer large;
+  char *ptr;
+
+  small.allocate(4);
+  small.write("abcd", 4, 0);
+
+  large.allocate(1000);
+  large.write("wxyz", 4, 0);
+  ptr = large.ptr();
+
+  MemoryBuffer moved_small(std::move(small));
+  MemoryBuffer moved_large(std::move(large));
+
+  BOOST_TEST(std::string(moved_small.ptr(), 4) == "abcd");
+  BOOST_TEST(small.getSize() == 0);
+  BOOST_CHECK_THROW( small.ptr(), CPGBackupCtlFailure );
+
+  /* Heap buffers are taken over without copying */
+  BOOST_TEST(moved_large.ptr() == ptr);
+  BOOST_TEST(large.getSize() == 0);
+
+  moved_small = std::move(moved_large);
+  BOOST_TEST(moved_small.ptr() == ptr);
+  BOOST_TEST(moved_small.getSize() == 1000);
+}
+
+BOOST_AUTO_TEST_CASE(TestMemoryBufferPool)
+{
+  std::shared_ptr<MemoryBufferPool> pool = std::make_shared<MemoryBufferPool>();
+
+  {
+    MemoryBuffer buffer(pool);
+
+    buffer.allocate(1000);
+    BOOST_TEST(buffer.getCapacity() == 1024);
+  }
+
+  BOOST_TEST(pool->countAllocations() == 1);
+
+  /* The buffer of the same size class is recycled */
+  for (int i = 0; i < 10; i++) {
+
+    MemoryBuffer buffer(pool);
+
+    buffer.allocate(600 + i);
+  }
+
+  BOOST_TEST(pool->countAllocations() == 1);
+  BOOST_TEST(pool->countReuses() == 10);
+
+  /* Inline buffers don't touch the pool */
+  {
+    MemoryBuffer buffer(pool);
+
+    buffer.allocate(10);
+  }
+
+  BOOST_TEST(pool->countAllocations() == 1);
+  BOOST_TEST(pool->countReuses() == 10);
+
+  /* Neither do buffers larger than the largest class */
+  {
+    MemoryBuffer buffer(pool);
+
+    buffer.allocate(MemoryBufferPool::MAX_CLASS_SIZE + 1);
+    BOOST_TEST(buffer.getCapacity() == MemoryBufferPool::MAX_CLASS_SIZE + 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestMemoryBufferPoolOutlivesBuffer)
+{
+  std::shared_ptr<MemoryBufferPool> pool = std::make_shared<MemoryBufferPool>();
+  ProtocolBuffer buffer(pool);
+
+  buffer.allocate(4096);
+
+  /* The buffer keeps the pool to return its memory to */
+  pool.reset();
+
+  BOOST_REQUIRE_NO_THROW( buffer.write_int(42) );
+}
+
+BOOST_AUTO_TEST_CASE(TestProtocolBufferMove)
+{
+  ProtocolBuffer buffer;
+  int value;
+
+  buffer.allocate(8);
+  buffer.write_int(42);
+  buffer.write_int(43);
+  buffer.first();
+  buffer.read_int(value);
+
+  ProtocolBuffer moved(std::move(buffer));
+
+  /* The position moves along */
+  BOOST_TEST(moved.pos() == 4);
+  moved.read_int(value);
+  BOOST_TEST(value == 43);
+}
@@ -12,7 +12,7 @@ using namespace pgbckctl;
  * NOTE: This needs to be in sync if you add or remove parser
  *       command checks.
  */
-#define NUM_SUCCESSFUL_PARSER_COMMANDS 62
+#define NUM_SUCCESSFUL_PARSER_COMMANDS 81
 #define COMMAND_IS_VALID(cmd, number) ( ((cmd) != nullptr) && ((number)++ > 0) )
 
 BOOST_AUTO_TEST_CASE(TestParser)
@@ -128,12 +128,19 @@ BOOST_AUTO_TEST_CASE(TestParser)
     BOOST_TEST( (!backup_profile->manifest) );
     BOOST_TEST( (backup_profile->name == "test") );
     BOOST_TEST( (backup_profile->compress_type == BACKUP_COMPRESS_TYPE_NONE) );
+    BOOST_TEST( (backup_profile->compress_level == 0) );
+    BOOST_TEST( (backup_profile->compress_workers == 0) );
+    BOOST_TEST( (backup_profile->parallel_writers == 0) );
     BOOST_TEST( (backup_profile->max_rate == 0) );
     BOOST_TEST( (backup_profile->label == "PG_BCK_CTL BASEBACKUP") );
     BOOST_TEST( (!backup_profile->fast_checkpoint) );
     BOOST_TEST( (!backup_profile->include_wal) );
     BOOST_TEST( (backup_profile->wait_for_wal) );
     BOOST_TEST( (!backup_profile->noverify_checksums) );
+    BOOST_TEST( (!backup_profile->incremental) );
+    BOOST_TEST( (!backup_profile->server_compression) );
+    BOOST_TEST( (!backup_profile->adaptive_rate) );
+    BOOST_TEST( (!backup_profile->deduplicate) );
     BOOST_TEST( (backup_profile->manifest_checksums == "CRC32C") );
 
     /* default checksum mode is CRC32C */
@@ -559,6 +566,7 @@ BOOST_AUTO_TEST_CASE(TestParser)
     std::shared_ptr<CatalogDescr> descr = command->getExecutableDescr();
     BOOST_TEST( (descr != nullptr) );
     BOOST_TEST( (descr->retention_name == "test") );
+    BOOST_TEST( !descr->retention_preview );
 
   }
 
@@ -1160,6 +1168,382 @@ BOOST_AUTO_TEST_CASE(TestParser)
 
   }
 
+  /* 63 START STREAMING FOR ARCHIVE test RESTART NODETACH */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("START STREAMING FOR ARCHIVE test RESTART NODETACH") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    std::shared_ptr<CatalogDescr> descr = nullptr;
+
+    BOOST_TEST( (command->getCommandTag() == START_STREAMING_FOR_ARCHIVE) );
+    BOOST_REQUIRE_NO_THROW( (descr = command->getExecutableDescr()) );
+
+    BOOST_TEST( (descr != nullptr) );
+    BOOST_TEST( (descr->archive_name == "test") );
+    BOOST_TEST( (descr->stream_archive_names.size() == 0) );
+    BOOST_TEST( descr->forceXLOGPosRestart );
+    BOOST_TEST( !descr->detach );
+
+  }
+
+  /* 64 START STREAMING FOR ARCHIVE test, test2, test3 NODETACH */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("START STREAMING FOR ARCHIVE test, test2,test3 NODETACH") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    std::shared_ptr<CatalogDescr> descr = nullptr;
+
+    BOOST_TEST( (command->getCommandTag() == START_STREAMING_FOR_ARCHIVE) );
+    BOOST_REQUIRE_NO_THROW( (descr = command->getExecutableDescr()) );
+
+    BOOST_TEST( (descr != nullptr) );
+    BOOST_TEST( (descr->archive_name == "test") );
+    BOOST_TEST( (descr->stream_archive_names.size() == 2) );
+
+    if (descr->stream_archive_names.size() == 2) {
+      BOOST_TEST( (descr->stream_archive_names[0] == "test2") );
+      BOOST_TEST( (descr->stream_archive_names[1] == "test3") );
+    }
+
+    BOOST_TEST( !descr->forceXLOGPosRestart );
+    BOOST_TEST( !descr->detach );
+
+  }
+
+  /* 65 SHOW STREAM STATISTICS */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("SHOW STREAM STATISTICS") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    std::shared_ptr<CatalogDescr> descr = nullptr;
+
+    BOOST_TEST( (command->getCommandTag() == SHOW_STREAM_STATISTICS) );
+    BOOST_REQUIRE_NO_THROW( (descr = command->getExecutableDescr()) );
+    BOOST_TEST( (descr != nullptr) );
+
+  }
+
+  /* 66 CREATE BACKUP PROFILE with compression level and workers */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("CREATE BACKUP PROFILE test COMPRESSION=ZSTD LEVEL=9 WORKERS=4 MAX_RATE=1024 PARALLEL=4") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    BOOST_TEST( (command->getCommandTag() == CREATE_BACKUP_PROFILE) );
+
+    std::shared_ptr<CatalogDescr> descr = command->getExecutableDescr();
+    std::shared_ptr<BackupProfileDescr> backup_profile = descr->getBackupProfileDescr();
+
+    BOOST_TEST( (backup_profile != nullptr) );
+    BOOST_TEST( (backup_profile->compress_type == BACKUP_COMPRESS_TYPE_ZSTD) );
+    BOOST_TEST( (backup_profile->compress_level == 9) );
+    BOOST_TEST( (backup_profile->compress_workers == 4) );
+    BOOST_TEST( (backup_profile->max_rate == 1024) );
+    BOOST_TEST( (backup_profile->parallel_writers == 4) );
+
+  }
+
+  /* 67 CREATE BACKUP PROFILE with incremental basebackups */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("CREATE BACKUP PROFILE test MANIFEST INCLUDED INCREMENTAL=TRUE") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    BOOST_TEST( (command->getCommandTag() == CREATE_BACKUP_PROFILE) );
+
+    std::shared_ptr<CatalogDescr> descr = command->getExecutableDescr();
+    std::shared_ptr<BackupProfileDescr> backup_profile = descr->getBackupProfileDescr();
+
+    BOOST_TEST( (backup_profile != nullptr) );
+    BOOST_TEST( (backup_profile->manifest) );
+    BOOST_TEST( (backup_profile->incremental) );
+
+  }
+
+  /* 68 CREATE BACKUP PROFILE with server-side compression */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("CREATE BACKUP PROFILE test COMPRESSION=ZSTD LEVEL=3 WORKERS=2 LOCATION=SERVER") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    BOOST_TEST( (command->getCommandTag() == CREATE_BACKUP_PROFILE) );
+
+    std::shared_ptr<CatalogDescr> descr = command->getExecutableDescr();
+    std::shared_ptr<BackupProfileDescr> backup_profile = descr->getBackupProfileDescr();
+
+    BOOST_TEST( (backup_profile != nullptr) );
+    BOOST_TEST( (backup_profile->compress_type == BACKUP_COMPRESS_TYPE_ZSTD) );
+    BOOST_TEST( (backup_profile->compress_level == 3) );
+    BOOST_TEST( (backup_profile->compress_workers == 2) );
+    BOOST_TEST( (backup_profile->server_compression) );
+
+  }
+
+  /* 69 CREATE BACKUP PROFILE with adaptive rate control */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("CREATE BACKUP PROFILE test MAX_RATE=1024 RATE_CONTROL=ADAPTIVE") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    BOOST_TEST( (command->getCommandTag() == CREATE_BACKUP_PROFILE) );
+
+    std::shared_ptr<CatalogDescr> descr = command->getExecutableDescr();
+    std::shared_ptr<BackupProfileDescr> backup_profile = descr->getBackupProfileDescr();
+
+    BOOST_TEST( (backup_profile != nullptr) );
+    BOOST_TEST( (backup_profile->max_rate == 1024) );
+    BOOST_TEST( (backup_profile->adaptive_rate) );
+
+  }
+
+  /* 70 VERIFY ARCHIVE ... BASEBACKUP */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("VERIFY ARCHIVE test BASEBACKUP 5") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    BOOST_TEST( (command->getCommandTag() == VERIFY_BASEBACKUP) );
+
+    std::shared_ptr<CatalogDescr> descr = command->getExecutableDescr();
+
+    BOOST_TEST( (descr->archive_name == "test") );
+    BOOST_TEST( (descr->basebackup_id == 5) );
+    BOOST_TEST( (descr->verify_workers == 0) );
+
+  }
+
+  /* 71 VERIFY ARCHIVE ... BASEBACKUP with PARALLEL */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("VERIFY ARCHIVE test BASEBACKUP 5 PARALLEL 4") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    BOOST_TEST( (command->getCommandTag() == VERIFY_BASEBACKUP) );
+
+    std::shared_ptr<CatalogDescr> descr = command->getExecutableDescr();
+
+    BOOST_TEST( (descr->basebackup_id == 5) );
+    BOOST_TEST( (descr->verify_workers == 4) );
+
+  }
+
+  /* 72 ALTER ARCHIVE ... SET LOG LAYOUT SHARDED */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("ALTER ARCHIVE test SET LOG LAYOUT SHARDED") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    BOOST_TEST( (command->getCommandTag() == ALTER_ARCHIVE_LOG_LAYOUT) );
+
+    std::shared_ptr<CatalogDescr> descr = command->getExecutableDescr();
+
+    BOOST_TEST( (descr->archive_name == "test") );
+    BOOST_TEST( (descr->log_layout_sharded == true) );
+
+  }
+
+  /* 73 ALTER ARCHIVE ... SET LOG LAYOUT FLAT */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("alter archive test set log layout flat") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    BOOST_TEST( (command->getCommandTag() == ALTER_ARCHIVE_LOG_LAYOUT) );
+
+    std::shared_ptr<CatalogDescr> descr = command->getExecutableDescr();
+
+    BOOST_TEST( (descr->log_layout_sharded == false) );
+
+  }
+
+  /* 74 ALTER ARCHIVE ... SET DSN still works next to SET LOG LAYOUT */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("ALTER ARCHIVE test SET DSN=\"host=localhost\"") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    BOOST_TEST( (command->getCommandTag() == ALTER_ARCHIVE) );
+
+  }
+
+  /* 75 APPLY RETENTION POLICY ... PREVIEW */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("APPLY RETENTION POLICY test TO ARCHIVE test PREVIEW") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    std::shared_ptr<CatalogDescr> descr = command->getExecutableDescr();
+
+    BOOST_TEST( (command->getCommandTag() == APPLY_RETENTION_POLICY) );
+    BOOST_TEST( descr->retention_preview );
+
+  }
+
+  /* 76 CREATE SCHEDULE ... BASEBACKUP */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("CREATE SCHEDULE FOR ARCHIVE test BASEBACKUP PROFILE nightly EVERY 1 DAYS JITTER 2 HOURS PRIORITY 10") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    std::shared_ptr<CatalogDescr> descr = command->getExecutableDescr();
+    std::shared_ptr<ScheduleDescr> schedule = descr->getScheduleDescr();
+
+    BOOST_TEST( (command->getCommandTag() == CREATE_SCHEDULE) );
+    BOOST_TEST( descr->archive_name == "test" );
+    BOOST_REQUIRE( (schedule != nullptr) );
+    BOOST_TEST( (schedule->type == SCHEDULE_BASEBACKUP) );
+    BOOST_TEST( schedule->interval == (unsigned int) 86400 );
+    BOOST_TEST( schedule->jitter == (unsigned int) 7200 );
+    BOOST_TEST( schedule->priority == 10 );
+    BOOST_TEST( descr->getBackupProfileDescr()->name == "nightly" );
+
+  }
+
+  /* 77 CREATE SCHEDULE ... VERIFY */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("CREATE SCHEDULE FOR ARCHIVE test VERIFY EVERY 30 MINUTES") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    std::shared_ptr<ScheduleDescr> schedule = command->getExecutableDescr()->getScheduleDescr();
+
+    BOOST_TEST( (command->getCommandTag() == CREATE_SCHEDULE) );
+    BOOST_REQUIRE( (schedule != nullptr) );
+    BOOST_TEST( (schedule->type == SCHEDULE_VERIFY) );
+    BOOST_TEST( schedule->interval == (unsigned int) 1800 );
+    BOOST_TEST( schedule->jitter == (unsigned int) 0 );
+
+  }
+
+  /* 78 DROP SCHEDULE */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("DROP SCHEDULE FOR ARCHIVE test VERIFY") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    BOOST_TEST( (command->getCommandTag() == DROP_SCHEDULE) );
+    BOOST_TEST( (command->getExecutableDescr()->getScheduleDescr()->type == SCHEDULE_VERIFY) );
+
+  }
+
+  /* 79 RESTORE ... RECOVERY TARGET TIME ... PREVIEW */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("RESTORE FROM ARCHIVE abc RECOVERY TARGET TIME \"2024-03-01 12:00:00\" TO DIRECTORY=\"/tmp/restore\" PREVIEW") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    std::shared_ptr<RestoreDescr> restoreDescr = command->getExecutableDescr()->getRestoreDescr();
+
+    BOOST_TEST( (command->getCommandTag() == RESTORE_BACKUP) );
+    BOOST_TEST( (restoreDescr->id.type == RESTORE_BASEBACKUP_BY_TARGET) );
+    BOOST_TEST( (restoreDescr->target_type == RESTORE_TARGET_TIME) );
+    BOOST_TEST( restoreDescr->target == "2024-03-01 12:00:00" );
+    BOOST_TEST( restoreDescr->preview );
+
+  }
+
+  /* 80 RESTORE ... RECOVERY TARGET LSN ... TIMELINE */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("RESTORE abc RECOVERY TARGET LSN \"0/5000028\" TIMELINE 2 TO DIRECTORY=\"/tmp/restore\"") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    std::shared_ptr<RestoreDescr> restoreDescr = command->getExecutableDescr()->getRestoreDescr();
+
+    BOOST_TEST( (restoreDescr->target_type == RESTORE_TARGET_LSN) );
+    BOOST_TEST( restoreDescr->target == "0/5000028" );
+    BOOST_TEST( restoreDescr->target_timeline == 2 );
+    BOOST_TEST( !restoreDescr->preview );
+
+  }
+
+  /* 81 CREATE BACKUP PROFILE with deduplication */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("CREATE BACKUP PROFILE test COMPRESSION=ZSTD MANIFEST INCLUDED DEDUPLICATE=TRUE") );
+
+  command = parser.getCommand();
+  BOOST_TEST( (command != nullptr) );
+
+  if (COMMAND_IS_VALID(command, count_parser_checks)) {
+
+    BOOST_TEST( (command->getCommandTag() == CREATE_BACKUP_PROFILE) );
+
+    std::shared_ptr<BackupProfileDescr> backup_profile
+      = command->getExecutableDescr()->getBackupProfileDescr();
+
+    BOOST_TEST( (backup_profile != nullptr) );
+    BOOST_TEST( (backup_profile->compress_type == BACKUP_COMPRESS_TYPE_ZSTD) );
+    BOOST_TEST( (backup_profile->manifest) );
+    BOOST_TEST( (backup_profile->deduplicate) );
+
+  }
+
+  /* RECOVERY TARGET LATEST isn't counted, it has no target to check */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("RESTORE abc RECOVERY TARGET LATEST TO DIRECTORY=\"/tmp/restore\"") );
+  BOOST_TEST( (parser.getCommand()->getExecutableDescr()->getRestoreDescr()->target_type == RESTORE_TARGET_LATEST) );
+
+  /* RECOVERY TARGET TIMELINE 0 should throw */
+  BOOST_CHECK_THROW( parser.parseLine("RESTORE abc RECOVERY TARGET LATEST TIMELINE 0 TO DIRECTORY=\"/tmp/restore\""),
+                     std::exception );
+
+  /* LIST SCHEDULES isn't counted, it has no arguments to check */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("LIST SCHEDULES") );
+  BOOST_TEST( (parser.getCommand()->getCommandTag() == LIST_SCHEDULES) );
+
+  /* CREATE SCHEDULE without an interval should throw */
+  BOOST_CHECK_THROW( parser.parseLine("CREATE SCHEDULE FOR ARCHIVE test BASEBACKUP"),
+                     CParserIssue );
+
+  /* SET LOG without a valid layout should throw */
+  BOOST_CHECK_THROW( parser.parseLine("ALTER ARCHIVE test SET LOG LAYOUT ROUNDROBIN"),
+                     CParserIssue );
+
+  /* LEVEL without COMPRESSION should throw */
+  BOOST_CHECK_THROW( parser.parseLine("CREATE BACKUP PROFILE test LEVEL=9"),
+                     CParserIssue );
+
+  /* Trailing comma in archive list should throw */
+  BOOST_CHECK_THROW( parser.parseLine("START STREAMING FOR ARCHIVE test,"),
+                     CParserIssue );
+
   /* IMPORTANT: Keep that check in sync with the number of
    * successful parser checks NUM_SUCCESSFUL_PARSER_COMMANDS
    *
@@ -1168,3 +1552,58 @@ BOOST_AUTO_TEST_CASE(TestParser)
   BOOST_TEST( count_parser_checks == NUM_SUCCESSFUL_PARSER_COMMANDS );
 
 }
+
+BOOST_AUTO_TEST_CASE(TestParserCommandFile)
+{
+  std::shared_ptr<PGBackupCtlCommand> first = nullptr;
+  std::vector<std::shared_ptr<PGBackupCtlCommand>> commands;
+  std::vector<std::string> split;
+  PGBackupCtlParser parser;
+
+  /*
+   * The grammar is reused across parseLine() calls, commands
+   * parsed before must not be touched by later ones.
+   */
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("DROP ARCHIVE first") );
+  first = parser.getCommand();
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("VERIFY ARCHIVE second") );
+
+  BOOST_TEST( first->archive_name() == "first" );
+  BOOST_TEST( (first->getCommandTag() == DROP_ARCHIVE) );
+  BOOST_TEST( parser.getCommand()->archive_name() == "second" );
+  BOOST_TEST( (parser.getCommand()->getCommandTag() == VERIFY_ARCHIVE) );
+
+  /* A failed parse must not leak into the next one */
+  BOOST_CHECK_THROW( parser.parseLine("DROP ARCHIVE"), CParserIssue );
+  BOOST_REQUIRE_NO_THROW( parser.parseLine("LIST ARCHIVE") );
+  BOOST_TEST( parser.getCommand()->archive_name() == "" );
+
+  /*
+   * Semicolons within quotes don't separate commands,
+   * comments and empty commands are skipped.
+   */
+  std::istringstream script("-- create the archive\n"
+                            "CREATE ARCHIVE test PARAMS\n"
+                            "  DIRECTORY=\"/tmp/a;b\" PGHOST=localhost;;\n"
+                            "  -- comment\n"
+                            "LIST ARCHIVE test; VERIFY ARCHIVE test\n");
+  split = PGBackupCtlParser::splitCommands(script);
+
+  BOOST_REQUIRE( split.size() == 3 );
+  BOOST_TEST( split[0].find("DIRECTORY=\"/tmp/a;b\"") != std::string::npos );
+
+  /* parseStream() returns all commands in order */
+  std::istringstream stream("DROP ARCHIVE a;\nDROP ARCHIVE b;\nLIST ARCHIVE c;\n");
+  BOOST_REQUIRE_NO_THROW( parser.parseStream(stream) );
+  commands = parser.getCommands();
+
+  BOOST_REQUIRE( commands.size() == 3 );
+  BOOST_TEST( commands[0]->archive_name() == "a" );
+  BOOST_TEST( commands[1]->archive_name() == "b" );
+  BOOST_TEST( commands[2]->archive_name() == "c" );
+  BOOST_TEST( parser.getCommand() == commands[2] );
+
+  /* A syntax error in any command fails the whole stream */
+  std::istringstream broken("DROP ARCHIVE a; DROP ARCHIVE; LIST ARCHIVE");
+  BOOST_CHECK_THROW( parser.parseStream(broken), CParserIssue );
+}
@@ -0,0 +1,2394 @@
+#define BOOST_TEST_MODULE TestWALFile
+#include <sys/file.h>
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <tuple>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <common.hxx>
+#include <fs-archive.hxx>
+#include <backup.hxx>
+#include <backupprocesses.hxx>
+#include <checksum.hxx>
+#include <verifybackup.hxx>
+#include <recovery.hxx>
+#include <walindex.hxx>
+#include <walcache.hxx>
+#include <walrestore.hxx>
+#include <objectstorage.hxx>
+
+extern "C" {
+#include <sys/wait.h>
+#include <unistd.h>
+}
+
+using namespace pgbckctl;
+
+/*
+ * Size of our fake WAL segment, 1MB is the
+ * smallest valid WAL segment size.
+ */
+#define TEST_WAL_SEGMENT_SIZE (1024 * 1024)
+
+static std::shared_ptr<BackupDirectory> test_archive_dir() {
+
+  path archivePath = path(BackupDirectory::system_temp_directory() / "_walFileTestArchive");
+
+  if (boost::filesystem::exists(archivePath))
+    boost::filesystem::remove_all(archivePath);
+
+  boost::filesystem::create_directories(archivePath);
+
+  std::shared_ptr<BackupDirectory> archiveDir
+    = std::make_shared<BackupDirectory>(archivePath);
+  archiveDir->create();
+
+  return archiveDir;
+
+}
+
+/*
+ * Writes a fake WAL segment with the specified compression method,
+ * renames it into its final name and reads it back.
+ */
+static void test_segment_roundtrip(BackupProfileCompressType compression,
+                                   std::string suffix) {
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  std::vector<char> data(TEST_WAL_SEGMENT_SIZE);
+  std::vector<char> readback(TEST_WAL_SEGMENT_SIZE);
+  std::string segname = "000000010000000000000001";
+  size_t rbytes = 0;
+  size_t r;
+
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (char) ((i / 512) % 251);
+
+  std::shared_ptr<BackupFile> walfile
+    = archiveDir->walfile(segname + ".partial", compression, 1);
+
+  walfile->setOpenMode("wb");
+  walfile->open();
+
+  /* write in chunks, like the walstreamer does */
+  for (size_t off = 0; off < data.size(); off += 8192)
+    walfile->write(data.data() + off, 8192);
+
+  walfile->fsync();
+  BOOST_TEST(walfile->current_position() == TEST_WAL_SEGMENT_SIZE);
+
+  path partialName(walfile->getFilePath());
+  BOOST_TEST(partialName.filename().string() == segname + ".partial" + suffix);
+  BOOST_TEST(logDir->determineXlogSegmentStatus(partialName) == WAL_SEGMENT_PARTIAL_COMPRESSED);
+  BOOST_TEST(ArchiveLogDirectory::xlogCompressionType(partialName) == compression);
+
+  /* rename() finishes the compressed stream and closes the file */
+  path finalName = logDir->getPath() / (segname + suffix);
+  walfile->rename(finalName);
+  BOOST_TEST(!walfile->isOpen());
+
+  BOOST_TEST(logDir->determineXlogSegmentStatus(finalName) == WAL_SEGMENT_COMPLETE_COMPRESSED);
+  BOOST_TEST(logDir->getXlogSegmentSize(finalName,
+                                        TEST_WAL_SEGMENT_SIZE,
+                                        WAL_SEGMENT_COMPLETE_COMPRESSED) == TEST_WAL_SEGMENT_SIZE);
+
+  /* compression should have done something on our data */
+  BOOST_TEST(file_size(finalName) < TEST_WAL_SEGMENT_SIZE);
+
+  walfile->setOpenMode("rb");
+  walfile->open();
+
+  while (rbytes < readback.size()
+         && (r = walfile->read(readback.data() + rbytes,
+                               std::min((size_t) 65536, readback.size() - rbytes))) > 0)
+    rbytes += r;
+
+  walfile->close();
+
+  BOOST_TEST(rbytes == TEST_WAL_SEGMENT_SIZE);
+  BOOST_TEST((data == readback));
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+BOOST_AUTO_TEST_CASE(TestSegmentStatus)
+{
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+
+  std::vector<std::pair<std::string, WALSegmentFileStatus>> files = {
+    { "000000010000000000000001", WAL_SEGMENT_COMPLETE },
+    { "000000010000000000000001.gz", WAL_SEGMENT_COMPLETE_COMPRESSED },
+    { "000000010000000000000001.zst", WAL_SEGMENT_COMPLETE_COMPRESSED },
+    { "000000010000000000000001.lz4", WAL_SEGMENT_COMPLETE_COMPRESSED },
+    { "000000010000000000000002.partial", WAL_SEGMENT_PARTIAL },
+    { "000000010000000000000002.partial.gz", WAL_SEGMENT_PARTIAL_COMPRESSED },
+    { "000000010000000000000002.partial.zst", WAL_SEGMENT_PARTIAL_COMPRESSED },
+    { "000000010000000000000002.partial.lz4", WAL_SEGMENT_PARTIAL_COMPRESSED },
+    { "00000002.history", WAL_SEGMENT_TLI_HISTORY_FILE },
+    { "00000002.history.zst", WAL_SEGMENT_TLI_HISTORY_FILE_COMPRESSED },
+    { "000000010000000000000002.partial.bz2", WAL_SEGMENT_INVALID_FILENAME },
+    { "xlogtemp.prealloc.0", WAL_SEGMENT_INVALID_FILENAME }
+  };
+
+  for (auto &f : files) {
+
+    ArchiveFile file(logDir->getPath() / f.first);
+
+    file.setOpenMode("w");
+    file.open();
+    file.close();
+
+    BOOST_TEST(logDir->determineXlogSegmentStatus(logDir->getPath() / f.first) == f.second);
+
+  }
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+static void touch_log_file(std::shared_ptr<ArchiveLogDirectory> logDir,
+                           std::string filename) {
+
+  ArchiveFile file(logDir->getPath() / filename);
+
+  file.setOpenMode("w");
+  file.open();
+  file.close();
+
+}
+
+BOOST_AUTO_TEST_CASE(TestWALSegmentIndex)
+{
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  WALSegmentIndexEntry last;
+  unsigned int tli = 0;
+  unsigned int segno = 0;
+  std::string xlogpos;
+
+  for (int i = 1; i <= 5; i++) {
+    touch_log_file(logDir, (boost::format("%08X%08X%08X") % 1 % 0 % i).str());
+  }
+
+  touch_log_file(logDir, "000000010000000000000006.partial");
+  touch_log_file(logDir, "00000002.history");
+  touch_log_file(logDir, "xlogtemp.prealloc.0");
+
+  /*
+   * No index yet, so this scans the log directory and
+   * creates the index.
+   */
+  xlogpos = logDir->getXlogStartPosition(tli, segno, TEST_WAL_SEGMENT_SIZE);
+
+  BOOST_TEST(tli == 1);
+  BOOST_TEST(segno == 6);
+  BOOST_TEST(xlogpos.length() > 0);
+  BOOST_TEST(boost::filesystem::exists(logDir->getPath() / WALSegmentIndex::INDEX_FILENAME));
+
+  {
+    WALSegmentIndex index(logDir->getPath(), TEST_WAL_SEGMENT_SIZE);
+
+    BOOST_TEST(index.size() == 7);
+    BOOST_TEST(index.range(1, 2, 4).size() == 3);
+    BOOST_TEST(index.range(2, 1, 6).size() == 0);
+
+    /*
+     * Streaming finalizes the partial segment and stacks a new one.
+     */
+    boost::filesystem::rename(logDir->getPath() / "000000010000000000000006.partial",
+                              logDir->getPath() / "000000010000000000000006");
+    index.rename("000000010000000000000006.partial",
+                 "000000010000000000000006",
+                 TEST_WAL_SEGMENT_SIZE);
+    touch_log_file(logDir, "000000010000000000000007.partial");
+    index.add("000000010000000000000007.partial", 0);
+
+    BOOST_TEST(index.size() == 8);
+    BOOST_TEST(index.last(last));
+    BOOST_TEST(last.segno == 7);
+    BOOST_TEST(last.status == WAL_SEGMENT_PARTIAL);
+
+    /*
+     * Another instance must see the same, without a rebuild.
+     */
+    WALSegmentIndex other(logDir->getPath(), TEST_WAL_SEGMENT_SIZE);
+
+    BOOST_TEST(other.last(last));
+    BOOST_TEST(last.segno == 7);
+    BOOST_TEST(other.range(1, 6, 6).front().status == WAL_SEGMENT_COMPLETE);
+    BOOST_TEST(other.range(1, 6, 6).front().size == TEST_WAL_SEGMENT_SIZE);
+
+    /*
+     * Removing files compacts the index, the first instance
+     * must pick that up.
+     */
+    other.remove({ "000000010000000000000001", "000000010000000000000002" });
+    BOOST_TEST(index.size() == 6);
+    BOOST_TEST(index.range(1, 0, 7).front().segno == 3);
+  }
+
+  /*
+   * A file created behind the back of the index must be
+   * found by a rebuild.
+   */
+  touch_log_file(logDir, "000000020000000000000009");
+
+  {
+    WALSegmentIndex index(logDir->getPath(), TEST_WAL_SEGMENT_SIZE);
+
+    BOOST_TEST(index.last(last));
+    BOOST_TEST(last.timeline == 2);
+    BOOST_TEST(last.segno == 9);
+  }
+
+  /*
+   * A truncated index is rebuilt, too.
+   */
+  boost::filesystem::resize_file(logDir->getPath() / WALSegmentIndex::INDEX_FILENAME,
+                                 boost::filesystem::file_size(logDir->getPath()
+                                                              / WALSegmentIndex::INDEX_FILENAME) - 10);
+
+  {
+    WALSegmentIndex index(logDir->getPath(), TEST_WAL_SEGMENT_SIZE);
+
+    /* segments 1 and 2 were only removed from the index */
+    BOOST_TEST(index.size() == 9);
+  }
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+BOOST_AUTO_TEST_CASE(TestRemoveXLogs)
+{
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  std::shared_ptr<BackupCleanupDescr> cleanupDescr = std::make_shared<BackupCleanupDescr>();
+  std::shared_ptr<xlog_cleanup_off_t> offset = std::make_shared<xlog_cleanup_off_t>();
+  XLogRemovalResult result;
+  std::vector<char> data(4096, 'x');
+
+  /*
+   * TLI 1 isn't referenced by any basebackup anymore, TLI 2
+   * should be cleaned up to segment 0x600 (including).
+   */
+  for (int i = 1; i <= 0x400; i++) {
+
+    ArchiveFile file(logDir->getPath() / (boost::format("%08X%08X%08X") % 1 % 0 % i).str());
+
+    file.setOpenMode("w");
+    file.open();
+    file.write(data.data(), data.size());
+    file.close();
+
+  }
+
+  for (int i = 0x401; i <= 0x800; i++)
+    touch_log_file(logDir, (boost::format("%08X%08X%08X") % 2 % 0 % i).str());
+
+  touch_log_file(logDir, "00000002.history");
+
+  offset->timeline = 2;
+  offset->wal_segment_size = TEST_WAL_SEGMENT_SIZE;
+#if PG_VERSION_NUM < 110000
+  XLogSegNoOffsetToRecPtr(0x600, 0, offset->wal_cleanup_start_pos);
+#else
+  XLogSegNoOffsetToRecPtr(0x600, 0, TEST_WAL_SEGMENT_SIZE, offset->wal_cleanup_start_pos);
+#endif
+  cleanupDescr->off_list[2] = offset;
+  cleanupDescr->mode = WAL_CLEANUP_OFFSET;
+
+  result = logDir->removeXLogs(cleanupDescr, TEST_WAL_SEGMENT_SIZE, true);
+
+  BOOST_TEST(result.dry_run);
+  BOOST_TEST(result.files == (0x400 + 0x200));
+  BOOST_TEST(result.bytes == 0x400 * data.size());
+  BOOST_TEST(boost::filesystem::exists(logDir->getPath() / "000000010000000000000001"));
+
+  result = logDir->removeXLogs(cleanupDescr, TEST_WAL_SEGMENT_SIZE);
+
+  BOOST_TEST(!result.dry_run);
+  BOOST_TEST(result.files == (0x400 + 0x200));
+  BOOST_TEST(result.bytes == 0x400 * data.size());
+  BOOST_TEST(!boost::filesystem::exists(logDir->getPath() / "000000010000000000000001"));
+  BOOST_TEST(!boost::filesystem::exists(logDir->getPath() / "000000020000000000000600"));
+  BOOST_TEST(boost::filesystem::exists(logDir->getPath() / "000000020000000000000601"));
+  BOOST_TEST(boost::filesystem::exists(logDir->getPath() / "00000002.history"));
+
+  /* The segment index must have followed */
+  {
+    WALSegmentIndex index(logDir->getPath(), TEST_WAL_SEGMENT_SIZE);
+    BOOST_TEST(index.size() == (0x200 + 1));
+  }
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+BOOST_AUTO_TEST_CASE(TestMoveXLogs)
+{
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  std::shared_ptr<BackupCleanupDescr> cleanupDescr = std::make_shared<BackupCleanupDescr>();
+  std::shared_ptr<xlog_cleanup_off_t> offset = std::make_shared<xlog_cleanup_off_t>();
+  path coldDir = archiveDir->getArchiveDir().string() + "_cold";
+  path moved = logDir->getPath() / "000000010000000000000002";
+  XLogRemovalResult result;
+  std::vector<char> data(4096, 'x');
+  std::vector<char> readback(data.size());
+
+  boost::filesystem::remove_all(coldDir);
+
+  for (int i = 1; i <= 8; i++) {
+
+    ArchiveFile file(logDir->getPath() / (boost::format("%08X%08X%08X") % 1 % 0 % i).str());
+
+    file.setOpenMode("w");
+    file.open();
+    file.write(data.data(), data.size());
+    file.close();
+
+  }
+
+  touch_log_file(logDir, "00000001.history");
+
+  /* Segments up to 4 (including) are moved */
+  offset->timeline = 1;
+  offset->wal_segment_size = TEST_WAL_SEGMENT_SIZE;
+#if PG_VERSION_NUM < 110000
+  XLogSegNoOffsetToRecPtr(4, 0, offset->wal_cleanup_start_pos);
+#else
+  XLogSegNoOffsetToRecPtr(4, 0, TEST_WAL_SEGMENT_SIZE, offset->wal_cleanup_start_pos);
+#endif
+  cleanupDescr->off_list[1] = offset;
+  cleanupDescr->mode = WAL_CLEANUP_OFFSET;
+
+  result = logDir->moveXLogs(cleanupDescr, TEST_WAL_SEGMENT_SIZE, coldDir / "log", true);
+
+  BOOST_TEST(result.dry_run);
+  BOOST_TEST(result.files == 4);
+  BOOST_TEST(!boost::filesystem::exists(coldDir / "log"));
+
+  result = logDir->moveXLogs(cleanupDescr, TEST_WAL_SEGMENT_SIZE, coldDir / "log");
+
+  BOOST_TEST(result.files == 4);
+  BOOST_TEST(result.bytes == 4 * data.size());
+  BOOST_TEST(boost::filesystem::is_symlink(moved));
+  BOOST_TEST(boost::filesystem::exists(coldDir / "log" / "000000010000000000000002"));
+  BOOST_TEST(!boost::filesystem::is_symlink(logDir->getPath() / "000000010000000000000005"));
+  BOOST_TEST(!boost::filesystem::is_symlink(logDir->getPath() / "00000001.history"));
+
+  /* A moved segment reads as before */
+  {
+    ArchiveFile file(moved);
+
+    file.setOpenMode("rb");
+    file.open();
+    file.read(readback.data(), readback.size());
+    file.close();
+
+    BOOST_TEST((readback == data));
+  }
+
+  /* Moving again skips what was moved before */
+  result = logDir->moveXLogs(cleanupDescr, TEST_WAL_SEGMENT_SIZE, coldDir / "log");
+  BOOST_TEST(result.files == 0);
+
+  /* Removing a moved segment removes its copy, too */
+#if PG_VERSION_NUM < 110000
+  XLogSegNoOffsetToRecPtr(2, 0, offset->wal_cleanup_start_pos);
+#else
+  XLogSegNoOffsetToRecPtr(2, 0, TEST_WAL_SEGMENT_SIZE, offset->wal_cleanup_start_pos);
+#endif
+
+  result = logDir->removeXLogs(cleanupDescr, TEST_WAL_SEGMENT_SIZE);
+
+  BOOST_TEST(result.files == 2);
+  BOOST_TEST(result.bytes == 2 * data.size());
+  BOOST_TEST(!boost::filesystem::exists(boost::filesystem::symlink_status(moved)));
+  BOOST_TEST(!boost::filesystem::exists(coldDir / "log" / "000000010000000000000002"));
+  BOOST_TEST(boost::filesystem::exists(coldDir / "log" / "000000010000000000000003"));
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+  boost::filesystem::remove_all(coldDir);
+
+}
+
+BOOST_AUTO_TEST_CASE(TestShardedLogLayout)
+{
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  std::shared_ptr<BackupCleanupDescr> cleanupDescr = std::make_shared<BackupCleanupDescr>();
+  std::shared_ptr<xlog_cleanup_off_t> offset = std::make_shared<xlog_cleanup_off_t>();
+  std::shared_ptr<BackupFile> file = nullptr;
+  path shard = logDir->getPath() / "00000001" / "00000000";
+  unsigned int tli = 0;
+  unsigned int segno = 0;
+  XLogRemovalResult result;
+
+  BOOST_TEST(logDir->getLogLayout() == WAL_LOG_LAYOUT_FLAT);
+
+  for (int i = 1; i <= 5; i++) {
+    touch_log_file(logDir, (boost::format("%08X%08X%08X") % 1 % 0 % i).str());
+  }
+
+  touch_log_file(logDir, "000000010000000000000006.partial");
+  touch_log_file(logDir, "00000001.history");
+
+  BOOST_TEST(logDir->migrateLogLayout(WAL_LOG_LAYOUT_SHARDED) == 5);
+  BOOST_TEST(logDir->getLogLayout() == WAL_LOG_LAYOUT_SHARDED);
+
+  BOOST_TEST(boost::filesystem::exists(shard / "000000010000000000000001"));
+  BOOST_TEST(!boost::filesystem::exists(logDir->getPath() / "000000010000000000000001"));
+  BOOST_TEST(boost::filesystem::exists(logDir->getPath() / "000000010000000000000006.partial"));
+  BOOST_TEST(boost::filesystem::exists(logDir->getPath() / "00000001.history"));
+
+  /*
+   * Partial segments stay where they are, locating them
+   * must fall back to the flat location.
+   */
+  BOOST_TEST(logDir->xlogFilePath("000000010000000000000006.partial")
+             == (shard / "000000010000000000000006.partial"));
+  BOOST_TEST(logDir->locateXLogFile("000000010000000000000006.partial")
+             == (logDir->getPath() / "000000010000000000000006.partial"));
+  BOOST_TEST(logDir->locateXLogFile("00000001.history")
+             == (logDir->getPath() / "00000001.history"));
+
+  /* The start position must be found within the shards */
+  logDir->getXlogStartPosition(tli, segno, TEST_WAL_SEGMENT_SIZE);
+
+  BOOST_TEST(tli == 1);
+  BOOST_TEST(segno == 6);
+
+  /* New files are created within their shard directory */
+  file = archiveDir->walfile("000000010000000100000001", BACKUP_COMPRESS_TYPE_NONE);
+  file->setOpenMode("w");
+  file->open();
+  file->close();
+
+  BOOST_TEST(boost::filesystem::exists(logDir->getPath() / "00000001" / "00000001"
+                                       / "000000010000000100000001"));
+
+  /* Retention must find and remove segments within the shards */
+  offset->timeline = 1;
+  offset->wal_segment_size = TEST_WAL_SEGMENT_SIZE;
+#if PG_VERSION_NUM < 110000
+  XLogSegNoOffsetToRecPtr(3, 0, offset->wal_cleanup_start_pos);
+#else
+  XLogSegNoOffsetToRecPtr(3, 0, TEST_WAL_SEGMENT_SIZE, offset->wal_cleanup_start_pos);
+#endif
+  cleanupDescr->off_list[1] = offset;
+  cleanupDescr->mode = WAL_CLEANUP_OFFSET;
+
+  result = logDir->removeXLogs(cleanupDescr, TEST_WAL_SEGMENT_SIZE);
+
+  BOOST_TEST(result.files == 3);
+  BOOST_TEST(!boost::filesystem::exists(shard / "000000010000000000000003"));
+  BOOST_TEST(boost::filesystem::exists(shard / "000000010000000000000004"));
+
+  /* Migrating back drops the shard directories */
+  BOOST_TEST(logDir->migrateLogLayout(WAL_LOG_LAYOUT_FLAT) == 3);
+  BOOST_TEST(logDir->getLogLayout() == WAL_LOG_LAYOUT_FLAT);
+
+  BOOST_TEST(boost::filesystem::exists(logDir->getPath() / "000000010000000000000004"));
+  BOOST_TEST(boost::filesystem::exists(logDir->getPath() / "000000010000000100000001"));
+  BOOST_TEST(!boost::filesystem::exists(logDir->getPath() / "00000001"));
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+BOOST_AUTO_TEST_CASE(TestGzipSegment)
+{
+  test_segment_roundtrip(BACKUP_COMPRESS_TYPE_GZIP, ".gz");
+}
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+BOOST_AUTO_TEST_CASE(TestZstdSegment)
+{
+  test_segment_roundtrip(BACKUP_COMPRESS_TYPE_ZSTD, ".zst");
+}
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+BOOST_AUTO_TEST_CASE(TestLZ4Segment)
+{
+  test_segment_roundtrip(BACKUP_COMPRESS_TYPE_LZ4, ".lz4");
+}
+#endif
+
+/*
+ * Writes a framed fake WAL segment with the specified compression
+ * method and positions a reader at various offsets. The segment must
+ * still be readable as a plain compressed stream.
+ */
+static void test_framed_segment(BackupProfileCompressType compression,
+                                std::string suffix) {
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  std::vector<char> data(TEST_WAL_SEGMENT_SIZE);
+  std::vector<char> readback(TEST_WAL_SEGMENT_SIZE);
+  std::string segname = "000000010000000000000001";
+  std::vector<CompressedFrame> frames;
+  uint64_t total_size = 0;
+  size_t rbytes = 0;
+  size_t r;
+  char buf[512];
+
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (char) ((i * 7 / 512) % 251);
+
+  /* 16 XLOG blocks per frame gives 8 frames */
+  std::shared_ptr<FramedArchiveFile> walfile
+    = std::make_shared<FramedArchiveFile>(archiveDir->walfile(segname + ".partial", compression, 1),
+                                          16 * 8192);
+
+  walfile->setOpenMode("wb");
+  walfile->open();
+
+  /* odd sized chunks, so frame boundaries fall within writes */
+  for (size_t off = 0; off < data.size(); off += 3000)
+    walfile->write(data.data() + off, std::min((size_t) 3000, data.size() - off));
+
+  BOOST_TEST(walfile->getFrames().size() == 8);
+
+  path finalName = logDir->getPath() / (segname + suffix);
+  walfile->rename(finalName);
+  BOOST_TEST(!walfile->isOpen());
+
+  BOOST_REQUIRE(FramedArchiveFile::readFrameTable(finalName, frames, total_size));
+  BOOST_TEST(frames.size() == 8);
+  BOOST_TEST(total_size == TEST_WAL_SEGMENT_SIZE);
+  BOOST_TEST(frames[3].uncompressed_offset == 3 * 16 * 8192);
+  BOOST_TEST(logDir->getXlogSegmentSize(finalName,
+                                        TEST_WAL_SEGMENT_SIZE,
+                                        WAL_SEGMENT_COMPLETE_COMPRESSED) == TEST_WAL_SEGMENT_SIZE);
+
+  /* The frame table is invisible to a plain reader */
+  std::shared_ptr<BackupFile> plain = archiveDir->walfile(segname, compression, 1);
+  plain->setOpenMode("rb");
+  plain->open();
+
+  while (rbytes < readback.size()
+         && (r = plain->read(readback.data() + rbytes,
+                             std::min((size_t) 65536, readback.size() - rbytes))) > 0)
+    rbytes += r;
+
+  BOOST_TEST(plain->read(buf, 1) == 0);
+  plain->close();
+
+  BOOST_TEST(rbytes == TEST_WAL_SEGMENT_SIZE);
+  BOOST_TEST((data == readback));
+
+  /* Seek forward, backward and within frames */
+  std::shared_ptr<FramedArchiveFile> reader = FramedArchiveFile::forReading(finalName);
+  std::vector<off_t> offsets = { 700000, 12345, 131072, 131072 + 8192, 1048000, 0, 524289 };
+
+  reader->open();
+  BOOST_TEST(reader->hasFrameTable());
+
+  for (off_t offset : offsets) {
+
+    size_t n = std::min((size_t) sizeof(buf), (size_t) (TEST_WAL_SEGMENT_SIZE - offset));
+
+    BOOST_TEST(reader->lseek(offset, SEEK_SET) == offset);
+    BOOST_TEST(reader->read(buf, n) == n);
+    BOOST_TEST(memcmp(buf, data.data() + offset, n) == 0);
+
+  }
+
+  /* LSN 0/1A0028 lies 0xA0028 bytes into segment 1 */
+  BOOST_TEST(reader->seekLSN((XLogRecPtr) 0x1A0028, TEST_WAL_SEGMENT_SIZE) == 0xA0028);
+  BOOST_TEST(reader->read(buf, sizeof(buf)) == sizeof(buf));
+  BOOST_TEST(memcmp(buf, data.data() + 0xA0028, sizeof(buf)) == 0);
+
+  BOOST_CHECK_THROW(reader->lseek(TEST_WAL_SEGMENT_SIZE + 1, SEEK_SET), CArchiveIssue);
+  reader->close();
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+BOOST_AUTO_TEST_CASE(TestFramedGzipSegment)
+{
+  test_framed_segment(BACKUP_COMPRESS_TYPE_GZIP, ".gz");
+}
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+BOOST_AUTO_TEST_CASE(TestFramedZstdSegment)
+{
+  test_framed_segment(BACKUP_COMPRESS_TYPE_ZSTD, ".zst");
+}
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+BOOST_AUTO_TEST_CASE(TestFramedLZ4Segment)
+{
+  test_framed_segment(BACKUP_COMPRESS_TYPE_LZ4, ".lz4");
+}
+#endif
+
+/*
+ * Writes a fake basebackup tarball into a streamed basebackup
+ * directory with the specified compression method and worker threads,
+ * and reads it back.
+ */
+static void test_basebackup_roundtrip(BackupProfileCompressType compression,
+                                      std::string suffix,
+                                      int workers) {
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  StreamingBaseBackupDirectory streamDir("streambackup-test",
+                                         archiveDir->getArchiveDir());
+  std::vector<char> data(8 * TEST_WAL_SEGMENT_SIZE);
+  std::vector<char> readback(data.size());
+  size_t rbytes = 0;
+  size_t r;
+
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (char) ((i / 512) % 251);
+
+  streamDir.create();
+
+  std::shared_ptr<BackupFile> tarball
+    = streamDir.basebackup("base.tar", compression, 1, workers);
+
+  BOOST_TEST(path(tarball->getFilePath()).filename().string() == "base.tar" + suffix);
+
+  tarball->setOpenMode("wb");
+  tarball->open();
+
+  for (size_t off = 0; off < data.size(); off += 65536)
+    tarball->write(data.data() + off, 65536);
+
+  /* flushing in between must not break the stream */
+  tarball->fsync();
+  tarball->close();
+
+  BOOST_TEST(file_size(tarball->getFilePath()) < data.size());
+
+  tarball->setOpenMode("rb");
+  tarball->open();
+
+  while (rbytes < readback.size()
+         && (r = tarball->read(readback.data() + rbytes,
+                               std::min((size_t) 65536, readback.size() - rbytes))) > 0)
+    rbytes += r;
+
+  /* nothing left after the end of the stream */
+  BOOST_TEST(tarball->read(readback.data(), 1) == 0);
+  tarball->close();
+
+  BOOST_TEST(rbytes == data.size());
+  BOOST_TEST((data == readback));
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+BOOST_AUTO_TEST_CASE(TestZstdBasebackupWorkers)
+{
+  test_basebackup_roundtrip(BACKUP_COMPRESS_TYPE_ZSTD, ".zst", 2);
+}
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZMA
+BOOST_AUTO_TEST_CASE(TestXZBasebackup)
+{
+  test_basebackup_roundtrip(BACKUP_COMPRESS_TYPE_XZ, ".xz", 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestXZBasebackupWorkers)
+{
+  test_basebackup_roundtrip(BACKUP_COMPRESS_TYPE_XZ, ".xz", 2);
+}
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+BOOST_AUTO_TEST_CASE(TestLZ4Basebackup)
+{
+  test_basebackup_roundtrip(BACKUP_COMPRESS_TYPE_LZ4, ".lz4", 0);
+}
+#endif
+
+/*
+ * Returns a ustar header, for a regular file by default.
+ */
+static std::vector<char> test_tar_header(std::string name, size_t size,
+                                         char type = '0',
+                                         std::string link = "") {
+
+  std::vector<char> header(512, 0);
+  unsigned int checksum = 0;
+
+  memcpy(header.data(), name.c_str(), name.length());
+  snprintf(header.data() + 100, 8, "%07o", (type == '5') ? 0700 : 0600);
+  snprintf(header.data() + 124, 12, "%011lo", (unsigned long) size);
+  header[156] = type;
+  memcpy(header.data() + 157, link.c_str(), link.length());
+  memcpy(header.data() + 257, "ustar", 6);
+  memcpy(header.data() + 263, "00", 2);
+
+  memset(header.data() + 148, ' ', 8);
+
+  for (auto c : header)
+    checksum += (unsigned char) c;
+
+  snprintf(header.data() + 148, 8, "%06o", checksum);
+
+  return header;
+
+}
+
+/*
+ * Writes a tar stream through an IndexedArchiveFile and extracts a
+ * single member via the written index afterwards.
+ */
+static void test_indexed_archive(BackupProfileCompressType compression,
+                                 bool syncpoints) {
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  StreamingBaseBackupDirectory streamDir("streambackup-test",
+                                         archiveDir->getArchiveDir());
+  ArchiveMemberIndex index;
+  ArchiveMemberIndexEntry entry;
+  std::vector<char> zeroes(1024, 0);
+  bool synced = false;
+
+  streamDir.create();
+
+  std::shared_ptr<BackupFile> tarball = streamDir.basebackup("base.tar", compression);
+  std::shared_ptr<IndexedArchiveFile> indexed = std::make_shared<IndexedArchiveFile>(tarball);
+
+  indexed->setSyncInterval(32768);
+  indexed->setOpenMode("wb");
+  indexed->open();
+
+  for (unsigned int i = 0; i < 16; i++) {
+
+    size_t size = 10000 + i * 3000;
+    std::vector<char> header = test_tar_header("base/1/" + CPGBackupCtlBase::intToStr(1000 + i),
+                                               size);
+    std::vector<char> contents(size + (512 - size % 512) % 512, 0);
+
+    std::fill(contents.begin(), contents.begin() + size, (char) ('A' + i));
+
+    /* split headers across writes, too */
+    indexed->write(header.data(), 100);
+    indexed->write(header.data() + 100, header.size() - 100);
+    indexed->write(contents.data(), contents.size());
+
+  }
+
+  indexed->write(zeroes.data(), zeroes.size());
+  indexed->close();
+
+  index.read(ArchiveMemberIndex::indexPath(path(tarball->getFilePath())));
+
+  BOOST_TEST(index.count() == (size_t) 16);
+  BOOST_TEST(!index.lookup("base/1/999", entry));
+  BOOST_REQUIRE(index.lookup("base/1/1011", entry));
+  BOOST_TEST(entry.size == (size_t) (10000 + 11 * 3000));
+
+  for (auto const& e : index.getEntries()) {
+    if (e.sync_offset > 0)
+      synced = true;
+  }
+
+  BOOST_TEST(synced == syncpoints);
+
+  /* Extract the member from the archive */
+  {
+    path target = archiveDir->getArchiveDir() / "1011";
+    std::shared_ptr<ArchiveFile> out = std::make_shared<ArchiveFile>(target);
+    std::ifstream in;
+    std::string readback;
+
+    tarball->setOpenMode("rb");
+    tarball->open();
+
+    out->setOpenMode("wb");
+    out->open();
+
+    BOOST_TEST(index.extract(tarball, entry, out) == entry.size);
+
+    out->close();
+    tarball->close();
+
+    in.open(target.string(), std::ios::binary);
+    readback.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+    BOOST_TEST(readback.size() == entry.size);
+    BOOST_TEST((std::count(readback.begin(), readback.end(), 'L') == (long) entry.size));
+  }
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+BOOST_AUTO_TEST_CASE(TestIndexedArchive)
+{
+  test_indexed_archive(BACKUP_COMPRESS_TYPE_NONE, true);
+}
+
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+BOOST_AUTO_TEST_CASE(TestIndexedGzipArchive)
+{
+  test_indexed_archive(BACKUP_COMPRESS_TYPE_GZIP, true);
+}
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+BOOST_AUTO_TEST_CASE(TestIndexedZstdArchive)
+{
+  test_indexed_archive(BACKUP_COMPRESS_TYPE_ZSTD, true);
+}
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+BOOST_AUTO_TEST_CASE(TestIndexedLZ4Archive)
+{
+  test_indexed_archive(BACKUP_COMPRESS_TYPE_LZ4, true);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(TestCRC32C)
+{
+  const std::string check = "123456789";
+  std::vector<char> data(100000);
+  uint32_t crc = 0xFFFFFFFF;
+
+  BOOST_TEST(CRC32C::compute(check.data(), check.length()) == 0xE3069283);
+  BOOST_TEST(CRC32C::compute(check.data(), 0) == 0);
+
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (char) (i % 253);
+
+  /* incremental updates at odd offsets must match a single pass */
+  for (size_t off = 0; off < data.size(); off += 777)
+    crc = CRC32C::update(crc, data.data() + off, std::min((size_t) 777, data.size() - off));
+
+  BOOST_TEST((crc ^ 0xFFFFFFFF) == CRC32C::compute(data.data(), data.size()));
+
+  /* manifest checksums are the hex encoded in-memory CRC */
+  CRC32CChecksum checksum;
+  checksum.update(check.data(), check.length());
+  BOOST_TEST(checksum.final() == "839206e3");
+}
+
+/*
+ * Builds a backup manifest for the specified files and
+ * WAL range.
+ */
+static std::string test_manifest(std::vector<std::pair<std::string, std::string>> const& files,
+                                 std::string start_lsn,
+                                 std::string end_lsn) {
+
+  std::ostringstream manifest;
+  std::string contents;
+
+  manifest << "{ \"PostgreSQL-Backup-Manifest-Version\": 1,\n";
+  manifest << "\"Files\": [\n";
+
+  for (size_t i = 0; i < files.size(); i++) {
+
+    CRC32CChecksum checksum;
+    checksum.update(files[i].second.data(), files[i].second.length());
+
+    manifest << "{ \"Path\": \"" << files[i].first << "\", "
+             << "\"Size\": " << files[i].second.length() << ", "
+             << "\"Last-Modified\": \"2026-10-14 12:00:00 GMT\", "
+             << "\"Checksum-Algorithm\": \"CRC32C\", "
+             << "\"Checksum\": \"" << checksum.final() << "\" }"
+             << ((i + 1 < files.size()) ? "," : "") << "\n";
+
+  }
+
+  manifest << "],\n";
+  manifest << "\"WAL-Ranges\": [\n";
+  manifest << "{ \"Timeline\": 1, \"Start-LSN\": \"" << start_lsn
+           << "\", \"End-LSN\": \"" << end_lsn << "\" }\n";
+  manifest << "],\n";
+
+  contents = manifest.str();
+
+  if (FileChecksum::supported("SHA256")) {
+
+    std::shared_ptr<FileChecksum> sha = FileChecksum::create("SHA256");
+    sha->update(contents.data(), contents.length());
+    contents += "\"Manifest-Checksum\": \"" + sha->final() + "\"}\n";
+
+  } else {
+
+    contents += "\"Manifest-Checksum\": \"unverified\"}\n";
+
+  }
+
+  return contents;
+
+}
+
+/*
+ * Writes a basebackup with an indexed tar archive and a manifest
+ * and verifies it, then breaks it and verifies again.
+ */
+static void test_verify_basebackup(BackupProfileCompressType compression) {
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  StreamingBaseBackupDirectory streamDir("streambackup-test",
+                                         archiveDir->getArchiveDir());
+  std::shared_ptr<BaseBackupDescr> bbdescr = std::make_shared<BaseBackupDescr>();
+  std::shared_ptr<BaseBackupVerificationResult> result = nullptr;
+  std::vector<std::pair<std::string, std::string>> files;
+  std::vector<char> zeroes(1024, 0);
+
+  streamDir.create();
+
+  std::shared_ptr<BackupFile> tarball = streamDir.basebackup("base.tar", compression);
+  std::shared_ptr<IndexedArchiveFile> indexed = std::make_shared<IndexedArchiveFile>(tarball);
+
+  indexed->setSyncInterval(32768);
+  indexed->setOpenMode("wb");
+  indexed->open();
+
+  for (unsigned int i = 0; i < 16; i++) {
+
+    std::string name = "base/1/" + CPGBackupCtlBase::intToStr(1000 + i);
+    std::string contents(10000 + i * 3000, (char) ('A' + i));
+    std::vector<char> header = test_tar_header(name, contents.length());
+    std::vector<char> padding((512 - contents.length() % 512) % 512, 0);
+
+    indexed->write(header.data(), header.size());
+    indexed->write(contents.data(), contents.length());
+    indexed->write(padding.data(), padding.size());
+
+    files.push_back(std::make_pair(name, contents));
+
+  }
+
+  indexed->write(zeroes.data(), zeroes.size());
+  indexed->close();
+
+  {
+    std::ofstream out((streamDir.getPath() / "backup_manifest").string(), std::ios::binary);
+    out << test_manifest(files, "0/200028", "0/200100");
+  }
+
+  /* The WAL range requires segment 2 */
+  {
+    std::ofstream out((logDir->getPath() / "000000010000000000000002").string(), std::ios::binary);
+  }
+
+  bbdescr->id = 1;
+  bbdescr->fsentry = streamDir.getPath().string();
+  bbdescr->wal_segment_size = TEST_WAL_SEGMENT_SIZE;
+  bbdescr->timeline = 1;
+
+  BaseBackupVerifier verifier(bbdescr, logDir->getPath());
+
+  /* split the archive to verify it with several workers */
+  verifier.setWorkers(4);
+  verifier.setTaskSize(65536);
+
+  result = verifier.verify();
+
+  for (auto &error : result->errors)
+    BOOST_TEST_MESSAGE(error.first << ": " << error.second);
+
+  BOOST_TEST(result->ok());
+  BOOST_TEST(result->manifest_found);
+  BOOST_TEST(result->files_checked == 16);
+  BOOST_TEST(result->wal_segments_checked == 1);
+
+  if (compression != BACKUP_COMPRESS_TYPE_LZ4)
+    BOOST_TEST(result->workers > 1);
+
+  /*
+   * Modify the contents of one file and drop another
+   * one from the manifest, remove the WAL segment.
+   */
+  files[3].second[42] = '*';
+  files.erase(files.begin() + 7);
+
+  {
+    std::ofstream out((streamDir.getPath() / "backup_manifest").string(), std::ios::binary);
+    out << test_manifest(files, "0/200028", "0/200100");
+  }
+
+  boost::filesystem::remove(logDir->getPath() / "000000010000000000000002");
+
+  result = verifier.verify();
+
+  BOOST_TEST(!result->ok());
+  BOOST_TEST(result->errors.size() == 3);
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+BOOST_AUTO_TEST_CASE(TestVerifyBasebackup)
+{
+  test_verify_basebackup(BACKUP_COMPRESS_TYPE_NONE);
+}
+
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+BOOST_AUTO_TEST_CASE(TestVerifyGzipBasebackup)
+{
+  test_verify_basebackup(BACKUP_COMPRESS_TYPE_GZIP);
+}
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+BOOST_AUTO_TEST_CASE(TestVerifyZstdBasebackup)
+{
+  test_verify_basebackup(BACKUP_COMPRESS_TYPE_ZSTD);
+}
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+BOOST_AUTO_TEST_CASE(TestVerifyLZ4Basebackup)
+{
+  /* no sync points, a single worker reads the archive */
+  test_verify_basebackup(BACKUP_COMPRESS_TYPE_LZ4);
+}
+#endif
+
+/*
+ * Writes a tar archive with the specified members into the
+ * basebackup directory. Members without contents and a type
+ * other than '0' are directories or symlinks to the contents.
+ */
+static void test_write_tar(StreamingBaseBackupDirectory &streamDir,
+                           std::string name,
+                           BackupProfileCompressType compression,
+                           std::vector<std::tuple<std::string, char, std::string>> const& members) {
+
+  std::shared_ptr<BackupFile> tarball = streamDir.basebackup(name, compression);
+  std::vector<char> zeroes(1024, 0);
+
+  tarball->setOpenMode("wb");
+  tarball->open();
+
+  for (auto &member : members) {
+
+    char type = std::get<1>(member);
+    std::string contents = (type == '0') ? std::get<2>(member) : "";
+    std::string link = (type == '2') ? std::get<2>(member) : "";
+    std::vector<char> header = test_tar_header(std::get<0>(member), contents.length(), type, link);
+    std::vector<char> padding((512 - contents.length() % 512) % 512, 0);
+
+    tarball->write(header.data(), header.size());
+
+    if (contents.length() > 0)
+      tarball->write(contents.data(), contents.length());
+
+    if (padding.size() > 0)
+      tarball->write(padding.data(), padding.size());
+
+  }
+
+  tarball->write(zeroes.data(), zeroes.size());
+  tarball->close();
+
+}
+
+/*
+ * Restores a basebackup with two tablespaces, one of them
+ * remapped, and checks the restored files.
+ */
+static void test_tar_recovery(BackupProfileCompressType compression) {
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  StreamingBaseBackupDirectory streamDir("streambackup-test",
+                                         archiveDir->getArchiveDir());
+  path restoreDir = archiveDir->getArchiveDir() / "restore";
+  path pgdata = restoreDir / "pgdata";
+  path tblspc1 = restoreDir / "tblspc1";
+  path tblspc2 = restoreDir / "tblspc2";
+  std::shared_ptr<BaseBackupDescr> bbdescr = std::make_shared<BaseBackupDescr>();
+  std::shared_ptr<BackupTablespaceDescr> tablespace = std::make_shared<BackupTablespaceDescr>();
+  std::shared_ptr<RestoreDescr> restoreDescr = std::make_shared<RestoreDescr>(1);
+  std::string large(2 * TarRecovery::CHUNK_SIZE + 4711, 'x');
+  std::string contents;
+
+  for (size_t i = 0; i < large.length(); i++)
+    large[i] = (char) ('a' + (i / 512) % 26);
+
+  streamDir.create();
+
+  test_write_tar(streamDir, "base.tar", compression, {
+      std::make_tuple("global/", '5', ""),
+      std::make_tuple("global/pg_control", '0', std::string(8192, 'C')),
+      std::make_tuple("base/1/1000", '0', large),
+      std::make_tuple("base/1/1001", '0', ""),
+      std::make_tuple("tablespace_map", '0', "16384 /nonexisting/tblspc1\n"),
+      std::make_tuple("pg_tblspc/16385", '2', "/nonexisting/tblspc2")
+    });
+
+  test_write_tar(streamDir, "16384.tar", compression, {
+      std::make_tuple("PG_16_202307071/1/2000", '0', std::string(5000, 'T'))
+    });
+
+  test_write_tar(streamDir, "16385.tar", compression, {
+      std::make_tuple("PG_16_202307071/1/3000", '0', std::string(10, 'U'))
+    });
+
+  bbdescr->id = 1;
+  bbdescr->status = BaseBackupDescr::BASEBACKUP_STATUS_READY;
+  bbdescr->fsentry = streamDir.getPath().string();
+
+  /* 16385 isn't mapped, so it's restored to its original location */
+  tablespace->spcoid = 16385;
+  tablespace->spclocation = tblspc2.string();
+  bbdescr->tablespaces.push_back(tablespace);
+
+  restoreDescr->basebackup = bbdescr;
+  restoreDescr->target_directory = pgdata.string();
+  restoreDescr->prepareTablespaceDescrForMap(16384);
+  restoreDescr->stackTablespaceDescrForMap(tblspc1.string());
+
+  {
+    TarRecovery recovery(restoreDescr);
+    unsigned long long files = 0;
+
+    /* a short queue makes the decompressing threads wait */
+    recovery.setQueueDepth(2);
+    recovery.setSyncMethod("fsync", 4);
+    recovery.setProgressCallback([&](const TarRecoveryProgress &progress) {
+        files = progress.files;
+      });
+
+    recovery.init();
+    recovery.start();
+
+    BOOST_TEST(files == 8);
+  }
+
+  BOOST_TEST(is_directory(pgdata / "global"));
+  BOOST_TEST(file_size(pgdata / "global" / "pg_control") == 8192);
+  BOOST_TEST(file_size(pgdata / "base" / "1" / "1001") == 0);
+  BOOST_TEST(file_size(tblspc1 / "PG_16_202307071" / "1" / "2000") == 5000);
+  BOOST_TEST(file_size(tblspc2 / "PG_16_202307071" / "1" / "3000") == 10);
+
+  {
+    std::ifstream in((pgdata / "base" / "1" / "1000").string(), std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    BOOST_TEST((contents == large));
+  }
+
+  {
+    std::ifstream in((pgdata / "tablespace_map").string(), std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    BOOST_TEST(contents == "16384 " + tblspc1.string() + "\n");
+  }
+
+  BOOST_TEST(read_symlink(pgdata / "pg_tblspc" / "16385") == tblspc2);
+
+  /* Restoring into non-empty directories must fail */
+  {
+    TarRecovery recovery(restoreDescr);
+    BOOST_CHECK_THROW(recovery.init(), CArchiveIssue);
+  }
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+BOOST_AUTO_TEST_CASE(TestTarRecovery)
+{
+  test_tar_recovery(BACKUP_COMPRESS_TYPE_NONE);
+}
+
+#ifdef PG_BACKUP_CTL_HAS_ZLIB
+BOOST_AUTO_TEST_CASE(TestTarRecoveryGzip)
+{
+  test_tar_recovery(BACKUP_COMPRESS_TYPE_GZIP);
+}
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+BOOST_AUTO_TEST_CASE(TestTarRecoveryZstd)
+{
+  test_tar_recovery(BACKUP_COMPRESS_TYPE_ZSTD);
+}
+#endif
+
+#ifdef PG_BACKUP_CTL_HAS_LIBLZ4
+BOOST_AUTO_TEST_CASE(TestTarRecoveryLZ4)
+{
+  test_tar_recovery(BACKUP_COMPRESS_TYPE_LZ4);
+}
+#endif
+
+/*
+ * Writes two tar streams sharing a relation through DedupArchiveFile
+ * and reads them back.
+ */
+static void test_dedup_archive(BackupProfileCompressType compression) {
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<DedupChunkStore> store
+    = std::make_shared<DedupChunkStore>(DedupChunkStore::forArchive(archiveDir->getArchiveDir()));
+  std::string relation(2 * DedupArchiveFile::CHUNK_SIZE + 8192, 'x');
+  std::vector<char> zeroes(1024, 0);
+  std::vector<char> stream;
+  std::set<std::string> ids;
+  path file;
+
+  if (!DedupChunkStore::supported(compression))
+    return;
+
+  for (size_t i = 0; i < relation.length(); i++)
+    relation[i] = (char) ('a' + (i / 8192) % 26);
+
+  BOOST_TEST(store->empty());
+
+  for (int n = 1; n <= 2; n++) {
+
+    std::vector<std::pair<std::string, std::string>> members = {
+      { "global/pg_control", std::string(100, 'C') },
+      { "base/1/1000", relation },
+      { "base/1/1001", std::string(9000, (char) ('0' + n)) }
+    };
+
+    file = archiveDir->getArchiveDir() / ("base" + CPGBackupCtlBase::intToStr(n) + ".tar.dedup");
+    stream.clear();
+
+    for (auto &member : members) {
+
+      std::vector<char> header = test_tar_header(member.first, member.second.length());
+
+      stream.insert(stream.end(), header.begin(), header.end());
+      stream.insert(stream.end(), member.second.begin(), member.second.end());
+      stream.insert(stream.end(), (512 - member.second.length() % 512) % 512, 0);
+
+    }
+
+    stream.insert(stream.end(), zeroes.begin(), zeroes.end());
+
+    {
+      DedupArchiveFile dedup(file, store, compression, 0);
+
+      dedup.setOpenMode("wb");
+      dedup.open();
+
+      /* sweep() can't lock the store while it's written */
+      BOOST_TEST(store->lock(LOCK_EX | LOCK_NB) == -1);
+
+      /* odd write sizes split headers and chunks */
+      for (size_t pos = 0; pos < stream.size(); pos += 3333)
+        dedup.write(stream.data() + pos, std::min((size_t) 3333, stream.size() - pos));
+
+      dedup.close();
+
+      {
+        int lockfd = store->lock(LOCK_EX | LOCK_NB);
+
+        BOOST_TEST(lockfd >= 0);
+        DedupChunkStore::unlock(lockfd);
+      }
+
+      /* the relation is stored once */
+      if (n == 1) {
+        BOOST_TEST(dedup.bytesStored() == relation.length() + 9000);
+        BOOST_TEST(dedup.bytesReused() == 0);
+      } else {
+        BOOST_TEST(dedup.bytesStored() == 9000);
+        BOOST_TEST(dedup.bytesReused() == relation.length());
+      }
+    }
+
+    /* Read it back like restore and verify do */
+    {
+      std::shared_ptr<BackupFile> reader = BaseBackupVerifier::archiveFile(file);
+      std::vector<char> readback(stream.size() + 4096);
+      size_t len = 0;
+      size_t got;
+
+      BOOST_TEST(reader->isCompressed());
+
+      reader->setOpenMode("rb");
+      reader->open();
+
+      while ((got = reader->read(readback.data() + len,
+                                 std::min((size_t) 4096, readback.size() - len))) > 0)
+        len += got;
+
+      reader->close();
+
+      BOOST_TEST(len == stream.size());
+      BOOST_TEST(std::equal(stream.begin(), stream.end(), readback.begin()));
+    }
+
+  }
+
+  /* 3 chunks of the shared relation plus one base/1/1001 each */
+  ids = DedupChunkStore::referencedChunks(archiveDir->getArchiveDir());
+  BOOST_TEST(ids.size() == (size_t) 5);
+  BOOST_TEST(!store->empty());
+
+  for (auto &id : ids)
+    BOOST_TEST(store->exists(id));
+
+  /* Seeking forward skips, seeking backwards starts over */
+  {
+    DedupArchiveFile reader(file);
+    off_t offset = 1024 + DedupArchiveFile::CHUNK_SIZE;
+    char buf[512];
+
+    reader.setOpenMode("rb");
+    reader.open();
+
+    BOOST_TEST(reader.lseek(offset, SEEK_SET) == offset);
+    BOOST_TEST(reader.read(buf, 16) == (size_t) 16);
+    BOOST_TEST(std::equal(buf, buf + 16, stream.begin() + offset));
+
+    BOOST_TEST(reader.lseek(0, SEEK_SET) == 0);
+    BOOST_TEST(reader.read(buf, sizeof(buf)) == sizeof(buf));
+    BOOST_TEST(std::equal(buf, buf + sizeof(buf), stream.begin()));
+
+    BOOST_CHECK_THROW(reader.lseek(0, SEEK_END), CArchiveIssue);
+
+    reader.close();
+  }
+
+  /* A damaged chunk isn't handed out */
+  {
+    path chunk = store->chunkPath(*ids.begin());
+    std::vector<char> buf;
+
+    {
+      std::fstream out(chunk.string(), std::ios::in | std::ios::out | std::ios::binary);
+      out.seekp(10);
+      out.write("garbage", 7);
+    }
+
+    BOOST_CHECK_THROW(store->read(*ids.begin(), buf), CArchiveIssue);
+  }
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+BOOST_AUTO_TEST_CASE(TestDedupArchive)
+{
+  test_dedup_archive(BACKUP_COMPRESS_TYPE_NONE);
+}
+
+#ifdef PG_BACKUP_CTL_HAS_LIBZSTD
+BOOST_AUTO_TEST_CASE(TestDedupZstdArchive)
+{
+  test_dedup_archive(BACKUP_COMPRESS_TYPE_ZSTD);
+}
+#endif
+
+/*
+ * Streams two and a half fake WAL segments through a
+ * WALWriterPipeline.
+ */
+static void test_writer_pipeline(bool direct_write) {
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  std::shared_ptr<CatalogDescr> descr = std::make_shared<CatalogDescr>();
+  std::vector<char> data(8192);
+  XLogRecPtr pos = 0;
+
+  descr->directory = archiveDir->getArchiveDir().string();
+
+  std::shared_ptr<TransactionLogBackup> backup
+    = std::make_shared<TransactionLogBackup>(descr);
+
+  backup->setWalSegmentSize(TEST_WAL_SEGMENT_SIZE);
+  backup->setPreallocate(false);
+  backup->setDirectWrite(direct_write);
+  backup->initialize();
+
+  WALWriterPipeline pipeline(backup, 4);
+  pipeline.start();
+
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (char) (i % 251);
+
+  while (pos < (XLogRecPtr) (TEST_WAL_SEGMENT_SIZE * 2 + TEST_WAL_SEGMENT_SIZE / 2)) {
+    pipeline.push(pos, 1, data.data(), data.size());
+    pos += data.size();
+  }
+
+  /* sync everything written so far */
+  pipeline.drain();
+  pipeline.requestSync(true);
+  pipeline.stop();
+
+  BOOST_TEST(pipeline.queued() == 0);
+  BOOST_TEST(pipeline.writtenPosition() == pos);
+  BOOST_TEST(pipeline.flushedPosition() == pos);
+  BOOST_TEST(backup->countSynced() == 2);
+
+  /*
+   * Write statistics are maintained by the writer thread, two
+   * segment syncs plus the forced one above.
+   */
+  WALWriteStatistics wstats = backup->writeStatistics();
+  uint64_t bucketed = 0;
+
+  for (unsigned int i = 0; i < WAL_SYNC_LATENCY_BUCKETS; i++)
+    bucketed += wstats.sync_latency[i];
+
+  BOOST_TEST(wstats.bytes_written == pos);
+  BOOST_TEST(wstats.segments_synced == 2);
+  BOOST_TEST(wstats.syncs >= 3);
+  BOOST_TEST(bucketed == wstats.syncs);
+
+  BOOST_TEST(logDir->determineXlogSegmentStatus(logDir->getPath() / "000000010000000000000000")
+             == WAL_SEGMENT_COMPLETE);
+  BOOST_TEST(logDir->determineXlogSegmentStatus(logDir->getPath() / "000000010000000000000001")
+             == WAL_SEGMENT_COMPLETE);
+  BOOST_TEST(file_size(logDir->getPath() / "000000010000000000000002.partial")
+             == TEST_WAL_SEGMENT_SIZE / 2);
+
+  backup->finalize();
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+BOOST_AUTO_TEST_CASE(TestWALWriterPipeline)
+{
+  test_writer_pipeline(false);
+}
+
+BOOST_AUTO_TEST_CASE(TestWALWriterPipelineDirectWrite)
+{
+  test_writer_pipeline(true);
+}
+
+/*
+ * Streams fake WAL into preallocated segment files taken
+ * from a spare segment file.
+ */
+BOOST_AUTO_TEST_CASE(TestWALPreallocation)
+{
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  std::shared_ptr<CatalogDescr> descr = std::make_shared<CatalogDescr>();
+  std::vector<char> data(8192);
+  std::vector<char> readback(data.size());
+  XLogRecPtr flush_position = InvalidXLogRecPtr;
+  XLogRecPtr pos = 0;
+  path spare;
+  path partial;
+
+  descr->directory = archiveDir->getArchiveDir().string();
+
+  std::shared_ptr<TransactionLogBackup> backup
+    = std::make_shared<TransactionLogBackup>(descr);
+
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (char) (i % 251);
+
+  backup->setWalSegmentSize(TEST_WAL_SEGMENT_SIZE);
+  backup->setPreallocate(true);
+  backup->setPreallocSegments(1);
+  backup->initialize();
+
+  spare = logDir->getPath() / "xlogtemp.prealloc.0";
+  partial = logDir->getPath() / "000000010000000000000000.partial";
+
+  /* 1 The spare segment file is created with the full segment size */
+  BOOST_REQUIRE(boost::filesystem::exists(spare));
+  BOOST_TEST(file_size(spare) == TEST_WAL_SEGMENT_SIZE);
+
+  /* 2 The first write takes the spare file, it isn't truncated */
+  pos = backup->write(pos, data.data(), data.size(), flush_position, 1);
+
+  BOOST_TEST(!boost::filesystem::exists(spare));
+  BOOST_REQUIRE(boost::filesystem::exists(partial));
+  BOOST_TEST(file_size(partial) == TEST_WAL_SEGMENT_SIZE);
+
+  {
+    std::ifstream in(partial.string(), std::ios::binary);
+
+    in.read(readback.data(), readback.size());
+    BOOST_TEST(std::equal(data.begin(), data.end(), readback.begin()));
+  }
+
+  /* 3 The spare file is refilled off the write path */
+  backup->preallocateSpareSegments();
+  BOOST_REQUIRE(boost::filesystem::exists(spare));
+  BOOST_TEST(file_size(spare) == TEST_WAL_SEGMENT_SIZE);
+
+  /*
+   * 4 The size of the preallocated file doesn't satisfy the
+   *   check of a complete segment, the bytes written do
+   */
+  BOOST_CHECK_THROW(backup->finalizeCurrentWALFile(true), CArchiveIssue);
+  BOOST_TEST(boost::filesystem::exists(partial));
+
+  /* 5 The segment boundary finalizes the segment, the next one takes the spare */
+  while (pos < (XLogRecPtr) TEST_WAL_SEGMENT_SIZE)
+    pos = backup->write(pos, data.data(), data.size(), flush_position, 1);
+
+  BOOST_TEST(flush_position == (XLogRecPtr) TEST_WAL_SEGMENT_SIZE);
+  BOOST_TEST(!boost::filesystem::exists(partial));
+  BOOST_TEST(logDir->determineXlogSegmentStatus(logDir->getPath() / "000000010000000000000000")
+             == WAL_SEGMENT_COMPLETE);
+  BOOST_TEST(file_size(logDir->getPath() / "000000010000000000000000")
+             == TEST_WAL_SEGMENT_SIZE);
+
+  pos = backup->write(pos, data.data(), data.size(), flush_position, 1);
+
+  BOOST_TEST(!boost::filesystem::exists(spare));
+  BOOST_TEST(file_size(logDir->getPath() / "000000010000000000000001.partial")
+             == TEST_WAL_SEGMENT_SIZE);
+
+  backup->finalize();
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+/*
+ * An ArchiveFile on a filesystem without fallocate() support.
+ */
+class TestNoFallocateArchiveFile : public ArchiveFile {
+protected:
+
+  virtual int fallocate(size_t len) {
+    return EOPNOTSUPP;
+  }
+
+public:
+
+  TestNoFallocateArchiveFile(path file) : ArchiveFile(file) {}
+
+};
+
+BOOST_AUTO_TEST_CASE(TestArchiveFileAllocateZeroFill)
+{
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  path file = archiveDir->getArchiveDir() / "zerofill";
+  std::vector<char> readback(TEST_WAL_SEGMENT_SIZE + 1);
+  TestNoFallocateArchiveFile archfile(file);
+
+  archfile.setOpenMode("wb+");
+  archfile.open();
+  archfile.allocate(TEST_WAL_SEGMENT_SIZE);
+
+  /* positioned at the start again */
+  BOOST_TEST(archfile.current_position() == 0);
+  archfile.close();
+
+  BOOST_TEST(file_size(file) == TEST_WAL_SEGMENT_SIZE);
+
+  {
+    std::ifstream in(file.string(), std::ios::binary);
+
+    in.read(readback.data(), readback.size());
+    BOOST_TEST(in.gcount() == TEST_WAL_SEGMENT_SIZE);
+    BOOST_TEST(std::all_of(readback.begin(), readback.begin() + TEST_WAL_SEGMENT_SIZE,
+                           [](char c) { return c == 0; }));
+  }
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+/*
+ * Writes fake WAL through TransactionLogBackup::write() with the
+ * specified sync method and checks which flush positions the WAL
+ * sync policy reports.
+ */
+static void test_sync_policy(WALSyncMethod method) {
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<CatalogDescr> descr = std::make_shared<CatalogDescr>();
+  std::vector<char> data(8192, 'x');
+  WALSyncPolicy policy;
+  XLogRecPtr flush_position = InvalidXLogRecPtr;
+  XLogRecPtr pos = 0;
+
+  descr->directory = archiveDir->getArchiveDir().string();
+
+  std::shared_ptr<TransactionLogBackup> backup
+    = std::make_shared<TransactionLogBackup>(descr);
+
+  policy.sync_threshold_bytes = 3 * data.size();
+  policy.method = method;
+
+  backup->setWalSegmentSize(TEST_WAL_SEGMENT_SIZE);
+  backup->setSyncPolicy(policy);
+  backup->initialize();
+
+  /* 1 Nothing is flushed below the threshold */
+  for (int i = 0; i < 2; i++) {
+    pos = backup->write(pos, data.data(), data.size(), flush_position, 1);
+    BOOST_TEST(flush_position == InvalidXLogRecPtr);
+  }
+
+  BOOST_TEST(backup->sync(false) == InvalidXLogRecPtr);
+
+  /* 2 The write reaching the threshold syncs everything written */
+  pos = backup->write(pos, data.data(), data.size(), flush_position, 1);
+  BOOST_TEST(flush_position == pos);
+  BOOST_TEST(flush_position == (XLogRecPtr) (3 * data.size()));
+
+  /* 3 Forced syncs flush what's left, nothing to do afterwards */
+  pos = backup->write(pos, data.data(), data.size(), flush_position, 1);
+  BOOST_TEST(flush_position == InvalidXLogRecPtr);
+  BOOST_TEST(backup->sync(true) == pos);
+  BOOST_TEST(backup->sync(true) == InvalidXLogRecPtr);
+
+  /* 4 A segment boundary flushes the completed segment */
+  while (pos < (XLogRecPtr) TEST_WAL_SEGMENT_SIZE)
+    pos = backup->write(pos, data.data(), data.size(), flush_position, 1);
+
+  BOOST_TEST(flush_position == (XLogRecPtr) TEST_WAL_SEGMENT_SIZE);
+  BOOST_TEST(backup->countSynced() == 1);
+
+  /* 5 The interval triggers a sync regardless of the amount written */
+  policy.sync_threshold_bytes = 0;
+  policy.sync_interval_ms = 50;
+  backup->setSyncPolicy(policy);
+
+  pos = backup->write(pos, data.data(), data.size(), flush_position, 1);
+  usleep(100 * 1000);
+  pos = backup->write(pos, data.data(), data.size(), flush_position, 1);
+  BOOST_TEST(flush_position == pos);
+
+  backup->finalize();
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+BOOST_AUTO_TEST_CASE(TestWALSyncPolicy)
+{
+  test_sync_policy(WAL_SYNC_METHOD_FSYNC);
+  test_sync_policy(WAL_SYNC_METHOD_FDATASYNC);
+  test_sync_policy(WAL_SYNC_METHOD_SYNC_FILE_RANGE);
+}
+
+/*
+ * Fills data with XLOG pages starting at pos, each carrying
+ * a valid page header.
+ */
+static void test_xlog_pages(std::vector<char> &data, XLogRecPtr pos,
+                            TimeLineID tli) {
+
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (char) (i % 251);
+
+  for (size_t off = 0; off < data.size(); off += XLOG_BLCKSZ) {
+
+    XLogLongPageHeaderData hdr;
+    XLogRecPtr pageaddr = pos + off;
+    bool long_header = (pageaddr % TEST_WAL_SEGMENT_SIZE) == 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.std.xlp_magic = XLOG_PAGE_MAGIC;
+    hdr.std.xlp_info = long_header ? XLP_LONG_HEADER : 0;
+    hdr.std.xlp_tli = tli;
+    hdr.std.xlp_pageaddr = pageaddr;
+    hdr.xlp_seg_size = TEST_WAL_SEGMENT_SIZE;
+    hdr.xlp_xlog_blcksz = XLOG_BLCKSZ;
+
+    memcpy(data.data() + off, &hdr,
+           long_header ? SizeOfXLogLongPHD : SizeOfXLogShortPHD);
+
+  }
+
+}
+
+BOOST_AUTO_TEST_CASE(TestWALPageValidation)
+{
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  std::shared_ptr<CatalogDescr> descr = std::make_shared<CatalogDescr>();
+  std::vector<char> segment(TEST_WAL_SEGMENT_SIZE);
+  XLogRecPtr flush_position = InvalidXLogRecPtr;
+  WALSegmentIndexEntry last;
+  size_t off = 0;
+
+  descr->directory = archiveDir->getArchiveDir().string();
+  test_xlog_pages(segment, 0, 1);
+
+  std::shared_ptr<TransactionLogBackup> backup
+    = std::make_shared<TransactionLogBackup>(descr);
+
+  backup->setWalSegmentSize(TEST_WAL_SEGMENT_SIZE);
+  backup->setPreallocate(false);
+  backup->setValidation(WALPageValidator::modeFromString("checksums"));
+  backup->initialize();
+
+  /* Odd block sizes split page headers over several writes */
+  while (off < segment.size()) {
+
+    size_t len = std::min((size_t) 3001, segment.size() - off);
+
+    backup->write(off, segment.data() + off, len, flush_position, 1);
+    off += len;
+
+  }
+
+  BOOST_TEST(flush_position == (XLogRecPtr) TEST_WAL_SEGMENT_SIZE);
+  BOOST_REQUIRE(logDir->segmentIndex(TEST_WAL_SEGMENT_SIZE)->last(last));
+  BOOST_TEST(last.filename == "000000010000000000000000");
+  BOOST_TEST(last.has_checksum);
+  BOOST_TEST(last.crc32c == CRC32C::compute(segment.data(), segment.size()));
+
+  /* Checksums survive a rebuild of the index */
+  logDir->segmentIndex(TEST_WAL_SEGMENT_SIZE)->rebuild();
+  BOOST_REQUIRE(logDir->segmentIndex(TEST_WAL_SEGMENT_SIZE)->last(last));
+  BOOST_TEST(last.has_checksum);
+
+  /* A page claiming another XLOG position is rejected */
+  test_xlog_pages(segment, TEST_WAL_SEGMENT_SIZE, 1);
+  segment[2 * XLOG_BLCKSZ + offsetof(XLogPageHeaderData, xlp_pageaddr)] ^= 0x10;
+
+  BOOST_REQUIRE_NO_THROW(backup->write(TEST_WAL_SEGMENT_SIZE, segment.data(),
+                                       2 * XLOG_BLCKSZ, flush_position, 1));
+  BOOST_CHECK_THROW(backup->write(TEST_WAL_SEGMENT_SIZE + 2 * XLOG_BLCKSZ,
+                                  segment.data() + 2 * XLOG_BLCKSZ,
+                                  XLOG_BLCKSZ, flush_position, 1),
+                    CArchiveIssue);
+
+  /* So is a timeline beyond the streamed one */
+  WALPageValidator validator(WAL_VALIDATE_HEADERS, TEST_WAL_SEGMENT_SIZE);
+
+  test_xlog_pages(segment, 0, 2);
+  validator.startSegment(0);
+  BOOST_CHECK_THROW(validator.validate(0, segment.data(), XLOG_BLCKSZ, 1),
+                    CArchiveIssue);
+
+  backup->finalize();
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+/*
+ * Write errors in the writer thread must be reported to the receiver.
+ */
+BOOST_AUTO_TEST_CASE(TestWALWriterPipelineError)
+{
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<CatalogDescr> descr = std::make_shared<CatalogDescr>();
+  std::vector<char> data(8192);
+
+  descr->directory = archiveDir->getArchiveDir().string();
+
+  std::shared_ptr<TransactionLogBackup> backup
+    = std::make_shared<TransactionLogBackup>(descr);
+
+  backup->setWalSegmentSize(TEST_WAL_SEGMENT_SIZE);
+  backup->setPreallocate(false);
+  backup->initialize();
+
+  WALWriterPipeline pipeline(backup, 2);
+  pipeline.start();
+
+  /* doesn't start at a segment boundary */
+  pipeline.push(4096, 1, data.data(), data.size());
+
+  BOOST_CHECK_THROW(pipeline.drain(), CArchiveIssue);
+  BOOST_CHECK_THROW(pipeline.push(0, 1, data.data(), data.size()), CArchiveIssue);
+  BOOST_CHECK_THROW(pipeline.stop(), CArchiveIssue);
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+/*
+ * Streams three fake tablespace archives into a StreamBaseBackup
+ * with two archive writers, like BaseBackupProcess::stream() does, and
+ * reads them back after finalize().
+ */
+BOOST_AUTO_TEST_CASE(TestParallelArchiveWriters)
+{
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<CatalogDescr> descr = std::make_shared<CatalogDescr>();
+  std::vector<std::string> names = { "base.tar", "16384.tar", "16385.tar" };
+  std::vector<std::string> paths;
+  std::string directory;
+
+  descr->directory = archiveDir->getArchiveDir().string();
+
+  {
+    StreamBaseBackup backup(descr, SB_WRITE);
+
+    backup.setCompression(BACKUP_COMPRESS_TYPE_GZIP);
+    backup.setParallelWriters(2);
+    backup.initialize();
+    backup.create();
+
+    directory = backup.backupDirectoryString();
+
+    for (unsigned int i = 0; i < names.size(); i++) {
+
+      std::shared_ptr<BackupFile> file = backup.stackFile(names[i]);
+      std::vector<char> chunk(32768, (char) ('a' + i));
+
+      /* merely a PipelinedArchiveFile around the real archive file */
+      BOOST_TEST((std::dynamic_pointer_cast<PipelinedArchiveFile>(file) != nullptr));
+      BOOST_TEST(file->isCompressed());
+
+      for (unsigned int c = 0; c < 64; c++)
+        file->write(chunk.data(), chunk.size());
+
+      paths.push_back(file->getFilePath());
+
+      /* the last one is left for finalize() */
+      if (i < names.size() - 1) {
+        file->fsync();
+        file->close();
+      }
+
+    }
+
+    BOOST_REQUIRE_NO_THROW(backup.finalize());
+  }
+
+  for (unsigned int i = 0; i < paths.size(); i++) {
+
+    CompressedArchiveFile file(paths[i]);
+    std::vector<char> readback(32768 * 64 + 1);
+    size_t rbytes = 0;
+    size_t r;
+
+    file.setOpenMode("rb");
+    file.open();
+
+    while ((r = file.read(readback.data() + rbytes, readback.size() - rbytes)) > 0)
+      rbytes += r;
+
+    file.close();
+
+    BOOST_TEST(rbytes == (size_t) (32768 * 64));
+    BOOST_TEST((std::count(readback.begin(), readback.begin() + rbytes, (char) ('a' + i))
+                == (long) rbytes));
+
+  }
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+/*
+ * A failing archive writer must be reported to the receiver.
+ */
+BOOST_AUTO_TEST_CASE(TestParallelArchiveWriterError)
+{
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveWriterPool> pool = std::make_shared<ArchiveWriterPool>(2);
+  std::vector<char> chunk(8192);
+  path filename = archiveDir->getArchiveDir() / "readonly.tar";
+
+  /* create the file, so that we can open it read only */
+  {
+    ArchiveFile file(filename);
+    file.setOpenMode("w");
+    file.open();
+    file.close();
+  }
+
+  pool->start();
+
+  PipelinedArchiveFile file(std::make_shared<ArchiveFile>(filename), pool, 1);
+
+  file.setOpenMode("r");
+  file.open();
+  file.write(chunk.data(), chunk.size());
+
+  BOOST_CHECK_THROW(pool->drain(), CArchiveIssue);
+  BOOST_CHECK_THROW(file.write(chunk.data(), chunk.size()), CArchiveIssue);
+  BOOST_CHECK_THROW(pool->stop(), CArchiveIssue);
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+/*
+ * Writes through a ThrottledArchiveFile must not exceed the rate
+ * of its limiter, an unlimited limiter must not delay them at all.
+ */
+BOOST_AUTO_TEST_CASE(TestThrottledArchiveFile)
+{
+
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveRateLimiter> limiter = std::make_shared<ArchiveRateLimiter>(1048576);
+  std::vector<char> chunk(8192, 'x');
+  std::chrono::steady_clock::time_point start;
+  double elapsed;
+
+  ThrottledArchiveFile file(std::make_shared<ArchiveFile>(archiveDir->getArchiveDir() / "throttled.tar"),
+                            limiter);
+
+  file.setOpenMode("w");
+  file.open();
+
+  /* 512 KByte at 1 MByte/s, minus the initial burst */
+  start = std::chrono::steady_clock::now();
+
+  for (unsigned int i = 0; i < 64; i++)
+    file.write(chunk.data(), chunk.size());
+
+  elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  BOOST_TEST(elapsed >= 0.3);
+  BOOST_TEST(limiter->consumed() == (uint64_t) (64 * 8192));
+
+  /* Unlimited */
+  limiter->setRate(0);
+  start = std::chrono::steady_clock::now();
+
+  for (unsigned int i = 0; i < 64; i++)
+    file.write(chunk.data(), chunk.size());
+
+  elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  BOOST_TEST(elapsed < 0.3);
+  BOOST_TEST(limiter->consumed() == (uint64_t) (128 * 8192));
+
+  file.close();
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+/*
+ * XLOG data messages assigned from a raw buffer must reference
+ * the XLOG data in place and be reusable.
+ */
+BOOST_AUTO_TEST_CASE(TestXLOGDataMessageBuffer)
+{
+
+  std::vector<char> msg(25 + 8192);
+  XLOGDataStreamMessage datamsg(NULL, TEST_WAL_SEGMENT_SIZE);
+  MemoryBuffer srcbuffer;
+
+  msg[0] = 'w';
+  uint64_hton_sendbuf(&msg[1], 0x1000000);
+  uint64_hton_sendbuf(&msg[9], 0x2000000);
+  uint64_hton_sendbuf(&msg[17], 0);
+
+  datamsg.assignBuffer(msg.data(), msg.size());
+
+  BOOST_TEST(datamsg.getXLOGStartPos() == (XLogRecPtr) 0x1000000);
+  BOOST_TEST(datamsg.getXLOGServerPos() == (XLogRecPtr) 0x2000000);
+  BOOST_TEST((const void *) datamsg.buffer() == (const void *) (msg.data() + 25));
+  BOOST_TEST(datamsg.dataBufferSize() == 8192);
+
+  /* reuse with a message without any XLOG data */
+  datamsg.assignBuffer(msg.data(), 25);
+  BOOST_TEST((const void *) datamsg.buffer() == nullptr);
+  BOOST_TEST(datamsg.dataBufferSize() == 0);
+
+  /* assigning a MemoryBuffer keeps a private copy */
+  srcbuffer.allocate(msg.size());
+  srcbuffer.write(msg.data(), msg.size(), 0);
+  datamsg << srcbuffer;
+
+  BOOST_TEST((const void *) datamsg.buffer() != (const void *) (srcbuffer.ptr() + 25));
+  BOOST_TEST(datamsg.dataBufferSize() == 8192);
+  BOOST_TEST(memcmp(datamsg.buffer(), msg.data() + 25, 8192) == 0);
+
+  BOOST_CHECK_THROW(datamsg.assignBuffer(msg.data(), 24), XLOGMessageFailure);
+
+  msg[0] = 'k';
+  BOOST_CHECK_THROW(datamsg.assignBuffer(msg.data(), msg.size()), XLOGMessageFailure);
+
+}
+
+BOOST_AUTO_TEST_CASE(TestPrimaryFeedbackMessageBuffer)
+{
+
+  char msg[18];
+  PrimaryFeedbackMessage pm(NULL, TEST_WAL_SEGMENT_SIZE);
+
+  msg[0] = 'k';
+  uint64_hton_sendbuf(&msg[1], 0x3000000);
+  uint64_hton_sendbuf(&msg[9], 4711);
+  msg[17] = 1;
+
+  pm.assignBuffer(msg, sizeof(msg));
+
+  BOOST_TEST(pm.getXLOGServerPos() == (XLogRecPtr) 0x3000000);
+  BOOST_TEST(pm.getServerTime() == 4711);
+  BOOST_TEST(pm.responseRequested());
+
+  /* reused message objects must not keep the reply request */
+  msg[17] = 0;
+  pm.assignBuffer(msg, sizeof(msg));
+  BOOST_TEST(!pm.responseRequested());
+
+}
+
+/*
+ * A multiplexed stream which can't be started.
+ */
+class FailingWALStream : public MultiplexedWALStream {
+public:
+
+  std::string name;
+  std::string errmsg = "";
+
+  FailingWALStream(std::string name) { this->name = name; }
+
+  virtual std::string streamName() { return this->name; }
+  virtual std::shared_ptr<WALStreamerProcess> walStreamer() { return nullptr; }
+  virtual void startStream() { throw StreamingFailure("cannot connect " + this->name); }
+  virtual bool streamEnded(bool can_continue) { return false; }
+  virtual bool stopRequested() { return false; }
+  virtual void streamFailed(std::string errmsg) { this->errmsg = errmsg; }
+
+};
+
+BOOST_AUTO_TEST_CASE(TestWALStreamMultiplexerFailure)
+{
+  WALStreamMultiplexer mux;
+  std::shared_ptr<FailingWALStream> s1 = std::make_shared<FailingWALStream>("s1");
+  std::shared_ptr<FailingWALStream> s2 = std::make_shared<FailingWALStream>("s2");
+
+  BOOST_CHECK_THROW( mux.addStream(nullptr), StreamingFailure );
+  BOOST_CHECK_THROW( mux.setWakeupInterval(0), StreamingFailure );
+
+  BOOST_REQUIRE_NO_THROW( mux.addStream(s1) );
+  BOOST_REQUIRE_NO_THROW( mux.addStream(s2) );
+
+  /* Failing streams are reported per stream, run() returns afterwards */
+  BOOST_REQUIRE_NO_THROW( mux.run() );
+  BOOST_TEST( mux.activeStreams() == 0 );
+  BOOST_TEST( s1->errmsg == "cannot connect s1" );
+  BOOST_TEST( s2->errmsg == "cannot connect s2" );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestWALSegmentCache)
+{
+  std::vector<char> page(WALSegmentCache::PAGE_SIZE);
+  std::vector<char> out(WALSegmentCache::PAGE_SIZE);
+  wal_segment_cache_stats stats;
+  pid_t pid;
+  int status = 0;
+
+  BOOST_CHECK_THROW( WALSegmentCache(WALSegmentCache::PAGE_SIZE), CArchiveIssue );
+
+  /* A single set, so every page competes for the same slots */
+  WALSegmentCache cache(WALSegmentCache::PAGE_SIZE * WALSegmentCache::WAYS);
+
+  BOOST_TEST( cache.getPages() == WALSegmentCache::WAYS );
+  BOOST_TEST( !cache.read(1, 1, 42, 0, out.data()) );
+
+  for (unsigned int i = 0; i < WALSegmentCache::WAYS; i++) {
+    std::fill(page.begin(), page.end(), (char) i);
+    cache.insert(1, 1, 42, i, page.data());
+  }
+
+  BOOST_TEST( cache.read(1, 1, 42, 3, out.data()) );
+  BOOST_TEST( out[0] == 3 );
+  BOOST_TEST( out[WALSegmentCache::PAGE_SIZE - 1] == 3 );
+
+  /* Other timelines and archives don't hit */
+  BOOST_TEST( !cache.read(1, 2, 42, 3, out.data()) );
+  BOOST_TEST( !cache.read(2, 1, 42, 3, out.data()) );
+
+  /* Page 0 is the least recently used now and gets evicted */
+  for (unsigned int i = 1; i < WALSegmentCache::WAYS; i++)
+    BOOST_TEST( cache.read(1, 1, 42, i, out.data()) );
+
+  std::fill(page.begin(), page.end(), 'x');
+  cache.insert(1, 1, 43, 0, page.data());
+
+  BOOST_TEST( !cache.read(1, 1, 42, 0, out.data()) );
+  BOOST_TEST( cache.read(1, 1, 43, 0, out.data()) );
+  BOOST_TEST( out[0] == 'x' );
+
+  /* Pages inserted by a forked process are visible to its parent */
+  pid = fork();
+  BOOST_REQUIRE( pid >= 0 );
+
+  if (pid == 0) {
+    std::fill(page.begin(), page.end(), 'c');
+    cache.insert(1, 1, 44, 0, page.data());
+    _exit(0);
+  }
+
+  BOOST_REQUIRE( waitpid(pid, &status, 0) == pid );
+  BOOST_TEST( cache.read(1, 1, 44, 0, out.data()) );
+  BOOST_TEST( out[0] == 'c' );
+
+  stats = cache.stats();
+  BOOST_TEST( stats.evictions == 2 );
+  BOOST_TEST( stats.misses == 4 );
+
+}
+
+BOOST_AUTO_TEST_CASE(TestWALRestore)
+{
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  path pgwal = archiveDir->getArchiveDir() / "pg_wal";
+  path spool = WALRestore::defaultSpoolDirectory(pgwal / "RECOVERYXLOG");
+  std::vector<char> data(TEST_WAL_SEGMENT_SIZE);
+  std::vector<char> readback(TEST_WAL_SEGMENT_SIZE);
+
+  boost::filesystem::create_directories(pgwal);
+
+  /* Segments 1 to 3 of timeline 1, 4 is missing */
+  for (unsigned int seg = 1; seg <= 3; seg++) {
+
+    std::ofstream out((logDir->getPath() / ("00000001000000000000000" + std::to_string(seg))).string(),
+                      std::ios::binary);
+
+    std::fill(data.begin(), data.end(), (char) seg);
+    out.write(data.data(), data.size());
+
+  }
+
+  std::ofstream((logDir->getPath() / "00000002000000000000000A").string()) << "x";
+
+  WALRestore restore(logDir, spool);
+
+  BOOST_CHECK_THROW( restore.restore("../000000010000000000000001", pgwal / "RECOVERYXLOG"),
+                     CArchiveIssue );
+  BOOST_TEST( !restore.restore("000000010000000000000009", pgwal / "RECOVERYXLOG") );
+
+  BOOST_REQUIRE( restore.restore("000000010000000000000001", pgwal / "RECOVERYXLOG") );
+  BOOST_TEST( file_size(pgwal / "RECOVERYXLOG") == TEST_WAL_SEGMENT_SIZE );
+
+  /* A leftover of another timeline is removed from the spool */
+  boost::filesystem::create_directories(spool);
+  std::ofstream((spool / "00000002000000000000000A").string()) << "x";
+
+  restore.setPrefetch(4);
+  restore.prefetch("000000010000000000000001", TEST_WAL_SEGMENT_SIZE);
+
+  BOOST_TEST( exists(spool / "000000010000000000000002") );
+  BOOST_TEST( exists(spool / "000000010000000000000003") );
+  BOOST_TEST( !exists(spool / "000000010000000000000004") );
+  BOOST_TEST( !exists(spool / "00000002000000000000000A") );
+
+  /* Spooled segments are moved into place */
+  BOOST_REQUIRE( restore.restore("000000010000000000000003", pgwal / "RECOVERYXLOG") );
+  BOOST_TEST( !exists(spool / "000000010000000000000003") );
+
+  std::ifstream in((pgwal / "RECOVERYXLOG").string(), std::ios::binary);
+  in.read(readback.data(), readback.size());
+  BOOST_TEST( in.gcount() == TEST_WAL_SEGMENT_SIZE );
+  BOOST_TEST( readback[0] == 3 );
+  BOOST_TEST( readback[TEST_WAL_SEGMENT_SIZE - 1] == 3 );
+
+  /* Nothing to prefetch after history files */
+  restore.prefetch("00000002.history", TEST_WAL_SEGMENT_SIZE);
+  BOOST_TEST( exists(spool / "000000010000000000000002") );
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+BOOST_AUTO_TEST_CASE(TestWALRangeRestore)
+{
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  path pgdata = archiveDir->getArchiveDir() / "pgdata";
+  path pgwal = WALRangeRestore::walDirectory(pgdata, 160000);
+  std::vector<char> data(TEST_WAL_SEGMENT_SIZE);
+  std::vector<std::string> history = { "00000002.history" };
+
+  BOOST_TEST( WALRangeRestore::walDirectory(pgdata, 90600) == pgdata / "pg_xlog" );
+  BOOST_TEST( pgwal == pgdata / "pg_wal" );
+
+  /*
+   * Segments 1 and 2 of timeline 1, timeline 2 branches off
+   * within segment 3. Segment 4 claims to be segment 5.
+   */
+  for (auto &segment : std::vector<std::tuple<std::string, XLogRecPtr, TimeLineID>> {
+      std::make_tuple("000000010000000000000001", (XLogRecPtr) TEST_WAL_SEGMENT_SIZE, 1),
+      std::make_tuple("000000010000000000000002", (XLogRecPtr) 2 * TEST_WAL_SEGMENT_SIZE, 1),
+      std::make_tuple("000000020000000000000003", (XLogRecPtr) 3 * TEST_WAL_SEGMENT_SIZE, 2),
+      std::make_tuple("000000020000000000000004", (XLogRecPtr) 5 * TEST_WAL_SEGMENT_SIZE, 2) }) {
+
+    test_xlog_pages(data, std::get<1>(segment), std::get<2>(segment));
+    std::ofstream((logDir->getPath() / std::get<0>(segment)).string(),
+                  std::ios::binary).write(data.data(), data.size());
+
+  }
+
+  std::ofstream((logDir->getPath() / "00000002.history").string())
+    << "1\t0/300100\tno recovery target specified\n";
+
+  boost::filesystem::create_directories(pgdata);
+
+  {
+    WALRangeRestore restore(logDir, pgwal, TEST_WAL_SEGMENT_SIZE);
+
+    restore.setParallelism(2);
+    restore.start({ "000000010000000000000001",
+                    "000000010000000000000002",
+                    "000000020000000000000003" }, history);
+
+    BOOST_REQUIRE_NO_THROW( restore.wait() );
+    BOOST_TEST( restore.countRestored() == (unsigned int) 3 );
+    BOOST_TEST( exists(pgwal / "00000002.history") );
+    BOOST_TEST( file_size(pgwal / "000000020000000000000003") == TEST_WAL_SEGMENT_SIZE );
+  }
+
+  /* A gap in the range */
+  boost::filesystem::remove_all(pgwal);
+
+  {
+    WALRangeRestore restore(logDir, pgwal, TEST_WAL_SEGMENT_SIZE);
+
+    restore.start({ "000000010000000000000001",
+                    "000000020000000000000003" }, history);
+    BOOST_CHECK_THROW( restore.wait(), CArchiveIssue );
+  }
+
+  /* A segment holding the wrong XLOG */
+  {
+    WALRangeRestore restore(logDir, pgwal, TEST_WAL_SEGMENT_SIZE);
+
+    restore.start({ "000000020000000000000003",
+                    "000000020000000000000004" }, history);
+    BOOST_CHECK_THROW( restore.wait(), CArchiveIssue );
+    BOOST_TEST( !exists(pgwal / "000000020000000000000004") );
+  }
+
+  /* A segment missing in the archive */
+  {
+    WALRangeRestore restore(logDir, pgwal, TEST_WAL_SEGMENT_SIZE);
+
+    restore.start({ "000000020000000000000005" }, {});
+    BOOST_CHECK_THROW( restore.wait(), CArchiveIssue );
+  }
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+BOOST_AUTO_TEST_CASE(TestObjectUpload)
+{
+  std::shared_ptr<BackupDirectory> archiveDir = test_archive_dir();
+  std::shared_ptr<ArchiveLogDirectory> logDir = archiveDir->logdirectory();
+  path bucketDir = archiveDir->getArchiveDir() / "_storage";
+  std::shared_ptr<ArchiveStorageDescr> storage = std::make_shared<ArchiveStorageDescr>();
+  std::shared_ptr<UploadDescr> upload = std::make_shared<UploadDescr>();
+  std::vector<char> data(TEST_WAL_SEGMENT_SIZE);
+  std::vector<char> readback(TEST_WAL_SEGMENT_SIZE);
+  unsigned int started = 0;
+
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (char) (i % 251);
+
+  std::ofstream((logDir->getPath() / "000000010000000000000001").string(),
+                std::ios::binary).write(data.data(), data.size());
+
+  storage->endpoint = "file://" + bucketDir.string();
+  storage->bucket = "wal";
+  storage->prefix = "cluster1/";
+  storage->parallel = 3;
+
+  /* Small parts, so the segment is uploaded in 4 parts */
+  storage->part_size = TEST_WAL_SEGMENT_SIZE / 4;
+
+  BOOST_TEST( ObjectUploader::objectKey(storage, "/log/000000010000000000000001")
+              == "cluster1/log/000000010000000000000001" );
+
+  upload->kind = UPLOAD_WAL;
+  upload->path = (logDir->getPath() / "000000010000000000000001").string();
+  upload->object_key = ObjectUploader::objectKey(storage, "log/000000010000000000000001");
+
+  ObjectUploader uploader(storage);
+
+  uploader.upload(upload, [&started](std::shared_ptr<UploadDescr> u) {
+      BOOST_TEST( !u->upload_id.empty() );
+      started++;
+    });
+
+  BOOST_TEST( started == 1 );
+  BOOST_TEST( upload->size == TEST_WAL_SEGMENT_SIZE );
+  BOOST_TEST( uploader.bytesUploaded() == TEST_WAL_SEGMENT_SIZE );
+
+  path object = bucketDir / "wal" / "cluster1" / "log" / "000000010000000000000001";
+  BOOST_REQUIRE( exists(object) );
+
+  std::ifstream in(object.string(), std::ios::binary);
+  in.read(readback.data(), readback.size());
+  BOOST_TEST( in.gcount() == TEST_WAL_SEGMENT_SIZE );
+  BOOST_TEST( std::equal(data.begin(), data.end(), readback.begin()) );
+
+  /* No parts left behind, the local file is untouched */
+  BOOST_TEST( boost::filesystem::is_empty(bucketDir / "wal" / ".uploads") );
+  BOOST_TEST( exists(upload->path) );
+
+  /* Keys must not escape the bucket */
+  upload->object_key = "../escaped";
+  BOOST_CHECK_THROW( uploader.upload(upload), CArchiveIssue );
+
+  boost::filesystem::remove_all(archiveDir->getArchiveDir());
+
+}
+
+BOOST_AUTO_TEST_CASE(TestXLOGPositionArithmetic)
+{
+  typedef xlog::WALSegment<TEST_WAL_SEGMENT_SIZE> TestSegment;
+  char buf[xlog::XLOGPOS_BUFSIZE];
+  char fname[xlog::WAL_FILENAME_LEN + 1];
+  XLogRecPtr pos = InvalidXLogRecPtr;
+  TimeLineID tli = 0;
+  XLogSegNo segno = 0;
+
+  static_assert(TestSegment::number(0x3000060) == 0x30,
+                "segment number not computed at compile time");
+  static_assert(TestSegment::prevStartPosition(0x3000000) == 0x2F00000,
+                "previous segment start not computed at compile time");
+
+  /* Same format as the former std::hex encoding */
+  BOOST_TEST( xlog::encodeXLogPos(buf, 0x1A000000F0ULL) == 10 );
+  BOOST_TEST( std::string(buf) == "1a/f0" );
+  BOOST_TEST( PGStream::encodeXLOGPos(0) == "0/0" );
+
+  BOOST_TEST( PGStream::decodeXLOGPos("1A/F0") == 0x1A000000F0ULL );
+  BOOST_TEST( PGStream::decodeXLOGPos("ffffffff/ffffffff") == 0xFFFFFFFFFFFFFFFFULL );
+  BOOST_CHECK_THROW( PGStream::decodeXLOGPos(""), StreamingFailure );
+  BOOST_CHECK_THROW( PGStream::decodeXLOGPos("1A"), StreamingFailure );
+  BOOST_CHECK_THROW( PGStream::decodeXLOGPos("1A/"), StreamingFailure );
+  BOOST_CHECK_THROW( PGStream::decodeXLOGPos("1A/F0x"), StreamingFailure );
+  BOOST_CHECK_THROW( PGStream::decodeXLOGPos("123456789/0"), StreamingFailure );
+
+  BOOST_REQUIRE( xlog::decodeXLogPos("0/3000060", 9, pos) );
+  BOOST_TEST( pos == 0x3000060ULL );
+
+  /* 4096 segments per XLOG id with 1MB segments */
+  TestSegment::filename(fname, 2, 4096 + 0xFE);
+  BOOST_TEST( std::string(fname) == "0000000200000001000000FE" );
+  BOOST_TEST( ArchiveLogDirectory::XLogFileByRecPtr(0x1000000ULL, 1, TEST_WAL_SEGMENT_SIZE)
+              == "000000010000000000000010" );
+  BOOST_TEST( ArchiveLogDirectory::XLogPrevFileByRecPtr(0x1000000ULL, 1, TEST_WAL_SEGMENT_SIZE)
+              == "00000001000000000000000F" );
+
+  BOOST_REQUIRE( TestSegment::parse("0000000200000001000000FE.partial", 32, tli, segno) );
+  BOOST_TEST( tli == 2U );
+  BOOST_TEST( segno == 4096U + 0xFE );
+  BOOST_TEST( !TestSegment::parse("00000002.history", 16, tli, segno) );
+  BOOST_TEST( !TestSegment::parse("0000000200000001000000XY", 24, tli, segno) );
+}